@@ -0,0 +1,28 @@
+/**
+ * @file include/alcor2/alcor_blkcache.h
+ * @brief Userspace API: ATA block cache counters.
+ *
+ * Filled by @ref SYS_ALCOR_BLKCACHE. Counters are cumulative since boot;
+ * @c entries, @c dirty and @c capacity are current values, in 4 KB blocks.
+ * @c writebacks / @c write_cmds is the average write-back run length.
+ */
+
+#ifndef ALCOR2_ALCOR_BLKCACHE_H
+#define ALCOR2_ALCOR_BLKCACHE_H
+
+#include <alcor2/types.h>
+
+/** @brief Block cache statistics (fixed layout for syscall ABI). */
+typedef struct PACKED
+{
+  u64 hits;       /**< Reads served from the cache. */
+  u64 misses;     /**< Reads that went to the disk. */
+  u64 evictions;  /**< Valid blocks dropped to make room. */
+  u64 writebacks; /**< Dirty blocks written to the disk. */
+  u64 write_cmds; /**< Disk write commands issued for them. */
+  u64 entries;    /**< Blocks currently cached. */
+  u64 dirty;      /**< Cached blocks not yet on the disk. */
+  u64 capacity;   /**< Total cache slots. */
+} alcor_blkcache_stats_t;
+
+#endif
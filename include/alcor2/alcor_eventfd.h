@@ -0,0 +1,17 @@
+/**
+ * @file include/alcor2/alcor_eventfd.h
+ * @brief Userspace API: eventfd counters signalled by the keyboard.
+ *
+ * @ref SYS_EVENTFD2 accepts the Linux flags plus ::ALCOR_EFD_KEYBOARD. The
+ * counter of such an eventfd is incremented by one on every keyboard
+ * interrupt, so a program can block in epoll on keyboard input together
+ * with pipes and other descriptors, then read stdin until it runs dry.
+ */
+
+#ifndef ALCOR2_ALCOR_EVENTFD_H
+#define ALCOR2_ALCOR_EVENTFD_H
+
+/** @brief eventfd2 flag: count keyboard interrupts (Alcor2 extension). */
+#define ALCOR_EFD_KEYBOARD 0x10000000U
+
+#endif
@@ -5,6 +5,10 @@
  * Syscalls @ref SYS_ALCOR_FB_INFO and @ref SYS_ALCOR_FB_MMAP expose the same
  * memory the kernel console uses; drawing from userland is allowed and shares
  * the scanout buffer (coordinate with kernel writes).
+ *
+ * For tear-free frames, @ref SYS_ALCOR_FB_BACKBUF maps a private buffer of
+ * the same layout and @ref SYS_ALCOR_FB_PRESENT copies changed rectangles of
+ * it to the screen.
  */
 
 #ifndef ALCOR2_ALCOR_FB_H
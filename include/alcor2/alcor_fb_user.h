@@ -22,6 +22,12 @@
 #ifndef SYS_ALCOR_FB_MMAP
   #define SYS_ALCOR_FB_MMAP 499
 #endif
+#ifndef SYS_ALCOR_FB_BACKBUF
+  #define SYS_ALCOR_FB_BACKBUF 501
+#endif
+#ifndef SYS_ALCOR_FB_PRESENT
+  #define SYS_ALCOR_FB_PRESENT 502
+#endif
 /** @} */
 
 static inline long alcor_fb_info(alcor_fb_info_t *info)
@@ -44,4 +50,29 @@ static inline void *alcor_fb_mmap(void)
   return alcor_fb_mmap_hint(0, 0);
 }
 
+/**
+ * @brief Map an offscreen buffer laid out like the framebuffer (same pitch,
+ *        @c byte_len bytes) to draw frames into without tearing.
+ * @return User pointer to its first pixel, or @c (void *)-1 on error.
+ */
+static inline void *alcor_fb_backbuf(void)
+{
+  long r = syscall(SYS_ALCOR_FB_BACKBUF);
+  if(r < 0)
+    return (void *)-1;
+  return (void *)r;
+}
+
+/**
+ * @brief Copy rectangle (@p x, @p y, @p w, @p h) of @p backbuf to the screen;
+ *        @p w or @p h of 0 presents the whole buffer.
+ * @return 0, or a negative value on error.
+ */
+static inline long alcor_fb_present(
+    void *backbuf, unsigned x, unsigned y, unsigned w, unsigned h
+)
+{
+  return syscall(SYS_ALCOR_FB_PRESENT, backbuf, x, y, w, h);
+}
+
 #endif
@@ -0,0 +1,59 @@
+/**
+ * @file include/alcor2/alcor_kprof.h
+ * @brief Userspace API: sampling profile of the kernel.
+ *
+ * Driven by @ref SYS_ALCOR_KPROF. While profiling is on, every timer
+ * interrupt records where the CPU was: the interrupted RIP, the current
+ * pid and, in kernel mode, the return addresses found by walking the
+ * frame-pointer chain. Samples queue in a ring until read; a full ring
+ * drops new samples (counted) rather than overwrite unread ones, so read
+ * it often enough. Addresses are run-time ones: subtract
+ * <tt>kmain - (kmain's address in the kernel ELF)</tt> to symbolize.
+ */
+
+#ifndef ALCOR2_ALCOR_KPROF_H
+#define ALCOR2_ALCOR_KPROF_H
+
+#include <alcor2/types.h>
+
+/** @name SYS_ALCOR_KPROF operations (first argument)
+ * @{ */
+#define ALCOR_KPROF_OFF   0 /**< Stop sampling. */
+#define ALCOR_KPROF_ON    1 /**< Sample at arg Hz (0 = default). */
+#define ALCOR_KPROF_RESET 2 /**< Drop queued samples, zero the counters. */
+#define ALCOR_KPROF_READ  3 /**< Move queued samples to buf. */
+#define ALCOR_KPROF_INFO  4 /**< Fill an ::alcor_kprof_info_t. */
+/** @} */
+
+/** @brief Addresses per sample: the RIP and up to 7 callers. */
+#define ALCOR_KPROF_DEPTH 8
+
+/** @brief Sampling rate when ::ALCOR_KPROF_ON is given 0. */
+#define ALCOR_KPROF_DEFAULT_HZ 1000
+
+/** @brief Fastest sampling rate accepted. */
+#define ALCOR_KPROF_MAX_HZ 10000
+
+/** @brief @c flags bit: the CPU was in user mode (@c pc[0] only). */
+#define ALCOR_KPROF_USER 1
+
+/** @brief One sample (fixed layout for syscall ABI). */
+typedef struct PACKED
+{
+  u64 pid;   /**< Current process, 0 if none. */
+  u32 flags; /**< ::ALCOR_KPROF_USER. */
+  u32 depth; /**< Valid entries of @c pc. */
+  u64 pc[ALCOR_KPROF_DEPTH]; /**< RIP, then return addresses. */
+} alcor_kprof_sample_t;
+
+/** @brief Profiler state (fixed layout for syscall ABI). */
+typedef struct PACKED
+{
+  u64 kmain;   /**< Run-time address of kmain, for the load offset. */
+  u64 hz;      /**< Sampling rate, 0 while off. */
+  u64 samples; /**< Recorded since the last reset. */
+  u64 dropped; /**< Lost to a full ring since the last reset. */
+  u64 queued;  /**< Waiting to be read. */
+} alcor_kprof_info_t;
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * @file include/alcor2/alcor_memstat.h
+ * @brief Userspace API: physical memory and reclaimable cache usage.
+ *
+ * Filled by @ref SYS_ALCOR_MEMSTAT. Sizes are in bytes and current, except
+ * @c reclaimed, which is cumulative since boot. Free memory below
+ * @c wmark_low makes the caches shrink until it is back at @c wmark_high.
+ */
+
+#ifndef ALCOR2_ALCOR_MEMSTAT_H
+#define ALCOR2_ALCOR_MEMSTAT_H
+
+#include <alcor2/types.h>
+
+/** @brief Caches reported at most. */
+#define ALCOR_MEMSTAT_CACHES 8
+#define ALCOR_MEMSTAT_NAME   16
+
+/** @brief One reclaimable cache. */
+typedef struct PACKED
+{
+  char name[ALCOR_MEMSTAT_NAME]; /**< NUL-terminated. */
+  u64  bytes;                    /**< Memory the cache holds. */
+} alcor_memstat_cache_t;
+
+/** @brief Memory statistics (fixed layout for syscall ABI). */
+typedef struct PACKED
+{
+  u64                   total;      /**< Usable RAM. */
+  u64                   free;       /**< Free RAM. */
+  u64                   wmark_low;  /**< Reclaim starts below this. */
+  u64                   wmark_high; /**< Reclaim stops at this. */
+  u64                   reclaimed;  /**< Given back by the caches. */
+  u64                   ncaches;    /**< Valid entries of @c cache. */
+  alcor_memstat_cache_t cache[ALCOR_MEMSTAT_CACHES];
+} alcor_memstat_t;
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @file include/alcor2/alcor_perf.h
+ * @brief Userspace API: hardware performance counters (perf_event_open).
+ *
+ * @ref SYS_PERF_EVENT_OPEN takes the Linux arguments and the first 64
+ * bytes of the Linux attribute layout, and returns an fd whose read()
+ * gives the 8-byte count. The counters follow the monitored process
+ * across context switches; with pid -1 and cpu 0 one counts whatever
+ * the CPU runs. Only counting is supported: no sampling, no groups, no
+ * multiplexing (an event that finds no free counter fails with
+ * @c -EBUSY), and read_format must be 0. A CPU without an architectural
+ * PMU (AMD, or QEMU without KVM) has no events (@c -ENOENT).
+ */
+
+#ifndef ALCOR2_ALCOR_PERF_H
+#define ALCOR2_ALCOR_PERF_H
+
+#include <alcor2/types.h>
+
+/** @name Event types (@c type)
+ * @{ */
+#define ALCOR_PERF_TYPE_HARDWARE 0 /**< Generic event, ALCOR_PERF_HW_*. */
+#define ALCOR_PERF_TYPE_HW_CACHE 3 /**< Cache event, ALCOR_PERF_CACHE(). */
+#define ALCOR_PERF_TYPE_RAW      4 /**< IA32_PERFEVTSELx event and umask. */
+/** @} */
+
+/** @name ALCOR_PERF_TYPE_HARDWARE configs
+ * @{ */
+#define ALCOR_PERF_HW_CPU_CYCLES          0
+#define ALCOR_PERF_HW_INSTRUCTIONS        1
+#define ALCOR_PERF_HW_CACHE_REFERENCES    2 /**< Last-level cache. */
+#define ALCOR_PERF_HW_CACHE_MISSES        3 /**< Last-level cache. */
+#define ALCOR_PERF_HW_BRANCH_INSTRUCTIONS 4
+#define ALCOR_PERF_HW_BRANCH_MISSES       5
+#define ALCOR_PERF_HW_REF_CPU_CYCLES      9
+/** @} */
+
+/** @name ALCOR_PERF_TYPE_HW_CACHE configs
+ * Only (LL, READ, ACCESS or MISS) and (DTLB, READ or WRITE, MISS) exist;
+ * the dTLB ones are Intel model-specific events.
+ * @{ */
+#define ALCOR_PERF_CACHE_LL         2
+#define ALCOR_PERF_CACHE_DTLB       3
+#define ALCOR_PERF_CACHE_OP_READ    0
+#define ALCOR_PERF_CACHE_OP_WRITE   1
+#define ALCOR_PERF_CACHE_RES_ACCESS 0
+#define ALCOR_PERF_CACHE_RES_MISS   1
+#define ALCOR_PERF_CACHE(id, op, res) ((id) | ((op) << 8) | ((res) << 16))
+/** @} */
+
+/** @name @c flags bits
+ * @{ */
+#define ALCOR_PERF_DISABLED       (1ULL << 0) /**< Open stopped. */
+#define ALCOR_PERF_EXCLUDE_USER   (1ULL << 4) /**< Don't count ring 3. */
+#define ALCOR_PERF_EXCLUDE_KERNEL (1ULL << 5) /**< Don't count ring 0. */
+#define ALCOR_PERF_EXCLUDE_HV     (1ULL << 6) /**< Accepted, no effect. */
+#define ALCOR_PERF_EXCLUDE_IDLE   (1ULL << 7) /**< Accepted, no effect. */
+/** @} */
+
+/** @brief perf_event_open flag: set close-on-exec on the new fd. */
+#define ALCOR_PERF_FLAG_FD_CLOEXEC 8
+
+/** @name ioctl requests on a perf fd (argument ignored)
+ * @{ */
+#define ALCOR_PERF_IOC_ENABLE  0x2400 /**< Start counting. */
+#define ALCOR_PERF_IOC_DISABLE 0x2401 /**< Stop, keeping the count. */
+#define ALCOR_PERF_IOC_RESET   0x2403 /**< Zero the count. */
+/** @} */
+
+/** @brief Size of ::alcor_perf_attr_t (Linux PERF_ATTR_SIZE_VER0). */
+#define ALCOR_PERF_ATTR_SIZE 64
+
+/** @brief Event attributes (layout of Linux's struct perf_event_attr). */
+typedef struct PACKED
+{
+  u32 type;          /**< ::ALCOR_PERF_TYPE_HARDWARE, ... */
+  u32 size;          /**< ::ALCOR_PERF_ATTR_SIZE, or 0 for the same. */
+  u64 config;        /**< Event within @c type. */
+  u64 sample_period; /**< Must be 0: no sampling. */
+  u64 sample_type;   /**< Ignored. */
+  u64 read_format;   /**< Must be 0: read() gives the bare count. */
+  u64 flags;         /**< ::ALCOR_PERF_DISABLED, ... */
+  u32 wakeup_events; /**< Ignored. */
+  u32 bp_type;       /**< Ignored. */
+  u64 config1;       /**< Ignored. */
+} alcor_perf_attr_t;
+
+#endif
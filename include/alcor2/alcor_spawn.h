@@ -0,0 +1,50 @@
+/**
+ * @file include/alcor2/alcor_spawn.h
+ * @brief Userspace API: start programs from pre-loaded templates.
+ *
+ * Driven by @ref SYS_ALCOR_SPAWN. Warming a program loads it once, as exec
+ * would, into a template that never runs, with its code pages already
+ * mapped. Running it then starts a child of the caller on a copy-on-write
+ * copy of the template, with fresh arguments and the caller's fds after a
+ * list of dup2 / close actions: what fork plus exec would give, without
+ * copying the caller or loading the program again. A template is dropped
+ * when its file changes; running a program that has none fails with
+ * @c -ENOENT, so the caller falls back to posix_spawn.
+ */
+
+#ifndef ALCOR2_ALCOR_SPAWN_H
+#define ALCOR2_ALCOR_SPAWN_H
+
+#include <alcor2/types.h>
+
+/** @name SYS_ALCOR_SPAWN operations (first argument)
+ * @{ */
+#define ALCOR_SPAWN_WARM 0 /**< Load a template of the program at path. */
+#define ALCOR_SPAWN_RUN  1 /**< Start it, as an ::alcor_spawn_req_t says. */
+#define ALCOR_SPAWN_DROP 2 /**< Free its template (every one for NULL). */
+/** @} */
+
+/** @brief Templates kept at once; warming another evicts the oldest used. */
+#define ALCOR_SPAWN_TEMPLATES 8
+
+/** @brief Most fd actions one run takes. */
+#define ALCOR_SPAWN_MAX_FDS 32
+
+/** @brief One fd action: dup2(fd, target), or close(fd) if target < 0. */
+typedef struct PACKED
+{
+  i32 fd;
+  i32 target;
+} alcor_spawn_fd_t;
+
+/** @brief What to run a template with (fixed layout for syscall ABI). */
+typedef struct PACKED
+{
+  u64 argv;  /**< NULL-terminated argument vector (NULL: just the path). */
+  u64 envp;  /**< NULL-terminated environment, or NULL for none. */
+  u64 fds;   /**< Array of @c nfds ::alcor_spawn_fd_t, run in order. */
+  u32 nfds;  /**< At most ::ALCOR_SPAWN_MAX_FDS. */
+  u32 flags; /**< Must be 0. */
+} alcor_spawn_req_t;
+
+#endif
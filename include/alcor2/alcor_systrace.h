@@ -0,0 +1,39 @@
+/**
+ * @file include/alcor2/alcor_systrace.h
+ * @brief Userspace API: per-syscall counts and latency histograms.
+ *
+ * Driven by @ref SYS_ALCOR_SYSTRACE. While tracing is on, every syscall
+ * is timed in TSC cycles from handler entry to return, so a call that
+ * blocks includes its sleep. Statistics are kept globally and for each
+ * process; a process's statistics are dropped when it exits.
+ */
+
+#ifndef ALCOR2_ALCOR_SYSTRACE_H
+#define ALCOR2_ALCOR_SYSTRACE_H
+
+#include <alcor2/types.h>
+
+/** @name SYS_ALCOR_SYSTRACE operations (first argument)
+ * @{ */
+#define ALCOR_SYSTRACE_OFF   0 /**< Stop recording. */
+#define ALCOR_SYSTRACE_ON    1 /**< Start recording. */
+#define ALCOR_SYSTRACE_RESET 2 /**< Zero the stats of pid (0 = all). */
+#define ALCOR_SYSTRACE_READ  3 /**< Copy the stats of pid (0 = global). */
+/** @} */
+
+/** @brief Histogram buckets; bucket @c i counts calls of 2^i..2^(i+1)-1
+ * cycles, and the last bucket everything longer. */
+#define ALCOR_SYSTRACE_BUCKETS 32
+
+/** @brief Statistics of one syscall (fixed layout for syscall ABI). */
+typedef struct PACKED
+{
+  u64 nr;     /**< Syscall number. */
+  u64 count;  /**< Calls recorded. */
+  u64 cycles; /**< Total TSC cycles. */
+  u64 min;    /**< Fastest call. */
+  u64 max;    /**< Slowest call. */
+  u32 hist[ALCOR_SYSTRACE_BUCKETS]; /**< log2 latency histogram. */
+} alcor_systrace_entry_t;
+
+#endif
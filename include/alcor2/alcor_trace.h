@@ -0,0 +1,82 @@
+/**
+ * @file include/alcor2/alcor_trace.h
+ * @brief Userspace API: kernel event tracing.
+ *
+ * Driven by @ref SYS_ALCOR_TRACE. While tracing is on, tracepoints in the
+ * scheduler, the page-fault handler, the block layer, ext2, pipes and the
+ * syscall dispatcher append an ::alcor_trace_event_t stamped with the TSC
+ * to a ring. The ring overwrites its oldest events when full: a reader
+ * that falls behind loses the events in between (counted in
+ * alcor_trace_info_t::lost) but never stalls the kernel, so read often.
+ */
+
+#ifndef ALCOR2_ALCOR_TRACE_H
+#define ALCOR2_ALCOR_TRACE_H
+
+#include <alcor2/types.h>
+
+/** @name SYS_ALCOR_TRACE operations (first argument)
+ * @{ */
+#define ALCOR_TRACE_OFF  0 /**< Stop tracing. */
+#define ALCOR_TRACE_ON   1 /**< Trace the categories in arg (0 = all). */
+#define ALCOR_TRACE_READ 2 /**< Move queued events to buf. */
+#define ALCOR_TRACE_INFO 3 /**< Fill an ::alcor_trace_info_t. */
+/** @} */
+
+/** @name Categories (bits of the ::ALCOR_TRACE_ON mask)
+ * @{ */
+#define ALCOR_TRACE_CAT_SYSCALL (1U << 0)
+#define ALCOR_TRACE_CAT_SCHED   (1U << 1)
+#define ALCOR_TRACE_CAT_FAULT   (1U << 2)
+#define ALCOR_TRACE_CAT_BLOCK   (1U << 3)
+#define ALCOR_TRACE_CAT_FS      (1U << 4)
+#define ALCOR_TRACE_CAT_PIPE    (1U << 5)
+#define ALCOR_TRACE_CAT_ALL     0x3FU
+/** @} */
+
+/** @name Events (alcor_trace_event_t::event) and their arguments
+ * @{ */
+#define ALCOR_TRACE_SYSCALL_ENTER  1  /**< Number, first argument. */
+#define ALCOR_TRACE_SYSCALL_EXIT   2  /**< Number, return value. */
+#define ALCOR_TRACE_SWITCH         3  /**< Previous pid, next pid. */
+#define ALCOR_TRACE_FAULT_BEGIN    4  /**< Address, error code. */
+#define ALCOR_TRACE_FAULT_END      5  /**< Address, 1 if it was handled. */
+#define ALCOR_TRACE_BIO_SUBMIT     6  /**< Id, LBA, ::ALCOR_TRACE_BIO. */
+#define ALCOR_TRACE_BIO_DONE       7  /**< Id, status. */
+#define ALCOR_TRACE_ATA_READ       8  /**< Drive, LBA, sectors. */
+#define ALCOR_TRACE_ATA_READ_END   9  /**< Result. */
+#define ALCOR_TRACE_EXT2_READ      10 /**< Inode, offset, bytes. */
+#define ALCOR_TRACE_EXT2_READ_END  11 /**< Result. */
+#define ALCOR_TRACE_PIPE_READ      12 /**< Bytes asked for. */
+#define ALCOR_TRACE_PIPE_READ_END  13 /**< Result. */
+#define ALCOR_TRACE_PIPE_WRITE     14 /**< Bytes offered. */
+#define ALCOR_TRACE_PIPE_WRITE_END 15 /**< Result. */
+#define ALCOR_TRACE_EVENTS         16
+/** @} */
+
+/** @brief Third argument of ::ALCOR_TRACE_BIO_SUBMIT: sectors, operation
+ *         (0 read, 1 write, 2 flush) and drive. */
+#define ALCOR_TRACE_BIO(count, op, drive)                                      \
+  ((u64)(count) | (u64)(op) << 32 | (u64)(drive) << 40)
+
+/** @brief One event (fixed layout for syscall ABI). */
+typedef struct PACKED
+{
+  u64 tsc;    /**< Time stamp counter when it happened. */
+  u16 event;  /**< ::ALCOR_TRACE_SYSCALL_ENTER, ... */
+  u16 cpu;    /**< CPU it happened on. */
+  u32 pid;    /**< Current process, 0 if none. */
+  u64 arg[3]; /**< Event arguments; unused ones are 0. */
+} alcor_trace_event_t;
+
+/** @brief Tracer state (fixed layout for syscall ABI). */
+typedef struct PACKED
+{
+  u64 tsc_hz;  /**< TSC ticks per second, 0 if unknown. */
+  u64 mask;    /**< Categories traced, 0 while off. */
+  u64 written; /**< Events recorded since tracing was turned on. */
+  u64 lost;    /**< Overwritten before they were read. */
+  u64 queued;  /**< Waiting to be read. */
+} alcor_trace_info_t;
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file include/alcor2/alcor_uring.h
+ * @brief Userspace API: submission/completion rings for batched syscalls.
+ *
+ * A program lays out one ::alcor_uring_t header, @c entries submission
+ * entries and twice as many completion entries back to back in its own
+ * memory, registers the block with @ref SYS_ALCOR_URING_SETUP and gets a
+ * ring fd. It then queues operations by filling SQEs and moving
+ * @c sq_tail, and hands them all to the kernel with one
+ * @ref SYS_ALCOR_URING_ENTER. Results come back as CQEs, tagged with the
+ * SQE's @c user_data, that the program consumes by moving @c cq_head.
+ *
+ * Before it runs a batch the kernel starts the disk reads of every READ
+ * in it at once, so their transfers overlap instead of queueing one behind
+ * the other. POLL and TIMEOUT entries that are not done at once stay
+ * pending in the kernel and complete on a later enter; the enter call
+ * sleeps until enough completions are posted or none can arrive.
+ *
+ * Each index is a free-running counter; slot i is at @c i & (entries-1).
+ * The kernel writes @c sq_head and @c cq_tail, the program the other two.
+ */
+
+#ifndef ALCOR2_ALCOR_URING_H
+#define ALCOR2_ALCOR_URING_H
+
+#include <alcor2/types.h>
+
+/** @brief Largest @c entries accepted (a power of two). */
+#define ALCOR_URING_MAX_ENTRIES 4096
+
+/** @brief POLL and TIMEOUT entries a ring keeps pending at most. */
+#define ALCOR_URING_MAX_PENDING 64
+
+/** @brief READ/WRITE @c off meaning "at the fd's position, moving it". */
+#define ALCOR_URING_OFF_CUR (~0ULL)
+
+/** @name SQE opcodes
+ * @{ */
+#define ALCOR_URING_OP_NOP     0 /**< res 0. */
+#define ALCOR_URING_OP_READ    1 /**< read/pread64(fd, addr, len, off). */
+#define ALCOR_URING_OP_WRITE   2 /**< write/pwrite64(fd, addr, len, off). */
+#define ALCOR_URING_OP_OPENAT  3 /**< openat(fd, addr, op_flags, len). */
+#define ALCOR_URING_OP_CLOSE   4 /**< close(fd). */
+#define ALCOR_URING_OP_STAT    5 /**< newfstatat(fd, addr, addr2, op_flags). */
+#define ALCOR_URING_OP_FSYNC   6 /**< fsync(fd). */
+#define ALCOR_URING_OP_POLL    7 /**< Wait for poll events op_flags on fd. */
+#define ALCOR_URING_OP_TIMEOUT 8 /**< -ETIME once off ns have passed. */
+/** @} */
+
+/** @brief Ring header, at the start of the registered block. */
+typedef struct PACKED
+{
+  u32 sq_head; /**< Next SQE the kernel takes (kernel-written). */
+  u32 sq_tail; /**< One past the last SQE queued (program-written). */
+  u32 cq_head; /**< Next CQE to consume (program-written). */
+  u32 cq_tail; /**< One past the last CQE posted (kernel-written). */
+  u32 entries; /**< SQ size; the CQ holds twice as many. */
+  u32 dropped; /**< SQEs rejected as malformed (kernel-written). */
+  u64 reserved;
+} alcor_uring_t;
+
+/** @brief Submission queue entry. */
+typedef struct PACKED
+{
+  u8  opcode;    /**< ALCOR_URING_OP_*. */
+  u8  flags;     /**< Must be 0. */
+  u16 pad;
+  i32 fd;        /**< Target fd, or dirfd for OPENAT and STAT. */
+  u64 off;       /**< File offset, or ns for TIMEOUT. */
+  u64 addr;      /**< Buffer or path. */
+  u32 len;       /**< Bytes, or mode for OPENAT. */
+  u32 op_flags;  /**< Open, stat or poll flags. */
+  u64 user_data; /**< Copied to the CQE. */
+  u64 addr2;     /**< struct stat for STAT. */
+  u64 reserved[2];
+} alcor_uring_sqe_t;
+
+/** @brief Completion queue entry. */
+typedef struct PACKED
+{
+  u64 user_data; /**< From the SQE. */
+  i64 res;       /**< The syscall's result: a count, fd, mask or -errno. */
+} alcor_uring_cqe_t;
+
+/** @brief Bytes the registered block needs for @p entries. */
+#define ALCOR_URING_SIZE(entries)                                              \
+  (sizeof(alcor_uring_t) + (u64)(entries) * sizeof(alcor_uring_sqe_t) +        \
+   2 * (u64)(entries) * sizeof(alcor_uring_cqe_t))
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * @file include/alcor2/arch/acpi.h
+ * @brief ACPI table lookup.
+ *
+ * Only the static tables are read: the RSDP the bootloader found leads to
+ * the XSDT (or the RSDT on ACPI 1.0 firmware), whose entries are searched
+ * by signature. There is no AML interpreter. Tables are mapped uncached
+ * through the MMIO window when first looked up and stay mapped.
+ */
+
+#ifndef ALCOR2_ACPI_H
+#define ALCOR2_ACPI_H
+
+#include <alcor2/limine.h>
+#include <alcor2/types.h>
+
+/** @brief Header every ACPI system description table starts with. */
+typedef struct PACKED
+{
+  char sig[4];
+  u32  length; /**< Whole table, header included. */
+  u8   revision;
+  u8   checksum;
+  char oem_id[6];
+  char oem_table_id[8];
+  u32  oem_revision;
+  u32  creator_id;
+  u32  creator_revision;
+} acpi_header_t;
+
+/**
+ * @brief Locate the root table through the bootloader's RSDP.
+ * @param rsdp Bootloader RSDP response, or NULL if there was none.
+ */
+void acpi_init(const struct limine_rsdp_response *rsdp);
+
+/**
+ * @brief Find a table by signature.
+ * @param sig Four-character signature, e.g. "MCFG".
+ * @return The mapped table, checksum verified, or NULL if there is none.
+ */
+const acpi_header_t *acpi_find_table(const char *sig);
+
+#endif
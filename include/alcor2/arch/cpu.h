@@ -11,6 +11,9 @@
 
 #include <alcor2/types.h>
 
+/** @brief RFLAGS interrupt-enable bit. */
+#define CPU_RFLAGS_IF 0x200
+
 /**
  * @brief Halt the CPU indefinitely.
  *
@@ -38,6 +41,11 @@ void cpu_enable_interrupts(void);
  */
 void cpu_enable_sse(void);
 
+/**
+ * @brief Enable them on an AP, as ::cpu_enable_sse did on the BSP.
+ */
+void cpu_enable_sse_cpu(void);
+
 /**
  * @brief Set the FS base MSR for thread-local storage.
  * @param addr Linear address for FS segment base.
@@ -50,4 +58,39 @@ void cpu_set_fs_base(u64 addr);
  */
 u64 cpu_get_fs_base(void);
 
+/**
+ * @brief Execute CPUID.
+ * @param leaf Leaf (EAX).
+ * @param sub  Subleaf (ECX).
+ * @param r    Receives EAX, EBX, ECX, EDX.
+ */
+static inline void cpu_cpuid(u32 leaf, u32 sub, u32 r[4])
+{
+  __asm__ volatile("cpuid"
+                   : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3])
+                   : "a"(leaf), "c"(sub));
+}
+
+/**
+ * @brief Read RFLAGS.
+ * @return The flags; ::CPU_RFLAGS_IF tells whether interrupts are on.
+ */
+static inline u64 cpu_read_flags(void)
+{
+  u64 flags;
+  __asm__ volatile("pushfq; popq %0" : "=r"(flags)::"memory");
+  return flags;
+}
+
+/**
+ * @brief Read the time-stamp counter.
+ * @return TSC value in cycles.
+ */
+static inline u64 cpu_rdtsc(void)
+{
+  u32 lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((u64)hi << 32) | lo;
+}
+
 #endif
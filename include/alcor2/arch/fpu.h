@@ -0,0 +1,57 @@
+/**
+ * @file include/alcor2/arch/fpu.h
+ * @brief Per-process x87/SSE/AVX state, switched lazily.
+ *
+ * The FPU registers belong to whichever process used them last. Switching
+ * to another process only sets CR0.TS; the state is swapped in the #NM
+ * trap raised by its first FPU instruction, so processes that never touch
+ * the FPU cost nothing. Each CPU's registers have their own owner.
+ */
+
+#ifndef ALCOR2_FPU_H
+#define ALCOR2_FPU_H
+
+#include <alcor2/types.h>
+
+struct proc;
+
+/**
+ * @brief Enable every XSAVE component the kernel manages (x87, SSE, AVX,
+ *        AVX-512) and capture the initial state. Needs the heap.
+ */
+void fpu_init(void);
+
+/** @brief Enable the same components on the calling AP. */
+void fpu_init_cpu(void);
+
+/** @brief Arrange for @p next's first FPU instruction to trap if needed. */
+void fpu_switch(struct proc *next);
+
+/** @brief Save the calling CPU's owner's state and leave it with none. */
+void fpu_unload(void);
+
+/**
+ * @brief Whether @p p's state is live on a CPU other than the caller's,
+ *        which then must run it rather than the caller.
+ */
+bool fpu_held_elsewhere(const struct proc *p);
+
+/**
+ * @brief #NM handler: give the registers to the current process.
+ * @return false if there is no process or no memory for its state.
+ */
+bool fpu_trap(void);
+
+/**
+ * @brief Give @p child a copy of @p parent's FPU state.
+ * @return 0, or -ENOMEM.
+ */
+int fpu_fork(struct proc *child, struct proc *parent);
+
+/**
+ * @brief Drop @p p's FPU state (exit, or exec: the new image starts from
+ *        the initial state).
+ */
+void fpu_release(struct proc *p);
+
+#endif
@@ -86,12 +86,54 @@ typedef struct PACKED
 } tss_t;
 
 /**
- * @brief Initialize the GDT and load the TSS.
+ * @brief The GDT itself.
+ *
+ * Table layout is constrained by SYSRET/STAR semantics on AMD64: the MSR
+ * holds a base segment selector such that STAR[63:48]+16 selects 64-bit
+ * user code, STAR[63:48]+8 selects user data/stack, and STAR[63:48]+0 is
+ * the 32-bit compat code slot. User data therefore sits immediately before
+ * user code in the GDT (see @c user_data / @c user_code below).
+ *
+ * @c null plus four zeroed @c reserved entries pad indices so
+ * @c kernel_code lands at selector @c GDT_KERNEL_CODE (0x28) expected
+ * elsewhere in the kernel.
+ */
+typedef struct PACKED
+{
+  gdt_entry_t     null;
+  gdt_entry_t     reserved[4];
+  gdt_entry_t     kernel_code; /**< 0x28 */
+  gdt_entry_t     kernel_data; /**< 0x30 */
+  gdt_entry_t     user_data;   /**< 0x38 - MUST precede user_code for SYSRET */
+  gdt_entry_t     user_code;   /**< 0x40 */
+  gdt_tss_entry_t tss;         /**< 0x48 */
+} gdt_table_t;
+
+/**
+ * @brief One CPU's GDT and TSS.
+ *
+ * LTR marks a TSS descriptor busy, so no two CPUs can load the same one;
+ * each CPU gets its own table and TSS.
+ */
+typedef struct
+{
+  gdt_table_t table;
+  gdt_ptr_t   gdtr;
+  tss_t       tss;
+} gdt_cpu_t;
+
+/**
+ * @brief Initialize the GDT and load the TSS on the bootstrap CPU.
  */
 void gdt_init(void);
 
 /**
- * @brief Update the TSS ring-0 stack pointer.
+ * @brief Build @p cpu's GDT and TSS and load them on the calling CPU.
+ */
+void gdt_init_cpu(gdt_cpu_t *cpu);
+
+/**
+ * @brief Update the calling CPU's TSS ring-0 stack pointer.
  * @param rsp0 New kernel stack pointer.
  */
 void tss_set_rsp0(u64 rsp0);
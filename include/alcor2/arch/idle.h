@@ -0,0 +1,42 @@
+/**
+ * @file include/alcor2/arch/idle.h
+ * @brief CPU idle: MONITOR/MWAIT with C-state selection, or HLT.
+ *
+ * With MONITOR/MWAIT (CPUID.01H:ECX[3] and leaf 5) the idle CPU arms the
+ * monitor on the word a wakeup writes, so a store to it from any CPU ends
+ * the wait without an interrupt. The C-state is chosen from how long the
+ * CPU is expected to stay idle: the deepest one CPUID.05H:EDX enumerates
+ * whose target residency fits. Without MWAIT both fall back to HLT.
+ */
+
+#ifndef ALCOR2_IDLE_H
+#define ALCOR2_IDLE_H
+
+#include <alcor2/types.h>
+
+/** @brief MWAIT C-states tracked (C1 … C7). */
+#define IDLE_CSTATES 7
+
+/** @brief Detect MONITOR/MWAIT and the C-states, and report them. */
+void cpu_idle_init(void);
+
+/**
+ * @brief Sleep until an interrupt, or a store to @p watch.
+ *
+ * Called with interrupts disabled, after the caller has found nothing to
+ * do; returns with them disabled again, after the waking interrupt has
+ * been handled.
+ *
+ * @param watch     Word a wakeup writes (the run queue head).
+ * @param budget_ns Expected idle time (next timer), or 0 if unbounded.
+ */
+void cpu_idle(const volatile void *watch, u64 budget_ns);
+
+/**
+ * @brief Park a CPU with interrupts off, in its deepest C-state.
+ *
+ * For APs without a local APIC, which no IPI could wake. Never returns.
+ */
+NORETURN void cpu_idle_park(void);
+
+#endif
@@ -58,11 +58,55 @@ typedef struct PACKED
   u64 ss;
 } interrupt_frame_t;
 
+/** @brief Handler of a hardware IRQ line claimed at run time. */
+typedef void (*irq_line_fn)(void);
+
+/** @brief Handlers that may share one run-time IRQ line. */
+#define IRQ_LINE_SHARE_MAX 4
+
+/**
+ * @brief Attach a handler to an IRQ line (PCI INTx routed through the PIC).
+ *
+ * For devices whose line is only known after PCI enumeration. PCI lines
+ * can be shared, so every handler on a line runs for each interrupt and
+ * must check its own device. The line is not unmasked here.
+ *
+ * @param irq IRQ line (0-15).
+ * @param fn  Handler, called with interrupts disabled.
+ * @return true on success, false if the line has no free slot.
+ */
+bool irq_register(u8 irq, irq_line_fn fn);
+
+/** @brief First IDT vector handed out to message-signalled interrupts. */
+#define IRQ_MSI_VECTOR_BASE  64
+/** @brief Vectors available to message-signalled interrupts. */
+#define IRQ_MSI_VECTOR_COUNT 32
+
+/**
+ * @brief Claim an IDT vector for an MSI or MSI-X message.
+ *
+ * The messages are delivered to the local APIC, which also takes the
+ * EOI after @p fn returns; the 8259 is not involved. A vector belongs to
+ * one handler, so it needs no check of whose interrupt it was.
+ *
+ * @param fn Handler, called with interrupts disabled.
+ * @return The vector, or 0 if all are taken or there is no local APIC.
+ */
+u8 irq_alloc_vector(irq_line_fn fn);
+
+/** @brief Give back a vector from irq_alloc_vector() no device uses. */
+void irq_free_vector(u8 vector);
+
 /**
  * @brief Initialize the IDT and install default handlers.
  */
 void idt_init(void);
 
+/**
+ * @brief Load the IDT built by idt_init on the calling CPU.
+ */
+void idt_load(void);
+
 /**
  * @brief Set an IDT entry.
  * @param vector Interrupt vector number (0-255).
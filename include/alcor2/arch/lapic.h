@@ -0,0 +1,46 @@
+/**
+ * @file include/alcor2/arch/lapic.h
+ * @brief Local APIC and its timer.
+ *
+ * Every CPU has its own local APIC at the same physical address; each CPU
+ * reaching the registers reaches its own. The timer is used in one-shot
+ * mode: it is armed for the next deadline and stays quiet after firing,
+ * so an idle CPU is not woken by ticks it does not need. Its rate is
+ * measured against PIT channel 2 once, on the BSP.
+ */
+
+#ifndef ALCOR2_LAPIC_H
+#define ALCOR2_LAPIC_H
+
+#include <alcor2/types.h>
+
+/** @brief IDT vector of the timer, just past the remapped PIC IRQs. */
+#define LAPIC_TIMER_VECTOR    48
+/** @brief IDT vector of spurious interrupts (low nibble all ones). */
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+/**
+ * @brief Map the local APIC, enable it on this CPU and calibrate its timer.
+ * @return false if there is no usable xAPIC; the PIT then stays in charge.
+ */
+bool lapic_init(void);
+
+/** @brief Whether lapic_init() found and enabled the local APIC. */
+bool lapic_enabled(void);
+
+/** @brief APIC ID of the calling CPU, the destination of its MSIs. */
+u32 lapic_id(void);
+
+/** @brief Enable the local APIC of the calling CPU, timer masked. */
+void lapic_init_cpu(void);
+
+/** @brief Make this CPU's timer interrupt once, @p ns from now. */
+void lapic_timer_arm(u64 ns);
+
+/** @brief Signal end of interrupt to this CPU's local APIC. */
+void lapic_eoi(void);
+
+/** @brief Interrupt the CPU whose local APIC is @p apic_id at @p vector. */
+void lapic_send_ipi(u32 apic_id, u8 vector);
+
+#endif
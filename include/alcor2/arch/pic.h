@@ -42,4 +42,10 @@ void pic_eoi(u8 irq);
  */
 void pic_unmask(u8 irq);
 
+/**
+ * @brief Mask (disable) an IRQ line.
+ * @param irq IRQ number (0-15).
+ */
+void pic_mask(u8 irq);
+
 #endif
@@ -3,6 +3,8 @@
  * @brief 8253/8254 PIT (Programmable Interval Timer) driver.
  *
  * Configures the PIT for periodic timer interrupts and tracks system ticks.
+ * Once the clock is calibrated, the tick goes one-shot and is driven by
+ * the local APIC timer where there is one.
  */
 
 #ifndef ALCOR2_PIT_H
@@ -16,6 +18,40 @@
  */
 void pit_init(u32 frequency);
 
+/** @brief Tick frequency set by ::pit_init, in Hz. */
+u32 pit_get_hz(void);
+
+/**
+ * @brief Measure the rate of an up-counter against PIT channel 2.
+ * @param read Returns the counter's current value.
+ * @return Counts per second, or 0 if channel 2 did not respond.
+ */
+u64 pit_measure_hz(u64 (*read)(void));
+
+/**
+ * @brief Switch to one-shot interrupts for precise timers.
+ *
+ * Needs a TSC-based ::time_monotonic_ns; ticks then follow that clock.
+ * The local APIC timer takes over from channel 0 if there is one.
+ */
+void pit_start_oneshot(void);
+
+/**
+ * @brief Stop or restart the BSP's tick while it idles.
+ *
+ * While stopped, interrupts come only for kernel timers and at least once
+ * a second. No-op before ::pit_start_oneshot.
+ */
+void pit_set_idle(bool on);
+
+/**
+ * @brief Arm the calling AP's next scheduler tick.
+ *
+ * Called as the AP leaves idle; its ticks then keep themselves going
+ * until it is back.
+ */
+void pit_arm_ap(void);
+
 /**
  * @brief Enable preemptive scheduling on timer tick.
  */
@@ -0,0 +1,66 @@
+/**
+ * @file include/alcor2/arch/pmu.h
+ * @brief Architectural performance monitoring (CPUID leaf 0xA).
+ *
+ * Only the general-purpose counters are used: each is programmed with an
+ * IA32_PERFEVTSELx value and counts from zero until stopped. Which event
+ * a counter holds, and for whom, is decided by the perf events layer
+ * (see alcor2/alcor_perf.h).
+ */
+
+#ifndef ALCOR2_PMU_H
+#define ALCOR2_PMU_H
+
+#include <alcor2/types.h>
+
+/** @brief Counters used at most, whatever the CPU has. */
+#define PMU_MAX_COUNTERS 8
+
+/** @name Architectural events (bit numbers of CPUID.0AH:EBX)
+ * @{ */
+#define PMU_EV_CYCLES        0 /**< Unhalted core cycles. */
+#define PMU_EV_INSTRUCTIONS  1 /**< Instructions retired. */
+#define PMU_EV_REF_CYCLES    2 /**< Unhalted reference cycles. */
+#define PMU_EV_LLC_REFS      3 /**< Last-level cache references. */
+#define PMU_EV_LLC_MISSES    4 /**< Last-level cache misses. */
+#define PMU_EV_BRANCHES      5 /**< Branch instructions retired. */
+#define PMU_EV_BRANCH_MISSES 6 /**< Mispredicted branches retired. */
+#define PMU_ARCH_EVENTS      7
+/** @} */
+
+/** @name IA32_PERFEVTSELx bits
+ * @{ */
+#define PMU_SEL_USR (1ULL << 16) /**< Count in ring 3. */
+#define PMU_SEL_OS  (1ULL << 17) /**< Count in ring 0. */
+#define PMU_SEL_INT (1ULL << 20) /**< Interrupt on overflow. */
+#define PMU_SEL_EN  (1ULL << 22) /**< Counter enabled. */
+/** @} */
+
+/** @brief Detect the PMU and report it on the console. */
+void pmu_init(void);
+
+/** @brief Reset the calling AP's counters as ::pmu_init did the BSP's. */
+void pmu_init_cpu(void);
+
+/** @brief General-purpose counters available; 0 without a PMU. */
+u32 pmu_counters(void);
+
+/** @brief True on an Intel CPU, whose model-specific events we know. */
+bool pmu_is_intel(void);
+
+/**
+ * @brief Event and unit mask of architectural event @p ev.
+ * @return The IA32_PERFEVTSELx low bits, or 0 if the CPU lacks it.
+ */
+u64 pmu_arch_event(u32 ev);
+
+/** @brief Start counter @p idx from zero with selector @p sel. */
+void pmu_start(u32 idx, u64 sel);
+
+/** @brief Count of running counter @p idx. */
+u64 pmu_read(u32 idx);
+
+/** @brief Stop counter @p idx. @return Its final count. */
+u64 pmu_stop(u32 idx);
+
+#endif
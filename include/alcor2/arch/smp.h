@@ -0,0 +1,137 @@
+/**
+ * @file include/alcor2/arch/smp.h
+ * @brief Per-CPU state, the kernel lock and inter-processor interrupts.
+ *
+ * The bootloader starts every AP and leaves it spinning; smp_init moves
+ * each one onto the kernel's page tables, its own kernel stack, GDT and TSS
+ * and the shared IDT. Once the first process is ready smp_start lets them
+ * go: from then on every CPU takes syscalls, interrupts and timer ticks
+ * and runs processes from its own run queue (see proc/sched.h).
+ *
+ * Each CPU reaches its ::cpu_t through GS. SWAPGS on every entry from
+ * ring 3 swaps in the kernel's GS base and every return swaps the user's
+ * back, so the user's lives in IA32_KERNEL_GS_BASE while in the kernel.
+ *
+ * The kernel itself runs on one CPU at a time, under the kernel lock. A
+ * CPU takes it on entry from user mode, or when an interrupt wakes it from
+ * idle, and drops it on the way back to user mode or when it goes idle;
+ * it stays held across a switch between processes on the same CPU. So
+ * kernel code sees other CPUs only as running user code or idling, and
+ * everything the single-CPU kernel guarded with cli holds as before. A
+ * process may however come back from a sleep on a different CPU, so
+ * nothing may keep a ::cpu_t pointer across one.
+ *
+ * Without a local APIC there are no IPIs to wake or flush the APs, which
+ * then stay parked.
+ */
+
+#ifndef ALCOR2_SMP_H
+#define ALCOR2_SMP_H
+
+#include <alcor2/arch/gdt.h>
+#include <alcor2/limine.h>
+#include <alcor2/types.h>
+
+struct proc;
+
+/** @brief CPUs tracked, BSP included; further APs are left in the loader. */
+#define SMP_MAX_CPUS 64
+
+/** @name IPI vectors
+ * @{ */
+#define SMP_RESCHED_VECTOR 0xF0 /**< Look at the run queue again. */
+#define SMP_TLB_VECTOR     0xF1 /**< Flush a page (see smp_tlb_shootdown). */
+/** @} */
+
+/**
+ * @brief One CPU's state. The first four fields are at fixed offsets,
+ *        used by the syscall entry (syscall.asm).
+ */
+typedef struct cpu
+{
+  struct cpu   *self;         /**< gs:0, so GS-relative code finds it. */
+  u64           kernel_rsp;   /**< gs:8: running process's kernel stack. */
+  u64           user_rsp;     /**< gs:16: user RSP over syscall entry. */
+  u8           *sig_work;     /**< gs:24: running process's @c sig_work. */
+  struct proc  *proc;         /**< Running process, or NULL while idle. */
+  u32           id;           /**< Kernel CPU number; the BSP is 0. */
+  u32           lapic_id;     /**< Local APIC ID. */
+  u64           pml4;         /**< Address space loaded (see vmm_switch). */
+  u64           cr3;          /**< AP bring-up: kernel page tables. */
+  u64           stack_top;    /**< AP bring-up: kernel stack, then idle's. */
+  u64           idle_rsp;     /**< Saved stack pointer of the idle loop. */
+  volatile bool need_resched; /**< A READY process is owed this CPU. */
+  volatile bool idle;         /**< In the idle loop with nothing to run. */
+  volatile bool online;       /**< Scheduling, and answering IPIs. */
+  bool          locked;       /**< Holds the kernel lock. */
+  gdt_cpu_t     gdt;          /**< GDT and TSS. */
+} cpu_t;
+
+_Static_assert(offsetof(cpu_t, kernel_rsp) == 8, "cpu_t kernel_rsp");
+_Static_assert(offsetof(cpu_t, user_rsp) == 16, "cpu_t user_rsp");
+_Static_assert(offsetof(cpu_t, sig_work) == 24, "cpu_t sig_work");
+
+/** @brief The calling CPU's state. */
+static inline cpu_t *cpu_this(void)
+{
+  cpu_t *cpu;
+  __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+  return cpu;
+}
+
+/** @brief Kernel number of the calling CPU. */
+static inline u32 smp_cpu_id(void)
+{
+  return cpu_this()->id;
+}
+
+/**
+ * @brief Point GS at the BSP's ::cpu_t, which holds the kernel lock.
+ *
+ * The first thing kmain does: the VMM and the GDT code already use it.
+ */
+void smp_init_bsp(void);
+
+/**
+ * @brief Bring up the APs in @p smp and leave them waiting for smp_start.
+ * @param smp Bootloader SMP response, or NULL if there was none.
+ */
+void smp_init(const struct limine_smp_response *smp);
+
+/** @brief Let the APs run processes. Called with the first one queued. */
+void smp_start(void);
+
+/** @brief CPUs in the tables, online or not. */
+u32 smp_cpu_count(void);
+
+/** @brief CPU number @p id (below smp_cpu_count()). */
+cpu_t *smp_cpu(u32 id);
+
+/** @brief Take the kernel lock; interrupts must be off. */
+void kernel_lock(void);
+
+/** @brief Drop the kernel lock; interrupts must be off. */
+void kernel_unlock(void);
+
+/**
+ * @brief Make @p cpu look at its run queue (need_resched, or idle).
+ *
+ * Sends a reschedule IPI unless @p cpu is NULL, the caller, or offline.
+ */
+void smp_kick(cpu_t *cpu);
+
+/** @brief Some idle CPU other than the caller, or NULL if none is. */
+cpu_t *smp_idle_cpu(void);
+
+/**
+ * @brief Drop the TLB entry of @p va on the other CPUs that may hold it.
+ *
+ * Returns once they all have. Called with the kernel lock held.
+ *
+ * @param pml4 Address space the page is in (only CPUs that have it loaded
+ *             are asked), or 0 for a kernel-half page (every CPU is).
+ * @param va   The page.
+ */
+void smp_tlb_shootdown(u64 pml4, u64 va);
+
+#endif
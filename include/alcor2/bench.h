@@ -0,0 +1,18 @@
+/**
+ * @file include/alcor2/bench.h
+ * @brief Boot-time micro-benchmarks of the core kernel paths.
+ *
+ * Booting with @c bench on the kernel command line runs them once the
+ * boot sequence is done and before the first user process starts. Each
+ * result is one line, "[BENCH] name  N.NN ns/op", on the console (and so
+ * on COM1), so runs can be captured and compared as the allocators and
+ * the scheduler change.
+ */
+
+#ifndef ALCOR2_BENCH_H
+#define ALCOR2_BENCH_H
+
+/** @brief Time each benchmark and report its cost per operation. */
+void bench_run(void);
+
+#endif
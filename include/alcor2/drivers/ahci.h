@@ -0,0 +1,57 @@
+/**
+ * @file ahci.h
+ * @brief AHCI SATA host controller driver.
+ *
+ * SATA disks behind an AHCI controller are registered as ordinary ATA
+ * drives, so ata_read(), ata_write() and the block cache work unchanged;
+ * ata_submit() hands their requests to this driver. With native command
+ * queuing each port keeps up to 32 commands outstanding and the disk
+ * orders them itself. Completions arrive on the controller's PCI
+ * interrupt line.
+ */
+
+#ifndef ALCOR2_AHCI_H
+#define ALCOR2_AHCI_H
+
+#include <alcor2/drivers/ata.h>
+#include <alcor2/types.h>
+
+/** @brief SATA disks driven at most (one per free ATA drive slot). */
+#define AHCI_MAX_DISKS 4
+
+/**
+ * @brief Find an AHCI controller and bring up the disks on its ports.
+ *
+ * Must run after the PIC and heap are initialised.
+ *
+ * @return Number of SATA disks found (0 without a controller).
+ */
+u32 ahci_init(void);
+
+/**
+ * @brief Describe a disk for the ATA drive table.
+ * @param n Disk index (below the count ahci_init() returned).
+ * @param d Drive descriptor to fill.
+ * @return true if @p n is a disk.
+ */
+bool ahci_attach(u32 n, ata_drive_t *d);
+
+/**
+ * @brief Queue a request on a disk's port.
+ *
+ * Called by ata_submit() once the request has been validated; completion
+ * goes through ata_bio_end(). Before the scheduler runs the call polls the
+ * port until the request completes.
+ *
+ * @param n   Disk index.
+ * @param bio Request.
+ * @return 0 if accepted, negative errno if the request is invalid.
+ */
+i64 ahci_submit(u8 n, ata_bio_t *bio);
+
+/**
+ * @brief Time out lost commands (called from the timer interrupt).
+ */
+void ahci_tick(void);
+
+#endif
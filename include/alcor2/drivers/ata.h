@@ -3,13 +3,26 @@
  * @brief ATA/IDE DMA driver.
  *
  * Provides sector-level read/write access to ATA hard drives using DMA.
- * Falls back to PIO during early boot (before PCI/DMA setup).
+ * Falls back to PIO during early boot (before PCI/DMA setup). SATA disks
+ * on an AHCI controller (see ahci.h) and virtio block devices (see
+ * virtio_blk.h) appear as drives here too.
  * Supports both LBA28 and LBA48 addressing modes.
+ *
+ * DMA requests (ata_bio_t) are queued per channel and completed from the
+ * IRQ handler, which starts the next request straight away. Transfers use
+ * scatter/gather PRD tables built from the callers' pages. The next one
+ * is chosen in C-LOOK order (ascending LBA, wrapping around) unless a
+ * request has waited past its deadline, and requests that continue it on
+ * disk are merged into the same DMA transfer.
  */
 
 #ifndef ALCOR2_ATA_H
 #define ALCOR2_ATA_H
 
+#include <alcor2/alcor_blkcache.h>
+#include <alcor2/proc/mutex.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/spinlock.h>
 #include <alcor2/types.h>
 
 struct proc;
@@ -51,6 +64,8 @@ struct proc;
 #define ATA_CMD_CACHE_FLUSH     0xE7
 #define ATA_CMD_CACHE_FLUSH_EXT 0xEA
 #define ATA_CMD_IDENTIFY        0xEC
+#define ATA_CMD_READ_FPDMA      0x60 /* NCQ (AHCI) */
+#define ATA_CMD_WRITE_FPDMA     0x61
 
 /* Bus Master IDE registers (offset from BAR4) */
 #define BMI_CMD    0x00 /* Command register */
@@ -81,6 +96,57 @@ typedef struct PACKED
   u16 flags;      /* Bit 15 = end of table */
 } ata_prd_t;
 
+/* Block request operations (ata_bio_t::op) */
+#define ATA_BIO_READ  0
+#define ATA_BIO_WRITE 1
+#define ATA_BIO_FLUSH 2 /* Commit the drive's write cache; no data */
+
+#define ATA_BIO_MAX_SEGS    32     /* Scatter/gather segments per request */
+#define ATA_BIO_MAX_SECTORS 256    /* 128 KB, the LBA28 command limit */
+#define ATA_BIO_PENDING     (-255) /* ata_bio_t::status until completion */
+#define ATA_BIO_DEADLINE    50     /* Ticks before a request jumps the queue */
+
+/**
+ * @brief One contiguous piece of a request's data.
+ */
+typedef struct
+{
+  void *buf;   /* Kernel virtual address */
+  u32   bytes; /* Multiple of ATA_SECTOR_SIZE */
+} ata_seg_t;
+
+struct ata_bio;
+
+/**
+ * @brief Request completion callback; runs in IRQ context.
+ */
+typedef void (*ata_bio_done_t)(struct ata_bio *bio);
+
+/**
+ * @brief Block request: one transfer of consecutive sectors.
+ *
+ * The data is scattered over @c seg, whose sizes must add up to
+ * @c count sectors. The caller owns the request and its buffers until
+ * @c status leaves ATA_BIO_PENDING.
+ */
+typedef struct ata_bio
+{
+  u64             lba;                   /* First sector */
+  u32             count;                 /* Sectors (0 for ATA_BIO_FLUSH) */
+  u8              drive;                 /* Drive index (0-3) */
+  u8              op;                    /* ATA_BIO_READ / WRITE / FLUSH */
+  u8              nseg;                  /* Used entries of seg */
+  u8              tries;                 /* Driver: attempts so far */
+  u8              direct;                /* Driver: DMA into seg in place */
+  ata_seg_t       seg[ATA_BIO_MAX_SEGS]; /* Data segments, in disk order */
+  ata_bio_done_t  done;                  /* Completion callback, or NULL */
+  void           *priv;                  /* Caller data for done */
+  volatile i64    status;                /* ATA_BIO_PENDING, 0 or -errno */
+  wait_queue_t    waiters;               /* Driver: processes in ata_wait() */
+  u64             queued;                /* Driver: tick of submission */
+  struct ata_bio *next;                  /* Driver: queue / transfer link */
+} ata_bio_t;
+
 /**
  * @brief Channel state for IRQ synchronization.
  */
@@ -95,21 +161,33 @@ typedef enum
  */
 typedef struct ata_channel
 {
-  u16         base;       /* Data port base (0x1F0 or 0x170) */
-  u16         ctrl;       /* Control port (0x3F6 or 0x376) */
-  u16         bmi;        /* Bus Master IDE base */
-  u8          irq;        /* IRQ number (14 or 15) */
-  ata_state_t state;      /* Current I/O state */
-  u8          status;     /* Last status from IRQ */
-  u8          bmi_status; /* Last BMI status */
-  u8          error;      /* Last error register */
-  struct proc
-      *waiter;     /* Blocked proc waiting for IRQ (NULL = poll / early boot) */
-  ata_prd_t *prdt; /* PRD table (virtual) */
-  u64        prdt_phys; /* PRD table (physical) */
-  bool       dma_ok;    /* DMA available */
+  u16          base;       /* Data port base (0x1F0 or 0x170) */
+  u16          ctrl;       /* Control port (0x3F6 or 0x376) */
+  u16          bmi;        /* Bus Master IDE base */
+  u8           irq;        /* IRQ number (14 or 15) */
+  ata_state_t  state;      /* Current I/O state */
+  u8           status;     /* Last status from IRQ */
+  u8           bmi_status; /* Last BMI status */
+  u8           error;      /* Last error register */
+  struct proc *waiter;     /* Proc waiting for IRQ (NULL = poll / early boot) */
+  wait_queue_t irq_wq;     /* Where @c waiter sleeps until the IRQ */
+  ata_prd_t   *prdt;       /* PRD table (virtual) */
+  u64          prdt_phys;  /* PRD table (physical) */
+  bool         dma_ok;     /* DMA available */
+  ata_bio_t   *active;     /* Transfer in progress (merged requests) */
+  ata_bio_t   *q_head;     /* Requests waiting, in submission order */
+  ata_bio_t   *q_tail;
+  u64          deadline;   /* Tick at which the active request times out */
+  u64          head_pos;   /* Elevator position: end of the last transfer */
+  spinlock_t   lock;       /* Guards the queue and @c active (IRQ-safe) */
+  mutex_t      pio;        /* Serialises PIO commands on the channel */
 } ata_channel_t;
 
+/* Host controller of a drive (ata_drive_t::host) */
+#define ATA_HOST_IDE    0
+#define ATA_HOST_AHCI   1 /* see ahci.h */
+#define ATA_HOST_VIRTIO 2 /* see virtio_blk.h */
+
 /**
  * @brief ATA drive descriptor.
  */
@@ -121,9 +199,15 @@ typedef struct ata_drive
   bool           atapi;      /* ATAPI device (not supported) */
   bool           lba48;      /* Supports 48-bit LBA */
   bool           dma;        /* Supports DMA */
+  u8             host;       /* ATA_HOST_*; channel is only used for IDE */
+  u8             port;       /* Disk index within the AHCI / virtio driver */
   u64            sectors;    /* Total sector count */
   char           model[41];  /* Model string */
   char           serial[21]; /* Serial number */
+  u64            rd_ios;     /* Read requests submitted */
+  u64            rd_sectors; /* Sectors they asked for */
+  u64            wr_ios;     /* Write requests submitted */
+  u64            wr_sectors; /* Sectors they carried */
 } ata_drive_t;
 
 /**
@@ -150,6 +234,11 @@ i64 ata_read(u8 drive, u64 lba, u32 count, void *buf);
 
 /**
  * @brief Write sectors to drive.
+ *
+ * The data lands in the write-back block cache; it reaches the disk later
+ * (see ata_sync() and ata_flush_expired()). Errors from an earlier deferred
+ * write-back may surface here.
+ *
  * @param drive Drive index.
  * @param lba   Starting logical block address.
  * @param count Number of sectors to write.
@@ -158,6 +247,110 @@ i64 ata_read(u8 drive, u64 lba, u32 count, void *buf);
  */
 i64 ata_write(u8 drive, u64 lba, u32 count, const void *buf);
 
+/**
+ * @brief Transfer sectors straight between the disk and physical pages.
+ *
+ * The block cache is bypassed: dirty cached blocks in the range are
+ * written back first so a read sees them, and a write drops the range's
+ * cached copies, before and after it. The transfer is split into
+ * ATA_BIO_MAX_SECTORS requests, several of which are kept in flight so
+ * the queue can merge them.
+ *
+ * @param drive  Drive index.
+ * @param op     ATA_BIO_READ or ATA_BIO_WRITE.
+ * @param lba    Starting logical block address.
+ * @param count  Number of sectors.
+ * @param pages  Physical addresses of the pages holding the data, which
+ *               must stay allocated until the call returns.
+ * @param offset Byte offset of the data in @p pages[0] (sector-aligned).
+ * @return 0 on success, negative errno on error.
+ */
+i64 ata_direct(
+    u8 drive, u8 op, u64 lba, u32 count, const u64 *pages, u32 offset
+);
+
+/**
+ * @brief Queue a block request.
+ *
+ * With DMA the request is queued on its channel and the call returns at
+ * once; the IRQ handler completes it and starts the next one. Queued
+ * requests may be reordered and merged, but never past a flush or an
+ * earlier request they overlap with a write. The drive transfers straight
+ * into or out of the segments when their pages are DMA-reachable (below
+ * 4 GB); otherwise the data goes through the channel's 64 KB bounce
+ * buffer, and larger requests fall back to PIO. Without DMA
+ * (or before the scheduler runs) it is carried out with PIO before
+ * returning. Either way completion sets @c status, wakes ata_wait() and
+ * calls @c done.
+ *
+ * @param bio Request; @c lba, @c count, @c drive, @c op and @c seg set.
+ * @return 0 if accepted, negative errno if the request is invalid.
+ */
+i64 ata_submit(ata_bio_t *bio);
+
+/**
+ * @brief Finish a request: set its status, wake its waiter, call @c done.
+ *
+ * Called by host controller drivers (the IDE channels and AHCI) with
+ * interrupts disabled.
+ *
+ * @param bio    Completed request.
+ * @param status 0 or negative errno.
+ */
+void ata_bio_end(ata_bio_t *bio, i64 status);
+
+/**
+ * @brief Fill a drive descriptor from IDENTIFY DEVICE data.
+ * @param d  Drive descriptor (marked present).
+ * @param id The 256 IDENTIFY words.
+ */
+void ata_parse_identify(ata_drive_t *d, const u16 *id);
+
+/**
+ * @brief Sleep until a submitted request completes.
+ * @param bio Request passed to ata_submit().
+ * @return 0 on success, negative errno on I/O failure.
+ */
+i64 ata_wait(ata_bio_t *bio);
+
+/**
+ * @brief Start reading sectors into the block cache without waiting.
+ *
+ * A hint: blocks already cached, or that cannot get a clean cache slot,
+ * are skipped, and nothing happens without DMA.
+ *
+ * @param drive Drive index.
+ * @param lba   Starting logical block address.
+ * @param count Number of sectors.
+ */
+void ata_prefetch(u8 drive, u64 lba, u32 count);
+
+/**
+ * @brief Time out a stuck request (called from the PIT IRQ).
+ */
+void ata_tick(void);
+
+/**
+ * @brief Write back a drive's dirty cached blocks and flush its own cache.
+ * @param drive Drive index.
+ * @return 0 once the data is on the disk, negative errno on error.
+ */
+i64 ata_sync(u8 drive);
+
+/**
+ * @brief Start writing back dirty blocks that have waited too long.
+ *
+ * Cheap when nothing is due. Called on the way out of every syscall; the
+ * write-backs are queued and the call does not wait for them.
+ */
+void ata_flush_expired(void);
+
+/**
+ * @brief Snapshot the block cache counters.
+ * @param out Filled with the current statistics.
+ */
+void ata_cache_stats(alcor_blkcache_stats_t *out);
+
 /**
  * @brief IRQ handler (called from IDT stub).
  * @param irq IRQ number (14 or 15).
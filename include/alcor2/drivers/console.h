@@ -36,6 +36,12 @@ typedef struct
  */
 void console_init(void *fb, u64 width, u64 height, u64 pitch_bytes, u16 bpp);
 
+/**
+ * @brief Draw through another mapping of the same framebuffer.
+ * @param fb Its first pixel (such as a write-combined mapping).
+ */
+void console_set_framebuffer(void *fb);
+
 /**
  * @brief Set the console color theme.
  * @param theme Color theme to use.
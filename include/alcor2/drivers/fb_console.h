@@ -32,6 +32,48 @@
 /** RECLAIM: resume kernel rendering, repaint the grid. arg ignored. */
 #define FB_CONSOLE_RECLAIM ((unsigned)('F' << 8) | 3U)
 
+/** MAP_GRID: map the cell grid into the caller. arg = fb_console_grid_t*. */
+#define FB_CONSOLE_MAP_GRID                                                    \
+  ((2U << 30) | ((unsigned)'F' << 8) | 4U | (sizeof(fb_console_grid_t) << 16))
+
+/** PRESENT: paint dirty cells of a row range. arg = fb_console_present_t*. */
+#define FB_CONSOLE_PRESENT                                                     \
+  ((1U << 30) | ((unsigned)'F' << 8) | 5U |                                    \
+   (sizeof(fb_console_present_t) << 16))
+
+/**
+ * @brief One cell of the console grid, as FB_CONSOLE_MAP_GRID shares it.
+ *
+ * Cell (col, row) is at index row * cols + col, with cols as TIOCGWINSZ
+ * reports it (the grid is re-laid out when the window size changes). A
+ * program writing cells sets @c dirty on each one it changed; only those
+ * are painted by FB_CONSOLE_PRESENT.
+ */
+typedef struct
+{
+  uint32_t cp;    /**< Unicode codepoint at this cell. */
+  uint32_t fg;    /**< RGB foreground. */
+  uint32_t bg;    /**< RGB background. */
+  uint16_t attr;  /**< SGR attribute bits (reserved). */
+  uint16_t dirty; /**< Changed since it was last painted. */
+} fb_console_cell_t;
+
+/** @brief Filled in by FB_CONSOLE_MAP_GRID. */
+typedef struct
+{
+  uint64_t cells_user; /**< userspace VA of the fb_console_cell_t grid. */
+  uint64_t map_size;   /**< bytes mapped there (whole pages). */
+  uint32_t cols;       /**< grid width in cells when mapped. */
+  uint32_t rows;       /**< grid height in cells when mapped. */
+} fb_console_grid_t;
+
+/** @brief Argument of FB_CONSOLE_PRESENT: rows [first_row, +n_rows). */
+typedef struct
+{
+  uint32_t first_row;
+  uint32_t n_rows;
+} fb_console_present_t;
+
 /**
  * @brief Initialise the runtime console using the same framebuffer the boot
  * logger has been writing to. Allocates the cell grid via kmalloc, so call
@@ -112,9 +154,45 @@ void fb_console_get_size(int *cols, int *rows);
  *  for cursor keys instead of CSI (`\E[A`). Toggled by ncurses keypad mode. */
 bool fb_console_app_cursor_keys(void);
 
+/**
+ * @brief Page the screen through the scrollback.
+ *
+ * The view moves half a screen per page and is repainted only when it
+ * moves. Output arriving meanwhile updates the grid without being shown.
+ *
+ * @param pages Pages to scroll back (> 0) or forward (< 0); 0 returns to
+ *              the live screen.
+ */
+void fb_console_scroll_view(int pages);
+
 void fb_console_yield(void);
 
 /** @brief Resume kernel rendering; repaint the cell grid. */
 void fb_console_reclaim(void);
 
+/**
+ * @brief Physical pages holding the cell grid, for FB_CONSOLE_MAP_GRID.
+ *
+ * They stay allocated, and hold the grid, for the life of the console.
+ *
+ * @return false before the console is initialised.
+ */
+bool fb_console_grid_pages(u64 *phys, u64 *pages);
+
+/**
+ * @brief Paint the grid cells marked dirty in rows
+ *        [@p first_row, @p first_row + @p n_rows) (FB_CONSOLE_PRESENT).
+ */
+void fb_console_present(u32 first_row, u32 n_rows);
+
+/**
+ * @brief Check the glyph blend against the per-channel formula it replaced.
+ *
+ * Runs every (fg, bg, alpha) byte combination in each channel; the boot
+ * benchmarks call it.
+ *
+ * @return Blends compared, or 0 if any differed.
+ */
+u64 fb_console_blend_check(void);
+
 #endif /* ALCOR2_FB_CONSOLE_H */
@@ -42,4 +42,7 @@ u64 fb_user_map_size(void);
 /** @brief Offset in bytes from @ref fb_user_phys_base to the first pixel. */
 u64 fb_user_mmap_pixel_offset(void);
 
+/** @brief Kernel address of the first pixel (write-combined), or NULL. */
+u8 *fb_user_pixels(void);
+
 #endif
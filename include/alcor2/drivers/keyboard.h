@@ -50,12 +50,12 @@ typedef struct
 } key_state_t;
 
 /**
- * @brief Keyboard event handler callback.
- * @param c ASCII character (or 0 if non-printable).
- * @param scancode Raw scancode.
- * @param state Modifier key state.
+ * @brief Bottom half run by the keyboard IRQ after queueing a scancode.
+ *
+ * Runs with interrupts disabled and drains the ring with keyboard_raw_pop();
+ * the waiters are woken once it returns.
  */
-typedef void (*keyboard_handler_t)(char c, u8 scancode, key_state_t state);
+typedef void (*keyboard_bh_t)(void);
 
 /**
  * @brief Initialize the PS/2 keyboard driver.
@@ -63,10 +63,10 @@ typedef void (*keyboard_handler_t)(char c, u8 scancode, key_state_t state);
 void keyboard_init(void);
 
 /**
- * @brief Set the keyboard event handler.
- * @param handler Callback function.
+ * @brief Install the keyboard IRQ bottom half (the line discipline).
+ * @param bh Callback, or NULL to leave scancodes in the ring.
  */
-void keyboard_set_handler(keyboard_handler_t handler);
+void keyboard_set_bottom_half(keyboard_bh_t bh);
 
 /**
  * @brief Convert scancode to ASCII character.
@@ -98,17 +98,29 @@ bool keyboard_raw_available(void);
 
 /**
  * @brief Pop one raw scancode from the ring buffer.
+ *
+ * Must be called with interrupts disabled (the bottom half is).
  * @return The oldest unread scancode byte.
  */
 u8 keyboard_raw_pop(void);
 
 /**
- * @brief Copy pending scancodes without consuming (irq snapshot).
- * @param dst Output buffer (caller-sized).
- * @param cap Capacity of @p dst.
- * @return Number of bytes copied (0 if empty).
+ * @brief Sleep until the next keyboard interrupt.
+ *
+ * The bottom half has run by the time the caller wakes.
+ * Must be called with interrupts disabled.
+ *
+ * @return 0 when woken by the IRQ, @c -EINTR on a signal.
+ */
+i64 keyboard_wait(void);
+
+struct poll_table;
+
+/**
+ * @brief Register a poll table on the queue the keyboard IRQ wakes.
+ * @param pt Poll table, or NULL.
  */
-u32 keyboard_raw_peek(u8 *dst, u32 cap);
+void keyboard_poll_wait(struct poll_table *pt);
 
 /**
  * @brief Scancodes discarded since boot because the irq ring was full.
@@ -2,8 +2,10 @@
  * @file pci.h
  * @brief PCI bus driver.
  *
- * Provides PCI configuration space access and device enumeration.
- * Used primarily to locate the IDE controller for DMA support.
+ * Provides PCI configuration space access (ECAM when ACPI describes it,
+ * the legacy ports otherwise) and an inventory built once at boot.
+ * Used to locate the IDE, AHCI and virtio storage controllers, and to
+ * switch them from their shared INTx line to MSI or MSI-X messages.
  */
 
 #ifndef ALCOR2_PCI_H
@@ -20,6 +22,10 @@
 #define PCI_CLASS_STORAGE 0x01
 /** @brief IDE controller subclass. */
 #define PCI_SUBCLASS_IDE 0x01
+/** @brief SATA controller subclass. */
+#define PCI_SUBCLASS_SATA 0x06
+/** @brief AHCI programming interface of a SATA controller. */
+#define PCI_PROG_IF_AHCI 0x01
 
 /* BAR register offsets */
 #define PCI_BAR0 0x10
@@ -38,12 +44,48 @@
 #define PCI_SUBCLASS    0x0A
 #define PCI_PROG_IF     0x09
 #define PCI_HEADER_TYPE 0x0E
+#define PCI_CAP_PTR     0x34
 #define PCI_INTERRUPT   0x3C
+#define PCI_CLASS_DWORD 0x08 /* revision, prog-if, subclass, class */
+
+/* Status register bits */
+#define PCI_STATUS_CAP_LIST 0x0010
+
+/* BAR type bits */
+#define PCI_BAR_IO        0x1
+#define PCI_BAR_TYPE_MASK 0x6
+#define PCI_BAR_TYPE_64   0x4
+
+/* Capability IDs */
+#define PCI_CAP_MSI    0x05
+#define PCI_CAP_VENDOR 0x09
+#define PCI_CAP_MSIX   0x11
+
+/* MSI capability (offsets from the capability) */
+#define PCI_MSI_CTRL     0x02
+#define PCI_MSI_ADDR     0x04
+#define PCI_MSI_ENABLE   0x0001
+#define PCI_MSI_MME_MASK 0x0070 /* messages enabled, log2 */
+#define PCI_MSI_64BIT    0x0080
+#define PCI_MSI_MASKABLE 0x0100
+
+/* MSI-X capability (offsets from the capability) and table */
+#define PCI_MSIX_CTRL       0x02
+#define PCI_MSIX_TABLE      0x04   /* offset in BAR | BAR index */
+#define PCI_MSIX_SIZE_MASK  0x07FF /* table entries - 1 */
+#define PCI_MSIX_FUNC_MASK  0x4000
+#define PCI_MSIX_ENABLE     0x8000
+#define PCI_MSIX_BIR_MASK   0x7
+#define PCI_MSIX_ENTRY_SIZE 16
+
+/** @brief Address an MSI writes to reach a local APIC (ID in 19:12). */
+#define PCI_MSI_ADDR_BASE 0xFEE00000U
 
 /* Command register bits */
-#define PCI_CMD_IO     0x0001
-#define PCI_CMD_MEMORY 0x0002
-#define PCI_CMD_MASTER 0x0004
+#define PCI_CMD_IO       0x0001
+#define PCI_CMD_MEMORY   0x0002
+#define PCI_CMD_MASTER   0x0004
+#define PCI_CMD_INTX_OFF 0x0400
 
 /**
  * @brief PCI device descriptor.
@@ -60,6 +102,8 @@ typedef struct pci_device
   u8  prog_if;    /**< Programming interface. */
   u8  irq;        /**< Interrupt line. */
   u32 bar[6];     /**< Base Address Registers. */
+  u8  cap_msi;    /**< Config offset of the MSI capability, or 0. */
+  u8  cap_msix;   /**< Config offset of the MSI-X capability, or 0. */
 } pci_device_t;
 
 /**
@@ -112,6 +156,23 @@ void pci_write16(u8 bus, u8 slot, u8 func, u8 offset, u16 val);
  */
 void pci_write32(u8 bus, u8 slot, u8 func, u8 offset, u32 val);
 
+/**
+ * @brief Map the ECAM window from the ACPI MCFG table, if any, and
+ *        enumerate every function into the inventory.
+ *
+ * Runs after acpi_init(). Lookups made before it enumerate through the
+ * ports on first use instead.
+ */
+void pci_init(void);
+
+/**
+ * @brief Find a device in the inventory by class and subclass.
+ * @param class_code PCI class code.
+ * @param subclass   PCI subclass code.
+ * @return The first match, or NULL. The entry lives as long as the kernel.
+ */
+const pci_device_t *pci_find(u8 class_code, u8 subclass);
+
 /**
  * @brief Find PCI device by class and subclass.
  * @param class_code PCI class code.
@@ -121,10 +182,76 @@ void pci_write32(u8 bus, u8 slot, u8 func, u8 offset, u32 val);
  */
 bool pci_find_device(u8 class_code, u8 subclass, pci_device_t *dev);
 
+/**
+ * @brief Find PCI device by vendor and device ID.
+ * @param vendor    Vendor ID.
+ * @param device_id Device ID.
+ * @param dev       Output device descriptor (filled if found).
+ * @return true if found.
+ */
+bool pci_find_id(u16 vendor, u16 device_id, pci_device_t *dev);
+
+/**
+ * @brief Find a capability in a device's capability list.
+ * @param dev    Device.
+ * @param cap_id Capability ID (e.g. PCI_CAP_VENDOR).
+ * @param after  Offset of the previous match, or 0 for the first one.
+ * @return Config-space offset of the capability, or 0 if there is none.
+ */
+u8 pci_find_capability(const pci_device_t *dev, u8 cap_id, u8 after);
+
+/**
+ * @brief Physical base address of a memory BAR (32- or 64-bit).
+ * @param dev Device.
+ * @param bar BAR index (0-5).
+ * @return Base address, or 0 for an I/O or unset BAR.
+ */
+u64 pci_bar_address(const pci_device_t *dev, u8 bar);
+
 /**
  * @brief Enable bus mastering for a PCI device.
  * @param dev Device to configure.
  */
 void pci_enable_bus_master(const pci_device_t *dev);
 
+/**
+ * @brief Switch a device to a single MSI message on @p vector.
+ *
+ * The message goes to the calling CPU's local APIC, edge-triggered, and
+ * the INTx line is turned off.
+ *
+ * @param dev    Device.
+ * @param vector IDT vector from irq_alloc_vector().
+ * @return false if the device has no MSI capability.
+ */
+bool pci_enable_msi(const pci_device_t *dev, u8 vector);
+
+/**
+ * @brief MSI-X table entries of a device.
+ * @param dev Device.
+ * @return Entries, or 0 if it has no MSI-X capability.
+ */
+u32 pci_msix_count(const pci_device_t *dev);
+
+/**
+ * @brief Switch a device to MSI-X, entry @c i signalling @p vectors[i].
+ *
+ * Entries from @p n on stay masked. Like pci_enable_msi(), the messages
+ * go to the calling CPU's local APIC and INTx is turned off. Memory
+ * decoding must already be on (pci_enable_bus_master()), as the table is
+ * in a memory BAR.
+ *
+ * @param dev     Device.
+ * @param vectors IDT vectors from irq_alloc_vector().
+ * @param n       Entries to program, at most pci_msix_count().
+ * @return false if the device has no MSI-X or the table cannot be mapped.
+ */
+bool pci_enable_msix(const pci_device_t *dev, const u8 *vectors, u32 n);
+
+/**
+ * @brief Turn MSI-X off again and give the device back its INTx line.
+ * @param dev Device.
+ */
+void pci_disable_msix(const pci_device_t *dev);
+
 #endif
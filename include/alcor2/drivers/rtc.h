@@ -0,0 +1,17 @@
+/**
+ * @file include/alcor2/drivers/rtc.h
+ * @brief CMOS real-time clock (wall-clock time at boot).
+ */
+
+#ifndef ALCOR2_RTC_H
+#define ALCOR2_RTC_H
+
+#include <alcor2/types.h>
+
+/**
+ * @brief Read the CMOS clock, which is assumed to run in UTC.
+ * @return Seconds since the Unix epoch.
+ */
+i64 rtc_read_unix(void);
+
+#endif
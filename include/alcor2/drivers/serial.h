@@ -0,0 +1,28 @@
+/**
+ * @file include/alcor2/drivers/serial.h
+ * @brief 16550 UART on COM1, output only.
+ *
+ * The kernel console copies its output here, so the boot log and reports
+ * such as the boot benchmarks reach a host terminal (QEMU @c -serial
+ * stdio) where they can be captured and compared between builds.
+ */
+
+#ifndef ALCOR2_SERIAL_H
+#define ALCOR2_SERIAL_H
+
+#include <alcor2/types.h>
+
+/**
+ * @brief Program COM1 for 115200 baud, 8N1, and check that it answers.
+ *
+ * Without a UART, output is dropped.
+ */
+void serial_init(void);
+
+/** @brief Send @p c, as CR LF for a newline. */
+void serial_putchar(char c);
+
+/** @brief Send the string @p s. */
+void serial_print(const char *s);
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * @file virtio_blk.h
+ * @brief Virtio block device driver (modern PCI transport).
+ *
+ * The first virtio-blk device (e.g. QEMU's -drive if=virtio) is registered
+ * as an ordinary ATA drive, so ata_read(), ata_write() and the block cache
+ * use it unchanged; ata_submit() hands its requests to this driver.
+ * Requests go onto one split virtqueue, and every request queued since the
+ * last kick goes to the device with a single doorbell write.
+ */
+
+#ifndef ALCOR2_VIRTIO_BLK_H
+#define ALCOR2_VIRTIO_BLK_H
+
+#include <alcor2/drivers/ata.h>
+#include <alcor2/types.h>
+
+/**
+ * @brief Find a virtio block device and set up its request queue.
+ *
+ * Must run after the PIC and heap are initialised.
+ *
+ * @return Number of disks found (0 or 1).
+ */
+u32 virtio_blk_init(void);
+
+/**
+ * @brief Describe a disk for the ATA drive table.
+ * @param n Disk index (below the count virtio_blk_init() returned).
+ * @param d Drive descriptor to fill.
+ * @return true if @p n is a disk.
+ */
+bool virtio_blk_attach(u32 n, ata_drive_t *d);
+
+/**
+ * @brief Queue a request on a disk.
+ *
+ * Called by ata_submit() once the request has been validated; completion
+ * goes through ata_bio_end(). Before the scheduler runs the call polls the
+ * device until the request completes.
+ *
+ * @param n   Disk index.
+ * @param bio Request.
+ * @return 0 if accepted, negative errno if the request is invalid.
+ */
+i64 virtio_blk_submit(u8 n, ata_bio_t *bio);
+
+/**
+ * @brief Poll for completions when no interrupt line is routed (timer IRQ).
+ */
+void virtio_blk_tick(void);
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * @file virtio_net.h
+ * @brief Virtio network device driver (modern PCI transport).
+ *
+ * The first virtio-net device (e.g. QEMU's -device virtio-net-pci) becomes
+ * the stack's interface through net_attach(). Received frames are handed
+ * to net_rx() from the interrupt; frames to send are queued on the
+ * transmit virtqueue by reference, with their fragments, and freed once
+ * the device has read them.
+ */
+
+#ifndef ALCOR2_VIRTIO_NET_H
+#define ALCOR2_VIRTIO_NET_H
+
+#include <alcor2/types.h>
+
+/**
+ * @brief Find a virtio network device, post receive buffers and attach it.
+ *
+ * Must run after the PIC, heap and PCI inventory are initialised.
+ *
+ * @return Number of interfaces found (0 or 1).
+ */
+u32 virtio_net_init(void);
+
+/**
+ * @brief Per-tick work (timer IRQ): poll the queues when no interrupt is
+ *        routed, and replace receive buffers that could not be allocated.
+ */
+void virtio_net_tick(void);
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * @file include/alcor2/fs/dcache.h
+ * @brief Directory entry cache for path lookups.
+ *
+ * Caches name lookups by (volume, directory inode, name), including
+ * negative results, so resolving a hot path skips directory block parsing.
+ * Filesystems fill it from their lookup code and keep it current when they
+ * add or remove entries; names longer than DCACHE_NAME_MAX are never
+ * cached. Entries are recycled in LRU order.
+ */
+
+#ifndef ALCOR2_DCACHE_H
+#define ALCOR2_DCACHE_H
+
+#include <alcor2/types.h>
+
+/** @brief Longest name the cache stores. */
+#define DCACHE_NAME_MAX 31
+
+/**
+ * @brief Look a name up in a directory.
+ * @param volume Filesystem instance (mount fs_data).
+ * @param dir Directory inode number.
+ * @param name Entry name.
+ * @param ino Output inode number, 0 if the name is known not to exist.
+ * @param type Output entry type (filesystem-defined).
+ * @return true if the answer was cached.
+ */
+bool dcache_lookup(
+    const void *volume, u64 dir, const char *name, u64 *ino, u8 *type
+);
+
+/**
+ * @brief Record the result of a lookup, or an entry just added or removed.
+ * @param volume Filesystem instance.
+ * @param dir Directory inode number.
+ * @param name Entry name.
+ * @param ino Inode number, or 0 for a negative entry.
+ * @param type Entry type.
+ */
+void dcache_add(
+    const void *volume, u64 dir, const char *name, u64 ino, u8 type
+);
+
+/**
+ * @brief Forget every entry of a directory (it was removed).
+ * @param volume Filesystem instance.
+ * @param dir Directory inode number.
+ */
+void dcache_drop_dir(const void *volume, u64 dir);
+
+#endif
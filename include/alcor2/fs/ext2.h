@@ -84,6 +84,13 @@
 #define EXT2_FT_SYMLINK  7
 /** @} */
 
+/** @name Directory index (htree)
+ * @{ */
+#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x0020     /**< Volume may use htree */
+#define EXT2_INDEX_FL                 0x00001000 /**< Directory is indexed */
+#define EXT2_FLAGS_UNSIGNED_HASH      0x0002     /**< Hash unsigned chars */
+/** @} */
+
 /**
  * @brief ext2 superblock structure.
  *
@@ -136,16 +143,27 @@ typedef struct
   u32 s_journal_inum;
   u32 s_journal_dev;
   u32 s_last_orphan;
-  /* Directory indexing (not used) */
-  u32 s_hash_seed[4];
-  u8  s_def_hash_version;
+  /* Directory indexing */
+  u32 s_hash_seed[4];      /**< htree hash seed (all zero = default) */
+  u8  s_def_hash_version;  /**< Hash for new indexed directories */
   u8  s_reserved_char_pad;
   u16 s_reserved_word_pad;
   u32 s_default_mount_opts;
   u32 s_first_meta_bg;
-  u8  s_reserved[760]; /**< Padding to 1024 bytes */
+  /* ext4 fields up to s_flags */
+  u32 s_mkfs_time;
+  u32 s_jnl_blocks[17];
+  u32 s_blocks_count_hi;
+  u32 s_r_blocks_count_hi;
+  u32 s_free_blocks_count_hi;
+  u16 s_min_extra_isize;
+  u16 s_want_extra_isize;
+  u32 s_flags;         /**< EXT2_FLAGS_* */
+  u8  s_reserved[668]; /**< Padding to 1024 bytes */
 } PACKED ext2_superblock_t;
 
+_Static_assert(sizeof(ext2_superblock_t) == 1024, "ext2 superblock size");
+
 /**
  * @brief Block group descriptor.
  *
@@ -204,6 +222,21 @@ typedef struct
   char name[];    /**< Filename (not null-terminated) */
 } PACKED ext2_dirent_t;
 
+/** @brief Inode hash buckets tracking block tree changes for run maps. */
+#define EXT2_TREE_GEN_SLOTS 64
+
+/**
+ * @brief In-memory copy of a group's block or inode bitmap.
+ *
+ * Loaded on first allocation in the group and written back by the next
+ * metadata flush.
+ */
+typedef struct
+{
+  u8  *bits;  /**< Bitmap block (NULL = not loaded) */
+  bool dirty; /**< Modified since last written */
+} ext2_bitmap_t;
+
 /**
  * @brief ext2 volume descriptor.
  */
@@ -222,8 +255,78 @@ typedef struct
   bool               mounted;          /**< Volume is mounted */
   ext2_superblock_t  sb;               /**< Cached superblock */
   ext2_group_desc_t *groups;           /**< Group descriptor table */
+  ext2_bitmap_t     *block_bitmaps;    /**< Per-group block bitmaps */
+  ext2_bitmap_t     *inode_bitmaps;    /**< Per-group inode bitmaps */
+  u8                *gdt_dirty;        /**< Per GDT block: needs writing */
+  bool               sb_dirty;         /**< Superblock needs writing */
+  u32                meta_changes;     /**< Updates since last flush */
+  u64                meta_since;       /**< Tick of oldest unflushed update */
+  u32                alloc_gen;        /**< Bumped per block alloc/free */
+  u32                tree_gen[EXT2_TREE_GEN_SLOTS]; /**< Per-inode changes */
 } ext2_volume_t;
 
+/**
+ * @brief Run of consecutive file blocks stored in consecutive disk blocks.
+ */
+typedef struct
+{
+  u32 file_block; /**< First file block */
+  u32 disk_block; /**< Disk block backing it */
+  u32 count;      /**< Blocks in the run */
+} ext2_run_t;
+
+/** @brief Pointer block levels a block map caches (ind, dind, tind). */
+#define EXT2_MAP_LEVELS 3
+
+/**
+ * @brief Indirect blocks an open file last mapped through.
+ *
+ * Slot n keeps the pointer block n levels above the data blocks, so
+ * mapping consecutive file blocks reads each pointer block once. The
+ * slots are dropped whenever the volume's alloc_gen moves on.
+ */
+typedef struct
+{
+  u32  gen;                    /**< Volume alloc_gen the slots match */
+  u32  block[EXT2_MAP_LEVELS]; /**< Cached pointer block (0 = empty) */
+  u32 *ptrs;                   /**< Slot contents, allocated on first use */
+} ext2_block_map_t;
+
+/**
+ * @brief Blocks reserved past a file's last allocation.
+ *
+ * An allocation for a file that is being written takes a few blocks more
+ * than it needs; the next allocation that continues right after it is
+ * served from the window, so files appended in small pieces stay
+ * contiguous even while other files grow. The blocks are marked in use
+ * and handed back when the last handle closes.
+ */
+typedef struct
+{
+  u32 block; /**< First reserved block */
+  u32 count; /**< Reserved blocks (0 = none) */
+} ext2_prealloc_t;
+
+/**
+ * @brief In-memory inode, shared by every open handle on it.
+ *
+ * Entries are hashed by (volume, inode number). Referenced entries are
+ * pinned; unreferenced ones stay cached on an LRU list so repeated lookups
+ * and stats skip the inode table.
+ */
+typedef struct ext2_cinode
+{
+  const ext2_volume_t *vol;   /**< Volume */
+  u32                  ino;   /**< Inode number */
+  u32                  refs;  /**< Open handles */
+  bool                 dirty; /**< Modified since last written */
+  ext2_inode_t         inode; /**< Inode contents */
+  ext2_prealloc_t      pa;    /**< Preallocation window */
+  struct ext2_cinode  *hnext; /**< Hash chain */
+  struct ext2_cinode  *prev;  /**< LRU list of unreferenced entries */
+  struct ext2_cinode  *next;
+} ext2_cinode_t;
+
 /**
  * @brief ext2 file handle.
  *
@@ -233,12 +336,18 @@ typedef struct
  */
 typedef struct
 {
-  ext2_volume_t *vol;       /**< Volume reference */
-  u32            inode_num; /**< Inode number */
-  ext2_inode_t   inode;     /**< Cached inode */
-  bool           is_dir;    /**< Is a directory */
-  bool           in_use;    /**< Handle is in use */
-  bool           dirty;     /**< Inode modified */
+  ext2_volume_t   *vol;       /**< Volume reference */
+  u32              inode_num; /**< Inode number */
+  ext2_cinode_t   *ci;        /**< Shared cached inode */
+  bool             is_dir;    /**< Is a directory */
+  bool             in_use;    /**< Handle is in use */
+  ext2_block_map_t map;       /**< Indirect block cache */
+  ext2_run_t      *runs;      /**< Decoded block tree (NULL = not built) */
+  u32              nruns;     /**< Entries in @c runs */
+  u32              runs_gen;  /**< Volume tree_gen the runs match */
+  bool             runs_off;  /**< Tree changed under us: probe blocks */
+  u64              rd_index;  /**< Next entry index ext2_readdir expects */
+  u64              rd_pos;    /**< Directory byte position of that entry */
 } ext2_file_t;
 
 /**
@@ -297,6 +406,34 @@ i64 ext2_read(ext2_file_t *file, void *buf, u64 count, u64 offset);
  */
 i64 ext2_write(ext2_file_t *file, const void *buf, u64 count, u64 offset);
 
+/**
+ * @brief Write @p iovcnt buffers to a file, back to back from @p offset.
+ * @return Bytes written, or negative on error.
+ */
+i64 ext2_writev(
+    ext2_file_t *file, const vfs_iovec_t *iov, u32 iovcnt, u64 offset
+);
+
+/**
+ * @brief Transfer whole blocks between a file and pinned pages, uncached.
+ *
+ * Each run of consecutive disk blocks goes to the drive as one
+ * ata_direct() call; holes read as zeros, and a write allocates blocks
+ * for them and extends the file as ext2_writev() does.
+ *
+ * @param file   File handle.
+ * @param write  Write the pages to the file (else read into them).
+ * @param pages  Physical addresses of the pages, pinned by the caller.
+ * @param first  Byte offset of the data in @p pages[0].
+ * @param count  Bytes; a multiple of the block size.
+ * @param offset File position; a multiple of the block size.
+ * @return Bytes transferred, -EOPNOTSUPP if misaligned, or negative errno.
+ */
+i64 ext2_direct(
+    ext2_file_t *file, bool write, const u64 *pages, u32 first, u64 count,
+    u64 offset
+);
+
 /**
  * @brief Read next directory entry.
  * @param dir Directory handle.
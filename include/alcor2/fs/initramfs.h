@@ -0,0 +1,29 @@
+/**
+ * @file include/alcor2/fs/initramfs.h
+ * @brief Boot-time root filesystem from a cpio archive.
+ *
+ * An archive in the "newc" cpio format (@c cpio -o -H newc), loaded by
+ * Limine as a module, is unpacked into ramfs before anything is mounted,
+ * so the first programs can run before the disk is ready.
+ */
+
+#ifndef ALCOR2_INITRAMFS_H
+#define ALCOR2_INITRAMFS_H
+
+#include <alcor2/types.h>
+
+/** @brief Whether the @p size bytes at @p data start with a newc header. */
+bool initramfs_is_cpio(const void *data, u64 size);
+
+/**
+ * @brief Create the archive's directories and regular files in ramfs.
+ *
+ * Other entries (symlinks, devices) are skipped, and so are paths that
+ * would leave the root.
+ *
+ * @return Number of entries created, or @c -EINVAL if the archive is cut
+ *         short or malformed; entries before the damage are kept.
+ */
+i64 initramfs_unpack(const void *data, u64 size);
+
+#endif
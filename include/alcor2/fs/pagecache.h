@@ -0,0 +1,121 @@
+/**
+ * @file include/alcor2/fs/pagecache.h
+ * @brief Per-inode page cache for file reads, writes and mmap.
+ *
+ * File pages are cached by (volume, inode, page index). read() is served
+ * from the cache and write() updates cached pages as it writes through to
+ * the driver. For mmap the cache hands out physical frames; every mapping
+ * of a page holds its own PMM reference, so processes mapping the same file
+ * share one frame. MAP_PRIVATE mappings get the frame copy-on-write and
+ * MAP_SHARED mappings write into it directly. Files are addressed through
+ * an OFT slot kept alive by the caller. Unmapped clean pages are evicted in
+ * LRU order when memory runs low.
+ */
+
+#ifndef ALCOR2_PAGECACHE_H
+#define ALCOR2_PAGECACHE_H
+
+#include <alcor2/fs/vfs.h>
+#include <alcor2/types.h>
+
+/**
+ * @brief Initialise the page cache.
+ *
+ * Must run after heap_init() and vfs_init().
+ */
+void pcache_init(void);
+
+/**
+ * @brief Get the cached frame for one page of a file, reading it if needed.
+ *
+ * The caller receives its own reference on the frame (drop it with
+ * pmm_free(), as unmapping does). Bytes past end-of-file read as zero. A
+ * miss reads the next few pages along with it, in one driver call.
+ *
+ * @param oft_idx OFT slot of the open file.
+ * @param index Page index within the file.
+ * @return Physical address of the page, or NULL on I/O or memory failure.
+ */
+void *pcache_get_page(i32 oft_idx, u64 index);
+
+/**
+ * @brief Get the frame for one page of a file only if it is already cached.
+ *
+ * Like pcache_get_page() but never reads from the driver, so it is cheap
+ * enough to call speculatively.
+ *
+ * @param oft_idx OFT slot of the open file.
+ * @param index Page index within the file.
+ * @return Physical address of the page (with a reference), or NULL.
+ */
+void *pcache_peek_page(i32 oft_idx, u64 index);
+
+/**
+ * @brief Read from a regular file through the cache.
+ *
+ * Reads stop at end-of-file. Missing pages are read from the driver in
+ * runs and stay cached for later reads and mappings. When @p ra shows the
+ * file is read sequentially, pages past the request are read ahead too:
+ * in the background through the driver's readahead hint when it has one,
+ * otherwise along with the request.
+ *
+ * @param oft_idx OFT slot of the open file.
+ * @param ra Readahead state of the open file, or NULL for none.
+ * @param buf Destination buffer.
+ * @param count Maximum number of bytes.
+ * @param offset File offset.
+ * @return Bytes read (0 at EOF), or negative errno.
+ */
+i64 pcache_read(
+    i32 oft_idx, vfs_readahead_t *ra, void *buf, u64 count, u64 offset
+);
+
+/**
+ * @brief Note that a MAP_SHARED mapping is about to write to a page.
+ * @param oft_idx OFT slot of the open file.
+ * @param index Page index within the file.
+ */
+void pcache_mark_dirty(i32 oft_idx, u64 index);
+
+/**
+ * @brief Write dirty pages in [first, end) back to the file.
+ *
+ * Pages are written up to the current file size only, so a mapping never
+ * extends its file. A page no mapping holds any more is marked clean.
+ *
+ * @param oft_idx OFT slot of the open file.
+ * @param first First page index.
+ * @param end End page index (exclusive).
+ */
+void pcache_writeback(i32 oft_idx, u64 first, u64 end);
+
+/**
+ * @brief Copy data just written with write() into any cached pages.
+ *
+ * Keeps mappings coherent with the file contents.
+ *
+ * @param oft_idx OFT slot of the open file.
+ * @param buf Data that was written.
+ * @param count Number of bytes written.
+ * @param offset File offset of the write.
+ */
+void pcache_update(i32 oft_idx, const void *buf, u64 count, u64 offset);
+
+/**
+ * @brief Drop cached pages past a new file size and zero the partial tail.
+ * @param oft_idx OFT slot of the open file.
+ * @param size New file size in bytes.
+ */
+void pcache_truncate(i32 oft_idx, u64 size);
+
+/**
+ * @brief Forget every cached page of an inode (it was deleted).
+ *
+ * Frames still mapped stay valid for their mappings.
+ *
+ * @param volume Volume the inode lives on.
+ * @param ino Inode number.
+ */
+void pcache_invalidate(const void *volume, u64 ino);
+
+#endif
@@ -0,0 +1,42 @@
+/**
+ * @file include/alcor2/fs/procfs.h
+ * @brief The @c proc filesystem and the system-wide counters it reports.
+ *
+ * Mounted on @c /proc, it serves read-only text files in the Linux
+ * layouts: @c meminfo, @c stat, @c diskstats, @c slabinfo and one @c stat
+ * per process under @c /proc/<pid>, plus @c heapinfo on the large heap
+ * and @c irqsoff on interrupts-off latency. Each open takes a snapshot,
+ * so a reader sees one consistent set of numbers however it splits its
+ * reads.
+ *
+ * The counters in ::kstat are plain increments on their hot paths; only
+ * the boot CPU runs, so they need no atomics.
+ */
+
+#ifndef ALCOR2_PROCFS_H
+#define ALCOR2_PROCFS_H
+
+#include <alcor2/arch/pic.h>
+#include <alcor2/types.h>
+
+/** @brief Events counted since boot. */
+typedef struct
+{
+  u64 ctxt;                     /**< Context switches. */
+  u64 syscalls;                 /**< System calls. */
+  u64 faults;                   /**< User page faults resolved. */
+  u64 forks;                    /**< Processes created. */
+  u64 irqs[PIC_IRQ_LINE_COUNT]; /**< Interrupts per legacy IRQ line. */
+  u64 lapic_timer;              /**< Local APIC timer interrupts. */
+  u64 msi;                      /**< MSI and MSI-X interrupts. */
+  u64 idle_ns;                  /**< Time with nothing to run. */
+  u64 sys_ns;                   /**< Time running system calls. */
+} kstat_t;
+
+/** @brief The counters, updated where the events happen. */
+extern kstat_t kstat;
+
+/** @brief Register the @c proc filesystem type. */
+void procfs_init(void);
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @file include/alcor2/fs/ramfs.h
+ * @brief In-memory filesystem.
+ *
+ * There is one ramfs tree; every @c ramfs mount shows it. File data lives
+ * in page frames that the page cache maps directly.
+ */
+
+#ifndef ALCOR2_RAMFS_H
+#define ALCOR2_RAMFS_H
+
+#include <alcor2/types.h>
+
+/** @brief Create the root directory and register the @c ramfs type. */
+void ramfs_init(void);
+
+/**
+ * @brief Create @p path in the tree, with any missing parent directories.
+ *
+ * Works without a process or a mount, so boot code can fill the tree
+ * before anything runs.
+ *
+ * @param path Normalised absolute path.
+ * @param type ::VFS_FILE or ::VFS_DIRECTORY.
+ * @param data Contents of a file (@p size bytes); ignored for a directory.
+ * @param size Length of @p data.
+ * @return 0 on success, also when a directory already exists; an existing
+ *         file is overwritten.
+ * @retval -ENOTDIR      A parent component is a file.
+ * @retval -EEXIST       @p path exists with the other type.
+ * @retval -ENAMETOOLONG A component does not fit ::VFS_NAME_MAX.
+ * @retval -ENOMEM       Out of memory.
+ */
+i64 ramfs_install(const char *path, u8 type, const void *data, u64 size);
+
+/**
+ * @brief Create an unlinked file and open it read-write (memfd_create).
+ *
+ * The file lives in frames like any other ramfs file, so every MAP_SHARED
+ * mapping of it, in any process, is the same memory. It is freed when the
+ * last fd and mapping go.
+ *
+ * @param name Label only; shown as @c memfd:name and truncated to fit.
+ * @param sealable Allow F_ADD_SEALS (otherwise F_SEAL_SEAL is set).
+ * @param flags Extra open flags (@c O_CLOEXEC).
+ * @return New fd, or negative errno.
+ */
+i64 ramfs_memfd(const char *name, bool sealable, u32 flags);
+
+#endif
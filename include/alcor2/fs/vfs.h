@@ -20,8 +20,12 @@
  *
  * @par Pipe integration
  * Pipes bypass the filesystem driver: their ::vfs_oft_entry_t carries a
- * non-NULL @c pipe pointer and a ::VFS_KIND_PIPE_RD or ::VFS_KIND_PIPE_WR
+ * non-NULL @c obj pointer and a ::VFS_KIND_PIPE_RD or ::VFS_KIND_PIPE_WR
  * kind.  The @c ops and @c handle fields are @c NULL for pipe entries.
+ * Epoll instances, eventfds, timerfds, perf events, submission rings and
+ * sockets are kernel objects of the same sort (::VFS_KIND_EPOLL,
+ * ::VFS_KIND_EVENTFD, ::VFS_KIND_TIMERFD, ::VFS_KIND_PERF,
+ * ::VFS_KIND_URING, ::VFS_KIND_SOCKET).
  *
  * @par Mount resolution
  * Path lookup performs longest-prefix matching over the mount table.  All
@@ -29,8 +33,9 @@
  * @c . and @c .. resolved — so drivers always receive a clean relative path.
  *
  * @par Working directory
- * The current working directory is stored per-process in @c proc_t::cwd.
- * Relative paths supplied to any VFS function are anchored there.
+ * The current working directory is stored per-process in @c proc_t::cwd,
+ * with an open handle on it in @c proc_t::cwd_oft.  Relative paths supplied
+ * to any VFS function are anchored there.
  */
 
 #ifndef ALCOR2_VFS_H
@@ -44,6 +49,8 @@
 #define VFS_PATH_MAX 256
 /** @brief Maximum open file descriptors per process. */
 #define VFS_MAX_FD 256
+/** @brief @c dirfd value meaning "relative to the working directory". */
+#define VFS_AT_FDCWD (-100)
 
 /** @name Node types
  *
@@ -64,6 +71,19 @@
  */
 typedef void *fs_handle_t;
 
+/**
+ * @brief One buffer of a vectored transfer, laid out like POSIX
+ *        @c struct @c iovec.
+ */
+typedef struct
+{
+  void *base; /**< Start of the buffer. */
+  u64   len;  /**< Bytes at @c base. */
+} vfs_iovec_t;
+
+/** @brief Buffers a vectored transfer may name (POSIX @c IOV_MAX). */
+#define VFS_IOV_MAX 1024
+
 /** @brief Magic @c st_dev value reported for all ramfs inodes. */
 #define VFS_RAMFS_ST_DEV 0x726D667300000001ULL
 
@@ -83,6 +103,22 @@ typedef struct
   u64 ino;      /**< Inode number; unique within a mounted volume. */
 } vfs_stat_t;
 
+/**
+ * @brief Receives one entry from a driver's @c iterate callback.
+ *
+ * @param ctx  Context passed to @c iterate.
+ * @param name Entry name (not NUL-terminated).
+ * @param len  Name length in bytes.
+ * @param ino  Inode number.
+ * @param type ::VFS_FILE or ::VFS_DIRECTORY.
+ * @param next Directory position just past this entry.
+ * @return true to continue, false if the entry was not taken (buffer full);
+ *         the driver then stops without consuming it.
+ */
+typedef bool (*vfs_filldir_t)(
+    void *ctx, const char *name, u32 len, u64 ino, u8 type, u64 next
+);
+
 /**
  * @brief Filesystem driver operations table.
  *
@@ -102,6 +138,20 @@ typedef struct
    */
   fs_handle_t (*open)(void *fs_data, const char *path, u32 flags);
 
+  /**
+   * @brief Open an existing node at @p path relative to directory @p dir.
+   *
+   * Lets relative lookups start from an open directory instead of walking
+   * from the mount root.  Never called with @c O_CREAT.
+   *
+   * @param dir    Directory handle returned by @c open.
+   * @param path   Clean relative path (no @c . or @c .. components) that
+   *               does not cross a mount point.
+   * @param flags  Open flags.
+   * @return Opaque handle on success, @c NULL on failure.
+   */
+  fs_handle_t (*open_at)(fs_handle_t dir, const char *path, u32 flags);
+
   /**
    * @brief Release resources held by @p fh.  Must not block.
    * @param fh  Handle returned by @c open; never @c NULL.
@@ -120,6 +170,19 @@ typedef struct
    */
   i64 (*write)(fs_handle_t fh, const void *buf, u64 count, u64 offset);
 
+  /**
+   * @brief Write @p iovcnt buffers back to back from @p offset on.
+   *
+   * Optional; without it the VFS calls @c write once per buffer. A driver
+   * that has per-call costs (block mapping, a partial block read back and
+   * written out) provides it so a gather write pays them once.
+   *
+   * @return Bytes written, or negative @c -errno.
+   */
+  i64 (*writev)(
+      fs_handle_t fh, const vfs_iovec_t *iov, u32 iovcnt, u64 offset
+  );
+
   /**
    * @brief Create a directory at @p path.
    * @return 0 on success, negative @c -errno on failure.
@@ -162,6 +225,21 @@ typedef struct
    */
   i64 (*readdir)(fs_handle_t fh, u64 index, char *name, vfs_stat_t *st);
 
+  /**
+   * @brief Pass directory entries from position @p pos on to @p fill.
+   *
+   * Optional; preferred over @c readdir by getdents. Positions are opaque
+   * cookies chosen by the driver (0 = start), so each call resumes where
+   * the last one stopped instead of counting entries from the start.
+   *
+   * @param fh   Open directory handle.
+   * @param pos  Position to start from.
+   * @param fill Called per entry until it returns false or entries run out.
+   * @param ctx  Passed to @p fill.
+   * @return 0 on success, negative @c -errno on failure.
+   */
+  i64 (*iterate)(fs_handle_t fh, u64 pos, vfs_filldir_t fill, void *ctx);
+
   /**
    * @brief Truncate @p fh to exactly @p length bytes.
    * @return 0 on success, negative @c -errno on failure.
@@ -178,6 +256,68 @@ typedef struct
    * @return Target length on success, negative @c -errno on failure.
    */
   i64 (*readlink)(void *fs_data, const char *path, char *buf, u64 cap);
+
+  /**
+   * @brief Commit the data and metadata of @p fh to stable storage.
+   * @return 0 on success, negative @c -errno on failure.
+   */
+  i64 (*fsync)(fs_handle_t fh);
+
+  /**
+   * @brief Commit everything written to the volume to stable storage.
+   * @return 0 on success, negative @c -errno on failure.
+   */
+  i64 (*sync)(void *fs_data);
+
+  /**
+   * @brief Hint that bytes [offset, offset + count) of @p fh will be read.
+   *
+   * Optional. The driver may start reading them in the background and
+   * returns without waiting; later reads find the data already cached.
+   */
+  void (*readahead)(fs_handle_t fh, u64 offset, u64 count);
+
+  /**
+   * @brief Move data between @p fh and pinned pages, bypassing the caches.
+   *
+   * Optional; backs @c O_DIRECT. The data starts @p first bytes into the
+   * page at @p pages[0] and runs on through the following pages. A driver
+   * that cannot carry out a particular request unbuffered (one that is not
+   * block-aligned, say) returns @c -EOPNOTSUPP and the VFS takes the
+   * buffered path instead.
+   *
+   * @param write  true to write the pages to the file, false to read.
+   * @param pages  Physical addresses of the pages, pinned by the caller.
+   * @return Bytes transferred (reads stop at end-of-file), or @c -errno.
+   */
+  i64 (*direct)(
+      fs_handle_t fh, bool write, const u64 *pages, u32 first, u64 count,
+      u64 offset
+  );
+
+  /**
+   * @brief Return the frame holding page @p index of a memory-backed file.
+   *
+   * Drivers that keep file data in page-sized frames set this; the page
+   * cache then maps their frames directly and reads go straight to the
+   * driver instead of through cached copies.
+   *
+   * @return Physical address with a new reference for the caller (dropped
+   *         with @c pmm_free), or @c NULL on failure.
+   */
+  void *(*get_page)(fs_handle_t fh, u64 index);
+
+  /**
+   * @brief Add @p add to the seals of @p fh (0 only reads them).
+   *
+   * Optional; files without it cannot be sealed. The driver enforces the
+   * seals on write and truncate, the VFS on shared writable mappings.
+   *
+   * @return Seals now in effect, @c -EPERM if @c F_SEAL_SEAL forbids new
+   *         ones, @c -EBUSY if @c F_SEAL_WRITE meets a mapped page, or
+   *         negative @c -errno.
+   */
+  i64 (*seal)(fs_handle_t fh, u32 add);
 } fs_ops_t;
 
 /**
@@ -210,11 +350,24 @@ typedef struct
 #define O_CREAT  0x0040 /**< Create the file if it does not exist. */
 #define O_TRUNC  0x0200 /**< Truncate to zero length on open. */
 #define O_APPEND 0x0400 /**< All writes advance to end-of-file first. */
+#define O_DIRECT 0x4000 /**< Aligned transfers bypass the caches. */
+#define O_NONBLOCK                                                             \
+  0x0800 /**< Socket calls fail with @c EAGAIN rather than block. */
 #define O_DIRECTORY                                                            \
   0x10000                 /**< Fail if path does not resolve to a directory. */
 #define O_CLOEXEC 0x80000 /**< Close this fd automatically on @c execve. */
 /** @} */
 
+/** @name File seals (@c fcntl @c F_ADD_SEALS, Linux values)
+ * @{ */
+#define F_SEAL_SEAL         0x0001 /**< No more seals may be added. */
+#define F_SEAL_SHRINK       0x0002 /**< The file may not get smaller. */
+#define F_SEAL_GROW         0x0004 /**< The file may not get larger. */
+#define F_SEAL_WRITE        0x0008 /**< The contents may not change. */
+#define F_SEAL_FUTURE_WRITE 0x0010 /**< No new ways to change them. */
+#define F_SEAL_ALL          0x001F
+/** @} */
+
 /** @name Seek origins (POSIX)
  * @{ */
 #define SEEK_SET 0 /**< Offset is relative to the beginning of the file. */
@@ -244,6 +397,19 @@ typedef struct
   char d_name[]; /**< NUL-terminated filename. */
 } PACKED dirent_t;
 
+/**
+ * @brief Readahead state of an open file, kept by the page cache.
+ *
+ * Zero (the state of a fresh OFT entry) means a read from the start of the
+ * file counts as sequential, with readahead not yet started.
+ */
+typedef struct
+{
+  u64 next;   /**< Page a sequential reader asks for next. */
+  u64 ahead;  /**< End of the pages already hinted to the driver. */
+  u32 window; /**< Pages read past a request; 0 while reads are random. */
+} vfs_readahead_t;
+
 /**
  * @brief VFS-level Open File Description.
  *
@@ -251,21 +417,30 @@ typedef struct
  * shared across descriptors created with @c dup and across @c fork ; the
  * reference count tracks how many per-process fd slots point here.
  *
- * @note For pipe entries, @c ops and @c handle are @c NULL.  Use @c pipe and
- *       @c kind to distinguish direction.
+ * @note For pipe, epoll, eventfd, timerfd and perf entries, @c ops and
+ *       @c handle are @c NULL.  Use @c obj and @c kind to tell them
+ *       apart.
  */
 typedef struct
 {
   fs_handle_t     handle; /**< Driver handle; @c NULL for pipes. */
   const fs_ops_t *ops;    /**< Driver operations; @c NULL for pipes. */
-  void           *pipe;   /**< Opaque pipe object; @c NULL for regular files. */
-  u64             offset; /**< Current byte offset (or entry index for dirs). */
+  void           *obj;    /**< Pipe or epoll object; @c NULL for files. */
+  u64             offset; /**< Byte offset; for dirs the driver's position. */
   u32             flags;  /**< Open flags: @c O_RDONLY, @c O_APPEND, etc. */
-  i32             kind;   /**< ::VFS_KIND_FILE, ::VFS_KIND_PIPE_RD, or
-                               ::VFS_KIND_PIPE_WR. */
-  i32  refcount;          /**< Number of fd slots sharing this description. */
-  u64  st_dev;            /**< Cached device ID (used by @c fstat). */
-  bool in_use;            /**< @c true when this slot is allocated. */
+  i32             kind;   /**< ::VFS_KIND_FILE, ::VFS_KIND_PIPE_RD,
+                               ::VFS_KIND_PIPE_WR, ::VFS_KIND_EPOLL,
+                               ::VFS_KIND_EVENTFD, ::VFS_KIND_TIMERFD,
+                               ::VFS_KIND_PERF, ::VFS_KIND_URING or
+                               ::VFS_KIND_SOCKET. */
+  i32             refcount; /**< Number of fd slots sharing this description. */
+  u64             st_dev;   /**< Cached device ID (used by @c fstat). */
+  void           *volume;   /**< Owning mount's @c fs_data (page-cache key). */
+  u64             ino;      /**< Inode number at open (page-cache key). */
+  u8              type;     /**< Node type at open (::VFS_FILE, ...). */
+  vfs_readahead_t ra;       /**< Sequential-read tracking (page cache). */
+  char           *path;     /**< Absolute path of a directory, else NULL. */
+  bool            in_use;   /**< @c true when this slot is allocated. */
 } vfs_oft_entry_t;
 
 /** @name OFT kind — also used as pipe-direction argument to @c pipe_oft_release
@@ -273,6 +448,22 @@ typedef struct
 #define VFS_KIND_FILE    0 /**< Regular file. */
 #define VFS_KIND_PIPE_RD 1 /**< Pipe, read end. */
 #define VFS_KIND_PIPE_WR 2 /**< Pipe, write end. */
+#define VFS_KIND_EPOLL   3 /**< Epoll instance. */
+#define VFS_KIND_EVENTFD 4 /**< eventfd counter. */
+#define VFS_KIND_TIMERFD 5 /**< timerfd timer. */
+#define VFS_KIND_PERF    6 /**< perf_event_open counter. */
+#define VFS_KIND_URING   7 /**< Submission/completion ring. */
+#define VFS_KIND_SOCKET  8 /**< TCP or UDP socket. */
+/** @} */
+
+/** @name Readiness bits reported by ::vfs_poll (Linux poll/epoll values)
+ * @{ */
+#define VFS_POLL_IN   0x001 /**< Data to read, without blocking. */
+#define VFS_POLL_PRI  0x002 /**< Urgent data (never reported). */
+#define VFS_POLL_OUT  0x004 /**< Room to write, without blocking. */
+#define VFS_POLL_ERR  0x008 /**< Error, e.g. no reader left on a pipe. */
+#define VFS_POLL_HUP  0x010 /**< No writer left on a pipe. */
+#define VFS_POLL_NVAL 0x020 /**< Not an open descriptor. */
 /** @} */
 
 /**
@@ -296,6 +487,9 @@ i64 vfs_register_fs(const fs_type_t *fstype);
 /**
  * @brief Mount @p source at @p target using the named filesystem driver.
  *
+ * A target that is already mounted on is covered: lookups go to the new
+ * mount, while files already open on the old one stay usable.
+ *
  * @param source  Device identifier forwarded to the driver's @c mount callback.
  * @param target  Absolute mount-point path (normalised internally).
  * @param fstype  Name of a previously registered filesystem type.
@@ -319,6 +513,22 @@ i64 vfs_mount(const char *source, const char *target, const char *fstype);
  */
 i64 vfs_open(const char *path, u32 flags);
 
+/**
+ * @brief Open @p path relative to directory fd @p dirfd.
+ *
+ * Relative paths under an open directory (or under the working directory
+ * for ::VFS_AT_FDCWD) are looked up by the driver starting from that
+ * directory's inode when it supports @c open_at and no mount is crossed.
+ *
+ * @param dirfd  Directory fd, or ::VFS_AT_FDCWD.
+ * @param path   Absolute path, or path relative to @p dirfd.
+ * @param flags  Open flags, as for ::vfs_open.
+ * @return New file descriptor on success, or negative @c -errno.
+ * @retval -EBADF    @p dirfd is not open.
+ * @retval -ENOTDIR  @p dirfd is not a directory.
+ */
+i64 vfs_openat(i64 dirfd, const char *path, u32 flags);
+
 /**
  * @brief Release a file descriptor.
  *
@@ -352,6 +562,64 @@ i64 vfs_read(i64 fd, void *buf, u64 count);
  */
 i64 vfs_write(i64 fd, const void *buf, u64 count);
 
+/**
+ * @brief Read into @p iovcnt buffers in turn, as one ::vfs_read.
+ *
+ * The fd is resolved once. A pipe fills the buffers under one hold of its
+ * lock; a file stops at the first short buffer.
+ *
+ * @return Bytes read in total, or negative @c -errno if none were.
+ */
+i64 vfs_readv(i64 fd, const vfs_iovec_t *iov, u32 iovcnt);
+
+/**
+ * @brief Write @p iovcnt buffers in turn, as one ::vfs_write.
+ *
+ * The fd is resolved and @c O_APPEND applied once; drivers with a
+ * @c writev op take the whole vector in one call.
+ *
+ * @return Bytes written in total, or negative @c -errno if none were.
+ */
+i64 vfs_writev(i64 fd, const vfs_iovec_t *iov, u32 iovcnt);
+
+/**
+ * @brief Write @p count bytes from @p buf to @p fd at @p offset.
+ *
+ * The file offset of @p fd is neither used nor moved.
+ *
+ * @return Bytes written, or negative @c -errno.
+ * @retval -ESPIPE  @p fd refers to a pipe.
+ */
+i64 vfs_pwrite(i64 fd, const void *buf, u64 count, u64 offset);
+
+/**
+ * @brief Receives file data from ::vfs_sendfile.
+ * @param ctx    Context passed to ::vfs_sendfile.
+ * @param buf    Kernel pointer into a page-cache page.
+ * @param count  Bytes available at @p buf.
+ * @return Bytes consumed (fewer stops the transfer), or negative @c -errno.
+ */
+typedef i64 (*vfs_sink_t)(void *ctx, const void *buf, u64 count);
+
+/**
+ * @brief Feed up to @p count bytes of a regular file to @p sink.
+ *
+ * The data is handed over straight from page-cache pages, so it never
+ * passes through a user buffer.
+ *
+ * @param in_fd   Regular file to read.
+ * @param offset  Read position, advanced by the bytes sent; @c NULL to use
+ *                and advance the file offset of @p in_fd instead.
+ * @param count   Maximum number of bytes.
+ * @param sink    Destination callback.
+ * @param ctx     Passed to @p sink.
+ * @return Bytes sent (0 at end-of-file), or negative @c -errno.
+ * @retval -EINVAL  @p in_fd is not a regular file.
+ */
+i64 vfs_sendfile(
+    i64 in_fd, u64 *offset, u64 count, vfs_sink_t sink, void *ctx
+);
+
 /**
  * @brief Reposition the file offset of @p fd.
  *
@@ -371,6 +639,15 @@ i64 vfs_seek(i64 fd, i64 offset, i32 whence);
  */
 i64 vfs_stat(const char *path, vfs_stat_t *st);
 
+/**
+ * @brief Stat @p path relative to directory fd @p dirfd.
+ *
+ * Resolution follows ::vfs_openat.
+ *
+ * @return 0 on success, or negative @c -errno.
+ */
+i64 vfs_statat(i64 dirfd, const char *path, vfs_stat_t *st);
+
 /**
  * @brief Stat an open file descriptor.
  *
@@ -418,6 +695,22 @@ i64 vfs_getdents(i64 fd, void *buf, u64 count);
  */
 i64 vfs_ftruncate(i64 fd, u64 length);
 
+/**
+ * @brief Write @p fd's cached data back and wait for it to reach the disk.
+ *
+ * Dirty MAP_SHARED pages go to the driver first, then the driver's @c fsync
+ * commits the file. Drivers without one (ramfs) have nothing to commit.
+ *
+ * @return 0 on success, @c -EINVAL if @p fd is a pipe, or negative @c -errno.
+ */
+i64 vfs_fsync(i64 fd);
+
+/**
+ * @brief Write every open file's cached data back, then sync every mount.
+ * @return 0 on success, or the first error reported by a driver.
+ */
+i64 vfs_sync(void);
+
 /**
  * @brief Read the target of the symbolic link at @p path.
  *
@@ -470,11 +763,13 @@ const char *vfs_getcwd(void);
  */
 i64 vfs_chdir(const char *path);
 
+struct proc;
+
 /**
- * @brief Initialise a per-process fd array to the "all closed" state.
- * @param fds  Array of ::VFS_MAX_FD @c i32 values to initialise.
+ * @brief Initialise a process's fd table to the "all closed" state.
+ * @param p  Process whose fd array and open-fd bitmap are reset.
  */
-void vfs_proc_init_fds(i32 *fds);
+void vfs_proc_init_fds(struct proc *p);
 
 /**
  * @brief Inherit parent's fd table into child's after @c fork.
@@ -482,24 +777,20 @@ void vfs_proc_init_fds(i32 *fds);
  * Copies every open fd slot and calls ::vfs_oft_retain for each, so parent
  * and child hold independent references to the same OFT entries.
  *
- * @param child_fds   Destination fd array (written).
- * @param child_clox  Destination cloexec bitmap (written).
- * @param parent_fds  Source fd array (read-only).
- * @param parent_clox Source cloexec bitmap (read-only).
+ * @param child   Destination process (fd table, cloexec flags, bitmap).
+ * @param parent  Source process (read-only).
  */
-void vfs_proc_inherit_fds(
-    i32 *child_fds, u8 *child_clox, const i32 *parent_fds, const u8 *parent_clox
-);
+void vfs_proc_inherit_fds(struct proc *child, const struct proc *parent);
 
 /**
  * @brief Release all file descriptors held by an exiting process.
  *
  * Calls ::vfs_oft_release for every open slot.  Entries whose refcount reaches
- * zero are torn down.  All slots in @p fds are set to -1 on return.
+ * zero are torn down.  All slots of @p p are closed on return.
  *
- * @param fds  Per-process fd array to drain.
+ * @param p  Process whose fd table is drained.
  */
-void vfs_proc_release_fds(i32 *fds);
+void vfs_proc_release_fds(struct proc *p);
 
 /**
  * @brief Close every fd in the calling process that has @c FD_CLOEXEC set.
@@ -508,6 +799,26 @@ void vfs_proc_release_fds(i32 *fds);
  */
 void vfs_proc_close_cloexec_fds(void);
 
+/** @brief One fd action of a spawn: dup2(fd, target), or close(fd) when
+ *  @c target is negative (as posix_spawn file actions). */
+typedef struct
+{
+  i32 fd;
+  i32 target;
+} vfs_fd_action_t;
+
+/**
+ * @brief Set up a spawned child's fd table, inherited from its parent: run
+ *        @p acts in order, then close the close-on-exec fds.
+ *
+ * Closing an fd that is not open is not an error. A target fd of a dup2
+ * is left open across the exec, as posix_spawn leaves it.
+ *
+ * @return 0, or @c -EBADF if a dup2 source is not open or an fd is out of
+ *         range (actions before it have run).
+ */
+i64 vfs_proc_spawn_fds(struct proc *p, const vfs_fd_action_t *acts, u32 n);
+
 /**
  * @brief Duplicate @p oldfd, placing the clone at the lowest free fd ≥ 3.
  * @return New file descriptor on success, @c -EBADF if @p oldfd is invalid.
@@ -524,17 +835,29 @@ i64 vfs_dup(i64 oldfd);
  */
 i64 vfs_dup2(i64 oldfd, i64 newfd);
 
+struct poll_table;
+
 /**
- * @brief Check whether @p fd has data available without blocking.
- * @return Positive if ready, 0 if not ready, negative @c -errno on error.
+ * @brief Report the readiness of an open file description.
+ *
+ * With a poll table, the caller is also registered on the wait queues that
+ * are woken when the readiness changes.  Regular files are always ready.
+ *
+ * @param idx OFT slot index.
+ * @param pt  Poll table, or NULL to only query.
+ * @return ::VFS_POLL_IN and friends, or @c -EBADF.
  */
-i32 vfs_select_read_ready(i64 fd);
+i32 vfs_oft_poll(i32 idx, struct poll_table *pt);
+
+/** @brief ::vfs_oft_poll for a descriptor of the calling process. */
+i32 vfs_poll(i64 fd, struct poll_table *pt);
 
 /**
- * @brief Check whether @p fd can accept a write without blocking.
- * @return Positive if ready, 0 if not ready, negative @c -errno on error.
+ * @brief Pass a readahead hint for bytes [offset, offset + count) of
+ *        @p fd to its driver, if it is a regular file and the driver
+ *        takes hints (see ::fs_ops_t @c readahead).
  */
-i32 vfs_select_write_ready(i64 fd);
+void vfs_readahead(i64 fd, u64 offset, u64 count);
 
 /** @return @c true if @p fd refers to either end of a pipe. */
 bool vfs_fd_is_pipe(u64 fd);
@@ -554,13 +877,57 @@ bool vfs_fd_is_valid(i64 fd);
 i64 vfs_install_fd(i32 oft_idx);
 
 /**
- * @brief Allocate an OFT entry for one end of a pipe.
+ * @brief Allocate an OFT entry for a kernel object.
  *
- * @param kind  ::VFS_KIND_PIPE_RD or ::VFS_KIND_PIPE_WR.
- * @param pipe  Opaque pipe object returned by @c pipe_alloc_obj.
+ * @param kind  ::VFS_KIND_PIPE_RD or ::VFS_KIND_PIPE_WR for a pipe end from
+ *              @c pipe_alloc_obj, ::VFS_KIND_EPOLL for an epoll instance,
+ *              ::VFS_KIND_EVENTFD for an eventfd, ::VFS_KIND_TIMERFD for
+ *              a timerfd, ::VFS_KIND_PERF for a perf event,
+ *              ::VFS_KIND_URING for a submission ring or ::VFS_KIND_SOCKET
+ *              for a socket.
+ * @param obj   The object.
  * @return OFT index on success, negative @c -errno on failure.
  */
-i32 vfs_oft_alloc_pipe(i32 kind, void *pipe);
+i32 vfs_oft_alloc_obj(i32 kind, void *obj);
+
+/**
+ * @brief Install an fd for a driver handle that no path leads to.
+ *
+ * For files created unlinked (@c memfd_create). On failure @p fh is closed.
+ *
+ * @param ops Driver operations for @p fh.
+ * @param volume Volume the handle belongs to (its mount's @c fs_data).
+ * @param fh Open handle; the fd owns it from here on.
+ * @param flags Open flags (access mode, @c O_CLOEXEC).
+ * @return New fd, or negative @c -errno.
+ */
+i64 vfs_open_handle(
+    const fs_ops_t *ops, void *volume, fs_handle_t fh, u32 flags
+);
+
+/**
+ * @brief Add seals to (or, with @p add 0, read the seals of) an OFT slot.
+ * @return Seals now in effect, or @c -EINVAL if the file cannot be sealed;
+ *         see the @c seal op for the rest.
+ */
+i64 vfs_oft_seals(i32 idx, u32 add);
+
+/**
+ * @brief Translate a file descriptor of the calling process to its OFT slot.
+ * @return OFT index on success, @c -EBADF if @p fd is not open.
+ */
+i32 vfs_fd_to_oft(i64 fd);
+
+/**
+ * @brief Look up an OFT slot.
+ *
+ * Used by subsystems that keep a file alive through a retained OFT slot
+ * rather than an fd (file mmap, page cache).
+ *
+ * @param idx  OFT slot index.
+ * @return Entry, or @c NULL if @p idx is out of range or not in use.
+ */
+const vfs_oft_entry_t *vfs_oft_get(i32 idx);
 
 /**
  * @brief Increment the refcount of OFT slot @p idx.
@@ -577,7 +944,10 @@ void vfs_oft_retain(i32 idx);
  *
  * When the count reaches zero the entry is torn down: the driver's @c close
  * callback is invoked for file entries; ::pipe_oft_release is called for pipe
- * entries with the stored kind.
+ * entries with the stored kind, ::epoll_oft_release for epoll entries,
+ * ::eventfd_oft_release for eventfds, ::timerfd_oft_release for timerfds,
+ * ::perf_oft_release for perf events and ::sock_oft_release for sockets.
+ * Epoll instances stop watching the entry.
  *
  * @param idx  OFT slot index; silently ignored if out of range or not in use.
  */
@@ -42,6 +42,13 @@ typedef enum
   KBD_LAYOUT_COUNT
 } kbd_layout_t;
 
+/**
+ * @brief Install the line discipline as the keyboard IRQ bottom half.
+ *
+ * Call before keyboard_init() unmasks the IRQ.
+ */
+void kbd_init(void);
+
 void         kbd_set_layout(kbd_layout_t layout);
 kbd_layout_t kbd_get_layout(void);
 
@@ -51,12 +58,15 @@ u64 kbd_read_translated(char *buf, u64 count);
 /**
  * @brief read(2) on stdin using this process's termios (ICANON/!ICANON,
  * VMIN/VTIME).
+ *
+ * The termios also becomes the mode the IRQ-time line discipline edits in.
+ * @return Bytes read, or @c -EINTR if a signal arrived while blocked.
  */
 u64 kbd_read_for_process(struct proc *p, char *buf, u64 count);
 
 /**
  * True when select(2) on fd 0 should mark the fd readable: a read(2) can return
- * a byte (or out_pend holds CSI bytes). Key-up scancodes alone do not count.
+ * without blocking (a whole line in canonical mode, any byte otherwise).
  */
 bool kbd_raw_pending(void);
 
@@ -14,6 +14,13 @@
 
 #include <alcor2/types.h>
 
+/**
+ * @brief Pick the memory routines' large-size strategy for this CPU.
+ *
+ * Safe to skip or call late: until then large copies use REP MOVSQ.
+ */
+void kstdlib_init(void);
+
 /**
  * @brief Copy memory region.
  * @param dst Destination.
@@ -39,6 +46,30 @@ void *kmemset(void *dst, int val, u64 n);
  */
 void kzero(void *dst, u64 n);
 
+/**
+ * @brief Zero a large region without pulling it into the cache.
+ *
+ * Non-temporal stores (MOVNTI, no FPU state involved); for memory that
+ * will not be read soon, such as a fresh huge page.
+ *
+ * @param dst Destination, 8-byte aligned.
+ * @param n Byte count, a multiple of 32.
+ */
+void kzero_nt(void *dst, u64 n);
+
+/**
+ * @brief Copy a region without pulling the destination into the cache.
+ *
+ * Non-temporal stores (MOVNTI) for writes to write-combining memory such
+ * as the framebuffer. No alignment is required; any tail of less than a
+ * word is stored normally.
+ *
+ * @param dst Destination.
+ * @param src Source.
+ * @param n Byte count.
+ */
+void kmemcpy_nt(void *dst, const void *src, u64 n);
+
 /**
  * @brief Get string length.
  * @param s String.
@@ -50,6 +50,16 @@ _Static_assert(sizeof(k_termios_t) == KTERM_SZ, "k_termios_t must be 60 bytes");
 #define KTERM_VTIME  5
 #define KTERM_VMIN   6
 
+/**
+ * ioctl(request), no argument, on either end of a pipe: mark the pipe as
+ * relaying a terminal, so both ends answer the TTY ioctls (and isatty())
+ * as the console does. Unmarked pipes and redirected stdio are not
+ * terminals, which lets stdio buffer output to them fully.
+ *
+ * Mirrors musl `_IO('P', 1)` encoding.
+ */
+#define ALCOR2_IOC_PIPE_SET_TTY ((0x50U << 8) | 1U)
+
 void ktermios_init_default(k_termios_t *t);
 
 #endif
@@ -3,7 +3,8 @@
  * @brief Limine bootloader protocol definitions.
  *
  * Structures and macros for interacting with the Limine bootloader.
- * Provides framebuffer, memory map, HHDM offset, and module loading.
+ * Provides framebuffer, memory map, HHDM offset, module loading, the
+ * application processors, the kernel command line and the ACPI RSDP.
  */
 
 #ifndef ALCOR2_LIMINE_H
@@ -38,6 +39,21 @@
   {                                                                            \
     LIMINE_MAGIC_0, LIMINE_MAGIC_1, 0x3e7e279702be32af, 0xca1c4f3bd1280cee     \
   }
+
+#define LIMINE_SMP_REQUEST_ID                                                  \
+  {                                                                            \
+    LIMINE_MAGIC_0, LIMINE_MAGIC_1, 0x95a67b819a1b857e, 0xa0b61b723b6a73e0     \
+  }
+
+#define LIMINE_EXECUTABLE_FILE_REQUEST_ID                                      \
+  {                                                                            \
+    LIMINE_MAGIC_0, LIMINE_MAGIC_1, 0xad97e90e83f1ed67, 0x31eb5d1c5ff23b69     \
+  }
+
+#define LIMINE_RSDP_REQUEST_ID                                                 \
+  {                                                                            \
+    LIMINE_MAGIC_0, LIMINE_MAGIC_1, 0xc5e77b6b397e7b43, 0x27637845accdcf3c     \
+  }
 /** @} */
 
 /** @name Memory map entry types
@@ -207,6 +223,25 @@ struct limine_file
   u8    part_uuid[16];
 };
 
+/**
+ * @brief Executable file response: the kernel image and its command line.
+ */
+struct limine_executable_file_response
+{
+  u64                 revision;
+  struct limine_file *executable_file;
+};
+
+/**
+ * @brief Executable file request structure.
+ */
+struct limine_executable_file_request
+{
+  u64                                     id[4];
+  u64                                     revision;
+  struct limine_executable_file_response *response;
+};
+
 /**
  * @brief Module response from bootloader.
  */
@@ -229,4 +264,62 @@ struct limine_module_request
   struct limine_file           **internal_modules;
 };
 
+/**
+ * @brief One processor, as reported by the SMP response.
+ *
+ * An AP spins in the bootloader until @c goto_address is written; it then
+ * jumps there with this structure as its only argument, on a small stack
+ * in bootloader-reclaimable memory.
+ */
+struct limine_smp_info
+{
+  u32 processor_id;
+  u32 lapic_id;
+  u64 reserved;
+  void (*volatile goto_address)(struct limine_smp_info *info);
+  u64 extra_argument; /**< Free for the kernel to pass a pointer. */
+};
+
+/**
+ * @brief SMP response from bootloader.
+ */
+struct limine_smp_response
+{
+  u64                      revision;
+  u32                      flags;
+  u32                      bsp_lapic_id;
+  u64                      cpu_count;
+  struct limine_smp_info **cpus;
+};
+
+/**
+ * @brief SMP request structure.
+ */
+struct limine_smp_request
+{
+  u64                         id[4];
+  u64                         revision;
+  struct limine_smp_response *response;
+  u64                         flags; /**< Bit 0: enable x2APIC if possible. */
+};
+
+/**
+ * @brief RSDP response from bootloader.
+ */
+struct limine_rsdp_response
+{
+  u64 revision;
+  u64 address; /**< Physical address of the RSDP (base revision 3). */
+};
+
+/**
+ * @brief RSDP request structure.
+ */
+struct limine_rsdp_request
+{
+  u64                          id[4];
+  u64                          revision;
+  struct limine_rsdp_response *response;
+};
+
 #endif
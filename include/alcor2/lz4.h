@@ -0,0 +1,42 @@
+/**
+ * @file include/alcor2/lz4.h
+ * @brief LZ4 block compression.
+ *
+ * Raw LZ4 blocks (no frame header or checksum), as the reference
+ * LZ4_compress_default() / LZ4_decompress_safe() produce and accept.
+ */
+
+#ifndef ALCOR2_LZ4_H
+#define ALCOR2_LZ4_H
+
+#include <alcor2/types.h>
+
+/** @brief log2 of the match finder's hash table entries. */
+#define LZ4_HASH_LOG   12
+/** @brief Bytes of scratch lz4_compress() needs. */
+#define LZ4_WORK_SIZE  ((1U << LZ4_HASH_LOG) * sizeof(u32))
+/** @brief Largest input lz4_compress() accepts. */
+#define LZ4_MAX_INPUT  (64U * 1024)
+
+/**
+ * @brief Compress @p n bytes into an LZ4 block.
+ * @param src Input.
+ * @param n Input bytes (at most ::LZ4_MAX_INPUT).
+ * @param dst Output.
+ * @param cap Output capacity.
+ * @param work Scratch of ::LZ4_WORK_SIZE bytes, 4-byte aligned.
+ * @return Compressed size, or 0 if it would not fit in @p cap.
+ */
+u32 lz4_compress(const void *src, u32 n, void *dst, u32 cap, void *work);
+
+/**
+ * @brief Decompress an LZ4 block, never reading or writing out of bounds.
+ * @param src Compressed block.
+ * @param n Its size.
+ * @param dst Output.
+ * @param cap Output capacity.
+ * @return Decompressed size, or -1 if the block is malformed or too big.
+ */
+i64 lz4_decompress(const void *src, u32 n, void *dst, u32 cap);
+
+#endif
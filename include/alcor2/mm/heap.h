@@ -2,14 +2,30 @@
  * @file include/alcor2/mm/heap.h
  * @brief Kernel heap allocator.
  *
- * Simple free-list based dynamic memory allocator for the kernel.
+ * Small requests (up to KMALLOC_MAX_SMALL bytes) are served from
+ * segregated size-class slabs; larger ones fall back to a first-fit free
+ * list. Dedicated object caches (kmem_cache_*) share the slab layer.
+ *
+ * Every cache counts its allocations, frees and peak use, and the large
+ * heap does the same plus a survey of its free list, for /proc/slabinfo
+ * and /proc/heapinfo. Building with @c HEAP_TAG_SITES=1 also attributes
+ * each allocation to the code that made it (see ::heap_site_t).
  */
 
 #ifndef ALCOR2_HEAP_H
 #define ALCOR2_HEAP_H
 
+#include <alcor2/spinlock.h>
 #include <alcor2/types.h>
 
+/** @brief 1 to record the call site of every allocation. */
+#ifndef HEAP_TAG_SITES
+#define HEAP_TAG_SITES 0
+#endif
+
+/** @brief Call sites told apart; later ones are merged into slot 0. */
+#define HEAP_SITES 256
+
 /** @brief Initial heap size in 4K pages. */
 #define HEAP_INITIAL_PAGES 16
 
@@ -24,7 +40,9 @@ typedef struct heap_block
   u32                magic;
   u32                size;
   u8                 free;
-  u8                 reserved[7];
+  u8                 reserved;
+  u16                site; /**< ::heap_site_t index, with HEAP_TAG_SITES. */
+  u8                 pad[4];
   struct heap_block *next;
   struct heap_block *prev;
 } PACKED heap_block_t;
@@ -35,6 +53,95 @@ typedef struct heap_block
 /** @brief Minimum allocation size in bytes. */
 #define HEAP_MIN_ALLOC 32
 
+/** @brief Smallest kmalloc size class in bytes. */
+#define KMALLOC_MIN_SMALL 16
+
+/** @brief Largest kmalloc request served from slabs. */
+#define KMALLOC_MAX_SMALL 2048
+
+/** @brief Number of kmalloc size classes (16, 32, ..., 2048). */
+#define KMALLOC_CLASSES 8
+
+/** @brief Buddy order of the slabs backing kmalloc size classes. */
+#define KMALLOC_SLAB_ORDER 1
+
+/** @brief Magic number for slab header validation. */
+#define KMEM_SLAB_MAGIC 0x51AB51AB
+
+/** @brief Maximum number of object caches (including kmalloc classes). */
+#define KMEM_MAX_CACHES 32
+
+/** @brief Object constructor, run once per object when its slab is made. */
+typedef void (*kmem_ctor_t)(void *obj);
+
+struct kmem_cache;
+
+/**
+ * @brief Slab header, stored at the start of each (order-aligned) slab.
+ */
+typedef struct kmem_slab
+{
+  u32                magic;
+  u32                inuse;
+  struct kmem_cache *cache;
+  void              *free;
+  struct kmem_slab  *next;
+  struct kmem_slab  *prev;
+} kmem_slab_t;
+
+/**
+ * @brief Cache of equally sized objects carved out of slabs.
+ */
+typedef struct kmem_cache
+{
+  const char  *name;
+  u32          obj_size;
+  u32          stride;   /**< Slot size (object + free link if ctor). */
+  u32          free_off; /**< Offset of the free-list link in a slot. */
+  u32          order;    /**< Buddy order of each slab. */
+  u32          per_slab;
+  u32          first; /**< Offset of the first object in a slab. */
+  kmem_ctor_t  ctor;
+  kmem_slab_t *partial; /**< Slabs with at least one free object. */
+  kmem_slab_t *full;
+  kmem_slab_t *empty; /**< At most one spare slab kept for reuse. */
+  u64          slabs;
+  u64          objs_inuse;
+  u64          objs_peak; /**< Most objects in use at once. */
+  u64          allocs;
+  u64          frees;
+  spinlock_t   lock; /**< Guards the slab lists and counters. */
+} kmem_cache_t;
+
+/** @brief Large-heap counters and the shape of its free list. */
+typedef struct
+{
+  u64 used;         /**< Bytes handed out. */
+  u64 size;         /**< Bytes mapped for it. */
+  u64 peak;         /**< Most bytes handed out at once. */
+  u64 allocs;
+  u64 frees;
+  u64 free_blocks;  /**< Blocks on the free list. */
+  u64 free_bytes;   /**< Bytes in them. */
+  u64 largest_free; /**< Biggest request that fits without growing. */
+} heap_stats_t;
+
+/**
+ * @brief Allocations made from one call site (with HEAP_TAG_SITES).
+ *
+ * Slab objects are charged the object size of their cache, large blocks
+ * their rounded size. Slot 0 collects what came from sites past the
+ * table's end.
+ */
+typedef struct
+{
+  u64 site; /**< Return address into the caller; 0 if the slot is free. */
+  u64 allocs;
+  u64 frees;
+  u64 live;      /**< Bytes still allocated. */
+  u64 live_peak; /**< Most bytes allocated at once. */
+} heap_site_t;
+
 /**
  * @brief Initialize the kernel heap.
  */
@@ -68,4 +175,46 @@ void kfree(void *ptr);
  */
 void *krealloc(void *ptr, u64 new_size);
 
+/**
+ * @brief Create an object cache.
+ * @param name Cache name (not copied).
+ * @param size Object size in bytes.
+ * @param ctor Optional constructor run on each object of a new slab; freed
+ *             objects must be returned in their constructed state.
+ * @return Cache handle, or NULL if the cache table is full.
+ */
+kmem_cache_t *kmem_cache_create(const char *name, u32 size, kmem_ctor_t ctor);
+
+/**
+ * @brief Allocate an object from a cache.
+ * @param cache Cache handle.
+ * @return Object pointer, or NULL on failure.
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/**
+ * @brief Return an object to its cache.
+ * @param cache Cache the object was allocated from.
+ * @param obj Object pointer, or NULL (ignored).
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/**
+ * @brief Counters of the large-block heap (requests above
+ *        KMALLOC_MAX_SMALL), its free list walked under the heap lock.
+ */
+void heap_stats(heap_stats_t *out);
+
+/**
+ * @brief Copy of call-site slot @p i.
+ * @return false past the last slot, or in a build without HEAP_TAG_SITES.
+ */
+bool heap_site_get(u32 i, heap_site_t *out);
+
+/**
+ * @brief Object cache number @p i, kmalloc classes first.
+ * @return The cache, or NULL past the last one.
+ */
+const kmem_cache_t *kmem_cache_get(u32 i);
+
 #endif
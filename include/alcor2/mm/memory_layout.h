@@ -15,12 +15,21 @@
  * Higher-half kernel mapping (0xFFFF800000000000 and above)
  * @{ */
 
+/** @brief Start of the kernel half; mappings above it are global. */
+#define KERNEL_SPACE_BASE 0xFFFF800000000000ULL
+
 /** @brief Kernel heap base address */
 #define KERNEL_HEAP_BASE 0xFFFFFFFF90000000ULL
 
 /** @brief Kernel heap initial address for debug display */
 #define KERNEL_HEAP_BASE_DISPLAY 0x90000000
 
+/** @brief Window for device register (MMIO) mappings, see vmm_map_mmio() */
+#define KERNEL_MMIO_BASE 0xFFFFFFFFF0000000ULL
+
+/** @brief End of the MMIO window (exclusive) */
+#define KERNEL_MMIO_END 0xFFFFFFFFFF000000ULL
+
 /** @} */
 
 /** @name User Virtual Address Space
@@ -37,12 +46,21 @@
 /** @brief User stack base (matches @c PROC_USER_STACK = 8 MiB). */
 #define USER_STACK_BASE (USER_STACK_TOP - (8ULL * 1024 * 1024))
 
+/** @brief vvar page; the vDSO image follows it (see alcor2/proc/vdso.h). */
+#define USER_VDSO_BASE 0x00007FFF00100000ULL
+
 /** @brief User heap start for brk() allocations (1GB) */
 #define USER_HEAP_START 0x0000000040000000ULL
 
 /* 256 GiB; must stay below USER_SPACE_END */
 #define USER_MMAP_BASE 0x0000000400000000ULL
 
+/** @brief Load address of a position-independent (ET_DYN) executable. */
+#define USER_PIE_BASE 0x0000555555554000ULL
+
+/** @brief Load address of the program interpreter (PT_INTERP). */
+#define USER_INTERP_BASE 0x00007F0000000000ULL
+
 /** @} */
 
 /** @name Page Table Manipulation
@@ -2,18 +2,22 @@
  * @file include/alcor2/mm/pmm.h
  * @brief Physical memory manager (page allocator).
  *
- * Bitmap-based allocator for 4K physical pages.
+ * Buddy allocator for 4K physical pages (orders 0..PMM_MAX_ORDER).
  */
 
 #ifndef ALCOR2_PMM_H
 #define ALCOR2_PMM_H
 
+#include <alcor2/alcor_memstat.h>
 #include <alcor2/limine.h>
 #include <alcor2/types.h>
 
 /** @brief Size of a physical page. */
 #define PAGE_SIZE 4096
 
+/** @brief Largest buddy block order (2^10 pages = 4MB). */
+#define PMM_MAX_ORDER 10
+
 /**
  * @brief Initialize the physical memory manager.
  * @param memmap Limine memory map response.
@@ -29,13 +33,47 @@ void *pmm_alloc(void);
 
 /**
  * @brief Allocate multiple contiguous pages.
+ *
+ * A power-of-two @p count up to 2^PMM_MAX_ORDER is aligned to its size.
+ *
  * @param count Number of pages.
  * @return Physical address of the first page, or NULL on failure.
  */
 void *pmm_alloc_pages(usize count);
 
 /**
- * @brief Free a single page.
+ * @brief Allocate 2^@p order contiguous pages, aligned to their size, only
+ *        if a free block is at hand.
+ *
+ * Unlike pmm_alloc_pages() this neither drains the hot caches nor reclaims,
+ * so it suits opportunistic users (huge pages) that have a fallback.
+ *
+ * @param order Block order (at most PMM_MAX_ORDER).
+ * @return Physical address of the first page, or NULL.
+ */
+void *pmm_try_alloc_order(u32 order);
+
+/**
+ * @brief Allocate a single zero-filled 4K page.
+ *
+ * Served from the pool ::pmm_prezero fills in idle time, or cleared on
+ * the spot when that is empty.
+ *
+ * @return Physical address, or NULL if out of memory.
+ */
+void *pmm_alloc_zeroed(void);
+
+/**
+ * @brief Zero a batch of free pages into the pool behind pmm_alloc_zeroed().
+ *
+ * For the idle loop; runs with interrupts enabled.
+ *
+ * @return false if the pool is full or no free page is left to zero.
+ */
+bool pmm_prezero(void);
+
+/**
+ * @brief Free a single page, or drop one reference if it is shared.
  * @param addr Physical address of the page.
  */
 void pmm_free(void *addr);
@@ -47,6 +85,58 @@ void pmm_free(void *addr);
  */
 void pmm_free_pages(void *addr, usize count);
 
+/**
+ * @brief Add a reference to an allocated page (dropped by pmm_free()).
+ * @param addr Physical address of the page.
+ * @return false if the address is not RAM owned by the PMM.
+ */
+bool pmm_page_ref(void *addr);
+
+/**
+ * @brief Check whether a page has more than one owner.
+ * @param addr Physical address of the page.
+ * @return true if the page is shared.
+ */
+bool pmm_page_shared(void *addr);
+
+/** @brief A cache that can give pages back under memory pressure. */
+typedef struct
+{
+  const char *name; /**< Reported by ::pmm_memstat. */
+  /** Free up to @p nr_pages pages from the LRU tail; returns pages freed. */
+  u64 (*scan)(u64 nr_pages);
+  /** Pages the cache holds now. */
+  u64 (*count)(void);
+  /** Only asked by ::pmm_balance, never by a failing allocation (which
+   * may come from an interrupt). */
+  bool balance_only;
+} pmm_shrinker_t;
+
+/**
+ * @brief Register a cache that can give pages back under memory pressure.
+ *
+ * Shrinkers run, in registration order, when free memory falls below the
+ * low watermark (see ::pmm_balance) and when an allocation would
+ * otherwise fail.
+ *
+ * @param s Shrinker; must outlive the PMM (static).
+ */
+void pmm_register_shrinker(const pmm_shrinker_t *s);
+
+/**
+ * @brief Shrink the caches if free memory is below the low watermark.
+ *
+ * Reclaims until the high watermark is reached or the caches have nothing
+ * left to give. Called by the scheduler and by page faults short of
+ * memory, from process context.
+ *
+ * @return true if anything was freed.
+ */
+bool pmm_balance(void);
+
+/** @brief Fill @p out with memory and per-cache usage. */
+void pmm_memstat(alcor_memstat_t *out);
+
 /**
  * @brief Get total physical memory in bytes.
  * @return Total memory size.
@@ -0,0 +1,63 @@
+/**
+ * @file include/alcor2/mm/swap.h
+ * @brief Compressed swap for anonymous memory.
+ *
+ * When memory runs low, private anonymous pages that have not been touched
+ * since the last pass are compressed into a pool on the kernel heap and
+ * their frames freed. The PTE keeps a swap entry (::VMM_SWAP with the slot
+ * number in the frame bits) until the next access faults the page back in.
+ * A drive carrying a Linux swap signature ("mkswap") extends the pool: the
+ * coldest compressed pages are written out to it once the pool outgrows
+ * its share of RAM.
+ */
+
+#ifndef ALCOR2_SWAP_H
+#define ALCOR2_SWAP_H
+
+#include <alcor2/types.h>
+
+/** @brief Swap usage, in bytes (see ::swap_stats). */
+typedef struct
+{
+  u64 pool;      /**< Heap held by compressed pages. */
+  u64 pooled;    /**< Pages (uncompressed size) held in the pool. */
+  u64 disk;      /**< Size of the swap device, 0 without one. */
+  u64 disk_used; /**< Pages written out to it. */
+} swap_stats_t;
+
+/**
+ * @brief Set up the pool and register the swap shrinker.
+ *
+ * Must run after the heap, ATA and process table are initialised: a swap
+ * device is looked for, and written to by a kernel task.
+ */
+void swap_init(void);
+
+/**
+ * @brief Add a reference to a swap entry (a page table was copied).
+ * @param entry Non-present PTE with ::VMM_SWAP set.
+ */
+void swap_dup(u64 entry);
+
+/**
+ * @brief Drop a reference to a swap entry; the last one frees the slot.
+ * @param entry Non-present PTE with ::VMM_SWAP set.
+ */
+void swap_free(u64 entry);
+
+/**
+ * @brief Read a swapped-out page back.
+ *
+ * May sleep reading from the swap device. The slot holds its contents
+ * until the caller replaces the entry (which frees it).
+ *
+ * @param entry Non-present PTE with ::VMM_SWAP set.
+ * @param page Kernel address of a page to fill.
+ * @return false on I/O error or a stale entry.
+ */
+bool swap_read(u64 entry, void *page);
+
+/** @brief Fill @p out with current usage. */
+void swap_stats(swap_stats_t *out);
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file include/alcor2/mm/uaccess.h
+ * @brief Copying to and from user memory.
+ *
+ * A user pointer is checked against USER_SPACE_END only; whether the pages
+ * behind it exist is left to the copy itself. Faults on user addresses are
+ * demand paging as usual, and a fault the VMAs cannot satisfy makes the
+ * copy return -EFAULT instead of panicking: every instruction that touches
+ * user memory is listed in the @c .ex_table section with the address to
+ * resume at (see ::uaccess_fixup).
+ */
+
+#ifndef ALCOR2_UACCESS_H
+#define ALCOR2_UACCESS_H
+
+#include <alcor2/types.h>
+
+/**
+ * @brief Copy @p n bytes from user address @p src to kernel @p dst.
+ * @return 0, or -EFAULT if part of the source is not readable user memory.
+ */
+int copy_from_user(void *dst, const void *src, u64 n);
+
+/**
+ * @brief Copy @p n bytes from kernel @p src to user address @p dst.
+ * @return 0, or -EFAULT if part of the target is not writable user memory.
+ */
+int copy_to_user(void *dst, const void *src, u64 n);
+
+/**
+ * @brief Copy a NUL-terminated user string into @p dst.
+ * @param dst Kernel buffer of @p size bytes; terminated on success.
+ * @param src User address.
+ * @param size Capacity of @p dst, terminator included.
+ * @return Length without the terminator, -EFAULT, or -ENAMETOOLONG if
+ *         no terminator was found in the first @p size bytes.
+ */
+i64 strncpy_from_user(char *dst, const char *src, u64 size);
+
+/**
+ * @brief Length of a NUL-terminated user string, looking at most @p max
+ *        bytes in.
+ * @return Length without the terminator, @p max if none was found, or
+ *         -EFAULT.
+ */
+i64 strnlen_user(const char *src, u64 max);
+
+/**
+ * @brief Pin the pages behind a user buffer for device DMA.
+ *
+ * Each page is faulted in the way the device will access it (for @p write,
+ * copy-on-write is broken so the device fills the process's own frame)
+ * and gets a frame reference, so it can be neither freed nor swapped out
+ * until unpin_user_pages(). Huge mappings are not pinned.
+ *
+ * @param addr First byte of the buffer.
+ * @param len Length in bytes (non-zero).
+ * @param write The device will write to the pages (a read from disk).
+ * @param pages Out: physical address of every page the buffer spans.
+ * @return Number of pages pinned, or -EFAULT with none left pinned.
+ */
+i64 pin_user_pages(u64 addr, u64 len, bool write, u64 *pages);
+
+/**
+ * @brief Drop the references pin_user_pages() took.
+ * @param pages Physical page addresses.
+ * @param n Number of pages.
+ */
+void unpin_user_pages(const u64 *pages, u64 n);
+
+/**
+ * @brief Find where a faulting user access resumes.
+ *
+ * Called by the page-fault handler for kernel-mode faults on user
+ * addresses that demand paging could not resolve.
+ *
+ * @param rip Faulting instruction pointer.
+ * @return Fixup address, or 0 if @p rip is not a listed user access (a
+ *         kernel bug).
+ */
+u64 uaccess_fixup(u64 rip);
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * @file include/alcor2/mm/vma.h
+ * @brief Per-process virtual memory areas (mmap/brk regions).
+ *
+ * A process keeps its mmap and brk regions in a sorted, non-overlapping
+ * array so the page-fault path can find the region covering an address by
+ * binary search and populate memory on first touch. Each region records
+ * its protection, mapping flags and, for file mappings, the backing file
+ * and offset. File pages come from the page cache (see pagecache.h).
+ */
+
+#ifndef ALCOR2_VMA_H
+#define ALCOR2_VMA_H
+
+#include <alcor2/types.h>
+
+/** @name VMA flags
+ * @{ */
+#define VMA_READ   0x01 /**< PROT_READ */
+#define VMA_WRITE  0x02 /**< PROT_WRITE */
+#define VMA_EXEC   0x04 /**< PROT_EXEC */
+#define VMA_PROT   (VMA_READ | VMA_WRITE | VMA_EXEC)
+#define VMA_ANON   0x10 /**< Demand-zero: pages are faulted in on first touch. */
+#define VMA_HEAP   0x20 /**< brk heap. */
+#define VMA_SHARED 0x40 /**< MAP_SHARED (otherwise private). */
+#define VMA_DEVICE 0x80 /**< Device memory (framebuffer); not PMM-backed. */
+#define VMA_STACK  0x100 /**< User stack: faulted in by page, never huge. */
+/** @} */
+
+/** @brief One mapped region [start, end), both page-aligned. */
+typedef struct
+{
+  u64 start;
+  u64 end;
+  u64 offset; /**< File offset mapped at @c start (file mappings). */
+  i32 file;   /**< Retained OFT slot of the backing file, or -1. */
+  u32 flags;  /**< VMA_* flags. */
+} vma_t;
+
+/** @brief Sorted array of a process's regions. */
+typedef struct
+{
+  vma_t *v;
+  u32    count;
+  u32    cap;
+} vma_list_t;
+
+/**
+ * @brief Release a region list's storage and empty it.
+ *
+ * Dirty MAP_SHARED file pages are written back and file references are
+ * dropped, so call this after the pages themselves have been unmapped.
+ *
+ * @param l Region list.
+ */
+void vma_list_free(vma_list_t *l);
+
+/**
+ * @brief Copy a region list (fork).
+ * @param dst Destination (must be empty).
+ * @param src Source list.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int vma_list_clone(vma_list_t *dst, const vma_list_t *src);
+
+/**
+ * @brief Find the region containing an address.
+ * @param l Region list.
+ * @param addr Address to look up.
+ * @return Region, or NULL if @p addr is not mapped by any region.
+ */
+const vma_t *vma_find(const vma_list_t *l, u64 addr);
+
+/**
+ * @brief Record a new region, merging with compatible neighbours.
+ *
+ * The range must not overlap an existing region (callers vma_remove()
+ * it first, as MAP_FIXED does). Neighbours merge when their flags match
+ * and, for file mappings, the same file continues at the adjacent offset.
+ * On success the list takes over the caller's reference on @c vma->file.
+ *
+ * @param l Region list.
+ * @param vma Region to record (copied).
+ * @return 0 on success, -EEXIST on overlap, -ENOMEM on failure.
+ */
+int vma_insert(vma_list_t *l, const vma_t *vma);
+
+/**
+ * @brief Forget [start, end), splitting regions that straddle its edges.
+ *
+ * Like vma_list_free(), writes back and releases any file backing.
+ *
+ * @param l Region list.
+ * @param start First address (page-aligned).
+ * @param end End address (page-aligned, exclusive).
+ * @return 0 on success, -ENOMEM if a split could not be recorded.
+ */
+int vma_remove(vma_list_t *l, u64 start, u64 end);
+
+/**
+ * @brief Replace the protection bits of every region inside [start, end).
+ * @param l Region list.
+ * @param start First address (page-aligned).
+ * @param end End address (page-aligned, exclusive).
+ * @param prot New VMA_PROT bits.
+ * @return 0 on success, -ENOMEM if a split could not be recorded.
+ */
+int vma_protect(vma_list_t *l, u64 start, u64 end, u32 prot);
+
+/**
+ * @brief Resolve a user page fault from the current process's regions.
+ *
+ * Not-present faults in a demand-zero region map a fresh zeroed page on
+ * write, or the shared zero page on read. In a file region they map the
+ * page-cache frame: shared regions write to it directly, private ones get
+ * it copy-on-write. Other write faults on present pages are handed to
+ * vmm_handle_cow_fault().
+ *
+ * @param addr Faulting address (CR2).
+ * @param err Page-fault error code.
+ * @return true if resolved and the access can be retried.
+ */
+bool vma_handle_fault(u64 addr, u64 err);
+
+/**
+ * @brief Map in, read-only, the not yet mapped pages of the private file
+ *        regions of @p l, as read faults would.
+ *
+ * Pages mapped by fault-around are not counted. Works on the current
+ * address space, which must be the one @p l describes; may sleep.
+ *
+ * @param l Region list.
+ * @param max_pages Most pages to fault in.
+ * @return Pages faulted in; fewer if a page could not be read.
+ */
+u32 vma_prefault(const vma_list_t *l, u32 max_pages);
+
+/**
+ * @brief Make the page at @p addr present and writable from the regions
+ *        of @p l, as a write fault on it would.
+ *
+ * Works on the current address space, which must be the one @p l
+ * describes, so it can serve a process that is not running yet.
+ *
+ * @param l Region list.
+ * @param addr Address in the page.
+ * @return true if the page can now be written.
+ */
+bool vma_fault_write(const vma_list_t *l, u64 addr);
+
+#endif
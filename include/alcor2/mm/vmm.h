@@ -16,8 +16,45 @@
 #define VMM_WRITE   (1ULL << 1)
 #define VMM_USER    (1ULL << 2)
 #define VMM_NX      (1ULL << 63)
+/** Global: survives CR3 loads; set on every kernel-half leaf. */
+#define VMM_GLOBAL  (1ULL << 8)
+/** Software bit: leaf is copy-on-write, or PD entry points at a shared PT. */
+#define VMM_COW     (1ULL << 9)
+/** Software bit: leaf is a MAP_SHARED page; never made copy-on-write. */
+#define VMM_SHARED  (1ULL << 10)
+/** Set by the CPU on the first access through a leaf. */
+#define VMM_ACCESSED (1ULL << 5)
+/** Software bit of a non-present leaf: the page is swapped out and the
+ * frame bits hold its slot (see mm/swap.h). */
+#define VMM_SWAP    (1ULL << 11)
+/** PWT | PCD: device registers, never cached. */
+#define VMM_NOCACHE ((1ULL << 3) | (1ULL << 4))
+/** PWT alone, which selects PAT entry 1; vmm_pat_init() makes that
+ * write-combining (without PAT it stays write-through). Same bit in
+ * 4 KiB and 2 MiB leaves. */
+#define VMM_WC      (1ULL << 3)
 /** @} */
 
+/** @name Page-fault error code bits
+ * @{ */
+#define VMM_PF_PRESENT (1ULL << 0) /**< Protection fault on a present page */
+#define VMM_PF_WRITE   (1ULL << 1) /**< Faulting access was a write */
+#define VMM_PF_USER    (1ULL << 2) /**< Fault raised in user mode */
+/** @} */
+
+/** @brief Bytes mapped by one 2 MiB page-directory leaf (huge page). */
+#define VMM_HUGE_SIZE  (2ULL * 1024 * 1024)
+/** @brief 4 KiB pages in a huge page. */
+#define VMM_HUGE_PAGES (VMM_HUGE_SIZE / 4096)
+/** @brief PMM block order of a huge page. */
+#define VMM_HUGE_ORDER 9
+
+/** @brief True if the leaf @p e is a swap entry rather than a mapping. */
+static inline bool vmm_is_swap(u64 e)
+{
+  return (e & (VMM_PRESENT | VMM_SWAP)) == VMM_SWAP;
+}
+
 /** @brief Kernel higher-half base address. */
 #define KERNEL_BASE 0xFFFFFFFF80000000ULL
 
@@ -27,6 +64,24 @@
  */
 void vmm_init(u64 hhdm_offset);
 
+/**
+ * @brief Make PAT entry 1 write-combining on this CPU (see ::VMM_WC).
+ *
+ * vmm_init() calls it on the BSP and vmm_init_cpu() on every AP, as the
+ * SDM wants all processors to agree on the PAT. The other entries are
+ * left alone.
+ */
+void vmm_pat_init(void);
+
+/**
+ * @brief Set the calling AP's paging up as vmm_init() did the BSP's: PAT,
+ *        global pages, PCIDs and CR0.WP. It must run on the kernel PML4.
+ */
+void vmm_init_cpu(void);
+
+/** @brief Physical address of the kernel's PML4, loaded while idle. */
+u64 vmm_kernel_pml4(void);
+
 /**
  * @brief Map a virtual page to a physical page.
  * @param virt Virtual address.
@@ -35,6 +90,23 @@ void vmm_init(u64 hhdm_offset);
  */
 void vmm_map(u64 virt, u64 phys, u64 flags);
 
+/**
+ * @brief Map a 2 MiB page in the current address space.
+ *
+ * Both addresses must be 2 MiB aligned. A huge leaf holds one reference on
+ * each of its 4 KiB frames, exactly as 512 PTEs would, and is split back
+ * into a PT whenever part of it is remapped, unmapped or copied on write.
+ *
+ * @param virt Virtual address.
+ * @param phys Physical address.
+ * @param flags Page flags (VMM_PRESENT is added).
+ * @return false, changing nothing, if anything is mapped in the range.
+ */
+bool vmm_map_huge(u64 virt, u64 phys, u64 flags);
+
+/** @brief vmm_map_huge() in the address space @p pml4_phys. */
+bool vmm_map_huge_in(u64 pml4_phys, u64 virt, u64 phys, u64 flags);
+
 /**
  * @brief Allocate and map a range of consecutive virtual pages.
  *
@@ -50,12 +122,60 @@ void vmm_map(u64 virt, u64 phys, u64 flags);
  */
 bool vmm_map_range_alloc(u64 virt_start, u64 count, u64 flags);
 
+/**
+ * @brief Map device registers (an MMIO BAR) uncached into kernel space.
+ *
+ * Mappings are carved from the KERNEL_MMIO_BASE window, are visible in
+ * every address space and are never removed.
+ *
+ * @param phys Physical base address (need not be page-aligned).
+ * @param size Size of the register block in bytes.
+ * @return Virtual address of @p phys, or NULL if the window is full.
+ */
+void *vmm_map_mmio(u64 phys, u64 size);
+
+/**
+ * @brief Map memory write-combined into kernel space (a framebuffer).
+ *
+ * Like vmm_map_mmio(), from the same window, but stores are gathered into
+ * bursts instead of going to the device one at a time.
+ *
+ * @param phys Physical base address (need not be page-aligned).
+ * @param size Size in bytes.
+ * @return Virtual address of @p phys, or NULL if the window is full.
+ */
+void *vmm_map_wc(u64 phys, u64 size);
+
 /**
  * @brief Unmap a virtual page.
  * @param virt Virtual address.
  */
 void vmm_unmap(u64 virt);
 
+/**
+ * @brief Unmap and free a user range of the current address space.
+ *
+ * Walks the paging structures once, skipping absent levels, and frees
+ * every PT/PD/PDPT the range covers completely along with its pages, as
+ * well as tables it leaves empty. The TLB is flushed once at the end.
+ *
+ * @param start First address (page-aligned).
+ * @param end End address (page-aligned, exclusive).
+ */
+void vmm_unmap_range(u64 start, u64 end);
+
+/**
+ * @brief Change the flags of every present page in a user range.
+ *
+ * Pages still shared copy-on-write stay read-only until written. Like
+ * ::vmm_unmap_range, walks once and flushes the TLB once.
+ *
+ * @param start First address (page-aligned).
+ * @param end End address (page-aligned, exclusive).
+ * @param flags New page flags (VMM_PRESENT is implied).
+ */
+void vmm_protect_range(u64 start, u64 end, u64 flags);
+
 /**
  * @brief Get physical address for virtual address.
  * @param virt Virtual address.
@@ -64,7 +184,51 @@ void vmm_unmap(u64 virt);
 u64 vmm_get_phys(u64 virt);
 
 /**
- * @brief Switch to a different page table.
+ * @brief Get the 4 KiB leaf entry for a user address, present or not.
+ * @param virt Virtual address in the current address space.
+ * @return The entry, or 0 if there is none (huge leaves included).
+ */
+u64 vmm_get_leaf(u64 virt);
+
+/**
+ * @brief Visitor for ::vmm_walk_private.
+ * @return true to stop the walk.
+ */
+typedef bool (*vmm_leaf_fn)(u64 pml4_phys, u64 virt, u64 *pte, void *arg);
+
+/**
+ * @brief Visit the present 4 KiB leaves of [start, end) in the page tables
+ *        @p pml4_phys does not share with another address space.
+ *
+ * Fork-shared PTs and huge leaves are skipped. The visitor may rewrite the
+ * entry, followed by ::vmm_flush_page_in.
+ *
+ * @param pml4_phys Address space, current or not.
+ * @param start First address (page-aligned).
+ * @param end End address (page-aligned, exclusive).
+ * @param fn Visitor.
+ * @param arg Passed to @p fn.
+ * @return Address after the page the visitor stopped at, or @p end.
+ */
+u64 vmm_walk_private(
+    u64 pml4_phys, u64 start, u64 end, vmm_leaf_fn fn, void *arg
+);
+
+/**
+ * @brief Drop the TLB entry of one page of any address space.
+ *
+ * The current one gets an invlpg; another loses its PCID tags, so the
+ * next switch to it flushes, and CPUs that have it loaded are sent a
+ * shootdown. Called under the kernel lock.
+ *
+ * @param pml4_phys Address space.
+ * @param virt Page whose PTE changed.
+ */
+void vmm_flush_page_in(u64 pml4_phys, u64 virt);
+
+/**
+ * @brief Switch the calling CPU to a different page table, keeping its TLB
+ *        entries if it still has one of that CPU's PCID tags.
  * @param pml4_phys Physical address of PML4.
  */
 void vmm_switch(u64 pml4_phys);
@@ -91,12 +255,40 @@ u64 vmm_create_address_space(void);
 void vmm_map_in(u64 pml4_phys, u64 virt, u64 phys, u64 flags);
 
 /**
- * @brief Clone user mappings for fork.
+ * @brief Clone user mappings for fork (copy-on-write).
  * @param src_pml4 Source PML4 physical address.
  * @return New PML4 physical address with cloned mappings.
  */
 u64 vmm_clone_address_space(u64 src_pml4_phys);
 
+/**
+ * @brief Physical address of the shared, always-zero page.
+ *
+ * Mapped read-only (VMM_COW when the region is writable) for reads of
+ * untouched anonymous memory; never freed.
+ *
+ * @return Physical address.
+ */
+u64 vmm_zero_page(void);
+
+/**
+ * @brief Resolve a write fault on a copy-on-write page.
+ * @param virt Faulting address.
+ * @return true if resolved (retry the access), false for a real fault.
+ */
+bool vmm_handle_cow_fault(u64 virt);
+
+/**
+ * @brief Count the user pages an address space has resident.
+ *
+ * Mappings of the shared zero page are not counted, as they hold no memory
+ * of their own.
+ *
+ * @param pml4_phys Physical address of PML4.
+ * @return Resident 4 KB pages (a 2 MB page counts as 512).
+ */
+u64 vmm_user_pages(u64 pml4_phys);
+
 /**
  * @brief Destroy all user mappings in an address space.
  * @param pml4_phys Physical address of PML4.
@@ -131,6 +323,31 @@ static inline void *phys_to_virt(u64 phys)
   return (void *)(phys + vmm_get_hhdm());
 }
 
+/**
+ * @brief Convert an HHDM virtual address back to physical.
+ * @param virt Virtual address in HHDM region.
+ * @return Physical address.
+ */
+static inline u64 virt_to_phys(const void *virt)
+{
+  return (u64)virt - vmm_get_hhdm();
+}
+
+/**
+ * @brief Physical address of any kernel buffer (for device DMA).
+ *
+ * HHDM addresses convert directly; the kernel image and heap live above
+ * KERNEL_BASE and are looked up in the page tables.
+ *
+ * @param virt Kernel virtual address.
+ * @return Physical address, or 0 if not mapped.
+ */
+static inline u64 vmm_kernel_phys(const void *virt)
+{
+  return (u64)virt >= KERNEL_BASE ? vmm_get_phys((u64)virt)
+                                  : virt_to_phys(virt);
+}
+
 /**
  * @brief Check if pointer is in user space.
  * @param ptr Pointer to check.
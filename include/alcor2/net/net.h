@@ -0,0 +1,224 @@
+/**
+ * @file include/alcor2/net/net.h
+ * @brief Network stack core: packet buffers, the interface, Ethernet/ARP,
+ *        IPv4 and ICMP.
+ *
+ * @par Packet buffers
+ * A ::netbuf_t is one physical page: the descriptor at its start, then
+ * ::NETBUF_HEADROOM bytes into which each layer pushes its header on the
+ * way down, then the packet. Payload may instead be attached by reference
+ * as fragments of other pages (a TCP send buffer, the page cache); each
+ * fragment holds a page reference until the buffer is freed, so the NIC
+ * reads the data where it already lies and nothing is copied on transmit.
+ *
+ * @par Context
+ * Received frames are processed by the driver's interrupt handler and
+ * socket calls run with interrupts off, so the stack needs no locks; only
+ * the boot CPU runs. All addresses and ports outside the wire headers are
+ * kept in host byte order.
+ */
+
+#ifndef ALCOR2_NET_H
+#define ALCOR2_NET_H
+
+#include <alcor2/types.h>
+
+/** @brief Bytes before the packet reserved for the headers of each layer. */
+#define NETBUF_HEADROOM 256
+/** @brief Payload fragments a buffer can reference. */
+#define NETBUF_FRAGS    4
+
+#define ETH_ALEN      6
+#define ETH_HLEN      14
+#define ETH_MTU       1500
+#define ETH_P_IP      0x0800
+#define ETH_P_ARP     0x0806
+#define IP_HLEN       20
+#define IP_PROTO_ICMP 1
+#define IP_PROTO_TCP  6
+#define IP_PROTO_UDP  17
+
+/** @brief A slice of a referenced page. */
+typedef struct
+{
+  u64 phys; /**< Physical address of the first byte. */
+  u32 len;
+} net_frag_t;
+
+/** @brief One packet (see the file comment). */
+typedef struct netbuf
+{
+  struct netbuf *next;                /**< Queue link for the owner. */
+  u8            *data;                /**< First byte of the packet. */
+  u32            len;                 /**< Bytes at @c data. */
+  u32            nfrags;              /**< Used entries of @c frags. */
+  net_frag_t     frags[NETBUF_FRAGS]; /**< Payload after @c data. */
+  /** @brief TX offload: the device sums from byte @c csum_start to the
+   *         end and stores the sum @c csum_off bytes past the start;
+   *         @c csum_off is 0 when the checksum is already filled in. */
+  u16            csum_start;
+  u16            csum_off;
+  bool           csum_ok; /**< RX: the device verified the checksum. */
+  u32            saddr;   /**< RX: IPv4 source, for the sockets. */
+  u16            sport;   /**< RX: transport source port. */
+} netbuf_t;
+
+/** @brief The network interface, filled in by its driver. */
+typedef struct netif
+{
+  u8   mac[ETH_ALEN];
+  u32  ip; /**< Address, netmask and default gateway. */
+  u32  netmask;
+  u32  gateway;
+  bool tx_csum; /**< The device fills in TCP and UDP checksums. */
+  /** @brief Queue frame @p nb (Ethernet header first); takes ownership. */
+  void (*xmit)(struct netif *nif, netbuf_t *nb);
+  u64  rx_packets;
+  u64  rx_bytes;
+  u64  rx_dropped;
+  u64  tx_packets;
+  u64  tx_bytes;
+  u64  tx_dropped;
+} netif_t;
+
+/** @name Byte order
+ * @{ */
+static inline u16 net_htons(u16 v)
+{
+  return __builtin_bswap16(v);
+}
+
+static inline u32 net_htonl(u32 v)
+{
+  return __builtin_bswap32(v);
+}
+
+#define net_ntohs net_htons
+#define net_ntohl net_htonl
+/** @} */
+
+/** @brief IPv4 address @p a.@p b.@p c.@p d in host order. */
+#define NET_IP4(a, b, c, d)                                                    \
+  ((u32)(a) << 24 | (u32)(b) << 16 | (u32)(c) << 8 | (u32)(d))
+
+/** @name Packet buffers
+ * @{ */
+
+/** @brief A fresh buffer with empty data at ::NETBUF_HEADROOM, or NULL. */
+netbuf_t *netbuf_alloc(void);
+
+/** @brief Free @p nb and drop its fragments' page references. */
+void netbuf_free(netbuf_t *nb);
+
+/** @brief Free a whole @c next-linked list. */
+void netbuf_free_list(netbuf_t *nb);
+
+/** @brief Grow the packet by @p n bytes at the front; returns them. */
+u8 *netbuf_push(netbuf_t *nb, u32 n);
+
+/** @brief Drop @p n bytes from the front of the packet. */
+void netbuf_pull(netbuf_t *nb, u32 n);
+
+/** @brief Append @p n bytes inside the page; NULL if they do not fit. */
+u8 *netbuf_put(netbuf_t *nb, u32 n);
+
+/**
+ * @brief Attach @p len bytes at physical @p phys as payload, taking a
+ *        reference on their page (the slice must not cross a page).
+ * @return false if every fragment slot is in use.
+ */
+bool netbuf_add_frag(netbuf_t *nb, u64 phys, u32 len);
+
+/** @brief Bytes in the packet, fragments included. */
+u32 netbuf_total(const netbuf_t *nb);
+
+/**
+ * @brief Copy @p len bytes of the packet, from byte @p off, into @p dst.
+ * @return Bytes copied (fewer if the packet ends first).
+ */
+u32 netbuf_copy(const netbuf_t *nb, u32 off, void *dst, u32 len);
+/** @} */
+
+/** @name Checksums
+ * @{ */
+
+/**
+ * @brief Add @p len bytes to a one's-complement sum.
+ * @param at Offset of @p buf within the summed data (its parity matters).
+ */
+u64 net_csum_add(u64 sum, const void *buf, u64 len, u64 at);
+
+/** @brief Sum of a whole packet, fragments included, from byte 0. */
+u64 net_csum_netbuf(u64 sum, const netbuf_t *nb);
+
+/** @brief Fold @p sum to 16 bits and complement it (host order). */
+u16 net_csum_fold(u64 sum);
+
+/** @brief Sum of the TCP/UDP pseudo-header. */
+u64 net_csum_pseudo(u32 src, u32 dst, u8 proto, u32 len);
+/** @} */
+
+/** @name Interface
+ * @{ */
+
+/** @brief Make @p nif the interface; its driver calls this once. */
+void net_attach(netif_t *nif);
+
+/** @brief The interface, or NULL if there is no NIC. */
+netif_t *net_if(void);
+
+/**
+ * @brief A frame arrived; @p nb starts at its Ethernet header.
+ *        Consumes @p nb. Called by the driver with interrupts off.
+ */
+void net_rx(netif_t *nif, netbuf_t *nb);
+
+/** @brief Work the drivers and the stack need once per tick. */
+void net_tick(void);
+/** @} */
+
+/** @name Ethernet and ARP
+ * @{ */
+
+/** @brief Handle a received Ethernet frame (consumes @p nb). */
+void eth_input(netif_t *nif, netbuf_t *nb);
+
+/**
+ * @brief Send IPv4 packet @p nb to @p next_hop, resolving its MAC
+ *        address first if needed (consumes @p nb).
+ */
+void eth_output_ip(netif_t *nif, netbuf_t *nb, u32 next_hop);
+
+/** @brief Retry unanswered ARP requests and age the cache (per tick). */
+void arp_tick(void);
+/** @} */
+
+/** @name IPv4 and ICMP
+ * @{ */
+
+/** @brief Handle a received IPv4 packet, from its header (consumes @p nb). */
+void ip_input(netif_t *nif, netbuf_t *nb);
+
+/**
+ * @brief Send @p nb, which starts at a transport header, from @p src to
+ *        @p dst (consumes @p nb).
+ * @return 0, or @c -ENETUNREACH without an interface or route.
+ */
+i64 ip_output(netbuf_t *nb, u32 src, u32 dst, u8 proto);
+
+/**
+ * @brief Deliver the packets sent to a local address since the last call.
+ *
+ * Socket calls run it before they sleep or return, and net_tick() for
+ * what timers sent; a protocol never sees its own packets while it is
+ * still in the middle of sending them.
+ *
+ * @return Whether any packet was delivered.
+ */
+bool ip_loopback_run(void);
+
+/** @brief Handle a received ICMP message (consumes @p nb). */
+void icmp_input(netif_t *nif, netbuf_t *nb, u32 src, u32 dst);
+/** @} */
+
+#endif
@@ -0,0 +1,154 @@
+/**
+ * @file include/alcor2/net/sock.h
+ * @brief Sockets: the object behind a socket fd, and the TCP and UDP
+ *        protocol entry points it uses.
+ *
+ * A socket lives in the open file table as a ::VFS_KIND_SOCKET entry whose
+ * object is a ::sock_t. socket.c turns the BSD socket syscalls into calls
+ * on the protocol below; tcp.c and udp.c never see user sockaddrs. All
+ * functions run with interrupts off, and those that block sleep on the
+ * socket's @c wq, which the protocol wakes on every state change.
+ */
+
+#ifndef ALCOR2_NET_SOCK_H
+#define ALCOR2_NET_SOCK_H
+
+#include <alcor2/net/net.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/time.h>
+#include <alcor2/types.h>
+
+/** @name Socket types and shutdown bits (Linux values)
+ * @{ */
+#define SOCK_STREAM 1
+#define SOCK_DGRAM  2
+#define SHUT_RD_BIT 1 /**< No more receives (shutdown SHUT_RD adds it). */
+#define SHUT_WR_BIT 2 /**< No more sends. */
+/** @} */
+
+/** @brief recv/send flags the protocols understand. */
+#define MSG_PEEK     0x02
+#define MSG_DONTWAIT 0x40
+
+struct tcp_pcb;
+
+/** @brief A socket (the @c obj of a ::VFS_KIND_SOCKET entry). */
+typedef struct sock
+{
+  u8              type;      /**< ::SOCK_STREAM or ::SOCK_DGRAM. */
+  u8              shut;      /**< ::SHUT_RD_BIT, ::SHUT_WR_BIT. */
+  bool            bound;     /**< Has a local port. */
+  bool            connected; /**< UDP: has a default destination. */
+  u32             laddr;     /**< Local address and port (host order). */
+  u16             lport;
+  u32             raddr; /**< Peer address and port. */
+  u16             rport;
+  i32             error;    /**< Pending error for SO_ERROR (-errno). */
+  u64             rcvtimeo; /**< SO_RCVTIMEO in ns, 0 for none. */
+  u64             sndtimeo; /**< SO_SNDTIMEO in ns, 0 for none. */
+  wait_queue_t    wq;       /**< Readers, writers and pollers. */
+  netbuf_t       *rx_head;  /**< UDP: datagrams not yet read. */
+  netbuf_t       *rx_tail;
+  u32             rx_bytes;
+  struct tcp_pcb *pcb;  /**< TCP: the connection. */
+  struct sock    *next; /**< UDP: bound-socket list link. */
+} sock_t;
+
+/** @brief Deadline for a blocking call under timeout @p timeo (0: none). */
+static inline u64 sock_deadline(u64 timeo)
+{
+  return timeo ? time_monotonic_ns() + timeo : 0;
+}
+
+/**
+ * @brief Sleep on @p s until woken, its timeout passes or a signal comes.
+ * @param deadline ::time_monotonic_ns to give up at, 0 for none.
+ * @return 0 if woken, @c -EAGAIN if @p nonblock or timed out, @c -EINTR.
+ */
+i64 sock_wait(sock_t *s, bool nonblock, u64 deadline);
+
+/** @brief Source address for packets from @p s to @p dst. */
+u32 sock_src_addr(const sock_t *s, u32 dst);
+
+/** @name TCP
+ * @{ */
+
+/** @brief Give @p s a closed connection; @c -ENOMEM if none is left. */
+i64 tcp_attach(sock_t *s);
+
+/** @brief Bind to @p port (0 for an ephemeral one). */
+i64 tcp_bind(sock_t *s, u32 addr, u16 port);
+
+/** @brief Start accepting up to @p backlog pending connections. */
+i64 tcp_listen(sock_t *s, u32 backlog);
+
+/**
+ * @brief Connect to @p addr:@p port.
+ * @return 0 once established, @c -EINPROGRESS if @p nonblock, or -errno.
+ */
+i64 tcp_connect(sock_t *s, u32 addr, u16 port, bool nonblock);
+
+/**
+ * @brief Take an established connection off the listen queue.
+ * @param child Receives a new socket for it.
+ */
+i64 tcp_accept(sock_t *s, sock_t **child, bool nonblock);
+
+/** @brief Queue @p len bytes from @p buf, copying them. */
+i64 tcp_send(sock_t *s, const void *buf, u64 len, bool nonblock);
+
+/**
+ * @brief Queue @p len bytes at physical @p phys by reference (sendfile).
+ *
+ * The connection takes a reference on the page and transmits from it
+ * until the peer acknowledges the bytes; the slice must not cross a page.
+ *
+ * @return @p len, or -errno if nothing was queued.
+ */
+i64 tcp_send_page(sock_t *s, u64 phys, u32 len, bool nonblock);
+
+/** @brief Read up to @p len bytes; @p flags may include ::MSG_PEEK. */
+i64 tcp_recv(sock_t *s, void *buf, u64 len, u32 flags, bool nonblock);
+
+/** @brief Stop sending (::SHUT_WR_BIT set in @p how) and/or receiving. */
+i64 tcp_shutdown(sock_t *s, u32 how);
+
+/** @brief The fd is gone: close gracefully and let go of @p s. */
+void tcp_close(sock_t *s);
+
+/** @brief ::VFS_POLL_IN and friends. */
+u32 tcp_poll(sock_t *s);
+
+/** @brief Receive a segment, from its TCP header (consumes @p nb). */
+void tcp_input(netbuf_t *nb, u32 src, u32 dst);
+/** @} */
+
+/** @name UDP
+ * @{ */
+
+/** @brief Bind to @p port (0 for an ephemeral one). */
+i64 udp_bind(sock_t *s, u32 addr, u16 port);
+
+/** @brief Send one datagram of @p len bytes to @p addr:@p port. */
+i64 udp_sendto(sock_t *s, const void *buf, u64 len, u32 addr, u16 port);
+
+/**
+ * @brief Receive one datagram, truncated to @p len bytes.
+ * @param addr Receives the sender's address and @p port its port, if set.
+ */
+i64 udp_recvfrom(
+    sock_t *s, void *buf, u64 len, u32 flags, bool nonblock, u32 *addr,
+    u16 *port
+);
+
+/** @brief The fd is gone: unbind and drop queued datagrams. */
+void udp_close(sock_t *s);
+
+/** @brief ::VFS_POLL_IN and friends. */
+u32 udp_poll(sock_t *s);
+
+/** @brief Receive a datagram, from its UDP header (consumes @p nb). */
+void udp_input(netbuf_t *nb, u32 src, u32 dst);
+/** @} */
+
+#endif
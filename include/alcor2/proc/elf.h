@@ -9,6 +9,7 @@
 #ifndef ALCOR2_ELF_H
 #define ALCOR2_ELF_H
 
+#include <alcor2/mm/vma.h>
 #include <alcor2/types.h>
 
 /** @brief ELF magic number (\x7FELF in little-endian). */
@@ -127,17 +128,24 @@ typedef struct
   u64 sh_entsize;   /**< Entry size if table. */
 } __attribute__((packed)) Elf64_Shdr;
 
+/** @brief Longest PT_INTERP path, NUL included. */
+#define ELF_INTERP_MAX 256
+
 /**
  * @brief Loaded ELF information.
  */
 typedef struct
 {
-  u64 entry; /**< Entry point address. */
-  u64 base;  /**< Load base address. */
-  u64 end;   /**< End of loaded segments. */
-  u64 phdr;  /**< Virtual address of program header table (for AT_PHDR). */
-  u16 phent; /**< Size of one program header entry (for AT_PHENT). */
-  u16 phnum; /**< Number of program header entries (for AT_PHNUM). */
+  u64  entry; /**< Entry point address. */
+  u64  base;  /**< Load base address. */
+  u64  end;   /**< End of loaded segments. */
+  u64  phdr;  /**< Virtual address of program header table (for AT_PHDR). */
+  u64  bias;  /**< Added to every p_vaddr (non-zero for ET_DYN only). */
+  u16  type;  /**< ET_EXEC or ET_DYN. */
+  u16  phent; /**< Size of one program header entry (for AT_PHENT). */
+  u16  phnum; /**< Number of program header entries (for AT_PHNUM). */
+  /** @brief PT_INTERP path (the dynamic loader), or empty if static. */
+  char interp[ELF_INTERP_MAX];
 } elf_info_t;
 
 /**
@@ -150,18 +158,40 @@ typedef struct
 int elf_load(const void *data, u64 size, elf_info_t *info);
 
 /**
- * @brief Load an ELF64 executable streaming directly from a file descriptor.
+ * @brief Load an ELF64 executable from a file descriptor, on demand.
  *
- * Reads the ELF header and program headers with small stack/heap allocations,
- * then reads each PT_LOAD segment directly into HHDM-mapped physical pages.
- * No intermediate 87MB kernel buffer is needed — O(1) kernel memory overhead.
+ * Each PT_LOAD segment is recorded in @p vmas as a private mapping of the
+ * file plus a demand-zero bss; pages are read from the page cache on first
+ * touch. Only the page where file data gives way to bss is read up front.
+ * Images whose segments cannot be mapped page by page (misaligned offsets,
+ * segments sharing a page) are copied in eagerly.
  *
- * @param fd   Open file descriptor positioned anywhere (position is saved and
- *             restored on return).
- * @param info Output: loaded ELF information.
+ * An ET_DYN image (PIE or shared object) is placed at @p dyn_base; the
+ * addresses in @p info include that bias. A PT_INTERP path is reported in
+ * @c info->interp for the caller to load; it is not loaded here.
+ *
+ * Must be called in the target address space of the current process.
+ *
+ * @param fd       Open file descriptor (its position is moved).
+ * @param vmas     Region list of the current process.
+ * @param dyn_base Load address for ET_DYN; ignored for ET_EXEC.
+ * @param info     Output: loaded ELF information.
  * @return 0 on success, -1 on error.
  */
-int elf_load_fd(i64 fd, elf_info_t *info);
+int elf_load_fd(i64 fd, vma_list_t *vmas, u64 dyn_base, elf_info_t *info);
+
+/**
+ * @brief Forget the cached headers of an inode (its contents changed).
+ *
+ * elf_load_fd() keeps the validated ELF and program headers of recent
+ * executables, keyed like the page cache, so repeated execs of a binary do
+ * no header I/O. The VFS calls this whenever a file is written, truncated
+ * or removed.
+ *
+ * @param volume Volume the inode lives on.
+ * @param ino Inode number.
+ */
+void elf_cache_invalidate(const void *volume, u64 ino);
 
 /**
  * @brief Validate an ELF64 header.
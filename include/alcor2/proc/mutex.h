@@ -0,0 +1,52 @@
+/**
+ * @file include/alcor2/proc/mutex.h
+ * @brief Sleeping locks.
+ *
+ * A ::mutex_t is for critical sections that may block, such as a PIO
+ * transfer waiting for its IRQ. A process that finds it taken sleeps on
+ * the mutex's wait queue; unlocking hands it to the oldest waiter's next
+ * attempt. Mutexes may not be taken from IRQ context, nor while holding a
+ * spinlock.
+ */
+
+#ifndef ALCOR2_MUTEX_H
+#define ALCOR2_MUTEX_H
+
+#include <alcor2/proc/wait.h>
+#include <alcor2/spinlock.h>
+#include <alcor2/types.h>
+
+typedef struct mutex
+{
+  spinlock_t   lock;    /**< Guards @c locked and @c owner. */
+  bool         locked;
+  struct proc *owner;   /**< Holder, or NULL (also before the scheduler). */
+  wait_queue_t waiters;
+} mutex_t;
+
+/** @brief Static initialiser of an unlocked mutex. */
+#define MUTEX_INIT(n) {.lock = SPINLOCK_INIT(n, LOCK_CLASS_MUTEX)}
+
+/** @brief Make @p m an unlocked mutex. */
+void mutex_init(mutex_t *m, const char *name);
+
+/** @brief Take @p m, sleeping until it is free. */
+void mutex_lock(mutex_t *m);
+
+/** @brief Take @p m if it is free. */
+bool mutex_trylock(mutex_t *m);
+
+/** @brief Release @p m and wake one waiter. */
+void mutex_unlock(mutex_t *m);
+
+/**
+ * @brief Release @p m, sleep on @p wq, then take @p m again.
+ *
+ * Whoever wakes @p wq does so holding @p m, so a wake that follows the
+ * release cannot be missed.
+ *
+ * @return As ::wait_sleep_bits.
+ */
+i64 mutex_sleep(mutex_t *m, wait_queue_t *wq);
+
+#endif
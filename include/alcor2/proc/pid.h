@@ -0,0 +1,37 @@
+/**
+ * @file include/alcor2/proc/pid.h
+ * @brief PID allocation and PID to process lookup.
+ *
+ * PIDs come from a bitmap and are handed out cyclically, like Linux, so a
+ * PID just freed is not reused until the counter wraps. A hash keyed by
+ * PID finds a process from the time it is published until it is reaped.
+ *
+ * All calls must be made with interrupts disabled.
+ */
+
+#ifndef ALCOR2_PID_H
+#define ALCOR2_PID_H
+
+#include <alcor2/types.h>
+
+struct proc;
+
+/** @brief PIDs are 1 .. PID_MAX - 1. */
+#define PID_MAX 32768
+
+/** @brief Reserve the next free PID, or return 0 if none is left. */
+u64 pid_alloc(void);
+
+/** @brief Return @p pid to the pool. */
+void pid_free(u64 pid);
+
+/** @brief Make @p p findable by its @c pid. */
+void pid_hash_add(struct proc *p);
+
+/** @brief Stop @p p being findable by PID. */
+void pid_hash_remove(struct proc *p);
+
+/** @brief The process published under @p pid, or NULL. */
+struct proc *pid_lookup(u64 pid);
+
+#endif
@@ -11,26 +11,44 @@
 
 #include <alcor2/fs/vfs.h>
 #include <alcor2/ktermios.h>
+#include <alcor2/mm/vma.h>
 #include <alcor2/proc/signal.h>
 #include <alcor2/sys/syscall.h>
 #include <alcor2/types.h>
 
-/** @brief Maximum number of processes. */
-#define PROC_MAX 64
+/**
+ * @brief Most bytes an exec may pass: every argv and envp string with its
+ *        terminator, plus one pointer per string (cf. Linux's ARG_MAX).
+ */
+#define PROC_ARG_MAX (256ULL * 1024)
 
-/** @brief Max argv entries for execve / ELF stack build (clang → cc1 needs
- * many). */
-#define PROC_MAX_ARGV 128
+/** @brief argv and envp of an exec, packed for the new user stack. */
+typedef struct
+{
+  char *strings; /**< argv strings, then envp strings, each NUL-terminated. */
+  u64   size;    /**< Bytes in @c strings. */
+  u32   argc;
+  u32   envc;
+} proc_args_t;
 
-/** @brief Max length of one argv string / exec path snapshot (bytes). */
-#define PROC_MAX_ARG_STRLEN 384
+/**
+ * @brief What a loaded image's startup stack tells it about itself (the
+ *        auxv entries), kept so a stack can be built for it later.
+ */
+typedef struct
+{
+  u64  entry;       /**< AT_ENTRY: the program's own entry point. */
+  u64  phdr;        /**< AT_PHDR, 0 if the headers are not mapped. */
+  u16  phent;       /**< AT_PHENT. */
+  u16  phnum;       /**< AT_PHNUM. */
+  bool dynamic;     /**< Starts in its interpreter (AT_BASE is valid). */
+  u64  interp_base; /**< AT_BASE: load bias of the interpreter. */
+  u64  vdso;        /**< AT_SYSINFO_EHDR, 0 without a vDSO. */
+} proc_image_t;
 
 /** @brief Maximum process name length. */
 #define PROC_NAME_MAX 32
 
-/** @brief Canonical kbd line edit + ready buffers (stdin discipline). */
-#define PROC_KBD_LINE_CAP 256
-
 /** @brief Stored path for @c /proc/self/exe (LLVM, musl @c realpath). */
 #define PROC_EXE_PATH_MAX 256
 
@@ -43,6 +61,26 @@
 /** @brief waitpid option: return immediately if no child has exited. */
 #define WNOHANG 1
 
+/**
+ * @brief Resources a process has used, as @c getrusage reports them.
+ *
+ * System time is what the process spent inside system calls; the rest of
+ * @c runtime is user time. Block counts are 512-byte sectors moved by
+ * requests the process issued; a fault is major when it had to read one.
+ */
+typedef struct
+{
+  u64 runtime; /**< Unweighted ns run so far (CPU time). */
+  u64 stime;   /**< Part of @c runtime spent in system calls. */
+  u64 minflt;  /**< Page faults resolved from memory. */
+  u64 majflt;  /**< Page faults that waited for the disk. */
+  u64 nvcsw;   /**< Switches away because it blocked or exited. */
+  u64 nivcsw;  /**< Switches away while still runnable (preempted). */
+  u64 inblock; /**< Sectors read. */
+  u64 oublock; /**< Sectors written. */
+  u64 maxrss;  /**< Most resident user pages seen. */
+} proc_usage_t;
+
 /**
  * @brief Process states.
  */
@@ -55,6 +93,9 @@ typedef enum
   PROC_STATE_ZOMBIE
 } proc_state_t;
 
+/** @brief Body of a kernel task (see ::proc_create_kernel). */
+typedef void (*proc_kentry_t)(void);
+
 /**
  * @brief Process Control Block.
  */
@@ -80,6 +121,8 @@ typedef struct proc
   u64          user_rsp;
   u64          user_rflags;
   u64          fs_base;
+  /** @brief FPU save area (see arch/fpu.h), or NULL until first FPU use. */
+  void        *fpu_state;
   /** If non-zero, parent is blocked in vfork-style clone until this child execs
    * or exits. */
   u64 vfork_waiting_for;
@@ -87,19 +130,23 @@ typedef struct proc
   u64 program_break;
   u64 heap_break;
   u64 mmap_base;
+  /** @brief mmap/brk regions; inherited on fork, emptied on exec. */
+  vma_list_t vmas;
+  /** @brief @c cr3 is the vfork parent's. Until exec or exit the parent
+   * lends this process its @c vmas and breaks too. */
+  bool vm_borrowed;
+  /** @brief Body of a kernel task, or NULL for a user process. Kernel tasks
+   * never enter ring 3 and take no signals. */
+  proc_kentry_t kentry;
 
   /** @name Signal state */
   u64           sig_pending;       /**< Bitmask of pending signals */
   u64           sig_mask;          /**< Bitmask of blocked signals */
   k_sigaction_t sig_actions[NSIG]; /**< Per-signal action table */
+  u8            sig_work;          /**< Pending & ~blocked is non-zero */
 
   /** Emulated TTY attributes (TCGETS/TCSETS on fd 0/1/2 and pipe ends). */
   k_termios_t termios;
-  /** @name Keyboard line discipline (ICANON) */
-  u32  kbd_edit_len;
-  u32  kbd_ready_len;
-  char kbd_edit[PROC_KBD_LINE_CAP];
-  char kbd_ready[PROC_KBD_LINE_CAP];
 
   /** @brief Pointer to the saved registers of the currently executing syscall.
    * Required for rt_sigreturn and clone/fork to access user registers. */
@@ -113,6 +160,46 @@ typedef struct proc
    * This is a per-descriptor attribute (not per open-file-description), so
    * dup/dup2 always clears it on the new fd. */
   u8 fd_cloexec[VFS_MAX_FD];
+  /** @brief Bitmap of open fds (bit set = @c fds[i] >= 0), so the lowest
+   * free descriptor is found a word at a time. */
+  u64 fd_open[VFS_MAX_FD / 64];
+  /** @brief OFT entry of the open working directory, or -1 (e.g. before
+   * the first chdir). Relative lookups start from it. */
+  i32 cwd_oft;
+  /** @brief Syscall statistics while tracing is on, or NULL. */
+  struct systrace_proc *systrace;
+  /** @brief perf events counting this process (see alcor2/sys/perf.h). */
+  struct perf_event *perf_events;
+  /** @brief Run queue links; only READY processes are on the queue. */
+  struct proc *rq_prev;
+  struct proc *rq_next;
+  /** @brief CPU whose run queue it is on, or that it runs or last ran on. */
+  u32 cpu;
+  /** @brief Nice value, ::NICE_MIN .. ::NICE_MAX. */
+  i32 nice;
+  /** @brief SCHED_NORMAL, SCHED_BATCH or SCHED_IDLE. */
+  u32 sched_policy;
+  /** @brief Weighted ns run so far; the least runs next. */
+  u64 vruntime;
+  /** @brief Monotonic ns when the current stretch of running was charged. */
+  u64 exec_start;
+  /** @brief Monotonic ns at creation. */
+  u64 start_time;
+  /** @brief CPU time, faults, switches and I/O of this process. */
+  proc_usage_t usage;
+  /** @brief Sum over the children it has reaped, and theirs. */
+  proc_usage_t cusage;
+  /** @brief PID hash chain. */
+  struct proc *pid_next;
+  /** @brief Every published process, newest first. */
+  struct proc *all_prev;
+  struct proc *all_next;
+  /** @brief Children not yet reaped, newest first. */
+  struct proc *children;
+  /** @brief Links in the parent's @c children, or in the list of orphaned
+   * zombies once the parent is gone. */
+  struct proc *sibling_prev;
+  struct proc *sibling_next;
 } proc_t;
 
 /**
@@ -126,15 +213,6 @@ void proc_init(void);
  */
 proc_t *proc_current(void);
 
-/**
- * @brief Index of @p in the kernel process table (0 .. PROC_MAX-1), or -1 if
- *        @p is NULL or not a current table slot.
- *
- * Used for per-slot counters (e.g. syscall preemption) — do not use PID as an
- * array index.
- */
-int proc_table_index(const proc_t *p);
-
 /**
  * @brief Create a process from an ELF image held in kernel memory.
  *
@@ -147,15 +225,43 @@ u64 proc_create_mem(
 );
 
 /**
- * @brief Timer IRQ hook: request reschedule at next syscall return.
+ * @brief Create a kernel task that runs @p entry in ring 0, then exits.
+ *
+ * The task is scheduled like a process, so it may sleep on disk I/O while
+ * user processes run; it has no parent and is reaped once it exits.
+ *
+ * @return PID of the task, or 0 if out of memory or PIDs.
+ */
+u64 proc_create_kernel(const char *name, proc_kentry_t entry);
+
+/**
+ * @brief Make a BLOCKED process READY and queue it to run.
+ *
+ * Requests a reschedule if it is owed the CPU ahead of the running process.
+ * Does nothing for a process in any other state. Safe from IRQ context.
+ */
+void proc_wake(proc_t *p);
+
+/**
+ * @brief Timer IRQ hook: request reschedule at the calling CPU's next
+ *        return to user mode.
  */
 void proc_tick(void);
 
 /**
- * @brief Syscall exit hook: run scheduler if @ref proc_tick flagged preemption.
+ * @brief Return-to-user hook (syscalls and interrupts from ring 3): run the
+ *        scheduler if @ref proc_tick or a wakeup flagged preemption.
  */
 void proc_check_resched(void);
 
+/**
+ * @brief The calling CPU's idle loop: run processes from its run queue,
+ *        or steal them, and sleep when there are none.
+ *
+ * Entered once per CPU, under the kernel lock, on a stack of its own.
+ */
+NORETURN void proc_idle(void);
+
 /**
  * @brief Exit the current process with the given exit code.
  * @param code Exit code.
@@ -174,10 +280,12 @@ i64 proc_wait(u64 pid);
  * @param pid -1 = any child, >0 = specific child.
  * @param status Pointer to store exit status (can be NULL).
  * @param options WNOHANG etc (0 = block).
+ * @param usage Receives the child's resource usage, own and its children's
+ * (can be NULL).
  * @return Child PID on success, 0 if WNOHANG and no child ready, negative on
  * error.
  */
-i64 proc_waitpid(i64 pid, i32 *status, i32 options);
+i64 proc_waitpid(i64 pid, i32 *status, i32 options, proc_usage_t *usage);
 
 /**
  * @brief Fork the current process.
@@ -202,7 +310,8 @@ void proc_notify_exec(const proc_t *p);
 /**
  * @brief POSIX-style exec: replace @p p's user image with the ELF read from
  * @p elf_fd. Tears down the current user mappings, loads the new ELF, and
- * builds a fresh user stack with @p argv.
+ * builds a fresh user stack from @p args (copied in kernel memory, since
+ * the old image is gone by then).
  *
  * On success @p p->user_rip / @p p->user_rsp point at the new entry; the
  * caller is responsible for updating its in-flight syscall frame so the
@@ -216,12 +325,42 @@ void proc_notify_exec(const proc_t *p);
  * @return 0 on success, negative -errno on failure.
  */
 i64 proc_exec_replace_image(
-    proc_t *p, const char *name, i64 elf_fd, char *const argv[],
-    char *const envp[]
+    proc_t *p, const char *name, i64 elf_fd, const proc_args_t *args
 );
 
-/** After XCR0 setup: snapshot a clean FPU/SSE state (see cpu_enable_sse). */
-void proc_capture_default_fpu(void);
+/**
+ * @brief Load the ELF at @p path into a parked process that never runs,
+ *        for ::proc_spawn to start copies of.
+ *
+ * The image is laid out as exec lays it out but with an empty demand-zero
+ * stack, which holds no memory, and up to @p prefault of its file pages
+ * are mapped in, so none of that is paid again per copy. The template has
+ * no PID and is invisible to proc_get; free it with ::proc_template_free.
+ *
+ * @param path Executable to load.
+ * @param prefault Most file pages mapped in up front.
+ * @param img Receives the auxv values ::proc_spawn starts copies with.
+ * @return The template, or NULL if the file cannot be loaded.
+ */
+proc_t *proc_template_load(const char *path, u32 prefault, proc_image_t *img);
+
+/** @brief Free a template of ::proc_template_load. Its copies live on. */
+void proc_template_free(proc_t *t);
+
+/**
+ * @brief Start a child of the current process running a copy of template
+ *        @p t, as if the caller had forked and the child exec'd its file.
+ *
+ * The copy shares the template's page tables copy-on-write. Its stack is
+ * built from @p args; its fds are the caller's after @p acts are applied
+ * in order, minus the close-on-exec ones; caught signals are reset.
+ *
+ * @return PID of the child, or -errno (-EBADF for a bad fd action).
+ */
+i64 proc_spawn(
+    const proc_t *t, const proc_image_t *img, const proc_args_t *args,
+    const vfs_fd_action_t *acts, u32 nacts
+);
 
 /**
  * @brief Switch to a process (called by scheduler or exec).
@@ -241,6 +380,19 @@ void proc_schedule(void);
  */
 proc_t *proc_get(u64 pid);
 
+/**
+ * @brief First of every published process, zombies included.
+ * @return Newest process; follow @c all_next for the rest, or NULL.
+ */
+proc_t *proc_list_head(void);
+
+/**
+ * @brief Resource usage of @p p so far, its running stretch included.
+ *
+ * @c maxrss is brought up to the pages @p p has resident now.
+ */
+void proc_usage(proc_t *p, proc_usage_t *out);
+
 /**
  * @brief Start the first user process (from kernel main).
  * @param elf_data Pointer to ELF data.
@@ -0,0 +1,80 @@
+/**
+ * @file include/alcor2/proc/sched.h
+ * @brief Weighted fair scheduling of READY processes.
+ *
+ * Each process accumulates virtual runtime: the nanoseconds it ran, scaled
+ * by the weight of its nice value, so a favoured process ages slowly. The
+ * run queue is kept in virtual-runtime order and the process at its head
+ * runs next. A process that slept is placed no further back than a little
+ * behind the queue's minimum, so interactive work that wakes up runs
+ * ahead of CPU-bound work without being able to bank credit forever.
+ *
+ * Each CPU has a run queue of its own; one with nothing to run takes work
+ * from the others (see sched_pick_next).
+ *
+ * All calls must be made with interrupts disabled, under the kernel lock.
+ */
+
+#ifndef ALCOR2_SCHED_H
+#define ALCOR2_SCHED_H
+
+#include <alcor2/types.h>
+
+struct proc;
+
+/** @name Nice range
+ * @{ */
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+/** @} */
+
+/** @name Scheduling policies (Linux values)
+ * @{ */
+#define SCHED_NORMAL 0 /**< Fair share by nice weight. */
+#define SCHED_FIFO   1 /**< Real-time; not supported. */
+#define SCHED_RR     2 /**< Real-time; not supported. */
+#define SCHED_BATCH  3 /**< Fair share, never preempts on wakeup. */
+#define SCHED_IDLE   5 /**< Fair share at the lowest weight. */
+/** @} */
+
+/** @brief Queue @p p, marked READY, on its CPU's queue by its virtual
+ *         runtime. */
+void sched_enqueue(struct proc *p);
+
+/** @brief Take @p p off its run queue. */
+void sched_dequeue(struct proc *p);
+
+/**
+ * @brief Dequeue the process the calling CPU should run next, or NULL if
+ *        none. With its own queue empty, one is taken from another CPU's.
+ */
+struct proc *sched_pick_next(void);
+
+/** @brief Word written when the calling CPU's empty run queue gains a
+ *         process (for MWAIT). */
+const volatile void *sched_idle_watch(void);
+
+/** @brief Charge @p p for the time it has run since it was last charged. */
+void sched_update(struct proc *p);
+
+/** @brief Note that @p p starts running now. */
+void sched_start(struct proc *p);
+
+/**
+ * @brief Queue a process that has been sleeping.
+ * @param cur The running process, or NULL.
+ * @return true if @p p should preempt @p cur.
+ */
+bool sched_wakeup(struct proc *p, struct proc *cur);
+
+/**
+ * @brief Timer tick while @p cur runs.
+ * @return true if a READY process is now owed the CPU.
+ */
+bool sched_tick(struct proc *cur);
+
+/** @brief Give a new child the policy, nice value and place of @p parent,
+ *         on the calling CPU's queue. */
+void sched_fork(struct proc *child, const struct proc *parent);
+
+#endif
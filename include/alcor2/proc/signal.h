@@ -57,14 +57,15 @@
  *
  * The full Linux x86_64 set is exposed so musl's @c rt_sigaction wire layout
  * is preserved across the syscall boundary. Today the delivery path
- * (@c proc_check_signals) only consults @c SA_NODEFER and @c SA_RESETHAND;
- * the others are accepted into @c k_sigaction_t but otherwise inert.
+ * (@c proc_check_signals) only consults @c SA_RESTART, @c SA_NODEFER and
+ * @c SA_RESETHAND; the others are accepted into @c k_sigaction_t but
+ * otherwise inert.
  * @{ */
 #define SA_NOCLDSTOP 0x00000001u /* inert */
 #define SA_NOCLDWAIT 0x00000002u /* inert */
 #define SA_SIGINFO   0x00000004u /* inert */
 #define SA_RESTORER  0x04000000u /* inert */
-#define SA_RESTART   0x10000000u /* inert */
+#define SA_RESTART   0x10000000u /* honored — see proc_check_signals */
 #define SA_NODEFER   0x40000000u /* honored — see proc_check_signals */
 #define SA_RESETHAND 0x80000000u /* honored — see proc_check_signals */
 /** @} */
@@ -110,13 +111,15 @@ typedef struct
 /**
  * @brief Check for deliverable signals and set up signal frame if needed.
  *
- * Called from syscall_entry (ASM) after syscall_dispatch returns.
+ * Called from syscall_entry (ASM) after syscall_dispatch returns, if the
+ * current process's @c sig_work flag is set.
  * May redirect the syscall frame to a signal handler by modifying
  * frame->rip, frame->rsp, and frame->rdi.
  *
  * @param frame Pointer to the syscall_frame_t on the kernel stack.
+ * @param nr    Number of the returning syscall, re-issued on SA_RESTART.
  */
-void proc_check_signals(void *frame);
+void proc_check_signals(void *frame, u64 nr);
 
 /**
  * @brief Asynchronously deliver a signal to a process.
@@ -0,0 +1,55 @@
+/**
+ * @file include/alcor2/proc/vdso.h
+ * @brief vDSO: user-mapped clock code and the data page it reads.
+ *
+ * Every process gets two read-only mappings at ::USER_VDSO_BASE: the vvar
+ * page holding a ::vdso_data_t, and right above it the vDSO, a small ELF
+ * shared object exporting @c __vdso_clock_gettime, @c __vdso_gettimeofday
+ * and @c __vdso_getcpu. Its address is passed in @c AT_SYSINFO_EHDR, which
+ * musl looks up at startup to skip those syscalls.
+ *
+ * This header is also compiled into the vDSO itself, so it must stay
+ * freestanding.
+ */
+
+#ifndef ALCOR2_VDSO_H
+#define ALCOR2_VDSO_H
+
+#include <alcor2/types.h>
+
+/** @name vdso_data_t::clock_mode
+ * @{ */
+#define VDSO_CLOCK_NONE 0 /**< No usable TSC: the vDSO makes the syscall. */
+#define VDSO_CLOCK_TSC  1 /**< Clocks are computed from the TSC. */
+/** @} */
+
+/** @brief Contents of the vvar page; written once at boot. */
+typedef struct
+{
+  u32 clock_mode;      /**< ::VDSO_CLOCK_TSC or ::VDSO_CLOCK_NONE. */
+  u32 shift;           /**< Scale: ns = (cycles * mult) >> shift. */
+  u64 mult;
+  u64 tsc_base;        /**< TSC value at CLOCK_MONOTONIC zero. */
+  u64 realtime_offset; /**< CLOCK_REALTIME minus CLOCK_MONOTONIC, in ns. */
+} vdso_data_t;
+
+/** @brief CLOCK_MONOTONIC in ns for TSC value @p tsc. */
+static inline u64 vdso_tsc_to_ns(const vdso_data_t *vd, u64 tsc)
+{
+  unsigned __int128 ns = (unsigned __int128)(tsc - vd->tsc_base) * vd->mult;
+  return (u64)(ns >> vd->shift);
+}
+
+/**
+ * @brief Copy the built-in vDSO image and the clock parameters into the
+ *        frames every process maps. Call after ::time_init.
+ */
+void vdso_init(void);
+
+/**
+ * @brief Map the vvar page and the vDSO into address space @p cr3.
+ * @return Address of the vDSO ELF header, or 0 if there is no vDSO.
+ */
+u64 vdso_map(u64 cr3);
+
+#endif
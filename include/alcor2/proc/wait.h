@@ -0,0 +1,186 @@
+/**
+ * @file include/alcor2/proc/wait.h
+ * @brief Wait queues: sleep until an event, with optional timeout.
+ *
+ * A process that must wait for a condition links a ::wait_entry_t (on its
+ * kernel stack) onto a queue and blocks; whoever makes the condition true
+ * wakes one or all entries. A sleeping process is not scheduled at all, and
+ * an IRQ handler that wakes it makes it runnable immediately. A timeout is a
+ * ::ktimer_t in the entry, so it ends the sleep as precisely as the timer
+ * interrupt allows.
+ *
+ * poll()/select() sleep on many queues at once through a ::poll_table_t.
+ * An entry may instead carry a callback (epoll): a wake runs it and leaves
+ * the entry queued, and it does not count towards a wake's limit.
+ *
+ * All calls must be made with interrupts disabled (syscall context or an IRQ
+ * handler). Waking may happen from IRQ context; sleeping may not.
+ */
+
+#ifndef ALCOR2_WAIT_H
+#define ALCOR2_WAIT_H
+
+#include <alcor2/timer.h>
+#include <alcor2/types.h>
+
+struct proc;
+struct spinlock;
+struct wait_queue;
+
+/** @brief One sleeping process; lives on the sleeper's stack. */
+typedef struct wait_entry
+{
+  struct proc       *proc;     /**< Sleeper (NULL for callback entries). */
+  struct wait_queue *wq;       /**< Queue it is on; NULL once woken. */
+  struct wait_entry *prev;     /**< Queue links (FIFO). */
+  struct wait_entry *next;
+  u64                space;    /**< Key namespace (futex address space). */
+  u64                key;      /**< Caller tag (e.g. futex address). */
+  u32                bits;     /**< Wake filter (futex bitset). */
+  ktimer_t           timer;    /**< Timeout, armed if the sleep has one. */
+  bool               timed_out;
+  /** @brief Run on wake instead of readying @c proc, if set. */
+  void (*func)(struct wait_entry *we);
+} wait_entry_t;
+
+/** @brief FIFO of sleepers. Zero-initialised storage is an empty queue. */
+typedef struct wait_queue
+{
+  wait_entry_t *head;
+  wait_entry_t *tail;
+} wait_queue_t;
+
+/**
+ * @brief Registrations of one poll()/select()/epoll pass.
+ *
+ * Pollable objects call ::poll_wait for each queue that is woken when their
+ * readiness changes. The entries come from caller storage.
+ */
+typedef struct poll_table
+{
+  wait_entry_t *entries;  /**< Registration slots. */
+  u32           cap;      /**< Slots in @c entries. */
+  u32           n;        /**< Slots in use. */
+  bool          overflow; /**< A registration did not fit. */
+  u64           key;      /**< Tag for new entries. */
+  void (*func)(wait_entry_t *we); /**< Callback for new entries, or NULL. */
+} poll_table_t;
+
+/** @brief Make @p wq an empty queue. */
+void wait_queue_init(wait_queue_t *wq);
+
+/**
+ * @brief Block the current process on @p wq until woken.
+ *
+ * The caller checks its condition first and re-checks it afterwards; a
+ * signal also ends the sleep.
+ *
+ * @param wq      Queue to sleep on.
+ * @param space   Namespace of @p key (0 if unused).
+ * @param key     Tag matched by ::wait_wake_bits (0 if unused).
+ * @param bits     Only wakes whose bits intersect these reach this sleeper.
+ * @param deadline ::time_monotonic_ns value to give up at, 0 for no limit.
+ * @return 0 if woken, @c -ETIMEDOUT, or @c -EINTR if a signal is pending.
+ */
+i64 wait_sleep_bits(
+    wait_queue_t *wq, u64 space, u64 key, u32 bits, u64 deadline
+);
+
+/**
+ * @brief ::wait_sleep_bits that releases @p lock while asleep.
+ *
+ * The process is queued before @p lock is dropped, so a waker that takes
+ * @p lock after the caller checked its condition cannot be missed. @p lock
+ * is held again on return.
+ */
+i64 wait_sleep_locked(
+    wait_queue_t *wq, struct spinlock *lock, u64 space, u64 key, u32 bits,
+    u64 deadline
+);
+
+/** @brief ::wait_sleep_bits reachable by every wake. */
+static inline i64 wait_sleep_until(wait_queue_t *wq, u64 key, u64 deadline)
+{
+  return wait_sleep_bits(wq, 0, key, ~0U, deadline);
+}
+
+/**
+ * @brief ::wait_sleep_until with a timeout relative to now.
+ * @param timeout PIT ticks to sleep at most, 0 for no limit.
+ */
+i64 wait_sleep(wait_queue_t *wq, u64 key, u64 timeout);
+
+/**
+ * @brief Wake up to @p max sleepers in FIFO order.
+ * @return Number woken.
+ */
+u32 wait_wake(wait_queue_t *wq, u32 max);
+
+/** @brief Wake the oldest sleeper of @p wq. */
+static inline u32 wait_wake_one(wait_queue_t *wq)
+{
+  return wait_wake(wq, 1);
+}
+
+/** @brief Wake every sleeper of @p wq. */
+static inline u32 wait_wake_all(wait_queue_t *wq)
+{
+  return wait_wake(wq, ~0U);
+}
+
+/**
+ * @brief Wake up to @p max sleepers tagged (@p space, @p key) whose bits
+ *        intersect @p bits.
+ * @return Number woken.
+ */
+u32 wait_wake_bits(wait_queue_t *wq, u64 space, u64 key, u32 bits, u32 max);
+
+/** @brief Wake up to @p max sleepers whose tag is @p key. */
+static inline u32 wait_wake_key(wait_queue_t *wq, u64 key, u32 max)
+{
+  return wait_wake_bits(wq, 0, key, ~0U, max);
+}
+
+/**
+ * @brief Move up to @p max sleepers tagged (@p space, @p key) to @p to,
+ *        retagged (@p space, @p nkey).
+ * @return Number moved.
+ */
+u32 wait_requeue(
+    wait_queue_t *from, u64 space, u64 key, wait_queue_t *to, u64 nkey,
+    u32 max
+);
+
+/** @brief True if no process sleeps on @p wq. */
+static inline bool wait_queue_empty(const wait_queue_t *wq)
+{
+  return wq->head == NULL;
+}
+
+/**
+ * @brief Prepare @p pt to register the current process.
+ * @param entries Storage for @p cap registrations.
+ */
+void poll_table_init(poll_table_t *pt, wait_entry_t *entries, u32 cap);
+
+/**
+ * @brief Register @p pt's owner on @p wq (pollable objects call this).
+ * @param pt Poll table, or NULL to only query readiness.
+ */
+void poll_wait(poll_table_t *pt, wait_queue_t *wq);
+
+/**
+ * @brief Block until any queue registered in @p pt is woken.
+ *
+ * If some registration did not fit, the sleep lasts one tick at most so
+ * the caller rescans. The registrations are dropped before returning.
+ *
+ * @param deadline ::time_monotonic_ns value to give up at, 0 for no limit.
+ * @return 0 if woken, @c -ETIMEDOUT, or @c -EINTR.
+ */
+i64 poll_table_sleep(poll_table_t *pt, u64 deadline);
+
+/** @brief Drop every registration of @p pt. */
+void poll_table_release(poll_table_t *pt);
+
+#endif
@@ -0,0 +1,74 @@
+/**
+ * @file include/alcor2/spinlock.h
+ * @brief Ticket spinlocks with lock-order checking.
+ *
+ * A ticket lock is handed out in the order CPUs asked for it, so no waiter
+ * starves. A lock that an IRQ handler also takes must be held with
+ * interrupts disabled (::spin_lock_irqsave) wherever interrupts may be on.
+ * Nothing may sleep while holding a spinlock; ::wait_sleep_locked drops one
+ * around the sleep.
+ *
+ * Every lock has a ::lock_class_t. A CPU holding a lock may only take
+ * locks of a higher class, or of the same class at a higher address. With
+ * SPINLOCK_DEBUG set in spinlock.c, every acquisition is checked against
+ * the locks the CPU holds and violations are reported before they can
+ * deadlock.
+ */
+
+#ifndef ALCOR2_SPINLOCK_H
+#define ALCOR2_SPINLOCK_H
+
+#include <alcor2/types.h>
+
+/** @brief Lock classes, in the only order in which they may nest. */
+typedef enum
+{
+  LOCK_CLASS_MUTEX,      /**< Internal lock of a ::mutex_t. */
+  LOCK_CLASS_FUTEX,      /**< One futex hash bucket. */
+  LOCK_CLASS_OFT,        /**< Open file table slots and refcounts. */
+  LOCK_CLASS_ATA,        /**< One IDE channel's request queue. */
+  LOCK_CLASS_KMEM_CACHE, /**< One slab cache. */
+  LOCK_CLASS_HEAP,       /**< Large-allocation heap. */
+  LOCK_CLASS_HEAP_SITE,  /**< Call-site table of HEAP_TAG_SITES builds. */
+  LOCK_CLASS_PMM,        /**< Buddy lists and hot page caches. */
+} lock_class_t;
+
+typedef struct spinlock
+{
+  volatile u16 next;  /**< Ticket the next arrival draws. */
+  volatile u16 owner; /**< Ticket that holds the lock. */
+  lock_class_t class;
+  const char  *name;  /**< For lock-order reports. */
+} spinlock_t;
+
+/** @brief Static initialiser of an unlocked lock. */
+#define SPINLOCK_INIT(n, c) {.next = 0, .owner = 0, .class = (c), .name = (n)}
+
+/** @brief Make @p l an unlocked lock of class @p class. */
+void spin_init(spinlock_t *l, const char *name, lock_class_t class);
+
+/** @brief Take @p l, spinning until it is free. */
+void spin_lock(spinlock_t *l);
+
+/** @brief Release @p l. */
+void spin_unlock(spinlock_t *l);
+
+/**
+ * @brief Disable interrupts on this CPU, then take @p l.
+ * @return Saved RFLAGS for ::spin_unlock_irqrestore.
+ */
+u64 spin_lock_irqsave(spinlock_t *l);
+
+/** @brief Release @p l and re-enable interrupts if @p flags had them on. */
+void spin_unlock_irqrestore(spinlock_t *l, u64 flags);
+
+/** @brief True if some CPU holds @p l. */
+static inline bool spin_is_locked(const spinlock_t *l)
+{
+  return l->next != l->owner;
+}
+
+/** @brief Report a sleep attempted while this CPU holds a spinlock. */
+void spin_might_sleep(void);
+
+#endif
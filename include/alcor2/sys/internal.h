@@ -21,6 +21,7 @@
 #ifndef ALCOR2_SYS_INTERNAL_H
 #define ALCOR2_SYS_INTERNAL_H
 
+#include <alcor2/fs/vfs.h>
 #include <alcor2/sys/syscall.h>
 
 typedef u64 (*syscall_fn_t)(u64, u64, u64, u64, u64, u64);
@@ -48,8 +49,26 @@ SYSCALL_DECL(sys_ioctl);
 SYSCALL_DECL(sys_nanosleep);
 SYSCALL_DECL(sys_readv);
 SYSCALL_DECL(sys_writev);
+SYSCALL_DECL(sys_preadv);
+SYSCALL_DECL(sys_pwritev);
 SYSCALL_DECL(sys_select);
 SYSCALL_DECL(sys_poll);
+SYSCALL_DECL(sys_sendfile);
+SYSCALL_DECL(sys_copy_file_range);
+SYSCALL_DECL(sys_splice);
+SYSCALL_DECL(sys_tee);
+SYSCALL_DECL(sys_vmsplice);
+SYSCALL_DECL(sys_epoll_create);
+SYSCALL_DECL(sys_epoll_create1);
+SYSCALL_DECL(sys_epoll_ctl);
+SYSCALL_DECL(sys_epoll_wait);
+SYSCALL_DECL(sys_epoll_pwait);
+SYSCALL_DECL(sys_eventfd);
+SYSCALL_DECL(sys_eventfd2);
+SYSCALL_DECL(sys_timerfd_create);
+SYSCALL_DECL(sys_timerfd_settime);
+SYSCALL_DECL(sys_timerfd_gettime);
+SYSCALL_DECL(sys_perf_event_open);
 
 /* Memory */
 SYSCALL_DECL(sys_mmap);
@@ -69,6 +88,7 @@ SYSCALL_DECL(sys_newfstatat);
 SYSCALL_DECL(sys_dup);
 SYSCALL_DECL(sys_dup2);
 SYSCALL_DECL(sys_fcntl);
+SYSCALL_DECL(sys_memfd_create);
 SYSCALL_DECL(sys_getdents);
 SYSCALL_DECL(sys_getdents64);
 SYSCALL_DECL(sys_getcwd);
@@ -79,6 +99,8 @@ SYSCALL_DECL(sys_creat);
 SYSCALL_DECL(sys_unlink);
 SYSCALL_DECL(sys_rename);
 SYSCALL_DECL(sys_ftruncate);
+SYSCALL_DECL(sys_fsync);
+SYSCALL_DECL(sys_sync);
 SYSCALL_DECL(sys_pread64);
 SYSCALL_DECL(sys_pwrite64);
 SYSCALL_DECL(sys_symlink);
@@ -91,24 +113,44 @@ SYSCALL_DECL(sys_gettid);
 SYSCALL_DECL(sys_getppid);
 SYSCALL_DECL(sys_clone);
 SYSCALL_DECL(sys_fork);
+SYSCALL_DECL(sys_vfork);
 SYSCALL_DECL(sys_execve);
 SYSCALL_DECL(sys_exit);
 SYSCALL_DECL(sys_wait4);
+SYSCALL_DECL(sys_getrusage);
+SYSCALL_DECL(sys_times);
 SYSCALL_DECL(sys_uname);
 SYSCALL_DECL(sys_getuid);
 SYSCALL_DECL(sys_getgid);
 SYSCALL_DECL(sys_geteuid);
 SYSCALL_DECL(sys_getegid);
 SYSCALL_DECL(sys_set_tid_address);
+SYSCALL_DECL(sys_alcor_spawn);
 
 /* Misc */
 SYSCALL_DECL(sys_gettimeofday);
 SYSCALL_DECL(sys_futex);
 SYSCALL_DECL(sys_clock_gettime);
+SYSCALL_DECL(sys_clock_getres);
 SYSCALL_DECL(sys_sched_yield);
 SYSCALL_DECL(sys_sched_getaffinity);
+SYSCALL_DECL(sys_getpriority);
+SYSCALL_DECL(sys_setpriority);
+SYSCALL_DECL(sys_sched_setparam);
+SYSCALL_DECL(sys_sched_getparam);
+SYSCALL_DECL(sys_sched_setscheduler);
+SYSCALL_DECL(sys_sched_getscheduler);
+SYSCALL_DECL(sys_sched_get_priority_max);
+SYSCALL_DECL(sys_sched_get_priority_min);
 SYSCALL_DECL(sys_getrlimit);
 SYSCALL_DECL(sys_prlimit64);
+SYSCALL_DECL(sys_alcor_blkcache_stats);
+SYSCALL_DECL(sys_alcor_memstat);
+SYSCALL_DECL(sys_alcor_systrace);
+SYSCALL_DECL(sys_alcor_kprof);
+SYSCALL_DECL(sys_alcor_trace);
+SYSCALL_DECL(sys_alcor_uring_setup);
+SYSCALL_DECL(sys_alcor_uring_enter);
 
 /* Signals and arch (Linux ABI) */
 SYSCALL_DECL(sys_rt_sigaction);
@@ -128,18 +170,43 @@ SYSCALL_DECL(sys_exit_group);
 /* Userspace FB / compositors */
 SYSCALL_DECL(sys_alcor_fb_info);
 SYSCALL_DECL(sys_alcor_fb_mmap);
+SYSCALL_DECL(sys_alcor_fb_backbuf);
+SYSCALL_DECL(sys_alcor_fb_present);
 
-/**
- * @brief True if @c pipe_read would not block (data in buffer or EOF).
- */
-bool pipe_poll_read_ready(const void *pipe);
+/* Sockets */
+SYSCALL_DECL(sys_socket);
+SYSCALL_DECL(sys_connect);
+SYSCALL_DECL(sys_accept);
+SYSCALL_DECL(sys_accept4);
+SYSCALL_DECL(sys_sendto);
+SYSCALL_DECL(sys_recvfrom);
+SYSCALL_DECL(sys_sendmsg);
+SYSCALL_DECL(sys_recvmsg);
+SYSCALL_DECL(sys_shutdown);
+SYSCALL_DECL(sys_bind);
+SYSCALL_DECL(sys_listen);
+SYSCALL_DECL(sys_getsockname);
+SYSCALL_DECL(sys_getpeername);
+SYSCALL_DECL(sys_setsockopt);
+SYSCALL_DECL(sys_getsockopt);
+
+struct poll_table;
 
 /**
- * @brief Check if a pipe can be written to without blocking.
+ * @brief Readiness of one end of a pipe (see ::vfs_oft_poll).
  * @param pipe Opaque pointer to the pipe.
- * @return true if space is available or read end is closed.
+ * @param kind ::VFS_KIND_PIPE_RD or ::VFS_KIND_PIPE_WR.
+ * @param pt   Poll table to register on the end's wait queue, or NULL.
+ * @return ::VFS_POLL_IN / ::VFS_POLL_HUP for the read end, ::VFS_POLL_OUT /
+ *         ::VFS_POLL_ERR for the write end.
  */
-bool pipe_poll_write_ready(const void *pipe);
+u32 pipe_poll(void *pipe, i32 kind, struct poll_table *pt);
+
+/** @brief Mark a pipe object as a terminal relay (see ktermios.h). */
+void pipe_set_tty(void *pipe);
+
+/** @brief Whether ::pipe_set_tty was called on the pipe object. */
+bool pipe_is_tty(const void *pipe);
 
 /**
  * @brief Read up to @p count bytes from the read end of a pipe object.
@@ -153,9 +220,21 @@ i64 pipe_read_obj(void *pipe, void *buf, u64 count);
  */
 i64 pipe_write_obj(void *pipe, const void *buf, u64 count);
 
+/**
+ * @brief Read into @p iovcnt buffers in turn under one hold of the lock.
+ * @return As ::pipe_read_obj, counting all buffers.
+ */
+i64 pipe_readv_obj(void *pipe, const vfs_iovec_t *iov, u32 iovcnt);
+
+/**
+ * @brief Write @p iovcnt buffers in turn under one hold of the lock.
+ * @return As ::pipe_write_obj, counting all buffers.
+ */
+i64 pipe_writev_obj(void *pipe, const vfs_iovec_t *iov, u32 iovcnt);
+
 /**
  * @brief Allocate a fresh pipe object. Both ends start refcount=1; the caller
- * is expected to wrap it in two OFT entries via @c vfs_oft_alloc_pipe and
+ * is expected to wrap it in two OFT entries via @c vfs_oft_alloc_obj and
  * release one of them if any setup step fails.
  *
  * @return Opaque pipe pointer, or NULL on exhaustion.
@@ -171,6 +250,174 @@ void *pipe_alloc_obj(void);
  */
 void pipe_oft_release(i32 kind, void *pipe);
 
+/** @brief Ring capacity of a pipe in bytes (F_GETPIPE_SZ). */
+u64 pipe_get_size(const void *pipe);
+
+/**
+ * @brief Resize a pipe's ring (F_SETPIPE_SZ).
+ *
+ * @p size is rounded up to a power-of-two number of pages.
+ *
+ * @return New capacity in bytes, @c -EPERM above the maximum, or @c -EBUSY
+ *         if the queued data would not fit.
+ */
+i64 pipe_set_size(void *pipe, u64 size);
+
+/**
+ * @brief Queue file pages on a pipe without copying them (splice in).
+ *
+ * Arguments mirror ::vfs_sendfile; the pipe takes a reference on each
+ * page-cache frame.
+ *
+ * @return Bytes queued, or negative -errno.
+ */
+i64 pipe_splice_in(void *pipe, i64 in_fd, u64 *offset, u64 len);
+
+/**
+ * @brief Drain up to @p len bytes of a pipe into @p sink (splice out).
+ *
+ * Blocks until data arrives or the write end closes, like a read.
+ *
+ * @return Bytes consumed, 0 at end-of-file, or negative -errno.
+ */
+i64 pipe_splice_out(void *pipe, u64 len, vfs_sink_t sink, void *ctx);
+
+/**
+ * @brief Move or duplicate queued pages from one pipe to another.
+ * @param keep true to leave the data in @p in (tee), false to consume it.
+ * @return Bytes transferred, 0 at end-of-file, or negative -errno.
+ */
+i64 pipe_transfer(void *in, void *out, u64 len, bool keep);
+
+/**
+ * @brief Readiness of a descriptor as poll()/select() see it.
+ *
+ * Like ::vfs_poll, but stdio descriptors without an OFT entry report the
+ * keyboard (fd 0) or the console (fds 1 and 2).
+ *
+ * @return ::VFS_POLL_IN and friends, or @c -EBADF.
+ */
+i32 io_poll_fd(u64 fd, struct poll_table *pt);
+
+/** @brief Readiness of an epoll instance: ::VFS_POLL_IN once events wait. */
+u32 epoll_poll(void *ep, struct poll_table *pt);
+
+/**
+ * @brief Tear down an epoll instance when its OFT entry is released.
+ * @param ep Epoll object.
+ */
+void epoll_oft_release(void *ep);
+
+/**
+ * @brief Stop every epoll instance from watching OFT slot @p idx.
+ *
+ * Called from vfs_oft_release() before the entry's object goes away.
+ */
+void epoll_oft_closed(i32 idx);
+
+/** @brief Readiness of an eventfd: ::VFS_POLL_IN while the counter is
+ *  non-zero, ::VFS_POLL_OUT while it can grow. */
+u32 eventfd_poll(void *efd, struct poll_table *pt);
+
+/**
+ * @brief Read the counter of an eventfd into an 8-byte @p buf.
+ * @return 8, or negative -errno (@c -EAGAIN if zero and non-blocking).
+ */
+i64 eventfd_read_obj(void *efd, void *buf, u64 count);
+
+/**
+ * @brief Add the 8-byte value in @p buf to the counter of an eventfd.
+ * @return 8, or negative -errno.
+ */
+i64 eventfd_write_obj(void *efd, const void *buf, u64 count);
+
+/** @brief Free an eventfd when its OFT entry is released. */
+void eventfd_oft_release(void *efd);
+
+/** @brief Readiness of a timerfd: ::VFS_POLL_IN once it has expired. */
+u32 timerfd_poll(void *tfd, struct poll_table *pt);
+
+/**
+ * @brief Read the expiration count of a timerfd into an 8-byte @p buf.
+ * @return 8, or negative -errno (@c -EAGAIN if none and non-blocking).
+ */
+i64 timerfd_read_obj(void *tfd, void *buf, u64 count);
+
+/** @brief Disarm and free a timerfd when its OFT entry is released. */
+void timerfd_oft_release(void *tfd);
+
+/**
+ * @brief Read the count of a perf event into an 8-byte @p buf.
+ * @return 8, or @c -ENOSPC if @p buf is smaller.
+ */
+i64 perf_read_obj(void *ev, void *buf, u64 count);
+
+/** @brief Stop and free a perf event when its OFT entry is released. */
+void perf_oft_release(void *ev);
+
+/** @brief Free a submission ring when its OFT entry is released. */
+void uring_oft_release(void *ring);
+
+/** @brief Readiness of a socket (see ::tcp_poll and ::udp_poll). */
+u32 sock_poll(void *sock, struct poll_table *pt);
+
+/**
+ * @brief read() on a socket: receive up to @p count bytes.
+ * @param flags The entry's open flags, for ::O_NONBLOCK.
+ * @return Bytes read, 0 at end of stream, or negative -errno.
+ */
+i64 sock_read_obj(void *sock, void *buf, u64 count, u32 flags);
+
+/**
+ * @brief write() on a socket: send @p count bytes to the connected peer.
+ * @return Bytes queued, or negative -errno.
+ */
+i64 sock_write_obj(void *sock, const void *buf, u64 count, u32 flags);
+
+/** @brief Close the connection and free a socket with its OFT entry. */
+void sock_oft_release(void *sock);
+
+/**
+ * @brief sendfile() to a TCP socket: queue page-cache pages by reference.
+ *
+ * Arguments mirror ::vfs_sendfile.
+ *
+ * @return Bytes queued, negative -errno, or @c -ENOTSOCK if @p out_fd is
+ *         not a stream socket and the caller should copy instead.
+ */
+i64 sock_sendfile(i64 out_fd, i64 in_fd, u64 *offset, u64 count);
+
+/** @brief Iovecs a vectored call copies to the stack rather than the heap. */
+#define SYS_IOV_FAST 8
+
+/**
+ * @brief Copy the user iovec array at @p uptr into the kernel.
+ *
+ * Every buffer is checked as a user range here, once, so the VFS can copy
+ * through the pointers. Arrays of up to ::SYS_IOV_FAST land in @p fast;
+ * longer ones are allocated and must be freed with ::iov_release.
+ *
+ * @return 0 with @p *out set, or @c -EINVAL, @c -EFAULT or @c -ENOMEM.
+ */
+i64 iov_import(u64 uptr, u64 iovcnt, vfs_iovec_t *fast, vfs_iovec_t **out);
+
+/** @brief Free what ::iov_import allocated, if anything. */
+void iov_release(vfs_iovec_t *iov, const vfs_iovec_t *fast);
+
+/**
+ * @brief ENABLE, DISABLE or RESET the perf event behind @p fd.
+ * @return 0, @c -EINVAL for another request, or @c -ENOTTY if @p fd is
+ *         not a perf event.
+ */
+i64 perf_ioctl(i64 fd, u64 request);
+
+/**
+ * @brief FB_CONSOLE_MAP_GRID: map the console cell grid into the caller
+ *        and describe the mapping in the ::fb_console_grid_t at @p arg.
+ * @return 0, or negative -errno.
+ */
+u64 fb_map_grid(u64 arg);
+
 #undef SYSCALL_DECL
 
 #endif
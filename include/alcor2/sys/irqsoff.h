@@ -0,0 +1,90 @@
+/**
+ * @file include/alcor2/sys/irqsoff.h
+ * @brief Interrupts-off latency tracker.
+ *
+ * Built with @c IRQSOFF_TRACE=1 (make @c IRQSOFF=1), every stretch the
+ * CPU spends with interrupts disabled is timed with the TSC, from the
+ * moment IF is cleared to the moment it is set again, and charged to the
+ * code that cleared it. Stretches start in four places: an explicit
+ * cpu_disable_interrupts() or spin_lock_irqsave() (charged to its caller),
+ * a system call (IF is cleared on entry; charged to the syscall), and a
+ * hardware interrupt or page fault taken with interrupts on (charged to
+ * the vector). /proc/irqsoff reports the worst stretch, a histogram and
+ * the worst offenders; without the flag the hooks compile to nothing.
+ *
+ * Every hook runs with interrupts off. Each CPU times its own stretch, and
+ * only one under the kernel lock records it, so the state needs no lock
+ * of its own.
+ */
+
+#ifndef ALCOR2_IRQSOFF_H
+#define ALCOR2_IRQSOFF_H
+
+#include <alcor2/types.h>
+
+/** @brief 1 to time every interrupts-off stretch. */
+#ifndef IRQSOFF_TRACE
+#define IRQSOFF_TRACE 0
+#endif
+
+/** @name Sites that are not code addresses (kernel addresses are above)
+ * @{ */
+#define IRQSOFF_SYSCALL (1ULL << 32) /**< | syscall number */
+#define IRQSOFF_IRQ     (2ULL << 32) /**< | IRQ line */
+#define IRQSOFF_FAULT   (3ULL << 32) /**< | exception vector */
+/** @} */
+
+/** @brief Histogram buckets: under 1 us, then one per power of two. */
+#define IRQSOFF_BUCKETS 20
+
+/** @brief Sites told apart; later ones are merged into slot 0. */
+#define IRQSOFF_SITES 128
+
+/** @brief Stretches that began at one site. */
+typedef struct
+{
+  u64 site;    /**< Where IF was cleared; 0 if the slot is free. */
+  u64 count;
+  u64 total_ns;
+  u64 max_ns;  /**< The longest. */
+  u64 max_end; /**< Where the longest one ended. */
+} irqsoff_site_t;
+
+#if IRQSOFF_TRACE
+
+/** @brief IF was just cleared at @p site; start the clock. */
+void irqsoff_begin(u64 site);
+
+/** @brief IF is about to be set at @p site; charge the stretch, if any. */
+void irqsoff_end(u64 site);
+
+#else
+
+static inline void irqsoff_begin(u64 site)
+{
+  (void)site;
+}
+
+static inline void irqsoff_end(u64 site)
+{
+  (void)site;
+}
+
+#endif
+
+/**
+ * @brief Copy of site slot @p i.
+ * @return false past the last slot, or in a build without IRQSOFF_TRACE.
+ */
+bool irqsoff_site_get(u32 i, irqsoff_site_t *out);
+
+/**
+ * @brief The longest stretch so far and the histogram of all of them.
+ * @param worst   Receives the longest stretch's sites and length, with
+ *                @c count and @c total_ns over every stretch.
+ * @param buckets Receives ::IRQSOFF_BUCKETS counts.
+ * @return false in a build without IRQSOFF_TRACE.
+ */
+bool irqsoff_summary(irqsoff_site_t *worst, u64 *buckets);
+
+#endif
@@ -0,0 +1,22 @@
+/**
+ * @file include/alcor2/sys/kprof.h
+ * @brief Sampling kernel profiler (see alcor2/alcor_kprof.h).
+ *
+ * The timer interrupt handlers pass their frame to ::kprof_sample. While
+ * ::kprof_period_ns is non-zero the tick code also makes sure an
+ * interrupt comes at least that often, idle or not.
+ */
+
+#ifndef ALCOR2_KPROF_H
+#define ALCOR2_KPROF_H
+
+#include <alcor2/arch/idt.h>
+#include <alcor2/types.h>
+
+/** @brief Time between samples, 0 while profiling is off. */
+extern u64 kprof_period_ns;
+
+/** @brief Record where @p frame interrupted the CPU, if profiling. */
+void kprof_sample(const interrupt_frame_t *frame);
+
+#endif
@@ -0,0 +1,24 @@
+/**
+ * @file include/alcor2/sys/perf.h
+ * @brief Per-process performance counters (see alcor2/alcor_perf.h).
+ *
+ * The scheduler hands every switch to ::perf_switch, which saves the
+ * counts of the outgoing process's events and starts the incoming one's,
+ * so each event only sees its own process. Both checks are a NULL test
+ * for processes nobody monitors.
+ */
+
+#ifndef ALCOR2_SYS_PERF_H
+#define ALCOR2_SYS_PERF_H
+
+#include <alcor2/types.h>
+
+struct proc;
+
+/** @brief Move the counters from @p prev (may be NULL) to @p next. */
+void perf_switch(struct proc *prev, struct proc *next);
+
+/** @brief Stop counting @p p (it is exiting); its fds keep the counts. */
+void perf_proc_exit(struct proc *p);
+
+#endif
@@ -43,15 +43,32 @@
 #define SYS_DUP2              33
 #define SYS_NANOSLEEP         35
 #define SYS_GETPID            39
-#define SYS_FACCESSAT         48
+#define SYS_SENDFILE          40
+#define SYS_SOCKET            41
+#define SYS_CONNECT           42
+#define SYS_ACCEPT            43
+#define SYS_SENDTO            44
+#define SYS_RECVFROM          45
+#define SYS_SENDMSG           46
+#define SYS_RECVMSG           47
+#define SYS_SHUTDOWN          48
+#define SYS_BIND              49
+#define SYS_LISTEN            50
+#define SYS_GETSOCKNAME       51
+#define SYS_GETPEERNAME       52
+#define SYS_SETSOCKOPT        54
+#define SYS_GETSOCKOPT        55
 #define SYS_CLONE             56
 #define SYS_FORK              57
+#define SYS_VFORK             58
 #define SYS_EXECVE            59
 #define SYS_EXIT              60
 #define SYS_WAIT4             61
 #define SYS_KILL              62
 #define SYS_UNAME             63
 #define SYS_FCNTL             72
+#define SYS_FSYNC             74
+#define SYS_FDATASYNC         75
 #define SYS_FTRUNCATE         77
 #define SYS_GETDENTS          78
 #define SYS_GETCWD            79
@@ -70,25 +87,67 @@
 #define SYS_GETEGID           108
 #define SYS_GETPPID           110
 #define SYS_GETRLIMIT         97
+#define SYS_GETRUSAGE         98
+#define SYS_TIMES             100
 #define SYS_PRLIMIT64         302
 #define SYS_ARCH_PRCTL        158
+#define SYS_SYNC              162
 #define SYS_MOUNT             165
 #define SYS_UMOUNT2           166
 #define SYS_GETTID            186
 #define SYS_TKILL             200
 #define SYS_FUTEX             202
 #define SYS_SCHED_GETAFFINITY 204
+#define SYS_EPOLL_CREATE      213
 #define SYS_SET_TID_ADDRESS   218
 #define SYS_TGKILL            234
 #define SYS_CLOCK_GETTIME     228
+#define SYS_CLOCK_GETRES      229
 #define SYS_EXIT_GROUP        231
+#define SYS_EPOLL_WAIT        232
+#define SYS_EPOLL_CTL         233
 #define SYS_GETDENTS64        217
 #define SYS_OPENAT            257
 #define SYS_NEWFSTATAT        262
+#define SYS_FACCESSAT         269
+#define SYS_SPLICE            275
+#define SYS_TEE               276
+#define SYS_VMSPLICE          278
+#define SYS_EPOLL_PWAIT       281
+#define SYS_TIMERFD_CREATE    283
+#define SYS_EVENTFD           284
+#define SYS_TIMERFD_SETTIME   286
+#define SYS_TIMERFD_GETTIME   287
+#define SYS_ACCEPT4           288
+#define SYS_EVENTFD2          290
+#define SYS_EPOLL_CREATE1     291
 #define SYS_PIPE2             293
+#define SYS_PREADV            295
+#define SYS_PWRITEV           296
+#define SYS_PERF_EVENT_OPEN   298
+#define SYS_MEMFD_CREATE      319
+#define SYS_COPY_FILE_RANGE   326
 #define SYS_SIGALTSTACK       131
+#define SYS_GETPRIORITY       140
+#define SYS_SETPRIORITY       141
+#define SYS_SCHED_SETPARAM    142
+#define SYS_SCHED_GETPARAM    143
+#define SYS_SCHED_SETSCHED    144
+#define SYS_SCHED_GETSCHED    145
+#define SYS_SCHED_PRIO_MAX    146
+#define SYS_SCHED_PRIO_MIN    147
+#define SYS_ALCOR_SYSTRACE    496 /**< Syscall latency tracing. */
+#define SYS_ALCOR_BLKCACHE    497 /**< ATA block cache counters. */
 #define SYS_ALCOR_FB_INFO     498 /**< User FB geometry (@ref alcor_fb_info_t). */
 #define SYS_ALCOR_FB_MMAP     499 /**< Map linear framebuffer (RW, shared). */
+#define SYS_ALCOR_MEMSTAT     500 /**< Memory and cache usage. */
+#define SYS_ALCOR_FB_BACKBUF  501 /**< Map an offscreen buffer like the FB. */
+#define SYS_ALCOR_FB_PRESENT  502 /**< Copy a rectangle of it to the FB. */
+#define SYS_ALCOR_KPROF       503 /**< Sampling kernel profiler. */
+#define SYS_ALCOR_TRACE       504 /**< Kernel event tracing. */
+#define SYS_ALCOR_URING_SETUP 505 /**< Register a submission ring. */
+#define SYS_ALCOR_URING_ENTER 506 /**< Submit to and wait on a ring. */
+#define SYS_ALCOR_SPAWN       507 /**< Run a pre-loaded program template. */
 #define SYS_MAX               512
 /* Unmapped syscall numbers in dispatcher intentionally return -ENOSYS. */
 /** @} */
@@ -118,6 +177,9 @@ _Static_assert(offsetof(syscall_frame_t, rsp) == 17 * 8, "syscall_frame rsp");
  */
 void syscall_init(void);
 
+/** @brief Program the same MSRs on the calling AP. */
+void syscall_init_cpu(void);
+
 /**
  * @brief Syscall dispatcher (called from ASM entry).
  * @param frame Saved syscall frame.
@@ -125,6 +187,12 @@ void syscall_init(void);
  */
 u64 syscall_dispatch(syscall_frame_t *frame);
 
+/**
+ * @brief Name of syscall @p num, as in the dispatch table.
+ * @return The name, or NULL if @p num has no handler.
+ */
+const char *syscall_name(u64 num);
+
 /**
  * @brief Return the syscall_frame_t for the currently executing syscall.
  *
@@ -135,13 +203,15 @@ syscall_frame_t *syscall_get_current_frame(void);
 
 /** @name MSR definitions for SYSCALL/SYSRET
  * @{ */
-#define MSR_EFER    0xC0000080
-#define MSR_STAR    0xC0000081
-#define MSR_LSTAR   0xC0000082
-#define MSR_SFMASK  0xC0000084
-#define MSR_FS_BASE 0xC0000100
-#define MSR_GS_BASE 0xC0000101
-#define EFER_SCE    (1 << 0)
+#define MSR_EFER           0xC0000080
+#define MSR_STAR           0xC0000081
+#define MSR_LSTAR          0xC0000082
+#define MSR_SFMASK         0xC0000084
+#define MSR_FS_BASE        0xC0000100
+#define MSR_GS_BASE        0xC0000101
+/** @brief The user's GS base while in the kernel (swapped by SWAPGS). */
+#define MSR_KERNEL_GS_BASE 0xC0000102
+#define EFER_SCE           (1 << 0)
 /** @} */
 
 #endif
@@ -0,0 +1,31 @@
+/**
+ * @file include/alcor2/sys/systrace.h
+ * @brief Syscall latency tracing (see alcor2/alcor_systrace.h).
+ *
+ * The dispatcher times each handler while ::systrace_enabled is set and
+ * hands the cycle count to ::systrace_record. Per-process tables are
+ * allocated on a process's first traced syscall.
+ */
+
+#ifndef ALCOR2_SYSTRACE_H
+#define ALCOR2_SYSTRACE_H
+
+#include <alcor2/types.h>
+
+struct proc;
+
+/** @brief Set while tracing is on; checked on every syscall. */
+extern bool systrace_enabled;
+
+/**
+ * @brief Account one syscall.
+ * @param p      Calling process, or NULL.
+ * @param nr     Syscall number (below ::SYS_MAX).
+ * @param cycles TSC cycles the handler took.
+ */
+void systrace_record(struct proc *p, u64 nr, u64 cycles);
+
+/** @brief Free the statistics of @p p (it is exiting). */
+void systrace_proc_exit(struct proc *p);
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ * @file include/alcor2/sys/trace.h
+ * @brief Static tracepoints (see alcor2/alcor_trace.h).
+ *
+ * Every ::TRACE site starts with a 5-byte NOP recorded in the
+ * @c .trace_sites section. While tracing is off that NOP is all a site
+ * costs; turning tracing on patches each one into a jump to the code that
+ * calls ::trace_emit, and turning it off patches the NOPs back.
+ */
+
+#ifndef ALCOR2_SYS_TRACE_H
+#define ALCOR2_SYS_TRACE_H
+
+#include <alcor2/alcor_trace.h>
+#include <alcor2/types.h>
+
+/** @brief True while tracing is on: a NOP, or a jump to the true branch. */
+__attribute__((always_inline)) static inline bool trace_on(void)
+{
+  __asm__ goto("1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n"
+               ".pushsection .trace_sites, \"a\"\n"
+               ".balign 4\n"
+               ".long 1b - ., %l[on] - .\n"
+               ".popsection\n"
+               :
+               :
+               :
+               : on);
+  return false;
+on:
+  return true;
+}
+
+/**
+ * @brief Record @p event with its arguments, if its category is traced.
+ * @param event ::ALCOR_TRACE_SYSCALL_ENTER, ...
+ */
+void trace_emit(u32 event, u64 a0, u64 a1, u64 a2);
+
+/** @brief Tracepoint: record @p event with arguments when tracing is on. */
+#define TRACE(event, a0, a1, a2)                                               \
+  do {                                                                         \
+    if(trace_on())                                                             \
+      trace_emit((event), (u64)(a0), (u64)(a1), (u64)(a2));                    \
+  } while(0)
+
+#endif
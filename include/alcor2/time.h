@@ -0,0 +1,46 @@
+/**
+ * @file include/alcor2/time.h
+ * @brief Kernel clocks: CLOCK_MONOTONIC and CLOCK_REALTIME.
+ *
+ * CLOCK_MONOTONIC counts from kernel entry (::time_boot_stamp), from the
+ * TSC when it is present and calibrates (the PIT then runs one-shot), else
+ * from ::time_init on, in PIT ticks. It is the kernel's one time base:
+ * scheduling, timeouts and timers all use ::time_monotonic_ns.
+ * CLOCK_REALTIME adds the CMOS clock reading taken at the same moment. The
+ * vDSO computes the same values from the parameters in ::time_vdso_data.
+ */
+
+#ifndef ALCOR2_TIME_H
+#define ALCOR2_TIME_H
+
+#include <alcor2/proc/vdso.h>
+#include <alcor2/types.h>
+
+#define NSEC_PER_SEC  1000000000ULL
+#define NSEC_PER_USEC 1000ULL
+
+/**
+ * @brief Note the TSC at kernel entry, where CLOCK_MONOTONIC starts.
+ * @return The TSC reading, or 0 without a TSC.
+ */
+u64 time_boot_stamp(void);
+
+/** @brief Calibrate the TSC and read the wall clock (after ::pit_init). */
+void time_init(void);
+
+/** @brief Nanoseconds since boot. */
+u64 time_monotonic_ns(void);
+
+/** @brief TSC ticks per second, 0 if the clocks do not use the TSC. */
+u64 time_tsc_hz(void);
+
+/** @brief Granularity of both clocks in nanoseconds (1 with the TSC). */
+u64 time_resolution_ns(void);
+
+/** @brief Nanoseconds since the Unix epoch. */
+u64 time_realtime_ns(void);
+
+/** @brief Clock parameters published to user space through the vvar page. */
+const vdso_data_t *time_vdso_data(void);
+
+#endif
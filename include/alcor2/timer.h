@@ -0,0 +1,61 @@
+/**
+ * @file include/alcor2/timer.h
+ * @brief One-shot kernel timers on CLOCK_MONOTONIC.
+ *
+ * A ::ktimer_t is armed for an absolute deadline in nanoseconds of
+ * ::time_monotonic_ns and runs its callback, from the timer interrupt,
+ * once that deadline has passed. Armed timers are kept on one list in
+ * deadline order, so the interrupt only looks at the front, and the PIT
+ * is programmed to fire when the earliest one is due rather than at the
+ * next 10 ms tick.
+ *
+ * All calls must be made with interrupts disabled, under the kernel lock;
+ * any CPU may arm a timer, but callbacks run on the BSP. A callback may
+ * re-arm its own timer.
+ */
+
+#ifndef ALCOR2_TIMER_H
+#define ALCOR2_TIMER_H
+
+#include <alcor2/types.h>
+
+/** @brief A one-shot timer; embedded in the object it belongs to. */
+typedef struct ktimer
+{
+  u64            expires; /**< Deadline (monotonic ns); 0 when not armed. */
+  struct ktimer *prev;    /**< Deadline list links. */
+  struct ktimer *next;
+  /** @brief Run from the timer interrupt once @c expires has passed. */
+  void (*func)(struct ktimer *t);
+  void *arg; /**< For @c func. */
+} ktimer_t;
+
+/** @brief Prepare @p t to run @p func(@p t) when it expires. */
+void timer_init(ktimer_t *t, void (*func)(ktimer_t *t), void *arg);
+
+/**
+ * @brief Arm @p t for @p expires, replacing any earlier deadline.
+ * @param expires Monotonic nanoseconds; a time already past fires on the
+ *                next timer interrupt.
+ */
+void timer_arm(ktimer_t *t, u64 expires);
+
+/** @brief Disarm @p t if it is armed. */
+void timer_cancel(ktimer_t *t);
+
+/** @brief True while @p t is armed and has not fired. */
+static inline bool timer_pending(const ktimer_t *t)
+{
+  return t->expires != 0;
+}
+
+/**
+ * @brief Fire every timer due at @p now (called from the PIT IRQ).
+ * @return Deadline of the earliest timer still armed, or 0 if none is.
+ */
+u64 timer_run(u64 now);
+
+/** @brief Deadline of the earliest armed timer, or 0 if none is. */
+u64 timer_next(void);
+
+#endif
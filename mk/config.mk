@@ -47,10 +47,22 @@ endif
 # Kernel compile / link
 CFLAGS := -std=gnu11 -Wall -Wextra -Werror \
           -ffreestanding -fno-stack-protector -fno-stack-check \
-          -fno-lto -fPIE -m64 -march=x86-64 \
+          -fno-lto -fPIE -fno-omit-frame-pointer -m64 -march=x86-64 \
           -mno-80387 -mno-mmx -mno-sse -mno-sse2 -mno-red-zone \
           -I$(INCLUDE) -MMD -MP
 
+# HEAP_TAG=1: record each kernel allocation's call site (/proc/heapinfo).
+HEAP_TAG ?= 0
+ifeq ($(HEAP_TAG),1)
+  CFLAGS += -DHEAP_TAG_SITES=1
+endif
+
+# IRQSOFF=1: time every interrupts-off stretch (/proc/irqsoff).
+IRQSOFF ?= 0
+ifeq ($(IRQSOFF),1)
+  CFLAGS += -DIRQSOFF_TRACE=1
+endif
+
 LDFLAGS := -nostdlib -static -pie --no-dynamic-linker \
            -z text -z max-page-size=0x1000 -T scripts/linker.ld
 
@@ -66,6 +78,16 @@ QEMU       ?= qemu-system-x86_64
 QEMU_RAM   ?= 2048M
 USE_KVM    ?=
 
+# COM1 on the terminal QEMU runs in (kernel reports such as bench).
+QEMU_SERIAL ?= -serial stdio
+
+# Virtio NIC on QEMU's user-mode network (guest 10.0.2.15, host 10.0.2.2);
+# e.g. add ,hostfwd=tcp::8080-:80 to reach a guest server. Empty: no NIC.
+QEMU_NET ?= -netdev user,id=net0 -device virtio-net-pci,netdev=net0
+
+# Kernel command line, appended to limine.conf in the ISO (e.g. bench).
+KERNEL_CMDLINE ?=
+
 QEMU_KVM := -cpu max
 ifeq ($(UNAME),Linux)
   ifeq ($(USE_KVM),0)
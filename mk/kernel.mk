@@ -1,6 +1,8 @@
 # Kernel object tree + unified compile_commands (kernel .c + user/apps .cpp)
 
-KERNEL_SRCS_C   := $(shell find $(SRC) -name '*.c')
+# The vDSO is user code: it is linked on its own, not into the kernel.
+VDSO_DIR        := $(SRC)/arch/x86_64/vdso
+KERNEL_SRCS_C   := $(shell find $(SRC) -path $(VDSO_DIR) -prune -o -name '*.c' -print)
 KERNEL_SRCS_ASM := $(shell find $(SRC) -name '*.asm')
 
 OBJS := $(patsubst $(SRC)/%.c,$(BUILD)/%.c.o,$(KERNEL_SRCS_C)) \
@@ -22,6 +24,25 @@ $(BUILD)/%.asm.o: $(SRC)/%.asm
 	@mkdir -p $(@D)
 	$(AS) $(ASFLAGS) $< -o $@
 
+# vDSO: position-independent shared object, embedded by vdso_image.asm.
+VDSO_SO      := $(BUILD)/vdso/vdso.so
+VDSO_CFLAGS  := -std=gnu11 -Wall -Wextra -Werror -O2 \
+                -ffreestanding -fno-stack-protector -fno-stack-check \
+                -fno-lto -fPIC -fno-asynchronous-unwind-tables -m64 \
+                -march=x86-64 -mno-80387 -mno-mmx -mno-sse -mno-sse2 \
+                -I$(INCLUDE)
+VDSO_LDFLAGS := -shared -nostdlib -Wl,-T,$(VDSO_DIR)/vdso.lds \
+                -Wl,-soname=linux-vdso.so.1 -Wl,--hash-style=both \
+                -Wl,--build-id=none -Wl,--no-undefined \
+                -Wl,-z,max-page-size=0x1000
+
+$(VDSO_SO): $(VDSO_DIR)/vdso.c $(VDSO_DIR)/vdso.lds
+	@mkdir -p $(@D)
+	$(CC) $(VDSO_CFLAGS) $(VDSO_LDFLAGS) $< -o $@
+
+$(BUILD)/arch/x86_64/vdso_image.asm.o: $(VDSO_SO)
+$(BUILD)/arch/x86_64/vdso_image.asm.o: ASFLAGS += -DVDSO_SO='"$(VDSO_SO)"'
+
 $(BUILD)/$(KERNEL): $(OBJS)
 	@mkdir -p $(@D)
 	$(LD) $(LDFLAGS) $^ -o $@
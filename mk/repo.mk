@@ -17,6 +17,7 @@ help:
 	@echo "  disk-mount / disk-umount   manual inspect of $(DISK)"
 	@echo "  disk-resync       user + disk-populate"
 	@echo "  make run USE_KVM=0   slower CPU emu (TCG); KVM itself does not use sudo"
+	@echo "  make run KERNEL_CMDLINE=bench   boot-time kernel micro-benchmarks (also on serial)"
 	@echo "  toolchain         bootstrap fb_tty + ncurses + on-disk clang (long: ~1h on first run)"
 	@echo "  musl | musl-cross | clang | ncurses | freetype | harfbuzz   individual bootstrap targets"
 	@echo "  format lint check qa — static analysis / style"
@@ -32,6 +33,7 @@ user: thirdparty/musl/$(MUSL_PREFIX)/lib/libc.a
 	$(MAKE) -C user/apps/shell
 	$(MAKE) -C user/apps/vega
 	$(MAKE) -C user/bin
+	$(MAKE) -C user/bench
 	@if [ -f thirdparty/musl-cross/bin/x86_64-linux-musl-g++ ]; then \
 		$(MAKE) -C user/apps; \
 	else \
@@ -45,6 +47,10 @@ iso-kernel: $(BUILD)/$(KERNEL) thirdparty/limine/limine
 	@mkdir -p $(BUILD)/iso/boot/limine $(BUILD)/iso/EFI/BOOT
 	@cp $(BUILD)/$(KERNEL) $(BUILD)/iso/boot/
 	@cp scripts/limine.conf $(BUILD)/iso/boot/limine/
+	@if [ -n "$(KERNEL_CMDLINE)" ]; then \
+		printf '\n    cmdline: %s\n' "$(KERNEL_CMDLINE)" \
+			>> $(BUILD)/iso/boot/limine/limine.conf; \
+	fi
 	@cp thirdparty/limine/limine-bios.sys      $(BUILD)/iso/boot/limine/
 	@cp thirdparty/limine/limine-bios-cd.bin   $(BUILD)/iso/boot/limine/
 	@cp thirdparty/limine/limine-uefi-cd.bin   $(BUILD)/iso/boot/limine/
@@ -65,7 +71,14 @@ iso: toolchain $(BUILD)/$(KERNEL) thirdparty/limine/limine user
 	@cp user/build/apps/shell.elf $(BUILD)/iso/boot/ 2>/dev/null || true
 	@cp user/build/bin/*.elf $(BUILD)/iso/bin/ 2>/dev/null || true
 	@cp user/build/apps/*.elf $(BUILD)/iso/bin/ 2>/dev/null || true
+	@sh scripts/mkinitramfs.sh $(BUILD)/iso/boot/initramfs.cpio
 	@cp scripts/limine.conf $(BUILD)/iso/boot/limine/
+	@printf '\n    module_path: boot():/boot/initramfs.cpio' \
+		>> $(BUILD)/iso/boot/limine/limine.conf
+	@if [ -n "$(KERNEL_CMDLINE)" ]; then \
+		printf '\n    cmdline: %s\n' "$(KERNEL_CMDLINE)" \
+			>> $(BUILD)/iso/boot/limine/limine.conf; \
+	fi
 	@cp thirdparty/limine/limine-bios.sys      $(BUILD)/iso/boot/limine/
 	@cp thirdparty/limine/limine-bios-cd.bin   $(BUILD)/iso/boot/limine/
 	@cp thirdparty/limine/limine-uefi-cd.bin   $(BUILD)/iso/boot/limine/
@@ -117,18 +130,34 @@ disk-populate: user
 	@echo "stage → $(DISK_ROOT)"
 	@rm -rf $(DISK_ROOT)
 	@mkdir -p $(DISK_ROOT)/bin $(DISK_ROOT)/etc $(DISK_ROOT)/tmp $(DISK_ROOT)/home \
+		$(DISK_ROOT)/lib \
 		$(DISK_ROOT)/usr/bin \
 		$(DISK_ROOT)/usr/include $(DISK_ROOT)/usr/lib
 	@sh scripts/macos-disk-preserve.sh $(DISK) $(DISK_ROOT) || true
 	@cp user/build/bin/*.elf  $(DISK_ROOT)/bin/ 2>/dev/null || true
 	@cp user/build/apps/*.elf $(DISK_ROOT)/bin/ 2>/dev/null || true
 	@for f in $(DISK_ROOT)/bin/*.elf; do [ -f "$$f" ] && mv "$$f" "$${f%.elf}"; done
+	@mkdir -p $(DISK_ROOT)/bench
+	@for f in user/build/bench/*.elf; do \
+		[ -f "$$f" ] && cp "$$f" "$(DISK_ROOT)/bench/$$(basename "$$f" .elf)"; \
+	done; true
+	@if [ -f $(BUILD)/$(KERNEL) ]; then \
+		mkdir -p $(DISK_ROOT)/boot; cp $(BUILD)/$(KERNEL) $(DISK_ROOT)/boot/; \
+	fi
 
 	@cp -r thirdparty/musl/$(MUSL_PREFIX)/include/. $(DISK_ROOT)/usr/include/
 	@cp thirdparty/musl/$(MUSL_PREFIX)/lib/libc.a $(DISK_ROOT)/usr/lib/libc.a
 	@cp thirdparty/musl/$(MUSL_PREFIX)/lib/crt1.o $(DISK_ROOT)/usr/lib/crt1.o
 	@cp thirdparty/musl/$(MUSL_PREFIX)/lib/crti.o $(DISK_ROOT)/usr/lib/crti.o
 	@cp thirdparty/musl/$(MUSL_PREFIX)/lib/crtn.o $(DISK_ROOT)/usr/lib/crtn.o
+	@if [ -f thirdparty/musl/$(MUSL_PREFIX)/lib/libc.so ]; then \
+		cp thirdparty/musl/$(MUSL_PREFIX)/lib/libc.so $(DISK_ROOT)/lib/libc.so; \
+		ln -sf libc.so $(DISK_ROOT)/lib/ld-musl-x86_64.so.1; \
+	fi
+	@for f in thirdparty/musl-cross/x86_64-linux-musl/lib/libstdc++.so* \
+		  thirdparty/musl-cross/x86_64-linux-musl/lib/libgcc_s.so*; do \
+		[ -e "$$f" ] && cp -P "$$f" $(DISK_ROOT)/lib/; \
+	done; true
 	@if [ -f thirdparty/ncurses-install/usr/lib/libncurses.a ]; then \
 		echo "[disk-root] ncurses"; \
 		cp thirdparty/ncurses-install/usr/lib/libncurses.a $(DISK_ROOT)/usr/lib/; \
@@ -202,7 +231,7 @@ disk-resync: user disk-populate
 run: iso disk-populate
 	$(QEMU) -cdrom $(BUILD)/$(ISO) \
 		-drive file=$(DISK),format=raw,if=ide,cache=writeback \
-		-boot order=d -m $(QEMU_RAM) $(QEMU_KVM)
+		-boot order=d -m $(QEMU_RAM) $(QEMU_KVM) $(QEMU_SERIAL) $(QEMU_NET)
 
 clean:
 	rm -rf $(BUILD)
@@ -214,6 +243,7 @@ clean:
 	-$(MAKE) -C user/apps/shell clean
 	-$(MAKE) -C user/apps/vega clean
 	-$(MAKE) -C user/bin clean
+	-$(MAKE) -C user/bench clean
 	-$(MAKE) -C user/apps clean
 
 distclean: clean
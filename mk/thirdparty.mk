@@ -61,7 +61,7 @@ thirdparty/musl/$(MUSL_PREFIX)/lib/libc.a:
 	@curl -sL $(MUSL_URL) | tar xz -C thirdparty
 	@mv thirdparty/musl-$(MUSL_VER) thirdparty/musl
 	@cd thirdparty/musl && ./configure --prefix=$$(pwd)/$(MUSL_PREFIX) \
-		--disable-shared $(MUSL_CONFIGURE_EXTRA) \
+		--syslibdir=$$(pwd)/$(MUSL_PREFIX)/lib $(MUSL_CONFIGURE_EXTRA) \
 		CFLAGS='-Os -fno-stack-protector' >/dev/null
 	@$(MAKE) -C thirdparty/musl -j$(JOBS) >/dev/null
 	@$(MAKE) -C thirdparty/musl install >/dev/null
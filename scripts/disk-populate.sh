@@ -9,12 +9,15 @@
 #
 #   /bin/        shell … font-demo (+ Fira Code TTF when built), cc-wrapper …
 #   /usr/bin/    cxx (alias of cc-wrapper)
+#   /lib/        libc.so + ld-musl-x86_64.so.1 (dynamic loader), libstdc++.so …
+#   /bench/      micro-benchmarks (benchall runs them all, JSON out)
 #   /usr/lib/    crt1.o … libc.a libncurses.a libtinfo.a libgcc*.a libstdc++.a …
 #   /usr/include musl + ncurses headers (curses.h, …)
 #   /usr/share/terminfo   optional — from host `make ncurses`
 #   /etc/profile TERM default + hints
 #   /home/       sample sources (simple.c, hi.c, ncurses-demo.c when ncurses present)
 #   /etc/motd    welcome banner
+#   /boot/alcor2.elf      kernel image, for kprof's symbols (when built)
 
 set -eu
 
@@ -48,9 +51,9 @@ LLD_BIN=$CLANG_INSTALL/usr/bin/lld
 
 # ----- 1. Skeleton -----------------------------------------------------------
 $S mkdir -p \
-  "$MNT/bin" "$MNT/etc" "$MNT/tmp" "$MNT/home" \
+  "$MNT/bin" "$MNT/etc" "$MNT/tmp" "$MNT/home" "$MNT/lib" \
   "$MNT/usr/bin" "$MNT/usr/include" "$MNT/usr/lib" \
-  "$MNT/usr/lib/clang"
+  "$MNT/usr/lib/clang" "$MNT/var/cache/cc"
 
 # Sample sources for testing the in-OS toolchains.
 printf 'int main(void){return 0;}\n' \
@@ -71,6 +74,20 @@ for f in "$USER_BUILD/bin"/*.elf "$USER_BUILD/apps"/*.elf; do
   $S cp "$f" "$MNT/bin/$bn"
 done
 
+# Benchmarks: /bench/benchall -o FILE runs them all.
+$S rm -rf "$MNT/bench"
+$S mkdir -p "$MNT/bench"
+for f in "$USER_BUILD/bench"/*.elf; do
+  [ -f "$f" ] || continue
+  $S cp "$f" "$MNT/bench/$(basename "$f" .elf)"
+done
+
+# Kernel image: kprof names sampled addresses from its symbol table.
+if [ -f "$BUILD/alcor2.elf" ]; then
+  $S mkdir -p "$MNT/boot"
+  $S cp "$BUILD/alcor2.elf" "$MNT/boot/alcor2.elf"
+fi
+
 # Fonts for font-demo (FreeType + HarfBuzz on guest).
 fd_fira="$USER_BUILD/apps/font-demo/FiraCode-Regular.ttf"
 [ -f "$fd_fira" ] && $S cp "$fd_fira" "$MNT/bin/FiraCode-Regular.ttf"
@@ -106,6 +123,17 @@ for lib in libm libpthread librt libdl; do
   [ -f "$src" ] && $S cp "$src" "$MNT/usr/lib/$lib.a" || true
 done
 
+# Shared libc; musl's loader is the same object under the PT_INTERP name.
+if [ -f "$MUSL/lib/libc.so" ]; then
+  $S cp "$MUSL/lib/libc.so" "$MNT/lib/libc.so"
+  $S ln -sf libc.so "$MNT/lib/ld-musl-x86_64.so.1"
+fi
+# The C++ apps link libstdc++ and libgcc_s dynamically (user/common.mk).
+for pat in 'libstdc++.so*' 'libgcc_s.so*'; do
+  find "$MUSL_SYSROOT/lib" -maxdepth 1 -name "$pat" 2>/dev/null \
+    | while read -r f; do $S cp -P "$f" "$MNT/lib/"; done
+done
+
 # ----- 4. Clang/LLD toolchain (optional, requires `make clang`) -------------
 if [ -n "$CLANG_BIN" ] && [ -f "$CLANG_BIN" ]; then
   # 4a. Real clang + lld binaries. The wrapper at /bin/clang execs clang.real,
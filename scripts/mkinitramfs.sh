@@ -0,0 +1,41 @@
+#!/bin/sh
+# scripts/mkinitramfs.sh — pack the Alcor2 initramfs (newc cpio).
+#
+# Called by `make iso`. The first argument is the archive to write. Limine
+# loads it as a module; the kernel unpacks it into ramfs on / and mounts
+# the ext2 disk over it once the disk is ready.
+#
+# Layout produced:
+#
+#   /bin/        shell, vega and the small tools (ls, cat, echo, …)
+#   /etc/profile TERM default
+#   /etc/motd    one-line banner
+#   /tmp/ /home/ empty, writable
+
+set -eu
+
+OUT=${1:?output archive}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+USER_BUILD=$ROOT/user/build
+STAGE=$ROOT/build/initramfs
+
+rm -rf "$STAGE"
+mkdir -p "$STAGE/bin" "$STAGE/etc" "$STAGE/tmp" "$STAGE/home"
+
+# Toolchain drivers and large apps stay on the disk.
+for f in "$USER_BUILD/bin"/*.elf "$USER_BUILD/apps/shell.elf" \
+         "$USER_BUILD/apps/vega.elf"; do
+  [ -f "$f" ] || continue
+  bn=$(basename "$f" .elf)
+  [ "$bn" = cc ] && continue
+  cp "$f" "$STAGE/bin/$bn"
+done
+
+cat > "$STAGE/etc/profile" <<'PROFILE'
+# Alcor2 initramfs environment — use: . /etc/profile
+export TERM="${TERM:-xterm-256color}"
+PROFILE
+echo "Welcome to Alcor2 (initramfs)." > "$STAGE/etc/motd"
+
+(cd "$STAGE" && find . | LC_ALL=C sort | cpio -o -H newc --quiet) > "$OUT"
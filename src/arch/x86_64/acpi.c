@@ -0,0 +1,91 @@
+/**
+ * @file src/arch/x86_64/acpi.c
+ * @brief ACPI static table lookup (see alcor2/arch/acpi.h).
+ *
+ * acpi_init maps every table the root table lists, once, so lookups are a
+ * scan of a small array and never touch the MMIO window again.
+ */
+
+#include <alcor2/arch/acpi.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/vmm.h>
+
+/** @brief Tables remembered at most. */
+#define ACPI_MAX_TABLES 32
+/** @brief Larger tables are assumed corrupt and skipped. */
+#define ACPI_TABLE_MAX  (64U * 1024)
+
+/** @brief Root System Description Pointer (ACPI 2.0 layout). */
+typedef struct PACKED
+{
+  char sig[8]; /**< "RSD PTR ". */
+  u8   checksum;
+  char oem_id[6];
+  u8   revision; /**< 0 for ACPI 1.0 (no XSDT), 2 from 2.0 on. */
+  u32  rsdt;
+  u32  length;
+  u64  xsdt;
+  u8   xchecksum;
+  u8   reserved[3];
+} acpi_rsdp_t;
+
+static const acpi_header_t *tables[ACPI_MAX_TABLES];
+static u32                  ntables;
+
+/* The bytes of a table add up to 0 mod 256. */
+static bool acpi_checksum_ok(const void *p, u64 len)
+{
+  const u8 *b   = p;
+  u8        sum = 0;
+  for(u64 i = 0; i < len; i++)
+    sum += b[i];
+  return sum == 0;
+}
+
+/* Map the table at @p phys: its header to learn the length, then all. */
+static const acpi_header_t *acpi_map(u64 phys)
+{
+  const acpi_header_t *h = vmm_map_mmio(phys, sizeof(*h));
+  if(!h || h->length < sizeof(*h) || h->length > ACPI_TABLE_MAX)
+    return NULL;
+  const acpi_header_t *t = vmm_map_mmio(phys, h->length);
+  return t && acpi_checksum_ok(t, t->length) ? t : NULL;
+}
+
+void acpi_init(const struct limine_rsdp_response *rsdp)
+{
+  if(!rsdp || !rsdp->address)
+    return;
+  const acpi_rsdp_t *r = vmm_map_mmio(rsdp->address, sizeof(*r));
+  if(!r || kstrncmp(r->sig, "RSD PTR ", 8) != 0 ||
+     !acpi_checksum_ok(r, offsetof(acpi_rsdp_t, length)))
+    return;
+
+  /* The XSDT lists 64-bit addresses, the RSDT 32-bit ones. */
+  bool                 x    = r->revision >= 2 && r->xsdt;
+  const acpi_header_t *root = acpi_map(x ? r->xsdt : r->rsdt);
+  if(!root)
+    return;
+
+  u32       esize = x ? 8 : 4;
+  u32       n     = (root->length - (u32)sizeof(*root)) / esize;
+  const u8 *ent   = (const u8 *)(root + 1);
+  for(u32 i = 0; i < n && ntables < ACPI_MAX_TABLES; i++) {
+    u64 phys = 0;
+    kmemcpy(&phys, ent + i * esize, esize);
+    const acpi_header_t *t = phys ? acpi_map(phys) : NULL;
+    if(t)
+      tables[ntables++] = t;
+  }
+  console_printf("[ACPI] %u tables (%s)\n", ntables, x ? "XSDT" : "RSDT");
+}
+
+const acpi_header_t *acpi_find_table(const char *sig)
+{
+  for(u32 i = 0; i < ntables; i++) {
+    if(kstrncmp(tables[i]->sig, sig, 4) == 0)
+      return tables[i];
+  }
+  return NULL;
+}
@@ -4,7 +4,9 @@
  */
 
 #include <alcor2/arch/cpu.h>
+#include <alcor2/arch/fpu.h>
 #include <alcor2/drivers/console.h>
+#include <alcor2/sys/irqsoff.h>
 
 /** @brief MSR register for FS base (thread-local storage). */
 #define MSR_FS_BASE 0xC0000100
@@ -41,7 +43,14 @@ void cpu_pause(void)
  */
 void cpu_disable_interrupts(void)
 {
+#if IRQSOFF_TRACE
+  u64 flags = cpu_read_flags();
   __asm__ volatile("cli");
+  if(flags & CPU_RFLAGS_IF)
+    irqsoff_begin((u64)__builtin_return_address(0));
+#else
+  __asm__ volatile("cli");
+#endif
 }
 
 /**
@@ -52,6 +61,10 @@ void cpu_disable_interrupts(void)
  */
 void cpu_enable_interrupts(void)
 {
+#if IRQSOFF_TRACE
+  if(!(cpu_read_flags() & CPU_RFLAGS_IF))
+    irqsoff_end((u64)__builtin_return_address(0));
+#endif
   __asm__ volatile("sti");
 }
 
@@ -84,14 +97,8 @@ u64 cpu_get_fs_base(void)
   return ((u64)hi << 32) | lo;
 }
 
-/**
- * @brief Enable SSE and FPU instructions.
- *
- * Configures CR0 and CR4 to enable SSE/SSE2 instructions and floating-point
- * operations. Initializes the FPU state. Must be called during kernel
- * initialization.
- */
-void cpu_enable_sse(void)
+/* Set the CR0 and CR4 bits for the FPU, SSE and XSAVE on this CPU. */
+static void sse_setup(void)
 {
   u64 cr0, cr4;
 
@@ -127,20 +134,27 @@ void cpu_enable_sse(void)
 
   /* Write CR4 */
   __asm__ volatile("mov %0, %%cr4" ::"r"(cr4));
+}
 
-  /* Initialize FPU */
-  __asm__ volatile("fninit");
-
-  if(ecx1 & (1UL << 26)) {
-    u64 xcr0 = (1UL << 0) | (1UL << 1); /* x87 + SSE */
-    if(ecx1 & (1UL << 28))
-      xcr0 |= (1UL << 2); /* AVX */
-    __asm__ volatile("xsetbv" ::"a"((u32)xcr0), "d"((u32)(xcr0 >> 32)), "c"(0));
-  }
+/**
+ * @brief Enable SSE and FPU instructions.
+ *
+ * Configures CR0 and CR4 to enable SSE/SSE2 instructions and floating-point
+ * operations. Initializes the FPU state. Must be called during kernel
+ * initialization.
+ */
+void cpu_enable_sse(void)
+{
+  sse_setup();
 
-  /* Capture a known-good FPU state to copy into each fresh proc on alloc. */
-  extern void proc_capture_default_fpu(void);
-  proc_capture_default_fpu();
+  /* Set XCR0 and capture the state each process starts from. */
+  fpu_init();
 
   console_print("[CPU] SSE/AVX/FPU enabled\n");
 }
+
+void cpu_enable_sse_cpu(void)
+{
+  sse_setup();
+  fpu_init_cpu();
+}
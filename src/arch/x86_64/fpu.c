@@ -0,0 +1,252 @@
+/**
+ * @file src/arch/x86_64/fpu.c
+ * @brief Lazy x87/SSE/AVX state switching.
+ *
+ * The kernel is built without SSE and never touches the FPU, so the
+ * registers keep the state of their owner, the process that used them
+ * last, across any number of switches. Running anyone else sets CR0.TS;
+ * when that process executes an FPU instruction the #NM trap saves the
+ * owner's state and loads its own. A process gets a save area on its
+ * first FPU instruction, so integer-only processes never have one.
+ *
+ * State is saved with XSAVEOPT where available (it skips components that
+ * were not changed since they were loaded), else XSAVE, else FXSAVE.
+ *
+ * Each CPU has its own owner. A process whose state is live on one CPU is
+ * not moved to another (see fpu_held_elsewhere); a CPU going idle saves its
+ * owner's state first, so that the process is free to move.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/fpu.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/errno.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/proc/proc.h>
+
+#define CR0_TS (1UL << 3)
+
+#define CPUID_1_ECX_XSAVE     (1U << 26)
+#define CPUID_LEAF_XSTATE     0xD
+#define CPUID_D1_EAX_XSAVEOPT (1U << 0)
+
+/** @name XCR0 components */
+#define XFEATURE_X87    (1ULL << 0)
+#define XFEATURE_SSE    (1ULL << 1)
+#define XFEATURE_AVX    (1ULL << 2)
+#define XFEATURE_AVX512 (7ULL << 5) /**< Opmask, ZMM_Hi256, Hi16_ZMM. */
+
+#define FXSAVE_SIZE  512
+/** @brief Largest save area taken (x87 through AVX-512 is 2.7 KiB). */
+#define FPU_MAX_SIZE 4096
+#define FPU_ALIGN    64
+/** @brief Slab objects are 16-byte aligned; pad to align the area. */
+#define FPU_SLACK    (FPU_ALIGN - 16)
+
+typedef enum
+{
+  FPU_FXSAVE,
+  FPU_XSAVE,
+  FPU_XSAVEOPT,
+} fpu_save_t;
+
+static fpu_save_t    save_insn  = FPU_FXSAVE;
+static u64           xfeatures;
+static u32           state_size = FXSAVE_SIZE;
+static kmem_cache_t *state_cache;
+/** @brief State right after FNINIT, loaded by a process's first use. */
+static u8            init_state[FPU_MAX_SIZE]
+    __attribute__((aligned(FPU_ALIGN)));
+/** @brief Process whose state is in each CPU's registers, or NULL. */
+static proc_t       *owner[SMP_MAX_CPUS];
+/** @brief Each CPU's CR0.TS, as last set. */
+static bool          ts[SMP_MAX_CPUS];
+
+/** @brief Aligned save area inside the slab object @p raw. */
+static inline void *area(void *raw)
+{
+  return (void *)(((u64)raw + FPU_ALIGN - 1) & ~(u64)(FPU_ALIGN - 1));
+}
+
+static void xsetbv(u64 v)
+{
+  __asm__ volatile("xsetbv" ::"a"((u32)v), "d"((u32)(v >> 32)), "c"(0));
+}
+
+static void save(void *a, fpu_save_t insn)
+{
+  u32 lo = (u32)xfeatures, hi = (u32)(xfeatures >> 32);
+  switch(insn) {
+  case FPU_XSAVEOPT:
+    __asm__ volatile("xsaveopt64 (%0)" ::"r"(a), "a"(lo), "d"(hi) : "memory");
+    break;
+  case FPU_XSAVE:
+    __asm__ volatile("xsave64 (%0)" ::"r"(a), "a"(lo), "d"(hi) : "memory");
+    break;
+  default:
+    __asm__ volatile("fxsave64 (%0)" ::"r"(a) : "memory");
+    break;
+  }
+}
+
+static void restore(const void *a)
+{
+  u32 lo = (u32)xfeatures, hi = (u32)(xfeatures >> 32);
+  if(save_insn == FPU_FXSAVE)
+    __asm__ volatile("fxrstor64 (%0)" ::"r"(a) : "memory");
+  else
+    __asm__ volatile("xrstor64 (%0)" ::"r"(a), "a"(lo), "d"(hi) : "memory");
+}
+
+static void set_ts(bool on)
+{
+  u32 cpu = smp_cpu_id();
+  if(ts[cpu] == on)
+    return;
+  if(on) {
+    u64 cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %0, %%cr0" ::"r"(cr0 | CR0_TS));
+  } else {
+    __asm__ volatile("clts");
+  }
+  ts[cpu] = on;
+}
+
+/** @brief Enable @p want in XCR0 and return the save area size it needs. */
+static u32 xstate_enable(u64 want)
+{
+  u32 r[4];
+  xsetbv(want);
+  cpu_cpuid(CPUID_LEAF_XSTATE, 0, r);
+  return r[1];
+}
+
+void fpu_init(void)
+{
+  u32 r[4];
+  cpu_cpuid(1, 0, r);
+  if(r[2] & CPUID_1_ECX_XSAVE) {
+    cpu_cpuid(CPUID_LEAF_XSTATE, 0, r);
+    u64 supported = ((u64)r[3] << 32) | r[0];
+    xfeatures     = supported & (XFEATURE_X87 | XFEATURE_SSE | XFEATURE_AVX |
+                             XFEATURE_AVX512);
+    /* AVX-512 state is all three components on top of AVX, or none. */
+    if(!(xfeatures & XFEATURE_AVX) ||
+       (xfeatures & XFEATURE_AVX512) != XFEATURE_AVX512)
+      xfeatures &= ~XFEATURE_AVX512;
+
+    state_size = xstate_enable(xfeatures);
+    if(state_size > FPU_MAX_SIZE) {
+      xfeatures &= ~XFEATURE_AVX512;
+      state_size = xstate_enable(xfeatures);
+    }
+
+    cpu_cpuid(CPUID_LEAF_XSTATE, 1, r);
+    save_insn = (r[0] & CPUID_D1_EAX_XSAVEOPT) ? FPU_XSAVEOPT : FPU_XSAVE;
+  }
+
+  __asm__ volatile("fninit");
+  save(init_state, save_insn == FPU_FXSAVE ? FPU_FXSAVE : FPU_XSAVE);
+
+  state_cache = kmem_cache_create("fpu", state_size + FPU_SLACK, NULL);
+  console_printf(
+      "[FPU] %s, XCR0 0x%lx, %u-byte state\n",
+      save_insn == FPU_XSAVEOPT ? "XSAVEOPT"
+      : save_insn == FPU_XSAVE  ? "XSAVE"
+                                : "FXSAVE",
+      xfeatures, state_size
+  );
+}
+
+void fpu_init_cpu(void)
+{
+  if(save_insn != FPU_FXSAVE)
+    xsetbv(xfeatures);
+  __asm__ volatile("clts");
+}
+
+void fpu_switch(proc_t *next)
+{
+  set_ts(next != owner[smp_cpu_id()]);
+}
+
+void fpu_unload(void)
+{
+  proc_t **o = &owner[smp_cpu_id()];
+  if(!*o)
+    return;
+  set_ts(false);
+  save(area((*o)->fpu_state), save_insn);
+  *o = NULL;
+  set_ts(true);
+}
+
+bool fpu_held_elsewhere(const proc_t *p)
+{
+  u32 self = smp_cpu_id();
+  for(u32 i = 0; i < smp_cpu_count(); i++) {
+    if(i != self && owner[i] == p)
+      return true;
+  }
+  return false;
+}
+
+bool fpu_trap(void)
+{
+  proc_t *p = proc_current();
+  if(!p || !state_cache)
+    return false;
+
+  if(!p->fpu_state) {
+    p->fpu_state = kmem_cache_alloc(state_cache);
+    if(!p->fpu_state)
+      return false;
+    kmemcpy(area(p->fpu_state), init_state, state_size);
+  }
+
+  proc_t **o = &owner[smp_cpu_id()];
+  set_ts(false);
+  if(*o != p) {
+    if(*o)
+      save(area((*o)->fpu_state), save_insn);
+    restore(area(p->fpu_state));
+    *o = p;
+  }
+  return true;
+}
+
+int fpu_fork(proc_t *child, proc_t *parent)
+{
+  if(!parent->fpu_state)
+    return 0;
+  child->fpu_state = kmem_cache_alloc(state_cache);
+  if(!child->fpu_state)
+    return -ENOMEM;
+
+  /* The parent is running, so if it owns the registers TS is clear. */
+  if(owner[smp_cpu_id()] == parent)
+    save(area(parent->fpu_state), save_insn);
+  kmemcpy(area(child->fpu_state), area(parent->fpu_state), state_size);
+  return 0;
+}
+
+void fpu_release(proc_t *p)
+{
+  /* A zombie may be reaped on another CPU than it last ran on; that CPU
+   * runs someone else now, so its TS is already set. */
+  for(u32 i = 0; i < smp_cpu_count(); i++) {
+    if(owner[i] == p && i != smp_cpu_id())
+      owner[i] = NULL;
+  }
+  if(owner[smp_cpu_id()] == p) {
+    owner[smp_cpu_id()] = NULL;
+    set_ts(true);
+  }
+  if(p->fpu_state) {
+    kmem_cache_free(state_cache, p->fpu_state);
+    p->fpu_state = NULL;
+  }
+}
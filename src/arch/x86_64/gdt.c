@@ -4,6 +4,8 @@
  */
 
 #include <alcor2/arch/gdt.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/sys/syscall.h>
 
 /** @name GDT Access Flags */
 /**@{*/
@@ -24,31 +26,17 @@
 
 extern void gdt_load(gdt_ptr_t *gdtr);
 
-/*
- * Table layout is constrained by SYSRET/STAR semantics on AMD64: the MSR holds
- * a base segment selector such that STAR[63:48]+16 selects 64-bit user code,
- * STAR[63:48]+8 selects user data/stack, and STAR[63:48]+0 is the 32-bit
- * compat code slot. User data therefore sits immediately before user code in
- * the GDT (see @c user_data / @c user_code below).
- *
- * @c null plus four zeroed @c reserved entries pad indices so @c kernel_code
- * lands at selector @c GDT_KERNEL_CODE (0x28) expected elsewhere in the kernel.
- */
+static inline u64 rdmsr(u32 msr)
+{
+  u32 lo, hi;
+  __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((u64)hi << 32) | lo;
+}
 
-/** @brief GDT table with kernel/user segments and TSS. */
-static struct
+static inline void wrmsr(u32 msr, u64 v)
 {
-  gdt_entry_t     null;
-  gdt_entry_t     reserved[4];
-  gdt_entry_t     kernel_code; /**< 0x28 */
-  gdt_entry_t     kernel_data; /**< 0x30 */
-  gdt_entry_t     user_data;   /**< 0x38 - MUST precede user_code for SYSRET */
-  gdt_entry_t     user_code;   /**< 0x40 */
-  gdt_tss_entry_t tss;         /**< 0x48 */
-} PACKED         gdt;
-
-static gdt_ptr_t gdtr;
-static tss_t     tss;
+  __asm__ volatile("wrmsr" ::"a"((u32)v), "d"((u32)(v >> 32)), "c"(msr));
+}
 
 /**
  * @brief Set a standard GDT entry.
@@ -84,29 +72,31 @@ static void gdt_set_tss(gdt_tss_entry_t *entry, u64 base)
 }
 
 /**
- * @brief Initialize the Global Descriptor Table and load the TSS.
+ * @brief Initialize a Global Descriptor Table and load it with its TSS.
  *
  * Sets up kernel code/data segments, user code/data segments (with proper
  * ordering for SYSRET compatibility), and the Task State Segment. Loads
  * the GDT and switches to the new segments.
  */
-void gdt_init(void)
+void gdt_init_cpu(gdt_cpu_t *cpu)
 {
-  gdt_set_entry(&gdt.null, 0, 0);
+  gdt_table_t *gdt = &cpu->table;
+
+  gdt_set_entry(&gdt->null, 0, 0);
 
   for(int i = 0; i < 4; i++) {
-    gdt_set_entry(&gdt.reserved[i], 0, 0);
+    gdt_set_entry(&gdt->reserved[i], 0, 0);
   }
 
   gdt_set_entry(
-      &gdt.kernel_code,
+      &gdt->kernel_code,
       GDT_ACCESS_PRESENT | GDT_ACCESS_RING0 | GDT_ACCESS_SEGMENT |
           GDT_ACCESS_EXEC | GDT_ACCESS_RW,
       GDT_FLAG_LONG | GDT_FLAG_GRANULAR
   );
 
   gdt_set_entry(
-      &gdt.kernel_data,
+      &gdt->kernel_data,
       GDT_ACCESS_PRESENT | GDT_ACCESS_RING0 | GDT_ACCESS_SEGMENT |
           GDT_ACCESS_RW,
       GDT_FLAG_GRANULAR
@@ -114,26 +104,34 @@ void gdt_init(void)
 
   /* User data MUST come before user code for SYSRET compatibility */
   gdt_set_entry(
-      &gdt.user_data,
+      &gdt->user_data,
       GDT_ACCESS_PRESENT | GDT_ACCESS_RING3 | GDT_ACCESS_SEGMENT |
           GDT_ACCESS_RW,
       GDT_FLAG_GRANULAR
   );
 
   gdt_set_entry(
-      &gdt.user_code,
+      &gdt->user_code,
       GDT_ACCESS_PRESENT | GDT_ACCESS_RING3 | GDT_ACCESS_SEGMENT |
           GDT_ACCESS_EXEC | GDT_ACCESS_RW,
       GDT_FLAG_LONG | GDT_FLAG_GRANULAR
   );
 
-  tss.iopb = sizeof(tss_t);
-  gdt_set_tss(&gdt.tss, (u64)&tss);
+  cpu->tss.iopb = sizeof(tss_t);
+  gdt_set_tss(&gdt->tss, (u64)&cpu->tss);
+
+  cpu->gdtr.limit = sizeof(*gdt) - 1;
+  cpu->gdtr.base  = (u64)gdt;
 
-  gdtr.limit = sizeof(gdt) - 1;
-  gdtr.base  = (u64)&gdt;
+  /* Loading GS zeroes its base, which points at the CPU's ::cpu_t. */
+  u64 gs = rdmsr(MSR_GS_BASE);
+  gdt_load(&cpu->gdtr);
+  wrmsr(MSR_GS_BASE, gs);
+}
 
-  gdt_load(&gdtr);
+void gdt_init(void)
+{
+  gdt_init_cpu(&cpu_this()->gdt);
 }
 
 /**
@@ -147,5 +145,5 @@ void gdt_init(void)
  */
 void tss_set_rsp0(u64 rsp0)
 {
-  tss.rsp0 = rsp0;
+  cpu_this()->gdt.tss.rsp0 = rsp0;
 }
@@ -0,0 +1,106 @@
+/**
+ * @file src/arch/x86_64/idle.c
+ * @brief CPU idle: MONITOR/MWAIT with C-state selection, or HLT.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/idle.h>
+#include <alcor2/drivers/console.h>
+
+#define CPUID_LEAF_MWAIT 5
+#define CPUID1_MONITOR   (1U << 3) /* ECX */
+
+/*
+ * Target residency of each MWAIT C-state, C1 first: how long an idle
+ * period must last for entering it to pay off. Without ACPI _CST these are
+ * conservative figures for recent Intel and AMD parts.
+ */
+static const u64 cstate_residency_ns[IDLE_CSTATES] = {
+    0, 20000, 100000, 400000, 800000, 1600000, 3200000,
+};
+
+static bool mwait_ok;
+/** @brief MWAIT hint (EAX) per C-state, or 0xFF if not enumerated. */
+static u8   cstate_hint[IDLE_CSTATES];
+/** @brief Deepest enumerated C-state (index into cstate_hint). */
+static u32  cstate_deepest;
+/** @brief Monitored while parked; nothing writes it. */
+static u64  park_word;
+
+void cpu_idle_init(void)
+{
+  u32 r[4];
+  cpu_cpuid(0, 0, r);
+  u32 max_leaf = r[0];
+  cpu_cpuid(1, 0, r);
+  if(!(r[2] & CPUID1_MONITOR) || max_leaf < CPUID_LEAF_MWAIT) {
+    console_print("[IDLE] HLT\n");
+    return;
+  }
+
+  /* EDX[4n+3:4n] is the number of sub-states of C(n); C1 always works. */
+  cpu_cpuid(CPUID_LEAF_MWAIT, 0, r);
+  u32 edx       = r[3];
+  cstate_hint[0] = 0x00;
+  for(u32 i = 1; i < IDLE_CSTATES; i++) {
+    u32 subs       = (edx >> (4 * (i + 1))) & 0xF;
+    cstate_hint[i] = subs ? (u8)(i << 4) : 0xFF;
+    if(subs)
+      cstate_deepest = i;
+  }
+  mwait_ok = true;
+  console_printf("[IDLE] MWAIT, C1..C%u\n", cstate_deepest + 1);
+}
+
+/* Deepest enumerated C-state whose target residency fits @p budget_ns. */
+static u32 cstate_pick(u64 budget_ns)
+{
+  u32 c = 0;
+  for(u32 i = 1; i <= cstate_deepest; i++) {
+    if(cstate_hint[i] == 0xFF)
+      continue;
+    if(budget_ns && budget_ns < cstate_residency_ns[i])
+      break;
+    c = i;
+  }
+  return c;
+}
+
+static void mwait_arm(const volatile void *watch)
+{
+  __asm__ volatile("monitor" ::"a"(watch), "c"(0), "d"(0) : "memory");
+}
+
+void cpu_idle(const volatile void *watch, u64 budget_ns)
+{
+  if(!mwait_ok) {
+    cpu_enable_interrupts();
+    __asm__ volatile("hlt");
+    cpu_disable_interrupts();
+    return;
+  }
+
+  u32 c = cstate_pick(budget_ns);
+  /* Armed before IF is set: a wakeup that lands between the two has
+   * written @p watch, so MWAIT returns at once instead of sleeping. */
+  mwait_arm(watch);
+  cpu_enable_interrupts();
+  __asm__ volatile("mwait" ::"a"((u32)cstate_hint[c]), "c"(0) : "memory");
+  cpu_disable_interrupts();
+}
+
+NORETURN void cpu_idle_park(void)
+{
+  cpu_disable_interrupts();
+  for(;;) {
+    if(mwait_ok) {
+      /* IF clear and ECX[0] clear: only NMI, SMI or INIT end the wait. */
+      mwait_arm(&park_word);
+      __asm__ volatile("mwait" ::"a"((u32)cstate_hint[cstate_deepest]),
+                       "c"(0)
+                       : "memory");
+    } else {
+      __asm__ volatile("hlt");
+    }
+  }
+}
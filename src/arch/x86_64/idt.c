@@ -4,12 +4,22 @@
  */
 
 #include <alcor2/arch/cpu.h>
+#include <alcor2/arch/fpu.h>
 #include <alcor2/arch/gdt.h>
 #include <alcor2/arch/idt.h>
+#include <alcor2/arch/lapic.h>
 #include <alcor2/arch/pic.h>
+#include <alcor2/arch/smp.h>
 #include <alcor2/drivers/ata.h>
 #include <alcor2/drivers/console.h>
+#include <alcor2/fs/procfs.h>
+#include <alcor2/mm/memory_layout.h>
+#include <alcor2/mm/uaccess.h>
+#include <alcor2/mm/vma.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/sys/irqsoff.h>
+#include <alcor2/sys/kprof.h>
+#include <alcor2/sys/trace.h>
 
 extern void        pit_tick(void);
 extern void        keyboard_irq(void);
@@ -19,12 +29,14 @@ static idt_ptr_t   idtr;
 
 extern void       *isr_stub_table[];
 extern void       *irq_stub_table[];
+extern void       *msi_stub_table[];
 
 /** Vector layout: CPU exceptions, then PIC IRQs at 32..47.
  *  @c X86_SEGMENT_RPL_MASK masks the CS/SS RPL; user ring is 3. */
 enum
 {
   X86_EXCEPTION_VECTOR_COUNT = 32,
+  X86_VEC_DEVICE_NA          = 7,
   X86_VEC_PAGE_FAULT         = 14,
   X86_SEGMENT_RPL_MASK       = 3,
 };
@@ -78,10 +90,76 @@ void idt_set_gate(u8 vector, void *handler, u8 flags)
   idt[vector].reserved    = 0;
 }
 
+/** @brief Called by every stub but the TLB IPI's before its handler.
+ * @return 1 if it took the kernel lock, for interrupt_exit. */
+u64 interrupt_enter(void)
+{
+  if(cpu_this()->locked)
+    return 0;
+  kernel_lock();
+  return 1;
+}
+
+/** @brief Called by the same stubs after the handler. A CPU that took the
+ * lock here came from ring 3 or from idle; back to ring 3 it runs a READY
+ * process owed the CPU first, as syscalls do on their way out. */
+void interrupt_exit(u64 locked, const interrupt_frame_t *frame)
+{
+  if(!locked)
+    return;
+  if((frame->cs & X86_SEGMENT_RPL_MASK) == X86_SEGMENT_RPL_MASK)
+    proc_check_resched();
+  cpu_disable_interrupts();
+  kernel_unlock();
+}
+
 void exception_handler(interrupt_frame_t *frame)
 {
   int user_fault = (frame->cs & X86_SEGMENT_RPL_MASK) == X86_SEGMENT_RPL_MASK;
 
+  /* User-half faults may be demand paging or copy-on-write. This also
+   * covers the kernel touching user buffers inside a syscall; if that
+   * access is bad, the uaccess routine doing it returns -EFAULT. */
+  if(frame->vector == X86_VEC_PAGE_FAULT) {
+    u64 cr2;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+    TRACE(ALCOR_TRACE_FAULT_BEGIN, cr2, frame->error_code, 0);
+    /* A fault from code running with interrupts on opens a stretch. */
+    u64 site = frame->rflags & CPU_RFLAGS_IF ? IRQSOFF_FAULT | frame->vector
+                                             : 0;
+    if(site)
+      irqsoff_begin(site);
+    proc_t *p       = proc_current();
+    u64     inblock = p ? p->usage.inblock : 0;
+    bool    handled = cr2 < USER_SPACE_END &&
+                      vma_handle_fault(cr2, frame->error_code);
+    TRACE(ALCOR_TRACE_FAULT_END, cr2, handled, 0);
+    if(handled) {
+      /* Major if resolving it had to read from the disk. */
+      if(p && p->usage.inblock != inblock)
+        p->usage.majflt++;
+      else if(p)
+        p->usage.minflt++;
+      kstat.faults++;
+      if(site)
+        irqsoff_end(site);
+      return;
+    }
+    if(site)
+      irqsoff_end(site);
+    u64 fixup = 0;
+    if(cr2 < USER_SPACE_END && !user_fault)
+      fixup = uaccess_fixup(frame->rip);
+    if(fixup) {
+      frame->rip = fixup;
+      return;
+    }
+  }
+
+  /* The kernel never uses the FPU; from user mode #NM is a lazy switch. */
+  if(frame->vector == X86_VEC_DEVICE_NA && user_fault && fpu_trap())
+    return;
+
   if(!user_fault)
     console_print("\n\n*** KERNEL PANIC ***\n\n");
 
@@ -168,11 +246,72 @@ static const irq_def_t irq_table[] = {
     IRQ_DEF(IRQ_ATA_SECONDARY, "ata1", irq__ata1_wrapper), IRQ_END
 };
 
+/** @brief Handlers attached at run time (PCI devices), per IRQ line. */
+static irq_line_fn irq_lines[PIC_IRQ_LINE_COUNT][IRQ_LINE_SHARE_MAX];
+
+bool irq_register(u8 irq, irq_line_fn fn)
+{
+  if(irq >= PIC_IRQ_LINE_COUNT || !fn)
+    return false;
+  for(int i = 0; i < IRQ_LINE_SHARE_MAX; i++) {
+    if(!irq_lines[irq][i]) {
+      irq_lines[irq][i] = fn;
+      return true;
+    }
+  }
+  return false;
+}
+
+/** @brief Handlers of the MSI vectors, by vector - IRQ_MSI_VECTOR_BASE. */
+static irq_line_fn msi_fns[IRQ_MSI_VECTOR_COUNT];
+
+u8 irq_alloc_vector(irq_line_fn fn)
+{
+  if(!fn || !lapic_enabled())
+    return 0;
+  for(u8 i = 0; i < IRQ_MSI_VECTOR_COUNT; i++) {
+    if(!msi_fns[i]) {
+      msi_fns[i] = fn;
+      idt_set_gate(IRQ_MSI_VECTOR_BASE + i, msi_stub_table[i], IDT_GATE_INT);
+      return IRQ_MSI_VECTOR_BASE + i;
+    }
+  }
+  return 0;
+}
+
+void irq_free_vector(u8 vector)
+{
+  if(vector >= IRQ_MSI_VECTOR_BASE &&
+     vector < IRQ_MSI_VECTOR_BASE + IRQ_MSI_VECTOR_COUNT)
+    msi_fns[vector - IRQ_MSI_VECTOR_BASE] = NULL;
+}
+
+/** @brief Message-signalled interrupt @p n (called by the vector stubs). */
+void msi_handler(u8 n, const interrupt_frame_t *frame)
+{
+  (void)frame;
+  irqsoff_begin(IRQSOFF_IRQ | (IRQ_MSI_VECTOR_BASE + n));
+  kstat.msi++;
+  if(n < IRQ_MSI_VECTOR_COUNT && msi_fns[n])
+    msi_fns[n]();
+  lapic_eoi();
+  irqsoff_end(IRQSOFF_IRQ | (IRQ_MSI_VECTOR_BASE + n));
+}
+
 /* Set to 1 to trace hardware interrupts */
 #define IRQ_TRACE 0
 
-void irq_handler(u8 irq)
+void irq_handler(u8 irq, const interrupt_frame_t *frame)
 {
+  /* Interrupts were on, or this one could not have come in. */
+  irqsoff_begin(IRQSOFF_IRQ | irq);
+  if(irq < PIC_IRQ_LINE_COUNT)
+    kstat.irqs[irq]++;
+
+  /* Without a LAPIC, channel 0 drives the tick and so the profiler. */
+  if(irq == IRQ_TIMER)
+    kprof_sample(frame);
+
   for(const irq_def_t *d = irq_table; d->name != NULL; d++) {
     if(d->irq == irq) {
 #if IRQ_TRACE
@@ -184,7 +323,13 @@ void irq_handler(u8 irq)
     }
   }
 
+  if(irq < PIC_IRQ_LINE_COUNT) {
+    for(int i = 0; i < IRQ_LINE_SHARE_MAX && irq_lines[irq][i]; i++)
+      irq_lines[irq][i]();
+  }
+
   pic_eoi(irq);
+  irqsoff_end(IRQSOFF_IRQ | irq);
 }
 
 void idt_init(void)
@@ -202,5 +347,10 @@ void idt_init(void)
   idtr.limit = sizeof(idt) - 1;
   idtr.base  = (u64)&idt;
 
+  idt_load();
+}
+
+void idt_load(void)
+{
   __asm__ volatile("lidt %0" : : "m"(idtr));
 }
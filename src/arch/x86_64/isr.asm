@@ -2,6 +2,12 @@ bits 64
 
 extern exception_handler
 extern irq_handler
+extern lapic_timer_irq
+extern msi_handler
+extern interrupt_enter
+extern interrupt_exit
+extern smp_resched_irq
+extern smp_tlb_irq
 
 section .text
 
@@ -41,27 +47,54 @@ section .text
     pop rax
 %endmacro
 
+; With the vector and error code on top of the CPU's frame: from ring 3
+; (the saved CS has RPL 3) GS is the user's, so swap the kernel's in, or
+; back on the way out.
+%macro swapgs_if_user 0
+    test byte [rsp + 24], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
+; Save the registers and take the kernel lock unless this CPU holds it
+; already; rbx remembers which, for trap_exit.
+%macro trap_entry 0
+    swapgs_if_user
+    push_regs
+    call interrupt_enter
+    mov rbx, rax
+%endmacro
+
+; Drop the kernel lock if trap_entry took it (rescheduling first on the
+; way back to ring 3), then return.
+%macro trap_exit 0
+    mov rdi, rbx
+    mov rsi, rsp
+    call interrupt_exit
+    pop_regs
+    swapgs_if_user
+    add rsp, 16
+    iretq
+%endmacro
+
 %macro isr_no_err 1
 isr_stub_%1:
     push 0
     push %1
-    push_regs
+    trap_entry
     mov rdi, rsp
     call exception_handler
-    pop_regs
-    add rsp, 16
-    iretq
+    trap_exit
 %endmacro
 
 %macro isr_err 1
 isr_stub_%1:
     push %1
-    push_regs
+    trap_entry
     mov rdi, rsp
     call exception_handler
-    pop_regs
-    add rsp, 16
-    iretq
+    trap_exit
 %endmacro
 
 isr_no_err 0
@@ -101,12 +134,11 @@ isr_no_err 31
 irq_stub_%1:
     push 0
     push (%1 + 32)
-    push_regs
+    trap_entry
     mov rdi, %1
+    mov rsi, rsp
     call irq_handler
-    pop_regs
-    add rsp, 16
-    iretq
+    trap_exit
 %endmacro
 
 %assign i 0
@@ -115,6 +147,63 @@ irq_stub_%1:
 %assign i i+1
 %endrep
 
+; Message-signalled interrupts (vectors 64..95); the handler sends the EOI.
+%macro msi_stub 1
+msi_stub_%1:
+    push 0
+    push (%1 + 64)
+    trap_entry
+    mov rdi, %1
+    mov rsi, rsp
+    call msi_handler
+    trap_exit
+%endmacro
+
+%assign i 0
+%rep 32
+    msi_stub i
+%assign i i+1
+%endrep
+
+; Local APIC timer (vector 48); the handler sends the LAPIC EOI itself.
+global lapic_timer_stub
+lapic_timer_stub:
+    push 0
+    push 48
+    trap_entry
+    mov rdi, rsp
+    call lapic_timer_irq
+    trap_exit
+
+; Reschedule IPI (vector 0xF0); trap_exit does the rescheduling.
+global smp_resched_stub
+smp_resched_stub:
+    push 0
+    push 0xF0
+    trap_entry
+    mov rdi, rsp
+    call smp_resched_irq
+    trap_exit
+
+; TLB shootdown IPI (vector 0xF1). Not under the kernel lock: the CPU that
+; sent it holds the lock and waits for this one to flush.
+global smp_tlb_stub
+smp_tlb_stub:
+    push 0
+    push 0xF1
+    swapgs_if_user
+    push_regs
+    call smp_tlb_irq
+    pop_regs
+    swapgs_if_user
+    add rsp, 16
+    iretq
+
+; Spurious LAPIC interrupts must not be acknowledged.
+global lapic_spurious_stub
+lapic_spurious_stub:
+    iretq
+
 section .data
 global isr_stub_table
 isr_stub_table:
@@ -131,4 +220,12 @@ irq_stub_table:
     dq irq_stub_%+i
 %assign i i+1
 %endrep
+
+global msi_stub_table
+msi_stub_table:
+%assign i 0
+%rep 32
+    dq msi_stub_%+i
+%assign i i+1
+%endrep
 section .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,185 @@
+/**
+ * @file src/arch/x86_64/lapic.c
+ * @brief Local APIC timer in one-shot mode.
+ *
+ * Legacy PIC interrupts still reach the CPU through LINT0 as the firmware
+ * set it up (virtual wire mode); only the timer and the spurious vector
+ * are configured here. PCI MSI/MSI-X messages are written straight to
+ * the BSP's APIC and acknowledged here too, as are the IPIs the CPUs send
+ * each other.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/idt.h>
+#include <alcor2/arch/lapic.h>
+#include <alcor2/arch/pit.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/fs/procfs.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/sys/irqsoff.h>
+#include <alcor2/sys/kprof.h>
+#include <alcor2/time.h>
+
+#define MSR_APIC_BASE        0x1B
+#define APIC_BASE_ENABLE     (1ULL << 11)
+#define APIC_BASE_X2APIC     (1ULL << 10)
+#define APIC_BASE_ADDR_MASK  0xFFFFFF000ULL
+#define CPUID_1_EDX_APIC     (1U << 9)
+
+/* Register offsets */
+#define LAPIC_ID             0x020
+#define LAPIC_EOI            0x0B0
+#define LAPIC_SVR            0x0F0
+#define LAPIC_ICR_LOW        0x300
+#define LAPIC_ICR_HIGH       0x310
+#define LAPIC_LVT_TIMER      0x320
+#define LAPIC_TIMER_INIT     0x380
+#define LAPIC_TIMER_CUR      0x390
+#define LAPIC_TIMER_DIV      0x3E0
+
+#define LAPIC_SVR_ENABLE     0x100
+#define LAPIC_LVT_MASKED     0x10000
+/** @brief ICR delivery status: the last IPI has not been accepted yet. */
+#define LAPIC_ICR_PENDING    0x1000
+/** @brief Divide configuration for a divisor of 16. */
+#define LAPIC_DIV_16         0x3
+
+/** @brief Shortest count armed, so deadlines cannot storm the CPU. */
+#define LAPIC_MIN_COUNT      16
+
+extern void lapic_timer_stub(void);
+extern void lapic_spurious_stub(void);
+extern void pit_tick(void);
+extern void pit_tick_ap(void);
+
+static volatile u32 *lapic;
+/** @brief Timer counts per second at LAPIC_DIV_16. */
+static u64           timer_hz;
+
+static inline u32 lapic_read(u32 reg)
+{
+  return lapic[reg / 4];
+}
+
+static inline void lapic_write(u32 reg, u32 v)
+{
+  lapic[reg / 4] = v;
+}
+
+static inline u64 rdmsr(u32 msr)
+{
+  u32 lo, hi;
+  __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((u64)hi << 32) | lo;
+}
+
+static bool cpu_has_apic(void)
+{
+  u32 r[4];
+  cpu_cpuid(1, 0, r);
+  return r[3] & CPUID_1_EDX_APIC;
+}
+
+/** @brief Counts elapsed since the timer was started from ~0. */
+static u64 timer_elapsed(void)
+{
+  return 0xFFFFFFFFU - lapic_read(LAPIC_TIMER_CUR);
+}
+
+bool lapic_enabled(void)
+{
+  return lapic != NULL;
+}
+
+u32 lapic_id(void)
+{
+  return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_init_cpu(void)
+{
+  lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+  lapic_write(LAPIC_TIMER_DIV, LAPIC_DIV_16);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+bool lapic_init(void)
+{
+  if(!cpu_has_apic())
+    return false;
+  u64 base = rdmsr(MSR_APIC_BASE);
+  /* x2APIC mode hides the MMIO registers. */
+  if(!(base & APIC_BASE_ENABLE) || (base & APIC_BASE_X2APIC))
+    return false;
+
+  lapic = vmm_map_mmio(base & APIC_BASE_ADDR_MASK, PAGE_SIZE);
+  if(!lapic)
+    return false;
+
+  idt_set_gate(LAPIC_TIMER_VECTOR, lapic_timer_stub, IDT_GATE_INT);
+  idt_set_gate(LAPIC_SPURIOUS_VECTOR, lapic_spurious_stub, IDT_GATE_INT);
+  lapic_init_cpu();
+
+  /* Count down from the top while PIT channel 2 times the window. */
+  lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFFU);
+  timer_hz = pit_measure_hz(timer_elapsed);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+  if(!timer_hz) {
+    lapic = NULL;
+    return false;
+  }
+
+  console_printf("[LAPIC] Timer %lu kHz\n", timer_hz / 1000);
+  return true;
+}
+
+void lapic_timer_arm(u64 ns)
+{
+  u64 count = ns * timer_hz / NSEC_PER_SEC;
+  if(count < LAPIC_MIN_COUNT)
+    count = LAPIC_MIN_COUNT;
+  if(count > 0xFFFFFFFFU)
+    count = 0xFFFFFFFFU;
+
+  /* One-shot mode: the LVT timer mode bits are zero. */
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INIT, (u32)count);
+}
+
+void lapic_eoi(void)
+{
+  lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(u32 apic_id, u8 vector)
+{
+  /* An interrupt sending one of its own between the two writes would
+   * redirect this one. */
+  u64 flags = cpu_read_flags();
+  cpu_disable_interrupts();
+  while(lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+    cpu_pause();
+  lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+  /* Fixed delivery to a physical destination: the vector is all. */
+  lapic_write(LAPIC_ICR_LOW, vector);
+  if(flags & CPU_RFLAGS_IF)
+    cpu_enable_interrupts();
+}
+
+/** @brief Timer interrupt (called by the vector 48 stub). */
+void lapic_timer_irq(const interrupt_frame_t *frame)
+{
+  irqsoff_begin(IRQSOFF_IRQ | LAPIC_TIMER_VECTOR);
+  kstat.lapic_timer++;
+  kprof_sample(frame);
+  /* Time, timers and devices are the BSP's; an AP only ticks a process. */
+  if(smp_cpu_id())
+    pit_tick_ap();
+  else
+    pit_tick();
+  lapic_eoi();
+  irqsoff_end(IRQSOFF_IRQ | LAPIC_TIMER_VECTOR);
+}
@@ -0,0 +1,118 @@
+/**
+ * @file src/arch/x86_64/pmu.c
+ * @brief Architectural performance counters (Intel SDM vol. 3B, ch. 20).
+ *
+ * CPUID leaf 0xA gives the PMU version, the number and width of the
+ * general-purpose counters and which of the architectural events the CPU
+ * lacks. AMD reports none of this there, and neither does QEMU without
+ * KVM, so such machines simply have no counters.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/pmu.h>
+#include <alcor2/drivers/console.h>
+
+#define CPUID_LEAF_PMU 0xA
+
+#define MSR_PMC0             0xC1
+#define MSR_PERFEVTSEL0      0x186
+#define MSR_PERF_GLOBAL_CTRL 0x38F
+
+/** @brief Event select and unit mask of each ::PMU_EV_CYCLES .. event. */
+static const u16 arch_events[PMU_ARCH_EVENTS] = {
+    0x003C, 0x00C0, 0x013C, 0x4F2E, 0x412E, 0x00C4, 0x00C5,
+};
+
+static u32 version;
+static u32 n_counters;
+static u64 counter_mask; /**< Bits a counter holds. */
+static u32 missing;      /**< CPUID.0AH:EBX: events the CPU lacks. */
+static u32 n_events;     /**< Architectural events CPUID describes. */
+static bool intel;
+
+static inline u64 rdmsr(u32 msr)
+{
+  u32 lo, hi;
+  __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((u64)hi << 32) | lo;
+}
+
+static inline void wrmsr(u32 msr, u64 v)
+{
+  __asm__ volatile("wrmsr" ::"a"((u32)v), "d"((u32)(v >> 32)), "c"(msr));
+}
+
+void pmu_init(void)
+{
+  u32 r[4];
+  cpu_cpuid(0, 0, r);
+  /* "GenuineIntel" in EBX, EDX, ECX. */
+  intel = r[1] == 0x756E6547 && r[3] == 0x49656E69 && r[2] == 0x6C65746E;
+  if(r[0] < CPUID_LEAF_PMU) {
+    console_print("[PMU] None\n");
+    return;
+  }
+
+  cpu_cpuid(CPUID_LEAF_PMU, 0, r);
+  version = r[0] & 0xFF;
+  u32 n   = (r[0] >> 8) & 0xFF;
+  u32 w   = (r[0] >> 16) & 0xFF;
+  if(!version || !n || w < 32 || w > 64) {
+    console_print("[PMU] None\n");
+    return;
+  }
+
+  n_counters   = n > PMU_MAX_COUNTERS ? PMU_MAX_COUNTERS : n;
+  counter_mask = w == 64 ? ~0ULL : (1ULL << w) - 1;
+  n_events     = (r[0] >> 24) & 0xFF;
+  missing      = r[1];
+  pmu_init_cpu();
+
+  console_printf(
+      "[PMU] Version %u, %u counters of %u bits\n", version, n_counters, w
+  );
+}
+
+void pmu_init_cpu(void)
+{
+  for(u32 i = 0; i < n_counters; i++)
+    wrmsr(MSR_PERFEVTSEL0 + i, 0);
+  /* From version 2 a counter also needs its global enable bit. */
+  if(n_counters && version >= 2)
+    wrmsr(MSR_PERF_GLOBAL_CTRL, (1ULL << n_counters) - 1);
+}
+
+u32 pmu_counters(void)
+{
+  return n_counters;
+}
+
+bool pmu_is_intel(void)
+{
+  return intel;
+}
+
+u64 pmu_arch_event(u32 ev)
+{
+  if(!n_counters || ev >= PMU_ARCH_EVENTS || ev >= n_events ||
+     (missing & (1U << ev)))
+    return 0;
+  return arch_events[ev];
+}
+
+void pmu_start(u32 idx, u64 sel)
+{
+  wrmsr(MSR_PMC0 + idx, 0);
+  wrmsr(MSR_PERFEVTSEL0 + idx, sel | PMU_SEL_EN);
+}
+
+u64 pmu_read(u32 idx)
+{
+  return rdmsr(MSR_PMC0 + idx) & counter_mask;
+}
+
+u64 pmu_stop(u32 idx)
+{
+  wrmsr(MSR_PERFEVTSEL0 + idx, 0);
+  return pmu_read(idx);
+}
@@ -0,0 +1,255 @@
+/**
+ * @file src/arch/x86_64/smp.c
+ * @brief Start the application processors; the kernel lock and IPIs.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/fpu.h>
+#include <alcor2/arch/gdt.h>
+#include <alcor2/arch/idle.h>
+#include <alcor2/arch/idt.h>
+#include <alcor2/arch/lapic.h>
+#include <alcor2/arch/pmu.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/sys/syscall.h>
+
+/** @brief Kernel stack of each AP, then of its idle loop. */
+#define SMP_AP_STACK (16ULL * 1024)
+/** @brief How long smp_init waits for the APs, in pause iterations. */
+#define SMP_WAIT_SPINS 100000000ULL
+
+extern void smp_resched_stub(void);
+extern void smp_tlb_stub(void);
+
+static cpu_t        cpu0;
+static cpu_t       *cpus[SMP_MAX_CPUS];
+static u32          ncpus;
+static volatile u32 aps_online;
+/** @brief Set by smp_start: the APs may take the kernel lock. */
+static volatile bool go;
+
+/* Ticket lock: the BSP holds ticket 0 from boot, so the next one is 1. */
+static volatile u32 klock_next = 1;
+static volatile u32 klock_owner;
+
+/* The one shootdown in flight; only the holder of the kernel lock starts
+ * one. Each CPU asked clears its bit in tlb_pending once it has flushed. */
+static u64          tlb_pml4;
+static u64          tlb_va;
+static volatile u64 tlb_pending;
+
+static inline void wrmsr(u32 msr, u64 v)
+{
+  __asm__ volatile("wrmsr" ::"a"((u32)v), "d"((u32)(v >> 32)), "c"(msr));
+}
+
+/* Point GS at @p cpu; the user's GS base starts out 0. */
+static void gs_init(cpu_t *cpu)
+{
+  cpu->self = cpu;
+  wrmsr(MSR_GS_BASE, (u64)cpu);
+  wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+/* Do what a shootdown asks of @p cpu, if it asks anything. */
+static void tlb_poll(cpu_t *cpu)
+{
+  u64 bit = 1ULL << cpu->id;
+  if(!(__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) & bit))
+    return;
+  if(!tlb_pml4 || cpu->pml4 == tlb_pml4)
+    __asm__ volatile("invlpg (%0)" ::"r"(tlb_va) : "memory");
+  __atomic_and_fetch(&tlb_pending, ~bit, __ATOMIC_RELEASE);
+}
+
+void smp_init_bsp(void)
+{
+  gs_init(&cpu0);
+  cpu0.locked = true;
+  cpus[0]     = &cpu0;
+  ncpus       = 1;
+}
+
+u32 smp_cpu_count(void)
+{
+  return ncpus;
+}
+
+cpu_t *smp_cpu(u32 id)
+{
+  return cpus[id];
+}
+
+void kernel_lock(void)
+{
+  cpu_t *cpu = cpu_this();
+  u32    t   = __atomic_fetch_add(&klock_next, 1, __ATOMIC_RELAXED);
+  /* The holder may be waiting for this CPU to flush. */
+  while(__atomic_load_n(&klock_owner, __ATOMIC_ACQUIRE) != t) {
+    tlb_poll(cpu);
+    cpu_pause();
+  }
+  cpu->locked = true;
+}
+
+void kernel_unlock(void)
+{
+  cpu_this()->locked = false;
+  __atomic_store_n(&klock_owner, klock_owner + 1, __ATOMIC_RELEASE);
+}
+
+void smp_kick(cpu_t *cpu)
+{
+  if(cpu && cpu != cpu_this() && cpu->online)
+    lapic_send_ipi(cpu->lapic_id, SMP_RESCHED_VECTOR);
+}
+
+cpu_t *smp_idle_cpu(void)
+{
+  cpu_t *self = cpu_this();
+  for(u32 i = 0; i < ncpus; i++) {
+    if(cpus[i] != self && cpus[i]->online && cpus[i]->idle)
+      return cpus[i];
+  }
+  return NULL;
+}
+
+void smp_tlb_shootdown(u64 pml4, u64 va)
+{
+  cpu_t *self = cpu_this();
+  u64    mask = 0;
+  for(u32 i = 0; i < ncpus; i++) {
+    const cpu_t *c = cpus[i];
+    if(c != self && c->online && (!pml4 || c->pml4 == pml4))
+      mask |= 1ULL << i;
+  }
+  if(!mask)
+    return;
+
+  tlb_pml4 = pml4;
+  tlb_va   = va;
+  __atomic_store_n(&tlb_pending, mask, __ATOMIC_RELEASE);
+  for(u32 i = 0; i < ncpus; i++) {
+    if(mask & (1ULL << i))
+      lapic_send_ipi(cpus[i]->lapic_id, SMP_TLB_VECTOR);
+  }
+  while(__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE))
+    cpu_pause();
+}
+
+/** @brief Reschedule IPI (called by its stub, under the kernel lock);
+ * the stub's way out does the rescheduling. */
+void smp_resched_irq(const interrupt_frame_t *frame)
+{
+  (void)frame;
+  lapic_eoi();
+}
+
+/** @brief Shootdown IPI (called by its stub, without the kernel lock:
+ * the sender is holding it). */
+void smp_tlb_irq(void)
+{
+  tlb_poll(cpu_this());
+  lapic_eoi();
+}
+
+/** @brief Runs on the AP's own stack: set the CPU up as the BSP was, wait
+ * for smp_start, then run processes from the idle loop. */
+static NORETURN void ap_main(cpu_t *cpu)
+{
+  gs_init(cpu);
+  gdt_init_cpu(&cpu->gdt);
+  idt_load();
+  vmm_init_cpu();
+  cpu_enable_sse_cpu();
+  __atomic_add_fetch(&aps_online, 1, __ATOMIC_RELEASE);
+
+  while(!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+    cpu_pause();
+  if(!lapic_enabled())
+    cpu_idle_park();
+
+  syscall_init_cpu();
+  pmu_init_cpu();
+  lapic_init_cpu();
+  cpu->online = true;
+  kernel_lock();
+  proc_idle();
+}
+
+/** @brief Bootloader jumps here on the AP, still on its stack. */
+static void ap_entry(struct limine_smp_info *info)
+{
+  cpu_t *cpu = (cpu_t *)info->extra_argument;
+
+  /* Not vmm_switch: that needs GS, and a PCID-tagged CR3 would fault
+   * here with CR4.PCIDE off. */
+  __asm__ volatile("mov %0, %%cr3" : : "r"(cpu->cr3) : "memory");
+  __asm__ volatile("mov %0, %%rsp\n"
+                   "xor %%ebp, %%ebp\n"
+                   "call *%1\n"
+                   :
+                   : "r"(cpu->stack_top), "r"(ap_main), "D"(cpu)
+                   : "memory");
+  __builtin_unreachable();
+}
+
+void smp_init(const struct limine_smp_response *smp)
+{
+  if(!smp) {
+    console_print("[SMP] No SMP response; running on the BSP only.\n");
+    return;
+  }
+
+  cpu0.lapic_id = smp->bsp_lapic_id;
+  u64 cr3       = vmm_get_current_pml4();
+  for(u64 i = 0; i < smp->cpu_count && ncpus < SMP_MAX_CPUS; i++) {
+    struct limine_smp_info *info = smp->cpus[i];
+    if(info->lapic_id == smp->bsp_lapic_id)
+      continue;
+
+    cpu_t *cpu   = kzalloc(sizeof(*cpu));
+    void  *stack = kmalloc(SMP_AP_STACK);
+    if(!cpu || !stack) {
+      kfree(cpu);
+      kfree(stack);
+      break;
+    }
+    cpu->id        = ncpus;
+    cpu->lapic_id  = info->lapic_id;
+    cpu->cr3       = cr3;
+    cpu->stack_top = ((u64)stack + SMP_AP_STACK) & ~15ULL;
+    cpus[ncpus++]  = cpu;
+
+    info->extra_argument = (u64)cpu;
+    __atomic_store_n(&info->goto_address, ap_entry, __ATOMIC_RELEASE);
+  }
+
+  u32 started = ncpus - 1;
+  for(u64 spin = 0; spin < SMP_WAIT_SPINS; spin++) {
+    if(__atomic_load_n(&aps_online, __ATOMIC_ACQUIRE) == started)
+      break;
+    cpu_pause();
+  }
+
+  console_printf(
+      "[SMP] %u of %u CPUs up\n", 1 + aps_online, (u32)smp->cpu_count
+  );
+}
+
+void smp_start(void)
+{
+  if(lapic_enabled()) {
+    idt_set_gate(SMP_RESCHED_VECTOR, smp_resched_stub, IDT_GATE_INT);
+    idt_set_gate(SMP_TLB_VECTOR, smp_tlb_stub, IDT_GATE_INT);
+    cpu0.lapic_id = lapic_id();
+    cpu0.online   = true;
+  } else if(ncpus > 1) {
+    console_print("[SMP] No local APIC: the APs stay parked.\n");
+  }
+  __atomic_store_n(&go, true, __ATOMIC_RELEASE);
+}
@@ -15,41 +15,43 @@
 ;;   - SS  = STAR[63:48] + 8
 ;;
 
-section .data
-
-;; User RSP saved during syscall (single-CPU shortcut).
-global syscall_user_rsp
-syscall_user_rsp: dq 0
+;; cpu_t fields (alcor2/arch/smp.h), reached through GS.
+%define CPU_KERNEL_RSP 8
+%define CPU_USER_RSP   16
+%define CPU_SIG_WORK   24
 
 section .text
 global syscall_entry
 extern syscall_dispatch
 extern proc_check_signals
-extern current_kernel_rsp
+extern kernel_lock
+extern kernel_unlock
 
 ;;
 ;; syscall_entry - Entry point for SYSCALL instruction
 ;;
 ;; SYSCALL does NOT switch stacks the way INT does, so we land here with
-;; user RSP still in RSP. The kernel stack top for the current process is
-;; published by proc_switch into the C global `current_kernel_rsp` (kept in
-;; sync with TSS.RSP0). We park user RSP in a scratch global and load the
-;; kernel stack before doing anything else; once we have a kernel stack we
-;; build syscall_frame_t, call the C dispatcher, and SYSRET back.
+;; user RSP still in RSP. SWAPGS gives us this CPU's cpu_t, where
+;; proc_switch publishes the kernel stack top of the process it runs (kept
+;; in sync with TSS.RSP0). We park user RSP in its scratch slot and load
+;; the kernel stack before doing anything else; once we have a kernel stack
+;; we build syscall_frame_t, take the kernel lock, call the C dispatcher,
+;; and drop the lock again just before SYSRET.
 ;;
-;; Single-CPU only: a multi-CPU port would use swapgs + per-cpu_data instead
-;; of two file-scope globals.
+;; The process may sleep in the dispatcher and wake up on another CPU, so
+;; the way out reads GS afresh rather than anything saved on the way in.
 ;;
 syscall_entry:
     ;; Interrupts are disabled by SFMASK MSR (IF cleared on entry).
 
     ;; Park user RSP; load this proc's kernel stack.
-    mov [rel syscall_user_rsp], rsp
-    mov rsp, [rel current_kernel_rsp]
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_KERNEL_RSP]
     
     ;; Build syscall_frame_t on stack (matches struct in syscall.h)
     ;; Layout: r15,r14,r13,r12,r11,r10,r9,r8,rbp,rdi,rsi,rdx,rcx,rbx,rax,rip,rflags,rsp
-    push qword [rel syscall_user_rsp]   ; rsp (user)
+    push qword [gs:CPU_USER_RSP]        ; rsp (user)
     push r11                             ; rflags (saved by SYSCALL)
     push rcx                             ; rip (return address)
     push rax                             ; syscall number
@@ -69,19 +71,32 @@ syscall_entry:
     push r15
     
     ;; Call C dispatcher: u64 syscall_dispatch(syscall_frame_t *frame)
+    ;; RBX (callee-saved; the user value is in the frame) keeps the syscall
+    ;; number for SA_RESTART once the rax slot holds the return value.
+    mov rbx, rax
+    call kernel_lock
     mov rdi, rsp
     call syscall_dispatch
     
     ;; Store return value in frame's rax slot
     mov [rsp + 14*8], rax
 
-    ;; Check for pending signals — may redirect frame to a signal handler
+    ;; Common case: no unblocked signal pending for this process
+    mov rax, [gs:CPU_SIG_WORK]
+    cmp byte [rax], 0
+    je .restore
+
+    ;; Deliver a signal — may redirect frame to a signal handler
     mov rdi, rsp
+    mov rsi, rbx
     call proc_check_signals
+
+.restore:
     
     ;; CRITICAL: Disable interrupts before restoring registers
     ;; sys_read may have enabled them while waiting for keyboard
     cli
+    call kernel_unlock
     
     ;; Restore registers
     pop r15
@@ -104,6 +119,7 @@ syscall_entry:
     pop rsp                              ; user RSP
     
     ;; Return to Ring 3 (SYSRET restores RFLAGS from R11, re-enabling interrupts)
+    swapgs
     o64 sysret
 
 section .note.GNU-stack noalloc noexec nowrite progbits
@@ -64,8 +64,9 @@ u64 sys_arch_prctl(u64 code, u64 addr, u64 a3, u64 a4, u64 a5, u64 a6)
       p->fs_base = addr;
     return 0;
 
+  /* The user's GS base sits in the swap slot until the way out. */
   case ARCH_SET_GS:
-    wrmsr(MSR_GS_BASE, addr);
+    wrmsr(MSR_KERNEL_GS_BASE, addr);
     return 0;
 
   case ARCH_GET_FS:
@@ -77,7 +78,7 @@ u64 sys_arch_prctl(u64 code, u64 addr, u64 a3, u64 a4, u64 a5, u64 a6)
   case ARCH_GET_GS:
     if(!addr)
       return (u64)-14; // -EFAULT
-    *(u64 *)addr = rdmsr(MSR_GS_BASE);
+    *(u64 *)addr = rdmsr(MSR_KERNEL_GS_BASE);
     return 0;
 
   default:
@@ -87,10 +88,7 @@ u64 sys_arch_prctl(u64 code, u64 addr, u64 a3, u64 a4, u64 a5, u64 a6)
 
 extern void syscall_entry(void);
 
-/**
- * @brief Initialize syscall mechanism (MSRs + LSTAR entry).
- */
-void syscall_init(void)
+void syscall_init_cpu(void)
 {
   /* Enable syscall extension */
   u64 efer = rdmsr(MSR_EFER);
@@ -106,6 +104,13 @@ void syscall_init(void)
 
   /* Clear IF (interrupt flag) on syscall entry */
   wrmsr(MSR_SFMASK, 0x200);
+}
 
+/**
+ * @brief Initialize syscall mechanism (MSRs + LSTAR entry).
+ */
+void syscall_init(void)
+{
+  syscall_init_cpu();
   console_print("[SYSCALL] Initialized\n");
 }
@@ -0,0 +1,98 @@
+/**
+ * @file src/arch/x86_64/vdso/vdso.c
+ * @brief vDSO functions, run in user mode inside every process.
+ *
+ * Built as a separate shared object (see mk/kernel.mk) and embedded into
+ * the kernel. The code must be position independent and may only touch
+ * its own text and the vvar page mapped just below it.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/proc/vdso.h>
+#include <alcor2/sys/syscall.h>
+
+#define CLOCK_REALTIME         0
+#define CLOCK_MONOTONIC        1
+#define CLOCK_MONOTONIC_RAW    4
+#define CLOCK_REALTIME_COARSE  5
+#define CLOCK_MONOTONIC_COARSE 6
+#define CLOCK_BOOTTIME         7
+
+#define NSEC_PER_SEC 1000000000ULL
+
+struct vdso_timespec
+{
+  i64 tv_sec;
+  i64 tv_nsec;
+};
+
+struct vdso_timeval
+{
+  i64 tv_sec;
+  i64 tv_usec;
+};
+
+/** @brief The vvar page; placed one page below the image by vdso.lds. */
+extern const vdso_data_t vvar __attribute__((visibility("hidden")));
+
+static long vdso_syscall2(long nr, long a1, long a2)
+{
+  long ret;
+  __asm__ volatile("syscall"
+                   : "=a"(ret)
+                   : "a"(nr), "D"(a1), "S"(a2)
+                   : "rcx", "r11", "memory");
+  return ret;
+}
+
+int __vdso_clock_gettime(int clk, struct vdso_timespec *ts)
+{
+  u64 offset;
+  switch(clk) {
+  case CLOCK_REALTIME:
+  case CLOCK_REALTIME_COARSE:
+    offset = vvar.realtime_offset;
+    break;
+  case CLOCK_MONOTONIC:
+  case CLOCK_MONOTONIC_RAW:
+  case CLOCK_MONOTONIC_COARSE:
+  case CLOCK_BOOTTIME:
+    offset = 0;
+    break;
+  default:
+    return (int)vdso_syscall2(SYS_CLOCK_GETTIME, clk, (long)ts);
+  }
+  if(vvar.clock_mode != VDSO_CLOCK_TSC)
+    return (int)vdso_syscall2(SYS_CLOCK_GETTIME, clk, (long)ts);
+
+  u64 ns      = vdso_tsc_to_ns(&vvar, cpu_rdtsc()) + offset;
+  ts->tv_sec  = (i64)(ns / NSEC_PER_SEC);
+  ts->tv_nsec = (i64)(ns % NSEC_PER_SEC);
+  return 0;
+}
+
+int __vdso_gettimeofday(struct vdso_timeval *tv, void *tz)
+{
+  if(vvar.clock_mode != VDSO_CLOCK_TSC)
+    return (int)vdso_syscall2(SYS_GETTIMEOFDAY, (long)tv, (long)tz);
+
+  if(tv) {
+    u64 ns = vdso_tsc_to_ns(&vvar, cpu_rdtsc()) + vvar.realtime_offset;
+    tv->tv_sec  = (i64)(ns / NSEC_PER_SEC);
+    tv->tv_usec = (i64)(ns % NSEC_PER_SEC / 1000);
+  }
+  return 0;
+}
+
+int __vdso_getcpu(unsigned *cpu, unsigned *node, void *unused)
+{
+  (void)unused;
+
+  /* Single node. Nothing here can tell the CPU, which may change under the
+   * caller anyway; report 0. */
+  if(cpu)
+    *cpu = 0;
+  if(node)
+    *node = 0;
+  return 0;
+}
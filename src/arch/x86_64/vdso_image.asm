@@ -0,0 +1,19 @@
+;;
+;; Alcor2 built-in vDSO image
+;;
+;; The shared object built from vdso/ (see mk/kernel.mk); VDSO_SO is its
+;; path. vdso_init() copies it into the frames mapped into every process.
+;;
+
+bits 64
+
+section .rodata
+global vdso_image
+global vdso_image_end
+
+align 16
+vdso_image:
+    incbin VDSO_SO
+vdso_image_end:
+
+section .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,641 @@
+/**
+ * @file src/drivers/ahci/ahci.c
+ * @brief AHCI SATA host controller driver (NCQ, PCI INTx completion).
+ *
+ * The controller's registers (ABAR, BAR5) are mapped uncached. Every port
+ * with a disk gets a command list, a received-FIS area and one command
+ * table per slot, all in one block of contiguous pages. Requests wait in a
+ * per-port FIFO and are issued as READ/WRITE FPDMA QUEUED commands, one
+ * per free tag, up to the queue depth the disk reports; flushes (and every
+ * command on disks without NCQ) run alone. The disk may complete queued
+ * commands in any order, so a request is held back while it overlaps an
+ * outstanding one and either of them writes.
+ *
+ * Completion is signalled by an MSI message to the local APIC when the
+ * controller has the capability, otherwise on the PCI interrupt line
+ * routed through the PIC. An error or a timeout
+ * restarts the port and retries every command that was in flight.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/idt.h>
+#include <alcor2/arch/io.h>
+#include <alcor2/arch/pic.h>
+#include <alcor2/arch/pit.h>
+#include <alcor2/drivers/ahci.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/drivers/pci.h>
+#include <alcor2/errno.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+
+/* HBA registers (byte offsets) */
+#define HBA_CAP      0x00
+#define HBA_GHC      0x04
+#define HBA_IS       0x08
+#define HBA_PI       0x0C
+#define HBA_CAP2     0x24
+#define HBA_BOHC     0x28
+#define HBA_PORTS    0x100 /* port n registers at HBA_PORTS + n * 0x80 */
+#define HBA_MAP_SIZE 0x1100
+
+#define CAP_NCS(c) ((((c) >> 8) & 0x1F) + 1) /* command slots per port */
+#define CAP_SNCQ   (1u << 30)
+#define CAP_S64A   (1u << 31)
+#define CAP2_BOH   (1u << 0)
+#define BOHC_BOS   (1u << 0)
+#define BOHC_OOS   (1u << 1)
+#define GHC_IE     (1u << 1)
+#define GHC_AE     (1u << 31)
+
+/* Port registers (byte offsets) */
+#define PX_CLB  0x00
+#define PX_CLBU 0x04
+#define PX_FB   0x08
+#define PX_FBU  0x0C
+#define PX_IS   0x10
+#define PX_IE   0x14
+#define PX_CMD  0x18
+#define PX_TFD  0x20
+#define PX_SIG  0x24
+#define PX_SSTS 0x28
+#define PX_SCTL 0x2C
+#define PX_SERR 0x30
+#define PX_SACT 0x34
+#define PX_CI   0x38
+
+#define PXCMD_ST  (1u << 0)
+#define PXCMD_SUD (1u << 1)
+#define PXCMD_POD (1u << 2)
+#define PXCMD_FRE (1u << 4)
+#define PXCMD_FR  (1u << 14)
+#define PXCMD_CR  (1u << 15)
+
+#define PXIS_DHRS (1u << 0)  /* D2H register FIS */
+#define PXIS_PSS  (1u << 1)  /* PIO setup FIS */
+#define PXIS_SDBS (1u << 3)  /* Set device bits FIS (NCQ completion) */
+#define PXIS_DPS  (1u << 5)  /* Descriptor processed */
+#define PXIS_IFS  (1u << 27) /* Interface fatal error */
+#define PXIS_HBDS (1u << 28) /* Host bus data error */
+#define PXIS_HBFS (1u << 29) /* Host bus fatal error */
+#define PXIS_TFES (1u << 30) /* Task file error */
+#define PXIS_ERR  (PXIS_IFS | PXIS_HBDS | PXIS_HBFS | PXIS_TFES)
+
+#define SSTS_DET_PRESENT 3
+#define SIG_ATA          0x00000101
+
+#define FIS_TYPE_H2D 0x27
+#define FIS_H2D_CMD  0x80 /* C bit: the FIS carries a command */
+#define CMDH_CFL     5    /* H2D FIS length in dwords */
+#define CMDH_WRITE   (1u << 6)
+#define PRD_MAX      (4u << 20) /* bytes per PRD entry */
+
+#define AHCI_SLOTS       32
+#define AHCI_PRDT_MAX    96 /* 128 KB over 32 segments, page by page */
+#define AHCI_RETRIES     3
+#define AHCI_TIMEOUT     500     /* ticks (5 s) */
+#define AHCI_SPIN        500000  /* io_wait() rounds (~0.5 s) */
+#define AHCI_POLL_ROUNDS 5000000 /* early-boot completion wait */
+
+/** @brief Command header (one per slot in the command list). */
+typedef struct PACKED
+{
+  u16          flags; /* CFL, W, ... */
+  u16          prdtl; /* PRD entries */
+  volatile u32 prdbc; /* bytes transferred */
+  u32          ctba;
+  u32          ctbau;
+  u32          rsvd[4];
+} ahci_cmd_hdr_t;
+
+/** @brief Physical region descriptor. */
+typedef struct PACKED
+{
+  u32 dba;
+  u32 dbau;
+  u32 rsvd;
+  u32 dbc; /* byte count - 1 */
+} ahci_prd_t;
+
+/** @brief Command table (128-byte aligned). */
+typedef struct PACKED
+{
+  u8         cfis[64];
+  u8         acmd[16];
+  u8         rsvd[48];
+  ahci_prd_t prdt[AHCI_PRDT_MAX];
+} ahci_cmd_table_t;
+
+#define AHCI_CL_BYTES    (AHCI_SLOTS * sizeof(ahci_cmd_hdr_t)) /* 1 KB */
+#define AHCI_FIS_OFFSET  AHCI_CL_BYTES
+#define AHCI_ID_OFFSET   (AHCI_FIS_OFFSET + 256)
+#define AHCI_PORT_PAGES  \
+  (1 + (AHCI_SLOTS * sizeof(ahci_cmd_table_t) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+/** @brief One port with a disk. */
+typedef struct
+{
+  volatile u32     *regs;
+  ahci_cmd_hdr_t   *cl;
+  ahci_cmd_table_t *tables;
+  const u16        *id;                 /* IDENTIFY data */
+  ata_bio_t        *slot[AHCI_SLOTS];   /* request on each command slot */
+  u64               deadline[AHCI_SLOTS];
+  u32               busy;               /* slots with a command issued */
+  bool              exclusive;          /* a non-queued command is running */
+  u8                depth;              /* NCQ tags usable; 0 = no NCQ */
+  bool              lba48;
+  ata_bio_t        *q_head;             /* requests waiting for a slot */
+  ata_bio_t        *q_tail;
+} ahci_port_t;
+
+static volatile u32 *hba;
+static ahci_port_t   g_ports[AHCI_MAX_DISKS];
+static u32           g_nports;
+static u32           g_nslots;
+static bool          g_s64a;
+static bool          g_irq_ok;
+static u8            g_msi; /* MSI vector, or 0 on the INTx line */
+
+static inline u32 port_rd(const ahci_port_t *p, u32 reg)
+{
+  return p->regs[reg / 4];
+}
+
+static inline void port_wr(const ahci_port_t *p, u32 reg, u32 val)
+{
+  p->regs[reg / 4] = val;
+}
+
+/* Spin until (*reg & mask) == want; false on timeout. */
+static bool spin_until(volatile u32 *reg, u32 mask, u32 want)
+{
+  for(u32 i = 0; i < AHCI_SPIN; i++) {
+    if((*reg & mask) == want)
+      return true;
+    io_wait();
+  }
+  return false;
+}
+
+/* Stop command processing and FIS reception. */
+static void port_stop(const ahci_port_t *p)
+{
+  port_wr(p, PX_CMD, port_rd(p, PX_CMD) & ~PXCMD_ST);
+  spin_until(&p->regs[PX_CMD / 4], PXCMD_CR, 0);
+  port_wr(p, PX_CMD, port_rd(p, PX_CMD) & ~PXCMD_FRE);
+  spin_until(&p->regs[PX_CMD / 4], PXCMD_FR, 0);
+}
+
+/* Start FIS reception and command processing. */
+static void port_start(const ahci_port_t *p)
+{
+  spin_until(&p->regs[PX_TFD / 4], ATA_SR_BSY | ATA_SR_DRQ, 0);
+  port_wr(p, PX_CMD, port_rd(p, PX_CMD) | PXCMD_FRE | PXCMD_SUD | PXCMD_POD);
+  port_wr(p, PX_CMD, port_rd(p, PX_CMD) | PXCMD_ST);
+}
+
+/* Re-establish the link (COMRESET) when the device is wedged. */
+static void port_comreset(const ahci_port_t *p)
+{
+  u32 sctl = port_rd(p, PX_SCTL) & ~0xFu;
+  port_wr(p, PX_SCTL, sctl | 1);
+  for(int i = 0; i < 2000; i++) /* >= 1 ms */
+    io_wait();
+  port_wr(p, PX_SCTL, sctl);
+  spin_until(&p->regs[PX_SSTS / 4], 0xF, SSTS_DET_PRESENT);
+  port_wr(p, PX_SERR, 0xFFFFFFFF);
+}
+
+/**
+ * @brief Append a kernel buffer to a command table's PRD table.
+ *
+ * Physically contiguous pages share an entry.
+ *
+ * @param t     Command table.
+ * @param n     Entries used so far (updated).
+ * @param buf   Buffer (word-aligned).
+ * @param bytes Length in bytes (even).
+ */
+static void prd_add(ahci_cmd_table_t *t, u32 *n, const void *buf, u32 bytes)
+{
+  u64 v   = (u64)buf;
+  u64 end = v + bytes;
+  while(v < end) {
+    u64 len  = PAGE_SIZE - (v & (PAGE_SIZE - 1));
+    u64 phys = vmm_kernel_phys((const void *)v);
+    if(len > end - v)
+      len = end - v;
+
+    ahci_prd_t *last      = *n ? &t->prdt[*n - 1] : NULL;
+    u64         last_phys = last ? (u64)last->dba | (u64)last->dbau << 32 : 0;
+    u32         last_len  = last ? last->dbc + 1 : 0;
+    if(last && last_phys + last_len == phys && last_len + len <= PRD_MAX) {
+      last->dbc += (u32)len;
+    } else {
+      t->prdt[*n].dba  = (u32)phys;
+      t->prdt[*n].dbau = (u32)(phys >> 32);
+      t->prdt[*n].rsvd = 0;
+      t->prdt[*n].dbc  = (u32)len - 1;
+      (*n)++;
+    }
+    v += len;
+  }
+}
+
+/* Whether the HBA can reach every byte of @p bio. */
+static bool bio_reachable(const ata_bio_t *bio)
+{
+  for(u32 i = 0; i < bio->nseg; i++) {
+    u64 v   = (u64)bio->seg[i].buf;
+    u64 end = v + bio->seg[i].bytes;
+    if(v & 1)
+      return false;
+    for(; v < end; v = (v & ~(u64)(PAGE_SIZE - 1)) + PAGE_SIZE) {
+      u64 phys = vmm_kernel_phys((const void *)v);
+      if(!phys || (!g_s64a && phys >= 0x100000000ULL))
+        return false;
+    }
+  }
+  return true;
+}
+
+/* Fill command slot @p s for @p bio. */
+static void cmd_build(ahci_port_t *p, u32 s, const ata_bio_t *bio, bool ncq)
+{
+  ahci_cmd_table_t *t = &p->tables[s];
+  u8               *f = t->cfis;
+  bool              w = bio->op == ATA_BIO_WRITE;
+  u32               n = 0;
+
+  kzero(f, sizeof(t->cfis));
+  f[0] = FIS_TYPE_H2D;
+  f[1] = FIS_H2D_CMD;
+
+  if(bio->op == ATA_BIO_FLUSH) {
+    f[2] = p->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH;
+  } else {
+    u64 lba = bio->lba;
+    if(ncq)
+      f[2] = w ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+    else if(p->lba48)
+      f[2] = w ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    else
+      f[2] = w ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+    f[4]  = (u8)lba;
+    f[5]  = (u8)(lba >> 8);
+    f[6]  = (u8)(lba >> 16);
+    f[7]  = 0x40; /* LBA mode */
+    f[8]  = (u8)(lba >> 24);
+    f[9]  = (u8)(lba >> 32);
+    f[10] = (u8)(lba >> 40);
+    if(ncq) {
+      f[3]  = (u8)bio->count; /* NCQ: count in the feature field */
+      f[11] = (u8)(bio->count >> 8);
+      f[12] = (u8)(s << 3); /* tag */
+    } else {
+      f[12] = (u8)bio->count;
+      f[13] = (u8)(bio->count >> 8);
+      if(!p->lba48)
+        f[7] |= (u8)((lba >> 24) & 0x0F);
+    }
+    for(u32 i = 0; i < bio->nseg; i++)
+      prd_add(t, &n, bio->seg[i].buf, bio->seg[i].bytes);
+  }
+
+  p->cl[s].flags = CMDH_CFL | (w ? CMDH_WRITE : 0);
+  p->cl[s].prdtl = (u16)n;
+  p->cl[s].prdbc = 0;
+}
+
+/* Whether @p bio overlaps a command in flight that it must not pass. */
+static bool port_conflicts(const ahci_port_t *p, const ata_bio_t *bio)
+{
+  for(u32 s = 0; s < AHCI_SLOTS; s++) {
+    const ata_bio_t *a = p->slot[s];
+    if(!(p->busy & (1u << s)) ||
+       (a->op != ATA_BIO_WRITE && bio->op != ATA_BIO_WRITE))
+      continue;
+    if(a->lba < bio->lba + bio->count && bio->lba < a->lba + a->count)
+      return true;
+  }
+  return false;
+}
+
+/* Issue waiting requests while slots are free (interrupts off). */
+static void port_dispatch(ahci_port_t *p)
+{
+  while(p->q_head && !p->exclusive) {
+    ata_bio_t *bio = p->q_head;
+    bool       ncq = p->depth && bio->op != ATA_BIO_FLUSH;
+    u32        s   = 0;
+
+    if(!ncq) {
+      if(p->busy)
+        return;
+      p->exclusive = true;
+    } else {
+      if(port_conflicts(p, bio))
+        return;
+      while(s < p->depth && (p->busy & (1u << s)))
+        s++;
+      if(s == p->depth)
+        return;
+    }
+
+    p->q_head = bio->next;
+    if(!p->q_head)
+      p->q_tail = NULL;
+    bio->next = NULL;
+
+    cmd_build(p, s, bio, ncq);
+    p->slot[s]      = bio;
+    p->deadline[s]  = pit_get_ticks() + AHCI_TIMEOUT;
+    p->busy        |= 1u << s;
+    __asm__ volatile("" ::: "memory");
+    if(ncq)
+      port_wr(p, PX_SACT, 1u << s);
+    port_wr(p, PX_CI, 1u << s);
+  }
+}
+
+/**
+ * @brief Restart a port after an error and retry what was in flight.
+ *
+ * Every outstanding command is aborted by the restart; each goes back to
+ * the front of the queue, or fails once it has used up its retries.
+ *
+ * @param p      Port.
+ * @param status Error for requests that fail.
+ */
+static void port_recover(ahci_port_t *p, i64 status)
+{
+  port_stop(p);
+  port_wr(p, PX_SERR, 0xFFFFFFFF);
+  port_wr(p, PX_IS, 0xFFFFFFFF);
+  if(port_rd(p, PX_TFD) & (ATA_SR_BSY | ATA_SR_DRQ))
+    port_comreset(p);
+  port_start(p);
+
+  u32 busy     = p->busy;
+  p->busy      = 0;
+  p->exclusive = false;
+  for(int s = AHCI_SLOTS - 1; s >= 0; s--) {
+    if(!(busy & (1u << s)))
+      continue;
+    ata_bio_t *bio = p->slot[s];
+    p->slot[s]     = NULL;
+    if(++bio->tries < AHCI_RETRIES) {
+      bio->next = p->q_head;
+      p->q_head = bio;
+      if(!p->q_tail)
+        p->q_tail = bio;
+    } else {
+      ata_bio_end(bio, status);
+    }
+  }
+  port_dispatch(p);
+}
+
+/* Retire completed commands and issue more (interrupts off). */
+static void port_service(ahci_port_t *p)
+{
+  u32 is = port_rd(p, PX_IS);
+  port_wr(p, PX_IS, is);
+  if(is & PXIS_ERR) {
+    port_recover(p, -EIO);
+    return;
+  }
+
+  u32 done = p->busy & ~(port_rd(p, PX_SACT) | port_rd(p, PX_CI));
+  for(u32 s = 0; done; s++) {
+    if(!(done & (1u << s)))
+      continue;
+    done          &= ~(1u << s);
+    ata_bio_t *bio = p->slot[s];
+    p->slot[s]     = NULL;
+    p->busy       &= ~(1u << s);
+    if(!p->busy)
+      p->exclusive = false;
+    ata_bio_end(bio, 0);
+  }
+  port_dispatch(p);
+}
+
+/** @brief Controller interrupt: service every port that raised it. */
+static void ahci_irq(void)
+{
+  u32 is = hba[HBA_IS / 4];
+  if(!is)
+    return;
+  for(u32 n = 0; n < g_nports; n++)
+    port_service(&g_ports[n]);
+  hba[HBA_IS / 4] = is;
+}
+
+void ahci_tick(void)
+{
+  u64 now = pit_get_ticks();
+  for(u32 n = 0; n < g_nports; n++) {
+    ahci_port_t *p = &g_ports[n];
+    if(!g_irq_ok)
+      port_service(p);
+    for(u32 s = 0; s < AHCI_SLOTS; s++) {
+      if((p->busy & (1u << s)) && now >= p->deadline[s]) {
+        port_recover(p, -ETIMEDOUT);
+        break;
+      }
+    }
+  }
+}
+
+i64 ahci_submit(u8 n, ata_bio_t *bio)
+{
+  if(n >= g_nports)
+    return -ENODEV;
+  if(bio->op != ATA_BIO_FLUSH && !bio_reachable(bio))
+    return -EINVAL;
+
+  ahci_port_t *p    = &g_ports[n];
+  bool         boot = !proc_current();
+
+  if(!boot)
+    cpu_disable_interrupts();
+  if(p->q_tail)
+    p->q_tail->next = bio;
+  else
+    p->q_head = bio;
+  p->q_tail = bio;
+  port_dispatch(p);
+
+  /* No scheduler to sleep in yet (interrupts are still off): poll. */
+  while(boot && bio->status == ATA_BIO_PENDING) {
+    u32 i = 0;
+    while(bio->status == ATA_BIO_PENDING && i++ < AHCI_POLL_ROUNDS) {
+      port_service(p);
+      io_wait();
+    }
+    if(bio->status == ATA_BIO_PENDING)
+      port_recover(p, -ETIMEDOUT);
+  }
+  if(!boot)
+    cpu_enable_interrupts();
+  return 0;
+}
+
+/* Run IDENTIFY DEVICE on slot 0 by polling (port bring-up only). */
+static bool port_identify(ahci_port_t *p, u16 *id)
+{
+  ahci_cmd_table_t *t = &p->tables[0];
+  u32               n = 0;
+
+  kzero(t->cfis, sizeof(t->cfis));
+  t->cfis[0] = FIS_TYPE_H2D;
+  t->cfis[1] = FIS_H2D_CMD;
+  t->cfis[2] = ATA_CMD_IDENTIFY;
+  prd_add(t, &n, id, 512);
+  p->cl[0].flags = CMDH_CFL;
+  p->cl[0].prdtl = (u16)n;
+  p->cl[0].prdbc = 0;
+
+  port_wr(p, PX_IS, 0xFFFFFFFF);
+  port_wr(p, PX_CI, 1);
+  for(u32 i = 0; i < AHCI_SPIN; i++) {
+    if(port_rd(p, PX_IS) & PXIS_ERR)
+      return false;
+    if(!(port_rd(p, PX_CI) & 1))
+      return !(port_rd(p, PX_TFD) & ATA_SR_ERR);
+    io_wait();
+  }
+  return false;
+}
+
+/* Bring up port @p num; true if it holds a usable disk. */
+static bool port_setup(u32 num, u32 cap)
+{
+  ahci_port_t *p = &g_ports[g_nports];
+  kzero(p, sizeof(*p));
+  p->regs = (volatile u32 *)((u8 *)hba + HBA_PORTS + num * 0x80);
+
+  if((port_rd(p, PX_SSTS) & 0xF) != SSTS_DET_PRESENT ||
+     port_rd(p, PX_SIG) != SIG_ATA)
+    return false;
+
+  void *mem = pmm_alloc_pages(AHCI_PORT_PAGES);
+  if(!mem)
+    return false;
+  u64 phys = (u64)mem;
+  if(!g_s64a && phys + AHCI_PORT_PAGES * PAGE_SIZE > 0x100000000ULL) {
+    pmm_free_pages(mem, AHCI_PORT_PAGES);
+    return false;
+  }
+  u8 *virt = phys_to_virt(phys);
+  kzero(virt, AHCI_PORT_PAGES * PAGE_SIZE);
+  p->cl     = (ahci_cmd_hdr_t *)virt;
+  p->tables = (ahci_cmd_table_t *)(virt + PAGE_SIZE);
+  p->id     = (const u16 *)(virt + AHCI_ID_OFFSET);
+
+  port_stop(p);
+  port_wr(p, PX_CLB, (u32)phys);
+  port_wr(p, PX_CLBU, (u32)(phys >> 32));
+  port_wr(p, PX_FB, (u32)(phys + AHCI_FIS_OFFSET));
+  port_wr(p, PX_FBU, (u32)((phys + AHCI_FIS_OFFSET) >> 32));
+  for(u32 s = 0; s < g_nslots; s++) {
+    u64 t          = phys + PAGE_SIZE + s * sizeof(ahci_cmd_table_t);
+    p->cl[s].ctba  = (u32)t;
+    p->cl[s].ctbau = (u32)(t >> 32);
+  }
+  port_wr(p, PX_SERR, 0xFFFFFFFF);
+  port_wr(p, PX_IS, 0xFFFFFFFF);
+  port_start(p);
+
+  if(!port_identify(p, (u16 *)p->id)) {
+    port_stop(p);
+    pmm_free_pages(mem, AHCI_PORT_PAGES);
+    return false;
+  }
+
+  p->lba48 = !!(p->id[83] & (1 << 10));
+  if((cap & CAP_SNCQ) && (p->id[76] & (1 << 8))) {
+    u32 depth = (p->id[75] & 0x1F) + 1u;
+    p->depth  = (u8)(depth < g_nslots ? depth : g_nslots);
+  }
+
+  port_wr(
+      p, PX_IE, PXIS_DHRS | PXIS_PSS | PXIS_SDBS | PXIS_DPS | PXIS_ERR
+  );
+  g_nports++;
+  return true;
+}
+
+u32 ahci_init(void)
+{
+  pci_device_t dev;
+  if(!pci_find_device(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, &dev) ||
+     dev.prog_if != PCI_PROG_IF_AHCI)
+    return 0;
+
+  pci_enable_bus_master(&dev);
+  hba = vmm_map_mmio(dev.bar[5] & ~0xFu, HBA_MAP_SIZE);
+  if(!hba) {
+    console_print("[AHCI] Cannot map ABAR\n");
+    return 0;
+  }
+
+  /* Take the controller over from the firmware. */
+  if(hba[HBA_CAP2 / 4] & CAP2_BOH) {
+    hba[HBA_BOHC / 4] |= BOHC_OOS;
+    spin_until(&hba[HBA_BOHC / 4], BOHC_BOS, 0);
+  }
+  hba[HBA_GHC / 4] |= GHC_AE;
+
+  u32 cap  = hba[HBA_CAP / 4];
+  u32 pi   = hba[HBA_PI / 4];
+  g_nslots = CAP_NCS(cap);
+  g_s64a   = !!(cap & CAP_S64A);
+
+  for(u32 n = 0; n < 32 && g_nports < AHCI_MAX_DISKS; n++) {
+    if(pi & (1u << n))
+      port_setup(n, cap);
+  }
+  if(!g_nports)
+    return 0;
+
+  /* Without MSI or a usable interrupt line, ahci_tick() polls the ports. */
+  g_msi = irq_alloc_vector(ahci_irq);
+  if(g_msi && !pci_enable_msi(&dev, g_msi)) {
+    irq_free_vector(g_msi);
+    g_msi = 0;
+  }
+  g_irq_ok = g_msi || (dev.irq < PIC_IRQ_LINE_COUNT &&
+                       irq_register(dev.irq, ahci_irq));
+  hba[HBA_IS / 4] = 0xFFFFFFFF;
+  if(g_irq_ok) {
+    hba[HBA_GHC / 4] |= GHC_IE;
+    if(!g_msi)
+      pic_unmask(dev.irq);
+  }
+
+  console_printf(
+      "[AHCI] %u disk(s), %u slots, %s %d%s\n", g_nports, g_nslots,
+      g_msi ? "MSI" : "IRQ",
+      g_msi ? (int)g_msi : g_irq_ok ? (int)dev.irq : -1,
+      (cap & CAP_SNCQ) ? ", NCQ" : ""
+  );
+  return g_nports;
+}
+
+bool ahci_attach(u32 n, ata_drive_t *d)
+{
+  if(n >= g_nports)
+    return false;
+  const ahci_port_t *p = &g_ports[n];
+  ata_parse_identify(d, p->id);
+  d->atapi = false;
+  d->dma   = true;
+  d->host  = ATA_HOST_AHCI;
+  d->port  = (u8)n;
+  return true;
+}
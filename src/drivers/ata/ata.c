@@ -2,25 +2,29 @@
  * @file src/drivers/ata/ata.c
  * @brief ATA/IDE disk driver (DMA + PIO fallback, LBA28/48).
  *
- * DMA via PCI Bus Master with per-channel bounce buffer.
- * The bounce buffer is 64 KB (16 contiguous pages) per channel, allowing
- * up to 128 sectors (64 KB) per single DMA command instead of 8 (4 KB).
- * Falls back to PIO when no current process (early boot), DMA unavailable,
- * or the transfer is too large for the bounce buffer.
+ * DMA via PCI Bus Master with scatter/gather PRD tables built from the
+ * callers' pages, up to 256 sectors (128 KB) per command. Memory the bus
+ * master cannot reach (above 4 GB) goes through a 64 KB per-channel bounce
+ * buffer instead. Falls back to PIO when no current process (early boot),
+ * DMA unavailable, or a bounced transfer is too large for the buffer.
  */
 
 #include <alcor2/arch/cpu.h>
 #include <alcor2/arch/io.h>
 #include <alcor2/arch/pic.h>
 #include <alcor2/arch/pit.h>
+#include <alcor2/drivers/ahci.h>
 #include <alcor2/drivers/ata.h>
 #include <alcor2/drivers/console.h>
 #include <alcor2/drivers/pci.h>
+#include <alcor2/drivers/virtio_blk.h>
 #include <alcor2/errno.h>
 #include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
 #include <alcor2/mm/pmm.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/sys/trace.h>
 
 #define TIMEOUT_TICKS    500 /* 5 s at 100 Hz */
 #define LBA28_LIMIT      0x10000000ULL
@@ -30,6 +34,9 @@
 #define DMA_BOUNCE_PAGES 16                          /* 64 KB per channel  */
 #define DMA_BOUNCE_BYTES (DMA_BOUNCE_PAGES * 0x1000) /* 65536 bytes        */
 #define DMA_MAX_SECTORS  (DMA_BOUNCE_BYTES / 512)    /* 128 sectors        */
+#define PRDT_ENTRIES     (0x1000 / sizeof(ata_prd_t)) /* one page            */
+#define PRD_MAX_BYTES    0x10000 /* per entry, within one 64 KB region */
+#define XFER_MAX_SEGS    128     /* keeps a transfer's PRDT within a page */
 
 static ata_channel_t channels[2];
 static ata_drive_t   drives[4];
@@ -178,9 +185,15 @@ static void identify(ata_drive_t *d)
   for(int i = 0; i < 256; i++)
     id[i] = inw(ch->base);
 
+  ata_parse_identify(d, id);
+}
+
+void ata_parse_identify(ata_drive_t *d, const u16 *id)
+{
   d->present = true;
   d->lba48   = !!(id[83] & (1 << 10));
   d->dma     = !!(id[49] & (1 << 8));
+  d->sectors = 0;
 
   if(d->lba48) {
     d->sectors = (u64)id[100] | ((u64)id[101] << 16) | ((u64)id[102] << 32) |
@@ -231,7 +244,8 @@ static i64 wait_irq(ata_channel_t *ch)
 
   u64 deadline = pit_get_ticks() + TIMEOUT_TICKS;
   while(ch->state == ATA_STATE_PENDING) {
-    if(pit_get_ticks() >= deadline) {
+    u64 now = pit_get_ticks();
+    if(now >= deadline) {
       if(ch->dma_ok)
         outb(ch->bmi + BMI_CMD, 0);
       ch->state  = ATA_STATE_IDLE;
@@ -239,9 +253,7 @@ static i64 wait_irq(ata_channel_t *ch)
       cpu_enable_interrupts();
       return -ETIMEDOUT;
     }
-    me->state = PROC_STATE_BLOCKED;
-    proc_schedule();
-    cpu_disable_interrupts();
+    wait_sleep(&ch->irq_wq, 0, deadline - now);
   }
 
   ch->waiter = NULL;
@@ -314,66 +326,62 @@ static void setup_prdt(ata_channel_t *ch, u64 phys, u32 bytes)
   outl(ch->bmi + BMI_PRDT, (u32)ch->prdt_phys);
 }
 
+/* Whether the bus master can transfer straight into or out of @p bio. */
+static bool bio_dma_direct(const ata_bio_t *bio)
+{
+  for(u32 i = 0; i < bio->nseg; i++) {
+    u64 v   = (u64)bio->seg[i].buf;
+    u64 end = v + bio->seg[i].bytes;
+    if(v & 1)
+      return false;
+    while(v < end) {
+      u64 len  = PAGE_SIZE - (v & (PAGE_SIZE - 1));
+      u64 phys = vmm_kernel_phys((const void *)v);
+      if(len > end - v)
+        len = end - v;
+      if(!phys || phys + len > 0x100000000ULL)
+        return false;
+      v += len;
+    }
+  }
+  return true;
+}
+
 /**
- * @brief DMA read/write through bounce buffer with retries.
- * @param d     Target drive.
- * @param lba   Starting sector.
- * @param count Sector count (must fit in one page).
- * @param buf   Caller's buffer.
- * @param write true = write, false = read.
- * @return 0 on success, negative errno on failure.
+ * @brief Append a buffer to a PRD table being built.
+ *
+ * Physically contiguous pages share an entry as long as it stays within
+ * one 64 KB region, as the bus master requires.
+ *
+ * @param prdt Table.
+ * @param n    Entries used so far (updated).
+ * @param buf  Kernel buffer (DMA-reachable, see bio_dma_direct()).
+ * @param bytes Length in bytes.
  */
-static i64
-    dma_transfer(ata_drive_t *d, u64 lba, u32 count, void *buf, bool write)
+static void prdt_add(ata_prd_t *prdt, u32 *n, const void *buf, u32 bytes)
 {
-  ata_channel_t *ch    = d->channel;
-  int            cidx  = (ch == &channels[0]) ? 0 : 1;
-  bool           ext   = d->lba48 && (lba + count) >= LBA28_LIMIT;
-  u32            bytes = count * ATA_SECTOR_SIZE;
-
-  if(bytes > DMA_BOUNCE_BYTES)
-    return -EINVAL;
-
-  void *bounce = bounce_virt[cidx];
-  u64   bphys  = bounce_phys[cidx];
-  if(!bounce)
-    return -ENOMEM;
-
-  if(write)
-    kmemcpy(bounce, buf, bytes);
-
-  for(int retry = 0; retry < MAX_RETRIES; retry++) {
-    outb(ch->bmi + BMI_CMD, 0);
-    outb(ch->bmi + BMI_STATUS, BMI_STATUS_IRQ | BMI_STATUS_ERR);
-
-    setup_prdt(ch, bphys, bytes);
-    prepare_irq_wait(ch);
-
-    if(ext) {
-      setup_lba48(d, lba, (u16)count);
-      reg_write(
-          ch, ATA_REG_COMMAND,
-          write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT
-      );
+  u64 v   = (u64)buf;
+  u64 end = v + bytes;
+  while(v < end) {
+    u64 len  = PAGE_SIZE - (v & (PAGE_SIZE - 1));
+    u64 phys = vmm_kernel_phys((const void *)v);
+    if(len > end - v)
+      len = end - v;
+
+    ata_prd_t *last = *n ? &prdt[*n - 1] : NULL;
+    u32        have = last ? (last->byte_count ? last->byte_count : 0x10000)
+                           : 0;
+    if(last && last->phys_addr + (u64)have == phys &&
+       (last->phys_addr >> 16) == ((phys + len - 1) >> 16)) {
+      last->byte_count = (u16)((have + len) & 0xFFFF);
     } else {
-      setup_lba28(d, lba, (u8)count);
-      reg_write(
-          ch, ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA
-      );
-    }
-
-    outb(ch->bmi + BMI_CMD, BMI_CMD_START | (write ? 0 : BMI_CMD_READ));
-    i64 r = wait_irq(ch);
-    outb(ch->bmi + BMI_CMD, 0);
-
-    if(r == 0 && !(ch->bmi_status & BMI_STATUS_ERR)) {
-      if(!write)
-        kmemcpy(buf, bounce, bytes);
-      return 0;
+      prdt[*n].phys_addr  = (u32)phys;
+      prdt[*n].byte_count = (u16)len;
+      prdt[*n].flags      = 0;
+      (*n)++;
     }
+    v += len;
   }
-
-  return -EIO;
 }
 
 /**
@@ -469,102 +477,948 @@ static i64 pio_write(ata_drive_t *d, u64 lba, u32 count, const void *buf)
   return 0;
 }
 
+/**
+ * @brief Ask a drive to commit its volatile write cache (PIO path).
+ * @param d Drive.
+ * @return 0 on success, negative errno on failure.
+ */
+static i64 pio_flush(ata_drive_t *d)
+{
+  ata_channel_t *ch = d->channel;
+  select_drive(d);
+  prepare_irq_wait(ch);
+  reg_write(
+      ch, ATA_REG_COMMAND,
+      d->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH
+  );
+  return wait_irq(ch);
+}
+
 /*
- * Block cache (read-side, write-through-with-invalidate).
+ * Request queue.
  *
- * 4 KB blocks (8 sectors), 1024 entries = 4 MB total. LRU eviction by
- * monotonic counter. Hits (the common case after warm-up) skip DMA/PIO
- * entirely — clang's repeated ELF page reads now cost a memcpy. Misses
- * fetch a full 4 KB block so adjacent reads land hot.
+ * Each channel runs one DMA transfer at a time and keeps the rest in
+ * submission order. When the channel goes idle,
+ * queue_dispatch() picks the next request with a C-LOOK elevator: the
+ * lowest (drive, LBA) at or past the end of the previous transfer, or the
+ * lowest overall once nothing is left ahead, so the heads sweep in one
+ * direction. A request older than ATA_BIO_DEADLINE is served first so a
+ * busy region cannot starve the rest of the disk. Queued requests of the
+ * same kind that continue the chosen one on disk ride along in the same
+ * transfer, up to ATA_BIO_MAX_SECTORS (one bounce buffer when bounced).
+ *
+ * Reordering never lets a request pass a flush, or pass an earlier request
+ * it overlaps when either of them writes, so ordering between callers that
+ * depend on it (sync writing a block whose write-back is still queued) is
+ * kept. Normally the PRD table points straight at the requests' segments;
+ * for a bounced transfer write data is gathered into the bounce buffer
+ * when it starts and read data is scattered out of it on completion. Queue
+ * state is only touched with the channel lock held, interrupts disabled.
+ * Completions run once the lock is dropped: a done() callback may submit
+ * the next request.
+ */
+
+static inline int channel_index(const ata_channel_t *ch)
+{
+  return ch == &channels[0] ? 0 : 1;
+}
+
+/* Whether requests for @p d go through the channel queue (DMA). */
+static bool queue_ok(const ata_drive_t *d)
+{
+  if(d->host != ATA_HOST_IDE)
+    return proc_current() != NULL;
+  return d->dma && d->channel->dma_ok &&
+         bounce_virt[channel_index(d->channel)] && proc_current();
+}
+
+/* Elevator sort key: drives on a channel are swept one after the other. */
+static inline u64 bio_key(const ata_bio_t *bio)
+{
+  return (u64)bio->drive << 56 | bio->lba;
+}
+
+/* Program the drive for the transfer headed by @p bio (interrupts off). */
+static void bio_start(ata_channel_t *ch, ata_bio_t *bio)
+{
+  ata_drive_t *d      = &drives[bio->drive];
+  int          cidx   = channel_index(ch);
+  u8          *bounce = bounce_virt[cidx];
+
+  ch->active   = bio;
+  ch->state    = ATA_STATE_PENDING;
+  ch->deadline = pit_get_ticks() + TIMEOUT_TICKS;
+
+  if(bio->op == ATA_BIO_FLUSH) {
+    select_drive(d);
+    reg_write(
+        ch, ATA_REG_COMMAND,
+        d->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH
+    );
+    return;
+  }
+
+  bool write = bio->op == ATA_BIO_WRITE;
+  u32  count = 0;
+  u32  nprd  = 0;
+  u64  off   = 0;
+  for(const ata_bio_t *b = bio; b; b = b->next) {
+    count += b->count;
+    for(u32 i = 0; i < b->nseg; i++) {
+      if(bio->direct)
+        prdt_add(ch->prdt, &nprd, b->seg[i].buf, b->seg[i].bytes);
+      else if(write && bio->tries == 0)
+        kmemcpy(bounce + off, b->seg[i].buf, b->seg[i].bytes);
+      off += b->seg[i].bytes;
+    }
+  }
+  bool ext = d->lba48 && (bio->lba + count) >= LBA28_LIMIT;
+
+  outb(ch->bmi + BMI_CMD, 0);
+  outb(ch->bmi + BMI_STATUS, BMI_STATUS_IRQ | BMI_STATUS_ERR);
+  if(bio->direct) {
+    ch->prdt[nprd - 1].flags = PRD_EOT;
+    outl(ch->bmi + BMI_PRDT, (u32)ch->prdt_phys);
+  } else {
+    setup_prdt(ch, bounce_phys[cidx], count * ATA_SECTOR_SIZE);
+  }
+
+  if(ext) {
+    setup_lba48(d, bio->lba, (u16)count);
+    reg_write(
+        ch, ATA_REG_COMMAND,
+        write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT
+    );
+  } else {
+    setup_lba28(d, bio->lba, (u8)count);
+    reg_write(
+        ch, ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA
+    );
+  }
+
+  outb(ch->bmi + BMI_CMD, BMI_CMD_START | (write ? 0 : BMI_CMD_READ));
+}
+
+/* Whether @p bio may be served before the requests queued ahead of it. */
+static bool queue_may_pass(const ata_channel_t *ch, const ata_bio_t *bio)
+{
+  for(const ata_bio_t *a = ch->q_head; a != bio; a = a->next) {
+    if(a->op == ATA_BIO_FLUSH)
+      return false;
+    if(a->drive != bio->drive ||
+       (a->op != ATA_BIO_WRITE && bio->op != ATA_BIO_WRITE))
+      continue;
+    if(a->lba < bio->lba + bio->count && bio->lba < a->lba + a->count)
+      return false;
+  }
+  return true;
+}
+
+/* Choose the next request to serve (C-LOOK with a deadline). */
+static ata_bio_t *queue_pick(const ata_channel_t *ch)
+{
+  ata_bio_t *first = ch->q_head;
+  if(!first || first->op == ATA_BIO_FLUSH ||
+     pit_get_ticks() - first->queued >= ATA_BIO_DEADLINE)
+    return first;
+
+  ata_bio_t *ahead  = NULL; /* lowest key at or past the heads */
+  ata_bio_t *lowest = NULL;
+  for(ata_bio_t *b = first; b && b->op != ATA_BIO_FLUSH; b = b->next) {
+    if(!queue_may_pass(ch, b))
+      continue;
+    u64 key = bio_key(b);
+    if(key >= ch->head_pos && (!ahead || key < bio_key(ahead)))
+      ahead = b;
+    if(!lowest || key < bio_key(lowest))
+      lowest = b;
+  }
+  return ahead ? ahead : lowest;
+}
+
+static void queue_unlink(ata_channel_t *ch, ata_bio_t *bio)
+{
+  ata_bio_t *prev = NULL;
+  for(ata_bio_t *b = ch->q_head; b != bio; b = b->next)
+    prev = b;
+  if(prev)
+    prev->next = bio->next;
+  else
+    ch->q_head = bio->next;
+  if(ch->q_tail == bio)
+    ch->q_tail = prev;
+  bio->next = NULL;
+}
+
+/* Start the next transfer if the channel is idle (channel lock held). */
+static void queue_dispatch(ata_channel_t *ch)
+{
+  if(ch->active)
+    return;
+  ata_bio_t *bio = queue_pick(ch);
+  if(!bio)
+    return;
+  queue_unlink(ch, bio);
+
+  /* Merge queued requests that continue this one on disk. */
+  ata_bio_t *tail  = bio;
+  u32        count = bio->count;
+  u32        nseg  = bio->nseg;
+  u32        limit = bio->direct ? ATA_BIO_MAX_SECTORS : DMA_MAX_SECTORS;
+  bool       found = bio->op != ATA_BIO_FLUSH;
+  while(found) {
+    found = false;
+    for(ata_bio_t *b = ch->q_head; b && b->op != ATA_BIO_FLUSH; b = b->next) {
+      if(b->drive != bio->drive || b->op != bio->op ||
+         b->direct != bio->direct || b->lba != tail->lba + tail->count ||
+         count + b->count > limit || nseg + b->nseg > XFER_MAX_SEGS ||
+         !queue_may_pass(ch, b))
+        continue;
+      queue_unlink(ch, b);
+      tail->next  = b;
+      tail        = b;
+      count      += b->count;
+      nseg       += b->nseg;
+      found       = true;
+      break;
+    }
+  }
+
+  ch->head_pos = bio_key(bio) + count;
+  bio_start(ch, bio);
+}
+
+/* Finish (or retry) the active transfer and start the next one (channel
+ * lock held). Returns the finished requests for bio_end_all(), or NULL. */
+static ata_bio_t *bio_complete(ata_channel_t *ch, i64 status)
+{
+  ata_bio_t *bio = ch->active;
+  outb(ch->bmi + BMI_CMD, 0);
+
+  if(status < 0 && ++bio->tries < MAX_RETRIES) {
+    bio_start(ch, bio);
+    return NULL;
+  }
+
+  if(status == 0 && bio->op == ATA_BIO_READ && !bio->direct) {
+    const u8 *bounce = bounce_virt[channel_index(ch)];
+    u64       off    = 0;
+    for(const ata_bio_t *b = bio; b; b = b->next) {
+      for(u32 i = 0; i < b->nseg; i++) {
+        kmemcpy(b->seg[i].buf, bounce + off, b->seg[i].bytes);
+        off += b->seg[i].bytes;
+      }
+    }
+  }
+
+  ch->active = NULL;
+  ch->state  = ATA_STATE_IDLE;
+  queue_dispatch(ch);
+  return bio;
+}
+
+/* End each request of a finished transfer (channel lock not held). */
+static void bio_end_all(ata_bio_t *bio, i64 status)
+{
+  while(bio) {
+    ata_bio_t *next = bio->next; /* done() may reuse the request */
+    ata_bio_end(bio, status);
+    bio = next;
+  }
+}
+
+void ata_bio_end(ata_bio_t *bio, i64 status)
+{
+  TRACE(ALCOR_TRACE_BIO_DONE, bio, status, 0);
+  bio->next   = NULL;
+  bio->status = status;
+  wait_wake_all(&bio->waiters);
+  if(bio->done)
+    bio->done(bio);
+}
+
+/* Carry a request out synchronously with PIO. */
+static i64 bio_pio(ata_drive_t *d, const ata_bio_t *bio)
+{
+  if(bio->op == ATA_BIO_FLUSH)
+    return pio_flush(d);
+
+  u64 lba = bio->lba;
+  for(u32 i = 0; i < bio->nseg; i++) {
+    u32 n = bio->seg[i].bytes / ATA_SECTOR_SIZE;
+    i64 r = bio->op == ATA_BIO_WRITE ? pio_write(d, lba, n, bio->seg[i].buf)
+                                     : pio_read(d, lba, n, bio->seg[i].buf);
+    if(r < 0)
+      return r;
+    lba += n;
+  }
+  return 0;
+}
+
+/* bio_pio() with the channel to itself: a PIO command sleeps for its IRQ. */
+static i64 bio_run_pio(ata_drive_t *d, const ata_bio_t *bio)
+{
+  mutex_lock(&d->channel->pio);
+  i64 r = bio_pio(d, bio);
+  mutex_unlock(&d->channel->pio);
+  return r;
+}
+
+i64 ata_submit(ata_bio_t *bio)
+{
+  if(!bio || bio->drive >= 4 || bio->op > ATA_BIO_FLUSH)
+    return -EINVAL;
+
+  ata_drive_t *d = &drives[bio->drive];
+  if(!d->present || d->atapi)
+    return -ENODEV;
+
+  if(bio->op != ATA_BIO_FLUSH) {
+    u64 bytes = 0;
+    for(u32 i = 0; i < bio->nseg; i++)
+      bytes += bio->seg[i].bytes;
+    if(bio->count == 0 || bio->count > ATA_BIO_MAX_SECTORS ||
+       bio->nseg > ATA_BIO_MAX_SEGS ||
+       bytes != (u64)bio->count * ATA_SECTOR_SIZE ||
+       bio->lba + bio->count > d->sectors)
+      return -EINVAL;
+    /* Charged to the process that submits it, even for write-back. */
+    proc_t *p = proc_current();
+    if(bio->op == ATA_BIO_READ) {
+      d->rd_ios++;
+      d->rd_sectors += bio->count;
+      if(p)
+        p->usage.inblock += bio->count;
+    } else {
+      d->wr_ios++;
+      d->wr_sectors += bio->count;
+      if(p)
+        p->usage.oublock += bio->count;
+    }
+  }
+
+  bio->status = ATA_BIO_PENDING;
+  bio->tries  = 0;
+  bio->next   = NULL;
+  wait_queue_init(&bio->waiters);
+  TRACE(
+      ALCOR_TRACE_BIO_SUBMIT, bio, bio->lba,
+      ALCOR_TRACE_BIO(bio->count, bio->op, bio->drive)
+  );
+  if(d->host == ATA_HOST_AHCI)
+    return ahci_submit(d->port, bio);
+  if(d->host == ATA_HOST_VIRTIO)
+    return virtio_blk_submit(d->port, bio);
+  bio->direct = bio->op != ATA_BIO_FLUSH && bio_dma_direct(bio);
+
+  /* Too big for the bounce buffer and not reachable in place: use PIO. */
+  if(!queue_ok(d) || (!bio->direct && bio->count > DMA_MAX_SECTORS)) {
+    bio->status = bio_run_pio(d, bio);
+    TRACE(ALCOR_TRACE_BIO_DONE, bio, bio->status, 0);
+    if(bio->done)
+      bio->done(bio);
+    return 0;
+  }
+
+  ata_channel_t *ch    = d->channel;
+  u64            flags = spin_lock_irqsave(&ch->lock);
+  bio->queued          = pit_get_ticks();
+  if(ch->q_tail)
+    ch->q_tail->next = bio;
+  else
+    ch->q_head = bio;
+  ch->q_tail = bio;
+  queue_dispatch(ch);
+  spin_unlock_irqrestore(&ch->lock, flags);
+  return 0;
+}
+
+i64 ata_wait(ata_bio_t *bio)
+{
+  cpu_disable_interrupts();
+  while(bio->status == ATA_BIO_PENDING)
+    wait_sleep(&bio->waiters, 0, 0);
+  cpu_enable_interrupts();
+  return bio->status;
+}
+
+/* Submit a request and sleep until it completes. */
+static i64 bio_sync(ata_bio_t *bio)
+{
+  i64 r = ata_submit(bio);
+  return r < 0 ? r : ata_wait(bio);
+}
+
+void ata_tick(void)
+{
+  ahci_tick();
+  virtio_blk_tick();
+
+  u64 now = pit_get_ticks();
+  for(int i = 0; i < 2; i++) {
+    ata_channel_t *ch    = &channels[i];
+    ata_bio_t     *done  = NULL;
+    u64            flags = spin_lock_irqsave(&ch->lock);
+    if(ch->active && now >= ch->deadline)
+      done = bio_complete(ch, -ETIMEDOUT);
+    spin_unlock_irqrestore(&ch->lock, flags);
+    bio_end_all(done, -ETIMEDOUT);
+  }
+}
+
+/*
+ * Block cache (write-back).
+ *
+ * 4 KB blocks (8 sectors). The number of slots scales with RAM (1/32 of
+ * it, CACHE_MIN_ENTRIES..CACHE_MAX_ENTRIES); each slot gets a page frame
+ * the first time it is used, and the PMM shrinker takes frames of clean,
+ * idle blocks back from the LRU tail under memory pressure. Entries hang
+ * off a hash table keyed by (drive, block_lba) and sit on one LRU list
+ * (free slots at the tail), so lookup, insert and eviction are O(1) and
+ * invalidating a range only probes the blocks it covers. Hits (the common
+ * case after warm-up) skip DMA/PIO entirely — clang's repeated ELF page
+ * reads now cost a memcpy. Misses fetch full 4 KB blocks, and a read that
+ * misses several consecutive blocks fetches them all with one DMA command,
+ * which the drive transfers straight into the cache entries.
+ *
+ * Writes only update the cached block and mark it dirty. Dirty blocks reach
+ * the disk when they are evicted, when too many pile up, when they have
+ * been dirty for CACHE_FLUSH_TICKS, or on ata_sync(). Each write-back takes
+ * the whole run of dirty blocks adjacent on disk (up to CACHE_RUN_MAX)
+ * and sends it as a single request. A per-entry generation counter tells
+ * whether a block was written again while its write-back was in flight, in
+ * which case it stays dirty.
+ *
+ * Prefetches and periodic write-backs are asynchronous: they are queued
+ * through a small table of in-flight requests (g_cache_io) and retired by
+ * cache_reap() from process context, so the IRQ handler never touches
+ * cache metadata. A block being prefetched is hashed but marked busy;
+ * lookups wait for its request before using it.
  */
 
 #define CACHE_BLOCK_SECTORS 8u
 #define CACHE_BLOCK_BYTES   ((u64)CACHE_BLOCK_SECTORS * 512u)
-#define CACHE_NUM_ENTRIES   1024
+#define CACHE_RAM_SHARE     32 /* slots cover at most 1/N of RAM */
+#define CACHE_MIN_ENTRIES   256
+#define CACHE_MAX_ENTRIES   16384 /* i16 slot numbers */
 #define CACHE_INVALID_LBA   ((u64) - 1)
+#define CACHE_NIL           (-1)
+#define CACHE_RUN_MAX       (ATA_BIO_MAX_SECTORS / CACHE_BLOCK_SECTORS)
+#define CACHE_DIRTY_MAX     (g_cache_entries / 2u) /* writers flush above */
+#define CACHE_FLUSH_TICKS   300                     /* 3 s at 100 Hz */
+#define CACHE_ALL_DRIVES    0xFF
+#define CACHE_IO_MAX        8 /* asynchronous requests in flight */
 
 // cppcheck-suppress unusedStructMember
 typedef struct
 {
   u64 block_lba; /* aligned, CACHE_INVALID_LBA = free slot */
-  u64 last_used;
+  u8 *data;      /* page frame (HHDM), NULL until the slot is used */
+  u32 gen;       /* bumped by every write into the block */
+  i16 hnext;     /* hash chain, CACHE_NIL terminated */
+  i16 prev;      /* LRU list, head = most recently used */
+  i16 next;
   u8  drive;
-  // cppcheck-suppress unusedStructMember
-  u8 pad[7];
-  u8 data[CACHE_BLOCK_BYTES];
+  u8  dirty; /* newer than the disk; not evictable until written */
+  u8  io;    /* 1 + g_cache_io slot with a request on it, 0 = none */
 } ata_cache_entry_t;
 
-static ata_cache_entry_t g_ata_cache[CACHE_NUM_ENTRIES];
-static u64               g_cache_counter = 0;
-static int               g_cache_inited  = 0;
+/**
+ * @brief Asynchronous prefetch or write-back of a run of blocks.
+ */
+typedef struct
+{
+  ata_bio_t bio;
+  i16       slot[CACHE_RUN_MAX]; /* entries covered, in disk order */
+  u32       gen[CACHE_RUN_MAX];  /* write-back: generation when queued */
+  u8        n;
+  bool      busy;
+} cache_io_t;
+
+static ata_cache_entry_t *g_ata_cache;
+static i16               *g_cache_hash;
+static u32                g_cache_entries;
+static u32                g_cache_hash_mask;
+static u64                g_cache_frames; /* slots holding a frame */
+static i16                g_lru_head     = CACHE_NIL;
+static i16                g_lru_tail     = CACHE_NIL;
+static int                g_cache_inited = 0;
+static u64                g_dirty_since; /* tick of the oldest dirty block */
+static cache_io_t         g_cache_io[CACHE_IO_MAX];
+
+static alcor_blkcache_stats_t g_cache_stats;
+
+static inline u32 cache_hash(u8 drive, u64 block_lba)
+{
+  u64 h = (block_lba / CACHE_BLOCK_SECTORS) * 0x9E3779B97F4A7C15ULL ^ drive;
+  return (u32)(h >> 40) & g_cache_hash_mask;
+}
+
+static void lru_unlink(i16 i)
+{
+  ata_cache_entry_t *e = &g_ata_cache[i];
+  if(e->prev != CACHE_NIL)
+    g_ata_cache[e->prev].next = e->next;
+  else
+    g_lru_head = e->next;
+  if(e->next != CACHE_NIL)
+    g_ata_cache[e->next].prev = e->prev;
+  else
+    g_lru_tail = e->prev;
+}
+
+static void lru_push_head(i16 i)
+{
+  ata_cache_entry_t *e = &g_ata_cache[i];
+  e->prev              = CACHE_NIL;
+  e->next              = g_lru_head;
+  if(g_lru_head != CACHE_NIL)
+    g_ata_cache[g_lru_head].prev = i;
+  g_lru_head = i;
+  if(g_lru_tail == CACHE_NIL)
+    g_lru_tail = i;
+}
+
+static void lru_push_tail(i16 i)
+{
+  ata_cache_entry_t *e = &g_ata_cache[i];
+  e->next              = CACHE_NIL;
+  e->prev              = g_lru_tail;
+  if(g_lru_tail != CACHE_NIL)
+    g_ata_cache[g_lru_tail].next = i;
+  g_lru_tail = i;
+  if(g_lru_head == CACHE_NIL)
+    g_lru_head = i;
+}
 
-static void              cache_init_once(void)
+static u64 cache_shrink(u64 want);
+
+static u64 cache_count(void)
+{
+  return g_cache_frames;
+}
+
+static const pmm_shrinker_t cache_shrinker = {
+    .name  = "blkcache",
+    .scan  = cache_shrink,
+    .count = cache_count,
+};
+
+/* Size the slot table for this machine's RAM; false if none could be had. */
+static bool cache_init_once(void)
 {
   if(g_cache_inited)
-    return;
-  for(int i = 0; i < CACHE_NUM_ENTRIES; i++)
-    g_ata_cache[i].block_lba = CACHE_INVALID_LBA;
+    return g_cache_entries != 0;
   g_cache_inited = 1;
+
+  u64 n = pmm_get_total() / CACHE_RAM_SHARE / CACHE_BLOCK_BYTES;
+  if(n < CACHE_MIN_ENTRIES)
+    n = CACHE_MIN_ENTRIES;
+  if(n > CACHE_MAX_ENTRIES)
+    n = CACHE_MAX_ENTRIES;
+
+  /* Hash table: a power of two, at least twice the slots. */
+  u32   hsize;
+  void *mem;
+  for(;;) {
+    for(hsize = 1; hsize < 2 * n; hsize *= 2)
+      ;
+    mem = kmalloc(n * sizeof(ata_cache_entry_t) + hsize * sizeof(i16));
+    if(mem || n <= CACHE_MIN_ENTRIES)
+      break;
+    n /= 2;
+  }
+  if(!mem) {
+    console_print("[ATA] No memory for the block cache\n");
+    return false;
+  }
+
+  g_ata_cache       = mem;
+  g_cache_hash      = (i16 *)(g_ata_cache + n);
+  g_cache_entries   = (u32)n;
+  g_cache_hash_mask = hsize - 1;
+  for(u32 i = 0; i < hsize; i++)
+    g_cache_hash[i] = CACHE_NIL;
+  for(i16 i = 0; i < (i16)n; i++) {
+    kzero(&g_ata_cache[i], sizeof(g_ata_cache[i]));
+    g_ata_cache[i].block_lba = CACHE_INVALID_LBA;
+    g_ata_cache[i].hnext     = CACHE_NIL;
+    lru_push_tail(i);
+  }
+  g_cache_stats.capacity = n;
+  pmm_register_shrinker(&cache_shrinker);
+  return true;
 }
 
-static ata_cache_entry_t *cache_lookup(u8 drive, u64 block_lba)
+static i16 cache_find(u8 drive, u64 block_lba)
+{
+  for(i16 i = g_cache_hash[cache_hash(drive, block_lba)]; i != CACHE_NIL;
+      i = g_ata_cache[i].hnext) {
+    if(g_ata_cache[i].block_lba == block_lba && g_ata_cache[i].drive == drive)
+      return i;
+  }
+  return CACHE_NIL;
+}
+
+/* Remove a valid entry from its hash chain and mark the slot free. */
+static void cache_unhash(i16 i)
+{
+  ata_cache_entry_t *e    = &g_ata_cache[i];
+  i16               *link = &g_cache_hash[cache_hash(e->drive, e->block_lba)];
+  while(*link != i)
+    link = &g_ata_cache[*link].hnext;
+  *link        = e->hnext;
+  e->hnext     = CACHE_NIL;
+  e->block_lba = CACHE_INVALID_LBA;
+  g_cache_stats.entries--;
+}
+
+/* Publish a slot under (drive, block_lba). */
+static void cache_insert(ata_cache_entry_t *e, u8 drive, u64 block_lba)
+{
+  u32 h           = cache_hash(drive, block_lba);
+  e->block_lba    = block_lba;
+  e->drive        = drive;
+  e->dirty        = 0;
+  e->hnext        = g_cache_hash[h];
+  g_cache_hash[h] = (i16)(e - g_ata_cache);
+  g_cache_stats.entries++;
+}
+
+/* Hand a clean slot back as free (LRU tail). */
+static void cache_release(ata_cache_entry_t *e)
+{
+  i16 i = (i16)(e - g_ata_cache);
+  if(e->block_lba != CACHE_INVALID_LBA)
+    cache_unhash(i);
+  lru_unlink(i);
+  lru_push_tail(i);
+}
+
+/* Retire finished asynchronous requests (process context only). */
+static void cache_reap(void)
+{
+  for(int i = 0; i < CACHE_IO_MAX; i++) {
+    cache_io_t *io = &g_cache_io[i];
+    if(!io->busy || io->bio.status == ATA_BIO_PENDING)
+      continue;
+
+    i64 st = io->bio.status;
+    for(u32 k = 0; k < io->n; k++) {
+      ata_cache_entry_t *e = &g_ata_cache[io->slot[k]];
+      if(e->io == i + 1)
+        e->io = 0;
+      if(io->bio.op == ATA_BIO_READ) {
+        if(st < 0)
+          cache_release(e);
+      } else if(st == 0 && e->dirty && e->gen == io->gen[k]) {
+        e->dirty = 0;
+        g_cache_stats.dirty--;
+      }
+    }
+    if(io->bio.op == ATA_BIO_WRITE && st == 0)
+      g_cache_stats.writebacks += io->n;
+    io->busy = false;
+  }
+}
+
+/* Sleep until the asynchronous request on entry @p i (if any) is retired. */
+static void cache_wait_io(i16 i)
+{
+  u8 io = g_ata_cache[i].io;
+  if(!io)
+    return;
+  ata_wait(&g_cache_io[io - 1].bio);
+  cache_reap();
+}
+
+static cache_io_t *cache_io_get(void)
 {
-  for(int i = 0; i < CACHE_NUM_ENTRIES; i++) {
-    if(g_ata_cache[i].block_lba == block_lba && g_ata_cache[i].drive == drive) {
-      g_ata_cache[i].last_used = ++g_cache_counter;
-      return &g_ata_cache[i];
+  for(int i = 0; i < CACHE_IO_MAX; i++) {
+    if(!g_cache_io[i].busy) {
+      g_cache_io[i].busy = true;
+      g_cache_io[i].n    = 0;
+      return &g_cache_io[i];
     }
   }
   return NULL;
 }
 
-static ata_cache_entry_t *cache_alloc(void)
+/* Find a block whose data is usable (waiting out a prefetch). */
+static ata_cache_entry_t *cache_lookup(u8 drive, u64 block_lba)
+{
+  i16 i = cache_find(drive, block_lba);
+  while(i != CACHE_NIL && g_ata_cache[i].io &&
+        g_cache_io[g_ata_cache[i].io - 1].bio.op == ATA_BIO_READ) {
+    cache_wait_io(i);
+    i = cache_find(drive, block_lba);
+  }
+  if(i == CACHE_NIL)
+    return NULL;
+  lru_unlink(i);
+  lru_push_head(i);
+  return &g_ata_cache[i];
+}
+
+/* Sectors of the block at @p block_lba that exist (short at disk end). */
+static u32 block_sectors(const ata_drive_t *d, u64 block_lba)
+{
+  u64 left = d->sectors - block_lba;
+  return left < CACHE_BLOCK_SECTORS ? (u32)left : CACHE_BLOCK_SECTORS;
+}
+
+/* Append the existing part of entry @p e's block to @p bio. */
+static void bio_add_block(
+    ata_bio_t *bio, const ata_drive_t *d, ata_cache_entry_t *e, u64 block_lba
+)
+{
+  u32 n                     = block_sectors(d, block_lba);
+  bio->seg[bio->nseg].buf   = e->data;
+  bio->seg[bio->nseg].bytes = n * ATA_SECTOR_SIZE;
+  bio->nseg++;
+  bio->count += n;
+}
+
+static void mark_dirty(ata_cache_entry_t *e)
+{
+  e->gen++;
+  if(e->dirty)
+    return;
+  if(g_cache_stats.dirty == 0)
+    g_dirty_since = pit_get_ticks();
+  e->dirty = 1;
+  g_cache_stats.dirty++;
+}
+
+/**
+ * @brief Collect the run of dirty blocks around slot @p i into a write.
+ *
+ * The run is every dirty block adjacent on disk to @p i's block, capped at
+ * CACHE_RUN_MAX blocks.
+ *
+ * @param i    Slot of a dirty block.
+ * @param idle Only take blocks with no asynchronous request on them.
+ * @param bio  Write request to fill (lba, count, segments).
+ * @param run  Slots of the run, in disk order.
+ * @param gen  Their generations.
+ * @return Number of blocks in the run (0 if @p i itself is busy).
+ */
+static u32 cache_dirty_run(i16 i, bool idle, ata_bio_t *bio, i16 *run, u32 *gen)
+{
+  u8                 drive = g_ata_cache[i].drive;
+  const ata_drive_t *d     = &drives[drive];
+  u64                lba   = g_ata_cache[i].block_lba;
+
+  for(u32 back = 1; back < CACHE_RUN_MAX && lba >= CACHE_BLOCK_SECTORS;
+      back++) {
+    i16 p = cache_find(drive, lba - CACHE_BLOCK_SECTORS);
+    if(p == CACHE_NIL || !g_ata_cache[p].dirty || (idle && g_ata_cache[p].io))
+      break;
+    lba -= CACHE_BLOCK_SECTORS;
+  }
+
+  kzero(bio, sizeof(*bio));
+  bio->lba   = lba;
+  bio->drive = drive;
+  bio->op    = ATA_BIO_WRITE;
+
+  u32 n = 0;
+  for(u64 b = lba; n < CACHE_RUN_MAX && b < d->sectors;
+      b += CACHE_BLOCK_SECTORS) {
+    i16 j = cache_find(drive, b);
+    if(j == CACHE_NIL || !g_ata_cache[j].dirty || (idle && g_ata_cache[j].io))
+      break;
+    run[n] = j;
+    gen[n] = g_ata_cache[j].gen;
+    n++;
+    bio_add_block(bio, d, &g_ata_cache[j], b);
+  }
+  return n;
+}
+
+/**
+ * @brief Write back the run of dirty blocks around slot @p i and wait.
+ * @param i Slot of a dirty block.
+ * @return 0 on success, negative errno on failure (blocks stay dirty).
+ */
+static i64 cache_flush_run(i16 i)
 {
-  /* Prefer free slot; else evict LRU. */
-  int idx    = 0;
-  u64 oldest = (u64)-1;
-  for(int i = 0; i < CACHE_NUM_ENTRIES; i++) {
-    if(g_ata_cache[i].block_lba == CACHE_INVALID_LBA)
-      return &g_ata_cache[i];
-    if(g_ata_cache[i].last_used < oldest) {
-      oldest = g_ata_cache[i].last_used;
-      idx    = i;
+  ata_bio_t bio;
+  i16       run[CACHE_RUN_MAX];
+  u32       gen[CACHE_RUN_MAX];
+  u32       n = cache_dirty_run(i, false, &bio, run, gen);
+
+  g_cache_stats.write_cmds++;
+  i64 r = bio_sync(&bio);
+  if(r < 0)
+    return r;
+
+  /* Dirty blocks are never evicted, so the run's slots are still ours. */
+  for(u32 k = 0; k < n; k++) {
+    ata_cache_entry_t *e = &g_ata_cache[run[k]];
+    if(e->dirty && e->gen == gen[k]) {
+      e->dirty = 0;
+      g_cache_stats.dirty--;
     }
   }
-  return &g_ata_cache[idx];
+  g_cache_stats.writebacks += n;
+  return 0;
 }
 
-static void cache_invalidate_range(u8 drive, u64 lba, u32 count)
+/**
+ * @brief Write back every dirty block of one drive and wait for it.
+ *
+ * Blocks with a write-back already queued are written again: requests
+ * complete in order, so once this returns the newest data is on disk.
+ *
+ * @param drive Drive index, or CACHE_ALL_DRIVES.
+ * @return 0 on success, or the first write error.
+ */
+static i64 cache_flush_all(u8 drive)
 {
-  u64 end = lba + count;
-  for(int i = 0; i < CACHE_NUM_ENTRIES; i++) {
-    if(g_ata_cache[i].block_lba == CACHE_INVALID_LBA)
+  i64 ret = 0;
+  cache_reap();
+  for(i16 i = 0; i < (i16)g_cache_entries && g_cache_stats.dirty; i++) {
+    const ata_cache_entry_t *e = &g_ata_cache[i];
+    if(!e->dirty || (drive != CACHE_ALL_DRIVES && e->drive != drive))
       continue;
-    if(g_ata_cache[i].drive != drive)
+    i64 r = cache_flush_run(i);
+    if(r < 0 && ret == 0)
+      ret = r;
+  }
+  if(g_cache_stats.dirty)
+    g_dirty_since = pit_get_ticks();
+  return ret;
+}
+
+/* Slot to reuse: the LRU tail, given a frame if it has none. Without
+ * memory for one, the least recently used slot that has a frame. */
+static i16 cache_victim(void)
+{
+  i16 i = g_lru_tail;
+  if(i == CACHE_NIL || g_ata_cache[i].data)
+    return i;
+  void *frame = pmm_alloc();
+  if(frame) {
+    g_ata_cache[i].data = phys_to_virt((u64)frame);
+    g_cache_frames++;
+    return i;
+  }
+  while(i != CACHE_NIL && !g_ata_cache[i].data)
+    i = g_ata_cache[i].prev;
+  return i;
+}
+
+/* Take the LRU tail (a free slot if any) and move it to the head. A dirty
+ * or busy tail is written back or waited for first; NULL if that fails. */
+static ata_cache_entry_t *cache_alloc(void)
+{
+  i16 i = cache_victim();
+  while(i != CACHE_NIL && (g_ata_cache[i].dirty || g_ata_cache[i].io)) {
+    if(g_ata_cache[i].io)
+      cache_wait_io(i);
+    else if(cache_flush_run(i) < 0)
+      return NULL;
+    i = cache_victim();
+  }
+  if(i == CACHE_NIL)
+    return NULL;
+  if(g_ata_cache[i].block_lba != CACHE_INVALID_LBA) {
+    cache_unhash(i);
+    g_cache_stats.evictions++;
+  }
+  lru_unlink(i);
+  lru_push_head(i);
+  return &g_ata_cache[i];
+}
+
+/* Like cache_alloc(), but never sleeps: NULL unless the tail is idle. */
+static ata_cache_entry_t *cache_alloc_idle(void)
+{
+  i16 i = cache_victim();
+  if(i == CACHE_NIL || g_ata_cache[i].dirty || g_ata_cache[i].io)
+    return NULL;
+  return cache_alloc();
+}
+
+/* PMM shrinker: give back the frames of clean, idle cached blocks, least
+ * recently used first. Unhashed slots are skipped: cache_fill() may hold
+ * them across its read. */
+static u64 cache_shrink(u64 want)
+{
+  u64 got = 0;
+  for(i16 i = g_lru_tail, prev; i != CACHE_NIL && got < want; i = prev) {
+    ata_cache_entry_t *e = &g_ata_cache[i];
+    prev                 = e->prev;
+    if(!e->data || e->dirty || e->io || e->block_lba == CACHE_INVALID_LBA)
       continue;
-    u64 b_start = g_ata_cache[i].block_lba;
-    u64 b_end   = b_start + CACHE_BLOCK_SECTORS;
-    if(b_start < end && b_end > lba)
-      g_ata_cache[i].block_lba = CACHE_INVALID_LBA;
+    cache_unhash(i);
+    pmm_free((void *)virt_to_phys(e->data));
+    e->data = NULL;
+    g_cache_frames--;
+    lru_unlink(i);
+    lru_push_tail(i);
+    got++;
   }
+  return got;
 }
 
-static i64 ata_read_raw(ata_drive_t *d, u64 lba, u32 count, void *buf)
+void ata_cache_stats(alcor_blkcache_stats_t *out)
 {
-  if(d->dma && d->channel->dma_ok && proc_current() && count <= DMA_MAX_SECTORS)
-    return dma_transfer(d, lba, count, buf, false);
-  return pio_read(d, lba, count, buf);
+  cache_init_once();
+  *out = g_cache_stats;
 }
 
 /**
- * @brief Read sectors from an ATA drive (cache + DMA/PIO fallback).
- * @param drive Drive index (0-3).
- * @param lba   Starting sector.
- * @param count Number of sectors.
- * @param buf   Output buffer.
- * @return 0 on success, negative errno on failure.
+ * @brief Read a run of uncached blocks from the disk into the cache.
+ *
+ * The run goes out as one request. Blocks another caller cached while
+ * the request slept are left alone.
+ *
+ * @param d         Drive.
+ * @param drive     Drive index.
+ * @param block_lba Block-aligned LBA of the first block.
+ * @param nblocks   Blocks in the run (1..CACHE_RUN_MAX).
+ * @return Number of blocks read, or negative errno.
  */
-i64 ata_read(u8 drive, u64 lba, u32 count, void *buf)
+static i64 cache_fill(ata_drive_t *d, u8 drive, u64 block_lba, u32 nblocks)
+{
+  ata_cache_entry_t *slot[CACHE_RUN_MAX];
+  for(u32 k = 0; k < nblocks; k++) {
+    slot[k] = cache_alloc();
+    if(!slot[k]) {
+      while(k--)
+        cache_release(slot[k]);
+      return -EIO;
+    }
+  }
+
+  ata_bio_t bio;
+  kzero(&bio, sizeof(bio));
+  bio.lba   = block_lba;
+  bio.drive = drive;
+  bio.op    = ATA_BIO_READ;
+  for(u32 k = 0; k < nblocks; k++)
+    bio_add_block(&bio, d, slot[k], block_lba + (u64)k * CACHE_BLOCK_SECTORS);
+  i64 r = bio_sync(&bio);
+
+  for(u32 k = 0; k < nblocks; k++) {
+    ata_cache_entry_t *e = slot[k];
+    u64                b = block_lba + (u64)k * CACHE_BLOCK_SECTORS;
+    if(r < 0 || cache_find(drive, b) != CACHE_NIL) {
+      cache_release(e);
+      continue;
+    }
+    /* Zero unread tail (partial block at disk end). */
+    u64 bytes = (u64)block_sectors(d, b) * ATA_SECTOR_SIZE;
+    kzero(e->data + bytes, CACHE_BLOCK_BYTES - bytes);
+    cache_insert(e, drive, b);
+  }
+  return r < 0 ? r : (i64)nblocks;
+}
+
+/* ata_read() proper: serve the sectors from the block cache, filling it. */
+static i64 cached_read(u8 drive, u64 lba, u32 count, void *buf)
 {
   if(drive >= 4 || !buf || count == 0)
     return -EINVAL;
@@ -575,11 +1429,14 @@ i64 ata_read(u8 drive, u64 lba, u32 count, void *buf)
   if(lba + count > d->sectors)
     return -EINVAL;
 
-  cache_init_once();
+  if(!cache_init_once())
+    return -ENOMEM;
+  cache_reap();
 
-  u64 cur = lba;
-  u64 end = lba + count;
-  u8 *out = (u8 *)buf;
+  u64 cur        = lba;
+  u64 end        = lba + count;
+  u8 *out        = (u8 *)buf;
+  u64 prefetched = 0; /* blocks of the last fill not yet consumed */
 
   while(cur < end) {
     u64 block_lba     = cur & ~(u64)(CACHE_BLOCK_SECTORS - 1);
@@ -589,24 +1446,28 @@ i64 ata_read(u8 drive, u64 lba, u32 count, void *buf)
     u64 take          = left_in_block < left_total ? left_in_block : left_total;
 
     ata_cache_entry_t *e = cache_lookup(drive, block_lba);
-    if(!e) {
-      e              = cache_alloc();
-      u64 block_size = CACHE_BLOCK_SECTORS;
-      if(block_lba + block_size > d->sectors)
-        block_size = d->sectors - block_lba;
-
-      i64 r = ata_read_raw(d, block_lba, (u32)block_size, e->data);
-      if(r < 0) {
-        e->block_lba = CACHE_INVALID_LBA;
-        return r;
-      }
-      /* Zero unread tail (partial block at disk end). */
-      for(u64 i = block_size * 512; i < CACHE_BLOCK_BYTES; i++)
-        e->data[i] = 0;
-
-      e->block_lba = block_lba;
-      e->drive     = drive;
-      e->last_used = ++g_cache_counter;
+    if(e && prefetched) {
+      prefetched--;
+    } else if(e) {
+      g_cache_stats.hits++;
+    } else {
+      /* Fetch the whole run of missing blocks the request covers at once. */
+      u32 run = 1;
+      while(run < CACHE_RUN_MAX &&
+            block_lba + (u64)run * CACHE_BLOCK_SECTORS < end &&
+            cache_find(drive, block_lba + (u64)run * CACHE_BLOCK_SECTORS) ==
+                CACHE_NIL)
+        run++;
+
+      i64 got = cache_fill(d, drive, block_lba, run);
+      if(got < 0)
+        return got;
+      g_cache_stats.misses += (u64)got;
+      prefetched = (u64)got - 1;
+
+      e = cache_lookup(drive, block_lba);
+      if(!e)
+        return -EIO;
     }
 
     kmemcpy(out, &e->data[in_block * 512], take * 512);
@@ -618,7 +1479,79 @@ i64 ata_read(u8 drive, u64 lba, u32 count, void *buf)
 }
 
 /**
- * @brief Write sectors to an ATA drive (DMA if available, else PIO).
+ * @brief Read sectors from an ATA drive (cache + DMA/PIO fallback).
+ * @param drive Drive index (0-3).
+ * @param lba   Starting sector.
+ * @param count Number of sectors.
+ * @param buf   Output buffer.
+ * @return 0 on success, negative errno on failure.
+ */
+i64 ata_read(u8 drive, u64 lba, u32 count, void *buf)
+{
+  TRACE(ALCOR_TRACE_ATA_READ, drive, lba, count);
+  i64 r = cached_read(drive, lba, count, buf);
+  TRACE(ALCOR_TRACE_ATA_READ_END, r, 0, 0);
+  return r;
+}
+
+void ata_prefetch(u8 drive, u64 lba, u32 count)
+{
+  if(drive >= 4 || count == 0)
+    return;
+  ata_drive_t *d = &drives[drive];
+  if(!d->present || d->atapi || !queue_ok(d))
+    return;
+  if(lba + count > d->sectors)
+    return;
+
+  if(!cache_init_once())
+    return;
+  cache_reap();
+
+  u64 block_lba = lba & ~(u64)(CACHE_BLOCK_SECTORS - 1);
+  u64 end       = lba + count;
+  while(block_lba < end) {
+    if(cache_find(drive, block_lba) != CACHE_NIL) {
+      block_lba += CACHE_BLOCK_SECTORS;
+      continue;
+    }
+
+    cache_io_t *io = cache_io_get();
+    if(!io)
+      return;
+    kzero(&io->bio, sizeof(io->bio));
+    io->bio.lba   = block_lba;
+    io->bio.drive = drive;
+    io->bio.op    = ATA_BIO_READ;
+
+    /* Claim idle slots for the run of missing blocks; hashing them now
+     * makes concurrent readers wait for this request. */
+    while(io->n < CACHE_RUN_MAX && block_lba < end &&
+          cache_find(drive, block_lba) == CACHE_NIL) {
+      ata_cache_entry_t *e = cache_alloc_idle();
+      if(!e)
+        break;
+      kzero(e->data, CACHE_BLOCK_BYTES);
+      cache_insert(e, drive, block_lba);
+      e->io             = (u8)(io - g_cache_io) + 1;
+      io->slot[io->n++] = (i16)(e - g_ata_cache);
+      bio_add_block(&io->bio, d, e, block_lba);
+      block_lba += CACHE_BLOCK_SECTORS;
+    }
+
+    if(io->n == 0 || ata_submit(&io->bio) < 0) {
+      for(u32 k = 0; k < io->n; k++) {
+        g_ata_cache[io->slot[k]].io = 0;
+        cache_release(&g_ata_cache[io->slot[k]]);
+      }
+      io->busy = false;
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Write sectors to an ATA drive (into the write-back cache).
  * @param drive Drive index (0-3).
  * @param lba   Starting sector.
  * @param count Number of sectors.
@@ -636,16 +1569,212 @@ i64 ata_write(u8 drive, u64 lba, u32 count, const void *buf)
   if(lba + count > d->sectors)
     return -EINVAL;
 
-  /* Write-through: invalidate any cached blocks overlapping this range so
-   * the next read sees fresh data. Simpler and safer than mutating cache
-   * entries in place (handles unaligned writes too). */
+  if(!cache_init_once())
+    return -ENOMEM;
+  cache_reap();
+
+  u64       cur = lba;
+  u64       end = lba + count;
+  const u8 *in  = (const u8 *)buf;
+
+  while(cur < end) {
+    u64 block_lba     = cur & ~(u64)(CACHE_BLOCK_SECTORS - 1);
+    u64 in_block      = cur - block_lba;
+    u64 left_in_block = CACHE_BLOCK_SECTORS - in_block;
+    u64 left_total    = end - cur;
+    u64 take          = left_in_block < left_total ? left_in_block : left_total;
+
+    ata_cache_entry_t *e = cache_lookup(drive, block_lba);
+    if(!e && in_block == 0 && take == block_sectors(d, block_lba)) {
+      /* Whole block overwritten: no need to read it first. */
+      e = cache_alloc();
+      if(!e)
+        return -EIO;
+      ata_cache_entry_t *raced = cache_lookup(drive, block_lba);
+      if(raced) {
+        cache_release(e);
+        e = raced;
+      } else {
+        kzero(e->data, CACHE_BLOCK_BYTES);
+        cache_insert(e, drive, block_lba);
+      }
+    } else if(!e) {
+      i64 got = cache_fill(d, drive, block_lba, 1);
+      if(got < 0)
+        return got;
+      e = cache_lookup(drive, block_lba);
+      if(!e)
+        return -EIO;
+    }
+
+    kmemcpy(&e->data[in_block * 512], in, take * 512);
+    mark_dirty(e);
+    in += take * 512;
+    cur += take;
+  }
+
+  if(g_cache_stats.dirty > CACHE_DIRTY_MAX)
+    return cache_flush_all(CACHE_ALL_DRIVES);
+  return 0;
+}
+
+/**
+ * @brief Reconcile the cache with a transfer that goes around it.
+ *
+ * Waits out requests on the range's blocks and writes back dirty ones, so
+ * the disk holds the newest data; with @p drop, clean copies are released
+ * as well (the disk is about to change under them).
+ *
+ * @return 0, or the first write-back error.
+ */
+static i64 cache_bypass(u8 drive, u64 lba, u32 count, bool drop)
+{
+  u64 end = lba + count;
+  for(u64 b = lba & ~(u64)(CACHE_BLOCK_SECTORS - 1); b < end;
+      b += CACHE_BLOCK_SECTORS) {
+    i16 i = cache_find(drive, b);
+    while(i != CACHE_NIL && g_ata_cache[i].io) {
+      cache_wait_io(i);
+      i = cache_find(drive, b);
+    }
+    if(i == CACHE_NIL)
+      continue;
+    if(g_ata_cache[i].dirty) {
+      i64 r = cache_flush_run(i);
+      if(r < 0)
+        return r;
+    }
+    if(drop && !g_ata_cache[i].dirty)
+      cache_release(&g_ata_cache[i]);
+  }
+  return 0;
+}
+
+#define DIRECT_BIOS 16 /* requests of one ata_direct() in flight: 2 MB */
+
+i64 ata_direct(
+    u8 drive, u8 op, u64 lba, u32 count, const u64 *pages, u32 offset
+)
+{
+  if(drive >= 4 || !pages || count == 0 ||
+     (op != ATA_BIO_READ && op != ATA_BIO_WRITE) || offset >= PAGE_SIZE ||
+     offset % ATA_SECTOR_SIZE)
+    return -EINVAL;
+
+  ata_drive_t *d = &drives[drive];
+  if(!d->present || d->atapi)
+    return -ENODEV;
+  if(lba + count > d->sectors)
+    return -EINVAL;
+
+  if(!cache_init_once())
+    return -ENOMEM;
+  cache_reap();
+  i64 ret = cache_bypass(drive, lba, count, op == ATA_BIO_WRITE);
+  if(ret < 0)
+    return ret;
+
+  ata_bio_t *bio = kmalloc(DIRECT_BIOS * sizeof(*bio));
+  if(!bio)
+    return -ENOMEM;
+
+  u64 done = 0;      /* sectors queued */
+  u64 pos  = offset; /* byte position in the pages */
+  while(done < count && ret == 0) {
+    u32 nbio = 0;
+    for(; nbio < DIRECT_BIOS && done < count; nbio++) {
+      ata_bio_t *b = &bio[nbio];
+      kzero(b, sizeof(*b));
+      b->lba   = lba + done;
+      b->drive = drive;
+      b->op    = op;
+
+      /* One segment per page, up to the request limits. */
+      while(done < count && b->nseg < ATA_BIO_MAX_SEGS &&
+            b->count < ATA_BIO_MAX_SECTORS) {
+        u64 in = pos % PAGE_SIZE;
+        u64 n  = (PAGE_SIZE - in) / ATA_SECTOR_SIZE;
+        if(n > ATA_BIO_MAX_SECTORS - b->count)
+          n = ATA_BIO_MAX_SECTORS - b->count;
+        if(n > count - done)
+          n = count - done;
+        b->seg[b->nseg].buf   = (u8 *)phys_to_virt(pages[pos / PAGE_SIZE]) + in;
+        b->seg[b->nseg].bytes = (u32)n * ATA_SECTOR_SIZE;
+        b->nseg++;
+        b->count += (u32)n;
+        done     += n;
+        pos      += n * ATA_SECTOR_SIZE;
+      }
+
+      i64 r = ata_submit(b);
+      if(r < 0) {
+        ret = r;
+        break;
+      }
+    }
+    for(u32 k = 0; k < nbio; k++) {
+      i64 r = ata_wait(&bio[k]);
+      if(r < 0 && ret == 0)
+        ret = r;
+    }
+  }
+  kfree(bio);
+
+  /* Readers may have cached the old contents while the write ran. */
+  if(op == ATA_BIO_WRITE) {
+    i64 r = cache_bypass(drive, lba, count, true);
+    if(ret == 0)
+      ret = r;
+  }
+  return ret;
+}
+
+i64 ata_sync(u8 drive)
+{
+  if(drive >= 4)
+    return -EINVAL;
+  ata_drive_t *d = &drives[drive];
+  if(!d->present || d->atapi)
+    return -ENODEV;
+
   cache_init_once();
-  cache_invalidate_range(drive, lba, count);
+  i64 ret = cache_flush_all(drive);
+
+  ata_bio_t bio;
+  kzero(&bio, sizeof(bio));
+  bio.drive = drive;
+  bio.op    = ATA_BIO_FLUSH;
+  i64 r     = bio_sync(&bio);
+  return ret < 0 ? ret : r;
+}
 
-  if(d->dma && d->channel->dma_ok && proc_current() && count <= DMA_MAX_SECTORS)
-    return dma_transfer(d, lba, count, (void *)buf, true);
+void ata_flush_expired(void)
+{
+  cache_reap();
+  if(!g_cache_stats.dirty ||
+     pit_get_ticks() - g_dirty_since < CACHE_FLUSH_TICKS)
+    return;
 
-  return pio_write(d, lba, count, buf);
+  for(i16 i = 0; i < (i16)g_cache_entries; i++) {
+    const ata_cache_entry_t *e = &g_ata_cache[i];
+    if(!e->dirty || e->io || !queue_ok(&drives[e->drive]))
+      continue;
+
+    cache_io_t *io = cache_io_get();
+    if(!io)
+      break;
+    io->n = (u8)cache_dirty_run(i, true, &io->bio, io->slot, io->gen);
+    for(u32 k = 0; k < io->n; k++)
+      g_ata_cache[io->slot[k]].io = (u8)(io - g_cache_io) + 1;
+    if(ata_submit(&io->bio) < 0) {
+      for(u32 k = 0; k < io->n; k++)
+        g_ata_cache[io->slot[k]].io = 0;
+      io->busy = false;
+      break;
+    }
+    g_cache_stats.write_cmds++;
+  }
+  g_dirty_since = pit_get_ticks();
 }
 
 /**
@@ -659,6 +1788,7 @@ void ata_irq(u8 channel)
 
   ata_channel_t *ch = &channels[channel];
 
+  spin_lock(&ch->lock);
   ch->status = reg_read(ch, ATA_REG_STATUS);
   ch->error  = (ch->status & ATA_SR_ERR) ? reg_read(ch, ATA_REG_ERROR) : 0;
 
@@ -667,27 +1797,34 @@ void ata_irq(u8 channel)
     outb(ch->bmi + BMI_STATUS, BMI_STATUS_IRQ | BMI_STATUS_ERR);
   }
 
+  if(ch->active) {
+    bool err = (ch->status & (ATA_SR_ERR | ATA_SR_DF)) ||
+               (ch->dma_ok && (ch->bmi_status & BMI_STATUS_ERR));
+    i64        status = err ? -EIO : 0;
+    ata_bio_t *done   = bio_complete(ch, status);
+    spin_unlock(&ch->lock);
+    bio_end_all(done, status);
+    return;
+  }
+
   ch->state = ATA_STATE_IDLE;
+  spin_unlock(&ch->lock);
 
-  if(ch->waiter) {
-    if(ch->waiter->state == PROC_STATE_BLOCKED)
-      ch->waiter->state = PROC_STATE_READY;
-    ch->waiter = NULL;
-  }
+  wait_wake_all(&ch->irq_wq);
 }
 
 /** @brief Detect and configure PCI IDE Bus Master for DMA. */
 static void init_dma(void)
 {
-  pci_device_t ide;
-  if(!pci_find_device(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &ide)) {
+  const pci_device_t *ide = pci_find(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE);
+  if(!ide) {
     console_print("[ATA] No IDE controller found, DMA disabled\n");
     return;
   }
 
-  pci_enable_bus_master(&ide);
+  pci_enable_bus_master(ide);
 
-  u16 bar4 = ide.bar[4] & 0xFFFC;
+  u16 bar4 = ide->bar[4] & 0xFFFC;
   if(bar4 == 0) {
     console_print("[ATA] BAR4 invalid, DMA disabled\n");
     return;
@@ -718,6 +1855,30 @@ static void init_dma(void)
   console_print("[ATA] DMA enabled\n");
 }
 
+/**
+ * @brief Give the disks of another host controller free drive slots.
+ * @param count  Disks the controller found.
+ * @param attach Fills a drive descriptor for one of them.
+ * @param name   Controller name for the log.
+ */
+static void attach_disks(
+    u32 count, bool (*attach)(u32, ata_drive_t *), const char *name
+)
+{
+  for(u32 n = 0, i = 0; n < count; n++) {
+    while(i < 4 && drives[i].present)
+      i++;
+    if(i == 4)
+      return;
+    if(!attach(n, &drives[i]))
+      continue;
+    console_printf(
+        "[ATA] Drive %d: %s (%d MB, %s)\n", (int)i, drives[i].model,
+        (u32)(drives[i].sectors / 2048), name
+    );
+  }
+}
+
 /** @brief Initialize the ATA subsystem (channels, drives, IRQs, DMA). */
 void ata_init(void)
 {
@@ -732,12 +1893,21 @@ void ata_init(void)
      .irq   = IRQ_ATA_SECONDARY,
      .state = ATA_STATE_IDLE};
 
+  for(int i = 0; i < 2; i++) {
+    spin_init(&channels[i].lock, "ata-channel", LOCK_CLASS_ATA);
+    mutex_init(&channels[i].pio, "ata-pio");
+  }
+
   for(int i = 0; i < 4; i++) {
     drives[i].channel = &channels[i / 2];
     drives[i].slave   = i % 2;
   }
 
   for(int i = 0; i < 4; i++) {
+    /* A slave needs a master on its cable, so an empty master saves the
+     * slave's IDENTIFY timeouts. */
+    if(drives[i].slave && !drives[i - 1].present)
+      continue;
     identify(&drives[i]);
     if(drives[i].present && !drives[i].atapi) {
       u32 mb = (u32)(drives[i].sectors / 2048);
@@ -758,6 +1928,11 @@ void ata_init(void)
   pic_unmask(IRQ_ATA_SECONDARY);
 
   init_dma();
+
+  /* Virtio and AHCI disks take the drive slots legacy IDE left empty. */
+  attach_disks(virtio_blk_init(), virtio_blk_attach, "virtio");
+  attach_disks(ahci_init(), ahci_attach, "AHCI");
+
   console_print("[ATA] Ready\n");
 }
 
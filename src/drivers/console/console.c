@@ -10,11 +10,14 @@
  *
  * Reached from kernel boot prints (main.c, sched, mm, ...) and from
  * @c sys_write whenever a process writes to stdout/stderr without an OFT
- * entry — which after the shell takes over is essentially never.
+ * entry — which after the shell takes over is essentially never. Every
+ * character is copied to COM1 as well, so the boot log of a headless VM
+ * can be captured.
  */
 
 #include "font.h"
 #include <alcor2/drivers/console.h>
+#include <alcor2/drivers/serial.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/types.h>
 #include <stdarg.h>
@@ -31,6 +34,9 @@ static struct
   u8           bytes_pp;
   u32          fg;
   u32          bg;
+  /** Eight pixels of fg / bg in framebuffer layout, for font_row_put(). */
+  u64          fg_pat[FONT_ROW_WORDS_MAX];
+  u64          bg_pat[FONT_ROW_WORDS_MAX];
   u32          cursor_x;
   u32          cursor_y;
 } ctx;
@@ -76,6 +82,24 @@ static void fb_put_pixel(u32 x, u32 y, u32 color)
   }
 }
 
+/** @brief Pack @p color the way fb_put_pixel() stores it. */
+static u32 native_color(u32 color)
+{
+  if(ctx.bytes_pp != 2)
+    return color;
+  u32 r = (color >> 16) & 0xffu;
+  u32 g = (color >> 8) & 0xffu;
+  u32 b = color & 0xffu;
+  return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+
+/** @brief Rebuild the row patterns after a colour change. */
+static void update_patterns(void)
+{
+  font_rows_pattern(ctx.fg_pat, native_color(ctx.fg), ctx.bytes_pp);
+  font_rows_pattern(ctx.bg_pat, native_color(ctx.bg), ctx.bytes_pp);
+}
+
 /** @brief Translate bits-per-pixel to bytes-per-pixel, clamped to [2, 4]. */
 static u8 bytes_pp_from_bpp(u16 bpp)
 {
@@ -106,12 +130,20 @@ void console_init(void *fb, u64 width, u64 height, u64 pitch_bytes, u16 bpp)
   ctx.cursor_y    = 0;
   ctx.fg          = 0xFFFFFFFF;
   ctx.bg          = 0xFF000000;
+  font_rows_init(ctx.bytes_pp);
+  update_patterns();
+}
+
+void console_set_framebuffer(void *fb)
+{
+  ctx.base = (volatile u8 *)fb;
 }
 
 void console_set_theme(console_theme_t theme)
 {
   ctx.fg = theme.foreground | 0xFF000000u;
   ctx.bg = theme.background | 0xFF000000u;
+  update_patterns();
 }
 
 /** @brief Fill rows [y0, y1) with @c ctx.bg, fast-path on 32 bpp. */
@@ -132,9 +164,15 @@ static void fb_clear_rectangle(u64 y0, u64 y1)
     }
     return;
   }
-  for(u64 y = y0; y < y1; y++)
-    for(u32 x = 0; x < (u32)ctx.width; x++)
+  /* Other depths: eight pixels per run of 64-bit stores, then the tail. */
+  u32 runs = (u32)ctx.width / FONT_W;
+  for(u64 y = y0; y < y1; y++) {
+    u8 *p = (u8 *)ctx.base + y * ctx.pitch_bytes;
+    for(u32 i = 0; i < runs; i++, p += FONT_W * ctx.bytes_pp)
+      font_row_put(p, 0, ctx.fg_pat, ctx.bg_pat, ctx.bytes_pp);
+    for(u32 x = runs * FONT_W; x < (u32)ctx.width; x++)
       fb_put_pixel(x, (u32)y, ctx.bg);
+  }
 }
 
 void console_clear(void)
@@ -158,6 +196,14 @@ static void draw_glyph(char c, u32 px, u32 py)
     return;
 
   const u8 *glyph = font_latin1[gi];
+  if((u64)px + FONT_W <= ctx.width && (u64)py + FONT_H <= ctx.height) {
+    u8 *p = (u8 *)ctx.base + (u64)py * ctx.pitch_bytes + (u64)px * ctx.bytes_pp;
+    for(int row = 0; row < FONT_H; row++, p += ctx.pitch_bytes)
+      font_row_put(p, glyph[row], ctx.fg_pat, ctx.bg_pat, ctx.bytes_pp);
+    return;
+  }
+
+  /* Clipped at the screen edge: pixel by pixel. */
   for(int row = 0; row < FONT_H; row++) {
     u8 bits = glyph[row];
     for(int col = 0; col < FONT_W; col++) {
@@ -198,6 +244,7 @@ static void scroll(void)
 
 void console_putchar(char c)
 {
+  serial_putchar(c);
   switch(c) {
   case '\n':
     ctx.cursor_x = 0;
@@ -212,11 +259,7 @@ void console_putchar(char c)
   case '\b':
     if(ctx.cursor_x >= FONT_W) {
       ctx.cursor_x -= FONT_W;
-      for(int row = 0; row < FONT_H; row++)
-        for(int col = 0; col < FONT_W; col++)
-          fb_put_pixel(
-              ctx.cursor_x + (u32)col, ctx.cursor_y + (u32)row, ctx.bg
-          );
+      draw_glyph(' ', ctx.cursor_x, ctx.cursor_y);
     }
     break;
   default:
@@ -4,4 +4,42 @@
 /** Monospace 8×16 framebuffer font; see font_bitmap.h. */
 #include "font_bitmap.h"
 
+/**
+ * @brief Words in one expanded glyph row: 8 pixels of 2-4 bytes each span
+ *        2-4 u64, so a row is written with as many 64-bit stores.
+ */
+#define FONT_ROW_WORDS_MAX 4u
+
+typedef u64 __attribute__((may_alias, aligned(1))) font_word_t;
+
+/**
+ * @brief Row masks for the current pixel size: word @c i of entry @c b has
+ *        every byte of pixel @c k set where bit @c 7-k of @c b is set.
+ */
+extern u64 font_row_mask[256][FONT_ROW_WORDS_MAX];
+
+/** @brief Build ::font_row_mask for @p bytes_pp (2-4); cheap if unchanged. */
+void font_rows_init(u8 bytes_pp);
+
+/**
+ * @brief Replicate the native pixel value @p native eight times into
+ *        @p pat, the colour operand of ::font_row_put.
+ */
+void font_rows_pattern(u64 pat[FONT_ROW_WORDS_MAX], u32 native, u8 bytes_pp);
+
+/**
+ * @brief Write the eight pixels of glyph row @p bits at @p dst, taking
+ *        @p fg where a bit is set and @p bg elsewhere. @p words is the
+ *        framebuffer's bytes per pixel.
+ */
+static inline void font_row_put(
+    void *dst, u8 bits, const u64 *fg, const u64 *bg, u32 words
+)
+{
+  font_word_t *d = dst;
+  const u64   *m = font_row_mask[bits];
+  for(u32 i = 0; i < words; i++)
+    d[i] = (fg[i] & m[i]) | (bg[i] & ~m[i]);
+}
+
 #endif
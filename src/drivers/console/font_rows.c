@@ -0,0 +1,41 @@
+/**
+ * @file src/drivers/console/font_rows.c
+ * @brief Bitmap font rows pre-expanded to pixel masks.
+ *
+ * A glyph row is one byte, one bit per pixel. Testing the bits one pixel at
+ * a time costs a branch and a narrow store per pixel; instead each of the
+ * 256 possible rows is expanded once into a mask in framebuffer layout, and
+ * a row is drawn as a few 64-bit select-and-store operations. The table
+ * depends only on the pixel size, which both consoles share.
+ */
+
+#include "font.h"
+#include <alcor2/kstdlib.h>
+
+u64 font_row_mask[256][FONT_ROW_WORDS_MAX];
+
+static u8 mask_bytes_pp;
+
+void font_rows_init(u8 bytes_pp)
+{
+  if(bytes_pp == mask_bytes_pp)
+    return;
+  for(u32 b = 0; b < 256; b++) {
+    u8 row[FONT_ROW_WORDS_MAX * 8] = {0};
+    for(u32 k = 0; k < 8; k++)
+      if(b & (0x80u >> k))
+        for(u32 j = 0; j < bytes_pp; j++)
+          row[k * bytes_pp + j] = 0xff;
+    kmemcpy(font_row_mask[b], row, sizeof(row));
+  }
+  mask_bytes_pp = bytes_pp;
+}
+
+void font_rows_pattern(u64 pat[FONT_ROW_WORDS_MAX], u32 native, u8 bytes_pp)
+{
+  u8 row[FONT_ROW_WORDS_MAX * 8] = {0};
+  for(u32 k = 0; k < 8; k++)
+    for(u32 j = 0; j < bytes_pp; j++)
+      row[k * bytes_pp + j] = (u8)(native >> (8 * j));
+  kmemcpy(pat, row, sizeof(row));
+}
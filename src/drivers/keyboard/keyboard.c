@@ -3,10 +3,10 @@
  * @brief PS/2 keyboard driver with scancode translation.
  */
 
-#include <alcor2/arch/cpu.h>
 #include <alcor2/arch/io.h>
 #include <alcor2/arch/pic.h>
 #include <alcor2/drivers/keyboard.h>
+#include <alcor2/proc/wait.h>
 
 #define KB_DATA_PORT   0x60
 #define KB_CMD_PORT    0x64
@@ -18,6 +18,10 @@ static volatile u32 kb_write_pos = 0;
 /** @brief Raw scancodes dropped because the ring buffer was full (burst input).
  */
 static u32  kb_drop_count = 0;
+/** @brief Readers in keyboard_wait() and pollers of stdin. */
+static wait_queue_t kb_waiters;
+/** @brief Consumer of the ring, run from keyboard_irq(). */
+static keyboard_bh_t kb_bottom_half;
 
 static void kb_push(u8 b)
 {
@@ -42,33 +46,33 @@ bool keyboard_raw_available(void)
 
 u8 keyboard_raw_pop(void)
 {
-  cpu_disable_interrupts();
   u8 b        = kb_buffer[kb_read_pos];
   kb_read_pos = (kb_read_pos + 1) % KB_BUFFER_SIZE;
-  cpu_enable_interrupts();
   return b;
 }
 
-u32 keyboard_raw_peek(u8 *dst, u32 cap)
+void keyboard_set_bottom_half(keyboard_bh_t bh)
 {
-  if(!dst || cap == 0)
-    return 0;
-  cpu_disable_interrupts();
-  u32 rp = kb_read_pos;
-  u32 wp = kb_write_pos;
-  u32 n  = (wp + KB_BUFFER_SIZE - rp) % KB_BUFFER_SIZE;
-  if(n > cap)
-    n = cap;
-  for(u32 i = 0; i < n; i++)
-    dst[i] = kb_buffer[(rp + i) % KB_BUFFER_SIZE];
-  cpu_enable_interrupts();
-  return n;
+  kb_bottom_half = bh;
 }
 
 void keyboard_irq(void)
 {
   u8 scancode = inb(KB_DATA_PORT);
   kb_push(scancode);
+  if(kb_bottom_half)
+    kb_bottom_half();
+  wait_wake_all(&kb_waiters);
+}
+
+i64 keyboard_wait(void)
+{
+  return wait_sleep(&kb_waiters, 0, 0);
+}
+
+void keyboard_poll_wait(poll_table_t *pt)
+{
+  poll_wait(pt, &kb_waiters);
 }
 
 void keyboard_init(void)
@@ -2,13 +2,78 @@
  * @file pci.c
  * @brief PCI bus driver.
  *
- * Provides configuration space access via I/O ports 0xCF8/0xCFC.
- * Enumerates devices on buses 0-255, slots 0-31, functions 0-7.
+ * Configuration space is reached through the PCIe ECAM window the ACPI
+ * MCFG table describes, one memory access per register, falling back to
+ * I/O ports 0xCF8/0xCFC (two port accesses per dword) without it. Devices
+ * are enumerated once, at pci_init() or the first lookup, by walking the
+ * bus tree from bus 0 through the PCI-to-PCI bridges rather than probing
+ * all 256 buses. The inventory keeps each function's descriptor and
+ * capability offsets, so lookups never touch config space.
+ *
+ * MSI and MSI-X messages are aimed at the local APIC of the CPU that
+ * programs them, the boot CPU for every driver set up at boot; their
+ * handlers take the kernel lock on whichever CPU they land.
  */
 
+#include <alcor2/arch/acpi.h>
 #include <alcor2/arch/io.h>
+#include <alcor2/arch/lapic.h>
 #include <alcor2/drivers/console.h>
 #include <alcor2/drivers/pci.h>
+#include <alcor2/mm/vmm.h>
+
+/** @brief Functions the inventory holds at most. */
+#define PCI_MAX_FUNCS 64
+
+#define PCI_HEADER_MULTI  0x80
+#define PCI_HEADER_BRIDGE 0x01
+#define PCI_SECONDARY_BUS 0x19
+
+/** @brief ECAM bytes per bus: 32 slots of 8 functions of 4 KiB. */
+#define PCI_ECAM_BUS_SIZE (1ULL << 20)
+
+/** @brief MCFG table: the header and 8 reserved bytes, then allocations. */
+typedef struct PACKED
+{
+  acpi_header_t hdr;
+  u64           reserved;
+} pci_mcfg_t;
+
+/** @brief One MCFG allocation: the ECAM window of a range of buses. */
+typedef struct PACKED
+{
+  u64 base; /**< Address of bus 0's configuration space. */
+  u16 segment;
+  u8  start_bus;
+  u8  end_bus;
+  u32 reserved;
+} pci_mcfg_alloc_t;
+
+static pci_device_t pci_devs[PCI_MAX_FUNCS];
+static u32          pci_ndevs;
+static bool         pci_scanned;
+
+static u64          ecam_base; /* 0: use the ports */
+static u8           ecam_start, ecam_end;
+static volatile u8 *ecam_bus[256]; /* mapped on first use */
+
+/* ECAM address of a config register, or NULL to go through the ports. */
+static volatile u8 *pci_ecam(u8 bus, u8 slot, u8 func, u8 offset)
+{
+  if(!ecam_base || bus < ecam_start || bus > ecam_end)
+    return NULL;
+  if(!ecam_bus[bus]) {
+    ecam_bus[bus] = vmm_map_mmio(
+        ecam_base + (u64)bus * PCI_ECAM_BUS_SIZE, PCI_ECAM_BUS_SIZE
+    );
+    /* The MMIO window is full: fall back to the ports for good. */
+    if(!ecam_bus[bus]) {
+      ecam_base = 0;
+      return NULL;
+    }
+  }
+  return ecam_bus[bus] + ((u32)slot << 15 | (u32)func << 12 | offset);
+}
 
 /* Build PCI config address dword. */
 static inline u32 pci_addr(u8 bus, u8 slot, u8 func, u8 offset)
@@ -27,6 +92,9 @@ static inline u32 pci_addr(u8 bus, u8 slot, u8 func, u8 offset)
  */
 u32 pci_read32(u8 bus, u8 slot, u8 func, u8 offset)
 {
+  volatile u8 *r = pci_ecam(bus, slot, func, offset & 0xFC);
+  if(r)
+    return *(volatile u32 *)r;
   outl(PCI_CONFIG_ADDR, pci_addr(bus, slot, func, offset));
   return inl(PCI_CONFIG_DATA);
 }
@@ -41,6 +109,9 @@ u32 pci_read32(u8 bus, u8 slot, u8 func, u8 offset)
  */
 u16 pci_read16(u8 bus, u8 slot, u8 func, u8 offset)
 {
+  volatile u8 *r = pci_ecam(bus, slot, func, offset & 0xFE);
+  if(r)
+    return *(volatile u16 *)r;
   u32 val = pci_read32(bus, slot, func, offset);
   return (val >> ((offset & 2) * 8)) & 0xFFFF;
 }
@@ -55,6 +126,9 @@ u16 pci_read16(u8 bus, u8 slot, u8 func, u8 offset)
  */
 u8 pci_read8(u8 bus, u8 slot, u8 func, u8 offset)
 {
+  volatile u8 *r = pci_ecam(bus, slot, func, offset);
+  if(r)
+    return *r;
   u32 val = pci_read32(bus, slot, func, offset);
   return (val >> ((offset & 3) * 8)) & 0xFF;
 }
@@ -69,12 +143,18 @@ u8 pci_read8(u8 bus, u8 slot, u8 func, u8 offset)
  */
 void pci_write32(u8 bus, u8 slot, u8 func, u8 offset, u32 val)
 {
+  volatile u8 *r = pci_ecam(bus, slot, func, offset & 0xFC);
+  if(r) {
+    *(volatile u32 *)r = val;
+    return;
+  }
   outl(PCI_CONFIG_ADDR, pci_addr(bus, slot, func, offset));
   outl(PCI_CONFIG_DATA, val);
 }
 
 /**
- * @brief Write 16-bit value to PCI config space (read-modify-write).
+ * @brief Write 16-bit value to PCI config space (read-modify-write
+ *        through the ports).
  * @param bus  Bus number.
  * @param slot Device slot.
  * @param func Function number.
@@ -83,6 +163,11 @@ void pci_write32(u8 bus, u8 slot, u8 func, u8 offset, u32 val)
  */
 void pci_write16(u8 bus, u8 slot, u8 func, u8 offset, u16 val)
 {
+  volatile u8 *r = pci_ecam(bus, slot, func, offset & 0xFE);
+  if(r) {
+    *(volatile u16 *)r = val;
+    return;
+  }
   u32 old     = pci_read32(bus, slot, func, offset);
   int shift   = (offset & 2) * 8;
   u32 mask    = 0xFFFF << shift;
@@ -111,6 +196,109 @@ static void pci_read_device(u8 bus, u8 slot, u8 func, pci_device_t *dev)
 
   for(int i = 0; i < 6; i++)
     dev->bar[i] = pci_read32(bus, slot, func, PCI_BAR0 + i * 4);
+
+  dev->cap_msi  = pci_find_capability(dev, PCI_CAP_MSI, 0);
+  dev->cap_msix = pci_find_capability(dev, PCI_CAP_MSIX, 0);
+}
+
+static void pci_scan_bus(u8 bus, int depth);
+
+/* Record one function and descend if it is a PCI-to-PCI bridge. */
+static void pci_scan_func(u8 bus, u8 slot, u8 func, int depth)
+{
+  if(pci_ndevs < PCI_MAX_FUNCS)
+    pci_read_device(bus, slot, func, &pci_devs[pci_ndevs++]);
+
+  u8 header = pci_read8(bus, slot, func, PCI_HEADER_TYPE);
+  if((header & 0x7F) == PCI_HEADER_BRIDGE) {
+    u8 secondary = pci_read8(bus, slot, func, PCI_SECONDARY_BUS);
+    if(secondary > bus)
+      pci_scan_bus(secondary, depth + 1);
+  }
+}
+
+/* Scan the 32 slots of @p bus; @p depth bounds a bad bridge setup. */
+static void pci_scan_bus(u8 bus, int depth)
+{
+  if(depth > 8)
+    return;
+  for(u8 slot = 0; slot < 32; slot++) {
+    if(pci_read16(bus, slot, 0, PCI_VENDOR_ID) == 0xFFFF)
+      continue;
+    u8 funcs =
+        pci_read8(bus, slot, 0, PCI_HEADER_TYPE) & PCI_HEADER_MULTI ? 8 : 1;
+    for(u8 func = 0; func < funcs; func++) {
+      if(pci_read16(bus, slot, func, PCI_VENDOR_ID) != 0xFFFF)
+        pci_scan_func(bus, slot, func, depth);
+    }
+  }
+}
+
+/*
+ * Enumerate once. A multi-function host bridge at 0:0.0 means one host
+ * controller per function, each owning the bus of that number.
+ */
+static void pci_enumerate(void)
+{
+  if(pci_scanned)
+    return;
+  pci_scanned = true;
+  if(!(pci_read8(0, 0, 0, PCI_HEADER_TYPE) & PCI_HEADER_MULTI)) {
+    pci_scan_bus(0, 0);
+    return;
+  }
+  for(u8 func = 0; func < 8; func++) {
+    if(pci_read16(0, 0, func, PCI_VENDOR_ID) != 0xFFFF)
+      pci_scan_bus(func, 0);
+  }
+}
+
+/* Take segment 0's ECAM window from the MCFG table, if there is one. */
+static void pci_find_ecam(void)
+{
+  const pci_mcfg_t *mcfg = (const pci_mcfg_t *)acpi_find_table("MCFG");
+  if(!mcfg || mcfg->hdr.length < sizeof(*mcfg))
+    return;
+  const pci_mcfg_alloc_t *a = (const pci_mcfg_alloc_t *)(mcfg + 1);
+  u32 n = (mcfg->hdr.length - (u32)sizeof(*mcfg)) / sizeof(*a);
+  for(u32 i = 0; i < n; i++) {
+    if(a[i].segment == 0 && a[i].base && a[i].start_bus <= a[i].end_bus) {
+      ecam_base  = a[i].base;
+      ecam_start = a[i].start_bus;
+      ecam_end   = a[i].end_bus;
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Choose the config access method and build the inventory.
+ */
+void pci_init(void)
+{
+  pci_find_ecam();
+  pci_enumerate();
+  console_printf(
+      "[PCI] %u functions, config space via %s\n", pci_ndevs,
+      ecam_base ? "ECAM" : "ports"
+  );
+}
+
+/**
+ * @brief First inventory entry with the given class and subclass.
+ * @param class_code PCI class code.
+ * @param subclass   PCI subclass code.
+ * @return The entry, or NULL if there is none.
+ */
+const pci_device_t *pci_find(u8 class_code, u8 subclass)
+{
+  pci_enumerate();
+  for(u32 i = 0; i < pci_ndevs; i++) {
+    if(pci_devs[i].class_code == class_code &&
+       pci_devs[i].subclass == subclass)
+      return &pci_devs[i];
+  }
+  return NULL;
 }
 
 /**
@@ -122,32 +310,73 @@ static void pci_read_device(u8 bus, u8 slot, u8 func, pci_device_t *dev)
  */
 bool pci_find_device(u8 class_code, u8 subclass, pci_device_t *dev)
 {
-  for(u16 bus = 0; bus < 256; bus++) {
-    for(u8 slot = 0; slot < 32; slot++) {
-      for(u8 func = 0; func < 8; func++) {
-        u16 vendor = pci_read16(bus, slot, func, PCI_VENDOR_ID);
-        if(vendor == 0xFFFF)
-          continue;
-
-        u8 cls = pci_read8(bus, slot, func, PCI_CLASS);
-        u8 sub = pci_read8(bus, slot, func, PCI_SUBCLASS);
-
-        if(cls == class_code && sub == subclass) {
-          pci_read_device(bus, slot, func, dev);
-          return true;
-        }
-
-        if(func == 0) {
-          u8 header = pci_read8(bus, slot, func, PCI_HEADER_TYPE);
-          if(!(header & 0x80))
-            break;
-        }
-      }
+  const pci_device_t *d = pci_find(class_code, subclass);
+  if(!d)
+    return false;
+  *dev = *d;
+  return true;
+}
+
+/**
+ * @brief Find first PCI device with the given vendor and device IDs.
+ * @param vendor    Vendor ID.
+ * @param device_id Device ID.
+ * @param dev       Output device descriptor (filled if found).
+ * @return true if found.
+ */
+bool pci_find_id(u16 vendor, u16 device_id, pci_device_t *dev)
+{
+  pci_enumerate();
+  for(u32 i = 0; i < pci_ndevs; i++) {
+    if(pci_devs[i].vendor_id == vendor &&
+       pci_devs[i].device_id == device_id) {
+      *dev = pci_devs[i];
+      return true;
     }
   }
   return false;
 }
 
+/**
+ * @brief Walk a device's capability list.
+ * @param dev    Device.
+ * @param cap_id Capability ID to look for.
+ * @param after  Config offset of the previous match, or 0 to start.
+ * @return Config offset of the next matching capability, or 0 if none.
+ */
+u8 pci_find_capability(const pci_device_t *dev, u8 cap_id, u8 after)
+{
+  u16 status = pci_read16(dev->bus, dev->slot, dev->func, PCI_STATUS);
+  if(!(status & PCI_STATUS_CAP_LIST))
+    return 0;
+
+  u8 off = after ? pci_read8(dev->bus, dev->slot, dev->func, after + 1)
+                 : pci_read8(dev->bus, dev->slot, dev->func, PCI_CAP_PTR);
+  for(int guard = 0; off >= 0x40 && guard < 48; guard++) {
+    off &= 0xFC;
+    if(pci_read8(dev->bus, dev->slot, dev->func, off) == cap_id)
+      return off;
+    off = pci_read8(dev->bus, dev->slot, dev->func, off + 1);
+  }
+  return 0;
+}
+
+/**
+ * @brief Physical base address of a memory BAR (32- or 64-bit).
+ * @param dev Device.
+ * @param bar BAR index (0-5).
+ * @return Base address, or 0 for an I/O or unset BAR.
+ */
+u64 pci_bar_address(const pci_device_t *dev, u8 bar)
+{
+  if(bar >= 6 || (dev->bar[bar] & PCI_BAR_IO))
+    return 0;
+  u64 base = dev->bar[bar] & ~0xFULL;
+  if((dev->bar[bar] & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64 && bar < 5)
+    base |= (u64)dev->bar[bar + 1] << 32;
+  return base;
+}
+
 /**
  * @brief Enable I/O, memory, and bus master for a PCI device.
  * @param dev Device to configure.
@@ -158,3 +387,128 @@ void pci_enable_bus_master(const pci_device_t *dev)
   cmd |= PCI_CMD_IO | PCI_CMD_MEMORY | PCI_CMD_MASTER;
   pci_write16(dev->bus, dev->slot, dev->func, PCI_COMMAND, cmd);
 }
+
+/* Set or clear the command register's INTx disable bit. */
+static void pci_intx_enable(const pci_device_t *dev, bool on)
+{
+  u16 cmd = pci_read16(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+  if(on)
+    cmd &= (u16)~PCI_CMD_INTX_OFF;
+  else
+    cmd |= PCI_CMD_INTX_OFF;
+  pci_write16(dev->bus, dev->slot, dev->func, PCI_COMMAND, cmd);
+}
+
+/* Message address that reaches the calling CPU's local APIC. */
+static u32 pci_msi_address(void)
+{
+  return PCI_MSI_ADDR_BASE | lapic_id() << 12;
+}
+
+/**
+ * @brief Program and enable one MSI message.
+ * @param dev    Device.
+ * @param vector IDT vector the message raises.
+ * @return false if the device has no MSI capability.
+ */
+bool pci_enable_msi(const pci_device_t *dev, u8 vector)
+{
+  u8 cap = dev->cap_msi;
+  if(!cap || !vector)
+    return false;
+
+  u16 ctl  = pci_read16(dev->bus, dev->slot, dev->func, cap + PCI_MSI_CTRL);
+  u8  data = cap + (ctl & PCI_MSI_64BIT ? 0x0C : 0x08);
+  pci_write32(
+      dev->bus, dev->slot, dev->func, cap + PCI_MSI_ADDR, pci_msi_address()
+  );
+  if(ctl & PCI_MSI_64BIT)
+    pci_write32(dev->bus, dev->slot, dev->func, cap + PCI_MSI_ADDR + 4, 0);
+  pci_write16(dev->bus, dev->slot, dev->func, data, vector);
+  /* The mask bits follow the data word. */
+  if(ctl & PCI_MSI_MASKABLE)
+    pci_write32(dev->bus, dev->slot, dev->func, data + 4, 0);
+
+  ctl = (u16)((ctl & ~PCI_MSI_MME_MASK) | PCI_MSI_ENABLE);
+  pci_write16(dev->bus, dev->slot, dev->func, cap + PCI_MSI_CTRL, ctl);
+  pci_intx_enable(dev, false);
+  return true;
+}
+
+/**
+ * @brief MSI-X table entries of a device.
+ * @param dev Device.
+ * @return Entries, or 0 without an MSI-X capability.
+ */
+u32 pci_msix_count(const pci_device_t *dev)
+{
+  u8 cap = dev->cap_msix;
+  if(!cap)
+    return 0;
+  u16 ctl = pci_read16(dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL);
+  return (ctl & PCI_MSIX_SIZE_MASK) + 1U;
+}
+
+/**
+ * @brief Program MSI-X entries 0 .. @p n - 1 and enable MSI-X.
+ * @param dev     Device.
+ * @param vectors IDT vector of each entry.
+ * @param n       Entries to program.
+ * @return false without MSI-X, or if the table cannot be mapped.
+ */
+bool pci_enable_msix(const pci_device_t *dev, const u8 *vectors, u32 n)
+{
+  u8 cap = dev->cap_msix;
+  if(!cap || !n)
+    return false;
+  u16 ctl = pci_read16(dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL);
+  if(n > (ctl & PCI_MSIX_SIZE_MASK) + 1U)
+    return false;
+
+  u32 table = pci_read32(dev->bus, dev->slot, dev->func, cap + PCI_MSIX_TABLE);
+  u64 base  = pci_bar_address(dev, table & PCI_MSIX_BIR_MASK);
+  if(!base)
+    return false;
+  volatile u32 *t = vmm_map_mmio(
+      base + (table & ~PCI_MSIX_BIR_MASK), (u64)n * PCI_MSIX_ENTRY_SIZE
+  );
+  if(!t)
+    return false;
+
+  /* Hold every vector masked while the table is written. */
+  pci_write16(
+      dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL,
+      ctl | PCI_MSIX_ENABLE | PCI_MSIX_FUNC_MASK
+  );
+  u32 addr = pci_msi_address();
+  for(u32 i = 0; i < n; i++) {
+    volatile u32 *e = t + i * (PCI_MSIX_ENTRY_SIZE / 4);
+    e[0]            = addr;
+    e[1]            = 0;
+    e[2]            = vectors[i];
+    e[3]            = 0; /* unmasked */
+  }
+  pci_write16(
+      dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL,
+      (u16)((ctl | PCI_MSIX_ENABLE) & ~PCI_MSIX_FUNC_MASK)
+  );
+  pci_intx_enable(dev, false);
+  return true;
+}
+
+/**
+ * @brief Disable MSI-X and re-enable INTx.
+ * @param dev Device.
+ */
+void pci_disable_msix(const pci_device_t *dev)
+{
+  u8 cap = dev->cap_msix;
+  if(!cap)
+    return;
+  u16 ctl = pci_read16(dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL);
+  pci_write16(
+      dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL,
+      (u16)(ctl & ~PCI_MSIX_ENABLE)
+  );
+  pci_intx_enable(dev, true);
+}
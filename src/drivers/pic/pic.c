@@ -86,3 +86,17 @@ void pic_unmask(u8 irq)
   if(irq >= 8)
     outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << 2));
 }
+
+/**
+ * @brief Mask an IRQ line on the PIC.
+ *
+ * The cascade line is left alone; other slave IRQs may still need it.
+ *
+ * @param irq IRQ number (0-15).
+ */
+void pic_mask(u8 irq)
+{
+  u16 port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+  u8  line = (irq < 8) ? irq : irq - 8;
+  outb(port, inb(port) | (1 << line));
+}
@@ -1,22 +1,73 @@
 /**
  * @file src/drivers/pit/pit.c
  * @brief 8253/8254 PIT timer driver.
+ *
+ * The PIT starts out periodic. Once the TSC clock is calibrated the tick
+ * goes one-shot: each interrupt programs the next one for the earlier of
+ * the next scheduler tick and the earliest kernel timer, so timers fire
+ * within microseconds of their deadline. The tick count is then derived
+ * from the clock rather than counted, so it stays right however few
+ * interrupts arrive. Where the CPU has a local APIC, its timer raises
+ * these interrupts instead of channel 0.
+ *
+ * While the CPU idles the tick is stopped: the next interrupt is armed for
+ * the earliest timer only, or PIT_IDLE_MAX_NS at most so that periodic
+ * work (disk timeouts) still runs now and then. While the kernel profiler
+ * is on, interrupts come at least at its sampling rate, idle or not.
+ *
+ * All of that is the BSP's. An AP's local APIC timer only ticks the
+ * process it runs, and is left unarmed while the AP idles.
  */
 
+#include <alcor2/arch/cpu.h>
 #include <alcor2/arch/io.h>
+#include <alcor2/arch/lapic.h>
+#include <alcor2/arch/pic.h>
 #include <alcor2/arch/pit.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/drivers/ata.h>
+#include <alcor2/drivers/console.h>
 #include <alcor2/drivers/fb_console.h>
+#include <alcor2/net/net.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/sys/kprof.h>
+#include <alcor2/time.h>
+#include <alcor2/timer.h>
 
 #define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
 #define PIT_CMD      0x43
 #define PIT_FREQ     1193182
 
+/* Port B: bit 0 gates channel 2, bit 1 drives the speaker, bit 5 reads
+ * channel 2's output. */
+#define PIT_PORT_B    0x61
+#define PIT_B_GATE2   0x01
+#define PIT_B_SPEAKER 0x02
+#define PIT_B_OUT2    0x20
+
+/** @brief TSC calibration window: 1/50 s. */
+#define PIT_CALIB_DIV 50
+
+/** @brief Shortest one-shot count (~10 us), so timers cannot storm IRQ0. */
+#define PIT_MIN_COUNT 12
+
+/** @brief Longest an idle CPU sleeps without an interrupt. */
+#define PIT_IDLE_MAX_NS (1000ULL * 1000 * 1000)
+
 /* Plain u64 load/store is atomic on x86_64 (single MOV). An i386 port would
  * need lock-prefixed 64-bit access or a seqcount for tear-free pit_get_ticks.
+ * In one-shot mode @c ticks is the last tick pit_tick() has handled.
  */
 static volatile u64 ticks           = 0;
 static bool         preempt_enabled = false;
+static u32          pit_hz          = 0;
+static bool         oneshot         = false;
+static bool         use_lapic       = false;
+static bool         idle            = false;
+static u64          tick_ns;      /**< Length of a tick (one-shot mode). */
+static u64          base_ns;      /**< Monotonic time at which ... */
+static u64          base_ticks;   /**< ... the tick count was this. */
 
 /**
  * @brief Initialize the PIT to generate timer interrupts.
@@ -29,12 +80,115 @@ static bool         preempt_enabled = false;
 void pit_init(u32 frequency)
 {
   u16 divisor = PIT_FREQ / frequency;
+  pit_hz      = frequency;
 
   outb(PIT_CMD, 0x36);
   outb(PIT_CHANNEL0, divisor & 0xFF);
   outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
 }
 
+u32 pit_get_hz(void)
+{
+  return pit_hz;
+}
+
+/**
+ * @brief Time @p read over a 20 ms one-shot of PIT channel 2.
+ *
+ * Channel 2 is not wired to an IRQ, so this polls its output bit and works
+ * with interrupts disabled. Channel 0 keeps running.
+ */
+u64 pit_measure_hz(u64 (*read)(void))
+{
+  u8 b = inb(PIT_PORT_B);
+  outb(PIT_PORT_B, (u8)((b & ~PIT_B_SPEAKER) | PIT_B_GATE2));
+
+  /* Mode 0: the output goes high once the count reaches zero. */
+  u16 count = PIT_FREQ / PIT_CALIB_DIV;
+  outb(PIT_CMD, 0xB0);
+  outb(PIT_CHANNEL2, count & 0xFF);
+  outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+
+  u64 start = read();
+  u64 spins = 0;
+  while(!(inb(PIT_PORT_B) & PIT_B_OUT2)) {
+    /* Each port read takes about a microsecond; give up after ~1 s. */
+    if(++spins > 1000000) {
+      outb(PIT_PORT_B, b);
+      return 0;
+    }
+  }
+  u64 counts = read() - start;
+
+  outb(PIT_PORT_B, b);
+  return counts * PIT_CALIB_DIV;
+}
+
+/** @brief Make channel 0 interrupt once, @p ns from now (mode 0). */
+static void pit_program(u64 ns)
+{
+  u64 count = ns * PIT_FREQ / NSEC_PER_SEC;
+  if(count < PIT_MIN_COUNT)
+    count = PIT_MIN_COUNT;
+  if(count > 0xFFFF)
+    count = 0xFFFF;
+
+  outb(PIT_CMD, 0x30);
+  outb(PIT_CHANNEL0, count & 0xFF);
+  outb(PIT_CHANNEL0, (count >> 8) & 0xFF);
+}
+
+/** @brief Tick count at monotonic time @p now (one-shot mode). */
+static u64 ticks_at(u64 now)
+{
+  return base_ticks + (now - base_ns) / tick_ns;
+}
+
+/**
+ * @brief Arm the next interrupt: the next tick unless idle, or @p timer
+ *        (earliest kernel timer, 0 if none) if that comes first.
+ */
+static void program_next(u64 timer)
+{
+  u64 now  = time_monotonic_ns();
+  u64 next = idle ? now + PIT_IDLE_MAX_NS
+                  : base_ns + (ticks_at(now) + 1 - base_ticks) * tick_ns;
+  if(kprof_period_ns && now + kprof_period_ns < next)
+    next = now + kprof_period_ns;
+  if(timer && timer < next)
+    next = timer;
+
+  u64 ns = next > now ? next - now : 0;
+  if(use_lapic)
+    lapic_timer_arm(ns);
+  else
+    pit_program(ns);
+}
+
+void pit_start_oneshot(void)
+{
+  tick_ns    = NSEC_PER_SEC / pit_hz;
+  base_ns    = time_monotonic_ns();
+  base_ticks = ticks;
+  oneshot    = true;
+
+  /* In mode 0 channel 0 falls silent once its count runs out. */
+  if(lapic_init()) {
+    pic_mask(IRQ_TIMER);
+    use_lapic = true;
+    console_print("[PIT] Ticks now come from the LAPIC timer\n");
+  }
+  program_next(timer_next());
+}
+
+void pit_set_idle(bool on)
+{
+  if(!oneshot || idle == on)
+    return;
+  idle = on;
+  program_next(timer_next());
+}
+
 /**
  * @brief Enable preemptive scheduling on timer ticks.
  *
@@ -47,29 +201,65 @@ void pit_enable_sched(void)
 }
 
 /**
- * @brief PIT interrupt handler (called by IRQ0 handler).
+ * @brief Timer interrupt handler (IRQ0, or the LAPIC timer vector).
  *
- * Increments the tick counter and invokes the scheduler if scheduling is
- * enabled.
+ * Advances the tick count, runs expired kernel timers and invokes the
+ * scheduler if scheduling is enabled. In one-shot mode an interrupt may
+ * come between ticks for a timer only, and it always arms the next one.
  */
 void pit_tick(void)
 {
-  ticks++;
+  bool tick = true;
+  if(oneshot) {
+    u64 now = ticks_at(time_monotonic_ns());
+    tick    = now != ticks;
+    ticks   = now;
+  } else {
+    ticks++;
+  }
 
-  /* Cheap call into the framebuffer console — no-op until fb_console_init has
-   * run + cells are allocated. Drives the cursor blink phase. */
-  fb_console_tick();
+  if(tick) {
+    /* Cheap call into the framebuffer console — no-op until fb_console_init
+     * has run + cells are allocated. Drives the cursor blink phase. */
+    fb_console_tick();
 
-  if(preempt_enabled) {
+    /* Time out a disk request whose completion interrupt never came. */
+    ata_tick();
+
+    /* Retry ARP, refill receive buffers, deliver looped-back packets. */
+    net_tick();
+  }
+
+  /* Wake sleepers and fire timers whose deadline has passed. */
+  u64 next = timer_run(time_monotonic_ns());
+  if(oneshot)
+    program_next(next);
+
+  if(tick && preempt_enabled) {
     proc_tick();
   }
 }
 
+void pit_arm_ap(void)
+{
+  lapic_timer_arm(tick_ns);
+}
+
+/** @brief LAPIC timer interrupt on an AP: a scheduler tick, and the next
+ *         one while a process still runs. */
+void pit_tick_ap(void)
+{
+  if(preempt_enabled)
+    proc_tick();
+  if(cpu_this()->proc)
+    pit_arm_ap();
+}
+
 /**
  * @brief Get the number of PIT ticks since initialization.
  * @return Tick count.
  */
 u64 pit_get_ticks(void)
 {
-  return ticks;
+  return oneshot ? ticks_at(time_monotonic_ns()) : ticks;
 }
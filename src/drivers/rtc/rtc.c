@@ -0,0 +1,96 @@
+/**
+ * @file src/drivers/rtc/rtc.c
+ * @brief CMOS real-time clock driver.
+ */
+
+#include <alcor2/arch/io.h>
+#include <alcor2/drivers/rtc.h>
+
+#define CMOS_ADDR 0x70
+#define CMOS_DATA 0x71
+
+#define RTC_SECONDS  0x00
+#define RTC_MINUTES  0x02
+#define RTC_HOURS    0x04
+#define RTC_DAY      0x07
+#define RTC_MONTH    0x08
+#define RTC_YEAR     0x09
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+
+#define RTC_A_UPDATING 0x80 /**< Registers are being updated. */
+#define RTC_B_24H      0x02 /**< Hours are 0-23, not 1-12 plus PM bit. */
+#define RTC_B_BINARY   0x04 /**< Values are binary, not BCD. */
+
+typedef struct
+{
+  u8 sec, min, hour, day, mon, year;
+} rtc_time_t;
+
+static u8 cmos_read(u8 reg)
+{
+  /* Bit 7 of the address port keeps NMIs disabled. */
+  outb(CMOS_ADDR, 0x80 | reg);
+  return inb(CMOS_DATA);
+}
+
+static void rtc_snapshot(rtc_time_t *t)
+{
+  while(cmos_read(RTC_STATUS_A) & RTC_A_UPDATING)
+    ;
+  t->sec  = cmos_read(RTC_SECONDS);
+  t->min  = cmos_read(RTC_MINUTES);
+  t->hour = cmos_read(RTC_HOURS);
+  t->day  = cmos_read(RTC_DAY);
+  t->mon  = cmos_read(RTC_MONTH);
+  t->year = cmos_read(RTC_YEAR);
+}
+
+static u8 bcd(u8 v)
+{
+  return (u8)((v >> 4) * 10 + (v & 0x0F));
+}
+
+/** @brief Days from 1970-01-01 to @p y-@p m-@p d (proleptic Gregorian). */
+static i64 days_from_civil(i64 y, u32 m, u32 d)
+{
+  y -= m <= 2;
+  i64 era = y / 400;
+  u32 yoe = (u32)(y - era * 400);
+  u32 doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  u32 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (i64)doe - 719468;
+}
+
+i64 rtc_read_unix(void)
+{
+  /* Read until two snapshots agree, so no update lands in between. */
+  rtc_time_t a, b;
+  rtc_snapshot(&b);
+  do {
+    a = b;
+    rtc_snapshot(&b);
+  } while(a.sec != b.sec || a.min != b.min || a.hour != b.hour ||
+          a.day != b.day || a.mon != b.mon || a.year != b.year);
+
+  u8   status = cmos_read(RTC_STATUS_B);
+  bool pm     = b.hour & 0x80;
+  b.hour &= 0x7F;
+  if(!(status & RTC_B_BINARY)) {
+    b.sec  = bcd(b.sec);
+    b.min  = bcd(b.min);
+    b.hour = bcd(b.hour);
+    b.day  = bcd(b.day);
+    b.mon  = bcd(b.mon);
+    b.year = bcd(b.year);
+  }
+  if(!(status & RTC_B_24H)) {
+    b.hour %= 12;
+    if(pm)
+      b.hour += 12;
+  }
+
+  /* Two-digit year; the century register is not standard. */
+  i64 days = days_from_civil(2000 + b.year, b.mon, b.day);
+  return days * 86400 + b.hour * 3600 + b.min * 60 + b.sec;
+}
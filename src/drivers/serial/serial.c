@@ -0,0 +1,67 @@
+/**
+ * @file src/drivers/serial/serial.c
+ * @brief 16550 UART driver (COM1, polled transmit).
+ */
+
+#include <alcor2/arch/io.h>
+#include <alcor2/drivers/serial.h>
+
+#define COM1 0x3F8
+
+#define UART_DATA 0 /**< Transmit holding / divisor low (DLAB). */
+#define UART_IER  1 /**< Interrupt enable / divisor high (DLAB). */
+#define UART_FCR  2
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+
+#define LCR_8N1  0x03
+#define LCR_DLAB 0x80
+#define FCR_FIFO 0xC7 /**< Enable and clear both FIFOs, 14-byte trigger. */
+#define MCR_DTR  0x01
+#define MCR_RTS  0x02
+#define MCR_OUT2 0x08
+#define MCR_LOOP 0x10
+#define LSR_THRE 0x20 /**< Transmit holding register empty. */
+
+/** @brief Divisor of the 115200 Hz base clock: 1 for 115200 baud. */
+#define UART_DIVISOR 1
+
+/** @brief Bounded wait for the transmitter, so a dead UART cannot hang. */
+#define UART_SPIN 100000
+
+static bool present;
+
+void serial_init(void)
+{
+  outb(COM1 + UART_IER, 0);
+  outb(COM1 + UART_LCR, LCR_DLAB);
+  outb(COM1 + UART_DATA, UART_DIVISOR & 0xFF);
+  outb(COM1 + UART_IER, UART_DIVISOR >> 8);
+  outb(COM1 + UART_LCR, LCR_8N1);
+  outb(COM1 + UART_FCR, FCR_FIFO);
+
+  /* Loop a byte back through the UART: no echo, no UART. */
+  outb(COM1 + UART_MCR, MCR_LOOP | MCR_OUT2 | MCR_RTS);
+  outb(COM1 + UART_DATA, 0xAE);
+  present = inb(COM1 + UART_DATA) == 0xAE;
+
+  outb(COM1 + UART_MCR, MCR_OUT2 | MCR_RTS | MCR_DTR);
+}
+
+void serial_putchar(char c)
+{
+  if(!present)
+    return;
+  if(c == '\n')
+    serial_putchar('\r');
+  for(u32 i = 0; i < UART_SPIN && !(inb(COM1 + UART_LSR) & LSR_THRE); i++)
+    ;
+  outb(COM1 + UART_DATA, (u8)c);
+}
+
+void serial_print(const char *s)
+{
+  while(*s)
+    serial_putchar(*s++);
+}
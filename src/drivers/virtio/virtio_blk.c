@@ -0,0 +1,545 @@
+/**
+ * @file src/drivers/virtio/virtio_blk.c
+ * @brief Virtio block driver (virtio 1.0 PCI transport, split virtqueue).
+ *
+ * The common, notify, ISR and device configuration structures are located
+ * through the vendor capabilities in PCI config space and mapped uncached.
+ * Requests use one descriptor chain each: a request header, the data
+ * segments split at page boundaries (physically contiguous pages share a
+ * descriptor) and a status byte. Waiting requests are added to the
+ * available ring in one pass and the device is notified once for the
+ * whole batch, unless it asked not to be.
+ *
+ * The device may complete requests in any order, so a request is held back
+ * while it overlaps one in flight and either of them writes, and a flush
+ * only starts once the queue is empty. Completion is signalled by MSI-X
+ * entry 0 when the device and the local APIC allow it, otherwise on the
+ * PCI interrupt line routed through the PIC.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/idt.h>
+#include <alcor2/arch/pic.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/drivers/pci.h>
+#include <alcor2/drivers/virtio_blk.h>
+#include <alcor2/errno.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+
+#define VIRTIO_VENDOR            0x1AF4
+#define VIRTIO_DEV_BLK_MODERN    0x1042
+#define VIRTIO_DEV_BLK_TRANSITNL 0x1001
+
+/* Vendor capability fields and types */
+#define VCAP_CFG_TYPE   3
+#define VCAP_BAR        4
+#define VCAP_OFFSET     8
+#define VCAP_LENGTH     12
+#define VCAP_NOTIFY_MUL 16
+#define VCAP_COMMON     1
+#define VCAP_NOTIFY     2
+#define VCAP_ISR        3
+#define VCAP_DEVICE     4
+
+/* Common configuration (byte offsets) */
+#define CC_DFSELECT    0x00
+#define CC_DF          0x04
+#define CC_GFSELECT    0x08
+#define CC_GF          0x0C
+#define CC_MSIX        0x10
+#define CC_STATUS      0x14
+#define CC_Q_SELECT    0x16
+#define CC_Q_SIZE      0x18
+#define CC_Q_MSIX      0x1A
+#define CC_Q_ENABLE    0x1C
+#define CC_Q_NOTIFYOFF 0x1E
+#define CC_Q_DESC      0x20
+#define CC_Q_DRIVER    0x28
+#define CC_Q_DEVICE    0x30
+
+#define STATUS_ACK         1
+#define STATUS_DRIVER      2
+#define STATUS_DRIVER_OK   4
+#define STATUS_FEATURES_OK 8
+#define STATUS_FAILED      128
+
+#define F_BLK_RO     (1ULL << 5)
+#define F_BLK_FLUSH  (1ULL << 9)
+#define F_VERSION_1  (1ULL << 32)
+#define MSIX_NONE    0xFFFF
+#define ISR_QUEUE    0x1
+#define USED_NO_NOTE 0x1 /* VRING_USED_F_NO_NOTIFY */
+
+#define DESC_NEXT  0x1
+#define DESC_WRITE 0x2 /* device writes the buffer */
+
+#define VBLK_T_IN    0
+#define VBLK_T_OUT   1
+#define VBLK_T_FLUSH 4
+
+#define VQ_MAX     256 /* ring entries used at most */
+#define VBLK_POLL  50000000
+#define VQ_NO_DESC 0xFFFF
+
+/** @brief Split virtqueue descriptor. */
+typedef struct PACKED
+{
+  u64 addr;
+  u32 len;
+  u16 flags;
+  u16 next;
+} vq_desc_t;
+
+/** @brief Driver (available) ring. */
+typedef struct PACKED
+{
+  u16 flags;
+  u16 idx;
+  u16 ring[VQ_MAX];
+} vq_avail_t;
+
+/** @brief Device (used) ring element. */
+typedef struct PACKED
+{
+  u32 id;
+  u32 len;
+} vq_used_elem_t;
+
+/** @brief Device (used) ring. */
+typedef struct PACKED
+{
+  u16            flags;
+  u16            idx;
+  vq_used_elem_t ring[VQ_MAX];
+} vq_used_t;
+
+/** @brief Per-chain request state, indexed by the chain's head descriptor. */
+typedef struct
+{
+  struct PACKED
+  {
+    u32 type;
+    u32 reserved;
+    u64 sector;
+  } hdr;
+  u8         status;
+  ata_bio_t *bio; /* NULL while the chain is free */
+} __attribute__((aligned(32))) vblk_req_t;
+
+/** @brief One virtio block device. */
+typedef struct
+{
+  volatile u8        *common;
+  volatile u8        *isr;
+  volatile u8        *devcfg;
+  volatile u16       *notify;
+  vq_desc_t          *desc;
+  vq_avail_t         *avail;
+  volatile vq_used_t *used;
+  u16                 qsize;
+  u16                 free_head; /* free descriptors, linked through next */
+  u16                 nfree;
+  u16                 last_used;
+  u32                 inflight;
+  bool                flushing; /* a flush is in flight: issue nothing else */
+  bool                ro;
+  u64                 sectors;
+  ata_bio_t          *q_head; /* requests waiting for descriptors */
+  ata_bio_t          *q_tail;
+  vblk_req_t          req[VQ_MAX];
+} vblk_t;
+
+static vblk_t g_vblk;
+static u32    g_nvblk;
+static bool   g_irq_ok;
+static u8     g_msix; /* MSI-X vector of queue 0, or 0 on the INTx line */
+
+static inline volatile u8 *cc8(const vblk_t *v, u32 off)
+{
+  return v->common + off;
+}
+
+static inline volatile u16 *cc16(const vblk_t *v, u32 off)
+{
+  return (volatile u16 *)(v->common + off);
+}
+
+static inline volatile u32 *cc32(const vblk_t *v, u32 off)
+{
+  return (volatile u32 *)(v->common + off);
+}
+
+/* Descriptors a chain for @p bio needs at most. */
+static u32 bio_descs(const ata_bio_t *bio)
+{
+  u32 n = 2; /* header + status */
+  for(u32 i = 0; i < bio->nseg; i++) {
+    u64 v = (u64)bio->seg[i].buf;
+    n += (u32)(((v + bio->seg[i].bytes - 1) >> 12) - (v >> 12) + 1);
+  }
+  return n;
+}
+
+static u16 desc_get(vblk_t *v)
+{
+  u16 d        = v->free_head;
+  v->free_head = v->desc[d].next;
+  v->nfree--;
+  return d;
+}
+
+/* Append a descriptor after @p prev (VQ_NO_DESC for the head). */
+static u16 desc_add(vblk_t *v, u16 prev, u64 phys, u32 len, u16 flags)
+{
+  u16 d            = desc_get(v);
+  v->desc[d].addr  = phys;
+  v->desc[d].len   = len;
+  v->desc[d].flags = flags;
+  v->desc[d].next  = VQ_NO_DESC;
+  if(prev != VQ_NO_DESC) {
+    v->desc[prev].flags |= DESC_NEXT;
+    v->desc[prev].next   = d;
+  }
+  return d;
+}
+
+/* Build the chain for @p bio and return its head. */
+static u16 chain_build(vblk_t *v, ata_bio_t *bio)
+{
+  u16         head = desc_get(v);
+  vblk_req_t *r    = &v->req[head];
+  u16         wr   = bio->op == ATA_BIO_READ ? DESC_WRITE : 0;
+
+  r->hdr.type     = bio->op == ATA_BIO_FLUSH  ? VBLK_T_FLUSH
+                    : bio->op == ATA_BIO_WRITE ? VBLK_T_OUT
+                                               : VBLK_T_IN;
+  r->hdr.reserved = 0;
+  r->hdr.sector   = bio->op == ATA_BIO_FLUSH ? 0 : bio->lba;
+  r->status       = 0xFF;
+  r->bio          = bio;
+
+  v->desc[head].addr  = vmm_kernel_phys(&r->hdr);
+  v->desc[head].len   = sizeof(r->hdr);
+  v->desc[head].flags = 0;
+  v->desc[head].next  = VQ_NO_DESC;
+
+  u16 last = head;
+  for(u32 i = 0; i < bio->nseg; i++) {
+    u64 a   = (u64)bio->seg[i].buf;
+    u64 end = a + bio->seg[i].bytes;
+    while(a < end) {
+      u64 len  = PAGE_SIZE - (a & (PAGE_SIZE - 1));
+      u64 phys = vmm_kernel_phys((const void *)a);
+      if(len > end - a)
+        len = end - a;
+      vq_desc_t *l = &v->desc[last];
+      if(last != head && l->addr + l->len == phys)
+        l->len += (u32)len;
+      else
+        last = desc_add(v, last, phys, (u32)len, wr);
+      a += len;
+    }
+  }
+  desc_add(v, last, vmm_kernel_phys(&r->status), 1, DESC_WRITE);
+  return head;
+}
+
+/* Return the chain starting at @p head to the free list. */
+static void chain_free(vblk_t *v, u16 head)
+{
+  u16 d = head;
+  for(;;) {
+    v->nfree++;
+    if(!(v->desc[d].flags & DESC_NEXT))
+      break;
+    d = v->desc[d].next;
+  }
+  v->desc[d].next = v->free_head;
+  v->free_head    = head;
+}
+
+/* Whether @p bio overlaps a request in flight that it must not pass. */
+static bool vblk_conflicts(const vblk_t *v, const ata_bio_t *bio)
+{
+  for(u32 i = 0; i < v->qsize && v->inflight; i++) {
+    const ata_bio_t *a = v->req[i].bio;
+    if(!a || (a->op != ATA_BIO_WRITE && bio->op != ATA_BIO_WRITE))
+      continue;
+    if(a->lba < bio->lba + bio->count && bio->lba < a->lba + a->count)
+      return true;
+  }
+  return false;
+}
+
+/* Move waiting requests onto the ring and kick once (interrupts off). */
+static void vblk_dispatch(vblk_t *v)
+{
+  u16 added = 0;
+  while(v->q_head && !v->flushing) {
+    ata_bio_t *bio = v->q_head;
+    if(bio->op == ATA_BIO_FLUSH ? v->inflight != 0 : vblk_conflicts(v, bio))
+      break;
+    if(bio_descs(bio) > v->nfree)
+      break;
+
+    v->q_head = bio->next;
+    if(!v->q_tail || !v->q_head)
+      v->q_tail = v->q_head;
+    bio->next = NULL;
+
+    u16 slot             = (u16)((v->avail->idx + added) % v->qsize);
+    v->avail->ring[slot] = chain_build(v, bio);
+    added++;
+    v->inflight++;
+    if(bio->op == ATA_BIO_FLUSH)
+      v->flushing = true;
+  }
+  if(!added)
+    return;
+
+  __asm__ volatile("" ::: "memory");
+  v->avail->idx += added;
+  __asm__ volatile("mfence" ::: "memory");
+  if(!(v->used->flags & USED_NO_NOTE))
+    *v->notify = 0;
+}
+
+/* Retire completed requests and issue more (interrupts off). */
+static void vblk_service(vblk_t *v)
+{
+  while(v->last_used != v->used->idx) {
+    __asm__ volatile("" ::: "memory");
+    u16         head = (u16)v->used->ring[v->last_used % v->qsize].id;
+    vblk_req_t *r    = &v->req[head];
+    ata_bio_t  *bio  = r->bio;
+
+    v->last_used++;
+    r->bio = NULL;
+    chain_free(v, head);
+    v->inflight--;
+    if(bio->op == ATA_BIO_FLUSH)
+      v->flushing = false;
+    ata_bio_end(bio, r->status == 0 ? 0 : -EIO);
+  }
+  vblk_dispatch(v);
+}
+
+/** @brief Device interrupt; reading the ISR status deasserts the line. */
+static void vblk_irq(void)
+{
+  if(!g_nvblk || !(*g_vblk.isr & ISR_QUEUE))
+    return;
+  vblk_service(&g_vblk);
+}
+
+/** @brief Queue 0's MSI-X message; the vector is not shared. */
+static void vblk_msix_irq(void)
+{
+  if(g_nvblk)
+    vblk_service(&g_vblk);
+}
+
+void virtio_blk_tick(void)
+{
+  if(g_nvblk && !g_irq_ok)
+    vblk_service(&g_vblk);
+}
+
+i64 virtio_blk_submit(u8 n, ata_bio_t *bio)
+{
+  if(n >= g_nvblk)
+    return -ENODEV;
+  vblk_t *v = &g_vblk;
+  if(bio->op == ATA_BIO_WRITE && v->ro)
+    return -EROFS;
+  if(bio_descs(bio) > v->qsize)
+    return -EINVAL;
+  for(u32 i = 0; i < bio->nseg; i++) {
+    if(!vmm_kernel_phys(bio->seg[i].buf))
+      return -EINVAL;
+  }
+
+  bool boot = !proc_current();
+  if(!boot)
+    cpu_disable_interrupts();
+  if(v->q_tail)
+    v->q_tail->next = bio;
+  else
+    v->q_head = bio;
+  v->q_tail = bio;
+  vblk_dispatch(v);
+
+  /* No scheduler to sleep in yet (interrupts are still off): poll. */
+  for(u32 i = 0; boot && bio->status == ATA_BIO_PENDING; i++) {
+    if(i == VBLK_POLL) {
+      ata_bio_end(bio, -ETIMEDOUT);
+      break;
+    }
+    vblk_service(v);
+    cpu_pause();
+  }
+  if(!boot)
+    cpu_enable_interrupts();
+  return 0;
+}
+
+/* Map the structure a vendor capability at @p cap points to. */
+static volatile u8 *map_cap(const pci_device_t *dev, u8 cap)
+{
+  u8  bar  = pci_read8(dev->bus, dev->slot, dev->func, cap + VCAP_BAR);
+  u32 off  = pci_read32(dev->bus, dev->slot, dev->func, cap + VCAP_OFFSET);
+  u32 len  = pci_read32(dev->bus, dev->slot, dev->func, cap + VCAP_LENGTH);
+  u64 base = pci_bar_address(dev, bar);
+  if(!base || !len)
+    return NULL;
+  return vmm_map_mmio(base + off, len);
+}
+
+/* Allocate and register queue 0. */
+static bool vblk_setup_queue(vblk_t *v, volatile u8 *notify_base, u32 mul)
+{
+  *cc16(v, CC_Q_SELECT) = 0;
+  u16 size              = *cc16(v, CC_Q_SIZE);
+  if(size == 0)
+    return false;
+  v->qsize = size < VQ_MAX ? size : VQ_MAX;
+
+  /* Page 0: descriptors; page 1: available ring, used ring at 2 KB. */
+  void *mem = pmm_alloc_pages(2);
+  if(!mem)
+    return false;
+  u64 phys = (u64)mem;
+  u8 *virt = phys_to_virt(phys);
+  kzero(virt, 2 * PAGE_SIZE);
+  v->desc  = (vq_desc_t *)virt;
+  v->avail = (vq_avail_t *)(virt + PAGE_SIZE);
+  v->used  = (volatile vq_used_t *)(virt + PAGE_SIZE + 2048);
+
+  for(u16 i = 0; i < v->qsize; i++)
+    v->desc[i].next = (u16)(i + 1 < v->qsize ? i + 1 : VQ_NO_DESC);
+  v->free_head = 0;
+  v->nfree     = v->qsize;
+
+  u64 drv                   = phys + PAGE_SIZE;
+  u64 dev                   = phys + PAGE_SIZE + 2048;
+  *cc16(v, CC_Q_SIZE)       = v->qsize;
+  *cc16(v, CC_Q_MSIX)       = g_msix ? 0 : MSIX_NONE;
+  *cc32(v, CC_Q_DESC)       = (u32)phys;
+  *cc32(v, CC_Q_DESC + 4)   = (u32)(phys >> 32);
+  *cc32(v, CC_Q_DRIVER)     = (u32)drv;
+  *cc32(v, CC_Q_DRIVER + 4) = (u32)(drv >> 32);
+  *cc32(v, CC_Q_DEVICE)     = (u32)dev;
+  *cc32(v, CC_Q_DEVICE + 4) = (u32)(dev >> 32);
+  v->notify = (volatile u16 *)(notify_base + *cc16(v, CC_Q_NOTIFYOFF) * mul);
+  *cc16(v, CC_Q_ENABLE) = 1;
+  return true;
+}
+
+u32 virtio_blk_init(void)
+{
+  pci_device_t dev;
+  if(!pci_find_id(VIRTIO_VENDOR, VIRTIO_DEV_BLK_MODERN, &dev) &&
+     !pci_find_id(VIRTIO_VENDOR, VIRTIO_DEV_BLK_TRANSITNL, &dev))
+    return 0;
+  pci_enable_bus_master(&dev);
+
+  vblk_t      *v           = &g_vblk;
+  volatile u8 *notify_base = NULL;
+  u32          mul         = 0;
+  for(u8 c = pci_find_capability(&dev, PCI_CAP_VENDOR, 0); c;
+      c    = pci_find_capability(&dev, PCI_CAP_VENDOR, c)) {
+    u8 type = pci_read8(dev.bus, dev.slot, dev.func, c + VCAP_CFG_TYPE);
+    if(type == VCAP_COMMON && !v->common) {
+      v->common = map_cap(&dev, c);
+    } else if(type == VCAP_NOTIFY && !notify_base) {
+      notify_base = map_cap(&dev, c);
+      mul = pci_read32(dev.bus, dev.slot, dev.func, c + VCAP_NOTIFY_MUL);
+    } else if(type == VCAP_ISR && !v->isr) {
+      v->isr = map_cap(&dev, c);
+    } else if(type == VCAP_DEVICE && !v->devcfg) {
+      v->devcfg = map_cap(&dev, c);
+    }
+  }
+  if(!v->common || !notify_base || !v->isr || !v->devcfg) {
+    console_print("[VIRTIO] Block device has no modern interface\n");
+    return 0;
+  }
+
+  /* Reset, then negotiate features. */
+  *cc8(v, CC_STATUS) = 0;
+  while(*cc8(v, CC_STATUS) != 0)
+    cpu_pause();
+  *cc8(v, CC_STATUS) = STATUS_ACK | STATUS_DRIVER;
+
+  *cc32(v, CC_DFSELECT) = 0;
+  u64 features          = *cc32(v, CC_DF);
+  *cc32(v, CC_DFSELECT) = 1;
+  features             |= (u64)*cc32(v, CC_DF) << 32;
+  u64 want              = features & (F_VERSION_1 | F_BLK_FLUSH | F_BLK_RO);
+  if(!(want & F_VERSION_1)) {
+    *cc8(v, CC_STATUS) = STATUS_FAILED;
+    return 0;
+  }
+  *cc32(v, CC_GFSELECT) = 0;
+  *cc32(v, CC_GF)       = (u32)want;
+  *cc32(v, CC_GFSELECT) = 1;
+  *cc32(v, CC_GF)       = (u32)(want >> 32);
+  *cc8(v, CC_STATUS)   |= STATUS_FEATURES_OK;
+
+  g_msix = irq_alloc_vector(vblk_msix_irq);
+  if(g_msix && !pci_enable_msix(&dev, &g_msix, 1)) {
+    irq_free_vector(g_msix);
+    g_msix = 0;
+  }
+  if(!(*cc8(v, CC_STATUS) & STATUS_FEATURES_OK) ||
+     !vblk_setup_queue(v, notify_base, mul)) {
+    *cc8(v, CC_STATUS) = STATUS_FAILED;
+    return 0;
+  }
+  *cc16(v, CC_MSIX) = MSIX_NONE;
+  /* A device that cannot map the vector reads back MSIX_NONE. */
+  if(g_msix && *cc16(v, CC_Q_MSIX) != 0) {
+    pci_disable_msix(&dev);
+    irq_free_vector(g_msix);
+    g_msix = 0;
+  }
+
+  v->ro              = !!(want & F_BLK_RO);
+  volatile u32 *cfg  = (volatile u32 *)v->devcfg;
+  v->sectors         = (u64)cfg[0] | (u64)cfg[1] << 32;
+  *cc8(v, CC_STATUS) |= STATUS_DRIVER_OK;
+  g_nvblk = 1;
+
+  /* Without MSI-X or a usable line, virtio_blk_tick() polls the queue. */
+  g_irq_ok = g_msix || (dev.irq < PIC_IRQ_LINE_COUNT &&
+                        irq_register(dev.irq, vblk_irq));
+  if(g_irq_ok && !g_msix)
+    pic_unmask(dev.irq);
+
+  console_printf(
+      "[VIRTIO] Block device: %d MB, queue %d, %s %d%s\n",
+      (u32)(v->sectors / 2048), (int)v->qsize, g_msix ? "MSI-X" : "IRQ",
+      g_msix ? (int)g_msix : g_irq_ok ? (int)dev.irq : -1,
+      v->ro ? ", read-only" : ""
+  );
+  return g_nvblk;
+}
+
+bool virtio_blk_attach(u32 n, ata_drive_t *d)
+{
+  if(n >= g_nvblk)
+    return false;
+  d->present = true;
+  d->atapi   = false;
+  d->lba48   = true;
+  d->dma     = true;
+  d->host    = ATA_HOST_VIRTIO;
+  d->port    = (u8)n;
+  d->sectors = g_vblk.sectors;
+  kstrncpy(d->model, "Virtio block device", sizeof(d->model));
+  d->serial[0] = '\0';
+  return true;
+}
@@ -0,0 +1,575 @@
+/**
+ * @file src/drivers/virtio/virtio_net.c
+ * @brief Virtio network driver (virtio 1.0 PCI transport, split virtqueues).
+ *
+ * The PCI side is set up as in virtio_blk.c. Queue 0 receives: each of its
+ * descriptors holds one ::netbuf_t, written by the device just below the
+ * buffer's data so the virtio-net header lands in the headroom and the
+ * frame where the stack expects it. Queue 1 transmits: the header is
+ * pushed in front of the frame and the chain has one descriptor for the
+ * linear part and one per fragment, so pages the stack attached by
+ * reference go to the device as they are. Frames that find no free
+ * descriptors wait on a short backlog.
+ *
+ * The device fills in TCP and UDP checksums (VIRTIO_NET_F_CSUM) and says
+ * which received ones it checked (VIRTIO_NET_F_GUEST_CSUM) when it offers
+ * to. Each queue has its own MSI-X entry when the device and the local
+ * APIC allow it; otherwise both share the PCI interrupt line, or the timer
+ * polls them.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/idt.h>
+#include <alcor2/arch/pic.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/drivers/pci.h>
+#include <alcor2/drivers/virtio_net.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/net/net.h>
+
+#define VIRTIO_VENDOR            0x1AF4
+#define VIRTIO_DEV_NET_MODERN    0x1041
+#define VIRTIO_DEV_NET_TRANSITNL 0x1000
+
+/* Vendor capability fields and types */
+#define VCAP_CFG_TYPE   3
+#define VCAP_BAR        4
+#define VCAP_OFFSET     8
+#define VCAP_LENGTH     12
+#define VCAP_NOTIFY_MUL 16
+#define VCAP_COMMON     1
+#define VCAP_NOTIFY     2
+#define VCAP_ISR        3
+#define VCAP_DEVICE     4
+
+/* Common configuration (byte offsets) */
+#define CC_DFSELECT    0x00
+#define CC_DF          0x04
+#define CC_GFSELECT    0x08
+#define CC_GF          0x0C
+#define CC_MSIX        0x10
+#define CC_STATUS      0x14
+#define CC_Q_SELECT    0x16
+#define CC_Q_SIZE      0x18
+#define CC_Q_MSIX      0x1A
+#define CC_Q_ENABLE    0x1C
+#define CC_Q_NOTIFYOFF 0x1E
+#define CC_Q_DESC      0x20
+#define CC_Q_DRIVER    0x28
+#define CC_Q_DEVICE    0x30
+
+#define STATUS_ACK         1
+#define STATUS_DRIVER      2
+#define STATUS_DRIVER_OK   4
+#define STATUS_FEATURES_OK 8
+#define STATUS_FAILED      128
+
+#define F_NET_CSUM       (1ULL << 0)
+#define F_NET_GUEST_CSUM (1ULL << 1)
+#define F_NET_MAC        (1ULL << 5)
+#define F_VERSION_1      (1ULL << 32)
+#define MSIX_NONE        0xFFFF
+#define ISR_QUEUE        0x1
+#define USED_NO_NOTE     0x1 /* VRING_USED_F_NO_NOTIFY */
+
+#define DESC_NEXT  0x1
+#define DESC_WRITE 0x2 /* device writes the buffer */
+
+#define HDR_F_NEEDS_CSUM 1
+#define HDR_F_DATA_VALID 4
+
+#define VQ_MAX       256 /* ring entries used at most */
+#define VQ_NO_DESC   0xFFFF
+#define VNET_RXQ     0
+#define VNET_TXQ     1
+#define VNET_RX_LEN  (ETH_HLEN + ETH_MTU)
+#define VNET_BACKLOG 128 /* frames waiting for descriptors at most */
+
+/** @brief Split virtqueue descriptor. */
+typedef struct PACKED
+{
+  u64 addr;
+  u32 len;
+  u16 flags;
+  u16 next;
+} vq_desc_t;
+
+/** @brief Driver (available) ring. */
+typedef struct PACKED
+{
+  u16 flags;
+  u16 idx;
+  u16 ring[VQ_MAX];
+} vq_avail_t;
+
+/** @brief Device (used) ring element. */
+typedef struct PACKED
+{
+  u32 id;
+  u32 len;
+} vq_used_elem_t;
+
+/** @brief Device (used) ring. */
+typedef struct PACKED
+{
+  u16            flags;
+  u16            idx;
+  vq_used_elem_t ring[VQ_MAX];
+} vq_used_t;
+
+/** @brief Header in front of every frame (virtio 1.0 layout). */
+typedef struct PACKED
+{
+  u8  flags;
+  u8  gso_type;
+  u16 hdr_len;
+  u16 gso_size;
+  u16 csum_start;
+  u16 csum_offset;
+  u16 num_buffers;
+} vnet_hdr_t;
+
+/** @brief One virtqueue and the buffer behind each chain. */
+typedef struct
+{
+  vq_desc_t          *desc;
+  vq_avail_t         *avail;
+  volatile vq_used_t *used;
+  volatile u16       *notify;
+  u16                 qsize;
+  u16                 free_head; /* free descriptors, linked through next */
+  u16                 nfree;
+  u16                 last_used;
+  netbuf_t           *buf[VQ_MAX]; /* by head descriptor */
+} vnet_queue_t;
+
+/** @brief The virtio network device. */
+typedef struct
+{
+  volatile u8 *common;
+  volatile u8 *isr;
+  volatile u8 *devcfg;
+  vnet_queue_t rxq;
+  vnet_queue_t txq;
+  netbuf_t    *tx_head; /* frames waiting for descriptors */
+  netbuf_t    *tx_tail;
+  u32          tx_backlog;
+  netif_t      nif;
+} vnet_t;
+
+static vnet_t g_vnet;
+static u32    g_nvnet;
+static bool   g_irq_ok;
+static u8     g_msix[2]; /* MSI-X vectors of queues 0 and 1, or 0 */
+
+static inline volatile u8 *cc8(const vnet_t *v, u32 off)
+{
+  return v->common + off;
+}
+
+static inline volatile u16 *cc16(const vnet_t *v, u32 off)
+{
+  return (volatile u16 *)(v->common + off);
+}
+
+static inline volatile u32 *cc32(const vnet_t *v, u32 off)
+{
+  return (volatile u32 *)(v->common + off);
+}
+
+static u16 desc_get(vnet_queue_t *q)
+{
+  u16 d        = q->free_head;
+  q->free_head = q->desc[d].next;
+  q->nfree--;
+  return d;
+}
+
+/* Append a descriptor after @p prev (VQ_NO_DESC for the head). */
+static u16 desc_add(vnet_queue_t *q, u16 prev, u64 phys, u32 len, u16 flags)
+{
+  u16 d            = desc_get(q);
+  q->desc[d].addr  = phys;
+  q->desc[d].len   = len;
+  q->desc[d].flags = flags;
+  q->desc[d].next  = VQ_NO_DESC;
+  if(prev != VQ_NO_DESC) {
+    q->desc[prev].flags |= DESC_NEXT;
+    q->desc[prev].next   = d;
+  }
+  return d;
+}
+
+/* Return the chain starting at @p head to the free list. */
+static void chain_free(vnet_queue_t *q, u16 head)
+{
+  u16 d = head;
+  for(;;) {
+    q->nfree++;
+    if(!(q->desc[d].flags & DESC_NEXT))
+      break;
+    d = q->desc[d].next;
+  }
+  q->desc[d].next = q->free_head;
+  q->free_head    = head;
+}
+
+/* Publish @p added chains put on @p q's ring and kick once. */
+static void vq_kick(vnet_queue_t *q, u16 added)
+{
+  if(!added)
+    return;
+  __asm__ volatile("" ::: "memory");
+  q->avail->idx += added;
+  __asm__ volatile("mfence" ::: "memory");
+  if(!(q->used->flags & USED_NO_NOTE))
+    *q->notify = 0;
+}
+
+/* Give the device a fresh buffer for every free receive descriptor. */
+static void vnet_rx_refill(vnet_t *v)
+{
+  vnet_queue_t *q     = &v->rxq;
+  u16           added = 0;
+  while(q->nfree) {
+    netbuf_t *nb = netbuf_alloc();
+    if(!nb)
+      break;
+    u8 *hdr = nb->data - sizeof(vnet_hdr_t);
+    u16 d   = desc_add(
+        q, VQ_NO_DESC, virt_to_phys(hdr), sizeof(vnet_hdr_t) + VNET_RX_LEN,
+        DESC_WRITE
+    );
+    u16 slot             = (u16)((q->avail->idx + added) % q->qsize);
+    q->buf[d]            = nb;
+    q->avail->ring[slot] = d;
+    added++;
+  }
+  vq_kick(q, added);
+}
+
+/* Hand received frames to the stack (interrupts off). */
+static void vnet_rx_service(vnet_t *v)
+{
+  vnet_queue_t *q = &v->rxq;
+  while(q->last_used != q->used->idx) {
+    __asm__ volatile("" ::: "memory");
+    u16       slot = q->last_used % q->qsize;
+    u16       d    = (u16)q->used->ring[slot].id;
+    u32       len  = q->used->ring[slot].len;
+    netbuf_t *nb   = q->buf[d];
+
+    q->last_used++;
+    q->buf[d] = NULL;
+    chain_free(q, d);
+    if(len < sizeof(vnet_hdr_t) + ETH_HLEN) {
+      v->nif.rx_dropped++;
+      netbuf_free(nb);
+      continue;
+    }
+    /* A partial checksum comes from the host side and was never sent. */
+    const vnet_hdr_t *h = (const vnet_hdr_t *)(nb->data - sizeof(*h));
+    nb->len             = len - (u32)sizeof(*h);
+    nb->csum_ok         = h->flags & (HDR_F_DATA_VALID | HDR_F_NEEDS_CSUM);
+    net_rx(&v->nif, nb);
+  }
+  vnet_rx_refill(v);
+}
+
+/* Build the chain for @p nb: header and linear part, then each fragment. */
+static u16 vnet_tx_chain(vnet_queue_t *q, netbuf_t *nb)
+{
+  u16         csum_start = nb->csum_start;
+  u16         csum_off   = nb->csum_off;
+  vnet_hdr_t *h          = (vnet_hdr_t *)netbuf_push(nb, sizeof(*h));
+  kzero(h, sizeof(*h));
+  if(csum_off) {
+    h->flags       = HDR_F_NEEDS_CSUM;
+    h->csum_start  = csum_start;
+    h->csum_offset = csum_off;
+  }
+
+  u16 head = desc_add(q, VQ_NO_DESC, virt_to_phys(nb->data), nb->len, 0);
+  u16 last = head;
+  for(u32 i = 0; i < nb->nfrags; i++)
+    last = desc_add(q, last, nb->frags[i].phys, nb->frags[i].len, 0);
+  q->buf[head] = nb;
+  return head;
+}
+
+/* Move backlogged frames onto the transmit ring (interrupts off). */
+static void vnet_tx_dispatch(vnet_t *v)
+{
+  vnet_queue_t *q     = &v->txq;
+  u16           added = 0;
+  while(v->tx_head && 1 + v->tx_head->nfrags <= q->nfree) {
+    netbuf_t *nb = v->tx_head;
+    v->tx_head   = nb->next;
+    if(!v->tx_head)
+      v->tx_tail = NULL;
+    nb->next = NULL;
+    v->tx_backlog--;
+
+    u16 slot             = (u16)((q->avail->idx + added) % q->qsize);
+    q->avail->ring[slot] = vnet_tx_chain(q, nb);
+    added++;
+  }
+  vq_kick(q, added);
+}
+
+/* Free frames the device has sent and queue more (interrupts off). */
+static void vnet_tx_service(vnet_t *v)
+{
+  vnet_queue_t *q = &v->txq;
+  while(q->last_used != q->used->idx) {
+    __asm__ volatile("" ::: "memory");
+    u16       head = (u16)q->used->ring[q->last_used % q->qsize].id;
+    netbuf_t *nb   = q->buf[head];
+
+    q->last_used++;
+    q->buf[head] = NULL;
+    chain_free(q, head);
+    netbuf_free(nb);
+  }
+  vnet_tx_dispatch(v);
+}
+
+/** @brief ::netif_t transmit hook. */
+static void vnet_xmit(netif_t *nif, netbuf_t *nb)
+{
+  vnet_t *v = &g_vnet;
+  if(v->tx_backlog == VNET_BACKLOG) {
+    nif->tx_dropped++;
+    netbuf_free(nb);
+    return;
+  }
+  nif->tx_packets++;
+  nif->tx_bytes += netbuf_total(nb);
+
+  nb->next = NULL;
+  if(v->tx_tail)
+    v->tx_tail->next = nb;
+  else
+    v->tx_head = nb;
+  v->tx_tail = nb;
+  v->tx_backlog++;
+  vnet_tx_service(v);
+}
+
+/** @brief Shared line: reading the ISR status deasserts it. */
+static void vnet_irq(void)
+{
+  if(!g_nvnet || !(*g_vnet.isr & ISR_QUEUE))
+    return;
+  vnet_tx_service(&g_vnet);
+  vnet_rx_service(&g_vnet);
+}
+
+/** @brief Queue 0's MSI-X message. */
+static void vnet_rx_irq(void)
+{
+  if(g_nvnet)
+    vnet_rx_service(&g_vnet);
+}
+
+/** @brief Queue 1's MSI-X message. */
+static void vnet_tx_irq(void)
+{
+  if(g_nvnet)
+    vnet_tx_service(&g_vnet);
+}
+
+void virtio_net_tick(void)
+{
+  if(!g_nvnet)
+    return;
+  if(!g_irq_ok) {
+    vnet_tx_service(&g_vnet);
+    vnet_rx_service(&g_vnet);
+  } else if(g_vnet.rxq.nfree) {
+    vnet_rx_refill(&g_vnet);
+  }
+}
+
+/* Map the structure a vendor capability at @p cap points to. */
+static volatile u8 *map_cap(const pci_device_t *dev, u8 cap)
+{
+  u8  bar  = pci_read8(dev->bus, dev->slot, dev->func, cap + VCAP_BAR);
+  u32 off  = pci_read32(dev->bus, dev->slot, dev->func, cap + VCAP_OFFSET);
+  u32 len  = pci_read32(dev->bus, dev->slot, dev->func, cap + VCAP_LENGTH);
+  u64 base = pci_bar_address(dev, bar);
+  if(!base || !len)
+    return NULL;
+  return vmm_map_mmio(base + off, len);
+}
+
+/* Allocate and register queue @p idx, signalling MSI-X entry @p idx. */
+static bool vnet_setup_queue(
+    vnet_t *v, vnet_queue_t *q, u16 idx, volatile u8 *notify_base, u32 mul
+)
+{
+  *cc16(v, CC_Q_SELECT) = idx;
+  u16 size              = *cc16(v, CC_Q_SIZE);
+  if(size == 0)
+    return false;
+  q->qsize = size < VQ_MAX ? size : VQ_MAX;
+
+  /* Page 0: descriptors; page 1: available ring, used ring at 1 KB. */
+  void *mem = pmm_alloc_pages(2);
+  if(!mem)
+    return false;
+  u64 phys = (u64)mem;
+  u8 *virt = phys_to_virt(phys);
+  kzero(virt, 2 * PAGE_SIZE);
+  q->desc  = (vq_desc_t *)virt;
+  q->avail = (vq_avail_t *)(virt + PAGE_SIZE);
+  q->used  = (volatile vq_used_t *)(virt + PAGE_SIZE + 1024);
+
+  for(u16 i = 0; i < q->qsize; i++)
+    q->desc[i].next = (u16)(i + 1 < q->qsize ? i + 1 : VQ_NO_DESC);
+  q->free_head = 0;
+  q->nfree     = q->qsize;
+
+  u64 drv                   = phys + PAGE_SIZE;
+  u64 dev                   = phys + PAGE_SIZE + 1024;
+  *cc16(v, CC_Q_SIZE)       = q->qsize;
+  *cc16(v, CC_Q_MSIX)       = g_msix[0] ? idx : MSIX_NONE;
+  *cc32(v, CC_Q_DESC)       = (u32)phys;
+  *cc32(v, CC_Q_DESC + 4)   = (u32)(phys >> 32);
+  *cc32(v, CC_Q_DRIVER)     = (u32)drv;
+  *cc32(v, CC_Q_DRIVER + 4) = (u32)(drv >> 32);
+  *cc32(v, CC_Q_DEVICE)     = (u32)dev;
+  *cc32(v, CC_Q_DEVICE + 4) = (u32)(dev >> 32);
+  q->notify = (volatile u16 *)(notify_base + *cc16(v, CC_Q_NOTIFYOFF) * mul);
+  *cc16(v, CC_Q_ENABLE) = 1;
+  return true;
+}
+
+/* Both queues got their MSI-X entries (a device that cannot map a vector
+ * reads back MSIX_NONE). */
+static bool vnet_msix_mapped(const vnet_t *v)
+{
+  for(u16 i = 0; i < 2; i++) {
+    *cc16(v, CC_Q_SELECT) = i;
+    if(*cc16(v, CC_Q_MSIX) != i)
+      return false;
+  }
+  return true;
+}
+
+/* Take two MSI-X vectors, one per queue, or none. */
+static void vnet_msix_alloc(const pci_device_t *dev)
+{
+  g_msix[0] = irq_alloc_vector(vnet_rx_irq);
+  g_msix[1] = irq_alloc_vector(vnet_tx_irq);
+  if(g_msix[0] && g_msix[1] && pci_msix_count(dev) >= 2 &&
+     pci_enable_msix(dev, g_msix, 2))
+    return;
+  for(u32 i = 0; i < 2; i++) {
+    if(g_msix[i])
+      irq_free_vector(g_msix[i]);
+    g_msix[i] = 0;
+  }
+}
+
+u32 virtio_net_init(void)
+{
+  pci_device_t dev;
+  if(!pci_find_id(VIRTIO_VENDOR, VIRTIO_DEV_NET_MODERN, &dev) &&
+     !pci_find_id(VIRTIO_VENDOR, VIRTIO_DEV_NET_TRANSITNL, &dev))
+    return 0;
+  pci_enable_bus_master(&dev);
+
+  vnet_t      *v           = &g_vnet;
+  volatile u8 *notify_base = NULL;
+  u32          mul         = 0;
+  for(u8 c = pci_find_capability(&dev, PCI_CAP_VENDOR, 0); c;
+      c    = pci_find_capability(&dev, PCI_CAP_VENDOR, c)) {
+    u8 type = pci_read8(dev.bus, dev.slot, dev.func, c + VCAP_CFG_TYPE);
+    if(type == VCAP_COMMON && !v->common) {
+      v->common = map_cap(&dev, c);
+    } else if(type == VCAP_NOTIFY && !notify_base) {
+      notify_base = map_cap(&dev, c);
+      mul = pci_read32(dev.bus, dev.slot, dev.func, c + VCAP_NOTIFY_MUL);
+    } else if(type == VCAP_ISR && !v->isr) {
+      v->isr = map_cap(&dev, c);
+    } else if(type == VCAP_DEVICE && !v->devcfg) {
+      v->devcfg = map_cap(&dev, c);
+    }
+  }
+  if(!v->common || !notify_base || !v->isr || !v->devcfg) {
+    console_print("[VIRTIO] Network device has no modern interface\n");
+    return 0;
+  }
+
+  /* Reset, then negotiate features. */
+  *cc8(v, CC_STATUS) = 0;
+  while(*cc8(v, CC_STATUS) != 0)
+    cpu_pause();
+  *cc8(v, CC_STATUS) = STATUS_ACK | STATUS_DRIVER;
+
+  *cc32(v, CC_DFSELECT) = 0;
+  u64 features          = *cc32(v, CC_DF);
+  *cc32(v, CC_DFSELECT) = 1;
+  features             |= (u64)*cc32(v, CC_DF) << 32;
+  u64 want              = features & (F_VERSION_1 | F_NET_CSUM |
+                                      F_NET_GUEST_CSUM | F_NET_MAC);
+  if(!(want & F_VERSION_1)) {
+    *cc8(v, CC_STATUS) = STATUS_FAILED;
+    return 0;
+  }
+  *cc32(v, CC_GFSELECT) = 0;
+  *cc32(v, CC_GF)       = (u32)want;
+  *cc32(v, CC_GFSELECT) = 1;
+  *cc32(v, CC_GF)       = (u32)(want >> 32);
+  *cc8(v, CC_STATUS)   |= STATUS_FEATURES_OK;
+
+  vnet_msix_alloc(&dev);
+  if(!(*cc8(v, CC_STATUS) & STATUS_FEATURES_OK) ||
+     !vnet_setup_queue(v, &v->rxq, VNET_RXQ, notify_base, mul) ||
+     !vnet_setup_queue(v, &v->txq, VNET_TXQ, notify_base, mul)) {
+    *cc8(v, CC_STATUS) = STATUS_FAILED;
+    return 0;
+  }
+  *cc16(v, CC_MSIX) = MSIX_NONE;
+  if(g_msix[0] && !vnet_msix_mapped(v)) {
+    pci_disable_msix(&dev);
+    for(u16 i = 0; i < 2; i++) {
+      *cc16(v, CC_Q_SELECT) = i;
+      *cc16(v, CC_Q_MSIX)   = MSIX_NONE;
+      irq_free_vector(g_msix[i]);
+      g_msix[i] = 0;
+    }
+  }
+
+  static const u8 fallback_mac[ETH_ALEN] = {0x02, 0, 0, 0, 0, 0x01};
+  for(u32 i = 0; i < ETH_ALEN; i++)
+    v->nif.mac[i] = want & F_NET_MAC ? v->devcfg[i] : fallback_mac[i];
+  v->nif.tx_csum = !!(want & F_NET_CSUM);
+  v->nif.xmit    = vnet_xmit;
+  net_attach(&v->nif);
+  *cc8(v, CC_STATUS) |= STATUS_DRIVER_OK;
+  g_nvnet             = 1;
+
+  /* Without MSI-X or a usable line, virtio_net_tick() polls the queues. */
+  g_irq_ok = g_msix[0] || (dev.irq < PIC_IRQ_LINE_COUNT &&
+                           irq_register(dev.irq, vnet_irq));
+  if(g_irq_ok && !g_msix[0])
+    pic_unmask(dev.irq);
+
+  vnet_rx_refill(v);
+
+  const u8 *m  = v->nif.mac;
+  u32       ip = v->nif.ip;
+  console_printf(
+      "[VIRTIO] Network device: %x:%x:%x:%x:%x:%x, %d.%d.%d.%d, %s %d%s\n",
+      m[0], m[1], m[2], m[3], m[4], m[5], (int)(ip >> 24),
+      (int)(ip >> 16 & 0xFF), (int)(ip >> 8 & 0xFF), (int)(ip & 0xFF),
+      g_msix[0] ? "MSI-X" : "IRQ",
+      g_msix[0] ? (int)g_msix[0] : g_irq_ok ? (int)dev.irq : -1,
+      v->nif.tx_csum ? ", checksum offload" : ""
+  );
+  return g_nvnet;
+}
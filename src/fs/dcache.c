@@ -0,0 +1,156 @@
+/**
+ * @file src/fs/dcache.c
+ * @brief Directory entry cache for path lookups.
+ *
+ * A fixed pool of entries lives in a hash table keyed by (volume,
+ * directory, name) and on one LRU list. A lookup moves its entry to the
+ * front; when the pool is full the least recently used entry is reused.
+ */
+
+#include <alcor2/fs/dcache.h>
+#include <alcor2/kstdlib.h>
+
+/** @brief Cached names at most. */
+#define DCACHE_ENTRIES 512
+/** @brief log2 of the hash bucket count. */
+#define DCACHE_HASH_BITS 8
+#define DCACHE_HASH_SIZE (1U << DCACHE_HASH_BITS)
+
+/** @brief One cached name. */
+typedef struct dentry
+{
+  const void    *volume;                    /**< Volume (mount fs_data). */
+  u64            dir;                       /**< Directory inode number. */
+  u64            ino;                       /**< Target inode, 0 = none. */
+  u8             type;                      /**< Entry type. */
+  u8             len;                       /**< Name length. */
+  char           name[DCACHE_NAME_MAX + 1]; /**< Name, NUL-terminated. */
+  struct dentry *hnext;                     /**< Hash chain. */
+  struct dentry *prev;                      /**< LRU list (head = newest). */
+  struct dentry *next;
+} dentry_t;
+
+static dentry_t  pool[DCACHE_ENTRIES];
+static u32       nr_used;
+static dentry_t *buckets[DCACHE_HASH_SIZE];
+static dentry_t *lru_head;
+static dentry_t *lru_tail;
+
+static u32 dcache_hash(const void *volume, u64 dir, const char *name, u32 len)
+{
+  u64 h = (u64)volume ^ (dir * 0x9E3779B97F4A7C15ULL);
+  for(u32 i = 0; i < len; i++)
+    h = (h ^ (u8)name[i]) * 0x100000001B3ULL;
+  return (u32)((h ^ (h >> 29)) & (DCACHE_HASH_SIZE - 1));
+}
+
+static void lru_unlink(dentry_t *de)
+{
+  if(de->prev)
+    de->prev->next = de->next;
+  else
+    lru_head = de->next;
+  if(de->next)
+    de->next->prev = de->prev;
+  else
+    lru_tail = de->prev;
+  de->prev = de->next = NULL;
+}
+
+static void lru_push(dentry_t *de)
+{
+  de->prev = NULL;
+  de->next = lru_head;
+  if(lru_head)
+    lru_head->prev = de;
+  lru_head = de;
+  if(!lru_tail)
+    lru_tail = de;
+}
+
+static void dcache_unhash(dentry_t *de)
+{
+  dentry_t **link =
+      &buckets[dcache_hash(de->volume, de->dir, de->name, de->len)];
+  while(*link != de)
+    link = &(*link)->hnext;
+  *link = de->hnext;
+}
+
+static dentry_t *
+    dcache_find(const void *volume, u64 dir, const char *name, u32 len)
+{
+  for(dentry_t *de = buckets[dcache_hash(volume, dir, name, len)]; de;
+      de           = de->hnext) {
+    if(de->volume == volume && de->dir == dir && de->len == len &&
+       kstrncmp(de->name, name, len) == 0)
+      return de;
+  }
+  return NULL;
+}
+
+bool dcache_lookup(
+    const void *volume, u64 dir, const char *name, u64 *ino, u8 *type
+)
+{
+  u64 len = kstrlen(name);
+  if(len > DCACHE_NAME_MAX)
+    return false;
+
+  dentry_t *de = dcache_find(volume, dir, name, (u32)len);
+  if(!de)
+    return false;
+
+  lru_unlink(de);
+  lru_push(de);
+  *ino  = de->ino;
+  *type = de->type;
+  return true;
+}
+
+void dcache_add(
+    const void *volume, u64 dir, const char *name, u64 ino, u8 type
+)
+{
+  u64 len = kstrlen(name);
+  if(len > DCACHE_NAME_MAX)
+    return;
+
+  dentry_t *de = dcache_find(volume, dir, name, (u32)len);
+  if(de) {
+    lru_unlink(de);
+  } else {
+    if(nr_used < DCACHE_ENTRIES) {
+      de = &pool[nr_used++];
+    } else {
+      de = lru_tail;
+      if(de->volume)
+        dcache_unhash(de);
+      lru_unlink(de);
+    }
+    de->volume = volume;
+    de->dir    = dir;
+    de->len    = (u8)len;
+    kmemcpy(de->name, name, len);
+    de->name[len] = '\0';
+
+    u32 b      = dcache_hash(volume, dir, name, (u32)len);
+    de->hnext  = buckets[b];
+    buckets[b] = de;
+  }
+  de->ino  = ino;
+  de->type = type;
+  lru_push(de);
+}
+
+void dcache_drop_dir(const void *volume, u64 dir)
+{
+  /* Unhashed entries stay on the LRU list until they are reused. */
+  for(u32 i = 0; i < nr_used; i++) {
+    if(pool[i].volume == volume && pool[i].dir == dir) {
+      dcache_unhash(&pool[i]);
+      pool[i].volume = NULL;
+      pool[i].hnext  = NULL;
+    }
+  }
+}
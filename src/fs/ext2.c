@@ -16,13 +16,18 @@
  * - No journal support
  */
 
+#include <alcor2/arch/pit.h>
 #include <alcor2/drivers/ata.h>
 #include <alcor2/drivers/console.h>
 #include <alcor2/errno.h>
+#include <alcor2/fs/dcache.h>
 #include <alcor2/fs/ext2.h>
 #include <alcor2/fs/vfs.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/sys/trace.h>
 
 /** @brief Maximum mounted ext2 volumes. */
 #define EXT2_MAX_VOLUMES 4
@@ -36,9 +41,12 @@
 /** @brief Maximum supported block size (for cache). */
 #define EXT2_MAX_BLOCK_SIZE 4096
 
-/** @brief Max contiguous blocks coalesced in a single read (16 x 4 KB). */
+/** @brief Max blocks probed for contiguity when a file has no run map. */
 #define EXT2_READ_RUN_MAX 16
 
+/** @brief Most runs a run map holds; more fragmented files probe instead. */
+#define EXT2_RUNS_MAX 1024
+
 /** @brief Pool of mounted volumes. */
 static ext2_volume_t g_volumes[EXT2_MAX_VOLUMES];
 
@@ -161,24 +169,27 @@ static i64 vol_write_block(const ext2_volume_t *vol, u32 block, const void *buf)
 }
 
 /**
- * @brief Write superblock back to disk.
+ * @brief Write the superblock back to disk.
+ *
+ * The free counts are summed from the group descriptors here rather than
+ * kept up to date on every allocation.
+ *
  * @param vol Volume with modified superblock.
  * @return 0 on success, negative on error.
  */
 static i64 write_superblock(ext2_volume_t *vol)
 {
-  u8 buf[EXT2_MIN_BLOCK_SIZE];
-
-  /* Read the block containing superblock */
-  if(vol_read_sectors(vol, 2, 2, buf) < 0) {
-    return -EIO;
+  u32 free_blocks = 0;
+  u32 free_inodes = 0;
+  for(u32 g = 0; g < vol->groups_count; g++) {
+    free_blocks += vol->groups[g].bg_free_blocks_count;
+    free_inodes += vol->groups[g].bg_free_inodes_count;
   }
+  vol->sb.s_free_blocks_count = free_blocks;
+  vol->sb.s_free_inodes_count = free_inodes;
 
-  /* Copy superblock to buffer */
-  kmemcpy(buf, &vol->sb, sizeof(ext2_superblock_t));
-
-  /* Write back */
-  if(vol_write_sectors(vol, 2, 2, buf) < 0) {
+  /* The superblock fills sectors 2-3 exactly */
+  if(vol_write_sectors(vol, 2, 2, &vol->sb) < 0) {
     return -EIO;
   }
 
@@ -186,7 +197,7 @@ static i64 write_superblock(ext2_volume_t *vol)
 }
 
 /**
- * @brief Write group descriptor table back to disk.
+ * @brief Write the modified blocks of the group descriptor table.
  * @param vol Volume.
  * @return 0 on success, negative on error.
  */
@@ -203,6 +214,9 @@ static i64 write_group_descriptors(ext2_volume_t *vol)
   u32 groups_per_block = vol->block_size / sizeof(ext2_group_desc_t);
 
   for(u32 b = 0; b < blocks_needed; b++) {
+    if(!vol->gdt_dirty[b])
+      continue;
+
     kzero(buf, vol->block_size);
     u32 start_group = b * groups_per_block;
     u32 count       = vol->groups_count - start_group;
@@ -215,12 +229,28 @@ static i64 write_group_descriptors(ext2_volume_t *vol)
       kfree(buf);
       return -EIO;
     }
+    vol->gdt_dirty[b] = 0;
   }
 
   kfree(buf);
   return 0;
 }
 
+/**
+ * @brief Note that a group's descriptor (and so the free counts) changed.
+ * @param vol Volume.
+ * @param group Group number.
+ */
+static void group_changed(ext2_volume_t *vol, u32 group)
+{
+  u32 groups_per_block = vol->block_size / sizeof(ext2_group_desc_t);
+
+  vol->gdt_dirty[group / groups_per_block] = 1;
+  vol->sb_dirty                            = true;
+  if(vol->meta_changes++ == 0)
+    vol->meta_since = pit_get_ticks();
+}
+
 /** @brief Set a bit in a bitmap. */
 static inline void bitmap_set(u8 *bitmap, u32 bit)
 {
@@ -233,59 +263,173 @@ static inline void bitmap_clear(u8 *bitmap, u32 bit)
   bitmap[bit >> 3] &= (u8) ~(1 << (bit & 7));
 }
 
-/** @brief Test if a bit is set in a bitmap. */
-static inline bool bitmap_test(const u8 *bitmap, u32 bit)
-    __attribute__((unused));
-static inline bool bitmap_test(const u8 *bitmap, u32 bit)
+/**
+ * @brief Find the first clear bit at or after @p start.
+ *
+ * Scans a 64-bit word at a time; bitmaps are whole blocks from kmalloc(),
+ * so every word touched is inside the buffer.
+ *
+ * @param bitmap Bitmap buffer.
+ * @param size   Number of bits in the bitmap.
+ * @param start  First bit to consider.
+ * @return Bit index if found, (u32)-1 if all bits are set.
+ */
+static u32 bitmap_find_clear(const u8 *bitmap, u32 size, u32 start)
 {
-  return (bitmap[bit >> 3] & (1 << (bit & 7))) != 0;
+  const u64 *words = (const u64 *)bitmap;
+  for(u32 bit = start; bit < size; bit = (bit & ~63U) + 64) {
+    u64 free = ~words[bit / 64] & (~0ULL << (bit % 64));
+    if(free) {
+      u32 found = (bit & ~63U) + (u32)__builtin_ctzll(free);
+      return found < size ? found : (u32)-1;
+    }
+  }
+  return (u32)-1;
 }
 
 /**
- * @brief Find first clear bit in bitmap.
+ * @brief Count the clear bits starting at @p start.
  * @param bitmap Bitmap buffer.
- * @param size   Number of bits to scan.
- * @return Bit index if found, (u32)-1 if all bits are set.
+ * @param size   Number of bits in the bitmap.
+ * @param start  First bit (clear).
+ * @param max    Stop counting here.
+ * @return Length of the clear run, at most @p max.
  */
-static u32 bitmap_find_clear(const u8 *bitmap, u32 size)
+static u32 bitmap_clear_run(const u8 *bitmap, u32 size, u32 start, u32 max)
 {
-  for(u32 byte = 0; byte < (size + 7) / 8; byte++) {
-    if(bitmap[byte] != 0xFF) {
-      /* Found a byte with a clear bit */
-      for(u32 bit = 0; bit < 8 && (byte * 8 + bit) < size; bit++) {
-        if(!(bitmap[byte] & (1 << bit))) {
-          return byte * 8 + bit;
-        }
-      }
+  const u64 *words = (const u64 *)bitmap;
+  u32        end   = size - start > max ? start + max : size;
+  u32        bit   = start;
+  while(bit < end) {
+    u64 used = words[bit / 64] >> (bit % 64);
+    if(used) {
+      bit += (u32)__builtin_ctzll(used);
+      break;
     }
+    bit = (bit & ~63U) + 64;
   }
-  return (u32)-1;
+  return (bit < end ? bit : end) - start;
 }
 
+/**
+ * @brief Get a group's block or inode bitmap, reading it on first use.
+ * @param vol    Volume.
+ * @param group  Group number.
+ * @param inodes True for the inode bitmap.
+ * @return Cached bitmap, or NULL on allocation or read failure.
+ */
+static ext2_bitmap_t *group_bitmap(ext2_volume_t *vol, u32 group, bool inodes)
+{
+  ext2_bitmap_t *bm = inodes ? &vol->inode_bitmaps[group]
+                             : &vol->block_bitmaps[group];
+  if(bm->bits)
+    return bm;
+
+  const ext2_group_desc_t *gd = &vol->groups[group];
+  u8                      *bits = kmalloc(vol->block_size);
+  if(!bits)
+    return NULL;
+
+  u32 block = inodes ? gd->bg_inode_bitmap : gd->bg_block_bitmap;
+  if(vol_read_block(vol, block, bits) < 0) {
+    kfree(bits);
+    return NULL;
+  }
+
+  bm->bits  = bits;
+  bm->dirty = false;
+  return bm;
+}
+
+/**
+ * @brief Write every modified group bitmap back to disk.
+ * @param vol Volume.
+ * @return 0 on success, negative errno on error.
+ */
+static i64 write_bitmaps(ext2_volume_t *vol)
+{
+  for(u32 g = 0; g < vol->groups_count; g++) {
+    ext2_bitmap_t *maps[2] = {&vol->block_bitmaps[g], &vol->inode_bitmaps[g]};
+    u32 blocks[2] = {vol->groups[g].bg_block_bitmap,
+                     vol->groups[g].bg_inode_bitmap};
+
+    for(u32 i = 0; i < 2; i++) {
+      if(!maps[i]->dirty)
+        continue;
+      if(vol_write_block(vol, blocks[i], maps[i]->bits) < 0)
+        return -EIO;
+      maps[i]->dirty = false;
+    }
+  }
+  return 0;
+}
+
+/** @brief Metadata updates that force a flush. */
+#define EXT2_META_FLUSH_CHANGES 256
+/** @brief Oldest unflushed metadata update allowed (5 s at 100 Hz). */
+#define EXT2_META_FLUSH_TICKS 500
+
 /**
  * @brief Flush volume metadata to disk.
  *
- * Writes superblock and group descriptor table.
+ * Writes dirty group bitmaps, the group descriptor blocks that changed and
+ * the superblock.
  *
  * @param vol Volume to flush.
  * @return 0 on success, negative errno on error.
  */
 static i64 flush_metadata(ext2_volume_t *vol)
 {
-  i64 ret = write_superblock(vol);
+  if(vol->meta_changes == 0)
+    return 0;
+
+  i64 ret = write_bitmaps(vol);
+  if(ret < 0)
+    return ret;
+
+  ret = write_group_descriptors(vol);
   if(ret < 0)
     return ret;
 
-  return write_group_descriptors(vol);
+  if(vol->sb_dirty) {
+    ret = write_superblock(vol);
+    if(ret < 0)
+      return ret;
+    vol->sb_dirty = false;
+  }
+
+  vol->meta_changes = 0;
+  return 0;
 }
 
 /**
- * @brief Allocate a block from a specific group.
+ * @brief Flush metadata once enough updates piled up or the oldest one
+ *        is old enough; sync and fsync flush unconditionally.
  * @param vol Volume.
+ * @return 0 on success, negative errno on error.
+ */
+static i64 metadata_tick(ext2_volume_t *vol)
+{
+  if(vol->meta_changes == 0)
+    return 0;
+  if(vol->meta_changes < EXT2_META_FLUSH_CHANGES &&
+     pit_get_ticks() - vol->meta_since < EXT2_META_FLUSH_TICKS)
+    return 0;
+  return flush_metadata(vol);
+}
+
+/**
+ * @brief Allocate a run of blocks from a specific group.
+ * @param vol   Volume.
  * @param group Group number.
- * @return Block number, or 0 on failure.
+ * @param start Bit to start searching from (the goal within the group).
+ * @param max   Blocks wanted.
+ * @param count Output: blocks allocated (contiguous, at most @p max).
+ * @return First block number, or 0 on failure.
  */
-static u32 alloc_block_in_group(ext2_volume_t *vol, u32 group)
+static u32 alloc_blocks_in_group(
+    ext2_volume_t *vol, u32 group, u32 start, u32 max, u32 *count
+)
 {
   if(group >= vol->groups_count)
     return 0;
@@ -294,34 +438,61 @@ static u32 alloc_block_in_group(ext2_volume_t *vol, u32 group)
   if(gd->bg_free_blocks_count == 0)
     return 0;
 
-  u8 *bitmap = kmalloc(vol->block_size);
-  if(!bitmap)
+  ext2_bitmap_t *bm = group_bitmap(vol, group, false);
+  if(!bm)
     return 0;
 
-  if(vol_read_block(vol, gd->bg_block_bitmap, bitmap) < 0) {
-    kfree(bitmap);
+  u32 size = vol->blocks_per_group;
+  u32 bit  = bitmap_find_clear(bm->bits, size, start);
+  if(bit == (u32)-1 && start > 0)
+    bit = bitmap_find_clear(bm->bits, size, 0);
+  if(bit == (u32)-1)
     return 0;
-  }
 
-  u32 bit = bitmap_find_clear(bitmap, vol->blocks_per_group);
-  if(bit == (u32)-1) {
-    kfree(bitmap);
-    return 0;
-  }
+  u32 n = bitmap_clear_run(bm->bits, size, bit, max);
+  if(n > gd->bg_free_blocks_count)
+    n = gd->bg_free_blocks_count;
+  for(u32 i = 0; i < n; i++)
+    bitmap_set(bm->bits, bit + i);
+  bm->dirty = true;
 
-  bitmap_set(bitmap, bit);
+  gd->bg_free_blocks_count -= (u16)n;
+  group_changed(vol, group);
 
-  if(vol_write_block(vol, gd->bg_block_bitmap, bitmap) < 0) {
-    kfree(bitmap);
-    return 0;
+  *count = n;
+  return group * vol->blocks_per_group + bit + vol->first_data_block;
+}
+
+/**
+ * @brief Allocate up to @p max contiguous blocks, as close to @p goal as
+ *        the goal's group allows.
+ * @param vol   Volume.
+ * @param goal  Preferred first block (e.g. the one after the file's last).
+ * @param max   Blocks wanted (at least 1).
+ * @param count Output: blocks allocated.
+ * @return First block number, or 0 if the volume is full.
+ */
+static u32 alloc_blocks(ext2_volume_t *vol, u32 goal, u32 max, u32 *count)
+{
+  u32 group = 0;
+  u32 start = 0;
+  if(goal >= vol->first_data_block && goal < vol->blocks_count) {
+    group = (goal - vol->first_data_block) / vol->blocks_per_group;
+    start = (goal - vol->first_data_block) % vol->blocks_per_group;
   }
 
-  kfree(bitmap);
+  /* Try the goal's group first */
+  u32 block = alloc_blocks_in_group(vol, group, start, max, count);
 
-  gd->bg_free_blocks_count--;
-  vol->sb.s_free_blocks_count--;
+  /* Search all groups */
+  for(u32 g = 0; !block && g < vol->groups_count; g++) {
+    if(g != group)
+      block = alloc_blocks_in_group(vol, g, 0, max, count);
+  }
 
-  u32 block = group * vol->blocks_per_group + bit + vol->first_data_block;
+  /* The new blocks are about to be linked in: cached block maps go stale. */
+  if(block)
+    vol->alloc_gen++;
   return block;
 }
 
@@ -333,21 +504,9 @@ static u32 alloc_block_in_group(ext2_volume_t *vol, u32 group)
  */
 static u32 alloc_block(ext2_volume_t *vol, u32 preferred_group)
 {
-  /* Try preferred group first */
-  u32 block = alloc_block_in_group(vol, preferred_group);
-  if(block)
-    return block;
-
-  /* Search all groups */
-  for(u32 g = 0; g < vol->groups_count; g++) {
-    if(g == preferred_group)
-      continue;
-    block = alloc_block_in_group(vol, g);
-    if(block)
-      return block;
-  }
-
-  return 0;
+  u32 count;
+  u32 goal = preferred_group * vol->blocks_per_group + vol->first_data_block;
+  return alloc_blocks(vol, goal, 1, &count);
 }
 
 /**
@@ -365,27 +524,16 @@ static i64 free_block(ext2_volume_t *vol, u32 block)
   u32 bit   = (block - vol->first_data_block) % vol->blocks_per_group;
 
   ext2_group_desc_t *gd = &vol->groups[group];
-
-  u8                *bitmap = kmalloc(vol->block_size);
-  if(!bitmap)
-    return -ENOMEM;
-
-  if(vol_read_block(vol, gd->bg_block_bitmap, bitmap) < 0) {
-    kfree(bitmap);
-    return -EIO;
-  }
-
-  bitmap_clear(bitmap, bit);
-
-  if(vol_write_block(vol, gd->bg_block_bitmap, bitmap) < 0) {
-    kfree(bitmap);
+  ext2_bitmap_t     *bm = group_bitmap(vol, group, false);
+  if(!bm)
     return -EIO;
-  }
 
-  kfree(bitmap);
+  bitmap_clear(bm->bits, bit);
+  bm->dirty = true;
 
   gd->bg_free_blocks_count++;
-  vol->sb.s_free_blocks_count++;
+  group_changed(vol, group);
+  vol->alloc_gen++;
 
   return 0;
 }
@@ -406,34 +554,21 @@ static u32 alloc_inode_in_group(ext2_volume_t *vol, u32 group, bool is_dir)
   if(gd->bg_free_inodes_count == 0)
     return 0;
 
-  u8 *bitmap = kmalloc(vol->block_size);
-  if(!bitmap)
-    return 0;
-
-  if(vol_read_block(vol, gd->bg_inode_bitmap, bitmap) < 0) {
-    kfree(bitmap);
-    return 0;
-  }
-
-  u32 bit = bitmap_find_clear(bitmap, vol->inodes_per_group);
-  if(bit == (u32)-1) {
-    kfree(bitmap);
+  ext2_bitmap_t *bm = group_bitmap(vol, group, true);
+  if(!bm)
     return 0;
-  }
-
-  bitmap_set(bitmap, bit);
 
-  if(vol_write_block(vol, gd->bg_inode_bitmap, bitmap) < 0) {
-    kfree(bitmap);
+  u32 bit = bitmap_find_clear(bm->bits, vol->inodes_per_group, 0);
+  if(bit == (u32)-1)
     return 0;
-  }
 
-  kfree(bitmap);
+  bitmap_set(bm->bits, bit);
+  bm->dirty = true;
 
   gd->bg_free_inodes_count--;
-  vol->sb.s_free_inodes_count--;
   if(is_dir)
     gd->bg_used_dirs_count++;
+  group_changed(vol, group);
 
   u32 inode = group * vol->inodes_per_group + bit + 1;
   return inode;
@@ -463,6 +598,103 @@ static u32 alloc_inode(ext2_volume_t *vol, u32 preferred_group, bool is_dir)
   return 0;
 }
 
+/** @brief Cached inodes at most; open files pin theirs. */
+#define EXT2_ICACHE_SIZE 512
+/** @brief Inode cache hash buckets. */
+#define EXT2_ICACHE_HASH 128
+
+static ext2_cinode_t  g_icache[EXT2_ICACHE_SIZE];
+static u32            g_icache_used;
+static ext2_cinode_t *g_ihash[EXT2_ICACHE_HASH];
+static ext2_cinode_t *g_ilru_head; /* unreferenced, most recent first */
+static ext2_cinode_t *g_ilru_tail;
+
+static inline u32 icache_hash(const ext2_volume_t *vol, u32 ino)
+{
+  return (u32)(((u64)vol >> 4) ^ (ino * 2654435761u)) % EXT2_ICACHE_HASH;
+}
+
+static ext2_cinode_t *icache_find(const ext2_volume_t *vol, u32 ino)
+{
+  for(ext2_cinode_t *ci = g_ihash[icache_hash(vol, ino)]; ci;
+      ci                = ci->hnext) {
+    if(ci->vol == vol && ci->ino == ino)
+      return ci;
+  }
+  return NULL;
+}
+
+static void icache_lru_unlink(ext2_cinode_t *ci)
+{
+  if(ci->prev)
+    ci->prev->next = ci->next;
+  else
+    g_ilru_head = ci->next;
+  if(ci->next)
+    ci->next->prev = ci->prev;
+  else
+    g_ilru_tail = ci->prev;
+  ci->prev = ci->next = NULL;
+}
+
+static void icache_lru_push(ext2_cinode_t *ci)
+{
+  ci->prev = NULL;
+  ci->next = g_ilru_head;
+  if(g_ilru_head)
+    g_ilru_head->prev = ci;
+  g_ilru_head = ci;
+  if(!g_ilru_tail)
+    g_ilru_tail = ci;
+}
+
+/* Remove @p ci from its hash chain; it stays on the LRU list for reuse. */
+static void icache_unhash(ext2_cinode_t *ci)
+{
+  ext2_cinode_t **link = &g_ihash[icache_hash(ci->vol, ci->ino)];
+  while(*link != ci)
+    link = &(*link)->hnext;
+  *link   = ci->hnext;
+  ci->vol = NULL;
+}
+
+/**
+ * @brief Cache an inode as unreferenced, reusing the LRU entry if full.
+ * @param vol Volume.
+ * @param ino Inode number.
+ * @param inode Inode contents.
+ * @return Entry, or NULL when every entry is pinned by an open handle.
+ */
+static ext2_cinode_t *icache_insert(
+    const ext2_volume_t *vol, u32 ino, const ext2_inode_t *inode
+)
+{
+  ext2_cinode_t *ci = NULL;
+  if(g_icache_used < EXT2_ICACHE_SIZE) {
+    ci = &g_icache[g_icache_used++];
+    icache_lru_push(ci);
+  } else if(g_ilru_tail) {
+    ci = g_ilru_tail;
+    if(ci->vol)
+      icache_unhash(ci);
+    icache_lru_unlink(ci);
+    icache_lru_push(ci);
+  } else {
+    return NULL;
+  }
+
+  u32 b      = icache_hash(vol, ino);
+  ci->vol    = vol;
+  ci->ino    = ino;
+  ci->refs   = 0;
+  ci->dirty  = false;
+  ci->inode  = *inode;
+  ci->pa     = (ext2_prealloc_t){0};
+  ci->hnext  = g_ihash[b];
+  g_ihash[b] = ci;
+  return ci;
+}
+
 /**
  * @brief Free an inode.
  * @param vol Volume.
@@ -479,35 +711,28 @@ static i64 free_inode(ext2_volume_t *vol, u32 ino, bool is_dir)
   u32                bit   = (ino - 1) % vol->inodes_per_group;
 
   ext2_group_desc_t *gd = &vol->groups[group];
-
-  u8                *bitmap = kmalloc(vol->block_size);
-  if(!bitmap)
-    return -ENOMEM;
-
-  if(vol_read_block(vol, gd->bg_inode_bitmap, bitmap) < 0) {
-    kfree(bitmap);
-    return -EIO;
-  }
-
-  bitmap_clear(bitmap, bit);
-
-  if(vol_write_block(vol, gd->bg_inode_bitmap, bitmap) < 0) {
-    kfree(bitmap);
+  ext2_bitmap_t     *bm = group_bitmap(vol, group, true);
+  if(!bm)
     return -EIO;
-  }
 
-  kfree(bitmap);
+  bitmap_clear(bm->bits, bit);
+  bm->dirty = true;
 
   gd->bg_free_inodes_count++;
-  vol->sb.s_free_inodes_count++;
   if(is_dir && gd->bg_used_dirs_count > 0)
     gd->bg_used_dirs_count--;
+  group_changed(vol, group);
+
+  /* Forget the contents unless a handle still holds the inode open. */
+  ext2_cinode_t *ci = icache_find(vol, ino);
+  if(ci && ci->refs == 0)
+    icache_unhash(ci);
 
   return 0;
 }
 
 /**
- * @brief Read an inode from disk.
+ * @brief Read an inode, from the inode cache when it holds it.
  * @param vol Volume.
  * @param ino Inode number.
  * @param inode Output inode structure.
@@ -518,6 +743,16 @@ static i64 read_inode(const ext2_volume_t *vol, u32 ino, ext2_inode_t *inode)
   if(ino < 1 || ino > vol->inodes_count)
     return -EINVAL;
 
+  ext2_cinode_t *ci = icache_find(vol, ino);
+  if(ci) {
+    if(ci->refs == 0) {
+      icache_lru_unlink(ci);
+      icache_lru_push(ci);
+    }
+    *inode = ci->inode;
+    return 0;
+  }
+
   u32 group       = (ino - 1) / vol->inodes_per_group;
   u32 index       = (ino - 1) % vol->inodes_per_group;
   u32 inode_table = vol->groups[group].bg_inode_table;
@@ -538,11 +773,12 @@ static i64 read_inode(const ext2_volume_t *vol, u32 ino, ext2_inode_t *inode)
   kmemcpy(inode, buf + offset, sizeof(ext2_inode_t));
   kfree(buf);
 
+  icache_insert(vol, ino, inode);
   return 0;
 }
 
 /**
- * @brief Write an inode to disk.
+ * @brief Write an inode to disk and to the inode cache.
  * @param vol Volume.
  * @param ino Inode number.
  * @param inode Inode structure.
@@ -579,18 +815,102 @@ static i64
   }
 
   kfree(buf);
+
+  ext2_cinode_t *ci = icache_find(vol, ino);
+  if(!ci)
+    icache_insert(vol, ino, inode);
+  else if(inode != &ci->inode)
+    ci->inode = *inode;
   return 0;
 }
 
+/**
+ * @brief Take a reference on an inode, pinning it in the inode cache.
+ * @param vol Volume.
+ * @param ino Inode number.
+ * @return Shared inode, or NULL on I/O error or when the cache is full of
+ *         pinned inodes.
+ */
+static ext2_cinode_t *inode_get(const ext2_volume_t *vol, u32 ino)
+{
+  ext2_inode_t inode;
+  if(read_inode(vol, ino, &inode) < 0)
+    return NULL;
+
+  ext2_cinode_t *ci = icache_find(vol, ino);
+  if(ci && ci->refs++ == 0)
+    icache_lru_unlink(ci);
+  return ci;
+}
+
+/**
+ * @brief Drop a reference taken with inode_get().
+ * @param ci Shared inode.
+ */
+static void inode_put(ext2_cinode_t *ci)
+{
+  if(--ci->refs == 0)
+    icache_lru_push(ci);
+}
+
+/**
+ * @brief Read entry @p idx of pointer block @p block.
+ *
+ * With a block map the block is kept in slot @p level, so the next lookup
+ * through the same pointer block costs no read or allocation.
+ *
+ * @param vol   Volume.
+ * @param map   Open file's block map, or NULL.
+ * @param level Map slot (levels above the data blocks, 0-2).
+ * @param block Pointer block number (0 = hole).
+ * @param idx   Entry index.
+ * @return Block number, or 0 if not allocated.
+ */
+static u32 read_block_ptr(
+    const ext2_volume_t *vol, ext2_block_map_t *map, u32 level, u32 block,
+    u32 idx
+)
+{
+  if(block == 0)
+    return 0;
+
+  if(map && map->gen != vol->alloc_gen) {
+    kzero(map->block, sizeof(map->block));
+    map->gen = vol->alloc_gen;
+  }
+  if(map && !map->ptrs)
+    map->ptrs = kmalloc((u64)EXT2_MAP_LEVELS * vol->block_size);
+
+  if(map && map->ptrs) {
+    u32 *ptrs = map->ptrs + level * (vol->block_size / 4);
+    if(map->block[level] != block) {
+      map->block[level] = 0;
+      if(vol_read_block(vol, block, ptrs) < 0)
+        return 0;
+      map->block[level] = block;
+    }
+    return ptrs[idx];
+  }
+
+  u32 *ptrs = kmalloc(vol->block_size);
+  if(!ptrs)
+    return 0;
+  u32 result = vol_read_block(vol, block, ptrs) < 0 ? 0 : ptrs[idx];
+  kfree(ptrs);
+  return result;
+}
+
 /**
  * @brief Get block number for a given file block index.
  * @param vol Volume.
  * @param inode Inode.
+ * @param map Open file's block map, or NULL to read pointer blocks afresh.
  * @param file_block File block index.
  * @return Block number, or 0 if not allocated.
  */
 static u32 get_block_num(
-    const ext2_volume_t *vol, const ext2_inode_t *inode, u32 file_block
+    const ext2_volume_t *vol, const ext2_inode_t *inode, ext2_block_map_t *map,
+    u32 file_block
 )
 {
   u32 ptrs_per_block = vol->block_size / 4;
@@ -603,406 +923,393 @@ static u32 get_block_num(
   file_block -= EXT2_NDIR_BLOCKS;
 
   /* Single indirect */
-  if(file_block < ptrs_per_block) {
-    if(inode->i_block[EXT2_IND_BLOCK] == 0)
-      return 0;
-
-    u32 *ind_block = kmalloc(vol->block_size);
-    if(!ind_block)
-      return 0;
-
-    if(vol_read_block(vol, inode->i_block[EXT2_IND_BLOCK], ind_block) < 0) {
-      kfree(ind_block);
-      return 0;
-    }
-
-    u32 result = ind_block[file_block];
-    kfree(ind_block);
-    return result;
-  }
+  if(file_block < ptrs_per_block)
+    return read_block_ptr(
+        vol, map, 0, inode->i_block[EXT2_IND_BLOCK], file_block
+    );
 
   file_block -= ptrs_per_block;
 
   /* Double indirect */
   if(file_block < ptrs_per_block * ptrs_per_block) {
-    if(inode->i_block[EXT2_DIND_BLOCK] == 0)
-      return 0;
-
-    u32 *dind_block = kmalloc(vol->block_size);
-    if(!dind_block)
-      return 0;
-
-    if(vol_read_block(vol, inode->i_block[EXT2_DIND_BLOCK], dind_block) < 0) {
-      kfree(dind_block);
-      return 0;
-    }
-
-    u32 ind_idx       = file_block / ptrs_per_block;
-    u32 ind_block_num = dind_block[ind_idx];
-    kfree(dind_block);
-
-    if(ind_block_num == 0)
-      return 0;
-
-    u32 *ind_block = kmalloc(vol->block_size);
-    if(!ind_block)
-      return 0;
-
-    if(vol_read_block(vol, ind_block_num, ind_block) < 0) {
-      kfree(ind_block);
-      return 0;
-    }
-
-    u32 result = ind_block[file_block % ptrs_per_block];
-    kfree(ind_block);
-    return result;
+    u32 ind = read_block_ptr(
+        vol, map, 1, inode->i_block[EXT2_DIND_BLOCK],
+        file_block / ptrs_per_block
+    );
+    return read_block_ptr(vol, map, 0, ind, file_block % ptrs_per_block);
   }
 
   file_block -= ptrs_per_block * ptrs_per_block;
 
   /* Triple indirect */
-  if(inode->i_block[EXT2_TIND_BLOCK] == 0)
-    return 0;
-
-  u32 *tind_block = kmalloc(vol->block_size);
-  if(!tind_block)
-    return 0;
-
-  if(vol_read_block(vol, inode->i_block[EXT2_TIND_BLOCK], tind_block) < 0) {
-    kfree(tind_block);
-    return 0;
-  }
-
-  u32 dind_idx       = file_block / (ptrs_per_block * ptrs_per_block);
-  u32 dind_block_num = tind_block[dind_idx];
-  kfree(tind_block);
-
-  if(dind_block_num == 0)
-    return 0;
+  u32 dind = read_block_ptr(
+      vol, map, 2, inode->i_block[EXT2_TIND_BLOCK],
+      file_block / (ptrs_per_block * ptrs_per_block)
+  );
+  u32 ind = read_block_ptr(
+      vol, map, 1, dind, (file_block / ptrs_per_block) % ptrs_per_block
+  );
+  return read_block_ptr(vol, map, 0, ind, file_block % ptrs_per_block);
+}
 
-  u32 *dind_block = kmalloc(vol->block_size);
-  if(!dind_block)
-    return 0;
+/**
+ * @brief Record that the block tree of inode @p ino changed.
+ *
+ * Open handles holding a run map of the inode stop using it.
+ */
+static inline void tree_changed(ext2_volume_t *vol, u32 ino)
+{
+  vol->tree_gen[ino % EXT2_TREE_GEN_SLOTS]++;
+}
 
-  if(vol_read_block(vol, dind_block_num, dind_block) < 0) {
-    kfree(dind_block);
-    return 0;
+/**
+ * @brief Decode a file's whole block tree into runs, leaving out holes.
+ * @param file Open regular file.
+ */
+static void build_runs(ext2_file_t *file)
+{
+  const ext2_volume_t *vol    = file->vol;
+  u32                  blocks = (u32)(
+      ((u64)file->ci->inode.i_size + vol->block_size - 1) / vol->block_size
+  );
+  u32         cap  = 16;
+  u32         n    = 0;
+  ext2_run_t *runs = kmalloc(cap * sizeof(ext2_run_t));
+  if(!runs) {
+    file->runs_off = true;
+    return;
   }
 
-  u32 remaining     = file_block % (ptrs_per_block * ptrs_per_block);
-  u32 ind_idx       = remaining / ptrs_per_block;
-  u32 ind_block_num = dind_block[ind_idx];
-  kfree(dind_block);
-
-  if(ind_block_num == 0)
-    return 0;
-
-  u32 *ind_block = kmalloc(vol->block_size);
-  if(!ind_block)
-    return 0;
+  file->runs_gen = vol->tree_gen[file->inode_num % EXT2_TREE_GEN_SLOTS];
+  for(u32 b = 0; b < blocks; b++) {
+    u32 num = get_block_num(vol, &file->ci->inode, &file->map, b);
+    if(num == 0)
+      continue;
 
-  if(vol_read_block(vol, ind_block_num, ind_block) < 0) {
-    kfree(ind_block);
-    return 0;
+    ext2_run_t *last = n ? &runs[n - 1] : NULL;
+    if(last && last->file_block + last->count == b &&
+       last->disk_block + last->count == num) {
+      last->count++;
+      continue;
+    }
+    if(n == cap) {
+      ext2_run_t *grown =
+          cap < EXT2_RUNS_MAX ? krealloc(runs, 2 * cap * sizeof(*runs)) : NULL;
+      if(!grown) {
+        kfree(runs);
+        file->runs_off = true;
+        return;
+      }
+      runs  = grown;
+      cap  *= 2;
+    }
+    runs[n++] = (ext2_run_t){.file_block = b, .disk_block = num, .count = 1};
   }
 
-  u32 result = ind_block[remaining % ptrs_per_block];
-  kfree(ind_block);
-  return result;
+  file->runs  = runs;
+  file->nruns = n;
 }
 
 /**
- * @brief Allocate and set a block for a given file block index.
- * @param vol Volume.
- * @param inode Inode (will be modified).
+ * @brief Map a file block and measure the extent it starts.
+ *
+ * Regular files decode their block tree into a run map on first use, so
+ * the lookup is a binary search; otherwise (directories, fragmented
+ * files, files whose tree changed since) up to EXT2_READ_RUN_MAX blocks
+ * are probed with get_block_num().
+ *
+ * @param file       Open file.
  * @param file_block File block index.
- * @param preferred_group Preferred block group for allocation.
- * @return Block number, or 0 on failure.
+ * @param max        Blocks the caller can use (at least 1).
+ * @param len        Output: blocks from @p file_block on that continue the
+ *                   extent (consecutive on disk, or all holes).
+ * @return Disk block, or 0 for a hole.
  */
-static u32 alloc_file_block(
-    ext2_volume_t *vol, ext2_inode_t *inode, u32 file_block, u32 preferred_group
-)
+static u32 file_extent(ext2_file_t *file, u32 file_block, u32 max, u32 *len)
 {
-  u32 ptrs_per_block = vol->block_size / 4;
-
-  /* Direct blocks */
-  if(file_block < EXT2_NDIR_BLOCKS) {
-    if(inode->i_block[file_block] == 0) {
-      u32 block = alloc_block(vol, preferred_group);
-      if(block == 0)
-        return 0;
-      inode->i_block[file_block] = block;
-      inode->i_blocks += vol->block_size / 512;
-
-      /* Zero the new block */
-      u8 *zero = kmalloc(vol->block_size);
-      if(zero) {
-        kzero(zero, vol->block_size);
-        vol_write_block(vol, block, zero);
-        kfree(zero);
-      }
+  const ext2_volume_t *vol = file->vol;
+  u32 gen = vol->tree_gen[file->inode_num % EXT2_TREE_GEN_SLOTS];
+
+  if(file->runs && file->runs_gen != gen) {
+    kfree(file->runs);
+    file->runs     = NULL;
+    file->runs_off = true;
+  }
+  if(!file->runs && !file->runs_off && !file->is_dir)
+    build_runs(file);
+
+  if(file->runs) {
+    /* First run starting past file_block. */
+    u32 lo = 0;
+    u32 hi = file->nruns;
+    while(lo < hi) {
+      u32 mid = (lo + hi) / 2;
+      if(file->runs[mid].file_block <= file_block)
+        lo = mid + 1;
+      else
+        hi = mid;
     }
-    return inode->i_block[file_block];
-  }
 
-  file_block -= EXT2_NDIR_BLOCKS;
-
-  /* Single indirect */
-  if(file_block < ptrs_per_block) {
-    /* Allocate indirect block if needed */
-    if(inode->i_block[EXT2_IND_BLOCK] == 0) {
-      u32 ind = alloc_block(vol, preferred_group);
-      if(ind == 0)
-        return 0;
-      inode->i_block[EXT2_IND_BLOCK] = ind;
-      inode->i_blocks += vol->block_size / 512;
-
-      u8 *zero = kmalloc(vol->block_size);
-      if(zero) {
-        kzero(zero, vol->block_size);
-        vol_write_block(vol, ind, zero);
-        kfree(zero);
-      }
+    const ext2_run_t *r     = lo ? &file->runs[lo - 1] : NULL;
+    u32               disk  = 0;
+    u32               avail = max;
+    if(r && file_block < r->file_block + r->count) {
+      disk  = r->disk_block + (file_block - r->file_block);
+      avail = r->file_block + r->count - file_block;
+    } else if(lo < file->nruns) {
+      avail = file->runs[lo].file_block - file_block;
     }
-
-    u32 *ind_block = kmalloc(vol->block_size);
-    if(!ind_block)
-      return 0;
-
-    if(vol_read_block(vol, inode->i_block[EXT2_IND_BLOCK], ind_block) < 0) {
-      kfree(ind_block);
-      return 0;
-    }
-
-    if(ind_block[file_block] == 0) {
-      u32 block = alloc_block(vol, preferred_group);
-      if(block == 0) {
-        kfree(ind_block);
-        return 0;
-      }
-      ind_block[file_block] = block;
-      inode->i_blocks += vol->block_size / 512;
-
-      vol_write_block(vol, inode->i_block[EXT2_IND_BLOCK], ind_block);
-
-      u8 *zero = kmalloc(vol->block_size);
-      if(zero) {
-        kzero(zero, vol->block_size);
-        vol_write_block(vol, block, zero);
-        kfree(zero);
-      }
-    }
-
-    u32 result = ind_block[file_block];
-    kfree(ind_block);
-    return result;
+    *len = avail < max ? avail : max;
+    return disk;
   }
 
-  file_block -= ptrs_per_block;
-
-  /* Double indirect */
-  if(file_block < ptrs_per_block * ptrs_per_block) {
-    /* Allocate double indirect block if needed */
-    if(inode->i_block[EXT2_DIND_BLOCK] == 0) {
-      u32 dind = alloc_block(vol, preferred_group);
-      if(dind == 0)
-        return 0;
-      inode->i_block[EXT2_DIND_BLOCK] = dind;
-      inode->i_blocks += vol->block_size / 512;
-
-      u8 *zero = kmalloc(vol->block_size);
-      if(zero) {
-        kzero(zero, vol->block_size);
-        vol_write_block(vol, dind, zero);
-        kfree(zero);
-      }
-    }
-
-    u32 *dind_block = kmalloc(vol->block_size);
-    if(!dind_block)
-      return 0;
-
-    if(vol_read_block(vol, inode->i_block[EXT2_DIND_BLOCK], dind_block) < 0) {
-      kfree(dind_block);
-      return 0;
-    }
-
-    u32 ind_idx = file_block / ptrs_per_block;
-
-    /* Allocate indirect block if needed */
-    if(dind_block[ind_idx] == 0) {
-      u32 ind = alloc_block(vol, preferred_group);
-      if(ind == 0) {
-        kfree(dind_block);
-        return 0;
-      }
-      dind_block[ind_idx] = ind;
-      inode->i_blocks += vol->block_size / 512;
-
-      vol_write_block(vol, inode->i_block[EXT2_DIND_BLOCK], dind_block);
-
-      u8 *zero = kmalloc(vol->block_size);
-      if(zero) {
-        kzero(zero, vol->block_size);
-        vol_write_block(vol, ind, zero);
-        kfree(zero);
-      }
-    }
-
-    u32 ind_block_num = dind_block[ind_idx];
-    kfree(dind_block);
-
-    u32 *ind_block = kmalloc(vol->block_size);
-    if(!ind_block)
-      return 0;
-
-    if(vol_read_block(vol, ind_block_num, ind_block) < 0) {
-      kfree(ind_block);
-      return 0;
-    }
-
-    u32 ind_offset = file_block % ptrs_per_block;
-    if(ind_block[ind_offset] == 0) {
-      u32 block = alloc_block(vol, preferred_group);
-      if(block == 0) {
-        kfree(ind_block);
-        return 0;
-      }
-      ind_block[ind_offset] = block;
-      inode->i_blocks += vol->block_size / 512;
-
-      vol_write_block(vol, ind_block_num, ind_block);
-
-      u8 *zero = kmalloc(vol->block_size);
-      if(zero) {
-        kzero(zero, vol->block_size);
-        vol_write_block(vol, block, zero);
-        kfree(zero);
-      }
-    }
-
-    u32 result = ind_block[ind_offset];
-    kfree(ind_block);
-    return result;
+  u32 num = get_block_num(vol, &file->ci->inode, &file->map, file_block);
+  u32 n   = 1;
+  if(max > EXT2_READ_RUN_MAX)
+    max = EXT2_READ_RUN_MAX;
+  while(n < max) {
+    u32 next = get_block_num(vol, &file->ci->inode, &file->map, file_block + n);
+    if(next != (num ? num + n : 0))
+      break;
+    n++;
   }
+  *len = n;
+  return num;
+}
 
-  file_block -= ptrs_per_block * ptrs_per_block;
-
-  /* Triple indirect */
-  if(inode->i_block[EXT2_TIND_BLOCK] == 0) {
-    u32 tind = alloc_block(vol, preferred_group);
-    if(tind == 0)
-      return 0;
-    inode->i_block[EXT2_TIND_BLOCK] = tind;
-    inode->i_blocks += vol->block_size / 512;
-
-    u8 *zero = kmalloc(vol->block_size);
-    if(zero) {
-      kzero(zero, vol->block_size);
-      vol_write_block(vol, tind, zero);
-      kfree(zero);
-    }
-  }
+/** @brief Most data blocks one alloc_file_blocks() call hands out. */
+#define EXT2_ALLOC_RUN_MAX 64
+/** @brief Blocks reserved ahead of a growing file. */
+#define EXT2_PREALLOC_BLOCKS 32
 
-  u32 *tind_block = kmalloc(vol->block_size);
-  if(!tind_block)
-    return 0;
+/**
+ * @brief Hand a preallocation window's blocks back to the volume.
+ * @param vol Volume.
+ * @param pa Window (emptied).
+ */
+static void prealloc_discard(ext2_volume_t *vol, ext2_prealloc_t *pa)
+{
+  for(u32 i = 0; i < pa->count; i++)
+    free_block(vol, pa->block + i);
+  pa->block = 0;
+  pa->count = 0;
+}
 
-  if(vol_read_block(vol, inode->i_block[EXT2_TIND_BLOCK], tind_block) < 0) {
-    kfree(tind_block);
-    return 0;
+/**
+ * @brief Allocate blocks for a file, through its preallocation window.
+ *
+ * A window that starts at @p goal serves the request; any other window is
+ * given back, and a fresh allocation reserves EXT2_PREALLOC_BLOCKS more
+ * than asked for.
+ *
+ * @param vol Volume.
+ * @param pa Window of the file, or NULL to allocate directly.
+ * @param goal Preferred first block.
+ * @param want Blocks wanted (at least 1).
+ * @param count Output: contiguous blocks allocated, at most @p want.
+ * @return First block number, or 0 if the volume is full.
+ */
+static u32 take_blocks(
+    ext2_volume_t *vol, ext2_prealloc_t *pa, u32 goal, u32 want, u32 *count
+)
+{
+  if(!pa)
+    return alloc_blocks(vol, goal, want, count);
+
+  if(pa->count && pa->block != goal)
+    prealloc_discard(vol, pa);
+
+  if(pa->count) {
+    u32 n      = want < pa->count ? want : pa->count;
+    u32 block  = pa->block;
+    pa->block += n;
+    pa->count -= n;
+    *count     = n;
+    vol->alloc_gen++;
+    return block;
   }
 
-  u32 dind_idx = file_block / (ptrs_per_block * ptrs_per_block);
-
-  if(tind_block[dind_idx] == 0) {
-    u32 dind = alloc_block(vol, preferred_group);
-    if(dind == 0) {
-      kfree(tind_block);
-      return 0;
-    }
-    tind_block[dind_idx] = dind;
-    inode->i_blocks += vol->block_size / 512;
-
-    vol_write_block(vol, inode->i_block[EXT2_TIND_BLOCK], tind_block);
+  u32 got;
+  u32 block = alloc_blocks(vol, goal, want + EXT2_PREALLOC_BLOCKS, &got);
+  if(block == 0)
+    return 0;
 
-    u8 *zero = kmalloc(vol->block_size);
-    if(zero) {
-      kzero(zero, vol->block_size);
-      vol_write_block(vol, dind, zero);
-      kfree(zero);
-    }
+  u32 n = want < got ? want : got;
+  if(got > n) {
+    pa->block = block + n;
+    pa->count = got - n;
   }
+  *count = n;
+  return block;
+}
 
-  u32 dind_block_num = tind_block[dind_idx];
-  kfree(tind_block);
-
-  u32 *dind_block = kmalloc(vol->block_size);
-  if(!dind_block)
+/**
+ * @brief Allocate a pointer block and zero it on disk.
+ * @param vol Volume.
+ * @param inode Inode the block is charged to.
+ * @param pa Preallocation window, or NULL.
+ * @param goal Preferred block number.
+ * @return Block number, or 0 on failure.
+ */
+static u32 alloc_ptr_block(
+    ext2_volume_t *vol, ext2_inode_t *inode, ext2_prealloc_t *pa, u32 goal
+)
+{
+  u32 count;
+  u32 block = take_blocks(vol, pa, goal, 1, &count);
+  if(block == 0)
     return 0;
+  inode->i_blocks += vol->block_size / 512;
 
-  if(vol_read_block(vol, dind_block_num, dind_block) < 0) {
-    kfree(dind_block);
-    return 0;
+  u8 *zero = kmalloc(vol->block_size);
+  if(zero) {
+    kzero(zero, vol->block_size);
+    vol_write_block(vol, block, zero);
+    kfree(zero);
   }
+  return block;
+}
 
-  u32 remaining = file_block % (ptrs_per_block * ptrs_per_block);
-  u32 ind_idx   = remaining / ptrs_per_block;
+/**
+ * @brief Allocate data blocks for a run of file blocks.
+ *
+ * Missing pointer blocks on the way are allocated (and zeroed) first. The
+ * data blocks are allocated as one contiguous run near @p goal, stopping at
+ * the first file block that is already mapped or that needs a different
+ * pointer block. Their contents are not initialised: the caller writes
+ * every block it gets.
+ *
+ * @param vol Volume.
+ * @param inode Inode (will be modified).
+ * @param pa Preallocation window of the file, or NULL.
+ * @param file_block First file block.
+ * @param max Blocks wanted (at least 1).
+ * @param goal Preferred disk block for @p file_block.
+ * @param count Output: file blocks now mapped from @p file_block on, to
+ *              consecutive disk blocks (1 if it was mapped already).
+ * @return Disk block of @p file_block, or 0 on failure.
+ */
+static u32 alloc_file_blocks(
+    ext2_volume_t *vol, ext2_inode_t *inode, ext2_prealloc_t *pa,
+    u32 file_block, u32 max, u32 goal, u32 *count
+)
+{
+  u32 ptrs_per_block = vol->block_size / 4;
+  u32 idx[4];
+  u32 depth;
 
-  if(dind_block[ind_idx] == 0) {
-    u32 ind = alloc_block(vol, preferred_group);
-    if(ind == 0) {
-      kfree(dind_block);
-      return 0;
+  /* Path from the inode down to the data block pointer */
+  if(file_block < EXT2_NDIR_BLOCKS) {
+    depth  = 0;
+    idx[0] = file_block;
+  } else if((file_block -= EXT2_NDIR_BLOCKS) < ptrs_per_block) {
+    depth  = 1;
+    idx[0] = EXT2_IND_BLOCK;
+    idx[1] = file_block;
+  } else if((file_block -= ptrs_per_block) < ptrs_per_block * ptrs_per_block) {
+    depth  = 2;
+    idx[0] = EXT2_DIND_BLOCK;
+    idx[1] = file_block / ptrs_per_block;
+    idx[2] = file_block % ptrs_per_block;
+  } else {
+    file_block -= ptrs_per_block * ptrs_per_block;
+    depth       = 3;
+    idx[0]      = EXT2_TIND_BLOCK;
+    idx[1]      = file_block / (ptrs_per_block * ptrs_per_block);
+    idx[2]      = (file_block / ptrs_per_block) % ptrs_per_block;
+    idx[3]      = file_block % ptrs_per_block;
+  }
+
+  /* Work on a copy of i_block: the inode struct is packed */
+  u32 iblock[EXT2_N_BLOCKS];
+  kmemcpy(iblock, inode->i_block, sizeof(iblock));
+
+  u32 *slots     = iblock;
+  u32 *ptr_buf   = NULL;
+  u32  ptr_block = 0;
+  u32  result    = 0;
+
+  for(u32 lvl = 0; lvl < depth; lvl++) {
+    u32 *slot = &slots[idx[lvl]];
+    if(*slot == 0) {
+      *slot = alloc_ptr_block(vol, inode, pa, goal);
+      if(*slot == 0)
+        goto out;
+      goal = *slot + 1;
+      if(ptr_buf)
+        vol_write_block(vol, ptr_block, ptr_buf);
     }
-    dind_block[ind_idx] = ind;
-    inode->i_blocks += vol->block_size / 512;
 
-    vol_write_block(vol, dind_block_num, dind_block);
-
-    u8 *zero = kmalloc(vol->block_size);
-    if(zero) {
-      kzero(zero, vol->block_size);
-      vol_write_block(vol, ind, zero);
-      kfree(zero);
-    }
-  }
+    ptr_block = *slot;
+    if(!ptr_buf && !(ptr_buf = kmalloc(vol->block_size)))
+      goto out;
+    if(vol_read_block(vol, ptr_block, ptr_buf) < 0)
+      goto out;
+    slots = ptr_buf;
+  }
+
+  u32 off   = idx[depth];
+  u32 limit = depth ? ptrs_per_block : EXT2_NDIR_BLOCKS;
+  if(slots[off]) {
+    *count = 1;
+    result = slots[off];
+    goto out;
+  }
+
+  u32 want = 1;
+  if(max > EXT2_ALLOC_RUN_MAX)
+    max = EXT2_ALLOC_RUN_MAX;
+  while(want < max && off + want < limit && slots[off + want] == 0)
+    want++;
+
+  u32 got;
+  result = take_blocks(vol, pa, goal, want, &got);
+  if(result == 0)
+    goto out;
+  for(u32 i = 0; i < got; i++)
+    slots[off + i] = result + i;
+  inode->i_blocks += got * (vol->block_size / 512);
+  if(ptr_buf)
+    vol_write_block(vol, ptr_block, ptr_buf);
+  *count = got;
+
+out:
+  kmemcpy(inode->i_block, iblock, sizeof(iblock));
+  kfree(ptr_buf);
+  return result;
+}
 
-  u32 ind_block_num = dind_block[ind_idx];
-  kfree(dind_block);
+/**
+ * @brief Allocate and set a block for a given file block index.
+ * @param vol Volume.
+ * @param inode Inode (will be modified).
+ * @param file_block File block index.
+ * @param preferred_group Preferred block group for allocation.
+ * @return Block number, or 0 on failure.
+ */
+static u32 alloc_file_block(
+    ext2_volume_t *vol, ext2_inode_t *inode, u32 file_block, u32 preferred_group
+)
+{
+  u32 goal = preferred_group * vol->blocks_per_group + vol->first_data_block;
+  u32 count;
 
-  u32 *ind_block = kmalloc(vol->block_size);
-  if(!ind_block)
-    return 0;
+  if(get_block_num(vol, inode, NULL, file_block))
+    return alloc_file_blocks(vol, inode, NULL, file_block, 1, goal, &count);
 
-  if(vol_read_block(vol, ind_block_num, ind_block) < 0) {
-    kfree(ind_block);
+  u32 block =
+      alloc_file_blocks(vol, inode, NULL, file_block, 1, goal, &count);
+  if(block == 0)
     return 0;
-  }
 
-  u32 ind_offset = remaining % ptrs_per_block;
-  if(ind_block[ind_offset] == 0) {
-    u32 block = alloc_block(vol, preferred_group);
-    if(block == 0) {
-      kfree(ind_block);
-      return 0;
-    }
-    ind_block[ind_offset] = block;
-    inode->i_blocks += vol->block_size / 512;
-
-    vol_write_block(vol, ind_block_num, ind_block);
-
-    u8 *zero = kmalloc(vol->block_size);
-    if(zero) {
-      kzero(zero, vol->block_size);
-      vol_write_block(vol, block, zero);
-      kfree(zero);
-    }
+  /* Zero the new block */
+  u8 *zero = kmalloc(vol->block_size);
+  if(zero) {
+    kzero(zero, vol->block_size);
+    vol_write_block(vol, block, zero);
+    kfree(zero);
   }
-
-  u32 result = ind_block[ind_offset];
-  kfree(ind_block);
-  return result;
+  return block;
 }
 
 /**
@@ -1027,7 +1334,7 @@ static i64 free_inode_blocks(ext2_volume_t *vol, ext2_inode_t *inode)
   if(inode->i_block[EXT2_IND_BLOCK]) {
     u32 *ind_block = kmalloc(vol->block_size);
     if(ind_block) {
-      if(vol_read_block(vol, inode->i_block[EXT2_IND_BLOCK], ind_block) == 0) {
+      if(vol_read_block(vol, inode->i_block[EXT2_IND_BLOCK], ind_block) >= 0) {
         for(u32 i = 0; i < ptrs_per_block; i++) {
           if(ind_block[i])
             free_block(vol, ind_block[i]);
@@ -1043,13 +1350,13 @@ static i64 free_inode_blocks(ext2_volume_t *vol, ext2_inode_t *inode)
   if(inode->i_block[EXT2_DIND_BLOCK]) {
     u32 *dind_block = kmalloc(vol->block_size);
     if(dind_block) {
-      if(vol_read_block(vol, inode->i_block[EXT2_DIND_BLOCK], dind_block) ==
+      if(vol_read_block(vol, inode->i_block[EXT2_DIND_BLOCK], dind_block) >=
          0) {
         for(u32 i = 0; i < ptrs_per_block; i++) {
           if(dind_block[i]) {
             u32 *ind_block = kmalloc(vol->block_size);
             if(ind_block) {
-              if(vol_read_block(vol, dind_block[i], ind_block) == 0) {
+              if(vol_read_block(vol, dind_block[i], ind_block) >= 0) {
                 for(u32 j = 0; j < ptrs_per_block; j++) {
                   if(ind_block[j])
                     free_block(vol, ind_block[j]);
@@ -1071,18 +1378,18 @@ static i64 free_inode_blocks(ext2_volume_t *vol, ext2_inode_t *inode)
   if(inode->i_block[EXT2_TIND_BLOCK]) {
     u32 *tind_block = kmalloc(vol->block_size);
     if(tind_block) {
-      if(vol_read_block(vol, inode->i_block[EXT2_TIND_BLOCK], tind_block) ==
+      if(vol_read_block(vol, inode->i_block[EXT2_TIND_BLOCK], tind_block) >=
          0) {
         for(u32 t = 0; t < ptrs_per_block; t++) {
           if(tind_block[t]) {
             u32 *dind_block = kmalloc(vol->block_size);
             if(dind_block) {
-              if(vol_read_block(vol, tind_block[t], dind_block) == 0) {
+              if(vol_read_block(vol, tind_block[t], dind_block) >= 0) {
                 for(u32 d = 0; d < ptrs_per_block; d++) {
                   if(dind_block[d]) {
                     u32 *ind_block = kmalloc(vol->block_size);
                     if(ind_block) {
-                      if(vol_read_block(vol, dind_block[d], ind_block) == 0) {
+                      if(vol_read_block(vol, dind_block[d], ind_block) >= 0) {
                         for(u32 i = 0; i < ptrs_per_block; i++) {
                           if(ind_block[i])
                             free_block(vol, ind_block[i]);
@@ -1110,8 +1417,414 @@ static i64 free_inode_blocks(ext2_volume_t *vol, ext2_inode_t *inode)
   return 0;
 }
 
+/*
+ * Hashed directory index (ext3/ext4 dir_index, "htree").
+ *
+ * Block 0 of an indexed directory holds "." and "..", whose rec_len covers
+ * the rest of the block, followed by the index root: a sorted array of
+ * (hash, block) entries. Interior blocks start with one empty entry
+ * spanning the block. Leaves are ordinary directory blocks holding the
+ * names whose hashes fall in their range, so drivers that ignore the index
+ * still see a valid linear directory.
+ */
+
+#define DX_HASH_LEGACY   0
+#define DX_HASH_HALF_MD4 1
+#define DX_HASH_TEA      2
+#define DX_HASH_UNSIGNED 3 /* added to the version for unsigned chars */
+#define DX_MAX_LEVELS    3 /* root plus two interior levels */
+#define DX_ROOT_INFO     24 /* after the "." and ".." entries */
+#define DX_NODE_ENTRIES  8  /* after the empty entry */
+#define DX_BLOCK_MASK    0x0FFFFFFF
+
+/** @brief Index root header. */
+typedef struct PACKED
+{
+  u32 reserved_zero;
+  u8  hash_version;
+  u8  info_length;
+  u8  indirect_levels;
+  u8  unused_flags;
+} dx_root_info_t;
+
+/** @brief Index entry; entry 0 holds (limit, count) in place of the hash. */
+typedef struct PACKED
+{
+  u32 hash;
+  u32 block;
+} dx_entry_t;
+
+/** @brief One level of an index walk. */
+typedef struct
+{
+  u8         *buf;     /* index block */
+  dx_entry_t *entries; /* entry array within buf */
+  dx_entry_t *at;      /* entry followed */
+} dx_frame_t;
+
+static inline u16 dx_limit(const dx_entry_t *e)
+{
+  return (u16)e[0].hash;
+}
+
+static inline u16 dx_count(const dx_entry_t *e)
+{
+  return (u16)(e[0].hash >> 16);
+}
+
+static inline int dx_char(const char *s, u32 i, bool unsig)
+{
+  return unsig ? (int)(u8)s[i] : (int)(i8)s[i];
+}
+
+static inline u32 rol32(u32 x, u32 n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+/* The original ext3 hash. */
+static u32 dx_hack_hash(const char *name, u32 len, bool unsig)
+{
+  u32 hash0 = 0x12A3FE2D;
+  u32 hash1 = 0x37ABE8F9;
+  for(u32 i = 0; i < len; i++) {
+    u32 hash = hash1 + (hash0 ^ (u32)(dx_char(name, i, unsig) * 7152373));
+    if(hash & 0x80000000)
+      hash -= 0x7FFFFFFF;
+    hash1 = hash0;
+    hash0 = hash;
+  }
+  return hash0 << 1;
+}
+
+/* Pack up to num * 4 name bytes into words, padded with the length. */
+static void dx_str2hashbuf(
+    const char *msg, i32 len, u32 *buf, i32 num, bool unsig
+)
+{
+  u32 pad = (u32)len | ((u32)len << 8);
+  pad    |= pad << 16;
+
+  u32 val = pad;
+  if(len > num * 4)
+    len = num * 4;
+  for(i32 i = 0; i < len; i++) {
+    val = (u32)dx_char(msg, (u32)i, unsig) + (val << 8);
+    if((i % 4) == 3) {
+      *buf++ = val;
+      val    = pad;
+      num--;
+    }
+  }
+  if(--num >= 0)
+    *buf++ = val;
+  while(--num >= 0)
+    *buf++ = pad;
+}
+
+static void dx_tea_transform(u32 buf[4], const u32 in[4])
+{
+  u32 sum = 0;
+  u32 b0  = buf[0];
+  u32 b1  = buf[1];
+  for(u32 n = 0; n < 16; n++) {
+    sum += 0x9E3779B9;
+    b0  += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+    b1  += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+  }
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+#define MD4_F(x, y, z)               ((z) ^ ((x) & ((y) ^ (z))))
+#define MD4_G(x, y, z)               (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define MD4_H(x, y, z)               ((x) ^ (y) ^ (z))
+#define MD4_ROUND(f, a, b, c, d, x, s) ((a) = rol32((a) + f(b, c, d) + (x), s))
+#define MD4_K2                       0x5A827999U
+#define MD4_K3                       0x6ED9EBA1U
+
+static void dx_half_md4_transform(u32 buf[4], const u32 in[8])
+{
+  u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  MD4_ROUND(MD4_F, a, b, c, d, in[0], 3);
+  MD4_ROUND(MD4_F, d, a, b, c, in[1], 7);
+  MD4_ROUND(MD4_F, c, d, a, b, in[2], 11);
+  MD4_ROUND(MD4_F, b, c, d, a, in[3], 19);
+  MD4_ROUND(MD4_F, a, b, c, d, in[4], 3);
+  MD4_ROUND(MD4_F, d, a, b, c, in[5], 7);
+  MD4_ROUND(MD4_F, c, d, a, b, in[6], 11);
+  MD4_ROUND(MD4_F, b, c, d, a, in[7], 19);
+
+  MD4_ROUND(MD4_G, a, b, c, d, in[1] + MD4_K2, 3);
+  MD4_ROUND(MD4_G, d, a, b, c, in[3] + MD4_K2, 5);
+  MD4_ROUND(MD4_G, c, d, a, b, in[5] + MD4_K2, 9);
+  MD4_ROUND(MD4_G, b, c, d, a, in[7] + MD4_K2, 13);
+  MD4_ROUND(MD4_G, a, b, c, d, in[0] + MD4_K2, 3);
+  MD4_ROUND(MD4_G, d, a, b, c, in[2] + MD4_K2, 5);
+  MD4_ROUND(MD4_G, c, d, a, b, in[4] + MD4_K2, 9);
+  MD4_ROUND(MD4_G, b, c, d, a, in[6] + MD4_K2, 13);
+
+  MD4_ROUND(MD4_H, a, b, c, d, in[3] + MD4_K3, 3);
+  MD4_ROUND(MD4_H, d, a, b, c, in[7] + MD4_K3, 9);
+  MD4_ROUND(MD4_H, c, d, a, b, in[2] + MD4_K3, 11);
+  MD4_ROUND(MD4_H, b, c, d, a, in[6] + MD4_K3, 15);
+  MD4_ROUND(MD4_H, a, b, c, d, in[1] + MD4_K3, 3);
+  MD4_ROUND(MD4_H, d, a, b, c, in[5] + MD4_K3, 9);
+  MD4_ROUND(MD4_H, c, d, a, b, in[0] + MD4_K3, 11);
+  MD4_ROUND(MD4_H, b, c, d, a, in[4] + MD4_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+/**
+ * @brief Hash a name the way the directory's index was built.
+ * @param vol Volume (for the hash seed).
+ * @param version DX_HASH_* version, plus DX_HASH_UNSIGNED if applicable.
+ * @param name Name.
+ * @param len Name length.
+ * @return Major hash with the collision bit clear.
+ */
+static u32 dx_hash(const ext2_volume_t *vol, u32 version, const char *name,
+                   u32 len)
+{
+  u32  buf[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+  u32  in[8];
+  bool unsig = version >= DX_HASH_UNSIGNED;
+  u32  hash;
+
+  for(u32 i = 0; i < 4; i++) {
+    if(vol->sb.s_hash_seed[i]) {
+      kmemcpy(buf, vol->sb.s_hash_seed, sizeof(buf));
+      break;
+    }
+  }
+
+  switch(unsig ? version - DX_HASH_UNSIGNED : version) {
+  case DX_HASH_LEGACY:
+    hash = dx_hack_hash(name, len, unsig);
+    break;
+  case DX_HASH_HALF_MD4:
+    for(i32 left = (i32)len; left > 0; left -= 32, name += 32) {
+      dx_str2hashbuf(name, left, in, 8, unsig);
+      dx_half_md4_transform(buf, in);
+    }
+    hash = buf[1];
+    break;
+  default:
+    for(i32 left = (i32)len; left > 0; left -= 16, name += 16) {
+      dx_str2hashbuf(name, left, in, 4, unsig);
+      dx_tea_transform(buf, in);
+    }
+    hash = buf[0];
+    break;
+  }
+
+  hash &= ~1U;
+  if(hash == 0xFFFFFFFEU) /* reserved for end-of-directory */
+    hash = 0xFFFFFFFCU;
+  return hash;
+}
+
+/* Whether @p e's entry array of @p bytes bytes has a sane count and limit. */
+static bool dx_entries_ok(const dx_entry_t *e, u32 bytes)
+{
+  return dx_count(e) != 0 && dx_count(e) <= dx_limit(e) &&
+         dx_limit(e) <= bytes / sizeof(dx_entry_t);
+}
+
+/**
+ * @brief Walk a directory's index down to the leaf that would hold a name.
+ * @param vol Volume.
+ * @param dir Directory inode.
+ * @param name Name.
+ * @param name_len Name length.
+ * @param bufs DX_MAX_LEVELS consecutive block buffers for the frames.
+ * @param frames Output: one frame per index level.
+ * @param hash Output: the name's hash.
+ * @return Levels walked, or 0 if the directory has no usable index.
+ */
+static u32 dx_probe(
+    const ext2_volume_t *vol, const ext2_inode_t *dir, const char *name,
+    u32 name_len, u8 *bufs, dx_frame_t *frames, u32 *hash
+)
+{
+  u32 bs = vol->block_size;
+  if(!(vol->sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) ||
+     !(dir->i_flags & EXT2_INDEX_FL))
+    return 0;
+
+  u32 block = get_block_num(vol, dir, NULL, 0);
+  if(block == 0 || vol_read_block(vol, block, bufs) < 0)
+    return 0;
+
+  const dx_root_info_t *info    = (const dx_root_info_t *)(bufs + DX_ROOT_INFO);
+  u32                   version = info->hash_version;
+  if(info->reserved_zero != 0 || info->info_length != sizeof(*info) ||
+     version > DX_HASH_TEA || info->indirect_levels >= DX_MAX_LEVELS)
+    return 0;
+  if(vol->sb.s_flags & EXT2_FLAGS_UNSIGNED_HASH)
+    version += DX_HASH_UNSIGNED;
+  *hash = dx_hash(vol, version, name, name_len);
+
+  u32 off = DX_ROOT_INFO + info->info_length;
+  for(u32 lvl = 0;; lvl++) {
+    u8         *buf     = bufs + lvl * bs;
+    dx_entry_t *entries = (dx_entry_t *)(buf + off);
+    if(!dx_entries_ok(entries, bs - off))
+      return 0;
+
+    /* Last entry whose hash is <= ours (entry 0 covers hash 0). */
+    dx_entry_t *p = entries + 1;
+    dx_entry_t *q = entries + dx_count(entries) - 1;
+    while(p <= q) {
+      dx_entry_t *m = p + (q - p) / 2;
+      if(m->hash > *hash)
+        q = m - 1;
+      else
+        p = m + 1;
+    }
+    frames[lvl] = (dx_frame_t){.buf = buf, .entries = entries, .at = p - 1};
+    if(lvl == info->indirect_levels)
+      return lvl + 1;
+
+    u32 next = frames[lvl].at->block & DX_BLOCK_MASK;
+    block    = get_block_num(vol, dir, NULL, next);
+    if(block == 0 || vol_read_block(vol, block, buf + bs) < 0)
+      return 0;
+    off = DX_NODE_ENTRIES;
+  }
+}
+
+/**
+ * @brief Step to the next leaf if it continues a run of colliding hashes.
+ * @param vol Volume.
+ * @param dir Directory inode.
+ * @param frames Frames from dx_probe().
+ * @param levels Levels dx_probe() returned.
+ * @param hash Hash being looked up.
+ * @return true if the next leaf may hold names with @p hash.
+ */
+static bool dx_next_leaf(
+    const ext2_volume_t *vol, const ext2_inode_t *dir, dx_frame_t *frames,
+    u32 levels, u32 hash
+)
+{
+  u32 lvl = levels - 1;
+  while(++frames[lvl].at >=
+        frames[lvl].entries + dx_count(frames[lvl].entries)) {
+    if(lvl == 0)
+      return false;
+    lvl--;
+  }
+  if((frames[lvl].at->hash & ~1U) != hash)
+    return false;
+
+  for(; lvl + 1 < levels; lvl++) {
+    u32 block =
+        get_block_num(vol, dir, NULL, frames[lvl].at->block & DX_BLOCK_MASK);
+    dx_frame_t *next = &frames[lvl + 1];
+    if(block == 0 || vol_read_block(vol, block, next->buf) < 0)
+      return false;
+    next->entries = (dx_entry_t *)(next->buf + DX_NODE_ENTRIES);
+    if(!dx_entries_ok(next->entries, vol->block_size - DX_NODE_ENTRIES))
+      return false;
+    next->at = next->entries;
+  }
+  return true;
+}
+
+/**
+ * @brief Find a name in one directory block.
+ * @param buf Directory block.
+ * @param block_size Block size.
+ * @param name Name.
+ * @param name_len Name length.
+ * @return The entry, or NULL.
+ */
+static const ext2_dirent_t *dirent_find(
+    const u8 *buf, u32 block_size, const char *name, u32 name_len
+)
+{
+  u32 block_offset = 0;
+  while(block_offset + sizeof(ext2_dirent_t) <= block_size) {
+    const ext2_dirent_t *de = (const ext2_dirent_t *)(buf + block_offset);
+
+    if(de->rec_len == 0)
+      break;
+
+    if(de->inode != 0 && de->name_len == name_len &&
+       kstrncmp(de->name, name, name_len) == 0)
+      return de;
+
+    block_offset += de->rec_len;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Look a name up through the directory's hash index.
+ * @param vol Volume.
+ * @param dir_inode Directory inode.
+ * @param name Entry name.
+ * @param name_len Name length.
+ * @param block_buf Scratch block buffer.
+ * @param out_ino Output inode number if found.
+ * @param out_type Output file type if found.
+ * @return 0 if found, -ENOENT if not, -ENOSYS if the directory has no
+ *         usable index.
+ */
+static i64 dx_find_entry(
+    const ext2_volume_t *vol, const ext2_inode_t *dir_inode, const char *name,
+    u32 name_len, u8 *block_buf, u32 *out_ino, u8 *out_type
+)
+{
+  if(!(vol->sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) ||
+     !(dir_inode->i_flags & EXT2_INDEX_FL))
+    return -ENOSYS;
+
+  u8 *bufs = kmalloc((u64)DX_MAX_LEVELS * vol->block_size);
+  if(!bufs)
+    return -ENOSYS;
+
+  dx_frame_t frames[DX_MAX_LEVELS];
+  u32        hash;
+  u32 levels = dx_probe(vol, dir_inode, name, name_len, bufs, frames, &hash);
+  i64 ret    = levels ? -ENOENT : -ENOSYS;
+
+  while(levels) {
+    u32 leaf  = frames[levels - 1].at->block & DX_BLOCK_MASK;
+    u32 block = get_block_num(vol, dir_inode, NULL, leaf);
+    if(block == 0 || vol_read_block(vol, block, block_buf) < 0) {
+      ret = -ENOSYS;
+      break;
+    }
+
+    const ext2_dirent_t *de =
+        dirent_find(block_buf, vol->block_size, name, name_len);
+    if(de) {
+      *out_ino  = de->inode;
+      *out_type = de->file_type;
+      ret       = 0;
+      break;
+    }
+    if(!dx_next_leaf(vol, dir_inode, frames, levels, hash))
+      break;
+  }
+
+  kfree(bufs);
+  return ret;
+}
+
 /**
  * @brief Find a directory entry by name.
+ *
+ * Indexed directories are searched through their hash index; others (and
+ * indexes this driver cannot read) are scanned block by block.
+ *
  * @param vol Volume.
  * @param dir_inode Directory inode.
  * @param name Entry name to find.
@@ -1132,10 +1845,18 @@ static i64 dir_find_entry(
   if(!block_buf)
     return -ENOMEM;
 
+  i64 ret = dx_find_entry(
+      vol, dir_inode, name, name_len, block_buf, out_ino, out_type
+  );
+  if(ret != -ENOSYS) {
+    kfree(block_buf);
+    return ret;
+  }
+
   u32 offset = 0;
   while(offset < dir_size) {
     u32 file_block = offset / block_size;
-    u32 block_num  = get_block_num(vol, dir_inode, file_block);
+    u32 block_num  = get_block_num(vol, dir_inode, NULL, file_block);
 
     if(block_num == 0) {
       offset += block_size;
@@ -1147,31 +1868,13 @@ static i64 dir_find_entry(
       return -EIO;
     }
 
-    u32 block_offset = 0;
-    while(block_offset < block_size) {
-      const ext2_dirent_t *de =
-          (const ext2_dirent_t *)(block_buf + block_offset);
-
-      if(de->rec_len == 0)
-        break;
-
-      if(de->inode != 0 && de->name_len == name_len) {
-        bool match = true;
-        for(u32 i = 0; i < name_len; i++) {
-          if(de->name[i] != name[i]) {
-            match = false;
-            break;
-          }
-        }
-        if(match) {
-          *out_ino  = de->inode;
-          *out_type = de->file_type;
-          kfree(block_buf);
-          return 0;
-        }
-      }
-
-      block_offset += de->rec_len;
+    const ext2_dirent_t *de =
+        dirent_find(block_buf, block_size, name, name_len);
+    if(de) {
+      *out_ino  = de->inode;
+      *out_type = de->file_type;
+      kfree(block_buf);
+      return 0;
     }
 
     offset += block_size;
@@ -1181,6 +1884,130 @@ static i64 dir_find_entry(
   return -ENOENT;
 }
 
+/**
+ * @brief Find a directory entry by name through the dentry cache.
+ * @param vol Volume.
+ * @param dir_ino Directory inode number.
+ * @param dir_inode Directory inode.
+ * @param name Entry name to find.
+ * @param out_ino Output inode number if found.
+ * @param out_type Output file type if found.
+ * @return 0 on success, -ENOENT if not found.
+ */
+static i64 dir_lookup(
+    const ext2_volume_t *vol, u32 dir_ino, const ext2_inode_t *dir_inode,
+    const char *name, u32 *out_ino, u8 *out_type
+)
+{
+  u64 ino;
+  if(dcache_lookup(vol, dir_ino, name, &ino, out_type)) {
+    *out_ino = (u32)ino;
+    return ino ? 0 : -ENOENT;
+  }
+
+  i64 ret = dir_find_entry(vol, dir_inode, name, out_ino, out_type);
+  if(ret == 0)
+    dcache_add(vol, dir_ino, name, *out_ino, *out_type);
+  else if(ret == -ENOENT)
+    dcache_add(vol, dir_ino, name, 0, 0);
+  return ret;
+}
+
+/**
+ * @brief Add an entry to a directory block if it has room.
+ * @param buf Directory block.
+ * @param block_size Block size.
+ * @param name Entry name.
+ * @param inode_num Inode number for the entry.
+ * @param file_type File type (EXT2_FT_*).
+ * @return true if the entry was added to @p buf.
+ */
+static bool dirent_insert(
+    u8 *buf, u32 block_size, const char *name, u32 inode_num, u8 file_type
+)
+{
+  u32 name_len   = kstrlen(name);
+  u32 needed_len = (sizeof(ext2_dirent_t) + name_len + 3) & ~3;
+
+  u32 offset = 0;
+  while(offset < block_size) {
+    ext2_dirent_t *de = (ext2_dirent_t *)(buf + offset);
+
+    if(de->rec_len == 0)
+      break;
+
+    /* Reuse an unused slot (deleted entry, or an htree node's empty
+     * record) in place rather than splitting it. */
+    if(de->inode == 0 && de->rec_len >= needed_len) {
+      de->inode     = inode_num;
+      de->name_len  = (u8)name_len;
+      de->file_type = file_type;
+      kmemcpy(de->name, name, name_len);
+      return true;
+    }
+
+    u32 actual_len = sizeof(ext2_dirent_t) + de->name_len;
+    actual_len     = (actual_len + 3) & ~3;
+
+    u32 free_space = de->rec_len - actual_len;
+
+    if(free_space >= needed_len) {
+      /* Split this entry */
+      u32 new_rec_len = de->rec_len - actual_len;
+      de->rec_len     = (u16)actual_len;
+
+      ext2_dirent_t *new_de = (ext2_dirent_t *)(buf + offset + actual_len);
+      new_de->inode         = inode_num;
+      new_de->rec_len       = (u16)new_rec_len;
+      new_de->name_len      = (u8)name_len;
+      new_de->file_type     = file_type;
+      kmemcpy(new_de->name, name, name_len);
+      return true;
+    }
+
+    offset += de->rec_len;
+  }
+  return false;
+}
+
+/**
+ * @brief Add an entry to the leaf an indexed directory's hash selects.
+ * @param vol Volume.
+ * @param dir_inode Directory inode.
+ * @param name Entry name.
+ * @param name_len Name length.
+ * @param block_buf Scratch block buffer.
+ * @param inode_num Inode number for the entry.
+ * @param file_type File type (EXT2_FT_*).
+ * @return 0 on success, -ENOSPC if the leaf is full, -ENOSYS without a
+ *         usable index, -EIO on write failure.
+ */
+static i64 dx_add_entry(
+    const ext2_volume_t *vol, const ext2_inode_t *dir_inode, const char *name,
+    u32 name_len, u8 *block_buf, u32 inode_num, u8 file_type
+)
+{
+  u8 *bufs = kmalloc((u64)DX_MAX_LEVELS * vol->block_size);
+  if(!bufs)
+    return -ENOSYS;
+
+  dx_frame_t frames[DX_MAX_LEVELS];
+  u32        hash;
+  u32 levels = dx_probe(vol, dir_inode, name, name_len, bufs, frames, &hash);
+  u32 block  = 0;
+  if(levels) {
+    u32 leaf = frames[levels - 1].at->block & DX_BLOCK_MASK;
+    block    = get_block_num(vol, dir_inode, NULL, leaf);
+  }
+  kfree(bufs);
+
+  if(block == 0 || vol_read_block(vol, block, block_buf) < 0)
+    return -ENOSYS;
+  if(!dirent_insert(block_buf, vol->block_size, name, inode_num, file_type))
+    return -ENOSPC;
+  return vol_write_block(vol, block, block_buf) < 0 ? -EIO : 0;
+}
+
 /**
  * @brief Add a directory entry.
  * @param vol Volume.
@@ -1197,63 +2024,54 @@ static i64 dir_add_entry(
 )
 {
   u32 name_len      = kstrlen(name);
-  u32 needed_len    = sizeof(ext2_dirent_t) + name_len;
   u32 block_size    = vol->block_size;
   u32 preferred_grp = (dir_ino - 1) / vol->inodes_per_group;
 
-  /* Align to 4 bytes */
-  needed_len = (needed_len + 3) & ~3;
-
   u8 *block_buf = kmalloc(block_size);
   if(!block_buf)
     return -ENOMEM;
 
+  if(dir_inode->i_flags & EXT2_INDEX_FL) {
+    i64 ret = dx_add_entry(
+        vol, dir_inode, name, name_len, block_buf, inode_num, file_type
+    );
+    if(ret == 0 || ret == -EIO) {
+      kfree(block_buf);
+      if(ret == 0)
+        dcache_add(vol, dir_ino, name, inode_num, file_type);
+      return ret;
+    }
+
+    /* The leaf is full (splitting is not supported) or the index is
+     * unreadable: drop the index, as drivers without htree support do.
+     * Its blocks remain a valid linear directory. */
+    dir_inode->i_flags &= ~EXT2_INDEX_FL;
+    if(write_inode(vol, dir_ino, dir_inode) < 0) {
+      kfree(block_buf);
+      return -EIO;
+    }
+  }
+
   u32 dir_blocks = (dir_inode->i_size + block_size - 1) / block_size;
 
   /* Search existing blocks for space */
   for(u32 b = 0; b < dir_blocks; b++) {
-    u32 block_num = get_block_num(vol, dir_inode, b);
+    u32 block_num = get_block_num(vol, dir_inode, NULL, b);
     if(block_num == 0)
       continue;
 
     if(vol_read_block(vol, block_num, block_buf) < 0)
       continue;
 
-    u32 offset = 0;
-    while(offset < block_size) {
-      ext2_dirent_t *de = (ext2_dirent_t *)(block_buf + offset);
-
-      if(de->rec_len == 0)
-        break;
-
-      u32 actual_len = sizeof(ext2_dirent_t) + de->name_len;
-      actual_len     = (actual_len + 3) & ~3;
-
-      u32 free_space = de->rec_len - actual_len;
-
-      if(free_space >= needed_len) {
-        /* Split this entry */
-        u32 new_rec_len = de->rec_len - actual_len;
-        de->rec_len     = (u16)actual_len;
-
-        ext2_dirent_t *new_de =
-            (ext2_dirent_t *)(block_buf + offset + actual_len);
-        new_de->inode     = inode_num;
-        new_de->rec_len   = (u16)new_rec_len;
-        new_de->name_len  = (u8)name_len;
-        new_de->file_type = file_type;
-        kmemcpy(new_de->name, name, name_len);
-
-        if(vol_write_block(vol, block_num, block_buf) < 0) {
-          kfree(block_buf);
-          return -EIO;
-        }
-
+    if(dirent_insert(block_buf, block_size, name, inode_num, file_type)) {
+      if(vol_write_block(vol, block_num, block_buf) < 0) {
         kfree(block_buf);
-        return 0;
+        return -EIO;
       }
 
-      offset += de->rec_len;
+      kfree(block_buf);
+      dcache_add(vol, dir_ino, name, inode_num, file_type);
+      return 0;
     }
   }
 
@@ -1284,18 +2102,21 @@ static i64 dir_add_entry(
   }
 
   kfree(block_buf);
+  dcache_add(vol, dir_ino, name, inode_num, file_type);
   return 0;
 }
 
 /**
  * @brief Remove a directory entry.
  * @param vol Volume.
+ * @param dir_ino Directory inode number.
  * @param dir_inode Directory inode.
  * @param name Entry name to remove.
  * @return 0 on success, negative on error.
  */
 static i64 dir_remove_entry(
-    const ext2_volume_t *vol, const ext2_inode_t *dir_inode, const char *name
+    const ext2_volume_t *vol, u32 dir_ino, const ext2_inode_t *dir_inode,
+    const char *name
 )
 {
   u32 name_len   = kstrlen(name);
@@ -1309,7 +2130,7 @@ static i64 dir_remove_entry(
   u32 offset = 0;
   while(offset < dir_size) {
     u32 file_block = offset / block_size;
-    u32 block_num  = get_block_num(vol, dir_inode, file_block);
+    u32 block_num  = get_block_num(vol, dir_inode, NULL, file_block);
 
     if(block_num == 0) {
       offset += block_size;
@@ -1352,6 +2173,7 @@ static i64 dir_remove_entry(
           }
 
           kfree(block_buf);
+          dcache_add(vol, dir_ino, name, 0, 0);
           return 0;
         }
       }
@@ -1387,7 +2209,7 @@ static bool
   u32 offset = 0;
   while(offset < dir_size) {
     u32 file_block = offset / block_size;
-    u32 block_num  = get_block_num(vol, dir_inode, file_block);
+    u32 block_num  = get_block_num(vol, dir_inode, NULL, file_block);
 
     if(block_num == 0) {
       offset += block_size;
@@ -1508,8 +2330,13 @@ static void build_symlink_path(
 
 /**
  * @brief Resolve a path to an inode, following symlinks.
+ *
+ * A path starting with '/' is resolved from the volume root, anything else
+ * from directory @p start_ino.
+ *
  * @param vol          Volume.
- * @param path         Path to resolve (relative to volume root).
+ * @param start_ino    Directory the walk starts from for relative paths.
+ * @param path         Path to resolve.
  * @param out_ino      Output inode number.
  * @param out_inode    Output inode structure.
  * @param follow_depth Current symlink-follow depth (prevents loops).
@@ -1518,22 +2345,24 @@ static void build_symlink_path(
 #define SYMLINK_MAX_FOLLOW 8
 
 static i64 resolve_path_depth(
-    const ext2_volume_t *vol, const char *path, u32 *out_ino,
+    const ext2_volume_t *vol, u32 start_ino, const char *path, u32 *out_ino,
     ext2_inode_t *out_inode, int follow_depth
 )
 {
   if(follow_depth > SYMLINK_MAX_FOLLOW)
     return -ELOOP;
 
-  u32          current_ino = EXT2_ROOT_INODE;
+  u32          current_ino = start_ino;
   ext2_inode_t current_inode;
 
-  if(read_inode(vol, current_ino, &current_inode) < 0)
-    return -EIO;
-
   /* Skip leading slash */
-  if(path[0] == '/')
+  if(path[0] == '/') {
+    current_ino = EXT2_ROOT_INODE;
     path++;
+  }
+
+  if(read_inode(vol, current_ino, &current_inode) < 0)
+    return -EIO;
 
   /* Empty path = root */
   if(path[0] == '\0') {
@@ -1570,8 +2399,10 @@ static i64 resolve_path_depth(
     /* Find entry */
     u32 entry_ino;
     u8  entry_type;
-    if(dir_find_entry(vol, &current_inode, component, &entry_ino, &entry_type) <
-       0)
+    if(dir_lookup(
+           vol, current_ino, &current_inode, component, &entry_ino,
+           &entry_type
+       ) < 0)
       return -ENOENT;
 
     current_ino = entry_ino;
@@ -1618,7 +2449,7 @@ static i64 resolve_path_depth(
       }
 
       return resolve_path_depth(
-          vol, followed, out_ino, out_inode, follow_depth + 1
+          vol, start_ino, followed, out_ino, out_inode, follow_depth + 1
       );
     }
   }
@@ -1641,7 +2472,7 @@ static i64 resolve_path(
     ext2_inode_t *out_inode
 )
 {
-  return resolve_path_depth(vol, path, out_ino, out_inode, 0);
+  return resolve_path_depth(vol, EXT2_ROOT_INODE, path, out_ino, out_inode, 0);
 }
 
 /**
@@ -1772,6 +2603,25 @@ ext2_volume_t *ext2_mount(u8 drive, u32 partition_lba)
   kmemcpy(vol->groups, gdt_buf, vol->groups_count * sizeof(ext2_group_desc_t));
   kfree(gdt_buf);
 
+  /* Bitmaps are read per group on first allocation there */
+  u64 maps_size      = (u64)vol->groups_count * sizeof(ext2_bitmap_t);
+  vol->block_bitmaps = kmalloc(maps_size);
+  vol->inode_bitmaps = kmalloc(maps_size);
+  vol->gdt_dirty     = kmalloc(gdt_blocks);
+  if(!vol->block_bitmaps || !vol->inode_bitmaps || !vol->gdt_dirty) {
+    kfree(vol->block_bitmaps);
+    kfree(vol->inode_bitmaps);
+    kfree(vol->gdt_dirty);
+    kfree(vol->groups);
+    console_print("[EXT2] Failed to allocate bitmap table\n");
+    return NULL;
+  }
+  kzero(vol->block_bitmaps, maps_size);
+  kzero(vol->inode_bitmaps, maps_size);
+  kzero(vol->gdt_dirty, gdt_blocks);
+  vol->sb_dirty     = false;
+  vol->meta_changes = 0;
+
   vol->mounted = true;
 
   console_printf(
@@ -1783,13 +2633,15 @@ ext2_volume_t *ext2_mount(u8 drive, u32 partition_lba)
 }
 
 /**
- * @brief Open a file or directory on an ext2 volume.
+ * @brief Open a file or directory, resolving relative paths from a directory.
  *
- * @param vol  Volume handle.
- * @param path Path to open.
+ * @param vol       Volume handle.
+ * @param start_ino Directory inode that relative paths start from.
+ * @param path      Path to open.
  * @return File handle, or NULL on failure.
  */
-ext2_file_t *ext2_open(ext2_volume_t *vol, const char *path)
+static ext2_file_t *
+    open_from(ext2_volume_t *vol, u32 start_ino, const char *path)
 {
   if(!vol || !vol->mounted || !path)
     return NULL;
@@ -1809,20 +2661,35 @@ ext2_file_t *ext2_open(ext2_volume_t *vol, const char *path)
   /* Resolve path */
   u32          ino;
   ext2_inode_t inode;
-  if(resolve_path(vol, path, &ino, &inode) < 0)
+  if(resolve_path_depth(vol, start_ino, path, &ino, &inode, 0) < 0)
+    return NULL;
+
+  ext2_cinode_t *ci = inode_get(vol, ino);
+  if(!ci)
     return NULL;
 
   /* Fill file handle */
   file->vol       = vol;
   file->inode_num = ino;
-  file->inode     = inode;
+  file->ci        = ci;
   file->is_dir    = (inode.i_mode & EXT2_S_IFMT) == EXT2_S_IFDIR;
   file->in_use    = true;
-  file->dirty     = false;
 
   return file;
 }
 
+/**
+ * @brief Open a file or directory on an ext2 volume.
+ *
+ * @param vol  Volume handle.
+ * @param path Path to open.
+ * @return File handle, or NULL on failure.
+ */
+ext2_file_t *ext2_open(ext2_volume_t *vol, const char *path)
+{
+  return open_from(vol, EXT2_ROOT_INODE, path);
+}
+
 /**
  * @brief Close an ext2 file handle.
  *
@@ -1835,12 +2702,29 @@ void ext2_close(ext2_file_t *file)
   if(!file || !file->in_use)
     return;
 
-  if(file->dirty) {
-    write_inode(file->vol, file->inode_num, &file->inode);
-    flush_metadata(file->vol);
-  }
-
-  file->in_use = false;
+  /* The last handle gives the preallocation window back. */
+  if(file->ci->refs == 1 && file->ci->pa.count)
+    prealloc_discard(file->vol, &file->ci->pa);
+
+  if(file->ci->dirty) {
+    write_inode(file->vol, file->inode_num, &file->ci->inode);
+    file->ci->dirty = false;
+  }
+  metadata_tick(file->vol);
+  inode_put(file->ci);
+  file->ci = NULL;
+
+  if(file->map.ptrs)
+    kfree(file->map.ptrs);
+  kzero(&file->map, sizeof(file->map));
+  if(file->runs)
+    kfree(file->runs);
+  file->runs     = NULL;
+  file->nruns    = 0;
+  file->runs_off = false;
+  file->rd_index = 0;
+  file->rd_pos   = 0;
+  file->in_use   = false;
 }
 
 /**
@@ -1860,121 +2744,136 @@ i64 ext2_read(ext2_file_t *file, void *buf, u64 count, u64 offset)
   u8                  *dst        = (u8 *)buf;
   u64                  bytes_read = 0;
   u32                  block_size = vol->block_size;
+  u32                  spb        = block_size / EXT2_SECTOR_SIZE;
 
   /* Limit to file size */
-  if(offset >= file->inode.i_size)
+  if(offset >= file->ci->inode.i_size)
     return 0;
-  if(offset + count > file->inode.i_size)
-    count = file->inode.i_size - offset;
+  if(offset + count > file->ci->inode.i_size)
+    count = file->ci->inode.i_size - offset;
 
   u8 *block_buf = cache_get_block(block_size);
   if(!block_buf)
     return -ENOMEM;
 
-  /* Multi-block read buffer (allocated once, optional fallback). */
-  u8 *run_buf = kmalloc((u64)EXT2_READ_RUN_MAX * block_size);
-
   while(bytes_read < count) {
     u64 current_pos  = offset + bytes_read;
     u32 file_block   = current_pos / block_size;
     u32 block_offset = current_pos % block_size;
-    u32 block_num    = get_block_num(vol, &file->inode, file_block);
+    u64 remaining    = count - bytes_read;
+    u32 max_run =
+        (u32)((remaining + block_offset + block_size - 1) / block_size);
+    u32 run;
+    u32 block_num = file_extent(file, file_block, max_run, &run);
 
     if(block_num == 0) {
       /* Sparse file - return zeros */
-      u64 to_read = block_size - block_offset;
-      if(to_read > count - bytes_read)
-        to_read = count - bytes_read;
+      u64 to_read = (u64)run * block_size - block_offset;
+      if(to_read > remaining)
+        to_read = remaining;
       kzero(dst + bytes_read, to_read);
       bytes_read += to_read;
       continue;
     }
 
-    u64 remaining = count - bytes_read;
-
-    if(run_buf) {
-      /* Multi-block fast path. */
-      u32 max_run =
-          (u32)((remaining + block_offset + block_size - 1) / block_size);
-      if(max_run > EXT2_READ_RUN_MAX)
-        max_run = EXT2_READ_RUN_MAX;
-
-      /* Detect how many consecutive disk blocks follow block_num. */
-      u32 run = 1;
-      while(run < max_run) {
-        u32 nxt = get_block_num(vol, &file->inode, file_block + run);
-        if(nxt != block_num + run)
-          break;
-        run++;
-      }
-
-      if(run == 1) {
-        /* Only one block (or fragmented): use cached single-block read. */
-        if(vol_read_block(vol, block_num, block_buf) < 0) {
-          kfree(run_buf);
-          cache_put_block(block_buf);
-          return bytes_read > 0 ? (i64)bytes_read : -EIO;
-        }
-        u64 to_read = block_size - block_offset;
-        if(to_read > remaining)
-          to_read = remaining;
-        kmemcpy(dst + bytes_read, block_buf + block_offset, to_read);
-        bytes_read += to_read;
-      } else {
-        /* Multi-block DMA: read `run` consecutive disk blocks at once. */
-        u32 sectors  = run * (block_size / EXT2_SECTOR_SIZE);
-        u32 base_sec = block_num * (block_size / EXT2_SECTOR_SIZE);
-        if(vol_read_sectors(vol, base_sec, sectors, run_buf) < 0) {
-          kfree(run_buf);
-          cache_put_block(block_buf);
-          return bytes_read > 0 ? (i64)bytes_read : -EIO;
-        }
-
-        u64 avail   = (u64)run * block_size - block_offset;
-        u64 to_read = remaining < avail ? remaining : avail;
-        kmemcpy(dst + bytes_read, run_buf + block_offset, to_read);
-        bytes_read += to_read;
-      }
-    } else {
-      /* run_buf unavailable: fall back to single-block reads. */
-      if(vol_read_block(vol, block_num, block_buf) < 0) {
+    if(block_offset == 0 && remaining >= block_size) {
+      /* Whole blocks of one extent: a single request into the caller. */
+      if(remaining / block_size < run)
+        run = (u32)(remaining / block_size);
+      if(vol_read_sectors(vol, block_num * spb, run * spb, dst + bytes_read) <
+         0) {
         cache_put_block(block_buf);
         return bytes_read > 0 ? (i64)bytes_read : -EIO;
       }
-      u64 to_read = block_size - block_offset;
-      if(to_read > remaining)
-        to_read = remaining;
-      kmemcpy(dst + bytes_read, block_buf + block_offset, to_read);
-      bytes_read += to_read;
+      bytes_read += (u64)run * block_size;
+      continue;
+    }
+
+    /* Partial block: go through the block buffer. */
+    if(vol_read_block(vol, block_num, block_buf) < 0) {
+      cache_put_block(block_buf);
+      return bytes_read > 0 ? (i64)bytes_read : -EIO;
     }
+    u64 to_read = block_size - block_offset;
+    if(to_read > remaining)
+      to_read = remaining;
+    kmemcpy(dst + bytes_read, block_buf + block_offset, to_read);
+    bytes_read += to_read;
   }
 
-  if(run_buf)
-    kfree(run_buf);
   cache_put_block(block_buf);
   return (i64)bytes_read;
 }
 
+/** @brief Read position in the source buffers of a gather write. */
+typedef struct
+{
+  const vfs_iovec_t *iov;
+  u32                left; /**< Buffers from @c iov on. */
+  u64                off;  /**< Bytes of @c iov[0] already taken. */
+} iov_cursor_t;
+
+/* Bytes left in the current buffer, skipping past empty ones. */
+static u64 iov_run(iov_cursor_t *c)
+{
+  while(c->left && c->off == c->iov->len) {
+    c->iov++;
+    c->left--;
+    c->off = 0;
+  }
+  return c->left ? c->iov->len - c->off : 0;
+}
+
+/* Copy the next @p n bytes of the buffers to @p dst. */
+static void iov_take(iov_cursor_t *c, u8 *dst, u64 n)
+{
+  while(n) {
+    u64 run = iov_run(c);
+    if(run > n)
+      run = n;
+    kmemcpy(dst, (const u8 *)c->iov->base + c->off, run);
+    c->off += run;
+    dst += run;
+    n -= run;
+  }
+}
+
+/** @brief Write data to an ext2 file: ext2_writev() with one buffer. */
+i64 ext2_write(ext2_file_t *file, const void *buf, u64 count, u64 offset)
+{
+  vfs_iovec_t v = {(void *)buf, count};
+  return ext2_writev(file, &v, 1, offset);
+}
+
 /**
- * @brief Write data to an ext2 file.
+ * @brief Write the buffers of @p iov to an ext2 file, back to back.
  *
- * Allocates new blocks as needed and extends the file.
+ * Allocates new blocks as needed and extends the file. A block that
+ * several small buffers share is assembled once and written once, and the
+ * inode goes out once at the end, which is what makes a gather write
+ * cheaper than one write per buffer.
  *
- * @param file  Open file handle.
- * @param buf   Source buffer.
- * @param count Number of bytes to write.
+ * @param file   Open file handle.
+ * @param iov    Source buffers.
+ * @param iovcnt Number of buffers.
+ * @param offset File position of the first byte.
  * @return Bytes written, or negative errno on error.
  */
-i64 ext2_write(ext2_file_t *file, const void *buf, u64 count, u64 offset)
+i64 ext2_writev(
+    ext2_file_t *file, const vfs_iovec_t *iov, u32 iovcnt, u64 offset
+)
 {
   if(!file || !file->in_use || file->is_dir)
     return -EINVAL;
 
+  u64 count = 0;
+  for(u32 i = 0; i < iovcnt; i++)
+    count += iov[i].len;
   if(count == 0)
     return 0;
 
   ext2_volume_t *vol           = file->vol;
-  const u8      *src           = (const u8 *)buf;
+  iov_cursor_t   src           = {iov, iovcnt, 0};
   u64            bytes_written = 0;
   u32            block_size    = vol->block_size;
   u32            preferred_grp = (file->inode_num - 1) / vol->inodes_per_group;
@@ -1983,67 +2882,232 @@ i64 ext2_write(ext2_file_t *file, const void *buf, u64 count, u64 offset)
   if(!block_buf)
     return -ENOMEM;
 
+  /* Blocks allocated by this call, mapped to consecutive disk blocks and
+   * not yet written: [fresh_lo, fresh_hi) -> fresh_disk. */
+  u32 fresh_lo   = 0;
+  u32 fresh_hi   = 0;
+  u32 fresh_disk = 0;
+  u32 goal       = 0;
+  u32 end_block  = (u32)((offset + count + block_size - 1) / block_size);
+
   while(bytes_written < count) {
     u64 current_pos  = offset + bytes_written;
     u32 file_block   = current_pos / block_size;
     u32 block_offset = current_pos % block_size;
+    u64 left         = count - bytes_written;
+
+    u32 block_num;
+    if(file_block >= fresh_lo && file_block < fresh_hi) {
+      block_num = fresh_disk + (file_block - fresh_lo);
+    } else {
+      block_num = get_block_num(vol, &file->ci->inode, &file->map, file_block);
+    }
 
-    /* Allocate block if needed */
-    u32 block_num = get_block_num(vol, &file->inode, file_block);
+    /* Allocate blocks for the rest of the write if needed */
     if(block_num == 0) {
-      block_num =
-          alloc_file_block(vol, &file->inode, file_block, preferred_grp);
+      if(goal == 0 && file_block > 0)
+        goal = get_block_num(vol, &file->ci->inode, &file->map, file_block - 1);
+      if(goal)
+        goal++;
+      else
+        goal = preferred_grp * vol->blocks_per_group + vol->first_data_block;
+
+      u32 run;
+      block_num = alloc_file_blocks(
+          vol, &file->ci->inode, &file->ci->pa, file_block,
+          end_block - file_block, goal, &run
+      );
       if(block_num == 0) {
         cache_put_block(block_buf);
         return bytes_written > 0 ? (i64)bytes_written : -ENOSPC;
       }
-      file->dirty = true;
+      fresh_lo   = file_block;
+      fresh_hi   = file_block + run;
+      fresh_disk = block_num;
+      file->ci->dirty = true;
+      tree_changed(vol, file->inode_num);
     }
 
-    /* Read existing block for partial write */
-    if(block_offset != 0 || (count - bytes_written) < block_size) {
-      if(vol_read_block(vol, block_num, block_buf) < 0) {
+    bool fresh   = file_block >= fresh_lo && file_block < fresh_hi;
+    u64  to_write;
+
+    u64 run = iov_run(&src);
+    if(fresh && block_offset == 0 && run >= block_size) {
+      /* Whole new blocks go straight from the caller's buffer. */
+      u64 whole = run / block_size;
+      if(whole > fresh_hi - file_block)
+        whole = fresh_hi - file_block;
+
+      u32 spb = block_size / EXT2_SECTOR_SIZE;
+      if(vol_write_sectors(
+             vol, block_num * spb, (u32)whole * spb,
+             (const u8 *)src.iov->base + src.off
+         ) < 0) {
         cache_put_block(block_buf);
         return bytes_written > 0 ? (i64)bytes_written : -EIO;
       }
-    }
+      to_write = whole * block_size;
+      src.off += to_write;
+      goal     = block_num + (u32)whole - 1;
+    } else {
+      /* New blocks start zeroed; an existing one is read for a partial
+       * write. */
+      if(fresh) {
+        kzero(block_buf, block_size);
+      } else if(block_offset != 0 || left < block_size) {
+        if(vol_read_block(vol, block_num, block_buf) < 0) {
+          cache_put_block(block_buf);
+          return bytes_written > 0 ? (i64)bytes_written : -EIO;
+        }
+      }
 
-    u64 to_write = block_size - block_offset;
-    if(to_write > count - bytes_written)
-      to_write = count - bytes_written;
+      to_write = block_size - block_offset;
+      if(to_write > left)
+        to_write = left;
 
-    kmemcpy(block_buf + block_offset, src + bytes_written, to_write);
+      iov_take(&src, block_buf + block_offset, to_write);
 
-    if(vol_write_block(vol, block_num, block_buf) < 0) {
-      cache_put_block(block_buf);
-      return bytes_written > 0 ? (i64)bytes_written : -EIO;
+      if(vol_write_block(vol, block_num, block_buf) < 0) {
+        cache_put_block(block_buf);
+        return bytes_written > 0 ? (i64)bytes_written : -EIO;
+      }
+      goal = block_num;
     }
 
     bytes_written += to_write;
 
-    if(current_pos + to_write > file->inode.i_size) {
-      file->inode.i_size = current_pos + to_write;
-      file->dirty        = true;
+    if(current_pos + to_write > file->ci->inode.i_size) {
+      file->ci->inode.i_size = current_pos + to_write;
+      file->ci->dirty        = true;
     }
   }
 
   cache_put_block(block_buf);
 
-  if(file->dirty) {
-    write_inode(vol, file->inode_num, &file->inode);
+  if(file->ci->dirty) {
+    write_inode(vol, file->inode_num, &file->ci->inode);
   }
 
   return (i64)bytes_written;
 }
 
+/* Zero @p bytes of pinned pages from byte @p pos of the run on. */
+static void pages_zero(const u64 *pages, u64 pos, u64 bytes)
+{
+  while(bytes) {
+    u64 in = pos % PAGE_SIZE;
+    u64 n  = PAGE_SIZE - in < bytes ? PAGE_SIZE - in : bytes;
+    kzero((u8 *)phys_to_virt(pages[pos / PAGE_SIZE]) + in, n);
+    pos   += n;
+    bytes -= n;
+  }
+}
+
+i64 ext2_direct(
+    ext2_file_t *file, bool write, const u64 *pages, u32 first, u64 count,
+    u64 offset
+)
+{
+  if(!file || !file->in_use || file->is_dir)
+    return -EINVAL;
+
+  ext2_volume_t *vol        = file->vol;
+  u32            block_size = vol->block_size;
+  u32            spb        = block_size / EXT2_SECTOR_SIZE;
+  u64            size       = file->ci->inode.i_size;
+  u64            end        = offset + count;
+  u32            goal       = 0;
+  u64            done       = 0;
+  i64            r          = 0;
+
+  if(count % block_size || offset % block_size)
+    return -EOPNOTSUPP;
+  if(!write) {
+    if(offset >= size)
+      return 0;
+    /* Whole blocks, up to the one holding end-of-file. */
+    if(end > size)
+      end = offset + (size - offset + block_size - 1) / block_size * block_size;
+  }
+
+  while(offset + done < end) {
+    u32 file_block = (u32)((offset + done) / block_size);
+    u32 max        = (u32)((end - offset - done) / block_size);
+    u32 run;
+    u32 block_num = file_extent(file, file_block, max, &run);
+
+    if(block_num == 0 && !write) {
+      pages_zero(pages, first + done, (u64)run * block_size);
+      done += (u64)run * block_size;
+      continue;
+    }
+    if(block_num == 0) {
+      if(goal == 0 && file_block > 0)
+        goal = get_block_num(vol, &file->ci->inode, &file->map, file_block - 1);
+      if(goal)
+        goal++;
+      else
+        goal = (file->inode_num - 1) / vol->inodes_per_group *
+                   vol->blocks_per_group +
+               vol->first_data_block;
+      block_num = alloc_file_blocks(
+          vol, &file->ci->inode, &file->ci->pa, file_block, run, goal, &run
+      );
+      if(block_num == 0) {
+        r = -ENOSPC;
+        break;
+      }
+      file->ci->dirty = true;
+      tree_changed(vol, file->inode_num);
+    }
+
+    u64 at = first + done;
+    r      = ata_direct(
+        vol->drive, write ? ATA_BIO_WRITE : ATA_BIO_READ,
+        vol->partition_lba + (u64)block_num * spb, run * spb,
+        pages + at / PAGE_SIZE, (u32)(at % PAGE_SIZE)
+    );
+    if(r < 0)
+      break;
+    done += (u64)run * block_size;
+    goal  = block_num + run - 1;
+    if(write && offset + done > file->ci->inode.i_size) {
+      file->ci->inode.i_size = offset + done;
+      file->ci->dirty        = true;
+    }
+  }
+
+  if(write && file->ci->dirty)
+    write_inode(vol, file->inode_num, &file->ci->inode);
+  if(!write && done > size - offset)
+    done = size - offset;
+  return done > 0 ? (i64)done : r;
+}
+
 /**
- * @brief Read the next directory entry.
+ * @brief Receives one used entry from dir_iterate().
+ * @param ctx Caller context.
+ * @param de Entry (valid during the call only).
+ * @param next Directory byte position just past the entry.
+ * @return true to continue, false to stop.
+ */
+typedef bool (*dirent_fn_t)(void *ctx, const ext2_dirent_t *de, u64 next);
+
+/**
+ * @brief Pass directory entries from byte position @p pos on to @p fill.
  *
- * @param dir   Open directory handle.
- * @param entry Output entry structure.
- * @return 1 if an entry was read, 0 at end, or negative errno on error.
+ * Positions are byte offsets into the directory. One that points inside a
+ * block may be stale (its entry was merged into the previous one since),
+ * so the block is walked from its start to the first record boundary at or
+ * past it.
+ *
+ * @param dir  Open directory handle.
+ * @param pos  Byte position to start from.
+ * @param fill Entry callback.
+ * @param ctx  Passed to @p fill.
+ * @return 0 on success, negative errno on error.
  */
-i64 ext2_readdir(ext2_file_t *dir, u64 index, ext2_entry_t *entry)
+static i64 dir_iterate(ext2_file_t *dir, u64 pos, dirent_fn_t fill, void *ctx)
 {
   if(!dir || !dir->in_use || !dir->is_dir)
     return -EINVAL;
@@ -2055,61 +3119,126 @@ i64 ext2_readdir(ext2_file_t *dir, u64 index, ext2_entry_t *entry)
   if(!block_buf)
     return -ENOMEM;
 
-  u32 current_entry = 0;
-  u32 pos           = 0;
+  bool check = pos % block_size != 0;
+  i64  ret   = 0;
 
-  while(pos < dir->inode.i_size) {
-    u32 file_block   = pos / block_size;
-    u32 block_offset = pos % block_size;
-    u32 block_num    = get_block_num(vol, &dir->inode, file_block);
+  while(pos < dir->ci->inode.i_size) {
+    u32 file_block = (u32)(pos / block_size);
+    u32 offset     = (u32)(pos % block_size);
+    u32 block_num =
+        get_block_num(vol, &dir->ci->inode, &dir->map, file_block);
 
+    pos = (u64)(file_block + 1) * block_size;
     if(block_num == 0) {
-      pos = (file_block + 1) * block_size;
+      check = false;
       continue;
     }
 
     if(vol_read_block(vol, block_num, block_buf) < 0) {
-      cache_put_block(block_buf);
-      return -EIO;
-    }
-
-    const ext2_dirent_t *de = (const ext2_dirent_t *)(block_buf + block_offset);
-
-    if(de->rec_len == 0) {
-      pos = (file_block + 1) * block_size;
-      continue;
+      ret = -EIO;
+      break;
     }
 
-    if(de->inode != 0) {
-      if(current_entry == index) {
-        /* Copy entry info */
-        u32 name_len = de->name_len;
-        if(name_len > EXT2_NAME_MAX)
-          name_len = EXT2_NAME_MAX;
-        kmemcpy(entry->name, de->name, name_len);
-        entry->name[name_len] = '\0';
-        entry->inode          = de->inode;
-        entry->file_type      = de->file_type;
-
-        /* Get file size */
-        ext2_inode_t file_inode;
-        if(read_inode(vol, de->inode, &file_inode) == 0) {
-          entry->size = file_inode.i_size;
-        } else {
-          entry->size = 0;
+    if(check) {
+      u32 at = 0;
+      while(at < offset) {
+        u16 rec_len = ((const ext2_dirent_t *)(block_buf + at))->rec_len;
+        if(rec_len == 0) {
+          at = block_size;
+          break;
         }
-
-        cache_put_block(block_buf);
-        return 1;
+        at += rec_len;
       }
-      current_entry++;
+      offset = at;
+      check  = false;
     }
 
-    pos += de->rec_len;
+    while(offset + sizeof(ext2_dirent_t) <= block_size) {
+      const ext2_dirent_t *de = (const ext2_dirent_t *)(block_buf + offset);
+      if(de->rec_len == 0 || offset + de->rec_len > block_size)
+        break;
+
+      u64 next = (u64)file_block * block_size + offset + de->rec_len;
+      if(de->inode != 0 && !fill(ctx, de, next))
+        goto out;
+      offset += de->rec_len;
+    }
   }
 
+out:
   cache_put_block(block_buf);
-  return 0;
+  return ret;
+}
+
+/** @brief ext2_readdir() state: entries to skip, then the one to return. */
+typedef struct
+{
+  u64           skip;
+  ext2_entry_t *entry;
+  u64           next;
+  bool          found;
+} readdir_ctx_t;
+
+static bool readdir_fill(void *ctx, const ext2_dirent_t *de, u64 next)
+{
+  readdir_ctx_t *r = ctx;
+  if(r->skip) {
+    r->skip--;
+    return true;
+  }
+
+  u32 name_len = de->name_len;
+  if(name_len > EXT2_NAME_MAX)
+    name_len = EXT2_NAME_MAX;
+  kmemcpy(r->entry->name, de->name, name_len);
+  r->entry->name[name_len] = '\0';
+  r->entry->inode          = de->inode;
+  r->entry->file_type      = de->file_type;
+  r->next                  = next;
+  r->found                 = true;
+  return false;
+}
+
+/**
+ * @brief Read the directory entry at position @p index.
+ *
+ * The handle remembers where the entry after the last one returned lives,
+ * so reading entries in order costs one step each.
+ *
+ * @param dir   Open directory handle.
+ * @param index Zero-based entry index.
+ * @param entry Output entry structure.
+ * @return 1 if an entry was read, 0 at end, or negative errno on error.
+ */
+i64 ext2_readdir(ext2_file_t *dir, u64 index, ext2_entry_t *entry)
+{
+  if(!dir || !dir->in_use || !dir->is_dir)
+    return -EINVAL;
+
+  readdir_ctx_t r   = {.skip = index, .entry = entry};
+  u64           pos = 0;
+  if(index >= dir->rd_index) {
+    r.skip = index - dir->rd_index;
+    pos    = dir->rd_pos;
+  }
+
+  i64 ret = dir_iterate(dir, pos, readdir_fill, &r);
+  if(ret < 0)
+    return ret;
+  if(!r.found)
+    return 0;
+
+  dir->rd_index = index + 1;
+  dir->rd_pos   = r.next;
+
+  /* Get file size */
+  ext2_inode_t file_inode;
+  if(read_inode(dir->vol, entry->inode, &file_inode) == 0) {
+    entry->size = file_inode.i_size;
+  } else {
+    entry->size = 0;
+  }
+  return 1;
 }
 
 /**
@@ -2201,7 +3330,9 @@ i64 ext2_readlink(
 
   u32 entry_ino;
   u8  entry_type;
-  if(dir_find_entry(vol, &parent_inode, filename, &entry_ino, &entry_type) < 0)
+  if(dir_lookup(
+         vol, parent_ino, &parent_inode, filename, &entry_ino, &entry_type
+     ) < 0)
     return -ENOENT;
 
   ext2_inode_t inode;
@@ -2304,15 +3435,18 @@ ext2_file_t *ext2_create(ext2_volume_t *vol, const char *path)
     return NULL;
   }
 
-  flush_metadata(vol);
+  metadata_tick(vol);
+
+  ext2_cinode_t *ci = inode_get(vol, new_ino);
+  if(!ci)
+    return NULL;
 
   /* Fill file handle */
   file->vol       = vol;
   file->inode_num = new_ino;
-  file->inode     = new_inode;
+  file->ci        = ci;
   file->is_dir    = false;
   file->in_use    = true;
-  file->dirty     = false;
 
   return file;
 }
@@ -2432,7 +3566,7 @@ i64 ext2_mkdir(ext2_volume_t *vol, const char *path)
   parent_inode.i_links_count++;
   write_inode(vol, parent_ino, &parent_inode);
 
-  flush_metadata(vol);
+  metadata_tick(vol);
   return 0;
 }
 
@@ -2457,18 +3591,20 @@ i64 ext2_truncate(ext2_file_t *file, u64 length)
 
   ext2_volume_t *vol = file->vol;
 
+  prealloc_discard(vol, &file->ci->pa);
   if(length == 0) {
     /* Free all data blocks. */
-    free_inode_blocks(vol, &file->inode);
+    free_inode_blocks(vol, &file->ci->inode);
+    tree_changed(vol, file->inode_num);
   }
 
-  file->inode.i_size = (u32)length;
-  file->dirty        = false; /* Inode is written below. */
+  file->ci->inode.i_size = (u32)length;
+  file->ci->dirty        = false; /* Inode is written below. */
 
-  if(write_inode(vol, file->inode_num, &file->inode) < 0)
+  if(write_inode(vol, file->inode_num, &file->ci->inode) < 0)
     return -EIO;
 
-  return flush_metadata(vol);
+  return metadata_tick(vol);
 }
 
 /**
@@ -2482,16 +3618,14 @@ i64 ext2_flush(ext2_file_t *file)
   if(!file || !file->in_use)
     return -EINVAL;
 
-  if(!file->dirty)
-    return 0;
-
-  if(write_inode(file->vol, file->inode_num, &file->inode) < 0)
-    return -EIO;
+  if(file->ci->dirty) {
+    if(write_inode(file->vol, file->inode_num, &file->ci->inode) < 0)
+      return -EIO;
+    file->ci->dirty = false;
+  }
 
   if(flush_metadata(file->vol) < 0)
     return -EIO;
-
-  file->dirty = false;
   return 0;
 }
 
@@ -2530,7 +3664,7 @@ i64 ext2_unlink(ext2_volume_t *vol, const char *path)
     return -ENOENT;
 
   /* Remove directory entry */
-  if(dir_remove_entry(vol, &parent_inode, filename) < 0)
+  if(dir_remove_entry(vol, parent_ino, &parent_inode, filename) < 0)
     return -EIO;
 
   /* Decrement link count */
@@ -2540,11 +3674,12 @@ i64 ext2_unlink(ext2_volume_t *vol, const char *path)
     /* Free all blocks and inode */
     free_inode_blocks(vol, &file_inode);
     free_inode(vol, file_ino, false);
+    tree_changed(vol, file_ino);
   } else {
     write_inode(vol, file_ino, &file_inode);
   }
 
-  flush_metadata(vol);
+  metadata_tick(vol);
   return 0;
 }
 
@@ -2589,7 +3724,7 @@ i64 ext2_rmdir(ext2_volume_t *vol, const char *path)
     return -ENOENT;
 
   /* Remove directory entry from parent */
-  if(dir_remove_entry(vol, &parent_inode, dirname) < 0)
+  if(dir_remove_entry(vol, parent_ino, &parent_inode, dirname) < 0)
     return -EIO;
 
   /* Decrement parent link count (for ..) */
@@ -2599,8 +3734,9 @@ i64 ext2_rmdir(ext2_volume_t *vol, const char *path)
   /* Free directory blocks and inode */
   free_inode_blocks(vol, &dir_inode);
   free_inode(vol, dir_ino, true);
+  dcache_drop_dir(vol, dir_ino);
 
-  flush_metadata(vol);
+  metadata_tick(vol);
   return 0;
 }
 
@@ -2615,6 +3751,15 @@ static fs_handle_t ext2_ops_open(void *fs_data, const char *path, u32 flags)
                                          : ext2_open(v, path));
 }
 
+static fs_handle_t
+    ext2_ops_open_at(fs_handle_t dir, const char *path, u32 flags)
+{
+  ext2_file_t *d = (ext2_file_t *)dir;
+  if(!d || !d->in_use || !d->is_dir || (flags & O_CREAT))
+    return NULL;
+  return (fs_handle_t)open_from(d->vol, d->inode_num, path);
+}
+
 static void ext2_ops_close(fs_handle_t fh)
 {
   ext2_close((ext2_file_t *)fh);
@@ -2622,7 +3767,11 @@ static void ext2_ops_close(fs_handle_t fh)
 
 static i64 ext2_ops_read(fs_handle_t fh, void *buf, u64 count, u64 offset)
 {
-  return ext2_read((ext2_file_t *)fh, buf, count, offset);
+  ext2_file_t *f = (ext2_file_t *)fh;
+  TRACE(ALCOR_TRACE_EXT2_READ, f ? f->inode_num : 0, offset, count);
+  i64 r = ext2_read(f, buf, count, offset);
+  TRACE(ALCOR_TRACE_EXT2_READ_END, r, 0, 0);
+  return r;
 }
 
 static i64
@@ -2631,6 +3780,21 @@ static i64
   return ext2_write((ext2_file_t *)fh, buf, count, offset);
 }
 
+static i64 ext2_ops_writev(
+    fs_handle_t fh, const vfs_iovec_t *iov, u32 iovcnt, u64 offset
+)
+{
+  return ext2_writev((ext2_file_t *)fh, iov, iovcnt, offset);
+}
+
+static i64 ext2_ops_direct(
+    fs_handle_t fh, bool write, const u64 *pages, u32 first, u64 count,
+    u64 offset
+)
+{
+  return ext2_direct((ext2_file_t *)fh, write, pages, first, count, offset);
+}
+
 static i64 ext2_ops_mkdir(void *fs_data, const char *path)
 {
   return ext2_mkdir(fs_data, path);
@@ -2652,7 +3816,7 @@ static i64 ext2_ops_fstat(fs_handle_t fh, vfs_stat_t *st)
   if(!f || !f->in_use || !st)
     return -EINVAL;
 
-  st->size     = f->inode.i_size;
+  st->size     = f->ci->inode.i_size;
   st->type     = f->is_dir ? VFS_DIRECTORY : VFS_FILE;
   st->created  = 0;
   st->modified = 0;
@@ -2690,6 +3854,28 @@ static i64
   return ret;
 }
 
+/* VFS filldir callback and its context, for iterate_fill(). */
+typedef struct
+{
+  vfs_filldir_t fill;
+  void         *ctx;
+} iterate_ctx_t;
+
+static bool iterate_fill(void *ctx, const ext2_dirent_t *de, u64 next)
+{
+  const iterate_ctx_t *it   = ctx;
+  u8                   type = (de->file_type == EXT2_FT_DIR) ? VFS_DIRECTORY
+                                                             : VFS_FILE;
+  return it->fill(it->ctx, de->name, de->name_len, de->inode, type, next);
+}
+
+static i64
+    ext2_ops_iterate(fs_handle_t fh, u64 pos, vfs_filldir_t fill, void *ctx)
+{
+  iterate_ctx_t it = {.fill = fill, .ctx = ctx};
+  return dir_iterate((ext2_file_t *)fh, pos, iterate_fill, &it);
+}
+
 static i64 ext2_ops_truncate(fs_handle_t fh, u64 length)
 {
   return ext2_truncate((ext2_file_t *)fh, length);
@@ -2701,6 +3887,49 @@ static i64
   return ext2_readlink(fs_data, path, buf, cap);
 }
 
+static i64 ext2_ops_fsync(fs_handle_t fh)
+{
+  ext2_file_t *file = (ext2_file_t *)fh;
+  i64          ret  = ext2_flush(file);
+  if(ret < 0)
+    return ret;
+  return ata_sync(file->vol->drive);
+}
+
+static i64 ext2_ops_sync(void *fs_data)
+{
+  ext2_volume_t *vol = fs_data;
+  i64            ret = flush_metadata(vol);
+  if(ret < 0)
+    return ret;
+  return ata_sync(vol->drive);
+}
+
+/* Queue background reads of the disk runs backing [offset, offset+count). */
+static void ext2_ops_readahead(fs_handle_t fh, u64 offset, u64 count)
+{
+  ext2_file_t         *file = (ext2_file_t *)fh;
+  const ext2_volume_t *vol  = file->vol;
+  u32                  spb  = vol->block_size / EXT2_SECTOR_SIZE;
+
+  if(offset >= file->ci->inode.i_size || count == 0)
+    return;
+  if(count > file->ci->inode.i_size - offset)
+    count = file->ci->inode.i_size - offset;
+
+  u32 first = (u32)(offset / vol->block_size);
+  u32 end   = (u32)((offset + count + vol->block_size - 1) / vol->block_size);
+  for(u32 b = first; b < end;) {
+    u32 run;
+    u32 num = file_extent(file, b, end - b, &run);
+    if(num)
+      ata_prefetch(
+          vol->drive, vol->partition_lba + (u64)num * spb, run * spb
+      );
+    b += run;
+  }
+}
+
 static void *ext2_ops_mount(const char *source, u32 flags)
 {
   (void)source;
@@ -2709,18 +3938,25 @@ static void *ext2_ops_mount(const char *source, u32 flags)
 }
 
 static const fs_ops_t g_ext2_fs_ops = {
-    .open     = ext2_ops_open,
-    .close    = ext2_ops_close,
-    .read     = ext2_ops_read,
-    .write    = ext2_ops_write,
-    .mkdir    = ext2_ops_mkdir,
-    .unlink   = ext2_ops_unlink,
-    .rmdir    = ext2_ops_rmdir,
-    .stat     = ext2_ops_stat,
-    .fstat    = ext2_ops_fstat,
-    .readdir  = ext2_ops_readdir,
-    .truncate = ext2_ops_truncate,
-    .readlink = ext2_ops_readlink,
+    .open      = ext2_ops_open,
+    .open_at   = ext2_ops_open_at,
+    .close     = ext2_ops_close,
+    .read      = ext2_ops_read,
+    .write     = ext2_ops_write,
+    .writev    = ext2_ops_writev,
+    .mkdir     = ext2_ops_mkdir,
+    .unlink    = ext2_ops_unlink,
+    .rmdir     = ext2_ops_rmdir,
+    .stat      = ext2_ops_stat,
+    .fstat     = ext2_ops_fstat,
+    .readdir   = ext2_ops_readdir,
+    .iterate   = ext2_ops_iterate,
+    .truncate  = ext2_ops_truncate,
+    .readlink  = ext2_ops_readlink,
+    .fsync     = ext2_ops_fsync,
+    .sync      = ext2_ops_sync,
+    .readahead = ext2_ops_readahead,
+    .direct    = ext2_ops_direct,
 };
 
 static const fs_type_t g_ext2_fstype = {
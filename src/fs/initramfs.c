@@ -0,0 +1,127 @@
+/**
+ * @file src/fs/initramfs.c
+ * @brief Unpack a newc cpio archive into ramfs.
+ *
+ * Each entry is a 110-byte header of ASCII hex fields, the NUL-terminated
+ * name, then the file data; name and data are each padded to 4 bytes.
+ * The entry named @c TRAILER!!! ends the archive. File contents are copied
+ * into ramfs page frames, so the module's memory is not needed afterwards.
+ */
+
+#include <alcor2/errno.h>
+#include <alcor2/fs/initramfs.h>
+#include <alcor2/fs/ramfs.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/kstdlib.h>
+
+#define CPIO_HDR_LEN  110
+#define CPIO_FIELD_W  8
+#define CPIO_MODE     1 /* field indices after the 6-byte magic */
+#define CPIO_FILESIZE 6
+#define CPIO_NAMESIZE 11
+
+#define CPIO_S_IFMT  0170000
+#define CPIO_S_IFDIR 0040000
+#define CPIO_S_IFREG 0100000
+
+/* Field @p idx of the header at @p hdr, or -1 if it is not hex. */
+static i64 cpio_field(const u8 *hdr, u32 idx)
+{
+  const u8 *s = hdr + 6 + idx * CPIO_FIELD_W;
+  i64       v = 0;
+  for(u32 i = 0; i < CPIO_FIELD_W; i++) {
+    u8 c = s[i];
+    if(c >= '0' && c <= '9')
+      v = v << 4 | (c - '0');
+    else if(c >= 'a' && c <= 'f')
+      v = v << 4 | (c - 'a' + 10);
+    else if(c >= 'A' && c <= 'F')
+      v = v << 4 | (c - 'A' + 10);
+    else
+      return -1;
+  }
+  return v;
+}
+
+static u64 cpio_align(u64 off)
+{
+  return (off + 3) & ~3ULL;
+}
+
+/*
+ * Turn archive name @p name ("bin/ls", "./bin/ls" or "/bin/ls") into the
+ * absolute path @p out. Empty names, "." and names with a ".." component
+ * give false.
+ */
+static bool cpio_path(const char *name, char *out)
+{
+  while(name[0] == '.' && name[1] == '/')
+    name += 2;
+  while(*name == '/')
+    name++;
+  if(!*name || kstreq(name, "."))
+    return false;
+
+  for(const char *c = name; *c;) {
+    const char *end = c;
+    while(*end && *end != '/')
+      end++;
+    if(end - c == 2 && c[0] == '.' && c[1] == '.')
+      return false;
+    c = *end ? end + 1 : end;
+  }
+
+  u64 len = kstrlen(name);
+  if(len + 2 > VFS_PATH_MAX)
+    return false;
+  out[0] = '/';
+  kmemcpy(out + 1, name, len + 1);
+  return true;
+}
+
+bool initramfs_is_cpio(const void *data, u64 size)
+{
+  const char *magic = (const char *)data;
+  return size >= CPIO_HDR_LEN && (kstrncmp(magic, "070701", 6) == 0 ||
+                                  kstrncmp(magic, "070702", 6) == 0);
+}
+
+i64 initramfs_unpack(const void *data, u64 size)
+{
+  const u8 *base    = (const u8 *)data;
+  u64       off     = 0;
+  i64       created = 0;
+  char      path[VFS_PATH_MAX];
+
+  for(;;) {
+    if(off > size || !initramfs_is_cpio(base + off, size - off))
+      return -EINVAL;
+    const u8 *hdr   = base + off;
+    i64       mode  = cpio_field(hdr, CPIO_MODE);
+    i64       fsize = cpio_field(hdr, CPIO_FILESIZE);
+    i64       nsize = cpio_field(hdr, CPIO_NAMESIZE);
+    if(mode < 0 || fsize < 0 || nsize <= 0)
+      return -EINVAL;
+
+    u64 name_off = off + CPIO_HDR_LEN;
+    u64 data_off = cpio_align(name_off + (u64)nsize);
+    if(data_off > size || (u64)fsize > size - data_off)
+      return -EINVAL;
+    const char *name = (const char *)base + name_off;
+    if(name[nsize - 1] != '\0')
+      return -EINVAL;
+    if(kstreq(name, "TRAILER!!!"))
+      return created;
+
+    u8 type = 0;
+    if((mode & CPIO_S_IFMT) == CPIO_S_IFDIR)
+      type = VFS_DIRECTORY;
+    else if((mode & CPIO_S_IFMT) == CPIO_S_IFREG)
+      type = VFS_FILE;
+    if(type && cpio_path(name, path) &&
+       ramfs_install(path, type, base + data_off, (u64)fsize) == 0)
+      created++;
+
+    off = cpio_align(data_off + (u64)fsize);
+  }
+}
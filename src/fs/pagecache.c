@@ -0,0 +1,498 @@
+/**
+ * @file src/fs/pagecache.c
+ * @brief Per-inode page cache for file reads, writes and mmap.
+ *
+ * Pages live in a hash table keyed by (volume, inode, index) and on one LRU
+ * list. The cache owns one PMM reference per page; each mapping adds its
+ * own. A page is only evicted once it is clean and no mapping holds it, so
+ * eviction never has to touch page tables. The cache grows up to a share of
+ * RAM and gives pages back through a PMM shrinker when memory runs out.
+ *
+ * Reads fill missing pages in runs with one driver call, so the filesystem
+ * sees large requests. Each open file tracks whether it is read
+ * sequentially; if so, the run extends past the request by a window that
+ * doubles on every sequential read.
+ *
+ * Drivers with a @c get_page op keep file data in frames of their own; those
+ * frames are mapped as-is and never enter the cache.
+ */
+
+#include <alcor2/errno.h>
+#include <alcor2/fs/pagecache.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+
+/** @brief log2 of the hash bucket count. */
+#define PCACHE_HASH_BITS 10
+#define PCACHE_HASH_SIZE (1U << PCACHE_HASH_BITS)
+/** @brief The cache holds at most 1/N of physical memory. */
+#define PCACHE_RAM_SHARE 2
+/** @brief Readahead window bounds, in pages. */
+#define PCACHE_RA_MIN 4
+#define PCACHE_RA_MAX 32
+
+/** @brief One cached file page. */
+typedef struct pcache_page
+{
+  const void         *volume; /**< Volume (mount fs_data). */
+  u64                 ino;    /**< Inode number. */
+  u64                 index;  /**< Page index within the file. */
+  u64                 phys;   /**< Backing frame. */
+  struct pcache_page *hnext;  /**< Hash chain. */
+  struct pcache_page *prev;   /**< LRU list (head = most recent). */
+  struct pcache_page *next;
+  bool                dirty;  /**< Written through a MAP_SHARED mapping. */
+} pcache_page_t;
+
+static pcache_page_t *buckets[PCACHE_HASH_SIZE];
+static pcache_page_t *lru_head;
+static pcache_page_t *lru_tail;
+static u64            nr_pages;
+static u64            max_pages;
+static kmem_cache_t  *page_cache;
+
+static u32 pcache_hash(const void *volume, u64 ino, u64 index)
+{
+  u64 h = (u64)volume ^ (ino * 0x9E3779B97F4A7C15ULL) ^
+          (index * 0xC2B2AE3D27D4EB4FULL);
+  return (u32)((h ^ (h >> 29)) & (PCACHE_HASH_SIZE - 1));
+}
+
+static void lru_unlink(pcache_page_t *pg)
+{
+  if(pg->prev)
+    pg->prev->next = pg->next;
+  else
+    lru_head = pg->next;
+  if(pg->next)
+    pg->next->prev = pg->prev;
+  else
+    lru_tail = pg->prev;
+  pg->prev = pg->next = NULL;
+}
+
+static void lru_push(pcache_page_t *pg)
+{
+  pg->prev = NULL;
+  pg->next = lru_head;
+  if(lru_head)
+    lru_head->prev = pg;
+  lru_head = pg;
+  if(!lru_tail)
+    lru_tail = pg;
+}
+
+static pcache_page_t *pcache_find(const void *volume, u64 ino, u64 index)
+{
+  for(pcache_page_t *pg = buckets[pcache_hash(volume, ino, index)]; pg;
+      pg = pg->hnext) {
+    if(pg->volume == volume && pg->ino == ino && pg->index == index)
+      return pg;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Unhash and free a page, dropping the cache's frame reference.
+ * @param pg Page to drop.
+ */
+static void pcache_drop(pcache_page_t *pg)
+{
+  pcache_page_t **link = &buckets[pcache_hash(pg->volume, pg->ino, pg->index)];
+  while(*link != pg)
+    link = &(*link)->hnext;
+  *link = pg->hnext;
+
+  lru_unlink(pg);
+  pmm_free((void *)pg->phys);
+  kmem_cache_free(page_cache, pg);
+  nr_pages--;
+}
+
+/**
+ * @brief Evict least recently used pages that nobody maps.
+ * @param want Number of pages to evict.
+ * @return Number of pages evicted.
+ */
+static u64 pcache_evict(u64 want)
+{
+  u64 got = 0;
+  for(pcache_page_t *pg = lru_tail, *prev; pg && got < want; pg = prev) {
+    prev = pg->prev;
+    if(!pg->dirty && !pmm_page_shared((void *)pg->phys)) {
+      pcache_drop(pg);
+      got++;
+    }
+  }
+  return got;
+}
+
+static u64 pcache_count(void)
+{
+  return nr_pages;
+}
+
+static const pmm_shrinker_t pcache_shrinker = {
+    .name  = "pagecache",
+    .scan  = pcache_evict,
+    .count = pcache_count,
+};
+
+/**
+ * @brief Cache a filled frame as page @p index of @p e's file.
+ * @param e Open file.
+ * @param index Page index within the file.
+ * @param phys Frame holding the page; the cache takes over its reference.
+ * @return New page (most recently used), or NULL if out of memory.
+ */
+static pcache_page_t *
+    pcache_insert(const vfs_oft_entry_t *e, u64 index, void *phys)
+{
+  pcache_page_t *pg = kmem_cache_alloc(page_cache);
+  if(!pg)
+    return NULL;
+  pg->volume = e->volume;
+  pg->ino    = e->ino;
+  pg->index  = index;
+  pg->phys   = (u64)phys;
+  pg->dirty  = false;
+
+  u32 h      = pcache_hash(pg->volume, pg->ino, pg->index);
+  pg->hnext  = buckets[h];
+  buckets[h] = pg;
+  lru_push(pg);
+  nr_pages++;
+  return pg;
+}
+
+/** @brief Allocate a frame for a new page, evicting one if at the limit. */
+static void *pcache_alloc_frame(void)
+{
+  if(nr_pages >= max_pages)
+    pcache_evict(1);
+  return pmm_alloc();
+}
+
+/**
+ * @brief Find a page in the cache, reading it from the file on a miss.
+ *
+ * The lookup is repeated after the read, which may block, so two faults
+ * on the same page never cache it twice.
+ *
+ * @param e Open file.
+ * @param index Page index within the file.
+ * @return Cached page (now most recently used), or NULL on failure.
+ */
+static pcache_page_t *pcache_lookup(const vfs_oft_entry_t *e, u64 index)
+{
+  pcache_page_t *pg = pcache_find(e->volume, e->ino, index);
+  if(pg) {
+    lru_unlink(pg);
+    lru_push(pg);
+    return pg;
+  }
+
+  void *phys = pcache_alloc_frame();
+  if(!phys)
+    return NULL;
+
+  u8 *dst = (u8 *)phys_to_virt((u64)phys);
+  i64 n   = e->ops->read(e->handle, dst, PAGE_SIZE, index * PAGE_SIZE);
+  if(n < 0) {
+    pmm_free(phys);
+    return NULL;
+  }
+  kzero(dst + n, PAGE_SIZE - (u64)n);
+
+  pg = pcache_find(e->volume, e->ino, index);
+  if(pg) {
+    pmm_free(phys);
+    lru_unlink(pg);
+    lru_push(pg);
+    return pg;
+  }
+
+  pg = pcache_insert(e, index, phys);
+  if(!pg)
+    pmm_free(phys);
+  return pg;
+}
+
+/**
+ * @brief Read a run of missing pages with one driver call and cache them.
+ *
+ * Covers [first, end) up to the first page already cached, at most
+ * PCACHE_RA_MAX pages, so the filesystem can merge the run into a few large
+ * disk transfers instead of one per page. Failures are silent: the caller
+ * falls back to reading pages one at a time.
+ *
+ * @param e Open file.
+ * @param first First page index (not cached).
+ * @param end End page index (exclusive, within the file).
+ */
+static void pcache_fill(const vfs_oft_entry_t *e, u64 first, u64 end)
+{
+  if(end > first + PCACHE_RA_MAX)
+    end = first + PCACHE_RA_MAX;
+
+  u64 n = 0;
+  while(first + n < end && !pcache_find(e->volume, e->ino, first + n))
+    n++;
+  if(n < 2)
+    return;
+
+  void *run = pmm_alloc_pages(n);
+  if(!run)
+    return;
+
+  u8 *src = (u8 *)phys_to_virt((u64)run);
+  i64 got = e->ops->read(e->handle, src, n * PAGE_SIZE, first * PAGE_SIZE);
+  for(u64 k = 0; got > 0 && k * PAGE_SIZE < (u64)got; k++) {
+    /* The read may have slept; keep whatever got cached meanwhile. */
+    if(pcache_find(e->volume, e->ino, first + k))
+      continue;
+
+    void *phys = pcache_alloc_frame();
+    if(!phys)
+      break;
+    u64 len = (u64)got - k * PAGE_SIZE;
+    if(len > PAGE_SIZE)
+      len = PAGE_SIZE;
+    u8 *dst = (u8 *)phys_to_virt((u64)phys);
+    kmemcpy(dst, src + k * PAGE_SIZE, len);
+    kzero(dst + len, PAGE_SIZE - len);
+    if(!pcache_insert(e, first + k, phys)) {
+      pmm_free(phys);
+      break;
+    }
+  }
+  pmm_free_pages(run, n);
+}
+
+/**
+ * @brief Update a file's readahead state for a read of pages [first, last].
+ *
+ * A read that starts where the previous one ended (or in the page it ended
+ * in) is sequential and doubles the window, up to PCACHE_RA_MAX; any other
+ * read turns readahead off until the reader is sequential again.
+ *
+ * @param ra Readahead state of the open file.
+ * @param first First page of the read.
+ * @param last Last page of the read.
+ * @return Number of pages to read past @p last.
+ */
+static u64 pcache_ra_update(vfs_readahead_t *ra, u64 first, u64 last)
+{
+  if(first != ra->next && first + 1 != ra->next) {
+    ra->window = 0;
+    ra->ahead  = 0;
+  } else if(ra->window == 0)
+    ra->window = PCACHE_RA_MIN;
+  else if(ra->window < PCACHE_RA_MAX)
+    ra->window *= 2;
+  ra->next = last + 1;
+  return ra->window;
+}
+
+void pcache_init(void)
+{
+  kzero(buckets, sizeof(buckets));
+  lru_head   = NULL;
+  lru_tail   = NULL;
+  nr_pages   = 0;
+  max_pages  = pmm_get_total() / PAGE_SIZE / PCACHE_RAM_SHARE;
+  page_cache = kmem_cache_create("pcache_page", sizeof(pcache_page_t), NULL);
+  pmm_register_shrinker(&pcache_shrinker);
+}
+
+void *pcache_get_page(i32 oft_idx, u64 index)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(oft_idx);
+  if(!e || !e->ops || !e->ops->read)
+    return NULL;
+  if(e->ops->get_page)
+    return e->ops->get_page(e->handle, index);
+
+  /* Page-by-page readers (faults, sendfile) mostly move forward. */
+  if(!pcache_find(e->volume, e->ino, index))
+    pcache_fill(e, index, index + PCACHE_RA_MIN);
+  pcache_page_t *pg = pcache_lookup(e, index);
+  if(!pg || !pmm_page_ref((void *)pg->phys))
+    return NULL;
+  return (void *)pg->phys;
+}
+
+void *pcache_peek_page(i32 oft_idx, u64 index)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(oft_idx);
+  if(!e || !e->ops || !e->ops->read)
+    return NULL;
+  if(e->ops->get_page)
+    return e->ops->get_page(e->handle, index);
+
+  pcache_page_t *pg = pcache_find(e->volume, e->ino, index);
+  if(!pg || !pmm_page_ref((void *)pg->phys))
+    return NULL;
+  return (void *)pg->phys;
+}
+
+i64 pcache_read(
+    i32 oft_idx, vfs_readahead_t *ra, void *buf, u64 count, u64 offset
+)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(oft_idx);
+  if(!e || !e->ops || !e->ops->read || !e->ops->fstat)
+    return -EBADF;
+  /* Memory-backed files are their own cache. */
+  if(e->ops->get_page)
+    return e->ops->read(e->handle, buf, count, offset);
+
+  vfs_stat_t st;
+  i64        ret = e->ops->fstat(e->handle, &st);
+  if(ret < 0)
+    return ret;
+  if(offset >= st.size || count == 0)
+    return 0;
+  if(count > st.size - offset)
+    count = st.size - offset;
+
+  u64 last       = (offset + count - 1) / PAGE_SIZE;
+  u64 window     = ra ? pcache_ra_update(ra, offset / PAGE_SIZE, last) : 0;
+  u64 size_pages = (st.size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  /* With a driver hint the window is read in the background below;
+   * otherwise it is read here along with the request. */
+  u64 end = last + 1 + (e->ops->readahead ? 0 : window);
+  if(end > size_pages)
+    end = size_pages;
+
+  u8 *dst  = (u8 *)buf;
+  u64 done = 0;
+  while(done < count) {
+    u64 index = (offset + done) / PAGE_SIZE;
+    u64 in    = (offset + done) % PAGE_SIZE;
+    u64 chunk = PAGE_SIZE - in < count - done ? PAGE_SIZE - in : count - done;
+
+    if(!pcache_find(e->volume, e->ino, index))
+      pcache_fill(e, index, end);
+    pcache_page_t *pg = pcache_lookup(e, index);
+    if(!pg)
+      return done ? (i64)done : -EIO;
+
+    /* Pin across the copy: faulting in @p buf may reclaim cache pages. */
+    u64 phys = pg->phys;
+    if(!pmm_page_ref((void *)phys))
+      return done ? (i64)done : -EIO;
+    kmemcpy(dst + done, (u8 *)phys_to_virt(phys) + in, chunk);
+    pmm_free((void *)phys);
+    done += chunk;
+  }
+
+  if(window && e->ops->readahead) {
+    u64 from = ra->ahead > last + 1 ? ra->ahead : last + 1;
+    u64 to   = last + 1 + window;
+    if(to > size_pages)
+      to = size_pages;
+    if(from < to) {
+      e->ops->readahead(e->handle, from * PAGE_SIZE, (to - from) * PAGE_SIZE);
+      ra->ahead = to;
+    }
+  }
+  return (i64)done;
+}
+
+void pcache_mark_dirty(i32 oft_idx, u64 index)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(oft_idx);
+  if(!e)
+    return;
+
+  pcache_page_t *pg = pcache_find(e->volume, e->ino, index);
+  if(pg)
+    pg->dirty = true;
+}
+
+void pcache_writeback(i32 oft_idx, u64 first, u64 end)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(oft_idx);
+  if(!e || !e->ops || !e->ops->write || !e->ops->fstat)
+    return;
+
+  vfs_stat_t st;
+  if(e->ops->fstat(e->handle, &st) < 0)
+    return;
+
+  u64 size_pages = (st.size + PAGE_SIZE - 1) / PAGE_SIZE;
+  if(end > size_pages)
+    end = size_pages;
+
+  for(u64 index = first; index < end; index++) {
+    pcache_page_t *pg = pcache_find(e->volume, e->ino, index);
+    if(!pg || !pg->dirty)
+      continue;
+
+    u64 off = index * PAGE_SIZE;
+    u64 len = st.size - off < PAGE_SIZE ? st.size - off : PAGE_SIZE;
+    if(e->ops->write(e->handle, phys_to_virt(pg->phys), len, off) < 0)
+      continue;
+
+    /* Another mapping may still be writing; keep it dirty until it leaves. */
+    if(!pmm_page_shared((void *)pg->phys))
+      pg->dirty = false;
+  }
+}
+
+void pcache_update(i32 oft_idx, const void *buf, u64 count, u64 offset)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(oft_idx);
+  if(!e || nr_pages == 0)
+    return;
+
+  const u8 *src = (const u8 *)buf;
+  while(count > 0) {
+    u64 index = offset / PAGE_SIZE;
+    u64 in    = offset % PAGE_SIZE;
+    u64 chunk = PAGE_SIZE - in < count ? PAGE_SIZE - in : count;
+
+    pcache_page_t *pg = pcache_find(e->volume, e->ino, index);
+    if(pg)
+      kmemcpy((u8 *)phys_to_virt(pg->phys) + in, src, chunk);
+
+    src += chunk;
+    offset += chunk;
+    count -= chunk;
+  }
+}
+
+void pcache_truncate(i32 oft_idx, u64 size)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(oft_idx);
+  if(!e || nr_pages == 0)
+    return;
+
+  u64 keep = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+  for(pcache_page_t *pg = lru_head, *next; pg; pg = next) {
+    next = pg->next;
+    if(pg->volume != e->volume || pg->ino != e->ino)
+      continue;
+    if(pg->index >= keep)
+      pcache_drop(pg);
+    else if(pg->index == keep - 1 && size % PAGE_SIZE)
+      kzero(
+          (u8 *)phys_to_virt(pg->phys) + size % PAGE_SIZE,
+          PAGE_SIZE - size % PAGE_SIZE
+      );
+  }
+}
+
+void pcache_invalidate(const void *volume, u64 ino)
+{
+  for(pcache_page_t *pg = lru_head, *next; pg; pg = next) {
+    next = pg->next;
+    if(pg->volume == volume && pg->ino == ino)
+      pcache_drop(pg);
+  }
+}
@@ -0,0 +1,800 @@
+/**
+ * @file src/fs/procfs.c
+ * @brief The @c proc filesystem (see alcor2/fs/procfs.h).
+ *
+ * Nodes are named by their path alone: the root, six system files and,
+ * per process, a directory holding @c stat. A file's text is generated
+ * when it is opened and kept with the handle, so reads are plain copies
+ * and @c fstat reports the size of the snapshot. The driver provides
+ * @c get_page over that snapshot, which makes the page cache pass reads
+ * straight through; nothing from one open is ever served to the next.
+ *
+ * The formats follow Linux for the fields that exist here, so tools
+ * written for it parse them: CPU time is in USER_HZ ticks and memory in
+ * kB. Fields with nothing behind them (nice time, merged requests, I/O
+ * times) read 0.
+ */
+
+#include <alcor2/alcor_blkcache.h>
+#include <alcor2/alcor_memstat.h>
+#include <alcor2/drivers/ata.h>
+#include <alcor2/errno.h>
+#include <alcor2/fs/procfs.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/swap.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/sys/irqsoff.h>
+#include <alcor2/sys/syscall.h>
+#include <alcor2/time.h>
+
+/** @brief Largest snapshot; longer text is cut off. */
+#define PROCFS_BUF 16384
+
+/** @brief Clock ticks per second of the CPU-time fields (Linux USER_HZ). */
+#define PROCFS_HZ 100
+
+/** @brief @c st_dev of every node. */
+#define PROCFS_ST_DEV 0x70726F6300000001ULL
+
+/** @brief Directory positions of the entries before the processes. */
+#define PROCFS_FIXED 7
+
+kstat_t kstat;
+
+extern void kmain(void);
+
+/** @brief What a node is. */
+typedef enum
+{
+  PROCFS_ROOT = 1,
+  PROCFS_MEMINFO,
+  PROCFS_STAT,
+  PROCFS_DISKSTATS,
+  PROCFS_SLABINFO,
+  PROCFS_HEAPINFO,
+  PROCFS_IRQSOFF,
+  PROCFS_PID_DIR,
+  PROCFS_PID_STAT,
+} procfs_kind_t;
+
+/** @brief An open node; files carry their snapshot. */
+typedef struct
+{
+  procfs_kind_t kind;
+  u64           pid;  /**< For the per-process nodes. */
+  char         *data; /**< Snapshot text, NULL for directories. */
+  u64           len;
+} procfs_node_t;
+
+/** @brief Text being generated. */
+typedef struct
+{
+  char *buf;
+  u64   len;
+} procfs_buf_t;
+
+/** @brief The fixed root entries, at positions 0 .. PROCFS_FIXED - 1. */
+static const struct
+{
+  const char   *name;
+  procfs_kind_t kind;
+} fixed[PROCFS_FIXED] = {
+    {"meminfo",   PROCFS_MEMINFO  },
+    {"stat",      PROCFS_STAT     },
+    {"diskstats", PROCFS_DISKSTATS},
+    {"slabinfo",  PROCFS_SLABINFO },
+    {"heapinfo",  PROCFS_HEAPINFO },
+    {"irqsoff",   PROCFS_IRQSOFF  },
+    {"self",      PROCFS_PID_DIR  },
+};
+
+/* Append @p s, dropping what does not fit. */
+static void put(procfs_buf_t *b, const char *s)
+{
+  while(*s && b->len < PROCFS_BUF)
+    b->buf[b->len++] = *s++;
+}
+
+/* Append @p v in decimal. */
+static void put_u64(procfs_buf_t *b, u64 v)
+{
+  char tmp[21];
+  int  n = 20;
+  tmp[n] = '\0';
+  do {
+    tmp[--n] = (char)('0' + v % 10);
+    v /= 10;
+  } while(v);
+  put(b, &tmp[n]);
+}
+
+/* Append @p v as 0x-prefixed hex. */
+static void put_hex(procfs_buf_t *b, u64 v)
+{
+  char tmp[19];
+  int  n = 18;
+  tmp[n] = '\0';
+  do {
+    tmp[--n] = "0123456789abcdef"[v & 0xF];
+    v >>= 4;
+  } while(v);
+  tmp[--n] = 'x';
+  tmp[--n] = '0';
+  put(b, &tmp[n]);
+}
+
+/* Append " @p v". */
+static void put_field(procfs_buf_t *b, u64 v)
+{
+  put(b, " ");
+  put_u64(b, v);
+}
+
+/* Append "@p name: <padding> @p v@p unit", meminfo style. */
+static void
+    put_named(procfs_buf_t *b, const char *name, u64 v, const char *unit)
+{
+  char         num[24];
+  procfs_buf_t nb = {.buf = num};
+  put_u64(&nb, v);
+  num[nb.len] = '\0';
+
+  put(b, name);
+  put(b, ":");
+  for(u64 col = kstrlen(name) + 1 + nb.len; col < 24; col++)
+    put(b, " ");
+  put(b, num);
+  put(b, unit);
+}
+
+/* Append "@p name: <padding> @p bytes/1024 kB". */
+static void put_kb(procfs_buf_t *b, const char *name, u64 bytes)
+{
+  put_named(b, name, bytes / 1024, " kB\n");
+}
+
+/* Append @p s padded with spaces to @p width columns. */
+static void put_padded(procfs_buf_t *b, const char *s, u64 width)
+{
+  put(b, s);
+  for(u64 col = kstrlen(s); col < width; col++)
+    put(b, " ");
+}
+
+static u64 ns_to_ticks(u64 ns)
+{
+  return ns / (NSEC_PER_SEC / PROCFS_HZ);
+}
+
+static void gen_meminfo(procfs_buf_t *b)
+{
+  alcor_memstat_t ms;
+  pmm_memstat(&ms);
+  u64 cached = 0;
+  for(u64 i = 0; i < ms.ncaches; i++)
+    cached += ms.cache[i].bytes;
+
+  heap_stats_t hs;
+  heap_stats(&hs);
+  u64 slab = 0, slab_used = 0;
+  for(u32 i = 0; kmem_cache_get(i); i++) {
+    const kmem_cache_t *c = kmem_cache_get(i);
+    slab      += c->slabs * (PAGE_SIZE << c->order);
+    slab_used += c->objs_inuse * c->obj_size;
+  }
+
+  put_kb(b, "MemTotal", ms.total);
+  put_kb(b, "MemFree", ms.free);
+  put_kb(b, "MemAvailable", ms.free + cached);
+  put_kb(b, "Cached", cached);
+  put_kb(b, "Slab", slab);
+  put_kb(b, "SlabInUse", slab_used);
+  put_kb(b, "HeapUsed", hs.used);
+  put_kb(b, "HeapSize", hs.size);
+  put_kb(b, "WmarkLow", ms.wmark_low);
+  put_kb(b, "WmarkHigh", ms.wmark_high);
+  put_kb(b, "Reclaimed", ms.reclaimed);
+
+  swap_stats_t ss;
+  swap_stats(&ss);
+  put_kb(b, "SwapTotal", ss.disk);
+  put_kb(b, "SwapFree", ss.disk - ss.disk_used);
+  put_kb(b, "Zswap", ss.pool);
+  put_kb(b, "Zswapped", ss.pooled);
+  for(u64 i = 0; i < ms.ncaches; i++) {
+    char name[ALCOR_MEMSTAT_NAME + 8] = "Cache_";
+    kstrlcat(name, ms.cache[i].name, sizeof(name));
+    put_kb(b, name, ms.cache[i].bytes);
+  }
+}
+
+static void gen_stat(procfs_buf_t *b)
+{
+  u64 now  = time_monotonic_ns();
+  u64 idle = kstat.idle_ns < now ? kstat.idle_ns : now;
+  u64 sys  = kstat.sys_ns < now - idle ? kstat.sys_ns : now - idle;
+  u64 user = now - idle - sys;
+
+  /* One CPU runs, so cpu0 is the total; nice time is not split out. */
+  for(int i = 0; i < 2; i++) {
+    put(b, i ? "cpu0" : "cpu ");
+    put_field(b, ns_to_ticks(user));
+    put(b, " 0");
+    put_field(b, ns_to_ticks(sys));
+    put_field(b, ns_to_ticks(idle));
+    put(b, " 0 0 0 0 0 0\n");
+  }
+
+  u64 intr = kstat.lapic_timer + kstat.msi;
+  for(u32 i = 0; i < PIC_IRQ_LINE_COUNT; i++)
+    intr += kstat.irqs[i];
+  put(b, "intr");
+  put_field(b, intr);
+  for(u32 i = 0; i < PIC_IRQ_LINE_COUNT; i++)
+    put_field(b, kstat.irqs[i]);
+
+  u64 running = 0, blocked = 0;
+  for(const proc_t *p = proc_list_head(); p; p = p->all_next) {
+    if(p->state == PROC_STATE_READY || p->state == PROC_STATE_RUNNING)
+      running++;
+    else if(p->state == PROC_STATE_BLOCKED)
+      blocked++;
+  }
+
+  put(b, "\nctxt");
+  put_field(b, kstat.ctxt);
+  put(b, "\nbtime");
+  put_field(b, (time_realtime_ns() - now) / NSEC_PER_SEC);
+  put(b, "\nprocesses");
+  put_field(b, kstat.forks);
+  put(b, "\nprocs_running");
+  put_field(b, running);
+  put(b, "\nprocs_blocked");
+  put_field(b, blocked);
+  put(b, "\nsyscalls");
+  put_field(b, kstat.syscalls);
+  put(b, "\npage_faults");
+  put_field(b, kstat.faults);
+  put(b, "\nlapic_timer");
+  put_field(b, kstat.lapic_timer);
+  put(b, "\nmsi");
+  put_field(b, kstat.msi);
+  put(b, "\n");
+}
+
+/*
+ * One Linux diskstats line per drive, under its IDE name and numbers, and
+ * a last line for the block cache the drives share:
+ * "blkcache hits misses evictions writebacks entries capacity hit%".
+ */
+static void gen_diskstats(procfs_buf_t *b)
+{
+  static const char *const names[4]      = {"hda", "hdb", "hdc", "hdd"};
+  static const u8          major[4]      = {3, 3, 22, 22};
+  static const u8          minor_base[2] = {0, 64};
+
+  for(u8 i = 0; i < 4; i++) {
+    const ata_drive_t *d = ata_get_drive(i);
+    if(!d || d->atapi)
+      continue;
+    put_field(b, major[i]);
+    put_field(b, minor_base[i % 2]);
+    put(b, " ");
+    put(b, names[i]);
+    put_field(b, d->rd_ios);
+    put(b, " 0");
+    put_field(b, d->rd_sectors);
+    put(b, " 0");
+    put_field(b, d->wr_ios);
+    put(b, " 0");
+    put_field(b, d->wr_sectors);
+    put(b, " 0 0 0 0\n");
+  }
+
+  alcor_blkcache_stats_t cs;
+  ata_cache_stats(&cs);
+  put(b, "blkcache");
+  put_field(b, cs.hits);
+  put_field(b, cs.misses);
+  put_field(b, cs.evictions);
+  put_field(b, cs.writebacks);
+  put_field(b, cs.entries);
+  put_field(b, cs.capacity);
+  put_field(b, cs.hits + cs.misses ? cs.hits * 100 / (cs.hits + cs.misses) : 0);
+  put(b, "\n");
+}
+
+/*
+ * Linux's slabinfo 2.1 columns up to pagesperslab, then the lifetime
+ * allocation and free counts and the most objects ever in use.
+ */
+static void gen_slabinfo(procfs_buf_t *b)
+{
+  put(b, "slabinfo - version: 2.1\n# name            <active_objs> "
+         "<num_objs> <objsize> <objperslab> <pagesperslab> : stats "
+         "<allocs> <frees> <peak_objs>\n");
+  for(u32 i = 0; kmem_cache_get(i); i++) {
+    const kmem_cache_t *c = kmem_cache_get(i);
+    put_padded(b, c->name, 17);
+    put_field(b, c->objs_inuse);
+    put_field(b, c->slabs * c->per_slab);
+    put_field(b, c->obj_size);
+    put_field(b, c->per_slab);
+    put_field(b, 1ULL << c->order);
+    put(b, " : stats");
+    put_field(b, c->allocs);
+    put_field(b, c->frees);
+    put_field(b, c->objs_peak);
+    put(b, "\n");
+  }
+}
+
+/*
+ * The large heap, then the call sites of a HEAP_TAG_SITES build. Their
+ * addresses are run-time ones; the kmain line gives the load offset.
+ * Fragmentation is the share of free bytes outside the largest block.
+ */
+static void gen_heapinfo(procfs_buf_t *b)
+{
+  heap_stats_t hs;
+  heap_stats(&hs);
+  put_kb(b, "HeapSize", hs.size);
+  put_kb(b, "HeapUsed", hs.used);
+  put_kb(b, "HeapPeak", hs.peak);
+  put_kb(b, "HeapFree", hs.free_bytes);
+  put_kb(b, "LargestFree", hs.largest_free);
+  put_named(b, "FreeBlocks", hs.free_blocks, "\n");
+  put_named(b, "Allocs", hs.allocs, "\n");
+  put_named(b, "Frees", hs.frees, "\n");
+  put_named(
+      b, "Fragmentation",
+      hs.free_bytes ? 100 - hs.largest_free * 100 / hs.free_bytes : 0, "%\n"
+  );
+
+  heap_site_t s;
+  if(!heap_site_get(0, &s))
+    return;
+  put(b, "\nkmain ");
+  put_hex(b, (u64)kmain);
+  put(b, "\nsite               allocs frees live live_peak\n");
+  for(u32 i = 0; heap_site_get(i, &s); i++) {
+    if(!s.allocs)
+      continue;
+    if(s.site)
+      put_hex(b, s.site);
+    else
+      put(b, "other");
+    put_field(b, s.allocs);
+    put_field(b, s.frees);
+    put_field(b, s.live);
+    put_field(b, s.live_peak);
+    put(b, "\n");
+  }
+}
+
+/* Append an interrupts-off site: a code address or a tagged number. */
+static void put_irqsoff_site(procfs_buf_t *b, u64 site)
+{
+  u64 n = site & 0xFFFFFFFFULL;
+  switch(site >> 32) {
+  case IRQSOFF_SYSCALL >> 32: {
+    const char *name = syscall_name(n);
+    put(b, "syscall ");
+    if(name)
+      put(b, name);
+    else
+      put_u64(b, n);
+    return;
+  }
+  case IRQSOFF_IRQ >> 32:
+    put(b, n < PIC_IRQ_LINE_COUNT ? "irq " : "vector ");
+    put_u64(b, n);
+    return;
+  case IRQSOFF_FAULT >> 32:
+    put(b, "fault ");
+    put_u64(b, n);
+    return;
+  default:
+    put_hex(b, site);
+  }
+}
+
+/*
+ * The interrupts-off stretches of an IRQSOFF_TRACE build: the longest,
+ * a histogram of all of them and, per starting site, count, total and
+ * longest in ns with where that one ended. Addresses are run-time ones,
+ * as in heapinfo.
+ */
+static void gen_irqsoff(procfs_buf_t *b)
+{
+  irqsoff_site_t w;
+  u64            hist[IRQSOFF_BUCKETS];
+  if(!irqsoff_summary(&w, hist)) {
+    put(b, "not tracked: kernel built without IRQSOFF_TRACE\n");
+    return;
+  }
+
+  put_named(b, "Stretches", w.count, "\n");
+  put_named(b, "TotalOff", w.total_ns, " ns\n");
+  put_named(b, "MaxOff", w.max_ns, " ns\n");
+  if(w.count) {
+    put(b, "MaxFrom: ");
+    put_irqsoff_site(b, w.site);
+    put(b, "\nMaxTo:   ");
+    put_irqsoff_site(b, w.max_end);
+    put(b, "\n");
+  }
+
+  put(b, "\nhistogram\n");
+  for(u32 i = 0; i < IRQSOFF_BUCKETS; i++) {
+    char         label[32];
+    procfs_buf_t lb = {.buf = label};
+    if(!i) {
+      put(&lb, "<1us");
+    } else if(i == IRQSOFF_BUCKETS - 1) {
+      put(&lb, ">=");
+      put_u64(&lb, 1ULL << (i - 1));
+      put(&lb, "us");
+    } else {
+      put_u64(&lb, 1ULL << (i - 1));
+      put(&lb, "-");
+      put_u64(&lb, 1ULL << i);
+      put(&lb, "us");
+    }
+    label[lb.len] = '\0';
+    put_padded(b, label, 16);
+    put_u64(b, hist[i]);
+    put(b, "\n");
+  }
+
+  put(b, "\nkmain ");
+  put_hex(b, (u64)kmain);
+  put(b, "\nsite count total_ns max_ns max_end\n");
+  irqsoff_site_t s;
+  for(u32 i = 0; irqsoff_site_get(i, &s); i++) {
+    if(!s.count)
+      continue;
+    if(i)
+      put_irqsoff_site(b, s.site);
+    else
+      put(b, "other");
+    put_field(b, s.count);
+    put_field(b, s.total_ns);
+    put_field(b, s.max_ns);
+    put(b, " ");
+    put_irqsoff_site(b, s.max_end);
+    put(b, "\n");
+  }
+}
+
+/*
+ * Fields 1-24 of Linux's /proc/<pid>/stat, up to rss. There are no
+ * process groups or sessions apart from the process itself, and no
+ * threads, so those fields are the PID and 1.
+ */
+static void gen_pid_stat(procfs_buf_t *b, proc_t *p)
+{
+  static const char state[] = {
+      [PROC_STATE_FREE]    = 'X',
+      [PROC_STATE_READY]   = 'R',
+      [PROC_STATE_RUNNING] = 'R',
+      [PROC_STATE_BLOCKED] = 'S',
+      [PROC_STATE_ZOMBIE]  = 'Z',
+  };
+  char st[4] = {' ', state[p->state], ' ', '\0'};
+
+  proc_usage_t u;
+  proc_usage(p, &u);
+  const proc_usage_t *c = &p->cusage;
+
+  u64 vsize = 0;
+  for(u32 i = 0; i < p->vmas.count; i++)
+    vsize += p->vmas.v[i].end - p->vmas.v[i].start;
+  u64 rss = p->state == PROC_STATE_ZOMBIE || !p->cr3 ? 0
+                                                    : vmm_user_pages(p->cr3);
+
+  put_u64(b, p->pid);
+  put(b, " (");
+  put(b, p->name);
+  put(b, ")");
+  put(b, st);
+  put_u64(b, p->parent_pid);
+  put_field(b, p->pid); /* pgrp */
+  put_field(b, p->pid); /* session */
+  put(b, " 0 -1 0");    /* tty_nr, tpgid, flags */
+  put_field(b, u.minflt);
+  put_field(b, c->minflt);
+  put_field(b, u.majflt);
+  put_field(b, c->majflt);
+  put_field(b, ns_to_ticks(u.runtime - u.stime));
+  put_field(b, ns_to_ticks(u.stime));
+  put_field(b, ns_to_ticks(c->runtime - c->stime));
+  put_field(b, ns_to_ticks(c->stime));
+  put_field(b, (u64)(20 + p->nice));
+  put(b, p->nice < 0 ? " -" : " ");
+  put_u64(b, (u64)(p->nice < 0 ? -p->nice : p->nice));
+  put(b, " 1 0");       /* num_threads, itrealvalue */
+  put_field(b, ns_to_ticks(p->start_time));
+  put_field(b, vsize);
+  put_field(b, rss);
+  put(b, "\n");
+}
+
+/**
+ * @brief Parse mount-relative @p path into a node kind and PID.
+ * @return The kind, or 0 if there is no such node.
+ */
+static procfs_kind_t procfs_lookup(const char *path, u64 *pid)
+{
+  *pid = 0;
+  if(path[0] == '/')
+    path++;
+  if(!*path)
+    return PROCFS_ROOT;
+
+  for(u32 i = 0; i < PROCFS_FIXED - 1; i++) {
+    if(kstreq(path, fixed[i].name))
+      return fixed[i].kind;
+  }
+
+  const char *p = path;
+  if(!kstrncmp(p, "self", 4) && (p[4] == '\0' || p[4] == '/')) {
+    const proc_t *cur = proc_current();
+    if(!cur)
+      return 0;
+    *pid = cur->pid;
+    p += 4;
+  } else {
+    if(*p < '0' || *p > '9')
+      return 0;
+    for(; *p >= '0' && *p <= '9'; p++)
+      *pid = *pid * 10 + (u64)(*p - '0');
+    if(!proc_get(*pid))
+      return 0;
+  }
+
+  if(*p == '\0')
+    return PROCFS_PID_DIR;
+  if(kstreq(p, "/stat"))
+    return PROCFS_PID_STAT;
+  return 0;
+}
+
+/* Inode numbers: the fixed nodes are their kind, process nodes carry the
+ * PID above it. */
+static u64 procfs_ino(procfs_kind_t kind, u64 pid)
+{
+  return pid << 4 | kind;
+}
+
+static u8 procfs_type(procfs_kind_t kind)
+{
+  return kind == PROCFS_ROOT || kind == PROCFS_PID_DIR ? VFS_DIRECTORY
+                                                       : VFS_FILE;
+}
+
+/**
+ * @brief Generate the text of file node @p kind into @p b.
+ * @return false if the process is gone.
+ */
+static bool procfs_generate(procfs_kind_t kind, u64 pid, procfs_buf_t *b)
+{
+  switch(kind) {
+  case PROCFS_MEMINFO:
+    gen_meminfo(b);
+    return true;
+  case PROCFS_STAT:
+    gen_stat(b);
+    return true;
+  case PROCFS_DISKSTATS:
+    gen_diskstats(b);
+    return true;
+  case PROCFS_SLABINFO:
+    gen_slabinfo(b);
+    return true;
+  case PROCFS_HEAPINFO:
+    gen_heapinfo(b);
+    return true;
+  case PROCFS_IRQSOFF:
+    gen_irqsoff(b);
+    return true;
+  case PROCFS_PID_STAT: {
+    proc_t *p = proc_get(pid);
+    if(!p)
+      return false;
+    gen_pid_stat(b, p);
+    return true;
+  }
+  default:
+    return true;
+  }
+}
+
+static fs_handle_t procfs_open(void *fs_data, const char *path, u32 flags)
+{
+  (void)fs_data;
+  if(flags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC))
+    return NULL;
+
+  u64           pid;
+  procfs_kind_t kind = procfs_lookup(path, &pid);
+  if(!kind)
+    return NULL;
+
+  procfs_node_t *n = kzalloc(sizeof(*n));
+  if(!n)
+    return NULL;
+  n->kind = kind;
+  n->pid  = pid;
+  if(procfs_type(kind) == VFS_FILE) {
+    procfs_buf_t b = {.buf = kmalloc(PROCFS_BUF)};
+    if(!b.buf || !procfs_generate(kind, pid, &b)) {
+      kfree(b.buf);
+      kfree(n);
+      return NULL;
+    }
+    n->data = b.buf;
+    n->len  = b.len;
+  }
+  return n;
+}
+
+static void procfs_close(fs_handle_t fh)
+{
+  procfs_node_t *n = fh;
+  kfree(n->data);
+  kfree(n);
+}
+
+static i64 procfs_read(fs_handle_t fh, void *buf, u64 count, u64 offset)
+{
+  const procfs_node_t *n = fh;
+  if(!n->data)
+    return -EISDIR;
+  if(offset >= n->len)
+    return 0;
+  if(count > n->len - offset)
+    count = n->len - offset;
+  kmemcpy(buf, n->data + offset, count);
+  return (i64)count;
+}
+
+/** @brief A private copy of page @p index of the snapshot, for mmap. */
+static void *procfs_get_page(fs_handle_t fh, u64 index)
+{
+  const procfs_node_t *n = fh;
+  if(!n->data)
+    return NULL;
+  void *phys = pmm_alloc_zeroed();
+  if(phys && index * PAGE_SIZE < n->len) {
+    u64 in = n->len - index * PAGE_SIZE;
+    kmemcpy(
+        phys_to_virt((u64)phys), n->data + index * PAGE_SIZE,
+        in < PAGE_SIZE ? in : PAGE_SIZE
+    );
+  }
+  return phys;
+}
+
+static void procfs_fill_stat(
+    procfs_kind_t kind, u64 pid, u64 size, vfs_stat_t *st
+)
+{
+  kzero(st, sizeof(*st));
+  st->size = size;
+  st->type = procfs_type(kind);
+  st->ino  = procfs_ino(kind, pid);
+  st->dev  = PROCFS_ST_DEV;
+}
+
+static i64 procfs_stat(void *fs_data, const char *path, vfs_stat_t *st)
+{
+  (void)fs_data;
+  u64           pid;
+  procfs_kind_t kind = procfs_lookup(path, &pid);
+  if(!kind)
+    return -ENOENT;
+
+  /* Files report the size a read would see now. */
+  u64 size = 0;
+  if(procfs_type(kind) == VFS_FILE) {
+    procfs_buf_t b = {.buf = kmalloc(PROCFS_BUF)};
+    if(!b.buf)
+      return -ENOMEM;
+    bool ok = procfs_generate(kind, pid, &b);
+    kfree(b.buf);
+    if(!ok)
+      return -ENOENT;
+    size = b.len;
+  }
+  procfs_fill_stat(kind, pid, size, st);
+  return 0;
+}
+
+static i64 procfs_fstat(fs_handle_t fh, vfs_stat_t *st)
+{
+  const procfs_node_t *n = fh;
+  procfs_fill_stat(n->kind, n->pid, n->len, st);
+  return 0;
+}
+
+/*
+ * Root positions: 0 .. PROCFS_FIXED - 1 are the fixed entries, then
+ * PROCFS_FIXED + pid resumes the processes from that PID on, in PID
+ * order, so entries are neither skipped nor repeated as processes come
+ * and go between calls.
+ */
+static i64
+    procfs_iterate(fs_handle_t fh, u64 pos, vfs_filldir_t fill, void *ctx)
+{
+  const procfs_node_t *n = fh;
+  if(n->kind == PROCFS_PID_DIR) {
+    if(pos == 0)
+      fill(ctx, "stat", 4, procfs_ino(PROCFS_PID_STAT, n->pid), VFS_FILE, 1);
+    return 0;
+  }
+  if(n->kind != PROCFS_ROOT)
+    return -ENOTDIR;
+
+  for(; pos < PROCFS_FIXED; pos++) {
+    u8 type = procfs_type(fixed[pos].kind);
+    if(!fill(
+           ctx, fixed[pos].name, (u32)kstrlen(fixed[pos].name),
+           procfs_ino(fixed[pos].kind, 0), type, pos + 1
+       ))
+      return 0;
+  }
+
+  for(;;) {
+    const proc_t *next = NULL;
+    for(const proc_t *p = proc_list_head(); p; p = p->all_next) {
+      if(p->pid >= pos - PROCFS_FIXED && (!next || p->pid < next->pid))
+        next = p;
+    }
+    if(!next)
+      return 0;
+
+    char         name[24];
+    procfs_buf_t b = {.buf = name};
+    put_u64(&b, next->pid);
+    if(!fill(
+           ctx, name, (u32)b.len, procfs_ino(PROCFS_PID_DIR, next->pid),
+           VFS_DIRECTORY, PROCFS_FIXED + next->pid + 1
+       ))
+      return 0;
+    pos = PROCFS_FIXED + next->pid + 1;
+  }
+}
+
+static const fs_ops_t procfs_ops = {
+    .open     = procfs_open,
+    .close    = procfs_close,
+    .read     = procfs_read,
+    .stat     = procfs_stat,
+    .fstat    = procfs_fstat,
+    .iterate  = procfs_iterate,
+    .get_page = procfs_get_page,
+};
+
+static void *procfs_mount(const char *source, u32 flags)
+{
+  (void)source;
+  (void)flags;
+  /* One global view; any non-NULL token will do. */
+  return (void *)1;
+}
+
+static const fs_type_t procfs_fstype = {
+    .name  = "proc",
+    .ops   = &procfs_ops,
+    .mount = procfs_mount,
+};
+
+void procfs_init(void)
+{
+  vfs_register_fs(&procfs_fstype);
+}
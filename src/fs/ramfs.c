@@ -3,28 +3,102 @@
  * @brief Standalone ramfs driver for Alcor2.
  *
  * Implements a simple tree-based in-memory filesystem.
+ *
+ * Each directory keeps its children on a list, in readdir order, and in a
+ * hash table by name that doubles as the directory grows. File data lives
+ * in whole PMM frames indexed by page number, so extending a file never
+ * copies what it already holds, and the page cache maps those frames
+ * directly instead of caching a copy.
+ *
+ * Files count their open handles, so one unlinked while open (or mapped,
+ * which holds the handle) lives on until the last close. memfd_create
+ * makes files that start out that way, and those alone may be sealed.
  */
 
 #include <alcor2/errno.h>
+#include <alcor2/fs/ramfs.h>
 #include <alcor2/fs/vfs.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+
+/** @brief Hash buckets a directory starts with. */
+#define RAM_HASH_MIN 8
+/** @brief The @c fs_data of every ramfs mount (there is one tree). */
+#define RAM_VOLUME ((void *)1)
 
 /** @brief Internal ramfs node. */
 typedef struct ram_node
 {
-  char             name[VFS_NAME_MAX];
-  u8               type;
-  u64              size;
-  u8              *data;
-  u64              capacity;
-  struct ram_node *parent;
-  struct ram_node *children;
-  struct ram_node *next;
+  char              name[VFS_NAME_MAX];
+  u8                type;
+  u64               size;
+  u64              *pages;    /* file data frames by page index, 0 = hole */
+  u64               npages;   /* slots in pages */
+  struct ram_node  *parent;
+  struct ram_node  *children; /* readdir order */
+  struct ram_node  *next;
+  struct ram_node  *prev;
+  struct ram_node  *hnext;    /* parent's hash chain */
+  struct ram_node **buckets;  /* children by name hash */
+  u32               nbuckets;
+  u32               nchildren;
+  struct ram_node  *rd_child; /* readdir cursor: child at rd_index */
+  u64               rd_index;
+  u32               opens;    /* open handles */
+  u32               seals;    /* F_SEAL_* */
+  bool              unlinked; /* out of the tree; freed on last close */
 } ram_node_t;
 
 static ram_node_t *root = NULL;
 
+static u32 ram__hash(const char *name, u64 len)
+{
+  u32 h = 2166136261U;
+  for(u64 i = 0; i < len; i++)
+    h = (h ^ (u8)name[i]) * 16777619U;
+  return h;
+}
+
+/**
+ * @brief Rebuild @p dir's hash table with @p nbuckets buckets.
+ * @return false if out of memory; the old table (if any) is kept.
+ */
+static bool ram__rehash(ram_node_t *dir, u32 nbuckets)
+{
+  ram_node_t **buckets = kzalloc(nbuckets * sizeof(*buckets));
+  if(!buckets)
+    return false;
+
+  for(ram_node_t *c = dir->children; c; c = c->next) {
+    u32 b      = ram__hash(c->name, kstrlen(c->name)) & (nbuckets - 1);
+    c->hnext   = buckets[b];
+    buckets[b] = c;
+  }
+  if(dir->buckets)
+    kfree(dir->buckets);
+  dir->buckets  = buckets;
+  dir->nbuckets = nbuckets;
+  return true;
+}
+
+/** @brief Find the child of @p dir named by the @p len bytes at @p name. */
+static ram_node_t *ram__find_child(ram_node_t *dir, const char *name, u64 len)
+{
+  if(len >= VFS_NAME_MAX)
+    return NULL;
+
+  ram_node_t *c = dir->buckets
+                      ? dir->buckets[ram__hash(name, len) & (dir->nbuckets - 1)]
+                      : dir->children;
+  for(; c; c = dir->buckets ? c->hnext : c->next) {
+    if(kstrncmp(c->name, name, len) == 0 && c->name[len] == '\0')
+      return c;
+  }
+  return NULL;
+}
+
 /** @brief Allocate and zero a new ramfs node with the given @p name and @p
  * type. */
 static ram_node_t *ram__create_node(const char *name, u8 type)
@@ -34,17 +108,141 @@ static ram_node_t *ram__create_node(const char *name, u8 type)
     return NULL;
 
   kstrncpy(node->name, name, VFS_NAME_MAX);
-  node->type = type;
+  node->type  = type;
+  node->seals = F_SEAL_SEAL;
   return node;
 }
 
-/** @brief Prepend @p child to @p parent's children list and set its parent
- * pointer. */
+/** @brief Prepend @p child to @p parent's children list, hash it by name
+ * and set its parent pointer. */
 static void ram__add_child(ram_node_t *parent, ram_node_t *child)
 {
-  child->parent    = parent;
-  child->next      = parent->children;
+  child->parent = parent;
+  child->prev   = NULL;
+  child->next   = parent->children;
+  if(parent->children)
+    parent->children->prev = child;
   parent->children = child;
+  parent->rd_child = NULL;
+  parent->nchildren++;
+
+  /* Rehashing relinks every child, this one included. Without a table
+   * lookups fall back to the list; a failed resize keeps chaining. */
+  u32 grow = parent->nbuckets ? parent->nbuckets * 2 : RAM_HASH_MIN;
+  if(parent->nchildren > parent->nbuckets && ram__rehash(parent, grow))
+    return;
+  if(parent->buckets) {
+    u32 h = ram__hash(child->name, kstrlen(child->name));
+    u32 b = h & (parent->nbuckets - 1);
+
+    child->hnext       = parent->buckets[b];
+    parent->buckets[b] = child;
+  }
+}
+
+/** @brief Unlink @p node from its parent's list and hash table. */
+static void ram__remove_child(ram_node_t *node)
+{
+  ram_node_t *parent = node->parent;
+  parent->rd_child   = NULL;
+  parent->nchildren--;
+
+  if(node->prev)
+    node->prev->next = node->next;
+  else
+    parent->children = node->next;
+  if(node->next)
+    node->next->prev = node->prev;
+
+  if(parent->buckets) {
+    u32          h    = ram__hash(node->name, kstrlen(node->name));
+    ram_node_t **link = &parent->buckets[h & (parent->nbuckets - 1)];
+    while(*link && *link != node)
+      link = &(*link)->hnext;
+    if(*link)
+      *link = node->hnext;
+  }
+}
+
+/**
+ * @brief Map page @p index of file @p node, optionally allocating it.
+ * @return Kernel pointer to the page, or NULL for a hole (or out of memory).
+ */
+static u8 *ram__page(ram_node_t *node, u64 index, bool alloc)
+{
+  if(index < node->npages && node->pages[index])
+    return (u8 *)phys_to_virt(node->pages[index]);
+  if(!alloc)
+    return NULL;
+
+  if(index >= node->npages) {
+    u64 n = node->npages ? node->npages : 8;
+    while(n <= index)
+      n *= 2;
+    u64 *pages = krealloc(node->pages, n * sizeof(u64));
+    if(!pages)
+      return NULL;
+    kzero(pages + node->npages, (n - node->npages) * sizeof(u64));
+    node->pages  = pages;
+    node->npages = n;
+  }
+
+  void *phys = pmm_alloc_zeroed();
+  if(!phys)
+    return NULL;
+  node->pages[index] = (u64)phys;
+  return (u8 *)phys_to_virt((u64)phys);
+}
+
+/** @brief Zero the bytes of @p node in [from, to) that live in pages. */
+static void ram__zero_range(ram_node_t *node, u64 from, u64 to)
+{
+  while(from < to) {
+    u64 in    = from % PAGE_SIZE;
+    u64 chunk = PAGE_SIZE - in < to - from ? PAGE_SIZE - in : to - from;
+    u8 *page  = ram__page(node, from / PAGE_SIZE, false);
+    if(page)
+      kzero(page + in, chunk);
+    from += chunk;
+  }
+}
+
+/**
+ * @brief Resize file @p node to @p length bytes.
+ *
+ * Shrinking frees the pages past the end and zeroes the tail of the last
+ * one; growing zeroes whatever a mapping may have left past the old end.
+ */
+static void ram__set_size(ram_node_t *node, u64 length)
+{
+  if(length > node->size) {
+    ram__zero_range(node, node->size, length);
+    node->size = length;
+    return;
+  }
+
+  u64 keep = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+  for(u64 i = keep; i < node->npages; i++) {
+    if(node->pages[i]) {
+      pmm_free((void *)node->pages[i]);
+      node->pages[i] = 0;
+    }
+  }
+  if(keep == 0 && node->pages) {
+    kfree(node->pages);
+    node->pages  = NULL;
+    node->npages = 0;
+  }
+  ram__zero_range(node, length, keep * PAGE_SIZE);
+  node->size = length;
+}
+
+/* Free a file no directory or handle refers to any more. Frames still
+ * mapped stay alive through the mappings' references. */
+static void ram__free_file(ram_node_t *node)
+{
+  ram__set_size(node, 0);
+  kfree(node);
 }
 
 /**
@@ -72,22 +270,12 @@ static ram_node_t *ram__resolve(const char *path)
     if(!*p)
       break;
 
-    char comp[VFS_NAME_MAX];
-    u32  i = 0;
-    while(*p && *p != '/' && i < VFS_NAME_MAX - 1)
-      comp[i++] = *p++;
-    comp[i] = '\0';
-
-    /* Reject components that exceed VFS_NAME_MAX-1 bytes. */
-    if(i == VFS_NAME_MAX - 1 && *p && *p != '/')
-      return NULL;
+    const char *comp = p;
+    while(*p && *p != '/')
+      p++;
 
-    ram_node_t *child = node->children;
-    while(child) {
-      if(kstreq(child->name, comp))
-        break;
-      child = child->next;
-    }
+    /* Longer components than VFS_NAME_MAX-1 bytes never match. */
+    ram_node_t *child = ram__find_child(node, comp, (u64)(p - comp));
     if(!child)
       return NULL;
     node = child;
@@ -131,15 +319,19 @@ static fs_handle_t ram_open(void *fs_data, const char *path, u32 flags)
     }
   }
 
-  if((flags & O_TRUNC) && node->type == VFS_FILE)
-    node->size = 0;
+  if((flags & O_TRUNC) && node->type == VFS_FILE &&
+     !(node->seals & (F_SEAL_SHRINK | F_SEAL_WRITE)))
+    ram__set_size(node, 0);
 
+  node->opens++;
   return (fs_handle_t)node;
 }
 
 static void ram_close(fs_handle_t fh)
 {
-  (void)fh;
+  ram_node_t *node = (ram_node_t *)fh;
+  if(--node->opens == 0 && node->unlinked)
+    ram__free_file(node);
 }
 
 static i64 ram_read(fs_handle_t fh, void *buf, u64 count, u64 offset)
@@ -153,7 +345,19 @@ static i64 ram_read(fs_handle_t fh, void *buf, u64 count, u64 offset)
   u64 avail = node->size - offset;
   if(count > avail)
     count = avail;
-  kmemcpy(buf, node->data + offset, count);
+
+  u8 *dst = (u8 *)buf;
+  for(u64 done = 0; done < count;) {
+    u64       in    = (offset + done) % PAGE_SIZE;
+    u64       chunk = PAGE_SIZE - in < count - done ? PAGE_SIZE - in
+                                                    : count - done;
+    const u8 *page  = ram__page(node, (offset + done) / PAGE_SIZE, false);
+    if(page)
+      kmemcpy(dst + done, page + in, chunk);
+    else
+      kzero(dst + done, chunk);
+    done += chunk;
+  }
   return (i64)count;
 }
 
@@ -163,28 +367,51 @@ static i64 ram_write(fs_handle_t fh, const void *buf, u64 count, u64 offset)
   if(node->type != VFS_FILE)
     return -EISDIR;
 
-  /* Guard offset + count and the subsequent round-up against u64 wrap-around.
-   * A wrapped @c new_cap would let @c kmemcpy run past the (smaller) buffer
-   * @c krealloc returned, corrupting the kernel heap. */
+  /* Guard offset + count and the page round-up against u64 wrap-around. */
   u64 end = offset + count;
   if(end < offset)
     return -EFBIG;
-  if(end > (u64)-1 - 1023u)
+  if(end > (u64)-1 - PAGE_SIZE)
     return -EFBIG;
-
-  if(end > node->capacity) {
-    u64   new_cap  = (end + 1023) & ~1023ULL;
-    void *new_data = krealloc(node->data, new_cap);
-    if(!new_data)
-      return -ENOMEM;
-    node->data     = new_data;
-    node->capacity = new_cap;
+  if((node->seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)) ||
+     ((node->seals & F_SEAL_GROW) && end > node->size))
+    return -EPERM;
+
+  /* A mapping may have written past the old end; the gap reads as zero. */
+  if(offset > node->size)
+    ram__set_size(node, offset);
+
+  const u8 *src  = (const u8 *)buf;
+  u64       done = 0;
+  while(done < count) {
+    u64 in    = (offset + done) % PAGE_SIZE;
+    u64 chunk = PAGE_SIZE - in < count - done ? PAGE_SIZE - in : count - done;
+    u8 *page  = ram__page(node, (offset + done) / PAGE_SIZE, true);
+    if(!page)
+      break;
+    kmemcpy(page + in, src + done, chunk);
+    done += chunk;
   }
 
-  kmemcpy(node->data + offset, buf, count);
-  if(end > node->size)
-    node->size = end;
-  return (i64)count;
+  if(offset + done > node->size)
+    node->size = offset + done;
+  return done ? (i64)done : -ENOMEM;
+}
+
+/**
+ * @brief Hand the frame behind page @p index of a file to the page cache.
+ *
+ * Holes are filled with a zeroed frame first, so every mapping of a page
+ * shares the frame that holds the file's data.
+ */
+static void *ram_get_page(fs_handle_t fh, u64 index)
+{
+  ram_node_t *node = (ram_node_t *)fh;
+  if(node->type != VFS_FILE || !ram__page(node, index, true))
+    return NULL;
+
+  void *phys = (void *)node->pages[index];
+  return pmm_page_ref(phys) ? phys : NULL;
 }
 
 static i64 ram_stat(void *fs_data, const char *path, vfs_stat_t *st)
@@ -243,19 +470,38 @@ static i64 ram_mkdir(void *fs_data, const char *path)
   return 0;
 }
 
+/**
+ * @brief Find the child at position @p index of directory @p node.
+ *
+ * Starts from the readdir cursor when it is at or before @p index, so
+ * listing a directory in order takes linear time.
+ */
+static ram_node_t *ram__child_at(ram_node_t *node, u64 index)
+{
+  ram_node_t *child = node->children;
+  u64         i     = 0;
+  if(node->rd_child && node->rd_index <= index) {
+    child = node->rd_child;
+    i     = node->rd_index;
+  }
+  for(; i < index && child; i++)
+    child = child->next;
+  return child;
+}
+
 static i64 ram_readdir(fs_handle_t fh, u64 index, char *name, vfs_stat_t *st)
 {
   ram_node_t *node = (ram_node_t *)fh;
   if(node->type != VFS_DIRECTORY)
     return -ENOTDIR;
 
-  ram_node_t *child = node->children;
-  for(u64 i = 0; i < index && child; i++)
-    child = child->next;
-
+  ram_node_t *child = ram__child_at(node, index);
   if(!child)
     return 0;
 
+  node->rd_child = child;
+  node->rd_index = index;
+
   kstrncpy(name, child->name, VFS_NAME_MAX);
   if(st) {
     st->size = child->size;
@@ -265,6 +511,26 @@ static i64 ram_readdir(fs_handle_t fh, u64 index, char *name, vfs_stat_t *st)
   return 1;
 }
 
+/** @brief Batched readdir; positions are child indexes. */
+static i64 ram_iterate(fs_handle_t fh, u64 pos, vfs_filldir_t fill, void *ctx)
+{
+  ram_node_t *node = (ram_node_t *)fh;
+  if(node->type != VFS_DIRECTORY)
+    return -ENOTDIR;
+
+  for(ram_node_t *child = ram__child_at(node, pos); child;
+      child             = child->next, pos++) {
+    node->rd_child = child;
+    node->rd_index = pos;
+    if(!fill(
+           ctx, child->name, (u32)kstrlen(child->name), (u64)(uintptr_t)child,
+           child->type, pos + 1
+       ))
+      break;
+  }
+  return 0;
+}
+
 static i64 ram_unlink(void *fs_data, const char *path)
 {
   (void)fs_data;
@@ -272,21 +538,11 @@ static i64 ram_unlink(void *fs_data, const char *path)
   if(!node || node->type == VFS_DIRECTORY)
     return -EISDIR;
 
-  /* Remove from parent's list */
-  ram_node_t *parent = node->parent;
-  if(parent->children == node) {
-    parent->children = node->next;
-  } else {
-    ram_node_t *prev = parent->children;
-    while(prev && prev->next != node)
-      prev = prev->next;
-    if(prev)
-      prev->next = node->next;
-  }
-
-  if(node->data)
-    kfree(node->data);
-  kfree(node);
+  ram__remove_child(node);
+  if(node->opens)
+    node->unlinked = true;
+  else
+    ram__free_file(node);
   return 0;
 }
 
@@ -303,16 +559,9 @@ static i64 ram_rmdir(void *fs_data, const char *path)
   if(node == root)
     return -EBUSY;
 
-  ram_node_t *parent = node->parent;
-  if(parent->children == node) {
-    parent->children = node->next;
-  } else {
-    ram_node_t *prev = parent->children;
-    while(prev && prev->next != node)
-      prev = prev->next;
-    if(prev)
-      prev->next = node->next;
-  }
+  ram__remove_child(node);
+  if(node->buckets)
+    kfree(node->buckets);
   kfree(node);
   return 0;
 }
@@ -322,21 +571,38 @@ static i64 ram_truncate(fs_handle_t fh, u64 length)
   ram_node_t *node = (ram_node_t *)fh;
   if(node->type != VFS_FILE)
     return -EISDIR;
+  if(((node->seals & F_SEAL_SHRINK) && length < node->size) ||
+     ((node->seals & F_SEAL_GROW) && length > node->size))
+    return -EPERM;
 
-  if(length == 0) {
-    if(node->data)
-      kfree(node->data);
-    node->data     = NULL;
-    node->capacity = 0;
-    node->size     = 0;
-    return 0;
-  }
-  /* Simple truncation not implemented yet for ramfs extension */
-  if(length < node->size) {
-    node->size = length;
-    return 0;
+  ram__set_size(node, length);
+  return 0;
+}
+
+/**
+ * @brief Add seals to a file.
+ *
+ * F_SEAL_WRITE needs every page unmapped: a shared mapping made earlier
+ * may already be writable, and telling it apart from a read-only one
+ * would mean walking page tables, so any extra frame reference refuses it.
+ */
+static i64 ram_seal(fs_handle_t fh, u32 add)
+{
+  ram_node_t *node = (ram_node_t *)fh;
+  if(node->type != VFS_FILE || (add & ~F_SEAL_ALL))
+    return -EINVAL;
+  if(!add)
+    return node->seals;
+  if(node->seals & F_SEAL_SEAL)
+    return -EPERM;
+  if(add & F_SEAL_WRITE) {
+    for(u64 i = 0; i < node->npages; i++) {
+      if(node->pages[i] && pmm_page_shared((void *)node->pages[i]))
+        return -EBUSY;
+    }
   }
-  return -ENOSYS;
+  node->seals |= add;
+  return node->seals;
 }
 
 static const fs_ops_t ram_ops = {
@@ -350,7 +616,10 @@ static const fs_ops_t ram_ops = {
     .stat     = ram_stat,
     .fstat    = ram_fstat,
     .readdir  = ram_readdir,
+    .iterate  = ram_iterate,
     .truncate = ram_truncate,
+    .get_page = ram_get_page,
+    .seal     = ram_seal,
 };
 
 static void *ram_mount_cb(const char *source, u32 flags)
@@ -358,7 +627,7 @@ static void *ram_mount_cb(const char *source, u32 flags)
   (void)source;
   (void)flags;
   /* Root is static, but we return a non-NULL token to signal success */
-  return (void *)1;
+  return RAM_VOLUME;
 }
 
 static const fs_type_t ram_fstype = {
@@ -380,3 +649,67 @@ void ramfs_init(void)
   root->parent = root;
   vfs_register_fs(&ram_fstype);
 }
+
+i64 ramfs_install(const char *path, u8 type, const void *data, u64 size)
+{
+  if(!root || !path || path[0] != '/')
+    return -EINVAL;
+
+  ram_node_t *node = root;
+  const char *p    = path;
+  while(*p) {
+    while(*p == '/')
+      p++;
+    if(!*p)
+      break;
+
+    const char *comp = p;
+    while(*p && *p != '/')
+      p++;
+    u64 len = (u64)(p - comp);
+    if(len >= VFS_NAME_MAX)
+      return -ENAMETOOLONG;
+
+    /* Components before the last are directories, made if missing. */
+    const char *rest = p;
+    while(*rest == '/')
+      rest++;
+    u8          want  = *rest ? VFS_DIRECTORY : type;
+    ram_node_t *child = ram__find_child(node, comp, len);
+    if(!child) {
+      char name[VFS_NAME_MAX];
+      kmemcpy(name, comp, len);
+      name[len] = '\0';
+      child     = ram__create_node(name, want);
+      if(!child)
+        return -ENOMEM;
+      ram__add_child(node, child);
+    } else if(child->type != want) {
+      return want == VFS_DIRECTORY ? -ENOTDIR : -EEXIST;
+    }
+    node = child;
+  }
+
+  if(node->type != VFS_FILE)
+    return 0;
+  ram__set_size(node, 0);
+  if(size && ram_write((fs_handle_t)node, data, size, 0) != (i64)size)
+    return -ENOMEM;
+  return 0;
+}
+
+i64 ramfs_memfd(const char *name, bool sealable, u32 flags)
+{
+  char label[VFS_NAME_MAX] = "memfd:";
+  kstrlcat(label, name, sizeof(label));
+
+  ram_node_t *node = root ? ram__create_node(label, VFS_FILE) : NULL;
+  if(!node)
+    return -ENOMEM;
+  node->parent   = root;
+  node->unlinked = true;
+  node->opens    = 1;
+  if(sealable)
+    node->seals = 0;
+  return vfs_open_handle(&ram_ops, RAM_VOLUME, node, O_RDWR | flags);
+}
@@ -8,27 +8,41 @@
  * @par Mount resolution
  * Paths are made absolute with ::vfs_make_absolute — relative paths are
  * anchored to the calling process's CWD stored in @c proc_t::cwd — then
- * normalised in-place by ::vfs_normalize.  ::vfs_find_mount performs
- * longest-prefix matching over the active mount table to select the
- * responsible driver.
+ * normalised in-place by ::vfs_normalize; ::vfs_resolve skips both steps
+ * for paths that are already canonical.  ::vfs_find_mount walks an index of
+ * active mounts kept ordered longest target first, so the first prefix
+ * match is the responsible driver.
  *
  * @par Open File Table lifetime
  * Each ::vfs_oft_entry_t carries a reference count.  ::vfs_oft_retain
  * increments it (fork, dup) and ::vfs_oft_release decrements it; when the
  * count reaches zero the driver's @c close or ::pipe_oft_release is invoked
  * and the slot is returned to the pool.  Per-process fd numbers are small
- * integers that index into this shared table.
+ * integers that index into this shared table.  @c oft_lock guards slot
+ * allocation and the reference counts; teardown runs without it.
  */
 
 #include <alcor2/errno.h>
+#include <alcor2/fs/pagecache.h>
 #include <alcor2/fs/vfs.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/uaccess.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/elf.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/spinlock.h>
 #include <alcor2/sys/internal.h>
 
 #define VFS_MAX_MOUNTS 16
-#define VFS_MAX_OFT    256
+/** @brief OFT entries per chunk; chunks are added as the table fills. */
+#define OFT_CHUNK 64
+/** @brief Bytes of an O_DIRECT transfer pinned at a time. */
+#define VFS_DIRECT_CHUNK (4ULL * 1024 * 1024)
+/** @brief Alignment O_DIRECT needs of the buffer, length and offset. */
+#define VFS_DIRECT_ALIGN 512
 
 /**
  * @brief Internal mount point descriptor.
@@ -40,36 +54,54 @@
 typedef struct
 {
   char            target[VFS_PATH_MAX]; /**< Normalised absolute mount point. */
+  u64             target_len; /**< kstrlen(target), cached at mount time. */
   void           *fs_data; /**< Volume-private data from @c mount callback. */
   const fs_ops_t *ops;     /**< Driver operations for this volume. */
   const fs_type_t *type;   /**< Registered type descriptor. */
   bool             active; /**< @c true when this slot holds a live mount. */
 } vfs_mount_t;
 
-static vfs_mount_t      mounts[VFS_MAX_MOUNTS];
-static vfs_oft_entry_t  oft[VFS_MAX_OFT];
-
-static const fs_type_t *fs_registry[8];
-static u32              fs_registry_count = 0;
-
-/** @brief Return @c true if @p path begins with @p prefix as a path component.
+/**
+ * @brief A block of OFT entries.
+ *
+ * Chunks never move once allocated, so entry pointers stay valid while the
+ * table grows; only the array of chunk pointers is reallocated.
  */
-static bool vfs_path_starts_with(const char *path, const char *prefix)
+typedef struct
 {
-  if(prefix[0] == '/' && prefix[1] == '\0')
-    return path[0] == '/';
-
-  u64 plen = kstrlen(prefix);
-  if(kstrncmp(path, prefix, plen) == 0)
-    return path[plen] == '\0' || path[plen] == '/';
-  return false;
+  u64             used; /**< Bit per entry: slot in use. */
+  vfs_oft_entry_t e[OFT_CHUNK];
+} oft_chunk_t;
+
+static vfs_mount_t   mounts[VFS_MAX_MOUNTS];
+static vfs_mount_t  *mount_index[VFS_MAX_MOUNTS]; /* longest target first */
+static u32           mount_count;
+static oft_chunk_t **oft_chunks;
+static u32           oft_nchunks;
+static u32           oft_cap;  /* slots in oft_chunks */
+static u32           oft_hint; /* no free entry below this chunk */
+static spinlock_t    oft_lock = SPINLOCK_INIT("oft", LOCK_CLASS_OFT);
+
+/** @brief OFT entry @p idx (must be below ::oft_size()). */
+#define OFT(idx) (oft_chunks[(u32)(idx) / OFT_CHUNK]->e[(u32)(idx) % OFT_CHUNK])
+
+/** @brief Number of OFT slots currently allocated. */
+static inline i32 oft_size(void)
+{
+  return (i32)(oft_nchunks * OFT_CHUNK);
 }
 
+static const fs_type_t *fs_registry[8];
+static u32              fs_registry_count = 0;
+
 /**
  * @brief Find the mount whose target is the longest prefix of @p path.
  *
  * Sets @p *rel_path to the portion of @p path after the mount target; it is
- * set to @c "/" when the path exactly equals the mount point.
+ * set to @c "/" when the path exactly equals the mount point.  The index is
+ * ordered by descending target length, newest first among equal targets,
+ * so the first mount whose target ends on a component boundary of @p path
+ * wins.
  *
  * @param path      Normalised absolute path to look up.
  * @param rel_path  Out-pointer receiving the driver-relative path; may be @c
@@ -78,25 +110,43 @@ static bool vfs_path_starts_with(const char *path, const char *prefix)
  */
 static vfs_mount_t *vfs_find_mount(const char *path, const char **rel_path)
 {
-  vfs_mount_t *best     = NULL;
-  u64          best_len = 0;
-
-  for(u32 i = 0; i < VFS_MAX_MOUNTS; i++) {
-    if(!mounts[i].active)
+  for(u32 i = 0; i < mount_count; i++) {
+    vfs_mount_t *m   = mount_index[i];
+    u64          len = m->target_len;
+
+    /* The root mount matches every absolute path. */
+    if(len == 1) {
+      if(path[0] != '/')
+        continue;
+      len = 0;
+    } else if(kstrncmp(path, m->target, len) != 0 ||
+              (path[len] != '\0' && path[len] != '/')) {
       continue;
-    u64 plen = kstrlen(mounts[i].target);
-    if(vfs_path_starts_with(path, mounts[i].target) && plen >= best_len) {
-      best     = &mounts[i];
-      best_len = plen;
     }
+
+    if(rel_path) {
+      *rel_path = path + len;
+      if((*rel_path)[0] == '\0')
+        *rel_path = "/";
+    }
+    return m;
   }
+  return NULL;
+}
 
-  if(best && rel_path) {
-    *rel_path = path + best_len;
-    if((*rel_path)[0] == '\0')
-      *rel_path = "/";
+/**
+ * @brief Add @p m to the mount index, keeping longer targets first.
+ *
+ * A mount goes ahead of older ones on the same target, so it covers them.
+ */
+static void mount_index_insert(vfs_mount_t *m)
+{
+  u32 i = mount_count++;
+  while(i > 0 && mount_index[i - 1]->target_len <= m->target_len) {
+    mount_index[i] = mount_index[i - 1];
+    i--;
   }
-  return best;
+  mount_index[i] = m;
 }
 
 /**
@@ -177,18 +227,149 @@ static void vfs_make_absolute(const char *path, char *out)
   vfs_normalize(out);
 }
 
-/** @brief Allocate and zero a free OFT slot; refcount is initialised to 1. */
+/**
+ * @brief Return @c true if @p rel is a clean relative path.
+ *
+ * Clean paths are non-empty, shorter than ::VFS_PATH_MAX, and contain no
+ * empty, @c . or @c .. components, no leading and no trailing slash.
+ */
+static bool vfs_is_clean_relative(const char *rel)
+{
+  const char *c = rel;
+  for(;;) {
+    const char *start = c;
+    while(*c && *c != '/')
+      c++;
+    u64 len = (u64)(c - start);
+    if(len == 0 || (len == 1 && start[0] == '.'))
+      return false;
+    if(len == 2 && start[0] == '.' && start[1] == '.')
+      return false;
+    if((u64)(c - rel) >= VFS_PATH_MAX - 1)
+      return false;
+    if(!*c)
+      return true;
+    c++;
+  }
+}
+
+/**
+ * @brief Return @c true if @p path is already in ::vfs_normalize form.
+ *
+ * Canonical paths are absolute and either @c "/" or @c "/" followed by a
+ * clean relative path.
+ */
+static bool vfs_is_canonical(const char *path)
+{
+  return path[0] == '/' &&
+         (path[1] == '\0' || vfs_is_clean_relative(path + 1));
+}
+
+/**
+ * @brief Resolve @p path to a normalised absolute path.
+ *
+ * Canonical absolute paths are returned as-is; anything else is rebuilt in
+ * @p buf via ::vfs_make_absolute.
+ *
+ * @param path  Input path (absolute or relative).
+ * @param buf   Scratch buffer of at least ::VFS_PATH_MAX bytes.
+ * @return @p path or @p buf, whichever holds the result.
+ */
+static const char *vfs_resolve(const char *path, char *buf)
+{
+  if(vfs_is_canonical(path))
+    return path;
+  vfs_make_absolute(path, buf);
+  return buf;
+}
+
+/** @brief Add one chunk of free entries to the OFT. */
+static bool oft_grow(void)
+{
+  if(oft_nchunks == oft_cap) {
+    u32           cap    = oft_cap ? oft_cap * 2 : 4;
+    oft_chunk_t **chunks = krealloc(oft_chunks, cap * sizeof(*chunks));
+    if(!chunks)
+      return false;
+    oft_chunks = chunks;
+    oft_cap    = cap;
+  }
+
+  oft_chunk_t *c = kzalloc(sizeof(oft_chunk_t));
+  if(!c)
+    return false;
+  oft_chunks[oft_nchunks++] = c;
+  return true;
+}
+
+/**
+ * @brief Allocate and zero a free OFT slot; refcount is initialised to 1.
+ *
+ * The first chunk with a clear bit in its use mask supplies the slot; the
+ * table grows by a chunk when all are full.
+ */
 static i32 oft_alloc(void)
 {
-  for(i32 i = 0; i < VFS_MAX_OFT; i++) {
-    if(!oft[i].in_use) {
-      kzero(&oft[i], sizeof(vfs_oft_entry_t));
-      oft[i].in_use   = true;
-      oft[i].refcount = 1;
-      return i;
+  spin_lock(&oft_lock);
+  for(u32 c = oft_hint;; c++) {
+    if(c == oft_nchunks && !oft_grow()) {
+      spin_unlock(&oft_lock);
+      return -ENFILE;
     }
+
+    u64 free = ~oft_chunks[c]->used;
+    if(!free)
+      continue;
+
+    u32 slot = (u32)__builtin_ctzll(free);
+    oft_chunks[c]->used |= 1ULL << slot;
+    oft_hint             = c;
+
+    i32 idx = (i32)(c * OFT_CHUNK + slot);
+    kzero(&OFT(idx), sizeof(vfs_oft_entry_t));
+    OFT(idx).in_use   = true;
+    OFT(idx).refcount = 1;
+    spin_unlock(&oft_lock);
+    return idx;
   }
-  return -ENFILE;
+}
+
+/** @brief Return OFT slot @p idx to the free pool. */
+static void oft_free(i32 idx)
+{
+  u32 c = (u32)idx / OFT_CHUNK;
+
+  spin_lock(&oft_lock);
+  OFT(idx).in_use = false;
+  oft_chunks[c]->used &= ~(1ULL << ((u32)idx % OFT_CHUNK));
+  if(c < oft_hint)
+    oft_hint = c;
+  spin_unlock(&oft_lock);
+}
+
+/** @brief Point fd @p fd of @p p at OFT slot @p idx, or close it (-1). */
+static void fd_set(proc_t *p, i64 fd, i32 idx)
+{
+  u64 bit = 1ULL << (fd % 64);
+
+  p->fds[fd] = idx;
+  if(idx >= 0)
+    p->fd_open[fd / 64] |= bit;
+  else
+    p->fd_open[fd / 64] &= ~bit;
+}
+
+/** @brief Lowest closed fd of @p p at or above @p from, or -1. */
+static i64 fd_lowest_free(const proc_t *p, i64 from)
+{
+  for(i64 w = from / 64; w < VFS_MAX_FD / 64; w++) {
+    u64 free = ~p->fd_open[w];
+    if(w == from / 64)
+      free &= ~0ULL << (from % 64);
+    if(free)
+      return w * 64 + __builtin_ctzll(free);
+  }
+  return -1;
 }
 
 /**
@@ -203,16 +384,31 @@ static i32 fd_to_oft(i64 fd)
   if(!p || fd < 0 || fd >= VFS_MAX_FD)
     return -1;
   i32 idx = p->fds[fd];
-  if(idx < 0 || idx >= VFS_MAX_OFT || !oft[idx].in_use)
+  if(idx < 0 || idx >= oft_size() || !OFT(idx).in_use)
     return -1;
   return idx;
 }
 
+i32 vfs_fd_to_oft(i64 fd)
+{
+  i32 idx = fd_to_oft(fd);
+  return idx < 0 ? -EBADF : idx;
+}
+
+const vfs_oft_entry_t *vfs_oft_get(i32 idx)
+{
+  if(idx < 0 || idx >= oft_size() || !OFT(idx).in_use)
+    return NULL;
+  return &OFT(idx);
+}
+
 /** @brief Increment the OFT refcount for slot @p idx. */
 void vfs_oft_retain(i32 idx)
 {
-  if(idx >= 0 && idx < VFS_MAX_OFT && oft[idx].in_use)
-    oft[idx].refcount++;
+  spin_lock(&oft_lock);
+  if(idx >= 0 && idx < oft_size() && OFT(idx).in_use)
+    OFT(idx).refcount++;
+  spin_unlock(&oft_lock);
 }
 
 /**
@@ -223,27 +419,44 @@ void vfs_oft_retain(i32 idx)
  */
 void vfs_oft_release(i32 idx)
 {
-  if(idx < 0 || idx >= VFS_MAX_OFT || !oft[idx].in_use)
+  spin_lock(&oft_lock);
+  bool last = idx >= 0 && idx < oft_size() && OFT(idx).in_use &&
+              --OFT(idx).refcount == 0;
+  spin_unlock(&oft_lock);
+  if(!last)
     return;
 
-  if(--oft[idx].refcount > 0)
-    return;
-
-  if(oft[idx].pipe)
-    pipe_oft_release(oft[idx].kind, oft[idx].pipe);
-
-  if(oft[idx].handle && oft[idx].ops && oft[idx].ops->close)
-    oft[idx].ops->close(oft[idx].handle);
-
-  oft[idx].in_use = false;
+  epoll_oft_closed(idx);
+  if(OFT(idx).kind == VFS_KIND_EPOLL)
+    epoll_oft_release(OFT(idx).obj);
+  else if(OFT(idx).kind == VFS_KIND_EVENTFD)
+    eventfd_oft_release(OFT(idx).obj);
+  else if(OFT(idx).kind == VFS_KIND_TIMERFD)
+    timerfd_oft_release(OFT(idx).obj);
+  else if(OFT(idx).kind == VFS_KIND_PERF)
+    perf_oft_release(OFT(idx).obj);
+  else if(OFT(idx).kind == VFS_KIND_URING)
+    uring_oft_release(OFT(idx).obj);
+  else if(OFT(idx).kind == VFS_KIND_SOCKET)
+    sock_oft_release(OFT(idx).obj);
+  else if(OFT(idx).obj)
+    pipe_oft_release(OFT(idx).kind, OFT(idx).obj);
+
+  if(OFT(idx).handle && OFT(idx).ops && OFT(idx).ops->close)
+    OFT(idx).ops->close(OFT(idx).handle);
+  if(OFT(idx).path)
+    kfree(OFT(idx).path);
+
+  oft_free(idx);
 }
 
 /**
  * @brief Install a new fd in the calling process pointing at OFT slot @p
  * oft_idx.
  *
- * Searches for the lowest free fd ≥ 3 (slots 0–2 are reserved for stdio).
- * Does not increment the OFT refcount — the caller owns that responsibility.
+ * Takes the lowest free fd ≥ 3 (slots 0–2 are reserved for stdio) from the
+ * process's fd bitmap. Does not increment the OFT refcount — the caller
+ * owns that responsibility.
  *
  * @return New fd on success, @c -EMFILE if the process fd table is full.
  */
@@ -252,20 +465,17 @@ i64 vfs_install_fd(i32 oft_idx)
   proc_t *p = proc_current();
   if(!p)
     return -EINVAL;
-  for(i64 i = 3; i < VFS_MAX_FD; i++) {
-    if(p->fds[i] < 0) {
-      p->fds[i] = oft_idx;
-      return i;
-    }
-  }
-  return -EMFILE;
+  i64 fd = fd_lowest_free(p, 3);
+  if(fd < 0)
+    return -EMFILE;
+  fd_set(p, fd, oft_idx);
+  return fd;
 }
 
-/** @brief Zero the mount table and OFT. */
+/** @brief Zero the mount table; the OFT grows on first use. */
 void vfs_init(void)
 {
   kzero(mounts, sizeof(mounts));
-  kzero(oft, sizeof(oft));
 }
 
 /** @brief Register a filesystem driver in the type registry. */
@@ -320,21 +530,60 @@ i64 vfs_mount(const char *source, const char *target, const char *fstype)
   mounts[slot].fs_data = fs_data;
   kstrncpy(mounts[slot].target, target, VFS_PATH_MAX);
   vfs_normalize(mounts[slot].target);
+  mounts[slot].target_len = kstrlen(mounts[slot].target);
+  mount_index_insert(&mounts[slot]);
 
   return 0;
 }
 
 /**
- * @brief Open or create a file and install a file descriptor.
+ * @brief Allocate an OFT entry for driver handle @p fh of volume @p volume.
  *
- * Resolves @p path to an absolute form, dispatches to the responsible driver,
- * allocates an OFT entry, and returns the lowest available fd ≥ 3.
+ * Directories keep a copy of their absolute path @p abs so ::vfs_openat can
+ * anchor relative lookups on them.  On failure @p fh is closed.
+ *
+ * @return OFT index, or negative errno.
  */
-i64 vfs_open(const char *path, u32 flags)
+static i32 oft_attach(
+    const fs_ops_t *ops, void *volume, fs_handle_t fh, u32 flags,
+    const char *abs
+)
 {
-  char abs[VFS_PATH_MAX];
-  vfs_make_absolute(path, abs);
+  i32 oft_idx = oft_alloc();
+  if(oft_idx < 0) {
+    ops->close(fh);
+    return oft_idx;
+  }
+
+  OFT(oft_idx).handle = fh;
+  OFT(oft_idx).ops    = ops;
+  OFT(oft_idx).flags  = flags;
+  OFT(oft_idx).kind   = VFS_KIND_FILE;
+  OFT(oft_idx).offset = 0;
+  OFT(oft_idx).volume = volume;
+
+  vfs_stat_t st;
+  if(ops->fstat && ops->fstat(fh, &st) == 0) {
+    OFT(oft_idx).ino  = st.ino;
+    OFT(oft_idx).type = st.type;
+  }
+  if(OFT(oft_idx).type == VFS_DIRECTORY && abs) {
+    u64 len = kstrlen(abs) + 1;
+
+    OFT(oft_idx).path = kmalloc(len);
+    if(OFT(oft_idx).path)
+      kmemcpy(OFT(oft_idx).path, abs, len);
+  }
+  if(flags & O_TRUNC) {
+    pcache_truncate(oft_idx, 0);
+    elf_cache_invalidate(OFT(oft_idx).volume, OFT(oft_idx).ino);
+  }
+  return oft_idx;
+}
 
+/** @brief Open normalised absolute path @p abs into a new OFT entry. */
+static i32 oft_open(const char *abs, u32 flags)
+{
   const char  *rel   = NULL;
   vfs_mount_t *mount = vfs_find_mount(abs, &rel);
   if(!mount)
@@ -343,19 +592,91 @@ i64 vfs_open(const char *path, u32 flags)
   fs_handle_t fh = mount->ops->open(mount->fs_data, rel, flags);
   if(!fh)
     return -ENOENT;
+  return oft_attach(mount->ops, mount->fs_data, fh, flags, abs);
+}
 
-  i32 oft_idx = oft_alloc();
-  if(oft_idx < 0) {
-    mount->ops->close(fh);
-    return oft_idx;
+/**
+ * @brief Resolve @p path for an @c *at call relative to directory @p dirfd.
+ *
+ * Absolute paths ignore @p dirfd.  A clean relative path below a directory
+ * whose OFT entry is at hand (a real @p dirfd, or the process's cwd handle
+ * for ::VFS_AT_FDCWD) that stays on the same mount is looked up by the
+ * driver starting from that directory's inode; @p *fh then holds the
+ * opened node.  Otherwise @p *fh is @c NULL and the caller resolves @p *abs
+ * from the root as usual.
+ *
+ * @param dirfd    Directory fd, or ::VFS_AT_FDCWD.
+ * @param path     Path to resolve.
+ * @param flags    Open flags; @c O_CREAT always takes the slow path.
+ * @param scratch  Buffer of ::VFS_PATH_MAX bytes.
+ * @param abs      Out: normalised absolute path of the target.
+ * @param mount    Out: mount holding @p *fh when it is set.
+ * @param fh       Out: handle opened directly from the directory, or NULL.
+ * @return 0 on success (including a lookup left to the caller), negative
+ *         errno if @p dirfd is unusable or a fast lookup found nothing.
+ */
+static i64 vfs_lookup_at(
+    i64 dirfd, const char *path, u32 flags, char *scratch, const char **abs,
+    vfs_mount_t **mount, fs_handle_t *fh
+)
+{
+  *fh = NULL;
+  if(path[0] == '/') {
+    *abs = vfs_resolve(path, scratch);
+    return 0;
   }
 
-  oft[oft_idx].handle = fh;
-  oft[oft_idx].ops    = mount->ops;
-  oft[oft_idx].flags  = flags;
-  oft[oft_idx].kind   = VFS_KIND_FILE;
-  oft[oft_idx].offset = 0;
+  i32         dir  = -1;
+  const char *base = "/";
+  if(dirfd == VFS_AT_FDCWD) {
+    proc_t *p = proc_current();
+    if(p) {
+      dir  = p->cwd_oft;
+      base = p->cwd[0] ? p->cwd : "/";
+    }
+  } else {
+    dir = fd_to_oft(dirfd);
+    if(dir < 0)
+      return -EBADF;
+    if(!OFT(dir).path)
+      return -ENOTDIR;
+    base = OFT(dir).path;
+  }
+
+  /* base is canonical, so joining needs no normalisation when path is
+   * clean. */
+  u64 blen = kstrlen(base);
+  if(blen == 1)
+    blen = 0;
+  if(blen + 1 + kstrlen(path) >= VFS_PATH_MAX)
+    return -ENAMETOOLONG;
+  kmemcpy(scratch, base, blen);
+  scratch[blen] = '/';
+  kstrncpy(scratch + blen + 1, path, VFS_PATH_MAX - blen - 1);
+  *abs = scratch;
+
+  if(!vfs_is_clean_relative(path)) {
+    vfs_normalize(scratch);
+    return 0;
+  }
+  if(dir < 0 || (flags & O_CREAT) || !OFT(dir).ops || !OFT(dir).ops->open_at)
+    return 0;
+
+  /* A longer mount on the way to the target means a mount crossing. */
+  vfs_mount_t *m = vfs_find_mount(scratch, NULL);
+  if(!m || m->fs_data != OFT(dir).volume)
+    return 0;
+
+  *fh = m->ops->open_at(OFT(dir).handle, path, flags);
+  if(!*fh)
+    return -ENOENT;
+  *mount = m;
+  return 0;
+}
 
+/** @brief Install an fd for freshly opened OFT entry @p oft_idx. */
+static i64 open_install(i32 oft_idx, u32 flags)
+{
   i64 fd = vfs_install_fd(oft_idx);
   if(fd < 0) {
     vfs_oft_release(oft_idx);
@@ -370,29 +691,230 @@ i64 vfs_open(const char *path, u32 flags)
 }
 
 /**
- * @brief Read up to @p count bytes from @p fd into @p buf.
+ * @brief Open or create a file and install a file descriptor.
  *
- * Pipe read-ends block until data is available or the write end closes.
- * The OFT file offset is advanced by the number of bytes actually read.
+ * Resolves @p path to an absolute form, dispatches to the responsible driver,
+ * allocates an OFT entry, and returns the lowest available fd ≥ 3.
  */
-i64 vfs_read(i64 fd, void *buf, u64 count)
+i64 vfs_open(const char *path, u32 flags)
 {
-  i32 oft_idx = fd_to_oft(fd);
+  return vfs_openat(VFS_AT_FDCWD, path, flags);
+}
+
+/**
+ * @brief Open @p path relative to directory @p dirfd.
+ *
+ * See ::vfs_lookup_at for when the lookup starts at the directory itself
+ * rather than at the root.
+ */
+i64 vfs_openat(i64 dirfd, const char *path, u32 flags)
+{
+  char         scratch[VFS_PATH_MAX];
+  const char  *abs;
+  vfs_mount_t *mount;
+  fs_handle_t  fh;
+
+  i64 r = vfs_lookup_at(dirfd, path, flags, scratch, &abs, &mount, &fh);
+  if(r < 0)
+    return r;
+
+  i32 oft_idx = fh ? oft_attach(mount->ops, mount->fs_data, fh, flags, abs)
+                  : oft_open(abs, flags);
   if(oft_idx < 0)
-    return -EBADF;
+    return oft_idx;
+  return open_install(oft_idx, flags);
+}
 
-  vfs_oft_entry_t *e = &oft[oft_idx];
+i64 vfs_open_handle(
+    const fs_ops_t *ops, void *volume, fs_handle_t fh, u32 flags
+)
+{
+  i32 oft_idx = oft_attach(ops, volume, fh, flags, NULL);
+  if(oft_idx < 0)
+    return oft_idx;
+  return open_install(oft_idx, flags);
+}
+
+i64 vfs_oft_seals(i32 idx, u32 add)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(idx);
+  if(!e || e->kind != VFS_KIND_FILE || !e->ops->seal)
+    return -EINVAL;
+  return e->ops->seal(e->handle, add);
+}
+
+/**
+ * @brief Move data for an O_DIRECT file straight between disk and @p buf.
+ *
+ * The user pages are pinned and handed to the driver a chunk at a time,
+ * skipping the page cache. Dirty mmap pages are written back before a read
+ * so it sees them, and cached pages take a write's data so they stay
+ * current. Returns -EOPNOTSUPP, before touching anything, when the request
+ * must take the buffered path instead: no O_DIRECT, a driver without
+ * @c direct, or a transfer it cannot take as it is (misaligned, say).
+ */
+static i64 oft_direct(
+    i32 oft_idx, bool write, void *buf, u64 count, u64 offset
+)
+{
+  vfs_oft_entry_t *e = &OFT(oft_idx);
+  u64              a = (u64)buf | count | offset;
+
+  if(!(e->flags & O_DIRECT) || e->kind != VFS_KIND_FILE ||
+     e->type != VFS_FILE || !e->ops->direct)
+    return -EOPNOTSUPP;
+  if(count == 0 || a % VFS_DIRECT_ALIGN || !vmm_is_user_range(buf, count))
+    return -EOPNOTSUPP;
+
+  u64 *pages = kmalloc((VFS_DIRECT_CHUNK / PAGE_SIZE + 1) * sizeof(u64));
+  if(!pages)
+    return -ENOMEM;
+  if(!write)
+    pcache_writeback(oft_idx, offset, offset + count);
+
+  u64 done = 0;
+  i64 r    = 0;
+  while(done < count) {
+    u64 want = count - done < VFS_DIRECT_CHUNK ? count - done
+                                               : VFS_DIRECT_CHUNK;
+    u64 at   = (u64)buf + done;
+    i64 n    = pin_user_pages(at, want, !write, pages);
+    if(n < 0) {
+      r = n;
+      break;
+    }
+    r = e->ops->direct(
+        e->handle, write, pages, (u32)(at % PAGE_SIZE), want, offset + done
+    );
+    unpin_user_pages(pages, (u64)n);
+    if(r <= 0)
+      break;
+    if(write)
+      pcache_update(oft_idx, (u8 *)buf + done, (u64)r, offset + done);
+    done += (u64)r;
+    if((u64)r < want)
+      break;
+  }
+  kfree(pages);
+
+  if(write && done)
+    elf_cache_invalidate(e->volume, e->ino);
+  /* A first chunk the driver would not take goes buffered, whole. */
+  if(done == 0 && r == -EOPNOTSUPP)
+    return -EOPNOTSUPP;
+  return done ? (i64)done : r;
+}
+
+/** @brief Read through OFT entry @p oft_idx at its offset, advancing it. */
+static i64 oft_read(i32 oft_idx, void *buf, u64 count)
+{
+  vfs_oft_entry_t *e = &OFT(oft_idx);
   if(e->kind == VFS_KIND_PIPE_RD)
-    return pipe_read_obj(e->pipe, buf, count);
+    return pipe_read_obj(e->obj, buf, count);
+  if(e->kind == VFS_KIND_PIPE_WR)
+    return -EBADF;
+  if(e->kind == VFS_KIND_EPOLL)
+    return -EINVAL;
+  if(e->kind == VFS_KIND_EVENTFD)
+    return eventfd_read_obj(e->obj, buf, count);
+  if(e->kind == VFS_KIND_TIMERFD)
+    return timerfd_read_obj(e->obj, buf, count);
+  if(e->kind == VFS_KIND_PERF)
+    return perf_read_obj(e->obj, buf, count);
+  if(e->kind == VFS_KIND_URING)
+    return -EINVAL;
+  if(e->kind == VFS_KIND_SOCKET)
+    return sock_read_obj(e->obj, buf, count, e->flags);
+
+  i64 bytes = oft_direct(oft_idx, false, buf, count, e->offset);
+  if(bytes == -EOPNOTSUPP)
+    bytes = e->type == VFS_FILE
+                ? pcache_read(oft_idx, &e->ra, buf, count, e->offset)
+                : e->ops->read(e->handle, buf, count, e->offset);
+  if(bytes > 0)
+    e->offset += (u64)bytes;
+  return bytes;
+}
+
+/** @brief Write through OFT entry @p oft_idx at its offset, advancing it. */
+static i64 oft_write(i32 oft_idx, const void *buf, u64 count)
+{
+  vfs_oft_entry_t *e = &OFT(oft_idx);
   if(e->kind == VFS_KIND_PIPE_WR)
+    return pipe_write_obj(e->obj, buf, count);
+  if(e->kind == VFS_KIND_PIPE_RD)
     return -EBADF;
+  if(e->kind == VFS_KIND_EPOLL)
+    return -EINVAL;
+  if(e->kind == VFS_KIND_EVENTFD)
+    return eventfd_write_obj(e->obj, buf, count);
+  if(e->kind == VFS_KIND_TIMERFD || e->kind == VFS_KIND_PERF ||
+     e->kind == VFS_KIND_URING)
+    return -EINVAL;
+  if(e->kind == VFS_KIND_SOCKET)
+    return sock_write_obj(e->obj, buf, count, e->flags);
+
+  if(e->flags & O_APPEND) {
+    vfs_stat_t st;
+    if(e->ops->fstat(e->handle, &st) == 0)
+      e->offset = st.size;
+  }
 
-  i64 bytes = e->ops->read(e->handle, buf, count, e->offset);
+  i64 bytes = oft_direct(oft_idx, true, (void *)buf, count, e->offset);
   if(bytes > 0)
     e->offset += (u64)bytes;
+  if(bytes != -EOPNOTSUPP)
+    return bytes;
+
+  bytes = e->ops->write(e->handle, buf, count, e->offset);
+  if(bytes > 0) {
+    pcache_update(oft_idx, buf, (u64)bytes, e->offset);
+    elf_cache_invalidate(e->volume, e->ino);
+    e->offset += (u64)bytes;
+  }
   return bytes;
 }
 
+/**
+ * @brief Read up to @p count bytes from @p fd into @p buf.
+ *
+ * Pipe read-ends block until data is available or the write end closes.
+ * Regular files are read through the page cache.  The OFT file offset is
+ * advanced by the number of bytes actually read.
+ */
+i64 vfs_read(i64 fd, void *buf, u64 count)
+{
+  i32 oft_idx = fd_to_oft(fd);
+  if(oft_idx < 0)
+    return -EBADF;
+  return oft_read(oft_idx, buf, count);
+}
+
+/** @brief Scatter read: one fd lookup, and one pipe lock, for all of @p iov. */
+i64 vfs_readv(i64 fd, const vfs_iovec_t *iov, u32 iovcnt)
+{
+  i32 oft_idx = fd_to_oft(fd);
+  if(oft_idx < 0)
+    return -EBADF;
+
+  vfs_oft_entry_t *e = &OFT(oft_idx);
+  if(e->kind == VFS_KIND_PIPE_RD)
+    return pipe_readv_obj(e->obj, iov, iovcnt);
+
+  u64 total = 0;
+  for(u32 i = 0; i < iovcnt; i++) {
+    if(!iov[i].len)
+      continue;
+    i64 n = oft_read(oft_idx, iov[i].base, iov[i].len);
+    if(n < 0)
+      return total ? (i64)total : n;
+    total += (u64)n;
+    if((u64)n < iov[i].len)
+      break;
+  }
+  return (i64)total;
+}
+
 /**
  * @brief Write @p count bytes from @p buf to @p fd.
  *
@@ -404,25 +926,139 @@ i64 vfs_write(i64 fd, const void *buf, u64 count)
   i32 oft_idx = fd_to_oft(fd);
   if(oft_idx < 0)
     return -EBADF;
+  return oft_write(oft_idx, buf, count);
+}
 
-  vfs_oft_entry_t *e = &oft[oft_idx];
-  if(e->kind == VFS_KIND_PIPE_WR)
-    return pipe_write_obj(e->pipe, buf, count);
-  if(e->kind == VFS_KIND_PIPE_RD)
+/**
+ * @brief Gather write: the driver's @c writev if it has one.
+ *
+ * O_DIRECT files go a buffer at a time, so each can skip the cache.
+ */
+i64 vfs_writev(i64 fd, const vfs_iovec_t *iov, u32 iovcnt)
+{
+  i32 oft_idx = fd_to_oft(fd);
+  if(oft_idx < 0)
     return -EBADF;
 
+  vfs_oft_entry_t *e = &OFT(oft_idx);
+  if(e->kind == VFS_KIND_PIPE_WR)
+    return pipe_writev_obj(e->obj, iov, iovcnt);
+
+  if(e->kind != VFS_KIND_FILE || !e->ops->writev || e->flags & O_DIRECT) {
+    u64 total = 0;
+    for(u32 i = 0; i < iovcnt; i++) {
+      if(!iov[i].len)
+        continue;
+      i64 n = oft_write(oft_idx, iov[i].base, iov[i].len);
+      if(n < 0)
+        return total ? (i64)total : n;
+      total += (u64)n;
+      if((u64)n < iov[i].len)
+        break;
+    }
+    return (i64)total;
+  }
+
   if(e->flags & O_APPEND) {
     vfs_stat_t st;
     if(e->ops->fstat(e->handle, &st) == 0)
       e->offset = st.size;
   }
 
-  i64 bytes = e->ops->write(e->handle, buf, count, e->offset);
-  if(bytes > 0)
+  i64 bytes = e->ops->writev(e->handle, iov, iovcnt, e->offset);
+  if(bytes > 0) {
+    u64 left = (u64)bytes;
+    u64 pos  = e->offset;
+    for(u32 i = 0; i < iovcnt && left; i++) {
+      u64 n = iov[i].len < left ? iov[i].len : left;
+      if(n)
+        pcache_update(oft_idx, iov[i].base, n, pos);
+      pos += n;
+      left -= n;
+    }
+    elf_cache_invalidate(e->volume, e->ino);
     e->offset += (u64)bytes;
+  }
+  return bytes;
+}
+
+/** @brief Write to @p fd at @p offset without touching its file offset. */
+i64 vfs_pwrite(i64 fd, const void *buf, u64 count, u64 offset)
+{
+  i32 oft_idx = fd_to_oft(fd);
+  if(oft_idx < 0)
+    return -EBADF;
+
+  const vfs_oft_entry_t *e = &OFT(oft_idx);
+  if(e->kind != VFS_KIND_FILE)
+    return -ESPIPE;
+
+  i64 bytes = e->ops->write(e->handle, buf, count, offset);
+  if(bytes > 0) {
+    pcache_update(oft_idx, buf, (u64)bytes, offset);
+    elf_cache_invalidate(e->volume, e->ino);
+  }
   return bytes;
 }
 
+/**
+ * @brief Hand a regular file's data to @p sink page by page.
+ *
+ * Each page is pinned with its own frame reference while @p sink runs, so
+ * a sink that blocks (a full pipe) cannot have the page evicted under it.
+ */
+i64 vfs_sendfile(
+    i64 in_fd, u64 *offset, u64 count, vfs_sink_t sink, void *ctx
+)
+{
+  i32 oft_idx = fd_to_oft(in_fd);
+  if(oft_idx < 0)
+    return -EBADF;
+
+  vfs_oft_entry_t *e = &OFT(oft_idx);
+  if(e->kind != VFS_KIND_FILE || e->type != VFS_FILE || !e->ops->fstat)
+    return -EINVAL;
+
+  vfs_stat_t st;
+  i64        ret = e->ops->fstat(e->handle, &st);
+  if(ret < 0)
+    return ret;
+
+  u64 pos  = offset ? *offset : e->offset;
+  u64 done = 0;
+  while(done < count && pos < st.size) {
+    u64 in    = pos % PAGE_SIZE;
+    u64 chunk = PAGE_SIZE - in;
+    if(chunk > count - done)
+      chunk = count - done;
+    if(chunk > st.size - pos)
+      chunk = st.size - pos;
+
+    void *phys = pcache_get_page(oft_idx, pos / PAGE_SIZE);
+    if(!phys) {
+      ret = -EIO;
+      break;
+    }
+    i64 n = sink(ctx, (u8 *)phys_to_virt((u64)phys) + in, chunk);
+    pmm_free(phys);
+    if(n <= 0) {
+      ret = n;
+      break;
+    }
+
+    pos += (u64)n;
+    done += (u64)n;
+    if((u64)n < chunk)
+      break;
+  }
+
+  if(offset)
+    *offset = pos;
+  else
+    e->offset = pos;
+  return done ? (i64)done : ret;
+}
+
 /**
  * @brief Release a file descriptor and decrement the OFT refcount.
  *
@@ -439,7 +1075,7 @@ i64 vfs_close(i64 fd)
     return -EBADF;
 
   vfs_oft_release(oft_idx);
-  p->fds[fd]        = -1;
+  fd_set(p, fd, -1);
   p->fd_cloexec[fd] = 0;
   return 0;
 }
@@ -447,8 +1083,8 @@ i64 vfs_close(i64 fd)
 /** @brief Stat the node at @p path via the responsible driver. */
 i64 vfs_stat(const char *path, vfs_stat_t *st)
 {
-  char abs[VFS_PATH_MAX];
-  vfs_make_absolute(path, abs);
+  char        scratch[VFS_PATH_MAX];
+  const char *abs = vfs_resolve(path, scratch);
   const char  *rel   = NULL;
   vfs_mount_t *mount = vfs_find_mount(abs, &rel);
   if(!mount)
@@ -456,6 +1092,23 @@ i64 vfs_stat(const char *path, vfs_stat_t *st)
   return mount->ops->stat(mount->fs_data, rel, st);
 }
 
+/** @brief Stat @p path relative to directory @p dirfd. */
+i64 vfs_statat(i64 dirfd, const char *path, vfs_stat_t *st)
+{
+  char         scratch[VFS_PATH_MAX];
+  const char  *abs;
+  vfs_mount_t *mount;
+  fs_handle_t  fh;
+
+  i64 r = vfs_lookup_at(dirfd, path, O_RDONLY, scratch, &abs, &mount, &fh);
+  if(r < 0 || !fh)
+    return r < 0 ? r : vfs_stat(abs, st);
+
+  r = mount->ops->fstat(fh, st);
+  mount->ops->close(fh);
+  return r;
+}
+
 /** @brief Stat an open file descriptor, returning synthetic metadata for pipes.
  */
 i64 vfs_fstat(i64 fd, vfs_stat_t *st)
@@ -463,19 +1116,19 @@ i64 vfs_fstat(i64 fd, vfs_stat_t *st)
   i32 idx = fd_to_oft(fd);
   if(idx < 0)
     return -EBADF;
-  if(oft[idx].pipe) {
+  if(OFT(idx).obj) {
     kzero(st, sizeof(*st));
     st->type = VFS_FIFO;
     return 0;
   }
-  return oft[idx].ops->fstat(oft[idx].handle, st);
+  return OFT(idx).ops->fstat(OFT(idx).handle, st);
 }
 
 /** @brief Create a directory at @p path via the responsible driver. */
 i64 vfs_mkdir(const char *path)
 {
-  char abs[VFS_PATH_MAX];
-  vfs_make_absolute(path, abs);
+  char        scratch[VFS_PATH_MAX];
+  const char *abs = vfs_resolve(path, scratch);
   const char  *rel   = NULL;
   vfs_mount_t *mount = vfs_find_mount(abs, &rel);
   if(!mount)
@@ -486,20 +1139,29 @@ i64 vfs_mkdir(const char *path)
 /** @brief Delete the file at @p path; fails if it is a directory. */
 i64 vfs_unlink(const char *path)
 {
-  char abs[VFS_PATH_MAX];
-  vfs_make_absolute(path, abs);
+  char        scratch[VFS_PATH_MAX];
+  const char *abs = vfs_resolve(path, scratch);
   const char  *rel   = NULL;
   vfs_mount_t *mount = vfs_find_mount(abs, &rel);
   if(!mount)
     return -ENOENT;
-  return mount->ops->unlink(mount->fs_data, rel);
+
+  vfs_stat_t st;
+  bool       have_ino = mount->ops->stat(mount->fs_data, rel, &st) == 0;
+
+  i64 ret = mount->ops->unlink(mount->fs_data, rel);
+  if(ret == 0 && have_ino) {
+    pcache_invalidate(mount->fs_data, st.ino);
+    elf_cache_invalidate(mount->fs_data, st.ino);
+  }
+  return ret;
 }
 
 /** @brief Remove the empty directory at @p path. */
 i64 vfs_rmdir(const char *path)
 {
-  char abs[VFS_PATH_MAX];
-  vfs_make_absolute(path, abs);
+  char        scratch[VFS_PATH_MAX];
+  const char *abs = vfs_resolve(path, scratch);
   const char  *rel   = NULL;
   vfs_mount_t *mount = vfs_find_mount(abs, &rel);
   if(!mount)
@@ -518,9 +1180,9 @@ i64 vfs_seek(i64 fd, i64 offset, i32 whence)
   i32 idx = fd_to_oft(fd);
   if(idx < 0)
     return -EBADF;
-  vfs_oft_entry_t *e = &oft[idx];
+  vfs_oft_entry_t *e = &OFT(idx);
 
-  if(e->pipe)
+  if(e->obj)
     return -ESPIPE;
 
   u64 base;
@@ -549,11 +1211,46 @@ i64 vfs_seek(i64 fd, i64 offset, i32 whence)
   return target;
 }
 
+/** @brief Output buffer state of one getdents() call. */
+typedef struct
+{
+  vfs_oft_entry_t *e;
+  u8              *out;
+  u64              count;
+  u64              written;
+} getdents_ctx_t;
+
+/** @brief Append one @c dirent64 record; see ::vfs_filldir_t. */
+static bool getdents_fill(
+    void *ctx, const char *name, u32 len, u64 ino, u8 type, u64 next
+)
+{
+  getdents_ctx_t *g      = ctx;
+  u32             reclen = (u32)((19 + len + 1 + 7) & ~7ULL);
+
+  if(g->written + reclen > g->count)
+    return false;
+
+  dirent_t *d = (dirent_t *)(g->out + g->written);
+  d->d_ino    = ino;
+  d->d_off    = (i64)next;
+  d->d_reclen = (u16)reclen;
+  d->d_type   = (type == VFS_DIRECTORY) ? DT_DIR : DT_REG;
+  kmemcpy(d->d_name, name, len);
+  d->d_name[len] = '\0';
+
+  g->written   += reclen;
+  g->e->offset  = next;
+  return true;
+}
+
 /**
  * @brief Fill @p buf with @c dirent64 entries from an open directory fd.
  *
  * Reads as many complete entries as fit within @p count bytes, advancing the
  * OFT directory position on each successful entry.  Returns 0 when exhausted.
+ * Drivers with an @c iterate callback fill the buffer in one pass from the
+ * stored position; others are asked for one entry index at a time.
  */
 i64 vfs_getdents(i64 fd, void *buf, u64 count)
 {
@@ -561,54 +1258,65 @@ i64 vfs_getdents(i64 fd, void *buf, u64 count)
   if(idx < 0)
     return -EBADF;
 
-  vfs_oft_entry_t *e       = &oft[idx];
-  u8              *out     = (u8 *)buf;
-  u64              written = 0;
+  vfs_oft_entry_t *e = &OFT(idx);
+  if(!e->ops)
+    return -ENOTDIR;
 
-  while(written + 32 <= count) {
+  getdents_ctx_t g = {.e = e, .out = (u8 *)buf, .count = count};
+
+  if(e->ops->iterate) {
+    i64 ret = e->ops->iterate(e->handle, e->offset, getdents_fill, &g);
+    if(ret < 0 && g.written == 0)
+      return ret;
+    return (i64)g.written;
+  }
+  if(!e->ops->readdir)
+    return -ENOTDIR;
+
+  for(;;) {
     vfs_stat_t st;
     char       name[VFS_NAME_MAX + 1];
     i64        ret = e->ops->readdir(e->handle, e->offset, name, &st);
     if(ret <= 0)
       break;
 
-    u32 namelen = (u32)kstrlen(name);
-    u32 reclen  = (u32)((19 + namelen + 1 + 7) & ~7ULL);
-
-    if(written + reclen > count)
+    if(!getdents_fill(
+           &g, name, (u32)kstrlen(name), st.ino, st.type, e->offset + 1
+       ))
       break;
-
-    dirent_t *d = (dirent_t *)(out + written);
-    d->d_ino    = st.ino;
-    d->d_off    = (i64)(e->offset + 1);
-    d->d_reclen = (u16)reclen;
-    d->d_type   = (st.type == VFS_DIRECTORY) ? DT_DIR : DT_REG;
-    kstrncpy(d->d_name, name, namelen + 1);
-
-    written += reclen;
-    e->offset++;
   }
 
-  return (i64)written;
+  return (i64)g.written;
 }
 
 /**
  * @brief Change the calling process's working directory to @p path.
  *
  * The path is validated as an existing directory before updating
- * @c proc_t::cwd.  Returns @c -ENOTDIR if the target does not exist or is
- * not a directory.
+ * @c proc_t::cwd; the directory stays open as @c proc_t::cwd_oft so relative
+ * lookups can start from it.  Returns @c -ENOTDIR if the target does not
+ * exist or is not a directory.
  */
 i64 vfs_chdir(const char *path)
 {
-  char abs[VFS_PATH_MAX];
-  vfs_make_absolute(path, abs);
-  vfs_stat_t st;
-  if(vfs_stat(abs, &st) < 0 || st.type != VFS_DIRECTORY)
+  char        scratch[VFS_PATH_MAX];
+  const char *abs = vfs_resolve(path, scratch);
+  i32 idx = oft_open(abs, O_RDONLY);
+  if(idx < 0)
     return -ENOTDIR;
+  if(OFT(idx).type != VFS_DIRECTORY) {
+    vfs_oft_release(idx);
+    return -ENOTDIR;
+  }
+
   proc_t *p = proc_current();
-  if(p)
-    kstrncpy(p->cwd, abs, VFS_PATH_MAX);
+  if(!p) {
+    vfs_oft_release(idx);
+    return 0;
+  }
+  kstrncpy(p->cwd, abs, VFS_PATH_MAX);
+  vfs_oft_release(p->cwd_oft);
+  p->cwd_oft = idx;
   return 0;
 }
 
@@ -635,10 +1343,10 @@ const char *vfs_getcwd(void)
  */
 i64 vfs_rename(const char *oldpath, const char *newpath)
 {
-  char abs_old[VFS_PATH_MAX];
-  char abs_new[VFS_PATH_MAX];
-  vfs_make_absolute(oldpath, abs_old);
-  vfs_make_absolute(newpath, abs_new);
+  char        buf_old[VFS_PATH_MAX];
+  char        buf_new[VFS_PATH_MAX];
+  const char *abs_old = vfs_resolve(oldpath, buf_old);
+  const char *abs_new = vfs_resolve(newpath, buf_new);
 
   vfs_stat_t st;
   if(vfs_stat(abs_old, &st) < 0)
@@ -673,17 +1381,27 @@ i64 vfs_rename(const char *oldpath, const char *newpath)
     off += (u64)n;
   }
 
+  /* The driver-level copy bypassed the page cache on both inodes. */
+  vfs_stat_t dst_st;
+  if(dst_m->ops->fstat(dst_fh, &dst_st) == 0) {
+    pcache_invalidate(dst_m->fs_data, dst_st.ino);
+    elf_cache_invalidate(dst_m->fs_data, dst_st.ino);
+  }
+
   src_m->ops->close(src_fh);
   dst_m->ops->close(dst_fh);
-  src_m->ops->unlink(src_m->fs_data, src_rel);
+  if(src_m->ops->unlink(src_m->fs_data, src_rel) == 0) {
+    pcache_invalidate(src_m->fs_data, st.ino);
+    elf_cache_invalidate(src_m->fs_data, st.ino);
+  }
   return 0;
 }
 
 /** @brief Read the target of the symbolic link at @p path into @p buf. */
 i64 vfs_readlink(const char *path, char *buf, u64 cap)
 {
-  char abs[VFS_PATH_MAX];
-  vfs_make_absolute(path, abs);
+  char        scratch[VFS_PATH_MAX];
+  const char *abs = vfs_resolve(path, scratch);
   const char  *rel;
   vfs_mount_t *m = vfs_find_mount(abs, &rel);
   if(!m || !m->ops->readlink)
@@ -697,9 +1415,50 @@ i64 vfs_ftruncate(i64 fd, u64 length)
   i32 idx = fd_to_oft(fd);
   if(idx < 0)
     return -EBADF;
-  if(oft[idx].pipe)
+  if(OFT(idx).obj)
+    return -EINVAL;
+
+  i64 ret = OFT(idx).ops->truncate(OFT(idx).handle, length);
+  if(ret == 0) {
+    pcache_truncate(idx, length);
+    elf_cache_invalidate(OFT(idx).volume, OFT(idx).ino);
+  }
+  return ret;
+}
+
+/** @brief Write back dirty pages of @p fd and commit it through the driver. */
+i64 vfs_fsync(i64 fd)
+{
+  i32 idx = fd_to_oft(fd);
+  if(idx < 0)
+    return -EBADF;
+  if(OFT(idx).obj)
     return -EINVAL;
-  return oft[idx].ops->truncate(oft[idx].handle, length);
+
+  if(OFT(idx).type == VFS_FILE)
+    pcache_writeback(idx, 0, (u64)-1);
+  if(!OFT(idx).ops->fsync)
+    return 0;
+  return OFT(idx).ops->fsync(OFT(idx).handle);
+}
+
+/** @brief Write back every open file's pages, then sync each mount. */
+i64 vfs_sync(void)
+{
+  for(i32 i = 0; i < oft_size(); i++) {
+    if(OFT(i).in_use && !OFT(i).obj && OFT(i).type == VFS_FILE)
+      pcache_writeback(i, 0, (u64)-1);
+  }
+
+  i64 ret = 0;
+  for(u32 i = 0; i < VFS_MAX_MOUNTS; i++) {
+    if(!mounts[i].active || !mounts[i].ops->sync)
+      continue;
+    i64 r = mounts[i].ops->sync(mounts[i].fs_data);
+    if(r < 0 && ret == 0)
+      ret = r;
+  }
+  return ret;
 }
 
 /** @brief Return the open flags stored in the OFT for @p fd. */
@@ -708,7 +1467,7 @@ i64 vfs_get_flags(i64 fd)
   i32 idx = fd_to_oft(fd);
   if(idx < 0)
     return -EBADF;
-  return oft[idx].flags;
+  return OFT(idx).flags;
 }
 
 /** @brief Overwrite the open flags for @p fd (used by @c fcntl @c F_SETFL). */
@@ -717,7 +1476,7 @@ i64 vfs_set_flags(i64 fd, u32 flags)
   i32 idx = fd_to_oft(fd);
   if(idx < 0)
     return -EBADF;
-  oft[idx].flags = flags;
+  OFT(idx).flags = flags;
   return 0;
 }
 
@@ -752,37 +1511,44 @@ i64 vfs_dup2(i64 oldfd, i64 newfd)
     return -EBADF;
   if(p->fds[newfd] >= 0)
     vfs_close(newfd);
-  p->fds[newfd] = idx;
+  fd_set(p, newfd, idx);
   vfs_oft_retain(idx);
   return newfd;
 }
 
-/** @brief Return positive if @p fd has data available without blocking, 0 if
- * not ready. */
-i32 vfs_select_read_ready(i64 fd)
+i32 vfs_oft_poll(i32 idx, poll_table_t *pt)
 {
-  i32 idx = fd_to_oft(fd);
-  if(idx < 0)
+  if(idx < 0 || idx >= oft_size() || !OFT(idx).in_use)
     return -EBADF;
-  if(oft[idx].kind == VFS_KIND_PIPE_WR)
-    return -EBADF;
-  if(oft[idx].kind == VFS_KIND_PIPE_RD)
-    return pipe_poll_read_ready(oft[idx].pipe) ? 1 : 0;
-  return 1;
+
+  vfs_oft_entry_t *e = &OFT(idx);
+  if(e->kind == VFS_KIND_PIPE_RD || e->kind == VFS_KIND_PIPE_WR)
+    return (i32)pipe_poll(e->obj, e->kind, pt);
+  if(e->kind == VFS_KIND_EPOLL)
+    return (i32)epoll_poll(e->obj, pt);
+  if(e->kind == VFS_KIND_EVENTFD)
+    return (i32)eventfd_poll(e->obj, pt);
+  if(e->kind == VFS_KIND_TIMERFD)
+    return (i32)timerfd_poll(e->obj, pt);
+  if(e->kind == VFS_KIND_SOCKET)
+    return (i32)sock_poll(e->obj, pt);
+  return VFS_POLL_IN | VFS_POLL_OUT;
 }
 
-/** @brief Return positive if @p fd can accept a write without blocking, 0 if
- * not ready. */
-i32 vfs_select_write_ready(i64 fd)
+i32 vfs_poll(i64 fd, poll_table_t *pt)
 {
   i32 idx = fd_to_oft(fd);
-  if(idx < 0)
-    return -EBADF;
-  if(oft[idx].kind == VFS_KIND_PIPE_RD)
-    return -EBADF;
-  if(oft[idx].kind == VFS_KIND_PIPE_WR)
-    return pipe_poll_write_ready(oft[idx].pipe) ? 1 : 0;
-  return 1;
+  return idx < 0 ? -EBADF : vfs_oft_poll(idx, pt);
+}
+
+void vfs_readahead(i64 fd, u64 offset, u64 count)
+{
+  i32 idx = fd_to_oft(fd);
+  if(idx < 0 || !count)
+    return;
+  vfs_oft_entry_t *e = &OFT(idx);
+  if(e->kind == VFS_KIND_FILE && e->type == VFS_FILE && e->ops->readahead)
+    e->ops->readahead(e->handle, offset, count);
 }
 
 /** @brief Return @c true if @p fd refers to either end of a pipe. */
@@ -791,7 +1557,7 @@ bool vfs_fd_is_pipe(u64 fd)
   i32 idx = fd_to_oft((i64)fd);
   if(idx < 0)
     return false;
-  return oft[idx].kind == VFS_KIND_PIPE_RD || oft[idx].kind == VFS_KIND_PIPE_WR;
+  return OFT(idx).kind == VFS_KIND_PIPE_RD || OFT(idx).kind == VFS_KIND_PIPE_WR;
 }
 
 /** @brief Return @c true if @p fd is currently open in the calling process. */
@@ -800,56 +1566,105 @@ bool vfs_fd_is_valid(i64 fd)
   return fd_to_oft(fd) >= 0;
 }
 
-/** @brief Allocate an OFT entry for one end of a pipe and set its kind. */
-i32 vfs_oft_alloc_pipe(i32 kind, void *pipe)
+/** @brief Allocate an OFT entry for a pipe end or other kernel object. */
+i32 vfs_oft_alloc_obj(i32 kind, void *obj)
 {
   i32 idx = oft_alloc();
   if(idx < 0)
     return idx;
-  oft[idx].kind = kind;
-  oft[idx].pipe = pipe;
+  OFT(idx).kind = kind;
+  OFT(idx).obj  = obj;
   return idx;
 }
 
-/** @brief Initialise @p fds to the "all closed" state (-1 in every slot). */
-void vfs_proc_init_fds(i32 *fds)
+/** @brief Initialise @p p's fd table to the "all closed" state. */
+void vfs_proc_init_fds(proc_t *p)
 {
   for(int i = 0; i < VFS_MAX_FD; i++)
-    fds[i] = -1;
+    p->fds[i] = -1;
+  kzero(p->fd_open, sizeof(p->fd_open));
+  p->cwd_oft = -1;
 }
 
 /**
  * @brief Copy the parent's fd table into the child's after @c fork.
  *
- * Retains every open OFT entry so parent and child hold independent
- * references to the same descriptions.
+ * Retains every open OFT entry, and the cwd handle, so parent and child hold
+ * independent references to the same descriptions.
  */
-void vfs_proc_inherit_fds(
-    i32 *child_fds, u8 *child_clox, const i32 *parent_fds, const u8 *parent_clox
-)
+void vfs_proc_inherit_fds(proc_t *child, const proc_t *parent)
 {
   for(int i = 0; i < VFS_MAX_FD; i++) {
-    child_fds[i]  = parent_fds[i];
-    child_clox[i] = parent_clox[i];
-    if(child_fds[i] >= 0)
-      vfs_oft_retain(child_fds[i]);
+    child->fds[i]        = parent->fds[i];
+    child->fd_cloexec[i] = parent->fd_cloexec[i];
+    if(child->fds[i] >= 0)
+      vfs_oft_retain(child->fds[i]);
   }
+  kmemcpy(child->fd_open, parent->fd_open, sizeof(child->fd_open));
+  child->cwd_oft = parent->cwd_oft;
+  vfs_oft_retain(child->cwd_oft);
 }
 
 /**
  * @brief Release all file descriptors held by an exiting process.
  *
- * Calls ::vfs_oft_release for every open slot and sets each entry to -1.
- * OFT entries are destroyed only when their refcount reaches zero.
+ * Calls ::vfs_oft_release for every open slot and sets each entry to -1,
+ * then drops the cwd handle.  OFT entries are destroyed only when their
+ * refcount reaches zero.
  */
-void vfs_proc_release_fds(i32 *fds)
+void vfs_proc_release_fds(proc_t *p)
 {
   for(int i = 0; i < VFS_MAX_FD; i++) {
-    if(fds[i] >= 0) {
-      vfs_oft_release(fds[i]);
-      fds[i] = -1;
+    if(p->fds[i] >= 0) {
+      vfs_oft_release(p->fds[i]);
+      p->fds[i] = -1;
     }
   }
+  kzero(p->fd_open, sizeof(p->fd_open));
+  vfs_oft_release(p->cwd_oft);
+  p->cwd_oft = -1;
+}
+
+/* Close every fd of @p p that has FD_CLOEXEC set. */
+static void close_cloexec_fds(proc_t *p)
+{
+  for(int i = 0; i < VFS_MAX_FD; i++) {
+    if(p->fd_cloexec[i] && p->fds[i] >= 0) {
+      vfs_oft_release(p->fds[i]);
+      fd_set(p, i, -1);
+      p->fd_cloexec[i] = 0;
+    }
+  }
+}
+
+i64 vfs_proc_spawn_fds(proc_t *p, const vfs_fd_action_t *acts, u32 n)
+{
+  for(u32 i = 0; i < n; i++) {
+    i32 fd     = acts[i].fd;
+    i32 target = acts[i].target;
+    if(fd < 0 || fd >= VFS_MAX_FD || target >= VFS_MAX_FD)
+      return -EBADF;
+    if(target < 0) {
+      if(p->fds[fd] >= 0) {
+        vfs_oft_release(p->fds[fd]);
+        fd_set(p, fd, -1);
+        p->fd_cloexec[fd] = 0;
+      }
+      continue;
+    }
+    i32 idx = p->fds[fd];
+    if(idx < 0)
+      return -EBADF;
+    if(target != fd) {
+      vfs_oft_retain(idx);
+      if(p->fds[target] >= 0)
+        vfs_oft_release(p->fds[target]);
+      fd_set(p, target, idx);
+    }
+    p->fd_cloexec[target] = 0;
+  }
+  close_cloexec_fds(p);
+  return 0;
 }
 
 /**
@@ -861,13 +1676,6 @@ void vfs_proc_release_fds(i32 *fds)
 void vfs_proc_close_cloexec_fds(void)
 {
   proc_t *p = proc_current();
-  if(!p)
-    return;
-  for(int i = 0; i < VFS_MAX_FD; i++) {
-    if(p->fd_cloexec[i] && p->fds[i] >= 0) {
-      vfs_oft_release(p->fds[i]);
-      p->fds[i]        = -1;
-      p->fd_cloexec[i] = 0;
-    }
-  }
+  if(p)
+    close_cloexec_fds(p);
 }
@@ -0,0 +1,290 @@
+/**
+ * @file src/kernel/bench.c
+ * @brief Boot-time micro-benchmarks (see alcor2/bench.h).
+ *
+ * Allocator benchmarks take a batch of objects and then give the batch
+ * back, timing each half, after one untimed round that fills caches and
+ * page tables. The clock is read once per batch or loop, never per
+ * operation, so its own cost stays out of the numbers.
+ *
+ * There are no processes yet, so the context switch is the bare
+ * ::context_switch between two kernel stacks plus the CR3 reload
+ * proc_switch() does, and the null syscall goes through syscall_dispatch()
+ * without the SYSCALL/SYSRET transition.
+ */
+
+#include <alcor2/bench.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/drivers/fb_console.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/memory_layout.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/sys/syscall.h>
+#include <alcor2/time.h>
+
+/** @brief Objects taken per allocator round. */
+#define BENCH_BATCH 256
+
+/** @brief Timed allocator rounds. */
+#define BENCH_ROUNDS 64
+
+/** @brief Iterations of the loop benchmarks. */
+#define BENCH_ITERS 100000
+
+/** @brief Bytes each kmemcpy size copies in total. */
+#define BENCH_COPY_BYTES (16ULL << 20)
+
+/** @brief Largest kmemcpy size. */
+#define BENCH_COPY_MAX (64ULL * 1024)
+
+/** @brief Column the results start in. */
+#define BENCH_NAME_W 24
+
+/** @brief Pages for vmm_map(): just past the MMIO window, unused. */
+#define BENCH_SCRATCH KERNEL_MMIO_END
+
+extern void context_switch(u64 *old_rsp, u64 new_rsp);
+
+static void *batch[BENCH_BATCH];
+
+static u64 main_rsp;
+static u64 peer_rsp;
+static u64 peer_cr3;
+
+/* Copy @p s to @p p, terminated; returns the end. */
+static char *put_str(char *p, const char *s)
+{
+  while(*s)
+    *p++ = *s++;
+  *p = '\0';
+  return p;
+}
+
+/* Write @p v in decimal at @p p; returns the end. */
+static char *put_u64(char *p, u64 v)
+{
+  char tmp[20];
+  int  n = 0;
+  do {
+    tmp[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while(v);
+  while(n)
+    *p++ = tmp[--n];
+  return p;
+}
+
+/* One result line: "@p name(@p size)" (no size if 0) and ns per op. */
+static void report(const char *name, u64 size, u64 ns, u64 ops)
+{
+  char  line[96];
+  char *p   = put_str(line, "[BENCH] ");
+  char *col = p + BENCH_NAME_W;
+  p         = put_str(p, name);
+  if(size) {
+    *p++ = '(';
+    p    = put_u64(p, size);
+    *p++ = ')';
+  }
+  do
+    *p++ = ' ';
+  while(p < col);
+
+  if(!ops) {
+    put_str(p, "failed\n");
+  } else {
+    u64 centi = ns * 100 / ops;
+    p         = put_u64(p, centi / 100);
+    *p++      = '.';
+    *p++      = (char)('0' + centi / 10 % 10);
+    *p++      = (char)('0' + centi % 10);
+    put_str(p, " ns/op\n");
+  }
+  console_print(line);
+}
+
+static void bench_pmm(void)
+{
+  u64 t_alloc = 0, t_free = 0, ops = 0;
+  for(int r = 0; r <= BENCH_ROUNDS; r++) {
+    u64 t0 = time_monotonic_ns();
+    int n  = 0;
+    while(n < BENCH_BATCH && (batch[n] = pmm_alloc()))
+      n++;
+    u64 t1 = time_monotonic_ns();
+    for(int i = 0; i < n; i++)
+      pmm_free(batch[i]);
+    u64 t2 = time_monotonic_ns();
+    if(n < BENCH_BATCH) {
+      report("pmm_alloc", 0, 0, 0);
+      return;
+    }
+    if(r) {
+      t_alloc += t1 - t0;
+      t_free  += t2 - t1;
+      ops     += (u64)n;
+    }
+  }
+  report("pmm_alloc", 0, t_alloc, ops);
+  report("pmm_free", 0, t_free, ops);
+}
+
+static void bench_kmalloc(u64 size)
+{
+  u64 t_alloc = 0, t_free = 0, ops = 0;
+  for(int r = 0; r <= BENCH_ROUNDS; r++) {
+    u64 t0 = time_monotonic_ns();
+    int n  = 0;
+    while(n < BENCH_BATCH && (batch[n] = kmalloc(size)))
+      n++;
+    u64 t1 = time_monotonic_ns();
+    for(int i = 0; i < n; i++)
+      kfree(batch[i]);
+    u64 t2 = time_monotonic_ns();
+    if(n < BENCH_BATCH) {
+      report("kmalloc", size, 0, 0);
+      return;
+    }
+    if(r) {
+      t_alloc += t1 - t0;
+      t_free  += t2 - t1;
+      ops     += (u64)n;
+    }
+  }
+  report("kmalloc", size, t_alloc, ops);
+  report("kfree", size, t_free, ops);
+}
+
+static void bench_vmm(void)
+{
+  void *frame = pmm_alloc();
+  if(!frame) {
+    report("vmm_map", 0, 0, 0);
+    return;
+  }
+
+  u64 t_map = 0, t_unmap = 0, ops = 0;
+  for(int r = 0; r <= BENCH_ROUNDS; r++) {
+    u64 t0 = time_monotonic_ns();
+    for(u64 i = 0; i < BENCH_BATCH; i++)
+      vmm_map(BENCH_SCRATCH + i * PAGE_SIZE, (u64)frame, VMM_WRITE | VMM_NX);
+    u64 t1 = time_monotonic_ns();
+    for(u64 i = 0; i < BENCH_BATCH; i++)
+      vmm_unmap(BENCH_SCRATCH + i * PAGE_SIZE);
+    u64 t2 = time_monotonic_ns();
+    if(r) {
+      t_map   += t1 - t0;
+      t_unmap += t2 - t1;
+      ops     += BENCH_BATCH;
+    }
+  }
+  pmm_free(frame);
+  report("vmm_map", 0, t_map, ops);
+  report("vmm_unmap", 0, t_unmap, ops);
+}
+
+static void bench_kmemcpy(void)
+{
+  static const u64 sizes[] = {64, 512, 4096, BENCH_COPY_MAX};
+
+  u8 *src = kmalloc(BENCH_COPY_MAX);
+  u8 *dst = kmalloc(BENCH_COPY_MAX);
+  if(!src || !dst) {
+    kfree(src);
+    kfree(dst);
+    report("kmemcpy", 0, 0, 0);
+    return;
+  }
+  kmemset(src, 0x5A, BENCH_COPY_MAX);
+  kmemcpy(dst, src, BENCH_COPY_MAX);
+
+  for(u64 s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    u64 iters = BENCH_COPY_BYTES / sizes[s];
+    u64 t0    = time_monotonic_ns();
+    for(u64 i = 0; i < iters; i++)
+      kmemcpy(dst, src, sizes[s]);
+    report("kmemcpy", sizes[s], time_monotonic_ns() - t0, iters);
+  }
+  kfree(src);
+  kfree(dst);
+}
+
+/* The other side of the switch benchmark: bounce straight back, forever. */
+static void peer_loop(void)
+{
+  for(;;) {
+    vmm_switch(peer_cr3);
+    context_switch(&peer_rsp, main_rsp);
+  }
+}
+
+static void bench_switch(void)
+{
+  u8 *stack = kmalloc(PROC_KERNEL_STACK);
+  if(!stack) {
+    report("context switch", 0, 0, 0);
+    return;
+  }
+
+  /* The frame context_switch pops: six registers, then peer_loop, which
+   * sees a fake return address like any called function. */
+  u64 *sp = (u64 *)((u64)(stack + PROC_KERNEL_STACK) & ~0xFULL);
+  *--sp   = 0;
+  *--sp   = (u64)peer_loop;
+  for(int i = 0; i < 6; i++)
+    *--sp = 0;
+  peer_rsp = (u64)sp;
+  peer_cr3 = vmm_get_current_pml4();
+
+  context_switch(&main_rsp, peer_rsp);
+  u64 t0 = time_monotonic_ns();
+  for(u64 i = 0; i < BENCH_ITERS; i++) {
+    vmm_switch(peer_cr3);
+    context_switch(&main_rsp, peer_rsp);
+  }
+  report("context switch", 0, time_monotonic_ns() - t0, BENCH_ITERS);
+  kfree(stack);
+}
+
+/* Exhaustive, so its time is per blend plus the reference formula. */
+static void bench_blend(void)
+{
+  u64 t0 = time_monotonic_ns();
+  u64 n  = fb_console_blend_check();
+  report("glyph blend (exact)", 0, time_monotonic_ns() - t0, n);
+}
+
+static void bench_syscall(void)
+{
+  syscall_frame_t frame;
+  kmemset(&frame, 0, sizeof(frame));
+  frame.rax = SYS_GETPID;
+
+  u64 t0 = time_monotonic_ns();
+  for(u64 i = 0; i < BENCH_ITERS; i++)
+    syscall_dispatch(&frame);
+  report("null syscall", 0, time_monotonic_ns() - t0, BENCH_ITERS);
+}
+
+void bench_run(void)
+{
+  char  line[64];
+  char *p = put_str(line, "[BENCH] clock resolution ");
+  p       = put_u64(p, time_resolution_ns());
+  put_str(p, " ns\n");
+  console_print(line);
+
+  bench_pmm();
+  static const u64 sizes[] = {16, 64, 256, 1024, 2048, 4096, 16384};
+  for(u64 i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    bench_kmalloc(sizes[i]);
+  bench_vmm();
+  bench_kmemcpy();
+  bench_switch();
+  bench_syscall();
+  bench_blend();
+  console_print("[BENCH] done\n");
+}
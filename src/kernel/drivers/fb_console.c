@@ -7,26 +7,91 @@
  * bitmap (used at boot and as fallback) or a userspace-supplied glyph atlas
  * registered through @c fb_console_set_atlas. The atlas also reflows the cell
  * grid to its own pixel dimensions and adds a 20 px margin around it.
+ *
+ * Glyphs are rendered into a cacheable RAM shadow of the screen in the
+ * framebuffer's own pixel format. Each write records the pixel span it
+ * changed on every row and copies just those spans to the write-combined
+ * VRAM when it finishes, so VRAM only ever sees sequential writes and is
+ * never read back (scrolling moves pixels within the shadow).
+ *
+ * Atlas glyphs are alpha-blended over their cell's colors once per
+ * (glyph, fg, bg, attr) and kept in a small LRU cache of composited cells,
+ * so redrawing a TUI screen is mostly row copies.
+ *
+ * Output is painted lazily: a write only updates the cell grid, marking
+ * cells whose contents changed, and the dirty cells are drawn once when
+ * it ends. Intermediate states within a write are never rendered, and a
+ * synchronized update (DECSET 2026) extends that across writes.
+ *
+ * The cell grid lives in whole pages that a full-screen program can map
+ * (FB_CONSOLE_MAP_GRID) to write cells directly, bypassing the escape
+ * parser, and then paint with FB_CONSOLE_PRESENT.
+ *
+ * Rows that scroll off the top of the screen are kept in a scrollback
+ * ring, each encoded as runs of identical attributes and a byte per
+ * codepoint (four only in rows that need them), which Shift-PgUp/PgDn
+ * page through. Pushing a row costs about as much as the memmove that
+ * scrolls it, and the scrolled-back view is painted only when it moves.
  */
 
 #include "../../drivers/console/font.h"
 #include <alcor2/drivers/fb_console.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/signal.h>
 #include <alcor2/types.h>
 
+typedef fb_console_cell_t fb_cell_t;
+
+#define INPUT_RING 256
+
+/** Ticks a synchronized update (DECSET 2026) may hold back painting. */
+#define FB_SYNC_TIMEOUT 20
+
+/** Composited atlas cells cached at most, and the memory they may take. */
+#define GLYPH_CACHE_MAX   256
+#define GLYPH_CACHE_BYTES (1024u * 1024u)
+/** Power of two, at least twice GLYPH_CACHE_MAX. */
+#define GLYPH_HASH_SIZE   512
+#define GLYPH_NIL         (-1)
+
+/** Scrollback rows kept at most, and the bytes their records may take. */
+#define SB_ROWS  4096
+#define SB_BYTES (512u * 1024u)
+
+/** One atlas glyph composited over a (fg, bg) pair in native pixels. */
 typedef struct
 {
-  u32 cp;   /**< Unicode codepoint at this cell. */
-  u32 fg;   /**< RGB foreground. */
-  u32 bg;   /**< RGB background. */
-  u16 attr; /**< SGR attribute bits (reserved). */
-  u16 _pad;
-} fb_cell_t;
+  u32 idx; /**< Atlas glyph index, ATLAS_NO_GLYPH = unused slot. */
+  u32 fg;
+  u32 bg;
+  u16 attr;
+  i16 hnext; /**< Hash chain, GLYPH_NIL terminated. */
+  i16 prev;  /**< LRU list, head = most recently used. */
+  i16 next;
+} glyph_slot_t;
+
+/* A scrollback row: this header, its attribute runs (sb_run_t), then a
+ * codepoint per cell, a byte each or a u32 each when wide. Trailing blank
+ * cells are not stored. Records are padded to 4 bytes. */
+typedef struct
+{
+  u16 cells;
+  u16 runs;
+  u8  wide;
+  u8  pad[3];
+} sb_row_t;
 
-#define INPUT_RING 256
+/* n consecutive cells sharing colors and attributes. */
+typedef struct
+{
+  u16 n;
+  u16 attr;
+  u32 fg;
+  u32 bg;
+} sb_run_t;
 
 static struct
 {
@@ -35,10 +100,25 @@ static struct
   u64          width, height, pitch;
   u8           bytes_pp;
 
-  /* Cell grid (kmalloc'd at init). */
+  /* Drawing goes to a RAM shadow of the screen in the framebuffer's pixel
+   * format (draw == shadow); flush() copies the spans it dirtied to VRAM.
+   * Without memory for one, draw points straight at VRAM. */
+  u8  *shadow;
+  u8  *draw;
+  u64  draw_pitch;
+  u32 *dirty_x0, *dirty_x1; /* per pixel row: dirty [x0, x1) */
+  u32  dirty_y0, dirty_y1;  /* rows that may have a dirty span */
+
+  /* Cell grid: grid_pages pages at grid_phys, allocated once at init so a
+   * mapping of it stays valid; a reflow reuses them if the grid fits. */
   fb_cell_t *cells;
+  u64        grid_phys;
+  u64        grid_pages;
+  size_t     grid_cap; /* in cells */
   int        rows, cols; /* in cells */
   int        cx, cy;     /* cursor in cell coords */
+  int        scroll_top; /* scroll region (DECSTBM): rows [top, bot] */
+  int        scroll_bot;
 
   /* Cell pixel dimensions. Defaults to the compiled-in CP437 bitmap size;
    * an atlas submission can replace them with its own cell_w / cell_h. */
@@ -83,6 +163,25 @@ static struct
   /* fb yielded to a userspace mmap-er (e.g. doom). */
   bool yielded;
 
+  /* Deferred painting: writes only update cells and mark them dirty;
+   * repaint() draws them once the write (or synchronized update) ends.
+   * Consecutive scrolls of one region in one direction are counted and
+   * applied to the pixels in one shift. */
+  bool paint_pending;
+  int  scroll_pending;     /* rows: > 0 up, < 0 down */
+  int  pend_top, pend_bot; /* region scroll_pending moves */
+  bool sync_update;        /* DECSET 2026 in effect */
+  u8   sync_ticks;         /* until the update is painted regardless */
+
+  /* Scrollback: sb_row_t records in a byte ring, indexed oldest first by
+   * a ring of their offsets. sb_view is how many rows the screen is
+   * scrolled back; while it is not 0 output updates the grid unseen. */
+  u8  *sb_bytes;
+  u32 *sb_off;
+  u32  sb_first, sb_count;
+  u32  sb_write; /* byte offset of the next record */
+  int  sb_view;
+
   /* Input ring (keyboard → reader). */
   u8           in_buf[INPUT_RING];
   unsigned int in_head, in_tail;
@@ -97,6 +196,20 @@ static struct
   u32  atlas_n_glyphs;
   u32  atlas_n_cp;
   u32  atlas_fallback;
+
+  /* Cache of composited atlas cells (see gcache_get()). */
+  glyph_slot_t *gc_slot;
+  u8           *gc_pixels; /* gc_n cells of atlas_cell_h rows each */
+  u32           gc_n;
+  u32           gc_row_bytes;
+  i16           gc_hash[GLYPH_HASH_SIZE];
+  i16           gc_head, gc_tail;
+
+  /* Bitmap rows: fg / bg patterns of the last colour pair drawn. */
+  bool pat_valid;
+  u32  pat_fg, pat_bg;
+  u64  fg_pat[FONT_ROW_WORDS_MAX];
+  u64  bg_pat[FONT_ROW_WORDS_MAX];
 } ctx;
 
 #define ATLAS_NO_GLYPH 0xFFFFFFFFu
@@ -122,34 +235,107 @@ static u8 bytes_pp_from_bpp(u16 bpp)
   }
 }
 
-static void fb_put_pixel(u32 x, u32 y, u32 color)
+/** Pack an RGB color into the framebuffer's pixel format. */
+static u32 native_color(u32 color)
 {
-  if(x >= ctx.width || y >= ctx.height)
-    return;
-  volatile u8 *p = ctx.base + (u64)y * ctx.pitch + (u64)x * ctx.bytes_pp;
   switch(ctx.bytes_pp) {
   case 4:
-    *(volatile u32 *)p = color | 0xFF000000u;
+    return color | 0xFF000000u;
+  case 2: {
+    u32 r = (color >> 16) & 0xffu;
+    u32 g = (color >> 8) & 0xffu;
+    u32 b = color & 0xffu;
+    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+  }
+  default:
+    return color;
+  }
+}
+
+/** Store a native_color() value at @p p in the draw buffer. */
+static inline void store_pixel(u8 *p, u32 native)
+{
+  switch(ctx.bytes_pp) {
+  case 4:
+    *(u32 *)p = native;
     return;
   case 3:
-    p[0] = (u8)(color & 0xffu);
-    p[1] = (u8)((color >> 8) & 0xffu);
-    p[2] = (u8)((color >> 16) & 0xffu);
+    p[0] = (u8)(native & 0xffu);
+    p[1] = (u8)((native >> 8) & 0xffu);
+    p[2] = (u8)((native >> 16) & 0xffu);
     return;
-  case 2: {
-    u32 r      = (color >> 16) & 0xffu;
-    u32 g      = (color >> 8) & 0xffu;
-    u32 b      = color & 0xffu;
-    u16 rgb565 = (u16)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
-    p[0]       = (u8)(rgb565 & 0xffu);
-    p[1]       = (u8)(rgb565 >> 8);
+  case 2:
+    *(u16 *)p = (u16)native;
     return;
-  }
   default:
     return;
   }
 }
 
+static inline u8 *pixel_at(u32 x, u32 y)
+{
+  return ctx.draw + (u64)y * ctx.draw_pitch + (u64)x * ctx.bytes_pp;
+}
+
+/** Record that pixels [x, x + w) of rows [y, y + h) differ from VRAM. */
+static void mark_dirty(u32 x, u32 y, u32 w, u32 h)
+{
+  if(!ctx.shadow || w == 0 || h == 0)
+    return;
+  u32 x1 = x + w;
+  if(y < ctx.dirty_y0)
+    ctx.dirty_y0 = y;
+  if(y + h > ctx.dirty_y1)
+    ctx.dirty_y1 = y + h;
+  for(u32 r = y; r < y + h; r++) {
+    if(x < ctx.dirty_x0[r])
+      ctx.dirty_x0[r] = x;
+    if(x1 > ctx.dirty_x1[r])
+      ctx.dirty_x1[r] = x1;
+  }
+}
+
+/** Copy the dirty span of every dirty row from the shadow to VRAM. */
+static void flush(void)
+{
+  if(!ctx.shadow)
+    return;
+  for(u32 y = ctx.dirty_y0; y < ctx.dirty_y1; y++) {
+    u32 x0 = ctx.dirty_x0[y];
+    u32 x1 = ctx.dirty_x1[y];
+    if(x0 >= x1)
+      continue;
+    u64 off = (u64)x0 * ctx.bytes_pp;
+    kmemcpy(
+        (u8 *)ctx.base + (u64)y * ctx.pitch + off,
+        ctx.shadow + (u64)y * ctx.draw_pitch + off,
+        (u64)(x1 - x0) * ctx.bytes_pp
+    );
+    ctx.dirty_x0[y] = (u32)ctx.width;
+    ctx.dirty_x1[y] = 0;
+  }
+  ctx.dirty_y0 = (u32)ctx.height;
+  ctx.dirty_y1 = 0;
+}
+
+/** Fill a rectangle (clipped to the screen) with an RGB color. */
+static void fill_rect(u32 x, u32 y, u32 w, u32 h, u32 color)
+{
+  if(x >= ctx.width || y >= ctx.height)
+    return;
+  if(w > ctx.width - x)
+    w = (u32)ctx.width - x;
+  if(h > ctx.height - y)
+    h = (u32)ctx.height - y;
+  u32 native = native_color(color);
+  for(u32 r = 0; r < h; r++) {
+    u8 *p = pixel_at(x, y + r);
+    for(u32 i = 0; i < w; i++, p += ctx.bytes_pp)
+      store_pixel(p, native);
+  }
+  mark_dirty(x, y, w, h);
+}
+
 /** Resolve a codepoint to an atlas glyph index, or ATLAS_NO_GLYPH if absent. */
 static u32 atlas_lookup(u32 cp)
 {
@@ -163,57 +349,255 @@ static u32 atlas_lookup(u32 cp)
   return ctx.atlas_fallback;
 }
 
-/** Blit one cell either from the atlas (Fira) or the compiled-in CP437 bitmap.
- *  Atlas is preferred when active and the codepoint is mapped. */
-static void blit_cell(int col, int row)
+/* Blending works on the three channels at once, one per 16-bit lane of a
+ * u64 (blue in bits 0-15, green 16-31, red 32-47): fg * a + bg * (255 - a)
+ * stays below 65536 per lane. The kernel has no SSE, so this is the widest
+ * integer lane split the 64-bit registers give. */
+#define BLEND_LANES 0x000000FF00FF00FFull
+/* Per lane: +128 rounds, +1 makes the shift-add below divide exactly. */
+#define BLEND_BIAS  0x0000008100810081ull
+
+static inline u64 blend_spread(u32 rgb)
+{
+  return (u64)(rgb & 0xffu) | ((u64)(rgb & 0xff00u) << 8) |
+         ((u64)(rgb & 0xff0000u) << 16);
+}
+
+/** (fg * a + bg * (255 - a) + 128) / 255 per channel, bit-exact. */
+static inline u32 blend_lanes(u64 fg, u64 bg, u32 a)
+{
+  u64 t = fg * a + bg * (255u - a) + BLEND_BIAS;
+  /* x / 255 == (x + 1 + (x >> 8)) >> 8 for every x that can occur here. */
+  t = ((t + ((t >> 8) & BLEND_LANES)) >> 8) & BLEND_LANES;
+  return (u32)(t & 0xffu) | (u32)((t >> 8) & 0xff00u) |
+         (u32)((t >> 16) & 0xff0000u);
+}
+
+/* The per-channel formula blend_lanes() replaced, kept as its reference. */
+static u32 blend_ref(u32 fg, u32 bg, u32 a)
+{
+  u32 rgb = 0;
+  for(u32 s = 0; s < 24; s += 8) {
+    u32 f = (fg >> s) & 0xffu, b = (bg >> s) & 0xffu;
+    rgb |= ((f * a + b * (255u - a) + 128u) / 255u) << s;
+  }
+  return rgb;
+}
+
+u64 fb_console_blend_check(void)
+{
+  u64 n = 0;
+  for(u32 f = 0; f < 256; f++) {
+    /* Each channel sees every byte, and the three differ, so a carry
+     * from one lane into the next would show. */
+    u32 fg  = f << 16 | (255u - f) << 8 | (f ^ 0xA5u);
+    u64 fgl = blend_spread(fg);
+    for(u32 b = 0; b < 256; b++) {
+      u32 bg  = b << 16 | (b ^ 0x3Cu) << 8 | (255u - b);
+      u64 bgl = blend_spread(bg);
+      for(u32 a = 0; a < 256; a++, n++)
+        if(blend_lanes(fgl, bgl, a) != blend_ref(fg, bg, a))
+          return 0;
+    }
+  }
+  return n;
+}
+
+/** Alpha-blend atlas glyph @p idx over @p c's colors into @p dst, a
+ *  @p w x @p h native-format block with rows @p pitch bytes apart. */
+static void
+    compose_glyph(u8 *dst, u64 pitch, u32 idx, const fb_cell_t *c, u32 w, u32 h)
+{
+  /* Source pixels: atlas_pixels + idx * cell_h * stride. The atlas's
+   * cell_w/cell_h are the cell pixel dimensions; the kernel adopts them
+   * verbatim at submission time so this loop covers the whole cell. */
+  const u8 *glyph = ctx.atlas_pixels + (size_t)idx * (size_t)ctx.atlas_cell_h *
+                                           (size_t)ctx.atlas_stride;
+  u32 atlas_bypp = (ctx.atlas_bpp + 7u) / 8u;
+  /* Atlas convention: alpha-style grayscale in red channel — userspace
+   * rasterises a single-channel coverage mask and packs it into bpp; the
+   * alpha channel when 32bpp. */
+  u32 a_off = atlas_bypp == 4u ? 3u : 0u;
+  u64 fg    = blend_spread(c->fg);
+  u64 bg    = blend_spread(c->bg);
+  u32 fg_px = native_color(c->fg);
+  u32 bg_px = native_color(c->bg);
+  for(u32 gy = 0; gy < h; gy++, dst += pitch) {
+    const u8 *src = glyph + (size_t)gy * (size_t)ctx.atlas_stride + a_off;
+    u8       *out = dst;
+    for(u32 gx = 0; gx < w; gx++, out += ctx.bytes_pp, src += atlas_bypp) {
+      u32 a = atlas_bypp ? (u32)*src : 0u;
+      /* Most of a glyph is fully transparent or fully opaque. */
+      if(a == 0u)
+        store_pixel(out, bg_px);
+      else if(a == 255u)
+        store_pixel(out, fg_px);
+      else
+        store_pixel(out, native_color(blend_lanes(fg, bg, a)));
+    }
+  }
+}
+
+static void gcache_unlink(i16 i)
+{
+  glyph_slot_t *s = &ctx.gc_slot[i];
+  if(s->prev != GLYPH_NIL)
+    ctx.gc_slot[s->prev].next = s->next;
+  else
+    ctx.gc_head = s->next;
+  if(s->next != GLYPH_NIL)
+    ctx.gc_slot[s->next].prev = s->prev;
+  else
+    ctx.gc_tail = s->prev;
+}
+
+static void gcache_push_head(i16 i)
 {
-  const fb_cell_t *c = &ctx.cells[(size_t)row * (size_t)ctx.cols + (size_t)col];
-  u32              px_x = (u32)ctx.margin_x + (u32)col * (u32)ctx.cell_w;
-  u32              px_y = (u32)ctx.margin_y + (u32)row * (u32)ctx.cell_h;
+  glyph_slot_t *s = &ctx.gc_slot[i];
+  s->prev         = GLYPH_NIL;
+  s->next         = ctx.gc_head;
+  if(ctx.gc_head != GLYPH_NIL)
+    ctx.gc_slot[ctx.gc_head].prev = i;
+  ctx.gc_head = i;
+  if(ctx.gc_tail == GLYPH_NIL)
+    ctx.gc_tail = i;
+}
+
+static u32 gcache_hash(u32 idx, u32 fg, u32 bg, u16 attr)
+{
+  u32 h = idx * 0x9E3779B1u ^ fg * 0x85EBCA77u ^ bg * 0xC2B2AE3Du ^ attr;
+  return (h ^ (h >> 15)) & (GLYPH_HASH_SIZE - 1);
+}
+
+/** Drop the glyph cache (the atlas or its cell size changed). */
+static void gcache_free(void)
+{
+  if(ctx.gc_slot)
+    kfree(ctx.gc_slot);
+  if(ctx.gc_pixels)
+    kfree(ctx.gc_pixels);
+  ctx.gc_slot   = NULL;
+  ctx.gc_pixels = NULL;
+  ctx.gc_n      = 0;
+}
+
+/** Size the glyph cache for the current atlas; left off without memory. */
+static void gcache_init(void)
+{
+  gcache_free();
+  ctx.gc_row_bytes = ctx.atlas_cell_w * ctx.bytes_pp;
+  u32 cell_bytes   = ctx.gc_row_bytes * ctx.atlas_cell_h;
+  u32 n            = GLYPH_CACHE_BYTES / cell_bytes;
+  if(n > GLYPH_CACHE_MAX)
+    n = GLYPH_CACHE_MAX;
+  if(n == 0)
+    return;
+
+  ctx.gc_slot   = (glyph_slot_t *)kmalloc(n * sizeof(glyph_slot_t));
+  ctx.gc_pixels = (u8 *)kmalloc((u64)n * cell_bytes);
+  if(!ctx.gc_slot || !ctx.gc_pixels) {
+    gcache_free();
+    return;
+  }
+  ctx.gc_n    = n;
+  ctx.gc_head = ctx.gc_tail = GLYPH_NIL;
+  for(u32 i = 0; i < GLYPH_HASH_SIZE; i++)
+    ctx.gc_hash[i] = GLYPH_NIL;
+  for(i16 i = 0; i < (i16)n; i++) {
+    ctx.gc_slot[i].idx   = ATLAS_NO_GLYPH;
+    ctx.gc_slot[i].hnext = GLYPH_NIL;
+    gcache_push_head(i);
+  }
+}
+
+/** Composited pixels of atlas glyph @p idx in @p c's colors, composing them
+ *  into the least recently used slot on a miss; NULL if there is no cache.
+ *  Rows are gc_row_bytes apart; the cell is atlas_cell_w x atlas_cell_h. */
+static const u8 *gcache_get(u32 idx, const fb_cell_t *c)
+{
+  if(!ctx.gc_slot)
+    return NULL;
+  u32  cell_bytes = ctx.gc_row_bytes * ctx.atlas_cell_h;
+  i16 *link       = &ctx.gc_hash[gcache_hash(idx, c->fg, c->bg, c->attr)];
+  for(i16 i = *link; i != GLYPH_NIL; i = ctx.gc_slot[i].hnext) {
+    const glyph_slot_t *s = &ctx.gc_slot[i];
+    if(s->idx == idx && s->fg == c->fg && s->bg == c->bg &&
+       s->attr == c->attr) {
+      gcache_unlink(i);
+      gcache_push_head(i);
+      return ctx.gc_pixels + (u64)i * cell_bytes;
+    }
+  }
+
+  i16           i = ctx.gc_tail;
+  glyph_slot_t *s = &ctx.gc_slot[i];
+  if(s->idx != ATLAS_NO_GLYPH) {
+    i16 *old = &ctx.gc_hash[gcache_hash(s->idx, s->fg, s->bg, s->attr)];
+    while(*old != i)
+      old = &ctx.gc_slot[*old].hnext;
+    *old = s->hnext;
+  }
+  s->idx   = idx;
+  s->fg    = c->fg;
+  s->bg    = c->bg;
+  s->attr  = c->attr;
+  s->hnext = *link;
+  *link    = i;
+  gcache_unlink(i);
+  gcache_push_head(i);
+
+  u8 *pixels = ctx.gc_pixels + (u64)i * cell_bytes;
+  compose_glyph(
+      pixels, ctx.gc_row_bytes, idx, c, ctx.atlas_cell_w, ctx.atlas_cell_h
+  );
+  return pixels;
+}
+
+/** Draw @p c at cell (col, row) either from the atlas (Fira) or the
+ *  compiled-in CP437 bitmap. Atlas is preferred when active and the
+ *  codepoint is mapped. */
+static void draw_cell(int col, int row, const fb_cell_t *c)
+{
+  u32 px_x = (u32)ctx.margin_x + (u32)col * (u32)ctx.cell_w;
+  u32 px_y = (u32)ctx.margin_y + (u32)row * (u32)ctx.cell_h;
+  if(px_x >= ctx.width || px_y >= ctx.height)
+    return;
+  u32 cell_w = (u32)ctx.cell_w;
+  u32 cell_h = (u32)ctx.cell_h;
+  if(cell_w > ctx.width - px_x)
+    cell_w = (u32)ctx.width - px_x;
+  if(cell_h > ctx.height - px_y)
+    cell_h = (u32)ctx.height - px_y;
 
   if(ctx.atlas_active) {
     u32 idx = atlas_lookup(c->cp);
     if(idx != ATLAS_NO_GLYPH && idx < ctx.atlas_n_glyphs) {
-      /* Source pixels: atlas_pixels + idx * cell_h * stride. The atlas's
-       * cell_w/cell_h are the cell pixel dimensions; the kernel adopts them
-       * verbatim at submission time so this loop covers the whole cell. */
-      const u8 *glyph = ctx.atlas_pixels + (size_t)idx *
-                                               (size_t)ctx.atlas_cell_h *
-                                               (size_t)ctx.atlas_stride;
-      u32 atlas_bypp = (ctx.atlas_bpp + 7u) / 8u;
-      for(u32 gy = 0; gy < ctx.atlas_cell_h && gy < (u32)ctx.cell_h; gy++) {
-        const u8 *row_src = glyph + (size_t)gy * (size_t)ctx.atlas_stride;
-        for(u32 gx = 0; gx < ctx.atlas_cell_w && gx < (u32)ctx.cell_w; gx++) {
-          const u8 *px = row_src + (size_t)gx * (size_t)atlas_bypp;
-          /* Atlas convention: alpha-style grayscale in red channel — userspace
-           * rasterises a single-channel coverage mask and packs it into bpp.
-           * Combine with the cell's fg/bg by 8-bit alpha blend. */
-          u32 a = (atlas_bypp >= 1u) ? (u32)px[0] : 0u;
-          if(atlas_bypp == 4u)
-            a = (u32)px[3]; /* alpha channel when 32bpp */
-          u32 inv = 255u - a;
-          u32 r   = ((((c->fg >> 16) & 0xffu) * a) +
-                   (((c->bg >> 16) & 0xffu) * inv) + 128u) /
-                  255u;
-          u32 g = ((((c->fg >> 8) & 0xffu) * a) +
-                   (((c->bg >> 8) & 0xffu) * inv) + 128u) /
-                  255u;
-          u32 b =
-              (((c->fg & 0xffu) * a) + ((c->bg & 0xffu) * inv) + 128u) / 255u;
-          fb_put_pixel(px_x + gx, px_y + gy, (r << 16) | (g << 8) | b);
-        }
+      u32 w = ctx.atlas_cell_w < cell_w ? ctx.atlas_cell_w : cell_w;
+      u32 h = ctx.atlas_cell_h < cell_h ? ctx.atlas_cell_h : cell_h;
+      const u8 *cached =
+          (w == ctx.atlas_cell_w && h == ctx.atlas_cell_h) ? gcache_get(idx, c)
+                                                           : NULL;
+      if(cached) {
+        for(u32 gy = 0; gy < h; gy++)
+          kmemcpy(
+              pixel_at(px_x, px_y + gy), cached + gy * ctx.gc_row_bytes,
+              ctx.gc_row_bytes
+          );
+      } else {
+        compose_glyph(pixel_at(px_x, px_y), ctx.draw_pitch, idx, c, w, h);
       }
-      /* Clear any trailing pixels (cell larger than atlas glyph). */
+      mark_dirty(px_x, px_y, w, h);
       return;
     }
   }
 
-  /* Bitmap fallback. Fill the full cell with bg first so a bigger
-   * (atlas-sized) cell does not leak old pixels around the 8×16 glyph; then
-   * centre the bitmap glyph inside it. */
-  for(int gy = 0; gy < ctx.cell_h; gy++)
-    for(int gx = 0; gx < ctx.cell_w; gx++)
-      fb_put_pixel(px_x + (u32)gx, px_y + (u32)gy, c->bg);
+  /* Bitmap fallback. A bigger (atlas-sized) cell is filled with bg first so
+   * it does not leak old pixels around the 8×16 glyph, which is centred
+   * inside it; the glyph's own rows cover it in full. */
+  if(cell_w != FONT_W || cell_h != FONT_H)
+    fill_rect(px_x, px_y, cell_w, cell_h, c->bg);
+  else
+    mark_dirty(px_x, px_y, cell_w, cell_h);
 
   u32 cp = c->cp;
   u8  glyph_idx;
@@ -228,60 +612,352 @@ static void blit_cell(int col, int row)
   if(gi < 0)
     return;
 
-  int       gx_off = (ctx.cell_w > FONT_W) ? (ctx.cell_w - FONT_W) / 2 : 0;
-  int       gy_off = (ctx.cell_h > FONT_H) ? (ctx.cell_h - FONT_H) / 2 : 0;
+  u32 gx_off = (cell_w > FONT_W) ? (cell_w - FONT_W) / 2 : 0;
+  u32 gy_off = (cell_h > FONT_H) ? (cell_h - FONT_H) / 2 : 0;
+  u32 fg     = native_color(c->fg);
 
   const u8 *glyph = font_latin1[gi];
-  for(int gy = 0; gy < FONT_H && gy < ctx.cell_h; gy++) {
-    u8 bits = glyph[gy];
-    for(int gx = 0; gx < FONT_W && gx < ctx.cell_w; gx++) {
+  if(gx_off + FONT_W <= cell_w) {
+    if(!ctx.pat_valid || ctx.pat_fg != c->fg || ctx.pat_bg != c->bg) {
+      font_rows_pattern(ctx.fg_pat, fg, ctx.bytes_pp);
+      font_rows_pattern(ctx.bg_pat, native_color(c->bg), ctx.bytes_pp);
+      ctx.pat_fg    = c->fg;
+      ctx.pat_bg    = c->bg;
+      ctx.pat_valid = true;
+    }
+    for(u32 gy = 0; gy < FONT_H && gy_off + gy < cell_h; gy++)
+      font_row_put(
+          pixel_at(px_x + gx_off, px_y + gy_off + gy), glyph[gy], ctx.fg_pat,
+          ctx.bg_pat, ctx.bytes_pp
+      );
+    return;
+  }
+
+  /* Cell narrower than the glyph: clip it pixel by pixel. */
+  for(u32 gy = 0; gy < FONT_H && gy_off + gy < cell_h; gy++) {
+    u8  bits = glyph[gy];
+    u8 *dst  = pixel_at(px_x + gx_off, px_y + gy_off + gy);
+    for(u32 gx = 0; gx < FONT_W && gx_off + gx < cell_w; gx++) {
       if((bits & (0x80u >> gx)) != 0)
-        fb_put_pixel(
-            px_x + (u32)(gx_off + gx), px_y + (u32)(gy_off + gy), c->fg
-        );
+        store_pixel(dst + gx * ctx.bytes_pp, fg);
     }
   }
 }
 
-/* Scroll the cell grid up by one row; clear bottom row. */
-static void scroll_one(void)
+/* Paint grid cell (col, row). */
+static void blit_cell(int col, int row)
+{
+  fb_cell_t *c = &ctx.cells[(size_t)row * (size_t)ctx.cols + (size_t)col];
+  c->dirty     = 0;
+  draw_cell(col, row, c);
+}
+
+/* Move the pixels of grid rows [top, bot] by n cells, up for n > 0 and
+ * down for n < 0, a pixel row at a time in the order that never overwrites
+ * a source row. Rows uncovered at the other end are left to their (dirty)
+ * cells. */
+static void scroll_pixels(int top, int bot, int n)
+{
+  u32 k     = (u32)(n > 0 ? n : -n);
+  u32 y0    = (u32)ctx.margin_y + (u32)top * (u32)ctx.cell_h;
+  u32 h     = ((u32)(bot - top + 1) - k) * (u32)ctx.cell_h;
+  u32 w     = (u32)ctx.cols * (u32)ctx.cell_w;
+  u64 span  = (u64)w * ctx.bytes_pp;
+  u64 shift = (u64)k * (u64)ctx.cell_h * ctx.draw_pitch;
+  if(n > 0) {
+    for(u32 y = 0; y < h; y++) {
+      u8 *dst = pixel_at((u32)ctx.margin_x, y0 + y);
+      kmemcpy(dst, dst + shift, span);
+    }
+    mark_dirty((u32)ctx.margin_x, y0, w, h);
+    return;
+  }
+  y0 += k * (u32)ctx.cell_h;
+  for(u32 y = h; y-- > 0;) {
+    u8 *dst = pixel_at((u32)ctx.margin_x, y0 + y);
+    kmemcpy(dst, dst - shift, span);
+  }
+  mark_dirty((u32)ctx.margin_x, y0, w, h);
+}
+
+/* Shift the pixels by the pending scroll. One that covers its whole region
+ * left every row in it dirty, so there is nothing worth moving. */
+static void apply_scroll(void)
+{
+  int n = ctx.scroll_pending;
+  /* Scrolled back, the pixels are not the grid's; they are all repainted
+   * on the way back to it. */
+  if(ctx.sb_view == 0 && n != 0 &&
+     (n > 0 ? n : -n) <= ctx.pend_bot - ctx.pend_top)
+    scroll_pixels(ctx.pend_top, ctx.pend_bot, n);
+  ctx.scroll_pending = 0;
+}
+
+/* Give cell (col, row) new contents; it is repainted only if they differ. */
+static void set_cell(int col, int row, u32 cp)
+{
+  fb_cell_t *c = &ctx.cells[(size_t)row * (size_t)ctx.cols + (size_t)col];
+  if(c->cp == cp && c->fg == ctx.cur_fg && c->bg == ctx.cur_bg &&
+     c->attr == 0)
+    return;
+  c->cp             = cp;
+  c->fg             = ctx.cur_fg;
+  c->bg             = ctx.cur_bg;
+  c->attr           = 0;
+  c->dirty          = 1;
+  ctx.paint_pending = true;
+}
+
+/* Bring the screen up to date with the cell grid: apply pending scrolls
+ * to the pixels, then paint the dirty cells. */
+static void repaint(void)
+{
+  if(ctx.sb_view)
+    return;
+  apply_scroll();
+  if(!ctx.paint_pending)
+    return;
+  for(int r = 0; r < ctx.rows; r++) {
+    for(int c = 0; c < ctx.cols; c++) {
+      if(ctx.cells[(size_t)r * (size_t)ctx.cols + (size_t)c].dirty)
+        blit_cell(c, r);
+    }
+  }
+  ctx.paint_pending = false;
+}
+
+/* Paint every cell, whatever is pending. */
+static void repaint_all(void)
 {
-  size_t row_bytes = (size_t)ctx.cols * sizeof(fb_cell_t);
-  for(int r = 0; r < ctx.rows - 1; r++)
-    kmemcpy(
-        &ctx.cells[(size_t)r * (size_t)ctx.cols],
-        &ctx.cells[(size_t)(r + 1) * (size_t)ctx.cols], row_bytes
-    );
-  for(int c = 0; c < ctx.cols; c++) {
-    fb_cell_t *cell =
-        &ctx.cells[(size_t)(ctx.rows - 1) * (size_t)ctx.cols + (size_t)c];
-    cell->cp   = (u32)' ';
-    cell->fg   = ctx.cur_fg;
-    cell->bg   = ctx.cur_bg;
-    cell->attr = 0;
-  }
-  /* Repaint everything — full-screen redraw on scroll. */
   for(int r = 0; r < ctx.rows; r++)
     for(int c = 0; c < ctx.cols; c++)
       blit_cell(c, r);
+  ctx.scroll_pending = 0;
+  ctx.paint_pending  = false;
+}
+
+/* Forget the oldest scrollback row. */
+static void sb_drop(void)
+{
+  ctx.sb_first = (ctx.sb_first + 1u) % SB_ROWS;
+  ctx.sb_count--;
+}
+
+/* Room for a @p len byte record as the newest row, dropping the oldest
+ * rows it would overwrite. Records lie in ring order from the oldest, so
+ * those at or past the write position are the oldest ones. */
+static u8 *sb_reserve(u32 len)
+{
+  if(ctx.sb_write + len > SB_BYTES) {
+    while(ctx.sb_count && ctx.sb_off[ctx.sb_first] >= ctx.sb_write)
+      sb_drop();
+    ctx.sb_write = 0;
+  }
+  while(ctx.sb_count &&
+        (ctx.sb_count == SB_ROWS ||
+         (ctx.sb_off[ctx.sb_first] >= ctx.sb_write &&
+          ctx.sb_off[ctx.sb_first] < ctx.sb_write + len)))
+    sb_drop();
+  u32 off = ctx.sb_write;
+  ctx.sb_off[(ctx.sb_first + ctx.sb_count) % SB_ROWS] = off;
+  ctx.sb_count++;
+  ctx.sb_write += len;
+  return ctx.sb_bytes + off;
+}
+
+static inline bool same_attrs(const fb_cell_t *a, const fb_cell_t *b)
+{
+  return a->fg == b->fg && a->bg == b->bg && a->attr == b->attr;
+}
+
+/* Append grid row @p row to the scrollback. */
+static void sb_push(int row)
+{
+  const fb_cell_t *cells = &ctx.cells[(size_t)row * (size_t)ctx.cols];
+  u32              n     = (u32)ctx.cols;
+  while(n > 0 && cells[n - 1].cp == (u32)' ' &&
+        cells[n - 1].bg == ctx.default_bg && cells[n - 1].attr == 0)
+    n--;
+  u32  runs = 0;
+  bool wide = false;
+  for(u32 i = 0; i < n; i++) {
+    if(i == 0 || !same_attrs(&cells[i], &cells[i - 1]))
+      runs++;
+    wide |= cells[i].cp > 0xffu;
+  }
+
+  u32 len = (u32)sizeof(sb_row_t) + runs * (u32)sizeof(sb_run_t) +
+            n * (wide ? 4u : 1u);
+  sb_row_t *rec = (sb_row_t *)sb_reserve((len + 3u) & ~3u);
+  rec->cells    = (u16)n;
+  rec->runs     = (u16)runs;
+  rec->wide     = wide;
+  sb_run_t *run = (sb_run_t *)(rec + 1) - 1;
+  for(u32 i = 0; i < n; i++) {
+    if(i == 0 || !same_attrs(&cells[i], &cells[i - 1])) {
+      run++;
+      run->n    = 0;
+      run->attr = cells[i].attr;
+      run->fg   = cells[i].fg;
+      run->bg   = cells[i].bg;
+    }
+    run->n++;
+  }
+  if(wide) {
+    u32 *cp = (u32 *)(run + 1);
+    for(u32 i = 0; i < n; i++)
+      cp[i] = cells[i].cp;
+  } else {
+    u8 *cp = (u8 *)(run + 1);
+    for(u32 i = 0; i < n; i++)
+      cp[i] = (u8)cells[i].cp;
+  }
+
+  /* Keep a scrolled-back view on the rows it shows. */
+  if(ctx.sb_view && ctx.sb_view < (int)ctx.sb_count)
+    ctx.sb_view++;
+}
+
+/* The top @p n rows of the scroll region are about to scroll off it: keep
+ * them if they are leaving the screen. */
+static void sb_save(int n)
+{
+  if(!ctx.sb_bytes || ctx.scroll_top != 0)
+    return;
+  if(n > ctx.scroll_bot + 1)
+    n = ctx.scroll_bot + 1;
+  for(int r = 0; r < n; r++)
+    sb_push(r);
+}
+
+/* Paint screen row @p row with the scrollback row @p back rows up from the
+ * newest (1 = the newest), padded with blanks to the grid width. */
+static void sb_paint_row(int row, u32 back)
+{
+  u32             idx  = (ctx.sb_first + ctx.sb_count - back) % SB_ROWS;
+  const sb_row_t *rec  = (const sb_row_t *)(ctx.sb_bytes + ctx.sb_off[idx]);
+  const sb_run_t *run  = (const sb_run_t *)(rec + 1);
+  const u8       *cp8  = (const u8 *)(run + rec->runs);
+  const u32      *cp   = (const u32 *)cp8;
+  fb_cell_t       c    = {0};
+  u32             left = 0;
+  for(int col = 0; col < ctx.cols; col++) {
+    if((u32)col < rec->cells) {
+      if(left == 0) {
+        c.fg   = run->fg;
+        c.bg   = run->bg;
+        c.attr = run->attr;
+        left   = run->n;
+        run++;
+      }
+      left--;
+      c.cp = rec->wide ? cp[col] : cp8[col];
+    } else {
+      c.cp   = (u32)' ';
+      c.fg   = ctx.default_fg;
+      c.bg   = ctx.default_bg;
+      c.attr = 0;
+    }
+    draw_cell(col, row, &c);
+  }
+}
+
+/* Paint the screen scrolled back sb_view rows: the newest scrollback rows
+ * above the top of the grid. */
+static void sb_paint_view(void)
+{
+  int v = ctx.sb_view;
+  for(int r = 0; r < ctx.rows; r++) {
+    if(r < v) {
+      sb_paint_row(r, (u32)(v - r));
+      continue;
+    }
+    const fb_cell_t *row = &ctx.cells[(size_t)(r - v) * (size_t)ctx.cols];
+    for(int c = 0; c < ctx.cols; c++)
+      draw_cell(c, r, &row[c]);
+  }
+}
+
+/* Scroll grid rows [top, bot] up by n rows (down for n < 0), clearing the
+ * rows that come in at the other end. */
+static void scroll_rows(int top, int bot, int n)
+{
+  int k = n > 0 ? n : -n;
+  if(k > bot - top + 1)
+    k = bot - top + 1;
+  size_t row_bytes = (size_t)ctx.cols * sizeof(fb_cell_t);
+  if(n > 0) {
+    for(int r = top; r + k <= bot; r++)
+      kmemcpy(
+          &ctx.cells[(size_t)r * (size_t)ctx.cols],
+          &ctx.cells[(size_t)(r + k) * (size_t)ctx.cols], row_bytes
+      );
+  } else {
+    for(int r = bot; r - k >= top; r--)
+      kmemcpy(
+          &ctx.cells[(size_t)r * (size_t)ctx.cols],
+          &ctx.cells[(size_t)(r - k) * (size_t)ctx.cols], row_bytes
+      );
+  }
+  int clear0 = n > 0 ? bot - k + 1 : top;
+  for(int r = clear0; r < clear0 + k; r++) {
+    for(int c = 0; c < ctx.cols; c++) {
+      fb_cell_t *cell = &ctx.cells[(size_t)r * (size_t)ctx.cols + (size_t)c];
+      cell->cp        = (u32)' ';
+      cell->fg        = ctx.cur_fg;
+      cell->bg        = ctx.cur_bg;
+      cell->attr      = 0;
+      cell->dirty     = 1;
+    }
+  }
+
+  /* The rest of the region is already drawn: repaint() shifts its pixels
+   * and paints the new rows. A scroll of another region or direction
+   * first moves the pixels by the one pending. */
+  if(ctx.scroll_pending != 0 &&
+     (ctx.pend_top != top || ctx.pend_bot != bot ||
+      (ctx.scroll_pending > 0) != (n > 0)))
+    apply_scroll();
+  ctx.pend_top = top;
+  ctx.pend_bot = bot;
+  ctx.scroll_pending += n > 0 ? k : -k;
+  ctx.paint_pending = true;
+}
+
+/* Make the whole grid the scroll region again. */
+static void reset_scroll_region(void)
+{
+  ctx.scroll_top = 0;
+  ctx.scroll_bot = ctx.rows - 1;
+}
+
+/* Move the cursor down a row; at the bottom margin, scroll the region. */
+static void line_feed(void)
+{
+  if(ctx.cy == ctx.scroll_bot) {
+    sb_save(1);
+    scroll_rows(ctx.scroll_top, ctx.scroll_bot, 1);
+  } else if(ctx.cy < ctx.rows - 1) {
+    ctx.cy++;
+  }
+}
+
+/* Move the cursor up a row; at the top margin, scroll the region down. */
+static void reverse_index(void)
+{
+  if(ctx.cy == ctx.scroll_top)
+    scroll_rows(ctx.scroll_top, ctx.scroll_bot, -1);
+  else if(ctx.cy > 0)
+    ctx.cy--;
 }
 
 static void put_cp_at_cursor(u32 cp)
 {
   if(ctx.cx >= ctx.cols) {
     ctx.cx = 0;
-    ctx.cy++;
-    if(ctx.cy >= ctx.rows) {
-      scroll_one();
-      ctx.cy = ctx.rows - 1;
-    }
+    line_feed();
   }
-  fb_cell_t *c = &ctx.cells[(size_t)ctx.cy * (size_t)ctx.cols + (size_t)ctx.cx];
-  c->cp        = cp;
-  c->fg        = ctx.cur_fg;
-  c->bg        = ctx.cur_bg;
-  c->attr      = 0;
-  blit_cell(ctx.cx, ctx.cy);
+  set_cell(ctx.cx, ctx.cy, cp);
   ctx.last_cp = cp;
   ctx.cx++;
 }
@@ -411,12 +1087,7 @@ static void erase_rect(int y0, int x0, int y1, int x1)
     for(int x = x0; x <= x1; x++) {
       if(x < 0 || x >= ctx.cols)
         continue;
-      fb_cell_t *c = &ctx.cells[(size_t)y * (size_t)ctx.cols + (size_t)x];
-      c->cp        = (u32)' ';
-      c->fg        = ctx.cur_fg;
-      c->bg        = ctx.cur_bg;
-      c->attr      = 0;
-      blit_cell(x, y);
+      set_cell(x, y, (u32)' ');
     }
   }
 }
@@ -435,6 +1106,23 @@ static void csi_cup(void)
   ctx.cx = col - 1;
 }
 
+static void csi_stbm(void)
+{
+  if(ctx.esc_buf[0] == '?') /* XTRESTORE, not margins */
+    return;
+  int pv[4];
+  int np  = csi_params(pv, 4);
+  int top = (np >= 1 && pv[0] >= 1) ? pv[0] : 1;
+  int bot = (np >= 2 && pv[1] >= 1) ? pv[1] : ctx.rows;
+  if(bot > ctx.rows)
+    bot = ctx.rows;
+  if(top >= bot)
+    return;
+  ctx.scroll_top = top - 1;
+  ctx.scroll_bot = bot - 1;
+  ctx.cx = ctx.cy = 0;
+}
+
 static void csi_sgr(void)
 {
   int pv[32];
@@ -511,10 +1199,15 @@ static void csi_dec_private(char cmd)
   }
   int on = (cmd == 'h');
   for(int k = 0; k < np; k++) {
-    if(pv[k] == 25)
+    if(pv[k] == 25) {
       ctx.cursor_visible = (u8)on;
-    else if(pv[k] == 1)
+    } else if(pv[k] == 1) {
       ctx.app_cursor_keys = (on != 0);
+    } else if(pv[k] == 2026) {
+      /* Synchronized update: hold painting until the matching reset. */
+      ctx.sync_update = (on != 0);
+      ctx.sync_ticks  = FB_SYNC_TIMEOUT;
+    }
     /* ?1049 (alt screen) intentionally ignored — draw into the live grid. */
   }
 }
@@ -625,6 +1318,26 @@ static void handle_csi(void)
       put_cp_at_cursor(ctx.last_cp);
     break;
   }
+  case 'S': { /* SU — scroll the region up Pn lines */
+    int n = csi_param1();
+    sb_save(n);
+    scroll_rows(ctx.scroll_top, ctx.scroll_bot, n);
+    break;
+  }
+  case 'T': /* SD — scroll the region down Pn lines */
+    scroll_rows(ctx.scroll_top, ctx.scroll_bot, -csi_param1());
+    break;
+  case 'L': /* IL — insert Pn lines at the cursor row */
+  case 'M': /* DL — delete Pn lines at the cursor row */
+    if(ctx.cy >= ctx.scroll_top && ctx.cy <= ctx.scroll_bot) {
+      int n = csi_param1();
+      scroll_rows(ctx.cy, ctx.scroll_bot, cmd == 'M' ? n : -n);
+      ctx.cx = 0;
+    }
+    break;
+  case 'r': /* DECSTBM — set top and bottom margins (1-based) */
+    csi_stbm();
+    break;
   case 's':
     ctx.saved_cx = ctx.cx;
     ctx.saved_cy = ctx.cy;
@@ -643,11 +1356,7 @@ static void handle_control(u8 b)
   switch(b) {
   case '\n':
     ctx.cx = 0;
-    ctx.cy++;
-    if(ctx.cy >= ctx.rows) {
-      scroll_one();
-      ctx.cy = ctx.rows - 1;
-    }
+    line_feed();
     return;
   case '\r':
     ctx.cx = 0;
@@ -722,6 +1431,38 @@ static void feed_utf8(u8 b)
   }
 }
 
+/* Back the screen with a RAM shadow. It starts as a copy of what the boot
+ * logger drew, the one time VRAM is read. */
+static void shadow_init(void)
+{
+  ctx.draw       = (u8 *)ctx.base;
+  ctx.draw_pitch = ctx.pitch;
+
+  u64  pitch  = ctx.width * ctx.bytes_pp;
+  u8  *shadow = (u8 *)kmalloc(pitch * ctx.height);
+  u32 *dirty  = (u32 *)kmalloc(2 * ctx.height * sizeof(u32));
+  if(!shadow || !dirty) {
+    if(shadow)
+      kfree(shadow);
+    if(dirty)
+      kfree(dirty);
+    return;
+  }
+  for(u64 y = 0; y < ctx.height; y++) {
+    kmemcpy(shadow + y * pitch, (u8 *)ctx.base + y * ctx.pitch, pitch);
+    dirty[y]              = (u32)ctx.width;
+    dirty[ctx.height + y] = 0;
+  }
+
+  ctx.shadow     = shadow;
+  ctx.draw       = shadow;
+  ctx.draw_pitch = pitch;
+  ctx.dirty_x0   = dirty;
+  ctx.dirty_x1   = dirty + ctx.height;
+  ctx.dirty_y0   = (u32)ctx.height;
+  ctx.dirty_y1   = 0;
+}
+
 bool fb_console_init(void *fb, u64 width, u64 height, u64 pitch, u16 bpp)
 {
   ctx.base     = (volatile u8 *)fb;
@@ -735,6 +1476,8 @@ bool fb_console_init(void *fb, u64 width, u64 height, u64 pitch, u16 bpp)
   ctx.margin_y = 0;
   ctx.cols     = (int)(width / (u64)ctx.cell_w);
   ctx.rows     = (int)(height / (u64)ctx.cell_h);
+  font_rows_init(ctx.bytes_pp);
+  reset_scroll_region();
   /* Nord defaults — fg = snow-storm-1, bg = polar-night-1. Match the look
    * the old userspace fb_tty shipped (see commit 438a24b for the source). */
   ctx.default_fg = 0xd8dee9u;
@@ -750,14 +1493,33 @@ bool fb_console_init(void *fb, u64 width, u64 height, u64 pitch, u16 bpp)
   ctx.in_head = ctx.in_tail = 0;
 
   size_t total = (size_t)ctx.rows * (size_t)ctx.cols;
-  ctx.cells    = (fb_cell_t *)kmalloc(total * sizeof(fb_cell_t));
-  if(!ctx.cells)
+  u64    pages = (total * sizeof(fb_cell_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+  void  *phys  = pmm_alloc_pages(pages);
+  if(!phys)
     return false;
+  ctx.grid_phys  = (u64)phys;
+  ctx.grid_pages = pages;
+  ctx.grid_cap   = pages * PAGE_SIZE / sizeof(fb_cell_t);
+  ctx.cells      = (fb_cell_t *)phys_to_virt(ctx.grid_phys);
   for(size_t i = 0; i < total; i++) {
-    ctx.cells[i].cp   = (u32)' ';
-    ctx.cells[i].fg   = ctx.default_fg;
-    ctx.cells[i].bg   = ctx.default_bg;
-    ctx.cells[i].attr = 0;
+    ctx.cells[i].cp    = (u32)' ';
+    ctx.cells[i].fg    = ctx.default_fg;
+    ctx.cells[i].bg    = ctx.default_bg;
+    ctx.cells[i].attr  = 0;
+    ctx.cells[i].dirty = 0;
+  }
+  shadow_init();
+
+  /* Without memory for the scrollback, rows scrolled off are just lost. */
+  ctx.sb_bytes = (u8 *)kmalloc(SB_BYTES);
+  ctx.sb_off   = (u32 *)kmalloc(SB_ROWS * sizeof(u32));
+  if(!ctx.sb_bytes || !ctx.sb_off) {
+    if(ctx.sb_bytes)
+      kfree(ctx.sb_bytes);
+    if(ctx.sb_off)
+      kfree(ctx.sb_off);
+    ctx.sb_bytes = NULL;
+    ctx.sb_off   = NULL;
   }
   return true;
 }
@@ -785,6 +1547,11 @@ static void feed_byte(u8 b)
       ctx.esc_state = 0;
       return;
     }
+    if(b == 'M') { /* RI */
+      reverse_index();
+      ctx.esc_state = 0;
+      return;
+    }
     if(b == '(' || b == ')') {
       ctx.esc_state = 3; /* wait for designator byte */
       return;
@@ -822,13 +1589,83 @@ static void feed_byte(u8 b)
   feed_utf8(b);
 }
 
+#define WORD_ONES  0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+
+/* Length of the run of printable ASCII (0x20..0x7e) at the start of @p p.
+ * Eight bytes at a time: a word is all printable when no byte is below
+ * 0x20 and none is above 0x7e (adding 1 does not carry into bit 7). */
+static size_t printable_run(const u8 *p, size_t len)
+{
+  size_t n = 0;
+  for(; n + 8 <= len; n += 8) {
+    u64 w;
+    __builtin_memcpy(&w, p + n, sizeof(w));
+    if(((w - 0x20 * WORD_ONES) | (w + WORD_ONES) | w) & WORD_HIGHS)
+      break;
+  }
+  while(n < len && p[n] >= 0x20u && p[n] < 0x7fu)
+    n++;
+  return n;
+}
+
+/* put_cp_at_cursor() for a run of printable ASCII, a row's worth at a
+ * time: each cell is compared and filled in place and only those that
+ * changed are left dirty, as set_cell() would. */
+static void put_ascii_run(const u8 *p, size_t n)
+{
+  bool changed = false;
+  while(n) {
+    if(ctx.cx >= ctx.cols) {
+      ctx.cx = 0;
+      line_feed();
+    }
+    size_t     k   = (size_t)(ctx.cols - ctx.cx);
+    fb_cell_t *row = &ctx.cells[(size_t)ctx.cy * (size_t)ctx.cols];
+    if(k > n)
+      k = n;
+    for(size_t i = 0; i < k; i++) {
+      fb_cell_t *c = &row[ctx.cx + (int)i];
+      if(c->cp == p[i] && c->fg == ctx.cur_fg && c->bg == ctx.cur_bg &&
+         c->attr == 0)
+        continue;
+      c->cp    = p[i];
+      c->fg    = ctx.cur_fg;
+      c->bg    = ctx.cur_bg;
+      c->attr  = 0;
+      c->dirty = 1;
+      changed  = true;
+    }
+    ctx.cx     += (int)k;
+    ctx.last_cp = p[k - 1];
+    p += k;
+    n -= k;
+  }
+  if(changed)
+    ctx.paint_pending = true;
+}
+
 void fb_console_write(const void *buf, size_t len)
 {
   if(ctx.yielded || !ctx.cells)
     return;
   const u8 *p = (const u8 *)buf;
-  for(size_t i = 0; i < len; i++)
-    feed_byte(p[i]);
+  for(size_t i = 0; i < len;) {
+    /* Plain text in the ground state skips the per-byte state machine. */
+    if(ctx.esc_state == 0 && ctx.utf8_rem == 0 && !ctx.g0_acs) {
+      size_t n = printable_run(p + i, len - i);
+      if(n) {
+        put_ascii_run(p + i, n);
+        i += n;
+        continue;
+      }
+    }
+    feed_byte(p[i++]);
+  }
+  if(!ctx.sync_update) {
+    repaint();
+    flush();
+  }
   /* Activity → cursor blink "on". */
   ctx.blink_ticks = 50;
   ctx.blink_on    = 1;
@@ -860,6 +1697,12 @@ void fb_console_tick(void)
 {
   if(ctx.yielded || !ctx.cells)
     return;
+  /* Writes run with interrupts off, so this never cuts into one. */
+  if(ctx.sync_update && --ctx.sync_ticks == 0) {
+    ctx.sync_update = false;
+    repaint();
+    flush();
+  }
   if(ctx.blink_ticks == 0) {
     ctx.blink_on    = (u8)!ctx.blink_on;
     ctx.blink_ticks = 50;
@@ -930,6 +1773,7 @@ int fb_console_set_atlas(const fb_console_atlas_t *meta)
   ctx.atlas_n_cp     = meta->n_cp;
   ctx.atlas_fallback = meta->fallback_idx;
   ctx.atlas_active   = true;
+  gcache_init();
 
   /* Adopt the atlas's cell pixel size and reflow the grid. Cursor + saved
    * cursor get clamped into the new geometry; existing content is discarded
@@ -950,17 +1794,15 @@ int fb_console_set_atlas(const fb_console_atlas_t *meta)
     if(new_rows < 1)
       new_rows = 1;
     size_t     total = (size_t)new_cols * (size_t)new_rows;
-    fb_cell_t *nc    = (fb_cell_t *)kmalloc(total * sizeof(fb_cell_t));
+    fb_cell_t *nc    = total <= ctx.grid_cap ? ctx.cells : NULL;
     if(nc) {
       for(size_t i = 0; i < total; i++) {
-        nc[i].cp   = (u32)' ';
-        nc[i].fg   = ctx.default_fg;
-        nc[i].bg   = ctx.default_bg;
-        nc[i].attr = 0;
+        nc[i].cp    = (u32)' ';
+        nc[i].fg    = ctx.default_fg;
+        nc[i].bg    = ctx.default_bg;
+        nc[i].attr  = 0;
+        nc[i].dirty = 0;
       }
-      if(ctx.cells)
-        kfree(ctx.cells);
-      ctx.cells    = nc;
       ctx.cols     = new_cols;
       ctx.rows     = new_rows;
       ctx.cell_w   = new_cell_w;
@@ -969,19 +1811,19 @@ int fb_console_set_atlas(const fb_console_atlas_t *meta)
       ctx.margin_y = new_marg_y;
       ctx.cx = ctx.cy = 0;
       ctx.saved_cx = ctx.saved_cy = 0;
+      reset_scroll_region();
       /* Wipe stale pixels left around the old grid. */
-      for(u32 y = 0; y < ctx.height; y++)
-        for(u32 x = 0; x < ctx.width; x++)
-          fb_put_pixel(x, y, ctx.default_bg);
+      fill_rect(0, 0, (u32)ctx.width, (u32)ctx.height, ctx.default_bg);
     }
-    /* If kmalloc fails, fall through and repaint with the existing grid;
-     * the atlas blit will just clip to ctx.cell_w/cell_h as before. */
+    /* If the new grid does not fit its pages, fall through and repaint
+     * with the existing grid; the atlas blit will just clip to
+     * ctx.cell_w/cell_h as before. */
   }
 
   /* Repaint the whole grid through the new path. */
-  for(int r = 0; r < ctx.rows; r++)
-    for(int c = 0; c < ctx.cols; c++)
-      blit_cell(c, r);
+  ctx.sb_view = 0;
+  repaint_all();
+  flush();
 
   /* Wake every TUI so they re-query TIOCGWINSZ and redraw at the real grid
    * size. Skipped when the grid stayed the same (e.g. atlas reloaded with
@@ -1004,17 +1846,75 @@ bool fb_console_app_cursor_keys(void)
   return ctx.app_cursor_keys;
 }
 
+void fb_console_scroll_view(int pages)
+{
+  if(ctx.yielded || !ctx.cells)
+    return;
+  int view = 0;
+  if(pages != 0) {
+    int page = ctx.rows > 1 ? ctx.rows / 2 : 1;
+    view     = ctx.sb_view + pages * page;
+    if(view > (int)ctx.sb_count)
+      view = (int)ctx.sb_count;
+    if(view < 0)
+      view = 0;
+  }
+  if(view == ctx.sb_view)
+    return;
+  ctx.sb_view = view;
+  if(view == 0)
+    repaint_all();
+  else
+    sb_paint_view();
+  flush();
+}
+
 void fb_console_yield(void)
 {
   ctx.yielded = true;
 }
 
+bool fb_console_grid_pages(u64 *phys, u64 *pages)
+{
+  if(!ctx.cells)
+    return false;
+  *phys  = ctx.grid_phys;
+  *pages = ctx.grid_pages;
+  return true;
+}
+
+void fb_console_present(u32 first_row, u32 n_rows)
+{
+  if(ctx.yielded || !ctx.cells || ctx.sb_view || first_row >= (u32)ctx.rows)
+    return;
+  if(n_rows > (u32)ctx.rows - first_row)
+    n_rows = (u32)ctx.rows - first_row;
+  /* Pixels must match the grid before cells are painted over them. */
+  apply_scroll();
+  for(u32 r = first_row; r < first_row + n_rows; r++) {
+    for(int c = 0; c < ctx.cols; c++) {
+      if(ctx.cells[(size_t)r * (size_t)ctx.cols + (size_t)c].dirty)
+        blit_cell(c, (int)r);
+    }
+  }
+  if(!ctx.sync_update)
+    flush();
+}
+
 void fb_console_reclaim(void)
 {
   ctx.yielded = false;
   if(!ctx.cells)
     return;
-  for(int r = 0; r < ctx.rows; r++)
-    for(int c = 0; c < ctx.cols; c++)
-      blit_cell(c, r);
+  /* Nothing was drawn while yielded, so the shadow still holds the screen
+   * (unless it was scrolled back). */
+  bool viewing = ctx.sb_view != 0;
+  ctx.sb_view  = 0;
+  if(ctx.shadow && !viewing) {
+    repaint();
+    mark_dirty(0, 0, (u32)ctx.width, (u32)ctx.height);
+  } else {
+    repaint_all();
+  }
+  flush();
 }
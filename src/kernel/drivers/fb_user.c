@@ -6,6 +6,7 @@
 #include <alcor2/drivers/fb_user.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
 
 #define PAGE_MASK_LOCAL (PAGE_SIZE - 1ULL)
 
@@ -15,6 +16,7 @@ static struct
   u64 phys_base;    /**< Page-aligned start. */
   u64 map_size;     /**< Page multiple covering the active framebuffer. */
   u64 pixel_offset; /**< Byte offset from @a phys_base to first pixel. */
+  u8 *pixels;       /**< Kernel address of the first pixel. */
   u64 width;
   u64 height;
   u64 pitch;
@@ -69,6 +71,11 @@ void fb_user_boot_init(
   g_fb.phys_base    = map_lo;
   g_fb.map_size     = map_sz;
   g_fb.pixel_offset = rel0;
+  /* The bootloader's mapping has whatever cache type the firmware left;
+   * our own write-combined one turns pixel stores into bursts. */
+  g_fb.pixels = (u8 *)vmm_map_wc(fb_phys, active);
+  if(!g_fb.pixels)
+    g_fb.pixels = (u8 *)lfb->address;
   g_fb.width        = lfb->width;
   g_fb.height       = lfb->height;
   g_fb.pitch        = lfb->pitch;
@@ -121,3 +128,8 @@ u64 fb_user_mmap_pixel_offset(void)
 {
   return g_fb.valid ? g_fb.pixel_offset : 0;
 }
+
+u8 *fb_user_pixels(void)
+{
+  return g_fb.valid ? g_fb.pixels : NULL;
+}
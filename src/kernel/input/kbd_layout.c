@@ -10,6 +10,9 @@
  * shell see the exact same byte stream a real UTF-8 terminal would feed
  * them, which keeps the FB tty decoder happy and stops ncurses' keyname()
  * from reporting "M-i" for é.
+ *
+ * Translation and the line discipline run in the keyboard IRQ's bottom half
+ * (::kbd_bottom_half), so read(2) only copies out queued input.
  */
 
 #include <alcor2/arch/cpu.h>
@@ -91,18 +94,13 @@ static void pend_ss3(char tail)
  * single-byte read. Latin-1 supplement codepoints (0x80..0xff, the AZERTY
  * é/à/ç/è/ù/î and the dead-key punctuation) are transcoded to their 2-byte
  * UTF-8 encoding and pushed to @c out_pend, matching what every modern
- * terminal feeds to its TTY. The caller (@c kbd_pop_byte) drains the queue
- * before re-entering @c process_raw_ctx, so the second UTF-8 byte surfaces
- * on the very next read.
- *
- * Dry-run mode reports readability without touching state.
+ * terminal feeds to its TTY. The bottom half drains the queue after each
+ * scancode, so both UTF-8 bytes reach the input queue together.
  *
  * @return @c true when @p out was set or at least one byte is now queued.
  */
-static bool emit_user_cp(unsigned char cp, unsigned char *out, bool dry)
+static bool emit_user_cp(unsigned char cp, unsigned char *out)
 {
-  if(dry)
-    return true;
   if(cp < 0x80u) {
     *out = cp;
     return true;
@@ -290,7 +288,9 @@ static bool us_caps_scan(u8 key)
   return p >= 'a' && p <= 'z';
 }
 
-#define KBD_RAW_PEEK_MAX 256
+#define KBD_LINE_CAP  256  /* canonical edit line */
+#define KBD_INPUT_CAP 4096 /* bytes ready for read(2) */
+#define KBD_LINES_MAX 64   /* complete lines queued in canonical mode */
 
 static kbd_layout_t layout = KBD_LAYOUT_US;
 
@@ -321,12 +321,10 @@ kbd_layout_t kbd_get_layout(void)
 }
 
 /**
- * @param dry If true, do not push CSI or set @a *out; only report if read would
- *            produce a user-visible byte (for select(2) readability).
- * @return true when @a *out should be delivered (dry) or out_pend was fed.
+ * @brief Translate one scancode, updating the modifier state in @p s.
+ * @return true when @a *out holds a byte; longer output goes to out_pend.
  */
-static bool
-    process_raw_ctx(u8 raw, kbd_ev_ctx_t *s, unsigned char *out, bool dry)
+static bool process_raw_ctx(u8 raw, kbd_ev_ctx_t *s, unsigned char *out)
 {
   if(raw == 0xe0) {
     s->pend_e0 = true;
@@ -352,65 +350,52 @@ static bool
     bool app = fb_console_app_cursor_keys();
     switch(ext) {
     case 0x48: /* Arrow up */
-      if(dry)
-        return true;
       if(app)
         pend_ss3('A');
       else
         pend_csi('A');
       break;
     case 0x50: /* Arrow down */
-      if(dry)
-        return true;
       if(app)
         pend_ss3('B');
       else
         pend_csi('B');
       break;
     case 0x4b: /* Arrow left */
-      if(dry)
-        return true;
       if(app)
         pend_ss3('D');
       else
         pend_csi('D');
       break;
     case 0x4d: /* Arrow right */
-      if(dry)
-        return true;
       if(app)
         pend_ss3('C');
       else
         pend_csi('C');
       break;
     case 0x47: /* Home */
-      if(dry)
-        return true;
       pend_csi_tilde(1u);
       break;
     case 0x4f: /* End */
-      if(dry)
-        return true;
       pend_csi_tilde(4u);
       break;
-    case 0x49: /* Page Up */
-      if(dry)
-        return true;
-      pend_csi_tilde(5u);
+    case 0x49: /* Page Up; with Shift, scroll the console back */
+      if(s->mod.shift)
+        fb_console_scroll_view(1);
+      else
+        pend_csi_tilde(5u);
       break;
-    case 0x51: /* Page Down */
-      if(dry)
-        return true;
-      pend_csi_tilde(6u);
+    case 0x51: /* Page Down; with Shift, scroll the console forward */
+      if(s->mod.shift)
+        fb_console_scroll_view(-1);
+      else
+        pend_csi_tilde(6u);
       break;
     case 0x52: /* Insert */
-      if(dry)
-        return true;
       pend_csi_tilde(2u);
       break;
     case 0x53: /* Delete — kept as 0x7f for shell backspace parity. */
-      if(!dry)
-        *out = 0x7f;
+      *out = 0x7f;
       return true;
     default:
       break;
@@ -451,63 +436,39 @@ static bool
    * layout table because their scancodes overlap nothing printable. */
   switch(key) {
   case 0x3b: /* F1 */
-    if(dry)
-      return true;
     pend_ss3('P');
     return false;
   case 0x3c: /* F2 */
-    if(dry)
-      return true;
     pend_ss3('Q');
     return false;
   case 0x3d: /* F3 */
-    if(dry)
-      return true;
     pend_ss3('R');
     return false;
   case 0x3e: /* F4 */
-    if(dry)
-      return true;
     pend_ss3('S');
     return false;
   case 0x3f: /* F5 */
-    if(dry)
-      return true;
     pend_csi_tilde(15u);
     return false;
   case 0x40: /* F6 */
-    if(dry)
-      return true;
     pend_csi_tilde(17u);
     return false;
   case 0x41: /* F7 */
-    if(dry)
-      return true;
     pend_csi_tilde(18u);
     return false;
   case 0x42: /* F8 */
-    if(dry)
-      return true;
     pend_csi_tilde(19u);
     return false;
   case 0x43: /* F9 */
-    if(dry)
-      return true;
     pend_csi_tilde(20u);
     return false;
   case 0x44: /* F10 */
-    if(dry)
-      return true;
     pend_csi_tilde(21u);
     return false;
   case 0x57: /* F11 */
-    if(dry)
-      return true;
     pend_csi_tilde(23u);
     return false;
   case 0x58: /* F12 */
-    if(dry)
-      return true;
     pend_csi_tilde(24u);
     return false;
   default:
@@ -520,20 +481,18 @@ static bool
   if(s->mod.ctrl) {
     unsigned char b = pl[key];
     if(b >= 'a' && b <= 'z') {
-      if(!dry)
-        *out = (unsigned char)(b - 'a' + 1);
+      *out = (unsigned char)(b - 'a' + 1);
       return true;
     }
     if(b >= 'A' && b <= 'Z') {
-      if(!dry)
-        *out = (unsigned char)(b - 'A' + 1);
+      *out = (unsigned char)(b - 'A' + 1);
       return true;
     }
     return false;
   }
 
   if(layout == KBD_LAYOUT_FR && (s->lalt_dn || s->ralt_dn) && fr_alt[key]) {
-    return emit_user_cp(fr_alt[key], out, dry);
+    return emit_user_cp(fr_alt[key], out);
   }
 
   bool eff_shift = s->mod.shift;
@@ -547,52 +506,7 @@ static bool
   unsigned char c = eff_shift ? sh[key] : pl[key];
   if(!c)
     return false;
-  return emit_user_cp(c, out, dry);
-}
-
-static bool kbd_peek_would_emit(const u8 *buf, u32 n, kbd_ev_ctx_t st)
-{
-  unsigned char dummy;
-  for(u32 i = 0; i < n; i++) {
-    if(process_raw_ctx(buf[i], &st, &dummy, true))
-      return true;
-  }
-  return false;
-}
-
-/**
- * Pop one translated byte from the keyboard path. When @a block is false,
- * drains the raw queue once without sleeping.
- */
-static bool kbd_pop_byte(unsigned char *out, bool block)
-{
-  for(;;) {
-    unsigned char pb;
-    if(out_pend_take(&pb)) {
-      *out = pb;
-      return true;
-    }
-    if(!block) {
-      while(keyboard_raw_available()) {
-        u8 raw = keyboard_raw_pop();
-        if(process_raw_ctx(raw, &g_kbd, out, false))
-          return true;
-      }
-      return false;
-    }
-    while(!keyboard_raw_available()) {
-      cpu_enable_interrupts();
-      __asm__ volatile("hlt");
-      cpu_disable_interrupts();
-      /* Yield to other processes (e.g. pipe relay parent) that became READY
-       * while we were waiting. proc_switch marks us READY so we will be
-       * rescheduled once the other process yields or blocks. */
-      proc_schedule();
-    }
-    u8 raw = keyboard_raw_pop();
-    if(process_raw_ctx(raw, &g_kbd, out, false))
-      return true;
-  }
+  return emit_user_cp(c, out);
 }
 
 static void tty_echo_byte(unsigned char c, bool echo_on)
@@ -638,136 +552,220 @@ static u32 utf8_trim_one(const char *buf, u32 len)
   return len;
 }
 
-static u64 kbd_deliver_ready(proc_t *p, char *buf, u64 count)
+/*
+ * Line discipline, run by the keyboard IRQ bottom half.
+ *
+ * Translated bytes are edited into kbd_edit in canonical mode and committed
+ * to the input queue a line at a time; otherwise they go straight there.
+ * Both queues belong to the terminal, not to a process: the mode comes from
+ * the termios of the last process to read or poll stdin (kbd_set_mode).
+ * Queue positions are free-running counters.
+ */
+static k_termios_t   kbd_tio;
+static char          kbd_edit[KBD_LINE_CAP];
+static u32           kbd_edit_len;
+static unsigned char kbd_in[KBD_INPUT_CAP];
+static u32           kbd_in_r;
+static u32           kbd_in_w;
+static u32           kbd_line_end[KBD_LINES_MAX]; /* kbd_in_w after a line */
+static u32           kbd_lines_r;
+static u32           kbd_lines_w;
+
+static bool kbd_canon(void)
 {
-  u64 to_copy = count;
-  if(to_copy > p->kbd_ready_len)
-    to_copy = p->kbd_ready_len;
-  if(to_copy == 0)
-    return 0;
-  kmemcpy(buf, p->kbd_ready, to_copy);
-  if(to_copy < p->kbd_ready_len) {
-    u32 rest = p->kbd_ready_len - (u32)to_copy;
-    kmemcpy(
-        p->kbd_ready, p->kbd_ready + to_copy, rest
-    ); /* src > dst, no overlap */
-    p->kbd_ready_len = rest;
-  } else
-    p->kbd_ready_len = 0;
-  return to_copy;
+  return (kbd_tio.c_lflag & KTERM_ICANON) != 0;
 }
 
-u64 kbd_read_for_process(proc_t *p, char *buf, u64 count)
+static u32 kbd_in_avail(void)
 {
-  u64 filled = 0;
+  return kbd_in_w - kbd_in_r;
+}
 
-  if(!p || count == 0)
-    return 0;
+static void kbd_in_push(unsigned char c)
+{
+  if(kbd_in_avail() < KBD_INPUT_CAP)
+    kbd_in[kbd_in_w++ % KBD_INPUT_CAP] = c;
+}
 
-  k_termios_t  *t       = &p->termios;
-  u32           lflag   = t->c_lflag;
-  bool          icanon  = (lflag & KTERM_ICANON) != 0;
-  bool          echo_on = (lflag & KTERM_ECHO) != 0;
-  u8            vmin    = t->c_cc[KTERM_VMIN];
-  u8            vtime   = t->c_cc[KTERM_VTIME];
-  unsigned char verase  = t->c_cc[KTERM_VERASE];
-  unsigned char vkill   = t->c_cc[KTERM_VKILL];
-  unsigned char veof    = t->c_cc[KTERM_VEOF];
-
-  if(icanon) {
-    u64 d = kbd_deliver_ready(p, buf, count);
-    if(d)
-      return d;
-
-    for(;;) {
-      unsigned char c;
-      kbd_pop_byte(&c, true);
-
-      if(c == verase || c == '\b') {
-        if(p->kbd_edit_len > 0) {
-          p->kbd_edit_len = utf8_trim_one(p->kbd_edit, p->kbd_edit_len);
-          tty_echo_erase(echo_on);
-        }
-        continue;
-      }
-
-      if(c == vkill) {
-        while(p->kbd_edit_len > 0) {
-          p->kbd_edit_len = utf8_trim_one(p->kbd_edit, p->kbd_edit_len);
-          tty_echo_erase(echo_on);
-        }
-        continue;
-      }
-
-      if(c == '\r' || c == '\n') {
-        tty_echo_byte(c, echo_on);
-        if(p->kbd_edit_len >= PROC_KBD_LINE_CAP)
-          p->kbd_edit_len = PROC_KBD_LINE_CAP - 1;
-        kmemcpy(p->kbd_ready, p->kbd_edit, p->kbd_edit_len);
-        p->kbd_ready_len              = p->kbd_edit_len + 1;
-        p->kbd_ready[p->kbd_edit_len] = '\n';
-        p->kbd_edit_len               = 0;
-        return kbd_deliver_ready(p, buf, count);
-      }
-
-      if(c == veof) {
-        if(p->kbd_edit_len == 0)
-          return 0;
-        kmemcpy(p->kbd_ready, p->kbd_edit, p->kbd_edit_len);
-        p->kbd_ready_len = p->kbd_edit_len;
-        p->kbd_edit_len  = 0;
-        return kbd_deliver_ready(p, buf, count);
-      }
-
-      if(p->kbd_edit_len < PROC_KBD_LINE_CAP - 1u) {
-        p->kbd_edit[p->kbd_edit_len++] = (char)c;
-        tty_echo_byte(c, echo_on);
-      }
+static void kbd_line_mark(void)
+{
+  if(kbd_lines_w - kbd_lines_r < KBD_LINES_MAX)
+    kbd_line_end[kbd_lines_w++ % KBD_LINES_MAX] = kbd_in_w;
+}
+
+/* Commit the edit line (plus @p nl when non-zero); dropped if it won't fit. */
+static void kbd_line_commit(unsigned char nl)
+{
+  u32 len = kbd_edit_len + (nl ? 1u : 0u);
+  if(KBD_INPUT_CAP - kbd_in_avail() >= len &&
+     kbd_lines_w - kbd_lines_r < KBD_LINES_MAX) {
+    for(u32 i = 0; i < kbd_edit_len; i++)
+      kbd_in_push((unsigned char)kbd_edit[i]);
+    if(nl)
+      kbd_in_push(nl);
+    kbd_line_mark();
+  }
+  kbd_edit_len = 0;
+}
+
+static void kbd_input_byte(unsigned char c)
+{
+  const k_termios_t *t       = &kbd_tio;
+  bool               echo_on = (t->c_lflag & KTERM_ECHO) != 0;
+
+  /* Typing brings a scrolled-back console back to the live screen. */
+  fb_console_scroll_view(0);
+
+  if(!kbd_canon()) {
+    kbd_in_push(c);
+    return;
+  }
+
+  if(c == t->c_cc[KTERM_VERASE] || c == '\b') {
+    if(kbd_edit_len > 0) {
+      kbd_edit_len = utf8_trim_one(kbd_edit, kbd_edit_len);
+      tty_echo_erase(echo_on);
     }
+    return;
   }
 
-  /* Non-canonical */
-  if(vmin == 0 && vtime == 0) {
-    while(filled < count && kbd_pop_byte((unsigned char *)&buf[filled], false))
-      filled++;
-    return filled;
+  if(c == t->c_cc[KTERM_VKILL]) {
+    while(kbd_edit_len > 0) {
+      kbd_edit_len = utf8_trim_one(kbd_edit, kbd_edit_len);
+      tty_echo_erase(echo_on);
+    }
+    return;
   }
 
-  if(vmin == 0) {
-    unsigned char oc;
-    kbd_pop_byte(&oc, true);
-    buf[0] = (char)oc;
-    return 1;
+  if(c == '\r' || c == '\n') {
+    tty_echo_byte(c, echo_on);
+    kbd_line_commit('\n');
+    return;
   }
 
-  u64 need = (u64)vmin;
-  if(need > count)
-    need = count;
+  /* EOF: the line so far, without a terminator; alone, a 0-byte read. */
+  if(c == t->c_cc[KTERM_VEOF]) {
+    kbd_line_commit(0);
+    return;
+  }
 
-  while(filled < need) {
-    unsigned char oc;
-    kbd_pop_byte(&oc, true);
-    buf[filled++] = (char)oc;
+  if(kbd_edit_len < KBD_LINE_CAP - 1u) {
+    kbd_edit[kbd_edit_len++] = (char)c;
+    tty_echo_byte(c, echo_on);
   }
-  while(filled < count) {
-    unsigned char oc;
-    if(!kbd_pop_byte(&oc, false))
-      break;
-    buf[filled++] = (char)oc;
+}
+
+/*
+ * Keyboard IRQ bottom half: translate every queued scancode and feed the
+ * line discipline. keyboard_irq then wakes the readers, so a read returns
+ * as soon as the key that completes it is down.
+ */
+static void kbd_bottom_half(void)
+{
+  while(keyboard_raw_available()) {
+    unsigned char c;
+    if(process_raw_ctx(keyboard_raw_pop(), &g_kbd, &c))
+      kbd_input_byte(c);
+    while(out_pend_take(&c))
+      kbd_input_byte(c);
   }
-  return filled;
 }
 
-bool kbd_select_read_ready(const proc_t *p)
+/* Switch the discipline to @p t, keeping what was typed under the old mode. */
+static void kbd_set_mode(const k_termios_t *t)
+{
+  bool was = kbd_canon();
+  kbd_tio  = *t;
+  bool now = kbd_canon();
+
+  if(was && !now) {
+    /* Half-edited line and unread lines become plain input. */
+    for(u32 i = 0; i < kbd_edit_len; i++)
+      kbd_in_push((unsigned char)kbd_edit[i]);
+    kbd_edit_len = 0;
+    kbd_lines_r  = kbd_lines_w;
+  } else if(!was && now && kbd_in_avail()) {
+    /* Raw typeahead is readable as one line. */
+    kbd_line_mark();
+  }
+}
+
+static bool kbd_input_ready(void)
+{
+  return kbd_canon() ? kbd_lines_r != kbd_lines_w : kbd_in_avail() != 0;
+}
+
+static u64 kbd_take(char *buf, u64 count)
+{
+  u64 n = kbd_in_avail();
+  if(n > count)
+    n = count;
+  for(u64 i = 0; i < n; i++)
+    buf[i] = (char)kbd_in[kbd_in_r++ % KBD_INPUT_CAP];
+  return n;
+}
+
+/* Sleep until the next keyboard interrupt; @c -EINTR on a signal. */
+static i64 kbd_sleep(void)
+{
+  cpu_disable_interrupts();
+  return keyboard_wait();
+}
+
+static u64 kbd_read(const k_termios_t *t, char *buf, u64 count)
+{
+  if(count == 0)
+    return 0;
+  kbd_set_mode(t);
+
+  if(kbd_canon()) {
+    while(kbd_lines_r == kbd_lines_w) {
+      i64 r = kbd_sleep();
+      if(r < 0)
+        return (u64)r;
+    }
+    /* At most the rest of the first line. */
+    u32 end  = kbd_line_end[kbd_lines_r % KBD_LINES_MAX];
+    u32 left = end - kbd_in_r;
+    u64 n    = kbd_take(buf, count < left ? count : left);
+    if(kbd_in_r == end)
+      kbd_lines_r++;
+    return n;
+  }
+
+  /* Non-canonical: wait for VMIN bytes (one if VMIN is 0 and VTIME is
+   * set; VTIME is otherwise ignored), then take what is there. */
+  u8  vmin  = t->c_cc[KTERM_VMIN];
+  u8  vtime = t->c_cc[KTERM_VTIME];
+  u64 need  = vmin ? vmin : vtime ? 1u : 0u;
+  if(need > count)
+    need = count;
+  while(kbd_in_avail() < need) {
+    i64 r = kbd_sleep();
+    if(r < 0)
+      return (u64)r;
+  }
+  return kbd_take(buf, count);
+}
+
+void kbd_init(void)
+{
+  ktermios_init_default(&kbd_tio);
+  keyboard_set_bottom_half(kbd_bottom_half);
+}
+
+u64 kbd_read_for_process(proc_t *p, char *buf, u64 count)
 {
   if(!p)
-    return kbd_raw_pending();
-  /* ICANON: line complete is the ideal condition, but our discipline runs
-   * inside read() rather than at IRQ time.  Fall through to kbd_raw_pending()
-   * so select() does not deadlock when the ready buffer is still empty. */
-  if((p->termios.c_lflag & KTERM_ICANON) != 0)
-    return p->kbd_ready_len > 0 || kbd_raw_pending();
-  return kbd_raw_pending();
+    return 0;
+  return kbd_read(&p->termios, buf, count);
+}
+
+bool kbd_select_read_ready(const proc_t *p)
+{
+  if(p)
+    kbd_set_mode(&p->termios);
+  return kbd_input_ready();
 }
 
 u64 kbd_read_translated(char *buf, u64 count)
@@ -776,31 +774,21 @@ u64 kbd_read_translated(char *buf, u64 count)
   if(p)
     return kbd_read_for_process(p, buf, count);
 
-  static proc_t boot_stub;
-  static int    boot_inited;
+  static k_termios_t boot_tio;
+  static int         boot_inited;
   if(!boot_inited) {
-    ktermios_init_default(&boot_stub.termios);
-    boot_stub.kbd_edit_len  = 0;
-    boot_stub.kbd_ready_len = 0;
-    boot_inited             = 1;
+    ktermios_init_default(&boot_tio);
+    boot_inited = 1;
   }
-  return kbd_read_for_process(&boot_stub, buf, count);
+  return kbd_read(&boot_tio, buf, count);
 }
 
 /**
- * @brief True when fd 0 read(2) can return without blocking for a new IRQ
- *        (pending CSI/user byte), not merely when key-up scancodes sit in the
- *        raw queue — otherwise select(2) would wake and read would block.
+ * @brief True when fd 0 read(2) would return without blocking: a whole line
+ *        is queued in canonical mode, any byte otherwise. Translation
+ *        happens at IRQ time, so key-up scancodes never count.
  */
 bool kbd_raw_pending(void)
 {
-  if(out_pend_r != out_pend_w)
-    return true;
-  if(!keyboard_raw_available())
-    return false;
-  u8  peek[KBD_RAW_PEEK_MAX];
-  u32 n = keyboard_raw_peek(peek, (u32)sizeof(peek));
-  if(n == 0)
-    return false;
-  return kbd_peek_would_emit(peek, n, g_kbd);
+  return kbd_input_ready();
 }
@@ -2,34 +2,54 @@
  * @file src/kernel/main.c
  * @brief Kernel entry point and bring-up sequence.
  *
- * Typical order: console → PMM (Limine map) → VMM (HHDM) → GDT/IDT → PIC/PIT →
- * kernel heap → ATA disk → ext2 volume on `/` → VFS → keyboard → syscall MSRs →
- * scheduler → first user program (shell or binary from module).
+ * Typical order: console → PMM (Limine map) → VMM (HHDM) → GDT/IDT → APs →
+ * PIC/PIT → kernel heap → ATA disk → ext2 volume on `/` → VFS → page cache →
+ * keyboard → syscall MSRs → scheduler → first user program (shell or binary
+ * from module).
+ *
+ * With a cpio initramfs among the modules, `/` is ramfs holding its files
+ * and the ext2 volume is mounted over it by a kernel task, so the first
+ * program starts without waiting for the disk.
  */
 
+#include <alcor2/arch/acpi.h>
 #include <alcor2/arch/cpu.h>
 #include <alcor2/arch/gdt.h>
+#include <alcor2/arch/idle.h>
 #include <alcor2/arch/idt.h>
 #include <alcor2/arch/pic.h>
 #include <alcor2/arch/pit.h>
+#include <alcor2/arch/pmu.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/bench.h>
 #include <alcor2/drivers/ata.h>
 #include <alcor2/drivers/console.h>
 #include <alcor2/drivers/fb_console.h>
 #include <alcor2/drivers/fb_user.h>
 #include <alcor2/drivers/keyboard.h>
+#include <alcor2/drivers/pci.h>
+#include <alcor2/drivers/serial.h>
+#include <alcor2/drivers/virtio_net.h>
 #include <alcor2/fs/ext2.h>
+#include <alcor2/fs/initramfs.h>
+#include <alcor2/fs/pagecache.h>
+#include <alcor2/fs/procfs.h>
+#include <alcor2/fs/ramfs.h>
 #include <alcor2/fs/vfs.h>
+#include <alcor2/kbd.h>
+#include <alcor2/kstdlib.h>
 #include <alcor2/limine.h>
 #include <alcor2/mm/heap.h>
 #include <alcor2/mm/pmm.h>
+#include <alcor2/mm/swap.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/elf.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/proc/vdso.h>
 #include <alcor2/sys/syscall.h>
+#include <alcor2/time.h>
 #include <alcor2/types.h>
 
-extern void ramfs_init(void);
-
 LIMINE_BASE_REVISION(3)
 LIMINE_REQUESTS_START
 
@@ -57,6 +77,25 @@ USED SECTION(".limine_requests"
     .revision = 0,
 };
 
+USED SECTION(".limine_requests"
+) static volatile struct limine_smp_request smp_request = {
+    .id       = LIMINE_SMP_REQUEST_ID,
+    .revision = 0,
+    .flags    = 0,
+};
+
+USED SECTION(".limine_requests"
+) static volatile struct limine_executable_file_request kernel_file_request = {
+    .id       = LIMINE_EXECUTABLE_FILE_REQUEST_ID,
+    .revision = 0,
+};
+
+USED SECTION(".limine_requests"
+) static volatile struct limine_rsdp_request rsdp_request = {
+    .id       = LIMINE_RSDP_REQUEST_ID,
+    .revision = 0,
+};
+
 LIMINE_REQUESTS_END
 
 /** @brief Print boot banner. */
@@ -84,6 +123,9 @@ static void init_early(
     const struct limine_hhdm_response *hhdm
 )
 {
+  kstdlib_init();
+  serial_init();
+
   /* Console */
   console_init(fb->address, fb->width, fb->height, fb->pitch, fb->bpp);
   console_set_theme((console_theme_t) {
@@ -109,6 +151,8 @@ static void init_early(
   console_print("VMM initialized.\n");
 
   fb_user_boot_init(fb, memmap, hhdm->offset);
+  void *pixels = fb_user_ready() ? fb_user_pixels() : fb->address;
+  console_set_framebuffer(pixels);
 
   heap_init();
   ramfs_init();
@@ -116,30 +160,120 @@ static void init_early(
   /* fb_console takes over the framebuffer with cell-grid + ANSI/CSI parsing.
    * Allocates via kmalloc, so it must run after heap_init. Falls back to the
    * boot logger if allocation fails. */
-  if(!fb_console_init(fb->address, fb->width, fb->height, fb->pitch, fb->bpp))
+  if(!fb_console_init(pixels, fb->width, fb->height, fb->pitch, fb->bpp))
     console_print("[fb_console] init failed; staying on boot logger.\n");
 }
 
+/**
+ * @brief First boot module that is (@p cpio true) or is not a cpio archive.
+ */
+static struct limine_file *find_module(bool cpio)
+{
+  const struct limine_module_response *r = module_request.response;
+  for(u64 i = 0; r && i < r->module_count; i++) {
+    struct limine_file *m = r->modules[i];
+    if(initramfs_is_cpio(m->address, m->size) == cpio)
+      return m;
+  }
+  return NULL;
+}
+
 /**
  * @brief Launch first user process from boot modules.
  */
 static void launch_init(void)
 {
-  if(!module_request.response || module_request.response->module_count == 0) {
+  struct limine_file *mod = find_module(false);
+  if(!mod) {
     console_print("[KERNEL] No modules found, halting.\n");
     return;
   }
 
-  struct limine_file *mod = module_request.response->modules[0];
   console_printf(
       "[KERNEL] Loading: %s (%lu bytes)\n", mod->path, (u64)mod->size
   );
 
-  /* proc_start_first jumps to ring 3 and never comes back. */
+  /* proc_start_first lets the APs go and idles; it never comes back. */
   const char *ep = (mod->path && mod->path[0]) ? mod->path : "/boot/shell.elf";
   proc_start_first(mod->address, mod->size, "shell", ep);
 }
 
+/**
+ * @brief Whether @p word is one of the space-separated words of the kernel
+ *        command line (the @c cmdline: entry of limine.conf).
+ */
+static bool cmdline_has(const char *word)
+{
+  if(!kernel_file_request.response)
+    return false;
+  const char *s = kernel_file_request.response->executable_file->cmdline;
+  u64         n = kstrlen(word);
+  while(s && *s) {
+    while(*s == ' ')
+      s++;
+    const char *end = s;
+    while(*end && *end != ' ')
+      end++;
+    if((u64)(end - s) == n && kstrncmp(s, word, n) == 0)
+      return true;
+    s = end;
+  }
+  return false;
+}
+
+/** @brief Steps timed for the boot summary. */
+#define BOOT_TIMES 24
+
+/** @brief Width of the step names in the boot summary. */
+#define BOOT_NAME_W 20
+
+/** @brief One timed boot step. */
+typedef struct
+{
+  const char *name;
+  u64         cycles; /**< TSC ticks it took. */
+} boot_time_t;
+
+static boot_time_t boot_times[BOOT_TIMES];
+static u32         boot_ntimes;
+static u64         boot_entry_tsc; /**< TSC at kmain, 0 without a TSC. */
+static u64         boot_last_tsc;
+
+/** @brief End the step @p name: charge it the TSC ticks since the last. */
+static void boot_time_mark(const char *name)
+{
+  u64 now = boot_entry_tsc ? cpu_rdtsc() : 0;
+  if(boot_ntimes < BOOT_TIMES)
+    boot_times[boot_ntimes++] = (boot_time_t) {name, now - boot_last_tsc};
+  boot_last_tsc = now;
+}
+
+/** @brief Print "[BOOT] @p name <padding> N us" for @p cycles TSC ticks. */
+static void boot_time_line(const char *name, u64 cycles, u64 hz)
+{
+  console_printf("[BOOT] %s", name);
+  for(u64 n = kstrlen(name); n < BOOT_NAME_W; n++)
+    console_putchar(' ');
+  console_printf("%u us\n", (u32)(cycles * 1000000 / hz));
+}
+
+/**
+ * @brief Print how long each boot step took, once the TSC is calibrated.
+ *
+ * "Before kernel" is the TSC at kernel entry: the time since the CPU came
+ * out of reset, spent in the firmware and the bootloader.
+ */
+static void boot_time_summary(void)
+{
+  u64 hz = time_tsc_hz();
+  if(!hz || !boot_entry_tsc)
+    return;
+  boot_time_line("Before kernel", boot_entry_tsc, hz);
+  for(u32 i = 0; i < boot_ntimes; i++)
+    boot_time_line(boot_times[i].name, boot_times[i].cycles, hz);
+  boot_time_line("Kernel total", boot_last_tsc - boot_entry_tsc, hz);
+}
+
 /** @brief Represents a single phase of the kernel boot process. */
 typedef struct
 {
@@ -147,6 +281,14 @@ typedef struct
   void        (*init)(void); /**< Phase-specific initialization function */
 } boot_phase_t;
 
+/**
+ * @brief Start the application processors; they wait for the first process.
+ */
+static void init_smp(void)
+{
+  smp_init(smp_request.response);
+}
+
 /**
  * @brief Initialize interrupt controllers and drivers.
  */
@@ -154,28 +296,51 @@ static void init_interrupts(void)
 {
   pic_init();
   pit_init(100);
+  time_init();
   pic_unmask(IRQ_TIMER);
   pit_enable_sched();
   console_print("PIC/PIT initialized (100Hz).\n");
 
+  kbd_init();
   keyboard_init();
   console_print("Keyboard initialized.\n");
 }
 
 /**
- * @brief Initialize storage and filesystems.
+ * @brief Read the ACPI tables and take the PCI inventory.
  */
-static void init_storage(void)
+static void init_pci(void)
 {
-  ata_init();
-  ext2_init();
+  acpi_init(rsdp_request.response);
+  pci_init();
+}
+
+/** @brief The initramfs holds `/` until init_disk_mount's task is done. */
+static bool root_deferred;
+
+/**
+ * @brief Give shm_open() its directory on whatever now holds `/dev`.
+ *
+ * musl keeps POSIX shared memory objects as files in /dev/shm; on ramfs
+ * their pages are the file, so every MAP_SHARED mapping shares them.
+ */
+static void make_shm_dir(void)
+{
+  vfs_mkdir("/dev");
+  vfs_mkdir("/dev/shm");
+}
 
-  /* Mount root filesystem */
+/**
+ * @brief Mount the first disk's ext2 volume on `/`, over an initramfs.
+ */
+static void mount_disk(void)
+{
   const ata_drive_t *hda = ata_get_drive(0);
   if(hda && hda->present) {
     if(vfs_mount("/dev/hda", "/", "ext2") == 0) {
       console_print("[INIT] Mounted /dev/hda (ext2) on /\n");
       vfs_mount(NULL, "/dev", "ramfs");
+      make_shm_dir();
     } else {
       console_print("[INIT] Failed to mount ext2 - falling back to ramfs\n");
     }
@@ -184,6 +349,61 @@ static void init_storage(void)
   }
 }
 
+/**
+ * @brief Unpack the initramfs, if Limine loaded one, and mount it on `/`.
+ * @return Whether there was one.
+ */
+static bool mount_initramfs(void)
+{
+  const struct limine_file *mod = find_module(true);
+  if(!mod)
+    return false;
+
+  i64 n = initramfs_unpack(mod->address, mod->size);
+  if(n < 0)
+    console_print("[INIT] initramfs is damaged; keeping what unpacked\n");
+  vfs_mount(NULL, "/", "ramfs");
+  console_printf(
+      "[INIT] Unpacked initramfs (%lu bytes) on /\n", (u64)mod->size
+  );
+  return true;
+}
+
+/**
+ * @brief Initialize storage and filesystems.
+ */
+static void init_storage(void)
+{
+  ata_init();
+  ext2_init();
+  procfs_init();
+
+  root_deferred = mount_initramfs();
+  if(!root_deferred)
+    mount_disk();
+  vfs_mount(NULL, "/proc", "proc");
+  make_shm_dir();
+}
+
+/**
+ * @brief With an initramfs on `/`, mount the disk from a kernel task; it
+ *        sleeps on the disk while the first program runs.
+ */
+static void init_disk_mount(void)
+{
+  if(root_deferred && !proc_create_kernel("mount", mount_disk))
+    mount_disk();
+}
+
+/**
+ * @brief Bring up the network interface, if there is one.
+ */
+static void init_network(void)
+{
+  if(!virtio_net_init())
+    console_print("[INIT] No network device\n");
+}
+
 /**
  * @brief Enable interrupts and log the event.
  */
@@ -198,12 +418,21 @@ static const boot_phase_t boot_sequence[] = {
     {"GDT Structure",       gdt_init        },
     {"IDT Structure",       idt_init        },
     {"SSE/FPU Support",     cpu_enable_sse  },
+    {"Perf Counters",       pmu_init        },
+    {"CPU Idle",            cpu_idle_init   },
+    {"Secondary CPUs",      init_smp        },
     {"Syscall Interface",   syscall_init    },
     {"PIC/PIT Timers",      pic_init        },
     {"Hardware Interrupts", init_interrupts },
+    {"ACPI & PCI",          init_pci        },
     {"VFS Orchestrator",    vfs_init        },
+    {"Page Cache",          pcache_init     },
     {"Storage & VFS",       init_storage    },
+    {"Network",             init_network    },
     {"Process Table",       proc_init       },
+    {"Disk Mount",          init_disk_mount },
+    {"Swap",                swap_init       },
+    {"vDSO",                vdso_init       },
     {"Global Interrupts",   init_enable_irqs},
     {NULL,                  NULL            }
 };
@@ -213,6 +442,11 @@ static const boot_phase_t boot_sequence[] = {
  */
 void kmain(void)
 {
+  /* Before anything asks which CPU it runs on (the VMM, the GDT). */
+  smp_init_bsp();
+  boot_entry_tsc = time_boot_stamp();
+  boot_last_tsc  = boot_entry_tsc;
+
   /* Validate bootloader response */
   if(!LIMINE_BASE_REVISION_OK || !fb_request.response ||
      fb_request.response->framebuffer_count < 1 || !memmap_request.response ||
@@ -225,13 +459,20 @@ void kmain(void)
       fb_request.response->framebuffers[0], memmap_request.response,
       hhdm_request.response
   );
+  boot_time_mark("Console & Memory");
 
   /* Execute boot sequence table */
   for(const boot_phase_t *p = boot_sequence; p->init; p++) {
     p->init();
     if(p->name)
       console_printf("[INIT] %s initialized.\n", p->name);
+    boot_time_mark(p->name ? p->name : "(unnamed)");
   }
+  boot_time_summary();
+
+  /* Baseline numbers for the core paths, before anything else runs. */
+  if(cmdline_has("bench"))
+    bench_run();
 
   /* Launch the init process from boot module 0. */
   launch_init();
@@ -0,0 +1,76 @@
+/**
+ * @file src/kernel/process/mutex.c
+ * @brief Sleeping locks.
+ */
+
+#include <alcor2/drivers/console.h>
+#include <alcor2/proc/mutex.h>
+#include <alcor2/proc/proc.h>
+
+void mutex_init(mutex_t *m, const char *name)
+{
+  spin_init(&m->lock, name, LOCK_CLASS_MUTEX);
+  m->locked = false;
+  m->owner  = NULL;
+  wait_queue_init(&m->waiters);
+}
+
+/** @brief Wait for @p m to be free and take it; @c m->lock is held. */
+static void mutex_acquire(mutex_t *m)
+{
+  /* A signal only ends one sleep; the lock is still wanted. */
+  while(m->locked)
+    wait_sleep_locked(&m->waiters, &m->lock, 0, 0, ~0U, 0);
+  m->locked = true;
+  m->owner  = proc_current();
+}
+
+/** @brief Give @p m up and wake one waiter; @c m->lock is held. */
+static void mutex_release(mutex_t *m)
+{
+  if(!m->locked)
+    console_printf("[MUTEX] %s: unlock while not locked\n", m->lock.name);
+  m->locked = false;
+  m->owner  = NULL;
+  wait_wake_one(&m->waiters);
+}
+
+void mutex_lock(mutex_t *m)
+{
+  spin_might_sleep();
+  u64 flags = spin_lock_irqsave(&m->lock);
+  if(m->locked && m->owner && m->owner == proc_current())
+    console_printf("[MUTEX] %s: recursive lock\n", m->lock.name);
+  mutex_acquire(m);
+  spin_unlock_irqrestore(&m->lock, flags);
+}
+
+bool mutex_trylock(mutex_t *m)
+{
+  u64  flags = spin_lock_irqsave(&m->lock);
+  bool got   = !m->locked;
+  if(got) {
+    m->locked = true;
+    m->owner  = proc_current();
+  }
+  spin_unlock_irqrestore(&m->lock, flags);
+  return got;
+}
+
+void mutex_unlock(mutex_t *m)
+{
+  u64 flags = spin_lock_irqsave(&m->lock);
+  mutex_release(m);
+  spin_unlock_irqrestore(&m->lock, flags);
+}
+
+i64 mutex_sleep(mutex_t *m, wait_queue_t *wq)
+{
+  u64 flags = spin_lock_irqsave(&m->lock);
+  mutex_release(m);
+  /* Queued on @p wq before m->lock is dropped. */
+  i64 r = wait_sleep_locked(wq, &m->lock, 0, 0, ~0U, 0);
+  mutex_acquire(m);
+  spin_unlock_irqrestore(&m->lock, flags);
+  return r;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file src/kernel/process/pid.c
+ * @brief PID bitmap and PID hash.
+ */
+
+#include <alcor2/proc/pid.h>
+#include <alcor2/proc/proc.h>
+
+/** @brief Buckets in the PID hash; a power of two. */
+#define PID_HASH_SIZE 256
+
+/** @brief Bit set = PID in use. PID 0 is never handed out. */
+static u64     pid_map[PID_MAX / 64] = {1};
+/** @brief Last PID handed out; the search for the next one starts after it. */
+static u64     pid_last;
+static proc_t *pid_hash[PID_HASH_SIZE];
+
+u64 pid_alloc(void)
+{
+  u64 pid = pid_last;
+  for(u64 n = 0; n < PID_MAX; n++) {
+    pid = (pid + 1) % PID_MAX;
+    u64 *word = &pid_map[pid / 64];
+    /* Skip a full word at once. */
+    if(*word == ~0ULL) {
+      n += 63 - pid % 64;
+      pid |= 63;
+      continue;
+    }
+    if(!(*word & (1ULL << (pid % 64)))) {
+      *word |= 1ULL << (pid % 64);
+      pid_last = pid;
+      return pid;
+    }
+  }
+  return 0;
+}
+
+void pid_free(u64 pid)
+{
+  if(pid && pid < PID_MAX)
+    pid_map[pid / 64] &= ~(1ULL << (pid % 64));
+}
+
+void pid_hash_add(proc_t *p)
+{
+  proc_t **head = &pid_hash[p->pid % PID_HASH_SIZE];
+  p->pid_next   = *head;
+  *head         = p;
+}
+
+void pid_hash_remove(proc_t *p)
+{
+  proc_t **link = &pid_hash[p->pid % PID_HASH_SIZE];
+  while(*link && *link != p)
+    link = &(*link)->pid_next;
+  if(*link)
+    *link = p->pid_next;
+  p->pid_next = NULL;
+}
+
+proc_t *pid_lookup(u64 pid)
+{
+  for(proc_t *p = pid_hash[pid % PID_HASH_SIZE]; p; p = p->pid_next) {
+    if(p->pid == pid)
+      return p;
+  }
+  return NULL;
+}
@@ -5,6 +5,7 @@
 section .text
 global proc_enter_first_time
 global proc_fork_child_entry
+extern kernel_unlock
 
 ;;
 ;; proc_enter_first_time
@@ -12,6 +13,8 @@ global proc_fork_child_entry
 ;; Called after context_switch to a new process.
 ;; The kernel stack has an iretq frame ready.
 ;; CR3 has already been switched by proc_switch before context_switch.
+;; Interrupts are still off from proc_switch; the kernel lock is dropped
+;; here, as on every way back to ring 3.
 ;;
 proc_enter_first_time:
     ;; Set user data segments. Skip FS/GS: in long mode, loading a segment
@@ -23,9 +26,17 @@ proc_enter_first_time:
     mov ds, ax
     mov es, ax
 
+    ;; The iretq frame leaves RSP 8 off 16-byte alignment.
+    mov rbp, rsp
+    and rsp, -16
+    call kernel_unlock
+    mov rsp, rbp
+    xor ebp, ebp
+
     ;; Enable interrupts will happen via iretq (RFLAGS has IF)
 
     ;; iretq frame is already on stack from proc_create
+    swapgs
     iretq
 
 ;;
@@ -50,6 +61,7 @@ proc_fork_child_entry:
     
     ;; Disable interrupts before restoring (will be re-enabled by sysret)
     cli
+    call kernel_unlock
     
     ;; Restore registers from syscall_frame_t (same as syscall_entry return)
     pop r15
@@ -72,6 +84,7 @@ proc_fork_child_entry:
     pop rsp                 ; user RSP
     
     ;; Return to Ring 3
+    swapgs
     o64 sysret
 
 section .note.GNU-stack noalloc noexec nowrite progbits
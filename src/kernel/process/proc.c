@@ -4,9 +4,14 @@
  */
 
 #include <alcor2/arch/cpu.h>
+#include <alcor2/arch/fpu.h>
 #include <alcor2/arch/gdt.h>
+#include <alcor2/arch/idle.h>
+#include <alcor2/arch/pit.h>
+#include <alcor2/arch/smp.h>
 #include <alcor2/drivers/console.h>
 #include <alcor2/errno.h>
+#include <alcor2/fs/procfs.h>
 #include <alcor2/fs/vfs.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/ktermios.h>
@@ -15,9 +20,17 @@
 #include <alcor2/mm/pmm.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/elf.h>
+#include <alcor2/proc/pid.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/proc/sched.h>
 #include <alcor2/proc/signal.h>
+#include <alcor2/proc/vdso.h>
+#include <alcor2/sys/perf.h>
 #include <alcor2/sys/syscall.h>
+#include <alcor2/sys/systrace.h>
+#include <alcor2/sys/trace.h>
+#include <alcor2/time.h>
+#include <alcor2/timer.h>
 
 /** @brief POSIX @c clone flag: parent blocks until child @c execve or @c _exit.
  * musl @c posix_spawn relies on this so the parent does not run concurrently
@@ -25,150 +38,313 @@
  * deadlocks).
  */
 #define ALCOR_CLONE_VFORK 0x00004000u
-
-static proc_t  proc_table[PROC_MAX];
-static proc_t *current_proc = NULL;
-static u64     next_pid     = 1;
-/** @brief Set by proc_tick; syscall exit runs proc_schedule when true. */
-static volatile bool need_resched = false;
-
-/** @brief Current kernel stack for syscall entry. */
-u64 current_kernel_rsp = 0;
-/** @brief Current process CR3 for address space switching. */
-u64 current_proc_cr3 = 0;
+/** @brief With ALCOR_CLONE_VFORK: run the child on the parent's memory. */
+#define ALCOR_CLONE_VM    0x00000100u
+
+/** @brief Every published process, including zombies; see proc_publish. */
+static proc_t *proc_list;
+/** @brief Zombies whose parent exited first; proc_alloc reaps them. */
+static proc_t *orphans;
+/** @brief Slab cache of proc_t. */
+static kmem_cache_t *proc_cache;
+/** @brief Slab cache of PROC_KERNEL_STACK-sized kernel stacks. */
+static kmem_cache_t *kstack_cache;
 
 /**
  * @brief Initialize the process subsystem.
  *
- * Clears the process table and sets all process slots to FREE state.
+ * Creates the process and kernel stack caches.
  */
 void proc_init(void)
 {
-  /* Clear process table */
-  for(int i = 0; i < PROC_MAX; i++) {
-    proc_table[i].state = PROC_STATE_FREE;
-    proc_table[i].pid   = 0;
+  proc_cache   = kmem_cache_create("proc", sizeof(proc_t), NULL);
+  kstack_cache = kmem_cache_create("kstack", PROC_KERNEL_STACK, NULL);
+}
+
+void proc_wake(proc_t *p)
+{
+  if(p->state != PROC_STATE_BLOCKED)
+    return;
+  /* Back on the CPU it last ran on, whose caches and FPU may still hold
+   * its state; if that one is busy, an idle one can steal it. */
+  cpu_t *cpu = smp_cpu(p->cpu);
+  if(sched_wakeup(p, cpu->proc)) {
+    cpu->need_resched = true;
+    smp_kick(cpu);
+  } else {
+    smp_kick(cpu->idle ? cpu : smp_idle_cpu());
   }
 }
 
+/* Queue a new process; an idle CPU, if any, takes it. */
+static void proc_run_new(proc_t *p)
+{
+  sched_enqueue(p);
+  smp_kick(smp_idle_cpu());
+}
+
 /**
  * @brief Get the currently running process.
  * @return Pointer to current process, or NULL if none.
  */
 proc_t *proc_current(void)
 {
-  return current_proc;
+  return cpu_this()->proc;
 }
 
 /**
- * @brief FXSAVE area filled at boot after FPU init — baseline for future
- *        per-process FPU on fork/switch (see cpu_enable_sse).
+ * @brief Get process by PID.
+ * @param pid Process ID to find.
+ * @return Pointer to process, or NULL if not found.
  */
-static u8 g_default_fpu_state[512] __attribute__((aligned(16)));
+proc_t *proc_get(u64 pid)
+{
+  return pid_lookup(pid);
+}
 
-void      proc_capture_default_fpu(void)
+proc_t *proc_list_head(void)
 {
-  __asm__ volatile("fxsave (%0)" ::"r"(g_default_fpu_state) : "memory");
+  return proc_list;
+}
+
+/* Raise @p p's peak RSS to what it has resident; borrowed memory is not its
+ * own. */
+static void usage_note_rss(proc_t *p)
+{
+  if(p->vm_borrowed || !p->cr3)
+    return;
+  u64 pages = vmm_user_pages(p->cr3);
+  if(pages > p->usage.maxrss)
+    p->usage.maxrss = pages;
+}
+
+/* Fold @p src into @p dst: counters add up, the peak is the larger. */
+static void usage_add(proc_usage_t *dst, const proc_usage_t *src)
+{
+  dst->runtime += src->runtime;
+  dst->stime   += src->stime;
+  dst->minflt  += src->minflt;
+  dst->majflt  += src->majflt;
+  dst->nvcsw   += src->nvcsw;
+  dst->nivcsw  += src->nivcsw;
+  dst->inblock += src->inblock;
+  dst->oublock += src->oublock;
+  if(src->maxrss > dst->maxrss)
+    dst->maxrss = src->maxrss;
+}
+
+void proc_usage(proc_t *p, proc_usage_t *out)
+{
+  if(p->state != PROC_STATE_ZOMBIE)
+    usage_note_rss(p);
+  *out    = p->usage;
+  u64 now = time_monotonic_ns();
+  if(p->state == PROC_STATE_RUNNING && now > p->exec_start)
+    out->runtime += now - p->exec_start;
+}
+
+void proc_signal_broadcast(int signum)
+{
+  for(proc_t *p = proc_list; p; p = p->all_next) {
+    if(p->state != PROC_STATE_ZOMBIE)
+      proc_signal(p->pid, signum);
+  }
+}
+
+/** @brief Push @p p on the sibling list at @p head. */
+static void sibling_push(proc_t **head, proc_t *p)
+{
+  p->sibling_prev = NULL;
+  p->sibling_next = *head;
+  if(*head)
+    (*head)->sibling_prev = p;
+  *head = p;
+}
+
+/** @brief Take @p p off the sibling list at @p head. */
+static void sibling_remove(proc_t **head, proc_t *p)
+{
+  if(p->sibling_prev)
+    p->sibling_prev->sibling_next = p->sibling_next;
+  else if(*head == p)
+    *head = p->sibling_next;
+  if(p->sibling_next)
+    p->sibling_next->sibling_prev = p->sibling_prev;
+  p->sibling_prev = NULL;
+  p->sibling_next = NULL;
 }
 
 /**
- * @brief Map a live proc_t* to its fixed slot in proc_table.
+ * @brief Free a zombie: its address space, kernel stack, PID and proc_t.
+ *
+ * @p p must not be the process whose kernel stack is in use.
  */
-int proc_table_index(const proc_t *p)
+static void proc_reap(proc_t *p)
 {
-  if(!p)
-    return -1;
-  for(unsigned i = 0; i < PROC_MAX; i++) {
-    if(&proc_table[i] == p)
-      return (int)i;
+  proc_t *parent = proc_get(p->parent_pid);
+  sibling_remove(parent ? &parent->children : &orphans, p);
+  if(parent) {
+    usage_add(&parent->cusage, &p->usage);
+    usage_add(&parent->cusage, &p->cusage);
   }
-  return -1;
+
+  pid_hash_remove(p);
+  if(p->all_prev)
+    p->all_prev->all_next = p->all_next;
+  else
+    proc_list = p->all_next;
+  if(p->all_next)
+    p->all_next->all_prev = p->all_prev;
+
+  if(!p->vm_borrowed)
+    vmm_destroy_user_mappings(p->cr3);
+  vma_list_free(&p->vmas);
+  kmem_cache_free(kstack_cache, p->kernel_stack);
+  pid_free(p->pid);
+  kmem_cache_free(proc_cache, p);
 }
 
 /**
- * @brief Get process by PID.
- * @param pid Process ID to find.
- * @return Pointer to process, or NULL if not found.
+ * @brief Lend @p parent's memory to its vfork child @p child.
+ *
+ * The page tables are shared; the region list and breaks move to the
+ * child, as the parent does not run until ::proc_vm_return.
  */
-proc_t *proc_get(u64 pid)
+static void proc_vm_lend(proc_t *child, proc_t *parent)
 {
-  for(int i = 0; i < PROC_MAX; i++) {
-    if(proc_table[i].pid == pid && proc_table[i].state != PROC_STATE_FREE) {
-      return &proc_table[i];
-    }
-  }
-  return NULL;
+  child->cr3           = parent->cr3;
+  child->vm_borrowed   = true;
+  child->vmas          = parent->vmas;
+  child->program_break = parent->program_break;
+  child->heap_break    = parent->heap_break;
+  child->mmap_base     = parent->mmap_base;
+  kzero(&parent->vmas, sizeof(parent->vmas));
 }
 
-void proc_signal_broadcast(int signum)
+/** @brief Hand a vfork child's borrowed memory back, changes included. */
+static void proc_vm_return(proc_t *child)
 {
-  for(int i = 0; i < PROC_MAX; i++) {
-    proc_t *p = &proc_table[i];
-    if(p->state == PROC_STATE_FREE || p->state == PROC_STATE_ZOMBIE)
-      continue;
-    proc_signal(p->pid, signum);
+  proc_t *parent = proc_get(child->parent_pid);
+  if(!parent) {
+    /* Nobody to give it to: the address space is the child's now. */
+    child->vm_borrowed = false;
+    return;
   }
+  parent->vmas          = child->vmas;
+  parent->program_break = child->program_break;
+  parent->heap_break    = child->heap_break;
+  parent->mmap_base     = child->mmap_base;
+  kzero(&child->vmas, sizeof(child->vmas));
 }
 
 /**
- * @brief Allocate a free process slot from the process table.
+ * @brief Allocate a blank process with a fresh PID.
  *
- * The slot is fully zeroed before any non-zero defaults are installed.
+ * The process is fully zeroed before any non-zero defaults are installed.
  * Going through @c kzero rather than field-by-field resets means a stale
- * @c sig_actions handler, @c sig_pending bit, etc. from a previously
- * reaped occupant cannot survive into the new process — and any future
- * field added to @c proc_t inherits the right "blank" default for free.
+ * @c sig_actions handler, @c sig_pending bit, etc. from a previous
+ * occupant of the memory cannot survive into the new process — and any
+ * future field added to @c proc_t inherits the right "blank" default for
+ * free.
  *
- * @return Pointer to free process slot, or NULL if table is full.
+ * Orphaned zombies are reaped first; by now none of them can still be
+ * running on its own kernel stack.
+ *
+ * @return New process, not yet visible to proc_get, or NULL if memory or
+ *         PIDs are exhausted.
  */
 static proc_t *proc_alloc(void)
 {
-  for(int i = 0; i < PROC_MAX; i++) {
-    proc_t *p = &proc_table[i];
-    if(p->state != PROC_STATE_FREE)
-      continue;
+  while(orphans)
+    proc_reap(orphans);
 
-    kzero(p, sizeof *p);
+  proc_t *p = kmem_cache_alloc(proc_cache);
+  if(!p)
+    return NULL;
+  kzero(p, sizeof *p);
+  p->pid = pid_alloc();
+  if(!p->pid) {
+    kmem_cache_free(proc_cache, p);
+    return NULL;
+  }
 
-    /* Re-establish the few fields that are not zero-valued in their fresh
-     * state. Everything else (signal actions / mask / pending, exit_code,
-     * fs_base, fd_cloexec, kbd_*_len, ...) is correctly zero from kzero. */
-    vfs_proc_init_fds(p->fds);
-    kstrncpy(p->cwd, "/", 2);
-    ktermios_init_default(&p->termios);
+  /* Re-establish the few fields that are not zero-valued in their fresh
+   * state. Everything else (signal actions / mask / pending, exit_code,
+   * fs_base, fd_cloexec, ...) is correctly zero from kzero. */
+  vfs_proc_init_fds(p);
+  kstrncpy(p->cwd, "/", 2);
+  ktermios_init_default(&p->termios);
+  p->start_time = time_monotonic_ns();
+  kstat.forks++;
+  return p;
+}
 
-    return p;
-  }
-  return NULL;
+/** @brief Give back a process from proc_alloc that was never published. */
+static void proc_discard(proc_t *p)
+{
+  pid_free(p->pid);
+  kmem_cache_free(proc_cache, p);
+}
+
+/**
+ * @brief Make @p p findable by PID, and a child of @p parent (if any).
+ */
+static void proc_publish(proc_t *p, proc_t *parent)
+{
+  pid_hash_add(p);
+  p->all_prev = NULL;
+  p->all_next = proc_list;
+  if(proc_list)
+    proc_list->all_prev = p;
+  proc_list = p;
+  if(parent)
+    sibling_push(&parent->children, p);
 }
 
 /**
- * @brief Push a string onto user stack and return the new stack pointer.
+ * @brief Pack kernel argv/envp vectors into one block for proc_setup_image.
  *
- * Must be called while in the process's address space.
- * The string is copied with null terminator and the stack pointer is aligned to
- * 8 bytes.
+ * With no @p argv, argv is just @p name. The block is kmalloc'd; the caller
+ * frees @c args->strings.
  *
- * @param sp Current stack pointer.
- * @param str String to push (null-terminated).
- * @return New stack pointer after pushing the string.
+ * @return 0 on success, -E2BIG past PROC_ARG_MAX, -ENOMEM.
  */
-static u64 push_string(u64 sp, const char *str)
+static int proc_args_pack(
+    const char *name, char *const argv[], char *const envp[], proc_args_t *args
+)
 {
-  u64 len = 0;
-  while(str[len])
-    len++;
-  len++; /* Include null terminator */
-
-  sp -= len;
-  sp &= ALIGN_8_MASK; /* Align to 8 bytes */
-
-  char *dst = (char *)sp;
-  for(u64 i = 0; i < len; i++) {
-    dst[i] = str[i];
+  static char *const no_env[] = {NULL};
+  char *const        self[]   = {(char *)name, NULL};
+  if(!argv || !argv[0])
+    argv = self;
+  if(!envp)
+    envp = no_env;
+
+  u64 bytes = 0;
+  u32 n     = 0;
+  for(char *const *v = argv; *v; v++, n++)
+    bytes += kstrlen(*v) + 1;
+  args->argc = n;
+  for(char *const *v = envp; *v; v++, n++)
+    bytes += kstrlen(*v) + 1;
+  args->envc = n - args->argc;
+  if(bytes + (u64)n * sizeof(char *) > PROC_ARG_MAX)
+    return -E2BIG;
+
+  args->strings = kmalloc(bytes);
+  if(!args->strings)
+    return -ENOMEM;
+  args->size = bytes;
+
+  char *dst = args->strings;
+  for(int pass = 0; pass < 2; pass++) {
+    for(char *const *v = pass ? envp : argv; *v; v++) {
+      u64 len = kstrlen(*v) + 1;
+      kmemcpy(dst, *v, len);
+      dst += len;
+    }
   }
-
-  return sp;
+  return 0;
 }
 
 /**
@@ -183,62 +359,12 @@ static u64 push_string(u64 sp, const char *str)
  * @param argv     Null-terminated argument array.
  * @return PID of the new process, or 0 on failure.
  */
-/* Allocate a user stack and load an ELF into @p p's address space, then
- * build the System V AMD64 startup stack (argc / argv / envp / auxv) and
- * populate p->user_*, p->program_break, p->heap_break, p->mmap_base.
- *
- * Caller invariant: @p p->cr3 is allocated and (for execve) the user-space
- * portion has already been cleared.
- *
- * Returns 0 on success, -errno on failure with no partial state left in @p p
- * other than possibly-mapped stack pages (the caller decides how to recover).
- */
-static int proc_setup_image(
-    proc_t *p, const char *name, const void *elf_data, u64 elf_size, i64 elf_fd,
-    char *const argv[], char *const envp[]
-)
+/* Build the System V AMD64 startup stack (argc / argv / envp / auxv) of
+ * @p img from the packed @p args at the top of the user stack, which must
+ * be mapped and writable in the current address space. Returns the new
+ * user sp. */
+static u64 proc_build_stack(const proc_image_t *img, const proc_args_t *args)
 {
-  u64   stack_pages     = (PROC_USER_STACK / 4096) + 1;
-  void *user_stack_phys = pmm_alloc_pages(stack_pages);
-  if(!user_stack_phys)
-    return -ENOMEM;
-
-  u64 user_stack_base = USER_STACK_BASE;
-  u64 stack_top       = USER_STACK_TOP;
-
-  for(u64 off = 0; off < stack_pages * 4096; off += 4096) {
-    vmm_map_in(
-        p->cr3, user_stack_base + off, (u64)user_stack_phys + off,
-        VMM_PRESENT | VMM_WRITE | VMM_USER
-    );
-  }
-  p->user_stack     = (void *)user_stack_base;
-  p->user_stack_top = (void *)stack_top;
-
-  u64 old_cr3 = vmm_get_current_pml4();
-  vmm_switch(p->cr3);
-
-  elf_info_t elf_info;
-  int        elf_result = (elf_fd >= 0) ? elf_load_fd(elf_fd, &elf_info)
-                                        : elf_load(elf_data, elf_size, &elf_info);
-  if(elf_result != 0) {
-    vmm_switch(old_cr3);
-    return -ENOEXEC;
-  }
-
-  /**
-   * Setup argc/argv on user stack according to System V x86-64 ABI.
-   *
-   * Stack layout from high to low addresses:
-   * - argv strings (null-terminated)
-   * - padding for alignment
-   * - NULL (end of argv array)
-   * - argv[argc-1]
-   * - ...
-   * - argv[0]
-   * - argc
-   */
-
   /*
    * Build initial user stack per the System V AMD64 ABI.
    *
@@ -246,34 +372,36 @@ static int proc_setup_image(
    *
    *   sp → [argc]
    *         [argv[0]] ... [argv[argc-1]] [NULL]   ← argv array
-   *         [NULL]                                ← envp array (empty)
+   *         [envp[0]] ... [envp[envc-1]] [NULL]   ← envp array
    *         [AT_type0][AT_val0] ...               ← auxv pairs
    *         [AT_NULL=0][0]                        ← auxv terminator
-   *         <string data>                         ← argument strings
+   *         [padding]                             ← keeps sp 16-aligned
+   *         <string data>                         ← argv, then envp strings
    *         stack_top (highest address)
    *
    * We push from stack_top downward, so the LAST push ends up at the
    * LOWEST address (= sp).  Order of pushes:
-   *   1. argv strings, then env strings  (highest)
+   *   1. the packed argv/envp strings, one copy (highest)
    *   2. auxv terminator AT_NULL (val then type — struct layout: type@low,
    * val@high)
    *   3. other auxv entries (AT_PHDR last pushed = lowest among auxv)
-   *   4. envp NULL + envp pointers (if any)
-   *   5. argv NULL terminator
-   *   6. argv pointers  (argv[0] last pushed = just above argc)
+   *   4-6. argv and envp pointer arrays, written in one go
    *   7. argc           (lowest address = final sp)
    */
 
-#define AT_NULL_V 0
-#define AT_PHDR   3
-#define AT_PHENT  4
-#define AT_PHNUM  5
-#define AT_PAGESZ 6
-#define AT_ENTRY  9
-#define AT_UID    11
-#define AT_EUID   12
-#define AT_GID    13
-#define AT_EGID   14
+#define AT_NULL_V       0
+#define AT_PHDR         3
+#define AT_PHENT        4
+#define AT_PHNUM        5
+#define AT_PAGESZ       6
+#define AT_BASE         7
+#define AT_FLAGS        8
+#define AT_ENTRY        9
+#define AT_UID          11
+#define AT_EUID         12
+#define AT_GID          13
+#define AT_EGID         14
+#define AT_SYSINFO_EHDR 33
 
   /* Each PUSH_AUX stores: val at higher address, type at lower address,
    * so reading as Elf64_auxv_t {u64 type; u64 val} gives the right layout. */
@@ -285,42 +413,15 @@ static int proc_setup_image(
     *(u64 *)sp = (u64)(type);                                                  \
   } while(0)
 
-  u64 sp = stack_top;
-
-  /* Count arguments */
-  int argc = 0;
-  if(argv) {
-    while(argc < PROC_MAX_ARGV && argv[argc])
-      argc++;
-  }
-  if(argc == 0)
-    argc = 1; /* will synthesise argv[0] = name below */
-
-  /* 1. Push argv strings (highest addresses) */
-  u64 arg_ptrs[PROC_MAX_ARGV];
-  if(argv && argv[0]) {
-    for(int i = argc - 1; i >= 0; i--) {
-      sp          = push_string(sp, argv[i]);
-      arg_ptrs[i] = sp;
-    }
-  } else {
-    sp          = push_string(sp, name);
-    arg_ptrs[0] = sp;
-  }
-
-  /* 1b. env strings (name=value), below argv strings on the stack */
-  int envc = 0;
-  u64 env_ptrs[PROC_MAX_ARGV];
-  if(envp) {
-    while(envc < PROC_MAX_ARGV && envp[envc]) {
-      sp             = push_string(sp, envp[envc]);
-      env_ptrs[envc] = sp;
-      envc++;
-    }
-  }
+  /* 1. argv then envp strings (highest addresses), already packed. */
+  u64 sp      = (USER_STACK_TOP - args->size) & ALIGN_16_MASK;
+  u64 strings = sp;
+  kmemcpy((void *)sp, args->strings, args->size);
 
-  /* Align to 16 bytes before the pointer/auxv area */
-  sp &= ALIGN_16_MASK;
+  /* argc, both vectors with their NULLs and the auxv pairs end at a
+   * 16-byte aligned sp, as the ABI wants at the entry point. */
+  if((args->argc + args->envc + 3) & 1)
+    sp -= 8;
 
   /* 2. auxv terminator AT_NULL (pushed first = highest auxv address) */
   PUSH_AUX(AT_NULL_V, 0);
@@ -330,35 +431,36 @@ static int proc_setup_image(
   PUSH_AUX(AT_GID, 0);
   PUSH_AUX(AT_EUID, 0);
   PUSH_AUX(AT_UID, 0);
-  PUSH_AUX(AT_ENTRY, elf_info.entry);
+  PUSH_AUX(AT_ENTRY, img->entry);
+  PUSH_AUX(AT_FLAGS, 0);
+  if(img->dynamic)
+    PUSH_AUX(AT_BASE, img->interp_base);
   PUSH_AUX(AT_PAGESZ, 4096);
-  if(elf_info.phdr) {
-    PUSH_AUX(AT_PHNUM, elf_info.phnum);
-    PUSH_AUX(AT_PHENT, elf_info.phent);
-    PUSH_AUX(AT_PHDR, elf_info.phdr);
-  }
-
-  /* 4. envp pointers + NULL terminator (musl: envp = argv + argc + 1) */
-  sp -= 8;
-  *(u64 *)sp = 0;
-  for(int i = envc - 1; i >= 0; i--) {
-    sp -= 8;
-    *(u64 *)sp = env_ptrs[i];
+  if(img->vdso)
+    PUSH_AUX(AT_SYSINFO_EHDR, img->vdso);
+  if(img->phdr) {
+    PUSH_AUX(AT_PHNUM, img->phnum);
+    PUSH_AUX(AT_PHENT, img->phent);
+    PUSH_AUX(AT_PHDR, img->phdr);
   }
 
-  /* 5. argv NULL terminator */
-  sp -= 8;
-  *(u64 *)sp = 0;
-
-  /* 6. argv pointers (argv[0] pushed last = just above argc) */
-  for(int i = argc - 1; i >= 0; i--) {
-    sp -= 8;
-    *(u64 *)sp = arg_ptrs[i];
+  /* 4-6. argv pointers, NULL, envp pointers, NULL (musl: envp = argv +
+   * argc + 1), filled upwards from just above argc. */
+  sp -= 8 * ((u64)args->argc + 1 + args->envc + 1);
+  u64 *vec = (u64 *)sp;
+  for(u32 i = 0; i < args->argc + args->envc; i++) {
+    if(i == args->argc)
+      *vec++ = 0;
+    *vec++ = strings;
+    strings += kstrlen((const char *)strings) + 1;
   }
+  if(args->envc == 0)
+    *vec++ = 0;
+  *vec = 0;
 
   /* 7. argc (last push = lowest address = final sp) */
   sp -= 8;
-  *(u64 *)sp = (u64)argc;
+  *(u64 *)sp = (u64)args->argc;
 
 #undef PUSH_AUX
 #undef AT_NULL_V
@@ -366,12 +468,117 @@ static int proc_setup_image(
 #undef AT_PHENT
 #undef AT_PHNUM
 #undef AT_PAGESZ
+#undef AT_BASE
+#undef AT_FLAGS
 #undef AT_ENTRY
 #undef AT_UID
 #undef AT_EUID
 #undef AT_GID
 #undef AT_EGID
+#undef AT_SYSINFO_EHDR
 
+  return sp;
+}
+
+/* Load the program interpreter @p path into the current (new) image.
+ * Its regions hold their own references to the file, so the fd is only
+ * needed while loading. */
+static int proc_load_interp(proc_t *p, const char *path, elf_info_t *out)
+{
+  i64 fd = vfs_open(path, 0);
+  if(fd < 0) {
+    console_printf("[PROC] No interpreter %s\n", path);
+    return -1;
+  }
+  int rc = elf_load_fd(fd, &p->vmas, USER_INTERP_BASE, out);
+  vfs_close(fd);
+  /* The loader must be self-contained; it cannot name one of its own. */
+  if(rc == 0 && out->interp[0] != '\0')
+    rc = -1;
+  return rc;
+}
+
+/* Allocate a user stack and load an ELF into @p p's address space, then
+ * build its startup stack from the packed @p args and populate p->user_*,
+ * p->program_break, p->heap_break, p->mmap_base. Without @p args (a spawn
+ * template) the stack is a demand-zero region instead, left empty
+ * (p->user_rsp 0) for proc_spawn to fill; @p out, if not NULL, receives
+ * what that needs.
+ *
+ * Caller invariant: @p p->cr3 is allocated and (for execve) the user-space
+ * portion has already been cleared.
+ *
+ * Returns 0 on success, -errno on failure with no partial state left in @p p
+ * other than possibly-mapped stack pages (the caller decides how to recover).
+ */
+static int proc_setup_image(
+    proc_t *p, const void *elf_data, u64 elf_size, i64 elf_fd,
+    const proc_args_t *args, proc_image_t *out
+)
+{
+  u64 stack_pages     = (PROC_USER_STACK / 4096) + 1;
+  u64 user_stack_base = USER_STACK_BASE;
+  u64 stack_top       = USER_STACK_TOP;
+
+  if(args) {
+    void *user_stack_phys = pmm_alloc_pages(stack_pages);
+    if(!user_stack_phys)
+      return -ENOMEM;
+    for(u64 off = 0; off < stack_pages * 4096; off += 4096) {
+      vmm_map_in(
+          p->cr3, user_stack_base + off, (u64)user_stack_phys + off,
+          VMM_PRESENT | VMM_WRITE | VMM_USER
+      );
+    }
+  } else {
+    /* A template lives as long as it stays warm and never runs; each of
+     * its children faults in just the stack it uses. */
+    vma_t stack = {
+        .start = user_stack_base,
+        .end   = user_stack_base + stack_pages * PAGE_SIZE,
+        .file  = -1,
+        .flags = VMA_READ | VMA_WRITE | VMA_ANON | VMA_STACK,
+    };
+    if(vma_insert(&p->vmas, &stack) < 0)
+      return -ENOMEM;
+  }
+  p->user_stack     = (void *)user_stack_base;
+  p->user_stack_top = (void *)stack_top;
+
+  u64 vdso_base = vdso_map(p->cr3);
+
+  u64 old_cr3 = vmm_get_current_pml4();
+  vmm_switch(p->cr3);
+
+  elf_info_t elf_info;
+  int        elf_result =
+      (elf_fd >= 0) ? elf_load_fd(elf_fd, &p->vmas, USER_PIE_BASE, &elf_info)
+                    : elf_load(elf_data, elf_size, &elf_info);
+  if(elf_result != 0) {
+    vmm_switch(old_cr3);
+    return -ENOEXEC;
+  }
+
+  /* A dynamically linked program starts in its interpreter (musl's
+   * ld.so), which finds the program through AT_PHDR / AT_ENTRY and itself
+   * through AT_BASE. */
+  elf_info_t interp;
+  bool       dynamic = elf_info.interp[0] != '\0';
+  if(dynamic && proc_load_interp(p, elf_info.interp, &interp) < 0) {
+    vmm_switch(old_cr3);
+    return -ENOEXEC;
+  }
+
+  proc_image_t img = {
+      .entry       = elf_info.entry,
+      .phdr        = elf_info.phdr,
+      .phent       = elf_info.phent,
+      .phnum       = elf_info.phnum,
+      .dynamic     = dynamic,
+      .interp_base = dynamic ? interp.bias : 0,
+      .vdso        = vdso_base,
+  };
+  u64 sp = args ? proc_build_stack(&img, args) : 0;
   vmm_switch(old_cr3);
 
   u64 elf_end_aligned = (elf_info.end + 0xFFF) & ALIGN_16_MASK;
@@ -379,10 +586,12 @@ static int proc_setup_image(
   p->heap_break       = USER_HEAP_START;
   p->mmap_base        = USER_MMAP_BASE;
 
-  p->user_rip    = elf_info.entry;
+  p->user_rip    = dynamic ? interp.entry : elf_info.entry;
   p->user_rsp    = sp;
   p->user_rflags = 0x202; /* IF enabled */
 
+  if(out)
+    *out = img;
   return 0;
 }
 
@@ -398,33 +607,42 @@ static u64 proc_create_inner(
 {
   proc_t *p = proc_alloc();
   if(!p) {
-    console_print("[PROC] No free process slots\n");
+    console_print("[PROC] No memory or PIDs for a new process\n");
     return 0;
   }
 
   p->cr3 = vmm_create_address_space();
   if(!p->cr3) {
+    proc_discard(p);
     console_print("[PROC] Failed to create address space\n");
     return 0;
   }
 
-  p->kernel_stack = kmalloc(PROC_KERNEL_STACK);
+  p->kernel_stack = kmem_cache_alloc(kstack_cache);
   if(!p->kernel_stack) {
     vmm_destroy_user_mappings(p->cr3);
+    proc_discard(p);
     console_print("[PROC] Failed to allocate kernel stack\n");
     return 0;
   }
   p->kernel_stack_top = (void *)((u64)p->kernel_stack + PROC_KERNEL_STACK);
 
-  if(proc_setup_image(p, name, elf_data, elf_size, elf_fd, argv, envp) < 0) {
-    kfree(p->kernel_stack);
+  proc_args_t args;
+  int         rc = proc_args_pack(name, argv, envp, &args);
+  if(rc == 0) {
+    rc = proc_setup_image(p, elf_data, elf_size, elf_fd, &args, NULL);
+    kfree(args.strings);
+  }
+  if(rc < 0) {
+    kmem_cache_free(kstack_cache, p->kernel_stack);
     vmm_destroy_user_mappings(p->cr3);
+    proc_discard(p);
     console_print("[PROC] Failed to load image\n");
     return 0;
   }
 
-  p->pid        = next_pid++;
-  p->parent_pid = current_proc ? current_proc->pid : 0;
+  proc_t *parent = proc_current();
+  p->parent_pid  = parent ? parent->pid : 0;
   kstrncpy(p->name, name, PROC_NAME_MAX);
   p->state             = PROC_STATE_READY;
   p->exit_code         = 0;
@@ -455,6 +673,9 @@ static u64 proc_create_inner(
   *(--ksp) = 0; /* r15 - popped first */
 
   p->saved_rsp = (u64)ksp;
+  proc_publish(p, parent);
+  sched_fork(p, parent);
+  proc_run_new(p);
 
   return p->pid;
 }
@@ -467,6 +688,49 @@ u64 proc_create_mem(
   return proc_create_inner(name, elf_data, elf_size, -1, argv, envp);
 }
 
+/* First code a kernel task runs, returned to by context_switch. */
+static void proc_kernel_entry(void)
+{
+  cpu_enable_interrupts();
+  proc_current()->kentry();
+  proc_exit(0);
+}
+
+u64 proc_create_kernel(const char *name, proc_kentry_t entry)
+{
+  proc_t *p = proc_alloc();
+  if(!p)
+    return 0;
+
+  /* The kernel half only; switching to it leaves the kernel unchanged. */
+  p->cr3          = vmm_create_address_space();
+  p->kernel_stack = p->cr3 ? kmem_cache_alloc(kstack_cache) : NULL;
+  if(!p->kernel_stack) {
+    if(p->cr3)
+      vmm_destroy_user_mappings(p->cr3);
+    proc_discard(p);
+    return 0;
+  }
+  p->kernel_stack_top = (void *)((u64)p->kernel_stack + PROC_KERNEL_STACK);
+  p->kentry           = entry;
+  p->state            = PROC_STATE_READY;
+  kstrncpy(p->name, name, PROC_NAME_MAX);
+
+  /* context_switch pops six callee-saved registers, then returns into
+   * proc_kernel_entry; the slot above keeps its stack ABI-aligned. */
+  u64 *ksp = (u64 *)p->kernel_stack_top;
+  *(--ksp) = 0;
+  *(--ksp) = (u64)proc_kernel_entry;
+  for(int i = 0; i < 6; i++)
+    *(--ksp) = 0;
+
+  p->saved_rsp = (u64)ksp;
+  proc_publish(p, NULL);
+  sched_fork(p, NULL);
+  proc_run_new(p);
+  return p->pid;
+}
+
 /**
  * @brief External assembly entry point for new processes.
  *
@@ -477,16 +741,43 @@ extern void proc_enter_first_time(void);
 
 static void proc_vfork_wake_parent(const proc_t *child);
 
+/* POSIX execve: reset every caught signal to SIG_DFL. SIG_IGN stays IGN.
+ * Without this, a stale handler from the old image points into freed user
+ * memory — first signal delivery faults and the new image dies. */
+static void proc_reset_caught_signals(proc_t *p)
+{
+  for(int i = 1; i < NSIG; i++) {
+    if(p->sig_actions[i].sa_handler != SIG_IGN) {
+      p->sig_actions[i].sa_handler  = SIG_DFL;
+      p->sig_actions[i].sa_flags    = 0;
+      p->sig_actions[i].sa_mask     = 0;
+      p->sig_actions[i].sa_restorer = 0;
+    }
+  }
+}
+
 i64         proc_exec_replace_image(
-            proc_t *p, const char *name, i64 elf_fd, char *const argv[],
-            char *const envp[]
+            proc_t *p, const char *name, i64 elf_fd, const proc_args_t *args
         )
 {
   /* We are running on @p p (this is its syscall handler), so p->cr3 IS the
-   * current cr3. Wipe the user-space portion before loading the new image. */
-  vmm_clear_user_mappings(p->cr3);
+   * current cr3. Wipe the user-space portion before loading the new image;
+   * a vfork child instead gives the borrowed one back and starts afresh. */
+  if(p->vm_borrowed) {
+    u64 cr3 = vmm_create_address_space();
+    if(!cr3)
+      return -ENOMEM;
+    proc_vm_return(p);
+    p->cr3         = cr3;
+    p->vm_borrowed = false;
+    vmm_switch(cr3);
+  } else {
+    usage_note_rss(p);
+    vmm_clear_user_mappings(p->cr3);
+    vma_list_free(&p->vmas);
+  }
 
-  int rc = proc_setup_image(p, name, NULL, 0, elf_fd, argv, envp);
+  int rc = proc_setup_image(p, NULL, 0, elf_fd, args, NULL);
   if(rc < 0)
     return rc;
 
@@ -498,24 +789,13 @@ i64         proc_exec_replace_image(
    * now; otherwise the next %fs-relative access uses a stale linear address. */
   p->fs_base = 0;
   cpu_set_fs_base(0);
+  fpu_release(p);
 
   kstrncpy(p->name, name, PROC_NAME_MAX);
   kstrncpy(p->exe_path, name, PROC_EXE_PATH_MAX);
   p->exe_path[PROC_EXE_PATH_MAX - 1] = '\0';
 
-  /* POSIX execve: reset every caught signal to SIG_DFL. SIG_IGN stays IGN.
-   * Without this, a stale handler from the old image points into freed user
-   * memory — first signal delivery faults and the new image dies. */
-  for(int i = 1; i < NSIG; i++) {
-    if(p->sig_actions[i].sa_handler != SIG_IGN) {
-      p->sig_actions[i].sa_handler  = SIG_DFL;
-      p->sig_actions[i].sa_flags    = 0;
-      p->sig_actions[i].sa_mask     = 0;
-      p->sig_actions[i].sa_restorer = 0;
-    }
-  }
-  p->kbd_edit_len  = 0;
-  p->kbd_ready_len = 0;
+  proc_reset_caught_signals(p);
   return 0;
 }
 
@@ -528,8 +808,7 @@ static void proc_vfork_wake_parent(const proc_t *child)
   if(!parent || parent->vfork_waiting_for != child->pid)
     return;
   parent->vfork_waiting_for = 0;
-  if(parent->state == PROC_STATE_BLOCKED)
-    parent->state = PROC_STATE_READY;
+  proc_wake(parent);
 }
 
 /**
@@ -543,6 +822,168 @@ void proc_notify_exec(const proc_t *p)
   proc_vfork_wake_parent(p);
 }
 
+proc_t *proc_template_load(const char *path, u32 prefault, proc_image_t *img)
+{
+  proc_t *self = proc_current();
+  if(!self)
+    return NULL;
+  i64 fd = vfs_open(path, 0);
+  if(fd < 0)
+    return NULL;
+
+  proc_t *t = kmem_cache_alloc(proc_cache);
+  if(!t) {
+    vfs_close(fd);
+    return NULL;
+  }
+  kzero(t, sizeof *t);
+  t->cr3 = vmm_create_address_space();
+  if(!t->cr3) {
+    kmem_cache_free(proc_cache, t);
+    vfs_close(fd);
+    return NULL;
+  }
+
+  /* The caller stands in for the template while it loads: a disk read
+   * that sleeps comes back to the template's cr3, and the swapper leaves
+   * a borrowed address space alone. */
+  u64  own_cr3      = self->cr3;
+  bool own_borrowed = self->vm_borrowed;
+  self->cr3         = t->cr3;
+  self->vm_borrowed = true;
+  vmm_switch(t->cr3);
+
+  int rc = proc_setup_image(t, NULL, 0, fd, NULL, img);
+  if(rc == 0)
+    vma_prefault(&t->vmas, prefault);
+
+  self->cr3         = own_cr3;
+  self->vm_borrowed = own_borrowed;
+  vmm_switch(own_cr3);
+  vfs_close(fd);
+
+  if(rc < 0) {
+    proc_template_free(t);
+    return NULL;
+  }
+  kstrncpy(t->name, path, PROC_NAME_MAX);
+  kstrncpy(t->exe_path, path, PROC_EXE_PATH_MAX);
+  t->exe_path[PROC_EXE_PATH_MAX - 1] = '\0';
+  return t;
+}
+
+void proc_template_free(proc_t *t)
+{
+  vmm_destroy_user_mappings(t->cr3);
+  vma_list_free(&t->vmas);
+  kmem_cache_free(proc_cache, t);
+}
+
+/* Bytes proc_build_stack writes below USER_STACK_TOP for @p args, at
+ * most: the strings, both vectors and argc, up to 16 auxv pairs, and the
+ * alignment padding. */
+static u64 proc_stack_need(const proc_args_t *args)
+{
+  return args->size + 8 * ((u64)args->argc + args->envc + 3) + 16 * 16 + 24;
+}
+
+i64 proc_spawn(
+    const proc_t *t, const proc_image_t *img, const proc_args_t *args,
+    const vfs_fd_action_t *acts, u32 nacts
+)
+{
+  proc_t *parent = proc_current();
+  if(!parent)
+    return -ESRCH;
+
+  proc_t *child = proc_alloc();
+  if(!child)
+    return -EAGAIN;
+  child->kernel_stack = kmem_cache_alloc(kstack_cache);
+  if(!child->kernel_stack) {
+    proc_discard(child);
+    return -ENOMEM;
+  }
+  child->kernel_stack_top =
+      (void *)((u64)child->kernel_stack + PROC_KERNEL_STACK);
+
+  /* Everything the template's exec set up is shared copy-on-write. */
+  child->cr3 = vmm_clone_address_space(t->cr3);
+  if(!child->cr3) {
+    kmem_cache_free(kstack_cache, child->kernel_stack);
+    proc_discard(child);
+    return -ENOMEM;
+  }
+  i64 rc = vma_list_clone(&child->vmas, &t->vmas) < 0 ? -ENOMEM : 0;
+  child->user_stack     = t->user_stack;
+  child->user_stack_top = t->user_stack_top;
+  child->program_break  = t->program_break;
+  child->heap_break     = t->heap_break;
+  child->mmap_base      = t->mmap_base;
+
+  /* Give the child its own stack pages for the arguments to land on, so
+   * building the stack cannot fault. */
+  if(rc == 0) {
+    u64 old_cr3 = vmm_get_current_pml4();
+    vmm_switch(child->cr3);
+    u64 page = (USER_STACK_TOP - proc_stack_need(args)) & ~PAGE_OFFSET_MASK;
+    for(; page < USER_STACK_TOP; page += PAGE_SIZE) {
+      if(!vma_fault_write(&child->vmas, page))
+        break;
+    }
+    if(page < USER_STACK_TOP)
+      rc = -ENOMEM;
+    else
+      child->user_rsp = proc_build_stack(img, args);
+    vmm_switch(old_cr3);
+  }
+
+  /* Last, as it is the only step whose failure must let go of fds. */
+  if(rc == 0) {
+    vfs_proc_inherit_fds(child, parent);
+    rc = vfs_proc_spawn_fds(child, acts, nacts);
+    if(rc < 0)
+      vfs_proc_release_fds(child);
+  }
+  if(rc < 0) {
+    kmem_cache_free(kstack_cache, child->kernel_stack);
+    vmm_destroy_user_mappings(child->cr3);
+    vma_list_free(&child->vmas);
+    proc_discard(child);
+    return rc;
+  }
+
+  child->parent_pid = parent->pid;
+  kstrncpy(child->name, t->name, PROC_NAME_MAX);
+  kstrncpy(child->exe_path, t->exe_path, PROC_EXE_PATH_MAX);
+  kstrncpy(child->cwd, parent->cwd, VFS_PATH_MAX);
+  kmemcpy(&child->termios, &parent->termios, sizeof(child->termios));
+  kmemcpy(child->sig_actions, parent->sig_actions, sizeof child->sig_actions);
+  child->sig_mask = parent->sig_mask;
+  proc_reset_caught_signals(child);
+
+  child->state       = PROC_STATE_READY;
+  child->user_rip    = t->user_rip;
+  child->user_rflags = t->user_rflags;
+
+  /* Enter user mode the way proc_create_inner's processes do. */
+  u64 *ksp = (u64 *)child->kernel_stack_top;
+  *(--ksp) = 0x3B;
+  *(--ksp) = child->user_rsp;
+  *(--ksp) = child->user_rflags;
+  *(--ksp) = 0x43;
+  *(--ksp) = child->user_rip;
+  *(--ksp) = (u64)proc_enter_first_time;
+  for(int i = 0; i < 6; i++)
+    *(--ksp) = 0;
+
+  child->saved_rsp = (u64)ksp;
+  proc_publish(child, parent);
+  sched_fork(child, parent);
+  proc_run_new(child);
+  return (i64)child->pid;
+}
+
 /**
  * @brief Exit the current process with the given exit code.
  *
@@ -553,28 +994,44 @@ void proc_notify_exec(const proc_t *p)
  */
 void proc_exit(i64 code)
 {
-  proc_t *p = current_proc;
+  proc_t *p = proc_current();
   if(!p) {
     console_print("[PROC] No current process to exit!\n");
     for(;;)
       cpu_halt();
   }
 
+  usage_note_rss(p);
+  if(p->vm_borrowed)
+    proc_vm_return(p);
   proc_vfork_wake_parent(p);
   p->exit_code = code;
   p->state     = PROC_STATE_ZOMBIE;
 
   /* Release per-process fd table; OFT entries close when refcount hits 0 */
-  vfs_proc_release_fds(p->fds);
+  vfs_proc_release_fds(p);
+  systrace_proc_exit(p);
+  perf_proc_exit(p);
+  fpu_release(p);
+
+  /* Nobody will wait for the children now: reap the zombies and leave the
+   * rest to be reaped once they exit. */
+  while(p->children) {
+    proc_t *c = p->children;
+    sibling_remove(&p->children, c);
+    c->parent_pid = 0;
+    if(c->state == PROC_STATE_ZOMBIE)
+      sibling_push(&orphans, c);
+  }
 
   /* Notify parent via SIGCHLD and wake it if blocked in waitpid */
   proc_t *parent = proc_get(p->parent_pid);
   if(parent) {
     proc_signal(p->parent_pid, SIGCHLD);
-    if(parent->state == PROC_STATE_BLOCKED &&
-       (parent->waiting_for_pid == p->pid || parent->waiting_for_pid == 0)) {
-      parent->state = PROC_STATE_READY;
-    }
+    if(parent->waiting_for_pid == p->pid || parent->waiting_for_pid == 0)
+      proc_wake(parent);
+  } else {
+    sibling_push(&orphans, p);
   }
 
   /* Schedule another process */
@@ -603,26 +1060,23 @@ i64 proc_wait(u64 pid)
 
   /* If child is already zombie, get exit code and free */
   if(child->state == PROC_STATE_ZOMBIE) {
-    i64 code     = child->exit_code;
-    child->state = PROC_STATE_FREE;
-    vmm_destroy_user_mappings(child->cr3);
-    kfree(child->kernel_stack);
+    i64 code = child->exit_code;
+    proc_reap(child);
     return code;
   }
 
   /* Block until child exits */
-  current_proc->state           = PROC_STATE_BLOCKED;
-  current_proc->waiting_for_pid = pid;
+  proc_t *self          = proc_current();
+  self->state           = PROC_STATE_BLOCKED;
+  self->waiting_for_pid = pid;
 
   proc_schedule();
 
   /* Woken up, child should be zombie now */
   child = proc_get(pid);
   if(child && child->state == PROC_STATE_ZOMBIE) {
-    i64 code     = child->exit_code;
-    child->state = PROC_STATE_FREE;
-    vmm_destroy_user_mappings(child->cr3);
-    kfree(child->kernel_stack);
+    i64 code = child->exit_code;
+    proc_reap(child);
     return code;
   }
 
@@ -630,24 +1084,31 @@ i64 proc_wait(u64 pid)
 }
 
 /**
- * @brief Timer hook: request a reschedule at the next syscall boundary.
+ * @brief Timer hook: charge the running process and, once a READY process
+ * has less virtual runtime, request a reschedule at the next return to
+ * user mode.
  *
- * Called from the PIT IRQ when preemptive scheduling is enabled.
+ * Called from the calling CPU's tick when preemptive scheduling is enabled.
  */
 void proc_tick(void)
 {
-  need_resched = true;
+  cpu_t *cpu = cpu_this();
+  if(sched_tick(cpu->proc))
+    cpu->need_resched = true;
 }
 
 /**
- * @brief If a timer tick requested preemption, run the process scheduler.
+ * @brief If a tick or a wakeup requested preemption, run the process
+ * scheduler.
  *
- * Called from syscall_dispatch before returning to user mode.
+ * Called before returning to user mode, from syscall_dispatch and from
+ * interrupts that came from ring 3.
  */
 void proc_check_resched(void)
 {
-  if(need_resched) {
-    need_resched = false;
+  cpu_t *cpu = cpu_this();
+  if(cpu->need_resched) {
+    cpu->need_resched = false;
     proc_schedule();
   }
 }
@@ -655,54 +1116,82 @@ void proc_check_resched(void)
 /**
  * @brief Schedule the next ready process to run.
  *
- * Performs simple round-robin scheduling. Searches for the next
- * PROC_STATE_READY process starting from the current process. If no ready
- * process is found, halts the CPU.
+ * The READY process with the least virtual runtime runs; a preempted
+ * process is queued again by what it has used. If no process is ready,
+ * the CPU goes back to its idle loop (see proc_idle).
  */
 void proc_schedule(void)
 {
   cpu_disable_interrupts();
 
-  /* Find next ready process */
-  proc_t *next = NULL;
+  /* Charge the caller now, so time spent idling below is not billed. */
+  proc_t *cur = proc_current();
+  if(cur)
+    sched_update(cur);
 
-  /* Simple round-robin: start from current+1 */
-  int start = current_proc ? (int)(current_proc - proc_table) : 0;
+  /* Trim the caches before free memory runs out, not when it has. */
+  pmm_balance();
 
-  for(int i = 1; i <= PROC_MAX; i++) {
-    int idx = (start + i) % PROC_MAX;
-    if(proc_table[idx].state == PROC_STATE_READY) {
-      next = &proc_table[idx];
-      break;
-    }
+  proc_t *next = sched_pick_next();
+  /* If the current process is still runnable (just yielding cooperatively),
+   * let it keep running — no context switch needed. */
+  if(!next && cur && cur->state == PROC_STATE_RUNNING) {
+    cpu_enable_interrupts();
+    return;
   }
+  proc_switch(next);
+}
 
-  if(!next) {
-    /* If the current process is still runnable (just yielding cooperatively),
-     * let it keep running — no context switch needed. */
-    if(current_proc && current_proc->state == PROC_STATE_RUNNING) {
-      cpu_enable_interrupts();
-      return;
-    }
-
-    /* All procs blocked: HLT until an IRQ fires, then re-scan for READY.
-     * IRQs (timer, keyboard, ATA completion) can flip a process to READY by
-     * waking a sleeper. */
-    for(;;) {
-      cpu_enable_interrupts();
-      __asm__ volatile("hlt");
-      cpu_disable_interrupts();
-
-      for(int i = 0; i < PROC_MAX; i++) {
-        if(proc_table[i].state == PROC_STATE_READY) {
-          proc_switch(&proc_table[i]);
-          return;
-        }
+/**
+ * @brief Idle loop of the calling CPU, on the stack it booted on.
+ *
+ * Runs whatever its run queue, or another CPU's, offers; with nothing to
+ * run it idles until an IRQ fires or a process is queued. IRQs (timer,
+ * keyboard, ATA completion) put a process on the run queue by waking a
+ * sleeper, and a CPU that queues one for an idle CPU sends it an IPI. The
+ * BSP's tick is stopped meanwhile so only real work wakes it, and the
+ * C-state is chosen by how far off the next timer is. Before sleeping,
+ * spare time goes into zeroing free pages, a batch at a time with
+ * interrupts on. The kernel lock is dropped only for the sleep itself.
+ */
+NORETURN void proc_idle(void)
+{
+  cpu_t *cpu = cpu_this();
+  for(;;) {
+    cpu_disable_interrupts();
+    proc_t *next = sched_pick_next();
+    if(!next) {
+      u64 idle_from = time_monotonic_ns();
+      cpu->idle     = true;
+      /* What ran last may move to another CPU: save its FPU state. */
+      fpu_unload();
+      if(!cpu->id)
+        pit_set_idle(true);
+      while(!next) {
+        cpu_enable_interrupts();
+        bool more = pmm_prezero();
+        cpu_disable_interrupts();
+        next = sched_pick_next();
+        if(next || more)
+          continue;
+        u64 due = timer_next();
+        u64 now = time_monotonic_ns();
+        kernel_unlock();
+        cpu_idle(sched_idle_watch(), !due ? 0 : due > now ? due - now : 1);
+        kernel_lock();
+        next = sched_pick_next();
       }
+      if(!cpu->id)
+        pit_set_idle(false);
+      cpu->idle = false;
+      kstat.idle_ns += time_monotonic_ns() - idle_from;
     }
-  }
 
-  proc_switch(next);
+    cpu->need_resched = false;
+    if(cpu->id)
+      pit_arm_ap();
+    proc_switch(next);
+  }
 }
 
 /**
@@ -717,40 +1206,57 @@ void proc_schedule(void)
 extern void context_switch(u64 *old_rsp, u64 new_rsp);
 
 /**
- * @brief Switch to a different process.
+ * @brief Switch the calling CPU to a different process.
  *
  * Updates process states, switches address spaces (CR3), updates TSS kernel
- * stack, restores TLS (FS base), and performs the context switch.
+ * stack, restores TLS (FS base), and performs the context switch. Either
+ * side may be NULL for the CPU's idle loop, which runs on the kernel's
+ * page tables. The kernel lock stays held across the switch.
  *
- * @param next Process to switch to.
+ * @param next Process to switch to, or NULL to go idle.
  */
 void proc_switch(proc_t *next)
 {
-  if(next == current_proc) {
+  cpu_t  *cpu  = cpu_this();
+  proc_t *prev = cpu->proc;
+  if(next && next == prev) {
+    /* Woken again before it got off the CPU. */
+    next->state = PROC_STATE_RUNNING;
+    sched_start(next);
     cpu_enable_interrupts();
     return;
   }
 
-  proc_t *prev = current_proc;
+  TRACE(ALCOR_TRACE_SWITCH, prev ? prev->pid : 0, next ? next->pid : 0, 0);
+  kstat.ctxt++;
 
   /* Save current FS base (TLS) before switching */
   if(prev) {
     prev->fs_base = cpu_get_fs_base();
   }
 
-  /* Update states */
+  /* Update states; a preempted process waits its turn again. */
   if(prev && prev->state == PROC_STATE_RUNNING) {
-    prev->state = PROC_STATE_READY;
+    prev->usage.nivcsw++;
+    sched_enqueue(prev);
+  } else if(prev) {
+    prev->usage.nvcsw++;
   }
-  next->state  = PROC_STATE_RUNNING;
-  current_proc = next;
+  cpu->proc = next;
+  if(!next) {
+    vmm_switch(vmm_kernel_pml4());
+    perf_switch(prev, NULL);
+    context_switch(&prev->saved_rsp, cpu->idle_rsp);
+    cpu_enable_interrupts();
+    return;
+  }
+  next->state = PROC_STATE_RUNNING;
+  sched_start(next);
 
   /* Set kernel stack for this process */
   tss_set_rsp0((u64)next->kernel_stack_top);
-  current_kernel_rsp = (u64)next->kernel_stack_top;
-
-  /* Set CR3 for proc_enter_first_time (used for new processes) */
-  current_proc_cr3 = next->cr3;
+  cpu->kernel_rsp = (u64)next->kernel_stack_top;
+  cpu->sig_work   = &next->sig_work;
 
   /* Switch address space */
   vmm_switch(next->cr3);
@@ -758,24 +1264,11 @@ void proc_switch(proc_t *next)
   /* Restore FS base (TLS) for new process. Must run even when 0: otherwise
    * the previous task's %fs leaks across switches (fatal after execve). */
   cpu_set_fs_base(next->fs_base);
+  fpu_switch(next);
+  perf_switch(prev, next);
 
-  /* Context switch */
-  if(prev) {
-    context_switch(&prev->saved_rsp, next->saved_rsp);
-  } else {
-    /* First switch, just load new context - matches context_switch pop order */
-    __asm__ volatile("mov %0, %%rsp\n"
-                     "pop %%r15\n"
-                     "pop %%r14\n"
-                     "pop %%r13\n"
-                     "pop %%r12\n"
-                     "pop %%rbx\n"
-                     "pop %%rbp\n"
-                     "ret\n"
-                     :
-                     : "r"(next->saved_rsp)
-                     : "memory");
-  }
+  /* Context switch. Back here, prev may be on another CPU than @c cpu. */
+  context_switch(prev ? &prev->saved_rsp : &cpu->idle_rsp, next->saved_rsp);
 
   cpu_enable_interrupts();
 }
@@ -783,8 +1276,9 @@ void proc_switch(proc_t *next)
 /**
  * @brief Start the first user process from kernel initialization.
  *
- * Creates a process from the given ELF data, switches to its address space,
- * and jumps to user mode. Never returns.
+ * Creates a process from the given ELF data, lets the APs go and becomes
+ * the BSP's idle loop, which runs the process. Never returns unless the
+ * process cannot be created.
  *
  * @param elf_data Pointer to ELF file data in memory.
  * @param elf_size Size of the ELF file in bytes.
@@ -812,29 +1306,10 @@ void proc_start_first(
     p->exe_path[0] = '\0';
   }
 
-  /* Switch to first process */
-  p->state     = PROC_STATE_RUNNING;
-  current_proc = p;
-
-  /* Set kernel stack for this process */
-  tss_set_rsp0((u64)p->kernel_stack_top);
-  current_kernel_rsp = (u64)p->kernel_stack_top;
-
-  /* Switch to process's address space */
-  vmm_switch(p->cr3);
-
-  /* Jump to process (never returns) - matches context_switch pop order */
-  __asm__ volatile("mov %0, %%rsp\n"
-                   "pop %%r15\n"
-                   "pop %%r14\n"
-                   "pop %%r13\n"
-                   "pop %%r12\n"
-                   "pop %%rbx\n"
-                   "pop %%rbp\n"
-                   "ret\n"
-                   :
-                   : "r"(p->saved_rsp)
-                   : "memory");
+  /* It is queued: let the APs go and become the BSP's idle loop, which
+   * runs it (never returns). */
+  smp_start();
+  proc_idle();
 }
 
 /**
@@ -848,7 +1323,9 @@ void proc_start_first(
  *                     user RSP from @p frame (plain @c fork).
  * @param clone_flags  Bitmask: @c ALCOR_CLONE_VFORK makes the parent block
  *                     in @c PROC_STATE_BLOCKED until the child execve's or
- *                     exits (matches musl @c posix_spawn's wire usage).
+ *                     exits (matches musl @c posix_spawn's wire usage). With
+ *                     @c ALCOR_CLONE_VM as well, the child runs on the
+ *                     parent's address space instead of a copy of it.
  *
  * @return Child PID to the parent (the child returns 0 via @c rax in its
  *         own syscall frame), or negative errno on failure.
@@ -858,33 +1335,37 @@ static i64 proc_fork_impl(
 )
 {
   u64     child_rsp = child_stack_arg ? child_stack_arg : frame->rsp;
-  proc_t *parent    = current_proc;
+  proc_t *parent    = proc_current();
+  bool    share_vm  = (clone_flags & (ALCOR_CLONE_VM | ALCOR_CLONE_VFORK)) ==
+                  (ALCOR_CLONE_VM | ALCOR_CLONE_VFORK);
   if(!parent)
     return -ESRCH;
 
   /* Allocate child process slot */
   proc_t *child = proc_alloc();
   if(!child) {
-    console_print("[PROC] fork: no free process slot\n");
-    return -ENOMEM;
-  }
-
-  /* Clone the address space */
-  child->cr3 = vmm_clone_address_space(parent->cr3);
-  if(!child->cr3) {
-    console_print("[PROC] fork: failed to clone address space\n");
-    child->state = PROC_STATE_FREE;
-    return -ENOMEM;
+    console_print("[PROC] fork: no memory or PIDs for the child\n");
+    return -EAGAIN;
   }
 
   /* Allocate kernel stack for child */
-  child->kernel_stack = kmalloc(PROC_KERNEL_STACK);
+  child->kernel_stack = kmem_cache_alloc(kstack_cache);
   if(!child->kernel_stack) {
     console_print("[PROC] fork: failed to allocate kernel stack\n");
-    vmm_destroy_user_mappings(child->cr3);
-    child->state = PROC_STATE_FREE;
+    proc_discard(child);
     return -ENOMEM;
   }
+
+  /* Clone the address space, unless the child borrows it until exec. */
+  if(!share_vm) {
+    child->cr3 = vmm_clone_address_space(parent->cr3);
+    if(!child->cr3) {
+      console_print("[PROC] fork: failed to clone address space\n");
+      kmem_cache_free(kstack_cache, child->kernel_stack);
+      proc_discard(child);
+      return -ENOMEM;
+    }
+  }
   child->kernel_stack_top =
       (void *)((u64)child->kernel_stack + PROC_KERNEL_STACK);
 
@@ -894,7 +1375,6 @@ static i64 proc_fork_impl(
   child->user_stack_top = parent->user_stack_top;
 
   /* Initialize child process */
-  child->pid        = next_pid++;
   child->parent_pid = parent->pid;
   kstrncpy(child->name, parent->name, PROC_NAME_MAX);
   child->state             = PROC_STATE_READY;
@@ -904,22 +1384,40 @@ static i64 proc_fork_impl(
   child->fs_base           = parent->fs_base;
 
   /* Copy per-process memory state */
-  child->program_break = parent->program_break;
-  child->heap_break    = parent->heap_break;
-  child->mmap_base     = parent->mmap_base;
+  if(!share_vm) {
+    child->program_break = parent->program_break;
+    child->heap_break    = parent->heap_break;
+    child->mmap_base     = parent->mmap_base;
+    if(vma_list_clone(&child->vmas, &parent->vmas) < 0) {
+      console_print("[PROC] fork: failed to copy memory regions\n");
+      kmem_cache_free(kstack_cache, child->kernel_stack);
+      vmm_destroy_user_mappings(child->cr3);
+      proc_discard(child);
+      return -ENOMEM;
+    }
+  }
+  if(fpu_fork(child, parent) < 0) {
+    console_print("[PROC] fork: failed to copy FPU state\n");
+    kmem_cache_free(kstack_cache, child->kernel_stack);
+    if(!share_vm) {
+      vmm_destroy_user_mappings(child->cr3);
+      vma_list_free(&child->vmas);
+    }
+    proc_discard(child);
+    return -ENOMEM;
+  }
+  /* Last: nothing below can fail and leave the parent without memory. */
+  if(share_vm)
+    proc_vm_lend(child, parent);
 
   /* Inherit parent's open file descriptors and per-fd cloexec bits. */
-  vfs_proc_inherit_fds(
-      child->fds, child->fd_cloexec, parent->fds, parent->fd_cloexec
-  );
+  vfs_proc_inherit_fds(child, parent);
 
   kstrncpy(child->cwd, parent->cwd, VFS_PATH_MAX);
   kstrncpy(child->exe_path, parent->exe_path, PROC_EXE_PATH_MAX);
   child->exe_path[PROC_EXE_PATH_MAX - 1] = '\0';
 
   kmemcpy(&child->termios, &parent->termios, sizeof(child->termios));
-  child->kbd_edit_len  = 0;
-  child->kbd_ready_len = 0;
 
   /* POSIX fork: child inherits parent's signal dispositions and mask, but
    * starts with an empty pending set. Without this copy the child would
@@ -928,6 +1426,7 @@ static i64 proc_fork_impl(
   kmemcpy(child->sig_actions, parent->sig_actions, sizeof child->sig_actions);
   child->sig_mask    = parent->sig_mask;
   child->sig_pending = 0;
+  child->sig_work    = false;
 
   /* Copy user context from syscall frame */
   child->user_rip    = frame->rip;
@@ -973,11 +1472,22 @@ static i64 proc_fork_impl(
     *(--ksp) = 0;
 
   child->saved_rsp = (u64)ksp;
+  proc_publish(child, parent);
+  sched_fork(child, parent);
+  /* A vfork parent blocks at once, handing this CPU to the child. */
+  if(clone_flags & ALCOR_CLONE_VFORK)
+    sched_enqueue(child);
+  else
+    proc_run_new(child);
 
   if(clone_flags & ALCOR_CLONE_VFORK) {
     parent->vfork_waiting_for = child->pid;
-    parent->state             = PROC_STATE_BLOCKED;
-    proc_schedule();
+    /* A signal may wake the parent early, but it cannot run without the
+     * memory it lent. */
+    do {
+      parent->state = PROC_STATE_BLOCKED;
+      proc_schedule();
+    } while(share_vm && parent->vfork_waiting_for == child->pid);
   }
 
   /* Parent returns child PID */
@@ -1002,6 +1512,16 @@ i64 proc_clone(const syscall_frame_t *frame, u64 child_stack, u32 clone_flags)
  */
 extern void proc_fork_child_entry(void);
 
+/** @brief A zombie child of @p parent, or NULL if none has exited. */
+static proc_t *proc_zombie_child(const proc_t *parent)
+{
+  for(proc_t *c = parent->children; c; c = c->sibling_next) {
+    if(c->state == PROC_STATE_ZOMBIE)
+      return c;
+  }
+  return NULL;
+}
+
 /**
  * @brief Wait for child process(es) to change state.
  *
@@ -1012,12 +1532,14 @@ extern void proc_fork_child_entry(void);
  * @param pid Process ID: -1 for any child, >0 for specific child.
  * @param status Pointer to store child's exit status (can be NULL).
  * @param options Wait options (e.g., WNOHANG for non-blocking).
+ * @param usage Receives the child's resource usage, its own plus that of
+ * the children it reaped (can be NULL).
  * @return Child PID on success, 0 if WNOHANG and no child ready, negative on
  * error.
  */
-i64 proc_waitpid(i64 pid, i32 *status, i32 options)
+i64 proc_waitpid(i64 pid, i32 *status, i32 options, proc_usage_t *usage)
 {
-  proc_t *parent = current_proc;
+  proc_t *parent = proc_current();
   if(!parent)
     return -1;
 
@@ -1026,29 +1548,11 @@ i64 proc_waitpid(i64 pid, i32 *status, i32 options)
 
   if(pid == -1) {
     /* Wait for any child */
-    for(int i = 0; i < PROC_MAX; i++) {
-      if(proc_table[i].parent_pid == parent->pid &&
-         proc_table[i].state != PROC_STATE_FREE) {
-        if(proc_table[i].state == PROC_STATE_ZOMBIE) {
-          child = &proc_table[i];
-          break;
-        }
-      }
-    }
+    child = proc_zombie_child(parent);
 
     /* No zombie child found */
     if(!child) {
-      /* Check if we have any children at all */
-      int has_children = 0;
-      for(int i = 0; i < PROC_MAX; i++) {
-        if(proc_table[i].parent_pid == parent->pid &&
-           proc_table[i].state != PROC_STATE_FREE) {
-          has_children = 1;
-          break;
-        }
-      }
-
-      if(!has_children) {
+      if(!parent->children) {
         return -ECHILD;
       }
 
@@ -1061,14 +1565,7 @@ i64 proc_waitpid(i64 pid, i32 *status, i32 options)
         parent->state           = PROC_STATE_BLOCKED;
         parent->waiting_for_pid = 0;
         proc_schedule();
-
-        for(int i = 0; i < PROC_MAX; i++) {
-          if(proc_table[i].parent_pid == parent->pid &&
-             proc_table[i].state == PROC_STATE_ZOMBIE) {
-            child = &proc_table[i];
-            break;
-          }
-        }
+        child = proc_zombie_child(parent);
       }
     }
   } else if(pid > 0) {
@@ -1108,11 +1605,13 @@ i64 proc_waitpid(i64 pid, i32 *status, i32 options)
     /* POSIX wait status: exit_code << 8 for normal termination */
     *status = (i32)((child->exit_code & 0xFF) << 8);
   }
+  if(usage) {
+    *usage = child->usage;
+    usage_add(usage, &child->cusage);
+  }
 
   /* Free child */
-  child->state = PROC_STATE_FREE;
-  kfree(child->kernel_stack);
-  vmm_destroy_user_mappings(child->cr3);
+  proc_reap(child);
 
   return child_pid;
 }
@@ -0,0 +1,198 @@
+/**
+ * @file src/kernel/process/sched.c
+ * @brief Run queue ordered by nice-weighted virtual runtime.
+ *
+ * The run queue is an intrusive list kept in order on insertion; picking
+ * the next process takes the head. Inserts walk from the tail, where a
+ * preempted process, having just run, usually belongs.
+ *
+ * Each CPU has its own queue and minimum; a process is queued on the CPU
+ * named by its @c cpu, the one it last ran on. A CPU whose queue is empty
+ * steals from another's, keeping the process's lead or lag over the
+ * minimum of the queue it leaves.
+ */
+
+#include <alcor2/arch/fpu.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/proc/sched.h>
+#include <alcor2/time.h>
+
+/** @brief Weight of nice 0. */
+#define NICE_0_WEIGHT 1024
+/** @brief Weight of SCHED_IDLE processes. */
+#define IDLE_WEIGHT 3
+
+/** @brief How far behind the minimum a woken sleeper is placed. */
+#define SCHED_SLEEPER_CREDIT_NS (12ULL * 1000 * 1000)
+/** @brief Lead a woken process needs over the running one to preempt it. */
+#define SCHED_WAKEUP_GRAN_NS (1ULL * 1000 * 1000)
+
+/** @brief Weight of nice -20 .. 19; each step is about 10% of CPU share. */
+static const u32 nice_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
+/** @brief One CPU's READY processes, lowest virtual runtime first. A
+ *         line each, so an idle CPU's MWAIT wakes on its own queue only. */
+typedef struct __attribute__((aligned(64)))
+{
+  proc_t *head;
+  proc_t *tail;
+  /** @brief Never decreases; new and woken ones are placed against it. */
+  u64     min_vruntime;
+} runqueue_t;
+
+static runqueue_t rq[SMP_MAX_CPUS];
+
+static u64 proc_weight(const proc_t *p)
+{
+  if(p->sched_policy == SCHED_IDLE)
+    return IDLE_WEIGHT;
+  return nice_weight[p->nice - NICE_MIN];
+}
+
+static void min_vruntime_update(runqueue_t *q, const proc_t *cur)
+{
+  u64 v = q->head ? q->head->vruntime : q->min_vruntime;
+  if(cur && cur->state == PROC_STATE_RUNNING && cur->vruntime < v)
+    v = cur->vruntime;
+  if(v > q->min_vruntime)
+    q->min_vruntime = v;
+}
+
+void sched_enqueue(proc_t *p)
+{
+  runqueue_t *q = &rq[p->cpu];
+  p->state      = PROC_STATE_READY;
+
+  /* Equal runtimes keep their arrival order. */
+  proc_t *prev = q->tail;
+  while(prev && prev->vruntime > p->vruntime)
+    prev = prev->rq_prev;
+
+  p->rq_prev = prev;
+  p->rq_next = prev ? prev->rq_next : q->head;
+  if(p->rq_next)
+    p->rq_next->rq_prev = p;
+  else
+    q->tail = p;
+  if(prev)
+    prev->rq_next = p;
+  else
+    q->head = p;
+}
+
+void sched_dequeue(proc_t *p)
+{
+  runqueue_t *q = &rq[p->cpu];
+  if(p->rq_prev)
+    p->rq_prev->rq_next = p->rq_next;
+  else
+    q->head = p->rq_next;
+  if(p->rq_next)
+    p->rq_next->rq_prev = p->rq_prev;
+  else
+    q->tail = p->rq_prev;
+  p->rq_prev = NULL;
+  p->rq_next = NULL;
+}
+
+/* Take a process from another CPU's queue onto the caller's, or NULL. One
+ * whose FPU state is still live on its CPU stays there. */
+static proc_t *steal(u32 self)
+{
+  u32 n = smp_cpu_count();
+  for(u32 k = 1; k < n; k++) {
+    runqueue_t *src = &rq[(self + k) % n];
+    proc_t     *p   = src->head;
+    while(p && fpu_held_elsewhere(p))
+      p = p->rq_next;
+    if(!p)
+      continue;
+
+    sched_dequeue(p);
+    u64 dst = rq[self].min_vruntime;
+    if(p->vruntime >= src->min_vruntime)
+      p->vruntime = dst + (p->vruntime - src->min_vruntime);
+    else if(src->min_vruntime - p->vruntime < dst)
+      p->vruntime = dst - (src->min_vruntime - p->vruntime);
+    else
+      p->vruntime = 0;
+    p->cpu = self;
+    return p;
+  }
+  return NULL;
+}
+
+proc_t *sched_pick_next(void)
+{
+  u32     self = smp_cpu_id();
+  proc_t *p    = rq[self].head;
+  if(!p)
+    return steal(self);
+  sched_dequeue(p);
+  return p;
+}
+
+const volatile void *sched_idle_watch(void)
+{
+  return &rq[smp_cpu_id()].head;
+}
+
+void sched_update(proc_t *p)
+{
+  u64 now = time_monotonic_ns();
+  if(now > p->exec_start) {
+    u64 ran           = now - p->exec_start;
+    p->usage.runtime += ran;
+    p->vruntime      += ran * NICE_0_WEIGHT / proc_weight(p);
+  }
+  p->exec_start = now;
+  min_vruntime_update(&rq[p->cpu], p);
+}
+
+void sched_start(proc_t *p)
+{
+  p->exec_start = time_monotonic_ns();
+}
+
+bool sched_wakeup(proc_t *p, proc_t *cur)
+{
+  u64 min   = rq[p->cpu].min_vruntime;
+  u64 floor = min > SCHED_SLEEPER_CREDIT_NS ? min - SCHED_SLEEPER_CREDIT_NS
+                                            : 0;
+  if(p->vruntime < floor)
+    p->vruntime = floor;
+  sched_enqueue(p);
+
+  if(!cur || cur->state != PROC_STATE_RUNNING ||
+     p->sched_policy == SCHED_BATCH || p->sched_policy == SCHED_IDLE)
+    return false;
+  sched_update(cur);
+  return p->vruntime + SCHED_WAKEUP_GRAN_NS < cur->vruntime;
+}
+
+bool sched_tick(proc_t *cur)
+{
+  if(!cur || cur->state != PROC_STATE_RUNNING)
+    return false;
+  sched_update(cur);
+  const proc_t *next = rq[cur->cpu].head;
+  return next && next->vruntime < cur->vruntime;
+}
+
+void sched_fork(proc_t *child, const proc_t *parent)
+{
+  child->nice         = parent ? parent->nice : 0;
+  child->sched_policy = parent ? parent->sched_policy : SCHED_NORMAL;
+  child->cpu          = smp_cpu_id();
+  /* Never ahead of the queue, so forking cannot jump the line. */
+  u64 min         = rq[child->cpu].min_vruntime;
+  child->vruntime = min;
+  if(parent && parent->vruntime > min)
+    child->vruntime = parent->vruntime;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file src/kernel/process/vdso.c
+ * @brief Map the vDSO and its vvar page into user address spaces.
+ *
+ * The frames are allocated once at boot and shared by every process; each
+ * mapping holds a PMM reference, so exit and exec drop theirs like any
+ * other page while the kernel's own reference keeps the frames alive. Both
+ * mappings are read-only, so fork shares them instead of marking them
+ * copy-on-write.
+ */
+
+#include <alcor2/drivers/console.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/memory_layout.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/vdso.h>
+#include <alcor2/time.h>
+
+/** @brief Largest vDSO image accepted, in pages. */
+#define VDSO_MAX_PAGES 2
+
+/* Embedded by vdso_image.asm. */
+extern const u8 vdso_image[];
+extern const u8 vdso_image_end[];
+
+static u64 vvar_phys;
+static u64 vdso_phys[VDSO_MAX_PAGES];
+static u32 vdso_pages;
+
+void vdso_init(void)
+{
+  u64 size = (u64)(vdso_image_end - vdso_image);
+  if(size < 4 || kstrncmp((const char *)vdso_image, "\x7f" "ELF", 4) != 0 ||
+     size > VDSO_MAX_PAGES * PAGE_SIZE) {
+    console_print("[VDSO] No usable image; clocks stay syscalls\n");
+    return;
+  }
+
+  void *vvar = pmm_alloc();
+  if(!vvar)
+    return;
+  kzero(phys_to_virt((u64)vvar), PAGE_SIZE);
+  kmemcpy(phys_to_virt((u64)vvar), time_vdso_data(), sizeof(vdso_data_t));
+
+  u32 pages = (u32)((size + PAGE_SIZE - 1) / PAGE_SIZE);
+  for(u32 i = 0; i < pages; i++) {
+    void *frame = pmm_alloc();
+    if(!frame) {
+      while(i--)
+        pmm_free((void *)vdso_phys[i]);
+      pmm_free(vvar);
+      return;
+    }
+    u64 off   = (u64)i * PAGE_SIZE;
+    u64 chunk = size - off < PAGE_SIZE ? size - off : PAGE_SIZE;
+    kzero(phys_to_virt((u64)frame), PAGE_SIZE);
+    kmemcpy(phys_to_virt((u64)frame), vdso_image + off, chunk);
+    vdso_phys[i] = (u64)frame;
+  }
+  vvar_phys  = (u64)vvar;
+  vdso_pages = pages;
+}
+
+u64 vdso_map(u64 cr3)
+{
+  if(!vdso_pages)
+    return 0;
+
+  pmm_page_ref((void *)vvar_phys);
+  vmm_map_in(cr3, USER_VDSO_BASE, vvar_phys, VMM_PRESENT | VMM_USER);
+  for(u32 i = 0; i < vdso_pages; i++) {
+    pmm_page_ref((void *)vdso_phys[i]);
+    vmm_map_in(
+        cr3, USER_VDSO_BASE + (u64)(i + 1) * PAGE_SIZE, vdso_phys[i],
+        VMM_PRESENT | VMM_USER
+    );
+  }
+  return USER_VDSO_BASE + PAGE_SIZE;
+}
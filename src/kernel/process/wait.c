@@ -0,0 +1,230 @@
+/**
+ * @file src/kernel/process/wait.c
+ * @brief Wait queues and sleep timeouts.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/pit.h>
+#include <alcor2/errno.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/spinlock.h>
+#include <alcor2/time.h>
+
+extern void proc_schedule(void);
+
+void wait_queue_init(wait_queue_t *wq)
+{
+  wq->head = NULL;
+  wq->tail = NULL;
+}
+
+static void queue_append(wait_queue_t *wq, wait_entry_t *we)
+{
+  we->wq   = wq;
+  we->next = NULL;
+  we->prev = wq->tail;
+  if(wq->tail)
+    wq->tail->next = we;
+  else
+    wq->head = we;
+  wq->tail = we;
+}
+
+static void queue_unlink(wait_entry_t *we)
+{
+  wait_queue_t *wq = we->wq;
+  if(we->prev)
+    we->prev->next = we->next;
+  else
+    wq->head = we->next;
+  if(we->next)
+    we->next->prev = we->prev;
+  else
+    wq->tail = we->prev;
+  we->wq = NULL;
+}
+
+/**
+ * @brief Wake one entry: run its callback, or take it off its queue and timer
+ * and make its process ready.
+ * @return true if a process was woken.
+ */
+static bool wake_entry(wait_entry_t *we)
+{
+  if(we->func) {
+    we->func(we);
+    return false;
+  }
+  queue_unlink(we);
+  timer_cancel(&we->timer);
+  proc_wake(we->proc);
+  return true;
+}
+
+/** @brief Timer callback: the sleep of an entry timed out. */
+static void wait_timeout(ktimer_t *t)
+{
+  wait_entry_t *we = (wait_entry_t *)t->arg;
+  we->timed_out    = true;
+  wake_entry(we);
+}
+
+i64 wait_sleep_locked(
+    wait_queue_t *wq, spinlock_t *lock, u64 space, u64 key, u32 bits,
+    u64 deadline
+)
+{
+  proc_t *me = proc_current();
+  if(!me) {
+    /* Early boot: nothing else can run, so let an IRQ make progress. */
+    if(lock)
+      spin_unlock(lock);
+    cpu_enable_interrupts();
+    __asm__ volatile("hlt");
+    cpu_disable_interrupts();
+    if(lock)
+      spin_lock(lock);
+    return 0;
+  }
+
+  wait_entry_t we = {.proc = me, .space = space, .key = key, .bits = bits};
+  timer_init(&we.timer, wait_timeout, &we);
+  queue_append(wq, &we);
+  if(deadline)
+    timer_arm(&we.timer, deadline);
+
+  me->state = PROC_STATE_BLOCKED;
+  if(lock)
+    spin_unlock(lock);
+  spin_might_sleep();
+  proc_schedule();
+  cpu_disable_interrupts();
+  if(lock)
+    spin_lock(lock);
+
+  if(!we.wq)
+    return we.timed_out ? -ETIMEDOUT : 0;
+
+  /* Made ready by something other than a wake: a signal. */
+  queue_unlink(&we);
+  timer_cancel(&we.timer);
+  return -EINTR;
+}
+
+i64 wait_sleep_bits(
+    wait_queue_t *wq, u64 space, u64 key, u32 bits, u64 deadline
+)
+{
+  return wait_sleep_locked(wq, NULL, space, key, bits, deadline);
+}
+
+i64 wait_sleep(wait_queue_t *wq, u64 key, u64 timeout)
+{
+  u64 deadline = 0;
+  if(timeout)
+    deadline = time_monotonic_ns() + timeout * (NSEC_PER_SEC / pit_get_hz());
+  return wait_sleep_until(wq, key, deadline);
+}
+
+u32 wait_wake(wait_queue_t *wq, u32 max)
+{
+  u32 n = 0;
+  for(wait_entry_t *we = wq->head; we && n < max;) {
+    wait_entry_t *next = we->next;
+    if(wake_entry(we))
+      n++;
+    we = next;
+  }
+  return n;
+}
+
+u32 wait_wake_bits(wait_queue_t *wq, u64 space, u64 key, u32 bits, u32 max)
+{
+  u32 n = 0;
+  for(wait_entry_t *we = wq->head; we && n < max;) {
+    wait_entry_t *next = we->next;
+    if(we->space == space && we->key == key && (we->bits & bits) &&
+       wake_entry(we))
+      n++;
+    we = next;
+  }
+  return n;
+}
+
+u32 wait_requeue(
+    wait_queue_t *from, u64 space, u64 key, wait_queue_t *to, u64 nkey,
+    u32 max
+)
+{
+  u32 n = 0;
+  for(wait_entry_t *we = from->head; we && n < max;) {
+    wait_entry_t *next = we->next;
+    if(we->space == space && we->key == key) {
+      queue_unlink(we);
+      we->key = nkey;
+      queue_append(to, we);
+      n++;
+    }
+    we = next;
+  }
+  return n;
+}
+
+void poll_table_init(poll_table_t *pt, wait_entry_t *entries, u32 cap)
+{
+  pt->entries  = entries;
+  pt->cap      = cap;
+  pt->n        = 0;
+  pt->overflow = false;
+  pt->key      = 0;
+  pt->func     = NULL;
+}
+
+void poll_wait(poll_table_t *pt, wait_queue_t *wq)
+{
+  if(!pt)
+    return;
+  if(pt->n == pt->cap) {
+    pt->overflow = true;
+    return;
+  }
+
+  wait_entry_t *we = &pt->entries[pt->n++];
+  *we              = (wait_entry_t){0};
+  we->proc         = pt->func ? NULL : proc_current();
+  we->key          = pt->key;
+  we->bits         = ~0U;
+  we->func         = pt->func;
+  queue_append(wq, we);
+}
+
+void poll_table_release(poll_table_t *pt)
+{
+  for(u32 i = 0; i < pt->n; i++) {
+    if(pt->entries[i].wq)
+      queue_unlink(&pt->entries[i]);
+  }
+  pt->n        = 0;
+  pt->overflow = false;
+}
+
+i64 poll_table_sleep(poll_table_t *pt, u64 deadline)
+{
+  if(pt->overflow) {
+    u64 tick = time_monotonic_ns() + NSEC_PER_SEC / pit_get_hz();
+    if(!deadline || tick < deadline)
+      deadline = tick;
+  }
+
+  /* The timeout rides on an entry of its own that nothing else wakes. */
+  wait_queue_t timer;
+  wait_queue_init(&timer);
+  i64 r = wait_sleep_until(&timer, 0, deadline);
+
+  bool woken = false;
+  for(u32 i = 0; i < pt->n; i++)
+    woken |= pt->entries[i].wq == NULL;
+  poll_table_release(pt);
+  return woken ? 0 : r;
+}
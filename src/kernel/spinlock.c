@@ -0,0 +1,127 @@
+/**
+ * @file src/kernel/spinlock.c
+ * @brief Ticket spinlocks and the lock-order checker.
+ *
+ * The checker keeps the locks this CPU holds on a stack. Locks are only
+ * taken under the kernel lock and never held across a switch, so one
+ * stack serves every CPU.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/spinlock.h>
+#include <alcor2/sys/irqsoff.h>
+
+/* Set to 1 to check every acquisition against the held-lock stack */
+#define SPINLOCK_DEBUG 0
+
+#if SPINLOCK_DEBUG
+/** @brief Deepest nesting the checker tracks. */
+#define SPINLOCK_MAX_HELD 8
+
+static const spinlock_t *held[SPINLOCK_MAX_HELD];
+static u32               nheld;
+
+static void lockdep_report(
+    const char *what, const spinlock_t *l, const spinlock_t *other
+)
+{
+  console_printf(
+      "[LOCK] %s: %s (class %d)", what, l->name ? l->name : "?", l->class
+  );
+  if(other)
+    console_printf(
+        " while holding %s (class %d)", other->name ? other->name : "?",
+        other->class
+    );
+  console_print("\n");
+}
+
+static void lockdep_acquire(const spinlock_t *l)
+{
+  for(u32 i = 0; i < nheld; i++) {
+    if(held[i] == l) {
+      /* Spinning now would never end. */
+      lockdep_report("recursive acquire", l, NULL);
+      cpu_halt();
+    }
+  }
+
+  const spinlock_t *top = nheld ? held[nheld - 1] : NULL;
+  if(top &&
+     (top->class > l->class || (top->class == l->class && top > l)))
+    lockdep_report("lock order violated", l, top);
+
+  if(nheld < SPINLOCK_MAX_HELD)
+    held[nheld++] = l;
+  else
+    lockdep_report("held-lock stack full", l, top);
+}
+
+static void lockdep_release(const spinlock_t *l)
+{
+  for(u32 i = nheld; i > 0; i--) {
+    if(held[i - 1] == l) {
+      for(; i < nheld; i++)
+        held[i - 1] = held[i];
+      nheld--;
+      return;
+    }
+  }
+  lockdep_report("release of a lock not held", l, NULL);
+}
+#endif
+
+void spin_init(spinlock_t *l, const char *name, lock_class_t class)
+{
+  l->next  = 0;
+  l->owner = 0;
+  l->class = class;
+  l->name  = name;
+}
+
+void spin_lock(spinlock_t *l)
+{
+#if SPINLOCK_DEBUG
+  lockdep_acquire(l);
+#endif
+  u16 ticket = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+  while(__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != ticket)
+    cpu_pause();
+}
+
+void spin_unlock(spinlock_t *l)
+{
+#if SPINLOCK_DEBUG
+  lockdep_release(l);
+#endif
+  /* Only the holder writes owner. */
+  __atomic_store_n(&l->owner, (u16)(l->owner + 1), __ATOMIC_RELEASE);
+}
+
+u64 spin_lock_irqsave(spinlock_t *l)
+{
+  u64 flags;
+  __asm__ volatile("pushfq; popq %0; cli" : "=r"(flags)::"memory");
+  if(flags & CPU_RFLAGS_IF)
+    irqsoff_begin((u64)__builtin_return_address(0));
+  spin_lock(l);
+  return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *l, u64 flags)
+{
+  spin_unlock(l);
+  if(flags & CPU_RFLAGS_IF) {
+    irqsoff_end((u64)__builtin_return_address(0));
+    cpu_enable_interrupts();
+  }
+}
+
+void spin_might_sleep(void)
+{
+#if SPINLOCK_DEBUG
+  if(nheld)
+    lockdep_report("sleep while holding", held[nheld - 1], NULL);
+#endif
+}
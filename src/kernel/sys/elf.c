@@ -3,8 +3,12 @@
  * @brief ELF64 executable loader: validation, PT_LOAD mapping, file or memory
  * copy, user entry.
  *
- * Uses `vmm_map_range_alloc` for anonymous page runs and `vfs_read` for
- * `elf_load_fd` (no kernel buffer sized to the whole file).
+ * `elf_load` copies a memory image into `vmm_map_range_alloc` page runs.
+ * `elf_load_fd` maps segments as file-backed regions faulted in from the
+ * page cache (see vma.h), so exec reads only the pages a program touches.
+ * It also places ET_DYN images at a caller-chosen base and reports
+ * PT_INTERP, which is how proc_setup_image runs dynamically linked
+ * programs through musl's loader.
  */
 
 #include <alcor2/drivers/console.h>
@@ -13,17 +17,21 @@
 #include <alcor2/mm/heap.h>
 #include <alcor2/mm/memory_layout.h>
 #include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vma.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/elf.h>
 
 static void elf_info_init(const Elf64_Ehdr *ehdr, elf_info_t *info)
 {
-  info->entry = ehdr->e_entry;
-  info->base  = ELF_BASE_SENTINEL;
-  info->end   = 0;
-  info->phdr  = 0;
-  info->phent = ehdr->e_phentsize;
-  info->phnum = ehdr->e_phnum;
+  info->entry     = ehdr->e_entry;
+  info->base      = ELF_BASE_SENTINEL;
+  info->end       = 0;
+  info->phdr      = 0;
+  info->bias      = 0;
+  info->type      = ehdr->e_type;
+  info->phent     = ehdr->e_phentsize;
+  info->phnum     = ehdr->e_phnum;
+  info->interp[0] = '\0';
 }
 
 static void elf_info_track_segment(
@@ -190,104 +198,356 @@ int elf_load(const void *data, u64 size, elf_info_t *info)
   return 0;
 }
 
+static inline u64 elf_page_up(u64 addr)
+{
+  return (addr + PAGE_OFFSET_MASK) & ~PAGE_OFFSET_MASK;
+}
+
+/** @brief VMA protection bits for a segment's p_flags. */
+static u32 elf_segment_prot(const Elf64_Phdr *phdr)
+{
+  u32 prot = 0;
+  if(phdr->p_flags & PF_R)
+    prot |= VMA_READ;
+  if(phdr->p_flags & PF_W)
+    prot |= VMA_WRITE;
+  if(phdr->p_flags & PF_X)
+    prot |= VMA_EXEC;
+  return prot;
+}
+
 /**
- * @brief Load an ELF64 executable streaming directly from a file descriptor.
+ * @brief Whether every PT_LOAD segment can be mapped from the page cache.
  *
- * Reads the ELF and program headers into small stack/heap buffers, then
- * streams each PT_LOAD segment directly into HHDM-mapped physical pages.
- * Kernel memory overhead is O(1) regardless of binary size — no full-file
- * buffer is allocated.
+ * File pages are mapped whole, so each segment must sit at the same offset
+ * within a page in memory as in the file, and no two segments may share a
+ * page (program headers list PT_LOAD segments in ascending order).
+ */
+static bool elf_can_demand_page(const Elf64_Phdr *phdrs, u16 phnum)
+{
+  u64 prev_end = 0;
+  for(u16 i = 0; i < phnum; i++) {
+    const Elf64_Phdr *phdr = &phdrs[i];
+    if(phdr->p_type != PT_LOAD || phdr->p_memsz == 0)
+      continue;
+    if((phdr->p_vaddr & PAGE_OFFSET_MASK) !=
+       (phdr->p_offset & PAGE_OFFSET_MASK))
+      return false;
+    if(phdr->p_filesz > phdr->p_memsz)
+      return false;
+    if((phdr->p_vaddr & ~PAGE_OFFSET_MASK) < prev_end)
+      return false;
+    prev_end = elf_page_up(phdr->p_vaddr + phdr->p_memsz);
+  }
+  return true;
+}
+
+/**
+ * @brief Register one PT_LOAD segment as regions faulted in on first touch.
  *
- * @param fd   Open VFS file descriptor.
- * @param info Output structure for entry point and memory range.
- * @return 0 on success, -1 on failure.
+ * Whole file pages become a private mapping of the file. The page holding
+ * the end of the file data is only part file: if bss follows, it is read in
+ * now with its tail zeroed. The rest of the bss is a demand-zero region.
+ */
+static int elf_map_segment_lazy(
+    i64 fd, i32 file, const Elf64_Phdr *phdr, vma_list_t *vmas
+)
+{
+  u64 start    = phdr->p_vaddr & ~PAGE_OFFSET_MASK;
+  u64 file_end = phdr->p_vaddr + phdr->p_filesz;
+  u64 mem_end  = elf_page_up(phdr->p_vaddr + phdr->p_memsz);
+  u32 prot     = elf_segment_prot(phdr);
+  /* Without bss the tail of the last file page may show whatever follows
+   * in the file, as on any ELF loader. */
+  u64 file_map_end = phdr->p_memsz > phdr->p_filesz
+                         ? file_end & ~PAGE_OFFSET_MASK
+                         : elf_page_up(file_end);
+
+  if(file_map_end > start) {
+    vfs_oft_retain(file);
+    vma_t vma = {
+        .start  = start,
+        .end    = file_map_end,
+        .offset = phdr->p_offset & ~PAGE_OFFSET_MASK,
+        .file   = file,
+        .flags  = prot,
+    };
+    if(vma_insert(vmas, &vma) < 0) {
+      vfs_oft_release(file);
+      return -1;
+    }
+  }
+  if(mem_end <= file_map_end)
+    return 0;
+
+  vma_t bss = {
+      .start  = file_map_end,
+      .end    = mem_end,
+      .offset = 0,
+      .file   = -1,
+      .flags  = prot | VMA_ANON,
+  };
+  if(vma_insert(vmas, &bss) < 0)
+    return -1;
+
+  if(file_end > file_map_end) {
+    u64   from = phdr->p_vaddr > file_map_end ? phdr->p_vaddr : file_map_end;
+    u64   len  = file_end - from;
+    void *phys = pmm_alloc();
+    if(!phys) {
+      console_print("[ELF] Out of memory\n");
+      return -1;
+    }
+    u8 *page = phys_to_virt((u64)phys);
+    kzero(page, PAGE_SIZE);
+    vfs_seek(fd, (i64)(phdr->p_offset + (from - phdr->p_vaddr)), SEEK_SET);
+    if(vfs_read(fd, page + (from & PAGE_OFFSET_MASK), len) != (i64)len) {
+      pmm_free(phys);
+      console_print("[ELF] Cannot read segment\n");
+      return -1;
+    }
+    vmm_map(
+        file_map_end, (u64)phys,
+        VMM_USER | ((prot & VMA_WRITE) ? VMM_WRITE : 0)
+    );
+  }
+  return 0;
+}
+
+/**
+ * @brief Copy one PT_LOAD segment into freshly allocated pages.
+ *
+ * Used for images whose layout cannot be mapped from the page cache. Data
+ * is streamed in 64 KB chunks (16 ext2 blocks per call) to keep the number
+ * of VFS/ext2/ATA round-trips low.
  */
-int elf_load_fd(i64 fd, elf_info_t *info)
+static int elf_load_segment_eager(i64 fd, const Elf64_Phdr *phdr)
+{
+#define ELF_READ_CHUNK (64UL * 1024)
+  if(elf_map_segment_pages(phdr->p_vaddr, phdr->p_memsz) < 0)
+    return -1;
+  if(phdr->p_filesz == 0)
+    return 0;
+
+  u8 *read_buf = (u8 *)kmalloc(ELF_READ_CHUNK);
+  if(!read_buf)
+    return -1;
+
+  vfs_seek(fd, (i64)phdr->p_offset, SEEK_SET);
+
+  u64 remaining = phdr->p_filesz;
+  u64 dst_vaddr = phdr->p_vaddr;
+
+  while(remaining > 0) {
+    u64 chunk = remaining < ELF_READ_CHUNK ? remaining : ELF_READ_CHUNK;
+    i64 n     = vfs_read(fd, read_buf, chunk);
+    if(n <= 0)
+      break;
+
+    elf_copy_to_mapped(dst_vaddr, read_buf, (u64)n);
+    dst_vaddr += (u64)n;
+    remaining -= (u64)n;
+  }
+
+  kfree(read_buf);
+  return 0;
+#undef ELF_READ_CHUNK
+}
+
+/** @brief Parsed headers of one executable, shared by all its execs. */
+typedef struct
+{
+  const void *volume; /**< Key: volume of the inode (OFT page-cache key). */
+  u64         ino;    /**< Key: inode number. */
+  u32         refs;   /**< The cache's reference plus one per exec. */
+  bool        lazy;   /**< Segments can be mapped from the page cache. */
+  elf_info_t  info;   /**< Layout, as elf_load_fd reports it. */
+  u16         nload;
+  Elf64_Phdr  load[]; /**< PT_LOAD segments with a non-zero p_memsz. */
+} elf_image_t;
+
+/** @brief Executables whose headers are kept (round-robin replacement). */
+#define ELF_CACHE_SLOTS 16
+
+static elf_image_t *elf_cache[ELF_CACHE_SLOTS];
+static u32          elf_cache_victim;
+
+static void elf_image_put(elf_image_t *img)
+{
+  if(--img->refs == 0)
+    kfree(img);
+}
+
+/** @brief Read and validate the headers behind @p fd. */
+static elf_image_t *elf_image_read(i64 fd)
 {
   /* Read and validate ELF header. */
   Elf64_Ehdr ehdr;
   vfs_seek(fd, 0, SEEK_SET);
   if(vfs_read(fd, &ehdr, sizeof(Elf64_Ehdr)) != (i64)sizeof(Elf64_Ehdr)) {
     console_print("[ELF] Cannot read ELF header\n");
-    return -1;
+    return NULL;
   }
   if(!elf_validate(&ehdr))
-    return -1;
+    return NULL;
   if(ehdr.e_phnum == 0 || ehdr.e_phoff == 0) {
     console_print("[ELF] No program headers\n");
-    return -1;
+    return NULL;
   }
 
   /* Read program headers (typically a few KB at most). */
-  u64         phdrs_size = (u64)ehdr.e_phnum * sizeof(Elf64_Phdr);
-  Elf64_Phdr *phdrs      = (Elf64_Phdr *)kmalloc(phdrs_size);
-  if(!phdrs)
-    return -1;
+  u64          phdrs_size = (u64)ehdr.e_phnum * sizeof(Elf64_Phdr);
+  elf_image_t *img        = kmalloc(sizeof(elf_image_t) + phdrs_size);
+  if(!img)
+    return NULL;
 
   vfs_seek(fd, (i64)ehdr.e_phoff, SEEK_SET);
-  if(vfs_read(fd, phdrs, phdrs_size) != (i64)phdrs_size) {
+  if(vfs_read(fd, img->load, phdrs_size) != (i64)phdrs_size) {
     console_print("[ELF] Cannot read program headers\n");
-    kfree(phdrs);
-    return -1;
+    kfree(img);
+    return NULL;
   }
 
-  elf_info_init(&ehdr, info);
-
-  /* Load each PT_LOAD segment. */
+  /* Keep only what exec maps, compacted in place. */
+  elf_info_init(&ehdr, &img->info);
+  img->nload     = 0;
+  u64 interp_off = 0;
+  u64 interp_len = 0;
   for(u16 i = 0; i < ehdr.e_phnum; i++) {
-    const Elf64_Phdr *phdr = &phdrs[i];
+    const Elf64_Phdr *phdr = &img->load[i];
+    if(phdr->p_type == PT_PHDR)
+      img->info.phdr = phdr->p_vaddr;
+    if(phdr->p_type == PT_INTERP) {
+      interp_off = phdr->p_offset;
+      interp_len = phdr->p_filesz;
+    }
     if(phdr->p_type != PT_LOAD || phdr->p_memsz == 0)
       continue;
+    elf_info_track_segment(&ehdr, phdr, &img->info);
+    img->load[img->nload++] = *phdr;
+  }
+  if(img->info.base == ELF_BASE_SENTINEL) {
+    console_print("[ELF] No loadable segments (fd)\n");
+    kfree(img);
+    return NULL;
+  }
 
-    u64 vaddr  = phdr->p_vaddr;
-    u64 memsz  = phdr->p_memsz;
-    u64 filesz = phdr->p_filesz;
-
-    elf_info_track_segment(&ehdr, phdr, info);
-
-    if(elf_map_segment_pages(vaddr, memsz) < 0) {
-      kfree(phdrs);
-      return -1;
+  /* The interpreter path, NUL-terminated in the file. */
+  if(interp_len) {
+    char *path = img->info.interp;
+    vfs_seek(fd, (i64)interp_off, SEEK_SET);
+    if(interp_len > ELF_INTERP_MAX ||
+       vfs_read(fd, path, interp_len) != (i64)interp_len ||
+       path[interp_len - 1] != '\0' || path[0] != '/') {
+      console_print("[ELF] Bad PT_INTERP\n");
+      kfree(img);
+      return NULL;
     }
+  }
 
-    /* Stream segment data in 64 KB chunks.
-     * Reading 64 KB at a time (16 ext2 blocks per call) reduces the number
-     * of VFS/ext2/ATA round-trips from ~21 700 to ~850 for an 87 MB binary,
-     * yielding a 25× reduction in per-call overhead. */
-    if(filesz > 0) {
-#define ELF_READ_CHUNK (64UL * 1024)
-      u8 *read_buf = (u8 *)kmalloc(ELF_READ_CHUNK);
-      if(!read_buf) {
-        kfree(phdrs);
-        return -1;
-      }
-
-      vfs_seek(fd, (i64)phdr->p_offset, SEEK_SET);
-
-      u64 remaining = filesz;
-      u64 dst_vaddr = vaddr;
-
-      while(remaining > 0) {
-        u64 chunk = remaining < ELF_READ_CHUNK ? remaining : ELF_READ_CHUNK;
-        i64 n     = vfs_read(fd, read_buf, chunk);
-        if(n <= 0)
-          break;
+  img->volume = NULL;
+  img->ino    = 0;
+  img->refs   = 1;
+  img->lazy   = elf_can_demand_page(img->load, img->nload);
+  return img;
+}
 
-        elf_copy_to_mapped(dst_vaddr, read_buf, (u64)n);
-        dst_vaddr += (u64)n;
-        remaining -= (u64)n;
+/**
+ * @brief Headers of the executable in OFT slot @p file, from the cache if
+ *        they were parsed before. Drop the reference with elf_image_put().
+ */
+static elf_image_t *elf_image_get(i64 fd, i32 file)
+{
+  const vfs_oft_entry_t *e = file >= 0 ? vfs_oft_get(file) : NULL;
+  bool                   cacheable =
+      e && e->kind == VFS_KIND_FILE && e->volume && e->ino;
+
+  if(cacheable) {
+    for(u32 i = 0; i < ELF_CACHE_SLOTS; i++) {
+      elf_image_t *img = elf_cache[i];
+      if(img && img->volume == e->volume && img->ino == e->ino) {
+        img->refs++;
+        return img;
       }
-
-      kfree(read_buf);
-#undef ELF_READ_CHUNK
     }
   }
 
-  kfree(phdrs);
+  elf_image_t *img = elf_image_read(fd);
+  if(!img || !cacheable)
+    return img;
+
+  u32 slot = 0;
+  while(slot < ELF_CACHE_SLOTS && elf_cache[slot])
+    slot++;
+  if(slot == ELF_CACHE_SLOTS) {
+    slot             = elf_cache_victim;
+    elf_cache_victim = (elf_cache_victim + 1) % ELF_CACHE_SLOTS;
+    elf_image_put(elf_cache[slot]);
+  }
+  img->refs++;
+  img->volume     = e->volume;
+  img->ino        = e->ino;
+  elf_cache[slot] = img;
+  return img;
+}
 
-  if(info->base == ELF_BASE_SENTINEL) {
-    console_print("[ELF] No loadable segments (fd)\n");
+void elf_cache_invalidate(const void *volume, u64 ino)
+{
+  for(u32 i = 0; i < ELF_CACHE_SLOTS; i++) {
+    elf_image_t *img = elf_cache[i];
+    if(img && img->volume == volume && img->ino == ino) {
+      elf_cache[i] = NULL;
+      elf_image_put(img);
+    }
+  }
+}
+
+/**
+ * @brief Load an ELF64 executable from a file descriptor, on demand.
+ *
+ * Takes the validated headers from the exec image cache, reading them only
+ * on the first exec of an inode, then records each PT_LOAD segment in
+ * @p vmas as a private file mapping plus a demand-zero bss, so pages are
+ * read from the page cache when first touched and exec costs what the
+ * program actually uses. Images whose segments cannot be mapped page by
+ * page are copied in up front instead. ET_DYN segments are shifted to
+ * @p dyn_base, which must be page aligned.
+ *
+ * @param fd       Open VFS file descriptor.
+ * @param vmas     Region list of the process being loaded (the current one).
+ * @param dyn_base Load address for ET_DYN; ignored for ET_EXEC.
+ * @param info     Output structure for entry point and memory range.
+ * @return 0 on success, -1 on failure.
+ */
+int elf_load_fd(i64 fd, vma_list_t *vmas, u64 dyn_base, elf_info_t *info)
+{
+  i32          file = vfs_fd_to_oft(fd);
+  elf_image_t *img  = elf_image_get(fd, file);
+  if(!img)
     return -1;
+
+  /* The cached layout is unbiased: the same image serves any base. */
+  u64  lowest = img->info.base & ~PAGE_OFFSET_MASK;
+  u64  bias   = img->info.type == ET_DYN ? dyn_base - lowest : 0;
+  bool lazy   = file >= 0 && img->lazy;
+  for(u16 i = 0; i < img->nload; i++) {
+    Elf64_Phdr seg = img->load[i];
+    seg.p_vaddr += bias;
+    int rc = lazy ? elf_map_segment_lazy(fd, file, &seg, vmas)
+                  : elf_load_segment_eager(fd, &seg);
+    if(rc < 0) {
+      elf_image_put(img);
+      return -1;
+    }
   }
+
+  *info = img->info;
+  info->entry += bias;
+  info->base += bias;
+  info->end += bias;
+  if(info->phdr)
+    info->phdr += bias;
+  info->bias = bias;
+  elf_image_put(img);
   return 0;
 }
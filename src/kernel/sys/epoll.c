@@ -0,0 +1,440 @@
+/**
+ * @file src/kernel/sys/epoll.c
+ * @brief epoll instances: an interest list with a ready list.
+ *
+ * Each watched descriptor is an ::epitem_t that stays registered on the
+ * wait queues of its target for as long as it is watched.  Those entries
+ * carry a callback instead of a sleeper, so whenever the target wakes its
+ * queue the item moves onto the instance's ready list and epoll_wait()
+ * sleepers are woken.  epoll_wait() then only re-checks items on the ready
+ * list instead of scanning every watched descriptor.
+ *
+ * Level-triggered items go back to the end of the ready list after being
+ * reported, and leave it once their target is no longer ready;
+ * edge-triggered items leave it at once until the next wake; one-shot items
+ * are disarmed until EPOLL_CTL_MOD.
+ */
+
+#include <alcor2/errno.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/sys/internal.h>
+#include <alcor2/time.h>
+
+/** @name epoll ABI (Linux x86_64)
+ * @{ */
+#define EPOLLRDHUP     0x2000U
+#define EPOLLONESHOT   (1U << 30)
+#define EPOLLET        (1U << 31)
+#define EPOLL_CTL_ADD  1
+#define EPOLL_CTL_DEL  2
+#define EPOLL_CTL_MOD  3
+#define EPOLL_CLOEXEC  O_CLOEXEC
+/** @} */
+
+/** @brief Conditions reported whether asked for or not. */
+#define EP_ALWAYS (VFS_POLL_ERR | VFS_POLL_HUP)
+
+/** @brief Wait queues one target registers on (pipe end or keyboard). */
+#define EP_ITEM_WAITS 2
+
+/** @brief x86_64 <sys/epoll.h> layout: packed, 12 bytes. */
+typedef struct __attribute__((packed))
+{
+  u32 events;
+  u64 data;
+} epoll_event_abi_t;
+
+struct epoll;
+
+/** @brief One watched descriptor. */
+typedef struct epitem
+{
+  struct epoll  *ep;     /**< Owning instance. */
+  struct epitem *next;   /**< Interest list. */
+  struct epitem *rnext;  /**< Ready list. */
+  i64            fd;     /**< Descriptor number it was added under. */
+  i32            oft;    /**< Target OFT slot; -1 for console stdio. */
+  u32            events; /**< Requested events and EPOLLET / EPOLLONESHOT. */
+  u64            data;   /**< Returned verbatim with each event. */
+  bool           ready;  /**< On the ready list. */
+  bool           armed;  /**< Cleared once a one-shot item fired. */
+  poll_table_t   pt;     /**< Standing registrations on the target. */
+  wait_entry_t   waits[EP_ITEM_WAITS];
+} epitem_t;
+
+/** @brief An epoll instance (the @c obj of a ::VFS_KIND_EPOLL entry). */
+typedef struct epoll
+{
+  epitem_t     *items;   /**< Interest list. */
+  epitem_t     *rhead;   /**< Ready list, oldest first. */
+  epitem_t     *rtail;
+  wait_queue_t  waiters; /**< epoll_wait() sleepers and poll() on the fd. */
+  struct epoll *next;    /**< All instances (see ::epoll_oft_closed). */
+} epoll_t;
+
+static epoll_t *ep_list;
+
+static void ep_ready_push(epoll_t *ep, epitem_t *it)
+{
+  it->ready = true;
+  it->rnext = NULL;
+  if(ep->rtail)
+    ep->rtail->rnext = it;
+  else
+    ep->rhead = it;
+  ep->rtail = it;
+}
+
+static epitem_t *ep_ready_pop(epoll_t *ep)
+{
+  epitem_t *it = ep->rhead;
+  ep->rhead    = it->rnext;
+  if(!ep->rhead)
+    ep->rtail = NULL;
+  it->ready = false;
+  it->rnext = NULL;
+  return it;
+}
+
+static void ep_ready_remove(epoll_t *ep, epitem_t *it)
+{
+  if(!it->ready)
+    return;
+  epitem_t *prev = NULL;
+  for(epitem_t *r = ep->rhead; r != it; r = r->rnext)
+    prev = r;
+  if(prev)
+    prev->rnext = it->rnext;
+  else
+    ep->rhead = it->rnext;
+  if(ep->rtail == it)
+    ep->rtail = prev;
+  it->ready = false;
+  it->rnext = NULL;
+}
+
+/** @brief Wait-queue callback: the target of an item changed state. */
+static void ep_callback(wait_entry_t *we)
+{
+  epitem_t *it = (epitem_t *)we->key;
+  epoll_t  *ep = it->ep;
+  if(!it->ready && it->armed)
+    ep_ready_push(ep, it);
+  wait_wake_all(&ep->waiters);
+}
+
+/** @brief Events of @p it that hold right now, registering when @p pt. */
+static u32 ep_item_poll(epitem_t *it, poll_table_t *pt)
+{
+  i32 mask = it->oft >= 0 ? vfs_oft_poll(it->oft, pt)
+                          : io_poll_fd((u64)it->fd, pt);
+  if(mask < 0)
+    return VFS_POLL_ERR;
+  u32 ev = (u32)mask;
+  if((ev & VFS_POLL_HUP) && (it->events & EPOLLRDHUP))
+    ev |= EPOLLRDHUP;
+  return ev & (it->events | EP_ALWAYS);
+}
+
+static void ep_item_free(epoll_t *ep, epitem_t *it)
+{
+  poll_table_release(&it->pt);
+  ep_ready_remove(ep, it);
+  kfree(it);
+}
+
+static void ep_unlink(epoll_t *ep, epitem_t *it)
+{
+  epitem_t **link = &ep->items;
+  while(*link != it)
+    link = &(*link)->next;
+  *link = it->next;
+  ep_item_free(ep, it);
+}
+
+static epitem_t *ep_find(epoll_t *ep, i64 fd, i32 oft)
+{
+  for(epitem_t *it = ep->items; it; it = it->next) {
+    if(it->fd == fd && it->oft == oft)
+      return it;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Move up to @p max reportable events off the ready list into @p out.
+ * @return Events stored.
+ */
+static u32 ep_collect(epoll_t *ep, epoll_event_abi_t *out, u32 max)
+{
+  epitem_t *again      = NULL;
+  epitem_t *again_tail = NULL;
+  u32       n          = 0;
+  while(n < max && ep->rhead) {
+    epitem_t *it = ep_ready_pop(ep);
+    if(!it->armed)
+      continue;
+    u32 ev = ep_item_poll(it, NULL);
+    if(!ev)
+      continue;
+
+    out[n].events = ev;
+    out[n].data   = it->data;
+    n++;
+    if(it->events & EPOLLONESHOT) {
+      it->armed = false;
+    } else if(!(it->events & EPOLLET)) {
+      /* Level-triggered: check it again on the next call. */
+      it->rnext = NULL;
+      if(again_tail)
+        again_tail->rnext = it;
+      else
+        again = it;
+      again_tail = it;
+    }
+  }
+  for(epitem_t *it = again; it;) {
+    epitem_t *next = it->rnext;
+    ep_ready_push(ep, it);
+    it = next;
+  }
+  return n;
+}
+
+u32 epoll_poll(void *obj, poll_table_t *pt)
+{
+  epoll_t *ep = obj;
+  poll_wait(pt, &ep->waiters);
+
+  /* Drop stale entries so poll() does not report an empty instance. */
+  for(epitem_t *it = ep->rhead; it;) {
+    epitem_t *next = it->rnext;
+    if(!it->armed || !ep_item_poll(it, NULL))
+      ep_ready_remove(ep, it);
+    it = next;
+  }
+  return ep->rhead ? VFS_POLL_IN : 0;
+}
+
+void epoll_oft_release(void *obj)
+{
+  epoll_t *ep = obj;
+  while(ep->items) {
+    epitem_t *it = ep->items;
+    ep->items    = it->next;
+    ep_item_free(ep, it);
+  }
+
+  epoll_t **link = &ep_list;
+  while(*link != ep)
+    link = &(*link)->next;
+  *link = ep->next;
+  kfree(ep);
+}
+
+void epoll_oft_closed(i32 idx)
+{
+  for(epoll_t *ep = ep_list; ep; ep = ep->next) {
+    for(epitem_t *it = ep->items; it;) {
+      epitem_t *next = it->next;
+      if(it->oft == idx)
+        ep_unlink(ep, it);
+      it = next;
+    }
+  }
+}
+
+/** @brief Instance behind @p epfd, or NULL if it is not an epoll fd. */
+static epoll_t *ep_from_fd(i64 epfd, i32 *oft)
+{
+  i32 idx = vfs_fd_to_oft(epfd);
+  if(idx < 0)
+    return NULL;
+  const vfs_oft_entry_t *e = vfs_oft_get(idx);
+  if(!e || e->kind != VFS_KIND_EPOLL)
+    return NULL;
+  if(oft)
+    *oft = idx;
+  return e->obj;
+}
+
+u64 sys_epoll_create1(u64 flags, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if((u32)flags & ~(u32)EPOLL_CLOEXEC)
+    return (u64)-EINVAL;
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-EINVAL;
+
+  epoll_t *ep = kzalloc(sizeof(*ep));
+  if(!ep)
+    return (u64)-ENOMEM;
+  ep->next = ep_list;
+  ep_list  = ep;
+
+  i32 oft = vfs_oft_alloc_obj(VFS_KIND_EPOLL, ep);
+  if(oft < 0) {
+    epoll_oft_release(ep);
+    return (u64)-ENFILE;
+  }
+  i64 fd = vfs_install_fd(oft);
+  if(fd < 0) {
+    vfs_oft_release(oft);
+    return (u64)fd;
+  }
+  if((u32)flags & EPOLL_CLOEXEC)
+    p->fd_cloexec[fd] = 1;
+  return (u64)fd;
+}
+
+u64 sys_epoll_create(u64 size, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  /* The size hint is ignored, but must be positive. */
+  if((i32)size <= 0)
+    return (u64)-EINVAL;
+  return sys_epoll_create1(0, 0, 0, 0, 0, 0);
+}
+
+u64 sys_epoll_ctl(u64 epfd, u64 op, u64 fd, u64 event, u64 a5, u64 a6)
+{
+  (void)a5;
+  (void)a6;
+
+  i32      ep_oft;
+  epoll_t *ep = ep_from_fd((i64)epfd, &ep_oft);
+  if(!ep)
+    return vfs_fd_is_valid((i64)epfd) ? (u64)-EINVAL : (u64)-EBADF;
+
+  /* Console stdio has no OFT entry but is still pollable. */
+  i32 oft = vfs_fd_to_oft((i64)fd);
+  if(oft < 0 && fd > 2)
+    return (u64)-EBADF;
+  if(oft < 0)
+    oft = -1;
+  if(oft == ep_oft)
+    return (u64)-EINVAL;
+  if(oft >= 0) {
+    const vfs_oft_entry_t *e = vfs_oft_get(oft);
+    if(e->kind == VFS_KIND_FILE)
+      return (u64)-EPERM;
+    if(e->kind == VFS_KIND_EPOLL)
+      return (u64)-EINVAL;
+  }
+
+  epoll_event_abi_t ev = {0};
+  if(op != EPOLL_CTL_DEL) {
+    if(!vmm_is_user_range((void *)event, sizeof(ev)))
+      return (u64)-EFAULT;
+    ev = *(const epoll_event_abi_t *)event;
+  }
+
+  epitem_t *it = ep_find(ep, (i64)fd, oft);
+  switch(op) {
+  case EPOLL_CTL_ADD:
+    if(it)
+      return (u64)-EEXIST;
+    it = kzalloc(sizeof(*it));
+    if(!it)
+      return (u64)-ENOMEM;
+    it->ep     = ep;
+    it->fd     = (i64)fd;
+    it->oft    = oft;
+    it->events = ev.events;
+    it->data   = ev.data;
+    it->armed  = true;
+    it->next   = ep->items;
+    ep->items  = it;
+
+    poll_table_init(&it->pt, it->waits, EP_ITEM_WAITS);
+    it->pt.key  = (u64)it;
+    it->pt.func = ep_callback;
+    if(ep_item_poll(it, &it->pt))
+      ep_ready_push(ep, it);
+    break;
+
+  case EPOLL_CTL_MOD:
+    if(!it)
+      return (u64)-ENOENT;
+    it->events = ev.events;
+    it->data   = ev.data;
+    it->armed  = true;
+    if(!it->ready && ep_item_poll(it, NULL))
+      ep_ready_push(ep, it);
+    break;
+
+  case EPOLL_CTL_DEL:
+    if(!it)
+      return (u64)-ENOENT;
+    ep_unlink(ep, it);
+    return 0;
+
+  default:
+    return (u64)-EINVAL;
+  }
+
+  if(ep->rhead)
+    wait_wake_all(&ep->waiters);
+  return 0;
+}
+
+u64 sys_epoll_wait(
+    u64 epfd, u64 events, u64 maxevents, u64 timeout, u64 a5, u64 a6
+)
+{
+  (void)a5;
+  (void)a6;
+
+  i32 max = (i32)maxevents;
+  if(max <= 0)
+    return (u64)-EINVAL;
+  if(!vmm_is_user_range((void *)events, (u64)max * sizeof(epoll_event_abi_t)))
+    return (u64)-EFAULT;
+  epoll_t *ep = ep_from_fd((i64)epfd, NULL);
+  if(!ep)
+    return vfs_fd_is_valid((i64)epfd) ? (u64)-EINVAL : (u64)-EBADF;
+
+  /* Negative waits forever. */
+  i32 ms       = (i32)timeout;
+  u64 deadline = 0;
+  if(ms > 0)
+    deadline = time_monotonic_ns() + (u64)ms * (NSEC_PER_SEC / 1000);
+
+  epoll_event_abi_t *out = (epoll_event_abi_t *)events;
+  for(;;) {
+    u32 n = ep_collect(ep, out, (u32)max);
+    if(n || ms == 0)
+      return n;
+
+    if(deadline && time_monotonic_ns() >= deadline)
+      return 0;
+    if(wait_sleep_until(&ep->waiters, 0, deadline) == -EINTR)
+      return (u64)-EINTR;
+  }
+}
+
+u64 sys_epoll_pwait(
+    u64 epfd, u64 events, u64 maxevents, u64 timeout, u64 sigmask, u64 a6
+)
+{
+  (void)a6;
+
+  /* Signal masks are not applied while waiting. */
+  (void)sigmask;
+  return sys_epoll_wait(epfd, events, maxevents, timeout, 0, 0);
+}
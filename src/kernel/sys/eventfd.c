@@ -0,0 +1,163 @@
+/**
+ * @file src/kernel/sys/eventfd.c
+ * @brief eventfd: a 64-bit counter that wakes readers when it is non-zero.
+ *
+ * An eventfd lives in the open file table as a ::VFS_KIND_EVENTFD entry.
+ * write() adds to the counter and read() takes it (or, with EFD_SEMAPHORE,
+ * one unit of it), blocking while it is zero. With ::ALCOR_EFD_KEYBOARD
+ * the instance also keeps a callback entry on the keyboard's wait queue,
+ * and every keyboard interrupt adds one to the counter.
+ */
+
+#include <alcor2/alcor_eventfd.h>
+#include <alcor2/drivers/keyboard.h>
+#include <alcor2/errno.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/sys/internal.h>
+
+/** @name eventfd ABI (Linux x86_64)
+ * @{ */
+#define EFD_SEMAPHORE 0x00001U
+#define EFD_NONBLOCK  0x00800U
+#define EFD_CLOEXEC   O_CLOEXEC
+/** @} */
+
+/** @brief Flags eventfd2 accepts. */
+#define EFD_FLAGS                                                              \
+  (EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC | ALCOR_EFD_KEYBOARD)
+
+/** @brief Largest value the counter can hold. */
+#define EFD_MAX 0xFFFFFFFFFFFFFFFEULL
+
+/** @brief An eventfd (the @c obj of a ::VFS_KIND_EVENTFD entry). */
+typedef struct
+{
+  u64          count;   /**< Counter value. */
+  u32          flags;   /**< EFD_SEMAPHORE, EFD_NONBLOCK, ALCOR_EFD_KEYBOARD. */
+  wait_queue_t waiters; /**< Blocked readers and writers, and pollers. */
+  poll_table_t kbd;     /**< Keyboard registration (ALCOR_EFD_KEYBOARD). */
+  wait_entry_t kbd_wait;
+} eventfd_t;
+
+static void efd_add(eventfd_t *efd, u64 n)
+{
+  efd->count = n > EFD_MAX - efd->count ? EFD_MAX : efd->count + n;
+  wait_wake_all(&efd->waiters);
+}
+
+/** @brief Keyboard wait-queue callback: a scancode arrived. */
+static void efd_keyboard(wait_entry_t *we)
+{
+  efd_add((eventfd_t *)we->key, 1);
+}
+
+u32 eventfd_poll(void *obj, poll_table_t *pt)
+{
+  eventfd_t *efd = (eventfd_t *)obj;
+  poll_wait(pt, &efd->waiters);
+
+  u32 mask = 0;
+  if(efd->count)
+    mask |= VFS_POLL_IN;
+  if(efd->count < EFD_MAX)
+    mask |= VFS_POLL_OUT;
+  return mask;
+}
+
+i64 eventfd_read_obj(void *obj, void *buf, u64 count)
+{
+  eventfd_t *efd = (eventfd_t *)obj;
+  if(count < sizeof(u64))
+    return -EINVAL;
+
+  while(!efd->count) {
+    if(efd->flags & EFD_NONBLOCK)
+      return -EAGAIN;
+    if(wait_sleep(&efd->waiters, 0, 0) == -EINTR)
+      return -EINTR;
+  }
+
+  u64 v = efd->flags & EFD_SEMAPHORE ? 1 : efd->count;
+  efd->count -= v;
+  *(u64 *)buf = v;
+  wait_wake_all(&efd->waiters);
+  return sizeof(u64);
+}
+
+i64 eventfd_write_obj(void *obj, const void *buf, u64 count)
+{
+  eventfd_t *efd = (eventfd_t *)obj;
+  if(count < sizeof(u64))
+    return -EINVAL;
+  u64 v = *(const u64 *)buf;
+  if(v > EFD_MAX)
+    return -EINVAL;
+
+  while(v > EFD_MAX - efd->count) {
+    if(efd->flags & EFD_NONBLOCK)
+      return -EAGAIN;
+    if(wait_sleep(&efd->waiters, 0, 0) == -EINTR)
+      return -EINTR;
+  }
+
+  if(v)
+    efd_add(efd, v);
+  return sizeof(u64);
+}
+
+void eventfd_oft_release(void *obj)
+{
+  eventfd_t *efd = (eventfd_t *)obj;
+  poll_table_release(&efd->kbd);
+  kfree(efd);
+}
+
+u64 sys_eventfd2(u64 initval, u64 flags, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if((u32)flags & ~EFD_FLAGS || initval > 0xFFFFFFFFULL)
+    return (u64)-EINVAL;
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-EINVAL;
+
+  eventfd_t *efd = kzalloc(sizeof(*efd));
+  if(!efd)
+    return (u64)-ENOMEM;
+  efd->count = initval;
+  efd->flags = (u32)flags & ~EFD_CLOEXEC;
+  poll_table_init(&efd->kbd, &efd->kbd_wait, 1);
+
+  i32 oft = vfs_oft_alloc_obj(VFS_KIND_EVENTFD, efd);
+  if(oft < 0) {
+    kfree(efd);
+    return (u64)-ENFILE;
+  }
+  i64 fd = vfs_install_fd(oft);
+  if(fd < 0) {
+    vfs_oft_release(oft);
+    return (u64)fd;
+  }
+
+  if(efd->flags & ALCOR_EFD_KEYBOARD) {
+    efd->kbd.key  = (u64)efd;
+    efd->kbd.func = efd_keyboard;
+    keyboard_poll_wait(&efd->kbd);
+  }
+  if((u32)flags & EFD_CLOEXEC)
+    p->fd_cloexec[fd] = 1;
+  return (u64)fd;
+}
+
+u64 sys_eventfd(u64 initval, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a2;
+  return sys_eventfd2(initval, 0, a3, a4, a5, a6);
+}
@@ -0,0 +1,123 @@
+/**
+ * @file src/kernel/sys/irqsoff.c
+ * @brief Interrupts-off latency tracker (see alcor2/sys/irqsoff.h).
+ *
+ * Only the outermost disable counts: the hooks that start a stretch are
+ * called only when IF was set, and an end with no stretch open (IF had
+ * been off since boot, or a nested section re-enabled first) is ignored.
+ * Until the TSC is calibrated its cycles are taken to be nanoseconds.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/sys/irqsoff.h>
+#include <alcor2/time.h>
+
+#if IRQSOFF_TRACE
+
+/** @brief When each CPU's open stretch began, or 0. */
+static u64            open_tsc[SMP_MAX_CPUS];
+static u64            open_site[SMP_MAX_CPUS];
+static irqsoff_site_t sites[IRQSOFF_SITES];
+static irqsoff_site_t worst;
+static u64            hist[IRQSOFF_BUCKETS];
+
+/* Slot of @p site, claimed on first use; 0 once the table is full. */
+static irqsoff_site_t *site_slot(u64 site)
+{
+  u32 i = (u32)((site >> 4) * 0x9E3779B1ULL % (IRQSOFF_SITES - 1)) + 1;
+  for(u32 n = 1; n < IRQSOFF_SITES; n++) {
+    if(sites[i].site == site || !sites[i].site) {
+      sites[i].site = site;
+      return &sites[i];
+    }
+    i = i % (IRQSOFF_SITES - 1) + 1;
+  }
+  return &sites[0];
+}
+
+void irqsoff_begin(u64 site)
+{
+  u32 c        = smp_cpu_id();
+  open_tsc[c]  = cpu_rdtsc();
+  open_site[c] = site;
+}
+
+void irqsoff_end(u64 site)
+{
+  u32 c = smp_cpu_id();
+  if(!open_tsc[c])
+    return;
+  u64 cycles  = cpu_rdtsc() - open_tsc[c];
+  open_tsc[c] = 0;
+  /* The tables are shared; an idle CPU outside the kernel lock leaves its
+   * stretch out. */
+  if(!cpu_this()->locked)
+    return;
+
+  u64 per_us = time_tsc_hz() / 1000000;
+  u64 ns     = per_us ? cycles * 1000 / per_us : cycles;
+
+  u64 us = ns / 1000;
+  u32 b  = us ? 64 - (u32)__builtin_clzll(us) : 0;
+  hist[b < IRQSOFF_BUCKETS ? b : IRQSOFF_BUCKETS - 1]++;
+
+  irqsoff_site_t *s = site_slot(open_site[c]);
+  s->count++;
+  s->total_ns += ns;
+  if(ns > s->max_ns) {
+    s->max_ns  = ns;
+    s->max_end = site;
+  }
+  if(ns > worst.max_ns) {
+    worst.site    = open_site[c];
+    worst.max_ns  = ns;
+    worst.max_end = site;
+  }
+  worst.count++;
+  worst.total_ns += ns;
+}
+
+/* Readers copy with interrupts off so a handler cannot update midway. */
+
+bool irqsoff_site_get(u32 i, irqsoff_site_t *out)
+{
+  if(i >= IRQSOFF_SITES)
+    return false;
+  u64 flags = cpu_read_flags();
+  cpu_disable_interrupts();
+  *out = sites[i];
+  if(flags & CPU_RFLAGS_IF)
+    cpu_enable_interrupts();
+  return true;
+}
+
+bool irqsoff_summary(irqsoff_site_t *w, u64 *buckets)
+{
+  u64 flags = cpu_read_flags();
+  cpu_disable_interrupts();
+  *w = worst;
+  for(u32 i = 0; i < IRQSOFF_BUCKETS; i++)
+    buckets[i] = hist[i];
+  if(flags & CPU_RFLAGS_IF)
+    cpu_enable_interrupts();
+  return true;
+}
+
+#else
+
+bool irqsoff_site_get(u32 i, irqsoff_site_t *out)
+{
+  (void)i;
+  (void)out;
+  return false;
+}
+
+bool irqsoff_summary(irqsoff_site_t *w, u64 *buckets)
+{
+  (void)w;
+  (void)buckets;
+  return false;
+}
+
+#endif
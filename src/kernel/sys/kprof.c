@@ -0,0 +1,193 @@
+/**
+ * @file src/kernel/sys/kprof.c
+ * @brief Sampling kernel profiler driven by the timer interrupt.
+ *
+ * The interrupt is the only writer of the ring and the syscall the only
+ * reader, so the two indices need no lock: each side publishes its own
+ * and only reads the other's. Every CPU's timer samples into it, but only
+ * under the kernel lock, so there is still one writer at a time and a
+ * single ring.
+ *
+ * Backtraces follow saved RBP values (the kernel keeps frame pointers) and
+ * stay on the interrupted process's kernel stack: a frame outside it, not
+ * above the previous one or returning outside the kernel text ends the
+ * walk, so a stray RBP cannot fault inside the interrupt.
+ */
+
+#include <alcor2/alcor_kprof.h>
+#include <alcor2/errno.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/uaccess.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/sys/internal.h>
+#include <alcor2/sys/kprof.h>
+#include <alcor2/time.h>
+
+/** @brief Samples queued at most; a power of two. */
+#define KPROF_RING 2048
+
+/** @brief Bounds of the kernel code, from the linker script. */
+extern const char __text_start[] __attribute__((visibility("hidden")));
+extern const char __text_end[] __attribute__((visibility("hidden")));
+
+extern void kmain(void);
+
+u64 kprof_period_ns;
+
+static alcor_kprof_sample_t *ring;
+static u64                   head; /**< Samples ever written. */
+static u64                   tail; /**< Samples ever read. */
+static u64                   kprof_hz;
+static u64                   last_ns; /**< Time of the last sample. */
+static u64                   nr_samples;
+static u64                   nr_dropped;
+
+static bool in_text(u64 addr)
+{
+  return addr >= (u64)__text_start && addr < (u64)__text_end;
+}
+
+/**
+ * @brief Return addresses of the frames from @p fp up, within the stack
+ *        range [@p lo, @p hi), into @p out.
+ * @return Addresses stored, at most @p max.
+ */
+static u32 backtrace(u64 fp, u64 lo, u64 hi, u64 *out, u32 max)
+{
+  u32 n = 0;
+  while(n < max && fp >= lo && fp + 16 <= hi && !(fp & 7)) {
+    const u64 *frame = (const u64 *)fp;
+    if(!in_text(frame[1]))
+      break;
+    out[n++] = frame[1];
+    if(frame[0] <= fp)
+      break;
+    fp = frame[0];
+  }
+  return n;
+}
+
+void kprof_sample(const interrupt_frame_t *frame)
+{
+  if(!kprof_period_ns)
+    return;
+  /* Interrupts for timers or ticks may come between the armed ones. */
+  u64 now = time_monotonic_ns();
+  if(now - last_ns < kprof_period_ns / 2)
+    return;
+  last_ns = now;
+
+  u64 t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+  if(head - t == KPROF_RING) {
+    nr_dropped++;
+    return;
+  }
+
+  alcor_kprof_sample_t *s = &ring[head % KPROF_RING];
+  proc_t               *p = proc_current();
+  s->pid                  = p ? p->pid : 0;
+  s->pc[0]                = frame->rip;
+  s->depth                = 1;
+  s->flags                = 0;
+  if(frame->cs & 3) {
+    s->flags = ALCOR_KPROF_USER;
+  } else if(p && (u64)frame >= (u64)p->kernel_stack &&
+            (u64)frame < (u64)p->kernel_stack_top) {
+    u64 ret[ALCOR_KPROF_DEPTH - 1];
+    u32 n = backtrace(
+        frame->rbp, (u64)frame, (u64)p->kernel_stack_top, ret,
+        ALCOR_KPROF_DEPTH - 1
+    );
+    kmemcpy(&s->pc[1], ret, n * sizeof(ret[0]));
+    s->depth += n;
+  }
+  nr_samples++;
+  __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Move up to @p cap queued samples to user buffer @p buf.
+ * @return Samples moved, or @c -EFAULT if none could be.
+ */
+static i64 kprof_read(alcor_kprof_sample_t *buf, u64 cap)
+{
+  u64 h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  u64 n = 0;
+  while(n < cap && tail != h) {
+    if(copy_to_user(&buf[n], &ring[tail % KPROF_RING], sizeof(*buf)) < 0)
+      return n ? (i64)n : -EFAULT;
+    __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    n++;
+  }
+  return (i64)n;
+}
+
+/**
+ * @brief Control the kernel profiler or read its samples.
+ *
+ * @param op    ::ALCOR_KPROF_ON, ::ALCOR_KPROF_OFF, ::ALCOR_KPROF_RESET,
+ *              ::ALCOR_KPROF_READ or ::ALCOR_KPROF_INFO.
+ * @param arg   ON: samples per second (0 = ::ALCOR_KPROF_DEFAULT_HZ).
+ *              READ: array of ::alcor_kprof_sample_t. INFO: an
+ *              ::alcor_kprof_info_t.
+ * @param count READ: capacity of @p arg in samples.
+ * @return READ: samples moved; otherwise 0. @c -EINVAL for a rate above
+ *         ::ALCOR_KPROF_MAX_HZ, @c -ENOMEM, @c -EFAULT.
+ */
+u64 sys_alcor_kprof(u64 op, u64 arg, u64 count, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  switch(op) {
+  case ALCOR_KPROF_ON:
+    if(!arg)
+      arg = ALCOR_KPROF_DEFAULT_HZ;
+    if(arg > ALCOR_KPROF_MAX_HZ)
+      return (u64)-EINVAL;
+    if(!ring) {
+      ring = kzalloc(KPROF_RING * sizeof(*ring));
+      if(!ring)
+        return (u64)-ENOMEM;
+    }
+    kprof_hz = arg;
+    __atomic_store_n(&kprof_period_ns, NSEC_PER_SEC / arg, __ATOMIC_RELEASE);
+    return 0;
+
+  case ALCOR_KPROF_OFF:
+    kprof_period_ns = 0;
+    kprof_hz        = 0;
+    return 0;
+
+  case ALCOR_KPROF_RESET:
+    __atomic_store_n(
+        &tail, __atomic_load_n(&head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE
+    );
+    nr_samples = 0;
+    nr_dropped = 0;
+    return 0;
+
+  case ALCOR_KPROF_READ:
+    if(!ring)
+      return 0;
+    return (u64)kprof_read((alcor_kprof_sample_t *)arg, count);
+
+  case ALCOR_KPROF_INFO: {
+    alcor_kprof_info_t info = {
+        .kmain   = (u64)kmain,
+        .hz      = kprof_hz,
+        .samples = nr_samples,
+        .dropped = nr_dropped,
+        .queued  = __atomic_load_n(&head, __ATOMIC_ACQUIRE) - tail,
+    };
+    if(copy_to_user((void *)arg, &info, sizeof(info)) < 0)
+      return (u64)-EFAULT;
+    return 0;
+  }
+
+  default:
+    return (u64)-EINVAL;
+  }
+}
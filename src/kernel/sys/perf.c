@@ -0,0 +1,345 @@
+/**
+ * @file src/kernel/sys/perf.c
+ * @brief perf_event_open: hardware counters per process or for the CPU.
+ *
+ * An event lives in the open file table as a ::VFS_KIND_PERF entry and
+ * owns one general-purpose counter for its lifetime. Events of processes
+ * share counters, since only the running process's events are loaded:
+ * ::perf_switch adds what the hardware counted to the outgoing events and
+ * starts the incoming ones from zero. Whole-CPU events keep their counter
+ * to themselves and run whoever is current. A process's events take the
+ * lowest counters, CPU events the highest.
+ *
+ * Everything here runs under the kernel lock, so nothing needs one of its
+ * own. Counters are per CPU, though: an event loaded on another CPU (its
+ * process runs there, or it counts that CPU) can only be read as of its
+ * last unload, and stopping it from here drops what it counted since.
+ */
+
+#include <alcor2/alcor_perf.h>
+#include <alcor2/arch/pmu.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/errno.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/uaccess.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/sys/internal.h>
+#include <alcor2/sys/perf.h>
+
+/** @brief @c flags bits perf_event_open accepts. */
+#define PERF_FLAGS                                                             \
+  (ALCOR_PERF_DISABLED | ALCOR_PERF_EXCLUDE_USER |                             \
+   ALCOR_PERF_EXCLUDE_KERNEL | ALCOR_PERF_EXCLUDE_HV |                         \
+   ALCOR_PERF_EXCLUDE_IDLE)
+
+/** @brief An event (the @c obj of a ::VFS_KIND_PERF entry). */
+typedef struct perf_event
+{
+  u64                evtsel;  /**< IA32_PERFEVTSELx value, without EN. */
+  u64                count;   /**< Counted before the last load. */
+  proc_t            *proc;    /**< Monitored process, NULL once it exited. */
+  struct perf_event *next;    /**< Next event of @c proc. */
+  u32                idx;     /**< Counter. */
+  u32                on;      /**< CPU it is loaded on, or counts. */
+  bool               cpu;     /**< Counts the whole CPU. */
+  bool               enabled; /**< Counting, as far as the user knows. */
+  bool               loaded;  /**< Running on counter @c idx right now. */
+} perf_event_t;
+
+static u32 cpu_used; /**< Counters owned by whole-CPU events. */
+static u32 proc_users[PMU_MAX_COUNTERS]; /**< Process events per counter. */
+
+/** @brief Architectural event of each ALCOR_PERF_HW_* config, or -1. */
+static const i8 hw_events[] = {
+    PMU_EV_CYCLES,   PMU_EV_INSTRUCTIONS,  PMU_EV_LLC_REFS, PMU_EV_LLC_MISSES,
+    PMU_EV_BRANCHES, PMU_EV_BRANCH_MISSES, -1,              -1,
+    -1,              PMU_EV_REF_CYCLES,
+};
+
+/** @brief Whether @p ev is counting on this CPU's counter @c idx. */
+static bool ev_here(const perf_event_t *ev)
+{
+  return ev->loaded && ev->on == smp_cpu_id();
+}
+
+static void ev_load(perf_event_t *ev)
+{
+  pmu_start(ev->idx, ev->evtsel);
+  ev->loaded = true;
+  ev->on     = smp_cpu_id();
+}
+
+static void ev_unload(perf_event_t *ev)
+{
+  if(ev_here(ev))
+    ev->count += pmu_stop(ev->idx);
+  ev->loaded = false;
+}
+
+/** @brief Whether @p ev should be on this CPU's counter when enabled. */
+static bool ev_active(const perf_event_t *ev)
+{
+  if(ev->cpu)
+    return ev->on == smp_cpu_id();
+  return ev->proc && ev->proc == proc_current();
+}
+
+/**
+ * @brief Event select and unit mask for (@p type, @p config).
+ * @return The IA32_PERFEVTSELx bits, or 0 if this CPU cannot count it.
+ */
+static u64 event_select(u32 type, u64 config)
+{
+  switch(type) {
+  case ALCOR_PERF_TYPE_HARDWARE:
+    if(config >= sizeof(hw_events) || hw_events[config] < 0)
+      return 0;
+    return pmu_arch_event((u32)hw_events[config]);
+
+  case ALCOR_PERF_TYPE_HW_CACHE:
+    if(config == ALCOR_PERF_CACHE(
+                     ALCOR_PERF_CACHE_LL, ALCOR_PERF_CACHE_OP_READ,
+                     ALCOR_PERF_CACHE_RES_ACCESS
+                 ))
+      return pmu_arch_event(PMU_EV_LLC_REFS);
+    if(config == ALCOR_PERF_CACHE(
+                     ALCOR_PERF_CACHE_LL, ALCOR_PERF_CACHE_OP_READ,
+                     ALCOR_PERF_CACHE_RES_MISS
+                 ))
+      return pmu_arch_event(PMU_EV_LLC_MISSES);
+    /* Not architectural: the encodings of recent Intel cores (walks
+     * caused by missed loads and stores). */
+    if(!pmu_is_intel())
+      return 0;
+    if(config == ALCOR_PERF_CACHE(
+                     ALCOR_PERF_CACHE_DTLB, ALCOR_PERF_CACHE_OP_READ,
+                     ALCOR_PERF_CACHE_RES_MISS
+                 ))
+      return 0x0108;
+    if(config == ALCOR_PERF_CACHE(
+                     ALCOR_PERF_CACHE_DTLB, ALCOR_PERF_CACHE_OP_WRITE,
+                     ALCOR_PERF_CACHE_RES_MISS
+                 ))
+      return 0x0149;
+    return 0;
+
+  case ALCOR_PERF_TYPE_RAW:
+    /* The privilege and enable bits are ours to set. */
+    return config & 0xFFFFFFFFULL &
+           ~(PMU_SEL_USR | PMU_SEL_OS | PMU_SEL_INT | PMU_SEL_EN);
+
+  default:
+    return 0;
+  }
+}
+
+/** @brief Lowest counter free of CPU events and of @p target's events. */
+static i32 alloc_proc_counter(const proc_t *target)
+{
+  u32 busy = cpu_used;
+  for(const perf_event_t *e = target->perf_events; e; e = e->next)
+    busy |= 1U << e->idx;
+  for(u32 i = 0; i < pmu_counters(); i++) {
+    if(!(busy & (1U << i)))
+      return (i32)i;
+  }
+  return -EBUSY;
+}
+
+/** @brief Highest counter no event uses. */
+static i32 alloc_cpu_counter(void)
+{
+  for(u32 i = pmu_counters(); i-- > 0;) {
+    if(!(cpu_used & (1U << i)) && !proc_users[i])
+      return (i32)i;
+  }
+  return -EBUSY;
+}
+
+void perf_switch(proc_t *prev, proc_t *next)
+{
+  if(prev) {
+    for(perf_event_t *e = prev->perf_events; e; e = e->next) {
+      if(e->loaded)
+        ev_unload(e);
+    }
+  }
+  if(next) {
+    for(perf_event_t *e = next->perf_events; e; e = e->next) {
+      if(e->enabled)
+        ev_load(e);
+    }
+  }
+}
+
+void perf_proc_exit(proc_t *p)
+{
+  perf_event_t *e = p->perf_events;
+  while(e) {
+    perf_event_t *next = e->next;
+    if(e->loaded)
+      ev_unload(e);
+    proc_users[e->idx]--;
+    e->proc = NULL;
+    e->next = NULL;
+    e       = next;
+  }
+  p->perf_events = NULL;
+}
+
+i64 perf_read_obj(void *obj, void *buf, u64 count)
+{
+  perf_event_t *ev = (perf_event_t *)obj;
+  if(count < sizeof(u64))
+    return -ENOSPC;
+  *(u64 *)buf = ev->count + (ev_here(ev) ? pmu_read(ev->idx) : 0);
+  return sizeof(u64);
+}
+
+void perf_oft_release(void *obj)
+{
+  perf_event_t *ev = (perf_event_t *)obj;
+  if(ev->loaded)
+    ev_unload(ev);
+  if(ev->cpu) {
+    cpu_used &= ~(1U << ev->idx);
+  } else if(ev->proc) {
+    perf_event_t **link = &ev->proc->perf_events;
+    while(*link != ev)
+      link = &(*link)->next;
+    *link = ev->next;
+    proc_users[ev->idx]--;
+  }
+  kfree(ev);
+}
+
+i64 perf_ioctl(i64 fd, u64 request)
+{
+  i32 idx = vfs_fd_to_oft(fd);
+  if(idx < 0)
+    return -ENOTTY;
+  const vfs_oft_entry_t *e = vfs_oft_get(idx);
+  if(!e || e->kind != VFS_KIND_PERF)
+    return -ENOTTY;
+
+  perf_event_t *ev = e->obj;
+  switch(request) {
+  case ALCOR_PERF_IOC_ENABLE:
+    if(!ev->enabled && ev_active(ev))
+      ev_load(ev);
+    ev->enabled = true;
+    return 0;
+
+  case ALCOR_PERF_IOC_DISABLE:
+    if(ev->loaded)
+      ev_unload(ev);
+    ev->enabled = false;
+    return 0;
+
+  case ALCOR_PERF_IOC_RESET:
+    ev->count = 0;
+    if(ev_here(ev))
+      pmu_start(ev->idx, ev->evtsel);
+    return 0;
+
+  default:
+    return -EINVAL;
+  }
+}
+
+/**
+ * @brief Open a counting event.
+ *
+ * @param attr     ::alcor_perf_attr_t.
+ * @param pid      0 for the caller, a pid, or -1 for the whole CPU.
+ * @param cpu      -1 (any) with a pid; 0 with pid -1.
+ * @param group_fd Must be -1.
+ * @param flags    ::ALCOR_PERF_FLAG_FD_CLOEXEC.
+ * @return The new fd, or @c -ENOENT for an event this CPU cannot count,
+ *         @c -EBUSY when no counter is free, @c -EOPNOTSUPP for sampling,
+ *         @c -ESRCH, @c -E2BIG, @c -EINVAL, @c -EFAULT, @c -ENOMEM.
+ */
+u64 sys_perf_event_open(
+    u64 attr, u64 pid, u64 cpu, u64 group_fd, u64 flags, u64 a6
+)
+{
+  (void)a6;
+
+  alcor_perf_attr_t a;
+  if(copy_from_user(&a, (const void *)attr, sizeof(a)) < 0)
+    return (u64)-EFAULT;
+  if(a.size && a.size < ALCOR_PERF_ATTR_SIZE)
+    return (u64)-E2BIG;
+  if(a.sample_period)
+    return (u64)-EOPNOTSUPP;
+  if(a.read_format || a.flags & ~PERF_FLAGS || (i32)group_fd != -1 ||
+     flags & ~(u64)ALCOR_PERF_FLAG_FD_CLOEXEC)
+    return (u64)-EINVAL;
+
+  proc_t *self = proc_current();
+  proc_t *target;
+  if(!self)
+    return (u64)-EINVAL;
+  if((i32)pid == -1) {
+    if((i32)cpu != 0)
+      return (u64)-EINVAL;
+    target = NULL;
+  } else {
+    if((i32)cpu != -1 && (i32)cpu != 0)
+      return (u64)-EINVAL;
+    if((i32)pid < 0)
+      return (u64)-EINVAL;
+    target = pid ? proc_get((i32)pid) : self;
+    if(!target || target->state == PROC_STATE_ZOMBIE)
+      return (u64)-ESRCH;
+  }
+
+  u64 sel = pmu_counters() ? event_select(a.type, a.config) : 0;
+  if(!sel)
+    return (u64)-ENOENT;
+  if(!(a.flags & ALCOR_PERF_EXCLUDE_USER))
+    sel |= PMU_SEL_USR;
+  if(!(a.flags & ALCOR_PERF_EXCLUDE_KERNEL))
+    sel |= PMU_SEL_OS;
+
+  i32 idx = target ? alloc_proc_counter(target) : alloc_cpu_counter();
+  if(idx < 0)
+    return (u64)idx;
+
+  perf_event_t *ev = kzalloc(sizeof(*ev));
+  if(!ev)
+    return (u64)-ENOMEM;
+  ev->evtsel = sel;
+  ev->idx    = (u32)idx;
+
+  i32 oft = vfs_oft_alloc_obj(VFS_KIND_PERF, ev);
+  if(oft < 0) {
+    kfree(ev);
+    return (u64)-ENFILE;
+  }
+  i64 fd = vfs_install_fd(oft);
+  if(fd < 0) {
+    vfs_oft_release(oft);
+    return (u64)fd;
+  }
+
+  if(target) {
+    ev->proc            = target;
+    ev->next            = target->perf_events;
+    target->perf_events = ev;
+    proc_users[idx]++;
+  } else {
+    ev->cpu = true;
+    ev->on  = smp_cpu_id();
+    cpu_used |= 1U << idx;
+  }
+  if(!(a.flags & ALCOR_PERF_DISABLED)) {
+    ev->enabled = true;
+    if(ev_active(ev))
+      ev_load(ev);
+  }
+  if(flags & ALCOR_PERF_FLAG_FD_CLOEXEC)
+    self->fd_cloexec[fd] = 1;
+  return (u64)fd;
+}
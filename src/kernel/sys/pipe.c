@@ -1,54 +1,162 @@
 /**
  * @file src/kernel/sys/pipe.c
- * @brief Anonymous pipes backed by a fixed-size ring buffer.
+ * @brief Anonymous pipes backed by a ring of page slots.
  *
  * Pipes live in the open file table as VFS_KIND_PIPE_RD / VFS_KIND_PIPE_WR
  * entries; per-process file descriptors point at those entries the same way
  * file fds do. End-of-pipe lifetime is reference-counted via the OFT
  * refcount, so fork-inheritance and dup/dup2 work the same as for files.
+ *
+ * Each slot of the ring holds a reference on one physical frame plus the
+ * byte range of it that carries data. write() fills frames the pipe owns;
+ * splice() and tee() instead queue references to page-cache frames or to
+ * another pipe's frames, so data moves without being copied. Those shared
+ * slots are never written into.
+ *
+ * Each pipe's ring is guarded by a mutex rather than a spinlock: it is held
+ * across copies to and from user memory, which may fault, and across
+ * splice sinks, which may block. Waiting for data or space drops it.
  */
 
 #include <alcor2/drivers/console.h>
 #include <alcor2/errno.h>
 #include <alcor2/fs/vfs.h>
 #include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
 #include <alcor2/mm/vmm.h>
+#include <alcor2/proc/mutex.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
 #include <alcor2/sys/internal.h>
+#include <alcor2/sys/trace.h>
 
-extern void proc_schedule(void);
+/** @brief Ring size of a new pipe, in page slots (64 KiB). */
+#define PIPE_DEF_SLOTS 16
+/** @brief Largest ring F_SETPIPE_SZ accepts, in page slots (1 MiB). */
+#define PIPE_MAX_SLOTS 256
 
-#define PIPE_BUF_SIZE 4096
-#define MAX_PIPES     16
+/** @brief One ring entry: a referenced frame and the data within it. */
+typedef struct
+{
+  u64 phys;   /**< Frame; the slot holds one reference. */
+  u32 offset; /**< First data byte within the frame. */
+  u32 len;    /**< Data bytes. */
+  bool own;   /**< Frame belongs to this pipe alone; write() may append. */
+} pipe_slot_t;
 
 typedef struct pipe
 {
-  u8      buffer[PIPE_BUF_SIZE];
-  u64     read_pos;
-  u64     write_pos;
-  u64     count;
-  int     read_open;
-  int     write_open;
-  int     allocated;
-  proc_t *waiting_reader; /**< Process blocked waiting for data to read. */
-  proc_t *waiting_writer; /**< Process blocked waiting for space to write. */
+  pipe_slot_t *slots;  /**< Ring of @c nslots entries. */
+  u32          nslots; /**< Ring size, a power of two. */
+  u32          head;   /**< Oldest occupied slot. */
+  u32          used;   /**< Occupied slots. */
+  u64          count;  /**< Data bytes across all slots. */
+  u64          spare;  /**< Drained frame kept for the next write, or 0. */
+  int          read_open;
+  int          write_open;
+  bool         tty;     /**< Relays a terminal (ALCOR2_IOC_PIPE_SET_TTY). */
+  wait_queue_t readers; /**< Processes blocked waiting for data to read. */
+  wait_queue_t writers; /**< Processes blocked waiting for space to write. */
+  mutex_t      lock;    /**< Guards everything above but the queues. */
 } pipe_t;
 
-static pipe_t pipes[MAX_PIPES];
+static pipe_slot_t *slot_at(const pipe_t *p, u32 i)
+{
+  return &p->slots[(p->head + i) & (p->nslots - 1)];
+}
+
+/** @brief Newest slot, if write() may still append to it. */
+static pipe_slot_t *open_tail(const pipe_t *p)
+{
+  if(!p->used)
+    return NULL;
+  pipe_slot_t *t = slot_at(p, p->used - 1);
+  return t->own && t->offset + t->len < PAGE_SIZE ? t : NULL;
+}
+
+/** @brief Drop @p n data bytes from the front of the ring. */
+static void pipe_consume(pipe_t *p, u64 n)
+{
+  p->count -= n;
+  while(n) {
+    pipe_slot_t *h    = slot_at(p, 0);
+    u32          take = n < h->len ? (u32)n : h->len;
+    h->offset += take;
+    h->len -= take;
+    n -= take;
+    if(h->len)
+      break;
+
+    if(h->own && !p->spare && !pmm_page_shared((void *)h->phys))
+      p->spare = h->phys;
+    else
+      pmm_free((void *)h->phys);
+    p->head = (p->head + 1) & (p->nslots - 1);
+    p->used--;
+  }
+}
 
-/** @brief Find a free pipe slot, zero it, and mark both ends open. */
+/**
+ * @brief Wait until the ring has data or no writer is left.
+ * @return false at end-of-file.
+ */
+static bool pipe_wait_data(pipe_t *p)
+{
+  while(p->count == 0 && p->write_open)
+    mutex_sleep(&p->lock, &p->readers);
+  return p->count > 0;
+}
+
+/**
+ * @brief Wait until a slot is free or no reader is left.
+ * @return false if the read end is closed.
+ */
+static bool pipe_wait_slot(pipe_t *p)
+{
+  while(p->used == p->nslots && p->read_open)
+    mutex_sleep(&p->lock, &p->writers);
+  return p->read_open;
+}
+
+/** @brief Queue @p len bytes at @p offset of referenced frame @p phys. */
+static void pipe_push(pipe_t *p, u64 phys, u32 offset, u32 len, bool own)
+{
+  pipe_slot_t *t = slot_at(p, p->used++);
+  t->phys        = phys;
+  t->offset      = offset;
+  t->len         = len;
+  t->own         = own;
+  p->count += len;
+  wait_wake_all(&p->readers);
+}
+
+/** @brief Allocate a zeroed pipe with both ends open. */
 static pipe_t *alloc_pipe(void)
 {
-  for(int i = 0; i < MAX_PIPES; i++) {
-    if(!pipes[i].allocated) {
-      kzero(&pipes[i], sizeof(pipes[i]));
-      pipes[i].allocated  = 1;
-      pipes[i].read_open  = 1;
-      pipes[i].write_open = 1;
-      return &pipes[i];
-    }
+  pipe_t *p = kzalloc(sizeof(pipe_t));
+  if(!p)
+    return NULL;
+  p->slots = kzalloc(PIPE_DEF_SLOTS * sizeof(pipe_slot_t));
+  if(!p->slots) {
+    kfree(p);
+    return NULL;
   }
-  return NULL;
+  p->nslots     = PIPE_DEF_SLOTS;
+  p->read_open  = 1;
+  p->write_open = 1;
+  mutex_init(&p->lock, "pipe");
+  return p;
+}
+
+static void free_pipe(pipe_t *p)
+{
+  if(p->count)
+    pipe_consume(p, p->count);
+  if(p->spare)
+    pmm_free((void *)p->spare);
+  kfree(p->slots);
+  kfree(p);
 }
 
 void *pipe_alloc_obj(void)
@@ -56,24 +164,66 @@ void *pipe_alloc_obj(void)
   return alloc_pipe();
 }
 
-bool pipe_poll_read_ready(const void *pipe_ptr)
+u32 pipe_poll(void *pipe_ptr, i32 kind, poll_table_t *pt)
 {
-  const pipe_t *p = (const pipe_t *)pipe_ptr;
-  if(!p || !p->allocated || !p->read_open)
-    return false;
-  if(p->count > 0)
-    return true;
-  return !p->write_open;
+  pipe_t *p = (pipe_t *)pipe_ptr;
+
+  if(kind == VFS_KIND_PIPE_RD) {
+    poll_wait(pt, &p->readers);
+    u32 mask = p->count ? VFS_POLL_IN : 0;
+    return p->write_open ? mask : mask | VFS_POLL_HUP;
+  }
+
+  /* A write with no reader left fails at once, so it counts as ready. */
+  poll_wait(pt, &p->writers);
+  if(!p->read_open)
+    return VFS_POLL_OUT | VFS_POLL_ERR;
+  return p->used < p->nslots || open_tail(p) ? VFS_POLL_OUT : 0;
 }
 
-bool pipe_poll_write_ready(const void *pipe_ptr)
+u64 pipe_get_size(const void *pipe_ptr)
 {
-  const pipe_t *p = (const pipe_t *)pipe_ptr;
-  if(!p || !p->allocated || !p->write_open)
-    return false;
-  if(!p->read_open)
-    return true;
-  return p->count < PIPE_BUF_SIZE;
+  return (u64)((const pipe_t *)pipe_ptr)->nslots * PAGE_SIZE;
+}
+
+i64 pipe_set_size(void *pipe_ptr, u64 size)
+{
+  pipe_t *p = (pipe_t *)pipe_ptr;
+  u32     n = 1;
+  while(n < PIPE_MAX_SLOTS && (u64)n * PAGE_SIZE < size)
+    n *= 2;
+  if((u64)n * PAGE_SIZE < size)
+    return -EPERM;
+
+  pipe_slot_t *slots = kzalloc(n * sizeof(pipe_slot_t));
+  if(!slots)
+    return -ENOMEM;
+
+  mutex_lock(&p->lock);
+  if(n < p->used) {
+    mutex_unlock(&p->lock);
+    kfree(slots);
+    return -EBUSY;
+  }
+  for(u32 i = 0; i < p->used; i++)
+    slots[i] = *slot_at(p, i);
+  kfree(p->slots);
+  p->slots  = slots;
+  p->nslots = n;
+  p->head   = 0;
+  wait_wake_all(&p->writers);
+  mutex_unlock(&p->lock);
+  return (i64)n * PAGE_SIZE;
+}
+
+void pipe_set_tty(void *pipe_ptr)
+{
+  ((pipe_t *)pipe_ptr)->tty = true;
+}
+
+bool pipe_is_tty(const void *pipe_ptr)
+{
+  return ((const pipe_t *)pipe_ptr)->tty;
 }
 
 void pipe_oft_release(i32 kind, void *pipe_ptr)
@@ -82,121 +232,252 @@ void pipe_oft_release(i32 kind, void *pipe_ptr)
   if(!p)
     return;
 
+  mutex_lock(&p->lock);
   if(kind == VFS_KIND_PIPE_RD) {
     if(p->read_open > 0)
       p->read_open--;
     /* Wake blocked writer so it sees EPIPE. */
-    if(!p->read_open && p->waiting_writer &&
-       p->waiting_writer->state == PROC_STATE_BLOCKED)
-      p->waiting_writer->state = PROC_STATE_READY;
+    if(!p->read_open)
+      wait_wake_all(&p->writers);
   } else if(kind == VFS_KIND_PIPE_WR) {
     if(p->write_open > 0)
       p->write_open--;
 
     /* Wake blocked reader so it returns EOF (0). */
-    if(!p->write_open && p->waiting_reader &&
-       p->waiting_reader->state == PROC_STATE_BLOCKED) {
-      p->waiting_reader->state = PROC_STATE_READY;
-      p->waiting_reader        = NULL;
-    }
+    if(!p->write_open)
+      wait_wake_all(&p->readers);
   }
 
-  if(!p->read_open && !p->write_open)
-    p->allocated = 0;
+  /* No end is left open, so nothing else can reach the pipe. */
+  bool dead = !p->read_open && !p->write_open;
+  mutex_unlock(&p->lock);
+  if(dead)
+    free_pipe(p);
+}
+
+/** @brief Bytes the @p iovcnt buffers at @p iov hold together. */
+static u64 iov_total(const vfs_iovec_t *iov, u32 iovcnt)
+{
+  u64 n = 0;
+  for(u32 i = 0; i < iovcnt; i++)
+    n += iov[i].len;
+  return n;
 }
 
 i64 pipe_read_obj(void *pipe_ptr, void *buf, u64 count)
+{
+  vfs_iovec_t v = {buf, count};
+  return pipe_readv_obj(pipe_ptr, &v, 1);
+}
+
+i64 pipe_readv_obj(void *pipe_ptr, const vfs_iovec_t *iov, u32 iovcnt)
 {
   pipe_t *p = (pipe_t *)pipe_ptr;
-  if(!p || !p->allocated)
+  if(!p || !p->read_open)
     return -EBADF;
-  if(!p->read_open)
-    return -EBADF;
-
-  if(p->count == 0 && !p->write_open)
-    return 0;
 
   /* Block (not spin) until data arrives or the write end closes. */
-  while(p->count == 0 && p->write_open) {
-    proc_t *me = proc_current();
-    if(me) {
-      p->waiting_reader = me;
-      me->state         = PROC_STATE_BLOCKED;
-    }
-    proc_schedule();
-    if(me)
-      p->waiting_reader = NULL;
+  TRACE(ALCOR_TRACE_PIPE_READ, iov_total(iov, iovcnt), 0, 0);
+  mutex_lock(&p->lock);
+  if(!pipe_wait_data(p)) {
+    mutex_unlock(&p->lock);
+    TRACE(ALCOR_TRACE_PIPE_READ_END, 0, 0, 0);
+    return 0;
   }
 
-  if(p->count == 0)
-    return 0; /* write end closed mid-wait */
-
-  u64 to_read = count > p->count ? p->count : count;
-  u8 *dst     = (u8 *)buf;
-  for(u64 i = 0; i < to_read; i++) {
-    dst[i]      = p->buffer[p->read_pos];
-    p->read_pos = (p->read_pos + 1) % PIPE_BUF_SIZE;
+  u64 done = 0;
+  for(u32 i = 0; i < iovcnt && p->count; i++) {
+    u8 *dst = (u8 *)iov[i].base;
+    u64 got = 0;
+    while(got < iov[i].len && p->count) {
+      const pipe_slot_t *h     = slot_at(p, 0);
+      u64                left  = iov[i].len - got;
+      u64                chunk = h->len < left ? h->len : left;
+      kmemcpy(dst + got, (u8 *)phys_to_virt(h->phys) + h->offset, chunk);
+      pipe_consume(p, chunk);
+      got += chunk;
+    }
+    done += got;
   }
-  p->count -= to_read;
 
   /* Wake a blocked writer now that space is available. */
-  if(p->waiting_writer && p->waiting_writer->state == PROC_STATE_BLOCKED) {
-    p->waiting_writer->state = PROC_STATE_READY;
-    p->waiting_writer        = NULL;
-  }
-
-  return (i64)to_read;
+  wait_wake_all(&p->writers);
+  mutex_unlock(&p->lock);
+  TRACE(ALCOR_TRACE_PIPE_READ_END, done, 0, 0);
+  return (i64)done;
 }
 
 i64 pipe_write_obj(void *pipe_ptr, const void *buf, u64 count)
+{
+  vfs_iovec_t v = {(void *)buf, count};
+  return pipe_writev_obj(pipe_ptr, &v, 1);
+}
+
+i64 pipe_writev_obj(void *pipe_ptr, const vfs_iovec_t *iov, u32 iovcnt)
 {
   pipe_t *p = (pipe_t *)pipe_ptr;
-  if(!p || !p->allocated)
-    return -EBADF;
-  if(!p->write_open)
+  if(!p || !p->write_open)
     return -EBADF;
   if(!p->read_open)
     return -EPIPE;
 
-  const u8 *src     = (const u8 *)buf;
-  u64       written = 0;
+  u64 count   = iov_total(iov, iovcnt);
+  u64 written = 0;
+  u64 base    = 0; /* bytes of the buffers before iov[i] */
+  u32 i       = 0;
+  i64 err     = 0;
 
+  TRACE(ALCOR_TRACE_PIPE_WRITE, count, 0, 0);
+  mutex_lock(&p->lock);
   while(written < count) {
-    /* Block (not spin) until space is available or the read end closes. */
-    while(p->count >= PIPE_BUF_SIZE && p->read_open) {
-      proc_t *me = proc_current();
-      if(me) {
-        p->waiting_writer = me;
-        me->state         = PROC_STATE_BLOCKED;
+    while(written - base >= iov[i].len)
+      base += iov[i++].len;
+
+    pipe_slot_t *t = open_tail(p);
+    if(!t) {
+      /* Block (not spin) until a slot frees up or the read end closes. */
+      if(!pipe_wait_slot(p)) {
+        err = -EPIPE;
+        break;
       }
-      proc_schedule();
-      if(me)
-        p->waiting_writer = NULL;
+
+      u64 phys = p->spare;
+      p->spare = 0;
+      if(!phys)
+        phys = (u64)pmm_alloc();
+      if(!phys) {
+        err = -ENOMEM;
+        break;
+      }
+      pipe_push(p, phys, 0, 0, true);
+      t = slot_at(p, p->used - 1);
     }
 
-    if(!p->read_open)
-      return written > 0 ? (i64)written : -EPIPE;
+    u64 end   = t->offset + t->len;
+    u64 left  = iov[i].len - (written - base);
+    u64 chunk = PAGE_SIZE - end < left ? PAGE_SIZE - end : left;
+    kmemcpy(
+        (u8 *)phys_to_virt(t->phys) + end,
+        (const u8 *)iov[i].base + (written - base), chunk
+    );
+    t->len += (u32)chunk;
+    p->count += chunk;
+    written += chunk;
 
-    u64 space    = PIPE_BUF_SIZE - p->count;
-    u64 to_write = count - written;
-    if(to_write > space)
-      to_write = space;
+    /* Wake a blocked reader now that data is available. */
+    wait_wake_all(&p->readers);
+  }
+  mutex_unlock(&p->lock);
 
-    for(u64 i = 0; i < to_write; i++) {
-      p->buffer[p->write_pos] = src[written + i];
-      p->write_pos            = (p->write_pos + 1) % PIPE_BUF_SIZE;
-    }
-    p->count += to_write;
-    written += to_write;
+  i64 r = written > 0 || !err ? (i64)written : err;
+  TRACE(ALCOR_TRACE_PIPE_WRITE_END, r, 0, 0);
+  return r;
+}
 
-    /* Wake a blocked reader now that data is available. */
-    if(p->waiting_reader && p->waiting_reader->state == PROC_STATE_BLOCKED) {
-      p->waiting_reader->state = PROC_STATE_READY;
-      p->waiting_reader        = NULL;
+/** @brief ::vfs_sendfile sink queueing page-cache frames on a pipe. */
+static i64 pipe_page_sink(void *ctx, const void *buf, u64 count)
+{
+  pipe_t *p = (pipe_t *)ctx;
+  if(!pipe_wait_slot(p))
+    return -EPIPE;
+
+  u64 phys  = virt_to_phys(buf);
+  u64 frame = phys & ~(u64)(PAGE_SIZE - 1);
+  if(!pmm_page_ref((void *)frame))
+    return -EIO;
+  pipe_push(p, frame, (u32)(phys - frame), (u32)count, false);
+  return (i64)count;
+}
+
+i64 pipe_splice_in(void *pipe_ptr, i64 in_fd, u64 *offset, u64 len)
+{
+  pipe_t *p = (pipe_t *)pipe_ptr;
+  if(!p->read_open)
+    return -EPIPE;
+  mutex_lock(&p->lock);
+  i64 r = vfs_sendfile(in_fd, offset, len, pipe_page_sink, p);
+  mutex_unlock(&p->lock);
+  return r;
+}
+
+i64 pipe_splice_out(void *pipe_ptr, u64 len, vfs_sink_t sink, void *ctx)
+{
+  pipe_t *p = (pipe_t *)pipe_ptr;
+  mutex_lock(&p->lock);
+  if(!pipe_wait_data(p)) {
+    mutex_unlock(&p->lock);
+    return 0;
+  }
+
+  u64 done = 0;
+  i64 ret  = 0;
+  while(done < len && p->count) {
+    const pipe_slot_t *h     = slot_at(p, 0);
+    u64                chunk = h->len < len - done ? h->len : len - done;
+
+    ret = sink(ctx, (u8 *)phys_to_virt(h->phys) + h->offset, chunk);
+    if(ret <= 0)
+      break;
+    pipe_consume(p, (u64)ret);
+    done += (u64)ret;
+    if((u64)ret < chunk)
+      break;
+  }
+
+  wait_wake_all(&p->writers);
+  mutex_unlock(&p->lock);
+  return done ? (i64)done : ret;
+}
+
+i64 pipe_transfer(void *in_ptr, void *out_ptr, u64 len, bool keep)
+{
+  pipe_t *in  = (pipe_t *)in_ptr;
+  pipe_t *out = (pipe_t *)out_ptr;
+  if(in == out)
+    return -EINVAL;
+  if(!out->read_open)
+    return -EPIPE;
+
+  /* Wait on each pipe alone: sleeping with the other's lock held could
+   * deadlock against a transfer the other way. */
+  mutex_lock(&in->lock);
+  bool ready = pipe_wait_data(in);
+  mutex_unlock(&in->lock);
+  if(!ready)
+    return 0;
+  mutex_lock(&out->lock);
+  ready = pipe_wait_slot(out);
+  mutex_unlock(&out->lock);
+  if(!ready)
+    return -EPIPE;
+
+  /* Then lock both, lower address first, and move what fits. */
+  mutex_lock(in < out ? &in->lock : &out->lock);
+  mutex_lock(in < out ? &out->lock : &in->lock);
+  u64 done = 0;
+  for(u32 i = 0; done < len && i < in->used; i++) {
+    if(out->used == out->nslots || !out->read_open)
+      break;
+
+    /* Both pipes now reference the frame, so neither may append to it. */
+    pipe_slot_t *s    = slot_at(in, keep ? i : 0);
+    u32          take = s->len < len - done ? s->len : (u32)(len - done);
+    pmm_page_ref((void *)s->phys);
+    s->own = false;
+    pipe_push(out, s->phys, s->offset, take, false);
+    if(!keep) {
+      pipe_consume(in, take);
+      i--;
     }
+    done += take;
   }
 
-  return (i64)written;
+  if(!keep)
+    wait_wake_all(&in->writers);
+  bool broken = !out->read_open;
+  mutex_unlock(&out->lock);
+  mutex_unlock(&in->lock);
+  return done || !broken ? (i64)done : -EPIPE;
 }
 
 u64 sys_pipe(u64 pipefd, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
@@ -218,12 +499,12 @@ u64 sys_pipe(u64 pipefd, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
   if(!p)
     return (u64)-ENOMEM;
 
-  i32 read_oft = vfs_oft_alloc_pipe(VFS_KIND_PIPE_RD, p);
+  i32 read_oft = vfs_oft_alloc_obj(VFS_KIND_PIPE_RD, p);
   if(read_oft < 0) {
-    p->allocated = 0;
+    free_pipe(p);
     return (u64)-ENFILE;
   }
-  i32 write_oft = vfs_oft_alloc_pipe(VFS_KIND_PIPE_WR, p);
+  i32 write_oft = vfs_oft_alloc_obj(VFS_KIND_PIPE_WR, p);
   if(write_oft < 0) {
     vfs_oft_release(read_oft);
     return (u64)-ENFILE;
@@ -238,8 +519,7 @@ u64 sys_pipe(u64 pipefd, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
   i64 write_fd = vfs_install_fd(write_oft);
   if(write_fd < 0) {
     vfs_oft_release(write_oft);
-    proc_current()->fds[read_fd] = -1;
-    vfs_oft_release(read_oft);
+    vfs_close(read_fd);
     return (u64)write_fd;
   }
 
@@ -8,15 +8,19 @@
  * Signal delivery flow:
  *   1. A signal is marked pending via proc_signal() (e.g. from kill or
  *      proc_exit SIGCHLD).
- *   2. On each syscall return, proc_check_signals() inspects pending &
- *      ~masked for the current process.
+ *   2. On each syscall return, syscall_entry tests the current process's
+ *      sig_work flag (pending & ~masked is non-zero) and only then calls
+ *      proc_check_signals().  Signals that are ignored when sent are
+ *      dropped at once, and blocked ones do not wake a sleeper, so neither
+ *      can make a blocking call fail with EINTR.
  *   3. If a deliverable signal exists and has a user handler, a
  *      sig_ucontext_t is pushed below the red zone on the user stack and
  *      the syscall frame is redirected to the handler.
  *   4. The handler runs, then calls sa_restorer which executes
  *      syscall(SYS_RT_SIGRETURN).
  *   5. sys_rt_sigreturn restores all registers from sig_ucontext_t and
- *      resumes the interrupted code.
+ *      resumes the interrupted code.  With SA_RESTART, a call the signal
+ *      interrupted is re-issued rather than returning EINTR.
  */
 
 #include <alcor2/drivers/console.h>
@@ -45,6 +49,43 @@ static int sig_default_ignore(int signum)
   }
 }
 
+/* Keep sig_work (the syscall exit fast-path test) in step with the sets. */
+static void sig_recalc(proc_t *p)
+{
+  p->sig_work = (p->sig_pending & ~p->sig_mask) != 0;
+}
+
+/* True if @p signum is discarded on arrival under the current action. */
+static bool sig_ignored(const proc_t *p, int signum)
+{
+  u64 handler = p->sig_actions[signum].sa_handler;
+  if(signum == SIGKILL || signum == SIGSTOP)
+    return false;
+  return handler == SIG_IGN ||
+         (handler == SIG_DFL && sig_default_ignore(signum));
+}
+
+/*
+ * Calls SA_RESTART does not re-issue: those with a timeout, which would
+ * start over, and those that wait for a signal (as on Linux, see signal(7)).
+ */
+static bool sig_restartable(u64 nr)
+{
+  switch(nr) {
+  case SYS_POLL:
+  case SYS_SELECT:
+  case SYS_NANOSLEEP:
+  case SYS_CONNECT:
+  case SYS_FUTEX:
+  case SYS_EPOLL_WAIT:
+  case SYS_EPOLL_PWAIT:
+  case SYS_ALCOR_URING_ENTER:
+    return false;
+  default:
+    return true;
+  }
+}
+
 /* Syscall implementations. */
 
 /**
@@ -86,6 +127,11 @@ u64 sys_rt_sigaction(
     if(!vmm_is_user_range((void *)act, sizeof(k_sigaction_t)))
       return (u64)-EFAULT;
     kmemcpy(&p->sig_actions[signum], (const void *)act, sizeof(k_sigaction_t));
+    /* POSIX: setting a pending signal to be ignored discards it. */
+    if(sig_ignored(p, (int)signum)) {
+      p->sig_pending &= ~(1ULL << signum);
+      sig_recalc(p);
+    }
   }
 
   return 0;
@@ -143,6 +189,7 @@ u64 sys_rt_sigprocmask(
     default:
       return (u64)-EINVAL;
     }
+    sig_recalc(p);
   }
 
   return 0;
@@ -199,8 +246,10 @@ u64 sys_rt_sigreturn(u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
 
   /* Restore signal mask */
   proc_t *p = proc_current();
-  if(p)
+  if(p) {
     p->sig_mask = ctx->sig_mask;
+    sig_recalc(p);
+  }
 
   /* Return ctx->rax — syscall_dispatch stores it back into frame->rax */
   return ctx->rax;
@@ -279,6 +328,9 @@ u64 sys_sigaltstack(u64 ss, u64 old_ss, u64 a3, u64 a4, u64 a5, u64 a6)
 /**
  * @brief Mark a signal as pending for a process and wake it if blocked.
  *
+ * A signal the target ignores is discarded here, and a blocked one stays
+ * pending without waking the target, so neither interrupts a sleep.
+ *
  * @param pid    Target process ID.
  * @param signum Signal number (1 … NSIG-1).
  */
@@ -288,22 +340,34 @@ void proc_signal(u64 pid, int signum)
     return;
 
   proc_t *p = proc_get(pid);
-  if(!p || p->state == PROC_STATE_FREE || p->state == PROC_STATE_ZOMBIE)
+  if(!p || p->kentry || p->state == PROC_STATE_FREE ||
+     p->state == PROC_STATE_ZOMBIE)
     return;
 
-  p->sig_pending |= (1ULL << signum);
+  u64 bit = 1ULL << signum;
+  if(!(p->sig_mask & bit) && sig_ignored(p, signum))
+    return;
+
+  p->sig_pending |= bit;
+  if(p->sig_mask & bit)
+    return;
 
   /* Unblock a sleeping process so it can handle the signal */
-  if(p->state == PROC_STATE_BLOCKED)
-    p->state = PROC_STATE_READY;
+  p->sig_work = true;
+  proc_wake(p);
 }
 
 /**
  * @brief Check for deliverable signals and set up a signal frame if needed.
  *
  * Called from syscall_entry (ASM) after syscall_dispatch returns,
- * before restoring user registers. May modify the syscall frame to
- * redirect execution to a signal handler.
+ * before restoring user registers, when the current process's sig_work
+ * flag is set. May modify the syscall frame to redirect execution to a
+ * signal handler.
+ *
+ * If the call failed with EINTR and the handler has SA_RESTART, the
+ * saved context points back at the @c syscall instruction with the call
+ * number in rax, so rt_sigreturn re-issues it.
  *
  * Delivery layout on user stack (grows down):
  * @code
@@ -312,8 +376,9 @@ void proc_signal(u64 pid, int signum)
  * @endcode
  *
  * @param frame_ptr Pointer to the syscall_frame_t on the kernel stack.
+ * @param nr        Number of the syscall that is returning.
  */
-void proc_check_signals(void *frame_ptr)
+void proc_check_signals(void *frame_ptr, u64 nr)
 {
   proc_t *p = proc_current();
   if(!p)
@@ -321,22 +386,17 @@ void proc_check_signals(void *frame_ptr)
 
   /* Deliverable = pending & ~masked */
   u64 deliverable = p->sig_pending & ~p->sig_mask;
-  if(!deliverable)
+  if(!deliverable) {
+    p->sig_work = false;
     return;
-
-  /* Find the lowest-numbered pending signal */
-  int signum = 0;
-  for(int i = 1; i < NSIG; i++) {
-    if(deliverable & (1ULL << i)) {
-      signum = i;
-      break;
-    }
   }
-  if(!signum)
-    return;
+
+  /* Lowest-numbered pending signal (tzcnt; bit 0 is never set) */
+  int signum = __builtin_ctzll(deliverable);
 
   /* Clear it from pending */
   p->sig_pending &= ~(1ULL << signum);
+  sig_recalc(p);
 
   k_sigaction_t *act = &p->sig_actions[signum];
 
@@ -400,6 +460,13 @@ void proc_check_signals(void *frame_ptr)
   ctx->signum   = (u32)signum;
   ctx->_pad     = 0;
 
+  /* SA_RESTART: resume at the 2-byte syscall instruction, not after it */
+  if(frame->rax == (u64)-EINTR && (act->sa_flags & SA_RESTART) &&
+     sig_restartable(nr)) {
+    ctx->rax = nr;
+    ctx->rip = frame->rip - 2;
+  }
+
   /* Push sa_restorer as return address beneath the context */
   user_rsp -= 8;
   *(u64 *)user_rsp = act->sa_restorer;
@@ -408,6 +475,7 @@ void proc_check_signals(void *frame_ptr)
   if(!(act->sa_flags & SA_NODEFER))
     p->sig_mask |= (1ULL << signum);
   p->sig_mask |= act->sa_mask;
+  sig_recalc(p);
 
   /* SA_RESETHAND: revert to SIG_DFL after one delivery */
   if(act->sa_flags & SA_RESETHAND)
@@ -0,0 +1,866 @@
+/**
+ * @file src/kernel/sys/socket.c
+ * @brief BSD socket syscalls over the TCP and UDP protocols in src/net.
+ *
+ * A socket lives in the open file table as a ::VFS_KIND_SOCKET entry whose
+ * object is a ::sock_t. These syscalls copy sockaddrs, option values and
+ * msghdrs in and out and call the protocol; read(), write() and poll()
+ * reach the same protocol calls through vfs.c. Only AF_INET is supported.
+ * Whether a call may block follows the entry's ::O_NONBLOCK, so fcntl()
+ * can change it, or ::MSG_DONTWAIT for one call.
+ *
+ * Packets to a local address are queued rather than delivered while the
+ * protocol is sending them, so every call that can send runs the loopback
+ * queue before it returns.
+ */
+
+#include <alcor2/errno.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/uaccess.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/net/net.h>
+#include <alcor2/net/sock.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/sys/internal.h>
+#include <alcor2/time.h>
+
+/** @name Socket ABI (Linux x86_64)
+ * @{ */
+#define AF_UNSPEC      0
+#define AF_INET        2
+#define SOCK_TYPE_MASK 0xF
+#define SOCK_NONBLOCK  O_NONBLOCK
+#define SOCK_CLOEXEC   O_CLOEXEC
+#define IPPROTO_TCP    6
+#define IPPROTO_UDP    17
+#define SOL_SOCKET     1
+#define SO_REUSEADDR   2
+#define SO_TYPE        3
+#define SO_ERROR       4
+#define SO_BROADCAST   6
+#define SO_SNDBUF      7
+#define SO_RCVBUF      8
+#define SO_KEEPALIVE   9
+#define SO_RCVTIMEO    20
+#define SO_SNDTIMEO    21
+#define TCP_NODELAY    1
+#define SOMAXCONN      128
+/** @} */
+
+/** @brief Buffer size getsockopt() reports for SO_SNDBUF and SO_RCVBUF. */
+#define SOCK_BUF_SIZE (64 * 1024)
+
+/** @brief Largest datagram gathered or scattered through a bounce buffer. */
+#define SOCK_DGRAM_MAX PAGE_SIZE
+
+/** @brief struct sockaddr_in. */
+typedef struct
+{
+  u16 family;
+  u16 port; /**< Network order. */
+  u32 addr; /**< Network order. */
+  u8  zero[8];
+} sockaddr_in_abi_t;
+
+/** @brief struct msghdr. */
+typedef struct
+{
+  u64 name;
+  u32 namelen;
+  u32 pad0;
+  u64 iov;
+  u64 iovlen;
+  u64 control;
+  u64 controllen;
+  i32 flags;
+  u32 pad1;
+} msghdr_abi_t;
+
+/** @brief struct timeval, as SO_RCVTIMEO and SO_SNDTIMEO take it. */
+typedef struct
+{
+  i64 sec;
+  i64 usec;
+} timeval_abi_t;
+
+static inline bool user_buf_ok(u64 ptr, u64 size)
+{
+  return ptr && vmm_is_user_range((void *)ptr, size);
+}
+
+/** @brief The socket behind @p fd and its open flags; NULL with @p *err. */
+static sock_t *sock_from_fd(u64 fd, u32 *fflags, i64 *err)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(vfs_fd_to_oft((i64)fd));
+  if(!e) {
+    *err = -EBADF;
+    return NULL;
+  }
+  if(e->kind != VFS_KIND_SOCKET) {
+    *err = -ENOTSOCK;
+    return NULL;
+  }
+  if(fflags)
+    *fflags = e->flags;
+  return e->obj;
+}
+
+/** @brief Finish a call that may have sent to a local address. */
+static u64 sock_ret(i64 r)
+{
+  ip_loopback_run();
+  return (u64)r;
+}
+
+/** @brief Read an AF_INET sockaddr of @p len bytes at @p uaddr. */
+static i64 sa_get(u64 uaddr, u64 len, u32 *addr, u16 *port)
+{
+  sockaddr_in_abi_t sa;
+  if(len < sizeof(sa))
+    return -EINVAL;
+  if(!user_buf_ok(uaddr, sizeof(sa)) ||
+     copy_from_user(&sa, (const void *)uaddr, sizeof(sa)))
+    return -EFAULT;
+  if(sa.family != AF_INET)
+    return -EAFNOSUPPORT;
+  *addr = net_ntohl(sa.addr);
+  *port = net_ntohs(sa.port);
+  return 0;
+}
+
+/**
+ * @brief Store @p addr:@p port at @p uaddr, truncated to @p *len bytes.
+ *
+ * @p *len becomes the full size, as for accept() and recvfrom().
+ */
+static i64 sa_put(u64 uaddr, u32 *len, u32 addr, u16 port)
+{
+  sockaddr_in_abi_t sa;
+  kzero(&sa, sizeof(sa));
+  sa.family = AF_INET;
+  sa.port   = net_htons(port);
+  sa.addr   = net_htonl(addr);
+
+  u32 n = *len < sizeof(sa) ? *len : (u32)sizeof(sa);
+  *len  = sizeof(sa);
+  if(n && (!user_buf_ok(uaddr, n) || copy_to_user((void *)uaddr, &sa, n)))
+    return -EFAULT;
+  return 0;
+}
+
+/** @brief ::sa_put with the length read from and written back to @p ulen. */
+static i64 sa_put_user(u64 uaddr, u64 ulen, u32 addr, u16 port)
+{
+  if(!uaddr)
+    return 0;
+  u32 len;
+  if(!user_buf_ok(ulen, sizeof(len)) ||
+     copy_from_user(&len, (const void *)ulen, sizeof(len)))
+    return -EFAULT;
+  if((i32)len < 0)
+    return -EINVAL;
+  i64 r = sa_put(uaddr, &len, addr, port);
+  if(r == 0 && copy_to_user((void *)ulen, &len, sizeof(len)))
+    r = -EFAULT;
+  return r;
+}
+
+/** @brief Whether a call on an entry with @p fflags and @p msg_flags may
+ *  not block. */
+static bool sock_nonblock(u32 fflags, u64 msg_flags)
+{
+  return (fflags & O_NONBLOCK) || (msg_flags & MSG_DONTWAIT);
+}
+
+/**
+ * @brief Give @p s a descriptor; frees it on failure.
+ * @param flags ::SOCK_NONBLOCK and ::SOCK_CLOEXEC.
+ */
+static i64 sock_install(proc_t *p, sock_t *s, u32 flags)
+{
+  i32 oft = vfs_oft_alloc_obj(VFS_KIND_SOCKET, s);
+  if(oft < 0) {
+    sock_oft_release(s);
+    return -ENFILE;
+  }
+  i64 fd = vfs_install_fd(oft);
+  if(fd < 0) {
+    vfs_oft_release(oft);
+    return fd;
+  }
+  vfs_set_flags(fd, O_RDWR | (flags & SOCK_NONBLOCK));
+  if(flags & SOCK_CLOEXEC)
+    p->fd_cloexec[fd] = 1;
+  return fd;
+}
+
+i64 sock_wait(sock_t *s, bool nonblock, u64 deadline)
+{
+  /* What we sent ourselves may be what the caller waits for. */
+  if(ip_loopback_run())
+    return 0;
+  if(nonblock)
+    return -EAGAIN;
+  i64 r = wait_sleep_until(&s->wq, 0, deadline);
+  return r == -ETIMEDOUT ? -EAGAIN : r;
+}
+
+u32 sock_src_addr(const sock_t *s, u32 dst)
+{
+  if(s->laddr)
+    return s->laddr;
+  if((dst >> 24) == 127)
+    return NET_IP4(127, 0, 0, 1);
+  netif_t *nif = net_if();
+  return nif ? nif->ip : 0;
+}
+
+u32 sock_poll(void *obj, poll_table_t *pt)
+{
+  sock_t *s = (sock_t *)obj;
+  ip_loopback_run();
+  poll_wait(pt, &s->wq);
+  return s->type == SOCK_STREAM ? tcp_poll(s) : udp_poll(s);
+}
+
+i64 sock_read_obj(void *obj, void *buf, u64 count, u32 flags)
+{
+  sock_t *s  = (sock_t *)obj;
+  bool    nb = sock_nonblock(flags, 0);
+  i64     r  = s->type == SOCK_STREAM
+                   ? tcp_recv(s, buf, count, 0, nb)
+                   : udp_recvfrom(s, buf, count, 0, nb, NULL, NULL);
+  return (i64)sock_ret(r);
+}
+
+i64 sock_write_obj(void *obj, const void *buf, u64 count, u32 flags)
+{
+  sock_t *s = (sock_t *)obj;
+  i64     r;
+  if(s->type == SOCK_STREAM)
+    r = tcp_send(s, buf, count, sock_nonblock(flags, 0));
+  else if(!s->connected)
+    r = -EDESTADDRREQ;
+  else
+    r = udp_sendto(s, buf, count, s->raddr, s->rport);
+  return (i64)sock_ret(r);
+}
+
+void sock_oft_release(void *obj)
+{
+  sock_t *s = (sock_t *)obj;
+  if(s->type == SOCK_STREAM)
+    tcp_close(s);
+  else
+    udp_close(s);
+  kfree(s);
+  ip_loopback_run();
+}
+
+/** @brief Where ::sock_page_sink sends. */
+typedef struct
+{
+  sock_t *s;
+  bool    nonblock;
+} sock_sink_t;
+
+/* ::vfs_sendfile hands over page-cache memory, so queue the page itself. */
+static i64 sock_page_sink(void *ctx, const void *buf, u64 count)
+{
+  const sock_sink_t *k = (const sock_sink_t *)ctx;
+  return tcp_send_page(k->s, virt_to_phys(buf), (u32)count, k->nonblock);
+}
+
+i64 sock_sendfile(i64 out_fd, i64 in_fd, u64 *offset, u64 count)
+{
+  u32     fflags;
+  i64     err;
+  sock_t *s = sock_from_fd((u64)out_fd, &fflags, &err);
+  if(!s || s->type != SOCK_STREAM)
+    return -ENOTSOCK;
+  sock_sink_t k = {s, sock_nonblock(fflags, 0)};
+  return (i64)sock_ret(vfs_sendfile(in_fd, offset, count, sock_page_sink, &k));
+}
+
+/**
+ * @brief Create an AF_INET socket.
+ *
+ * @p type is ::SOCK_STREAM (TCP) or ::SOCK_DGRAM (UDP), optionally ORed with
+ * SOCK_NONBLOCK and SOCK_CLOEXEC; @p protocol is 0 or the matching one.
+ */
+u64 sys_socket(u64 domain, u64 type, u64 protocol, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  u32 kind  = (u32)type & SOCK_TYPE_MASK;
+  u32 flags = (u32)type & ~SOCK_TYPE_MASK;
+  if(domain != AF_INET)
+    return (u64)-EAFNOSUPPORT;
+  if(flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC))
+    return (u64)-EINVAL;
+  if(kind != SOCK_STREAM && kind != SOCK_DGRAM)
+    return (u64)-EPROTONOSUPPORT;
+  if(protocol && protocol != (kind == SOCK_STREAM ? IPPROTO_TCP : IPPROTO_UDP))
+    return (u64)-EPROTONOSUPPORT;
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-EINVAL;
+
+  sock_t *s = kzalloc(sizeof(*s));
+  if(!s)
+    return (u64)-ENOMEM;
+  s->type = (u8)kind;
+  if(kind == SOCK_STREAM) {
+    i64 r = tcp_attach(s);
+    if(r < 0) {
+      kfree(s);
+      return (u64)r;
+    }
+  }
+  return (u64)sock_install(p, s, flags);
+}
+
+/** @brief Bind to a local address and port (port 0: an ephemeral one). */
+u64 sys_bind(u64 fd, u64 addr, u64 addrlen, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  i64     r;
+  sock_t *s = sock_from_fd(fd, NULL, &r);
+  if(!s)
+    return (u64)r;
+  u32 ip;
+  u16 port;
+  if((r = sa_get(addr, addrlen, &ip, &port)) < 0)
+    return (u64)r;
+  r = s->type == SOCK_STREAM ? tcp_bind(s, ip, port) : udp_bind(s, ip, port);
+  return (u64)r;
+}
+
+/** @brief Accept connections on a stream socket (see ::tcp_listen). */
+u64 sys_listen(u64 fd, u64 backlog, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  i64     r;
+  sock_t *s = sock_from_fd(fd, NULL, &r);
+  if(!s)
+    return (u64)r;
+  if(s->type != SOCK_STREAM)
+    return (u64)-EOPNOTSUPP;
+  i32 n = (i32)backlog;
+  if(n < 0 || n > SOMAXCONN)
+    n = SOMAXCONN;
+  return (u64)tcp_listen(s, n ? (u32)n : 1);
+}
+
+/**
+ * @brief Connect a stream socket, or set a datagram socket's peer.
+ *
+ * A non-blocking stream connect returns @c -EINPROGRESS and reports
+ * through poll() for writing and SO_ERROR. AF_UNSPEC dissolves a datagram
+ * socket's association.
+ */
+u64 sys_connect(u64 fd, u64 addr, u64 addrlen, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  i64     r;
+  u32     fflags;
+  sock_t *s = sock_from_fd(fd, &fflags, &r);
+  if(!s)
+    return (u64)r;
+
+  u16 family;
+  if(addrlen < sizeof(family) || !user_buf_ok(addr, sizeof(family)) ||
+     copy_from_user(&family, (const void *)addr, sizeof(family)))
+    return (u64)-EFAULT;
+  if(family == AF_UNSPEC && s->type == SOCK_DGRAM) {
+    s->connected = false;
+    s->raddr     = 0;
+    s->rport     = 0;
+    return 0;
+  }
+
+  u32 ip;
+  u16 port;
+  if((r = sa_get(addr, addrlen, &ip, &port)) < 0)
+    return (u64)r;
+  if(s->type == SOCK_STREAM)
+    return sock_ret(tcp_connect(s, ip, port, sock_nonblock(fflags, 0)));
+  if(!s->bound && (r = udp_bind(s, 0, 0)) < 0)
+    return (u64)r;
+  s->raddr     = ip;
+  s->rport     = port;
+  s->connected = true;
+  return 0;
+}
+
+/** @brief Take a connection off a listening socket's queue, with flags. */
+u64 sys_accept4(u64 fd, u64 addr, u64 addrlen, u64 flags, u64 a5, u64 a6)
+{
+  (void)a5;
+  (void)a6;
+
+  i64     r;
+  u32     fflags;
+  sock_t *s = sock_from_fd(fd, &fflags, &r);
+  if(!s)
+    return (u64)r;
+  if(s->type != SOCK_STREAM)
+    return (u64)-EOPNOTSUPP;
+  if((u32)flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC))
+    return (u64)-EINVAL;
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-EINVAL;
+
+  sock_t *c;
+  if((r = tcp_accept(s, &c, sock_nonblock(fflags, 0))) < 0)
+    return sock_ret(r);
+  if((r = sa_put_user(addr, addrlen, c->raddr, c->rport)) < 0) {
+    sock_oft_release(c);
+    return (u64)r;
+  }
+  return sock_ret(sock_install(p, c, (u32)flags));
+}
+
+/** @brief accept4() without flags. */
+u64 sys_accept(u64 fd, u64 addr, u64 addrlen, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  return sys_accept4(fd, addr, addrlen, 0, a5, a6);
+}
+
+/**
+ * @brief Send on a socket; a datagram socket may name its destination.
+ *
+ * @p flags may include ::MSG_DONTWAIT; others are ignored. Like pipes,
+ * sockets report a closed peer as @c -EPIPE without raising SIGPIPE.
+ */
+u64 sys_sendto(
+    u64 fd, u64 buf, u64 len, u64 flags, u64 dest_addr, u64 addrlen
+)
+{
+  i64     r;
+  u32     fflags;
+  sock_t *s = sock_from_fd(fd, &fflags, &r);
+  if(!s)
+    return (u64)r;
+  if(len && !user_buf_ok(buf, len))
+    return (u64)-EFAULT;
+  if(s->type == SOCK_STREAM)
+    return sock_ret(
+        tcp_send(s, (const void *)buf, len, sock_nonblock(fflags, flags))
+    );
+
+  u32 ip   = s->raddr;
+  u16 port = s->rport;
+  if(dest_addr)
+    r = sa_get(dest_addr, addrlen, &ip, &port);
+  else
+    r = s->connected ? 0 : -EDESTADDRREQ;
+  if(r < 0)
+    return (u64)r;
+  return sock_ret(udp_sendto(s, (const void *)buf, len, ip, port));
+}
+
+/**
+ * @brief Receive from a socket; a datagram socket reports the sender.
+ *
+ * @p flags may include ::MSG_PEEK and ::MSG_DONTWAIT. A datagram longer
+ * than @p len is truncated and the rest discarded.
+ */
+u64 sys_recvfrom(
+    u64 fd, u64 buf, u64 len, u64 flags, u64 src_addr, u64 addrlen
+)
+{
+  i64     r;
+  u32     fflags;
+  sock_t *s = sock_from_fd(fd, &fflags, &r);
+  if(!s)
+    return (u64)r;
+  if(len && !user_buf_ok(buf, len))
+    return (u64)-EFAULT;
+
+  bool nb = sock_nonblock(fflags, flags);
+  u32  rf = (u32)flags & MSG_PEEK;
+  if(s->type == SOCK_STREAM)
+    return sock_ret(tcp_recv(s, (void *)buf, len, rf, nb));
+
+  u32 ip;
+  u16 port;
+  r = udp_recvfrom(s, (void *)buf, len, rf, nb, &ip, &port);
+  if(r >= 0) {
+    i64 e = sa_put_user(src_addr, addrlen, ip, port);
+    if(e < 0)
+      r = e;
+  }
+  return sock_ret(r);
+}
+
+/* Send the buffers of @p iov in turn on a stream socket. */
+static i64 sock_sendv(sock_t *s, const vfs_iovec_t *iov, u64 n, bool nb)
+{
+  u64 total = 0;
+  for(u64 i = 0; i < n; i++) {
+    if(!iov[i].len)
+      continue;
+    i64 r = tcp_send(s, iov[i].base, iov[i].len, nb);
+    if(r < 0)
+      return total ? (i64)total : r;
+    total += (u64)r;
+    if((u64)r < iov[i].len)
+      break;
+  }
+  return (i64)total;
+}
+
+/* Fill the buffers of @p iov in turn from a stream socket; only the first
+ * wait may block, and a peek looks at the first buffer's worth. */
+static i64
+sock_recvv(sock_t *s, const vfs_iovec_t *iov, u64 n, u32 rf, bool nb)
+{
+  u64 total = 0;
+  for(u64 i = 0; i < n; i++) {
+    if(!iov[i].len)
+      continue;
+    i64 r = tcp_recv(s, iov[i].base, iov[i].len, rf, nb || total);
+    if(r < 0)
+      return total ? (i64)total : r;
+    total += (u64)r;
+    if((u64)r < iov[i].len || (rf & MSG_PEEK))
+      break;
+  }
+  return (i64)total;
+}
+
+/* Send one datagram gathered from @p iov. */
+static i64 sock_sendv_dgram(
+    sock_t *s, const vfs_iovec_t *iov, u64 n, u32 ip, u16 port
+)
+{
+  if(n == 1)
+    return udp_sendto(s, iov[0].base, iov[0].len, ip, port);
+  u64 total = 0;
+  for(u64 i = 0; i < n; i++)
+    total += iov[i].len;
+  if(total > SOCK_DGRAM_MAX)
+    return -EMSGSIZE;
+
+  u8 *bounce = kmalloc(SOCK_DGRAM_MAX);
+  if(!bounce)
+    return -ENOMEM;
+  u64 at = 0;
+  for(u64 i = 0; i < n; i++) {
+    kmemcpy(bounce + at, iov[i].base, iov[i].len);
+    at += iov[i].len;
+  }
+  i64 r = udp_sendto(s, bounce, total, ip, port);
+  kfree(bounce);
+  return r;
+}
+
+/* Receive one datagram scattered over @p iov. */
+static i64 sock_recvv_dgram(
+    sock_t *s, const vfs_iovec_t *iov, u64 n, u32 rf, bool nb, u32 *ip,
+    u16 *port
+)
+{
+  if(n == 1)
+    return udp_recvfrom(s, iov[0].base, iov[0].len, rf, nb, ip, port);
+
+  u8 *bounce = kmalloc(SOCK_DGRAM_MAX);
+  if(!bounce)
+    return -ENOMEM;
+  i64 r = udp_recvfrom(s, bounce, SOCK_DGRAM_MAX, rf, nb, ip, port);
+  u64 at = 0;
+  for(u64 i = 0; i < n && r > 0 && at < (u64)r; i++) {
+    u64 c = (u64)r - at < iov[i].len ? (u64)r - at : iov[i].len;
+    kmemcpy(iov[i].base, bounce + at, c);
+    at += c;
+  }
+  kfree(bounce);
+  return r < 0 ? r : (i64)at;
+}
+
+/* Copy in the msghdr at @p umsg and its iovec array. */
+static i64 msg_import(
+    u64 umsg, msghdr_abi_t *m, vfs_iovec_t *fast, vfs_iovec_t **iov
+)
+{
+  if(!user_buf_ok(umsg, sizeof(*m)) ||
+     copy_from_user(m, (const void *)umsg, sizeof(*m)))
+    return -EFAULT;
+  return iov_import(m->iov, m->iovlen, fast, iov);
+}
+
+/** @brief sendto() with a gather list; ancillary data is ignored. */
+u64 sys_sendmsg(u64 fd, u64 umsg, u64 flags, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  i64     r;
+  u32     fflags;
+  sock_t *s = sock_from_fd(fd, &fflags, &r);
+  if(!s)
+    return (u64)r;
+  msghdr_abi_t m;
+  vfs_iovec_t  fast[SYS_IOV_FAST];
+  vfs_iovec_t *iov;
+  if((r = msg_import(umsg, &m, fast, &iov)) < 0)
+    return (u64)r;
+
+  if(s->type == SOCK_STREAM) {
+    r = sock_sendv(s, iov, m.iovlen, sock_nonblock(fflags, flags));
+  } else {
+    u32 ip   = s->raddr;
+    u16 port = s->rport;
+    if(m.name)
+      r = sa_get(m.name, m.namelen, &ip, &port);
+    else
+      r = s->connected ? 0 : -EDESTADDRREQ;
+    if(r == 0)
+      r = sock_sendv_dgram(s, iov, m.iovlen, ip, port);
+  }
+  iov_release(iov, fast);
+  return sock_ret(r);
+}
+
+/**
+ * @brief recvfrom() with a scatter list.
+ *
+ * No ancillary data is ever returned, and @c msg_flags comes back 0.
+ */
+u64 sys_recvmsg(u64 fd, u64 umsg, u64 flags, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  i64     r;
+  u32     fflags;
+  sock_t *s = sock_from_fd(fd, &fflags, &r);
+  if(!s)
+    return (u64)r;
+  msghdr_abi_t m;
+  vfs_iovec_t  fast[SYS_IOV_FAST];
+  vfs_iovec_t *iov;
+  if((r = msg_import(umsg, &m, fast, &iov)) < 0)
+    return (u64)r;
+
+  bool nb = sock_nonblock(fflags, flags);
+  u32  rf = (u32)flags & MSG_PEEK;
+  if(s->type == SOCK_STREAM) {
+    r         = sock_recvv(s, iov, m.iovlen, rf, nb);
+    m.namelen = 0;
+  } else {
+    u32 ip;
+    u16 port;
+    r = sock_recvv_dgram(s, iov, m.iovlen, rf, nb, &ip, &port);
+    if(r >= 0 && m.name) {
+      i64 e = sa_put(m.name, &m.namelen, ip, port);
+      if(e < 0)
+        r = e;
+    }
+  }
+  iov_release(iov, fast);
+
+  m.controllen = 0;
+  m.flags      = 0;
+  if(r >= 0 && copy_to_user((void *)umsg, &m, sizeof(m)))
+    r = -EFAULT;
+  return sock_ret(r);
+}
+
+/** @brief Stop receiving (SHUT_RD), sending (SHUT_WR) or both. */
+u64 sys_shutdown(u64 fd, u64 how, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  i64     r;
+  sock_t *s = sock_from_fd(fd, NULL, &r);
+  if(!s)
+    return (u64)r;
+  if(how > 2)
+    return (u64)-EINVAL;
+  u32 bits = (u32)how + 1; /* SHUT_RD, SHUT_WR, SHUT_RDWR */
+  if(s->type == SOCK_STREAM)
+    return sock_ret(tcp_shutdown(s, bits));
+  if(!s->connected)
+    return (u64)-ENOTCONN;
+  s->shut |= (u8)bits;
+  wait_wake_all(&s->wq);
+  return 0;
+}
+
+/** @brief The local address; an unbound address reads as the source used. */
+u64 sys_getsockname(u64 fd, u64 addr, u64 addrlen, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  i64     r;
+  sock_t *s = sock_from_fd(fd, NULL, &r);
+  if(!s)
+    return (u64)r;
+  u32 ip = s->laddr;
+  if(!ip && s->raddr)
+    ip = sock_src_addr(s, s->raddr);
+  if(!addr)
+    return (u64)-EFAULT;
+  return (u64)sa_put_user(addr, addrlen, ip, s->lport);
+}
+
+/** @brief The peer's address; @c -ENOTCONN if there is none. */
+u64 sys_getpeername(u64 fd, u64 addr, u64 addrlen, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  i64     r;
+  sock_t *s = sock_from_fd(fd, NULL, &r);
+  if(!s)
+    return (u64)r;
+  if(!s->rport || (s->type == SOCK_DGRAM && !s->connected))
+    return (u64)-ENOTCONN;
+  if(!addr)
+    return (u64)-EFAULT;
+  return (u64)sa_put_user(addr, addrlen, s->raddr, s->rport);
+}
+
+/**
+ * @brief Set a socket option.
+ *
+ * SO_RCVTIMEO and SO_SNDTIMEO bound blocking calls. SO_REUSEADDR,
+ * SO_KEEPALIVE, SO_BROADCAST, the buffer sizes and TCP_NODELAY are
+ * accepted and have no effect: there is no TIME_WAIT port reservation to
+ * override, no keepalive timer, and segments leave as soon as the window
+ * allows.
+ */
+u64 sys_setsockopt(
+    u64 fd, u64 level, u64 name, u64 optval, u64 optlen, u64 a6
+)
+{
+  (void)a6;
+
+  i64     r;
+  sock_t *s = sock_from_fd(fd, NULL, &r);
+  if(!s)
+    return (u64)r;
+
+  if(level == SOL_SOCKET && (name == SO_RCVTIMEO || name == SO_SNDTIMEO)) {
+    timeval_abi_t tv;
+    if(optlen < sizeof(tv))
+      return (u64)-EINVAL;
+    if(!user_buf_ok(optval, sizeof(tv)) ||
+       copy_from_user(&tv, (const void *)optval, sizeof(tv)))
+      return (u64)-EFAULT;
+    if(tv.sec < 0 || tv.usec < 0 || tv.usec >= 1000000)
+      return (u64)-EDOM;
+    u64 ns = (u64)tv.sec * NSEC_PER_SEC + (u64)tv.usec * 1000;
+    if(name == SO_RCVTIMEO)
+      s->rcvtimeo = ns;
+    else
+      s->sndtimeo = ns;
+    return 0;
+  }
+
+  bool known = false;
+  if(level == SOL_SOCKET)
+    known = name == SO_REUSEADDR || name == SO_KEEPALIVE ||
+            name == SO_BROADCAST || name == SO_SNDBUF || name == SO_RCVBUF;
+  else if(level == IPPROTO_TCP)
+    known = s->type == SOCK_STREAM && name == TCP_NODELAY;
+  if(!known)
+    return (u64)-ENOPROTOOPT;
+  if(optlen < sizeof(i32))
+    return (u64)-EINVAL;
+  return user_buf_ok(optval, sizeof(i32)) ? 0 : (u64)-EFAULT;
+}
+
+/** @brief Read a socket option; SO_ERROR also clears the pending error. */
+u64 sys_getsockopt(
+    u64 fd, u64 level, u64 name, u64 optval, u64 optlen, u64 a6
+)
+{
+  (void)a6;
+
+  i64     r;
+  sock_t *s = sock_from_fd(fd, NULL, &r);
+  if(!s)
+    return (u64)r;
+
+  u32 len;
+  if(!user_buf_ok(optlen, sizeof(len)) ||
+     copy_from_user(&len, (const void *)optlen, sizeof(len)))
+    return (u64)-EFAULT;
+  if((i32)len < 0)
+    return (u64)-EINVAL;
+
+  timeval_abi_t tv;
+  i32           val  = 0;
+  const void   *src  = &val;
+  u32           size = sizeof(val);
+  if(level == SOL_SOCKET) {
+    switch(name) {
+    case SO_TYPE:
+      val = s->type;
+      break;
+    case SO_ERROR:
+      val      = -s->error;
+      s->error = 0;
+      break;
+    case SO_SNDBUF:
+    case SO_RCVBUF:
+      val = SOCK_BUF_SIZE;
+      break;
+    case SO_REUSEADDR:
+    case SO_KEEPALIVE:
+    case SO_BROADCAST:
+      break;
+    case SO_RCVTIMEO:
+    case SO_SNDTIMEO: {
+      u64 ns  = name == SO_RCVTIMEO ? s->rcvtimeo : s->sndtimeo;
+      tv.sec  = (i64)(ns / NSEC_PER_SEC);
+      tv.usec = (i64)(ns % NSEC_PER_SEC / 1000);
+      src     = &tv;
+      size    = sizeof(tv);
+      break;
+    }
+    default:
+      return (u64)-ENOPROTOOPT;
+    }
+  } else if(level == IPPROTO_TCP && s->type == SOCK_STREAM &&
+            name == TCP_NODELAY) {
+    val = 1;
+  } else {
+    return (u64)-ENOPROTOOPT;
+  }
+
+  u32 n = len < size ? len : size;
+  if((n && (!user_buf_ok(optval, n) || copy_to_user((void *)optval, src, n))) ||
+     copy_to_user((void *)optlen, &n, sizeof(n)))
+    return (u64)-EFAULT;
+  return 0;
+}
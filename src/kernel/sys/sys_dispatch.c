@@ -3,31 +3,35 @@
  * @brief Numbered syscall lookup and dispatch.
  */
 
+#include <alcor2/arch/cpu.h>
+#include <alcor2/drivers/ata.h>
 #include <alcor2/errno.h>
+#include <alcor2/fs/procfs.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/proc/sched.h>
 #include <alcor2/sys/internal.h>
+#include <alcor2/sys/irqsoff.h>
 #include <alcor2/sys/syscall.h>
+#include <alcor2/sys/systrace.h>
+#include <alcor2/sys/trace.h>
 
 /* Set to 1 to trace every syscall with its arguments */
 #define SYS_TRACE 0
 
+/** @brief Entry for syscall @p n, placed at index @p n of ::sys_table. */
 #define SYS_DEF(n, nm, fn)                                                     \
-  {                                                                            \
-    (n), (nm), (fn)                                                            \
-  }
-#define SYS_END                                                                \
-  {                                                                            \
-    0, NULL, NULL                                                              \
-  }
+  [(n)] = {(n), (nm), (fn)}
 
 /**
- * @brief Table of all supported syscalls.
+ * @brief Table of all supported syscalls, indexed by number (RAX).
  *
- * Ordered logically but uses explicit indices for RAX mapping.
- * Terminated by ::SYS_END sentinel.
+ * Listed logically; the designated initialisers place each entry at its
+ * syscall number, so dispatch is a single bounds-checked load.  Unlisted
+ * numbers are zero entries with no handler.  Assigning one number twice
+ * trips -Woverride-init.
  */
-static const sys_def_t sys_table[] = {
+static const sys_def_t sys_table[SYS_MAX] = {
     SYS_DEF(SYS_READ, "read", sys_read),
     SYS_DEF(SYS_WRITE, "write", sys_write),
     SYS_DEF(SYS_OPEN, "open", sys_open),
@@ -47,24 +51,75 @@ static const sys_def_t sys_table[] = {
     SYS_DEF(SYS_IOCTL, "ioctl", sys_ioctl),
     SYS_DEF(SYS_PREAD64, "pread64", sys_pread64),
     SYS_DEF(SYS_PWRITE64, "pwrite64", sys_pwrite64),
+    SYS_DEF(SYS_SENDFILE, "sendfile", sys_sendfile),
+    SYS_DEF(SYS_COPY_FILE_RANGE, "copy_file_range", sys_copy_file_range),
+    SYS_DEF(SYS_SPLICE, "splice", sys_splice),
+    SYS_DEF(SYS_TEE, "tee", sys_tee),
+    SYS_DEF(SYS_VMSPLICE, "vmsplice", sys_vmsplice),
     SYS_DEF(SYS_READV, "readv", sys_readv),
     SYS_DEF(SYS_WRITEV, "writev", sys_writev),
+    SYS_DEF(SYS_PREADV, "preadv", sys_preadv),
+    SYS_DEF(SYS_PWRITEV, "pwritev", sys_pwritev),
     SYS_DEF(SYS_ACCESS, "access", sys_access),
     SYS_DEF(SYS_PIPE, "pipe", sys_pipe),
     SYS_DEF(SYS_SELECT, "select", sys_select),
+    SYS_DEF(SYS_EPOLL_CREATE, "epoll_create", sys_epoll_create),
+    SYS_DEF(SYS_EPOLL_CREATE1, "epoll_create1", sys_epoll_create1),
+    SYS_DEF(SYS_EPOLL_CTL, "epoll_ctl", sys_epoll_ctl),
+    SYS_DEF(SYS_EPOLL_WAIT, "epoll_wait", sys_epoll_wait),
+    SYS_DEF(SYS_EPOLL_PWAIT, "epoll_pwait", sys_epoll_pwait),
+    SYS_DEF(SYS_EVENTFD, "eventfd", sys_eventfd),
+    SYS_DEF(SYS_EVENTFD2, "eventfd2", sys_eventfd2),
+    SYS_DEF(SYS_TIMERFD_CREATE, "timerfd_create", sys_timerfd_create),
+    SYS_DEF(SYS_TIMERFD_SETTIME, "timerfd_settime", sys_timerfd_settime),
+    SYS_DEF(SYS_TIMERFD_GETTIME, "timerfd_gettime", sys_timerfd_gettime),
+    SYS_DEF(SYS_PERF_EVENT_OPEN, "perf_event_open", sys_perf_event_open),
+    SYS_DEF(SYS_SOCKET, "socket", sys_socket),
+    SYS_DEF(SYS_CONNECT, "connect", sys_connect),
+    SYS_DEF(SYS_ACCEPT, "accept", sys_accept),
+    SYS_DEF(SYS_ACCEPT4, "accept4", sys_accept4),
+    SYS_DEF(SYS_SENDTO, "sendto", sys_sendto),
+    SYS_DEF(SYS_RECVFROM, "recvfrom", sys_recvfrom),
+    SYS_DEF(SYS_SENDMSG, "sendmsg", sys_sendmsg),
+    SYS_DEF(SYS_RECVMSG, "recvmsg", sys_recvmsg),
+    SYS_DEF(SYS_SHUTDOWN, "shutdown", sys_shutdown),
+    SYS_DEF(SYS_BIND, "bind", sys_bind),
+    SYS_DEF(SYS_LISTEN, "listen", sys_listen),
+    SYS_DEF(SYS_GETSOCKNAME, "getsockname", sys_getsockname),
+    SYS_DEF(SYS_GETPEERNAME, "getpeername", sys_getpeername),
+    SYS_DEF(SYS_SETSOCKOPT, "setsockopt", sys_setsockopt),
+    SYS_DEF(SYS_GETSOCKOPT, "getsockopt", sys_getsockopt),
     SYS_DEF(SYS_SCHED_YIELD, "sched_yield", sys_sched_yield),
+    SYS_DEF(SYS_GETPRIORITY, "getpriority", sys_getpriority),
+    SYS_DEF(SYS_SETPRIORITY, "setpriority", sys_setpriority),
+    SYS_DEF(SYS_SCHED_SETPARAM, "sched_setparam", sys_sched_setparam),
+    SYS_DEF(SYS_SCHED_GETPARAM, "sched_getparam", sys_sched_getparam),
+    SYS_DEF(SYS_SCHED_SETSCHED, "sched_setscheduler", sys_sched_setscheduler),
+    SYS_DEF(SYS_SCHED_GETSCHED, "sched_getscheduler", sys_sched_getscheduler),
+    SYS_DEF(
+        SYS_SCHED_PRIO_MAX, "sched_get_priority_max", sys_sched_get_priority_max
+    ),
+    SYS_DEF(
+        SYS_SCHED_PRIO_MIN, "sched_get_priority_min", sys_sched_get_priority_min
+    ),
     SYS_DEF(SYS_DUP, "dup", sys_dup),
     SYS_DEF(SYS_DUP2, "dup2", sys_dup2),
     SYS_DEF(SYS_NANOSLEEP, "nanosleep", sys_nanosleep),
     SYS_DEF(SYS_GETPID, "getpid", sys_getpid),
     SYS_DEF(SYS_CLONE, "clone", sys_clone),
     SYS_DEF(SYS_FORK, "fork", sys_fork),
+    SYS_DEF(SYS_VFORK, "vfork", sys_vfork),
     SYS_DEF(SYS_EXECVE, "execve", sys_execve),
     SYS_DEF(SYS_EXIT, "exit", sys_exit),
     SYS_DEF(SYS_WAIT4, "wait4", sys_wait4),
+    SYS_DEF(SYS_GETRUSAGE, "getrusage", sys_getrusage),
+    SYS_DEF(SYS_TIMES, "times", sys_times),
     SYS_DEF(SYS_KILL, "kill", sys_kill),
     SYS_DEF(SYS_UNAME, "uname", sys_uname),
     SYS_DEF(SYS_FCNTL, "fcntl", sys_fcntl),
+    SYS_DEF(SYS_MEMFD_CREATE, "memfd_create", sys_memfd_create),
+    SYS_DEF(SYS_FSYNC, "fsync", sys_fsync),
+    SYS_DEF(SYS_FDATASYNC, "fdatasync", sys_fsync),
     SYS_DEF(SYS_FTRUNCATE, "ftruncate", sys_ftruncate),
     SYS_DEF(SYS_GETDENTS, "getdents", sys_getdents),
     SYS_DEF(SYS_GETCWD, "getcwd", sys_getcwd),
@@ -79,12 +134,14 @@ static const sys_def_t sys_table[] = {
     SYS_DEF(SYS_GETTIMEOFDAY, "gettimeofday", sys_gettimeofday),
     SYS_DEF(SYS_GETRLIMIT, "getrlimit", sys_getrlimit),
     SYS_DEF(SYS_ARCH_PRCTL, "arch_prctl", sys_arch_prctl),
+    SYS_DEF(SYS_SYNC, "sync", sys_sync),
     SYS_DEF(SYS_GETTID, "gettid", sys_gettid),
     SYS_DEF(SYS_GETPPID, "getppid", sys_getppid),
     SYS_DEF(SYS_FUTEX, "futex", sys_futex),
     SYS_DEF(SYS_SCHED_GETAFFINITY, "sched_getaffinity", sys_sched_getaffinity),
     SYS_DEF(SYS_GETDENTS64, "getdents64", sys_getdents64),
     SYS_DEF(SYS_CLOCK_GETTIME, "clock_gettime", sys_clock_gettime),
+    SYS_DEF(SYS_CLOCK_GETRES, "clock_getres", sys_clock_getres),
     SYS_DEF(SYS_EXIT_GROUP, "exit_group", sys_exit_group),
     SYS_DEF(SYS_OPENAT, "openat", sys_openat),
     SYS_DEF(SYS_NEWFSTATAT, "newfstatat", sys_newfstatat),
@@ -99,9 +156,18 @@ static const sys_def_t sys_table[] = {
     SYS_DEF(SYS_GETEGID, "getegid", sys_getegid),
     SYS_DEF(SYS_TKILL, "tkill", sys_tkill),
     SYS_DEF(SYS_TGKILL, "tgkill", sys_tgkill),
+    SYS_DEF(SYS_ALCOR_SYSTRACE, "alcor_systrace", sys_alcor_systrace),
+    SYS_DEF(SYS_ALCOR_BLKCACHE, "alcor_blkcache", sys_alcor_blkcache_stats),
     SYS_DEF(SYS_ALCOR_FB_INFO, "alcor_fb_info", sys_alcor_fb_info),
     SYS_DEF(SYS_ALCOR_FB_MMAP, "alcor_fb_mmap", sys_alcor_fb_mmap),
-    SYS_END
+    SYS_DEF(SYS_ALCOR_MEMSTAT, "alcor_memstat", sys_alcor_memstat),
+    SYS_DEF(SYS_ALCOR_FB_BACKBUF, "alcor_fb_backbuf", sys_alcor_fb_backbuf),
+    SYS_DEF(SYS_ALCOR_FB_PRESENT, "alcor_fb_present", sys_alcor_fb_present),
+    SYS_DEF(SYS_ALCOR_KPROF, "alcor_kprof", sys_alcor_kprof),
+    SYS_DEF(SYS_ALCOR_TRACE, "alcor_trace", sys_alcor_trace),
+    SYS_DEF(SYS_ALCOR_URING_SETUP, "alcor_uring_setup", sys_alcor_uring_setup),
+    SYS_DEF(SYS_ALCOR_URING_ENTER, "alcor_uring_enter", sys_alcor_uring_enter),
+    SYS_DEF(SYS_ALCOR_SPAWN, "alcor_spawn", sys_alcor_spawn),
 };
 
 /**
@@ -115,11 +181,15 @@ syscall_frame_t *syscall_get_current_frame(void)
 
 static const sys_def_t *sys__find(u64 num)
 {
-  for(const sys_def_t *d = sys_table; d->name != NULL; d++) {
-    if(d->num == num)
-      return d;
-  }
-  return NULL;
+  if(num >= SYS_MAX || !sys_table[num].handler)
+    return NULL;
+  return &sys_table[num];
+}
+
+const char *syscall_name(u64 num)
+{
+  const sys_def_t *d = sys__find(num);
+  return d ? d->name : NULL;
 }
 
 /**
@@ -127,11 +197,16 @@ static const sys_def_t *sys__find(u64 num)
  *
  * Implements optional tracing and lookup through the declarative syscall table.
  */
+
 u64 syscall_dispatch(syscall_frame_t *frame)
 {
   u64              num = frame->rax;
   const sys_def_t *d   = sys__find(num);
 
+  /* SYSCALL cleared IF; the handler runs with interrupts off until it
+   * turns them on. */
+  irqsoff_begin(IRQSOFF_SYSCALL | num);
+
   proc_t          *p         = proc_current();
   syscall_frame_t *old_frame = NULL;
   if(p) {
@@ -145,6 +220,7 @@ u64 syscall_dispatch(syscall_frame_t *frame)
 #endif
     if(p)
       p->current_frame = old_frame;
+    irqsoff_end(IRQSOFF_SYSCALL | num);
     return (u64)-ENOSYS;
   }
 
@@ -155,9 +231,21 @@ u64 syscall_dispatch(syscall_frame_t *frame)
   );
 #endif
 
+  TRACE(ALCOR_TRACE_SYSCALL_ENTER, num, frame->rdi, 0);
+  kstat.syscalls++;
+  /* What the process runs from here to the way out is system time. */
+  u64 sys_from = 0;
+  if(p) {
+    sched_update(p);
+    sys_from = p->usage.runtime;
+  }
+  u64 t0  = systrace_enabled ? cpu_rdtsc() : 0;
   u64 ret = d->handler(
       frame->rdi, frame->rsi, frame->rdx, frame->r10, frame->r8, frame->r9
   );
+  if(t0 && systrace_enabled)
+    systrace_record(p, num, cpu_rdtsc() - t0);
+  TRACE(ALCOR_TRACE_SYSCALL_EXIT, num, ret, 0);
 
 #if SYS_TRACE
   console_printf(" = %lx\n", ret);
@@ -166,8 +254,19 @@ u64 syscall_dispatch(syscall_frame_t *frame)
   if(p)
     p->current_frame = old_frame;
 
+  /* Write back block-cache data that has been dirty for too long. */
+  ata_flush_expired();
+
+  if(p) {
+    sched_update(p);
+    u64 sys         = p->usage.runtime - sys_from;
+    p->usage.stime += sys;
+    kstat.sys_ns   += sys;
+  }
+
   /* Check if we need to switch tasks before returning to user mode. */
   proc_check_resched();
 
+  irqsoff_end(IRQSOFF_SYSCALL | num);
   return ret;
 }
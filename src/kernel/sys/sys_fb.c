@@ -1,14 +1,18 @@
 /**
  * @file src/kernel/sys/sys_fb.c
- * @brief Syscalls: framebuffer info + mmap (userspace drawing / font stacks).
+ * @brief Syscalls: framebuffer info + mmap (userspace drawing / font stacks),
+ *        and the mapping of the console cell grid.
  */
 
 #include <alcor2/alcor_fb.h>
+#include <alcor2/drivers/fb_console.h>
 #include <alcor2/drivers/fb_user.h>
 #include <alcor2/errno.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/mm/memory_layout.h>
 #include <alcor2/mm/pmm.h>
+#include <alcor2/mm/uaccess.h>
+#include <alcor2/mm/vma.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/proc.h>
 #include <alcor2/sys/internal.h>
@@ -59,20 +63,213 @@ u64 sys_alcor_fb_mmap(u64 hint, u64 size_req, u64 a3, u64 a4, u64 a5, u64 a6)
   if(size_req != 0 && size_req != map_sz)
     return (u64)-EINVAL;
 
-  u64 base = (hint != 0) ? (hint & ~(u64)(PAGE_SIZE - 1))
-                         : (p->mmap_base & ~(u64)(PAGE_SIZE - 1));
-  u64 end  = base + map_sz;
+  /* Without a hint, match the frame buffer's offset in its 2 MiB block so
+   * the interior can be mapped with huge pages. */
+  u64 base = hint & ~(u64)(PAGE_SIZE - 1);
+  if(hint == 0) {
+    base = (p->mmap_base + VMM_HUGE_SIZE - 1) & ~(VMM_HUGE_SIZE - 1);
+    base += phys0 & (VMM_HUGE_SIZE - 1);
+  }
+  u64 end = base + map_sz;
   if(end < base || end > USER_SPACE_END)
     return (u64)-ENOMEM;
 
+  vma_t vma = {
+      .start  = base,
+      .end    = end,
+      .offset = 0,
+      .file   = -1,
+      .flags  = VMA_READ | VMA_WRITE | VMA_SHARED | VMA_DEVICE,
+  };
+  if(vma_remove(&p->vmas, base, end) < 0 || vma_insert(&p->vmas, &vma) < 0)
+    return (u64)-ENOMEM;
+
   if(hint == 0)
     p->mmap_base = end;
 
+  u64 flags = VMM_PRESENT | VMM_WRITE | VMM_USER | VMM_WC;
+
+  for(u64 i = 0; i < n_pages;) {
+    u64 va = base + i * PAGE_SIZE;
+    u64 pa = phys0 + i * PAGE_SIZE;
+    if(!((va | pa) & (VMM_HUGE_SIZE - 1)) && n_pages - i >= VMM_HUGE_PAGES &&
+       vmm_map_huge_in(p->cr3, va, pa, flags)) {
+      i += VMM_HUGE_PAGES;
+      continue;
+    }
+    vmm_map_in(p->cr3, va, pa, flags);
+    i++;
+  }
+
+  return base + px_off;
+}
+
+/**
+ * @brief Map a private buffer laid out like the framebuffer (same pitch
+ *        and height) for drawing offscreen; ::sys_alcor_fb_present shows
+ *        parts of it.
+ *
+ * The buffer is backed up front, with huge pages where the PMM has them,
+ * so drawing into it never faults.
+ *
+ * @return User address of the first pixel, or negative -errno.
+ */
+u64 sys_alcor_fb_backbuf(u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a1;
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(!fb_user_ready())
+    return (u64)-ENODEV;
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-ENOMEM;
+
+  alcor_fb_info_t inf;
+  fb_user_fill_info(&inf);
+  u64 size = (inf.byte_len + PAGE_SIZE - 1) & ~(u64)(PAGE_SIZE - 1);
+  u64 base = (p->mmap_base + VMM_HUGE_SIZE - 1) & ~(VMM_HUGE_SIZE - 1);
+  u64 end  = base + size;
+  if(!size || end < base || end > USER_SPACE_END)
+    return (u64)-ENOMEM;
+
+  vma_t vma = {
+      .start  = base,
+      .end    = end,
+      .offset = 0,
+      .file   = -1,
+      .flags  = VMA_READ | VMA_WRITE | VMA_ANON,
+  };
+  if(vma_remove(&p->vmas, base, end) < 0 || vma_insert(&p->vmas, &vma) < 0)
+    return (u64)-ENOMEM;
+  p->mmap_base = end;
+
+  /* Whatever cannot be backed now is demand-zero like any anonymous map. */
   u64 flags = VMM_PRESENT | VMM_WRITE | VMM_USER;
+  for(u64 va = base; va < end;) {
+    if(!(va & (VMM_HUGE_SIZE - 1)) && end - va >= VMM_HUGE_SIZE) {
+      void *huge = pmm_try_alloc_order(VMM_HUGE_ORDER);
+      if(huge) {
+        kzero_nt(phys_to_virt((u64)huge), VMM_HUGE_SIZE);
+        if(vmm_map_huge_in(p->cr3, va, (u64)huge, flags)) {
+          va += VMM_HUGE_SIZE;
+          continue;
+        }
+        pmm_free_pages(huge, VMM_HUGE_PAGES);
+      }
+    }
+    void *page = pmm_alloc_zeroed();
+    if(!page)
+      break;
+    vmm_map_in(p->cr3, va, (u64)page, flags);
+    va += PAGE_SIZE;
+  }
+  return base;
+}
 
+/**
+ * @brief Copy rectangle (@p x, @p y, @p w, @p h) of the offscreen buffer
+ *        at @p buf to the same place on screen; w or h of 0 copies it all.
+ *
+ * The rectangle is clipped to the screen. Rows go out with non-temporal
+ * stores, so presenting does not evict the client's working set.
+ *
+ * @return 0, or negative -errno (@c -EFAULT unless @p buf starts a
+ *         readable buffer of the framebuffer's size).
+ */
+u64 sys_alcor_fb_present(u64 buf, u64 x, u64 y, u64 w, u64 h, u64 a6)
+{
+  (void)a6;
+
+  u8 *vram = fb_user_pixels();
+  if(!vram)
+    return (u64)-ENODEV;
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-ENOMEM;
+
+  alcor_fb_info_t inf;
+  fb_user_fill_info(&inf);
+  /* Reads of buf must fault in as ordinary demand paging: one readable,
+   * non-device region has to cover all of it. */
+  const vma_t *v = vma_find(&p->vmas, buf);
+  if(!v || !(v->flags & VMA_READ) || (v->flags & VMA_DEVICE) ||
+     buf + inf.byte_len < buf || buf + inf.byte_len > v->end)
+    return (u64)-EFAULT;
+
+  if(w == 0 || h == 0) {
+    x = 0;
+    y = 0;
+    w = inf.width;
+    h = inf.height;
+  }
+  if(x >= inf.width || y >= inf.height)
+    return 0;
+  if(w > inf.width - x)
+    w = inf.width - x;
+  if(h > inf.height - y)
+    h = inf.height - y;
+
+  u64 bypp = ((u64)inf.bpp + 7) / 8;
+  u64 off  = y * inf.pitch + x * bypp;
+  for(u64 r = 0; r < h; r++, off += inf.pitch)
+    kmemcpy_nt(vram + off, (const u8 *)buf + off, w * bypp);
+  return 0;
+}
+
+u64 fb_map_grid(u64 arg)
+{
+  if(!user_rw_ok(arg, sizeof(fb_console_grid_t)))
+    return (u64)-EFAULT;
+
+  u64 phys0, n_pages;
+  if(!fb_console_grid_pages(&phys0, &n_pages))
+    return (u64)-ENODEV;
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-ENOMEM;
+
+  u64 base = p->mmap_base;
+  u64 end  = base + n_pages * PAGE_SIZE;
+  if(end < base || end > USER_SPACE_END)
+    return (u64)-ENOMEM;
+
+  vma_t vma = {
+      .start  = base,
+      .end    = end,
+      .offset = 0,
+      .file   = -1,
+      .flags  = VMA_READ | VMA_WRITE | VMA_SHARED | VMA_DEVICE,
+  };
+  if(vma_remove(&p->vmas, base, end) < 0 || vma_insert(&p->vmas, &vma) < 0)
+    return (u64)-ENOMEM;
+  p->mmap_base = end;
+
+  /* Each user mapping takes its own page reference, so unmapping or
+   * process teardown drops that reference and never the console's.
+   * VMM_SHARED keeps fork from making the leaves copy-on-write: a renderer
+   * must keep drawing into the grid the console reads. */
   for(u64 i = 0; i < n_pages; i++) {
-    vmm_map_in(p->cr3, base + i * PAGE_SIZE, phys0 + i * PAGE_SIZE, flags);
+    u64 pa = phys0 + i * PAGE_SIZE;
+    pmm_page_ref((void *)pa);
+    vmm_map_in(
+        p->cr3, base + i * PAGE_SIZE, pa,
+        VMM_PRESENT | VMM_WRITE | VMM_USER | VMM_SHARED
+    );
   }
 
-  return base + px_off;
+  int               cols, rows;
+  fb_console_grid_t g;
+  fb_console_get_size(&cols, &rows);
+  g.cells_user = base;
+  g.map_size   = end - base;
+  g.cols       = (u32)cols;
+  g.rows       = (u32)rows;
+  if(copy_to_user((void *)arg, &g, sizeof(g)) < 0)
+    return (u64)-EFAULT;
+  return 0;
 }
@@ -2,14 +2,17 @@
  * @file src/kernel/sys/sys_fs.c
  * @brief Filesystem syscalls: open, close, stat, seek, rename, chdir, …
  *
- * Every entry point validates user pointers through the VMM before touching
- * them, then delegates to the VFS layer.  The @c stat_buf layout follows the
- * x86-64 POSIX ABI used by @c stat / @c fstat / @c lstat.
+ * Paths are copied in and stat buffers out with the uaccess routines, so a
+ * bad pointer fails with @c -EFAULT; the VFS layer only sees kernel copies.
+ * The @c stat_buf layout follows the x86-64 POSIX ABI used by @c stat /
+ * @c fstat / @c lstat.
  */
 
 #include <alcor2/errno.h>
+#include <alcor2/fs/ramfs.h>
 #include <alcor2/fs/vfs.h>
 #include <alcor2/kstdlib.h>
+#include <alcor2/mm/uaccess.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/proc.h>
 #include <alcor2/sys/internal.h>
@@ -70,10 +73,16 @@ static void fill_proc_self_exe_stat(struct stat_buf *st, proc_t *p)
   st->st_blksize = 4096;
 }
 
-/** @brief Return @c true if @p ptr is a valid, non-NULL user-space pointer. */
-static inline bool user_cstr_ok(u64 ptr)
+/**
+ * @brief Copy the user path at @p ptr into @p dst (@c VFS_PATH_MAX bytes).
+ * @return 0, @c -EFAULT or @c -ENAMETOOLONG.
+ */
+static i64 user_path(u64 ptr, char *dst)
 {
-  return ptr && vmm_is_user_ptr((void *)ptr);
+  if(!ptr)
+    return -EFAULT;
+  i64 len = strncpy_from_user(dst, (const char *)ptr, VFS_PATH_MAX);
+  return len < 0 ? len : 0;
 }
 
 /** @brief Return @c true if @p ptr..@p ptr+size is a valid user-space range. */
@@ -110,10 +119,12 @@ u64 sys_open(u64 path, u64 flags, u64 mode, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
-  if(!user_cstr_ok(path))
-    return (u64)-EFAULT;
+  char kpath[VFS_PATH_MAX];
+  i64  rc = user_path(path, kpath);
+  if(rc < 0)
+    return (u64)rc;
 
-  i64 fd = vfs_open((const char *)path, (u32)flags);
+  i64 fd = vfs_open(kpath, (u32)flags);
   return (u64)fd;
 }
 
@@ -130,6 +141,22 @@ u64 sys_close(u64 fd, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
   return (result < 0) ? (u64)result : 0;
 }
 
+/** @brief Stat the kernel copy @p path into the user buffer @p statbuf. */
+static u64 stat_path(const char *path, u64 statbuf)
+{
+  struct stat_buf st;
+  if(path_is_proc_self_exe(path)) {
+    fill_proc_self_exe_stat(&st, proc_current());
+  } else {
+    vfs_stat_t vst;
+    if(vfs_stat(path, &vst) < 0)
+      return (u64)-ENOENT;
+    fill_stat_buf(&st, &vst);
+  }
+  return copy_to_user((void *)statbuf, &st, sizeof(st)) < 0 ? (u64)-EFAULT
+                                                            : 0;
+}
+
 /** @brief Stat the node at @p path into a POSIX @c stat buffer. */
 u64 sys_stat(u64 path, u64 statbuf, u64 a3, u64 a4, u64 a5, u64 a6)
 {
@@ -138,20 +165,13 @@ u64 sys_stat(u64 path, u64 statbuf, u64 a3, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
-  if(!user_cstr_ok(path) || !user_buf_ok(statbuf, sizeof(struct stat_buf)))
+  char kpath[VFS_PATH_MAX];
+  i64  rc = user_path(path, kpath);
+  if(rc < 0)
+    return (u64)rc;
+  if(!user_buf_ok(statbuf, sizeof(struct stat_buf)))
     return (u64)-EFAULT;
-
-  if(path_is_proc_self_exe((const char *)path)) {
-    fill_proc_self_exe_stat((struct stat_buf *)statbuf, proc_current());
-    return 0;
-  }
-
-  vfs_stat_t vst;
-  if(vfs_stat((const char *)path, &vst) < 0)
-    return (u64)-ENOENT;
-
-  fill_stat_buf((struct stat_buf *)statbuf, &vst);
-  return 0;
+  return stat_path(kpath, statbuf);
 }
 
 /**
@@ -170,23 +190,22 @@ u64 sys_fstat(u64 fd, u64 statbuf, u64 a3, u64 a4, u64 a5, u64 a6)
   if(!user_buf_ok(statbuf, sizeof(struct stat_buf)))
     return (u64)-EFAULT;
 
-  struct stat_buf *st = (struct stat_buf *)statbuf;
+  struct stat_buf st;
   if(fd <= 2) {
-    kzero(st, sizeof(*st));
-    st->st_dev     = 0x1000000000000000ULL | (u64)fd;
-    st->st_ino     = (u64)fd;
-    st->st_mode    = 0020000 | 0666;
-    st->st_blksize = 4096;
-    st->st_nlink   = 1;
-    return 0;
+    kzero(&st, sizeof(st));
+    st.st_dev     = 0x1000000000000000ULL | (u64)fd;
+    st.st_ino     = (u64)fd;
+    st.st_mode    = 0020000 | 0666;
+    st.st_blksize = 4096;
+    st.st_nlink   = 1;
+  } else {
+    vfs_stat_t vst;
+    if(vfs_fstat((i64)fd, &vst) < 0)
+      return (u64)-EBADF;
+    fill_stat_buf(&st, &vst);
   }
-
-  vfs_stat_t vst;
-  if(vfs_fstat((i64)fd, &vst) < 0)
-    return (u64)-EBADF;
-
-  fill_stat_buf(st, &vst);
-  return 0;
+  return copy_to_user((void *)statbuf, &st, sizeof(st)) < 0 ? (u64)-EFAULT
+                                                            : 0;
 }
 
 /** @brief @c lstat — no symlink resolution in VFS yet; identical to @c stat. */
@@ -195,19 +214,10 @@ u64 sys_lstat(u64 path, u64 statbuf, u64 a3, u64 a4, u64 a5, u64 a6)
   return sys_stat(path, statbuf, a3, a4, a5, a6);
 }
 
-/** @brief Check that @p path exists and is accessible; always grants access. */
-u64 sys_access(u64 path, u64 mode, u64 a3, u64 a4, u64 a5, u64 a6)
+/** @brief Check that the kernel copy @p path exists. */
+static u64 access_path(const char *path)
 {
-  (void)mode;
-  (void)a3;
-  (void)a4;
-  (void)a5;
-  (void)a6;
-
-  if(!user_cstr_ok(path))
-    return (u64)-EFAULT;
-
-  if(path_is_proc_self_exe((const char *)path)) {
+  if(path_is_proc_self_exe(path)) {
     const proc_t *p = proc_current();
     if(!p || !p->exe_path[0])
       return (u64)-ENOENT;
@@ -215,46 +225,62 @@ u64 sys_access(u64 path, u64 mode, u64 a3, u64 a4, u64 a5, u64 a6)
   }
 
   vfs_stat_t st;
-  if(vfs_stat((const char *)path, &st) < 0)
+  if(vfs_stat(path, &st) < 0)
     return (u64)-ENOENT;
   return 0;
 }
 
+/** @brief Check that @p path exists and is accessible; always grants access. */
+u64 sys_access(u64 path, u64 mode, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)mode;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  char kpath[VFS_PATH_MAX];
+  i64  rc = user_path(path, kpath);
+  if(rc < 0)
+    return (u64)rc;
+  return access_path(kpath);
+}
+
 /**
- * @brief @c faccessat — only @c AT_FDCWD and absolute paths are supported.
+ * @brief @c faccessat — resolves @p pathname relative to @p dirfd.
  *
- * Relative paths with a real @p dirfd return @c -ENOSYS; all supported flags
- * are accepted and silently ignored (no fine-grained mode checking in VFS).
+ * All supported flags are accepted and silently ignored (no fine-grained
+ * mode checking in VFS).
  */
 u64 sys_faccessat(u64 dirfd, u64 pathname, u64 mode, u64 flags, u64 a5, u64 a6)
 {
-  const i64 AT_FDCWD = -100;
-
   (void)a5;
   (void)a6;
   (void)flags;
+  (void)mode;
 
-  if(!user_cstr_ok(pathname))
-    return (u64)-EFAULT;
-
-  const char *p = (const char *)pathname;
-  if(p[0] != '/' && (i64)dirfd != AT_FDCWD)
-    return (u64)-ENOSYS;
+  char p[VFS_PATH_MAX];
+  i64  rc = user_path(pathname, p);
+  if(rc < 0)
+    return (u64)rc;
+  if(p[0] == '/' || (i64)dirfd == VFS_AT_FDCWD)
+    return access_path(p);
 
-  return sys_access(pathname, mode, 0, 0, 0, 0);
+  vfs_stat_t st;
+  i64        r = vfs_statat((i64)dirfd, p, &st);
+  return r < 0 ? (u64)r : 0;
 }
 
 /**
- * @brief @c newfstatat — supports @c AT_FDCWD and absolute paths only.
+ * @brief @c newfstatat — stats @p pathname relative to @p dirfd.
  *
  * @c AT_SYMLINK_NOFOLLOW is accepted but not enforced (VFS has no @c lstat).
- * @c AT_EMPTY_PATH returns @c -ENOSYS.
+ * @c AT_EMPTY_PATH with an empty @p pathname stats @p dirfd itself.
  */
 u64 sys_newfstatat(
     u64 dirfd, u64 pathname, u64 statbuf, u64 flags, u64 a5, u64 a6
 )
 {
-  const i64 AT_FDCWD            = -100;
   const u32 AT_SYMLINK_NOFOLLOW = 0x100u;
   const u32 AT_NO_AUTOMOUNT     = 0x800u;
   const u32 AT_EMPTY_PATH       = 0x1000u;
@@ -263,25 +289,34 @@ u64 sys_newfstatat(
   (void)a5;
   (void)a6;
 
-  if(flags & AT_EMPTY_PATH)
-    return (u64)-ENOSYS;
-
   {
-    u32 allowed = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_STATX_MASK;
+    u32 allowed = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_EMPTY_PATH |
+                  AT_STATX_MASK;
     if((u32)flags & ~allowed)
       return (u64)-EINVAL;
   }
 
-  if(!user_cstr_ok(pathname) || !user_buf_ok(statbuf, sizeof(struct stat_buf)))
+  char p[VFS_PATH_MAX];
+  i64  rc = user_path(pathname, p);
+  if(rc < 0)
+    return (u64)rc;
+  if(!user_buf_ok(statbuf, sizeof(struct stat_buf)))
     return (u64)-EFAULT;
 
-  const char *p = (const char *)pathname;
-  if(p[0] != '/' && (i64)dirfd != AT_FDCWD)
-    return (u64)-ENOSYS;
+  if(p[0] == '\0' && (flags & AT_EMPTY_PATH))
+    return sys_fstat(dirfd, statbuf, 0, 0, 0, 0);
+  if(p[0] == '/' || (i64)dirfd == VFS_AT_FDCWD)
+    return stat_path(p, statbuf);
 
-  (void)dirfd;
-  (void)flags;
-  return sys_stat(pathname, statbuf, 0, 0, 0, 0);
+  vfs_stat_t vst;
+  i64        r = vfs_statat((i64)dirfd, p, &vst);
+  if(r < 0)
+    return (u64)r;
+
+  struct stat_buf st;
+  fill_stat_buf(&st, &vst);
+  return copy_to_user((void *)statbuf, &st, sizeof(st)) < 0 ? (u64)-EFAULT
+                                                            : 0;
 }
 
 /** @brief Duplicate @p oldfd to the lowest free fd ≥ 3. */
@@ -312,18 +347,24 @@ u64 sys_dup2(u64 oldfd, u64 newfd, u64 a3, u64 a4, u64 a5, u64 a6)
   return (result < 0) ? (u64)-EBADF : (u64)result;
 }
 
-#define F_DUPFD    0
-#define F_GETFD    1
-#define F_SETFD    2
-#define F_GETFL    3
-#define F_SETFL    4
-#define FD_CLOEXEC 1
+#define F_DUPFD      0
+#define F_GETFD      1
+#define F_SETFD      2
+#define F_GETFL      3
+#define F_SETFL      4
+#define F_SETPIPE_SZ 1031
+#define F_GETPIPE_SZ 1032
+#define F_ADD_SEALS  1033
+#define F_GET_SEALS  1034
+#define FD_CLOEXEC   1
 
 /**
  * @brief Perform a file-control operation on @p fd.
  *
  * Supported commands: @c F_DUPFD, @c F_GETFD, @c F_SETFD, @c F_GETFL,
- * @c F_SETFL.  Unknown commands return 0 to avoid breaking musl probes.
+ * @c F_SETFL, @c F_GETPIPE_SZ / @c F_SETPIPE_SZ on pipes, and
+ * @c F_ADD_SEALS / @c F_GET_SEALS on sealable files.  Unknown commands
+ * return 0 to avoid breaking musl probes.
  */
 u64 sys_fcntl(u64 fd, u64 cmd, u64 arg, u64 a4, u64 a5, u64 a6)
 {
@@ -369,11 +410,69 @@ u64 sys_fcntl(u64 fd, u64 cmd, u64 arg, u64 a4, u64 a5, u64 a6)
     if(fd <= 2)
       return 0;
     return vfs_set_flags((i64)fd, (u32)arg) < 0 ? (u64)-EBADF : 0;
+  case F_GETPIPE_SZ:
+  case F_SETPIPE_SZ: {
+    const vfs_oft_entry_t *e = vfs_oft_get(vfs_fd_to_oft((i64)fd));
+    if(!e)
+      return (u64)-EBADF;
+    if(e->kind != VFS_KIND_PIPE_RD && e->kind != VFS_KIND_PIPE_WR)
+      return (u64)-EINVAL;
+    if((int)cmd == F_GETPIPE_SZ)
+      return pipe_get_size(e->obj);
+    return (u64)pipe_set_size(e->obj, arg);
+  }
+  case F_ADD_SEALS:
+  case F_GET_SEALS: {
+    i32                    idx = vfs_fd_to_oft((i64)fd);
+    const vfs_oft_entry_t *e   = vfs_oft_get(idx);
+    if(!e)
+      return (u64)-EBADF;
+    if((int)cmd == F_GET_SEALS)
+      return (u64)vfs_oft_seals(idx, 0);
+    if(!(e->flags & (O_WRONLY | O_RDWR)))
+      return (u64)-EPERM;
+    i64 r = vfs_oft_seals(idx, (u32)arg);
+    return r < 0 ? (u64)r : 0;
+  }
   default:
     return 0;
   }
 }
 
+#define MFD_CLOEXEC       0x0001
+#define MFD_ALLOW_SEALING 0x0002
+/** @brief Longest name Linux takes: "memfd:" and it fit in 255 bytes. */
+#define MFD_NAME_MAX      249
+
+/**
+ * @brief Create an anonymous file (see ::ramfs_memfd).
+ *
+ * The name is kept as a label only. Huge-page, exec and noexec flags are
+ * rejected.
+ */
+u64 sys_memfd_create(u64 name, u64 flags, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(flags & ~(u64)(MFD_CLOEXEC | MFD_ALLOW_SEALING))
+    return (u64)-EINVAL;
+  if(!name)
+    return (u64)-EFAULT;
+
+  char kname[MFD_NAME_MAX + 1];
+  i64  len = strncpy_from_user(kname, (const char *)name, sizeof(kname));
+  if(len < 0)
+    return len == -ENAMETOOLONG ? (u64)-EINVAL : (u64)len;
+
+  return (u64)ramfs_memfd(
+      kname, (flags & MFD_ALLOW_SEALING) != 0,
+      (flags & MFD_CLOEXEC) ? O_CLOEXEC : 0
+  );
+}
+
 /** @brief Fill @p dirp with @c dirent64 entries from the open directory @p fd.
  */
 u64 sys_getdents(u64 fd, u64 dirp, u64 count, u64 a4, u64 a5, u64 a6)
@@ -416,7 +515,8 @@ u64 sys_getcwd(u64 buf, u64 size, u64 a3, u64 a4, u64 a5, u64 a6)
   u64         len = kstrlen(cwd);
   if(len + 1 > size)
     return (u64)-ERANGE;
-  kstrncpy((char *)buf, cwd, size);
+  if(copy_to_user((void *)buf, cwd, len + 1) < 0)
+    return (u64)-EFAULT;
   return len + 1;
 }
 
@@ -429,9 +529,11 @@ u64 sys_chdir(u64 path, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
-  if(!user_cstr_ok(path))
-    return (u64)-EFAULT;
-  i64 result = vfs_chdir((const char *)path);
+  char kpath[VFS_PATH_MAX];
+  i64  rc = user_path(path, kpath);
+  if(rc < 0)
+    return (u64)rc;
+  i64 result = vfs_chdir(kpath);
   return (result < 0) ? (u64)-ENOENT : 0;
 }
 
@@ -444,9 +546,11 @@ u64 sys_mkdir(u64 pathname, u64 mode, u64 a3, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
-  if(!user_cstr_ok(pathname))
-    return (u64)-EFAULT;
-  i64 result = vfs_mkdir((const char *)pathname);
+  char kpath[VFS_PATH_MAX];
+  i64  rc = user_path(pathname, kpath);
+  if(rc < 0)
+    return (u64)rc;
+  i64 result = vfs_mkdir(kpath);
   return (result < 0) ? (u64)-ENOENT : 0;
 }
 
@@ -459,9 +563,11 @@ u64 sys_rmdir(u64 pathname, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
-  if(!user_cstr_ok(pathname))
-    return (u64)-EFAULT;
-  i64 result = vfs_rmdir((const char *)pathname);
+  char kpath[VFS_PATH_MAX];
+  i64  rc = user_path(pathname, kpath);
+  if(rc < 0)
+    return (u64)rc;
+  i64 result = vfs_rmdir(kpath);
   return (result < 0) ? (u64)result : 0;
 }
 
@@ -485,9 +591,11 @@ u64 sys_unlink(u64 pathname, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
-  if(!user_cstr_ok(pathname))
-    return (u64)-EFAULT;
-  i64 result = vfs_unlink((const char *)pathname);
+  char kpath[VFS_PATH_MAX];
+  i64  rc = user_path(pathname, kpath);
+  if(rc < 0)
+    return (u64)rc;
+  i64 result = vfs_unlink(kpath);
   return (result < 0) ? (u64)-ENOENT : 0;
 }
 
@@ -500,10 +608,15 @@ u64 sys_rename(u64 oldpath, u64 newpath, u64 a3, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
-  if(!user_cstr_ok(oldpath) || !user_cstr_ok(newpath))
-    return (u64)-EFAULT;
+  char kold[VFS_PATH_MAX];
+  char knew[VFS_PATH_MAX];
+  i64  rc = user_path(oldpath, kold);
+  if(rc == 0)
+    rc = user_path(newpath, knew);
+  if(rc < 0)
+    return (u64)rc;
 
-  i64 result = vfs_rename((const char *)oldpath, (const char *)newpath);
+  i64 result = vfs_rename(kold, knew);
   return (result < 0) ? (u64)result : 0;
 }
 
@@ -522,6 +635,41 @@ u64 sys_ftruncate(u64 fd, u64 length, u64 a3, u64 a4, u64 a5, u64 a6)
   return (result < 0) ? (u64)result : 0;
 }
 
+/**
+ * @brief Commit the file open as @p fd to disk.
+ *
+ * Also serves @c fdatasync: the block cache does not tell data from metadata,
+ * so both write everything the file's volume has pending.
+ */
+u64 sys_fsync(u64 fd, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(fd <= 2)
+    return (u64)-EINVAL; /* console: nothing to commit */
+
+  i64 result = vfs_fsync((i64)fd);
+  return (result < 0) ? (u64)result : 0;
+}
+
+/** @brief Commit every pending write on every mounted volume to disk. */
+u64 sys_sync(u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a1;
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  vfs_sync(); /* sync(2) cannot fail */
+  return 0;
+}
+
 /**
  * @brief Read @p count bytes from @p fd at absolute @p offset without moving
  * the seek position.
@@ -583,14 +731,19 @@ u64 sys_symlink(u64 target, u64 linkpath, u64 a3, u64 a4, u64 a5, u64 a6)
   return (u64)-ENOSYS;
 }
 
-/** @brief @c openat — only @c AT_FDCWD is supported; delegates to ::sys_open.
- */
+/** @brief @c openat — opens @p path relative to directory fd @p dirfd. */
 u64 sys_openat(u64 dirfd, u64 path, u64 flags, u64 mode, u64 a5, u64 a6)
 {
-  const i64 AT_FDCWD = -100;
-  if((i64)dirfd != AT_FDCWD)
-    return (u64)-ENOSYS;
-  return sys_open(path, flags, mode, 0, a5, a6);
+  (void)mode;
+  (void)a5;
+  (void)a6;
+
+  char kpath[VFS_PATH_MAX];
+  i64  rc = user_path(path, kpath);
+  if(rc < 0)
+    return (u64)rc;
+
+  return (u64)vfs_openat((i64)dirfd, kpath, (u32)flags);
 }
 
 /**
@@ -605,13 +758,15 @@ u64 sys_readlink(u64 path, u64 buf, u64 bufsiz, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
-  if(!user_cstr_ok(path) || !user_buf_ok(buf, bufsiz))
+  char pstr[VFS_PATH_MAX];
+  i64  rc = user_path(path, pstr);
+  if(rc < 0)
+    return (u64)rc;
+  if(!user_buf_ok(buf, bufsiz))
     return (u64)-EFAULT;
   if(bufsiz == 0)
     return (u64)-EINVAL;
 
-  const char *pstr = (const char *)path;
-
   if(path_is_proc_self_exe(pstr)) {
     const proc_t *p = proc_current();
     if(!p || !p->exe_path[0])
@@ -619,7 +774,8 @@ u64 sys_readlink(u64 path, u64 buf, u64 bufsiz, u64 a4, u64 a5, u64 a6)
     u64 len = kstrlen(p->exe_path);
     if(len >= bufsiz)
       return (u64)-ERANGE;
-    kmemcpy((void *)buf, p->exe_path, len);
+    if(copy_to_user((void *)buf, p->exe_path, len) < 0)
+      return (u64)-EFAULT;
     return (u64)len;
   }
 
@@ -629,6 +785,7 @@ u64 sys_readlink(u64 path, u64 buf, u64 bufsiz, u64 a4, u64 a5, u64 a6)
     return (u64)tlen;
   if((u64)tlen >= bufsiz)
     return (u64)-ERANGE;
-  kmemcpy((void *)buf, ktarget, (u64)tlen);
+  if(copy_to_user((void *)buf, ktarget, (u64)tlen) < 0)
+    return (u64)-EFAULT;
   return (u64)tlen;
 }
@@ -1,11 +1,15 @@
 /**
  * @file src/kernel/sys/sys_io.c
- * @brief I/O syscalls: read, readv, write, writev, lseek, ioctl, nanosleep,
+ * @brief I/O syscalls: read, readv, preadv, write, writev, pwritev, sendfile,
+ *        copy_file_range, splice, tee, vmsplice, lseek, ioctl, nanosleep,
  *        select, poll.
  *
  * fd 0 (stdin) reads from the keyboard IRQ path when no OFT entry is mapped.
  * fd 1/2 (stdout/stderr) fall back to the framebuffer console under the same
  * condition.  All other fds are dispatched through the VFS layer.
+ *
+ * Arguments passed by reference (iovecs, offsets, fd sets, pollfds, ioctl
+ * structs) go through the uaccess routines, so a bad pointer is -EFAULT.
  */
 
 #include <alcor2/arch/cpu.h>
@@ -17,9 +21,13 @@
 #include <alcor2/kbd.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/ktermios.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/uaccess.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
 #include <alcor2/sys/internal.h>
+#include <alcor2/time.h>
 
 /** @brief Return @c true if @p ptr..@p ptr+size is a valid user read/write
  * range. */
@@ -100,6 +108,35 @@ u64 sys_write(u64 fd, u64 buf, u64 count, u64 a4, u64 a5, u64 a6)
   return (u64)vfs_write((i64)fd, (void *)buf, count);
 }
 
+/**
+ * @brief Pipe object behind @p fd if it is the @p kind end of a pipe.
+ * @return Pipe, or NULL if @p fd is not open or is something else.
+ */
+static void *fd_pipe(u64 fd, i32 kind)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(vfs_fd_to_oft((i64)fd));
+  return e && e->kind == kind ? e->obj : NULL;
+}
+
+/** @brief Pipe object behind either end at @p fd, or NULL. */
+static void *fd_any_pipe(u64 fd)
+{
+  void *p = fd_pipe(fd, VFS_KIND_PIPE_RD);
+  return p ? p : fd_pipe(fd, VFS_KIND_PIPE_WR);
+}
+
+/**
+ * @brief Whether @p fd is a terminal: the console behind a stdio fd with
+ *        no OFT entry, or a pipe marked with ::ALCOR2_IOC_PIPE_SET_TTY.
+ */
+static bool fd_is_tty(u64 fd)
+{
+  if(fd <= 2 && !fd_has_oft(fd))
+    return true;
+  void *p = fd_any_pipe(fd);
+  return p && pipe_is_tty(p);
+}
+
 /** @brief Reposition the file offset of @p fd (@c lseek). */
 u64 sys_lseek(u64 fd, u64 offset, u64 whence, u64 a4, u64 a5, u64 a6)
 {
@@ -142,7 +179,7 @@ static void winsize_from_console(k_winsize_t *w)
 }
 
 /**
- * @brief Emulated TTY ioctls for stdio fds and pipe ends.
+ * @brief Emulated TTY ioctls for the console and terminal-relay pipes.
  *
  * Handles @c TIOCGWINSZ / @c TIOCSWINSZ against the shared ::g_winsize and
  * @c TCGETS / @c TCSETS variants against the per-process @c k_termios_t.
@@ -159,8 +196,7 @@ static u64 ioctl_tty_emulated(proc_t *p, u64 request, u64 arg)
       return (u64)-EFAULT;
     k_winsize_t w;
     winsize_from_console(&w);
-    kmemcpy((void *)arg, &w, sizeof(w));
-    return 0;
+    return copy_to_user((void *)arg, &w, sizeof(w)) < 0 ? (u64)-EFAULT : 0;
   }
   case TIOCSWINSZ:
     /* The grid is owned by fb_console, not userspace. Accept the call so
@@ -171,15 +207,19 @@ static u64 ioctl_tty_emulated(proc_t *p, u64 request, u64 arg)
   case TCGETS:
     if(!user_rw_ok(arg, sizeof(k_termios_t)))
       return (u64)-EFAULT;
-    kmemcpy((void *)arg, &p->termios, sizeof(p->termios));
-    return 0;
+    return copy_to_user((void *)arg, &p->termios, sizeof(p->termios)) < 0
+               ? (u64)-EFAULT
+               : 0;
   case TCSETS:
   case TCSETSW:
-  case TCSETSF:
-    if(!user_rw_ok(arg, sizeof(k_termios_t)))
+  case TCSETSF: {
+    k_termios_t t;
+    if(!user_rw_ok(arg, sizeof(t)) ||
+       copy_from_user(&t, (const void *)arg, sizeof(t)) < 0)
       return (u64)-EFAULT;
-    kmemcpy(&p->termios, (void *)arg, sizeof(p->termios));
+    p->termios = t;
     return 0;
+  }
   default:
     return (u64)-ENOTTY;
   }
@@ -189,8 +229,10 @@ static u64 ioctl_tty_emulated(proc_t *p, u64 request, u64 arg)
  * @brief Perform a device control operation on @p fd.
  *
  * fd 0 handles the Alcor2-specific keyboard layout request
- * (@c ALCOR2_IOC_KBD_SET_LAYOUT).  stdio fds and pipe ends use the emulated
- * TTY path.  All other fds return @c -ENOTTY.
+ * (@c ALCOR2_IOC_KBD_SET_LAYOUT).  Perf event fds take the perf ioctls.
+ * A pipe end takes ::ALCOR2_IOC_PIPE_SET_TTY.  Terminals (see ::fd_is_tty)
+ * use the emulated TTY path.  All other fds, including pipes and stdio
+ * redirected to files, return @c -ENOTTY, so stdio buffers them fully.
  */
 u64 sys_ioctl(u64 fd, u64 request, u64 arg, u64 a4, u64 a5, u64 a6)
 {
@@ -200,23 +242,24 @@ u64 sys_ioctl(u64 fd, u64 request, u64 arg, u64 a4, u64 a5, u64 a6)
 
   if(fd == 0 && request == ALCOR2_IOC_KBD_SET_LAYOUT) {
     u32 lid;
-    if(!user_rw_ok(arg, sizeof(lid)))
+    if(!user_rw_ok(arg, sizeof(lid)) ||
+       copy_from_user(&lid, (const void *)arg, sizeof(lid)) < 0)
       return (u64)-EFAULT;
-    kmemcpy(&lid, (void *)arg, sizeof(lid));
     if(lid >= KBD_LAYOUT_COUNT)
       return (u64)-EINVAL;
     kbd_set_layout((kbd_layout_t)lid);
     return 0;
   }
 
-  /* Framebuffer console controls: SET_ATLAS uses the encoded request, while
-   * YIELD / RECLAIM are bare ('F'<<8 | nr) ioctls with no data. Routing
-   * through fd 1/2 is consistent with the rest of the TTY ioctls. */
+  /* Framebuffer console controls: SET_ATLAS, MAP_GRID and PRESENT use the
+   * encoded request, while YIELD / RECLAIM are bare ('F'<<8 | nr) ioctls
+   * with no data. Routing through fd 1/2 is consistent with the rest of
+   * the TTY ioctls. */
   if((fd == 1 || fd == 2) && request == FB_CONSOLE_SET_ATLAS) {
-    if(!user_rw_ok(arg, sizeof(fb_console_atlas_t)))
-      return (u64)-EFAULT;
     fb_console_atlas_t meta;
-    kmemcpy(&meta, (void *)arg, sizeof(meta));
+    if(!user_rw_ok(arg, sizeof(meta)) ||
+       copy_from_user(&meta, (const void *)arg, sizeof(meta)) < 0)
+      return (u64)-EFAULT;
     return (u64)(fb_console_set_atlas(&meta) == 0 ? 0 : -EINVAL);
   }
   if((fd == 1 || fd == 2) && request == FB_CONSOLE_YIELD) {
@@ -227,18 +270,54 @@ u64 sys_ioctl(u64 fd, u64 request, u64 arg, u64 a4, u64 a5, u64 a6)
     fb_console_reclaim();
     return 0;
   }
+  if((fd == 1 || fd == 2) && request == FB_CONSOLE_MAP_GRID)
+    return fb_map_grid(arg);
+  if((fd == 1 || fd == 2) && request == FB_CONSOLE_PRESENT) {
+    fb_console_present_t pr;
+    if(!user_rw_ok(arg, sizeof(pr)) ||
+       copy_from_user(&pr, (const void *)arg, sizeof(pr)) < 0)
+      return (u64)-EFAULT;
+    fb_console_present(pr.first_row, pr.n_rows);
+    return 0;
+  }
 
-  if(fd <= 2 || vfs_fd_is_pipe(fd))
+  i64 r = perf_ioctl((i64)fd, request);
+  if(r != -ENOTTY)
+    return (u64)r;
+
+  if(request == ALCOR2_IOC_PIPE_SET_TTY) {
+    void *p = fd_any_pipe(fd);
+    if(!p)
+      return (u64)-ENOTTY;
+    pipe_set_tty(p);
+    return 0;
+  }
+
+  if(fd_is_tty(fd))
     return ioctl_tty_emulated(proc_current(), request, arg);
 
   return (u64)-ENOTTY;
 }
 
+/**
+ * @brief Sleep until monotonic time @p deadline without being scheduled.
+ *
+ * Nothing wakes the private queue, so only the timeout ends the sleep;
+ * a signal just starts the remainder over. @p deadline = 0 sleeps forever.
+ */
+static void io__sleep_until(u64 deadline)
+{
+  wait_queue_t never;
+  wait_queue_init(&never);
+  while(!deadline || time_monotonic_ns() < deadline)
+    wait_sleep_until(&never, 0, deadline);
+}
+
 /**
  * @brief Sleep for the duration described by @p req (@c struct @c timespec).
  *
- * Implemented as a sequence of STI/HLT pairs, each ~10 ms.  @p rem is not
- * filled because preemption is cooperative and we don't track elapsed time.
+ * The caller sleeps on a kernel timer and is not scheduled until it
+ * expires.  @p rem is not filled: signals do not cut the sleep short.
  */
 u64 sys_nanosleep(u64 req, u64 rem, u64 a3, u64 a4, u64 a5, u64 a6)
 {
@@ -258,82 +337,391 @@ u64 sys_nanosleep(u64 req, u64 rem, u64 a3, u64 a4, u64 a5, u64 a6)
     return (u64)-EFAULT;
 
   const struct timespec *ts = (const struct timespec *)req;
-  if(ts->sec < 0 || ts->nsec < 0 || ts->nsec >= 1000000000)
+  if(ts->sec < 0 || ts->nsec < 0 || ts->nsec >= (i64)NSEC_PER_SEC)
     return (u64)-EINVAL;
 
-  u64 ms    = (u64)ts->sec * 1000 + (u64)ts->nsec / 1000000;
-  u64 ticks = (ms + 9) / 10;
-  if(ticks == 0)
-    ticks = 1;
-
-  for(u64 i = 0; i < ticks; i++) {
-    cpu_enable_interrupts();
-    __asm__ volatile("hlt");
-    cpu_disable_interrupts();
-  }
+  u64 ns = (u64)ts->sec * NSEC_PER_SEC + (u64)ts->nsec;
+  io__sleep_until(time_monotonic_ns() + (ns ? ns : 1));
   return 0;
 }
 
-/** @brief Scatter-gather read: read from @p fd into @p iovcnt buffers. */
+/** @brief User @c struct @c iovec, as vmsplice() reads it. */
 struct iovec
 {
   void *iov_base;
   u64   iov_len;
 };
 
-#define SYS_READV_IOV_MAX 1024
+void iov_release(vfs_iovec_t *iov, const vfs_iovec_t *fast)
+{
+  if(iov != fast)
+    kfree(iov);
+}
+
+i64 iov_import(u64 uptr, u64 iovcnt, vfs_iovec_t *fast, vfs_iovec_t **out)
+{
+  *out = fast;
+  if(iovcnt > VFS_IOV_MAX)
+    return -EINVAL;
+  if(!iovcnt)
+    return 0;
+  if(!user_rw_ok(uptr, iovcnt * sizeof(vfs_iovec_t)))
+    return -EFAULT;
 
+  vfs_iovec_t *iov = fast;
+  if(iovcnt > SYS_IOV_FAST && !(iov = kmalloc(iovcnt * sizeof(*iov))))
+    return -ENOMEM;
+
+  i64 err = copy_from_user(iov, (const void *)uptr, iovcnt * sizeof(*iov));
+  u64 total = 0;
+  for(u64 i = 0; i < iovcnt && !err; i++) {
+    if(!iov[i].len)
+      continue;
+    /* The byte total must fit the i64 return value. */
+    total += iov[i].len;
+    if(total < iov[i].len || (i64)total < 0)
+      err = -EINVAL;
+    else if(!user_rw_ok((u64)iov[i].base, iov[i].len))
+      err = -EFAULT;
+  }
+  if(err) {
+    iov_release(iov, fast);
+    return err;
+  }
+  *out = iov;
+  return 0;
+}
+
+/**
+ * @brief Scatter read: fill @p iovcnt buffers from @p fd in order.
+ *
+ * The whole vector goes to ::vfs_readv. Only the keyboard behind a bare
+ * fd 0 is still read one buffer at a time.
+ */
 u64 sys_readv(u64 fd, u64 iov_ptr, u64 iovcnt, u64 a4, u64 a5, u64 a6)
 {
   (void)a4;
   (void)a5;
   (void)a6;
 
-  if(iovcnt == 0 || iovcnt > SYS_READV_IOV_MAX)
+  vfs_iovec_t  fast[SYS_IOV_FAST];
+  vfs_iovec_t *iov;
+  i64          r = iov_import(iov_ptr, iovcnt, fast, &iov);
+  if(r < 0)
+    return (u64)r;
+
+  if(fd == 0 && !fd_has_oft(fd)) {
+    r = 0;
+    for(u64 i = 0; i < iovcnt; i++) {
+      if(!iov[i].len)
+        continue;
+      i64 n = (i64)sys_read(fd, (u64)iov[i].base, iov[i].len, 0, 0, 0);
+      if(n < 0) {
+        r = r ? r : n;
+        break;
+      }
+      r += n;
+      if((u64)n < iov[i].len)
+        break;
+    }
+  } else {
+    r = vfs_readv((i64)fd, iov, (u32)iovcnt);
+  }
+  iov_release(iov, fast);
+  return (u64)r;
+}
+
+/**
+ * @brief Gather write: write @p iovcnt buffers to @p fd in order.
+ *
+ * The whole vector goes to ::vfs_writev, so a pipe takes it under one
+ * lock and ext2 assembles shared blocks once. A bare fd 1/2 goes to the
+ * console buffer by buffer.
+ */
+u64 sys_writev(u64 fd, u64 iov_ptr, u64 iovcnt, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  vfs_iovec_t  fast[SYS_IOV_FAST];
+  vfs_iovec_t *iov;
+  i64          r = iov_import(iov_ptr, iovcnt, fast, &iov);
+  if(r < 0)
+    return (u64)r;
+
+  if((fd == 1 || fd == 2) && !fd_has_oft(fd)) {
+    r = 0;
+    for(u64 i = 0; i < iovcnt; i++)
+      r += (i64)stdout_fallback((u64)iov[i].base, iov[i].len);
+  } else {
+    r = vfs_writev((i64)fd, iov, (u32)iovcnt);
+  }
+  iov_release(iov, fast);
+  return (u64)r;
+}
+
+/**
+ * @brief Scatter read at absolute @p offset without moving the seek
+ *        position.
+ *
+ * Saves and restores the OFT offset around ::vfs_readv, as pread64 does;
+ * a pipe has none to save and gets @c -ESPIPE.
+ */
+u64 sys_preadv(u64 fd, u64 iov_ptr, u64 iovcnt, u64 offset, u64 a5, u64 a6)
+{
+  (void)a5;
+  (void)a6;
+
+  vfs_iovec_t  fast[SYS_IOV_FAST];
+  vfs_iovec_t *iov;
+  i64          r = iov_import(iov_ptr, iovcnt, fast, &iov);
+  if(r < 0)
+    return (u64)r;
+
+  i64 saved = vfs_seek((i64)fd, 0, SEEK_CUR);
+  if(saved < 0) {
+    iov_release(iov, fast);
+    return (u64)saved;
+  }
+  vfs_seek((i64)fd, (i64)offset, SEEK_SET);
+  r = vfs_readv((i64)fd, iov, (u32)iovcnt);
+  vfs_seek((i64)fd, saved, SEEK_SET);
+  iov_release(iov, fast);
+  return (u64)r;
+}
+
+/**
+ * @brief Gather write at absolute @p offset without moving the seek
+ *        position.
+ *
+ * As pwrite64: the OFT offset is saved and restored around ::vfs_writev,
+ * and stdio fds, which have no offset, write as ::sys_writev does.
+ */
+u64 sys_pwritev(u64 fd, u64 iov_ptr, u64 iovcnt, u64 offset, u64 a5, u64 a6)
+{
+  (void)a5;
+  (void)a6;
+
+  if(fd <= 2)
+    return sys_writev(fd, iov_ptr, iovcnt, 0, 0, 0);
+
+  vfs_iovec_t  fast[SYS_IOV_FAST];
+  vfs_iovec_t *iov;
+  i64          r = iov_import(iov_ptr, iovcnt, fast, &iov);
+  if(r < 0)
+    return (u64)r;
+
+  i64 saved = vfs_seek((i64)fd, 0, SEEK_CUR);
+  if(saved < 0) {
+    iov_release(iov, fast);
+    return (u64)saved;
+  }
+  vfs_seek((i64)fd, (i64)offset, SEEK_SET);
+  r = vfs_writev((i64)fd, iov, (u32)iovcnt);
+  vfs_seek((i64)fd, saved, SEEK_SET);
+  iov_release(iov, fast);
+  return (u64)r;
+}
+
+/** @brief ::vfs_sendfile sink writing to an fd (console for bare stdout). */
+static i64 fd_sink(void *ctx, const void *buf, u64 count)
+{
+  u64 fd = *(const u64 *)ctx;
+  if((fd == 1 || fd == 2) && !fd_has_oft(fd)) {
+    fb_console_write(buf, (size_t)count);
+    return (i64)count;
+  }
+  return vfs_write((i64)fd, buf, count);
+}
+
+/** @brief Destination of a ::pos_sink: an fd and an explicit offset. */
+typedef struct
+{
+  i64 fd;
+  u64 offset;
+} pos_sink_t;
+
+/** @brief ::vfs_sendfile sink writing at an offset without moving the fd. */
+static i64 pos_sink(void *ctx, const void *buf, u64 count)
+{
+  pos_sink_t *ps = ctx;
+  i64         n  = vfs_pwrite(ps->fd, buf, count, ps->offset);
+  if(n > 0)
+    ps->offset += (u64)n;
+  return n;
+}
+
+/** @brief Read the optional user offset at @p ptr. @return 0 or -EFAULT. */
+static int user_off_get(u64 ptr, u64 *off)
+{
+  return ptr ? copy_from_user(off, (const void *)ptr, sizeof(*off)) : 0;
+}
+
+/** @brief Store @p off back to the optional user offset at @p ptr. */
+static int user_off_put(u64 ptr, u64 off)
+{
+  return ptr ? copy_to_user((void *)ptr, &off, sizeof(off)) : 0;
+}
+
+/**
+ * @brief Copy from a regular file to @p out_fd inside the kernel.
+ *
+ * @p out_fd may be a file, a pipe or the console.  With a non-NULL
+ * @p offset_ptr the read starts there and the pointed-to value is advanced;
+ * the file offset of @p in_fd is left alone.
+ */
+u64 sys_sendfile(
+    u64 out_fd, u64 in_fd, u64 offset_ptr, u64 count, u64 a5, u64 a6
+)
+{
+  (void)a5;
+  (void)a6;
+
+  u64 off = 0;
+  if(user_off_get(offset_ptr, &off) < 0)
+    return (u64)-EFAULT;
+  if(count == 0)
+    return 0;
+
+  /* A stream socket takes the page-cache pages themselves. */
+  u64 *offp = offset_ptr ? &off : NULL;
+  i64  n    = sock_sendfile((i64)out_fd, (i64)in_fd, offp, count);
+  if(n == -ENOTSOCK)
+    n = vfs_sendfile((i64)in_fd, offp, count, fd_sink, &out_fd);
+  if(user_off_put(offset_ptr, off) < 0)
+    return (u64)-EFAULT;
+  return (u64)n;
+}
+
+/**
+ * @brief Copy a range between two regular files inside the kernel.
+ *
+ * Each side uses and advances its file offset when its offset pointer is
+ * NULL, or reads and advances the pointed-to value otherwise.  @p flags
+ * must be zero.
+ */
+u64 sys_copy_file_range(
+    u64 fd_in, u64 off_in, u64 fd_out, u64 off_out, u64 len, u64 flags
+)
+{
+  if(flags)
     return (u64)-EINVAL;
-  if(!iov_ptr || !user_rw_ok(iov_ptr, iovcnt * sizeof(struct iovec)))
+  u64 in_off = 0, out_off = 0;
+  if(user_off_get(off_in, &in_off) < 0 || user_off_get(off_out, &out_off) < 0)
     return (u64)-EFAULT;
 
-  const struct iovec *vec   = (const struct iovec *)iov_ptr;
-  u64                 total = 0;
+  vfs_stat_t st;
+  if(vfs_fstat((i64)fd_out, &st) < 0)
+    return (u64)-EBADF;
+  if(st.type != VFS_FILE)
+    return (u64)-EINVAL;
+  if(len == 0)
+    return 0;
 
-  for(u64 i = 0; i < iovcnt; i++) {
-    if(!vec[i].iov_base || vec[i].iov_len == 0)
-      continue;
-    if(!user_rw_ok((u64)vec[i].iov_base, vec[i].iov_len))
-      return (u64)-EFAULT;
+  u64       *in_pos = off_in ? &in_off : NULL;
+  pos_sink_t ps     = {.fd = (i64)fd_out, .offset = out_off};
+  i64        n;
+  if(off_out)
+    n = vfs_sendfile((i64)fd_in, in_pos, len, pos_sink, &ps);
+  else
+    n = vfs_sendfile((i64)fd_in, in_pos, len, fd_sink, &fd_out);
+  if(user_off_put(off_in, in_off) < 0 || user_off_put(off_out, ps.offset) < 0)
+    return (u64)-EFAULT;
+  return (u64)n;
+}
 
-    u64 chunk = sys_read(fd, (u64)vec[i].iov_base, vec[i].iov_len, 0, 0, 0);
-    if((i64)chunk < 0)
-      return chunk;
-    total += chunk;
-    if(chunk < vec[i].iov_len)
-      break;
+/**
+ * @brief Move data between a pipe and another fd without a user copy.
+ *
+ * At least one side must be a pipe, and a pipe side takes no offset.
+ * File pages are queued on the pipe by reference; pipe-to-pipe moves the
+ * queued pages themselves.  Flags are accepted and ignored.
+ */
+u64 sys_splice(
+    u64 fd_in, u64 off_in, u64 fd_out, u64 off_out, u64 len, u64 flags
+)
+{
+  (void)flags;
+
+  void *in  = fd_pipe(fd_in, VFS_KIND_PIPE_RD);
+  void *out = fd_pipe(fd_out, VFS_KIND_PIPE_WR);
+  if((in && off_in) || (out && off_out))
+    return (u64)-ESPIPE;
+  u64 in_off = 0, out_off = 0;
+  if(user_off_get(off_in, &in_off) < 0 || user_off_get(off_out, &out_off) < 0)
+    return (u64)-EFAULT;
+  if(len == 0)
+    return 0;
+
+  if(in && out)
+    return (u64)pipe_transfer(in, out, len, false);
+  if(out) {
+    i64 n = pipe_splice_in(out, (i64)fd_in, off_in ? &in_off : NULL, len);
+    if(user_off_put(off_in, in_off) < 0)
+      return (u64)-EFAULT;
+    return (u64)n;
   }
+  if(!in)
+    return (u64)-EINVAL;
+  if(!off_out)
+    return (u64)pipe_splice_out(in, len, fd_sink, &fd_out);
 
-  return total;
+  pos_sink_t ps = {.fd = (i64)fd_out, .offset = out_off};
+  i64        n  = pipe_splice_out(in, len, pos_sink, &ps);
+  if(user_off_put(off_out, ps.offset) < 0)
+    return (u64)-EFAULT;
+  return (u64)n;
 }
 
-/** @brief Gather-write: write @p iovcnt buffers to @p fd in order. */
-u64 sys_writev(u64 fd, u64 iov, u64 iovcnt, u64 a4, u64 a5, u64 a6)
+/** @brief Duplicate up to @p len queued bytes of one pipe onto another. */
+u64 sys_tee(u64 fd_in, u64 fd_out, u64 len, u64 flags, u64 a5, u64 a6)
 {
-  (void)a4;
+  (void)flags;
   (void)a5;
   (void)a6;
 
-  if(!iov)
+  void *in  = fd_pipe(fd_in, VFS_KIND_PIPE_RD);
+  void *out = fd_pipe(fd_out, VFS_KIND_PIPE_WR);
+  if(!in || !out)
+    return (u64)-EINVAL;
+  if(len == 0)
+    return 0;
+  return (u64)pipe_transfer(in, out, len, true);
+}
+
+/**
+ * @brief Write user iovecs into a pipe.
+ *
+ * The data is copied into pipe pages as by writev(); user pages are not
+ * mapped into the pipe.
+ */
+u64 sys_vmsplice(u64 fd, u64 iov, u64 nr_segs, u64 flags, u64 a5, u64 a6)
+{
+  (void)flags;
+  (void)a5;
+  (void)a6;
+
+  void *p = fd_pipe(fd, VFS_KIND_PIPE_WR);
+  if(!p)
+    return (u64)-EBADF;
+  if(!user_rw_ok(iov, nr_segs * sizeof(struct iovec)))
     return (u64)-EFAULT;
 
-  const struct iovec *vec   = (const struct iovec *)iov;
+  const struct iovec *uvec  = (const struct iovec *)iov;
   u64                 total = 0;
-  for(u64 i = 0; i < iovcnt; i++) {
-    if(vec[i].iov_base && vec[i].iov_len > 0) {
-      u64 written =
-          sys_write(fd, (u64)vec[i].iov_base, vec[i].iov_len, 0, 0, 0);
-      if((i64)written < 0)
-        return written;
-      total += written;
-    }
+  for(u64 i = 0; i < nr_segs; i++) {
+    struct iovec v;
+    if(copy_from_user(&v, &uvec[i], sizeof(v)) < 0)
+      return total ? total : (u64)-EFAULT;
+    if(!v.iov_len)
+      continue;
+    if(!user_rw_ok((u64)v.iov_base, v.iov_len))
+      return total ? total : (u64)-EFAULT;
+    i64 n = pipe_write_obj(p, v.iov_base, v.iov_len);
+    if(n < 0)
+      return total ? total : (u64)n;
+    total += (u64)n;
   }
   return total;
 }
@@ -372,50 +760,30 @@ static inline void sel_mask_high_bits(
   }
 }
 
-/** @brief Return positive if @p fd has data available, 0 if not, negative on
- * error. */
-static i32 sel_read_ready(u64 fd)
+i32 io_poll_fd(u64 fd, poll_table_t *pt)
 {
   if(fd >= VFS_MAX_FD)
     return -EBADF;
   if(fd == 0 && !fd_has_oft(fd)) {
-    proc_t *p = proc_current();
-    if(!p)
-      return kbd_raw_pending() ? 1 : 0;
-    return kbd_select_read_ready(p) ? 1 : 0;
+    keyboard_poll_wait(pt);
+    proc_t *p     = proc_current();
+    bool    ready = p ? kbd_select_read_ready(p) : kbd_raw_pending();
+    return ready ? VFS_POLL_IN : 0;
   }
   if((fd == 1 || fd == 2) && !fd_has_oft(fd))
-    return -EBADF;
-  return vfs_select_read_ready((i64)fd);
+    return VFS_POLL_OUT;
+  return vfs_poll((i64)fd, pt);
 }
 
-/** @brief Return positive if @p fd can accept a write, 0 if not, negative on
- * error. */
-static i32 sel_write_ready(u64 fd)
-{
-  if(fd >= VFS_MAX_FD)
-    return -EBADF;
-  if((fd == 1 || fd == 2) && !fd_has_oft(fd))
-    return 1;
-  if(fd == 0 && !fd_has_oft(fd))
-    return -EBADF;
-  return vfs_select_write_ready((i64)fd);
-}
-
-/** @brief ~10 ms of wall time per tick (matches ::sys_nanosleep heuristics). */
-static u64 io__ms_to_hlt_ticks(u64 ms)
-{
-  u64 t = (ms + 9) / 10;
-  return t ? t : 1;
-}
+/** @brief select() counts hang-ups and errors as readable / writable. */
+#define SEL_READ_BITS  (VFS_POLL_IN | VFS_POLL_HUP | VFS_POLL_ERR)
+#define SEL_WRITE_BITS (VFS_POLL_OUT | VFS_POLL_ERR)
 
-/** POSIX @c poll(2) event bits (subset). */
-#define POLL__IN       0x001
-#define POLL__PRI      0x002
-#define POLL__OUT      0x004
-#define POLL__NVAL     0x020
 #define POLL__MAX_NFDS VFS_MAX_FD
 
+/** @brief Registrations that fit on the stack; larger sets use the heap. */
+#define POLL__STACK_WAITS 16
+
 typedef struct
 {
   i32 fd;
@@ -424,70 +792,36 @@ typedef struct
 } poll__fd_abi_t;
 
 /**
- * @brief Compute select/poll timeout parameters from a millisecond value.
+ * @brief Compute poll timeout parameters from a millisecond value.
  *
  * Negative @p ms_signed means infinite wait.  Zero means poll-and-return.
- * Positive values are converted to HLT ticks via ::io__ms_to_hlt_ticks.
+ * Positive values are converted to nanoseconds.
  */
 static void io__timeout_calc(
-    i32 ms_signed, bool *immediate, bool *infinite, u64 *wait_ticks
+    i32 ms_signed, bool *immediate, bool *infinite, u64 *wait_ns
 )
 {
-  if(ms_signed < 0) {
-    *immediate  = false;
-    *infinite   = true;
-    *wait_ticks = 0;
-    return;
-  }
-  *infinite = false;
-  if(ms_signed == 0) {
-    *immediate  = true;
-    *wait_ticks = 0;
-    return;
-  }
-  *immediate  = false;
-  u64 ms      = (u64)ms_signed;
-  *wait_ticks = io__ms_to_hlt_ticks(ms);
+  *immediate = ms_signed == 0;
+  *infinite  = ms_signed < 0;
+  *wait_ns   = ms_signed > 0 ? (u64)ms_signed * (NSEC_PER_SEC / 1000) : 0;
 }
 
-/** @brief Return @c true if @p fd is open (including unmapped stdio fds). */
-static bool poll__fd_is_open(i32 fd)
-{
-  if(fd < 0)
-    return false;
-  if(fd == 0 && !fd_has_oft(0))
-    return true;
-  if((fd == 1 || fd == 2) && !fd_has_oft((u64)fd))
-    return true;
-  return vfs_fd_is_valid(fd);
-}
-
-/** @brief Fill @p e->revents for one poll entry; return non-zero if ready. */
-static int poll__fill_one(poll__fd_abi_t *e)
+/**
+ * @brief Fill @p e->revents for one poll entry; return non-zero if ready.
+ *
+ * Hang-ups and errors are reported whether or not they were asked for.
+ */
+static int poll__fill_one(poll__fd_abi_t *e, poll_table_t *pt)
 {
   e->revents = 0;
   if(e->fd < 0)
     return 0;
-  if(!poll__fd_is_open(e->fd)) {
-    e->revents = POLL__NVAL;
-    return 1;
-  }
 
-  i16 want = e->events;
-  if(want & (POLL__IN | POLL__PRI)) {
-    i32 st = sel_read_ready((u64)e->fd);
-    if(st > 0) {
-      if(want & POLL__IN)
-        e->revents |= POLL__IN;
-      if(want & POLL__PRI)
-        e->revents |= POLL__PRI;
-    }
-  }
-  if(want & POLL__OUT) {
-    i32 st = sel_write_ready((u64)e->fd);
-    if(st > 0)
-      e->revents |= POLL__OUT;
-  }
+  i32 mask = io_poll_fd((u64)e->fd, pt);
+  if(mask < 0)
+    e->revents = VFS_POLL_NVAL;
+  else
+    e->revents = (i16)(mask & (e->events | VFS_POLL_ERR | VFS_POLL_HUP));
   return e->revents != 0;
 }
 
@@ -500,7 +834,8 @@ static int poll__fill_one(poll__fd_abi_t *e)
  */
 static i32 select_scan(
     u32 nfds, const unsigned long *rin, const unsigned long *win,
-    unsigned long *rout, unsigned long *wout, unsigned long *eout, int *total
+    unsigned long *rout, unsigned long *wout, unsigned long *eout, int *total,
+    poll_table_t *pt
 )
 {
   int n = 0;
@@ -509,23 +844,25 @@ static i32 select_scan(
   kzero(eout, SEL_FDSET_SZ);
 
   for(u32 fd = 0; fd < nfds; fd++) {
-    if(sel_fdisset(rin, fd)) {
-      i32 st = sel_read_ready(fd);
-      if(st < 0)
-        return st;
-      if(!st)
-        sel_fdclr(rout, fd);
-      else
+    bool rd = sel_fdisset(rin, fd);
+    bool wr = sel_fdisset(win, fd);
+    if(!rd && !wr)
+      continue;
+
+    i32 mask = io_poll_fd(fd, pt);
+    if(mask < 0)
+      return mask;
+    if(rd) {
+      if(mask & SEL_READ_BITS)
         n++;
-    }
-    if(sel_fdisset(win, fd)) {
-      i32 st = sel_write_ready(fd);
-      if(st < 0)
-        return st;
-      if(!st)
-        sel_fdclr(wout, fd);
       else
+        sel_fdclr(rout, fd);
+    }
+    if(wr) {
+      if(mask & SEL_WRITE_BITS)
         n++;
+      else
+        sel_fdclr(wout, fd);
     }
   }
 
@@ -539,7 +876,7 @@ static i32 select_scan(
  * @return 0 on success, negative errno if the pointer is bad or values out of
  * range.
  */
-static i32 parse_timeval(u64 timeout_ptr, bool *poll_immediate, u64 *wait_ticks)
+static i32 parse_timeval(u64 timeout_ptr, bool *poll_immediate, u64 *wait_ns)
 {
   struct
   {
@@ -547,43 +884,74 @@ static i32 parse_timeval(u64 timeout_ptr, bool *poll_immediate, u64 *wait_ticks)
     i64 nsec_usec;
   } tv;
 
-  if(!user_rw_ok(timeout_ptr, sizeof(tv)))
+  if(!user_rw_ok(timeout_ptr, sizeof(tv)) ||
+     copy_from_user(&tv, (const void *)timeout_ptr, sizeof(tv)) < 0)
     return -EFAULT;
-  kmemcpy(&tv, (void *)timeout_ptr, sizeof(tv));
   if(tv.sec < 0 || tv.nsec_usec < 0 || tv.nsec_usec >= 1000000)
     return -EINVAL;
 
-  u64  ms = (u64)tv.sec * 1000 + (u64)tv.nsec_usec / 1000;
-  bool infinite;
-  io__timeout_calc((i32)ms, poll_immediate, &infinite, wait_ticks);
+  *wait_ns = (u64)tv.sec * NSEC_PER_SEC + (u64)tv.nsec_usec * NSEC_PER_USEC;
+  *poll_immediate = *wait_ns == 0;
   return 0;
 }
 
-/** @brief Yield the CPU for one ~10 ms timer tick, then yield to any other
- *         READY user proc.
+/**
+ * @brief Set up the poll table of a select()/poll() call on @p nfds fds.
  *
- * Syscall context runs with interrupts masked, so the timer alone doesn't
- * preempt this proc into another one (see "Pipe busy-wait must yield" in
- * user/shell/README.md). Without the explicit @c proc_schedule() call, a
- * select/poll loop here would hog the CPU for the full timeout, and any
- * child it's polling on (e.g. an ncurses app writing into the shell's
- * relay pipe) would never run.
+ * Every fd registers on at most one wait queue.  Small sets use @p stack;
+ * if the heap cannot supply a larger array the table overflows and each
+ * sleep becomes a one-tick rescan instead.
+ */
+static void sel_table_init(poll_table_t *pt, wait_entry_t *stack, u32 nfds)
+{
+  wait_entry_t *ents = stack;
+  u32           cap  = POLL__STACK_WAITS;
+  if(nfds > cap) {
+    wait_entry_t *heap = kmalloc((u64)nfds * sizeof(wait_entry_t));
+    if(heap) {
+      ents = heap;
+      cap  = nfds;
+    }
+  }
+  poll_table_init(pt, ents, cap);
+}
+
+static void sel_table_free(poll_table_t *pt, const wait_entry_t *stack)
+{
+  poll_table_release(pt);
+  if(pt->entries != stack)
+    kfree(pt->entries);
+}
+
+/**
+ * @brief Sleep until a queue registered by the last scan is woken, or a
+ *        deadline passes.
+ *
+ * The caller is not scheduled at all meanwhile; it rescans its fds once
+ * this returns.
  *
- * Matches the pattern used by the keyboard wait loop in @c kbd_layout.c. */
-static void sel_hlt_slice(void)
+ * @param infinite  No deadline.
+ * @param deadline  Monotonic time at which to give up.
+ * @return false once the deadline has passed.
+ */
+static bool sel_sleep(poll_table_t *pt, bool infinite, u64 deadline)
 {
-  cpu_enable_interrupts();
-  __asm__ volatile("hlt");
-  cpu_disable_interrupts();
-  proc_schedule();
+  if(!infinite && time_monotonic_ns() >= deadline) {
+    poll_table_release(pt);
+    return false;
+  }
+  poll_table_sleep(pt, infinite ? 0 : deadline);
+  return true;
 }
 
 /**
  * @brief Monitor up to @p nfds_u descriptors for I/O readiness (@c select).
  *
  * Copies the caller's @c fd_set bitmaps into kernel buffers, scans them in a
- * loop sleeping one HLT tick per iteration until at least one fd is ready or
- * the timeout expires.  The output sets are zeroed on timeout.
+ * loop until at least one fd is ready or the timeout expires.  Each scan
+ * registers on the wait queues of the fds it watches, so between scans the
+ * caller sleeps until one of them changes.  The output sets are zeroed on
+ * timeout.
  */
 u64 sys_select(
     u64 nfds_u, u64 readfds, u64 writefds, u64 exceptfds, u64 timeout, u64 a6
@@ -597,7 +965,7 @@ u64 sys_select(
   u32  nfds      = (u32)nfds_u;
   u32  nlongs    = nfds ? (nfds + (SEL_NFDBITS - 1)) / SEL_NFDBITS : 0;
   bool poll_mode = false;
-  u64  ticks_rem = 0;
+  u64  wait_ns = 0;
   bool infinite  = false;
 
   if(nfds && !readfds && !writefds && !exceptfds)
@@ -606,17 +974,15 @@ u64 sys_select(
   if(nfds == 0) {
     if(timeout) {
       bool immediate = false;
-      i32  prc       = parse_timeval(timeout, &immediate, &ticks_rem);
+      i32  prc       = parse_timeval(timeout, &immediate, &wait_ns);
       if(prc)
         return (u64)prc;
       if(immediate)
         return 0;
-      for(u64 t = 0; t < ticks_rem; t++)
-        sel_hlt_slice();
+      io__sleep_until(time_monotonic_ns() + wait_ns);
       return 0;
     }
-    for(;;)
-      sel_hlt_slice();
+    io__sleep_until(0);
   }
 
   if(nlongs > SEL_FDSET_LONG)
@@ -630,75 +996,61 @@ u64 sys_select(
   kzero(win, sizeof(win));
   kzero(ein, sizeof(ein));
 
-  if(readfds) {
-    if(!user_rw_ok(readfds, (u64)nlongs * sizeof(unsigned long)))
-      return (u64)-EFAULT;
-    kmemcpy(rin, (void *)readfds, (u64)nlongs * sizeof(unsigned long));
-  }
-  if(writefds) {
-    if(!user_rw_ok(writefds, (u64)nlongs * sizeof(unsigned long)))
-      return (u64)-EFAULT;
-    kmemcpy(win, (void *)writefds, (u64)nlongs * sizeof(unsigned long));
-  }
-  if(exceptfds) {
-    if(!user_rw_ok(exceptfds, (u64)nlongs * sizeof(unsigned long)))
-      return (u64)-EFAULT;
-    kmemcpy(ein, (void *)exceptfds, (u64)nlongs * sizeof(unsigned long));
-  }
+  u64 set_sz = (u64)nlongs * sizeof(unsigned long);
+  if((readfds && copy_from_user(rin, (const void *)readfds, set_sz) < 0) ||
+     (writefds && copy_from_user(win, (const void *)writefds, set_sz) < 0) ||
+     (exceptfds && copy_from_user(ein, (const void *)exceptfds, set_sz) < 0))
+    return (u64)-EFAULT;
 
   sel_mask_high_bits(rin, win, ein, nfds, nlongs);
 
   if(timeout) {
     bool immediate = false;
-    i32  prc       = parse_timeval(timeout, &immediate, &ticks_rem);
+    i32  prc       = parse_timeval(timeout, &immediate, &wait_ns);
     if(prc)
       return (u64)prc;
     poll_mode = immediate;
   } else
     infinite = true;
 
-  for(;;) {
-    int total = 0;
-    i32 err   = select_scan(nfds, rin, win, rout, wout, eout, &total);
-    if(err)
-      return (u64)err;
-
-    if(total > 0 || poll_mode) {
-      if(readfds)
-        kmemcpy((void *)readfds, rout, (u64)nlongs * sizeof(unsigned long));
-      if(writefds)
-        kmemcpy((void *)writefds, wout, (u64)nlongs * sizeof(unsigned long));
-      if(exceptfds)
-        kmemcpy((void *)exceptfds, eout, (u64)nlongs * sizeof(unsigned long));
-      return (u64)total;
-    }
-
-    if(!infinite) {
-      if(ticks_rem == 0)
-        break;
-      ticks_rem--;
-    }
+  wait_entry_t waits[POLL__STACK_WAITS];
+  poll_table_t pt;
+  sel_table_init(&pt, waits, nfds);
 
-    sel_hlt_slice();
+  u64 deadline = time_monotonic_ns() + wait_ns;
+  int total    = 0;
+  i32 err;
+  for(;;) {
+    err = select_scan(
+        nfds, rin, win, rout, wout, eout, &total, poll_mode ? NULL : &pt
+    );
+    if(err || total > 0 || poll_mode)
+      break;
+    if(!sel_sleep(&pt, infinite, deadline))
+      break;
   }
-
-  kzero(rout, sizeof(rout));
-  kzero(wout, sizeof(wout));
-  kzero(eout, sizeof(eout));
-  if(readfds)
-    kmemcpy((void *)readfds, rout, (u64)nlongs * sizeof(unsigned long));
-  if(writefds)
-    kmemcpy((void *)writefds, wout, (u64)nlongs * sizeof(unsigned long));
-  if(exceptfds)
-    kmemcpy((void *)exceptfds, eout, (u64)nlongs * sizeof(unsigned long));
-  return 0;
+  sel_table_free(&pt, waits);
+  if(err)
+    return (u64)err;
+
+  if(total == 0) {
+    kzero(rout, sizeof(rout));
+    kzero(wout, sizeof(wout));
+    kzero(eout, sizeof(eout));
+  }
+  if((readfds && copy_to_user((void *)readfds, rout, set_sz) < 0) ||
+     (writefds && copy_to_user((void *)writefds, wout, set_sz) < 0) ||
+     (exceptfds && copy_to_user((void *)exceptfds, eout, set_sz) < 0))
+    return (u64)-EFAULT;
+  return (u64)total;
 }
 
 /**
  * @brief Wait for events on an array of @p nfds_u file descriptors (@c poll).
  *
  * Copies the @c pollfd array into a kernel-side buffer, checks readiness in a
- * loop sleeping one HLT tick per iteration, and copies results back on exit.
+ * loop, sleeping on the fds' wait queues between scans (as @c select does),
+ * and copies results back on exit.
  * Returns 0 on timeout, the number of ready fds otherwise.
  */
 u64 sys_poll(u64 fds, u64 nfds_u, u64 timeout_u, u64 a4, u64 a5, u64 a6)
@@ -717,47 +1069,41 @@ u64 sys_poll(u64 fds, u64 nfds_u, u64 timeout_u, u64 a4, u64 a5, u64 a6)
 
   i32            timeout_ms = (i32)timeout_u;
   bool           immediate, infinite;
-  u64            ticks_rem = 0;
+  u64            wait_ns = 0;
   poll__fd_abi_t local[POLL__MAX_NFDS];
 
-  io__timeout_calc(timeout_ms, &immediate, &infinite, &ticks_rem);
+  io__timeout_calc(timeout_ms, &immediate, &infinite, &wait_ns);
 
   if(nfds == 0) {
     if(immediate)
       return 0;
-    if(infinite) {
-      for(;;)
-        sel_hlt_slice();
-    }
-    for(u64 t = 0; t < ticks_rem; t++)
-      sel_hlt_slice();
+    io__sleep_until(infinite ? 0 : time_monotonic_ns() + wait_ns);
     return 0;
   }
 
-  kmemcpy(local, (void *)fds, (u64)nfds * sizeof(poll__fd_abi_t));
+  u64 bytes = (u64)nfds * sizeof(poll__fd_abi_t);
+  if(copy_from_user(local, (const void *)fds, bytes) < 0)
+    return (u64)-EFAULT;
+
+  wait_entry_t waits[POLL__STACK_WAITS];
+  poll_table_t pt;
+  sel_table_init(&pt, waits, nfds);
 
+  u64 deadline = time_monotonic_ns() + wait_ns;
+  int nready   = 0;
   for(;;) {
-    int nready = 0;
     for(u32 i = 0; i < nfds; i++) {
-      if(poll__fill_one(&local[i]))
+      if(poll__fill_one(&local[i], immediate ? NULL : &pt))
         nready++;
     }
-
-    if(nready > 0 || immediate) {
-      kmemcpy((void *)fds, local, (u64)nfds * sizeof(poll__fd_abi_t));
-      return (u64)nready;
-    }
-
-    if(!infinite) {
-      if(ticks_rem == 0)
-        break;
-      ticks_rem--;
-    }
-    sel_hlt_slice();
+    if(nready > 0 || immediate)
+      break;
+    if(!sel_sleep(&pt, infinite, deadline))
+      break;
   }
+  sel_table_free(&pt, waits);
 
-  for(u32 i = 0; i < nfds; i++)
-    local[i].revents = 0;
-  kmemcpy((void *)fds, local, (u64)nfds * sizeof(poll__fd_abi_t));
-  return 0;
+  if(copy_to_user((void *)fds, local, bytes) < 0)
+    return (u64)-EFAULT;
+  return (u64)nready;
 }
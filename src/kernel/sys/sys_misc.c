@@ -1,13 +1,22 @@
 /**
  * @file src/kernel/sys/sys_misc.c
- * @brief Misc syscalls: `uname`, time, minimal `futex`, `sched_yield`.
+ * @brief Misc syscalls: `uname`, time, `futex`, scheduling, block cache
+ * and memory counters.
  */
 
+#include <alcor2/arch/smp.h>
+#include <alcor2/drivers/ata.h>
 #include <alcor2/errno.h>
 #include <alcor2/kstdlib.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/uaccess.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/proc.h>
+#include <alcor2/proc/sched.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/spinlock.h>
 #include <alcor2/sys/internal.h>
+#include <alcor2/time.h>
 
 static inline bool user_buf_ok(u64 ptr, u64 size)
 {
@@ -50,6 +59,8 @@ u64 sys_gettimeofday(u64 tv, u64 tz, u64 a3, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
+  if(!tv)
+    return 0;
   if(!user_buf_ok(tv, 16))
     return (u64)-EFAULT;
 
@@ -59,13 +70,13 @@ u64 sys_gettimeofday(u64 tv, u64 tz, u64 a3, u64 a4, u64 a5, u64 a6)
     i64 tv_usec;
   } *t = (void *)tv;
 
-  t->tv_sec  = 0;
-  t->tv_usec = 0;
+  u64 ns     = time_realtime_ns();
+  t->tv_sec  = (i64)(ns / NSEC_PER_SEC);
+  t->tv_usec = (i64)(ns % NSEC_PER_SEC / NSEC_PER_USEC);
   return 0;
 }
 
-/* Blocking futex. Keys map to the CPU physical backing of each 4-byte futex
- * word — safe with CLONE_THREAD (shared PTEs) unlike raw user VAs alone. */
+/* Blocking futex on hashed wait queues; see ::futex_key_t for the keys. */
 
 #define FUTEX_WAIT            0
 #define FUTEX_WAKE            1
@@ -83,78 +94,266 @@ u64 sys_gettimeofday(u64 tv, u64 tz, u64 a3, u64 a4, u64 a5, u64 a6)
 #define FUTEX_PRIVATE_FLAG    128
 #define FUTEX_CLOCK_REALTIME  256
 
-#define FUTEX_QUEUE_LEN       256
+/** @brief log2 of the futex hash bucket count. */
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1U << FUTEX_HASH_BITS)
 
 extern void proc_schedule(void);
 
-static struct
+/**
+ * @brief Identity of a futex word.
+ *
+ * Process-private futexes (FUTEX_PRIVATE_FLAG) are keyed by address space
+ * and virtual address, which needs no page-table walk. Shared ones are
+ * keyed by the physical address of the word, so every mapping of it
+ * agrees; their @c space is 0, which no address space uses.
+ */
+typedef struct
 {
-  u64     key_pa; /**< Full physical addr of backing u32 word */
-  proc_t *waiter;
-} g_futex_q[FUTEX_QUEUE_LEN];
+  u64 space; /**< CR3 of the address space, or 0 for a shared futex. */
+  u64 addr;  /**< Virtual (private) or physical (shared) address. */
+} futex_key_t;
 
-static u64 futex_key_pa(u64 uaddr)
+/** @brief Sleepers of the futex keys that hash to one bucket. */
+typedef struct
 {
-  if(!uaddr || (uaddr & 3ULL) != 0)
-    return 0;
-  u64 pa = vmm_get_phys(uaddr);
-  return pa;
+  spinlock_t   lock; /**< Taken before the futex word is compared. */
+  wait_queue_t q;    /**< Each wait entry is tagged with its key. */
+} futex_bucket_t;
+
+static futex_bucket_t g_futex_q[FUTEX_HASH_SIZE] = {
+    [0 ... FUTEX_HASH_SIZE - 1] = {
+        .lock = SPINLOCK_INIT("futex", LOCK_CLASS_FUTEX)
+    }
+};
+
+static futex_bucket_t *futex_bucket(const futex_key_t *k)
+{
+  u64 h = (k->addr >> 2) ^ (k->space >> 12);
+  return &g_futex_q[(h * 0x9E3779B97F4A7C15ULL) >> (64 - FUTEX_HASH_BITS)];
 }
 
-static bool futex_read_u32(u64 uaddr, u32 *out)
+/** @brief Lock the buckets of @p a and @p b, lower address first. */
+static void futex_lock_pair(futex_bucket_t *a, futex_bucket_t *b)
 {
-  if(!user_buf_ok(uaddr, sizeof(u32)))
-    return false;
-  u64 pa = vmm_get_phys(uaddr);
-  if(!pa)
+  if(a > b) {
+    futex_bucket_t *t = a;
+    a                 = b;
+    b                 = t;
+  }
+  spin_lock(&a->lock);
+  if(b != a)
+    spin_lock(&b->lock);
+}
+
+static void futex_unlock_pair(futex_bucket_t *a, futex_bucket_t *b)
+{
+  if(b != a)
+    spin_unlock(&b->lock);
+  spin_unlock(&a->lock);
+}
+
+/** @brief Build the key of the futex word at @p uaddr; false if invalid. */
+static bool futex_key(u64 uaddr, bool private, futex_key_t *k)
+{
+  if(!uaddr || (uaddr & 3ULL) != 0 || !user_buf_ok(uaddr, sizeof(u32)))
     return false;
-  const volatile u32 *kv =
-      (const volatile u32 *)((u8 *)phys_to_virt(pa) + 0); /* NOLINT */
-  *out = *kv;
-  return true;
+  if(private) {
+    k->space = proc_current()->cr3;
+    k->addr  = uaddr;
+    return true;
+  }
+  k->space = 0;
+  k->addr  = vmm_get_phys(uaddr);
+  return k->addr != 0;
 }
 
-static u64 futex_wake_pa(u64 key_pa, u64 max_wake)
+/** @brief Clamp a user wake/requeue count to the wait-queue API. */
+static u32 futex_count(u64 n)
 {
-  u64 woke = 0;
-  if(!key_pa || max_wake == 0)
+  return n > 0xFFFFFFFFULL ? ~0U : (u32)n;
+}
+
+static u64 futex_wake(const futex_key_t *k, u32 bits, u32 max)
+{
+  if(max == 0)
     return 0;
+  futex_bucket_t *b = futex_bucket(k);
+  spin_lock(&b->lock);
+  u64 n = wait_wake_bits(&b->q, k->space, k->addr, bits, max);
+  spin_unlock(&b->lock);
+  return n;
+}
 
-  for(int i = 0; i < FUTEX_QUEUE_LEN && woke < max_wake; i++) {
-    if(g_futex_q[i].key_pa != key_pa || !g_futex_q[i].waiter)
-      continue;
+/** @brief Move up to @p max waiters; both buckets are locked. */
+static u64
+    futex_requeue(const futex_key_t *from, const futex_key_t *to, u32 max)
+{
+  if(max == 0 || (from->space == to->space && from->addr == to->addr))
+    return 0;
+  return wait_requeue(
+      &futex_bucket(from)->q, from->space, from->addr, &futex_bucket(to)->q,
+      to->addr, max
+  );
+}
 
-    proc_t *w           = g_futex_q[i].waiter;
-    g_futex_q[i].key_pa = 0;
-    g_futex_q[i].waiter = NULL;
-    if(w->state == PROC_STATE_BLOCKED)
-      w->state = PROC_STATE_READY;
-    woke++;
-  }
+/**
+ * @brief Convert a futex timeout (struct timespec) to a monotonic deadline.
+ *
+ * FUTEX_WAIT takes a relative timeout; FUTEX_WAIT_BITSET an absolute one
+ * on CLOCK_MONOTONIC, or CLOCK_REALTIME with FUTEX_CLOCK_REALTIME.
+ *
+ * @return ::time_monotonic_ns deadline, 0 for no timeout, or negative
+ *         -errno (@c -ETIMEDOUT if an absolute deadline has already passed).
+ */
+static i64 futex_deadline(u64 timeout, bool absolute, bool realtime)
+{
+  struct
+  {
+    i64 sec;
+    i64 nsec;
+  } const *ts = (const void *)timeout;
 
-  return woke;
+  if(!timeout)
+    return 0;
+  if(!user_buf_ok(timeout, sizeof(*ts)))
+    return -EFAULT;
+  if(ts->sec < 0 || ts->nsec < 0 || ts->nsec >= (i64)NSEC_PER_SEC)
+    return -EINVAL;
+
+  u64 ns  = (u64)ts->sec * NSEC_PER_SEC + (u64)ts->nsec;
+  u64 now = time_monotonic_ns();
+  if(!absolute)
+    return (i64)(now + (ns ? ns : 1));
+
+  /* Move a CLOCK_REALTIME deadline onto the monotonic clock. */
+  if(realtime)
+    ns -= time_realtime_ns() - now;
+  if((i64)ns <= (i64)now)
+    return -ETIMEDOUT;
+  return (i64)ns;
 }
 
-static u64 futex_requeue_pa(u64 from_pa, u64 to_pa, u64 max_mv)
+/** @name FUTEX_WAKE_OP encoding of val3
+ * @{ */
+#define FUTEX_OP_SET         0 /**< uaddr2 = oparg */
+#define FUTEX_OP_ADD         1 /**< uaddr2 += oparg */
+#define FUTEX_OP_OR          2 /**< uaddr2 |= oparg */
+#define FUTEX_OP_ANDN        3 /**< uaddr2 &= ~oparg */
+#define FUTEX_OP_XOR         4 /**< uaddr2 ^= oparg */
+#define FUTEX_OP_OPARG_SHIFT 8 /**< oparg is a shift count */
+#define FUTEX_OP_CMP_EQ      0
+#define FUTEX_OP_CMP_NE      1
+#define FUTEX_OP_CMP_LT      2
+#define FUTEX_OP_CMP_LE      3
+#define FUTEX_OP_CMP_GT      4
+#define FUTEX_OP_CMP_GE      5
+/** @} */
+
+/** @brief Sign-extend the 12-bit field of @p v at bit @p shift. */
+static i32 futex_op_field(u32 v, u32 shift)
 {
-  u64 mv = 0;
-  if(!from_pa || !to_pa || from_pa == to_pa || max_mv == 0)
-    return 0;
+  return (i32)(v << (20 - shift)) >> 20;
+}
 
-  for(int i = 0; i < FUTEX_QUEUE_LEN && mv < max_mv; i++) {
-    if(g_futex_q[i].key_pa != from_pa || !g_futex_q[i].waiter)
-      continue;
-    g_futex_q[i].key_pa = to_pa;
-    mv++;
+/**
+ * @brief FUTEX_WAKE_OP: update @p uaddr2, wake @p nr on @p uaddr and, if the
+ *        old value of @p uaddr2 passes the encoded test, @p nr2 on it.
+ *
+ * Syscalls run with interrupts off on our one CPU, so the read-modify-write
+ * of @p uaddr2 is atomic for user space.
+ */
+static u64 futex_wake_op(
+    u64 uaddr, u64 uaddr2, bool private, u32 nr, u32 nr2, u32 encoded
+)
+{
+  u32 op     = (encoded >> 28) & 0xF;
+  u32 cmp    = (encoded >> 24) & 0xF;
+  i32 oparg  = futex_op_field(encoded, 12);
+  i32 cmparg = futex_op_field(encoded, 0);
+  if(op & FUTEX_OP_OPARG_SHIFT) {
+    if(oparg < 0 || oparg > 31)
+      return (u64)-EINVAL;
+    oparg = (i32)(1U << oparg);
+    op &= ~FUTEX_OP_OPARG_SHIFT;
+  }
+
+  futex_key_t k1;
+  if(!futex_key(uaddr, private, &k1) || !user_buf_ok(uaddr2, sizeof(u32)) ||
+     (uaddr2 & 3ULL))
+    return (u64)-EFAULT;
+
+  /* Write through the user mapping so a copy-on-write page is unshared. */
+  volatile u32 *word = (volatile u32 *)uaddr2;
+  i32           old  = (i32)*word;
+  u32           v    = (u32)oparg;
+  switch(op) {
+  case FUTEX_OP_SET:
+    break;
+  case FUTEX_OP_ADD:
+    v = (u32)old + v;
+    break;
+  case FUTEX_OP_OR:
+    v = (u32)old | v;
+    break;
+  case FUTEX_OP_ANDN:
+    v = (u32)old & ~v;
+    break;
+  case FUTEX_OP_XOR:
+    v = (u32)old ^ v;
+    break;
+  default:
+    return (u64)-ENOSYS;
+  }
+
+  bool hit;
+  switch(cmp) {
+  case FUTEX_OP_CMP_EQ:
+    hit = old == cmparg;
+    break;
+  case FUTEX_OP_CMP_NE:
+    hit = old != cmparg;
+    break;
+  case FUTEX_OP_CMP_LT:
+    hit = old < cmparg;
+    break;
+  case FUTEX_OP_CMP_LE:
+    hit = old <= cmparg;
+    break;
+  case FUTEX_OP_CMP_GT:
+    hit = old > cmparg;
+    break;
+  case FUTEX_OP_CMP_GE:
+    hit = old >= cmparg;
+    break;
+  default:
+    return (u64)-ENOSYS;
   }
-  return mv;
+  *word = v;
+
+  u64         woken = futex_wake(&k1, ~0U, nr);
+  futex_key_t k2;
+  if(hit && futex_key(uaddr2, private, &k2))
+    woken += futex_wake(&k2, ~0U, nr2);
+  return woken;
 }
 
+/**
+ * @brief futex(uaddr, op, val, timeout / val2, uaddr2, val3).
+ *
+ * Waiters sleep on a hashed bucket chosen by the ::futex_key_t of the
+ * futex word, tagged with that key and their bitset, so a wake only
+ * visits one bucket and only wakes matching waiters. For REQUEUE,
+ * CMP_REQUEUE and WAKE_OP, the fourth argument is the count val2.
+ */
 u64 sys_futex(u64 uaddr, u64 op, u64 val, u64 timeout, u64 uaddr2, u64 val3)
 {
-  (void)timeout;
+  u32  cmd      = (u32)op & ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME);
+  bool realtime = (u32)op & FUTEX_CLOCK_REALTIME;
+  bool private  = (u32)op & FUTEX_PRIVATE_FLAG;
 
-  u32 cmd = (u32)op & ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME);
+  if(!proc_current())
+    return (u64)-ESRCH;
 
   /* Priority-inheritance / lock-pi: not implemented in full; treat as the
    * closest non-PI primitive so libstdc++/musl does not spin into abort. */
@@ -165,96 +364,104 @@ u64 sys_futex(u64 uaddr, u64 op, u64 val, u64 timeout, u64 uaddr2, u64 val3)
   if(cmd == FUTEX_CMP_REQUEUE_PI)
     cmd = FUTEX_CMP_REQUEUE;
 
-  if(cmd == FUTEX_WAKE_OP) {
-    /* Full WAKE_OP decode is huge; lld/musl only need forward progress. */
-    u64 k = futex_key_pa(uaddr);
-    if(!k)
-      return (u64)-EFAULT;
-    return futex_wake_pa(k, 256);
-  }
-
-  if(cmd == FUTEX_FD)
-    return (u64)-ENOSYS;
+  switch(cmd) {
+  case FUTEX_WAIT:
+  case FUTEX_WAIT_BITSET: {
+    u32 bits = cmd == FUTEX_WAIT ? ~0U : (u32)val3;
+    if(!bits)
+      return (u64)-EINVAL;
 
-  if(cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET) {
-    u32 curv;
-    if(!futex_read_u32(uaddr, &curv))
+    futex_key_t k;
+    if(!futex_key(uaddr, private, &k))
       return (u64)-EFAULT;
-    if(curv != (u32)val)
+    /* This first read also faults the word in, which must not happen
+     * under the bucket lock. */
+    if(*(const volatile u32 *)uaddr != (u32)val)
       return (u64)-EAGAIN;
 
-    u64 key = futex_key_pa(uaddr);
-    if(!key)
-      return (u64)-EFAULT;
-
-    proc_t *cur = proc_current();
-    if(!cur)
-      return (u64)-ESRCH;
-
-    int slot = -1;
-    for(int i = 0; i < FUTEX_QUEUE_LEN; i++) {
-      if(g_futex_q[i].key_pa == 0) {
-        slot = i;
-        break;
-      }
-    }
-    if(slot < 0)
-      return (u64)-ENOMEM;
-
-    g_futex_q[slot].key_pa = key;
-    g_futex_q[slot].waiter = cur;
-    cur->state             = PROC_STATE_BLOCKED;
-    proc_schedule();
-
-    if(g_futex_q[slot].waiter == cur) {
-      g_futex_q[slot].key_pa = 0;
-      g_futex_q[slot].waiter = NULL;
-    }
-    return 0;
+    i64 deadline = futex_deadline(timeout, cmd == FUTEX_WAIT_BITSET, realtime);
+    if(deadline < 0)
+      return (u64)deadline;
+
+    /* A waker changes the word before it takes the lock, so a value still
+     * unchanged under it means the wake is still to come. */
+    futex_bucket_t *b = futex_bucket(&k);
+    spin_lock(&b->lock);
+    i64 r = -EAGAIN;
+    if(*(const volatile u32 *)uaddr == (u32)val)
+      r = wait_sleep_locked(
+          &b->q, &b->lock, k.space, k.addr, bits, (u64)deadline
+      );
+    spin_unlock(&b->lock);
+    return (u64)r;
   }
 
-  if(cmd == FUTEX_WAKE || cmd == FUTEX_WAKE_BITSET) {
-    u64 k = futex_key_pa(uaddr);
-    if(!k)
+  case FUTEX_WAKE:
+  case FUTEX_WAKE_BITSET: {
+    u32 bits = cmd == FUTEX_WAKE ? ~0U : (u32)val3;
+    if(!bits)
+      return (u64)-EINVAL;
+    futex_key_t k;
+    if(!futex_key(uaddr, private, &k))
       return (u64)-EFAULT;
-    return futex_wake_pa(k, val ? val : ~(u64)0);
+    return futex_wake(&k, bits, futex_count(val));
   }
 
-  /* REQUEUE variants (musl pthread_cond). Keep semantics loose: wake every
-   * waiter on @p uaddr, then requeue every remaining waiter onto @p uaddr2.
-   * (Linux passes wake/requeue counts in r10/r9 — we ignore them so we never
-   * leave waiters stuck if those args are mis-parsed.) */
-  if(cmd == FUTEX_REQUEUE || cmd == FUTEX_CMP_REQUEUE) {
-    (void)val3;
-
-    if(cmd == FUTEX_CMP_REQUEUE) {
-      u32 curv;
-      if(!futex_read_u32(uaddr, &curv))
-        return (u64)-EFAULT;
-      if(curv != (u32)val)
-        return (u64)-EAGAIN;
-    }
-
-    if(!user_buf_ok(uaddr2, sizeof(u32)))
-      return (u64)-EFAULT;
-
-    u64 k1 = futex_key_pa(uaddr);
-    u64 k2 = futex_key_pa(uaddr2);
-    if(!k1 || !k2)
+  case FUTEX_REQUEUE:
+  case FUTEX_CMP_REQUEUE: {
+    /* Wake val waiters on uaddr and move up to val2 of the rest to
+     * uaddr2, so a condition-variable broadcast wakes one thread instead
+     * of the whole herd. */
+    futex_key_t k1, k2;
+    if(!futex_key(uaddr, private, &k1) || !futex_key(uaddr2, private, &k2))
       return (u64)-EFAULT;
+    /* Checked again under the locks; this read faults the word in. */
+    if(cmd == FUTEX_CMP_REQUEUE && *(const volatile u32 *)uaddr != (u32)val3)
+      return (u64)-EAGAIN;
 
-    u64 wk = futex_wake_pa(k1, ~(u64)0);
-    u64 rq = futex_requeue_pa(k1, k2, ~(u64)0);
-    (void)timeout;
-    return wk + rq;
+    futex_bucket_t *b1 = futex_bucket(&k1);
+    futex_bucket_t *b2 = futex_bucket(&k2);
+    futex_lock_pair(b1, b2);
+    u64 r = (u64)-EAGAIN;
+    if(cmd != FUTEX_CMP_REQUEUE || *(const volatile u32 *)uaddr == (u32)val3) {
+      r = wait_wake_bits(&b1->q, k1.space, k1.addr, ~0U, futex_count(val));
+      r += futex_requeue(&k1, &k2, futex_count(timeout));
+    }
+    futex_unlock_pair(b1, b2);
+    return r;
   }
 
-  return (u64)-ENOSYS;
+  case FUTEX_WAKE_OP:
+    return futex_wake_op(
+        uaddr, uaddr2, private, futex_count(val), futex_count(timeout),
+        (u32)val3
+    );
+
+  default:
+    return (u64)-ENOSYS;
+  }
 }
 
+/** @name Clock IDs (Linux ABI)
+ * @{ */
+#define CLOCK_REALTIME           0
+#define CLOCK_MONOTONIC          1
+#define CLOCK_PROCESS_CPUTIME_ID 2
+#define CLOCK_THREAD_CPUTIME_ID  3
+#define CLOCK_MONOTONIC_RAW      4
+#define CLOCK_REALTIME_COARSE    5
+#define CLOCK_MONOTONIC_COARSE   6
+#define CLOCK_BOOTTIME           7
+/** @} */
+
+/**
+ * @brief clock_gettime(clk, tp); the vDSO answers most calls without it.
+ *
+ * The CPU-time clocks read the caller's runtime; each process has one
+ * thread, so both give the same value.
+ */
 u64 sys_clock_gettime(u64 clk, u64 tp, u64 a3, u64 a4, u64 a5, u64 a6)
 {
-  (void)clk;
   (void)a3;
   (void)a4;
   (void)a5;
@@ -265,10 +472,58 @@ u64 sys_clock_gettime(u64 clk, u64 tp, u64 a3, u64 a4, u64 a5, u64 a6)
     i64 s;
     i64 ns;
   } *ts = (void *)tp;
+  u64 ns;
+  switch(clk) {
+  case CLOCK_REALTIME:
+  case CLOCK_REALTIME_COARSE:
+    ns = time_realtime_ns();
+    break;
+  case CLOCK_PROCESS_CPUTIME_ID:
+  case CLOCK_THREAD_CPUTIME_ID: {
+    proc_usage_t u = {0};
+    if(proc_current())
+      proc_usage(proc_current(), &u);
+    ns = u.runtime;
+    break;
+  }
+  case CLOCK_MONOTONIC:
+  case CLOCK_MONOTONIC_RAW:
+  case CLOCK_MONOTONIC_COARSE:
+  case CLOCK_BOOTTIME:
+    ns = time_monotonic_ns();
+    break;
+  default:
+    return (u64)-EINVAL;
+  }
   if(!user_buf_ok(tp, sizeof(*ts)))
     return (u64)-EFAULT;
-  ts->s  = 0;
-  ts->ns = 0;
+  ts->s  = (i64)(ns / NSEC_PER_SEC);
+  ts->ns = (i64)(ns % NSEC_PER_SEC);
+  return 0;
+}
+
+/** @brief clock_getres(clk, res); every clock ticks with the same source. */
+u64 sys_clock_getres(u64 clk, u64 res, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  struct
+  {
+    i64 s;
+    i64 ns;
+  } *ts = (void *)res;
+  if(clk > CLOCK_BOOTTIME)
+    return (u64)-EINVAL;
+  if(!res)
+    return 0;
+  if(!user_buf_ok(res, sizeof(*ts)))
+    return (u64)-EFAULT;
+  u64 ns = time_resolution_ns();
+  ts->s  = (i64)(ns / NSEC_PER_SEC);
+  ts->ns = (i64)(ns % NSEC_PER_SEC);
   return 0;
 }
 
@@ -287,11 +542,12 @@ u64 sys_sched_yield(u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
 }
 
 /**
- * @brief Stub for sched_getaffinity(pid, cpusetsize, mask).
+ * @brief sched_getaffinity(pid, cpusetsize, mask).
  *
- * We have a single-CPU kernel so the affinity mask is always {0}. Writes
- * one byte (bit 0 set) into the user-supplied @p mask buffer and returns
- * the size of the populated mask in bytes (Linux convention).
+ * Every process may run on every CPU that schedules, so the mask is the
+ * online CPUs (the BSP always). Fills the user-supplied @p mask buffer,
+ * clearing bits past the last CPU, and returns the size of the populated
+ * mask in bytes (Linux convention).
  */
 u64 sys_sched_getaffinity(
     u64 pid, u64 cpusetsize, u64 mask, u64 a4, u64 a5, u64 a6
@@ -309,12 +565,194 @@ u64 sys_sched_getaffinity(
     return (u64)-EFAULT;
 
   u8 *m = (u8 *)mask;
-  m[0]  = 0x01; /* CPU 0 only */
-  for(u64 i = 1; i < cpusetsize; i++)
+  for(u64 i = 0; i < cpusetsize; i++)
     m[i] = 0;
+  m[0] = 0x01; /* Online or not, the BSP runs processes. */
+  for(u32 c = 1; c < smp_cpu_count() && c / 8 < cpusetsize; c++) {
+    if(smp_cpu(c)->online)
+      m[c / 8] |= (u8)(1U << (c % 8));
+  }
   return cpusetsize;
 }
 
+/** @brief getpriority/setpriority @c which for a single process. */
+#define PRIO_PROCESS 0
+/** @brief sched_setscheduler flag: children start at the default policy. */
+#define SCHED_RESET_ON_FORK 0x40000000U
+
+/** @brief struct sched_param. */
+typedef struct
+{
+  i32 sched_priority;
+} sched_param_abi_t;
+
+/** @brief The live process @p pid names, the caller for 0; NULL if none. */
+static proc_t *sched_target(u64 pid)
+{
+  proc_t *p = (i64)pid == 0 ? proc_current() : proc_get(pid);
+  return p && p->state != PROC_STATE_ZOMBIE ? p : NULL;
+}
+
+/**
+ * @brief getpriority(which, who): the raw kernel value 20 - nice.
+ *
+ * Only PRIO_PROCESS is supported; there are no process groups or users to
+ * select by.
+ */
+u64 sys_getpriority(u64 which, u64 who, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(which != PRIO_PROCESS)
+    return (u64)-EINVAL;
+  proc_t *p = sched_target(who);
+  if(!p)
+    return (u64)-ESRCH;
+  return (u64)(20 - p->nice);
+}
+
+/** @brief setpriority(which, who, prio); @p prio is clamped to the range. */
+u64 sys_setpriority(u64 which, u64 who, u64 prio, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(which != PRIO_PROCESS)
+    return (u64)-EINVAL;
+  proc_t *p = sched_target(who);
+  if(!p)
+    return (u64)-ESRCH;
+
+  i32 nice = (i32)prio;
+  if(nice < NICE_MIN)
+    nice = NICE_MIN;
+  if(nice > NICE_MAX)
+    nice = NICE_MAX;
+  /* Charge the old weight first; only time from now on uses the new one. */
+  if(p == proc_current())
+    sched_update(p);
+  p->nice = nice;
+  return 0;
+}
+
+/**
+ * @brief sched_setscheduler(pid, policy, param).
+ *
+ * The fair policies are supported; SCHED_FIFO and SCHED_RR are refused
+ * with EPERM, as for a process without the privilege to use them.
+ * SCHED_RESET_ON_FORK is accepted and ignored.
+ */
+u64 sys_sched_setscheduler(
+    u64 pid, u64 policy, u64 param, u64 a4, u64 a5, u64 a6
+)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(!user_buf_ok(param, sizeof(sched_param_abi_t)))
+    return (u64)-EFAULT;
+  policy = (u32)policy & ~SCHED_RESET_ON_FORK;
+  if(policy == SCHED_FIFO || policy == SCHED_RR)
+    return (u64)-EPERM;
+  if(policy != SCHED_NORMAL && policy != SCHED_BATCH && policy != SCHED_IDLE)
+    return (u64)-EINVAL;
+  if(((const sched_param_abi_t *)param)->sched_priority != 0)
+    return (u64)-EINVAL;
+  proc_t *p = sched_target(pid);
+  if(!p)
+    return (u64)-ESRCH;
+
+  if(p == proc_current())
+    sched_update(p);
+  p->sched_policy = (u32)policy;
+  return 0;
+}
+
+u64 sys_sched_getscheduler(u64 pid, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  proc_t *p = sched_target(pid);
+  return p ? p->sched_policy : (u64)-ESRCH;
+}
+
+/** @brief sched_setparam(pid, param): the fair policies only take 0. */
+u64 sys_sched_setparam(u64 pid, u64 param, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(!user_buf_ok(param, sizeof(sched_param_abi_t)))
+    return (u64)-EFAULT;
+  if(!sched_target(pid))
+    return (u64)-ESRCH;
+  if(((const sched_param_abi_t *)param)->sched_priority != 0)
+    return (u64)-EINVAL;
+  return 0;
+}
+
+u64 sys_sched_getparam(u64 pid, u64 param, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(!user_buf_ok(param, sizeof(sched_param_abi_t)))
+    return (u64)-EFAULT;
+  if(!sched_target(pid))
+    return (u64)-ESRCH;
+  ((sched_param_abi_t *)param)->sched_priority = 0;
+  return 0;
+}
+
+/** @brief Highest static priority of @p policy (99 for the real-time ones). */
+u64 sys_sched_get_priority_max(
+    u64 policy, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6
+)
+{
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(policy == SCHED_FIFO || policy == SCHED_RR)
+    return 99;
+  if(policy == SCHED_NORMAL || policy == SCHED_BATCH || policy == SCHED_IDLE)
+    return 0;
+  return (u64)-EINVAL;
+}
+
+/** @brief Lowest static priority of @p policy (1 for the real-time ones). */
+u64 sys_sched_get_priority_min(
+    u64 policy, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6
+)
+{
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(policy == SCHED_FIFO || policy == SCHED_RR)
+    return 1;
+  if(policy == SCHED_NORMAL || policy == SCHED_BATCH || policy == SCHED_IDLE)
+    return 0;
+  return (u64)-EINVAL;
+}
+
 /** Linux rlimit struct: each value is rlim_t (u64 on x86_64). */
 struct k_rlimit
 {
@@ -387,3 +825,35 @@ u64 sys_prlimit64(
   }
   return 0;
 }
+
+u64 sys_alcor_blkcache_stats(u64 buf, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(!user_buf_ok(buf, sizeof(alcor_blkcache_stats_t)))
+    return (u64)-EFAULT;
+
+  alcor_blkcache_stats_t st;
+  ata_cache_stats(&st);
+  kmemcpy((void *)buf, &st, sizeof(st));
+  return 0;
+}
+
+u64 sys_alcor_memstat(u64 buf, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  alcor_memstat_t st;
+  pmm_memstat(&st);
+  if(copy_to_user((void *)buf, &st, sizeof(st)) < 0)
+    return (u64)-EFAULT;
+  return 0;
+}
@@ -2,16 +2,17 @@
  * @file src/kernel/sys/sys_mm.c
  * @brief Memory syscalls: `mmap`, `mprotect`, `munmap`, `brk`.
  *
- * Page alignment, prot → PTE flags, filling file-backed pages through the VFS,
- * and anonymous ranges via `vmm_map_range_alloc` where applicable.
+ * Page alignment and prot → PTE/VMA flags. mmap and brk only record a
+ * region in the process's VMA list; pages are faulted in on first touch
+ * (see vma_handle_fault), from the page cache for file mappings.
  */
 
-#include <alcor2/drivers/fb_user.h>
 #include <alcor2/errno.h>
 #include <alcor2/fs/vfs.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/mm/memory_layout.h>
 #include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vma.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/proc.h>
 #include <alcor2/sys/internal.h>
@@ -46,62 +47,50 @@ static u64 build_vmm_flags(u64 prot)
   return flags;
 }
 
-static void unmap_and_free_range(u64 start, u64 length)
+static u32 build_vma_flags(u64 prot)
 {
-  for(u64 off = 0; off < length; off += PAGE_SIZE) {
-    u64 va   = start + off;
-    u64 phys = vmm_get_phys(va);
-    if(phys) {
-      vmm_unmap(va);
-      if(!fb_user_phys_page_is_framebuffer(phys))
-        pmm_free((void *)phys);
-    }
-  }
-}
-
-static i64 map_zeroed_user_range(u64 base, u64 length, u64 map_flags)
-{
-  u64 count = length >> 12; /* length is already page-aligned */
-  if(!vmm_map_range_alloc(base, count, map_flags | VMM_WRITE)) {
-    unmap_and_free_range(base, length);
-    return -ENOMEM;
-  }
-  return 0;
-}
-
-static void apply_final_prot(u64 base, u64 length, u64 map_flags)
-{
-  for(u64 off = 0; off < length; off += PAGE_SIZE) {
-    u64 va   = base + off;
-    u64 phys = vmm_get_phys(va);
-    if(phys)
-      vmm_map(va, phys, map_flags);
-  }
+  u32 flags = 0;
+  if(prot & PROT_READ)
+    flags |= VMA_READ;
+  if(prot & PROT_WRITE)
+    flags |= VMA_WRITE;
+  if(prot & PROT_EXEC)
+    flags |= VMA_EXEC;
+  return flags;
 }
 
-static void fill_file_backed_pages(u64 base, u64 length, i64 fd, u64 offset)
+/**
+ * @brief Take a reference on the file behind @p fd for a new mapping.
+ * @return OFT slot on success, or negative errno.
+ */
+static i32 mmap_file_get(u64 fd, u64 prot, u64 flags)
 {
-  i64 saved_pos = vfs_seek(fd, 0, SEEK_CUR);
-  vfs_seek(fd, (i64)offset, SEEK_SET);
-
-  for(u64 map_off = 0; map_off < length;) {
-    u64 page_virt = base + map_off;
-    u64 phys      = vmm_get_phys(page_virt);
-    if(!phys)
-      break;
-    u8 *dst        = (u8 *)(phys + vmm_get_hhdm());
-    u64 page_local = map_off & PAGE_MASK_LOCAL;
-    u64 chunk      = PAGE_SIZE - page_local;
-    if(chunk > length - map_off)
-      chunk = length - map_off;
-
-    i64 n = vfs_read(fd, dst + page_local, chunk);
-    if(n <= 0)
-      break;
-    map_off += (u64)n;
+  i32 oft_idx = vfs_fd_to_oft((i64)fd);
+  if(oft_idx < 0)
+    return -EBADF;
+
+  const vfs_oft_entry_t *e = vfs_oft_get(oft_idx);
+  if(e->kind != VFS_KIND_FILE)
+    return -EACCES;
+
+  vfs_stat_t st;
+  if(!e->ops->fstat || e->ops->fstat(e->handle, &st) < 0 ||
+     st.type != VFS_FILE)
+    return -ENODEV;
+
+  u32 acc = e->flags & (O_WRONLY | O_RDWR);
+  if(acc == O_WRONLY)
+    return -EACCES;
+  if((flags & MAP_SHARED) && (prot & PROT_WRITE) && acc != O_RDWR)
+    return -EACCES;
+  if((flags & MAP_SHARED) && (prot & PROT_WRITE)) {
+    i64 seals = vfs_oft_seals(oft_idx, 0);
+    if(seals > 0 && (seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)))
+      return -EPERM;
   }
 
-  vfs_seek(fd, saved_pos, SEEK_SET);
+  vfs_oft_retain(oft_idx);
+  return oft_idx;
 }
 
 u64 sys_mmap(u64 addr, u64 length, u64 prot, u64 flags, u64 fd, u64 offset)
@@ -121,39 +110,57 @@ u64 sys_mmap(u64 addr, u64 length, u64 prot, u64 flags, u64 fd, u64 offset)
   if(aligned_len < length)
     return (u64)-ENOMEM;
 
+  bool is_anon = (flags & MAP_ANONYMOUS) != 0 || fd == (u64)-1;
+  if(!is_anon && (offset & PAGE_MASK_LOCAL))
+    return (u64)-EINVAL;
+
   u64 base = (fixed && addr != 0) ? page_align_down(addr)
                                   : page_align_down(p->mmap_base);
-  u64 end  = base + aligned_len;
+  /* Large anonymous regions start on a 2 MiB boundary for huge pages. */
+  if(!fixed && is_anon && aligned_len >= VMM_HUGE_SIZE)
+    base = (base + VMM_HUGE_SIZE - 1) & ~(VMM_HUGE_SIZE - 1);
+  u64 end = base + aligned_len;
   if(end < base || end > USER_SPACE_END)
     return (u64)-ENOMEM;
 
-  bool is_anon = (flags & MAP_ANONYMOUS) != 0 || fd == (u64)-1;
-  if(!is_anon && (offset & PAGE_MASK_LOCAL))
-    return (u64)-EINVAL;
-
-  u64 map_flags = build_vmm_flags(prot);
+  vma_t vma = {
+      .start  = base,
+      .end    = end,
+      .offset = is_anon ? 0 : offset,
+      .file   = -1,
+      .flags  = build_vma_flags(prot),
+  };
+  if(is_anon)
+    vma.flags |= VMA_ANON;
+  if(flags & MAP_SHARED)
+    vma.flags |= VMA_SHARED;
+
+  if(!is_anon) {
+    vma.file = mmap_file_get(fd, prot, flags);
+    if(vma.file < 0)
+      return (u64)(i64)vma.file;
+  }
 
   /* MAP_FIXED requires "replace any existing mapping at this range with a
-   * fresh zero-filled mapping" semantics. vmm_map_range_alloc skips pages
-   * already PRESENT, so the new contents would be stale parent/peer data —
-   * which is what causes mallocng's a_crash() (heap metadata mismatch).
-   * Unmap the range first so the subsequent alloc sees only fresh pages. */
-  if(fixed)
-    unmap_and_free_range(base, aligned_len);
+   * fresh zero-filled mapping" semantics. Drop the old pages and regions so
+   * the range faults in fresh zero pages instead of stale parent/peer data —
+   * which is what causes mallocng's a_crash() (heap metadata mismatch). */
+  if(fixed) {
+    vmm_unmap_range(base, end);
+    if(vma_remove(&p->vmas, base, end) < 0) {
+      vfs_oft_release(vma.file);
+      return (u64)-ENOMEM;
+    }
+  }
 
-  i64 map_ret = map_zeroed_user_range(base, aligned_len, map_flags);
-  if(map_ret < 0)
-    return (u64)map_ret;
+  if(vma_insert(&p->vmas, &vma) < 0) {
+    vfs_oft_release(vma.file);
+    return (u64)-ENOMEM;
+  }
 
   if(!fixed)
     p->mmap_base = end;
 
-  if(!is_anon)
-    fill_file_backed_pages(base, length, (i64)fd, offset);
-
-  if(!(prot & PROT_WRITE))
-    apply_final_prot(base, aligned_len, map_flags);
-
   return base;
 }
 
@@ -170,11 +177,13 @@ u64 sys_mprotect(u64 addr, u64 len, u64 prot, u64 a4, u64 a5, u64 a6)
   u64 aligned_end   = page_align_up(addr + len);
   u64 map_flags     = build_vmm_flags(prot);
 
-  for(u64 va = aligned_start; va < aligned_end; va += PAGE_SIZE) {
-    u64 phys = vmm_get_phys(va);
-    if(phys)
-      vmm_map(va, phys, map_flags);
-  }
+  proc_t *p = proc_current();
+  if(p && vma_protect(&p->vmas, aligned_start, aligned_end,
+                      build_vma_flags(prot)) < 0)
+    return (u64)-ENOMEM;
+
+  /* Pages not faulted in yet pick the new protection up from the VMA. */
+  vmm_protect_range(aligned_start, aligned_end, map_flags);
   return 0;
 }
 
@@ -192,7 +201,11 @@ u64 sys_munmap(u64 addr, u64 len, u64 a3, u64 a4, u64 a5, u64 a6)
 
   u64 aligned_start = page_align_down(addr);
   u64 aligned_end   = page_align_up(addr + len);
-  unmap_and_free_range(aligned_start, aligned_end - aligned_start);
+  vmm_unmap_range(aligned_start, aligned_end);
+
+  proc_t *p = proc_current();
+  if(p && vma_remove(&p->vmas, aligned_start, aligned_end) < 0)
+    return (u64)-ENOMEM;
   return 0;
 }
 
@@ -215,13 +228,16 @@ u64 sys_brk(u64 addr, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
     u64 old_end = page_align_up(p->program_break);
     u64 new_end = page_align_up(addr);
 
-    for(u64 page_addr = old_end; page_addr < new_end; page_addr += PAGE_SIZE) {
-      u64 phys = (u64)pmm_alloc();
-      if(!phys)
-        return p->program_break;
-      vmm_map(page_addr, phys, VMM_PRESENT | VMM_WRITE | VMM_USER);
-      kzero((u8 *)(phys + vmm_get_hhdm()), PAGE_SIZE);
-    }
+    /* Grow the demand-zero heap region; pages appear on first touch. */
+    vma_t heap = {
+        .start  = old_end,
+        .end    = new_end,
+        .offset = 0,
+        .file   = -1,
+        .flags  = VMA_READ | VMA_WRITE | VMA_ANON | VMA_HEAP,
+    };
+    if(new_end > old_end && vma_insert(&p->vmas, &heap) < 0)
+      return p->program_break;
     p->program_break = addr;
   }
   return p->program_break;
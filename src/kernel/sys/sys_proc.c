@@ -1,73 +1,156 @@
 /**
  * @file src/kernel/sys/sys_proc.c
- * @brief Process syscalls: PID queries, fork, exec, wait, clone, identity.
+ * @brief Process syscalls: PID queries, fork, exec, spawn templates, wait,
+ *        clone, identity, resource usage.
  *
- * All user pointers (path strings, argv/envp vectors, wait-status buffers)
- * are validated through the VMM before any kernel-side access.
+ * User memory (path strings, argv/envp vectors, wait-status buffers) is
+ * only read and written through the uaccess routines, so a bad pointer
+ * makes the call fail with @c -EFAULT.
  */
 
+#include <alcor2/alcor_spawn.h>
 #include <alcor2/errno.h>
 #include <alcor2/fs/vfs.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/uaccess.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/proc/proc.h>
 #include <alcor2/sys/internal.h>
+#include <alcor2/time.h>
 
 #define ALCOR_CLONE_VM     0x00000100u
 #define ALCOR_CLONE_VFORK  0x00004000u
 #define ALCOR_CLONE_THREAD 0x00010000u
 #define ALCOR_CSIGNAL      0x000000ffu
 
-#define MAX_EXEC_ARGS      PROC_MAX_ARGV
-#define MAX_ARG_LEN        PROC_MAX_ARG_STRLEN
+/** @brief File pages of a program mapped when it is warmed (1 MiB). */
+#define SPAWN_PREFAULT 256
 
-/** @brief Return @c true if @p ptr is a valid, non-NULL user-space pointer. */
-static inline bool user_cstr_ok(u64 ptr)
+_Static_assert(
+    sizeof(alcor_spawn_fd_t) == sizeof(vfs_fd_action_t), "spawn fd action"
+);
+
+/**
+ * @brief A warmed program. The table holds one reference and every run in
+ *        progress another, so dropping it mid-run is safe.
+ */
+typedef struct
 {
-  return ptr && vmm_is_user_ptr((void *)ptr);
-}
+  proc_t      *image;
+  proc_image_t aux;
+  u64          dev; /**< The file it was loaded from... */
+  u64          ino;
+  u64          size; /**< ...and its version then. */
+  u64          modified;
+  u64          used; /**< ::spawn_clock at the last warm or run. */
+  u32          refs;
+} spawn_template_t;
+
+static spawn_template_t *spawn_slots[ALCOR_SPAWN_TEMPLATES];
+static u64               spawn_clock;
 
-/** @brief Return @c true if @p ptr..@p ptr+size is a valid user-space range. */
-static inline bool user_buf_ok(u64 ptr, u64 size)
+/**
+ * @brief Measure a null-terminated user-space string vector for execve.
+ *
+ * Adds the string bytes (with terminators) to @p *bytes and the string
+ * count to @p *count. Every string costs its bytes plus one pointer against
+ * @c PROC_ARG_MAX.
+ *
+ * @return 0 on success, @c -EFAULT if a slot or string is not readable,
+ *         @c -E2BIG if the vectors outgrow @c PROC_ARG_MAX.
+ */
+static i64 user_strvec_size(char *const *user_vec, u32 *count, u64 *bytes)
 {
-  return ptr && vmm_is_user_range((void *)ptr, size);
+  if(!user_vec)
+    return 0;
+  for(u32 n = 0;; n++) {
+    const char *p;
+    if(copy_from_user(&p, &user_vec[n], sizeof(p)) < 0)
+      return -EFAULT;
+    if(!p)
+      return 0;
+    i64 len = strnlen_user(p, PROC_ARG_MAX);
+    if(len < 0)
+      return len;
+    *bytes += (u64)len + 1;
+    (*count)++;
+    if(*bytes + (u64)*count * sizeof(char *) > PROC_ARG_MAX)
+      return -E2BIG;
+  }
 }
 
 /**
- * @brief Copy a null-terminated user-space string vector into kernel storage.
+ * @brief Append the @p count strings of a vector measured with
+ *        user_strvec_size() to @p dst, stopping at @p end.
  *
- * Reads up to @c MAX_EXEC_ARGS pointers from @p user_vec, validates each with
- * VMM, and copies the string contents into @p store.  Pointer entries are
- * written to @p ptrs (null-terminated).  @p *out_count receives the count.
+ * The strings are read again, so another thread of the caller could have
+ * changed them in between; @p end keeps the copy inside the block.
  *
- * @return 0 on success, @c -EFAULT if any pointer fails validation.
+ * @return End of the copied strings, or NULL if a string is unreadable or
+ *         no longer fits.
  */
-static i64 copy_user_strvec(
-    char **user_vec, char store[][MAX_ARG_LEN], char *ptrs[], int *out_count
+static char *copy_user_strvec(
+    char *const *user_vec, u32 count, char *dst, const char *end
 )
 {
-  int n = 0;
-  if(user_vec) {
-    for(; n < MAX_EXEC_ARGS; n++) {
-      /* Validate the pointer slot BEFORE dereferencing it. Without this the
-       * loop happily reads @c user_vec[n] from kernel memory once @c user_vec
-       * crosses USER_SPACE_END mid-array, leaking those bytes into the new
-       * process via @c store[n]. */
-      if(!user_buf_ok((u64)&user_vec[n], sizeof(char *)))
-        return -EFAULT;
-      char *p = user_vec[n];
-      if(!p)
-        break;
-      if(!user_cstr_ok((u64)p))
-        return -EFAULT;
-      kstrncpy(store[n], p, MAX_ARG_LEN);
-      store[n][MAX_ARG_LEN - 1] = '\0';
-      ptrs[n]                   = store[n];
-    }
+  for(u32 i = 0; i < count; i++) {
+    const char *p;
+    if(copy_from_user(&p, &user_vec[i], sizeof(p)) < 0)
+      return NULL;
+    i64 len = p ? strncpy_from_user(dst, p, (u64)(end - dst)) : -EFAULT;
+    if(len < 0)
+      return NULL;
+    dst += len + 1;
+  }
+  return dst;
+}
+
+/**
+ * @brief Pack the user argv and envp vectors of an exec of @p name into
+ *        one kernel block; with no argv, argv is just @p name.
+ *
+ * @return 0 with @c args->strings kmalloc'd (the caller frees it), or
+ *         @c -EFAULT, @c -E2BIG, @c -ENOMEM.
+ */
+static i64 user_args_pack(
+    const char *name, char *const *uargv, char *const *uenvp,
+    proc_args_t *args
+)
+{
+  *args  = (proc_args_t){.strings = NULL, .size = 0, .argc = 0, .envc = 0};
+  i64 rc = user_strvec_size(uargv, &args->argc, &args->size);
+  if(rc == 0)
+    rc = user_strvec_size(uenvp, &args->envc, &args->size);
+  if(rc == 0 && args->argc == 0) {
+    /* No argv: the new image gets argv[0] = path. */
+    args->size += kstrlen(name) + 1;
+    if(args->size + (u64)(args->envc + 1) * sizeof(char *) > PROC_ARG_MAX)
+      rc = -E2BIG;
+  }
+  if(rc < 0)
+    return rc;
+
+  args->strings = kmalloc(args->size ? args->size : 1);
+  if(!args->strings)
+    return -ENOMEM;
+
+  char       *dst = args->strings;
+  const char *end = args->strings + args->size;
+  if(args->argc == 0) {
+    u64 len = kstrlen(name) + 1;
+    kmemcpy(dst, name, len);
+    dst += len;
+    args->argc = 1;
+  } else {
+    dst = copy_user_strvec(uargv, args->argc, dst, end);
+  }
+  if(!dst || !copy_user_strvec(uenvp, args->envc, dst, end)) {
+    kfree(args->strings);
+    args->strings = NULL;
+    return -EFAULT;
   }
-  ptrs[n]    = NULL;
-  *out_count = n;
   return 0;
 }
 
@@ -149,10 +232,29 @@ u64 sys_fork(u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
   return (u64)proc_fork(frame);
 }
 
+/**
+ * @brief Start a child on the caller's memory and stack (@c vfork); the
+ *        caller resumes once the child execs or exits.
+ */
+u64 sys_vfork(u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a1;
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  const syscall_frame_t *frame = syscall_get_current_frame();
+  if(!frame)
+    return (u64)-EINVAL;
+  return (u64)proc_clone(frame, 0, ALCOR_CLONE_VM | ALCOR_CLONE_VFORK);
+}
+
 /**
  * @brief Replace the calling process image with a new ELF at @p pathname.
  *
- * Copies argv and envp into kernel heap buffers, opens the target file via
+ * Packs argv and envp into one kernel buffer, opens the target file via
  * the VFS, loads it into the current process, closes O_CLOEXEC fds, wakes
  * any vfork-blocked parent, and redirects the in-flight syscall return frame
  * to the new entry point.
@@ -163,62 +265,31 @@ u64 sys_execve(u64 pathname, u64 argv, u64 envp, u64 a4, u64 a5, u64 a6)
   (void)a5;
   (void)a6;
 
-  if(!user_cstr_ok(pathname))
-    return (u64)-EFAULT;
-  const char *path = (const char *)pathname;
-
-  if(argv && !user_buf_ok(argv, sizeof(char *)))
-    return (u64)-EFAULT;
-  if(envp && !user_buf_ok(envp, sizeof(char *)))
-    return (u64)-EFAULT;
+  /* The path and strings live in the old image, which exec destroys (or,
+   * for a vfork child, hands back), so they are copied first: the path to
+   * the stack, argv and envp into one packed block. */
+  char name[PROC_EXE_PATH_MAX];
+  i64  rc_path = -EFAULT;
+  if(pathname)
+    rc_path = strncpy_from_user(name, (const char *)pathname, sizeof(name));
+  if(rc_path < 0)
+    return (u64)rc_path;
 
   vfs_stat_t st;
-  if(vfs_stat(path, &st) < 0)
+  if(vfs_stat(name, &st) < 0)
     return (u64)-ENOENT;
   if(st.type != VFS_FILE)
     return (u64)-EACCES;
 
-  /* All five scratch buffers are freed at the single @c out: label so the
-   * function has one cleanup path instead of five copies of five kfrees. */
-  char(*arg_storage)[MAX_ARG_LEN] = kmalloc((u64)MAX_EXEC_ARGS * MAX_ARG_LEN);
-  char **new_argv = kmalloc((u64)(MAX_EXEC_ARGS + 1) * sizeof(char *));
-  char(*env_storage)[MAX_ARG_LEN] = kmalloc((u64)MAX_EXEC_ARGS * MAX_ARG_LEN);
-  char **new_envp     = kmalloc((u64)(MAX_EXEC_ARGS + 1) * sizeof(char *));
-  char  *name_storage = kmalloc(MAX_ARG_LEN);
+  proc_args_t args;
+  i64         rc_pack = user_args_pack(
+      name, (char *const *)argv, (char *const *)envp, &args
+  );
+  if(rc_pack < 0)
+    return (u64)rc_pack;
 
-  u64    rc_u = 0;
-  i64    fd   = -1;
-
-  if(!arg_storage || !new_argv || !env_storage || !new_envp || !name_storage) {
-    rc_u = (u64)-ENOMEM;
-    goto out;
-  }
-
-  int argc = 0, envc = 0;
-
-  i64 rc_argv = copy_user_strvec((char **)argv, arg_storage, new_argv, &argc);
-  if(rc_argv < 0) {
-    rc_u = (u64)rc_argv;
-    goto out;
-  }
-  if(argc == 0) {
-    kstrncpy(arg_storage[0], path, MAX_ARG_LEN);
-    arg_storage[0][MAX_ARG_LEN - 1] = '\0';
-    new_argv[0]                     = arg_storage[0];
-    new_argv[1]                     = NULL;
-    argc                            = 1;
-  }
-
-  i64 rc_envp = copy_user_strvec((char **)envp, env_storage, new_envp, &envc);
-  if(rc_envp < 0) {
-    rc_u = (u64)rc_envp;
-    goto out;
-  }
-
-  kstrncpy(name_storage, path, MAX_ARG_LEN);
-  name_storage[MAX_ARG_LEN - 1] = '\0';
-
-  fd = vfs_open(path, 0);
+  u64 rc_u = 0;
+  i64 fd   = vfs_open(name, 0);
   if(fd < 0) {
     rc_u = (u64)-ENOENT;
     goto out;
@@ -230,11 +301,13 @@ u64 sys_execve(u64 pathname, u64 argv, u64 envp, u64 a4, u64 a5, u64 a6)
     goto out;
   }
 
-  i64 rc = proc_exec_replace_image(p, name_storage, fd, new_argv, new_envp);
+  i64 rc = proc_exec_replace_image(p, name, fd, &args);
   vfs_close(fd);
   fd = -1;
-  if(rc < 0)
+  if(rc < 0) {
+    kfree(args.strings);
     proc_exit(127);
+  }
 
   /* Close O_CLOEXEC fds, then wake any vfork-blocked parent. */
   vfs_proc_close_cloexec_fds();
@@ -251,14 +324,184 @@ u64 sys_execve(u64 pathname, u64 argv, u64 envp, u64 a4, u64 a5, u64 a6)
 out:
   if(fd >= 0)
     vfs_close(fd);
-  kfree(arg_storage);
-  kfree(new_argv);
-  kfree(env_storage);
-  kfree(new_envp);
-  kfree(name_storage);
+  kfree(args.strings);
   return rc_u;
 }
 
+static void spawn_put(spawn_template_t *t)
+{
+  if(--t->refs)
+    return;
+  proc_template_free(t->image);
+  kfree(t);
+}
+
+/* Slot of the template of the file @p st describes, or -1. */
+static int spawn_find(const vfs_stat_t *st)
+{
+  for(int i = 0; i < ALCOR_SPAWN_TEMPLATES; i++) {
+    const spawn_template_t *t = spawn_slots[i];
+    if(t && t->dev == st->dev && t->ino == st->ino)
+      return i;
+  }
+  return -1;
+}
+
+static bool spawn_fresh(const spawn_template_t *t, const vfs_stat_t *st)
+{
+  return t->size == st->size && t->modified == st->modified;
+}
+
+static void spawn_drop_slot(int i)
+{
+  spawn_put(spawn_slots[i]);
+  spawn_slots[i] = NULL;
+}
+
+/* Load a template of @p name unless a current one is cached. */
+static i64 spawn_warm(const char *name)
+{
+  vfs_stat_t st;
+  if(vfs_stat(name, &st) < 0)
+    return -ENOENT;
+  if(st.type != VFS_FILE)
+    return -EACCES;
+  int slot = spawn_find(&st);
+  if(slot >= 0 && spawn_fresh(spawn_slots[slot], &st)) {
+    spawn_slots[slot]->used = ++spawn_clock;
+    return 0;
+  }
+
+  spawn_template_t *t = kzalloc(sizeof(*t));
+  if(!t)
+    return -ENOMEM;
+  t->image = proc_template_load(name, SPAWN_PREFAULT, &t->aux);
+  if(!t->image) {
+    kfree(t);
+    return -ENOEXEC;
+  }
+  t->dev      = st.dev;
+  t->ino      = st.ino;
+  t->size     = st.size;
+  t->modified = st.modified;
+  t->used     = ++spawn_clock;
+  t->refs     = 1;
+
+  /* Loading slept: look again, another warm may have filled the table. */
+  slot = spawn_find(&st);
+  if(slot < 0) {
+    slot = 0;
+    for(int i = 0; i < ALCOR_SPAWN_TEMPLATES; i++) {
+      if(!spawn_slots[i]) {
+        slot = i;
+        break;
+      }
+      if(spawn_slots[i]->used < spawn_slots[slot]->used)
+        slot = i;
+    }
+  }
+  if(spawn_slots[slot])
+    spawn_drop_slot(slot);
+  spawn_slots[slot] = t;
+  return 0;
+}
+
+/* Start the template of @p name as @p ureq asks; -ENOENT without one. */
+static i64 spawn_run(const char *name, const alcor_spawn_req_t *ureq)
+{
+  alcor_spawn_req_t req;
+  if(copy_from_user(&req, ureq, sizeof(req)) < 0)
+    return -EFAULT;
+  if(req.flags || req.nfds > ALCOR_SPAWN_MAX_FDS)
+    return -EINVAL;
+  vfs_fd_action_t acts[ALCOR_SPAWN_MAX_FDS];
+  if(req.nfds && copy_from_user(
+                     acts, (const void *)req.fds, req.nfds * sizeof(acts[0])
+                 ) < 0)
+    return -EFAULT;
+
+  /* Everything that may sleep comes before the lookup. */
+  proc_args_t args;
+  i64         rc = user_args_pack(
+      name, (char *const *)req.argv, (char *const *)req.envp, &args
+  );
+  if(rc < 0)
+    return rc;
+  vfs_stat_t st;
+  int        slot = vfs_stat(name, &st) < 0 ? -1 : spawn_find(&st);
+  if(slot >= 0 && !spawn_fresh(spawn_slots[slot], &st)) {
+    spawn_drop_slot(slot);
+    slot = -1;
+  }
+  if(slot < 0) {
+    kfree(args.strings);
+    return -ENOENT;
+  }
+
+  spawn_template_t *t = spawn_slots[slot];
+  t->used             = ++spawn_clock;
+  t->refs++;
+  rc = proc_spawn(t->image, &t->aux, &args, acts, req.nfds);
+  spawn_put(t);
+  kfree(args.strings);
+  return rc;
+}
+
+/* Free the template of @p name, or every one when @p name is NULL. */
+static i64 spawn_drop(const char *name)
+{
+  if(!name) {
+    for(int i = 0; i < ALCOR_SPAWN_TEMPLATES; i++) {
+      if(spawn_slots[i])
+        spawn_drop_slot(i);
+    }
+    return 0;
+  }
+  vfs_stat_t st;
+  int        slot = vfs_stat(name, &st) < 0 ? -1 : spawn_find(&st);
+  if(slot < 0)
+    return -ENOENT;
+  spawn_drop_slot(slot);
+  return 0;
+}
+
+/**
+ * @brief Manage and run program templates (see alcor_spawn.h).
+ *
+ * @param op ::ALCOR_SPAWN_WARM, ::ALCOR_SPAWN_RUN or ::ALCOR_SPAWN_DROP.
+ * @param path The program; NULL for DROP means every template.
+ * @param req RUN: an ::alcor_spawn_req_t.
+ * @return RUN: PID of the child. Otherwise 0. @c -ENOENT when RUN or DROP
+ *         find no current template, @c -ENOEXEC if WARM cannot load the
+ *         file, @c -EBADF for a bad fd action, @c -EINVAL, @c -EFAULT.
+ */
+u64 sys_alcor_spawn(u64 op, u64 path, u64 req, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  char name[PROC_EXE_PATH_MAX];
+  if(path) {
+    i64 rc = strncpy_from_user(name, (const char *)path, sizeof(name));
+    if(rc < 0)
+      return (u64)rc;
+  } else if(op != ALCOR_SPAWN_DROP) {
+    return (u64)-EFAULT;
+  }
+
+  switch(op) {
+  case ALCOR_SPAWN_WARM:
+    return (u64)spawn_warm(name);
+  case ALCOR_SPAWN_RUN:
+    return (u64)spawn_run(name, (const alcor_spawn_req_t *)req);
+  case ALCOR_SPAWN_DROP:
+    return (u64)spawn_drop(path ? name : NULL);
+  default:
+    return (u64)-EINVAL;
+  }
+}
+
 /** @brief Terminate the calling process with @p status. */
 u64 sys_exit(u64 status, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
 {
@@ -277,31 +520,180 @@ u64 sys_exit_group(u64 status, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
   return sys_exit(status, a2, a3, a4, a5, a6);
 }
 
+/** @name getrusage targets (Linux ABI)
+ * @{ */
+#define RUSAGE_SELF     0
+#define RUSAGE_CHILDREN (-1)
+#define RUSAGE_THREAD   1
+/** @} */
+
+/** @brief Clock ticks per second of @c times (Linux USER_HZ). */
+#define TIMES_HZ 100
+
+/** @brief Linux @c struct @c timeval. */
+struct k_timeval
+{
+  i64 tv_sec;
+  i64 tv_usec;
+};
+
+/** @brief Linux @c struct @c rusage; fields not kept here read 0. */
+struct k_rusage
+{
+  struct k_timeval ru_utime;
+  struct k_timeval ru_stime;
+  i64              ru_maxrss; /**< kB */
+  i64              ru_ixrss;
+  i64              ru_idrss;
+  i64              ru_isrss;
+  i64              ru_minflt;
+  i64              ru_majflt;
+  i64              ru_nswap;
+  i64              ru_inblock;
+  i64              ru_oublock;
+  i64              ru_msgsnd;
+  i64              ru_msgrcv;
+  i64              ru_nsignals;
+  i64              ru_nvcsw;
+  i64              ru_nivcsw;
+};
+
+/** @brief Linux @c struct @c tms, in ::TIMES_HZ ticks. */
+struct k_tms
+{
+  i64 tms_utime;
+  i64 tms_stime;
+  i64 tms_cutime;
+  i64 tms_cstime;
+};
+
+static struct k_timeval ns_to_timeval(u64 ns)
+{
+  struct k_timeval tv = {
+      .tv_sec  = (i64)(ns / NSEC_PER_SEC),
+      .tv_usec = (i64)(ns % NSEC_PER_SEC / NSEC_PER_USEC),
+  };
+  return tv;
+}
+
+static i64 ns_to_times_ticks(u64 ns)
+{
+  return (i64)(ns / (NSEC_PER_SEC / TIMES_HZ));
+}
+
+/* Copy @p u out to user @p dst as a Linux rusage. */
+static i64 rusage_to_user(u64 dst, const proc_usage_t *u)
+{
+  struct k_rusage ru;
+  kzero(&ru, sizeof(ru));
+  ru.ru_utime   = ns_to_timeval(u->runtime - u->stime);
+  ru.ru_stime   = ns_to_timeval(u->stime);
+  ru.ru_maxrss  = (i64)(u->maxrss * (PAGE_SIZE / 1024));
+  ru.ru_minflt  = (i64)u->minflt;
+  ru.ru_majflt  = (i64)u->majflt;
+  ru.ru_inblock = (i64)u->inblock;
+  ru.ru_oublock = (i64)u->oublock;
+  ru.ru_nvcsw   = (i64)u->nvcsw;
+  ru.ru_nivcsw  = (i64)u->nivcsw;
+  return copy_to_user((void *)dst, &ru, sizeof(ru));
+}
+
 /**
  * @brief Wait for a child process to change state (@c wait4).
  *
- * Delegates to ::proc_waitpid.  @p wstatus is written only when non-NULL and
- * the call returns a valid child PID.  @p rusage is ignored.
+ * Delegates to ::proc_waitpid.  @p wstatus and @p rusage are written only
+ * when non-NULL and the call returns a valid child PID; the usage is the
+ * child's own plus that of the children it reaped.
  */
 u64 sys_wait4(u64 pid, u64 wstatus, u64 options, u64 rusage, u64 a5, u64 a6)
 {
-  (void)rusage;
   (void)a5;
   (void)a6;
 
-  i32  kstatus     = 0;
-  i32 *kstatus_ptr = wstatus ? &kstatus : NULL;
+  i32           kstatus     = 0;
+  i32          *kstatus_ptr = wstatus ? &kstatus : NULL;
+  proc_usage_t  usage;
+  proc_usage_t *usage_ptr = rusage ? &usage : NULL;
 
-  i64  ret = proc_waitpid((i64)pid, kstatus_ptr, (i32)options);
-  if(ret > 0 && wstatus) {
-    if(!user_buf_ok(wstatus, sizeof(i32)))
-      return (u64)-EFAULT;
-    *(i32 *)wstatus = kstatus;
-  }
+  i64 ret = proc_waitpid((i64)pid, kstatus_ptr, (i32)options, usage_ptr);
+  if(ret > 0 && wstatus &&
+     copy_to_user((void *)wstatus, &kstatus, sizeof(kstatus)) < 0)
+    return (u64)-EFAULT;
+  if(ret > 0 && rusage && rusage_to_user(rusage, &usage) < 0)
+    return (u64)-EFAULT;
 
   return (u64)ret;
 }
 
+/**
+ * @brief Report resources used (@c getrusage).
+ *
+ * @c RUSAGE_THREAD is the same as @c RUSAGE_SELF: every process has one
+ * thread. @c RUSAGE_CHILDREN covers the children reaped so far and theirs.
+ */
+u64 sys_getrusage(u64 who, u64 usage, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-ESRCH;
+
+  proc_usage_t u;
+  switch((i64)(i32)who) {
+  case RUSAGE_SELF:
+  case RUSAGE_THREAD:
+    proc_usage(p, &u);
+    break;
+  case RUSAGE_CHILDREN:
+    u = p->cusage;
+    break;
+  default:
+    return (u64)-EINVAL;
+  }
+  if(rusage_to_user(usage, &u) < 0)
+    return (u64)-EFAULT;
+  return 0;
+}
+
+/**
+ * @brief Process and reaped-children CPU times (@c times).
+ *
+ * @p buf may be NULL. Returns the ticks since boot, a value only useful
+ * for taking differences, as on Linux.
+ */
+u64 sys_times(u64 buf, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-ESRCH;
+
+  if(buf) {
+    proc_usage_t        u;
+    const proc_usage_t *c = &p->cusage;
+    proc_usage(p, &u);
+
+    struct k_tms t = {
+        .tms_utime  = ns_to_times_ticks(u.runtime - u.stime),
+        .tms_stime  = ns_to_times_ticks(u.stime),
+        .tms_cutime = ns_to_times_ticks(c->runtime - c->stime),
+        .tms_cstime = ns_to_times_ticks(c->stime),
+    };
+    if(copy_to_user((void *)buf, &t, sizeof(t)) < 0)
+      return (u64)-EFAULT;
+  }
+  return (u64)ns_to_times_ticks(time_monotonic_ns());
+}
+
 /** @brief Return the calling process's real user ID (always 0 — root). */
 u64 sys_getuid(u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 a6)
 {
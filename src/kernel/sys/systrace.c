@@ -0,0 +1,193 @@
+/**
+ * @file src/kernel/sys/systrace.c
+ * @brief Per-syscall counts and log2 latency histograms.
+ *
+ * Global statistics are indexed by syscall number. Per-process tables are
+ * smaller: syscall numbers get a slot the first time anyone makes them
+ * while tracing, and every process table is indexed by slot. A global
+ * reset bumps a generation number instead of visiting every process; a
+ * table from an older generation reads as empty and is zeroed on its next
+ * update.
+ */
+
+#include <alcor2/alcor_systrace.h>
+#include <alcor2/errno.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/sys/internal.h>
+#include <alcor2/sys/syscall.h>
+#include <alcor2/sys/systrace.h>
+
+/** @brief Distinct syscalls a process table can tell apart. */
+#define SYSTRACE_SLOTS 128
+
+/** @brief Statistics of one syscall. */
+typedef struct
+{
+  u64 count;
+  u64 cycles;
+  u64 min;
+  u64 max;
+  u32 hist[ALCOR_SYSTRACE_BUCKETS];
+} systrace_stat_t;
+
+/** @brief Statistics of one process, indexed by slot. */
+struct systrace_proc
+{
+  u64             gen; /**< ::systrace_gen the table belongs to. */
+  systrace_stat_t stat[SYSTRACE_SLOTS];
+};
+
+bool systrace_enabled;
+
+static systrace_stat_t global_stat[SYS_MAX];
+static u8              slot_of[SYS_MAX]; /**< Slot + 1, 0 = none yet. */
+static u16             slot_nr[SYSTRACE_SLOTS];
+static u32             nr_slots;
+static u64             systrace_gen;
+
+static void stat_add(systrace_stat_t *st, u64 cycles)
+{
+  u32 b = cycles ? 63 - (u32)__builtin_clzll(cycles) : 0;
+  if(b >= ALCOR_SYSTRACE_BUCKETS)
+    b = ALCOR_SYSTRACE_BUCKETS - 1;
+
+  if(!st->count || cycles < st->min)
+    st->min = cycles;
+  if(cycles > st->max)
+    st->max = cycles;
+  st->count++;
+  st->cycles += cycles;
+  st->hist[b]++;
+}
+
+/** @brief Slot of syscall @p nr, assigning one if needed; -1 when full. */
+static i32 slot_get(u64 nr)
+{
+  if(slot_of[nr])
+    return slot_of[nr] - 1;
+  if(nr_slots == SYSTRACE_SLOTS)
+    return -1;
+  slot_nr[nr_slots] = (u16)nr;
+  slot_of[nr]       = (u8)++nr_slots;
+  return (i32)nr_slots - 1;
+}
+
+void systrace_record(proc_t *p, u64 nr, u64 cycles)
+{
+  stat_add(&global_stat[nr], cycles);
+  if(!p)
+    return;
+
+  if(!p->systrace) {
+    p->systrace = kzalloc(sizeof(*p->systrace));
+    if(!p->systrace)
+      return;
+    p->systrace->gen = systrace_gen;
+  } else if(p->systrace->gen != systrace_gen) {
+    kzero(p->systrace, sizeof(*p->systrace));
+    p->systrace->gen = systrace_gen;
+  }
+
+  i32 slot = slot_get(nr);
+  if(slot >= 0)
+    stat_add(&p->systrace->stat[slot], cycles);
+}
+
+void systrace_proc_exit(proc_t *p)
+{
+  kfree(p->systrace);
+  p->systrace = NULL;
+}
+
+static void entry_fill(
+    alcor_systrace_entry_t *out, u64 nr, const systrace_stat_t *st
+)
+{
+  out->nr     = nr;
+  out->count  = st->count;
+  out->cycles = st->cycles;
+  out->min    = st->min;
+  out->max    = st->max;
+  kmemcpy(out->hist, st->hist, sizeof(out->hist));
+}
+
+/**
+ * @brief Copy the statistics of @p pid (0 = global) to @p out.
+ * @return Entries written: one per syscall made, at most @p cap.
+ */
+static i64 systrace_read(u64 pid, alcor_systrace_entry_t *out, u64 cap)
+{
+  u64 n = 0;
+  if(pid == 0) {
+    for(u64 nr = 0; nr < SYS_MAX && n < cap; nr++) {
+      if(global_stat[nr].count)
+        entry_fill(&out[n++], nr, &global_stat[nr]);
+    }
+    return (i64)n;
+  }
+
+  proc_t *p = proc_get(pid);
+  if(!p)
+    return -ESRCH;
+  const struct systrace_proc *t = p->systrace;
+  if(!t || t->gen != systrace_gen)
+    return 0;
+  for(u32 s = 0; s < nr_slots && n < cap; s++) {
+    if(t->stat[s].count)
+      entry_fill(&out[n++], slot_nr[s], &t->stat[s]);
+  }
+  return (i64)n;
+}
+
+/**
+ * @brief Control syscall tracing or read its statistics.
+ *
+ * @param op    ::ALCOR_SYSTRACE_ON, ::ALCOR_SYSTRACE_OFF,
+ *              ::ALCOR_SYSTRACE_RESET or ::ALCOR_SYSTRACE_READ.
+ * @param pid   Process for RESET / READ; 0 means all (RESET) or the global
+ *              totals (READ).
+ * @param buf   READ: array of ::alcor_systrace_entry_t.
+ * @param count READ: capacity of @p buf in entries.
+ * @return READ: entries written; otherwise 0. @c -ESRCH for an unknown pid.
+ */
+u64 sys_alcor_systrace(u64 op, u64 pid, u64 buf, u64 count, u64 a5, u64 a6)
+{
+  (void)a5;
+  (void)a6;
+
+  switch(op) {
+  case ALCOR_SYSTRACE_OFF:
+  case ALCOR_SYSTRACE_ON:
+    systrace_enabled = op == ALCOR_SYSTRACE_ON;
+    return 0;
+
+  case ALCOR_SYSTRACE_RESET:
+    if(pid == 0) {
+      kzero(global_stat, sizeof(global_stat));
+      systrace_gen++;
+      return 0;
+    }
+    {
+      proc_t *p = proc_get(pid);
+      if(!p)
+        return (u64)-ESRCH;
+      if(p->systrace)
+        kzero(p->systrace->stat, sizeof(p->systrace->stat));
+    }
+    return 0;
+
+  case ALCOR_SYSTRACE_READ:
+    if(count > SYS_MAX)
+      count = SYS_MAX;
+    if(!buf ||
+       !vmm_is_user_range((void *)buf, count * sizeof(alcor_systrace_entry_t)))
+      return (u64)-EFAULT;
+    return (u64)systrace_read(pid, (alcor_systrace_entry_t *)buf, count);
+
+  default:
+    return (u64)-EINVAL;
+  }
+}
@@ -0,0 +1,243 @@
+/**
+ * @file src/kernel/sys/timerfd.c
+ * @brief timerfd: a kernel timer whose expirations are read from a fd.
+ *
+ * A timerfd lives in the open file table as a ::VFS_KIND_TIMERFD entry and
+ * owns a ::ktimer_t. Each expiration adds one to a counter and, for an
+ * interval timer, re-arms the timer from the interrupt; read() takes the
+ * counter, blocking while it is zero. Deadlines are kept on the monotonic
+ * clock; a CLOCK_REALTIME timer is converted when it is set.
+ */
+
+#include <alcor2/errno.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/sys/internal.h>
+#include <alcor2/time.h>
+#include <alcor2/timer.h>
+
+/** @name timerfd ABI (Linux x86_64)
+ * @{ */
+#define CLOCK_REALTIME          0
+#define CLOCK_MONOTONIC         1
+#define CLOCK_BOOTTIME          7
+#define TFD_NONBLOCK            0x00800U
+#define TFD_CLOEXEC             O_CLOEXEC
+#define TFD_TIMER_ABSTIME       1U
+#define TFD_TIMER_CANCEL_ON_SET 2U
+/** @} */
+
+/** @brief struct itimerspec. */
+typedef struct
+{
+  i64 interval_sec;
+  i64 interval_nsec;
+  i64 value_sec;
+  i64 value_nsec;
+} itimerspec_abi_t;
+
+static inline bool user_buf_ok(u64 ptr, u64 size)
+{
+  return ptr && vmm_is_user_range((void *)ptr, size);
+}
+
+/** @brief A timerfd (the @c obj of a ::VFS_KIND_TIMERFD entry). */
+typedef struct
+{
+  ktimer_t     timer;    /**< Next expiration. */
+  u64          interval; /**< Period in ns, 0 for a one-shot timer. */
+  u64          ticks;    /**< Expirations not yet read. */
+  i32          clock;    /**< Clock the timer was created on. */
+  u32          flags;    /**< TFD_NONBLOCK. */
+  wait_queue_t waiters;  /**< Blocked readers and pollers. */
+} timerfd_t;
+
+/** @brief Timer callback: count the expiration and re-arm an interval. */
+static void tfd_expire(ktimer_t *t)
+{
+  timerfd_t *tfd = (timerfd_t *)t->arg;
+  tfd->ticks++;
+  if(tfd->interval) {
+    /* Count the periods missed while interrupts were off, too. */
+    u64 now  = time_monotonic_ns();
+    u64 next = t->expires + tfd->interval;
+    if(next <= now) {
+      u64 missed = (now - next) / tfd->interval + 1;
+      tfd->ticks += missed;
+      next += missed * tfd->interval;
+    }
+    timer_arm(t, next);
+  }
+  wait_wake_all(&tfd->waiters);
+}
+
+u32 timerfd_poll(void *obj, poll_table_t *pt)
+{
+  timerfd_t *tfd = (timerfd_t *)obj;
+  poll_wait(pt, &tfd->waiters);
+  return tfd->ticks ? VFS_POLL_IN : 0;
+}
+
+i64 timerfd_read_obj(void *obj, void *buf, u64 count)
+{
+  timerfd_t *tfd = (timerfd_t *)obj;
+  if(count < sizeof(u64))
+    return -EINVAL;
+
+  while(!tfd->ticks) {
+    if(tfd->flags & TFD_NONBLOCK)
+      return -EAGAIN;
+    if(wait_sleep_until(&tfd->waiters, 0, 0) == -EINTR)
+      return -EINTR;
+  }
+
+  *(u64 *)buf = tfd->ticks;
+  tfd->ticks  = 0;
+  return sizeof(u64);
+}
+
+void timerfd_oft_release(void *obj)
+{
+  timerfd_t *tfd = (timerfd_t *)obj;
+  timer_cancel(&tfd->timer);
+  kfree(tfd);
+}
+
+/** @brief The timerfd behind @p fd, or NULL. */
+static timerfd_t *tfd_from_fd(i64 fd)
+{
+  i32 idx = vfs_fd_to_oft(fd);
+  if(idx < 0)
+    return NULL;
+  const vfs_oft_entry_t *e = vfs_oft_get(idx);
+  return e && e->kind == VFS_KIND_TIMERFD ? e->obj : NULL;
+}
+
+/** @brief Seconds and nanoseconds to ns; false if out of range. */
+static bool tfd_ns(i64 sec, i64 nsec, u64 *ns)
+{
+  if(sec < 0 || nsec < 0 || nsec >= (i64)NSEC_PER_SEC)
+    return false;
+  *ns = (u64)sec * NSEC_PER_SEC + (u64)nsec;
+  return true;
+}
+
+/** @brief Store the remaining time and interval of @p tfd in @p out. */
+static void tfd_get(const timerfd_t *tfd, itimerspec_abi_t *out)
+{
+  u64 left = 0;
+  if(timer_pending(&tfd->timer)) {
+    u64 now = time_monotonic_ns();
+    left    = tfd->timer.expires > now ? tfd->timer.expires - now : 1;
+  }
+  out->interval_sec  = (i64)(tfd->interval / NSEC_PER_SEC);
+  out->interval_nsec = (i64)(tfd->interval % NSEC_PER_SEC);
+  out->value_sec     = (i64)(left / NSEC_PER_SEC);
+  out->value_nsec    = (i64)(left % NSEC_PER_SEC);
+}
+
+u64 sys_timerfd_create(u64 clockid, u64 flags, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC &&
+     clockid != CLOCK_BOOTTIME)
+    return (u64)-EINVAL;
+  if((u32)flags & ~(TFD_NONBLOCK | TFD_CLOEXEC))
+    return (u64)-EINVAL;
+  proc_t *p = proc_current();
+  if(!p)
+    return (u64)-EINVAL;
+
+  timerfd_t *tfd = kzalloc(sizeof(*tfd));
+  if(!tfd)
+    return (u64)-ENOMEM;
+  timer_init(&tfd->timer, tfd_expire, tfd);
+  tfd->clock = (i32)clockid;
+  tfd->flags = (u32)flags & TFD_NONBLOCK;
+
+  i32 oft = vfs_oft_alloc_obj(VFS_KIND_TIMERFD, tfd);
+  if(oft < 0) {
+    kfree(tfd);
+    return (u64)-ENFILE;
+  }
+  i64 fd = vfs_install_fd(oft);
+  if(fd < 0) {
+    vfs_oft_release(oft);
+    return (u64)fd;
+  }
+  if((u32)flags & TFD_CLOEXEC)
+    p->fd_cloexec[fd] = 1;
+  return (u64)fd;
+}
+
+/**
+ * @brief Arm or disarm a timerfd.
+ *
+ * A zero @c it_value disarms. With TFD_TIMER_ABSTIME @c it_value is a time
+ * on the timer's clock, else it is relative to now. Pending expirations
+ * are discarded. TFD_TIMER_CANCEL_ON_SET is accepted, but the realtime
+ * clock is never set, so it has no effect.
+ */
+u64 sys_timerfd_settime(
+    u64 fd, u64 flags, u64 new_value, u64 old_value, u64 a5, u64 a6
+)
+{
+  (void)a5;
+  (void)a6;
+
+  if((u32)flags & ~(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET))
+    return (u64)-EINVAL;
+  timerfd_t *tfd = tfd_from_fd((i64)fd);
+  if(!tfd)
+    return vfs_fd_is_valid((i64)fd) ? (u64)-EINVAL : (u64)-EBADF;
+  if(!user_buf_ok(new_value, sizeof(itimerspec_abi_t)) ||
+     (old_value && !user_buf_ok(old_value, sizeof(itimerspec_abi_t))))
+    return (u64)-EFAULT;
+
+  const itimerspec_abi_t *its = (const itimerspec_abi_t *)new_value;
+  u64                     value, interval;
+  if(!tfd_ns(its->value_sec, its->value_nsec, &value) ||
+     !tfd_ns(its->interval_sec, its->interval_nsec, &interval))
+    return (u64)-EINVAL;
+
+  if(old_value)
+    tfd_get(tfd, (itimerspec_abi_t *)old_value);
+
+  timer_cancel(&tfd->timer);
+  tfd->ticks    = 0;
+  tfd->interval = interval;
+  if(!value)
+    return 0;
+
+  u64 now = time_monotonic_ns();
+  if(!((u32)flags & TFD_TIMER_ABSTIME))
+    value += now;
+  else if(tfd->clock == CLOCK_REALTIME)
+    value -= time_realtime_ns() - now;
+  /* A deadline already past expires on the next timer interrupt. */
+  timer_arm(&tfd->timer, (i64)value < (i64)now ? now : value);
+  return 0;
+}
+
+u64 sys_timerfd_gettime(u64 fd, u64 cur_value, u64 a3, u64 a4, u64 a5, u64 a6)
+{
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  timerfd_t *tfd = tfd_from_fd((i64)fd);
+  if(!tfd)
+    return vfs_fd_is_valid((i64)fd) ? (u64)-EINVAL : (u64)-EBADF;
+  if(!user_buf_ok(cur_value, sizeof(itimerspec_abi_t)))
+    return (u64)-EFAULT;
+  tfd_get(tfd, (itimerspec_abi_t *)cur_value);
+  return 0;
+}
@@ -0,0 +1,248 @@
+/**
+ * @file src/kernel/sys/trace.c
+ * @brief Static tracepoints and the ring their events go to.
+ *
+ * The ring overwrites: a writer claims the next sequence number with one
+ * atomic add, fills the slot and publishes it by storing the number + 1
+ * in the slot, so writers never wait for one another or for the reader.
+ * The reader checks that number before and after copying a slot out and
+ * skips slots a writer has claimed again since. Writers on every CPU share
+ * the one ring; the @c cpu field tells them apart.
+ *
+ * Sites are patched from the syscall, which runs with interrupts off and
+ * under the kernel lock, so no CPU runs a tracepoint while it is half
+ * patched.
+ */
+
+#include <alcor2/alcor_trace.h>
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/smp.h>
+#include <alcor2/errno.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/uaccess.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/sys/internal.h>
+#include <alcor2/sys/trace.h>
+#include <alcor2/time.h>
+
+/** @brief Events kept at most; a power of two. */
+#define TRACE_RING 8192
+
+/** @brief Events copied out per batch in a read. */
+#define TRACE_BATCH 32
+
+#define CR0_WP (1ULL << 16)
+
+/** @brief One tracepoint: its NOP and the branch it jumps to when on. */
+typedef struct
+{
+  i32 code;   /**< The 5-byte NOP, relative to this field. */
+  i32 target; /**< The enabled branch, relative to this field. */
+} trace_site_t;
+
+/** @brief Bounds of the site table, from the linker script. */
+extern const trace_site_t __trace_sites_start[]
+    __attribute__((visibility("hidden")));
+extern const trace_site_t __trace_sites_end[]
+    __attribute__((visibility("hidden")));
+
+/** @brief A ring slot. */
+typedef struct
+{
+  u64                 seq; /**< Sequence number + 1, 0 while being filled. */
+  alcor_trace_event_t ev;
+} trace_slot_t;
+
+/** @brief Category of each event. */
+static const u8 event_cat[ALCOR_TRACE_EVENTS] = {
+    [ALCOR_TRACE_SYSCALL_ENTER]  = ALCOR_TRACE_CAT_SYSCALL,
+    [ALCOR_TRACE_SYSCALL_EXIT]   = ALCOR_TRACE_CAT_SYSCALL,
+    [ALCOR_TRACE_SWITCH]         = ALCOR_TRACE_CAT_SCHED,
+    [ALCOR_TRACE_FAULT_BEGIN]    = ALCOR_TRACE_CAT_FAULT,
+    [ALCOR_TRACE_FAULT_END]      = ALCOR_TRACE_CAT_FAULT,
+    [ALCOR_TRACE_BIO_SUBMIT]     = ALCOR_TRACE_CAT_BLOCK,
+    [ALCOR_TRACE_BIO_DONE]       = ALCOR_TRACE_CAT_BLOCK,
+    [ALCOR_TRACE_ATA_READ]       = ALCOR_TRACE_CAT_BLOCK,
+    [ALCOR_TRACE_ATA_READ_END]   = ALCOR_TRACE_CAT_BLOCK,
+    [ALCOR_TRACE_EXT2_READ]      = ALCOR_TRACE_CAT_FS,
+    [ALCOR_TRACE_EXT2_READ_END]  = ALCOR_TRACE_CAT_FS,
+    [ALCOR_TRACE_PIPE_READ]      = ALCOR_TRACE_CAT_PIPE,
+    [ALCOR_TRACE_PIPE_READ_END]  = ALCOR_TRACE_CAT_PIPE,
+    [ALCOR_TRACE_PIPE_WRITE]     = ALCOR_TRACE_CAT_PIPE,
+    [ALCOR_TRACE_PIPE_WRITE_END] = ALCOR_TRACE_CAT_PIPE,
+};
+
+static const u8 nop5[5] = {0x0F, 0x1F, 0x44, 0x00, 0x00};
+
+static trace_slot_t *ring;
+static u64           head;    /**< Sequence numbers handed out. */
+static u64           tail;    /**< Next sequence number to read. */
+static u64           written; /**< Events since tracing was turned on. */
+static u64           lost;    /**< Overwritten before being read. */
+static u32           trace_mask;
+static bool          patched; /**< Sites jump to their enabled branch. */
+
+/** @brief Rewrite every site as a NOP or as a jump to its branch. */
+static void patch_sites(bool on)
+{
+  if(patched == on)
+    return;
+  u64 cr0;
+  __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+  __asm__ volatile("mov %0, %%cr0" : : "r"(cr0 & ~CR0_WP) : "memory");
+  for(const trace_site_t *s = __trace_sites_start; s < __trace_sites_end;
+      s++) {
+    u8       *code   = (u8 *)&s->code + s->code;
+    const u8 *target = (const u8 *)&s->target + s->target;
+    if(on) {
+      i32 rel = (i32)(target - (code + 5));
+      code[0] = 0xE9;
+      kmemcpy(code + 1, &rel, sizeof(rel));
+    } else {
+      kmemcpy(code, nop5, sizeof(nop5));
+    }
+  }
+  __asm__ volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+  patched = on;
+}
+
+void trace_emit(u32 event, u64 a0, u64 a1, u64 a2)
+{
+  if(event >= ALCOR_TRACE_EVENTS ||
+     !(__atomic_load_n(&trace_mask, __ATOMIC_ACQUIRE) & event_cat[event]))
+    return;
+
+  u64           seq = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+  trace_slot_t *s   = &ring[seq % TRACE_RING];
+  __atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  proc_t *p    = proc_current();
+  s->ev.tsc    = cpu_rdtsc();
+  s->ev.event  = (u16)event;
+  s->ev.cpu    = (u16)smp_cpu_id();
+  s->ev.pid    = p ? (u32)p->pid : 0;
+  s->ev.arg[0] = a0;
+  s->ev.arg[1] = a1;
+  s->ev.arg[2] = a2;
+  __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&written, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Take up to @p max readable events off the ring into @p out.
+ * @return Events taken; fewer than @p max once the reader caught up.
+ */
+static u32 ring_take(alcor_trace_event_t *out, u32 max)
+{
+  u32 n = 0;
+  while(n < max) {
+    u64 h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if(tail == h)
+      break;
+    if(h - tail > TRACE_RING) {
+      lost += h - TRACE_RING - tail;
+      tail  = h - TRACE_RING;
+    }
+
+    const trace_slot_t *s   = &ring[tail % TRACE_RING];
+    u64                 seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if(seq < tail + 1)
+      break; /* Still being written. */
+    out[n] = s->ev;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(seq == tail + 1 &&
+       __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+      n++;
+    else
+      lost++;
+    tail++;
+  }
+  return n;
+}
+
+/**
+ * @brief Move up to @p cap queued events to user buffer @p buf.
+ * @return Events moved, or @c -EFAULT if none could be.
+ */
+static i64 trace_read(alcor_trace_event_t *buf, u64 cap)
+{
+  alcor_trace_event_t batch[TRACE_BATCH];
+  u64                 n = 0;
+  while(n < cap) {
+    u32 want = cap - n < TRACE_BATCH ? (u32)(cap - n) : TRACE_BATCH;
+    u32 got  = ring_take(batch, want);
+    if(got && copy_to_user(&buf[n], batch, got * sizeof(batch[0])) < 0)
+      return n ? (i64)n : -EFAULT;
+    n += got;
+    if(got < want)
+      break;
+  }
+  return (i64)n;
+}
+
+/**
+ * @brief Control kernel tracing or read its events.
+ *
+ * @param op    ::ALCOR_TRACE_ON, ::ALCOR_TRACE_OFF, ::ALCOR_TRACE_READ or
+ *              ::ALCOR_TRACE_INFO.
+ * @param arg   ON: categories (0 = ::ALCOR_TRACE_CAT_ALL). READ: array of
+ *              ::alcor_trace_event_t. INFO: an ::alcor_trace_info_t.
+ * @param count READ: capacity of @p arg in events.
+ * @return READ: events moved; otherwise 0. @c -EINVAL for an unknown
+ *         category, @c -ENOMEM, @c -EFAULT.
+ */
+u64 sys_alcor_trace(u64 op, u64 arg, u64 count, u64 a4, u64 a5, u64 a6)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  switch(op) {
+  case ALCOR_TRACE_ON:
+    if(!arg)
+      arg = ALCOR_TRACE_CAT_ALL;
+    if(arg & ~(u64)ALCOR_TRACE_CAT_ALL)
+      return (u64)-EINVAL;
+    if(!ring) {
+      ring = kzalloc(TRACE_RING * sizeof(*ring));
+      if(!ring)
+        return (u64)-ENOMEM;
+    }
+    /* Start from an empty ring. */
+    tail    = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    written = 0;
+    lost    = 0;
+    __atomic_store_n(&trace_mask, (u32)arg, __ATOMIC_RELEASE);
+    patch_sites(true);
+    return 0;
+
+  case ALCOR_TRACE_OFF:
+    patch_sites(false);
+    __atomic_store_n(&trace_mask, 0, __ATOMIC_RELEASE);
+    return 0;
+
+  case ALCOR_TRACE_READ:
+    if(!ring)
+      return 0;
+    return (u64)trace_read((alcor_trace_event_t *)arg, count);
+
+  case ALCOR_TRACE_INFO: {
+    u64                h    = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    alcor_trace_info_t info = {
+        .tsc_hz  = time_tsc_hz(),
+        .mask    = trace_mask,
+        .written = written,
+        .lost    = lost + (h - tail > TRACE_RING ? h - tail - TRACE_RING : 0),
+        .queued  = h - tail > TRACE_RING ? TRACE_RING : h - tail,
+    };
+    if(copy_to_user((void *)arg, &info, sizeof(info)) < 0)
+      return (u64)-EFAULT;
+    return 0;
+  }
+
+  default:
+    return (u64)-EINVAL;
+  }
+}
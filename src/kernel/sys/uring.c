@@ -0,0 +1,323 @@
+/**
+ * @file src/kernel/sys/uring.c
+ * @brief Submission/completion rings (see alcor2/alcor_uring.h).
+ *
+ * A ring lives in the open file table as a ::VFS_KIND_URING entry whose
+ * object records where the caller's ring block is. The block itself stays
+ * in user memory and is only touched through the uaccess routines, so a
+ * ring that has been unmapped makes enter fail with -EFAULT rather than
+ * fault the kernel; after fork each process reaches its own copy.
+ *
+ * There are no kernel threads, so a batch runs in the enter call: first
+ * every READ at a known offset has its blocks requested from the disk at
+ * once, through the driver's readahead hint, then the entries run in order
+ * through the ordinary syscall handlers and find those blocks arriving or
+ * cached. POLL and TIMEOUT entries that cannot complete at once are kept
+ * pending and rechecked on every enter, which sleeps on their wait queues
+ * and nearest deadline while it waits for completions.
+ */
+
+#include <alcor2/alcor_uring.h>
+#include <alcor2/errno.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/uaccess.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
+#include <alcor2/sys/internal.h>
+#include <alcor2/time.h>
+
+/** @brief Conditions a POLL reports whether asked for or not. */
+#define URING_POLL_ALWAYS (VFS_POLL_ERR | VFS_POLL_HUP)
+
+/** @brief Wait registrations on the stack; more fall back to tick rescans. */
+#define URING_STACK_WAITS 16
+
+/** @brief A POLL or TIMEOUT entry waiting to complete. */
+typedef struct
+{
+  u64 user_data;
+  u64 deadline; /**< TIMEOUT: ::time_monotonic_ns to complete at. */
+  i32 fd;       /**< POLL: descriptor watched. */
+  u32 events;   /**< POLL: ::VFS_POLL_IN and friends asked for. */
+  u8  opcode;
+} uring_pend_t;
+
+/** @brief A ring (the @c obj of a ::VFS_KIND_URING entry). */
+typedef struct
+{
+  u64          base;    /**< User address of the ::alcor_uring_t. */
+  u32          entries; /**< SQ size, a power of two. */
+  u32          npending;
+  uring_pend_t pending[ALCOR_URING_MAX_PENDING];
+} uring_t;
+
+static u64 sqe_addr(const uring_t *r, u32 i)
+{
+  return r->base + sizeof(alcor_uring_t) +
+         (u64)(i & (r->entries - 1)) * sizeof(alcor_uring_sqe_t);
+}
+
+static u64 cqe_addr(const uring_t *r, u32 i)
+{
+  return r->base + sizeof(alcor_uring_t) +
+         (u64)r->entries * sizeof(alcor_uring_sqe_t) +
+         (u64)(i & (2 * r->entries - 1)) * sizeof(alcor_uring_cqe_t);
+}
+
+/** @brief Store @p v in the header field at byte @p field. */
+static int put_u32(const uring_t *r, u64 field, u32 v)
+{
+  return copy_to_user((void *)(r->base + field), &v, sizeof(v));
+}
+
+/** @brief CQEs posted and not yet consumed, or -EFAULT. */
+static i64 cq_ready(const uring_t *r)
+{
+  alcor_uring_t h;
+  if(copy_from_user(&h, (const void *)r->base, sizeof(h)) < 0)
+    return -EFAULT;
+  return (i64)(u32)(h.cq_tail - h.cq_head);
+}
+
+/**
+ * @brief Post one completion.
+ * @return true, or false if the CQ is full or the ring is unreachable.
+ */
+static bool cq_post(const uring_t *r, u64 user_data, i64 res)
+{
+  alcor_uring_t h;
+  if(copy_from_user(&h, (const void *)r->base, sizeof(h)) < 0 ||
+     (u32)(h.cq_tail - h.cq_head) >= 2 * r->entries)
+    return false;
+
+  alcor_uring_cqe_t c = {user_data, res};
+  return copy_to_user((void *)cqe_addr(r, h.cq_tail), &c, sizeof(c)) == 0 &&
+         put_u32(r, offsetof(alcor_uring_t, cq_tail), h.cq_tail + 1) == 0;
+}
+
+/** @brief Run one non-waiting operation through its syscall handler. */
+static i64 run_sqe(const alcor_uring_sqe_t *s)
+{
+  u64 fd = (u64)(i64)s->fd;
+  switch(s->opcode) {
+  case ALCOR_URING_OP_NOP:
+    return 0;
+  case ALCOR_URING_OP_READ:
+    if(s->off == ALCOR_URING_OFF_CUR)
+      return (i64)sys_read(fd, s->addr, s->len, 0, 0, 0);
+    return (i64)sys_pread64(fd, s->addr, s->len, s->off, 0, 0);
+  case ALCOR_URING_OP_WRITE:
+    if(s->off == ALCOR_URING_OFF_CUR)
+      return (i64)sys_write(fd, s->addr, s->len, 0, 0, 0);
+    return (i64)sys_pwrite64(fd, s->addr, s->len, s->off, 0, 0);
+  case ALCOR_URING_OP_OPENAT:
+    return (i64)sys_openat(fd, s->addr, s->op_flags, s->len, 0, 0);
+  case ALCOR_URING_OP_CLOSE:
+    return (i64)sys_close(fd, 0, 0, 0, 0, 0);
+  case ALCOR_URING_OP_STAT:
+    return (i64)sys_newfstatat(fd, s->addr, s->addr2, s->op_flags, 0, 0);
+  case ALCOR_URING_OP_FSYNC:
+    return (i64)sys_fsync(fd, 0, 0, 0, 0, 0);
+  default:
+    return -EINVAL;
+  }
+}
+
+/**
+ * @brief Whether pending entry @p p is done, and its result.
+ * @param pt Poll table to register POLL entries on, or NULL.
+ */
+static bool pend_check(const uring_pend_t *p, poll_table_t *pt, i64 *res)
+{
+  if(p->opcode == ALCOR_URING_OP_TIMEOUT) {
+    *res = -ETIME;
+    return time_monotonic_ns() >= p->deadline;
+  }
+  i32 mask = io_poll_fd((u64)(i64)p->fd, pt);
+  *res     = mask < 0 ? mask : mask & (i32)(p->events | URING_POLL_ALWAYS);
+  return *res != 0;
+}
+
+/**
+ * @brief Post every pending entry that is done and has CQ room.
+ * @param pt        Registers the rest on their queues, or NULL.
+ * @param deadline  Receives the nearest TIMEOUT deadline, 0 if none.
+ */
+static void pend_reap(uring_t *r, poll_table_t *pt, u64 *deadline)
+{
+  *deadline = 0;
+  for(u32 i = 0; i < r->npending;) {
+    uring_pend_t *p = &r->pending[i];
+    i64           res;
+    if(pend_check(p, pt, &res) && cq_post(r, p->user_data, res)) {
+      *p = r->pending[--r->npending];
+      continue;
+    }
+    if(p->opcode == ALCOR_URING_OP_TIMEOUT &&
+       (!*deadline || p->deadline < *deadline))
+      *deadline = p->deadline;
+    i++;
+  }
+}
+
+/**
+ * @brief Start the disk reads of every positioned READ in SQ slots
+ *        @p head .. @p head + @p n, so they complete in parallel.
+ */
+static void prefetch_reads(const uring_t *r, u32 head, u32 n)
+{
+  for(u32 i = 0; i < n; i++) {
+    alcor_uring_sqe_t s;
+    if(copy_from_user(&s, (const void *)sqe_addr(r, head + i), sizeof(s)) <
+       0)
+      return;
+    if(s.opcode == ALCOR_URING_OP_READ && s.off != ALCOR_URING_OFF_CUR)
+      vfs_readahead(s.fd, s.off, s.len);
+  }
+}
+
+void uring_oft_release(void *obj)
+{
+  kfree(obj);
+}
+
+/** @brief The ring behind @p fd, or NULL. */
+static uring_t *uring_from_fd(i64 fd)
+{
+  const vfs_oft_entry_t *e = vfs_oft_get(vfs_fd_to_oft(fd));
+  return e && e->kind == VFS_KIND_URING ? e->obj : NULL;
+}
+
+/**
+ * @brief Register the ring block at @p ring for @p entries SQEs.
+ *
+ * The header is initialised (indices 0, @c entries set); the SQE and CQE
+ * arrays are left as they are.
+ *
+ * @return A ring fd, or -EINVAL (entries not a power of two up to
+ *         ::ALCOR_URING_MAX_ENTRIES, or flags), -EFAULT or -ENFILE.
+ */
+u64 sys_alcor_uring_setup(
+    u64 ring, u64 entries, u64 flags, u64 a4, u64 a5, u64 a6
+)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  if(flags || !entries || entries > ALCOR_URING_MAX_ENTRIES ||
+     (entries & (entries - 1)))
+    return (u64)-EINVAL;
+  if(!ring || !vmm_is_user_range((void *)ring, ALCOR_URING_SIZE(entries)))
+    return (u64)-EFAULT;
+
+  alcor_uring_t h = {.entries = (u32)entries};
+  if(copy_to_user((void *)ring, &h, sizeof(h)) < 0)
+    return (u64)-EFAULT;
+
+  uring_t *r = kzalloc(sizeof(*r));
+  if(!r)
+    return (u64)-ENOMEM;
+  r->base    = ring;
+  r->entries = (u32)entries;
+
+  i32 oft = vfs_oft_alloc_obj(VFS_KIND_URING, r);
+  if(oft < 0) {
+    kfree(r);
+    return (u64)-ENFILE;
+  }
+  i64 fd = vfs_install_fd(oft);
+  if(fd < 0)
+    vfs_oft_release(oft);
+  return (u64)fd;
+}
+
+/**
+ * @brief Run up to @p to_submit queued SQEs, then wait until at least
+ *        @p min_complete CQEs are ready.
+ *
+ * Submission stops early when the CQ has no room, so no result is lost;
+ * a POLL or TIMEOUT beyond ::ALCOR_URING_MAX_PENDING completes at once
+ * with -EBUSY. The wait ends early on a signal, or when nothing is
+ * pending that could still complete.
+ *
+ * @return SQEs consumed, or -EBADF / -EFAULT.
+ */
+u64 sys_alcor_uring_enter(
+    u64 fd, u64 to_submit, u64 min_complete, u64 a4, u64 a5, u64 a6
+)
+{
+  (void)a4;
+  (void)a5;
+  (void)a6;
+
+  uring_t *r = uring_from_fd((i64)fd);
+  if(!r)
+    return vfs_fd_is_valid((i64)fd) ? (u64)-EINVAL : (u64)-EBADF;
+
+  alcor_uring_t h;
+  if(copy_from_user(&h, (const void *)r->base, sizeof(h)) < 0)
+    return (u64)-EFAULT;
+  u32 queued = h.sq_tail - h.sq_head;
+  if(queued > r->entries)
+    return (u64)-EINVAL;
+  u32 n = to_submit < queued ? (u32)to_submit : queued;
+
+  u64 deadline;
+  pend_reap(r, NULL, &deadline);
+  prefetch_reads(r, h.sq_head, n);
+
+  u32 done = 0;
+  for(; done < n; done++) {
+    alcor_uring_sqe_t s;
+    if(copy_from_user(
+           &s, (const void *)sqe_addr(r, h.sq_head + done), sizeof(s)
+       ) < 0 ||
+       cq_ready(r) >= 2 * r->entries)
+      break;
+
+    if(s.opcode == ALCOR_URING_OP_POLL ||
+       s.opcode == ALCOR_URING_OP_TIMEOUT) {
+      uring_pend_t p = {
+          .user_data = s.user_data,
+          .deadline  = time_monotonic_ns() + s.off,
+          .fd        = s.fd,
+          .events    = s.op_flags,
+          .opcode    = s.opcode,
+      };
+      i64  res;
+      bool now = pend_check(&p, NULL, &res);
+      if(!now && r->npending < ALCOR_URING_MAX_PENDING)
+        r->pending[r->npending++] = p;
+      else
+        cq_post(r, s.user_data, now ? res : -EBUSY);
+      continue;
+    }
+    bool bad = s.flags || s.opcode > ALCOR_URING_OP_TIMEOUT;
+    if(bad)
+      put_u32(r, offsetof(alcor_uring_t, dropped), ++h.dropped);
+    cq_post(r, s.user_data, bad ? -EINVAL : run_sqe(&s));
+  }
+  if(put_u32(r, offsetof(alcor_uring_t, sq_head), h.sq_head + done) < 0)
+    return (u64)-EFAULT;
+
+  wait_entry_t waits[URING_STACK_WAITS];
+  poll_table_t pt;
+  for(;;) {
+    i64 ready = cq_ready(r);
+    if(ready < 0 || (u64)ready >= min_complete || !r->npending)
+      break;
+    poll_table_init(&pt, waits, URING_STACK_WAITS);
+    pend_reap(r, &pt, &deadline);
+    ready = cq_ready(r);
+    if(ready < 0 || (u64)ready >= min_complete || !r->npending) {
+      poll_table_release(&pt);
+      break;
+    }
+    if(poll_table_sleep(&pt, deadline) == -EINTR)
+      break;
+  }
+  return done;
+}
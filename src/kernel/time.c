@@ -0,0 +1,144 @@
+/**
+ * @file src/kernel/time.c
+ * @brief Kernel clocks from the TSC, the PIT and the CMOS clock.
+ *
+ * The TSC rate comes from CPUID where the CPU or hypervisor states it
+ * exactly (leaf 0x15, or the 0x40000010 timing leaf), and is measured
+ * against PIT channel 2 otherwise. A TSC that is not invariant may drift
+ * with power states; it is still used, as there is no better clock.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/pit.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/drivers/rtc.h>
+#include <alcor2/time.h>
+
+/** @brief Fixed-point shift of vdso_data_t::mult. */
+#define TIME_SHIFT 32
+
+#define CPUID_1_EDX_TSC          (1U << 4)
+#define CPUID_1_ECX_HYPERVISOR   (1U << 31)
+#define CPUID_80000007_EDX_INVAR (1U << 8)
+#define CPUID_LEAF_TSC           0x15
+#define CPUID_LEAF_HV_BASE       0x40000000
+#define CPUID_LEAF_HV_TIMING     0x40000010
+#define CPUID_LEAF_EXT_BASE      0x80000000
+#define CPUID_LEAF_EXT_POWER     0x80000007
+
+static vdso_data_t time_data;
+static u64         tsc_rate; /**< TSC ticks per second, 0 without one. */
+static u64         boot_tsc; /**< TSC at kernel entry, 0 if not noted. */
+
+static bool cpu_has_tsc(void)
+{
+  u32 r[4];
+  cpu_cpuid(1, 0, r);
+  return r[3] & CPUID_1_EDX_TSC;
+}
+
+/** @brief True if the TSC ticks at a constant rate in every power state. */
+static bool tsc_invariant(void)
+{
+  u32 r[4];
+  cpu_cpuid(CPUID_LEAF_EXT_BASE, 0, r);
+  if(r[0] < CPUID_LEAF_EXT_POWER)
+    return false;
+  cpu_cpuid(CPUID_LEAF_EXT_POWER, 0, r);
+  return r[3] & CPUID_80000007_EDX_INVAR;
+}
+
+/** @brief TSC rate as CPUID reports it, or 0 if it does not. */
+static u64 tsc_hz_cpuid(void)
+{
+  u32 r[4];
+  cpu_cpuid(0, 0, r);
+  if(r[0] >= CPUID_LEAF_TSC) {
+    /* EAX:EBX is the TSC / crystal ratio, ECX the crystal rate. */
+    cpu_cpuid(CPUID_LEAF_TSC, 0, r);
+    if(r[0] && r[1] && r[2])
+      return (u64)r[2] * r[1] / r[0];
+  }
+
+  cpu_cpuid(1, 0, r);
+  if(!(r[2] & CPUID_1_ECX_HYPERVISOR))
+    return 0;
+  cpu_cpuid(CPUID_LEAF_HV_BASE, 0, r);
+  if(r[0] < CPUID_LEAF_HV_TIMING)
+    return 0;
+  /* VMware-style timing leaf: EAX is the TSC rate in kHz. */
+  cpu_cpuid(CPUID_LEAF_HV_TIMING, 0, r);
+  return (u64)r[0] * 1000;
+}
+
+u64 time_boot_stamp(void)
+{
+  if(cpu_has_tsc())
+    boot_tsc = cpu_rdtsc();
+  return boot_tsc;
+}
+
+void time_init(void)
+{
+  u64         tsc_hz = 0;
+  const char *source = "CPUID";
+  if(cpu_has_tsc()) {
+    tsc_hz = tsc_hz_cpuid();
+    if(!tsc_hz) {
+      tsc_hz = pit_measure_hz(cpu_rdtsc);
+      source = "PIT";
+    }
+  }
+
+  tsc_rate = tsc_hz;
+  if(tsc_hz) {
+    time_data.clock_mode = VDSO_CLOCK_TSC;
+    time_data.shift      = TIME_SHIFT;
+    time_data.mult       = (NSEC_PER_SEC << TIME_SHIFT) / tsc_hz;
+    time_data.tsc_base   = boot_tsc ? boot_tsc : cpu_rdtsc();
+    console_printf(
+        "[TIME] TSC %lu kHz (%s)%s\n", tsc_hz / 1000, source,
+        tsc_invariant() ? "" : ", not invariant"
+    );
+    pit_start_oneshot();
+  } else {
+    time_data.clock_mode = VDSO_CLOCK_NONE;
+    console_print("[TIME] No TSC; clocks use PIT ticks\n");
+  }
+
+  i64 now = rtc_read_unix();
+  if(now < 0)
+    now = 0;
+  time_data.realtime_offset = (u64)now * NSEC_PER_SEC - time_monotonic_ns();
+}
+
+u64 time_monotonic_ns(void)
+{
+  if(time_data.clock_mode == VDSO_CLOCK_TSC)
+    return vdso_tsc_to_ns(&time_data, cpu_rdtsc());
+  u32 hz = pit_get_hz();
+  return hz ? pit_get_ticks() * (NSEC_PER_SEC / hz) : 0;
+}
+
+u64 time_tsc_hz(void)
+{
+  return tsc_rate;
+}
+
+u64 time_resolution_ns(void)
+{
+  if(time_data.clock_mode == VDSO_CLOCK_TSC)
+    return 1;
+  u32 hz = pit_get_hz();
+  return hz ? NSEC_PER_SEC / hz : NSEC_PER_SEC;
+}
+
+u64 time_realtime_ns(void)
+{
+  return time_monotonic_ns() + time_data.realtime_offset;
+}
+
+const vdso_data_t *time_vdso_data(void)
+{
+  return &time_data;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file src/kernel/timer.c
+ * @brief One-shot kernel timers.
+ */
+
+#include <alcor2/arch/smp.h>
+#include <alcor2/timer.h>
+
+/** @brief Armed timers, earliest first. */
+static ktimer_t *timer_head;
+
+void timer_init(ktimer_t *t, void (*func)(ktimer_t *t), void *arg)
+{
+  t->expires = 0;
+  t->prev    = NULL;
+  t->next    = NULL;
+  t->func    = func;
+  t->arg     = arg;
+}
+
+void timer_cancel(ktimer_t *t)
+{
+  if(!t->expires)
+    return;
+  if(t->prev)
+    t->prev->next = t->next;
+  else
+    timer_head = t->next;
+  if(t->next)
+    t->next->prev = t->prev;
+  t->prev    = NULL;
+  t->next    = NULL;
+  t->expires = 0;
+}
+
+void timer_arm(ktimer_t *t, u64 expires)
+{
+  timer_cancel(t);
+  /* 0 means "not armed"; the first nanosecond after boot is long gone. */
+  t->expires = expires ? expires : 1;
+
+  ktimer_t **link = &timer_head;
+  ktimer_t  *prev = NULL;
+  while(*link && (*link)->expires <= t->expires) {
+    prev = *link;
+    link = &(*link)->next;
+  }
+  t->prev = prev;
+  t->next = *link;
+  if(*link)
+    (*link)->prev = t;
+  *link = t;
+
+  /* The BSP runs timers; idle, it sleeps until the old earliest one. */
+  if(!prev && smp_cpu(0)->idle)
+    smp_kick(smp_cpu(0));
+}
+
+u64 timer_run(u64 now)
+{
+  while(timer_head && timer_head->expires <= now) {
+    ktimer_t *t = timer_head;
+    timer_cancel(t);
+    t->func(t);
+  }
+  return timer_next();
+}
+
+u64 timer_next(void)
+{
+  return timer_head ? timer_head->expires : 0;
+}
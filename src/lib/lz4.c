@@ -0,0 +1,167 @@
+/**
+ * @file src/lib/lz4.c
+ * @brief LZ4 block compression.
+ *
+ * The compressor is the single-pass greedy one of the reference
+ * implementation: a 4-byte hash of each position finds the last place those
+ * bytes were seen, and a match is taken as soon as one is found. That is
+ * fast and gets most of the ratio on the data the kernel compresses (memory
+ * pages, dominated by zeros and repeated words). The block format's end
+ * rules are kept so any LZ4 decoder reads the output: the last 5 bytes are
+ * always literals and no match starts in the last 12.
+ */
+
+#include <alcor2/kstdlib.h>
+#include <alcor2/lz4.h>
+
+#define LZ4_MINMATCH     4
+#define LZ4_LASTLITERALS 5
+#define LZ4_MFLIMIT      12
+#define LZ4_MAX_DISTANCE 65535
+
+static inline u32 lz4_read32(const u8 *p)
+{
+  u32 v;
+  __builtin_memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline u32 lz4_hash(u32 v)
+{
+  return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/* Bytes a length field of @p len needs after the token's 4 bits. */
+static inline u32 lz4_len_bytes(u32 len)
+{
+  return len < 15 ? 0 : (len - 15) / 255 + 1;
+}
+
+static u8 *lz4_put_len(u8 *op, u32 len)
+{
+  for(len -= 15; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (u8)len;
+  return op;
+}
+
+u32 lz4_compress(const void *src, u32 n, void *dst, u32 cap, void *work)
+{
+  const u8 *in     = src;
+  u8       *op     = dst;
+  u8       *oend   = op + cap;
+  u32      *table  = work;
+  u32       anchor = 0;
+
+  if(n > LZ4_MAX_INPUT)
+    return 0;
+  kzero(table, LZ4_WORK_SIZE);
+
+  /* Empty slots read as position 0, a real if unlikely candidate; starting
+   * at 1 keeps every candidate behind the cursor. */
+  for(u32 ip = 1; ip + LZ4_MFLIMIT <= n;) {
+    u32 seq = lz4_read32(in + ip);
+    u32 h   = lz4_hash(seq);
+    u32 ref = table[h];
+    table[h] = ip;
+    if(ip - ref > LZ4_MAX_DISTANCE || lz4_read32(in + ref) != seq) {
+      ip++;
+      continue;
+    }
+
+    /* Extend backwards over literals, then forwards up to the tail. */
+    while(ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+      ip--;
+      ref--;
+    }
+    u32 len = LZ4_MINMATCH;
+    while(ip + len < n - LZ4_LASTLITERALS && in[ref + len] == in[ip + len])
+      len++;
+
+    u32 lit = ip - anchor;
+    u32 ml  = len - LZ4_MINMATCH;
+    if((u64)(oend - op) <
+       1 + lz4_len_bytes(lit) + lit + 2 + lz4_len_bytes(ml))
+      return 0;
+    u8 *token = op++;
+    *token    = (u8)((lit < 15 ? lit : 15) << 4);
+    if(lit >= 15)
+      op = lz4_put_len(op, lit);
+    kmemcpy(op, in + anchor, lit);
+    op += lit;
+    *op++   = (u8)(ip - ref);
+    *op++   = (u8)((ip - ref) >> 8);
+    *token |= (u8)(ml < 15 ? ml : 15);
+    if(ml >= 15)
+      op = lz4_put_len(op, ml);
+
+    /* Hash the match's last position too: runs continue from there. */
+    ip += len;
+    anchor = ip;
+    if(ip + LZ4_MFLIMIT <= n)
+      table[lz4_hash(lz4_read32(in + ip - 2))] = ip - 2;
+  }
+
+  u32 lit = n - anchor;
+  if((u64)(oend - op) < 1 + lz4_len_bytes(lit) + lit)
+    return 0;
+  *op++ = (u8)((lit < 15 ? lit : 15) << 4);
+  if(lit >= 15)
+    op = lz4_put_len(op, lit);
+  kmemcpy(op, in + anchor, lit);
+  op += lit;
+  return (u32)(op - (u8 *)dst);
+}
+
+/* Read a length continuation; false if the block ends inside it. */
+static bool lz4_get_len(const u8 **ip, const u8 *iend, u32 *len)
+{
+  u8 b;
+  do {
+    if(*ip >= iend)
+      return false;
+    b     = *(*ip)++;
+    *len += b;
+  } while(b == 255);
+  return true;
+}
+
+i64 lz4_decompress(const void *src, u32 n, void *dst, u32 cap)
+{
+  const u8 *ip   = src;
+  const u8 *iend = ip + n;
+  u8       *op   = dst;
+  u8       *oend = op + cap;
+
+  while(ip < iend) {
+    u8  token = *ip++;
+    u32 lit   = token >> 4;
+    if(lit == 15 && !lz4_get_len(&ip, iend, &lit))
+      return -1;
+    if((u64)(iend - ip) < lit || (u64)(oend - op) < lit)
+      return -1;
+    kmemcpy(op, ip, lit);
+    ip += lit;
+    op += lit;
+    /* The last sequence is literals only. */
+    if(ip == iend)
+      break;
+
+    if(iend - ip < 2)
+      return -1;
+    u32 off = ip[0] | (u32)ip[1] << 8;
+    ip += 2;
+    u32 len = token & 15;
+    if(len == 15 && !lz4_get_len(&ip, iend, &len))
+      return -1;
+    len += LZ4_MINMATCH;
+    if(off == 0 || off > (u64)(op - (u8 *)dst) || (u64)(oend - op) < len)
+      return -1;
+
+    /* Byte by byte: the match may overlap what it is producing. */
+    const u8 *m = op - off;
+    while(len--)
+      *op++ = *m++;
+  }
+  return op - (u8 *)dst;
+}
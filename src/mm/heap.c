@@ -2,7 +2,19 @@
  * @file src/mm/heap.c
  * @brief Kernel heap allocator implementation.
  *
- * First-fit allocator with block coalescing, backed by PMM pages.
+ * Requests up to KMALLOC_MAX_SMALL bytes come from power-of-two size-class
+ * slabs reached through the HHDM, so allocation and free are O(1). Larger
+ * requests use a first-fit allocator with block coalescing over pages
+ * mapped at KERNEL_HEAP_BASE; kfree() tells the two apart by address.
+ *
+ * Each cache has its own lock and heap_lock guards the large heap. Both
+ * are dropped around PMM allocations that could reclaim memory; memory is
+ * freed from IRQ context, so both are held with interrupts off.
+ *
+ * With HEAP_TAG_SITES, each allocation records the slot of its call site:
+ * large blocks in their header, slab objects in an array of u16 between
+ * the slab header and the first object. The site table is only touched
+ * with no other heap lock held.
  */
 
 #include <alcor2/drivers/console.h>
@@ -11,67 +23,90 @@
 #include <alcor2/mm/memory_layout.h>
 #include <alcor2/mm/pmm.h>
 #include <alcor2/mm/vmm.h>
+#include <alcor2/spinlock.h>
 
+static spinlock_t    heap_lock    = SPINLOCK_INIT("heap", LOCK_CLASS_HEAP);
 static heap_block_t *heap_start   = NULL;
 static heap_block_t *heap_end     = NULL;
 static u64           heap_size    = 0;
 static u64           heap_used    = 0;
+static u64           heap_peak    = 0;
+static u64           heap_allocs  = 0;
+static u64           heap_frees   = 0;
 static u64           heap_next_va = KERNEL_HEAP_BASE;
 
-/**
- * @brief Expand heap by allocating and mapping new physical pages.
- * @param pages Number of 4KB pages to add.
- * @return 0 on success, negative on failure.
- */
-static int heap_expand(u64 pages)
-{
-  if(pages == 0) {
-    pages = 1;
-  }
+static kmem_cache_t  g_caches[KMEM_MAX_CACHES];
+static u32           g_cache_count = 0;
+static kmem_cache_t *g_kmalloc_classes[KMALLOC_CLASSES];
 
-  u64 size = pages * PAGE_SIZE;
+/** @brief Offset of the first object in a slab. */
+#define KMEM_SLAB_HDR ((sizeof(kmem_slab_t) + 15) & ~15ULL)
 
-  /* Allocate physical pages (PMM returns physical address as void*) */
-  void *phys_ptr = pmm_alloc_pages(pages);
-  if(phys_ptr == NULL) {
-    return -1;
-  }
+/** @brief Fewest objects a dedicated cache's slab should hold. */
+#define KMEM_SLAB_MIN_OBJS 4
 
-  u64 phys = (u64)phys_ptr;
-  u64 virt = heap_next_va;
+/** @brief Bytes of site tag each slab object costs. */
+#define KMEM_TAG_SIZE (HEAP_TAG_SITES ? sizeof(u16) : 0)
 
-  /* Map each page into the heap virtual address space */
-  for(u64 i = 0; i < pages; i++) {
-    vmm_map(
-        virt + (i * PAGE_SIZE), phys + (i * PAGE_SIZE), VMM_PRESENT | VMM_WRITE
-    );
-  }
+#if HEAP_TAG_SITES
 
-  /* Update next available virtual address */
-  heap_next_va += size;
+/** @brief Where the allocator was called from. */
+#define HEAP_SITE() ((u64)__builtin_return_address(0))
 
-  /* Initialize the new block */
-  heap_block_t *block = (heap_block_t *)virt;
-  block->magic        = HEAP_BLOCK_MAGIC;
-  block->size         = size - HEAP_HEADER_SIZE;
-  block->free         = 1;
-  block->next         = NULL;
-  block->prev         = heap_end;
+static spinlock_t  site_lock = SPINLOCK_INIT("heap_site", LOCK_CLASS_HEAP_SITE);
+static heap_site_t g_sites[HEAP_SITES];
 
-  /* Link into the block list */
-  if(heap_end != NULL) {
-    heap_end->next = block;
-  }
-  if(heap_start == NULL) {
-    heap_start = block;
+/* Slot of @p site, claimed on first use; 0 once the table is full. */
+static u16 site_slot(u64 site)
+{
+  u32 i = (u32)((site >> 4) * 0x9E3779B1ULL % (HEAP_SITES - 1)) + 1;
+  for(u32 n = 1; n < HEAP_SITES; n++) {
+    if(g_sites[i].site == site || !g_sites[i].site) {
+      g_sites[i].site = site;
+      return (u16)i;
+    }
+    i = i % (HEAP_SITES - 1) + 1;
   }
-  heap_end = block;
+  return 0;
+}
 
-  heap_size += size;
+/* Charge @p bytes to @p site; returns the slot to give back on free. */
+static u16 site_alloc(u64 site, u64 bytes)
+{
+  u64          flags = spin_lock_irqsave(&site_lock);
+  u16          slot  = site_slot(site);
+  heap_site_t *s     = &g_sites[slot];
+  s->allocs++;
+  s->live += bytes;
+  if(s->live > s->live_peak)
+    s->live_peak = s->live;
+  spin_unlock_irqrestore(&site_lock, flags);
+  return slot;
+}
 
-  return 0;
+static void site_free(u16 slot, u64 bytes)
+{
+  u64 flags = spin_lock_irqsave(&site_lock);
+  g_sites[slot].frees++;
+  g_sites[slot].live -= bytes;
+  spin_unlock_irqrestore(&site_lock, flags);
 }
 
+/* Tag of @p obj, in the array after its slab's header. */
+static inline u16 *slab_tag(
+    const kmem_cache_t *cache, kmem_slab_t *slab, const void *obj
+)
+{
+  u64 index = ((u64)obj - (u64)slab - cache->first) / cache->stride;
+  return (u16 *)((u8 *)slab + KMEM_SLAB_HDR) + index;
+}
+
+#else
+
+#define HEAP_SITE() 0ULL
+
+#endif
+
 /**
  * @brief Find first free block that fits requested size.
  * @param size Minimum size needed.
@@ -119,14 +154,27 @@ static void split_block(heap_block_t *block, u64 size)
   block->next = new_block;
 }
 
+/** @brief True if @p next starts where @p block ends. */
+static inline bool heap_adjacent(const heap_block_t *block,
+                                 const heap_block_t *next)
+{
+  return (const u8 *)block + HEAP_HEADER_SIZE + block->size ==
+         (const u8 *)next;
+}
+
 /**
  * @brief Merge block with adjacent free blocks.
+ *
+ * Blocks are only merged when they touch: an expansion that ran out of
+ * memory leaves an unmapped hole behind it.
+ *
  * @param block Block to coalesce.
  */
 static void coalesce(heap_block_t *block)
 {
   /* Merge with next block if free */
-  while(block->next != NULL && block->next->free) {
+  while(block->next != NULL && block->next->free &&
+        heap_adjacent(block, block->next)) {
     heap_block_t *next = block->next;
 
     block->size += HEAP_HEADER_SIZE + next->size;
@@ -141,7 +189,8 @@ static void coalesce(heap_block_t *block)
   }
 
   /* Merge with previous block if free */
-  if(block->prev != NULL && block->prev->free) {
+  if(block->prev != NULL && block->prev->free &&
+     heap_adjacent(block->prev, block)) {
     heap_block_t *prev = block->prev;
 
     prev->size += HEAP_HEADER_SIZE + block->size;
@@ -156,6 +205,415 @@ static void coalesce(heap_block_t *block)
   }
 }
 
+/** @brief Expansions of at least this many pages end on a 2 MiB boundary. */
+#define HEAP_HUGE_MIN_PAGES (VMM_HUGE_PAGES / 2)
+
+/**
+ * @brief Back heap addresses with fresh frames.
+ *
+ * Each 2 MiB-aligned stretch gets one huge page if the PMM has a free
+ * order-9 block to spare, which saves the TLB 511 entries; the rest is
+ * mapped page by page.
+ *
+ * @param virt First address, page aligned.
+ * @param size Bytes to map, a multiple of PAGE_SIZE.
+ * @return Bytes mapped from @p virt on, less than @p size if out of memory.
+ */
+static u64 heap_map(u64 virt, u64 size)
+{
+  u64 done = 0;
+  while(done < size) {
+    u64 va = virt + done;
+    if(!(va & (VMM_HUGE_SIZE - 1)) && size - done >= VMM_HUGE_SIZE) {
+      void *huge = pmm_try_alloc_order(VMM_HUGE_ORDER);
+      if(huge) {
+        if(vmm_map_huge(va, (u64)huge, VMM_PRESENT | VMM_WRITE)) {
+          done += VMM_HUGE_SIZE;
+          continue;
+        }
+        pmm_free_pages(huge, VMM_HUGE_PAGES);
+      }
+    }
+
+    void *page = pmm_alloc();
+    if(!page)
+      break;
+    vmm_map(va, (u64)page, VMM_PRESENT | VMM_WRITE);
+    done += PAGE_SIZE;
+  }
+  return done;
+}
+
+/**
+ * @brief Expand heap by allocating and mapping new physical pages.
+ *
+ * The address range is reserved under heap_lock and mapped without it,
+ * since the PMM may reclaim memory; the new block is then linked in
+ * address order. Large expansions are rounded up to end on a 2 MiB
+ * boundary so the next ones can use huge pages.
+ *
+ * @param pages Number of 4KB pages to add.
+ * @return 0 on success, negative on failure.
+ */
+static int heap_expand(u64 pages)
+{
+  if(pages == 0) {
+    pages = 1;
+  }
+
+  u64 flags = spin_lock_irqsave(&heap_lock);
+  u64 virt  = heap_next_va;
+  u64 size  = pages * PAGE_SIZE;
+  if(pages >= HEAP_HUGE_MIN_PAGES) {
+    size = ((virt + size + VMM_HUGE_SIZE - 1) & ~(VMM_HUGE_SIZE - 1)) - virt;
+  }
+  heap_next_va += size;
+  spin_unlock_irqrestore(&heap_lock, flags);
+
+  u64 mapped = heap_map(virt, size);
+  if(mapped == 0) {
+    return -1;
+  }
+
+  /* Initialize the new block */
+  heap_block_t *block = (heap_block_t *)virt;
+  block->magic        = HEAP_BLOCK_MAGIC;
+  block->size         = mapped - HEAP_HEADER_SIZE;
+  block->free         = 1;
+
+  /* Link into the block list after the last block below it */
+  flags              = spin_lock_irqsave(&heap_lock);
+  heap_block_t *prev = heap_end;
+  while(prev != NULL && prev > block) {
+    prev = prev->prev;
+  }
+  block->prev = prev;
+  block->next = prev != NULL ? prev->next : heap_start;
+  if(block->next != NULL) {
+    block->next->prev = block;
+  } else {
+    heap_end = block;
+  }
+  if(prev != NULL) {
+    prev->next = block;
+  } else {
+    heap_start = block;
+  }
+
+  heap_size += mapped;
+  coalesce(block);
+
+  spin_unlock_irqrestore(&heap_lock, flags);
+  return mapped == size ? 0 : -1;
+}
+
+/**
+ * @brief Unlink a slab from one of its cache's lists.
+ * @param head List head.
+ * @param slab Slab to unlink.
+ */
+static void slab_list_remove(kmem_slab_t **head, kmem_slab_t *slab)
+{
+  if(slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *head = slab->next;
+  if(slab->next)
+    slab->next->prev = slab->prev;
+  slab->next = NULL;
+  slab->prev = NULL;
+}
+
+/**
+ * @brief Push a slab onto one of its cache's lists.
+ * @param head List head.
+ * @param slab Slab to push.
+ */
+static void slab_list_push(kmem_slab_t **head, kmem_slab_t *slab)
+{
+  slab->prev = NULL;
+  slab->next = *head;
+  if(*head)
+    (*head)->prev = slab;
+  *head = slab;
+}
+
+/**
+ * @brief Get the free-list link stored in an object slot.
+ * @param cache Owning cache.
+ * @param obj Object pointer.
+ * @return Address of the link.
+ */
+static inline void **slab_link(const kmem_cache_t *cache, void *obj)
+{
+  return (void **)((u8 *)obj + cache->free_off);
+}
+
+/**
+ * @brief Allocate and carve a new slab for a cache.
+ * @param cache Cache to grow.
+ * @return New slab with every object free, or NULL if out of memory.
+ */
+static kmem_slab_t *slab_create(kmem_cache_t *cache)
+{
+  void *phys = cache->order == 0 ? pmm_alloc()
+                                 : pmm_alloc_pages(1ULL << cache->order);
+  if(!phys)
+    return NULL;
+
+  kmem_slab_t *slab = (kmem_slab_t *)phys_to_virt((u64)phys);
+  slab->magic       = KMEM_SLAB_MAGIC;
+  slab->inuse       = 0;
+  slab->cache       = cache;
+  slab->free        = NULL;
+  slab->next        = NULL;
+  slab->prev        = NULL;
+
+  /* Thread the free list back to front so objects come out in order. */
+  u8 *base = (u8 *)slab + cache->first;
+  for(u32 i = cache->per_slab; i-- > 0;) {
+    void *obj = base + (u64)i * cache->stride;
+    if(cache->ctor)
+      cache->ctor(obj);
+    *slab_link(cache, obj) = slab->free;
+    slab->free             = obj;
+  }
+  return slab;
+}
+
+/**
+ * @brief Give a slab's pages back to the PMM.
+ * @param cache Owning cache.
+ * @param slab Empty slab.
+ */
+static void slab_destroy(const kmem_cache_t *cache, kmem_slab_t *slab)
+{
+  slab->magic = 0;
+  if(cache->order == 0)
+    pmm_free((void *)virt_to_phys(slab));
+  else
+    pmm_free_pages((void *)virt_to_phys(slab), (usize)1 << cache->order);
+}
+
+/**
+ * @brief Initialize a cache descriptor.
+ * @param cache Descriptor to fill.
+ * @param name Cache name.
+ * @param size Object size.
+ * @param ctor Optional constructor.
+ * @param order Slab order, or -1 to pick one from the object size.
+ */
+static void cache_setup(
+    kmem_cache_t *cache, const char *name, u32 size, kmem_ctor_t ctor,
+    i32 order
+)
+{
+  kzero(cache, sizeof(*cache));
+  spin_init(&cache->lock, name, LOCK_CLASS_KMEM_CACHE);
+  cache->name     = name;
+  cache->obj_size = size;
+  cache->ctor     = ctor;
+
+  /* A constructed object must survive being free, so keep the link
+   * outside it when there is a constructor. */
+  if(ctor) {
+    cache->free_off = (size + 7) & ~7U;
+    cache->stride   = (cache->free_off + sizeof(void *) + 15) & ~15U;
+  } else {
+    cache->free_off = 0;
+    cache->stride   = (size + 15) & ~15U;
+    if(cache->stride < sizeof(void *))
+      cache->stride = 16;
+  }
+
+  u32 slot = cache->stride + KMEM_TAG_SIZE;
+  if(order < 0) {
+    order = 0;
+    while(order < PMM_MAX_ORDER &&
+          ((PAGE_SIZE << order) - KMEM_SLAB_HDR) / slot < KMEM_SLAB_MIN_OBJS)
+      order++;
+  }
+  u64 bytes       = PAGE_SIZE << order;
+  cache->order    = (u32)order;
+  cache->per_slab = (u32)((bytes - KMEM_SLAB_HDR) / slot);
+  cache->first =
+      (u32)((KMEM_SLAB_HDR + cache->per_slab * KMEM_TAG_SIZE + 15) & ~15ULL);
+  /* Aligning the first object can push the last one off the end. */
+  if(cache->per_slab &&
+     cache->first + (u64)cache->per_slab * cache->stride > bytes)
+    cache->per_slab--;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, u32 size, kmem_ctor_t ctor)
+{
+  if(size == 0 || g_cache_count >= KMEM_MAX_CACHES)
+    return NULL;
+
+  kmem_cache_t *cache = &g_caches[g_cache_count++];
+  cache_setup(cache, name, size, ctor, -1);
+  if(cache->per_slab == 0) {
+    g_cache_count--;
+    return NULL;
+  }
+  return cache;
+}
+
+/* kmem_cache_alloc() on behalf of call site @p site. */
+static void *cache_alloc(kmem_cache_t *cache, u64 site)
+{
+  u64          flags = spin_lock_irqsave(&cache->lock);
+  kmem_slab_t *slab  = cache->partial;
+
+  if(!slab) {
+    slab         = cache->empty;
+    cache->empty = NULL;
+    if(!slab) {
+      spin_unlock_irqrestore(&cache->lock, flags);
+      slab = slab_create(cache);
+      if(!slab)
+        return NULL;
+      flags = spin_lock_irqsave(&cache->lock);
+      cache->slabs++;
+    }
+    slab_list_push(&cache->partial, slab);
+  }
+
+  void *obj  = slab->free;
+  slab->free = *slab_link(cache, obj);
+  slab->inuse++;
+  cache->objs_inuse++;
+  cache->allocs++;
+  if(cache->objs_inuse > cache->objs_peak)
+    cache->objs_peak = cache->objs_inuse;
+
+  if(!slab->free) {
+    slab_list_remove(&cache->partial, slab);
+    slab_list_push(&cache->full, slab);
+  }
+  spin_unlock_irqrestore(&cache->lock, flags);
+
+#if HEAP_TAG_SITES
+  *slab_tag(cache, slab, obj) = site_alloc(site, cache->obj_size);
+#else
+  (void)site;
+#endif
+  return obj;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+  return cache_alloc(cache, HEAP_SITE());
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+  if(obj == NULL)
+    return;
+
+  kmem_slab_t *slab = (kmem_slab_t *)((u64)obj &
+                                      ~((PAGE_SIZE << cache->order) - 1));
+  if(slab->magic != KMEM_SLAB_MAGIC || slab->cache != cache) {
+    console_print("[HEAP] Bad free: object not from this cache\n");
+    return;
+  }
+
+#if HEAP_TAG_SITES
+  site_free(*slab_tag(cache, slab, obj), cache->obj_size);
+#endif
+
+  u64          flags = spin_lock_irqsave(&cache->lock);
+  kmem_slab_t *spare = NULL;
+
+  bool was_full          = slab->free == NULL;
+  *slab_link(cache, obj) = slab->free;
+  slab->free             = obj;
+  slab->inuse--;
+  cache->objs_inuse--;
+  cache->frees++;
+
+  if(was_full) {
+    slab_list_remove(&cache->full, slab);
+    slab_list_push(&cache->partial, slab);
+  }
+
+  if(slab->inuse == 0) {
+    slab_list_remove(&cache->partial, slab);
+    /* Keep one spare slab so alloc/free around a boundary doesn't thrash. */
+    spare        = cache->empty;
+    cache->empty = slab;
+    if(spare)
+      cache->slabs--;
+  }
+  spin_unlock_irqrestore(&cache->lock, flags);
+
+  if(spare)
+    slab_destroy(cache, spare);
+}
+
+/**
+ * @brief Map a small request size to its kmalloc size class.
+ * @param size Request size (1..KMALLOC_MAX_SMALL).
+ * @return Class index.
+ */
+static inline u32 kmalloc_class(u64 size)
+{
+  u32 idx = 0;
+  while(((u64)KMALLOC_MIN_SMALL << idx) < size)
+    idx++;
+  return idx;
+}
+
+/**
+ * @brief Check whether a pointer belongs to the first-fit large heap.
+ * @param ptr Pointer returned by kmalloc.
+ * @return true for large-heap blocks, false for slab objects.
+ */
+static inline bool is_large_block(const void *ptr)
+{
+  return (u64)ptr >= KERNEL_HEAP_BASE && (u64)ptr < heap_next_va;
+}
+
+void heap_stats(heap_stats_t *out)
+{
+  kzero(out, sizeof(*out));
+  u64 flags   = spin_lock_irqsave(&heap_lock);
+  out->used   = heap_used;
+  out->size   = heap_size;
+  out->peak   = heap_peak;
+  out->allocs = heap_allocs;
+  out->frees  = heap_frees;
+  for(const heap_block_t *b = heap_start; b; b = b->next) {
+    if(!b->free)
+      continue;
+    out->free_blocks++;
+    out->free_bytes += b->size;
+    if(b->size > out->largest_free)
+      out->largest_free = b->size;
+  }
+  spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+bool heap_site_get(u32 i, heap_site_t *out)
+{
+#if HEAP_TAG_SITES
+  if(i >= HEAP_SITES)
+    return false;
+  u64 flags = spin_lock_irqsave(&site_lock);
+  *out      = g_sites[i];
+  spin_unlock_irqrestore(&site_lock, flags);
+  return true;
+#else
+  (void)i;
+  (void)out;
+  return false;
+#endif
+}
+
+const kmem_cache_t *kmem_cache_get(u32 i)
+{
+  return i < g_cache_count ? &g_caches[i] : NULL;
+}
+
 /**
  * @brief Initialize the kernel heap allocator.
  *
@@ -164,6 +622,20 @@ static void coalesce(heap_block_t *block)
  */
 void heap_init(void)
 {
+  static const char *const class_names[KMALLOC_CLASSES] = {
+      "kmalloc-16",  "kmalloc-32",  "kmalloc-64",   "kmalloc-128",
+      "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+  };
+
+  for(u32 i = 0; i < KMALLOC_CLASSES; i++) {
+    kmem_cache_t *cache = &g_caches[g_cache_count++];
+    cache_setup(
+        cache, class_names[i], KMALLOC_MIN_SMALL << i, NULL,
+        KMALLOC_SLAB_ORDER
+    );
+    g_kmalloc_classes[i] = cache;
+  }
+
   if(heap_expand(HEAP_INITIAL_PAGES) != 0) {
     console_print("[HEAP] Init failed!\n");
     return;
@@ -176,21 +648,27 @@ void heap_init(void)
 }
 
 /**
- * @brief Allocate memory from kernel heap.
+ * @brief Allocate memory from kernel heap for call site @p site.
  *
- * Uses first-fit algorithm to find a suitable free block. If no block is large
- * enough, expands the heap by allocating more physical pages. Blocks are
- * automatically split if significantly larger than needed.
+ * Small requests are taken from the matching size-class slab. Larger ones
+ * use a first-fit search; if no block is large enough, the heap is expanded
+ * by allocating more physical pages. Blocks are automatically split if
+ * significantly larger than needed.
  *
  * @param size Number of bytes to allocate (automatically aligned to 16 bytes).
+ * @param site Caller's return address, for HEAP_TAG_SITES.
  * @return Pointer to allocated memory, or NULL on failure.
  */
-void *kmalloc(u64 size)
+static void *heap_alloc(u64 size, u64 site)
 {
   if(size == 0) {
     return NULL;
   }
 
+  if(size <= KMALLOC_MAX_SMALL) {
+    return cache_alloc(g_kmalloc_classes[kmalloc_class(size)], site);
+  }
+
   /* Align to 16 bytes */
   size = (size + 15) & ~15ULL;
   if(size < HEAP_MIN_ALLOC) {
@@ -198,10 +676,12 @@ void *kmalloc(u64 size)
   }
 
   /* Find a suitable block */
+  u64           flags = spin_lock_irqsave(&heap_lock);
   heap_block_t *block = find_free_block(size);
 
   /* Expand heap if needed */
   if(block == NULL) {
+    spin_unlock_irqrestore(&heap_lock, flags);
     u64 pages = (size + HEAP_HEADER_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
     if(pages < 4) {
       pages = 4;
@@ -211,8 +691,10 @@ void *kmalloc(u64 size)
       return NULL;
     }
 
+    flags = spin_lock_irqsave(&heap_lock);
     block = find_free_block(size);
     if(block == NULL) {
+      spin_unlock_irqrestore(&heap_lock, flags);
       return NULL;
     }
   }
@@ -222,10 +704,23 @@ void *kmalloc(u64 size)
 
   block->free = 0;
   heap_used += block->size;
+  heap_allocs++;
+  if(heap_used > heap_peak)
+    heap_peak = heap_used;
+
+  spin_unlock_irqrestore(&heap_lock, flags);
 
+#if HEAP_TAG_SITES
+  block->site = site_alloc(site, block->size);
+#endif
   return (void *)((u8 *)block + HEAP_HEADER_SIZE);
 }
 
+void *kmalloc(u64 size)
+{
+  return heap_alloc(size, HEAP_SITE());
+}
+
 /**
  * @brief Allocate zeroed memory from kernel heap.
  *
@@ -236,7 +731,7 @@ void *kmalloc(u64 size)
  */
 void *kzalloc(u64 size)
 {
-  void *ptr = kmalloc(size);
+  void *ptr = heap_alloc(size, HEAP_SITE());
   if(ptr != NULL) {
     kzero(ptr, size);
   }
@@ -257,6 +752,18 @@ void kfree(void *ptr)
     return;
   }
 
+  if(!is_large_block(ptr)) {
+    const kmem_slab_t *slab =
+        (const kmem_slab_t *)((u64)ptr &
+                              ~((PAGE_SIZE << KMALLOC_SLAB_ORDER) - 1));
+    if(slab->magic != KMEM_SLAB_MAGIC) {
+      console_print("[HEAP] Bad free: invalid magic\n");
+      return;
+    }
+    kmem_cache_free(slab->cache, ptr);
+    return;
+  }
+
   heap_block_t *block = (heap_block_t *)((u8 *)ptr - HEAP_HEADER_SIZE);
 
   /* Validate */
@@ -265,15 +772,27 @@ void kfree(void *ptr)
     return;
   }
 
+  u64 flags = spin_lock_irqsave(&heap_lock);
   if(block->free) {
+    spin_unlock_irqrestore(&heap_lock, flags);
     console_print("[HEAP] Double free detected\n");
     return;
   }
 
   block->free = 1;
   heap_used -= block->size;
+  heap_frees++;
+#if HEAP_TAG_SITES
+  u16 site  = block->site;
+  u64 bytes = block->size;
+#endif
 
   coalesce(block);
+  spin_unlock_irqrestore(&heap_lock, flags);
+
+#if HEAP_TAG_SITES
+  site_free(site, bytes);
+#endif
 }
 
 /**
@@ -291,7 +810,7 @@ void kfree(void *ptr)
 void *krealloc(void *ptr, u64 new_size)
 {
   if(ptr == NULL) {
-    return kmalloc(new_size);
+    return heap_alloc(new_size, HEAP_SITE());
   }
 
   if(new_size == 0) {
@@ -299,25 +818,37 @@ void *krealloc(void *ptr, u64 new_size)
     return NULL;
   }
 
-  const heap_block_t *block =
-      (const heap_block_t *)((u8 *)ptr - HEAP_HEADER_SIZE);
+  u64 old_size;
+  if(is_large_block(ptr)) {
+    const heap_block_t *block =
+        (const heap_block_t *)((u8 *)ptr - HEAP_HEADER_SIZE);
 
-  if(block->magic != HEAP_BLOCK_MAGIC) {
-    return NULL;
+    if(block->magic != HEAP_BLOCK_MAGIC) {
+      return NULL;
+    }
+    old_size = block->size;
+  } else {
+    const kmem_slab_t *slab =
+        (const kmem_slab_t *)((u64)ptr &
+                              ~((PAGE_SIZE << KMALLOC_SLAB_ORDER) - 1));
+    if(slab->magic != KMEM_SLAB_MAGIC) {
+      return NULL;
+    }
+    old_size = slab->cache->obj_size;
   }
 
   /* Current block is large enough */
-  if(block->size >= new_size) {
+  if(old_size >= new_size) {
     return ptr;
   }
 
   /* Allocate new and copy */
-  void *new_ptr = kmalloc(new_size);
+  void *new_ptr = heap_alloc(new_size, HEAP_SITE());
   if(new_ptr == NULL) {
     return NULL;
   }
 
-  kmemcpy(new_ptr, ptr, block->size);
+  kmemcpy(new_ptr, ptr, old_size);
 
   kfree(ptr);
   return new_ptr;
@@ -1,23 +1,123 @@
 /**
  * @file src/mm/pmm.c
- * @brief Physical memory manager using bitmap allocator.
+ * @brief Physical memory manager using a buddy allocator.
+ *
+ * Free memory is kept as power-of-two blocks (orders 0..PMM_MAX_ORDER) on
+ * per-order free lists. The list nodes live inside the free pages themselves
+ * (reached through the HHDM); a one-byte-per-page table records which pages
+ * head a free block and at what order, so buddies can be found and merged in
+ * O(1) per level.
+ *
+ * Allocated blocks carry no metadata: callers free by (address, count), and
+ * a multi-page allocation may be released page by page. Shared pages (COW
+ * fork) hold extra references in page_refs[]; pmm_free() drops one and only
+ * frees the page with the last.
+ *
+ * Single pages go through a per-CPU LIFO cache of recently freed pages
+ * (still warm in the data cache), which is refilled from and drained to the
+ * buddy lists PMM_PCP_BATCH pages at a time.
+ *
+ * The idle loop takes cold pages off the buddy lists, zeroes them with
+ * non-temporal stores and keeps them in a pool that pmm_alloc_zeroed()
+ * serves first, so page tables and demand-zero faults rarely wait for a
+ * clear. The pool is handed back when the buddy lists run dry.
+ *
+ * Caches holding reclaimable pages register a shrinker. Besides being
+ * asked when an allocation would fail, they are asked by pmm_balance()
+ * to trim their LRU tails once free memory drops below a low watermark,
+ * until it is back above a high one, so allocations rarely hit the limit.
+ *
+ * pmm_lock guards the free lists, the hot caches, page_info and page_refs.
+ * Pages are freed from IRQ context, so it is held with interrupts off.
+ * Shrinkers run without it: they free pages.
  */
 
+#include <alcor2/drivers/console.h>
+#include <alcor2/kstdlib.h>
 #include <alcor2/limine.h>
 #include <alcor2/mm/memory_layout.h>
 #include <alcor2/mm/pmm.h>
+#include <alcor2/spinlock.h>
 #include <alcor2/types.h>
 
+/* Set to 1 to cross-check every alloc/free against a page bitmap */
+#define PMM_DEBUG 0
+
+/** @brief page_info flag: page heads a block on a free list. */
+#define PMM_PAGE_FREE     0x80
+/** @brief page_info flag: page sits in a per-CPU hot page cache. */
+#define PMM_PAGE_CACHED   0x40
+/** @brief page_info flag: page is not usable RAM and is never handed out. */
+#define PMM_PAGE_RESERVED 0x20
+/** @brief page_info mask: order of the free block headed by the page. */
+#define PMM_ORDER_MASK    0x1F
+
+/** @brief page_info flags that make a free request a no-op. */
+#define PMM_PAGE_NOT_OWNED                                                     \
+  (PMM_PAGE_FREE | PMM_PAGE_CACHED | PMM_PAGE_RESERVED)
+
+/** @brief CPUs with their own hot page cache. */
+#define PMM_MAX_CPUS  1
+/** @brief Pages moved between a hot cache and the buddy lists at once. */
+#define PMM_PCP_BATCH 16
+/** @brief Hot cache fill level that triggers a drain. */
+#define PMM_PCP_HIGH  64
+
+/** @brief Pre-zeroed pages kept ready for pmm_alloc_zeroed(). */
+#define PMM_ZERO_POOL  256
+/** @brief Pages zeroed per pmm_prezero() call. */
+#define PMM_ZERO_BATCH 8
+
+/** @brief Reclaim callbacks consulted when memory runs out. */
+#define PMM_MAX_SHRINKERS 4
+/** @brief Low watermark: 1/N of usable RAM, at least PMM_WMARK_MIN pages. */
+#define PMM_WMARK_SHARE   128
+#define PMM_WMARK_MIN     256
+
+/** @brief Intrusive free-list node stored at the start of a free block. */
+typedef struct pmm_block
+{
+  struct pmm_block *next;
+  struct pmm_block *prev;
+} pmm_block_t;
+
+/** @brief Per-CPU stack of free order-0 pages. */
+typedef struct
+{
+  u64 count;
+  u64 pfns[PMM_PCP_HIGH];
+} pmm_pcp_t;
+
+static pmm_block_t *free_lists[PMM_MAX_ORDER + 1];
+static pmm_pcp_t    pcp[PMM_MAX_CPUS];
+/** @brief Pool of zeroed free pages, tagged PMM_PAGE_CACHED. */
+static u64          zero_pfns[PMM_ZERO_POOL];
+static u64          zero_count;
+static u8          *page_info;
+/** @brief Extra references per page beyond the first owner (COW sharing). */
+static u16         *page_refs;
+static u64          total_pages;
+static u64          free_pages;
+static u64          hhdm;
+
+static spinlock_t pmm_lock = SPINLOCK_INIT("pmm", LOCK_CLASS_PMM);
+
+static const pmm_shrinker_t *shrinkers[PMM_MAX_SHRINKERS];
+static u32                   nr_shrinkers;
+static bool                  reclaiming;
+static u64                   usable_pages;
+static u64                   wmark_low;
+static u64                   wmark_high;
+/** @brief Pages the shrinkers have given back since boot. */
+static u64                   reclaimed;
+
+#if PMM_DEBUG
 #define BITS_PER_ENTRY 64
 
 static u64 *bitmap;
-static u64  bitmap_size;
-static u64  total_pages;
-static u64  free_pages;
-static u64  hhdm;
 
 /**
- * @brief Mark page as allocated in bitmap.
+ * @brief Mark page as allocated in the debug bitmap.
  * @param page Page number.
  */
 static inline void bitmap_set(u64 page)
@@ -26,7 +126,7 @@ static inline void bitmap_set(u64 page)
 }
 
 /**
- * @brief Mark page as free in bitmap.
+ * @brief Mark page as free in the debug bitmap.
  * @param page Page number.
  */
 static inline void bitmap_clear(u64 page)
@@ -35,7 +135,7 @@ static inline void bitmap_clear(u64 page)
 }
 
 /**
- * @brief Test if page is allocated.
+ * @brief Test if page is allocated in the debug bitmap.
  * @param page Page number.
  * @return true if allocated.
  */
@@ -44,11 +144,255 @@ static inline bool bitmap_test(u64 page)
   return bitmap[page / BITS_PER_ENTRY] & (1ULL << (page % BITS_PER_ENTRY));
 }
 
+/**
+ * @brief Record a range as allocated, reporting pages that already were.
+ * @param pfn First page number.
+ * @param count Number of pages.
+ */
+static void debug_mark_used(u64 pfn, u64 count)
+{
+  for(u64 p = pfn; p < pfn + count; p++) {
+    if(bitmap_test(p))
+      console_printf("[PMM] page 0x%x handed out twice\n", p * PAGE_SIZE);
+    bitmap_set(p);
+  }
+}
+#endif
+
+/**
+ * @brief Get the HHDM view of the block starting at a page.
+ * @param pfn Page number.
+ * @return Free-list node for the block.
+ */
+static inline pmm_block_t *pfn_to_block(u64 pfn)
+{
+  return (pmm_block_t *)(pfn * PAGE_SIZE + hhdm);
+}
+
+/**
+ * @brief Get the page number of a free-list node.
+ * @param b Free-list node.
+ * @return Page number.
+ */
+static inline u64 block_to_pfn(const pmm_block_t *b)
+{
+  return ((u64)b - hhdm) / PAGE_SIZE;
+}
+
+/**
+ * @brief Push a block onto its order's free list.
+ * @param pfn First page of the block.
+ * @param order Block order.
+ */
+static void list_push(u64 pfn, u32 order)
+{
+  pmm_block_t *b = pfn_to_block(pfn);
+  b->prev        = NULL;
+  b->next        = free_lists[order];
+  if(b->next)
+    b->next->prev = b;
+  free_lists[order] = b;
+  page_info[pfn]    = PMM_PAGE_FREE | (u8)order;
+}
+
+/**
+ * @brief Unlink a block from its order's free list.
+ * @param pfn First page of the block.
+ * @param order Block order.
+ */
+static void list_remove(u64 pfn, u32 order)
+{
+  pmm_block_t *b = pfn_to_block(pfn);
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    free_lists[order] = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+  page_info[pfn] = 0;
+}
+
+/**
+ * @brief Free one aligned block, merging with free buddies.
+ * @param pfn First page of the block (aligned to 1 << order).
+ * @param order Block order.
+ */
+static void free_block(u64 pfn, u32 order)
+{
+  while(order < PMM_MAX_ORDER) {
+    u64 buddy = pfn ^ (1ULL << order);
+    if(buddy + (1ULL << order) > total_pages)
+      break;
+    if(page_info[buddy] != (PMM_PAGE_FREE | order))
+      break;
+    list_remove(buddy, order);
+    pfn &= ~(1ULL << order);
+    order++;
+  }
+  list_push(pfn, order);
+}
+
+/**
+ * @brief Free an arbitrary page range as maximal aligned blocks.
+ * @param pfn First page number.
+ * @param count Number of pages.
+ */
+static void free_range(u64 pfn, u64 count)
+{
+  while(count > 0) {
+    u32 order = 0;
+    while(order < PMM_MAX_ORDER && (pfn & (1ULL << order)) == 0 &&
+          (2ULL << order) <= count)
+      order++;
+    free_block(pfn, order);
+    free_pages += 1ULL << order;
+    pfn += 1ULL << order;
+    count -= 1ULL << order;
+  }
+}
+
+/**
+ * @brief Pop a block of exactly @p order, splitting a larger one if needed.
+ * @param order Requested order.
+ * @return First page number, or 0 if no block is large enough.
+ */
+static u64 alloc_order(u32 order)
+{
+  u32 o = order;
+  while(o <= PMM_MAX_ORDER && !free_lists[o])
+    o++;
+  if(o > PMM_MAX_ORDER)
+    return 0;
+
+  u64 pfn = block_to_pfn(free_lists[o]);
+  list_remove(pfn, o);
+
+  /* Return the upper halves until the block is the requested size. */
+  while(o > order) {
+    o--;
+    list_push(pfn + (1ULL << o), o);
+  }
+  return pfn;
+}
+
+/**
+ * @brief Get the hot page cache of the running CPU.
+ *
+ * The CPUs share one: the allocator only runs under the kernel lock, so
+ * caches of their own would just split the hot pages. This is the one
+ * place that changes once that lock is broken up.
+ *
+ * @return Hot page cache.
+ */
+static inline pmm_pcp_t *pcp_this(void)
+{
+  return &pcp[0];
+}
+
+/**
+ * @brief Move up to PMM_PCP_BATCH pages from the buddy lists into a cache.
+ * @param c Hot page cache.
+ */
+static void pcp_refill(pmm_pcp_t *c)
+{
+  while(c->count < PMM_PCP_BATCH) {
+    u64 pfn = alloc_order(0);
+    if(pfn == 0)
+      break;
+    page_info[pfn]      = PMM_PAGE_CACHED;
+    c->pfns[c->count++] = pfn;
+  }
+  /* Out of buddy pages: zeroed ones are still free memory. */
+  while(c->count < PMM_PCP_BATCH && zero_count > 0)
+    c->pfns[c->count++] = zero_pfns[--zero_count];
+}
+
+/** @brief Return every pre-zeroed page to the buddy lists. */
+static void zero_pool_drain(void)
+{
+  while(zero_count > 0) {
+    u64 pfn        = zero_pfns[--zero_count];
+    page_info[pfn] = 0;
+    free_block(pfn, 0);
+  }
+}
+
+/**
+ * @brief Return the PMM_PCP_BATCH coldest pages of a cache to the buddy lists.
+ * @param c Hot page cache.
+ */
+static void pcp_drain(pmm_pcp_t *c)
+{
+  u64 n = c->count < PMM_PCP_BATCH ? c->count : PMM_PCP_BATCH;
+
+  /* The bottom of the stack holds the least recently freed pages. */
+  for(u64 i = 0; i < n; i++) {
+    page_info[c->pfns[i]] = 0;
+    free_block(c->pfns[i], 0);
+  }
+  for(u64 i = n; i < c->count; i++)
+    c->pfns[i - n] = c->pfns[i];
+  c->count -= n;
+}
+
+/**
+ * @brief Allocate a run larger than the biggest buddy block.
+ *
+ * Looks for physically adjacent free max-order blocks; there are only
+ * total_pages >> PMM_MAX_ORDER candidates so the scan stays short.
+ *
+ * @param count Number of pages (> 1 << PMM_MAX_ORDER).
+ * @return First page number, or 0 if no such run exists.
+ */
+static u64 alloc_large(u64 count)
+{
+  const u64 step   = 1ULL << PMM_MAX_ORDER;
+  u64       blocks = (count + step - 1) / step;
+  u64       run    = 0;
+
+  for(u64 pfn = 0; pfn + step <= total_pages; pfn += step) {
+    if(page_info[pfn] != (PMM_PAGE_FREE | PMM_MAX_ORDER)) {
+      run = 0;
+      continue;
+    }
+    if(++run < blocks)
+      continue;
+
+    u64 start = pfn - (blocks - 1) * step;
+    for(u64 b = 0; b < blocks; b++)
+      list_remove(start + b * step, PMM_MAX_ORDER);
+    return start;
+  }
+  return 0;
+}
+
+/**
+ * @brief Take a block covering at least @p count pages off the free lists.
+ * @param count Number of pages (non-zero).
+ * @param got Output: number of pages actually taken.
+ * @return First page number, or 0 if no block is large enough.
+ */
+static u64 alloc_run(u64 count, u64 *got)
+{
+  if(count > (1ULL << PMM_MAX_ORDER)) {
+    *got = (count + (1ULL << PMM_MAX_ORDER) - 1) &
+           ~((1ULL << PMM_MAX_ORDER) - 1);
+    return alloc_large(count);
+  }
+
+  u32 order = 0;
+  while((1ULL << order) < count)
+    order++;
+  *got = 1ULL << order;
+  return alloc_order(order);
+}
+
 /**
  * @brief Initialize the physical memory manager.
  *
- * Parses the memory map to build a bitmap of free/used pages
- * and reserves kernel memory regions.
+ * Parses the memory map, carves the per-page metadata out of the first
+ * usable region large enough, then releases every usable page into the
+ * buddy free lists.
  *
  * @param memmap Limine memory map response.
  * @param hhdm_offset Higher-half direct map offset.
@@ -67,22 +411,44 @@ void pmm_init(struct limine_memmap_response *memmap, u64 hhdm_offset)
   }
 
   total_pages = highest_addr / PAGE_SIZE;
-  bitmap_size =
+
+  /* Metadata layout: [debug bitmap] page_refs[] page_info[] */
+  u64 meta_size = 0;
+#if PMM_DEBUG
+  u64 bitmap_size =
       (total_pages + BITS_PER_ENTRY - 1) / BITS_PER_ENTRY * sizeof(u64);
+  meta_size += bitmap_size;
+#endif
+  u64 refs_off = meta_size;
+  meta_size += total_pages * sizeof(u16);
+  u64 info_off = meta_size;
+  meta_size += total_pages;
+  meta_size = (meta_size + PAGE_SIZE - 1) & ~(u64)(PAGE_SIZE - 1);
 
   for(u64 i = 0; i < memmap->entry_count; i++) {
     struct limine_memmap_entry *e = memmap->entries[i];
-    if(e->type == LIMINE_MEMMAP_USABLE && e->length >= bitmap_size) {
+    if(e->type == LIMINE_MEMMAP_USABLE && e->length >= meta_size) {
+#if PMM_DEBUG
       bitmap = (u64 *)(e->base + hhdm);
-      e->base += bitmap_size;
-      e->length -= bitmap_size;
+#endif
+      page_refs = (u16 *)(e->base + hhdm + refs_off);
+      page_info = (u8 *)(e->base + hhdm + info_off);
+      e->base += meta_size;
+      e->length -= meta_size;
       break;
     }
   }
 
+  /* Everything is reserved until the usable regions are walked below. */
+  for(u64 i = 0; i < total_pages; i++) {
+    page_info[i] = PMM_PAGE_RESERVED;
+    page_refs[i] = 0;
+  }
+#if PMM_DEBUG
   for(u64 i = 0; i < bitmap_size / sizeof(u64); i++) {
     bitmap[i] = ALL_BITS_SET;
   }
+#endif
   free_pages = 0;
 
   for(u64 i = 0; i < memmap->entry_count; i++) {
@@ -90,44 +456,124 @@ void pmm_init(struct limine_memmap_response *memmap, u64 hhdm_offset)
     if(e->type == LIMINE_MEMMAP_USABLE) {
       u64 start = (e->base + PAGE_SIZE - 1) / PAGE_SIZE;
       u64 end   = (e->base + e->length) / PAGE_SIZE;
-      for(u64 p = start; p < end; p++) {
+      /* Page 0 would be indistinguishable from allocation failure. */
+      if(start == 0)
+        start = 1;
+      if(start >= end)
+        continue;
+      for(u64 p = start; p < end; p++)
+        page_info[p] = 0;
+#if PMM_DEBUG
+      for(u64 p = start; p < end; p++)
         bitmap_clear(p);
-        free_pages++;
-      }
+#endif
+      free_range(start, end - start);
     }
   }
+
+  usable_pages = free_pages;
+  wmark_low    = usable_pages / PMM_WMARK_SHARE;
+  if(wmark_low < PMM_WMARK_MIN)
+    wmark_low = PMM_WMARK_MIN;
+  wmark_high = 2 * wmark_low;
+}
+
+/**
+ * @brief Ask the registered shrinkers to give pages back.
+ *
+ * Not re-entered: a shrinker that allocates while reclaiming just sees the
+ * allocation fail.
+ *
+ * @param want Number of pages wanted.
+ * @param balance Called from pmm_balance(): balance-only shrinkers run too.
+ * @return true if anything was freed.
+ */
+static bool pmm_reclaim(u64 want, bool balance)
+{
+  if(reclaiming)
+    return false;
+
+  reclaiming = true;
+  u64 got    = 0;
+  for(u32 i = 0; i < nr_shrinkers && got < want; i++) {
+    if(balance || !shrinkers[i]->balance_only)
+      got += shrinkers[i]->scan(want - got);
+  }
+  reclaimed += got;
+  reclaiming = false;
+  return got > 0;
+}
+
+void pmm_register_shrinker(const pmm_shrinker_t *s)
+{
+  if(nr_shrinkers < PMM_MAX_SHRINKERS)
+    shrinkers[nr_shrinkers++] = s;
+}
+
+bool pmm_balance(void)
+{
+  u64 free = free_pages;
+  return free < wmark_low && pmm_reclaim(wmark_high - free, true);
+}
+
+void pmm_memstat(alcor_memstat_t *out)
+{
+  kzero(out, sizeof(*out));
+  out->total      = usable_pages * PAGE_SIZE;
+  out->free       = free_pages * PAGE_SIZE;
+  out->wmark_low  = wmark_low * PAGE_SIZE;
+  out->wmark_high = wmark_high * PAGE_SIZE;
+  out->reclaimed  = reclaimed * PAGE_SIZE;
+  for(u32 i = 0; i < nr_shrinkers && i < ALCOR_MEMSTAT_CACHES; i++) {
+    alcor_memstat_cache_t *c = &out->cache[out->ncaches++];
+    kstrncpy(c->name, shrinkers[i]->name, ALCOR_MEMSTAT_NAME - 1);
+    c->bytes = shrinkers[i]->count() * PAGE_SIZE;
+  }
 }
 
 /**
  * @brief Allocate a single 4KB physical page.
  *
- * Searches the bitmap for the first free page, marks it as allocated,
- * and returns its physical address.
+ * Pops the most recently freed page from the CPU's hot cache, refilling
+ * the cache from the buddy lists when it runs dry and reclaiming cached
+ * file pages when those are empty too.
  *
  * @return Physical address of the allocated page, or NULL if out of memory.
  */
 void *pmm_alloc(void)
 {
-  for(u64 i = 0; i < bitmap_size / sizeof(u64); i++) {
-    if(bitmap[i] != ALL_BITS_SET) {
-      for(int b = 0; b < BITS_PER_ENTRY; b++) {
-        u64 page = i * BITS_PER_ENTRY + b;
-        if(!bitmap_test(page)) {
-          bitmap_set(page);
-          free_pages--;
-          return (void *)(page * PAGE_SIZE);
-        }
-      }
+  u64        flags = spin_lock_irqsave(&pmm_lock);
+  pmm_pcp_t *c     = pcp_this();
+  if(c->count == 0)
+    pcp_refill(c);
+  if(c->count == 0) {
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    bool freed = pmm_reclaim(PMM_PCP_BATCH, false);
+    flags      = spin_lock_irqsave(&pmm_lock);
+    if(freed && c->count == 0)
+      pcp_refill(c);
+    if(c->count == 0) {
+      spin_unlock_irqrestore(&pmm_lock, flags);
+      return 0;
     }
   }
-  return 0;
+
+  u64 pfn        = c->pfns[--c->count];
+  page_info[pfn] = 0;
+  free_pages--;
+#if PMM_DEBUG
+  debug_mark_used(pfn, 1);
+#endif
+  spin_unlock_irqrestore(&pmm_lock, flags);
+  return (void *)(pfn * PAGE_SIZE);
 }
 
 /**
  * @brief Allocate multiple contiguous physical pages.
  *
- * Searches for a contiguous region of free pages, marks them as allocated,
- * and returns the physical address of the first page.
+ * Rounds @p count up to a power of two, takes a block of that order and
+ * hands the unused tail back to the free lists. Requests beyond the largest
+ * order are served from adjacent max-order blocks.
  *
  * @param count Number of pages to allocate.
  * @return Physical address of the first page, or NULL if not enough contiguous
@@ -135,61 +581,220 @@ void *pmm_alloc(void)
  */
 void *pmm_alloc_pages(usize count)
 {
-  u64 consecutive = 0;
-  u64 start_page  = 0;
+  if(count == 0)
+    return 0;
 
-  for(u64 p = 0; p < total_pages; p++) {
-    if(!bitmap_test(p)) {
-      if(consecutive == 0)
-        start_page = p;
-      consecutive++;
-      if(consecutive == count) {
-        for(u64 i = start_page; i < start_page + count; i++) {
-          bitmap_set(i);
-        }
-        free_pages -= count;
-        return (void *)(start_page * PAGE_SIZE);
-      }
+  u64 got;
+  u64 flags = spin_lock_irqsave(&pmm_lock);
+  u64 pfn   = alloc_run(count, &got);
+  for(int pass = 0; pfn == 0 && pass < 2; pass++) {
+    /* Second pass: reclaim first, then retry the same way. */
+    if(pass == 1) {
+      spin_unlock_irqrestore(&pmm_lock, flags);
+      bool freed = pmm_reclaim(count, false);
+      flags      = spin_lock_irqsave(&pmm_lock);
+      if(!freed)
+        break;
+    }
+    /* Cached single pages may be what keeps a buddy from merging. */
+    for(u32 i = 0; i < PMM_MAX_CPUS; i++) {
+      while(pcp[i].count > 0)
+        pcp_drain(&pcp[i]);
+    }
+    zero_pool_drain();
+    pfn = alloc_run(count, &got);
+  }
+  if(pfn == 0) {
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return 0;
+  }
+
+  free_pages -= got;
+  if(got > count)
+    free_range(pfn + count, got - count);
+#if PMM_DEBUG
+  debug_mark_used(pfn, count);
+#endif
+  spin_unlock_irqrestore(&pmm_lock, flags);
+  return (void *)(pfn * PAGE_SIZE);
+}
+
+void *pmm_alloc_zeroed(void)
+{
+  u64 flags = spin_lock_irqsave(&pmm_lock);
+  if(zero_count > 0) {
+    u64 pfn        = zero_pfns[--zero_count];
+    page_info[pfn] = 0;
+    free_pages--;
+#if PMM_DEBUG
+    debug_mark_used(pfn, 1);
+#endif
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return (void *)(pfn * PAGE_SIZE);
+  }
+  spin_unlock_irqrestore(&pmm_lock, flags);
+
+  void *page = pmm_alloc();
+  if(page)
+    kzero((void *)((u64)page + hhdm), PAGE_SIZE);
+  return page;
+}
+
+bool pmm_prezero(void)
+{
+  for(u32 i = 0; i < PMM_ZERO_BATCH; i++) {
+    u64 flags = spin_lock_irqsave(&pmm_lock);
+    u64 pfn   = zero_count < PMM_ZERO_POOL ? alloc_order(0) : 0;
+    if(pfn)
+      page_info[pfn] = PMM_PAGE_CACHED;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    if(!pfn)
+      return false;
+
+    /* Off every list and tagged cached, so nobody else can see it. */
+    kzero_nt((void *)(pfn * PAGE_SIZE + hhdm), PAGE_SIZE);
+
+    flags = spin_lock_irqsave(&pmm_lock);
+    if(zero_count < PMM_ZERO_POOL) {
+      zero_pfns[zero_count++] = pfn;
     } else {
-      consecutive = 0;
+      page_info[pfn] = 0;
+      free_block(pfn, 0);
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
   }
-  return 0;
+  return true;
+}
+
+void *pmm_try_alloc_order(u32 order)
+{
+  if(order > PMM_MAX_ORDER)
+    return 0;
+
+  u64 flags = spin_lock_irqsave(&pmm_lock);
+  u64 pfn   = alloc_order(order);
+  if(pfn) {
+    free_pages -= 1ULL << order;
+#if PMM_DEBUG
+    debug_mark_used(pfn, 1ULL << order);
+#endif
+  }
+  spin_unlock_irqrestore(&pmm_lock, flags);
+  return (void *)(pfn * PAGE_SIZE);
 }
 
 /**
  * @brief Free a single physical page.
  *
- * Marks the page as free in the bitmap, making it available for reallocation.
+ * Drops one reference; the last one pushes the page onto the CPU's hot
+ * cache, draining a batch back to the buddy lists when the cache is full.
+ * Addresses outside managed memory and pages that are already free are
+ * ignored.
  *
  * @param addr Physical address of the page to free.
  */
 void pmm_free(void *addr)
 {
-  u64 page = (u64)addr / PAGE_SIZE;
-  if(bitmap_test(page)) {
-    bitmap_clear(page);
-    free_pages++;
+  u64 pfn = (u64)addr / PAGE_SIZE;
+  if(pfn == 0 || pfn >= total_pages)
+    return;
+
+  u64 flags = spin_lock_irqsave(&pmm_lock);
+  if(page_info[pfn] & PMM_PAGE_NOT_OWNED)
+    goto out;
+  if(page_refs[pfn] > 0) {
+    page_refs[pfn]--;
+    goto out;
+  }
+#if PMM_DEBUG
+  if(!bitmap_test(pfn)) {
+    console_printf("[PMM] double free of page 0x%x\n", pfn * PAGE_SIZE);
+    goto out;
   }
+  bitmap_clear(pfn);
+#endif
+
+  pmm_pcp_t *c = pcp_this();
+  if(c->count == PMM_PCP_HIGH)
+    pcp_drain(c);
+  page_info[pfn]      = PMM_PAGE_CACHED;
+  c->pfns[c->count++] = pfn;
+  free_pages++;
+out:
+  spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 /**
  * @brief Free multiple contiguous physical pages.
  *
- * Marks a range of pages as free in the bitmap.
+ * The range need not match a previous allocation; it is split into
+ * maximal aligned blocks which are merged with their buddies. Reference
+ * counts are not consulted: use pmm_free() for pages that may be shared.
  *
  * @param addr Physical address of the first page.
  * @param count Number of pages to free.
  */
 void pmm_free_pages(void *addr, usize count)
 {
-  u64 page = (u64)addr / PAGE_SIZE;
-  for(usize i = 0; i < count; i++) {
-    if(bitmap_test(page + i)) {
-      bitmap_clear(page + i);
-      free_pages++;
+  u64 pfn = (u64)addr / PAGE_SIZE;
+  if(pfn == 0 || pfn >= total_pages)
+    return;
+  if(count > total_pages - pfn)
+    count = total_pages - pfn;
+
+  u64 flags = spin_lock_irqsave(&pmm_lock);
+#if PMM_DEBUG
+  for(u64 p = pfn; p < pfn + count; p++) {
+    if(!bitmap_test(p)) {
+      console_printf("[PMM] double free of page 0x%x\n", p * PAGE_SIZE);
+      continue;
     }
+    bitmap_clear(p);
+    free_range(p, 1);
+  }
+#else
+  if(!(page_info[pfn] & PMM_PAGE_NOT_OWNED))
+    free_range(pfn, count);
+#endif
+  spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+/**
+ * @brief Add a reference to an allocated page.
+ *
+ * Each reference is later dropped by one pmm_free() of the page.
+ *
+ * @param addr Physical address of the page.
+ * @return true if the page is managed RAM and was referenced, false for
+ *         addresses the PMM does not own (MMIO, framebuffer, ...).
+ */
+bool pmm_page_ref(void *addr)
+{
+  u64 pfn = (u64)addr / PAGE_SIZE;
+  if(pfn == 0 || pfn >= total_pages)
+    return false;
+
+  u64  flags = spin_lock_irqsave(&pmm_lock);
+  bool ok    = false;
+  if(!(page_info[pfn] & PMM_PAGE_NOT_OWNED) && page_refs[pfn] != 0xFFFF) {
+    page_refs[pfn]++;
+    ok = true;
   }
+  spin_unlock_irqrestore(&pmm_lock, flags);
+  return ok;
+}
+
+/**
+ * @brief Check whether an allocated page has more than one owner.
+ * @param addr Physical address of the page.
+ * @return true if pmm_free() would only drop a reference.
+ */
+bool pmm_page_shared(void *addr)
+{
+  u64 pfn = (u64)addr / PAGE_SIZE;
+  if(pfn >= total_pages)
+    return false;
+  return page_refs[pfn] > 0;
 }
 
 /**
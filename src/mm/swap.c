@@ -0,0 +1,502 @@
+/**
+ * @file src/mm/swap.c
+ * @brief Compressed swap for anonymous memory.
+ *
+ * The scanner is a clock over every process's private regions, driven by
+ * a balance-only PMM shrinker: a page whose accessed bit is set has it
+ * cleared and is passed over, one still clear a lap later is compressed
+ * with LZ4 into a heap allocation and its frame freed. Zero-filled pages
+ * take no pool space at all; pages that do not shrink to
+ * ::SWAP_MAX_STORED bytes stay resident, unless there is a swap device for
+ * them to go to. The clock hand is a (pid, address) pair, so it survives
+ * the process it points into exiting.
+ *
+ * Slots are numbered; the number goes in the PTE and indexes a table of
+ * chunks that grows on demand and never moves. A slot counts the swap
+ * entries naming it (page tables copied by fork each hold one).
+ *
+ * With a swap device, the kernel task kswapd keeps the pool below half its
+ * budget by writing the coldest slots out in whole pages, walking the slot
+ * table with a hand of its own. A slot being written keeps its pool copy
+ * until the write completes, so faults and frees never wait for kswapd;
+ * one freed meanwhile is left for kswapd to release.
+ *
+ * Everything runs on the BSP in process context, and kernel code is only
+ * preempted when it sleeps, so the tables need no lock: the only sleep is
+ * disk I/O, across which callers hold a slot reference.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/drivers/ata.h>
+#include <alcor2/drivers/console.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/lz4.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/memory_layout.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/swap.h>
+#include <alcor2/mm/vma.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+#include <alcor2/proc/wait.h>
+
+/** @brief The pool may hold at most 1/N of physical memory. */
+#define SWAP_POOL_SHARE  4
+/** @brief Compressed pages larger than this are not worth keeping. */
+#define SWAP_MAX_STORED  (PAGE_SIZE * 3 / 4)
+/** @brief Slots per table chunk. */
+#define SWAP_CHUNK_SLOTS 256
+/** @brief Slots allowed per page of RAM, on top of the device's pages. */
+#define SWAP_SLOTS_RATIO 4
+/** @brief Leaves the scanner looks at per call, at most. */
+#define SWAP_SCAN_MAX    32768
+/** @brief End of ::swap_free_head's list. */
+#define SWAP_NO_SLOT     0xFFFFFFFFU
+/** @brief Sectors per page on the swap device. */
+#define SWAP_PAGE_SECTORS (PAGE_SIZE / ATA_SECTOR_SIZE)
+
+/** @brief Linux swap header ("mkswap"), in the device's first page. */
+#define SWAP_MAGIC     "SWAPSPACE2"
+#define SWAP_MAGIC_OFF (PAGE_SIZE - 10)
+#define SWAP_LAST_OFF  1028 /* u32 last_page, after version */
+
+/** @brief One swapped-out page. */
+typedef struct
+{
+  void *data;    /* Compressed copy on the heap, or NULL */
+  u32   link;    /* Next free slot, while free */
+  u32   disk;    /* Page on the swap device, or 0 */
+  u16   len;     /* Bytes at data: 0 = zero page, PAGE_SIZE = raw */
+  u16   refs;    /* Swap entries naming it; 0 = free */
+  bool  writing; /* kswapd is copying it to the device */
+} swap_slot_t;
+
+/** @brief Progress of one scanner call. */
+typedef struct
+{
+  u64 want;   /* Frames to free */
+  u64 got;    /* Frames freed */
+  u64 budget; /* Leaves left to look at */
+} swap_scan_t;
+
+static swap_slot_t **chunks;
+static u32           nr_chunks;
+static u32           max_chunks;
+static u32           swap_free_head = SWAP_NO_SLOT;
+
+static u64 pool_bytes; /* heap held by slots */
+static u64 pool_pages; /* slots in the pool, zero pages included */
+static u64 pool_max;
+
+static u64 hand_pid;  /* clock hand: process ... */
+static u64 hand_addr; /* ... and next address in it */
+
+static u8  scratch[PAGE_SIZE] __attribute__((aligned(8)));
+static u32 lz4_work[LZ4_WORK_SIZE / sizeof(u32)];
+
+/* Swap device: a drive with a swap signature, pages 1 .. disk_pages - 1. */
+static bool         disk_on;
+static u8           disk_drive;
+static u32          disk_pages;
+static u32          disk_used;
+static u32          disk_hint;
+static u64         *disk_map;
+static u8          *disk_bounce;
+static u32          spill_hand;
+static wait_queue_t kswapd_wait;
+
+static inline u64 swap_entry(u32 slot)
+{
+  return ((u64)slot << 12) | VMM_SWAP;
+}
+
+static inline swap_slot_t *slot_get(u32 n)
+{
+  return &chunks[n / SWAP_CHUNK_SLOTS][n % SWAP_CHUNK_SLOTS];
+}
+
+static inline swap_slot_t *entry_slot(u64 entry)
+{
+  return slot_get((u32)((entry & PAGE_FRAME_MASK) >> 12));
+}
+
+/* Take a free slot, growing the table by a chunk if needed. */
+static bool slot_alloc(u32 *out)
+{
+  if(swap_free_head == SWAP_NO_SLOT) {
+    if(nr_chunks == max_chunks)
+      return false;
+    swap_slot_t *c = kzalloc(SWAP_CHUNK_SLOTS * sizeof(*c));
+    if(!c)
+      return false;
+    u32 base            = nr_chunks * SWAP_CHUNK_SLOTS;
+    chunks[nr_chunks++] = c;
+    for(u32 i = 0; i < SWAP_CHUNK_SLOTS; i++)
+      c[i].link = i + 1 < SWAP_CHUNK_SLOTS ? base + i + 1 : SWAP_NO_SLOT;
+    swap_free_head = base;
+  }
+
+  u32          n = swap_free_head;
+  swap_slot_t *s = slot_get(n);
+  swap_free_head = s->link;
+  *out           = n;
+  return true;
+}
+
+static void slot_release(u32 n)
+{
+  swap_slot_t *s = slot_get(n);
+  kzero(s, sizeof(*s));
+  s->link        = swap_free_head;
+  swap_free_head = n;
+}
+
+/* Drop the pool copy of a slot. */
+static void slot_unpool(swap_slot_t *s)
+{
+  if(s->data) {
+    kfree(s->data);
+    pool_bytes -= s->len;
+    s->data = NULL;
+  }
+  if(!s->disk)
+    pool_pages--;
+}
+
+static u32 disk_alloc(void)
+{
+  for(u32 i = 0; i < disk_pages; i++) {
+    u32 p = disk_hint + i;
+    if(p >= disk_pages)
+      p -= disk_pages;
+    if(p && !(disk_map[p / 64] & (1ULL << (p % 64)))) {
+      disk_map[p / 64] |= 1ULL << (p % 64);
+      disk_hint = p + 1;
+      disk_used++;
+      return p;
+    }
+  }
+  return 0;
+}
+
+static void disk_release(u32 p)
+{
+  disk_map[p / 64] &= ~(1ULL << (p % 64));
+  disk_used--;
+}
+
+/* Move one page between @p buf and page @p p of the swap device. */
+static i64 disk_io(u8 op, u32 p, void *buf)
+{
+  ata_bio_t bio = {
+      .lba    = (u64)p * SWAP_PAGE_SECTORS,
+      .count  = SWAP_PAGE_SECTORS,
+      .drive  = disk_drive,
+      .op     = op,
+      .nseg   = 1,
+      .seg[0] = {buf, PAGE_SIZE},
+  };
+  i64 r = ata_submit(&bio);
+  return r < 0 ? r : ata_wait(&bio);
+}
+
+static bool spill_wanted(void)
+{
+  return disk_on && pool_bytes > pool_max / 2 && disk_used + 1 < disk_pages;
+}
+
+/* Decide what to keep of @p page; false if it stays resident. */
+static bool swap_store(const void *page, u32 *slot)
+{
+  const u64 *w = page;
+  u32        i = 0;
+  while(i < PAGE_SIZE / sizeof(u64) && !w[i])
+    i++;
+
+  const void *src = scratch;
+  u32         len = 0;
+  if(i < PAGE_SIZE / sizeof(u64)) {
+    len = lz4_compress(page, PAGE_SIZE, scratch, SWAP_MAX_STORED, lz4_work);
+    if(!len && !disk_on)
+      return false;
+    if(!len) {
+      /* kswapd will take it to the device as is. */
+      src = page;
+      len = PAGE_SIZE;
+    }
+    if(pool_bytes + len > pool_max)
+      return false;
+  }
+
+  void *data = NULL;
+  if(len && !(data = kmalloc(len)))
+    return false;
+  if(!slot_alloc(slot)) {
+    kfree(data);
+    return false;
+  }
+  if(data)
+    kmemcpy(data, src, len);
+
+  swap_slot_t *s = slot_get(*slot);
+  s->data        = data;
+  s->len         = (u16)len;
+  s->refs        = 1;
+  pool_bytes    += len;
+  pool_pages++;
+  if(spill_wanted())
+    wait_wake_one(&kswapd_wait);
+  return true;
+}
+
+/* Clock step for one leaf (vmm_walk_private visitor). */
+static bool swap_visit(u64 pml4_phys, u64 virt, u64 *pte, void *arg)
+{
+  swap_scan_t *sc = arg;
+  u64          e  = *pte;
+  u64          pa = e & PAGE_FRAME_MASK;
+  sc->budget--;
+
+  if(e & VMM_ACCESSED) {
+    *pte = e & ~VMM_ACCESSED;
+    vmm_flush_page_in(pml4_phys, virt);
+  } else if(!(e & VMM_SHARED) && (e & VMM_USER) && pa != vmm_zero_page() &&
+            !pmm_page_shared((void *)pa)) {
+    /* A copy-on-write frame with no other owner left is ours alone. */
+    u32 slot;
+    if(swap_store(phys_to_virt(pa), &slot)) {
+      *pte = swap_entry(slot);
+      vmm_flush_page_in(pml4_phys, virt);
+      pmm_free((void *)pa);
+      sc->got++;
+    }
+  }
+  return sc->got >= sc->want || sc->budget == 0;
+}
+
+static bool swap_scannable(const proc_t *p)
+{
+  return p->state != PROC_STATE_FREE && p->state != PROC_STATE_ZOMBIE &&
+         !p->kentry && !p->vm_borrowed && p->cr3;
+}
+
+/* Scan @p p from @p from; returns where to resume, or 0 once through. */
+static u64 swap_scan_proc(const proc_t *p, u64 from, swap_scan_t *sc)
+{
+  for(u32 i = 0; i < p->vmas.count; i++) {
+    const vma_t *v = &p->vmas.v[i];
+    if(v->end <= from || (v->flags & (VMA_SHARED | VMA_DEVICE)))
+      continue;
+    u64 start = v->start > from ? v->start : from;
+    u64 next  = vmm_walk_private(p->cr3, start, v->end, swap_visit, sc);
+    if(sc->got >= sc->want || sc->budget == 0)
+      return next;
+  }
+  return 0;
+}
+
+static u64 swap_scan(u64 nr)
+{
+  swap_scan_t sc = {.want = nr, .budget = SWAP_SCAN_MAX};
+  proc_t     *p  = proc_get(hand_pid);
+  if(!p) {
+    p         = proc_list_head();
+    hand_addr = 0;
+  }
+
+  /* At most one lap, back to the start of the process it began in. */
+  for(proc_t *first = p; p;) {
+    if(swap_scannable(p)) {
+      hand_addr = swap_scan_proc(p, hand_addr, &sc);
+      if(hand_addr)
+        break;
+    }
+    hand_addr = 0;
+    p         = p->all_next ? p->all_next : proc_list_head();
+    if(p == first)
+      break;
+  }
+  hand_pid = p ? p->pid : 0;
+  return sc.got;
+}
+
+static u64 swap_count(void)
+{
+  return (pool_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+static const pmm_shrinker_t swap_shrinker = {
+    .name         = "swap",
+    .scan         = swap_scan,
+    .count        = swap_count,
+    .balance_only = true,
+};
+
+/* Write the next pooled slot out to the device; false if there was none
+ * or no room. */
+static bool swap_spill(void)
+{
+  u32 total = nr_chunks * SWAP_CHUNK_SLOTS;
+  u32 n     = 0;
+  u32 i     = 0;
+  for(; i < total; i++) {
+    n = (spill_hand + i) % total;
+    const swap_slot_t *s = slot_get(n);
+    if(s->refs && s->data && !s->writing)
+      break;
+  }
+  if(i == total)
+    return false;
+  spill_hand = n + 1;
+
+  u32 page = disk_alloc();
+  if(!page)
+    return false;
+  swap_slot_t *s = slot_get(n);
+  if(s->len == PAGE_SIZE)
+    kmemcpy(disk_bounce, s->data, PAGE_SIZE);
+  else
+    lz4_decompress(s->data, s->len, disk_bounce, PAGE_SIZE);
+  s->writing = true;
+  i64 r      = disk_io(ATA_BIO_WRITE, page, disk_bounce);
+  s->writing = false;
+
+  if(r < 0 || !s->refs) {
+    disk_release(page);
+    if(!s->refs)
+      slot_release(n);
+    return r >= 0;
+  }
+  slot_unpool(s);
+  s->disk = page;
+  return true;
+}
+
+/* Kernel task: keep the pool within budget while the device has room. */
+static void kswapd(void)
+{
+  for(;;) {
+    cpu_disable_interrupts();
+    while(!spill_wanted())
+      wait_sleep(&kswapd_wait, 0, 0);
+    cpu_enable_interrupts();
+    /* Drain to a quarter, so the next wake is a while off. */
+    while(pool_bytes > pool_max / 4 && swap_spill())
+      ;
+    if(spill_wanted()) {
+      /* Nothing left to write: wait for the scanner to store more. */
+      cpu_disable_interrupts();
+      wait_sleep(&kswapd_wait, 0, 0);
+      cpu_enable_interrupts();
+    }
+  }
+}
+
+/* Look for a drive carrying a Linux swap signature. */
+static void swap_probe_disk(void)
+{
+  u8 *hdr = kmalloc(PAGE_SIZE);
+  if(!hdr)
+    return;
+  for(u8 d = 0; d < 4 && !disk_on; d++) {
+    const ata_drive_t *dr = ata_get_drive(d);
+    if(!dr || !dr->present || dr->atapi ||
+       dr->sectors < 2 * SWAP_PAGE_SECTORS ||
+       ata_read(d, 0, SWAP_PAGE_SECTORS, hdr) < 0 ||
+       kstrncmp((const char *)hdr + SWAP_MAGIC_OFF, SWAP_MAGIC, 10) != 0)
+      continue;
+
+    u32 last = *(const u32 *)(hdr + SWAP_LAST_OFF);
+    u64 max  = dr->sectors / SWAP_PAGE_SECTORS;
+    u64 n    = (u64)last + 1 < max ? (u64)last + 1 : max;
+    disk_map = kzalloc((n + 63) / 64 * sizeof(u64));
+    void *b  = pmm_alloc();
+    if(n < 2 || !disk_map || !b) {
+      kfree(disk_map);
+      if(b)
+        pmm_free(b);
+      continue;
+    }
+    disk_bounce = phys_to_virt((u64)b);
+    disk_drive  = d;
+    disk_pages  = (u32)n;
+    disk_on     = true;
+  }
+  kfree(hdr);
+}
+
+void swap_init(void)
+{
+  u64 ram_pages = pmm_get_total() / PAGE_SIZE;
+  pool_max      = pmm_get_total() / SWAP_POOL_SHARE;
+  swap_probe_disk();
+
+  u64 slots  = ram_pages * SWAP_SLOTS_RATIO + disk_pages;
+  max_chunks = (u32)((slots + SWAP_CHUNK_SLOTS - 1) / SWAP_CHUNK_SLOTS);
+  chunks     = kzalloc(max_chunks * sizeof(*chunks));
+  if(!chunks)
+    return;
+  if(disk_on) {
+    if(proc_create_kernel("kswapd", kswapd))
+      console_printf(
+          "[SWAP] drive %u, %u MiB\n", disk_drive,
+          (u32)(disk_pages / (1024 * 1024 / PAGE_SIZE))
+      );
+    else
+      disk_on = false;
+  }
+  pmm_register_shrinker(&swap_shrinker);
+}
+
+void swap_dup(u64 entry)
+{
+  swap_slot_t *s = entry_slot(entry);
+  if(s->refs < 0xFFFF)
+    s->refs++;
+}
+
+void swap_free(u64 entry)
+{
+  u32          n = (u32)((entry & PAGE_FRAME_MASK) >> 12);
+  swap_slot_t *s = slot_get(n);
+  if(!s->refs || --s->refs)
+    return;
+
+  slot_unpool(s);
+  if(s->disk)
+    disk_release(s->disk);
+  s->disk = 0;
+  /* kswapd still has it: it releases the slot once the write completes. */
+  if(!s->writing)
+    slot_release(n);
+}
+
+bool swap_read(u64 entry, void *page)
+{
+  swap_slot_t *s = entry_slot(entry);
+  if(!s->refs)
+    return false;
+
+  bool ok = true;
+  if(s->data && s->len == PAGE_SIZE) {
+    kmemcpy(page, s->data, PAGE_SIZE);
+  } else if(s->data) {
+    ok = lz4_decompress(s->data, s->len, page, PAGE_SIZE) == PAGE_SIZE;
+  } else if(s->disk) {
+    /* Keep the slot while asleep: the entry may be dropped meanwhile. */
+    s->refs++;
+    ok = disk_io(ATA_BIO_READ, s->disk, page) >= 0;
+    swap_free(entry);
+  } else {
+    kzero(page, PAGE_SIZE);
+  }
+  return ok;
+}
+
+void swap_stats(swap_stats_t *out)
+{
+  out->pool      = pool_bytes;
+  out->pooled    = pool_pages * PAGE_SIZE;
+  out->disk      = disk_on ? (u64)(disk_pages - 1) * PAGE_SIZE : 0;
+  out->disk_used = (u64)disk_used * PAGE_SIZE;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file src/mm/uaccess.c
+ * @brief User memory copies that fail with -EFAULT instead of faulting.
+ *
+ * Each instruction here that dereferences a user address gets an
+ * @c .ex_table entry naming the instruction and the label to resume at.
+ * Entries hold offsets relative to themselves, so the position-independent
+ * kernel needs no relocations for them. The page-fault handler first tries
+ * demand paging; if the address has no VMA (or the access is not allowed)
+ * it looks the faulting RIP up here and resumes at the fixup, where the
+ * copy sees its error.
+ */
+
+#include <alcor2/errno.h>
+#include <alcor2/mm/memory_layout.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/uaccess.h>
+#include <alcor2/mm/vmm.h>
+
+/** @brief One user access: where it is and where to go if it faults. */
+typedef struct
+{
+  i32 insn;  /**< Faulting instruction, relative to this field. */
+  i32 fixup; /**< Resume address, relative to this field. */
+} uaccess_extable_t;
+
+/** @brief Bounds of the table, from the linker script. */
+extern const uaccess_extable_t __ex_table_start[]
+    __attribute__((visibility("hidden")));
+extern const uaccess_extable_t __ex_table_end[]
+    __attribute__((visibility("hidden")));
+
+/** @brief Assembler lines recording that a fault at @p from resumes at @p to. */
+#define UACCESS_EXTABLE(from, to)                                              \
+  ".pushsection .ex_table, \"a\"\n"                                            \
+  ".balign 4\n"                                                                \
+  ".long " from " - ., " to " - .\n"                                           \
+  ".popsection\n"
+
+/**
+ * @brief Copy with rep movsb, stopping at the first bad address.
+ * @return Bytes not copied (0 on success).
+ */
+static u64 copy_raw(void *dst, const void *src, u64 n)
+{
+  __asm__ volatile("1: rep movsb\n"
+                   "2:\n" UACCESS_EXTABLE("1b", "2b")
+                   : "+D"(dst), "+S"(src), "+c"(n)
+                   :
+                   : "memory");
+  return n;
+}
+
+/** @brief Read one user byte into @p out. @return 0 or -EFAULT. */
+static inline int get_user_u8(u8 *out, const char *p)
+{
+  int err = -EFAULT;
+  u8  v   = 0;
+  __asm__ volatile("1: movb (%[p]), %[v]\n"
+                   "   xorl %[err], %[err]\n"
+                   "2:\n" UACCESS_EXTABLE("1b", "2b")
+                   : [err] "+r"(err), [v] "+q"(v)
+                   : [p] "r"(p));
+  *out = v;
+  return err;
+}
+
+int copy_from_user(void *dst, const void *src, u64 n)
+{
+  if(!vmm_is_user_range(src, n))
+    return -EFAULT;
+  return copy_raw(dst, src, n) ? -EFAULT : 0;
+}
+
+int copy_to_user(void *dst, const void *src, u64 n)
+{
+  if(!vmm_is_user_range(dst, n))
+    return -EFAULT;
+  return copy_raw(dst, src, n) ? -EFAULT : 0;
+}
+
+i64 strncpy_from_user(char *dst, const char *src, u64 size)
+{
+  for(u64 i = 0; i < size; i++) {
+    u8 c;
+    if(!vmm_is_user_ptr(src + i) || get_user_u8(&c, src + i))
+      return -EFAULT;
+    dst[i] = (char)c;
+    if(!c)
+      return (i64)i;
+  }
+  return -ENAMETOOLONG;
+}
+
+i64 strnlen_user(const char *src, u64 max)
+{
+  for(u64 i = 0; i < max; i++) {
+    u8 c;
+    if(!vmm_is_user_ptr(src + i) || get_user_u8(&c, src + i))
+      return -EFAULT;
+    if(!c)
+      return (i64)i;
+  }
+  return (i64)max;
+}
+
+i64 pin_user_pages(u64 addr, u64 len, bool write, u64 *pages)
+{
+  if(len == 0 || !vmm_is_user_range((const void *)addr, len))
+    return -EFAULT;
+
+  u64 base = addr & ~(PAGE_SIZE - 1);
+  u64 n    = (addr + len - base + PAGE_SIZE - 1) / PAGE_SIZE;
+  u64 need = VMM_PRESENT | VMM_USER | (write ? VMM_WRITE : 0);
+  for(u64 i = 0; i < n; i++) {
+    u64 va = base + i * PAGE_SIZE;
+    u64 at = va < addr ? addr : va;
+    u8  b;
+
+    /* Touch a byte of the buffer on this page: demand paging, swap-in and
+     * COW then leave the frame mapped as the device will use it. */
+    if(copy_raw(&b, (const void *)at, 1) ||
+       (write && copy_raw((void *)at, &b, 1))) {
+      unpin_user_pages(pages, i);
+      return -EFAULT;
+    }
+    u64 pte = vmm_get_leaf(va);
+    if((pte & need) != need || (write && (pte & VMM_COW)) ||
+       !pmm_page_ref((void *)(pte & PAGE_FRAME_MASK))) {
+      unpin_user_pages(pages, i);
+      return -EFAULT;
+    }
+    pages[i] = pte & PAGE_FRAME_MASK;
+  }
+  return (i64)n;
+}
+
+void unpin_user_pages(const u64 *pages, u64 n)
+{
+  for(u64 i = 0; i < n; i++)
+    pmm_free((void *)pages[i]);
+}
+
+u64 uaccess_fixup(u64 rip)
+{
+  for(const uaccess_extable_t *e = __ex_table_start; e < __ex_table_end;
+      e++) {
+    if((u64)&e->insn + (i64)e->insn == rip)
+      return (u64)&e->fixup + (i64)e->fixup;
+  }
+  return 0;
+}
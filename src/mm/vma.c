@@ -0,0 +1,529 @@
+/**
+ * @file src/mm/vma.c
+ * @brief Per-process virtual memory areas and demand-zero page faults.
+ *
+ * Regions are kept in a kmalloc'd array sorted by address, with no
+ * overlaps, so lookups are a binary search and splits/merges are a
+ * memmove. Regions are not populated by mmap/brk; the #PF path maps the
+ * shared zero page on first read of anonymous memory, a private zeroed page
+ * on first write, and page-cache frames for file regions. Every region
+ * backed by a file holds its own reference on the OFT slot.
+ *
+ * Private file pages are the cache's own frames until written, so every
+ * process running a binary shares one copy of its text and read-only data.
+ * A read fault in a private file region also maps the neighbouring pages
+ * that are already cached: a program exec'd again then takes a fault per
+ * window rather than per page.
+ *
+ * Pages the swap scanner took are read back before anything else is
+ * looked at. A fault that finds memory short pushes cold pages out to swap
+ * and tries again, so a job that overcommits slows down rather than dies.
+ */
+
+#include <alcor2/errno.h>
+#include <alcor2/fs/pagecache.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/memory_layout.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/swap.h>
+#include <alcor2/mm/vma.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/proc/proc.h>
+
+/** @brief Initial capacity of a region array. */
+#define VMA_INITIAL_CAP  16
+/** @brief Pages in the aligned window around a read fault mapped with it. */
+#define VMA_FAULT_AROUND 16
+/** @brief Reclaim rounds a fault short of memory waits through. */
+#define VMA_FAULT_RETRIES 4
+
+/**
+ * @brief Index of the first region ending above @p addr.
+ * @param l Region list.
+ * @param addr Address.
+ * @return Index in [0, count].
+ */
+static u32 vma_lower_bound(const vma_list_t *l, u64 addr)
+{
+  u32 lo = 0;
+  u32 hi = l->count;
+  while(lo < hi) {
+    u32 mid = lo + (hi - lo) / 2;
+    if(l->v[mid].end <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * @brief Make room for @p extra more regions.
+ * @param l Region list.
+ * @param extra Number of regions about to be added.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+static int vma_reserve(vma_list_t *l, u32 extra)
+{
+  if(l->count + extra <= l->cap)
+    return 0;
+
+  u32 cap = l->cap ? l->cap : VMA_INITIAL_CAP;
+  while(cap < l->count + extra)
+    cap *= 2;
+
+  vma_t *v = krealloc(l->v, (u64)cap * sizeof(vma_t));
+  if(!v)
+    return -ENOMEM;
+  l->v   = v;
+  l->cap = cap;
+  return 0;
+}
+
+/**
+ * @brief Insert a region at a given index, shifting the tail up.
+ * @param l Region list (with room reserved).
+ * @param i Index.
+ * @param vma Region to insert.
+ */
+static void vma_insert_at(vma_list_t *l, u32 i, const vma_t *vma)
+{
+  for(u32 j = l->count; j > i; j--)
+    l->v[j] = l->v[j - 1];
+  l->v[i] = *vma;
+  l->count++;
+}
+
+/**
+ * @brief Drop a region's file backing, writing shared pages back first.
+ * @param vma Region being forgotten.
+ */
+static void vma_release(const vma_t *vma)
+{
+  if(vma->file < 0)
+    return;
+  if(vma->flags & VMA_SHARED) {
+    u64 first = vma->offset / PAGE_SIZE;
+    pcache_writeback(
+        vma->file, first, first + (vma->end - vma->start) / PAGE_SIZE
+    );
+  }
+  vfs_oft_release(vma->file);
+}
+
+/**
+ * @brief Delete regions [i, j), shifting the tail down.
+ * @param l Region list.
+ * @param i First index.
+ * @param j End index (exclusive).
+ */
+static void vma_delete_range(vma_list_t *l, u32 i, u32 j)
+{
+  u32 n = j - i;
+  for(u32 k = j; k < l->count; k++)
+    l->v[k - n] = l->v[k];
+  l->count -= n;
+}
+
+/**
+ * @brief Whether @p hi can be folded onto the end of @p lo.
+ * @param lo Lower region.
+ * @param hi Region starting at @p lo's end.
+ * @return true if both map the same kind of memory contiguously.
+ */
+static bool vma_mergeable(const vma_t *lo, const vma_t *hi)
+{
+  if(lo->end != hi->start || lo->flags != hi->flags || lo->file != hi->file)
+    return false;
+  return lo->file < 0 || lo->offset + (lo->end - lo->start) == hi->offset;
+}
+
+/**
+ * @brief Split the region straddling @p addr so a boundary falls on it.
+ * @param l Region list.
+ * @param addr Page-aligned address.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+static int vma_split(vma_list_t *l, u64 addr)
+{
+  u32 i = vma_lower_bound(l, addr);
+  if(i >= l->count || l->v[i].start >= addr)
+    return 0;
+
+  if(vma_reserve(l, 1) < 0)
+    return -ENOMEM;
+
+  vma_t upper = l->v[i];
+  upper.start = addr;
+  if(upper.file >= 0) {
+    upper.offset += addr - l->v[i].start;
+    vfs_oft_retain(upper.file);
+  }
+  l->v[i].end = addr;
+  vma_insert_at(l, i + 1, &upper);
+  return 0;
+}
+
+void vma_list_free(vma_list_t *l)
+{
+  for(u32 i = 0; i < l->count; i++)
+    vma_release(&l->v[i]);
+  if(l->v)
+    kfree(l->v);
+  l->v     = NULL;
+  l->count = 0;
+  l->cap   = 0;
+}
+
+int vma_list_clone(vma_list_t *dst, const vma_list_t *src)
+{
+  dst->v     = NULL;
+  dst->count = 0;
+  dst->cap   = 0;
+  if(src->count == 0)
+    return 0;
+
+  if(vma_reserve(dst, src->count) < 0)
+    return -ENOMEM;
+  kmemcpy(dst->v, src->v, (u64)src->count * sizeof(vma_t));
+  dst->count = src->count;
+  for(u32 i = 0; i < dst->count; i++)
+    vfs_oft_retain(dst->v[i].file);
+  return 0;
+}
+
+const vma_t *vma_find(const vma_list_t *l, u64 addr)
+{
+  u32 i = vma_lower_bound(l, addr);
+  if(i < l->count && l->v[i].start <= addr)
+    return &l->v[i];
+  return NULL;
+}
+
+int vma_insert(vma_list_t *l, const vma_t *vma)
+{
+  if(vma->start >= vma->end)
+    return -EINVAL;
+
+  u32 i = vma_lower_bound(l, vma->start);
+  if(i < l->count && l->v[i].start < vma->end)
+    return -EEXIST;
+
+  bool merge_prev = i > 0 && vma_mergeable(&l->v[i - 1], vma);
+  bool merge_next = i < l->count && vma_mergeable(vma, &l->v[i]);
+
+  /* A merged region already holds a reference on the same file. */
+  if(merge_prev && merge_next) {
+    l->v[i - 1].end = l->v[i].end;
+    vfs_oft_release(l->v[i].file);
+    vma_delete_range(l, i, i + 1);
+    vfs_oft_release(vma->file);
+    return 0;
+  }
+  if(merge_prev) {
+    l->v[i - 1].end = vma->end;
+    vfs_oft_release(vma->file);
+    return 0;
+  }
+  if(merge_next) {
+    l->v[i].start  = vma->start;
+    l->v[i].offset = vma->offset;
+    vfs_oft_release(vma->file);
+    return 0;
+  }
+
+  if(vma_reserve(l, 1) < 0)
+    return -ENOMEM;
+
+  vma_insert_at(l, i, vma);
+  return 0;
+}
+
+int vma_remove(vma_list_t *l, u64 start, u64 end)
+{
+  if(start >= end)
+    return 0;
+  if(vma_split(l, start) < 0 || vma_split(l, end) < 0)
+    return -ENOMEM;
+
+  u32 i = vma_lower_bound(l, start);
+  u32 j = i;
+  while(j < l->count && l->v[j].end <= end)
+    vma_release(&l->v[j++]);
+  vma_delete_range(l, i, j);
+  return 0;
+}
+
+int vma_protect(vma_list_t *l, u64 start, u64 end, u32 prot)
+{
+  if(start >= end)
+    return 0;
+  if(vma_split(l, start) < 0 || vma_split(l, end) < 0)
+    return -ENOMEM;
+
+  for(u32 i = vma_lower_bound(l, start); i < l->count && l->v[i].start < end;
+      i++)
+    l->v[i].flags = (l->v[i].flags & ~VMA_PROT) | (prot & VMA_PROT);
+  return 0;
+}
+
+/**
+ * @brief Page index in the backing file of a page inside a file region.
+ * @param vma File region.
+ * @param page Page-aligned address inside @p vma.
+ * @return File page index.
+ */
+static u64 vma_file_index(const vma_t *vma, u64 page)
+{
+  return (vma->offset + (page - vma->start)) / PAGE_SIZE;
+}
+
+/**
+ * @brief Map the already-cached pages around @p page in a private region.
+ *
+ * Pages are mapped as a read fault would map them; pages that are already
+ * present or not cached are left to their own faults.
+ *
+ * @param vma Private file region.
+ * @param page Page-aligned faulting address (mapped by the caller).
+ * @param flags Page flags for the mappings.
+ */
+static void vma_fault_around(const vma_t *vma, u64 page, u64 flags)
+{
+  u64 window = (u64)VMA_FAULT_AROUND * PAGE_SIZE;
+  u64 start  = page & ~(window - 1);
+  u64 end    = start + window;
+  if(start < vma->start)
+    start = vma->start;
+  if(end > vma->end)
+    end = vma->end;
+
+  for(u64 va = start; va < end; va += PAGE_SIZE) {
+    if(va == page || vmm_get_phys(va))
+      continue;
+    void *phys = pcache_peek_page(vma->file, vma_file_index(vma, va));
+    if(phys)
+      vmm_map(va, (u64)phys, flags);
+  }
+}
+
+/* Whether a shared region's file has been sealed against writes since it
+ * was mapped (mprotect can also make one writable after the seal). */
+static bool vma_write_sealed(const vma_t *vma)
+{
+  i64 seals = vfs_oft_seals(vma->file, 0);
+  return seals > 0 && (seals & F_SEAL_WRITE);
+}
+
+/**
+ * @brief Map a not-present page of a file region from the page cache.
+ * @param vma File region.
+ * @param page Page-aligned faulting address.
+ * @param write Whether the access was a write.
+ * @return true if the page was mapped.
+ */
+static bool vma_fault_file(const vma_t *vma, u64 page, bool write)
+{
+  if(write && (vma->flags & VMA_SHARED) && vma_write_sealed(vma))
+    return false;
+
+  u64   index = vma_file_index(vma, page);
+  void *phys  = pcache_get_page(vma->file, index);
+  if(!phys)
+    return false;
+
+  if(vma->flags & VMA_SHARED) {
+    /* Map read-only until written so the cache learns the page is dirty. */
+    u64 flags = VMM_USER | VMM_SHARED;
+    if(write) {
+      pcache_mark_dirty(vma->file, index);
+      flags |= VMM_WRITE;
+    }
+    vmm_map(page, (u64)phys, flags);
+    return true;
+  }
+
+  /* Private: share the cached frame until the first write copies it. */
+  u64 flags = VMM_USER;
+  if(vma->flags & VMA_WRITE)
+    flags |= VMM_COW;
+  vmm_map(page, (u64)phys, flags);
+  if(!write) {
+    vma_fault_around(vma, page, flags);
+    return true;
+  }
+  return vmm_handle_cow_fault(page);
+}
+
+/**
+ * @brief Back the whole 2 MiB block around a write fault with a huge page.
+ *
+ * Only done for private regions covering the block, when the PMM has an
+ * order-9 block free and nothing in the block is mapped yet.
+ *
+ * @param vma Anonymous region.
+ * @param page Page-aligned faulting address.
+ * @return true if the huge page was mapped.
+ */
+static bool vma_fault_huge(const vma_t *vma, u64 page)
+{
+  u64 base = page & ~(VMM_HUGE_SIZE - 1);
+  if((vma->flags & (VMA_SHARED | VMA_STACK)) || base < vma->start ||
+     base + VMM_HUGE_SIZE > vma->end)
+    return false;
+
+  void *phys = pmm_try_alloc_order(VMM_HUGE_ORDER);
+  if(!phys)
+    return false;
+  kzero_nt(phys_to_virt((u64)phys), VMM_HUGE_SIZE);
+  if(!vmm_map_huge(base, (u64)phys, VMM_USER | VMM_WRITE)) {
+    pmm_free_pages(phys, VMM_HUGE_PAGES);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Map a not-present page of a demand-zero region.
+ * @param vma Anonymous region.
+ * @param page Page-aligned faulting address.
+ * @param write Whether the access was a write.
+ * @return true if the page was mapped.
+ */
+static bool vma_fault_anon(const vma_t *vma, u64 page, bool write)
+{
+  if(write) {
+    if(vma_fault_huge(vma, page))
+      return true;
+    void *phys = pmm_alloc_zeroed();
+    if(!phys)
+      return false;
+    vmm_map(page, (u64)phys, VMM_USER | VMM_WRITE);
+    return true;
+  }
+
+  /* Reads share one zero page until the first write copies it. */
+  u64 flags = VMM_USER;
+  if(vma->flags & VMA_WRITE)
+    flags |= VMM_COW;
+  vmm_map(page, vmm_zero_page(), flags);
+  return true;
+}
+
+/**
+ * @brief Read a swapped-out page back into a fresh frame.
+ * @param vma Region of the page.
+ * @param page Page-aligned faulting address.
+ * @param entry Swap entry of the page.
+ * @return true if the page was mapped (or another fault got there first).
+ */
+static bool vma_fault_swap(const vma_t *vma, u64 page, u64 entry)
+{
+  void *phys = pmm_alloc();
+  if(!phys)
+    return false;
+  if(!swap_read(entry, phys_to_virt((u64)phys))) {
+    pmm_free(phys);
+    return false;
+  }
+  /* A read from the swap device sleeps; the entry may be gone since. */
+  if(vmm_get_leaf(page) != entry) {
+    pmm_free(phys);
+    return true;
+  }
+
+  u64 flags = VMM_USER;
+  if(vma->flags & VMA_WRITE)
+    flags |= VMM_WRITE;
+  vmm_map(page, (u64)phys, flags);
+  return true;
+}
+
+/* Resolve a fault on a page with no mapping. */
+static bool vma_fault_missing(const vma_t *vma, u64 page, bool write)
+{
+  u64 leaf = vmm_get_leaf(page);
+  if(vmm_is_swap(leaf))
+    return vma_fault_swap(vma, page, leaf);
+  if(vma->file >= 0)
+    return vma_fault_file(vma, page, write);
+  if(vma->flags & VMA_ANON)
+    return vma_fault_anon(vma, page, write);
+  return false;
+}
+
+bool vma_handle_fault(u64 addr, u64 err)
+{
+  const proc_t *p     = proc_current();
+  const vma_t  *vma   = p ? vma_find(&p->vmas, addr) : NULL;
+  bool          write = (err & VMM_PF_WRITE) != 0;
+  u64           page  = addr & ~PAGE_OFFSET_MASK;
+
+  if(err & VMM_PF_PRESENT) {
+    if(!write)
+      return false;
+    if(vma && vma->file >= 0 && (vma->flags & VMA_SHARED) &&
+       (vma->flags & VMA_WRITE)) {
+      if(vma_write_sealed(vma))
+        return false;
+      pcache_mark_dirty(vma->file, vma_file_index(vma, page));
+      vmm_protect_range(
+          page, page + PAGE_SIZE, VMM_USER | VMM_WRITE | VMM_SHARED
+      );
+      return true;
+    }
+    for(int i = 0; i < VMA_FAULT_RETRIES; i++) {
+      if(vmm_handle_cow_fault(addr))
+        return true;
+      if(!vma || !pmm_balance())
+        break;
+    }
+    return false;
+  }
+
+  if(!vma || !(vma->flags & VMA_PROT) || (vma->flags & VMA_DEVICE))
+    return false;
+  if(write && !(vma->flags & VMA_WRITE))
+    return false;
+
+  for(int i = 0; i < VMA_FAULT_RETRIES; i++) {
+    if(vma_fault_missing(vma, page, write))
+      return true;
+    if(!pmm_balance())
+      break;
+  }
+  return false;
+}
+
+u32 vma_prefault(const vma_list_t *l, u32 max_pages)
+{
+  u32 mapped = 0;
+  for(u32 i = 0; i < l->count && mapped < max_pages; i++) {
+    const vma_t *vma = &l->v[i];
+    if(vma->file < 0 || !(vma->flags & VMA_PROT) ||
+       (vma->flags & (VMA_SHARED | VMA_DEVICE)))
+      continue;
+    for(u64 page = vma->start; page < vma->end && mapped < max_pages;
+        page += PAGE_SIZE) {
+      if(vmm_get_phys(page))
+        continue;
+      if(!vma_fault_file(vma, page, false))
+        return mapped;
+      mapped++;
+    }
+  }
+  return mapped;
+}
+
+bool vma_fault_write(const vma_list_t *l, u64 addr)
+{
+  const vma_t *vma  = vma_find(l, addr);
+  u64          page = addr & ~PAGE_OFFSET_MASK;
+  u64          leaf = vmm_get_leaf(page);
+  if(leaf & VMM_PRESENT)
+    return (leaf & VMM_WRITE) || vmm_handle_cow_fault(addr);
+  return vma && (vma->flags & VMA_WRITE) &&
+         vma_fault_missing(vma, page, true);
+}
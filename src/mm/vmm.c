@@ -5,11 +5,44 @@
  *
  * Provides `vmm_map` / `vmm_unmap`, fork-time clone, and `vmm_map_range_alloc`
  * to map a run of pages while reusing page-table levels already walked.
+ *
+ * fork() is copy-on-write at two levels. The clone shares every user page
+ * table (PT) between parent and child by write-protecting the PD entries
+ * that point at it and tagging them VMM_COW; the first write under such an
+ * entry gives the writer a private PT whose writable leaves are in turn
+ * write-protected and tagged VMM_COW. Leaf and PT pages carry PMM reference
+ * counts, so pmm_free() only releases a page once its last sharer lets go.
+ *
+ * User PD entries may also be 2 MiB leaves (transparent huge pages for
+ * large anonymous mappings, the kernel heap, the framebuffer). A huge leaf
+ * references each of its 4 KiB frames like 512 PTEs would, so whenever
+ * part of one has to change it is split into a PT over the same frames and
+ * the 4 KiB paths take over. fork() shares huge leaves copy-on-write; the
+ * first write splits the writer's copy. 1 GiB leaves only occur in the
+ * bootloader's HHDM, which is never remapped.
+ *
+ * Kernel-half mappings are global, and where the CPU has PCIDs each address
+ * space loaded recently keeps a PCID tag on its TLB entries, so switching
+ * back to it does not flush them. The VMM_PCID_SLOTS tags are recycled
+ * round-robin; the first load under a recycled tag flushes what the
+ * previous owner left behind. Each CPU has its own tags. A CPU loading an
+ * address space takes its tags away from the others, so that a CPU that
+ * ran it before reloads it flushed rather than with entries that missed
+ * the invlpgs made meanwhile; one that has it loaded when its PTEs change
+ * is sent a shootdown (see smp_tlb_shootdown).
+ *
+ * A non-present leaf is either empty or a swap entry (VMM_SWAP, see
+ * mm/swap.h), which holds a reference on its swap slot the way a present
+ * leaf holds one on its frame: whatever replaces or frees the leaf drops
+ * it, and a page table copied for copy-on-write takes a second one.
  */
 
+#include <alcor2/arch/cpu.h>
+#include <alcor2/arch/smp.h>
 #include <alcor2/kstdlib.h>
 #include <alcor2/mm/memory_layout.h>
 #include <alcor2/mm/pmm.h>
+#include <alcor2/mm/swap.h>
 #include <alcor2/mm/vmm.h>
 #include <alcor2/types.h>
 
@@ -17,6 +50,197 @@ static u64 *kernel_pml4;
 static u64  kernel_pml4_phys;
 static u64  hhdm;
 
+/** @brief Backing store of vmm_zero_page(); lives in the kernel image. */
+static u8   zero_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static u64  zero_page_phys;
+
+/** @brief CR0 write-protect bit: supervisor writes honour read-only PTEs. */
+#define CR0_WP (1ULL << 16)
+
+#define CR4_PGE          (1ULL << 7)
+#define CR4_PCIDE        (1ULL << 17)
+#define CPUID_1_ECX_PCID (1U << 17)
+#define CPUID_1_EDX_PAT  (1U << 16)
+#define MSR_IA32_PAT     0x277
+/** @brief PAT memory type encoding for write-combining. */
+#define PAT_TYPE_WC      0x01ULL
+/** @brief CR3 bit 63: keep the TLB entries tagged with the loaded PCID. */
+#define CR3_NOFLUSH      (1ULL << 63)
+/** @brief PDPT/PD entry maps a 1 GiB/2 MiB page rather than a table. */
+#define PTE_HUGE         (1ULL << 7)
+
+/** @brief PCIDs in use (1 .. VMM_PCID_SLOTS; 0 is never loaded). */
+#define VMM_PCID_SLOTS 32
+/** @brief Range operations over more pages than this flush the whole TLB. */
+#define VMM_FLUSH_ALL_PAGES 32
+
+static bool pcid_enabled;
+/** @brief PML4 whose entries are tagged with PCID @c i + 1 on each CPU,
+ *         or 0. */
+static u64  pcid_owner[SMP_MAX_CPUS][VMM_PCID_SLOTS];
+/** @brief Slot recycled by each CPU's next miss. */
+static u32  pcid_victim[SMP_MAX_CPUS];
+
+/* Forget the tags for @p pml4_phys of every CPU but @p keep (-1: all). */
+static void pcid_drop(u64 pml4_phys, u32 keep)
+{
+  for(u32 c = 0; c < smp_cpu_count(); c++) {
+    for(u32 i = 0; c != keep && i < VMM_PCID_SLOTS; i++) {
+      if(pcid_owner[c][i] == pml4_phys)
+        pcid_owner[c][i] = 0;
+    }
+  }
+}
+
+/**
+ * @brief Flush all non-global TLB entries of the current address space.
+ */
+static inline void flush_tlb(void)
+{
+  u64 cr3;
+  __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+  __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+/**
+ * @brief Invalidate the TLB entries of [start, end) after a range update.
+ *
+ * Small ranges are dropped page by page, which keeps the rest of the TLB;
+ * beyond VMM_FLUSH_ALL_PAGES reloading CR3 is cheaper.
+ */
+static void flush_tlb_range(u64 start, u64 end)
+{
+  if((end - start) / PAGE_SIZE > VMM_FLUSH_ALL_PAGES) {
+    flush_tlb();
+    return;
+  }
+  for(u64 va = start; va < end; va += PAGE_SIZE)
+    __asm__ volatile("invlpg (%0)" ::"r"(va) : "memory");
+}
+
+/** @brief True if the paging-structure table @p t maps nothing, swapped
+ *         out pages included. */
+static bool table_empty(const u64 *t)
+{
+  for(int i = 0; i < 512; i++) {
+    if(t[i])
+      return false;
+  }
+  return true;
+}
+
+/** @brief Release what a leaf being overwritten held besides a frame. */
+static void drop_swap(u64 old)
+{
+  if(vmm_is_swap(old))
+    swap_free(old);
+}
+
+/**
+ * @brief Give the current walker a private copy of a shared page table.
+ *
+ * Every present leaf gains a reference for the new copy, as does every
+ * swap entry, and leaves that were writable become read-only + VMM_COW in
+ * both copies. Pages the PMM
+ * does not own (framebuffer) and MAP_SHARED leaves stay shared exactly as
+ * mapped.
+ *
+ * @param pde PD entry tagged VMM_COW.
+ * @return The now-private page table, or NULL if out of memory.
+ */
+static u64 *pt_make_private(u64 *pde)
+{
+  u64  old_phys = *pde & PAGE_FRAME_MASK;
+  u64 *old_pt   = (u64 *)phys_to_virt(old_phys);
+
+  /* Last sharer: the table is ours already. */
+  if(!pmm_page_shared((void *)old_phys)) {
+    *pde = (*pde | VMM_WRITE) & ~VMM_COW;
+    return old_pt;
+  }
+
+  void *new_phys = pmm_alloc();
+  if(!new_phys)
+    return NULL;
+
+  u64 *new_pt = (u64 *)phys_to_virt((u64)new_phys);
+  for(int i = 0; i < 512; i++) {
+    u64 e = old_pt[i];
+    if((e & VMM_PRESENT) && pmm_page_ref((void *)(e & PAGE_FRAME_MASK)) &&
+       (e & VMM_WRITE) && !(e & VMM_SHARED)) {
+      e         = (e & ~VMM_WRITE) | VMM_COW;
+      old_pt[i] = e;
+    } else if(vmm_is_swap(e)) {
+      swap_dup(e);
+    }
+    new_pt[i] = e;
+  }
+
+  pmm_free((void *)old_phys);
+  *pde = (u64)new_phys | ((*pde & PAGE_OFFSET_MASK) & ~VMM_COW) | VMM_WRITE;
+  flush_tlb();
+  return new_pt;
+}
+
+/**
+ * @brief Replace a 2 MiB leaf with a page table mapping the same frames.
+ *
+ * The PTEs inherit the leaf's flags, copy-on-write included, and take over
+ * its frame references. Until the first PTE changes (and is invalidated
+ * with invlpg, which drops the large TLB entry too) the huge translation
+ * still cached is the same as the new ones.
+ *
+ * @param pde PD entry holding a huge leaf.
+ * @return The new page table, or NULL if out of memory.
+ */
+static u64 *split_huge(u64 *pde)
+{
+  void *pt_phys = pmm_alloc();
+  if(!pt_phys)
+    return NULL;
+
+  u64 *pt   = (u64 *)phys_to_virt((u64)pt_phys);
+  u64  leaf = *pde & ~PTE_HUGE;
+  for(u64 i = 0; i < 512; i++)
+    pt[i] = leaf + i * PAGE_SIZE;
+
+  *pde = (u64)pt_phys | VMM_PRESENT | VMM_WRITE | (*pde & VMM_USER);
+  return pt;
+}
+
+/** @brief Drop the reference a huge leaf holds on each of its frames. */
+static void free_huge(u64 pde)
+{
+  u64 phys = pde & PAGE_FRAME_MASK;
+  for(u64 i = 0; i < VMM_HUGE_PAGES; i++)
+    pmm_free((void *)(phys + i * PAGE_SIZE));
+}
+
+/**
+ * @brief Build a leaf entry, keeping shared pages copy-on-write.
+ *
+ * Re-mapping a page that is still shared with writable flags (mprotect on
+ * memory inherited through fork) must not grant write access to the
+ * shared frame, so the entry becomes read-only + VMM_COW instead. New
+ * leaves start out accessed, so the swap scanner leaves a page alone
+ * until it has gone a whole pass without use.
+ *
+ * @param old Previous leaf entry.
+ * @param phys Physical address to map.
+ * @param flags Requested page flags.
+ * @return Entry to store.
+ */
+static u64 make_leaf(u64 old, u64 phys, u64 flags)
+{
+  u64 e     = (phys & PAGE_FRAME_MASK) | flags | VMM_PRESENT | VMM_ACCESSED;
+  u64 frame = phys & PAGE_FRAME_MASK;
+  if((e & VMM_WRITE) && !(e & VMM_SHARED) && (old & VMM_PRESENT) &&
+     (old & PAGE_FRAME_MASK) == frame &&
+     (frame == zero_page_phys || pmm_page_shared((void *)frame)))
+    e = (e & ~VMM_WRITE) | VMM_COW;
+  return e;
+}
+
 /**
  * @brief Get or create next page table level.
  * @param table Current table.
@@ -28,22 +252,27 @@ static u64  hhdm;
 static u64 *get_next_level(u64 *table, u64 index, bool create, u64 flags)
 {
   if(table[index] & VMM_PRESENT) {
+    /* A huge leaf has no table below it until it is split. */
+    if(table[index] & PTE_HUGE)
+      return create ? split_huge(&table[index]) : NULL;
     /* If user access is needed, ensure it's set on existing entry */
     if((flags & VMM_USER) && !(table[index] & VMM_USER)) {
       table[index] |= VMM_USER;
     }
+    /* Walking to modify: unshare a fork-shared page table first. */
+    if(create && (table[index] & VMM_COW))
+      return pt_make_private(&table[index]);
     return (u64 *)phys_to_virt(table[index] & PAGE_FRAME_MASK);
   }
 
   if(!create)
     return 0;
 
-  void *page = pmm_alloc();
+  void *page = pmm_alloc_zeroed();
   if(!page)
     return 0;
 
   u64 *new_table = (u64 *)phys_to_virt((u64)page);
-  kzero(new_table, 512 * sizeof(u64));
 
   /* Propagate USER flag to intermediate page table levels */
   u64 entry_flags = VMM_PRESENT | VMM_WRITE;
@@ -54,17 +283,80 @@ static u64 *get_next_level(u64 *table, u64 index, bool create, u64 flags)
   return new_table;
 }
 
+/** @brief Mark every leaf under @p table (at @p level, 1 = PT) global. */
+static void set_global(u64 *table, int level)
+{
+  for(int i = 0; i < 512; i++) {
+    if(!(table[i] & VMM_PRESENT))
+      continue;
+    if(level == 1 || (table[i] & PTE_HUGE))
+      table[i] |= VMM_GLOBAL;
+    else
+      set_global((u64 *)phys_to_virt(table[i] & PAGE_FRAME_MASK), level - 1);
+  }
+}
+
+/**
+ * @brief Make PAT entry 1 write-combining on this CPU (see ::VMM_WC).
+ *
+ * Called by vmm_init() on the BSP and by vmm_init_cpu() on every AP.
+ */
+void vmm_pat_init(void)
+{
+  u32 r[4];
+  cpu_cpuid(1, 0, r);
+  if(!(r[3] & CPUID_1_EDX_PAT))
+    return;
+
+  u32 lo, hi;
+  __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(MSR_IA32_PAT));
+  u64 pat = ((u64)hi << 32 | lo) & ~(0xFFULL << 8);
+  pat |= PAT_TYPE_WC << 8;
+
+  /* Nothing maps PWT alone yet, so no TLB entry has the old type; the
+   * caches are written back around the change as the SDM asks. */
+  __asm__ volatile("wbinvd" ::: "memory");
+  __asm__ volatile("wrmsr" ::"a"((u32)pat), "d"((u32)(pat >> 32)),
+                   "c"(MSR_IA32_PAT)
+                   : "memory");
+  __asm__ volatile("wbinvd" ::: "memory");
+}
+
+/**
+ * @brief Turn on global pages, PCIDs if @p pcid, and CR0.WP on this CPU.
+ * @return Whether PCIDs are on.
+ */
+static bool paging_init_cpu(bool pcid)
+{
+  /* Setting PGE flushes the whole TLB, so the new G bits all take hold.
+   * PCIDE needs CR3[11:0] clear, which every CR3 loaded so far has. */
+  u64 cr4;
+  __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+  cr4 |= CR4_PGE;
+  if(pcid)
+    cr4 |= CR4_PCIDE;
+  __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+
+  /* COW relies on kernel writes to user pages faulting too. */
+  u64 cr0;
+  __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+  __asm__ volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_WP));
+  return cr4 & CR4_PCIDE;
+}
+
 /**
  * @brief Initialize the virtual memory manager.
  *
  * Creates a new kernel PML4, copies the higher-half mappings from the
- * bootloader's PML4, and switches to the new page table.
+ * bootloader's PML4, and switches to the new page table. Kernel mappings
+ * are then made global and PCIDs enabled if the CPU has them.
  *
  * @param hhdm_offset Higher-half direct map offset from Limine.
  */
 void vmm_init(u64 hhdm_offset)
 {
   hhdm = hhdm_offset;
+  vmm_pat_init();
 
   void *pml4_phys  = pmm_alloc();
   kernel_pml4_phys = (u64)pml4_phys;
@@ -78,9 +370,29 @@ void vmm_init(u64 hhdm_offset)
 
   for(int i = 256; i < 512; i++) {
     kernel_pml4[i] = old_pml4[i];
+    if(kernel_pml4[i] & VMM_PRESENT)
+      set_global((u64 *)phys_to_virt(kernel_pml4[i] & PAGE_FRAME_MASK), 3);
   }
 
   vmm_switch((u64)pml4_phys);
+  zero_page_phys = vmm_get_phys((u64)zero_page);
+
+  u32 r[4];
+  cpu_cpuid(1, 0, r);
+  pcid_enabled = paging_init_cpu(r[2] & CPUID_1_ECX_PCID);
+}
+
+void vmm_init_cpu(void)
+{
+  vmm_pat_init();
+  /* The AP entry loaded these page tables without going through here. */
+  cpu_this()->pml4 = kernel_pml4_phys;
+  paging_init_cpu(pcid_enabled);
+}
+
+u64 vmm_kernel_pml4(void)
+{
+  return kernel_pml4_phys;
 }
 
 /**
@@ -112,9 +424,81 @@ void vmm_map(u64 virt, u64 phys, u64 flags)
   if(!pt)
     return;
 
-  pt[(virt >> 12) & PAGE_TABLE_INDEX_MASK] =
-      (phys & PAGE_FRAME_MASK) | flags | VMM_PRESENT;
+  if(virt >= KERNEL_SPACE_BASE)
+    flags |= VMM_GLOBAL;
+  u64 *pte = &pt[(virt >> 12) & PAGE_TABLE_INDEX_MASK];
+  u64  old = *pte;
+  *pte     = make_leaf(old, phys, flags);
+  drop_swap(old);
   __asm__ volatile("invlpg (%0)" ::"r"(virt) : "memory");
+  if(virt >= KERNEL_SPACE_BASE && (old & VMM_PRESENT))
+    smp_tlb_shootdown(0, virt);
+}
+
+bool vmm_map_huge_in(u64 pml4_phys, u64 virt, u64 phys, u64 flags)
+{
+  u64 *pml4 = (u64 *)phys_to_virt(pml4_phys);
+  u64 *pdpt =
+      get_next_level(pml4, (virt >> 39) & PAGE_TABLE_INDEX_MASK, true, flags);
+  if(!pdpt)
+    return false;
+  u64 *pd =
+      get_next_level(pdpt, (virt >> 30) & PAGE_TABLE_INDEX_MASK, true, flags);
+  if(!pd)
+    return false;
+
+  /* An empty PT of our own (left by a partial munmap) can go. */
+  u64 *pde = &pd[(virt >> 21) & PAGE_TABLE_INDEX_MASK];
+  if(*pde & VMM_PRESENT) {
+    if(*pde & (PTE_HUGE | VMM_COW))
+      return false;
+    const u64 *pt = (const u64 *)phys_to_virt(*pde & PAGE_FRAME_MASK);
+    if(!table_empty(pt))
+      return false;
+    pmm_free((void *)(*pde & PAGE_FRAME_MASK));
+  }
+
+  if(virt >= KERNEL_SPACE_BASE)
+    flags |= VMM_GLOBAL;
+  *pde = (phys & PAGE_FRAME_MASK) | flags | VMM_PRESENT | PTE_HUGE;
+  __asm__ volatile("invlpg (%0)" ::"r"(virt) : "memory");
+  return true;
+}
+
+bool vmm_map_huge(u64 virt, u64 phys, u64 flags)
+{
+  return vmm_map_huge_in(vmm_get_current_pml4(), virt, phys, flags);
+}
+
+/** @brief Next free address of the MMIO window. */
+static u64 mmio_next = KERNEL_MMIO_BASE;
+
+/* Map [phys, phys + size) at the next free address of the MMIO window. */
+static void *map_window(u64 phys, u64 size, u64 cache)
+{
+  u64 first = phys & ~PAGE_OFFSET_MASK;
+  u64 pages = (phys + size - first + PAGE_SIZE - 1) / PAGE_SIZE;
+  if(size == 0 || pages > (KERNEL_MMIO_END - mmio_next) / PAGE_SIZE)
+    return NULL;
+
+  u64 virt = mmio_next;
+  for(u64 i = 0; i < pages; i++)
+    vmm_map(
+        virt + i * PAGE_SIZE, first + i * PAGE_SIZE,
+        VMM_PRESENT | VMM_WRITE | cache
+    );
+  mmio_next += pages * PAGE_SIZE;
+  return (void *)(virt + (phys - first));
+}
+
+void *vmm_map_mmio(u64 phys, u64 size)
+{
+  return map_window(phys, size, VMM_NOCACHE);
+}
+
+void *vmm_map_wc(u64 phys, u64 size)
+{
+  return map_window(phys, size, VMM_WC);
 }
 
 /**
@@ -138,6 +522,8 @@ bool vmm_map_range_alloc(u64 virt_start, u64 count, u64 flags)
   u64 cr3;
   __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
   u64 *pml4 = (u64 *)phys_to_virt(cr3 & PAGE_FRAME_MASK);
+  if(virt_start >= KERNEL_SPACE_BASE)
+    flags |= VMM_GLOBAL;
 
   /* Cached pointers — invalidated when the corresponding index changes */
   u64  c_pml4_idx = ~0ULL, c_pdpt_idx = ~0ULL, c_pd_idx = ~0ULL;
@@ -176,11 +562,11 @@ bool vmm_map_range_alloc(u64 virt_start, u64 count, u64 flags)
     if(pt[pt_idx] & VMM_PRESENT)
       continue;
 
-    void *phys = pmm_alloc();
+    void *phys = pmm_alloc_zeroed();
     if(!phys)
       return false;
 
-    kzero(phys_to_virt((u64)phys), PAGE_SIZE);
+    drop_swap(pt[pt_idx]);
     pt[pt_idx] = ((u64)phys & PAGE_FRAME_MASK) | flags | VMM_PRESENT;
     __asm__ volatile("invlpg (%0)" ::"r"(virt) : "memory");
   }
@@ -215,13 +601,175 @@ void vmm_unmap(u64 virt)
   if(!pd)
     return;
 
-  u64 *pt = get_next_level(pd, pd_idx, false, 0);
+  u64 *pt;
+  if(pd[pd_idx] & PTE_HUGE)
+    pt = split_huge(&pd[pd_idx]);
+  else if(pd[pd_idx] & VMM_COW)
+    pt = pt_make_private(&pd[pd_idx]);
+  else
+    pt = get_next_level(pd, pd_idx, false, 0);
   if(!pt)
     return;
 
+  drop_swap(pt[pt_idx]);
   pt[pt_idx] = 0;
 
   __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+  /* Kernel-half entries are global: every CPU may hold this one. */
+  if(virt >= KERNEL_SPACE_BASE)
+    smp_tlb_shootdown(0, virt);
+}
+
+/** @brief Bytes mapped by one entry of a table at @p level (1 = PT). */
+static inline u64 level_span(int level)
+{
+  return 1ULL << (12 + 9 * (level - 1));
+}
+
+/**
+ * @brief Tear down [start, end) below one paging-structure table.
+ *
+ * Leaves are unmapped and released, swap entries with them; a lower
+ * table the range covers completely is released with everything below it
+ * in the same pass, and one the range leaves empty is released after it. A
+ * fork-shared PT that is covered completely only loses this address
+ * space's reference. Frames the PMM does not own (framebuffer, zero page)
+ * are ignored by pmm_free().
+ *
+ * @param table Table at @p level (4 = PML4 ... 1 = PT).
+ * @param level Paging level of @p table.
+ * @param base Virtual address mapped by @p table[0].
+ * @param start First address (page-aligned).
+ * @param end End address (page-aligned, exclusive).
+ */
+static void unmap_level(u64 *table, int level, u64 base, u64 start, u64 end)
+{
+  u64 span = level_span(level);
+  u64 i    = start > base ? (start - base) / span : 0;
+
+  for(; i < 512 && base + i * span < end; i++) {
+    u64 *e = &table[i];
+    if(level == 1 && vmm_is_swap(*e)) {
+      swap_free(*e);
+      *e = 0;
+      continue;
+    }
+    if(!(*e & VMM_PRESENT))
+      continue;
+
+    u64 lo   = base + i * span;
+    u64 phys = *e & PAGE_FRAME_MASK;
+    if(level == 1) {
+      *e = 0;
+      pmm_free((void *)phys);
+      continue;
+    }
+
+    bool whole = start <= lo && lo + span <= end;
+    u64 *next  = (u64 *)phys_to_virt(phys);
+    if(level == 2 && (*e & PTE_HUGE)) {
+      if(whole) {
+        free_huge(*e);
+        *e = 0;
+        continue;
+      }
+      next = split_huge(e);
+      if(!next)
+        continue;
+    } else if(level == 2 && (*e & VMM_COW)) {
+      if(whole && pmm_page_shared((void *)phys)) {
+        *e = 0;
+        pmm_free((void *)phys);
+        continue;
+      }
+      next = pt_make_private(e);
+      if(!next)
+        continue;
+    }
+
+    unmap_level(next, level - 1, lo, start, end);
+    if(whole || table_empty(next)) {
+      phys = *e & PAGE_FRAME_MASK;
+      *e   = 0;
+      pmm_free((void *)phys);
+    }
+  }
+}
+
+/**
+ * @brief Re-apply leaf flags to every present page of [start, end) below
+ *        one table, unsharing fork-shared PTs on the way.
+ * @param table Table at @p level (4 = PML4 ... 1 = PT).
+ * @param level Paging level of @p table.
+ * @param base Virtual address mapped by @p table[0].
+ * @param start First address (page-aligned).
+ * @param end End address (page-aligned, exclusive).
+ * @param flags New leaf flags.
+ */
+static void protect_level(
+    u64 *table, int level, u64 base, u64 start, u64 end, u64 flags
+)
+{
+  u64 span = level_span(level);
+  u64 i    = start > base ? (start - base) / span : 0;
+
+  for(; i < 512 && base + i * span < end; i++) {
+    u64 *e = &table[i];
+    if(!(*e & VMM_PRESENT))
+      continue;
+
+    if(level == 1) {
+      *e = make_leaf(*e, *e & PAGE_FRAME_MASK, flags);
+      continue;
+    }
+
+    if(level == 2 && (*e & PTE_HUGE)) {
+      u64 lo = base + i * span;
+      if(start <= lo && lo + span <= end) {
+        /* Shared frames stay read-only; a write fault splits the leaf. */
+        u64 leaf = (*e & (PAGE_FRAME_MASK | VMM_COW)) | flags | VMM_PRESENT |
+                   PTE_HUGE;
+        if(leaf & VMM_COW)
+          leaf &= ~VMM_WRITE;
+        *e = leaf;
+        continue;
+      }
+      if(!split_huge(e))
+        continue;
+    }
+
+    u64 *next = (level == 2 && (*e & VMM_COW))
+                    ? pt_make_private(e)
+                    : (u64 *)phys_to_virt(*e & PAGE_FRAME_MASK);
+    if(next)
+      protect_level(next, level - 1, base + i * span, start, end, flags);
+  }
+}
+
+void vmm_unmap_range(u64 start, u64 end)
+{
+  if(end > USER_SPACE_END)
+    end = USER_SPACE_END;
+  if(start >= end)
+    return;
+
+  unmap_level(
+      (u64 *)phys_to_virt(vmm_get_current_pml4()), 4, 0, start, end
+  );
+  flush_tlb_range(start, end);
+}
+
+void vmm_protect_range(u64 start, u64 end, u64 flags)
+{
+  if(end > USER_SPACE_END)
+    end = USER_SPACE_END;
+  if(start >= end)
+    return;
+
+  protect_level(
+      (u64 *)phys_to_virt(vmm_get_current_pml4()), 4, 0, start, end, flags
+  );
+  flush_tlb_range(start, end);
 }
 
 /**
@@ -250,10 +798,18 @@ u64 vmm_get_phys(u64 virt)
   if(!pdpt)
     return 0;
 
+  /* 1 GiB and 2 MiB leaves (HHDM, huge pages) end the walk early. */
+  u64 span = 1ULL << 30;
+  if((pdpt[pdpt_idx] & (VMM_PRESENT | PTE_HUGE)) == (VMM_PRESENT | PTE_HUGE))
+    return (pdpt[pdpt_idx] & PAGE_FRAME_MASK & ~(span - 1)) |
+           (virt & (span - 1));
   u64 *pd = get_next_level(pdpt, pdpt_idx, false, 0);
   if(!pd)
     return 0;
 
+  span = VMM_HUGE_SIZE;
+  if((pd[pd_idx] & (VMM_PRESENT | PTE_HUGE)) == (VMM_PRESENT | PTE_HUGE))
+    return (pd[pd_idx] & PAGE_FRAME_MASK & ~(span - 1)) | (virt & (span - 1));
   const u64 *pt = get_next_level(pd, pd_idx, false, 0);
   if(!pt)
     return 0;
@@ -264,16 +820,97 @@ u64 vmm_get_phys(u64 virt)
   return (pt[pt_idx] & PAGE_FRAME_MASK) | (virt & PAGE_OFFSET_MASK);
 }
 
+/* PD entry covering @p virt in @p pml4, or NULL if a level above is absent
+ * or a 1 GiB leaf. */
+static u64 *pd_entry(u64 *pml4, u64 virt)
+{
+  u64 *pdpt =
+      get_next_level(pml4, (virt >> 39) & PAGE_TABLE_INDEX_MASK, false, 0);
+  if(!pdpt)
+    return NULL;
+  u64 *pd =
+      get_next_level(pdpt, (virt >> 30) & PAGE_TABLE_INDEX_MASK, false, 0);
+  return pd ? &pd[(virt >> 21) & PAGE_TABLE_INDEX_MASK] : NULL;
+}
+
+u64 vmm_get_leaf(u64 virt)
+{
+  const u64 *pde = pd_entry(phys_to_virt(vmm_get_current_pml4()), virt);
+  if(!pde || !(*pde & VMM_PRESENT) || (*pde & PTE_HUGE))
+    return 0;
+  const u64 *pt = (const u64 *)phys_to_virt(*pde & PAGE_FRAME_MASK);
+  return pt[(virt >> 12) & PAGE_TABLE_INDEX_MASK];
+}
+
+u64 vmm_walk_private(
+    u64 pml4_phys, u64 start, u64 end, vmm_leaf_fn fn, void *arg
+)
+{
+  u64 *pml4 = (u64 *)phys_to_virt(pml4_phys);
+  for(u64 va = start; va < end;) {
+    u64        next = (va + VMM_HUGE_SIZE) & ~(VMM_HUGE_SIZE - 1);
+    const u64 *pde  = pd_entry(pml4, va);
+    if(!pde || (*pde & (VMM_PRESENT | PTE_HUGE | VMM_COW)) != VMM_PRESENT) {
+      va = next;
+      continue;
+    }
+
+    u64 *pt   = (u64 *)phys_to_virt(*pde & PAGE_FRAME_MASK);
+    u64  stop = next < end ? next : end;
+    for(; va < stop; va += PAGE_SIZE) {
+      u64 *pte = &pt[(va >> 12) & PAGE_TABLE_INDEX_MASK];
+      if((*pte & VMM_PRESENT) && fn(pml4_phys, va, pte, arg))
+        return va + PAGE_SIZE;
+    }
+  }
+  return end;
+}
+
+void vmm_flush_page_in(u64 pml4_phys, u64 virt)
+{
+  if(pml4_phys == vmm_get_current_pml4()) {
+    __asm__ volatile("invlpg (%0)" ::"r"(virt) : "memory");
+    return;
+  }
+  /* Without PCIDs the switch to it flushes anyway. */
+  pcid_drop(pml4_phys, (u32)-1);
+  smp_tlb_shootdown(pml4_phys, virt);
+}
+
 /**
  * @brief Switch to a different page table.
  *
  * Loads the specified PML4 into CR3, switching to a different address space.
+ * With PCIDs, an address space that still holds a tag keeps its TLB entries;
+ * otherwise it takes over the oldest tag and the load flushes it.
  *
  * @param pml4_phys Physical address of the PML4 to switch to.
  */
 void vmm_switch(u64 pml4_phys)
 {
-  __asm__ volatile("mov %0, %%cr3" : : "r"(pml4_phys) : "memory");
+  cpu_t *cpu = cpu_this();
+  u64    cr3 = pml4_phys;
+  if(pcid_enabled) {
+    u64 *owner  = pcid_owner[cpu->id];
+    u32 *victim = &pcid_victim[cpu->id];
+    u32  slot   = 0;
+    while(slot < VMM_PCID_SLOTS && owner[slot] != pml4_phys)
+      slot++;
+    if(slot < VMM_PCID_SLOTS) {
+      cr3 |= CR3_NOFLUSH;
+    } else {
+      slot        = *victim;
+      *victim     = (*victim + 1) % VMM_PCID_SLOTS;
+      owner[slot] = pml4_phys;
+    }
+    cr3 |= slot + 1;
+
+    /* The kernel's own tables have no user half to go stale. */
+    if(pml4_phys != kernel_pml4_phys)
+      pcid_drop(pml4_phys, cpu->id);
+  }
+  cpu->pml4 = pml4_phys;
+  __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
 }
 
 /**
@@ -349,7 +986,9 @@ void vmm_map_in(u64 pml4_phys, u64 virt, u64 phys, u64 flags)
   if(!pt)
     return;
 
-  pt[pt_idx] = (phys & PAGE_FRAME_MASK) | flags | VMM_PRESENT;
+  u64 old    = pt[pt_idx];
+  pt[pt_idx] = make_leaf(old, phys, flags);
+  drop_swap(old);
 }
 
 /**
@@ -364,17 +1003,35 @@ u64 vmm_get_current_pml4(void)
 }
 
 /**
- * @brief Clone an address space for fork().
+ * @brief Give a huge leaf a second owner (fork).
  *
- * Creates a new PML4, shares kernel-half entries (256..511) with the source,
- * and eagerly duplicates every user-half leaf: each PT/PD/PDPT level is
- * walked and a fresh physical page is allocated for each present leaf,
- * with its content @c kmemcpy'd from the source. Walk levels themselves
- * are also freshly allocated by @c vmm_map_in.
+ * Each PMM-owned frame gains a reference and the leaf becomes copy-on-write
+ * (even if read-only now, so a later mprotect cannot make the shared frames
+ * writable). MAP_SHARED and device leaves are shared as they are.
  *
- * NOT a copy-on-write implementation — every page is materialised at fork
- * time. Adding COW would mark both sides read-only and fault-trap the
- * first write; today's userland tolerates the eager cost.
+ * @param pde Huge leaf.
+ * @return Entry for both address spaces.
+ */
+static u64 share_huge(u64 pde)
+{
+  u64 phys = pde & PAGE_FRAME_MASK;
+  if(!pmm_page_ref((void *)phys))
+    return pde;
+  for(u64 i = 1; i < VMM_HUGE_PAGES; i++)
+    pmm_page_ref((void *)(phys + i * PAGE_SIZE));
+  if(pde & VMM_SHARED)
+    return pde;
+  return (pde & ~VMM_WRITE) | VMM_COW;
+}
+
+/**
+ * @brief Clone an address space for fork().
+ *
+ * Creates a new PML4 sharing kernel-half entries (256..511), gives the child
+ * fresh PDPT and PD levels for the user half, and shares every PT with the
+ * source: both PD entries are made read-only and tagged VMM_COW, and the PT
+ * page gains a reference. No user page is copied here; writes fault into
+ * vmm_handle_cow_fault(), which unshares the PT and then the page.
  *
  * @param src_pml4_phys Physical address of source PML4 to clone.
  * @return Physical address of new PML4, or 0 on failure.
@@ -387,66 +1044,141 @@ u64 vmm_clone_address_space(u64 src_pml4_phys)
     return 0;
 
   const u64 *src_pml4 = (const u64 *)phys_to_virt(src_pml4_phys);
+  u64       *dst_pml4 = (u64 *)phys_to_virt(dst_pml4_phys);
 
-  /* Walk user-space entries (0-255) and copy mappings */
   for(int pml4_idx = 0; pml4_idx < 256; pml4_idx++) {
     if(!(src_pml4[pml4_idx] & VMM_PRESENT))
       continue;
 
     const u64 *src_pdpt =
         (const u64 *)phys_to_virt(src_pml4[pml4_idx] & PAGE_FRAME_MASK);
+    void *dst_pdpt_phys = pmm_alloc_zeroed();
+    if(!dst_pdpt_phys)
+      goto fail;
+    u64 *dst_pdpt = (u64 *)phys_to_virt((u64)dst_pdpt_phys);
+    dst_pml4[pml4_idx] =
+        (u64)dst_pdpt_phys | (src_pml4[pml4_idx] & PAGE_OFFSET_MASK);
 
     for(int pdpt_idx = 0; pdpt_idx < 512; pdpt_idx++) {
       if(!(src_pdpt[pdpt_idx] & VMM_PRESENT))
         continue;
 
-      const u64 *src_pd =
-          (const u64 *)phys_to_virt(src_pdpt[pdpt_idx] & PAGE_FRAME_MASK);
+      u64 *src_pd =
+          (u64 *)phys_to_virt(src_pdpt[pdpt_idx] & PAGE_FRAME_MASK);
+      void *dst_pd_phys = pmm_alloc_zeroed();
+      if(!dst_pd_phys)
+        goto fail;
+      u64 *dst_pd = (u64 *)phys_to_virt((u64)dst_pd_phys);
+      dst_pdpt[pdpt_idx] =
+          (u64)dst_pd_phys | (src_pdpt[pdpt_idx] & PAGE_OFFSET_MASK);
 
       for(int pd_idx = 0; pd_idx < 512; pd_idx++) {
         if(!(src_pd[pd_idx] & VMM_PRESENT))
           continue;
 
-        const u64 *src_pt =
-            (const u64 *)phys_to_virt(src_pd[pd_idx] & PAGE_FRAME_MASK);
+        if(src_pd[pd_idx] & PTE_HUGE) {
+          src_pd[pd_idx] = share_huge(src_pd[pd_idx]);
+          dst_pd[pd_idx] = src_pd[pd_idx];
+          continue;
+        }
+        if(!pmm_page_ref((void *)(src_pd[pd_idx] & PAGE_FRAME_MASK)))
+          goto fail;
+        src_pd[pd_idx] = (src_pd[pd_idx] & ~VMM_WRITE) | VMM_COW;
+        dst_pd[pd_idx] = src_pd[pd_idx];
+      }
+    }
+  }
 
-        for(int pt_idx = 0; pt_idx < 512; pt_idx++) {
-          if(!(src_pt[pt_idx] & VMM_PRESENT))
-            continue;
+  /* The source just lost write access to its PTs. */
+  if(src_pml4_phys == vmm_get_current_pml4())
+    flush_tlb();
+  return dst_pml4_phys;
 
-          u64 src_phys = src_pt[pt_idx] & PAGE_FRAME_MASK;
-          u64 flags    = src_pt[pt_idx] & PAGE_OFFSET_MASK;
+fail:
+  vmm_destroy_user_mappings(dst_pml4_phys);
+  if(src_pml4_phys == vmm_get_current_pml4())
+    flush_tlb();
+  return 0;
+}
 
-          /* Calculate virtual address */
-          u64 virt = ((u64)pml4_idx << 39) | ((u64)pdpt_idx << 30) |
-                     ((u64)pd_idx << 21) | ((u64)pt_idx << 12);
+u64 vmm_zero_page(void)
+{
+  return zero_page_phys;
+}
 
-          /* Allocate new physical page */
-          void *dst_page = pmm_alloc();
-          if(!dst_page) {
-            /* Out of memory - should cleanup but simplified for now */
-            return 0;
-          }
+/**
+ * @brief Resolve a write fault on a copy-on-write user page.
+ *
+ * Unshares the covering page table if the fault hit a fork-shared PT, then
+ * copies the page if it is still shared (or just restores write access if
+ * this address space is its last owner).
+ *
+ * @param virt Faulting virtual address (CR2).
+ * @return true if the fault was resolved and the access can be retried.
+ */
+bool vmm_handle_cow_fault(u64 virt)
+{
+  u64 *pml4 = (u64 *)phys_to_virt(vmm_get_current_pml4());
 
-          /* Copy page contents */
-          const void *src_data = (const void *)phys_to_virt(src_phys);
-          void       *dst_data = (void *)phys_to_virt((u64)dst_page);
-          kmemcpy(dst_data, src_data, PAGE_SIZE);
+  u64 *pdpt =
+      get_next_level(pml4, (virt >> 39) & PAGE_TABLE_INDEX_MASK, false, 0);
+  if(!pdpt)
+    return false;
+  u64 *pd =
+      get_next_level(pdpt, (virt >> 30) & PAGE_TABLE_INDEX_MASK, false, 0);
+  if(!pd)
+    return false;
 
-          /* Map in destination address space */
-          vmm_map_in(dst_pml4_phys, virt, (u64)dst_page, flags);
-        }
-      }
-    }
+  u64 *pde = &pd[(virt >> 21) & PAGE_TABLE_INDEX_MASK];
+  if(!(*pde & VMM_PRESENT))
+    return false;
+
+  bool unshared = false;
+  u64 *pt       = (u64 *)phys_to_virt(*pde & PAGE_FRAME_MASK);
+  if(*pde & PTE_HUGE) {
+    /* Split; the page below is then copied like any 4 KiB COW page. */
+    if(!(*pde & VMM_COW))
+      return false;
+    pt = split_huge(pde);
+    if(!pt)
+      return false;
+  } else if(*pde & VMM_COW) {
+    pt = pt_make_private(pde);
+    if(!pt)
+      return false;
+    unshared = true;
   }
 
-  return dst_pml4_phys;
+  u64 *pte = &pt[(virt >> 12) & PAGE_TABLE_INDEX_MASK];
+  if(!(*pte & VMM_PRESENT))
+    return false;
+  if(*pte & VMM_WRITE)
+    return unshared;
+  if(!(*pte & VMM_COW))
+    return false;
+
+  u64 phys = *pte & PAGE_FRAME_MASK;
+  if(phys == zero_page_phys || pmm_page_shared((void *)phys)) {
+    void *copy = pmm_alloc();
+    if(!copy)
+      return false;
+    kmemcpy(phys_to_virt((u64)copy), phys_to_virt(phys), PAGE_SIZE);
+    pmm_free((void *)phys);
+    phys = (u64)copy;
+  }
+
+  *pte = (*pte & ~(PAGE_FRAME_MASK | VMM_COW)) | phys | VMM_WRITE;
+  __asm__ volatile("invlpg (%0)" ::"r"(virt) : "memory");
+  return true;
 }
 
 /**
  * @brief Walk the user half (PML4 entries 0..255) of @p pml4_phys and free
  *        every leaf page plus every PT/PD/PDPT level on the way up.
  *
+ * A PT still shared with another address space only loses this reference;
+ * its leaves belong to the remaining sharers.
+ *
  * @param pml4_phys     PML4 physical address to recurse into.
  * @param zero_entries  When @c true, also zeroes the PML4 entries after the
  *                      walk. Required by @c vmm_clear_user_mappings (the
@@ -476,14 +1208,23 @@ static void user_mappings_walk_and_free(u64 pml4_phys, bool zero_entries)
         if(!(pd[pd_idx] & VMM_PRESENT))
           continue;
 
-        const u64 *pt = (const u64 *)phys_to_virt(pd[pd_idx] & PAGE_FRAME_MASK);
+        if(pd[pd_idx] & PTE_HUGE) {
+          free_huge(pd[pd_idx]);
+          continue;
+        }
+
+        u64        pt_phys = pd[pd_idx] & PAGE_FRAME_MASK;
+        const u64 *pt      = (const u64 *)phys_to_virt(pt_phys);
 
-        for(int pt_idx = 0; pt_idx < 512; pt_idx++) {
-          if(!(pt[pt_idx] & VMM_PRESENT))
-            continue;
-          pmm_free((void *)(pt[pt_idx] & PAGE_FRAME_MASK));
+        if(!pmm_page_shared((void *)pt_phys)) {
+          for(int pt_idx = 0; pt_idx < 512; pt_idx++) {
+            drop_swap(pt[pt_idx]);
+            if(!(pt[pt_idx] & VMM_PRESENT))
+              continue;
+            pmm_free((void *)(pt[pt_idx] & PAGE_FRAME_MASK));
+          }
         }
-        pmm_free((void *)(pd[pd_idx] & PAGE_FRAME_MASK));
+        pmm_free((void *)pt_phys);
       }
       pmm_free((void *)(pdpt[pdpt_idx] & PAGE_FRAME_MASK));
     }
@@ -494,17 +1235,53 @@ static void user_mappings_walk_and_free(u64 pml4_phys, bool zero_entries)
   }
 }
 
+u64 vmm_user_pages(u64 pml4_phys)
+{
+  const u64 *pml4  = (const u64 *)phys_to_virt(pml4_phys);
+  u64        pages = 0;
+
+  for(int i = 0; i < 256; i++) {
+    if(!(pml4[i] & VMM_PRESENT))
+      continue;
+    const u64 *pdpt = (const u64 *)phys_to_virt(pml4[i] & PAGE_FRAME_MASK);
+    for(int j = 0; j < 512; j++) {
+      if(!(pdpt[j] & VMM_PRESENT))
+        continue;
+      const u64 *pd = (const u64 *)phys_to_virt(pdpt[j] & PAGE_FRAME_MASK);
+      for(int k = 0; k < 512; k++) {
+        if(!(pd[k] & VMM_PRESENT))
+          continue;
+        if(pd[k] & PTE_HUGE) {
+          pages += VMM_HUGE_PAGES;
+          continue;
+        }
+        const u64 *pt = (const u64 *)phys_to_virt(pd[k] & PAGE_FRAME_MASK);
+        for(int l = 0; l < 512; l++) {
+          if((pt[l] & VMM_PRESENT) &&
+             (pt[l] & PAGE_FRAME_MASK) != zero_page_phys)
+            pages++;
+        }
+      }
+    }
+  }
+  return pages;
+}
+
 void vmm_destroy_user_mappings(u64 pml4_phys)
 {
   user_mappings_walk_and_free(pml4_phys, false);
+  /* A new address space may get this PML4 page; it must not inherit the
+   * tag, and with it the stale TLB entries. */
+  pcid_drop(pml4_phys, (u32)-1);
   pmm_free((void *)pml4_phys);
 }
 
 void vmm_clear_user_mappings(u64 pml4_phys)
 {
   user_mappings_walk_and_free(pml4_phys, true);
-  /* Flush TLB so the now-cleared user mappings don't linger in cache. */
-  __asm__ volatile("mov %0, %%cr3" : : "r"(pml4_phys) : "memory");
+  /* @p pml4_phys is current: flush so the cleared user mappings don't
+   * linger in the TLB. */
+  flush_tlb();
 }
 
 /**
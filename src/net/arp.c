@@ -0,0 +1,263 @@
+/**
+ * @file src/net/arp.c
+ * @brief Ethernet framing and ARP address resolution.
+ *
+ * A small cache maps IPv4 next hops to MAC addresses. A packet for a hop
+ * that is not resolved yet waits on the entry while a request is out; the
+ * reply sends it. Requests are repeated once a second, three times, before
+ * the waiting packets are dropped. Resolved entries are refreshed by any
+ * ARP traffic from their owner and forgotten after five minutes.
+ */
+
+#include <alcor2/kstdlib.h>
+#include <alcor2/net/net.h>
+#include <alcor2/time.h>
+
+#define ARP_ENTRIES   16
+#define ARP_QUEUE     8 /* packets waiting on one entry at most */
+#define ARP_TRIES     3
+#define ARP_RETRY_NS  1000000000ULL
+#define ARP_EXPIRE_NS (300 * 1000000000ULL)
+
+#define ARP_HTYPE_ETH 1
+#define ARP_OP_REQ    1
+#define ARP_OP_REPLY  2
+
+/** @brief Ethernet header. */
+typedef struct PACKED
+{
+  u8  dst[ETH_ALEN];
+  u8  src[ETH_ALEN];
+  u16 type; /**< Network order. */
+} eth_hdr_t;
+
+/** @brief ARP packet for IPv4 over Ethernet (network order). */
+typedef struct PACKED
+{
+  u16 htype;
+  u16 ptype;
+  u8  hlen;
+  u8  plen;
+  u16 op;
+  u8  sha[ETH_ALEN];
+  u32 spa;
+  u8  tha[ETH_ALEN];
+  u32 tpa;
+} arp_pkt_t;
+
+/** @brief One cache entry; free while @c ip is 0. */
+typedef struct
+{
+  u32       ip;
+  u8        mac[ETH_ALEN];
+  bool      resolved;
+  u8        tries; /* requests sent while unresolved */
+  u32       nqueued;
+  u64       stamp; /* last request sent, or when resolved */
+  netbuf_t *queue; /* packets waiting for the address */
+} arp_entry_t;
+
+static arp_entry_t arp_cache[ARP_ENTRIES];
+static const u8    eth_bcast[ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static bool mac_eq(const u8 *a, const u8 *b)
+{
+  for(u32 i = 0; i < ETH_ALEN; i++) {
+    if(a[i] != b[i])
+      return false;
+  }
+  return true;
+}
+
+/* Prepend the Ethernet header and hand the frame to the driver. */
+static void eth_xmit(netif_t *nif, netbuf_t *nb, const u8 *dst, u16 type)
+{
+  eth_hdr_t *eh = (eth_hdr_t *)netbuf_push(nb, sizeof(*eh));
+  kmemcpy(eh->dst, dst, ETH_ALEN);
+  kmemcpy(eh->src, nif->mac, ETH_ALEN);
+  eh->type = net_htons(type);
+  if(nb->csum_off)
+    nb->csum_start += sizeof(*eh);
+  nif->xmit(nif, nb);
+}
+
+static arp_entry_t *arp_lookup(u32 ip)
+{
+  for(u32 i = 0; i < ARP_ENTRIES; i++) {
+    if(arp_cache[i].ip == ip)
+      return &arp_cache[i];
+  }
+  return NULL;
+}
+
+/* A free entry, or else the oldest resolved one. */
+static arp_entry_t *arp_new(u32 ip)
+{
+  arp_entry_t *e = NULL;
+  for(u32 i = 0; i < ARP_ENTRIES; i++) {
+    arp_entry_t *c = &arp_cache[i];
+    if(!c->ip) {
+      e = c;
+      break;
+    }
+    if(c->resolved && (!e || c->stamp < e->stamp))
+      e = c;
+  }
+  if(!e)
+    return NULL;
+  kzero(e, sizeof(*e));
+  e->ip = ip;
+  return e;
+}
+
+static void arp_send(netif_t *nif, u16 op, const u8 *tha, u32 tpa)
+{
+  netbuf_t *nb = netbuf_alloc();
+  if(!nb) {
+    nif->tx_dropped++;
+    return;
+  }
+  arp_pkt_t *a = (arp_pkt_t *)netbuf_put(nb, sizeof(*a));
+  a->htype     = net_htons(ARP_HTYPE_ETH);
+  a->ptype     = net_htons(ETH_P_IP);
+  a->hlen      = ETH_ALEN;
+  a->plen      = 4;
+  a->op        = net_htons(op);
+  kmemcpy(a->sha, nif->mac, ETH_ALEN);
+  a->spa = net_htonl(nif->ip);
+  if(op == ARP_OP_REPLY)
+    kmemcpy(a->tha, tha, ETH_ALEN);
+  else
+    kzero(a->tha, ETH_ALEN);
+  a->tpa = net_htonl(tpa);
+  eth_xmit(nif, nb, op == ARP_OP_REPLY ? tha : eth_bcast, ETH_P_ARP);
+}
+
+/* Record @p ip at @p mac and send whatever waited for it. */
+static void arp_learn(netif_t *nif, arp_entry_t *e, const u8 *mac)
+{
+  kmemcpy(e->mac, mac, ETH_ALEN);
+  e->resolved = true;
+  e->stamp    = time_monotonic_ns();
+
+  netbuf_t *q = e->queue;
+  e->queue    = NULL;
+  e->nqueued  = 0;
+  while(q) {
+    netbuf_t *next = q->next;
+    q->next        = NULL;
+    eth_xmit(nif, q, e->mac, ETH_P_IP);
+    q = next;
+  }
+}
+
+static void arp_input(netif_t *nif, netbuf_t *nb)
+{
+  if(nb->len < sizeof(arp_pkt_t)) {
+    netbuf_free(nb);
+    return;
+  }
+  const arp_pkt_t *a = (const arp_pkt_t *)nb->data;
+  u16              op  = net_ntohs(a->op);
+  u32              spa = net_ntohl(a->spa);
+  u32              tpa = net_ntohl(a->tpa);
+  if(net_ntohs(a->htype) != ARP_HTYPE_ETH ||
+     net_ntohs(a->ptype) != ETH_P_IP || a->hlen != ETH_ALEN ||
+     a->plen != 4 || !spa) {
+    netbuf_free(nb);
+    return;
+  }
+
+  /* Refresh a known sender; add it if the packet is about us. */
+  arp_entry_t *e = arp_lookup(spa);
+  if(!e && tpa == nif->ip)
+    e = arp_new(spa);
+  if(e)
+    arp_learn(nif, e, a->sha);
+
+  if(op == ARP_OP_REQ && tpa == nif->ip)
+    arp_send(nif, ARP_OP_REPLY, a->sha, spa);
+  netbuf_free(nb);
+}
+
+void eth_input(netif_t *nif, netbuf_t *nb)
+{
+  if(nb->len < sizeof(eth_hdr_t)) {
+    nif->rx_dropped++;
+    netbuf_free(nb);
+    return;
+  }
+  const eth_hdr_t *eh   = (const eth_hdr_t *)nb->data;
+  u16              type = net_ntohs(eh->type);
+  if(!mac_eq(eh->dst, nif->mac) && !mac_eq(eh->dst, eth_bcast)) {
+    netbuf_free(nb);
+    return;
+  }
+  netbuf_pull(nb, sizeof(*eh));
+  if(type == ETH_P_IP)
+    ip_input(nif, nb);
+  else if(type == ETH_P_ARP)
+    arp_input(nif, nb);
+  else
+    netbuf_free(nb);
+}
+
+void eth_output_ip(netif_t *nif, netbuf_t *nb, u32 next_hop)
+{
+  if(next_hop == 0xFFFFFFFFU) {
+    eth_xmit(nif, nb, eth_bcast, ETH_P_IP);
+    return;
+  }
+  arp_entry_t *e = arp_lookup(next_hop);
+  if(e && e->resolved) {
+    eth_xmit(nif, nb, e->mac, ETH_P_IP);
+    return;
+  }
+
+  if(!e && (e = arp_new(next_hop)) != NULL) {
+    e->tries = 1;
+    e->stamp = time_monotonic_ns();
+    arp_send(nif, ARP_OP_REQ, NULL, next_hop);
+  }
+  if(!e || e->nqueued == ARP_QUEUE) {
+    nif->tx_dropped++;
+    netbuf_free(nb);
+    return;
+  }
+  netbuf_t **pp = &e->queue;
+  while(*pp)
+    pp = &(*pp)->next;
+  nb->next = NULL;
+  *pp      = nb;
+  e->nqueued++;
+}
+
+void arp_tick(void)
+{
+  netif_t *nif = net_if();
+  if(!nif)
+    return;
+  u64 now = time_monotonic_ns();
+  for(u32 i = 0; i < ARP_ENTRIES; i++) {
+    arp_entry_t *e = &arp_cache[i];
+    if(!e->ip)
+      continue;
+    if(e->resolved) {
+      if(now - e->stamp > ARP_EXPIRE_NS)
+        e->ip = 0;
+      continue;
+    }
+    if(now - e->stamp < ARP_RETRY_NS)
+      continue;
+    if(e->tries == ARP_TRIES) {
+      nif->tx_dropped += e->nqueued;
+      netbuf_free_list(e->queue);
+      e->queue = NULL;
+      e->ip    = 0;
+      continue;
+    }
+    e->tries++;
+    e->stamp = now;
+    arp_send(nif, ARP_OP_REQ, NULL, e->ip);
+  }
+}
@@ -0,0 +1,185 @@
+/**
+ * @file src/net/ip.c
+ * @brief IPv4 input and output, loopback and ICMP echo.
+ *
+ * There is one interface and one route: hosts on its subnet are reached
+ * directly and everything else through the default gateway. Fragments are
+ * dropped rather than reassembled, and outgoing packets carry Don't
+ * Fragment, since TCP keeps its segments within the MTU. Packets for
+ * 127.0.0.0/8 or the interface's own address never reach the driver: they
+ * are copied into a fresh buffer and queued, and ip_loopback_run() feeds
+ * them to ip_input() later, once the sender is done updating its state.
+ */
+
+#include <alcor2/errno.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/net/net.h>
+#include <alcor2/net/sock.h>
+
+#define IP_DF       0x4000
+#define IP_MF       0x2000
+#define IP_OFF_MASK 0x1FFF
+#define IP_TTL      64
+
+#define ICMP_ECHO_REPLY 0
+#define ICMP_ECHO       8
+
+/** @brief IPv4 header without options (network order). */
+typedef struct PACKED
+{
+  u8  ver_ihl;
+  u8  tos;
+  u16 len;
+  u16 id;
+  u16 frag;
+  u8  ttl;
+  u8  proto;
+  u16 csum;
+  u32 src;
+  u32 dst;
+} ip_hdr_t;
+
+/** @brief ICMP header (network order). */
+typedef struct PACKED
+{
+  u8  type;
+  u8  code;
+  u16 csum;
+  u32 rest; /**< Identifier and sequence number for echo. */
+} icmp_hdr_t;
+
+static u16       ip_id;
+static netbuf_t *lo_head; /* looped-back packets not yet delivered */
+static netbuf_t *lo_tail;
+
+static bool ip_is_loopback(u32 ip)
+{
+  return (ip >> 24) == 127;
+}
+
+void ip_input(netif_t *nif, netbuf_t *nb)
+{
+  const ip_hdr_t *ih = (const ip_hdr_t *)nb->data;
+  u32             hl = (u32)(ih->ver_ihl & 0xF) * 4;
+  if(nb->len < sizeof(*ih) || (ih->ver_ihl >> 4) != 4 || hl < IP_HLEN ||
+     nb->len < hl || net_csum_fold(net_csum_add(0, ih, hl, 0)) != 0)
+    goto drop;
+
+  u32 len = net_ntohs(ih->len);
+  u32 src = net_ntohl(ih->src);
+  u32 dst = net_ntohl(ih->dst);
+  if(len < hl || len > nb->len || net_ntohs(ih->frag) & (IP_MF | IP_OFF_MASK))
+    goto drop;
+  if(!ip_is_loopback(dst) && dst != 0xFFFFFFFFU && (!nif || dst != nif->ip))
+    goto drop;
+
+  u8 proto = ih->proto;
+  nb->len  = len;
+  netbuf_pull(nb, hl);
+  nb->saddr = src;
+  if(proto == IP_PROTO_TCP)
+    tcp_input(nb, src, dst);
+  else if(proto == IP_PROTO_UDP)
+    udp_input(nb, src, dst);
+  else if(proto == IP_PROTO_ICMP)
+    icmp_input(nif, nb, src, dst);
+  else
+    netbuf_free(nb);
+  return;
+
+drop:
+  if(nif)
+    nif->rx_dropped++;
+  netbuf_free(nb);
+}
+
+/* Copy @p nb into one linear buffer, filling in an offloaded checksum. */
+static netbuf_t *ip_linearize(netbuf_t *nb)
+{
+  netbuf_t *lo  = netbuf_alloc();
+  u32       len = netbuf_total(nb);
+  if(!lo || !netbuf_put(lo, len)) {
+    if(lo)
+      netbuf_free(lo);
+    return NULL;
+  }
+  netbuf_copy(nb, 0, lo->data, len);
+  lo->csum_ok = true;
+  return lo;
+}
+
+bool ip_loopback_run(void)
+{
+  bool any = lo_head != NULL;
+  while(lo_head) {
+    netbuf_t *nb = lo_head;
+    lo_head      = nb->next;
+    if(!lo_head)
+      lo_tail = NULL;
+    nb->next = NULL;
+    ip_input(net_if(), nb);
+  }
+  return any;
+}
+
+i64 ip_output(netbuf_t *nb, u32 src, u32 dst, u8 proto)
+{
+  netif_t *nif = net_if();
+  bool     lo  = ip_is_loopback(dst) || (nif && dst == nif->ip);
+  if(!lo && (!nif || !nif->ip)) {
+    netbuf_free(nb);
+    return -ENETUNREACH;
+  }
+
+  ip_hdr_t *ih = (ip_hdr_t *)netbuf_push(nb, sizeof(*ih));
+  ih->ver_ihl  = 0x45;
+  ih->tos      = 0;
+  ih->len      = net_htons((u16)netbuf_total(nb));
+  ih->id       = net_htons(ip_id++);
+  ih->frag     = net_htons(IP_DF);
+  ih->ttl      = IP_TTL;
+  ih->proto    = proto;
+  ih->csum     = 0;
+  ih->src      = net_htonl(src);
+  ih->dst      = net_htonl(dst);
+  ih->csum     = net_htons(net_csum_fold(net_csum_add(0, ih, sizeof(*ih), 0)));
+  if(nb->csum_off)
+    nb->csum_start += sizeof(*ih);
+
+  if(lo) {
+    netbuf_t *copy = ip_linearize(nb);
+    netbuf_free(nb);
+    if(!copy)
+      return -ENOBUFS;
+    if(lo_tail)
+      lo_tail->next = copy;
+    else
+      lo_head = copy;
+    lo_tail = copy;
+    return 0;
+  }
+
+  u32 hop = dst;
+  if(dst != 0xFFFFFFFFU && (dst & nif->netmask) != (nif->ip & nif->netmask))
+    hop = nif->gateway;
+  eth_output_ip(nif, nb, hop);
+  return 0;
+}
+
+void icmp_input(netif_t *nif, netbuf_t *nb, u32 src, u32 dst)
+{
+  (void)nif;
+  icmp_hdr_t *ic = (icmp_hdr_t *)nb->data;
+  if(nb->len < sizeof(*ic) || net_csum_fold(net_csum_netbuf(0, nb)) != 0 ||
+     ic->type != ICMP_ECHO || dst == 0xFFFFFFFFU) {
+    netbuf_free(nb);
+    return;
+  }
+
+  /* Answer in place: same identifier, sequence and payload. */
+  ic->type = ICMP_ECHO_REPLY;
+  ic->csum = 0;
+  ic->csum = net_htons(net_csum_fold(net_csum_netbuf(0, nb)));
+  nb->next = NULL;
+  ip_output(nb, dst, src, IP_PROTO_ICMP);
+}
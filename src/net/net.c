@@ -0,0 +1,173 @@
+/**
+ * @file src/net/net.c
+ * @brief Packet buffers, checksums and the interface (see alcor2/net/net.h).
+ */
+
+#include <alcor2/drivers/virtio_net.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/net/net.h>
+
+static netif_t *g_nif;
+
+netbuf_t *netbuf_alloc(void)
+{
+  void *page = pmm_alloc();
+  if(!page)
+    return NULL;
+  netbuf_t *nb = phys_to_virt((u64)page);
+  kzero(nb, sizeof(*nb));
+  nb->data = (u8 *)nb + NETBUF_HEADROOM;
+  return nb;
+}
+
+void netbuf_free(netbuf_t *nb)
+{
+  for(u32 i = 0; i < nb->nfrags; i++)
+    pmm_free((void *)(nb->frags[i].phys & ~(u64)(PAGE_SIZE - 1)));
+  pmm_free((void *)virt_to_phys(nb));
+}
+
+void netbuf_free_list(netbuf_t *nb)
+{
+  while(nb) {
+    netbuf_t *next = nb->next;
+    netbuf_free(nb);
+    nb = next;
+  }
+}
+
+u8 *netbuf_push(netbuf_t *nb, u32 n)
+{
+  nb->data -= n;
+  nb->len  += n;
+  return nb->data;
+}
+
+void netbuf_pull(netbuf_t *nb, u32 n)
+{
+  nb->data += n;
+  nb->len  -= n;
+}
+
+u8 *netbuf_put(netbuf_t *nb, u32 n)
+{
+  u8 *end = nb->data + nb->len;
+  if(end + n > (u8 *)nb + PAGE_SIZE)
+    return NULL;
+  nb->len += n;
+  return end;
+}
+
+bool netbuf_add_frag(netbuf_t *nb, u64 phys, u32 len)
+{
+  if(nb->nfrags == NETBUF_FRAGS)
+    return false;
+  pmm_page_ref((void *)(phys & ~(u64)(PAGE_SIZE - 1)));
+  nb->frags[nb->nfrags].phys = phys;
+  nb->frags[nb->nfrags].len  = len;
+  nb->nfrags++;
+  return true;
+}
+
+u32 netbuf_total(const netbuf_t *nb)
+{
+  u32 n = nb->len;
+  for(u32 i = 0; i < nb->nfrags; i++)
+    n += nb->frags[i].len;
+  return n;
+}
+
+u32 netbuf_copy(const netbuf_t *nb, u32 off, void *dst, u32 len)
+{
+  u8  *d    = dst;
+  u32  done = 0;
+  u8  *src  = nb->data;
+  u32  have = nb->len;
+  for(u32 i = 0;; i++) {
+    if(off < have) {
+      u32 n = have - off < len - done ? have - off : len - done;
+      kmemcpy(d + done, src + off, n);
+      done += n;
+      off   = 0;
+    } else {
+      off -= have;
+    }
+    if(done == len || i == nb->nfrags)
+      break;
+    src  = phys_to_virt(nb->frags[i].phys);
+    have = nb->frags[i].len;
+  }
+  return done;
+}
+
+u64 net_csum_add(u64 sum, const void *buf, u64 len, u64 at)
+{
+  const u8 *p = buf;
+  /* A byte at an odd offset is the low half of its 16-bit word. */
+  if(len && (at & 1)) {
+    sum += *p++;
+    len--;
+  }
+  for(; len >= 2; p += 2, len -= 2)
+    sum += (u64)p[0] << 8 | p[1];
+  if(len)
+    sum += (u64)p[0] << 8;
+  return sum;
+}
+
+u64 net_csum_netbuf(u64 sum, const netbuf_t *nb)
+{
+  sum    = net_csum_add(sum, nb->data, nb->len, 0);
+  u64 at = nb->len;
+  for(u32 i = 0; i < nb->nfrags; i++) {
+    const net_frag_t *f = &nb->frags[i];
+    sum = net_csum_add(sum, phys_to_virt(f->phys), f->len, at);
+    at += f->len;
+  }
+  return sum;
+}
+
+u16 net_csum_fold(u64 sum)
+{
+  while(sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return (u16)~sum;
+}
+
+u64 net_csum_pseudo(u32 src, u32 dst, u8 proto, u32 len)
+{
+  return (u64)(src >> 16) + (src & 0xFFFF) + (dst >> 16) + (dst & 0xFFFF) +
+         proto + len;
+}
+
+void net_attach(netif_t *nif)
+{
+  /* QEMU's user-mode network, which has no DHCP client to talk to here. */
+  if(!nif->ip) {
+    nif->ip      = NET_IP4(10, 0, 2, 15);
+    nif->netmask = NET_IP4(255, 255, 255, 0);
+    nif->gateway = NET_IP4(10, 0, 2, 2);
+  }
+  g_nif = nif;
+}
+
+netif_t *net_if(void)
+{
+  return g_nif;
+}
+
+void net_rx(netif_t *nif, netbuf_t *nb)
+{
+  nif->rx_packets++;
+  nif->rx_bytes += nb->len;
+  eth_input(nif, nb);
+}
+
+void net_tick(void)
+{
+  virtio_net_tick();
+  arp_tick();
+  ip_loopback_run();
+}
@@ -0,0 +1,1273 @@
+/**
+ * @file src/net/tcp.c
+ * @brief TCP: connections, the send and receive paths, retransmission and
+ *        congestion control.
+ *
+ * @par Send buffer
+ * Unacknowledged and unsent bytes are a list of page slices. write() copies
+ * into pages of the connection's own, appending to the last one while it
+ * has room; sendfile() queues the page-cache pages themselves by taking a
+ * reference on each. A segment references its payload slices as netbuf
+ * fragments, so the NIC reads the bytes where they lie, and a slice is let
+ * go once every byte of it is acknowledged.
+ *
+ * @par Receive path
+ * In-order segments are queued as received, headers pulled. There is no
+ * reassembly: a segment past @c rcv_nxt is dropped and answered with a
+ * duplicate ACK, so the peer's fast retransmit fills the hole. The window
+ * is the receive buffer's free space, at most 64 KiB (no window scaling).
+ * Every segment carrying data is acknowledged at once.
+ *
+ * @par Timers
+ * Each connection has one timer: retransmission (RFC 6298, Karn's rule,
+ * 200 ms floor, doubling per timeout), and once nothing is in flight the
+ * zero-window probe, TIME_WAIT or the FIN_WAIT_2 limit of a closed socket.
+ * Congestion control is Reno: a 10-segment initial window, slow start,
+ * congestion avoidance, and fast retransmit and recovery on the third
+ * duplicate ACK.
+ *
+ * @par Lifetime
+ * A connection outlives its socket: close() only queues a FIN, and the
+ * connection, now orphaned, finishes the exchange on its own and frees
+ * itself in CLOSED.
+ */
+
+#include <alcor2/arch/cpu.h>
+#include <alcor2/errno.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/mm/heap.h>
+#include <alcor2/mm/pmm.h>
+#include <alcor2/mm/vmm.h>
+#include <alcor2/net/net.h>
+#include <alcor2/net/sock.h>
+#include <alcor2/time.h>
+#include <alcor2/timer.h>
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+
+#define TCP_HLEN        20
+#define TCP_OPT_MSS     2
+#define TCP_MSS_DEFAULT 536
+#define TCP_MSS_MIN     64 /* floor for a peer's option; 0 would stall */
+#define TCP_MSS_MAX     (ETH_MTU - IP_HLEN - TCP_HLEN)
+#define TCP_SNDBUF      (64 * 1024)
+#define TCP_RCVBUF      0xFFFF
+#define TCP_INIT_CWND   10 /* segments */
+#define TCP_BACKLOG_MAX 128
+#define TCP_PORT_EPH_LO 49152
+
+#define NS_PER_MS          1000000ULL
+#define TCP_RTO_INIT       (1000 * NS_PER_MS)
+#define TCP_RTO_MIN        (200 * NS_PER_MS)
+#define TCP_RTO_MAX        (60000 * NS_PER_MS)
+#define TCP_TIME_WAIT_NS   (2000 * NS_PER_MS)
+#define TCP_FIN_WAIT2_NS   (60000 * NS_PER_MS)
+#define TCP_RETRIES        12
+#define TCP_SYN_RETRIES    6
+
+#define SEQ_LT(a, b) ((i32)((a) - (b)) < 0)
+#define SEQ_LE(a, b) ((i32)((a) - (b)) <= 0)
+#define SEQ_GT(a, b) ((i32)((a) - (b)) > 0)
+#define SEQ_GE(a, b) ((i32)((a) - (b)) >= 0)
+
+enum
+{
+  TCP_CLOSED,
+  TCP_LISTEN,
+  TCP_SYN_SENT,
+  TCP_SYN_RCVD,
+  TCP_ESTABLISHED,
+  TCP_FIN_WAIT_1,
+  TCP_FIN_WAIT_2,
+  TCP_CLOSE_WAIT,
+  TCP_CLOSING,
+  TCP_LAST_ACK,
+  TCP_TIME_WAIT,
+};
+
+/** @brief TCP header (network order). */
+typedef struct PACKED
+{
+  u16 sport;
+  u16 dport;
+  u32 seq;
+  u32 ack;
+  u8  off; /**< Header length in words, in the high nibble. */
+  u8  flags;
+  u16 wnd;
+  u16 csum;
+  u16 urg;
+} tcp_hdr_t;
+
+/** @brief A slice of the send buffer (see the file comment). */
+typedef struct tcp_chunk
+{
+  struct tcp_chunk *next;
+  u64               phys; /**< First byte not yet acknowledged. */
+  u32               len;
+  bool              own; /**< Our page: write() may append to it. */
+} tcp_chunk_t;
+
+/** @brief A connection (or a listener). */
+typedef struct tcp_pcb
+{
+  struct tcp_pcb *next; /**< All connections. */
+  sock_t         *sock; /**< NULL once the fd is closed, or until accepted. */
+  u8              state;
+  u32             laddr;
+  u32             raddr;
+  u16             lport;
+  u16             rport;
+  u16             mss; /**< Largest segment the peer takes. */
+
+  u32          snd_una; /**< Oldest unacknowledged sequence number. */
+  u32          snd_nxt; /**< Next to send; falls back on a timeout. */
+  u32          snd_max; /**< Highest ever sent. */
+  u32          snd_wnd; /**< Peer's window. */
+  u32          snd_wl1; /**< Segment seq and ack of the last window. */
+  u32          snd_wl2;
+  u32          cwnd;
+  u32          ssthresh;
+  u32          recover; /**< snd_max when fast recovery began. */
+  u8           dupacks;
+  bool         fin_queued; /**< A FIN follows the buffered bytes. */
+  tcp_chunk_t *snd_head;   /**< Buffer, starting at @c snd_una. */
+  tcp_chunk_t *snd_tail;
+  u32          snd_len; /**< Bytes in the buffer. */
+
+  u32       rcv_nxt;
+  u32       rcv_adv; /**< Right edge of the window last advertised. */
+  netbuf_t *rx_head; /**< Received bytes not yet read. */
+  netbuf_t *rx_tail;
+  u32       rx_len;
+  bool      fin_rcvd;
+
+  ktimer_t timer;
+  u64      rto;
+  u64      srtt; /**< Smoothed RTT and its variation (ns). */
+  u64      rttvar;
+  u8       retries; /**< Timeouts in a row. */
+  bool     rtt_timing;
+  u32      rtt_seq; /**< The timed segment ends here. */
+  u64      rtt_start;
+
+  struct tcp_pcb *parent;   /**< Listener, until accepted. */
+  struct tcp_pcb *acc_head; /**< Listener: established, not accepted. */
+  struct tcp_pcb *acc_tail;
+  struct tcp_pcb *acc_next;
+  u32             backlog;
+  u32             npending; /**< Children in SYN_RCVD or not accepted. */
+} tcp_pcb_t;
+
+static tcp_pcb_t *tcp_pcbs;
+static u16        tcp_next_port = TCP_PORT_EPH_LO;
+
+static void tcp_timer(ktimer_t *t);
+
+static bool tcp_synced(const tcp_pcb_t *pcb)
+{
+  return pcb->state >= TCP_ESTABLISHED;
+}
+
+/* Free space in the receive buffer, as a window. */
+static u32 tcp_rcv_wnd(const tcp_pcb_t *pcb)
+{
+  return pcb->rx_len < TCP_RCVBUF ? TCP_RCVBUF - pcb->rx_len : 0;
+}
+
+static void tcp_wake(tcp_pcb_t *pcb)
+{
+  if(pcb->sock)
+    wait_wake_all(&pcb->sock->wq);
+}
+
+static tcp_pcb_t *tcp_pcb_new(void)
+{
+  tcp_pcb_t *pcb = kzalloc(sizeof(*pcb));
+  if(!pcb)
+    return NULL;
+  pcb->mss      = TCP_MSS_DEFAULT;
+  pcb->rto      = TCP_RTO_INIT;
+  pcb->ssthresh = 0xFFFFFFFFU;
+  timer_init(&pcb->timer, tcp_timer, pcb);
+  pcb->next = tcp_pcbs;
+  tcp_pcbs  = pcb;
+  return pcb;
+}
+
+static void tcp_snd_flush(tcp_pcb_t *pcb)
+{
+  while(pcb->snd_head) {
+    tcp_chunk_t *c = pcb->snd_head;
+    pcb->snd_head  = c->next;
+    pmm_free((void *)(c->phys & ~(u64)(PAGE_SIZE - 1)));
+    kfree(c);
+  }
+  pcb->snd_tail = NULL;
+  pcb->snd_len  = 0;
+}
+
+static void tcp_pcb_free(tcp_pcb_t *pcb)
+{
+  for(tcp_pcb_t **pp = &tcp_pcbs; *pp; pp = &(*pp)->next) {
+    if(*pp == pcb) {
+      *pp = pcb->next;
+      break;
+    }
+  }
+  timer_cancel(&pcb->timer);
+  tcp_snd_flush(pcb);
+  netbuf_free_list(pcb->rx_head);
+  kfree(pcb);
+}
+
+/* Take a child off its listener's accept queue, if it is on it. */
+static void tcp_unqueue(tcp_pcb_t *pcb)
+{
+  tcp_pcb_t *l = pcb->parent;
+  for(tcp_pcb_t **pp = &l->acc_head; *pp; pp = &(*pp)->acc_next) {
+    if(*pp == pcb) {
+      *pp = pcb->acc_next;
+      break;
+    }
+  }
+  l->acc_tail = NULL;
+  for(tcp_pcb_t *c = l->acc_head; c; c = c->acc_next)
+    l->acc_tail = c;
+  l->npending--;
+  pcb->parent = NULL;
+}
+
+/* The connection is over: free it unless a socket still holds it. */
+static void tcp_finish(tcp_pcb_t *pcb)
+{
+  pcb->state = TCP_CLOSED;
+  timer_cancel(&pcb->timer);
+  if(pcb->parent)
+    tcp_unqueue(pcb);
+  if(!pcb->sock) {
+    tcp_pcb_free(pcb);
+    return;
+  }
+  tcp_wake(pcb);
+}
+
+/* Fill in the checksum, or leave it to the device. */
+static void tcp_csum(netbuf_t *nb, tcp_hdr_t *th, u32 src, u32 dst)
+{
+  netif_t *nif = net_if();
+  u32      len = netbuf_total(nb);
+  u64      sum = net_csum_pseudo(src, dst, IP_PROTO_TCP, len);
+  th->csum     = 0;
+  if(nif && nif->tx_csum) {
+    /* The device adds the segment to the pseudo-header sum. */
+    th->csum     = net_htons((u16)~net_csum_fold(sum));
+    nb->csum_off = offsetof(tcp_hdr_t, csum);
+  } else {
+    th->csum = net_htons(net_csum_fold(net_csum_netbuf(sum, nb)));
+  }
+}
+
+/* Send a segment carrying no connection state (a RST). */
+static void tcp_send_bare(
+    u32 src, u32 dst, u16 sport, u16 dport, u32 seq, u32 ack, u8 flags
+)
+{
+  netbuf_t *nb = netbuf_alloc();
+  if(!nb)
+    return;
+  tcp_hdr_t *th = (tcp_hdr_t *)netbuf_put(nb, TCP_HLEN);
+  kzero(th, TCP_HLEN);
+  th->sport = net_htons(sport);
+  th->dport = net_htons(dport);
+  th->seq   = net_htonl(seq);
+  th->ack   = net_htonl(ack);
+  th->off   = (TCP_HLEN / 4) << 4;
+  th->flags = flags;
+  tcp_csum(nb, th, src, dst);
+  ip_output(nb, src, dst, IP_PROTO_TCP);
+}
+
+/*
+ * Send one segment at @p seq with @p len payload bytes from buffer offset
+ * @p off. Returns the payload bytes sent (fewer when the slices run out of
+ * fragment slots), or -ENOBUFS.
+ */
+static i64 tcp_xmit(tcp_pcb_t *pcb, u32 seq, u8 flags, u32 off, u32 len)
+{
+  netbuf_t *nb = netbuf_alloc();
+  if(!nb)
+    return -ENOBUFS;
+  u32        hlen = TCP_HLEN + (flags & TCP_SYN ? 4 : 0);
+  tcp_hdr_t *th   = (tcp_hdr_t *)netbuf_put(nb, hlen);
+
+  u32 sent = 0;
+  for(tcp_chunk_t *c = pcb->snd_head; c && sent < len; c = c->next) {
+    if(off >= c->len) {
+      off -= c->len;
+      continue;
+    }
+    u32 n = c->len - off < len - sent ? c->len - off : len - sent;
+    if(!netbuf_add_frag(nb, c->phys + off, n))
+      break;
+    sent += n;
+    off   = 0;
+  }
+  if(sent < len)
+    flags &= (u8)~TCP_FIN;
+
+  u32 wnd      = tcp_rcv_wnd(pcb);
+  pcb->rcv_adv = pcb->rcv_nxt + wnd;
+  th->sport    = net_htons(pcb->lport);
+  th->dport    = net_htons(pcb->rport);
+  th->seq      = net_htonl(seq);
+  th->ack      = flags & TCP_ACK ? net_htonl(pcb->rcv_nxt) : 0;
+  th->off      = (u8)((hlen / 4) << 4);
+  th->flags    = flags | (sent ? TCP_PSH : 0);
+  th->wnd      = net_htons((u16)wnd);
+  th->urg      = 0;
+  if(flags & TCP_SYN) {
+    u8 *opt = (u8 *)(th + 1);
+    opt[0]  = TCP_OPT_MSS;
+    opt[1]  = 4;
+    opt[2]  = TCP_MSS_MAX >> 8;
+    opt[3]  = TCP_MSS_MAX & 0xFF;
+  }
+  tcp_csum(nb, th, pcb->laddr, pcb->raddr);
+  i64 r = ip_output(nb, pcb->laddr, pcb->raddr, IP_PROTO_TCP);
+  return r < 0 ? r : (i64)sent;
+}
+
+static void tcp_send_ack(tcp_pcb_t *pcb)
+{
+  tcp_xmit(pcb, pcb->snd_nxt, TCP_ACK, 0, 0);
+}
+
+static void tcp_send_rst(tcp_pcb_t *pcb)
+{
+  tcp_send_bare(
+      pcb->laddr, pcb->raddr, pcb->lport, pcb->rport, pcb->snd_nxt,
+      pcb->rcv_nxt, TCP_RST | TCP_ACK
+  );
+}
+
+/* (Re)send our SYN, with an ACK in SYN_RCVD. */
+static void tcp_send_syn(tcp_pcb_t *pcb)
+{
+  u8 flags = TCP_SYN | (pcb->state == TCP_SYN_RCVD ? TCP_ACK : 0);
+  tcp_xmit(pcb, pcb->snd_una, flags, 0, 0);
+  pcb->snd_nxt = pcb->snd_max = pcb->snd_una + 1;
+  timer_arm(&pcb->timer, time_monotonic_ns() + pcb->rto);
+}
+
+/* Drop the connection with error @p err, resetting the peer if need be. */
+static void tcp_abort(tcp_pcb_t *pcb, i32 err)
+{
+  if(pcb->state >= TCP_SYN_RCVD && pcb->state != TCP_TIME_WAIT)
+    tcp_send_rst(pcb);
+  if(pcb->sock)
+    pcb->sock->error = err;
+  tcp_snd_flush(pcb);
+  tcp_finish(pcb);
+}
+
+/* Send what the windows allow; start the timer for it. */
+static void tcp_output(tcp_pcb_t *pcb)
+{
+  if(pcb->state != TCP_ESTABLISHED && pcb->state != TCP_CLOSE_WAIT &&
+     pcb->state != TCP_FIN_WAIT_1 && pcb->state != TCP_CLOSING &&
+     pcb->state != TCP_LAST_ACK)
+    return;
+
+  for(;;) {
+    u32 off = pcb->snd_nxt - pcb->snd_una;
+    if(off > pcb->snd_len)
+      break; /* the FIN is out */
+    u32 wnd  = pcb->snd_wnd < pcb->cwnd ? pcb->snd_wnd : pcb->cwnd;
+    u32 room = wnd > off ? wnd - off : 0;
+    u32 n    = pcb->snd_len - off;
+    if(n > room)
+      n = room;
+    if(n > pcb->mss)
+      n = pcb->mss;
+    bool fin = pcb->fin_queued && off + n == pcb->snd_len;
+    if(!n && !fin)
+      break;
+
+    i64 sent = tcp_xmit(
+        pcb, pcb->snd_nxt, TCP_ACK | (fin ? TCP_FIN : 0), off, n
+    );
+    if(sent < 0)
+      break;
+    fin = fin && (u32)sent == n;
+    if(!pcb->rtt_timing && pcb->snd_nxt == pcb->snd_max) {
+      pcb->rtt_timing = true;
+      pcb->rtt_seq    = pcb->snd_nxt + (u32)sent + fin;
+      pcb->rtt_start  = time_monotonic_ns();
+    }
+    pcb->snd_nxt += (u32)sent + fin;
+    if(SEQ_GT(pcb->snd_nxt, pcb->snd_max))
+      pcb->snd_max = pcb->snd_nxt;
+    if(!timer_pending(&pcb->timer))
+      timer_arm(&pcb->timer, time_monotonic_ns() + pcb->rto);
+    if(fin)
+      break;
+  }
+
+  /* A closed window with data waiting: probe it once the timer fires. */
+  if(pcb->snd_una == pcb->snd_max && pcb->snd_len && !pcb->snd_wnd &&
+     !timer_pending(&pcb->timer))
+    timer_arm(&pcb->timer, time_monotonic_ns() + pcb->rto);
+}
+
+/* RFC 6298 estimate from one sample of @p rtt ns. */
+static void tcp_rtt_sample(tcp_pcb_t *pcb, u64 rtt)
+{
+  if(!pcb->srtt) {
+    pcb->srtt   = rtt;
+    pcb->rttvar = rtt / 2;
+  } else {
+    u64 d       = rtt > pcb->srtt ? rtt - pcb->srtt : pcb->srtt - rtt;
+    pcb->rttvar = (3 * pcb->rttvar + d) / 4;
+    pcb->srtt   = (7 * pcb->srtt + rtt) / 8;
+  }
+  pcb->rto = pcb->srtt + 4 * pcb->rttvar;
+  if(pcb->rto < TCP_RTO_MIN)
+    pcb->rto = TCP_RTO_MIN;
+  if(pcb->rto > TCP_RTO_MAX)
+    pcb->rto = TCP_RTO_MAX;
+}
+
+/* Let go of the first @p n buffered bytes. */
+static void tcp_snd_trim(tcp_pcb_t *pcb, u32 n)
+{
+  pcb->snd_len -= n;
+  while(n) {
+    tcp_chunk_t *c    = pcb->snd_head;
+    u32          take = n < c->len ? n : c->len;
+    c->phys += take;
+    c->len  -= take;
+    n       -= take;
+    if(c->len)
+      break;
+    pcb->snd_head = c->next;
+    if(!pcb->snd_head)
+      pcb->snd_tail = NULL;
+    pmm_free((void *)((c->phys - 1) & ~(u64)(PAGE_SIZE - 1)));
+    kfree(c);
+  }
+}
+
+/* The FIN we sent is acknowledged. */
+static void tcp_fin_acked(tcp_pcb_t *pcb)
+{
+  if(pcb->state == TCP_FIN_WAIT_1) {
+    pcb->state = TCP_FIN_WAIT_2;
+    if(!pcb->sock)
+      timer_arm(&pcb->timer, time_monotonic_ns() + TCP_FIN_WAIT2_NS);
+  } else if(pcb->state == TCP_CLOSING) {
+    pcb->state = TCP_TIME_WAIT;
+    timer_arm(&pcb->timer, time_monotonic_ns() + TCP_TIME_WAIT_NS);
+  } else if(pcb->state == TCP_LAST_ACK) {
+    tcp_finish(pcb);
+  }
+}
+
+/*
+ * Process the ACK field of a segment in a synchronized state.
+ * Returns false if the connection was freed.
+ */
+static bool tcp_ack(tcp_pcb_t *pcb, u32 seq, u32 ack, u32 wnd, u32 dlen)
+{
+  u32 flight = pcb->snd_max - pcb->snd_una;
+
+  if(SEQ_GT(ack, pcb->snd_max)) {
+    tcp_send_ack(pcb);
+    return true;
+  }
+  if(SEQ_LT(pcb->snd_wl1, seq) ||
+     (pcb->snd_wl1 == seq && SEQ_LE(pcb->snd_wl2, ack))) {
+    bool same    = pcb->snd_wnd == wnd;
+    pcb->snd_wnd = wnd;
+    pcb->snd_wl1 = seq;
+    pcb->snd_wl2 = ack;
+    if(!same)
+      dlen = 1; /* a window update is no duplicate */
+  }
+
+  if(SEQ_LE(ack, pcb->snd_una)) {
+    if(ack != pcb->snd_una || dlen || !flight)
+      return true;
+    if(++pcb->dupacks == 3) {
+      /* Fast retransmit, then recovery with an inflated window. */
+      u32 half      = flight / 2;
+      pcb->ssthresh = half > 2u * pcb->mss ? half : 2u * pcb->mss;
+      pcb->cwnd     = pcb->ssthresh + 3u * pcb->mss;
+      pcb->recover  = pcb->snd_max;
+      u32  n   = pcb->snd_len < pcb->mss ? pcb->snd_len : pcb->mss;
+      bool fin = pcb->fin_queued && n == pcb->snd_len && flight > n;
+      tcp_xmit(pcb, pcb->snd_una, TCP_ACK | (fin ? TCP_FIN : 0), 0, n);
+      pcb->rtt_timing = false;
+    } else if(pcb->dupacks > 3) {
+      pcb->cwnd += pcb->mss;
+    }
+    return true;
+  }
+
+  u32 acked = ack - pcb->snd_una;
+  u32 data  = acked < pcb->snd_len ? acked : pcb->snd_len;
+  tcp_snd_trim(pcb, data);
+  pcb->snd_una = ack;
+  if(SEQ_LT(pcb->snd_nxt, ack))
+    pcb->snd_nxt = ack;
+  pcb->retries = 0;
+
+  if(pcb->rtt_timing && SEQ_GE(ack, pcb->rtt_seq)) {
+    pcb->rtt_timing = false;
+    tcp_rtt_sample(pcb, time_monotonic_ns() - pcb->rtt_start);
+  }
+  if(pcb->dupacks >= 3) {
+    if(SEQ_GE(ack, pcb->recover))
+      pcb->cwnd = pcb->ssthresh;
+  } else if(pcb->cwnd < pcb->ssthresh) {
+    pcb->cwnd += acked < pcb->mss ? acked : pcb->mss;
+  } else {
+    u32 inc    = pcb->cwnd ? (u32)((u64)pcb->mss * pcb->mss / pcb->cwnd)
+                           : pcb->mss;
+    pcb->cwnd += inc ? inc : 1;
+  }
+  pcb->dupacks = 0;
+
+  if(pcb->snd_una == pcb->snd_max)
+    timer_cancel(&pcb->timer);
+  else
+    timer_arm(&pcb->timer, time_monotonic_ns() + pcb->rto);
+  tcp_wake(pcb);
+
+  if(acked > data) {
+    tcp_fin_acked(pcb);
+    if(pcb->state == TCP_CLOSED && !pcb->sock)
+      return false;
+  }
+  return true;
+}
+
+/* Queue in-order payload @p nb (header pulled); false if it was not. */
+static bool tcp_data(tcp_pcb_t *pcb, netbuf_t *nb)
+{
+  u32 room = tcp_rcv_wnd(pcb);
+  if(!room)
+    return false;
+  if(nb->len > room)
+    nb->len = room;
+  nb->next = NULL;
+  if(pcb->rx_tail)
+    pcb->rx_tail->next = nb;
+  else
+    pcb->rx_head = nb;
+  pcb->rx_tail  = nb;
+  pcb->rx_len  += nb->len;
+  pcb->rcv_nxt += nb->len;
+  tcp_wake(pcb);
+  return true;
+}
+
+/* The peer's FIN arrived, in order. */
+static void tcp_fin(tcp_pcb_t *pcb)
+{
+  pcb->rcv_nxt++;
+  pcb->fin_rcvd = true;
+  if(pcb->state == TCP_ESTABLISHED) {
+    pcb->state = TCP_CLOSE_WAIT;
+  } else if(pcb->state == TCP_FIN_WAIT_1) {
+    pcb->state = TCP_CLOSING;
+  } else if(pcb->state == TCP_FIN_WAIT_2) {
+    pcb->state = TCP_TIME_WAIT;
+    timer_arm(&pcb->timer, time_monotonic_ns() + TCP_TIME_WAIT_NS);
+  }
+  tcp_wake(pcb);
+}
+
+static u16 tcp_parse_mss(const tcp_hdr_t *th, u32 hlen)
+{
+  const u8 *o = (const u8 *)(th + 1);
+  for(u32 i = 0; i + 1 < hlen - TCP_HLEN;) {
+    if(o[i] == 0)
+      break;
+    if(o[i] == 1) {
+      i++;
+      continue;
+    }
+    if(o[i + 1] < 2)
+      break;
+    if(o[i] == TCP_OPT_MSS && o[i + 1] == 4 && i + 4 <= hlen - TCP_HLEN) {
+      u16 mss = (u16)(o[i + 2] << 8 | o[i + 3]);
+      if(mss < TCP_MSS_MIN)
+        return TCP_MSS_MIN;
+      return mss < TCP_MSS_MAX ? mss : TCP_MSS_MAX;
+    }
+    i += o[i + 1];
+  }
+  return TCP_MSS_DEFAULT;
+}
+
+static u32 tcp_isn(void)
+{
+  /* RFC 793's 4 us clock, perturbed so back-to-back ISNs differ. */
+  static u32 salt;
+  salt += (u32)cpu_rdtsc() | 1;
+  return (u32)(time_monotonic_ns() / 4000) + salt;
+}
+
+static void tcp_init_window(tcp_pcb_t *pcb)
+{
+  pcb->cwnd = TCP_INIT_CWND * (u32)pcb->mss;
+}
+
+static tcp_pcb_t *tcp_lookup(u32 src, u32 dst, u16 sport, u16 dport)
+{
+  tcp_pcb_t *listener = NULL;
+  for(tcp_pcb_t *p = tcp_pcbs; p; p = p->next) {
+    if(p->lport != dport || p->state == TCP_CLOSED)
+      continue;
+    if(p->state == TCP_LISTEN) {
+      if(!p->laddr || p->laddr == dst)
+        listener = p;
+      continue;
+    }
+    if(p->rport == sport && p->raddr == src && p->laddr == dst)
+      return p;
+  }
+  return listener;
+}
+
+/* A SYN for listener @p l: start a child connection. */
+static void tcp_listen_input(
+    tcp_pcb_t *l, const tcp_hdr_t *th, u32 hlen, u32 src, u32 dst
+)
+{
+  if(l->npending >= l->backlog)
+    return;
+  tcp_pcb_t *c = tcp_pcb_new();
+  if(!c)
+    return;
+  c->state   = TCP_SYN_RCVD;
+  c->laddr   = dst;
+  c->raddr   = src;
+  c->lport   = l->lport;
+  c->rport   = net_ntohs(th->sport);
+  c->mss     = tcp_parse_mss(th, hlen);
+  c->rcv_nxt = net_ntohl(th->seq) + 1;
+  c->snd_una = tcp_isn();
+  c->snd_wnd = net_ntohs(th->wnd);
+  c->snd_wl1 = net_ntohl(th->seq);
+  c->parent  = l;
+  l->npending++;
+  tcp_init_window(c);
+  tcp_send_syn(c);
+}
+
+/* Segment for a connection in SYN_SENT. */
+static void tcp_syn_sent_input(
+    tcp_pcb_t *pcb, const tcp_hdr_t *th, u32 hlen, u32 seq, u32 ack
+)
+{
+  u8 flags = th->flags;
+  if((flags & TCP_ACK) && ack != pcb->snd_una + 1) {
+    if(!(flags & TCP_RST))
+      tcp_send_bare(
+          pcb->laddr, pcb->raddr, pcb->lport, pcb->rport, ack, 0, TCP_RST
+      );
+    return;
+  }
+  if(flags & TCP_RST) {
+    if(flags & TCP_ACK)
+      tcp_abort(pcb, -ECONNREFUSED);
+    return;
+  }
+  if(!(flags & TCP_SYN))
+    return;
+
+  pcb->rcv_nxt = seq + 1;
+  pcb->mss     = tcp_parse_mss(th, hlen);
+  pcb->snd_wnd = net_ntohs(th->wnd);
+  pcb->snd_wl1 = seq;
+  pcb->snd_wl2 = ack;
+  tcp_init_window(pcb);
+  if(flags & TCP_ACK) {
+    pcb->snd_una = ack;
+    pcb->state   = TCP_ESTABLISHED;
+    pcb->retries = 0;
+    timer_cancel(&pcb->timer);
+    tcp_send_ack(pcb);
+    tcp_wake(pcb);
+    tcp_output(pcb);
+  } else {
+    pcb->state = TCP_SYN_RCVD; /* simultaneous open */
+    tcp_send_syn(pcb);
+  }
+}
+
+void tcp_input(netbuf_t *nb, u32 src, u32 dst)
+{
+  const tcp_hdr_t *th   = (const tcp_hdr_t *)nb->data;
+  u32              hlen = nb->len >= TCP_HLEN ? (u32)(th->off >> 4) * 4 : 0;
+  if(hlen < TCP_HLEN || hlen > nb->len)
+    goto drop;
+  u64 psum = net_csum_pseudo(src, dst, IP_PROTO_TCP, nb->len);
+  if(!nb->csum_ok && net_csum_fold(net_csum_netbuf(psum, nb)) != 0)
+    goto drop;
+
+  u8  flags = th->flags;
+  u32 seq   = net_ntohl(th->seq);
+  u32 ack   = net_ntohl(th->ack);
+  u32 wnd   = net_ntohs(th->wnd);
+  u16 sport = net_ntohs(th->sport);
+  u16 dport = net_ntohs(th->dport);
+  u32 dlen  = nb->len - hlen;
+
+  tcp_pcb_t *pcb = tcp_lookup(src, dst, sport, dport);
+  if(!pcb || (pcb->state == TCP_LISTEN && (flags & TCP_ACK))) {
+    if(!(flags & TCP_RST)) {
+      u32 rack = seq + dlen + !!(flags & TCP_SYN) + !!(flags & TCP_FIN);
+      if(flags & TCP_ACK)
+        tcp_send_bare(dst, src, dport, sport, ack, 0, TCP_RST);
+      else
+        tcp_send_bare(dst, src, dport, sport, 0, rack, TCP_RST | TCP_ACK);
+    }
+    goto drop;
+  }
+  if(pcb->state == TCP_LISTEN) {
+    if((flags & (TCP_SYN | TCP_RST)) == TCP_SYN)
+      tcp_listen_input(pcb, th, hlen, src, dst);
+    goto drop;
+  }
+  if(pcb->state == TCP_SYN_SENT) {
+    tcp_syn_sent_input(pcb, th, hlen, seq, ack);
+    goto drop;
+  }
+
+  /* Synchronized (or SYN_RCVD): trim bytes we already have. */
+  netbuf_pull(nb, hlen);
+  if(SEQ_LT(seq, pcb->rcv_nxt)) {
+    u32 dup = pcb->rcv_nxt - seq;
+    if(flags & TCP_SYN) {
+      flags &= (u8)~TCP_SYN;
+      dup--;
+      seq++;
+    }
+    if(dup >= dlen && !(dup == dlen && (flags & TCP_FIN))) {
+      /* All old (a retransmission): just tell the peer where we are. */
+      if(!(flags & TCP_RST))
+        tcp_send_ack(pcb);
+      if(pcb->state == TCP_TIME_WAIT && (flags & TCP_FIN))
+        timer_arm(&pcb->timer, time_monotonic_ns() + TCP_TIME_WAIT_NS);
+      goto drop;
+    }
+    netbuf_pull(nb, dup);
+    dlen -= dup;
+    seq  += dup;
+  }
+
+  if(flags & TCP_RST) {
+    if(seq == pcb->rcv_nxt)
+      tcp_abort(pcb, pcb->state == TCP_SYN_RCVD && !pcb->parent
+                         ? -ECONNREFUSED
+                         : -ECONNRESET);
+    goto drop;
+  }
+  if(flags & TCP_SYN) {
+    tcp_send_ack(pcb);
+    goto drop;
+  }
+  if(!(flags & TCP_ACK))
+    goto drop;
+
+  if(pcb->state == TCP_SYN_RCVD) {
+    if(ack != pcb->snd_una + 1) {
+      tcp_send_bare(dst, src, dport, sport, ack, 0, TCP_RST);
+      goto drop;
+    }
+    pcb->snd_una = ack;
+    pcb->state   = pcb->fin_queued ? TCP_FIN_WAIT_1 : TCP_ESTABLISHED;
+    pcb->retries = 0;
+    pcb->snd_wnd = wnd;
+    pcb->snd_wl1 = seq;
+    pcb->snd_wl2 = ack;
+    timer_cancel(&pcb->timer);
+    if(pcb->parent) {
+      tcp_pcb_t *l = pcb->parent;
+      if(l->acc_tail)
+        l->acc_tail->acc_next = pcb;
+      else
+        l->acc_head = pcb;
+      l->acc_tail = pcb;
+      tcp_wake(l);
+    }
+    tcp_wake(pcb);
+  }
+  if(!tcp_ack(pcb, seq, ack, wnd, dlen))
+    goto drop;
+  if(pcb->state == TCP_CLOSED)
+    goto drop;
+
+  bool need_ack = false;
+  bool queued   = false;
+  if(seq != pcb->rcv_nxt) {
+    /* A hole before this segment: duplicate ACK, drop. */
+    if(dlen || (flags & TCP_FIN))
+      tcp_send_ack(pcb);
+    goto drop;
+  }
+  if(dlen && pcb->state <= TCP_FIN_WAIT_2) {
+    if(!pcb->sock && !pcb->parent) {
+      /* Data for a closed socket: nobody will read it. */
+      tcp_abort(pcb, -ECONNRESET);
+      goto drop;
+    }
+    u32 len  = nb->len;
+    queued   = tcp_data(pcb, nb);
+    need_ack = true;
+    if(!queued || nb->len < len)
+      flags &= (u8)~TCP_FIN;
+  }
+  if((flags & TCP_FIN) && !pcb->fin_rcvd) {
+    tcp_fin(pcb);
+    need_ack = true;
+  }
+
+  u32 before = pcb->snd_nxt;
+  tcp_output(pcb);
+  if(need_ack && pcb->snd_nxt == before)
+    tcp_send_ack(pcb);
+  if(queued)
+    return;
+
+drop:
+  netbuf_free(nb);
+}
+
+static void tcp_timer(ktimer_t *t)
+{
+  tcp_pcb_t *pcb = t->arg;
+  u64        now = time_monotonic_ns();
+
+  if(pcb->state == TCP_TIME_WAIT ||
+     (pcb->state == TCP_FIN_WAIT_2 && !pcb->sock)) {
+    tcp_finish(pcb);
+    return;
+  }
+  if(pcb->state == TCP_SYN_SENT || pcb->state == TCP_SYN_RCVD) {
+    if(++pcb->retries > TCP_SYN_RETRIES) {
+      tcp_abort(pcb, -ETIMEDOUT);
+      return;
+    }
+    pcb->rto = pcb->rto * 2 < TCP_RTO_MAX ? pcb->rto * 2 : TCP_RTO_MAX;
+    tcp_send_syn(pcb);
+    return;
+  }
+
+  pcb->rto = pcb->rto * 2 < TCP_RTO_MAX ? pcb->rto * 2 : TCP_RTO_MAX;
+  if(pcb->snd_una == pcb->snd_max) {
+    /* Zero-window probe: an old sequence number makes the peer answer
+     * with its current window. */
+    if(pcb->snd_len && !pcb->snd_wnd) {
+      tcp_xmit(pcb, pcb->snd_una - 1, TCP_ACK, 0, 0);
+      timer_arm(&pcb->timer, now + pcb->rto);
+    }
+    return;
+  }
+
+  if(++pcb->retries > TCP_RETRIES) {
+    tcp_abort(pcb, -ETIMEDOUT);
+    return;
+  }
+  u32 flight      = pcb->snd_max - pcb->snd_una;
+  pcb->ssthresh   = flight / 2 > 2u * pcb->mss ? flight / 2 : 2u * pcb->mss;
+  pcb->cwnd       = pcb->mss;
+  pcb->snd_nxt    = pcb->snd_una;
+  pcb->dupacks    = 0;
+  pcb->rtt_timing = false;
+  timer_arm(&pcb->timer, now + pcb->rto);
+  tcp_output(pcb);
+}
+
+/* A free port, or 0. */
+static bool tcp_port_used(u16 port, u32 addr)
+{
+  for(tcp_pcb_t *p = tcp_pcbs; p; p = p->next) {
+    if(p->lport == port && p->state != TCP_TIME_WAIT &&
+       (!p->laddr || !addr || p->laddr == addr))
+      return true;
+  }
+  return false;
+}
+
+i64 tcp_attach(sock_t *s)
+{
+  tcp_pcb_t *pcb = tcp_pcb_new();
+  if(!pcb)
+    return -ENOMEM;
+  pcb->sock = s;
+  s->pcb    = pcb;
+  return 0;
+}
+
+i64 tcp_bind(sock_t *s, u32 addr, u16 port)
+{
+  netif_t   *nif = net_if();
+  tcp_pcb_t *pcb = s->pcb;
+  if(s->bound || pcb->state != TCP_CLOSED)
+    return -EINVAL;
+  if(addr && (addr >> 24) != 127 && (!nif || addr != nif->ip))
+    return -EADDRNOTAVAIL;
+
+  if(!port) {
+    for(u32 i = 0; i < 65536 - TCP_PORT_EPH_LO && !port; i++) {
+      u16 p         = tcp_next_port;
+      tcp_next_port = p == 0xFFFF ? TCP_PORT_EPH_LO : (u16)(p + 1);
+      if(!tcp_port_used(p, addr))
+        port = p;
+    }
+    if(!port)
+      return -EADDRINUSE;
+  } else if(tcp_port_used(port, addr)) {
+    return -EADDRINUSE;
+  }
+  pcb->laddr = s->laddr = addr;
+  pcb->lport = s->lport = port;
+  s->bound   = true;
+  return 0;
+}
+
+i64 tcp_listen(sock_t *s, u32 backlog)
+{
+  tcp_pcb_t *pcb = s->pcb;
+  if(pcb->state != TCP_CLOSED && pcb->state != TCP_LISTEN)
+    return -EINVAL;
+  if(!s->bound) {
+    i64 r = tcp_bind(s, 0, 0);
+    if(r < 0)
+      return r;
+  }
+  pcb->state   = TCP_LISTEN;
+  pcb->backlog = backlog < 1                 ? 1
+                 : backlog > TCP_BACKLOG_MAX ? TCP_BACKLOG_MAX
+                                             : backlog;
+  return 0;
+}
+
+/* Wait for the connection to leave SYN_SENT / SYN_RCVD. */
+static i64 tcp_wait_synced(sock_t *s, bool nonblock, u64 deadline)
+{
+  while(s->pcb->state == TCP_SYN_SENT || s->pcb->state == TCP_SYN_RCVD) {
+    i64 r = sock_wait(s, nonblock, deadline);
+    if(r < 0)
+      return r;
+  }
+  if(s->error) {
+    i64 err  = s->error;
+    s->error = 0;
+    return err;
+  }
+  return 0;
+}
+
+i64 tcp_connect(sock_t *s, u32 addr, u16 port, bool nonblock)
+{
+  tcp_pcb_t *pcb = s->pcb;
+  if(pcb->state == TCP_SYN_SENT)
+    return nonblock ? -EALREADY : tcp_wait_synced(s, false, 0);
+  if(pcb->state == TCP_LISTEN)
+    return -EINVAL;
+  if(pcb->state != TCP_CLOSED || pcb->rport)
+    return -EISCONN;
+  if(!addr || !port)
+    return -ECONNREFUSED;
+
+  u32 src = sock_src_addr(s, addr);
+  if(!src)
+    return -ENETUNREACH;
+  if(!s->bound) {
+    i64 r = tcp_bind(s, 0, 0);
+    if(r < 0)
+      return r;
+  }
+  pcb->laddr = s->laddr = src;
+  pcb->raddr = s->raddr = addr;
+  pcb->rport = s->rport = port;
+
+  pcb->state   = TCP_SYN_SENT;
+  pcb->snd_una = tcp_isn();
+  pcb->retries = 0;
+  tcp_send_syn(pcb);
+  if(nonblock)
+    return -EINPROGRESS;
+  return tcp_wait_synced(s, false, 0);
+}
+
+i64 tcp_accept(sock_t *s, sock_t **child, bool nonblock)
+{
+  tcp_pcb_t *l = s->pcb;
+  if(l->state != TCP_LISTEN)
+    return -EINVAL;
+  u64 deadline = sock_deadline(s->rcvtimeo);
+  while(!l->acc_head) {
+    i64 r = sock_wait(s, nonblock, deadline);
+    if(r < 0)
+      return r;
+  }
+
+  sock_t *c = kzalloc(sizeof(*c));
+  if(!c)
+    return -ENOMEM;
+  tcp_pcb_t *pcb = l->acc_head;
+  tcp_unqueue(pcb);
+  c->type  = SOCK_STREAM;
+  c->bound = true;
+  c->laddr = pcb->laddr;
+  c->lport = pcb->lport;
+  c->raddr = pcb->raddr;
+  c->rport = pcb->rport;
+  c->pcb   = pcb;
+  pcb->sock = c;
+  /* The peer may have closed or reset before we got here. */
+  if(pcb->state == TCP_CLOSED)
+    c->error = -ECONNRESET;
+  *child = c;
+  return 0;
+}
+
+/* Room for more bytes in the send buffer, waiting for it if need be. */
+static i64 tcp_send_wait(sock_t *s, bool nonblock, u64 deadline)
+{
+  i64 r = tcp_wait_synced(s, nonblock, deadline);
+  if(r < 0)
+    return r;
+  for(;;) {
+    tcp_pcb_t *pcb = s->pcb;
+    if((s->shut & SHUT_WR_BIT) || pcb->fin_queued ||
+       (pcb->state != TCP_ESTABLISHED && pcb->state != TCP_CLOSE_WAIT))
+      return pcb->state == TCP_CLOSED && !pcb->rport ? -ENOTCONN : -EPIPE;
+    if(pcb->snd_len < TCP_SNDBUF)
+      return 0;
+    r = sock_wait(s, nonblock, deadline);
+    if(r < 0)
+      return r;
+    if(s->error) {
+      r        = s->error;
+      s->error = 0;
+      return r;
+    }
+  }
+}
+
+static void tcp_snd_append(tcp_pcb_t *pcb, tcp_chunk_t *c)
+{
+  c->next = NULL;
+  if(pcb->snd_tail)
+    pcb->snd_tail->next = c;
+  else
+    pcb->snd_head = c;
+  pcb->snd_tail  = c;
+  pcb->snd_len  += c->len;
+}
+
+i64 tcp_send(sock_t *s, const void *buf, u64 len, bool nonblock)
+{
+  tcp_pcb_t *pcb      = s->pcb;
+  const u8  *src      = buf;
+  u64        done     = 0;
+  u64        deadline = sock_deadline(s->sndtimeo);
+  while(done < len) {
+    i64 r = tcp_send_wait(s, nonblock || done, deadline);
+    if(r < 0) {
+      if(done && r == -EAGAIN && !nonblock)
+        continue; /* sent some: now block for the rest */
+      if(done)
+        break;
+      return r;
+    }
+
+    /* Append to our last page while it has room, else start one. */
+    u32          space = TCP_SNDBUF - pcb->snd_len;
+    tcp_chunk_t *c     = pcb->snd_tail;
+    u32          in    = c ? (u32)((c->phys + c->len) & (PAGE_SIZE - 1)) : 0;
+    if(!c || !c->own || !in) {
+      void *page = pmm_alloc();
+      c          = page ? kzalloc(sizeof(*c)) : NULL;
+      if(!c) {
+        if(page)
+          pmm_free(page);
+        if(done)
+          break;
+        return -ENOBUFS;
+      }
+      c->phys = (u64)page;
+      c->own  = true;
+      tcp_snd_append(pcb, c);
+      in = 0;
+    }
+    u32 n = PAGE_SIZE - in;
+    if(n > space)
+      n = space;
+    if(n > len - done)
+      n = (u32)(len - done);
+    kmemcpy((u8 *)phys_to_virt(c->phys) + c->len, src + done, n);
+    c->len       += n;
+    pcb->snd_len += n;
+    done         += n;
+    tcp_output(pcb);
+  }
+  return (i64)done;
+}
+
+i64 tcp_send_page(sock_t *s, u64 phys, u32 len, bool nonblock)
+{
+  tcp_pcb_t *pcb = s->pcb;
+  i64        r   = tcp_send_wait(s, nonblock, sock_deadline(s->sndtimeo));
+  if(r < 0)
+    return r;
+  tcp_chunk_t *c = kzalloc(sizeof(*c));
+  if(!c)
+    return -ENOBUFS;
+  if(!pmm_page_ref((void *)(phys & ~(u64)(PAGE_SIZE - 1)))) {
+    kfree(c);
+    return -EINVAL;
+  }
+  c->phys = phys;
+  c->len  = len;
+  tcp_snd_append(pcb, c);
+  tcp_output(pcb);
+  return len;
+}
+
+i64 tcp_recv(sock_t *s, void *buf, u64 len, u32 flags, bool nonblock)
+{
+  tcp_pcb_t *pcb      = s->pcb;
+  u64        deadline = sock_deadline(s->rcvtimeo);
+  if(pcb->state == TCP_LISTEN || (pcb->state == TCP_CLOSED && !pcb->rport))
+    return -ENOTCONN;
+  while(!pcb->rx_len) {
+    if(s->error) {
+      i64 err  = s->error;
+      s->error = 0;
+      return err;
+    }
+    if(pcb->fin_rcvd || pcb->state == TCP_CLOSED || (s->shut & SHUT_RD_BIT))
+      return 0;
+    i64 r = sock_wait(s, nonblock, deadline);
+    if(r < 0)
+      return r;
+  }
+
+  u8  *dst  = buf;
+  u64  done = 0;
+  u32  wnd  = pcb->rcv_adv - pcb->rcv_nxt;
+  for(netbuf_t *nb = pcb->rx_head; nb && done < len;) {
+    u32 n = nb->len < len - done ? nb->len : (u32)(len - done);
+    kmemcpy(dst + done, nb->data, n);
+    done += n;
+    if(flags & MSG_PEEK) {
+      nb = nb->next;
+      continue;
+    }
+    netbuf_pull(nb, n);
+    pcb->rx_len -= n;
+    if(nb->len)
+      break;
+    pcb->rx_head = nb->next;
+    if(!pcb->rx_head)
+      pcb->rx_tail = NULL;
+    netbuf_free(nb);
+    nb = pcb->rx_head;
+  }
+
+  /* Tell the peer once the window has opened by a useful amount. */
+  if(tcp_synced(pcb) && !pcb->fin_rcvd &&
+     tcp_rcv_wnd(pcb) >= wnd + 2u * pcb->mss)
+    tcp_send_ack(pcb);
+  return (i64)done;
+}
+
+i64 tcp_shutdown(sock_t *s, u32 how)
+{
+  tcp_pcb_t *pcb = s->pcb;
+  if(!tcp_synced(pcb) && pcb->state != TCP_SYN_RCVD)
+    return -ENOTCONN;
+  s->shut |= (u8)how;
+  if((how & SHUT_WR_BIT) && !pcb->fin_queued) {
+    if(pcb->state == TCP_ESTABLISHED || pcb->state == TCP_SYN_RCVD) {
+      pcb->fin_queued = true;
+      if(pcb->state == TCP_ESTABLISHED)
+        pcb->state = TCP_FIN_WAIT_1;
+    } else if(pcb->state == TCP_CLOSE_WAIT) {
+      pcb->fin_queued = true;
+      pcb->state      = TCP_LAST_ACK;
+    }
+    tcp_output(pcb);
+  }
+  tcp_wake(pcb);
+  return 0;
+}
+
+void tcp_close(sock_t *s)
+{
+  tcp_pcb_t *pcb = s->pcb;
+  pcb->sock      = NULL;
+  s->pcb         = NULL;
+
+  if(pcb->state == TCP_LISTEN) {
+    for(tcp_pcb_t *c = tcp_pcbs, *next; c; c = next) {
+      next = c->next;
+      if(c->parent == pcb)
+        tcp_abort(c, -ECONNABORTED);
+    }
+    tcp_pcb_free(pcb);
+    return;
+  }
+  if(pcb->state == TCP_CLOSED || pcb->state == TCP_SYN_SENT) {
+    tcp_pcb_free(pcb);
+    return;
+  }
+  /* Unread data: the peer learns it was lost (RFC 2525). */
+  if(pcb->rx_len) {
+    tcp_abort(pcb, -ECONNRESET);
+    return;
+  }
+  if(!pcb->fin_queued) {
+    pcb->fin_queued = true;
+    if(pcb->state == TCP_ESTABLISHED)
+      pcb->state = TCP_FIN_WAIT_1;
+    else if(pcb->state == TCP_CLOSE_WAIT)
+      pcb->state = TCP_LAST_ACK;
+    tcp_output(pcb);
+  } else if(pcb->state == TCP_FIN_WAIT_2) {
+    timer_arm(&pcb->timer, time_monotonic_ns() + TCP_FIN_WAIT2_NS);
+  }
+}
+
+u32 tcp_poll(sock_t *s)
+{
+  tcp_pcb_t *pcb  = s->pcb;
+  u32        mask = 0;
+  if(pcb->state == TCP_LISTEN)
+    return pcb->acc_head ? VFS_POLL_IN : 0;
+  if(pcb->state == TCP_SYN_SENT || pcb->state == TCP_SYN_RCVD)
+    return 0;
+  if(pcb->rx_len || pcb->fin_rcvd || (s->shut & SHUT_RD_BIT))
+    mask |= VFS_POLL_IN;
+  if((pcb->state == TCP_ESTABLISHED || pcb->state == TCP_CLOSE_WAIT) &&
+     !pcb->fin_queued && pcb->snd_len < TCP_SNDBUF)
+    mask |= VFS_POLL_OUT;
+  if(s->error)
+    mask |= VFS_POLL_ERR;
+  if(pcb->state == TCP_CLOSED || (pcb->fin_rcvd && pcb->fin_queued))
+    mask |= VFS_POLL_HUP | VFS_POLL_IN;
+  return mask;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file src/net/udp.c
+ * @brief UDP: datagram delivery to bound sockets.
+ *
+ * Bound sockets are kept on one list, searched for each datagram;
+ * a connected socket only takes datagrams from its peer. A socket queues
+ * the received buffers themselves, up to ::UDP_RCVBUF bytes, and later
+ * datagrams are dropped until it reads.
+ */
+
+#include <alcor2/errno.h>
+#include <alcor2/fs/vfs.h>
+#include <alcor2/kstdlib.h>
+#include <alcor2/net/net.h>
+#include <alcor2/net/sock.h>
+
+#define UDP_HLEN     8
+#define UDP_RCVBUF   (64 * 1024)
+#define UDP_MAX_DATA (ETH_MTU - IP_HLEN - UDP_HLEN)
+#define PORT_EPH_LO  49152
+
+/** @brief UDP header (network order). */
+typedef struct PACKED
+{
+  u16 sport;
+  u16 dport;
+  u16 len;
+  u16 csum;
+} udp_hdr_t;
+
+static sock_t *udp_socks; /* bound sockets */
+static u16     udp_next_port = PORT_EPH_LO;
+
+static bool udp_port_used(u16 port)
+{
+  for(sock_t *s = udp_socks; s; s = s->next) {
+    if(s->lport == port)
+      return true;
+  }
+  return false;
+}
+
+i64 udp_bind(sock_t *s, u32 addr, u16 port)
+{
+  netif_t *nif = net_if();
+  if(s->bound)
+    return -EINVAL;
+  if(addr && (addr >> 24) != 127 && (!nif || addr != nif->ip))
+    return -EADDRNOTAVAIL;
+
+  if(!port) {
+    for(u32 i = 0; i < 65536 - PORT_EPH_LO && !port; i++) {
+      u16 p         = udp_next_port;
+      udp_next_port = p == 0xFFFF ? PORT_EPH_LO : (u16)(p + 1);
+      if(!udp_port_used(p))
+        port = p;
+    }
+    if(!port)
+      return -EADDRINUSE;
+  } else if(udp_port_used(port)) {
+    return -EADDRINUSE;
+  }
+
+  s->laddr  = addr;
+  s->lport  = port;
+  s->bound  = true;
+  s->next   = udp_socks;
+  udp_socks = s;
+  return 0;
+}
+
+i64 udp_sendto(sock_t *s, const void *buf, u64 len, u32 addr, u16 port)
+{
+  if(s->shut & SHUT_WR_BIT)
+    return -EPIPE;
+  if(len > UDP_MAX_DATA)
+    return -EMSGSIZE;
+  if(!s->bound) {
+    i64 r = udp_bind(s, 0, 0);
+    if(r < 0)
+      return r;
+  }
+
+  netbuf_t *nb = netbuf_alloc();
+  if(!nb)
+    return -ENOBUFS;
+  udp_hdr_t *uh = (udp_hdr_t *)netbuf_put(nb, UDP_HLEN + (u32)len);
+  kmemcpy(uh + 1, buf, len);
+
+  u32 src   = sock_src_addr(s, addr);
+  u32 ulen  = UDP_HLEN + (u32)len;
+  uh->sport = net_htons(s->lport);
+  uh->dport = net_htons(port);
+  uh->len   = net_htons((u16)ulen);
+  uh->csum  = 0;
+  u64 sum   = net_csum_pseudo(src, addr, IP_PROTO_UDP, ulen);
+  u16 csum  = net_csum_fold(net_csum_netbuf(sum, nb));
+  uh->csum  = net_htons(csum ? csum : 0xFFFF);
+
+  i64 r = ip_output(nb, src, addr, IP_PROTO_UDP);
+  return r < 0 ? r : (i64)len;
+}
+
+i64 udp_recvfrom(
+    sock_t *s, void *buf, u64 len, u32 flags, bool nonblock, u32 *addr,
+    u16 *port
+)
+{
+  u64 deadline = sock_deadline(s->rcvtimeo);
+  while(!s->rx_head) {
+    if(s->shut & SHUT_RD_BIT)
+      return 0;
+    i64 r = sock_wait(s, nonblock, deadline);
+    if(r < 0)
+      return r;
+  }
+
+  netbuf_t *nb = s->rx_head;
+  u32       n  = len < nb->len ? (u32)len : nb->len;
+  kmemcpy(buf, nb->data, n);
+  if(addr)
+    *addr = nb->saddr;
+  if(port)
+    *port = nb->sport;
+  if(!(flags & MSG_PEEK)) {
+    s->rx_head = nb->next;
+    if(!s->rx_head)
+      s->rx_tail = NULL;
+    s->rx_bytes -= nb->len;
+    netbuf_free(nb);
+  }
+  return n;
+}
+
+void udp_close(sock_t *s)
+{
+  for(sock_t **pp = &udp_socks; *pp; pp = &(*pp)->next) {
+    if(*pp == s) {
+      *pp = s->next;
+      break;
+    }
+  }
+  netbuf_free_list(s->rx_head);
+  s->rx_head = s->rx_tail = NULL;
+  s->bound   = false;
+}
+
+u32 udp_poll(sock_t *s)
+{
+  u32 mask = VFS_POLL_OUT;
+  if(s->rx_head || (s->shut & SHUT_RD_BIT))
+    mask |= VFS_POLL_IN;
+  if(s->error)
+    mask |= VFS_POLL_ERR;
+  return mask;
+}
+
+void udp_input(netbuf_t *nb, u32 src, u32 dst)
+{
+  const udp_hdr_t *uh   = (const udp_hdr_t *)nb->data;
+  u32              ulen = nb->len >= UDP_HLEN ? net_ntohs(uh->len) : 0;
+  if(ulen < UDP_HLEN || ulen > nb->len)
+    goto drop;
+  nb->len = ulen;
+  u64 sum = net_csum_pseudo(src, dst, IP_PROTO_UDP, ulen);
+  if(uh->csum && !nb->csum_ok && net_csum_fold(net_csum_netbuf(sum, nb)))
+    goto drop;
+
+  u16     sport = net_ntohs(uh->sport);
+  u16     dport = net_ntohs(uh->dport);
+  sock_t *s     = udp_socks;
+  for(; s; s = s->next) {
+    if(s->lport != dport || (s->laddr && s->laddr != dst))
+      continue;
+    if(s->connected && (s->raddr != src || s->rport != sport))
+      continue;
+    break;
+  }
+  if(!s || (s->shut & SHUT_RD_BIT) || s->rx_bytes + ulen > UDP_RCVBUF)
+    goto drop;
+
+  netbuf_pull(nb, UDP_HLEN);
+  nb->saddr = src;
+  nb->sport = sport;
+  nb->next  = NULL;
+  if(s->rx_tail)
+    s->rx_tail->next = nb;
+  else
+    s->rx_head = nb;
+  s->rx_tail   = nb;
+  s->rx_bytes += nb->len;
+  wait_wake_all(&s->wq);
+  return;
+
+drop:
+  netbuf_free(nb);
+}
@@ -193,7 +193,14 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  fill_bg(fb, &inf, 0x001a2430u);
+  /* Draw the frame offscreen and show it in one present, so the screen
+   * never shows it half drawn; without a back buffer, draw in place. */
+  auto *draw      = static_cast<uint8_t *>(alcor_fb_backbuf());
+  bool  offscreen = draw != (uint8_t *)-1;
+  if(!offscreen)
+    draw = fb;
+
+  fill_bg(draw, &inf, 0x001a2430u);
 
   unsigned pxy = inf.height > 480 ? 32u : 22u;
   int      y0  = (int)(inf.height / 5);
@@ -208,13 +215,17 @@ int main(int argc, char **argv)
                           : "Alcor2 userspace draws the framebuffer.";
 
   shape_draw_line(
-      fb, &inf, face, hbfont, pxy, 24, y0 + (int)pxy * 5 / 4, line1, 0x00a8e8ffu
+      draw, &inf, face, hbfont, pxy, 24, y0 + (int)pxy * 5 / 4, line1,
+      0x00a8e8ffu
   );
   shape_draw_line(
-      fb, &inf, face, hbfont, pxy * 3 / 4u, 24,
+      draw, &inf, face, hbfont, pxy * 3 / 4u, 24,
       y0 + (int)pxy * 5 / 4 + (int)pxy + 16, line2, 0x0088c8ffu
   );
 
+  if(offscreen)
+    alcor_fb_present(draw, 0, 0, 0, 0);
+
   hb_font_destroy(hbfont);
   FT_Done_Face(face);
   FT_Done_FreeType(ftlib);
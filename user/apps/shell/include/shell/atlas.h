@@ -11,6 +11,9 @@
  * @brief Load the TTF at @p font_path, rasterize ASCII + box-drawing + a few
  * Latin-1 glyphs, and submit the atlas to the kernel.
  *
+ * An atlas cached on disk from the same font and metrics is submitted
+ * instead of rasterizing; a fresh one is cached for the next start.
+ *
  * @return 0 on success, -1 if the font file cannot be opened, FreeType setup
  *         fails, or the kernel rejects the atlas (in which case the kernel
  *         keeps its built-in CP437 bitmap fallback — the shell is still
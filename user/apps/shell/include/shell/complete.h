@@ -0,0 +1,44 @@
+/**
+ * @file shell/complete.h
+ * @brief Tab completion of command names and paths.
+ *
+ * Directory listings are cached and revalidated with stat(), so pressing
+ * Tab in a large PATH directory reads it once rather than on every press.
+ */
+
+#ifndef SHELL_COMPLETE_H
+#define SHELL_COMPLETE_H
+
+#include <stddef.h>
+
+/** @brief What the word at the end of a line can be completed to. */
+typedef struct
+{
+  char **names; /* sorted; a directory's ends in '/' */
+  int    n;
+  size_t start; /* offset in the line where the names' text begins */
+} completion_t;
+
+/**
+ * @brief Find the completions of the word ending @p line (@p len bytes).
+ *
+ * A word without '/' in command position matches shell builtins, vega
+ * utilities and programs in PATH; any other word matches the entries of
+ * the directory it names (the working directory if none).
+ *
+ * @return 0, or -1 on allocation failure. @p out->n may be 0 either way;
+ *         release @p out with completion_free().
+ */
+int complete(const char *line, size_t len, completion_t *out);
+
+/** @brief Free what complete() stored in @p c. */
+void completion_free(completion_t *c);
+
+/**
+ * @brief Note that a command ran and may have changed any directory. A
+ *        listing whose directory reports no modification time (Alcor2's
+ *        filesystems do not keep one yet) is read again after this.
+ */
+void complete_invalidate(void);
+
+#endif /* SHELL_COMPLETE_H */
@@ -0,0 +1,42 @@
+/**
+ * @file shell/history.h
+ * @brief Command history: the last HISTORY_MAX lines, kept in a file
+ * across sessions and indexed for Ctrl-R substring search.
+ *
+ * Entries are numbered by a sequence that only grows, so a number stays
+ * valid (or reports the entry gone) while newer lines are added.
+ */
+
+#ifndef SHELL_HISTORY_H
+#define SHELL_HISTORY_H
+
+#define HISTORY_MAX  500
+/** @brief History file unless @c VEGA_HISTFILE names another. */
+#define HISTORY_FILE "/.vega_history"
+
+/** @brief Read the history file. Call once, before the first prompt. */
+void history_load(void);
+
+/**
+ * @brief Record @p line (one line, no newline) as the newest entry and
+ * append it to the file. Empty lines and repeats of the newest entry are
+ * dropped.
+ */
+void history_add(const char *line);
+
+/** @brief Number one past the newest entry. */
+int history_end(void);
+
+/** @brief Number of the oldest entry still kept. */
+int history_begin(void);
+
+/** @brief Text of entry @p seq, or NULL if it is out of range. */
+const char *history_get(int seq);
+
+/**
+ * @brief Newest entry older than @p before whose text contains @p query.
+ * @return Its number, or -1 if there is none.
+ */
+int history_search(const char *query, int before);
+
+#endif /* SHELL_HISTORY_H */
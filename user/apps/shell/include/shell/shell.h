@@ -48,6 +48,9 @@ int            sh_unlink(const char *path);
 
 /* Shell-side builtin dispatch (registered with libvega's ops table). */
 bool sh_is_builtin(const char *name);
+bool sh_is_pure_builtin(const char *name);
+/** NULL-terminated names of the shell builtins (for completion). */
+const char *const *sh_builtin_names(void);
 int  sh_run_builtin(int argc, char *const argv[]);
 
 #endif /* SHELL_H */
@@ -9,16 +9,22 @@
  */
 
 #include <shell/atlas.h>
+#include <shell/complete.h>
+#include <shell/history.h>
 #include <shell/shell.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <vega/host.h>
 #include <vega/vega.h>
 
 static const vega_host_ops_t shell_host = {
     .is_builtin  = sh_is_builtin,
     .run_builtin = sh_run_builtin,
+    .is_pure     = sh_is_pure_builtin,
 };
 
 #ifndef VEGA_VERSION
@@ -36,6 +42,10 @@ typedef struct
 
 static LineEditState s_edit = {.pushback = -1};
 
+/* Prints the prompt of the line being read, to redraw it after listing
+ * completions. */
+typedef void (*prompt_fn_t)(void);
+
 /** Special return codes for read_line(): negative values that don't clash
  *  with a byte-count. RL_EOF is the existing "user hit Ctrl-D on an empty
  *  line"; RL_INTERRUPT signals SIGINT-style Ctrl-C so the caller can drop
@@ -83,16 +93,185 @@ static int store_utf8_cp(char *buf, size_t size, size_t *pos, uint32_t cp)
   return 0;
 }
 
+/* Number of codepoints (terminal cells) in the first @p len bytes of @p s. */
+static size_t count_cps(const char *s, size_t len)
+{
+  size_t n = 0;
+  for(size_t i = 0; i < len; i++)
+    n += ((unsigned char)s[i] & 0xc0u) != 0x80u;
+  return n;
+}
+
+/* Move back over the @p cells just printed and clear to the end of line. */
+static void erase_cells(size_t cells)
+{
+  while(cells-- > 0)
+    sh_putchar('\b');
+  sh_puts("\x1b[K");
+}
+
+/* Make @p text, cut to fit @p size on a codepoint boundary, the line in
+ * @p buf and print it. */
+static void set_line(char *buf, size_t size, size_t *pos, const char *text)
+{
+  size_t n = strlen(text);
+  if(n > size - 1) {
+    n = size - 1;
+    while(n > 0 && ((unsigned char)text[n] & 0xc0u) == 0x80u)
+      n--;
+  }
+  memcpy(buf, text, n);
+  buf[n] = '\0';
+  *pos   = n;
+  sh_stdout_bytes(buf, n);
+}
+
+/* Replace the line in @p buf (@p *pos bytes so far) and on screen. */
+static void replace_line(char *buf, size_t size, size_t *pos, const char *text)
+{
+  erase_cells(count_cps(buf, *pos));
+  set_line(buf, size, pos, text);
+}
+
+/* Append @p n bytes of @p s to the line and echo them; false if they do not
+ * fit. */
+static int append(char *buf, size_t size, size_t *pos, const char *s, size_t n)
+{
+  if(*pos + n >= size)
+    return 0;
+  memcpy(buf + *pos, s, n);
+  *pos += n;
+  sh_stdout_bytes(s, n);
+  return 1;
+}
+
+/* Tab: complete the word before the cursor. One match is appended whole
+ * (then a space, unless it is a directory); several are extended to their
+ * common prefix, or listed when that adds nothing. */
+static void tab_complete(
+    char *buf, size_t size, size_t *pos, prompt_fn_t prompt
+)
+{
+  completion_t c;
+  if(complete(buf, *pos, &c) < 0 || c.n == 0) {
+    completion_free(&c);
+    return;
+  }
+
+  size_t typed  = *pos - c.start;
+  size_t common = strlen(c.names[0]);
+  for(int i = 1; i < c.n; i++) {
+    size_t k = 0;
+    while(k < common && c.names[i][k] == c.names[0][k])
+      k++;
+    common = k;
+  }
+  while(common > typed && ((unsigned char)c.names[0][common] & 0xc0u) == 0x80u)
+    common--;
+
+  if(common > typed || c.n == 1) {
+    int fits = append(buf, size, pos, c.names[0] + typed, common - typed);
+    if(fits && c.n == 1 && c.names[0][common - 1] != '/')
+      (void)append(buf, size, pos, " ", 1);
+  } else {
+    sh_putchar('\n');
+    for(int i = 0; i < c.n; i++) {
+      sh_puts(c.names[i]);
+      sh_puts("  ");
+    }
+    sh_putchar('\n');
+    prompt();
+    sh_stdout_bytes(buf, *pos);
+  }
+  completion_free(&c);
+}
+
+/* Show the Ctrl-R status line for @p query and the entry @p match; returns
+ * the cells it takes. */
+static size_t show_search(const char *query, int match, int failed)
+{
+  const char *text = match >= 0 ? history_get(match) : "";
+  const char *head =
+      failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`";
+  sh_puts(head);
+  sh_puts(query);
+  sh_puts("': ");
+  sh_puts(text);
+  return strlen(head) + count_cps(query, strlen(query)) + 3 +
+         count_cps(text, strlen(text));
+}
+
+/* Ctrl-R: incremental search of the history, newest first. Typing narrows
+ * the query, Ctrl-R again finds an older match, Ctrl-G gives the line back
+ * as it was. Any other key leaves the match in the line and is then handled
+ * as usual (Enter runs it). */
+static void reverse_search(char *buf, size_t size, size_t *pos)
+{
+  char   query[64];
+  size_t qlen   = 0;
+  int    match  = -1;
+  int    failed = 0;
+  int    c;
+  query[0] = '\0';
+
+  erase_cells(count_cps(buf, *pos));
+  size_t shown = show_search(query, match, failed);
+  while(1) {
+    c = sh_getchar();
+    if(c < 0)
+      continue;
+    if(c == 0x12) {
+      int older = history_search(query, match >= 0 ? match : history_end());
+      failed    = older < 0 && qlen > 0;
+      if(older >= 0)
+        match = older;
+    } else if(c == '\b' || c == 127) {
+      while(qlen > 0 && ((unsigned char)query[--qlen] & 0xc0u) == 0x80u)
+        ;
+      query[qlen] = '\0';
+      match       = history_search(query, history_end());
+      failed      = 0;
+    } else if(c >= 32) {
+      if(qlen == sizeof(query) - 1)
+        continue;
+      query[qlen++] = (char)c;
+      query[qlen]   = '\0';
+      /* Keep showing the last match until the query finds another. */
+      int m  = history_search(query, history_end());
+      failed = m < 0;
+      if(m >= 0)
+        match = m;
+    } else {
+      break;
+    }
+    erase_cells(shown);
+    shown = show_search(query, match, failed);
+  }
+
+  erase_cells(shown);
+  if(c == 0x07 || match < 0)
+    sh_stdout_bytes(buf, *pos);
+  else
+    set_line(buf, size, pos, history_get(match));
+  if(c != 0x07)
+    s_edit.pushback = c;
+}
+
 /**
  * @brief Read a line of input from the user with basic line editing.
  * @param buf Buffer to store the line.
  * @param size Size of the buffer.
+ * @param prompt Prints this line's prompt again (after a completion list).
  * @return Number of characters read, or special value for EOF.
  */
-static int read_line(char *buf, size_t size)
+static int read_line(char *buf, size_t size, prompt_fn_t prompt)
 {
   size_t pos = 0;
   int    c;
+  /* Up/Down walk the history; the line being typed is kept in draft. */
+  int    hist = history_end();
+  char   draft[MAX_CMD_LEN];
+  draft[0] = '\0';
 
   while(1) {
     if(s_edit.pushback >= 0) {
@@ -139,6 +318,16 @@ static int read_line(char *buf, size_t size)
       continue;
     }
 
+    if(c == '\t') {
+      tab_complete(buf, size, &pos, prompt);
+      continue;
+    }
+
+    if(c == 0x12) {
+      reverse_search(buf, size, &pos);
+      continue;
+    }
+
     if(c == 0x0C) {
       sh_clear();
       line_edit_reset(&s_edit);
@@ -158,7 +347,20 @@ static int read_line(char *buf, size_t size)
         do {
           cp = sh_getchar();
         } while(cp >= 0x30 && cp <= 0x3f);
-        (void)cp;
+        /* Up and Down walk the history. */
+        if(cp == 'A' && hist > history_begin()) {
+          if(hist == history_end()) {
+            memcpy(draft, buf, pos);
+            draft[pos] = '\0';
+          }
+          replace_line(buf, size, &pos, history_get(--hist));
+        } else if(cp == 'B' && hist < history_end()) {
+          hist++;
+          replace_line(
+              buf, size, &pos,
+              hist == history_end() ? draft : history_get(hist)
+          );
+        }
         continue;
       }
       if(c2 == 'O') {
@@ -362,6 +564,11 @@ static int is_input_complete(const char *buf)
          !in_hd_body;
 }
 
+static void print_continuation(void)
+{
+  sh_puts("> ");
+}
+
 /* Read input lines into @p buf until they form a complete statement.
  * Returns total bytes accumulated, RL_EOF on Ctrl-D at empty line, or 0
  * when interrupted with Ctrl-C. */
@@ -371,7 +578,9 @@ static int read_complete_statement(char *buf, size_t size)
   buf[0]     = '\0';
 
   while(1) {
-    int len = read_line(buf + pos, size - pos);
+    int len = read_line(
+        buf + pos, size - pos, pos == 0 ? print_prompt : print_continuation
+    );
     if(len == RL_EOF)
       return RL_EOF;
     if(len == RL_INTERRUPT)
@@ -387,10 +596,18 @@ static int read_complete_statement(char *buf, size_t size)
     if(is_input_complete(buf))
       return (int)pos;
 
-    sh_puts("> ");
+    print_continuation();
   }
 }
 
+/** @brief CLOCK_MONOTONIC in ms; on Alcor2 it counts from kernel entry. */
+static long mono_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 /**
  * @brief Shell main entry point. Sets up libvega, submits the Fira atlas to
  * the kernel console, then enters the read-eval-print loop.
@@ -404,6 +621,7 @@ int main(int argc, char *argv[])
 
   /* No procfs on Alcor2; LLVM/musl fall back to PATH for argv-only lookups. */
   setenv("PATH", "/bin:/usr/bin", 0);
+  vega_spawn_warm();
 
   /* Raw mode: shell handles line editing; the kernel renders. */
   sh_set_stdin_raw();
@@ -413,18 +631,29 @@ int main(int argc, char *argv[])
   const char *font = getenv("ALCOR2_FONT");
   if(!font || !*font)
     font = "/bin/FiraCode-Regular.ttf";
-  const char *fb_off = getenv("ALCOR2_FB_TTY");
+  const char *fb_off   = getenv("ALCOR2_FB_TTY");
+  long        atlas_ms = mono_ms();
   if(!(fb_off && fb_off[0] == '0'))
     (void)atlas_submit(font);
+  atlas_ms = mono_ms() - atlas_ms;
+
+  history_load();
 
   char line[MAX_CMD_LEN];
 
+  /* Time to the first prompt, for tracking boot time. */
+  snprintf(
+      line, sizeof(line), "  Up in %ld ms (font atlas %ld ms).\n", mono_ms(),
+      atlas_ms
+  );
   sh_puts("\n");
   sh_puts("  vega " VEGA_VERSION " - Alcor2 shell\n");
+  sh_puts(line);
   sh_puts("  Type 'help' for available commands.\n");
   sh_puts("\n");
 
   while(1) {
+    vega_jobs_notify();
     print_prompt();
 
     int len = read_complete_statement(line, sizeof(line));
@@ -432,8 +661,17 @@ int main(int argc, char *argv[])
       sh_puts("exit\n");
       exit(0);
     }
-    if(len > 0)
+    if(len > 0) {
+      /* Statements typed on one line are kept in the history. */
+      char *nl = strchr(line, '\n');
+      if(nl && nl[1] == '\0') {
+        *nl = '\0';
+        history_add(line);
+        *nl = '\n';
+      }
       vega_run(line);
+      complete_invalidate();
+    }
   }
 
   return 0;
@@ -4,8 +4,14 @@
  * it to the kernel framebuffer console via @c FB_CONSOLE_SET_ATLAS.
  *
  * Covers ASCII printable, Latin-1 supplement, box-drawing, block elements,
- * and arrows — enough for ncurses-style TUIs. Unmapped codepoints fall back
- * to the kernel's CP437 bitmap.
+ * geometric shapes, arrows and Braille — enough for ncurses-style TUIs and
+ * graph-drawing monitors. Unmapped codepoints fall back to the kernel's CP437
+ * bitmap.
+ *
+ * Rasterising takes a noticeable part of boot-to-prompt, so the finished
+ * atlas is kept in @c ATLAS_CACHE_PATH, keyed by a hash of the font file,
+ * the cell metrics and the ranges. A matching cache file is mapped and
+ * handed to the kernel as it is; FreeType only runs when it is stale.
  */
 
 #include <alcor2/drivers/fb_console.h>
@@ -13,9 +19,11 @@
 #include <ft2build.h>
 #include <shell/atlas.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include FT_FREETYPE_H
@@ -35,10 +43,29 @@ static const struct
     {0x00A0u, 0x00FFu}, /* Latin-1 supplement */
     {0x2500u, 0x257Fu}, /* Box drawing */
     {0x2580u, 0x259Fu}, /* Block elements */
+    {0x25A0u, 0x25FFu}, /* Geometric shapes */
     {0x2190u, 0x21FFu}, /* Arrows */
+    {0x2800u, 0x28FFu}, /* Braille patterns (graphs in top-like tools) */
 };
 
-#define CP_MAP_SIZE 0x2600u
+#define CP_MAP_SIZE 0x2900u
+
+/* On-disk atlas cache: header, then cp_map[n_cp], then the pixels. */
+#define ATLAS_CACHE_PATH    "/tmp/fira-atlas.cache"
+#define ATLAS_CACHE_MAGIC   0x54414c41u /* "ALAT" */
+#define ATLAS_CACHE_VERSION 1u
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t font_hash; /**< FNV-1a of the font file. */
+  uint64_t key_hash;  /**< FNV-1a of the metrics and kRanges. */
+  uint32_t n_glyphs;
+  uint32_t n_cp;
+  uint32_t fallback_idx;
+  uint32_t pixels_size;
+} atlas_cache_hdr_t;
 
 /** Edge flags for the procedurally-drawn box-drawing glyphs below. */
 enum
@@ -159,6 +186,113 @@ static int load_font_file(const char *path, uint8_t **out, size_t *osz)
   return 0;
 }
 
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME  0x100000001b3ull
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  for(size_t i = 0; i < len; i++)
+    h = (h ^ p[i]) * FNV_PRIME;
+  return h;
+}
+
+/** Hash of everything besides the font that shapes the atlas. */
+static uint64_t atlas_key_hash(void)
+{
+  const uint32_t metrics[] = {CELL_W, CELL_H, FIRA_PX, CP_MAP_SIZE};
+  uint64_t       h         = fnv1a(FNV_OFFSET, metrics, sizeof metrics);
+  return fnv1a(h, kRanges, sizeof kRanges);
+}
+
+static int submit(
+    const uint8_t *pixels, uint32_t pixels_size, const uint32_t *cp_map,
+    uint32_t n_glyphs, uint32_t fallback_idx
+)
+{
+  fb_console_atlas_t meta = {
+      .pixels_user  = (uint64_t)(uintptr_t)pixels,
+      .pixels_size  = pixels_size,
+      .cell_w       = CELL_W,
+      .cell_h       = CELL_H,
+      .stride_bytes = CELL_W, /* 1 byte alpha per pixel */
+      .bpp          = 8,
+      .n_glyphs     = n_glyphs,
+      .cp_map_user  = (uint64_t)(uintptr_t)cp_map,
+      .n_cp         = CP_MAP_SIZE,
+      .fallback_idx = fallback_idx,
+  };
+  /* The kernel copies pixels + cp_map into its own buffers. */
+  return ioctl(STDOUT_FILENO, FB_CONSOLE_SET_ATLAS, &meta) == 0 ? 0 : -1;
+}
+
+/** Submit the cached atlas if it was built from this font and key.
+ *  @return 0 on success, -1 if the cache is missing, stale or rejected. */
+static int cache_submit(uint64_t font_hash)
+{
+  int fd = open(ATLAS_CACHE_PATH, O_RDONLY);
+  if(fd < 0)
+    return -1;
+  struct stat st;
+  if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(atlas_cache_hdr_t)) {
+    close(fd);
+    return -1;
+  }
+  size_t size = (size_t)st.st_size;
+  void  *map  = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+    return -1;
+
+  const atlas_cache_hdr_t *h  = (const atlas_cache_hdr_t *)map;
+  int                      rc = -1;
+  if(h->magic == ATLAS_CACHE_MAGIC && h->version == ATLAS_CACHE_VERSION &&
+     h->font_hash == font_hash && h->key_hash == atlas_key_hash() &&
+     h->n_cp == CP_MAP_SIZE &&
+     size == sizeof *h + (size_t)h->n_cp * sizeof(uint32_t) + h->pixels_size) {
+    const uint32_t *cp_map = (const uint32_t *)(h + 1);
+    rc = submit(
+        (const uint8_t *)(cp_map + h->n_cp), h->pixels_size, cp_map,
+        h->n_glyphs, h->fallback_idx
+    );
+  }
+  munmap(map, size);
+  return rc;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)buf;
+  while(len > 0) {
+    ssize_t n = write(fd, p, len);
+    if(n <= 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/** Store a freshly rasterised atlas for the next start. Best effort: it is
+ *  written aside and renamed into place, so a reader never sees half. */
+static void cache_store(
+    const atlas_cache_hdr_t *h, const uint32_t *cp_map, const uint8_t *pixels
+)
+{
+  static const char tmp[] = ATLAS_CACHE_PATH ".new";
+  int               fd    = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0)
+    return;
+  int rc = write_all(fd, h, sizeof *h);
+  if(rc == 0)
+    rc = write_all(fd, cp_map, (size_t)h->n_cp * sizeof(uint32_t));
+  if(rc == 0)
+    rc = write_all(fd, pixels, h->pixels_size);
+  close(fd);
+  if(rc < 0 || rename(tmp, ATLAS_CACHE_PATH) < 0)
+    unlink(tmp);
+}
+
 int atlas_submit(const char *font_path)
 {
   /* Load TTF into memory. */
@@ -167,6 +301,12 @@ int atlas_submit(const char *font_path)
   if(load_font_file(font_path, &font_data, &font_size) < 0)
     return -1;
 
+  uint64_t font_hash = fnv1a(FNV_OFFSET, font_data, font_size);
+  if(cache_submit(font_hash) == 0) {
+    free(font_data);
+    return 0;
+  }
+
   FT_Library lib;
   if(FT_Init_FreeType(&lib) != 0) {
     free(font_data);
@@ -221,8 +361,9 @@ int atlas_submit(const char *font_path)
   if(FT_Load_Char(face, (uint32_t)'?', FT_LOAD_RENDER) == 0)
     rasterise_into_slot(face->glyph, fallback_idx, baseline, pixels);
 
-  /* All requested ranges. Codepoints FreeType can't load are skipped: their
-   * cp_map entries stay 0xFFFFFFFF and the kernel falls back to CP437.
+  /* All requested ranges. Codepoints the font lacks or FreeType can't load
+   * are skipped: their cp_map entries stay 0xFFFFFFFF and the kernel falls
+   * back to CP437.
    *
    * Light box-drawing chars (U+2500..U+253F subset) are drawn procedurally:
    * Fira's box glyphs don't span the full cell width, so adjacent cells
@@ -236,7 +377,8 @@ int atlas_submit(const char *font_path)
         idx = next_idx++;
         rasterise_box(idx, edges, pixels);
       } else {
-        if(FT_Load_Char(face, cpi, FT_LOAD_RENDER) != 0)
+        if(FT_Get_Char_Index(face, cpi) == 0 ||
+           FT_Load_Char(face, cpi, FT_LOAD_RENDER) != 0)
           continue;
         idx = next_idx++;
         rasterise_into_slot(face->glyph, idx, baseline, pixels);
@@ -250,23 +392,23 @@ int atlas_submit(const char *font_path)
   FT_Done_FreeType(lib);
   free(font_data);
 
-  fb_console_atlas_t meta = {
-      .pixels_user  = (uint64_t)(uintptr_t)pixels,
-      .pixels_size  = (uint32_t)atlas_size,
-      .cell_w       = CELL_W,
-      .cell_h       = CELL_H,
-      .stride_bytes = CELL_W, /* 1 byte alpha per pixel */
-      .bpp          = 8,
-      .n_glyphs     = n_glyphs,
-      .cp_map_user  = (uint64_t)(uintptr_t)cp_map,
-      .n_cp         = CP_MAP_SIZE,
-      .fallback_idx = fallback_idx,
-  };
-
-  int rc = ioctl(STDOUT_FILENO, FB_CONSOLE_SET_ATLAS, &meta);
-  /* The kernel copies pixels + cp_map into its own buffers; we can free
-   * the userspace originals now. */
+  int rc = submit(
+      pixels, (uint32_t)atlas_size, cp_map, n_glyphs, fallback_idx
+  );
+  if(rc == 0) {
+    atlas_cache_hdr_t h = {
+        .magic        = ATLAS_CACHE_MAGIC,
+        .version      = ATLAS_CACHE_VERSION,
+        .font_hash    = font_hash,
+        .key_hash     = atlas_key_hash(),
+        .n_glyphs     = n_glyphs,
+        .n_cp         = CP_MAP_SIZE,
+        .fallback_idx = fallback_idx,
+        .pixels_size  = (uint32_t)atlas_size,
+    };
+    cache_store(&h, cp_map, pixels);
+  }
   free(pixels);
   free(cp_map);
-  return (rc == 0) ? 0 : -1;
+  return rc;
 }
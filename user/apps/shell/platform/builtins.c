@@ -7,13 +7,22 @@
  */
 
 #include <shell/shell.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <vega/host.h>
 #include <vega/vega.h>
 
 static const char *shell_builtins[] = {
-    "exit", "cd", "pwd", "help", "version", "clear", NULL,
+    "exit", "cd", "pwd", "help", "version", "clear", "hash", "source",
+    "enable", "time", NULL,
+};
+
+/* The ones that only print, which $(...) may run without forking. */
+static const char *pure_builtins[] = {
+    "pwd", "help", "version", "clear", NULL,
 };
 
 static void cmd_help(void)
@@ -26,6 +35,10 @@ static void cmd_help(void)
   sh_puts("    help              this message\n");
   sh_puts("    version           OS + vega version\n");
   sh_puts("    clear             clear the screen\n");
+  sh_puts("    hash [-r] [cmd]   show, forget or add remembered paths\n");
+  sh_puts("    source <file>     run a vega script in this shell\n");
+  sh_puts("    enable [-n] [cmd] list or switch in-shell utilities\n");
+  sh_puts("    time <cmd>        run cmd, then print real/user/sys time\n");
   sh_puts("\n");
 }
 
@@ -61,15 +74,215 @@ static int cmd_pwd(void)
   return 1;
 }
 
-bool sh_is_builtin(const char *name)
+static void print_hash_entry(
+    const char *name, const char *path, unsigned hits, void *ctx
+)
+{
+  (void)name;
+  int *n = ctx;
+  if((*n)++ == 0)
+    sh_puts("hits\tcommand\n");
+  char buf[12];
+  int  len = 0;
+  do {
+    buf[len++] = (char)('0' + hits % 10);
+    hits /= 10;
+  } while(hits);
+  while(len > 0)
+    sh_putchar(buf[--len]);
+  sh_putchar('\t');
+  sh_puts(path);
+  sh_putchar('\n');
+}
+
+/* bash's `hash`: no arguments lists the remembered command paths, -r
+ * forgets them all, names are looked up and remembered. */
+static int cmd_hash(int argc, char *const argv[])
+{
+  int i = 1;
+  if(i < argc && strcmp(argv[i], "-r") == 0) {
+    vega_hash_reset();
+    i++;
+  }
+  if(argc == 1) {
+    int n = 0;
+    vega_hash_each(print_hash_entry, &n);
+    if(n == 0)
+      sh_puts("hash: hash table empty\n");
+    return 0;
+  }
+
+  int rc = 0;
+  for(; i < argc; i++) {
+    if(vega_hash_add(argv[i]) < 0) {
+      sh_puts("hash: ");
+      sh_puts(argv[i]);
+      sh_puts(": not found\n");
+      rc = 1;
+    }
+  }
+  return rc;
+}
+
+static void print_util(const char *name, int enabled, void *ctx)
+{
+  (void)ctx;
+  sh_puts(enabled ? "enable " : "enable -n ");
+  sh_puts(name);
+  sh_putchar('\n');
+}
+
+/* bash's `enable`: no names lists the utilities libvega runs in the shell
+ * (echo, test, ...), -n switches the named ones off so their binaries in
+ * PATH run instead, and names alone switch them back on. */
+static int cmd_enable(int argc, char *const argv[])
+{
+  int i  = 1;
+  int on = 1;
+  if(i < argc && strcmp(argv[i], "-n") == 0) {
+    on = 0;
+    i++;
+  }
+  if(i == argc) {
+    vega_util_each(print_util, NULL);
+    return 0;
+  }
+
+  int rc = 0;
+  for(; i < argc; i++) {
+    if(vega_util_enable(argv[i], on) < 0) {
+      sh_puts("enable: ");
+      sh_puts(argv[i]);
+      sh_puts(": not a utility builtin\n");
+      rc = 1;
+    }
+  }
+  return rc;
+}
+
+static int cmd_source(int argc, char *const argv[])
+{
+  if(argc < 2) {
+    sh_puts("source: usage: source <file>\n");
+    return 1;
+  }
+  int rc = vega_source(argv[1]);
+  if(rc < 0) {
+    sh_puts("source: ");
+    sh_puts(argv[1]);
+    sh_puts(": cannot read\n");
+    return 1;
+  }
+  return rc;
+}
+
+/* Append @p arg to @p line as one bareword, every special character
+ * escaped, so vega parses back exactly that argument. */
+static bool append_word(char *line, size_t cap, size_t *len, const char *arg)
 {
-  for(int i = 0; shell_builtins[i]; i++) {
-    if(strcmp(name, shell_builtins[i]) == 0)
+  size_t n = *len;
+  if(n && n < cap)
+    line[n++] = ' ';
+  if(!*arg && n + 2 < cap) {
+    line[n++] = '\'';
+    line[n++] = '\'';
+  }
+  for(; *arg; arg++) {
+    char c     = *arg;
+    bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                 (c >= '0' && c <= '9') || strchr("_-./=,:+%@", c);
+    if(!plain && n < cap)
+      line[n++] = '\\';
+    if(n < cap)
+      line[n++] = c;
+  }
+  if(n >= cap)
+    return false;
+  line[n] = '\0';
+  *len    = n;
+  return true;
+}
+
+static long tv_us(struct timeval tv)
+{
+  return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+/* CPU microseconds of this shell and its reaped children so far. */
+static void cpu_us(long *user, long *sys)
+{
+  struct rusage self, kids;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &kids);
+  *user = tv_us(self.ru_utime) + tv_us(kids.ru_utime);
+  *sys  = tv_us(self.ru_stime) + tv_us(kids.ru_stime);
+}
+
+static void print_time(const char *label, long us)
+{
+  char buf[48];
+  snprintf(
+      buf, sizeof(buf), "%s\t%ldm%ld.%03lds\n", label, us / 60000000L,
+      us / 1000000L % 60, us / 1000L % 1000
+  );
+  sh_puts(buf);
+}
+
+/* bash's `time`: run the rest of the line as a command, then report the
+ * wall-clock time and the CPU time it and its children used. */
+static int cmd_time(int argc, char *const argv[])
+{
+  char   line[4 * MAX_CMD_LEN];
+  size_t len = 0;
+  line[0]    = '\0';
+  for(int i = 1; i < argc; i++) {
+    if(!append_word(line, sizeof(line), &len, argv[i])) {
+      sh_puts("time: command too long\n");
+      return 1;
+    }
+  }
+
+  struct timespec t0, t1;
+  long            user0, sys0, user1, sys1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  cpu_us(&user0, &sys0);
+  int rc = len ? vega_run(line) : 0;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  cpu_us(&user1, &sys1);
+
+  long real = (t1.tv_sec - t0.tv_sec) * 1000000L +
+              (t1.tv_nsec - t0.tv_nsec) / 1000L;
+  sh_puts("\n");
+  print_time("real", real);
+  print_time("user", user1 - user0);
+  print_time("sys", sys1 - sys0);
+  return rc;
+}
+
+static bool listed(const char *const *list, const char *name)
+{
+  for(int i = 0; list[i]; i++) {
+    if(strcmp(name, list[i]) == 0)
       return true;
   }
   return false;
 }
 
+bool sh_is_builtin(const char *name)
+{
+  return listed(shell_builtins, name);
+}
+
+bool sh_is_pure_builtin(const char *name)
+{
+  return listed(pure_builtins, name);
+}
+
+const char *const *sh_builtin_names(void)
+{
+  return shell_builtins;
+}
+
 int sh_run_builtin(int argc, char *const argv[])
 {
   const char *name = argv[0];
@@ -92,5 +305,13 @@ int sh_run_builtin(int argc, char *const argv[])
     sh_clear();
     return 0;
   }
+  if(strcmp(name, "hash") == 0)
+    return cmd_hash(argc, argv);
+  if(strcmp(name, "source") == 0)
+    return cmd_source(argc, argv);
+  if(strcmp(name, "enable") == 0)
+    return cmd_enable(argc, argv);
+  if(strcmp(name, "time") == 0)
+    return cmd_time(argc, argv);
   return -1;
 }
@@ -0,0 +1,318 @@
+/**
+ * @file apps/shell/platform/complete.c
+ * @brief Tab completion and the directory listing cache behind it.
+ *
+ * A listing is kept sorted, so the names starting with the typed prefix
+ * are one binary search away. It stays valid while stat() of its
+ * directory reports the same inode, size and modification time; since a
+ * zero time means the filesystem does not track it, such listings are
+ * also dropped after every command the shell runs (complete_invalidate).
+ */
+
+#include <dirent.h>
+#include <shell/complete.h>
+#include <shell/shell.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vega/vega.h>
+
+#define DIR_CACHE_SLOTS 8
+
+typedef struct
+{
+  char     path[MAX_PATH]; /* "" marks a free slot */
+  dev_t    dev;
+  ino_t    ino;
+  off_t    size;
+  time_t   mtime;
+  unsigned gen;  /* g_gen when read */
+  unsigned used; /* g_clock when last looked up */
+  char   **names;
+  int      n;
+} dir_cache_t;
+
+static dir_cache_t g_dirs[DIR_CACHE_SLOTS];
+static unsigned    g_gen;
+static unsigned    g_clock;
+
+void complete_invalidate(void)
+{
+  g_gen++;
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void drop(dir_cache_t *d)
+{
+  for(int i = 0; i < d->n; i++)
+    free(d->names[i]);
+  free(d->names);
+  d->names   = NULL;
+  d->n       = 0;
+  d->path[0] = '\0';
+}
+
+/* Read directory @p path into @p d; returns -1 if that fails. */
+static int fill(dir_cache_t *d, const char *path, const struct stat *st)
+{
+  DIR *dir = sh_opendir(path);
+  if(!dir)
+    return -1;
+  int            cap = 0;
+  struct dirent *e;
+  while((e = sh_readdir(dir)) != NULL) {
+    if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+      continue;
+    if(d->n == cap) {
+      cap          = cap ? cap * 2 : 32;
+      char **names = (char **)realloc(d->names, cap * sizeof(*names));
+      if(!names)
+        break;
+      d->names = names;
+    }
+    size_t len  = strlen(e->d_name);
+    int    isd  = e->d_type == DT_DIR;
+    char  *name = (char *)malloc(len + 2);
+    if(!name)
+      break;
+    memcpy(name, e->d_name, len);
+    name[len]       = '/';
+    name[len + isd] = '\0';
+    d->names[d->n++] = name;
+  }
+  sh_closedir(dir);
+
+  qsort(d->names, (size_t)d->n, sizeof(*d->names), cmp_name);
+  strncpy(d->path, path, MAX_PATH - 1);
+  d->path[MAX_PATH - 1] = '\0';
+  d->dev                = st->st_dev;
+  d->ino                = st->st_ino;
+  d->size               = st->st_size;
+  d->mtime              = st->st_mtime;
+  d->gen                = g_gen;
+  return 0;
+}
+
+/* The listing of directory @p path, read only if the cached one is stale;
+ * NULL if it cannot be read. */
+static dir_cache_t *listing(const char *path)
+{
+  struct stat st;
+  if(sh_stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+    return NULL;
+
+  dir_cache_t *d = NULL;
+  for(int i = 0; i < DIR_CACHE_SLOTS && !d; i++) {
+    if(strcmp(g_dirs[i].path, path) == 0)
+      d = &g_dirs[i];
+  }
+  if(d && d->dev == st.st_dev && d->ino == st.st_ino &&
+     d->size == st.st_size && d->mtime == st.st_mtime &&
+     (d->mtime != 0 || d->gen == g_gen)) {
+    d->used = ++g_clock;
+    return d;
+  }
+
+  if(!d) {
+    d = &g_dirs[0];
+    for(int i = 1; i < DIR_CACHE_SLOTS; i++) {
+      if(g_dirs[i].used < d->used)
+        d = &g_dirs[i];
+    }
+  }
+  drop(d);
+  if(fill(d, path, &st) < 0) {
+    drop(d);
+    return NULL;
+  }
+  d->used = ++g_clock;
+  return d;
+}
+
+static int add(completion_t *c, int *cap, const char *name)
+{
+  if(c->n == *cap) {
+    int    n     = *cap ? *cap * 2 : 16;
+    char **names = (char **)realloc(c->names, n * sizeof(*names));
+    if(!names)
+      return -1;
+    c->names = names;
+    *cap     = n;
+  }
+  char *copy = strdup(name);
+  if(!copy)
+    return -1;
+  c->names[c->n++] = copy;
+  return 0;
+}
+
+/* Add the names in @p d that start with @p prefix (@p plen bytes). Hidden
+ * ones only match a prefix starting with '.'; directories are skipped when
+ * @p files_only. */
+static int add_listed(
+    completion_t *c, int *cap, const dir_cache_t *d, const char *prefix,
+    size_t plen, int files_only
+)
+{
+  int lo = 0, hi = d->n;
+  while(lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if(strncmp(d->names[mid], prefix, plen) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for(int i = lo; i < d->n && strncmp(d->names[i], prefix, plen) == 0; i++) {
+    const char *name = d->names[i];
+    if(name[0] == '.' && prefix[0] != '.')
+      continue;
+    if(files_only && name[strlen(name) - 1] == '/')
+      continue;
+    if(add(c, cap, name) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+typedef struct
+{
+  completion_t *c;
+  int          *cap;
+  const char   *prefix;
+  size_t        plen;
+  int           failed;
+} util_ctx_t;
+
+static void add_util(const char *name, int enabled, void *ctx)
+{
+  util_ctx_t *u = (util_ctx_t *)ctx;
+  if(enabled && strncmp(name, u->prefix, u->plen) == 0 &&
+     add(u->c, u->cap, name) < 0)
+    u->failed = 1;
+}
+
+/* Commands named @p prefix...: builtins, utilities, programs in PATH. */
+static int add_commands(
+    completion_t *c, int *cap, const char *prefix, size_t plen
+)
+{
+  for(const char *const *b = sh_builtin_names(); *b; b++) {
+    if(strncmp(*b, prefix, plen) == 0 && add(c, cap, *b) < 0)
+      return -1;
+  }
+  util_ctx_t u = {c, cap, prefix, plen, 0};
+  vega_util_each(add_util, &u);
+  if(u.failed)
+    return -1;
+
+  const char *path = getenv("PATH");
+  if(!path || !*path)
+    path = "/bin:/usr/bin";
+  while(*path) {
+    const char *colon = strchr(path, ':');
+    size_t      n     = colon ? (size_t)(colon - path) : strlen(path);
+    if(n > 0 && n < MAX_PATH) {
+      char dir[MAX_PATH];
+      memcpy(dir, path, n);
+      dir[n]               = '\0';
+      const dir_cache_t *d = listing(dir);
+      if(d && add_listed(c, cap, d, prefix, plen, 1) < 0)
+        return -1;
+    }
+    path += n + (colon ? 1 : 0);
+  }
+  return 0;
+}
+
+static int is_delim(char ch)
+{
+  return strchr(" \t|;&<>(){}", ch) != NULL;
+}
+
+/* True if the word starting at @p start of @p line is a command name: it
+ * opens the line or follows an operator, a brace or a keyword that takes
+ * a command. */
+static int in_command_position(const char *line, size_t start)
+{
+  size_t i = start;
+  while(i > 0 && (line[i - 1] == ' ' || line[i - 1] == '\t'))
+    i--;
+  if(i == 0 || strchr("|;&({}", line[i - 1]))
+    return 1;
+  size_t end = i;
+  while(i > 0 && !is_delim(line[i - 1]))
+    i--;
+  size_t n = end - i;
+  return (n == 2 && strncmp(line + i, "if", 2) == 0) ||
+         (n == 4 && strncmp(line + i, "else", 4) == 0) ||
+         (n == 5 && strncmp(line + i, "while", 5) == 0);
+}
+
+int complete(const char *line, size_t len, completion_t *out)
+{
+  out->names = NULL;
+  out->n     = 0;
+
+  size_t start = len;
+  while(start > 0 && !is_delim(line[start - 1]) && line[start - 1] != '"' &&
+        line[start - 1] != '\'')
+    start--;
+  const char *word  = line + start;
+  size_t      wlen  = len - start;
+  const char *slash = NULL;
+  for(const char *p = word; p < word + wlen; p++) {
+    if(*p == '/')
+      slash = p;
+  }
+
+  int cap = 0, rc = 0;
+  if(!slash && in_command_position(line, start)) {
+    out->start = start;
+    rc         = add_commands(out, &cap, word, wlen);
+  } else {
+    char dir[MAX_PATH];
+    if(!slash) {
+      strcpy(dir, ".");
+    } else {
+      size_t n = (size_t)(slash - word);
+      if(n + 2 > MAX_PATH)
+        return 0;
+      memcpy(dir, word, n ? n : 1); /* "/x" lists "/" */
+      dir[n ? n : 1] = '\0';
+    }
+    const char *prefix = slash ? slash + 1 : word;
+    out->start         = (size_t)(prefix - line);
+    const dir_cache_t *d = listing(dir);
+    if(d)
+      rc = add_listed(out, &cap, d, prefix, len - out->start, 0);
+  }
+  if(rc < 0) {
+    completion_free(out);
+    return -1;
+  }
+
+  /* A builtin can also be a utility or a program: list each name once. */
+  qsort(out->names, (size_t)out->n, sizeof(*out->names), cmp_name);
+  int k = 0;
+  for(int i = 0; i < out->n; i++) {
+    if(k > 0 && strcmp(out->names[k - 1], out->names[i]) == 0)
+      free(out->names[i]);
+    else
+      out->names[k++] = out->names[i];
+  }
+  out->n = k;
+  return 0;
+}
+
+void completion_free(completion_t *c)
+{
+  for(int i = 0; i < c->n; i++)
+    free(c->names[i]);
+  free(c->names);
+  c->names = NULL;
+  c->n     = 0;
+}
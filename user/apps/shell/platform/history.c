@@ -0,0 +1,266 @@
+/**
+ * @file apps/shell/platform/history.c
+ * @brief Command history and its suffix index.
+ *
+ * Kept entries live in a ring. Every suffix of every entry is listed in one
+ * array sorted by its text (a suffix array), so the entries containing a
+ * query are exactly those with a suffix starting with it: they sit next to
+ * each other and one binary search finds them, which keeps Ctrl-R instant
+ * while the user types however full the history is. history_add merges
+ * the new line's sorted suffixes in and drops the evicted entry's in the
+ * same pass.
+ *
+ * The file has one entry per line. It is only appended to, except that
+ * loading rewrites it once it holds more than HISTORY_MAX lines.
+ */
+
+#include <fcntl.h>
+#include <shell/history.h>
+#include <shell/shell.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** @brief Longer history files are not read (500 full lines is 128 KiB). */
+#define HISTORY_FILE_MAX (1024 * 1024)
+
+typedef struct
+{
+  uint32_t seq; /* entry */
+  uint16_t off; /* where in its text the suffix starts */
+} suffix_t;
+
+static char     *ring[HISTORY_MAX]; /* entry seq at seq % HISTORY_MAX */
+static int       next_seq;
+static suffix_t *sufs; /* every suffix of every kept entry, sorted */
+static int       n_sufs;
+
+static const char *file_path(void)
+{
+  const char *p = getenv("VEGA_HISTFILE");
+  return (p && *p) ? p : HISTORY_FILE;
+}
+
+static const char *suffix_text(const suffix_t *s)
+{
+  return ring[s->seq % HISTORY_MAX] + s->off;
+}
+
+static int cmp_suffix(const void *a, const void *b)
+{
+  return strcmp(suffix_text(a), suffix_text(b));
+}
+
+int history_end(void)
+{
+  return next_seq;
+}
+
+int history_begin(void)
+{
+  return next_seq > HISTORY_MAX ? next_seq - HISTORY_MAX : 0;
+}
+
+const char *history_get(int seq)
+{
+  if(seq < history_begin() || seq >= next_seq)
+    return NULL;
+  return ring[seq % HISTORY_MAX];
+}
+
+/* Entry @p seq's suffixes into @p out; returns how many. */
+static int entry_suffixes(int seq, suffix_t *out)
+{
+  size_t len = strlen(ring[seq % HISTORY_MAX]);
+  for(size_t i = 0; i < len; i++) {
+    out[i].seq = (uint32_t)seq;
+    out[i].off = (uint16_t)i;
+  }
+  return (int)len;
+}
+
+static int worth_keeping(const char *line)
+{
+  size_t len = strlen(line);
+  if(len == 0 || len >= MAX_CMD_LEN)
+    return 0;
+  const char *newest = history_get(next_seq - 1);
+  return !newest || strcmp(newest, line) != 0;
+}
+
+/* Make @p line the newest entry, indexing it. Returns -1 (and changes
+ * nothing) if it is not worth keeping or memory runs out. */
+static int remember(const char *line)
+{
+  if(!worth_keeping(line))
+    return -1;
+
+  size_t    len    = strlen(line);
+  char     *copy   = strdup(line);
+  suffix_t *add    = (suffix_t *)malloc(len * sizeof(*add));
+  suffix_t *merged = (suffix_t *)malloc((n_sufs + len) * sizeof(*merged));
+  if(!copy || !add || !merged) {
+    free(copy);
+    free(add);
+    free(merged);
+    return -1;
+  }
+
+  /* The evicted entry and the new one share a ring slot: the evicted
+   * suffixes are recognised by number and never looked at. */
+  int    evict = next_seq - HISTORY_MAX;
+  char **slot  = &ring[next_seq % HISTORY_MAX];
+  free(*slot);
+  *slot = copy;
+
+  int n = entry_suffixes(next_seq, add);
+  qsort(add, (size_t)n, sizeof(*add), cmp_suffix);
+  int i = 0, j = 0, k = 0;
+  while(i < n_sufs || j < n) {
+    if(i < n_sufs && (int)sufs[i].seq == evict)
+      i++;
+    else if(j == n || (i < n_sufs && cmp_suffix(&sufs[i], &add[j]) <= 0))
+      merged[k++] = sufs[i++];
+    else
+      merged[k++] = add[j++];
+  }
+  free(add);
+  free(sufs);
+  sufs   = merged;
+  n_sufs = k;
+  next_seq++;
+  return 0;
+}
+
+int history_search(const char *query, int before)
+{
+  size_t qlen = strlen(query);
+  if(qlen == 0)
+    return -1;
+
+  /* First suffix not below the query; its matches follow. */
+  int lo = 0, hi = n_sufs;
+  while(lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if(strncmp(suffix_text(&sufs[mid]), query, qlen) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  int best = -1;
+  for(int i = lo; i < n_sufs; i++) {
+    if(strncmp(suffix_text(&sufs[i]), query, qlen) != 0)
+      break;
+    int seq = (int)sufs[i].seq;
+    if(seq < before && seq > best)
+      best = seq;
+  }
+  return best;
+}
+
+/* Build the index over every kept entry from scratch. */
+static void index_all(void)
+{
+  size_t total = 0;
+  for(int seq = history_begin(); seq < next_seq; seq++)
+    total += strlen(history_get(seq));
+  free(sufs);
+  n_sufs = 0;
+  sufs   = (suffix_t *)malloc((total ? total : 1) * sizeof(*sufs));
+  if(!sufs)
+    return;
+  for(int seq = history_begin(); seq < next_seq; seq++)
+    n_sufs += entry_suffixes(seq, sufs + n_sufs);
+  qsort(sufs, (size_t)n_sufs, sizeof(*sufs), cmp_suffix);
+}
+
+static void write_all(int fd, const char *s, size_t len)
+{
+  while(len > 0) {
+    ssize_t n = write(fd, s, len);
+    if(n <= 0)
+      return;
+    s += n;
+    len -= (size_t)n;
+  }
+}
+
+/* Replace the file with the kept entries, oldest first. */
+static void rewrite_file(void)
+{
+  int fd = open(file_path(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if(fd < 0)
+    return;
+  for(int seq = history_begin(); seq < next_seq; seq++) {
+    const char *e = history_get(seq);
+    write_all(fd, e, strlen(e));
+    write_all(fd, "\n", 1);
+  }
+  close(fd);
+}
+
+void history_add(const char *line)
+{
+  if(remember(line) < 0)
+    return;
+  int fd = open(file_path(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+  if(fd < 0)
+    return;
+  write_all(fd, line, strlen(line));
+  write_all(fd, "\n", 1);
+  close(fd);
+}
+
+void history_load(void)
+{
+  int fd = open(file_path(), O_RDONLY);
+  if(fd < 0)
+    return;
+  struct stat st;
+  char       *text = NULL;
+  size_t      len  = 0;
+  if(fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size <= HISTORY_FILE_MAX)
+    text = (char *)malloc((size_t)st.st_size + 1);
+  while(text && len < (size_t)st.st_size) {
+    ssize_t n = read(fd, text + len, (size_t)st.st_size - len);
+    if(n <= 0)
+      break;
+    len += (size_t)n;
+  }
+  close(fd);
+  if(!text)
+    return;
+  text[len] = '\0';
+
+  /* Only the last HISTORY_MAX lines are kept, and indexed at the end with
+   * one sort rather than a merge per line. */
+  int lines = 0;
+  for(size_t i = 0; i < len; i++)
+    lines += text[i] == '\n';
+  int   skip = lines > HISTORY_MAX ? lines - HISTORY_MAX : 0;
+  char *p    = text;
+  while(*p) {
+    char *nl = strchr(p, '\n');
+    if(nl)
+      *nl = '\0';
+    if(skip > 0) {
+      skip--;
+    } else if(worth_keeping(p)) {
+      char **slot = &ring[next_seq % HISTORY_MAX];
+      free(*slot);
+      *slot = strdup(p);
+      if(!*slot)
+        break;
+      next_seq++;
+    }
+    p = nl ? nl + 1 : p + strlen(p);
+  }
+  free(text);
+  index_all();
+
+  if(lines > HISTORY_MAX)
+    rewrite_file();
+}
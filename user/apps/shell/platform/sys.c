@@ -14,6 +14,7 @@
 #include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
+#include <vega/host.h>
 
 /** Process Control */
 
@@ -57,6 +58,9 @@ long sh_read(int fd, void *buf, size_t len)
  */
 long sh_write(int fd, const void *buf, size_t len)
 {
+  /* Through libvega, so an in-process $(...) captures builtin output. */
+  if(fd == STDOUT_FILENO)
+    return vega_stdout_write(buf, len);
   return write(fd, buf, len);
 }
 
@@ -79,7 +83,7 @@ int sh_ioctl(int fd, unsigned long request, void *arg)
 void sh_clear(void)
 {
   const char *clear = "\033[2J\033[H";
-  write(STDOUT_FILENO, clear, strlen(clear));
+  sh_write(STDOUT_FILENO, clear, strlen(clear));
 }
 
 /** Filesystem Functions */
@@ -0,0 +1,80 @@
+/**
+ * @file user/bench/bench.c
+ * @brief Option parsing, timing and JSON output for the benchmarks.
+ */
+
+#include "bench.h"
+
+#include <grendizer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+uint64_t bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int bench_parse(
+    int argc, char **argv, const char *program, const char *about,
+    unsigned long *iters, unsigned long *size, const char *size_hint
+)
+{
+  gr_opt opts[] = {
+      GR_UINT('n', "iters", iters, "N", "Repetitions"),
+      GR_UINT('s', "size", size, "SIZE", size_hint),
+      GR_END
+  };
+  if(!size)
+    opts[1] = (gr_opt)GR_END;
+
+  gr_spec spec = {
+      .program = program,
+      .usage   = "[options]",
+      .options = opts,
+      .epilog  = about,
+  };
+  gr_rest rest;
+  int     rc = gr_parse(&spec, argc, argv, &rest, NULL, 0);
+  if(rc != GR_OK)
+    return rc == GR_HELP ? 0 : 1;
+  if(rest.argc || !*iters || (size && !*size)) {
+    gr_usage(&spec, stderr);
+    return 1;
+  }
+  return -1;
+}
+
+static void result(
+    const char *name, uint64_t value, const char *unit, uint64_t iters
+)
+{
+  printf(
+      "{\"name\":\"%s\",\"value\":%llu,\"unit\":\"%s\",\"count\":%llu}\n",
+      name, (unsigned long long)value, unit, (unsigned long long)iters
+  );
+  fflush(stdout);
+}
+
+void bench_latency(const char *name, uint64_t ns, uint64_t ops)
+{
+  result(name, ops ? ns / ops : 0, "ns", ops);
+}
+
+void bench_rate(const char *name, uint64_t ns, uint64_t ops)
+{
+  result(name, ns ? ops * 1000000000ULL / ns : 0, "ops/s", ops);
+}
+
+void bench_bandwidth(const char *name, uint64_t ns, uint64_t bytes)
+{
+  result(name, ns ? bytes / 1024 * 1000000000ULL / ns : 0, "KiB/s", bytes);
+}
+
+void bench_die(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
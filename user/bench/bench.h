@@ -0,0 +1,52 @@
+/**
+ * @file user/bench/bench.h
+ * @brief Shared helpers of the user/bench micro-benchmarks.
+ *
+ * Every benchmark prints its results on standard output, one JSON object
+ * per line:
+ *
+ *   {"name":"pipe_latency","value":18342,"unit":"ns","count":10000}
+ *
+ * where count is the operations timed, or the bytes for a bandwidth, so
+ * a run can be collected with benchall, or with grep, and compared
+ * between kernel revisions. Values are integers: the userland is built
+ * without floating point.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+/** @brief Where the disk image installs the benchmarks. */
+#define BENCH_DIR "/bench"
+
+/** @brief CLOCK_MONOTONIC in nanoseconds. */
+uint64_t bench_now_ns(void);
+
+/**
+ * @brief Parse the options every benchmark takes.
+ *
+ * -n ITERS sets @p *iters (left alone when not given), -s SIZE
+ * @p *size when @p size is not NULL.
+ *
+ * @return -1 to run, otherwise the exit status for main to return.
+ */
+int bench_parse(
+    int argc, char **argv, const char *program, const char *about,
+    unsigned long *iters, unsigned long *size, const char *size_hint
+);
+
+/** @brief Report @p ns spent on @p ops operations as ns per operation. */
+void bench_latency(const char *name, uint64_t ns, uint64_t ops);
+
+/** @brief Report @p ops operations in @p ns as operations per second. */
+void bench_rate(const char *name, uint64_t ns, uint64_t ops);
+
+/** @brief Report @p bytes moved in @p ns as KiB per second. */
+void bench_bandwidth(const char *name, uint64_t ns, uint64_t bytes);
+
+/** @brief Print @p msg with errno's text and exit with status 1. */
+void bench_die(const char *msg) __attribute__((noreturn));
+
+#endif
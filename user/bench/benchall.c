@@ -0,0 +1,140 @@
+/**
+ * @file user/bench/benchall.c
+ * @brief Run the benchmarks and gather their results into one JSON file.
+ *
+ * Usage: benchall [-o FILE] [NAME...]
+ *
+ * Runs each benchmark (all of them when no NAME is given) from the
+ * directory benchall itself was started from, or BENCH_DIR, reads the
+ * result lines off its standard output and writes
+ *
+ *   {"system":{...uname...},"results":[...],"failed":[...]}
+ *
+ * to FILE or standard output. The benchmarks' standard error, and the
+ * console benchmark's output, still go to the console.
+ */
+
+#include "bench.h"
+
+#include <grendizer.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char *const g_all[] = {
+    "proc", "pipe", "file", "fault", "futex", "console",
+};
+
+#define NALL (sizeof(g_all) / sizeof(g_all[0]))
+
+static char g_dir[256];
+static int  g_nresults;
+static int  g_nfailed;
+static char g_failed[NALL * 2][32];
+
+/* Run @p name, copying its result lines to @p out; false if it failed. */
+static int run_one(const char *name, FILE *out)
+{
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s", g_dir, name);
+
+  int fd[2];
+  if(pipe(fd) < 0)
+    return 0;
+  pid_t pid = fork();
+  if(pid < 0)
+    return 0;
+  if(pid == 0) {
+    close(fd[0]);
+    dup2(fd[1], STDOUT_FILENO);
+    close(fd[1]);
+    char *argv[] = {path, NULL};
+    execv(path, argv);
+    perror(path);
+    _exit(127);
+  }
+  close(fd[1]);
+
+  FILE *in = fdopen(fd[0], "r");
+  char  line[512];
+  while(in && fgets(line, sizeof(line), in)) {
+    if(line[0] != '{')
+      continue;
+    line[strcspn(line, "\n")] = '\0';
+    fprintf(out, "%s\n    %s", g_nresults++ ? "," : "", line);
+  }
+  if(in)
+    fclose(in);
+  else
+    close(fd[0]);
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void set_dir(const char *argv0)
+{
+  const char *slash = strrchr(argv0, '/');
+  if(slash && (size_t)(slash - argv0) < sizeof(g_dir))
+    snprintf(g_dir, sizeof(g_dir), "%.*s", (int)(slash - argv0), argv0);
+  else
+    snprintf(g_dir, sizeof(g_dir), "%s", BENCH_DIR);
+}
+
+/**
+ * @brief benchall main entry point.
+ */
+int main(int argc, char *argv[])
+{
+  const char *output = NULL;
+  gr_opt      opts[] = {
+      GR_STR('o', "output", &output, "FILE", "Write the JSON to FILE"),
+      GR_END
+  };
+  gr_spec spec = {
+      .program = "benchall",
+      .usage   = "[-o FILE] [NAME...]",
+      .options = opts,
+      .epilog  = "Benchmarks: proc pipe file fault futex console.",
+  };
+  gr_rest rest;
+  int     rc = gr_parse(&spec, argc, argv, &rest, NULL, 0);
+  if(rc != GR_OK)
+    return rc == GR_HELP ? 0 : 1;
+
+  FILE *out = output ? fopen(output, "w") : stdout;
+  if(!out) {
+    perror(output);
+    return 1;
+  }
+  set_dir(argv[0]);
+
+  struct utsname u;
+  if(uname(&u) < 0)
+    memset(&u, 0, sizeof(u));
+  fprintf(
+      out,
+      "{\n  \"system\": {\"sysname\": \"%s\", \"release\": \"%s\", "
+      "\"version\": \"%s\", \"machine\": \"%s\"},\n  \"results\": [",
+      u.sysname, u.release, u.version, u.machine
+  );
+
+  int          n     = rest.argc ? rest.argc : (int)NALL;
+  const char **names = rest.argc ? (const char **)rest.argv : NULL;
+  for(int i = 0; i < n; i++) {
+    const char *name = names ? names[i] : g_all[i];
+    if(!run_one(name, out) && g_nfailed < (int)(NALL * 2))
+      snprintf(g_failed[g_nfailed++], sizeof(g_failed[0]), "%s", name);
+  }
+
+  fprintf(out, "\n  ],\n  \"failed\": [");
+  for(int i = 0; i < g_nfailed; i++)
+    fprintf(out, "%s\"%s\"", i ? ", " : "", g_failed[i]);
+  fprintf(out, "]\n}\n");
+  if(out != stdout)
+    fclose(out);
+  return g_nfailed ? 1 : 0;
+}
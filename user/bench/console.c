@@ -0,0 +1,37 @@
+/**
+ * @file user/bench/console.c
+ * @brief Console write throughput.
+ *
+ * Writes full 80-column lines to standard error, which is the console
+ * under benchall (standard output carries the results).
+ */
+
+#include "bench.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define LINE 80
+
+int main(int argc, char *argv[])
+{
+  unsigned long lines = 2000;
+  int           rc    = bench_parse(
+      argc, argv, "console", "Time lines written to the console (stderr).",
+      &lines, NULL, NULL
+  );
+  if(rc >= 0)
+    return rc;
+
+  char line[LINE];
+  memset(line, '#', sizeof(line) - 1);
+  line[LINE - 1] = '\n';
+
+  uint64_t t0 = bench_now_ns();
+  for(unsigned long i = 0; i < lines; i++) {
+    if(write(STDERR_FILENO, line, LINE) != LINE)
+      bench_die("console: write");
+  }
+  bench_bandwidth("console_write", bench_now_ns() - t0, lines * LINE);
+  return 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file user/bench/fault.c
+ * @brief Anonymous mmap page faults.
+ *
+ * Each round maps 1 MiB, touches every page once and unmaps it. The
+ * mapping stays under 2 MiB so every touch is a 4 KiB fault, not a share
+ * of a huge page.
+ */
+
+#include "bench.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MAP_BYTES  (1024 * 1024)
+#define PAGE_BYTES 4096
+
+int main(int argc, char *argv[])
+{
+  unsigned long rounds = 64;
+  int           rc     = bench_parse(
+      argc, argv, "fault", "Time first-touch faults on anonymous memory.",
+      &rounds, NULL, NULL
+  );
+  if(rc >= 0)
+    return rc;
+
+  uint64_t ns = 0;
+  for(unsigned long r = 0; r < rounds; r++) {
+    volatile char *p = mmap(
+        NULL, MAP_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0
+    );
+    if(p == MAP_FAILED)
+      bench_die("fault: mmap");
+    uint64_t t0 = bench_now_ns();
+    for(unsigned long off = 0; off < MAP_BYTES; off += PAGE_BYTES)
+      p[off] = 1;
+    ns += bench_now_ns() - t0;
+    munmap((void *)p, MAP_BYTES);
+  }
+  bench_latency("mmap_fault", ns, rounds * (MAP_BYTES / PAGE_BYTES));
+  return 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file user/bench/file.c
+ * @brief File system: sequential and random reads, create, unlink, stat.
+ *
+ * Works in /tmp on the root (ext2) volume. The file is read right after
+ * it is written, so the reads measure the cached path; the create and
+ * unlink rates include directory updates on disk as the kernel does them.
+ */
+
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCH_FILE "/tmp/bench.dat"
+#define BENCH_TREE "/tmp/bench.d"
+
+/** @brief Bytes per sequential read. */
+#define SEQ_CHUNK (64 * 1024)
+
+/** @brief Bytes per random read. */
+#define RAND_BLOCK 4096
+
+static char g_buf[SEQ_CHUNK];
+
+static void make_file(unsigned long bytes)
+{
+  int fd = open(BENCH_FILE, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if(fd < 0)
+    bench_die("file: " BENCH_FILE);
+  for(unsigned long off = 0; off < bytes; off += SEQ_CHUNK) {
+    if(write(fd, g_buf, SEQ_CHUNK) != SEQ_CHUNK)
+      bench_die("file: write");
+  }
+  close(fd);
+}
+
+static void read_seq(unsigned long bytes)
+{
+  int fd = open(BENCH_FILE, O_RDONLY);
+  if(fd < 0)
+    bench_die("file: " BENCH_FILE);
+  uint64_t      t0  = bench_now_ns();
+  unsigned long got = 0;
+  ssize_t       n;
+  while(got < bytes && (n = read(fd, g_buf, SEQ_CHUNK)) > 0)
+    got += (unsigned long)n;
+  bench_bandwidth("file_read_seq", bench_now_ns() - t0, got);
+  close(fd);
+}
+
+static void read_random(unsigned long bytes)
+{
+  int fd = open(BENCH_FILE, O_RDONLY);
+  if(fd < 0)
+    bench_die("file: " BENCH_FILE);
+  unsigned long blocks = bytes / RAND_BLOCK;
+  uint64_t      x      = 88172645463325252ULL;
+  uint64_t      t0     = bench_now_ns();
+  for(unsigned long i = 0; i < blocks; i++) {
+    /* xorshift64: the same block order on every run. */
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    off_t off = (off_t)(x % blocks) * RAND_BLOCK;
+    if(pread(fd, g_buf, RAND_BLOCK, off) != RAND_BLOCK)
+      bench_die("file: pread");
+  }
+  bench_latency("file_read_random", bench_now_ns() - t0, blocks);
+  close(fd);
+}
+
+static void tree(unsigned long files)
+{
+  char path[64];
+  if(mkdir(BENCH_TREE, 0755) < 0 && access(BENCH_TREE, F_OK) < 0)
+    bench_die("file: " BENCH_TREE);
+
+  uint64_t t0 = bench_now_ns();
+  for(unsigned long i = 0; i < files; i++) {
+    snprintf(path, sizeof(path), BENCH_TREE "/f%lu", i);
+    int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    if(fd < 0)
+      bench_die("file: create");
+    close(fd);
+  }
+  bench_rate("file_create", bench_now_ns() - t0, files);
+
+  struct stat st;
+  t0 = bench_now_ns();
+  for(unsigned long i = 0; i < files; i++) {
+    if(stat(BENCH_FILE, &st) < 0)
+      bench_die("file: stat");
+  }
+  bench_latency("file_stat", bench_now_ns() - t0, files);
+
+  t0 = bench_now_ns();
+  for(unsigned long i = 0; i < files; i++) {
+    snprintf(path, sizeof(path), BENCH_TREE "/f%lu", i);
+    if(unlink(path) < 0)
+      bench_die("file: unlink");
+  }
+  bench_rate("file_unlink", bench_now_ns() - t0, files);
+  rmdir(BENCH_TREE);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long files = 1000;
+  unsigned long mib   = 16;
+  int           rc    = bench_parse(
+      argc, argv, "file", "Time reads, creates, unlinks and stats in /tmp.",
+      &files, &mib, "MiB read"
+  );
+  if(rc >= 0)
+    return rc;
+
+  unsigned long bytes = mib << 20;
+  make_file(bytes);
+  read_seq(bytes);
+  read_random(bytes);
+  tree(files);
+  unlink(BENCH_FILE);
+  return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file user/bench/futex.c
+ * @brief Futex ping-pong between two processes.
+ *
+ * The word lives in a shared anonymous page, so the (non-private) futex
+ * is keyed by the page both processes map. Each side waits for its turn,
+ * hands the turn over and wakes the other; one iteration is a round trip.
+ */
+
+#include "bench.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+/* Wait until *@p w is @p mine, then give the turn to @p theirs. */
+static void turn(int *w, int mine, int theirs)
+{
+  int v;
+  while((v = __atomic_load_n(w, __ATOMIC_ACQUIRE)) != mine)
+    syscall(SYS_futex, w, FUTEX_WAIT, v, NULL, NULL, 0);
+  __atomic_store_n(w, theirs, __ATOMIC_RELEASE);
+  syscall(SYS_futex, w, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long iters = 10000;
+  int           rc    = bench_parse(
+      argc, argv, "futex", "Time futex wake/wait round trips.", &iters, NULL,
+      NULL
+  );
+  if(rc >= 0)
+    return rc;
+
+  int *w = mmap(
+      NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+      -1, 0
+  );
+  if(w == MAP_FAILED)
+    bench_die("futex: mmap");
+  *w = 0;
+
+  pid_t pid = fork();
+  if(pid < 0)
+    bench_die("futex: fork");
+  if(pid == 0) {
+    for(unsigned long i = 0; i < iters; i++)
+      turn(w, 1, 0);
+    _exit(0);
+  }
+
+  uint64_t t0 = bench_now_ns();
+  for(unsigned long i = 0; i < iters; i++)
+    turn(w, 0, 1);
+  /* The last hand-over is complete once the child takes its turn. */
+  while(__atomic_load_n(w, __ATOMIC_ACQUIRE) != 0)
+    syscall(SYS_futex, w, FUTEX_WAIT, 1, NULL, NULL, 0);
+  bench_latency("futex_pingpong", bench_now_ns() - t0, iters);
+  waitpid(pid, NULL, 0);
+  return 0;
+}
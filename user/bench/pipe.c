@@ -0,0 +1,94 @@
+/**
+ * @file user/bench/pipe.c
+ * @brief Pipe latency (one-byte round trip) and bandwidth.
+ */
+
+#include "bench.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** @brief Bytes per write in the bandwidth test. */
+#define CHUNK (64 * 1024)
+
+static char g_buf[CHUNK];
+
+static void latency(unsigned long iters)
+{
+  int to[2], from[2];
+  if(pipe(to) < 0 || pipe(from) < 0)
+    bench_die("pipe: pipe");
+
+  pid_t pid = fork();
+  if(pid < 0)
+    bench_die("pipe: fork");
+  if(pid == 0) {
+    char c;
+    close(to[1]);
+    close(from[0]);
+    while(read(to[0], &c, 1) == 1 && write(from[1], &c, 1) == 1)
+      ;
+    _exit(0);
+  }
+  close(to[0]);
+  close(from[1]);
+
+  char     c  = 'x';
+  uint64_t t0 = bench_now_ns();
+  for(unsigned long i = 0; i < iters; i++) {
+    if(write(to[1], &c, 1) != 1 || read(from[0], &c, 1) != 1)
+      bench_die("pipe: round trip");
+  }
+  bench_latency("pipe_latency", bench_now_ns() - t0, iters);
+  close(to[1]);
+  close(from[0]);
+  waitpid(pid, NULL, 0);
+}
+
+static void bandwidth(unsigned long bytes)
+{
+  int fd[2];
+  if(pipe(fd) < 0)
+    bench_die("pipe: pipe");
+
+  pid_t pid = fork();
+  if(pid < 0)
+    bench_die("pipe: fork");
+  if(pid == 0) {
+    close(fd[0]);
+    for(unsigned long left = bytes; left;) {
+      size_t  n = left < CHUNK ? left : CHUNK;
+      ssize_t w = write(fd[1], g_buf, n);
+      if(w <= 0)
+        _exit(1);
+      left -= (unsigned long)w;
+    }
+    _exit(0);
+  }
+  close(fd[1]);
+
+  uint64_t      t0  = bench_now_ns();
+  unsigned long got = 0;
+  ssize_t       n;
+  while((n = read(fd[0], g_buf, CHUNK)) > 0)
+    got += (unsigned long)n;
+  bench_bandwidth("pipe_bandwidth", bench_now_ns() - t0, got);
+  close(fd[0]);
+  waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long iters = 10000;
+  unsigned long mib   = 64;
+  int           rc    = bench_parse(
+      argc, argv, "pipe", "Time pipe round trips and streaming.", &iters, &mib,
+      "MiB streamed"
+  );
+  if(rc >= 0)
+    return rc;
+
+  latency(iters);
+  bandwidth(mib << 20);
+  return 0;
+}
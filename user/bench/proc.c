@@ -0,0 +1,59 @@
+/**
+ * @file user/bench/proc.c
+ * @brief Process creation: fork+exit and fork+exec.
+ *
+ * fork_exit times a fork whose child exits at once, reaped by waitpid;
+ * fork_exec has the child exec this binary again, which exits as soon as
+ * it sees --child.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void reap(pid_t pid)
+{
+  int status;
+  if(pid < 0)
+    bench_die("proc: fork");
+  if(waitpid(pid, &status, 0) < 0)
+    bench_die("proc: waitpid");
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc == 2 && strcmp(argv[1], "--child") == 0)
+    return 0;
+
+  unsigned long iters = 500;
+  int           rc    = bench_parse(
+      argc, argv, "proc", "Time fork+exit and fork+exec.", &iters, NULL, NULL
+  );
+  if(rc >= 0)
+    return rc;
+
+  uint64_t t0 = bench_now_ns();
+  for(unsigned long i = 0; i < iters; i++) {
+    pid_t pid = fork();
+    if(pid == 0)
+      _exit(0);
+    reap(pid);
+  }
+  bench_latency("fork_exit", bench_now_ns() - t0, iters);
+
+  char *child[] = {argv[0], "--child", NULL};
+  t0            = bench_now_ns();
+  for(unsigned long i = 0; i < iters; i++) {
+    pid_t pid = fork();
+    if(pid == 0) {
+      execv(argv[0], child);
+      _exit(127);
+    }
+    reap(pid);
+  }
+  bench_latency("fork_exec", bench_now_ns() - t0, iters);
+  return 0;
+}
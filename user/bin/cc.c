@@ -20,11 +20,24 @@
  * getMainExecutable() reads /proc/self/exe (we have no procfs) then falls back
  * to PATH lookup on basename-only argv[0]. Without PATH, it returns "" and
  * posix_spawn fails with EACCES (“Permission denied”).
+ *
+ * Single-file compiles (`-c foo.c [-o foo.o]`) go through a content-hashed
+ * object cache under /var/cache/cc (override with CC_CACHE_DIR, disable with
+ * CC_NOCACHE=1). The key covers the preprocessed source, every forwarded
+ * flag except the output name and the identity of clang.real, so an
+ * unchanged translation unit is rebuilt by copying its object instead of
+ * running the compiler. Preprocessing is a fraction of a full compile, which
+ * is what makes a no-op rebuild fast.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #define REAL_CLANG "/bin/clang.real"
@@ -39,6 +52,13 @@
 #define CXX_INC        "/usr/include/c++/9.4.0"
 #define CXX_INC_TARGET "/usr/include/c++/9.4.0/x86_64-linux-musl"
 
+/* Compile cache. Bump CACHE_FORMAT when what goes into the key changes. */
+#define CACHE_DIR    "/var/cache/cc"
+#define CACHE_FORMAT "alcor2-cc-cache 1"
+#define COPY_BUF     (64 * 1024)
+
+static char copy_buf[COPY_BUF];
+
 /**
  * @brief Detect whether we should run in C++ mode.
  *
@@ -77,6 +97,332 @@ static void push(char **fwd, int *n, const char *a)
   fwd[(*n)++] = (char *)a;
 }
 
+/* FNV-1a, 128-bit: wide enough that a collision (a wrong object linked
+ * in) is not a practical concern, and simple enough to keep in the driver. */
+typedef unsigned __int128 hash_t;
+
+#define FNV128_PRIME (((hash_t)1 << 88) | 0x13b)
+#define FNV128_BASIS                                                          \
+  (((hash_t)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL)
+
+static void hash_bytes(hash_t *h, const void *p, size_t n)
+{
+  const unsigned char *b = p;
+  for(size_t i = 0; i < n; i++) {
+    *h ^= b[i];
+    *h *= FNV128_PRIME;
+  }
+}
+
+/* The terminator goes in too, so {"-DA", "B"} and {"-D", "AB"} differ. */
+static void hash_str(hash_t *h, const char *s)
+{
+  hash_bytes(h, s, strlen(s) + 1);
+}
+
+/* Options whose value is the next argument. */
+static int takes_value(const char *a)
+{
+  static const char *const opts[] = {
+      "-o",       "-I",         "-D",       "-U",         "-x",
+      "-include", "-imacros",   "-isystem", "-idirafter", "-iquote",
+      "-iprefix", "-isysroot",  "-MF",      "-MT",        "-MQ",
+      "-Xclang",  "-Xlinker",   "-target",  "-L",         "-Xassembler",
+      "-arch",    "-Xpreprocessor",
+  };
+  for(size_t i = 0; i < sizeof(opts) / sizeof(opts[0]); i++)
+    if(!strcmp(a, opts[i]))
+      return 1;
+  return 0;
+}
+
+/* Options whose output is not (only) the object, or that print instead of
+ * compiling: these always run the compiler. */
+static int uncacheable(const char *a)
+{
+  static const char *const opts[] = {
+      "-E",  "-S",   "-M",  "-MM", "-MD",     "-MMD",
+      "-",   "-###", "-v",  "-fsyntax-only", "--version",
+  };
+  if(a[0] == '@' || !strncmp(a, "-save-temps", 11) ||
+     !strncmp(a, "--analyze", 9))
+    return 1;
+  for(size_t i = 0; i < sizeof(opts) / sizeof(opts[0]); i++)
+    if(!strcmp(a, opts[i]))
+      return 1;
+  return 0;
+}
+
+static int is_source(const char *path)
+{
+  static const char *const exts[] = {
+      ".c", ".cc", ".cpp", ".cxx", ".c++", ".C", ".i", ".ii",
+  };
+  const char *dot = strrchr(path, '.');
+  if(!dot)
+    return 0;
+  for(size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++)
+    if(!strcmp(dot, exts[i]))
+      return 1;
+  return 0;
+}
+
+/** @brief What a cacheable command line compiles, and where to. */
+typedef struct
+{
+  const char *src; /**< The single input file. */
+  const char *out; /**< Object to produce. */
+  int         dbg; /**< -g given: the object records the cwd. */
+  char        defout[PATH_MAX];
+} cache_job_t;
+
+/**
+ * @brief Decide whether @p args (the user's arguments) can use the cache.
+ *
+ * Only `-c` of exactly one C/C++ source qualifies; anything that writes
+ * extra files (dependency output, temps) or does not produce an object is
+ * left to the compiler.
+ *
+ * @return 1 and fill @p job if the compile is cacheable, 0 otherwise.
+ */
+static int cache_parse(int argc, char **args, cache_job_t *job)
+{
+  int compile = 0;
+
+  job->src = NULL;
+  job->out = NULL;
+  job->dbg = 0;
+  for(int i = 0; i < argc; i++) {
+    const char *a = args[i];
+    if(uncacheable(a))
+      return 0;
+    if(!strcmp(a, "-c"))
+      compile = 1;
+    else if(!strcmp(a, "-o") && i + 1 < argc)
+      job->out = args[++i];
+    else if(!strncmp(a, "-o", 2))
+      job->out = a + 2;
+    else if(takes_value(a))
+      i++;
+    else if(!strncmp(a, "-g", 2) && strcmp(a, "-g0"))
+      job->dbg = 1;
+    else if(a[0] != '-') {
+      if(job->src || !is_source(a))
+        return 0;
+      job->src = a;
+    }
+  }
+  if(!compile || !job->src)
+    return 0;
+
+  if(!job->out) {
+    /* Clang's default: the input's basename with .o, in the cwd. */
+    const char *base = strrchr(job->src, '/');
+    base             = base ? base + 1 : job->src;
+    const char *dot  = strrchr(base, '.');
+    int         len  = (int)(dot - base);
+    if(snprintf(job->defout, sizeof(job->defout), "%.*s.o", len, base) >=
+       (int)sizeof(job->defout))
+      return 0;
+    job->out = job->defout;
+  }
+  return 1;
+}
+
+/* Start clang.real with stdout/stderr on @p out/@p err (-1: inherit). */
+static pid_t spawn(char **args, int out, int err)
+{
+  pid_t pid = fork();
+  if(pid == 0) {
+    if(out >= 0)
+      dup2(out, 1);
+    if(err >= 0)
+      dup2(err, 2);
+    execv(REAL_CLANG, args);
+    (void)fprintf(stderr, "cc: cannot exec %s\n", REAL_CLANG);
+    _exit(127);
+  }
+  return pid;
+}
+
+/* Exit status of @p pid, or -1 if it did not exit normally. */
+static int reap(pid_t pid)
+{
+  int st;
+  while(waitpid(pid, &st, 0) < 0)
+    if(errno != EINTR)
+      return -1;
+  return WIFEXITED(st) ? WEXITSTATUS(st) : -1;
+}
+
+/**
+ * @brief Hash the preprocessed source of a compile.
+ *
+ * Runs @p fwd with `-c` turned into `-E` and the output dropped, so it goes
+ * to a pipe. Diagnostics are discarded: the real compile shows them.
+ *
+ * @return 0 on success, -1 if preprocessing failed.
+ */
+static int hash_preprocessed(hash_t *h, char **fwd, int n)
+{
+  char **pre = (char **)malloc((size_t)(n + 1) * sizeof(*pre));
+  int    m   = 0;
+  int    fds[2];
+  if(!pre)
+    return -1;
+  for(int i = 0; i < n; i++) {
+    if(!strcmp(fwd[i], "-o"))
+      i++;
+    else if(!strncmp(fwd[i], "-o", 2))
+      continue;
+    else
+      pre[m++] = strcmp(fwd[i], "-c") ? fwd[i] : "-E";
+  }
+  pre[m] = NULL;
+
+  int null = open("/dev/null", O_WRONLY);
+  if(pipe(fds) < 0) {
+    free(pre);
+    return -1;
+  }
+  pid_t pid = spawn(pre, fds[1], null);
+  close(fds[1]);
+  if(null >= 0)
+    close(null);
+  free(pre);
+  if(pid < 0) {
+    close(fds[0]);
+    return -1;
+  }
+
+  ssize_t got;
+  while((got = read(fds[0], copy_buf, sizeof(copy_buf))) > 0)
+    hash_bytes(h, copy_buf, (size_t)got);
+  close(fds[0]);
+  return reap(pid) == 0 ? 0 : -1;
+}
+
+/* Copy @p from to @p to through a temporary file next to it, so a reader
+ * (or a concurrent build) never sees a partial object. */
+static int copy_file(const char *from, const char *to)
+{
+  char tmp[PATH_MAX];
+  if(snprintf(tmp, sizeof(tmp), "%s.%d.tmp", to, (int)getpid()) >=
+     (int)sizeof(tmp))
+    return -1;
+
+  int in = open(from, O_RDONLY);
+  if(in < 0)
+    return -1;
+  int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(out < 0) {
+    close(in);
+    return -1;
+  }
+
+  ssize_t got;
+  int     rc = 0;
+  while(rc == 0 && (got = read(in, copy_buf, sizeof(copy_buf))) > 0)
+    if(write(out, copy_buf, (size_t)got) != got)
+      rc = -1;
+  if(got < 0)
+    rc = -1;
+  close(in);
+  if(close(out) < 0)
+    rc = -1;
+  if(rc == 0 && rename(tmp, to) < 0)
+    rc = -1;
+  if(rc < 0)
+    unlink(tmp);
+  return rc;
+}
+
+/**
+ * @brief Run a compile through the object cache.
+ * @param argc Number of user arguments.
+ * @param args The user arguments (also the tail of @p fwd).
+ * @param fwd Full forwarded command line, @p n entries.
+ * @return The compile's exit status, or -1 if the cache does not apply and
+ *         the caller should exec the compiler as usual.
+ */
+static int cache_compile(int argc, char **args, char **fwd, int n)
+{
+  cache_job_t job;
+  struct stat st;
+  const char *dir = getenv("CC_CACHE_DIR");
+  char        path[PATH_MAX];
+  char        err[PATH_MAX];
+  char        cwd[PATH_MAX];
+
+  if(!dir || !*dir)
+    dir = CACHE_DIR;
+  if(!cache_parse(argc, args, &job) || stat(REAL_CLANG, &st) < 0)
+    return -1;
+  if(mkdir(dir, 0755) < 0 && access(dir, W_OK) < 0)
+    return -1;
+
+  /* Key: compiler identity, forwarded flags (minus the output, so moving a
+   * build tree still hits), the cwd when it ends up in debug info, and the
+   * preprocessed source. */
+  hash_t h = FNV128_BASIS;
+  hash_str(&h, CACHE_FORMAT);
+  hash_bytes(&h, &st.st_size, sizeof(st.st_size));
+  hash_bytes(&h, &st.st_mtime, sizeof(st.st_mtime));
+  for(int i = 0; i < n; i++) {
+    if(!strcmp(fwd[i], "-o"))
+      i++;
+    else if(strncmp(fwd[i], "-o", 2))
+      hash_str(&h, fwd[i]);
+  }
+  if(job.dbg && getcwd(cwd, sizeof(cwd)))
+    hash_str(&h, cwd);
+  if(hash_preprocessed(&h, fwd, n) < 0)
+    return -1;
+
+  /* Two-level layout (ab/cdef….o) keeps each ext2 directory short. */
+  unsigned long long hi = (unsigned long long)(h >> 64);
+  unsigned long long lo = (unsigned long long)h;
+  if(snprintf(path, sizeof(path), "%s/%02llx", dir, hi >> 56) >=
+     (int)sizeof(path))
+    return -1;
+  (void)mkdir(path, 0755);
+  if(snprintf(path, sizeof(path), "%s/%02llx/%014llx%016llx.o", dir,
+              hi >> 56, hi & 0xffffffffffffffULL, lo) >= (int)sizeof(path))
+    return -1;
+
+  if(copy_file(path, job.out) == 0)
+    return 0;
+
+  /* Miss: compile, capturing diagnostics. A compile that printed any is
+   * not stored, so its warnings show again on the next build. */
+  if(snprintf(err, sizeof(err), "%s/err.%d", dir, (int)getpid()) >=
+     (int)sizeof(err))
+    return -1;
+  int efd = open(err, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+  pid_t pid = spawn(fwd, -1, efd);
+  if(pid < 0) {
+    if(efd >= 0) {
+      close(efd);
+      unlink(err);
+    }
+    return -1;
+  }
+  int   rc    = reap(pid);
+  off_t noisy = efd >= 0 ? lseek(efd, 0, SEEK_END) : 1;
+  if(efd >= 0) {
+    ssize_t got;
+    (void)lseek(efd, 0, SEEK_SET);
+    while((got = read(efd, copy_buf, sizeof(copy_buf))) > 0)
+      (void)write(2, copy_buf, (size_t)got);
+    close(efd);
+    unlink(err);
+  }
+  if(rc == 0 && noisy == 0)
+    (void)copy_file(job.out, path);
+  return rc < 0 ? 1 : rc;
+}
+
 int main(int argc, char *argv[])
 {
   /* Worst-case size: our own injected flags (~24) + every user arg. */
@@ -145,6 +491,13 @@ int main(int argc, char *argv[])
 
   fwd[n] = NULL;
 
+  const char *nocache = getenv("CC_NOCACHE");
+  if(!nocache || !*nocache || !strcmp(nocache, "0")) {
+    int rc = cache_compile(argc - 1, argv + 1, fwd, n);
+    if(rc >= 0)
+      return rc;
+  }
+
   execv(REAL_CLANG, fwd);
   (void)fprintf(stderr, "cc: cannot exec %s\n", REAL_CLANG);
   return 127;
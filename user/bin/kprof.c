@@ -0,0 +1,422 @@
+/**
+ * @file user/bin/kprof.c
+ * @brief Profile the kernel: where does its time go?
+ *
+ * Usage: kprof [options] SECONDS
+ *        kprof [options] -- COMMAND [ARGS...]
+ *
+ * Turns the kernel's sampling profiler on, drains its ring until the time
+ * is up or the command has exited, then names every sampled address with
+ * the symbol table of the kernel ELF and prints a flat profile (self and
+ * inclusive samples per function) and the callers of the hottest ones.
+ */
+
+#include <alcor2/alcor_kprof.h>
+#include <elf.h>
+#include <grendizer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_ALCOR_KPROF
+  #define SYS_ALCOR_KPROF 503
+#endif
+
+#define KPROF_KERNEL "/boot/alcor2.elf"
+
+/** @brief How often the ring is drained while recording. */
+#define DRAIN_US 20000
+
+/** @brief Callers listed under each hot function. */
+#define MAX_CALLERS 5
+
+typedef struct
+{
+  uint64_t    addr;
+  uint64_t    size; /* 0 when the symbol does not say */
+  const char *name;
+} sym_t;
+
+typedef struct
+{
+  int      caller;
+  int      callee;
+  unsigned count;
+} edge_t;
+
+static char  *g_image;
+static sym_t *g_syms;
+static int    g_nsyms;
+
+/* Function ids past the symbols. */
+#define ID_UNKNOWN (g_nsyms)
+#define ID_USER    (g_nsyms + 1)
+
+static long kprof_ctl(int op, unsigned long arg, unsigned long count)
+{
+  return syscall(SYS_ALCOR_KPROF, op, arg, count);
+}
+
+static int cmp_sym(const void *a, const void *b)
+{
+  const sym_t *x = a, *y = b;
+  return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+/* Read the function symbols of the ELF at @p path, sorted by address. */
+static int load_symbols(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if(!f)
+    return -1;
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  g_image = len > 0 ? malloc((size_t)len) : NULL;
+  int ok  = g_image && fread(g_image, 1, (size_t)len, f) == (size_t)len;
+  fclose(f);
+  if(!ok || (size_t)len < sizeof(Elf64_Ehdr) ||
+     memcmp(g_image, ELFMAG, SELFMAG) != 0)
+    return -1;
+
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *)g_image;
+  if(eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf64_Shdr) > (size_t)len)
+    return -1;
+  const Elf64_Shdr *sh = (const Elf64_Shdr *)(g_image + eh->e_shoff);
+  for(int i = 0; i < eh->e_shnum; i++) {
+    if(sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum)
+      continue;
+    const Elf64_Shdr *strs = &sh[sh[i].sh_link];
+    if(sh[i].sh_offset + sh[i].sh_size > (size_t)len ||
+       strs->sh_offset + strs->sh_size > (size_t)len)
+      return -1;
+    const Elf64_Sym *st = (const Elf64_Sym *)(g_image + sh[i].sh_offset);
+    size_t           n  = sh[i].sh_size / sizeof(Elf64_Sym);
+    g_syms              = calloc(n ? n : 1, sizeof(*g_syms));
+    if(!g_syms)
+      return -1;
+    for(size_t k = 0; k < n; k++) {
+      int type = ELF64_ST_TYPE(st[k].st_info);
+      /* Assembler labels (interrupt stubs) come out untyped. */
+      if((type != STT_FUNC && type != STT_NOTYPE) ||
+         st[k].st_shndx == SHN_UNDEF || st[k].st_shndx >= SHN_LORESERVE ||
+         st[k].st_name == 0 || st[k].st_name >= strs->sh_size)
+        continue;
+      g_syms[g_nsyms].addr = st[k].st_value;
+      g_syms[g_nsyms].size = st[k].st_size;
+      g_syms[g_nsyms].name = g_image + strs->sh_offset + st[k].st_name;
+      g_nsyms++;
+    }
+    qsort(g_syms, (size_t)g_nsyms, sizeof(*g_syms), cmp_sym);
+    return g_nsyms > 0 ? 0 : -1;
+  }
+  return -1;
+}
+
+static const sym_t *find_symbol(const char *name)
+{
+  for(int i = 0; i < g_nsyms; i++) {
+    if(strcmp(g_syms[i].name, name) == 0)
+      return &g_syms[i];
+  }
+  return NULL;
+}
+
+/* Function id of link-time address @p addr. */
+static int symbolize(uint64_t addr)
+{
+  int lo = 0, hi = g_nsyms;
+  while(lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if(g_syms[mid].addr <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo == 0)
+    return ID_UNKNOWN;
+  const sym_t *s = &g_syms[lo - 1];
+  if(s->size && addr >= s->addr + s->size)
+    return ID_UNKNOWN;
+  return lo - 1;
+}
+
+static const char *id_name(int id)
+{
+  if(id == ID_USER)
+    return "[user]";
+  if(id == ID_UNKNOWN)
+    return "[unknown]";
+  return g_syms[id].name;
+}
+
+static alcor_kprof_sample_t *g_samples;
+static size_t                g_nsamples;
+static size_t                g_cap;
+
+/* Move what the kernel has queued into g_samples. */
+static int drain(void)
+{
+  while(1) {
+    if(g_nsamples == g_cap) {
+      size_t cap = g_cap ? g_cap * 2 : 4096;
+      void  *p   = realloc(g_samples, cap * sizeof(*g_samples));
+      if(!p)
+        return -1;
+      g_samples = p;
+      g_cap     = cap;
+    }
+    long n = kprof_ctl(
+        ALCOR_KPROF_READ, (unsigned long)(g_samples + g_nsamples),
+        g_cap - g_nsamples
+    );
+    if(n < 0)
+      return -1;
+    g_nsamples += (size_t)n;
+    if(g_nsamples < g_cap)
+      return 0;
+  }
+}
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Sample for @p seconds, or until @p cmd (when set) exits. */
+static int record(unsigned long hz, unsigned long seconds, char **cmd)
+{
+  pid_t child = -1;
+  if(kprof_ctl(ALCOR_KPROF_RESET, 0, 0) < 0 ||
+     kprof_ctl(ALCOR_KPROF_ON, hz, 0) < 0) {
+    perror("kprof: cannot start the profiler");
+    return -1;
+  }
+  if(cmd) {
+    child = fork();
+    if(child == 0) {
+      execvp(cmd[0], cmd);
+      fprintf(stderr, "kprof: cannot run '%s'\n", cmd[0]);
+      _exit(127);
+    }
+    if(child < 0)
+      perror("kprof: fork");
+  }
+
+  uint64_t end = now_us() + (uint64_t)seconds * 1000000;
+  int      rc  = 0;
+  while(rc == 0) {
+    if(drain() < 0)
+      rc = -1;
+    else if(child > 0 && waitpid(child, NULL, WNOHANG) == child)
+      break;
+    else if(child <= 0 && (cmd || now_us() >= end))
+      break;
+    else
+      usleep(DRAIN_US);
+  }
+  kprof_ctl(ALCOR_KPROF_OFF, 0, 0);
+  if(rc == 0 && drain() < 0)
+    rc = -1;
+  if(rc < 0)
+    fprintf(stderr, "kprof: out of memory\n");
+  return rc;
+}
+
+static unsigned *g_self;
+static unsigned *g_total;
+
+/* Most self samples first, then most inclusive ones. */
+static int by_self(const void *a, const void *b)
+{
+  int ia = *(const int *)a, ib = *(const int *)b;
+  if(g_self[ia] != g_self[ib])
+    return (g_self[ia] < g_self[ib]) - (g_self[ia] > g_self[ib]);
+  return (g_total[ia] < g_total[ib]) - (g_total[ia] > g_total[ib]);
+}
+
+static int by_edge(const void *a, const void *b)
+{
+  const edge_t *x = a, *y = b;
+  if(x->callee != y->callee)
+    return x->callee - y->callee;
+  return x->caller - y->caller;
+}
+
+static int by_count(const void *a, const void *b)
+{
+  const edge_t *x = a, *y = b;
+  return (x->count < y->count) - (x->count > y->count);
+}
+
+/* "12.3%" of @p n out of @p total, without floating point. */
+static void print_pct(unsigned n, size_t total)
+{
+  unsigned long permille = total ? (unsigned long)n * 1000 / total : 0;
+  printf("%5lu.%lu%%", permille / 10, permille % 10);
+}
+
+/* Fold the samples into function counts and call edges, and print them. */
+static int report(const alcor_kprof_info_t *info, long top)
+{
+  const sym_t *km    = find_symbol("kmain");
+  uint64_t     slide = km ? info->kmain - km->addr : 0;
+  int          nids  = g_nsyms + 2;
+
+  g_self         = calloc((size_t)nids, sizeof(*g_self));
+  g_total        = calloc((size_t)nids, sizeof(*g_total));
+  edge_t *edges  = malloc(
+      (g_nsamples ? g_nsamples : 1) * (ALCOR_KPROF_DEPTH - 1) * sizeof(*edges)
+  );
+  int    *order  = malloc((size_t)nids * sizeof(*order));
+  size_t  nedges = 0, user = 0;
+  if(!g_self || !g_total || !edges || !order) {
+    fprintf(stderr, "kprof: out of memory\n");
+    return 1;
+  }
+
+  for(size_t i = 0; i < g_nsamples; i++) {
+    const alcor_kprof_sample_t *s = &g_samples[i];
+    int                         ids[ALCOR_KPROF_DEPTH];
+    int                         depth = (int)s->depth;
+    if(depth < 1 || depth > ALCOR_KPROF_DEPTH)
+      continue;
+    if(s->flags & ALCOR_KPROF_USER) {
+      user++;
+      ids[0] = ID_USER;
+      depth  = 1;
+    } else {
+      /* A return address is just past its call: look up the call. */
+      for(int d = 0; d < depth; d++)
+        ids[d] = symbolize(s->pc[d] - slide - (d > 0));
+    }
+    g_self[ids[0]]++;
+    for(int d = 0; d < depth; d++) {
+      int seen = 0;
+      for(int e = 0; e < d && !seen; e++)
+        seen = ids[e] == ids[d];
+      if(!seen)
+        g_total[ids[d]]++;
+      if(d > 0 && ids[d] != ids[d - 1]) {
+        edges[nedges].caller = ids[d];
+        edges[nedges].callee = ids[d - 1];
+        edges[nedges].count  = 1;
+        nedges++;
+      }
+    }
+  }
+
+  /* Count each distinct edge once. */
+  qsort(edges, nedges, sizeof(*edges), by_edge);
+  size_t k = 0;
+  for(size_t i = 0; i < nedges; i++) {
+    if(k > 0 && by_edge(&edges[k - 1], &edges[i]) == 0)
+      edges[k - 1].count++;
+    else
+      edges[k++] = edges[i];
+  }
+  nedges = k;
+
+  printf(
+      "%zu samples at %lu Hz, %zu in user mode, %lu dropped\n", g_nsamples,
+      (unsigned long)info->hz, user, (unsigned long)info->dropped
+  );
+  if(!km)
+    printf("kprof: no kmain in the kernel ELF, addresses may be off\n");
+
+  int nshown = 0;
+  for(int id = 0; id < nids; id++) {
+    if(g_total[id])
+      order[nshown++] = id;
+  }
+  qsort(order, (size_t)nshown, sizeof(*order), by_self);
+  if(top > 0 && nshown > top)
+    nshown = (int)top;
+
+  printf("\n   self   total  samples  function\n");
+  for(int i = 0; i < nshown; i++) {
+    int id = order[i];
+    print_pct(g_self[id], g_nsamples);
+    print_pct(g_total[id], g_nsamples);
+    printf("  %7u  %s\n", g_self[id], id_name(id));
+  }
+
+  printf("\ncallers (samples through each call)\n");
+  for(int i = 0; i < nshown; i++) {
+    int     id = order[i];
+    edge_t *lo = edges, *hi = edges + nedges;
+    while(lo < hi && lo->callee != id)
+      lo++;
+    edge_t *end = lo;
+    while(end < hi && end->callee == id)
+      end++;
+    if(lo == end)
+      continue;
+    qsort(lo, (size_t)(end - lo), sizeof(*lo), by_count);
+    printf("  %s\n", id_name(id));
+    for(edge_t *e = lo; e < end && e < lo + MAX_CALLERS; e++)
+      printf("    %7u  %s\n", e->count, id_name(e->caller));
+  }
+  return 0;
+}
+
+/**
+ * @brief kprof main entry point.
+ */
+int main(int argc, char *argv[])
+{
+  unsigned long hz     = ALCOR_KPROF_DEFAULT_HZ;
+  long          top    = 20;
+  const char   *kernel = KPROF_KERNEL;
+  gr_opt        opts[] = {
+      GR_UINT('r', "rate", &hz, "HZ", "Samples per second (default 1000)"),
+      GR_STR('k', "kernel", &kernel, "ELF", "Kernel image with symbols"),
+      GR_INT('n', "top", &top, "N", "Functions listed (default 20)"),
+      GR_END
+  };
+
+  gr_spec spec = {
+      .program = "kprof",
+      .usage   = "[options] SECONDS | [options] -- COMMAND [ARGS...]",
+      .options = opts,
+      .epilog  = "Samples the kernel for SECONDS, or while COMMAND runs."
+  };
+
+  gr_rest rest;
+  int     rc = gr_parse(&spec, argc, argv, &rest, NULL, 0);
+  if(rc != GR_OK)
+    return (rc == GR_HELP) ? 0 : 1;
+  if(rest.argc == 0) {
+    gr_usage(&spec, stderr);
+    return 1;
+  }
+
+  char         *end;
+  unsigned long seconds = strtoul(rest.argv[0], &end, 10);
+  char        **cmd     = NULL;
+  if(end == rest.argv[0] || *end || rest.argc > 1) {
+    cmd     = rest.argv;
+    seconds = 0;
+  }
+
+  if(load_symbols(kernel) < 0) {
+    fprintf(stderr, "kprof: cannot read symbols from '%s'\n", kernel);
+    return 1;
+  }
+  if(record(hz, seconds, cmd) < 0)
+    return 1;
+
+  alcor_kprof_info_t info;
+  if(kprof_ctl(ALCOR_KPROF_INFO, (unsigned long)&info, 0) < 0) {
+    perror("kprof: cannot read the profiler state");
+    return 1;
+  }
+  info.hz = hz;
+  return report(&info, top);
+}
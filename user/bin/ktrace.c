@@ -0,0 +1,421 @@
+/**
+ * @file user/bin/ktrace.c
+ * @brief Record kernel events as a Chrome trace.
+ *
+ * Usage: ktrace [options] SECONDS
+ *        ktrace [options] -- COMMAND [ARGS...]
+ *
+ * Turns the kernel's tracepoints on, streams its event ring to a JSON
+ * file in the Chrome trace event format until the time is up or the
+ * command has exited, then turns them off again. Syscalls, page faults,
+ * reads and pipe transfers become slices of the process they ran in; the
+ * CPU's track shows which process ran when, and block requests show as
+ * async slices from submission to completion. Open the file in
+ * chrome://tracing or ui.perfetto.dev.
+ */
+
+#include <alcor2/alcor_trace.h>
+#include <grendizer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_ALCOR_TRACE
+  #define SYS_ALCOR_TRACE 504
+#endif
+
+/** @brief How often the ring is drained while recording. */
+#define DRAIN_US 10000
+
+/** @brief Events read per call. */
+#define BATCH 512
+
+typedef struct
+{
+  const char *name;
+  unsigned    bit;
+} category_t;
+
+static const category_t g_cats[] = {
+    {"syscall", ALCOR_TRACE_CAT_SYSCALL},
+    {"sched", ALCOR_TRACE_CAT_SCHED},
+    {"fault", ALCOR_TRACE_CAT_FAULT},
+    {"block", ALCOR_TRACE_CAT_BLOCK},
+    {"fs", ALCOR_TRACE_CAT_FS},
+    {"pipe", ALCOR_TRACE_CAT_PIPE},
+};
+
+/* Names of the syscalls worth naming; the rest show by number. */
+static const struct
+{
+  unsigned    nr;
+  const char *name;
+} g_syscalls[] = {
+    {0, "read"},         {1, "write"},           {2, "open"},
+    {3, "close"},        {4, "stat"},            {5, "fstat"},
+    {7, "poll"},         {8, "lseek"},           {9, "mmap"},
+    {11, "munmap"},      {12, "brk"},            {16, "ioctl"},
+    {22, "pipe"},        {33, "dup2"},           {35, "nanosleep"},
+    {39, "getpid"},      {57, "fork"},           {58, "vfork"},
+    {59, "execve"},      {60, "exit"},           {61, "wait4"},
+    {217, "getdents64"}, {228, "clock_gettime"}, {231, "exit_group"},
+    {232, "epoll_wait"}, {257, "openat"},        {262, "newfstatat"},
+};
+
+static FILE    *g_out;
+static int      g_first = 1;
+static uint64_t g_tsc_hz;
+static uint64_t g_t0; /* TSC of the first event */
+static int      g_have_t0;
+static uint64_t g_last_ns; /* Time of the latest event */
+static pid_t    g_self;
+static uint64_t g_run_since; /* When the running process came in */
+static uint32_t g_running;
+static int      g_have_run;
+static size_t   g_nevents;
+
+static long trace_ctl(int op, unsigned long arg, unsigned long count)
+{
+  return syscall(SYS_ALCOR_TRACE, op, arg, count);
+}
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Nanoseconds from the first event to TSC value @p tsc. */
+static uint64_t tsc_ns(uint64_t tsc)
+{
+  uint64_t d = tsc - g_t0;
+  return d / g_tsc_hz * 1000000000ULL +
+         d % g_tsc_hz * 1000000000ULL / g_tsc_hz;
+}
+
+/* Start one event object: the fields every event has. */
+static void begin_event(
+    const char *name, const char *cat, const char *ph, uint64_t ns,
+    uint32_t pid
+)
+{
+  fprintf(
+      g_out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\"",
+      g_first ? "" : ",", name, cat, ph
+  );
+  fprintf(
+      g_out, ",\"ts\":%llu.%03llu,\"pid\":%u,\"tid\":%u",
+      (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000), pid,
+      pid
+  );
+  g_first = 0;
+}
+
+static void end_event(void)
+{
+  fputc('}', g_out);
+}
+
+static const char *syscall_name(uint64_t nr, char *buf, size_t len)
+{
+  for(size_t i = 0; i < sizeof(g_syscalls) / sizeof(g_syscalls[0]); i++) {
+    if(g_syscalls[i].nr == nr)
+      return g_syscalls[i].name;
+  }
+  snprintf(buf, len, "syscall %llu", (unsigned long long)nr);
+  return buf;
+}
+
+/* Close the CPU-track slice of the process that ran until @p ns. */
+static void close_run(uint64_t ns)
+{
+  if(!g_have_run)
+    return;
+  char     name[32];
+  uint64_t dur = ns - g_run_since;
+  snprintf(name, sizeof(name), "pid %u", g_running);
+  begin_event(name, "sched", "X", g_run_since, 0);
+  fprintf(
+      g_out, ",\"dur\":%llu.%03llu", (unsigned long long)(dur / 1000),
+      (unsigned long long)(dur % 1000)
+  );
+  end_event();
+}
+
+static void emit(const alcor_trace_event_t *e)
+{
+  if(!g_have_t0) {
+    g_t0      = e->tsc;
+    g_have_t0 = 1;
+  }
+  uint64_t ns  = tsc_ns(e->tsc);
+  uint32_t pid = e->pid;
+  char     buf[32];
+  g_last_ns    = ns;
+
+  /* ktrace's own reads would drown everything else. */
+  if(pid == (uint32_t)g_self && e->event != ALCOR_TRACE_SWITCH)
+    return;
+  g_nevents++;
+
+  switch(e->event) {
+  case ALCOR_TRACE_SYSCALL_ENTER:
+    begin_event(
+        syscall_name(e->arg[0], buf, sizeof(buf)), "syscall", "B", ns, pid
+    );
+    fprintf(
+        g_out, ",\"args\":{\"arg0\":\"0x%llx\"}",
+        (unsigned long long)e->arg[1]
+    );
+    break;
+  case ALCOR_TRACE_SYSCALL_EXIT:
+    begin_event(
+        syscall_name(e->arg[0], buf, sizeof(buf)), "syscall", "E", ns, pid
+    );
+    fprintf(g_out, ",\"args\":{\"ret\":%lld}", (long long)e->arg[1]);
+    break;
+  case ALCOR_TRACE_SWITCH:
+    close_run(ns);
+    g_running   = (uint32_t)e->arg[1];
+    g_run_since = ns;
+    g_have_run  = 1;
+    return;
+  case ALCOR_TRACE_FAULT_BEGIN:
+    begin_event("page fault", "fault", "B", ns, pid);
+    fprintf(
+        g_out, ",\"args\":{\"addr\":\"0x%llx\",\"error\":%llu}",
+        (unsigned long long)e->arg[0], (unsigned long long)e->arg[1]
+    );
+    break;
+  case ALCOR_TRACE_FAULT_END:
+    begin_event("page fault", "fault", "E", ns, pid);
+    fprintf(
+        g_out, ",\"args\":{\"handled\":%llu}", (unsigned long long)e->arg[1]
+    );
+    break;
+  case ALCOR_TRACE_BIO_SUBMIT: {
+    static const char *ops[] = {"read", "write", "flush", "?"};
+    unsigned           op    = (unsigned)(e->arg[2] >> 32) & 0xFF;
+    begin_event("bio", "block", "b", ns, 0);
+    fprintf(
+        g_out,
+        ",\"id\":\"0x%llx\",\"args\":{\"op\":\"%s\",\"lba\":%llu,"
+        "\"sectors\":%llu,\"drive\":%llu,\"pid\":%u}",
+        (unsigned long long)e->arg[0], ops[op < 3 ? op : 3],
+        (unsigned long long)e->arg[1],
+        (unsigned long long)(e->arg[2] & 0xFFFFFFFFULL),
+        (unsigned long long)(e->arg[2] >> 40), pid
+    );
+    break;
+  }
+  case ALCOR_TRACE_BIO_DONE:
+    begin_event("bio", "block", "e", ns, 0);
+    fprintf(
+        g_out, ",\"id\":\"0x%llx\",\"args\":{\"status\":%lld}",
+        (unsigned long long)e->arg[0], (long long)e->arg[1]
+    );
+    break;
+  case ALCOR_TRACE_ATA_READ:
+    begin_event("ata_read", "block", "B", ns, pid);
+    fprintf(
+        g_out, ",\"args\":{\"drive\":%llu,\"lba\":%llu,\"sectors\":%llu}",
+        (unsigned long long)e->arg[0], (unsigned long long)e->arg[1],
+        (unsigned long long)e->arg[2]
+    );
+    break;
+  case ALCOR_TRACE_EXT2_READ:
+    begin_event("ext2_read", "fs", "B", ns, pid);
+    fprintf(
+        g_out, ",\"args\":{\"inode\":%llu,\"offset\":%llu,\"bytes\":%llu}",
+        (unsigned long long)e->arg[0], (unsigned long long)e->arg[1],
+        (unsigned long long)e->arg[2]
+    );
+    break;
+  case ALCOR_TRACE_PIPE_READ:
+  case ALCOR_TRACE_PIPE_WRITE:
+    begin_event(
+        e->event == ALCOR_TRACE_PIPE_READ ? "pipe read" : "pipe write", "pipe",
+        "B", ns, pid
+    );
+    fprintf(
+        g_out, ",\"args\":{\"bytes\":%llu}", (unsigned long long)e->arg[0]
+    );
+    break;
+  case ALCOR_TRACE_ATA_READ_END:
+  case ALCOR_TRACE_EXT2_READ_END:
+  case ALCOR_TRACE_PIPE_READ_END:
+  case ALCOR_TRACE_PIPE_WRITE_END: {
+    const char *name = e->event == ALCOR_TRACE_ATA_READ_END    ? "ata_read"
+                       : e->event == ALCOR_TRACE_EXT2_READ_END ? "ext2_read"
+                       : e->event == ALCOR_TRACE_PIPE_READ_END ? "pipe read"
+                                                               : "pipe write";
+    begin_event(name, "", "E", ns, pid);
+    fprintf(g_out, ",\"args\":{\"ret\":%lld}", (long long)e->arg[0]);
+    break;
+  }
+  default:
+    g_nevents--;
+    return;
+  }
+  end_event();
+}
+
+/* Stream what the kernel has queued to the output. */
+static int drain(void)
+{
+  static alcor_trace_event_t buf[BATCH];
+  long                       n;
+  do {
+    n = trace_ctl(ALCOR_TRACE_READ, (unsigned long)buf, BATCH);
+    if(n < 0)
+      return -1;
+    for(long i = 0; i < n; i++)
+      emit(&buf[i]);
+  } while(n == BATCH);
+  return 0;
+}
+
+/* Trace for @p seconds, or until @p cmd (when set) exits. */
+static int record(unsigned mask, unsigned long seconds, char **cmd)
+{
+  pid_t child = -1;
+  if(trace_ctl(ALCOR_TRACE_ON, mask, 0) < 0) {
+    perror("ktrace: cannot start tracing");
+    return -1;
+  }
+  if(cmd) {
+    child = fork();
+    if(child == 0) {
+      execvp(cmd[0], cmd);
+      fprintf(stderr, "ktrace: cannot run '%s'\n", cmd[0]);
+      _exit(127);
+    }
+    if(child < 0)
+      perror("ktrace: fork");
+  }
+
+  uint64_t end = now_us() + (uint64_t)seconds * 1000000;
+  int      rc  = 0;
+  while(rc == 0) {
+    if(drain() < 0)
+      rc = -1;
+    else if(child > 0 && waitpid(child, NULL, WNOHANG) == child)
+      break;
+    else if(child <= 0 && (cmd || now_us() >= end))
+      break;
+    else
+      usleep(DRAIN_US);
+  }
+  trace_ctl(ALCOR_TRACE_OFF, 0, 0);
+  if(rc == 0 && drain() < 0)
+    rc = -1;
+  if(rc < 0)
+    perror("ktrace: cannot read events");
+  return rc;
+}
+
+/* Turn a comma-separated category list into a mask. */
+static int parse_categories(char *list, unsigned *mask)
+{
+  *mask = 0;
+  for(char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+    size_t i = 0;
+    while(i < sizeof(g_cats) / sizeof(g_cats[0]) &&
+          strcmp(g_cats[i].name, name) != 0)
+      i++;
+    if(i == sizeof(g_cats) / sizeof(g_cats[0])) {
+      fprintf(stderr, "ktrace: unknown category '%s'\n", name);
+      return -1;
+    }
+    *mask |= g_cats[i].bit;
+  }
+  return 0;
+}
+
+/**
+ * @brief ktrace main entry point.
+ */
+int main(int argc, char *argv[])
+{
+  const char *cats   = NULL;
+  const char *output = "trace.json";
+  gr_opt      opts[] = {
+      GR_STR('e', "events", &cats, "LIST", "Categories (default all)"),
+      GR_STR('o', "output", &output, "FILE", "Trace file (trace.json)"),
+      GR_END
+  };
+
+  gr_spec spec = {
+      .program = "ktrace",
+      .usage   = "[options] SECONDS | [options] -- COMMAND [ARGS...]",
+      .options = opts,
+      .epilog  = "Categories: syscall sched fault block fs pipe."
+  };
+
+  gr_rest rest;
+  int     rc = gr_parse(&spec, argc, argv, &rest, NULL, 0);
+  if(rc != GR_OK)
+    return (rc == GR_HELP) ? 0 : 1;
+  if(rest.argc == 0) {
+    gr_usage(&spec, stderr);
+    return 1;
+  }
+
+  unsigned mask = 0;
+  if(cats) {
+    char *list = strdup(cats);
+    if(!list || parse_categories(list, &mask) < 0)
+      return 1;
+  }
+
+  char         *end;
+  unsigned long seconds = strtoul(rest.argv[0], &end, 10);
+  char        **cmd     = NULL;
+  if(end == rest.argv[0] || *end || rest.argc > 1) {
+    cmd     = rest.argv;
+    seconds = 0;
+  }
+
+  alcor_trace_info_t info;
+  if(trace_ctl(ALCOR_TRACE_INFO, (unsigned long)&info, 0) < 0) {
+    perror("ktrace: cannot read the tracer state");
+    return 1;
+  }
+  g_tsc_hz = info.tsc_hz;
+  if(!g_tsc_hz) {
+    fprintf(stderr, "ktrace: TSC rate unknown, assuming 1 GHz\n");
+    g_tsc_hz = 1000000000ULL;
+  }
+
+  g_out = fopen(output, "w");
+  if(!g_out) {
+    perror(output);
+    return 1;
+  }
+  g_self = getpid();
+  fprintf(
+      g_out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":["
+             "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+             "\"args\":{\"name\":\"CPU 0\"}}"
+  );
+  g_first = 0;
+
+  rc = record(mask, seconds, cmd);
+  close_run(g_last_ns);
+  fprintf(g_out, "\n]}\n");
+  fclose(g_out);
+  if(rc < 0)
+    return 1;
+
+  if(trace_ctl(ALCOR_TRACE_INFO, (unsigned long)&info, 0) == 0)
+    printf(
+        "%zu events written to %s, %llu lost\n", g_nevents, output,
+        (unsigned long long)info.lost
+    );
+  return 0;
+}
@@ -0,0 +1,245 @@
+/**
+ * @file user/bin/pstat.c
+ * @brief Count hardware events of a command, or of the whole CPU.
+ *
+ * Usage: pstat [options] -- COMMAND [ARGS...]
+ *        pstat [options] -a SECONDS
+ *
+ * Opens one perf event per requested counter on the command's process
+ * before letting it exec, or on the CPU for -a, and prints the counts
+ * when it exits or the time is up. Events the CPU cannot count, or that
+ * find no free counter, are reported as such rather than estimated.
+ */
+
+#include <alcor2/alcor_perf.h>
+#include <errno.h>
+#include <grendizer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef SYS_perf_event_open
+  #define SYS_perf_event_open 298
+#endif
+
+#define DEFAULT_EVENTS                                                         \
+  "cycles,instructions,cache-references,cache-misses,branch-misses,"          \
+  "dtlb-load-misses"
+
+typedef struct
+{
+  const char *name;
+  uint32_t    type;
+  uint64_t    config;
+} event_t;
+
+static const event_t g_events[] = {
+    {"cycles", ALCOR_PERF_TYPE_HARDWARE, ALCOR_PERF_HW_CPU_CYCLES},
+    {"instructions", ALCOR_PERF_TYPE_HARDWARE, ALCOR_PERF_HW_INSTRUCTIONS},
+    {"ref-cycles", ALCOR_PERF_TYPE_HARDWARE, ALCOR_PERF_HW_REF_CPU_CYCLES},
+    {"cache-references", ALCOR_PERF_TYPE_HARDWARE,
+     ALCOR_PERF_HW_CACHE_REFERENCES},
+    {"cache-misses", ALCOR_PERF_TYPE_HARDWARE, ALCOR_PERF_HW_CACHE_MISSES},
+    {"branches", ALCOR_PERF_TYPE_HARDWARE,
+     ALCOR_PERF_HW_BRANCH_INSTRUCTIONS},
+    {"branch-misses", ALCOR_PERF_TYPE_HARDWARE, ALCOR_PERF_HW_BRANCH_MISSES},
+    {"dtlb-load-misses", ALCOR_PERF_TYPE_HW_CACHE,
+     ALCOR_PERF_CACHE(
+         ALCOR_PERF_CACHE_DTLB, ALCOR_PERF_CACHE_OP_READ,
+         ALCOR_PERF_CACHE_RES_MISS
+     )},
+    {"dtlb-store-misses", ALCOR_PERF_TYPE_HW_CACHE,
+     ALCOR_PERF_CACHE(
+         ALCOR_PERF_CACHE_DTLB, ALCOR_PERF_CACHE_OP_WRITE,
+         ALCOR_PERF_CACHE_RES_MISS
+     )},
+};
+
+#define NEVENTS (sizeof(g_events) / sizeof(g_events[0]))
+
+/* One requested counter: its event, fd (or -errno) and final count. */
+typedef struct
+{
+  const event_t *ev;
+  int            fd;
+  uint64_t       count;
+} counter_t;
+
+static counter_t g_ctr[NEVENTS];
+static int       g_nctr;
+
+static const event_t *find_event(const char *name)
+{
+  for(size_t i = 0; i < NEVENTS; i++) {
+    if(strcmp(g_events[i].name, name) == 0)
+      return &g_events[i];
+  }
+  return NULL;
+}
+
+/* Fill g_ctr from the comma-separated @p list. */
+static int parse_events(char *list)
+{
+  for(char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+    const event_t *ev = find_event(name);
+    if(!ev) {
+      fprintf(stderr, "pstat: unknown event '%s'\n", name);
+      return -1;
+    }
+    if(g_nctr == (int)NEVENTS) {
+      fprintf(stderr, "pstat: too many events\n");
+      return -1;
+    }
+    g_ctr[g_nctr++].ev = ev;
+  }
+  return 0;
+}
+
+/* Open every counter on @p pid (-1: the CPU); failures stay in fd. */
+static void open_counters(pid_t pid, uint64_t flags)
+{
+  for(int i = 0; i < g_nctr; i++) {
+    alcor_perf_attr_t attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type   = g_ctr[i].ev->type;
+    attr.size   = sizeof(attr);
+    attr.config = g_ctr[i].ev->config;
+    attr.flags  = flags;
+    long fd     = syscall(
+        SYS_perf_event_open, &attr, pid, pid == -1 ? 0 : -1, -1,
+        ALCOR_PERF_FLAG_FD_CLOEXEC
+    );
+    g_ctr[i].fd = fd < 0 ? -errno : (int)fd;
+  }
+}
+
+static uint64_t count_of(const char *name)
+{
+  for(int i = 0; i < g_nctr; i++) {
+    if(g_ctr[i].fd >= 0 && strcmp(g_ctr[i].ev->name, name) == 0)
+      return g_ctr[i].count;
+  }
+  return 0;
+}
+
+/* "  # 1.23 per cycle" style ratio of @p n to @p d, two decimals. */
+static void print_ratio(uint64_t n, uint64_t d, const char *what)
+{
+  if(!d)
+    return;
+  uint64_t r = n * 100 / d;
+  printf(
+      "  # %llu.%02llu %s", (unsigned long long)(r / 100),
+      (unsigned long long)(r % 100), what
+  );
+}
+
+static void report(void)
+{
+  for(int i = 0; i < g_nctr; i++) {
+    counter_t *c = &g_ctr[i];
+    if(c->fd < 0 || read(c->fd, &c->count, sizeof(c->count)) != 8) {
+      const char *why = c->fd == -EBUSY    ? "<no free counter>"
+                        : c->fd == -ENOENT ? "<not supported>"
+                                           : "<error>";
+      printf("%20s  %s\n", why, c->ev->name);
+      continue;
+    }
+    printf("%20llu  %-18s", (unsigned long long)c->count, c->ev->name);
+    if(strcmp(c->ev->name, "instructions") == 0)
+      print_ratio(c->count, count_of("cycles"), "per cycle");
+    else if(strcmp(c->ev->name, "cache-misses") == 0)
+      print_ratio(c->count * 100, count_of("cache-references"), "% of refs");
+    else if(strcmp(c->ev->name, "branch-misses") == 0)
+      print_ratio(c->count * 100, count_of("branches"), "% of branches");
+    printf("\n");
+  }
+}
+
+/* Run @p cmd with the counters attached before it execs. */
+static int run(char **cmd, uint64_t flags)
+{
+  int go[2];
+  if(pipe(go) < 0) {
+    perror("pstat: pipe");
+    return 1;
+  }
+  pid_t child = fork();
+  if(child < 0) {
+    perror("pstat: fork");
+    return 1;
+  }
+  if(child == 0) {
+    char c;
+    close(go[1]);
+    if(read(go[0], &c, 1) != 1)
+      _exit(127);
+    close(go[0]);
+    execvp(cmd[0], cmd);
+    fprintf(stderr, "pstat: cannot run '%s'\n", cmd[0]);
+    _exit(127);
+  }
+
+  close(go[0]);
+  open_counters(child, flags);
+  if(write(go[1], "g", 1) != 1)
+    perror("pstat: write");
+  close(go[1]);
+  int status = 0;
+  waitpid(child, &status, 0);
+  report();
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/**
+ * @brief pstat main entry point.
+ */
+int main(int argc, char *argv[])
+{
+  const char   *events  = DEFAULT_EVENTS;
+  unsigned long seconds = 0;
+  int           user    = 0;
+  int           kernel  = 0;
+  gr_opt        opts[]  = {
+      GR_STR('e', "events", &events, "LIST", "Comma-separated events"),
+      GR_UINT('a', "all", &seconds, "SECONDS", "Count the whole CPU"),
+      GR_FLAG('u', "user", &user, "Count user mode only"),
+      GR_FLAG('k', "kernel", &kernel, "Count kernel mode only"),
+      GR_END
+  };
+
+  gr_spec spec = {
+      .program = "pstat",
+      .usage   = "[options] -- COMMAND [ARGS...] | [options] -a SECONDS",
+      .options = opts,
+      .epilog  = "Events: cycles instructions ref-cycles cache-references\n"
+                 "cache-misses branches branch-misses dtlb-load-misses\n"
+                 "dtlb-store-misses."
+  };
+
+  gr_rest rest;
+  int     rc = gr_parse(&spec, argc, argv, &rest, NULL, 0);
+  if(rc != GR_OK)
+    return (rc == GR_HELP) ? 0 : 1;
+  if((rest.argc == 0) == (seconds == 0) || (user && kernel)) {
+    gr_usage(&spec, stderr);
+    return 1;
+  }
+
+  char *list = strdup(events);
+  if(!list || parse_events(list) < 0)
+    return 1;
+  uint64_t flags = user     ? ALCOR_PERF_EXCLUDE_KERNEL
+                   : kernel ? ALCOR_PERF_EXCLUDE_USER
+                            : 0;
+
+  if(rest.argc)
+    return run(rest.argv, flags);
+  open_counters(-1, flags);
+  sleep((unsigned)seconds);
+  report();
+  return 0;
+}
@@ -0,0 +1,13 @@
+/**
+ * sync - Write cached data to disk
+ *
+ * Usage: sync
+ */
+
+#include <unistd.h>
+
+int main(void)
+{
+  sync();
+  return 0;
+}
@@ -53,5 +53,10 @@ CXXFLAGS := -std=gnu++17 -Wall -Wextra -Os \
             -I$(USER_BASE)/../include \
             -I$(USER_BASE)/include
 
-# libgcc_eh before libc (unwind / dl_iterate_phdr from libc.a)
-CXX_SHLIBS := -lstdc++ -lgcc_eh -lc -lgcc
+# C++ apps link dynamically: the toolchain's start files, musl's loader as
+# PT_INTERP, and libc.so / libstdc++.so from /lib, whose text every one of
+# them shares. -L$(MUSL_LIB) picks the libc.so the disk ships. (Alcor's crt0
+# and user.ld stay with the static C programs.)
+CXX_CRT     := $(BUILD_DIR)/crt/alcor2_stdio_tty.o
+CXX_LDFLAGS := -no-pie -L$(MUSL_LIB) \
+               -Wl,--dynamic-linker=/lib/ld-musl-x86_64.so.1 -Wl,--gc-sections
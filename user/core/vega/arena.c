@@ -0,0 +1,162 @@
+/**
+ * @file core/vega/arena.c
+ * @brief Chunked bump allocator.
+ *
+ * The arena header sits at the start of its first chunk, so creating one is
+ * a single allocation, or none: the first chunk of the last destroyed arena
+ * is kept for the next statement. Requests too big for a normal chunk get a
+ * chunk of their own.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <vega/arena.h>
+
+#define CHUNK_SIZE 4096
+#define ALIGN      16
+
+typedef struct chunk
+{
+  struct chunk *next;
+  size_t        size; /* bytes usable after the header */
+  size_t        used;
+} chunk_t;
+
+struct vega_arena
+{
+  chunk_t *head; /* chunk being filled */
+  char    *last; /* newest block, for in-place growth */
+};
+
+#define HDR_SIZE   ((sizeof(chunk_t) + ALIGN - 1) & ~(size_t)(ALIGN - 1))
+#define ARENA_SIZE ((sizeof(vega_arena_t) + ALIGN - 1) & ~(size_t)(ALIGN - 1))
+
+static vega_arena_t *g_current;
+static chunk_t      *g_spare;
+
+static char *chunk_data(chunk_t *c)
+{
+  return (char *)c + HDR_SIZE;
+}
+
+static chunk_t *chunk_new(size_t size)
+{
+  chunk_t *c = (chunk_t *)malloc(HDR_SIZE + size);
+  if(!c)
+    return NULL;
+  c->next = NULL;
+  c->size = size;
+  c->used = 0;
+  return c;
+}
+
+vega_arena_t *arena_create(void)
+{
+  chunk_t *c = g_spare;
+  if(c)
+    g_spare = NULL;
+  else if(!(c = chunk_new(CHUNK_SIZE)))
+    return NULL;
+
+  c->next         = NULL;
+  c->used         = ARENA_SIZE;
+  vega_arena_t *a = (vega_arena_t *)chunk_data(c);
+  a->head         = c;
+  a->last         = NULL;
+  return a;
+}
+
+void arena_destroy(vega_arena_t *a)
+{
+  if(!a)
+    return;
+  if(g_current == a)
+    g_current = NULL;
+  /* Keep one normal-size chunk for the next arena. The header lives in
+   * one of these chunks, so nothing reads @p a once the loop starts. */
+  chunk_t *c = a->head;
+  while(c) {
+    chunk_t *next = c->next;
+    if(!g_spare && c->size == CHUNK_SIZE)
+      g_spare = c;
+    else
+      free(c);
+    c = next;
+  }
+}
+
+vega_arena_t *arena_use(vega_arena_t *a)
+{
+  vega_arena_t *prev = g_current;
+  g_current          = a;
+  return prev;
+}
+
+static void *arena_alloc(vega_arena_t *a, size_t n)
+{
+  n          = (n + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+  chunk_t *c = a->head;
+  if(c->size - c->used < n) {
+    /* A big block gets its own chunk behind the head, which keeps
+     * filling; anything else starts a fresh head. */
+    chunk_t *nc = chunk_new(n > CHUNK_SIZE / 4 ? n : CHUNK_SIZE);
+    if(!nc)
+      return NULL;
+    if(n > CHUNK_SIZE / 4) {
+      nc->next = c->next;
+      c->next  = nc;
+      nc->used = n;
+      return chunk_data(nc);
+    }
+    nc->next = c;
+    a->head  = nc;
+    c        = nc;
+  }
+  char *p = chunk_data(c) + c->used;
+  c->used += n;
+  a->last = p;
+  return p;
+}
+
+void *vg_alloc(size_t n)
+{
+  return g_current ? arena_alloc(g_current, n) : malloc(n);
+}
+
+void *vg_realloc(void *p, size_t old, size_t n)
+{
+  vega_arena_t *a = g_current;
+  if(!a)
+    return realloc(p, n);
+  if(!p)
+    return arena_alloc(a, n);
+
+  chunk_t *c = a->head;
+  if(p == a->last) {
+    size_t start = (size_t)((char *)p - chunk_data(c));
+    size_t need  = (n + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    if(need <= c->size - start) {
+      c->used = start + need;
+      return p;
+    }
+  }
+  void *q = arena_alloc(a, n);
+  if(q)
+    memcpy(q, p, old < n ? old : n);
+  return q;
+}
+
+void vg_free(void *p)
+{
+  if(!g_current)
+    free(p);
+}
+
+char *vg_strdup(const char *s)
+{
+  size_t n = strlen(s) + 1;
+  char  *d = (char *)vg_alloc(n);
+  if(d)
+    memcpy(d, s, n);
+  return d;
+}
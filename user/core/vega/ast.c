@@ -1,35 +1,43 @@
 /**
  * @file core/vega/ast.c
  * @brief AST node allocation and teardown.
+ *
+ * Everything is allocated with vg_alloc, so a tree built while an arena is
+ * current lives in that arena and ast_free of it is a no-op walk.
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <vega/arena.h>
 #include <vega/ast.h>
 
 #define INITIAL_ARGV_CAP 4
 
 ast_t *ast_new_cmd(void)
 {
-  ast_t *n = (ast_t *)malloc(sizeof(*n));
+  ast_t *n = (ast_t *)vg_alloc(sizeof(*n));
   if(!n)
     return NULL;
   n->kind       = AST_CMD;
-  n->u.cmd.argv = (char **)malloc(sizeof(char *) * INITIAL_ARGV_CAP);
+  n->u.cmd.argv = (char **)vg_alloc(sizeof(char *) * INITIAL_ARGV_CAP);
   if(!n->u.cmd.argv) {
-    free(n);
+    vg_free(n);
     return NULL;
   }
-  n->u.cmd.argv[0]   = NULL;
-  n->u.cmd.argc      = 0;
-  n->u.cmd.cap       = INITIAL_ARGV_CAP;
-  n->u.cmd.redirs    = NULL;
-  n->u.cmd.fail_fast = 0;
+  n->u.cmd.argv[0]      = NULL;
+  n->u.cmd.argc         = 0;
+  n->u.cmd.cap          = INITIAL_ARGV_CAP;
+  n->u.cmd.redirs       = NULL;
+  n->u.cmd.fail_fast    = 0;
+  n->u.cmd.resolved     = 0;
+  n->u.cmd.resolved_gen = 0;
+  n->u.cmd.resolved_fn  = NULL;
   return n;
 }
 
 int ast_cmd_add_redir(ast_t *n, redir_kind_t kind, char *target)
 {
-  redir_t *r = (redir_t *)malloc(sizeof(*r));
+  redir_t *r = (redir_t *)vg_alloc(sizeof(*r));
   if(!r)
     return -1;
   r->kind   = kind;
@@ -48,7 +56,9 @@ int ast_cmd_push_arg(ast_t *n, char *arg)
 {
   if(n->u.cmd.argc + 1 >= n->u.cmd.cap) {
     int    new_cap = n->u.cmd.cap * 2;
-    char **new_arr = (char **)realloc(n->u.cmd.argv, sizeof(char *) * new_cap);
+    char **new_arr = (char **)vg_realloc(
+        n->u.cmd.argv, sizeof(char *) * n->u.cmd.cap, sizeof(char *) * new_cap
+    );
     if(!new_arr)
       return -1;
     n->u.cmd.argv = new_arr;
@@ -61,7 +71,7 @@ int ast_cmd_push_arg(ast_t *n, char *arg)
 
 ast_t *ast_new_binop(ast_kind_t kind, ast_t *left, ast_t *right)
 {
-  ast_t *n = (ast_t *)malloc(sizeof(*n));
+  ast_t *n = (ast_t *)vg_alloc(sizeof(*n));
   if(!n) {
     ast_free(left);
     ast_free(right);
@@ -75,7 +85,7 @@ ast_t *ast_new_binop(ast_kind_t kind, ast_t *left, ast_t *right)
 
 ast_t *ast_new_if(ast_t *cond, ast_t *then_branch, ast_t *else_branch)
 {
-  ast_t *n = (ast_t *)malloc(sizeof(*n));
+  ast_t *n = (ast_t *)vg_alloc(sizeof(*n));
   if(!n) {
     ast_free(cond);
     ast_free(then_branch);
@@ -91,7 +101,7 @@ ast_t *ast_new_if(ast_t *cond, ast_t *then_branch, ast_t *else_branch)
 
 ast_t *ast_new_while(ast_t *cond, ast_t *body)
 {
-  ast_t *n = (ast_t *)malloc(sizeof(*n));
+  ast_t *n = (ast_t *)vg_alloc(sizeof(*n));
   if(!n) {
     ast_free(cond);
     ast_free(body);
@@ -107,22 +117,24 @@ ast_t *ast_new_while(ast_t *cond, ast_t *body)
 
 ast_t *ast_new_for(char *name)
 {
-  ast_t *n = (ast_t *)malloc(sizeof(*n));
+  ast_t *n = (ast_t *)vg_alloc(sizeof(*n));
   if(!n) {
-    free(name);
+    vg_free(name);
     return NULL;
   }
   n->kind         = AST_FOR;
   n->u.for_.name  = name;
-  n->u.for_.words = (char **)malloc(sizeof(char *) * INITIAL_FOR_CAP);
+  n->u.for_.words = (char **)vg_alloc(sizeof(char *) * INITIAL_FOR_CAP);
   if(!n->u.for_.words) {
-    free(name);
-    free(n);
+    vg_free(name);
+    vg_free(n);
     return NULL;
   }
-  n->u.for_.nwords = 0;
-  n->u.for_.cap    = INITIAL_FOR_CAP;
-  n->u.for_.body   = NULL;
+  n->u.for_.nwords  = 0;
+  n->u.for_.cap     = INITIAL_FOR_CAP;
+  n->u.for_.body    = NULL;
+  n->u.for_.par     = 0;
+  n->u.for_.workers = NULL;
   return n;
 }
 
@@ -130,8 +142,10 @@ int ast_for_push_word(ast_t *n, char *word)
 {
   if(n->u.for_.nwords >= n->u.for_.cap) {
     int    new_cap = n->u.for_.cap * 2;
-    char **new_arr =
-        (char **)realloc(n->u.for_.words, sizeof(char *) * new_cap);
+    char **new_arr = (char **)vg_realloc(
+        n->u.for_.words, sizeof(char *) * n->u.for_.cap,
+        sizeof(char *) * new_cap
+    );
     if(!new_arr)
       return -1;
     n->u.for_.words = new_arr;
@@ -148,13 +162,13 @@ void ast_for_set_body(ast_t *n, ast_t *body)
 
 ast_t *ast_new_fn(char *name, char **arg_names, int n_args, ast_t *body)
 {
-  ast_t *n = (ast_t *)malloc(sizeof(*n));
+  ast_t *n = (ast_t *)vg_alloc(sizeof(*n));
   if(!n) {
-    free(name);
+    vg_free(name);
     if(arg_names) {
       for(int i = 0; i < n_args; i++)
-        free(arg_names[i]);
-      free(arg_names);
+        vg_free(arg_names[i]);
+      vg_free(arg_names);
     }
     ast_free(body);
     return NULL;
@@ -169,10 +183,10 @@ ast_t *ast_new_fn(char *name, char **arg_names, int n_args, ast_t *body)
 
 ast_t *ast_new_let(char *name, char *value)
 {
-  ast_t *n = (ast_t *)malloc(sizeof(*n));
+  ast_t *n = (ast_t *)vg_alloc(sizeof(*n));
   if(!n) {
-    free(name);
-    free(value);
+    vg_free(name);
+    vg_free(value);
     return NULL;
   }
   n->kind         = AST_LET;
@@ -181,18 +195,30 @@ ast_t *ast_new_let(char *name, char *value)
   return n;
 }
 
+ast_t *ast_new_bg(ast_t *body)
+{
+  ast_t *n = (ast_t *)vg_alloc(sizeof(*n));
+  if(!n) {
+    ast_free(body);
+    return NULL;
+  }
+  n->kind      = AST_BG;
+  n->u.bg.body = body;
+  return n;
+}
+
 #define INITIAL_PIPELINE_CAP 2
 
 ast_t *ast_new_pipeline(void)
 {
-  ast_t *n = (ast_t *)malloc(sizeof(*n));
+  ast_t *n = (ast_t *)vg_alloc(sizeof(*n));
   if(!n)
     return NULL;
   n->kind = AST_PIPE;
   n->u.pipeline.stages =
-      (ast_t **)malloc(sizeof(ast_t *) * INITIAL_PIPELINE_CAP);
+      (ast_t **)vg_alloc(sizeof(ast_t *) * INITIAL_PIPELINE_CAP);
   if(!n->u.pipeline.stages) {
-    free(n);
+    vg_free(n);
     return NULL;
   }
   n->u.pipeline.n   = 0;
@@ -204,8 +230,10 @@ int ast_pipeline_push(ast_t *n, ast_t *stage)
 {
   if(n->u.pipeline.n >= n->u.pipeline.cap) {
     int     new_cap = n->u.pipeline.cap * 2;
-    ast_t **new_arr =
-        (ast_t **)realloc(n->u.pipeline.stages, sizeof(ast_t *) * new_cap);
+    ast_t **new_arr = (ast_t **)vg_realloc(
+        n->u.pipeline.stages, sizeof(ast_t *) * n->u.pipeline.cap,
+        sizeof(ast_t *) * new_cap
+    );
     if(!new_arr)
       return -1;
     n->u.pipeline.stages = new_arr;
@@ -222,12 +250,12 @@ void ast_free(ast_t *n)
   switch(n->kind) {
   case AST_CMD:
     for(int i = 0; i < n->u.cmd.argc; i++)
-      free(n->u.cmd.argv[i]);
-    free(n->u.cmd.argv);
+      vg_free(n->u.cmd.argv[i]);
+    vg_free(n->u.cmd.argv);
     for(redir_t *r = n->u.cmd.redirs; r;) {
       redir_t *next = r->next;
-      free(r->target);
-      free(r);
+      vg_free(r->target);
+      vg_free(r);
       r = next;
     }
     break;
@@ -240,7 +268,7 @@ void ast_free(ast_t *n)
   case AST_PIPE:
     for(int i = 0; i < n->u.pipeline.n; i++)
       ast_free(n->u.pipeline.stages[i]);
-    free(n->u.pipeline.stages);
+    vg_free(n->u.pipeline.stages);
     break;
   case AST_IF:
     ast_free(n->u.if_.cond);
@@ -252,27 +280,204 @@ void ast_free(ast_t *n)
     ast_free(n->u.while_.body);
     break;
   case AST_FOR:
-    free(n->u.for_.name);
+    vg_free(n->u.for_.name);
     for(int i = 0; i < n->u.for_.nwords; i++)
-      free(n->u.for_.words[i]);
-    free(n->u.for_.words);
+      vg_free(n->u.for_.words[i]);
+    vg_free(n->u.for_.words);
+    vg_free(n->u.for_.workers);
     ast_free(n->u.for_.body);
     break;
   case AST_FN:
-    /* Fields may have been NULL'd out when the function was registered
-     * (the table steals ownership). Each free() is NULL-safe. */
-    free(n->u.fn.name);
+    /* arg_names is NULL for a function without parameters. */
+    vg_free(n->u.fn.name);
     if(n->u.fn.arg_names) {
       for(int i = 0; i < n->u.fn.n_args; i++)
-        free(n->u.fn.arg_names[i]);
-      free(n->u.fn.arg_names);
+        vg_free(n->u.fn.arg_names[i]);
+      vg_free(n->u.fn.arg_names);
     }
     ast_free(n->u.fn.body);
     break;
   case AST_LET:
-    free(n->u.let_.name);
-    free(n->u.let_.value);
+    vg_free(n->u.let_.name);
+    vg_free(n->u.let_.value);
     break;
+  case AST_BG:
+    ast_free(n->u.bg.body);
+    break;
+  }
+  vg_free(n);
+}
+
+/* strdup that maps NULL to NULL; sets *failed when allocation fails. */
+static char *dup_str(const char *s, int *failed)
+{
+  if(!s)
+    return NULL;
+  char *d = vg_strdup(s);
+  if(!d)
+    *failed = 1;
+  return d;
+}
+
+/* Clone @p n into @p *out; returns -1 on allocation failure, in which case
+ * *out is NULL. */
+static int clone_child(const ast_t *n, ast_t **out)
+{
+  *out = ast_clone(n);
+  return (n && !*out) ? -1 : 0;
+}
+
+static ast_t *clone_cmd(const ast_t *n)
+{
+  ast_t *c = ast_new_cmd();
+  if(!c)
+    return NULL;
+  int failed = 0;
+  for(int i = 0; i < n->u.cmd.argc && !failed; i++) {
+    char *a = dup_str(n->u.cmd.argv[i], &failed);
+    if(a && ast_cmd_push_arg(c, a) < 0) {
+      vg_free(a);
+      failed = 1;
+    }
+  }
+  for(const redir_t *r = n->u.cmd.redirs; r && !failed; r = r->next) {
+    char *t = dup_str(r->target, &failed);
+    if(!failed && ast_cmd_add_redir(c, r->kind, t) < 0) {
+      vg_free(t);
+      failed = 1;
+    }
+  }
+  if(failed) {
+    ast_free(c);
+    return NULL;
+  }
+  c->u.cmd.fail_fast = n->u.cmd.fail_fast;
+  return c;
+}
+
+static ast_t *clone_for(const ast_t *n)
+{
+  int    failed = 0;
+  ast_t *c      = ast_new_for(dup_str(n->u.for_.name, &failed));
+  if(!c)
+    return NULL;
+  for(int i = 0; i < n->u.for_.nwords && !failed; i++) {
+    char *w = dup_str(n->u.for_.words[i], &failed);
+    if(w && ast_for_push_word(c, w) < 0) {
+      vg_free(w);
+      failed = 1;
+    }
+  }
+  c->u.for_.par     = n->u.for_.par;
+  c->u.for_.workers = dup_str(n->u.for_.workers, &failed);
+  if(failed || clone_child(n->u.for_.body, &c->u.for_.body) < 0) {
+    ast_free(c);
+    return NULL;
+  }
+  return c;
+}
+
+static ast_t *clone_fn(const ast_t *n)
+{
+  int    failed = 0;
+  char  *name   = dup_str(n->u.fn.name, &failed);
+  char **args   = NULL;
+  int    n_args = 0;
+  if(n->u.fn.arg_names && n->u.fn.n_args > 0) {
+    args = (char **)vg_alloc((size_t)n->u.fn.n_args * sizeof(*args));
+    if(args)
+      memset(args, 0, (size_t)n->u.fn.n_args * sizeof(*args));
+    else
+      failed = 1;
+    for(; !failed && n_args < n->u.fn.n_args; n_args++)
+      args[n_args] = dup_str(n->u.fn.arg_names[n_args], &failed);
+  }
+  ast_t *body = NULL;
+  if(!failed && clone_child(n->u.fn.body, &body) < 0)
+    failed = 1;
+  /* ast_new_fn frees what it was given if it fails, and so does ast_free
+   * of the half-built node below. */
+  ast_t *c = ast_new_fn(name, args, n->u.fn.n_args, body);
+  if(c && failed) {
+    ast_free(c);
+    return NULL;
+  }
+  return c;
+}
+
+ast_t *ast_clone(const ast_t *n)
+{
+  if(!n)
+    return NULL;
+
+  ast_t *a, *b, *e;
+  switch(n->kind) {
+  case AST_CMD:
+    return clone_cmd(n);
+  case AST_AND:
+  case AST_OR:
+  case AST_SEQ:
+    if(clone_child(n->u.binop.left, &a) < 0)
+      return NULL;
+    if(clone_child(n->u.binop.right, &b) < 0) {
+      ast_free(a);
+      return NULL;
+    }
+    return ast_new_binop(n->kind, a, b);
+  case AST_PIPE: {
+    ast_t *c = ast_new_pipeline();
+    if(!c)
+      return NULL;
+    for(int i = 0; i < n->u.pipeline.n; i++) {
+      ast_t *s = ast_clone(n->u.pipeline.stages[i]);
+      if(!s || ast_pipeline_push(c, s) < 0) {
+        ast_free(s);
+        ast_free(c);
+        return NULL;
+      }
+    }
+    return c;
+  }
+  case AST_IF:
+    if(clone_child(n->u.if_.cond, &a) < 0)
+      return NULL;
+    if(clone_child(n->u.if_.then_branch, &b) < 0) {
+      ast_free(a);
+      return NULL;
+    }
+    if(clone_child(n->u.if_.else_branch, &e) < 0) {
+      ast_free(a);
+      ast_free(b);
+      return NULL;
+    }
+    return ast_new_if(a, b, e);
+  case AST_WHILE:
+    if(clone_child(n->u.while_.cond, &a) < 0)
+      return NULL;
+    if(clone_child(n->u.while_.body, &b) < 0) {
+      ast_free(a);
+      return NULL;
+    }
+    return ast_new_while(a, b);
+  case AST_FOR:
+    return clone_for(n);
+  case AST_FN:
+    return clone_fn(n);
+  case AST_LET: {
+    int   failed = 0;
+    char *name   = dup_str(n->u.let_.name, &failed);
+    char *value  = dup_str(n->u.let_.value, &failed);
+    if(failed) {
+      vg_free(name);
+      vg_free(value);
+      return NULL;
+    }
+    return ast_new_let(name, value);
+  }
+  case AST_BG:
+    if(clone_child(n->u.bg.body, &a) < 0)
+      return NULL;
+    return ast_new_bg(a);
   }
-  free(n);
+  return NULL;
 }
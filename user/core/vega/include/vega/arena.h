@@ -0,0 +1,45 @@
+/**
+ * @file vega/arena.h
+ * @brief Bump arenas owning a parsed tree and everything hanging off it.
+ *
+ * Tokens, AST nodes, argv arrays and strings are carved out of one arena per
+ * statement and released together by arena_destroy, instead of being freed
+ * node by node. The core allocates through vg_alloc and friends, which use
+ * whichever arena is current (arena_use) and fall back to the C heap when
+ * none is; vg_free is a no-op inside an arena. A tree must therefore only
+ * ever be freed the way it was allocated.
+ */
+
+#ifndef VEGA_ARENA_H
+#define VEGA_ARENA_H
+
+#include <stddef.h>
+
+typedef struct vega_arena vega_arena_t;
+
+/** @brief New empty arena (reuses a cached first chunk when one is free). */
+vega_arena_t *arena_create(void);
+
+/** @brief Release @p a and everything allocated from it. NULL-safe. */
+void arena_destroy(vega_arena_t *a);
+
+/**
+ * @brief Make @p a (or NULL, the C heap) the target of vg_* allocations.
+ * @return The previously current arena, to restore afterwards.
+ */
+vega_arena_t *arena_use(vega_arena_t *a);
+
+/** @brief Allocate @p n bytes, 16-byte aligned, from the current arena. */
+void *vg_alloc(size_t n);
+
+/** @brief Resize @p p from @p old to @p n bytes; grows in place when @p p is
+ *         the arena's newest block. */
+void *vg_realloc(void *p, size_t old, size_t n);
+
+/** @brief Free @p p when allocated from the heap; no-op in an arena. */
+void vg_free(void *p);
+
+/** @brief Copy @p s with vg_alloc. */
+char *vg_strdup(const char *s);
+
+#endif /* VEGA_ARENA_H */
@@ -29,6 +29,7 @@ typedef enum
   AST_FOR,   /* for var in words... { body } */
   AST_FN,    /* fn name(args) { body } — registers a function on exec */
   AST_LET, /* let NAME VALUE — variable assignment (value expanded at exec) */
+  AST_BG,  /* body & — runs body as a background job */
 } ast_kind_t;
 
 typedef enum
@@ -56,9 +57,10 @@ typedef struct redir
 } redir_t;
 
 /**
- * @brief AST node. CMD nodes own a heap argv and an optional redir list;
- * binary nodes own their two children. The union is grown by later phases
- * (pipes, control flow).
+ * @brief AST node. CMD nodes own an argv and an optional redir list; binary
+ * nodes own their two children. All of it comes from vg_alloc, normally in
+ * the arena of the statement or function definition (vega/arena.h). The
+ * union is grown by later phases (pipes, control flow).
  */
 typedef struct ast_node
 {
@@ -73,6 +75,12 @@ typedef struct ast_node
       redir_t *redirs;
       int      fail_fast; /* set by parser when argv[0] ended with `!`;
                              shell exits with the cmd's status if non-zero */
+      /* Dispatch cache, written only by the runtime (sdk/vega/exec.c):
+       * what argv[0] resolved to, valid while the function table is at
+       * generation resolved_gen. Zero from the parser means unresolved. */
+      int         resolved;
+      unsigned    resolved_gen;
+      const void *resolved_fn;
     } cmd;
     struct
     {
@@ -104,6 +112,8 @@ typedef struct ast_node
       int              nwords;
       int              cap;
       struct ast_node *body;
+      int              par;     /* `par [N] for`: bodies run in parallel */
+      char            *workers; /* unexpanded N; NULL for one per CPU */
     } for_;
     struct
     {
@@ -117,6 +127,10 @@ typedef struct ast_node
       char *name;  /* variable name */
       char *value; /* unexpanded source word; expand_word at exec time */
     } let_;
+    struct
+    {
+      struct ast_node *body;
+    } bg;
   } u;
 } ast_t;
 
@@ -177,8 +191,8 @@ void ast_for_set_body(ast_t *n, ast_t *body);
 /**
  * @brief Allocate an AST_FN node, taking ownership of @p name, @p arg_names
  * (heap array of @p n_args heap strings; may be NULL when n_args == 0), and
- * @p body. Executing this node registers the function (the table steals
- * the body and arg_names).
+ * @p body. Executing this node registers a copy of the function, so the
+ * node itself is never modified.
  */
 ast_t *ast_new_fn(char *name, char **arg_names, int n_args, ast_t *body);
 
@@ -189,6 +203,12 @@ ast_t *ast_new_fn(char *name, char **arg_names, int n_args, ast_t *body);
  */
 ast_t *ast_new_let(char *name, char *value);
 
+/**
+ * @brief Allocate an AST_BG node, taking ownership of @p body. On allocation
+ * failure @p body is freed and NULL is returned.
+ */
+ast_t *ast_new_bg(ast_t *body);
+
 /** @brief Allocate an empty AST_PIPE node. */
 ast_t *ast_new_pipeline(void);
 
@@ -202,4 +222,11 @@ int ast_pipeline_push(ast_t *n, ast_t *stage);
 /** @brief Free an AST node and everything it owns. NULL-safe. */
 void ast_free(ast_t *n);
 
+/**
+ * @brief Deep-copy @p n (NULL-safe) into the current arena. The copy's
+ *        dispatch caches start unresolved.
+ * @return The copy, or NULL on allocation failure (nothing leaks).
+ */
+ast_t *ast_clone(const ast_t *n);
+
 #endif /* VEGA_AST_H */
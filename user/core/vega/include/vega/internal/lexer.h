@@ -21,6 +21,7 @@ typedef enum
   TOK_STRING,       /* double-quoted; expansion lands later */
   TOK_PIPE,         /* |  */
   TOK_AND,          /* && */
+  TOK_AMP,          /* &  */
   TOK_OR,           /* || */
   TOK_SEMI,         /* ;  */
   TOK_REDIR_OUT,    /* >  */
@@ -35,8 +36,9 @@ typedef enum
 } tok_kind_t;
 
 /**
- * @brief One lexed token. @c text is heap-allocated for WORD/STRING and must
- * be freed by the consumer; for operator tokens it is NULL.
+ * @brief One lexed token. @c text comes from vg_alloc for WORD/STRING and is
+ * released with lex_token_free (a no-op in an arena); for operator tokens it
+ * is NULL.
  */
 typedef struct
 {
@@ -11,8 +11,9 @@
 /**
  * @brief Parse @p line into an AST.
  *
- * On success returns a freshly allocated AST that the caller must
- * @ref ast_free. On parse error prints a diagnostic and returns NULL.
+ * The tree, and every token string in it, is allocated in the current arena
+ * (arena_use), and goes away with it. On parse error prints a diagnostic
+ * and returns NULL; partial nodes stay in the arena until it is destroyed.
  */
 ast_t *vega_parse(const char *line);
 
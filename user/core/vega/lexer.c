@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <vega/arena.h>
 #include <vega/host.h>
 #include <vega/internal/host.h>
 #include <vega/internal/lexer.h>
@@ -56,7 +57,7 @@ static tok_t read_squote(lexer_t *L)
     return t;
   }
   size_t len = (size_t)(L->cur - start);
-  char  *out = (char *)malloc(len + 2);
+  char  *out = (char *)vg_alloc(len + 2);
   if(!out) {
     L->error = 1;
     t.kind   = TOK_EOF;
@@ -96,7 +97,7 @@ static tok_t read_dquote(lexer_t *L)
     t.kind   = TOK_EOF;
     return t;
   }
-  char *out = (char *)malloc(n + 1);
+  char *out = (char *)vg_alloc(n + 1);
   if(!out) {
     L->error = 1;
     t.kind   = TOK_EOF;
@@ -168,7 +169,7 @@ static tok_t read_word(lexer_t *L)
     scan++;
     n++;
   }
-  char *out = (char *)malloc(n + 1);
+  char *out = (char *)vg_alloc(n + 1);
   if(!out) {
     L->error = 1;
     t.kind   = TOK_EOF;
@@ -258,11 +259,7 @@ static tok_t scan_one(lexer_t *L)
       L->cur++;
       t.kind = TOK_AND;
     } else {
-      (void)write(
-          STDOUT_FILENO, ("vega: '&' (background) not yet supported\n"),
-          strlen(("vega: '&' (background) not yet supported\n"))
-      );
-      L->error = 1;
+      t.kind = TOK_AMP;
     }
     return t;
   case ';':
@@ -338,7 +335,7 @@ tok_t lex_peek(lexer_t *L)
 void lex_token_free(tok_t *t)
 {
   if(t->text) {
-    free(t->text);
+    vg_free(t->text);
     t->text = NULL;
   }
 }
@@ -393,7 +390,7 @@ char *lex_read_heredoc_body(lexer_t *L, const char *delim)
 
 done: {
   size_t len = (size_t)(body_end - body_start);
-  char  *out = (char *)malloc(len + 1);
+  char  *out = (char *)vg_alloc(len + 1);
   if(!out) {
     L->error = 1;
     return NULL;
@@ -418,6 +415,8 @@ const char *tok_name(tok_kind_t k)
     return "'|'";
   case TOK_AND:
     return "'&&'";
+  case TOK_AMP:
+    return "'&'";
   case TOK_OR:
     return "'||'";
   case TOK_SEMI:
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <vega/arena.h>
 #include <vega/host.h>
 #include <vega/internal/host.h>
 #include <vega/internal/lexer.h>
@@ -90,7 +91,7 @@ static ast_t *parse_command(lexer_t *L)
     if(t.kind == TOK_WORD || t.kind == TOK_STRING) {
       lex_next(L);
       if(ast_cmd_push_arg(n, t.text) < 0) {
-        free(t.text);
+        vg_free(t.text);
         ast_free(n);
         return NULL;
       }
@@ -110,14 +111,14 @@ static ast_t *parse_command(lexer_t *L)
       }
 
       char *body = lex_read_heredoc_body(L, delim_tok.text);
-      free(delim_tok.text);
+      vg_free(delim_tok.text);
       if(!body) {
         ast_free(n);
         return NULL;
       }
 
       if(ast_cmd_add_redir(n, REDIR_HEREDOC, body) < 0) {
-        free(body);
+        vg_free(body);
         ast_free(n);
         return NULL;
       }
@@ -137,7 +138,7 @@ static ast_t *parse_command(lexer_t *L)
         return NULL;
       }
       if(ast_cmd_add_redir(n, rk, target.text) < 0) {
-        free(target.text);
+        vg_free(target.text);
         ast_free(n);
         return NULL;
       }
@@ -281,7 +282,7 @@ static ast_t *parse_let(lexer_t *L)
   tok_t value = lex_next(L);
   if(value.kind != TOK_WORD && value.kind != TOK_STRING) {
     diag_unexpected(value.kind);
-    free(name.text);
+    vg_free(name.text);
     lex_token_free(&value);
     L->error = 1;
     return NULL;
@@ -308,7 +309,7 @@ static ast_t *parse_for(lexer_t *L)
         STDOUT_FILENO, ("vega: expected 'in' after for variable\n"),
         strlen(("vega: expected 'in' after for variable\n"))
     );
-    free(name_tok.text);
+    vg_free(name_tok.text);
     L->error = 1;
     return NULL;
   }
@@ -325,7 +326,7 @@ static ast_t *parse_for(lexer_t *L)
       break;
     lex_next(L);
     if(ast_for_push_word(n, t.text) < 0) {
-      free(t.text);
+      vg_free(t.text);
       ast_free(n);
       return NULL;
     }
@@ -356,7 +357,7 @@ static ast_t *parse_fn(lexer_t *L)
         STDOUT_FILENO, ("vega: expected '(' after fn name\n"),
         strlen(("vega: expected '(' after fn name\n"))
     );
-    free(name_tok.text);
+    vg_free(name_tok.text);
     L->error = 1;
     return NULL;
   }
@@ -371,13 +372,15 @@ static ast_t *parse_fn(lexer_t *L)
     tok_t t = lex_next(L);
     if(n_args >= cap) {
       int    new_cap = (cap == 0) ? 4 : cap * 2;
-      char **new_arr = (char **)realloc(arg_names, sizeof(char *) * new_cap);
+      char **new_arr = (char **)vg_realloc(
+          arg_names, sizeof(char *) * cap, sizeof(char *) * new_cap
+      );
       if(!new_arr) {
-        free(t.text);
+        vg_free(t.text);
         for(int i = 0; i < n_args; i++)
-          free(arg_names[i]);
-        free(arg_names);
-        free(name_tok.text);
+          vg_free(arg_names[i]);
+        vg_free(arg_names);
+        vg_free(name_tok.text);
         L->error = 1;
         return NULL;
       }
@@ -391,9 +394,9 @@ static ast_t *parse_fn(lexer_t *L)
     diag_unexpected(lex_peek(L).kind);
     L->error = 1;
     for(int i = 0; i < n_args; i++)
-      free(arg_names[i]);
-    free(arg_names);
-    free(name_tok.text);
+      vg_free(arg_names[i]);
+    vg_free(arg_names);
+    vg_free(name_tok.text);
     return NULL;
   }
   lex_next(L); /* consume ')' */
@@ -401,17 +404,49 @@ static ast_t *parse_fn(lexer_t *L)
   ast_t *body = parse_brace_body(L);
   if(L->error) {
     for(int i = 0; i < n_args; i++)
-      free(arg_names[i]);
-    free(arg_names);
-    free(name_tok.text);
+      vg_free(arg_names[i]);
+    vg_free(arg_names);
+    vg_free(name_tok.text);
     return NULL;
   }
 
   return ast_new_fn(name_tok.text, arg_names, n_args, body);
 }
 
+/* `par` consumed by parse_unit; expects an optional worker count word and
+ * then a `for` loop, whose bodies are run in parallel. */
+static ast_t *parse_par(lexer_t *L)
+{
+  char *workers = NULL;
+  tok_t t       = lex_peek(L);
+  if((t.kind == TOK_WORD && strcmp(t.text, "for") != 0) ||
+     t.kind == TOK_STRING) {
+    lex_next(L);
+    workers = t.text;
+  }
+
+  if(!match_keyword(L, "for")) {
+    (void)write(
+        STDOUT_FILENO, ("vega: expected 'for' after par\n"),
+        strlen(("vega: expected 'for' after par\n"))
+    );
+    vg_free(workers);
+    L->error = 1;
+    return NULL;
+  }
+
+  ast_t *n = parse_for(L);
+  if(!n) {
+    vg_free(workers);
+    return NULL;
+  }
+  n->u.for_.par     = 1;
+  n->u.for_.workers = workers;
+  return n;
+}
+
 /* A "unit" is a single command in the pipeline grammar — either a compound
- * statement (`if`, `while`, `for`, `fn`) or a simple command. */
+ * statement (`if`, `while`, `for`, `par for`, `fn`) or a simple command. */
 static ast_t *parse_unit(lexer_t *L)
 {
   tok_t t = lex_peek(L);
@@ -430,6 +465,11 @@ static ast_t *parse_unit(lexer_t *L)
     lex_token_free(&t);
     return parse_for(L);
   }
+  if(t.kind == TOK_WORD && strcmp(t.text, "par") == 0) {
+    lex_next(L);
+    lex_token_free(&t);
+    return parse_par(L);
+  }
   if(t.kind == TOK_WORD && strcmp(t.text, "fn") == 0) {
     lex_next(L);
     lex_token_free(&t);
@@ -507,19 +547,43 @@ static ast_t *parse_and_or(lexer_t *L)
   return left;
 }
 
-static ast_t *parse_list(lexer_t *L)
+/* An and-or list, run in the background when '&' follows it. Sets *sep
+ * when a separator (';' or '&') was consumed after it. */
+static ast_t *parse_item(lexer_t *L, int *sep)
 {
-  ast_t *left = parse_and_or(L);
+  ast_t *item = parse_and_or(L);
+  *sep        = 0;
   if(L->error)
     return NULL;
 
-  while(1) {
-    tok_t t = lex_peek(L);
-    if(t.kind != TOK_SEMI)
-      break;
-    lex_next(L); /* consume ';' */
+  tok_kind_t k = lex_peek(L).kind;
+  if(k == TOK_AMP) {
+    lex_next(L);
+    *sep = 1;
+    if(!item) {
+      diag_unexpected(TOK_AMP);
+      L->error = 1;
+      return NULL;
+    }
+    item = ast_new_bg(item);
+    if(!item)
+      L->error = 1;
+  } else if(k == TOK_SEMI) {
+    lex_next(L);
+    *sep = 1;
+  }
+  return item;
+}
+
+static ast_t *parse_list(lexer_t *L)
+{
+  int    sep;
+  ast_t *left = parse_item(L, &sep);
+  if(L->error)
+    return NULL;
 
-    ast_t *right = parse_and_or(L);
+  while(sep) {
+    ast_t *right = parse_item(L, &sep);
     if(L->error) {
       ast_free(left);
       return NULL;
@@ -1,14 +1,17 @@
 /* Stdio buffering for Alcor2 userland.
  *
  * - TTY stdin: unbuffered so getchar/wgetch sees keys without line delay.
- * - TTY or pipe stdout: when the shell relays child stdout through a pipe into
- *   the FB terminal, isatty(1) is false and musl uses *full* buffering.
- *   ncurses refresh() then keeps CSI output in memory until exit — blank
- *   screen until getch returns. Force unbuffered stdout (and stderr) so every
- *   write reaches the relay immediately.
+ * - stdout: line-buffered on a terminal, fully buffered otherwise, with a
+ *   larger buffer than musl's 1 KiB default so `cmd > bigfile` and
+ *   `cmd | other` cost one write per 16 KiB instead of one per printf.
+ *   The kernel answers the TTY ioctls behind isatty() only for the console
+ *   and for pipes a terminal relay has marked with ALCOR2_IOC_PIPE_SET_TTY,
+ *   so output that reaches the screen through a relay is still flushed at
+ *   each newline; ncurses flushes its own output on refresh() either way.
+ * - stderr: unbuffered, as C requires.
  *
- * Trade-off: redirections like `cmd > bigfile` do more syscalls; acceptable
- * on this system.
+ * musl flushes stdout only at a newline, on fflush() or at exit, not when
+ * stdin is read: prompts without a newline must fflush(stdout).
  *
  * Ncurses needs a real TERM= name. Kernels often leave TERM unset or
  * "unknown", which yields: Error opening terminal: unknown */
@@ -17,6 +20,11 @@
 #include <string.h>
 #include <unistd.h>
 
+/* Bytes stdout collects before a write when it is not a terminal. */
+#define ALCOR2_STDOUT_BUF 16384
+
+static char alcor2_stdout_buf[ALCOR2_STDOUT_BUF];
+
 __attribute__((constructor)) static void alcor2_stdio_tty_buffering(void)
 {
   const char *t = getenv("TERM");
@@ -31,6 +39,9 @@ __attribute__((constructor)) static void alcor2_stdio_tty_buffering(void)
   if(isatty(STDIN_FILENO))
     (void)setvbuf(stdin, NULL, _IONBF, 0);
 
-  (void)setvbuf(stdout, NULL, _IONBF, 0);
+  (void)setvbuf(
+      stdout, alcor2_stdout_buf, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF,
+      sizeof(alcor2_stdout_buf)
+  );
   (void)setvbuf(stderr, NULL, _IONBF, 0);
 }
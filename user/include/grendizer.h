@@ -24,6 +24,14 @@
  * Subcommands may be nested arbitrarily deep.  @c help and @c --help are
  * handled automatically at every level.
  *
+ * @par Lookup indexes
+ * By default every option and subcommand token is matched by scanning its
+ * table.  Tools with large tables can attach a precomputed ::gr_index to
+ * the ::gr_spec and a name-sorted order to each command table; both can be
+ * built at run time (::gr_index_build, ::gr_cmd_order) or, from C++, at
+ * compile time (@c gr::make_index, @c gr::cmd_order).  Matching rules are
+ * unchanged.
+ *
  * @par Quick start
  * @code
  * #include <grendizer.h>
@@ -229,6 +237,32 @@ extern "C"
 
   /** @} */
 
+/** @brief Most options a ::gr_index can describe. */
+#define GR_INDEX_MAX 512
+
+  /**
+   * @brief Precomputed lookup tables for one ::gr_opt array.
+   *
+   * With an index, ::gr_parse finds a short option in one table access and
+   * a long option by binary search instead of scanning the option array
+   * for every token.  When two entries share a name the first one still
+   * wins.  Fill one with ::gr_index_build or, in C++, @c gr::make_index .
+   */
+  typedef struct gr_index
+  {
+    /** Option array described; an index for another array is ignored. */
+    const gr_opt *options;
+
+    /** Number of entries used in @c by_long . */
+    size_t long_count;
+
+    /** Position + 1 in @c options of each short name; @c 0 if unused. */
+    unsigned short by_short[256];
+
+    /** Positions of the options that have a long name, sorted by it. */
+    unsigned short by_long[GR_INDEX_MAX];
+  } gr_index;
+
   /**
    * @brief Parsing context passed to ::gr_parse.
    *
@@ -260,6 +294,12 @@ extern "C"
      * options table.  Useful for examples or notes.
      */
     const char *epilog;
+
+    /**
+     * Optional lookup index built from @c options (see ::gr_index).  When
+     * @c NULL options are found by scanning the table.
+     */
+    const gr_index *index;
   } gr_spec;
 
   /**
@@ -315,6 +355,19 @@ extern "C"
    */
   void gr_usage(const gr_spec *spec, FILE *stream);
 
+  /**
+   * @brief Build the lookup index for a sentinel-terminated option table.
+   *
+   * Build once and reuse: the index only depends on the option names.
+   *
+   * @param index    Caller-owned index to fill (non-NULL).
+   * @param options  Option table; must outlive every parse using @p index.
+   *
+   * @return ::GR_OK, or ::GR_ERR when @p options has more than
+   *         ::GR_INDEX_MAX entries (@p index is then left unusable).
+   */
+  int gr_index_build(gr_index *index, const gr_opt *options);
+
   /**
    * @brief Leaf handler called after the subcommand path is resolved.
    *
@@ -357,12 +410,18 @@ extern "C"
 
     /** Number of entries in @p children (excluding the sentinel). */
     size_t child_count;
+
+    /**
+     * Optional positions of @p children sorted by name (see ::gr_cmd_order),
+     * letting dispatch binary-search the group; @c NULL scans it.
+     */
+    const unsigned short *order;
   } gr_cmd;
 
 /** @brief Sentinel that terminates a ::gr_cmd array. */
 #define GR_CMD_END                                                             \
   {                                                                            \
-    NULL, NULL, NULL, NULL, NULL, 0                                            \
+    NULL, NULL, NULL, NULL, NULL, 0, NULL                                      \
   }
 
   /**
@@ -384,8 +443,26 @@ extern "C"
 
     /** Forwarded verbatim to every ::gr_cmd_fn @c userdata parameter. */
     void *userdata;
+
+    /** Optional name order of @p commands, as ::gr_cmd::order . */
+    const unsigned short *order;
   } gr_app;
 
+  /**
+   * @brief Compute the name order of a command table.
+   *
+   * Fills @p order with the positions of @p table[0..n-1] sorted by name,
+   * ready for ::gr_cmd::order or ::gr_app::order .
+   *
+   * @param table  Command table.
+   * @param n      Entries of @p table to cover (excluding the sentinel).
+   * @param order  Caller-owned array of @p n entries.
+   *
+   * @return ::GR_OK, or ::GR_ERR when an entry has no name or @p n does not
+   *         fit the order type.
+   */
+  int gr_cmd_order(const gr_cmd *table, size_t n, unsigned short *order);
+
   /**
    * @brief Dispatch @c main arguments through the subcommand tree.
    *
@@ -404,6 +481,86 @@ extern "C"
 
 #ifdef __cplusplus
 }
+
+/**
+ * @brief Compile-time builders for the Grendizer lookup tables (C++17).
+ *
+ * The tables must have static storage so their addresses are constants:
+ * @code
+ * static int verbose;
+ * static constexpr gr_opt opts[] = {
+ *     GR_FLAG('v', "verbose", &verbose, "Enable verbose output"),
+ *     GR_END
+ * };
+ * static constexpr gr_index opts_index = gr::make_index(opts);
+ *
+ * gr_spec spec = {"tool", nullptr, opts, nullptr, &opts_index};
+ * @endcode
+ *
+ * @c gr::cmd_order does the same for a command table; pass its @c at
+ * member as ::gr_cmd::order of the parent entry.
+ */
+namespace gr
+{
+  namespace detail
+  {
+    constexpr int cmp(const char *a, const char *b)
+    {
+      while(*a && *a == *b) {
+        a++;
+        b++;
+      }
+      return (unsigned char)*a - (unsigned char)*b;
+    }
+  } // namespace detail
+
+  /** @brief Build the ::gr_index of @p options during compilation. */
+  template <size_t N> constexpr gr_index make_index(const gr_opt (&options)[N])
+  {
+    static_assert(N <= GR_INDEX_MAX + 1, "too many options for a gr_index");
+
+    gr_index ix{};
+    for(size_t n = 0; n < N && options[n].kind != GR_KIND_END; n++) {
+      const gr_opt &o = options[n];
+      if(o.short_name && !ix.by_short[(unsigned char)o.short_name])
+        ix.by_short[(unsigned char)o.short_name] = (unsigned short)(n + 1);
+      if(o.long_name) {
+        size_t j = ix.long_count++;
+        for(; j > 0 &&
+              detail::cmp(options[ix.by_long[j - 1]].long_name, o.long_name) >
+                  0;
+            j--)
+          ix.by_long[j] = ix.by_long[j - 1];
+        ix.by_long[j] = (unsigned short)n;
+      }
+    }
+    ix.options = options;
+    return ix;
+  }
+
+  /** @brief Name order of a command table, as built by ::gr::cmd_order. */
+  template <size_t N> struct cmd_order_t
+  {
+    unsigned short at[N]; /**< Positions sorted by name; sentinel unused. */
+  };
+
+  /** @brief Build ::gr_cmd::order for @p cmds during compilation. */
+  template <size_t N>
+  constexpr cmd_order_t<N> cmd_order(const gr_cmd (&cmds)[N])
+  {
+    static_assert(N <= 65536, "too many commands for a gr_cmd order");
+
+    cmd_order_t<N> ord{};
+    for(size_t n = 0; n < N && cmds[n].name; n++) {
+      size_t j = n;
+      for(; j > 0 && detail::cmp(cmds[ord.at[j - 1]].name, cmds[n].name) > 0;
+          j--)
+        ord.at[j] = ord.at[j - 1];
+      ord.at[j] = (unsigned short)n;
+    }
+    return ord;
+  }
+} // namespace gr
 #endif
 
 #endif /* GRENDIZER_H */
@@ -7,7 +7,11 @@
  * a handful of things the language itself can't decide:
  *
  *   - which builtin commands are available in this host (shell has cd/pwd/...,
- *     CLI has none).
+ *     CLI has none), and which of them only print, so `$(...)` may run
+ *     them without forking.
+ *
+ * Builtins write their standard output through vega_stdout_write() so that
+ * a substitution running them in the shell process can collect it.
  *
  * Everything else (stdout, filesystem queries, etc.) libvega does through
  * plain musl.
@@ -23,8 +27,9 @@
 #define MAX_PATH 256
 
 /**
- * @brief Operations libvega calls back into the host for. All fields are
- * required; hosts with no extra builtins return false from @c is_builtin.
+ * @brief Operations libvega calls back into the host for. All fields but
+ * @c is_pure are required; hosts with no extra builtins return false from
+ * @c is_builtin.
  */
 typedef struct vega_host_ops
 {
@@ -34,6 +39,11 @@ typedef struct vega_host_ops
   /** Execute a host builtin. argv[0] is the name, argv[argc] is NULL.
    *  Returns the builtin's exit status. */
   int (*run_builtin)(int argc, char *const argv[]);
+
+  /** True if running builtin @p name changes nothing but what it writes
+   *  (pwd, not cd). `$(...)` runs those in the shell process instead of a
+   *  forked child. May be NULL: every builtin is then assumed impure. */
+  bool (*is_pure)(const char *name);
 } vega_host_ops_t;
 
 /**
@@ -43,4 +53,12 @@ typedef struct vega_host_ops
  */
 void vega_init(const vega_host_ops_t *ops);
 
+/**
+ * @brief Write @p len bytes of builtin output to standard output, or into
+ * the buffer of the `$(...)` running the builtin in the shell process.
+ *
+ * @return Bytes written, or -1 on error.
+ */
+long vega_stdout_write(const void *buf, size_t len);
+
 #endif /* VEGA_HOST_H */
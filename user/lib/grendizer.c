@@ -76,11 +76,39 @@ static const char *gr__progname(const gr_spec *spec, const char *argv0)
   return gr__basename(argv0);
 }
 
+/**
+ * @brief Compare NUL-terminated @p name with @p key[0..len-1], as strcmp().
+ */
+static int gr__namecmp(const char *name, const char *key, size_t len)
+{
+  int r = strncmp(name, key, len);
+  if(r != 0)
+    return r;
+  return name[len] != '\0';
+}
+
+/**
+ * @brief Return the index attached to @p spec, or @c NULL if it has none
+ * (or one built for a different option table).
+ */
+static const gr_index *gr__index(const gr_spec *spec)
+{
+  const gr_index *ix = spec->index;
+  return (ix && ix->options == spec->options) ? ix : NULL;
+}
+
 /**
  * @brief Find the option with @p key as its short name, or @c NULL.
  */
-static const gr_opt *gr__by_short(const gr_opt *opts, char key)
+static const gr_opt *gr__by_short(const gr_spec *spec, char key)
 {
+  const gr_index *ix   = gr__index(spec);
+  const gr_opt   *opts = spec->options;
+
+  if(ix) {
+    unsigned slot = ix->by_short[(unsigned char)key];
+    return slot ? &opts[slot - 1] : NULL;
+  }
   for(; opts->kind != GR_KIND_END; opts++)
     if(opts->short_name && opts->short_name == key)
       return opts;
@@ -91,8 +119,27 @@ static const gr_opt *gr__by_short(const gr_opt *opts, char key)
  * @brief Find the option whose long name exactly matches @p name[0..len-1].
  */
 static const gr_opt *
-    gr__by_long(const gr_opt *opts, const char *name, size_t len)
+    gr__by_long(const gr_spec *spec, const char *name, size_t len)
 {
+  const gr_index *ix   = gr__index(spec);
+  const gr_opt   *opts = spec->options;
+
+  if(ix) {
+    size_t lo = 0, hi = ix->long_count;
+
+    /* Leftmost match, so duplicates resolve to the first entry. */
+    while(lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if(gr__namecmp(opts[ix->by_long[mid]].long_name, name, len) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if(lo < ix->long_count &&
+       gr__namecmp(opts[ix->by_long[lo]].long_name, name, len) == 0)
+      return &opts[ix->by_long[lo]];
+    return NULL;
+  }
   for(; opts->kind != GR_KIND_END; opts++) {
     if(opts->long_name && strncmp(opts->long_name, name, len) == 0 &&
        opts->long_name[len] == '\0')
@@ -383,6 +430,37 @@ void gr_usage(const gr_spec *spec, FILE *stream)
     fprintf(stream, "\n%s\n", spec->epilog);
 }
 
+int gr_index_build(gr_index *index, const gr_opt *options)
+{
+  size_t n;
+
+  if(!index || !options)
+    return GR_ERR;
+  memset(index, 0, sizeof *index);
+
+  for(n = 0; options[n].kind != GR_KIND_END; n++) {
+    const gr_opt *o = &options[n];
+
+    if(n >= GR_INDEX_MAX)
+      return GR_ERR;
+    if(o->short_name && !index->by_short[(unsigned char)o->short_name])
+      index->by_short[(unsigned char)o->short_name] = (unsigned short)(n + 1);
+    if(o->long_name) {
+      /* Insertion sort; ties keep table order so the first entry wins. */
+      size_t j = index->long_count++;
+      for(; j > 0 &&
+            strcmp(options[index->by_long[j - 1]].long_name, o->long_name) > 0;
+          j--)
+        index->by_long[j] = index->by_long[j - 1];
+      index->by_long[j] = (unsigned short)n;
+    }
+  }
+
+  /* Set last: until then the index matches no table and is ignored. */
+  index->options = options;
+  return GR_OK;
+}
+
 int gr_parse(
     const gr_spec *spec, int argc, char **argv, gr_rest *rest, char *errbuf,
     size_t errcap
@@ -436,14 +514,14 @@ int gr_parse(
 
       /* Built-in --help (only when the caller does not claim --help). */
       if(nlen == 4 && memcmp(body, "help", 4) == 0 &&
-         !gr__by_long(spec->options, "help", 4)) {
+         !gr__by_long(spec, "help", 4)) {
         gr_spec s = *spec;
         s.program = prog;
         gr_usage(&s, stdout);
         return GR_HELP;
       }
 
-      o = gr__by_long(spec->options, body, nlen);
+      o = gr__by_long(spec, body, nlen);
       if(!o) {
         gr__errf(
             errbuf, errcap, stderr, "%s: unknown option '--%.*s'", prog,
@@ -487,7 +565,7 @@ int gr_parse(
     }
 
     /* Built-in -h (only when the caller does not claim -h). */
-    if(tok[1] == 'h' && tok[2] == '\0' && !gr__by_short(spec->options, 'h')) {
+    if(tok[1] == 'h' && tok[2] == '\0' && !gr__by_short(spec, 'h')) {
       gr_spec s = *spec;
       s.program = prog;
       gr_usage(&s, stdout);
@@ -496,7 +574,7 @@ int gr_parse(
 
     for(const char *p = tok + 1; *p; p++) {
       char          key = *p;
-      const gr_opt *o   = gr__by_short(spec->options, key);
+      const gr_opt *o   = gr__by_short(spec, key);
       if(!o) {
         gr__errf(errbuf, errcap, stderr, "%s: unknown option '-%c'", prog, key);
         return GR_ERR;
@@ -553,15 +631,49 @@ static const char *gr__app_prog(const gr_app *app, const char *argv0)
   return gr__basename(argv0);
 }
 
+int gr_cmd_order(const gr_cmd *table, size_t n, unsigned short *order)
+{
+  size_t i, j;
+
+  if(!table || !order || n > 65536)
+    return GR_ERR;
+  for(i = 0; i < n; i++) {
+    if(!table[i].name)
+      return GR_ERR;
+    for(j = i; j > 0 && strcmp(table[order[j - 1]].name, table[i].name) > 0;
+        j--)
+      order[j] = order[j - 1];
+    order[j] = (unsigned short)i;
+  }
+  return GR_OK;
+}
+
 /**
  * @brief Look up @p name in a flat ::gr_cmd table of length @p n.
+ *
+ * Binary-searches through @p order when the table has one.
  */
-static const gr_cmd *
-    gr__find_cmd(const gr_cmd *table, size_t n, const char *name)
+static const gr_cmd *gr__find_cmd(
+    const gr_cmd *table, size_t n, const unsigned short *order,
+    const char *name
+)
 {
   size_t i;
   if(!name)
     return NULL;
+  if(order) {
+    size_t lo = 0, hi = n;
+    while(lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if(strcmp(table[order[mid]].name, name) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if(lo < n && strcmp(table[order[lo]].name, name) == 0)
+      return &table[order[lo]];
+    return NULL;
+  }
   for(i = 0; i < n; i++)
     if(table[i].name && strcmp(table[i].name, name) == 0)
       return &table[i];
@@ -650,6 +762,7 @@ static void gr__print_cmd(
  * @param app       Application descriptor.
  * @param cmds      Current-level command table.
  * @param n         Length of @p cmds.
+ * @param order     Name order of @p cmds, or @c NULL.
  * @param path      Accumulated path string (modified in place).
  * @param cap       Capacity of @p path buffer.
  * @param argc      Remaining argument count.
@@ -659,7 +772,7 @@ static void gr__print_cmd(
  */
 static int gr__help_walk(
     const char *prog, const gr_app *app, const gr_cmd *cmds, size_t n,
-    char *path, int argc, char **argv
+    const unsigned short *order, char *path, int argc, char **argv
 )
 {
   const gr_cmd *cmd;
@@ -669,7 +782,7 @@ static int gr__help_walk(
     fprintf(stderr, "%s: 'help' requires a command name\n", prog);
     return 2;
   }
-  cmd = gr__find_cmd(cmds, n, argv[0]);
+  cmd = gr__find_cmd(cmds, n, order, argv[0]);
   if(!cmd) {
     fprintf(stderr, "%s: no such command: %s\n", prog, argv[0]);
     return 2;
@@ -685,20 +798,25 @@ static int gr__help_walk(
     return 2;
   }
   return gr__help_walk(
-      prog, app, cmd->children, cmd->child_count, next, argc - 1, argv + 1
+      prog, app, cmd->children, cmd->child_count, cmd->order, next, argc - 1,
+      argv + 1
   );
 }
 
 /**
  * @brief Recursive dispatch worker.
+ *
+ * @p cmds is @p parent's children, or the top-level table when @p parent is
+ * @c NULL ; the name order comes from the same place.
  */
 static int gr__dispatch(
     const char *prog, const gr_app *app, const gr_cmd *parent,
     const gr_cmd *cmds, size_t n, const char *path, int argc, char **argv
 )
 {
-  const gr_cmd *cmd;
-  char          next[256];
+  const unsigned short *order = parent ? parent->order : app->order;
+  const gr_cmd         *cmd;
+  char                  next[256];
 
   /* No tokens left: show help at this level. */
   if(argc == 0) {
@@ -733,10 +851,12 @@ static int gr__dispatch(
       return 0;
     }
     char empty[256] = {0};
-    return gr__help_walk(prog, app, cmds, n, empty, argc - 1, argv + 1);
+    return gr__help_walk(
+        prog, app, cmds, n, order, empty, argc - 1, argv + 1
+    );
   }
 
-  cmd = gr__find_cmd(cmds, n, argv[0]);
+  cmd = gr__find_cmd(cmds, n, order, argv[0]);
   if(!cmd) {
     fprintf(stderr, "%s: unknown command '%s'\n", prog, argv[0]);
     fprintf(stderr, "Run '%s help' for usage.\n", prog);
@@ -0,0 +1,133 @@
+/**
+ * @file sdk/vega/capture.c
+ * @brief Buffers behind in-process command substitution.
+ *
+ * Each open capture is a heap buffer grown a page at a time, linked to the
+ * capture it interrupted. Nothing is written to fd 1 while one collects, so
+ * a substitution producing more than a pipe's worth of output cannot block
+ * the shell against itself.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vega/host.h>
+#include <vega/internal/capture.h>
+
+#define CAPTURE_PAGE 4096
+
+typedef struct capture
+{
+  char           *data;
+  size_t          len;
+  size_t          cap;
+  int             failed;    /* an append ran out of memory */
+  int             suspended; /* ::capture_suspend depth */
+  struct capture *outer;
+} capture_t;
+
+static capture_t *g_top;
+
+int capture_begin(void)
+{
+  capture_t *c = (capture_t *)calloc(1, sizeof(*c));
+  if(!c)
+    return -1;
+  c->outer = g_top;
+  g_top    = c;
+  return 0;
+}
+
+char *capture_end(size_t *len)
+{
+  capture_t *c = g_top;
+  if(!c)
+    return NULL;
+  g_top = c->outer;
+
+  char  *data   = c->data;
+  size_t n      = c->len;
+  int    failed = c->failed;
+  free(c);
+
+  if(failed) {
+    free(data);
+    return NULL;
+  }
+  if(!data)
+    data = (char *)calloc(1, 1);
+  else
+    data[n] = '\0'; /* reserve() kept a byte for it */
+  *len = n;
+  return data;
+}
+
+int capture_active(void)
+{
+  return g_top && !g_top->suspended;
+}
+
+void capture_suspend(void)
+{
+  if(g_top)
+    g_top->suspended++;
+}
+
+void capture_resume(void)
+{
+  if(g_top && g_top->suspended)
+    g_top->suspended--;
+}
+
+/* Make room for @p n more bytes plus the terminating NUL, in whole pages. */
+static int reserve(capture_t *c, size_t n)
+{
+  if(c->failed)
+    return -1;
+  size_t need = c->len + n + 1;
+  if(need <= c->cap)
+    return 0;
+  size_t cap  = (need + CAPTURE_PAGE - 1) & ~(size_t)(CAPTURE_PAGE - 1);
+  char  *data = (char *)realloc(c->data, cap);
+  if(!data) {
+    c->failed = 1;
+    return -1;
+  }
+  c->data = data;
+  c->cap  = cap;
+  return 0;
+}
+
+long vega_stdout_write(const void *buf, size_t len)
+{
+  if(!capture_active())
+    return write(STDOUT_FILENO, buf, len);
+  if(reserve(g_top, len) < 0)
+    return -1;
+  memcpy(g_top->data + g_top->len, buf, len);
+  g_top->len += len;
+  return (long)len;
+}
+
+void capture_drain(int fd)
+{
+  capture_t *c = g_top;
+  char       scratch[256];
+  for(;;) {
+    long n;
+    if(c && reserve(c, CAPTURE_PAGE) == 0) {
+      n = read(fd, c->data + c->len, CAPTURE_PAGE);
+      if(n > 0)
+        c->len += (size_t)n;
+    } else {
+      n = read(fd, scratch, sizeof(scratch));
+    }
+    if(n <= 0)
+      return;
+  }
+}
+
+void capture_forget(void)
+{
+  g_top = NULL;
+}
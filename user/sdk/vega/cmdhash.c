@@ -0,0 +1,121 @@
+/**
+ * @file sdk/vega/cmdhash.c
+ * @brief Fixed-capacity command path cache, open addressing on strhash.
+ *
+ * Entries are never removed from their slot: forgetting a name only frees
+ * its path, so probe chains stay intact and the next put reuses the slot.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <vega/internal/cmdhash.h>
+#include <vega/internal/strhash.h>
+#include <vega/vega.h>
+
+#define HASH_SLOTS 64 /* power of two */
+#define HASH_MAX   48 /* names kept before the table stops growing */
+
+typedef struct
+{
+  char    *name; /* NULL: slot never used */
+  char    *path; /* NULL: name forgotten */
+  unsigned hits;
+} hash_entry_t;
+
+static hash_entry_t g_table[HASH_SLOTS];
+static int          g_count = 0;
+static char        *g_path_env; /* PATH the table was filled under */
+
+/* Slot holding @p name, or the empty slot that ends its probe chain (NULL if
+ * the table has neither). */
+static hash_entry_t *probe(const char *name)
+{
+  unsigned i = strhash(name) & (HASH_SLOTS - 1);
+  for(int n = 0; n < HASH_SLOTS; n++) {
+    hash_entry_t *e = &g_table[i];
+    if(!e->name || strcmp(e->name, name) == 0)
+      return e;
+    i = (i + 1) & (HASH_SLOTS - 1);
+  }
+  return NULL;
+}
+
+void vega_hash_reset(void)
+{
+  for(int i = 0; i < HASH_SLOTS; i++) {
+    free(g_table[i].name);
+    free(g_table[i].path);
+    g_table[i].name = NULL;
+    g_table[i].path = NULL;
+    g_table[i].hits = 0;
+  }
+  g_count = 0;
+  free(g_path_env);
+  g_path_env = NULL;
+}
+
+/* Drop everything if PATH changed since the table was filled. */
+static void check_path_env(void)
+{
+  const char *env = getenv("PATH");
+  if(!env)
+    env = "";
+  if(g_path_env && strcmp(g_path_env, env) == 0)
+    return;
+  vega_hash_reset();
+  g_path_env = strdup(env);
+}
+
+const char *cmdhash_get(const char *name)
+{
+  check_path_env();
+  hash_entry_t *e = probe(name);
+  if(!e || !e->name || !e->path)
+    return NULL;
+  e->hits++;
+  return e->path;
+}
+
+void cmdhash_put(const char *name, const char *path)
+{
+  check_path_env();
+  if(!g_path_env)
+    return; /* could not record PATH: caching would never invalidate */
+
+  hash_entry_t *e = probe(name);
+  if(!e)
+    return;
+  if(!e->name) {
+    if(g_count >= HASH_MAX)
+      return;
+    e->name = strdup(name);
+    if(!e->name)
+      return;
+    g_count++;
+  }
+  char *copy = strdup(path);
+  if(!copy)
+    return;
+  free(e->path);
+  e->path = copy;
+  e->hits = 0;
+}
+
+void cmdhash_forget(const char *name)
+{
+  hash_entry_t *e = probe(name);
+  if(!e || !e->name)
+    return;
+  free(e->path);
+  e->path = NULL;
+  e->hits = 0;
+}
+
+void vega_hash_each(vega_hash_fn_t fn, void *ctx)
+{
+  check_path_env();
+  for(int i = 0; i < HASH_SLOTS; i++) {
+    if(g_table[i].name && g_table[i].path)
+      fn(g_table[i].name, g_table[i].path, g_table[i].hits, ctx);
+  }
+}
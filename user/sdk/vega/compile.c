@@ -0,0 +1,179 @@
+/**
+ * @file sdk/vega/compile.c
+ * @brief AST → bytecode compiler.
+ *
+ * Code is emitted into a growing scratch buffer, with forward jumps patched
+ * once their target is known, then copied into a single exact-size block
+ * behind the program header.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <vega/arena.h>
+#include <vega/ast.h>
+#include <vega/internal/bytecode.h>
+
+typedef struct
+{
+  vega_insn_t *code;
+  int          n;
+  int          cap;
+  int          n_slots;
+  int          failed;
+} compiler_t;
+
+/* Append one instruction; returns its index (or -1 once out of memory). */
+static int emit(compiler_t *c, vega_op_t op, int slot, int arg, ast_t *node)
+{
+  if(c->failed)
+    return -1;
+  if(c->n == c->cap) {
+    int          cap  = c->cap ? c->cap * 2 : 32;
+    vega_insn_t *code = (vega_insn_t *)realloc(c->code, cap * sizeof(*code));
+    if(!code) {
+      c->failed = 1;
+      return -1;
+    }
+    c->code = code;
+    c->cap  = cap;
+  }
+  vega_insn_t *i = &c->code[c->n];
+  i->op          = (unsigned char)op;
+  i->slot        = (unsigned short)slot;
+  i->arg         = arg;
+  i->node        = node;
+  return c->n++;
+}
+
+/* Point the jump at @p at to the next instruction to be emitted. */
+static void patch(compiler_t *c, int at)
+{
+  if(at >= 0)
+    c->code[at].arg = c->n;
+}
+
+static int new_slots(compiler_t *c, int n)
+{
+  int s = c->n_slots;
+  c->n_slots += n;
+  return s;
+}
+
+/* Leave @p n's status in the register. Every node but NULL also ends with
+ * OP_STATUS, matching where vega_exec used to publish $?. */
+static void compile_node(compiler_t *c, ast_t *n)
+{
+  if(!n) {
+    emit(c, OP_CONST, 0, 0, NULL);
+    return;
+  }
+
+  switch(n->kind) {
+  case AST_CMD:
+    emit(c, OP_CMD, 0, 0, n);
+    break;
+  case AST_PIPE:
+    emit(c, OP_PIPE, 0, 0, n);
+    break;
+  case AST_LET:
+    emit(c, OP_LET, 0, 0, n);
+    break;
+  case AST_FN:
+    emit(c, OP_FN, 0, 0, n);
+    break;
+  case AST_BG:
+    emit(c, OP_BG, 0, 0, n);
+    break;
+  case AST_AND:
+  case AST_OR: {
+    compile_node(c, n->u.binop.left);
+    int skip = emit(c, n->kind == AST_AND ? OP_JNZ : OP_JZ, 0, 0, NULL);
+    compile_node(c, n->u.binop.right);
+    patch(c, skip);
+    break;
+  }
+  case AST_SEQ:
+    compile_node(c, n->u.binop.left);
+    compile_node(c, n->u.binop.right);
+    break;
+  case AST_IF: {
+    compile_node(c, n->u.if_.cond);
+    int to_else = emit(c, OP_JNZ, 0, 0, NULL);
+    compile_node(c, n->u.if_.then_branch);
+    int to_end = emit(c, OP_JMP, 0, 0, NULL);
+    patch(c, to_else);
+    compile_node(c, n->u.if_.else_branch);
+    patch(c, to_end);
+    break;
+  }
+  case AST_WHILE: {
+    int s = new_slots(c, 1);
+    emit(c, OP_CONST, 0, 0, NULL);
+    emit(c, OP_STORE, s, 0, NULL);
+    int top = c->n;
+    compile_node(c, n->u.while_.cond);
+    int done = emit(c, OP_JNZ, 0, 0, NULL);
+    compile_node(c, n->u.while_.body);
+    emit(c, OP_STORE, s, 0, NULL);
+    emit(c, OP_JMP, 0, top, NULL);
+    patch(c, done);
+    emit(c, OP_LOAD, s, 0, NULL);
+    break;
+  }
+  case AST_FOR: {
+    if(n->u.for_.par) {
+      emit(c, OP_PAR, 0, 0, n);
+      break;
+    }
+    /* slots[s] is the loop's status, slots[s + 1] the next word. */
+    int s = new_slots(c, 2);
+    emit(c, OP_CONST, 0, 0, NULL);
+    emit(c, OP_STORE, s, 0, NULL);
+    emit(c, OP_STORE, s + 1, 0, NULL);
+    int top  = c->n;
+    int done = emit(c, OP_FOR_NEXT, s, 0, n);
+    if(n->u.for_.body) {
+      compile_node(c, n->u.for_.body);
+      emit(c, OP_STORE, s, 0, NULL);
+    }
+    emit(c, OP_JMP, 0, top, NULL);
+    patch(c, done);
+    emit(c, OP_LOAD, s, 0, NULL);
+    break;
+  }
+  default:
+    emit(c, OP_CONST, 0, 0, NULL);
+    break;
+  }
+  emit(c, OP_STATUS, 0, 0, NULL);
+}
+
+vega_prog_t *vega_compile(ast_t *root)
+{
+  compiler_t c = {0};
+  compile_node(&c, root);
+  emit(&c, OP_END, 0, 0, NULL);
+  if(c.failed) {
+    free(c.code);
+    return NULL;
+  }
+
+  vega_prog_t *p =
+      (vega_prog_t *)malloc(sizeof(*p) + (size_t)c.n * sizeof(vega_insn_t));
+  if(p) {
+    p->arena   = NULL;
+    p->n_slots = c.n_slots;
+    p->n_code  = c.n;
+    memcpy(p->code, c.code, (size_t)c.n * sizeof(vega_insn_t));
+  }
+  free(c.code);
+  return p;
+}
+
+void vega_prog_free(vega_prog_t *p)
+{
+  if(!p)
+    return;
+  arena_destroy(p->arena);
+  free(p);
+}
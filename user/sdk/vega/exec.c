@@ -1,107 +1,166 @@
 /**
  * @file sdk/vega/exec.c
- * @brief Walks vega AST nodes and runs them.
+ * @brief Runs vega programs: the bytecode VM and the commands it calls.
  *
- * AST_CMD: resolve via /bin or /usr/bin, absolute path, or relative path
- * containing '/' (e.g. ./a.out per POSIX); fork+execve+wait,
- * applying redirections in the child. AST_AND/OR/SEQ short-circuit the obvious
- * way. AST_PIPE forks N children plumbed by N-1 pipes; pipeline status is the
- * last stage's. Builtins run in the shell process when standalone (so cd
- * mutates parent state); builtins in a pipeline run in a forked subshell.
+ * vega_exec compiles a tree (compile.c) and runs it; function bodies keep
+ * their compiled form in the function table. Control flow is jumps in the
+ * VM; what follows is how the leaves run.
+ *
+ * AST_CMD: resolve via PATH (remembered in cmdhash), absolute path, or
+ * relative path containing '/' (e.g. ./a.out per POSIX); posix_spawn+wait, with
+ * redirections opened by the shell and dup2'd into place by the spawn. (musl
+ * spawns with CLONE_VM|CLONE_VFORK, so nothing copies the shell's address
+ * space.) Commands vega_spawn_warm() pre-loaded skip even the exec: the
+ * kernel starts a copy of their template with the same fd actions
+ * (alcor_spawn.h), and posix_spawn is the fallback. AST_AND/OR/SEQ
+ * compile to jumps that short-circuit the obvious way. AST_PIPE forks N
+ * children plumbed by N-1 pipes; pipeline status is the last stage's.
+ * Builtins run in the shell process when standalone (so cd mutates parent
+ * state); builtins in a pipeline run in a forked subshell.
+ * While an in-process `$(...)` captures (capture.h), every child spawned
+ * gets a pipe as fd 1 and the shell drains it before waiting.
  */
 
+#include <alcor2/alcor_spawn.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <spawn.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <vega/host.h>
+#include <vega/internal/bytecode.h>
+#include <vega/internal/capture.h>
+#include <vega/internal/cmdhash.h>
 #include <vega/internal/exec.h>
 #include <vega/internal/expand.h>
 #include <vega/internal/fntab.h>
 #include <vega/internal/host.h>
+#include <vega/internal/jobs.h>
+#include <vega/internal/utils.h>
 #include <vega/vega.h>
 
 /* musl exposes this; must not pass NULL to execve — breaks getenv, setenv,
  * ncurses terminfo lookup, etc. (undefined environ → faults like CR2 ~0x45). */
 extern char **environ;
 
-#define MAX_EXEC_PATH   256
-#define MAX_PIPE_STAGES 16
+#define MAX_EXEC_PATH    256
+#define MAX_PIPE_STAGES  16
+#define MAX_SPAWN_REDIRS 16
+#define DEFAULT_PATH     "/bin:/usr/bin"
+#define VM_STACK_SLOTS   16 /* loop slots kept on the C stack */
+#define CAPTURE_DEPTH    8  /* function calls followed by exec_capturable */
+#define INLINE_INPUT_MAX 4096 /* POSIX PIPE_BUF: a pipe always holds this */
+#define MAX_WRITERS      16
+#define PRESPAWN_DEFAULT "ls:cat:mkdir:rm:touch"
 
-/** musl/clang treat argv[0] like /proc/self/exe — must be the resolved path.
- *  @return 0 on success, -1 if strdup fails (caller should _exit in the child).
- */
-static int child_argv0_to_resolved_path(char **argv, const char *path)
+#ifndef SYS_ALCOR_SPAWN
+  #define SYS_ALCOR_SPAWN 507
+#endif
+
+/* The fd actions of a spawn again, for ALCOR_SPAWN_RUN; n < 0 once they
+ * no longer fit, which leaves the command to posix_spawn. */
+typedef struct
 {
-  if(!argv || !argv[0] || !path)
-    return -1;
-  char *copy = strdup(path);
-  if(!copy)
-    return -1;
-  free(argv[0]);
-  argv[0] = copy;
-  return 0;
+  alcor_spawn_fd_t a[ALCOR_SPAWN_MAX_FDS];
+  int              n;
+} spawn_acts_t;
+
+/* Writer children feeding large heredocs, oldest first. Each command
+ * reaps the ones it started, once nothing of it reads their pipes. */
+static pid_t writers[MAX_WRITERS];
+static int   n_writers = 0;
+
+/* Write all of @p text (and a newline if @p append_newline) to @p fd. */
+static void write_input(int fd, const char *text, int append_newline)
+{
+  size_t len = strlen(text);
+  while(len > 0) {
+    long n = write(fd, text, len);
+    if(n <= 0)
+      return; /* EPIPE: the reader is gone */
+    text += n;
+    len -= (size_t)n;
+  }
+  if(append_newline)
+    (void)write(fd, "\n", 1);
 }
 
-/* Set up a here-string / heredoc: pipe, write @p text into it, close the
- * write end, dup2 the read end onto fd 0. Caps at the pipe buffer size
- * (~4KB on this kernel); larger payloads would need a temp-file path.
- * For here-strings (`<<<`) bash adds an implicit trailing newline; heredocs
+/* Set up a here-string / heredoc: a pipe whose read end is returned (-1 on
+ * error) with @p text on its way in. A body that fits the pipe is written
+ * here; a bigger one is written by a forked child while the command reads
+ * it, since the shell would block on a full pipe nobody drains yet. For
+ * here-strings (`<<<`) bash adds an implicit trailing newline; heredocs
  * already include the newline of their last body line. */
-static int apply_pipe_input(const char *text, int append_newline)
+static int pipe_input_fd(const char *text, int append_newline)
 {
   int pipefd[2];
   if(pipe(pipefd) < 0)
     return -1;
 
-  size_t len = strlen(text);
-  if(len > 0)
-    write(pipefd[1], text, len);
-  if(append_newline)
-    write(pipefd[1], "\n", 1);
+  size_t len = strlen(text) + (append_newline ? 1 : 0);
+  if(len > INLINE_INPUT_MAX && n_writers < MAX_WRITERS) {
+    pid_t pid = fork();
+    if(pid == 0) {
+      close(pipefd[0]);
+      write_input(pipefd[1], text, append_newline);
+      _exit(0);
+    }
+    if(pid > 0) {
+      writers[n_writers++] = pid;
+      close(pipefd[1]);
+      return pipefd[0];
+    }
+  }
+
+  write_input(pipefd[1], text, append_newline);
   close(pipefd[1]);
+  return pipefd[0];
+}
 
-  if(dup2(pipefd[0], 0) < 0) {
-    close(pipefd[0]);
-    return -1;
-  }
-  close(pipefd[0]);
-  return 0;
+/* Wait for the heredoc writers started since there were @p mark of them.
+ * Called with every read end closed, so each has finished or gets EPIPE. */
+static void reap_writers(int mark)
+{
+  while(n_writers > mark)
+    waitpid(writers[--n_writers], NULL, 0);
 }
 
-/* Open @p target with flags appropriate for the redir kind, then dup2 onto the
- * canonical fd (0 for IN, 1 for OUT/APPEND). Returns 0 on success, -1 on any
- * error — caller is expected to bail out. The redir's target is expanded here
- * (rather than once up-front) so that loop-bodies see fresh values per
- * iteration. */
-static int apply_one_redir(const redir_t *r)
+/* Open @p target with flags appropriate for the redir kind and store the
+ * canonical fd it belongs on (0 for IN, 1 for OUT/APPEND) in @p dest_fd.
+ * Returns the open fd, or -1 on any error (already reported). The redir's
+ * target is expanded here (rather than once up-front) so that loop-bodies
+ * see fresh values per iteration. */
+static int open_redir(const redir_t *r, int *dest_fd)
 {
   char *target = expand_word(r->target);
   if(!target)
     return -1;
 
   if(r->kind == REDIR_HERESTRING || r->kind == REDIR_HEREDOC) {
-    int rc = apply_pipe_input(target, r->kind == REDIR_HERESTRING);
+    int fd = pipe_input_fd(target, r->kind == REDIR_HERESTRING);
     free(target);
-    return rc;
+    *dest_fd = 0;
+    return fd;
   }
 
   int flags = 0;
-  int dest_fd;
   switch(r->kind) {
   case REDIR_OUT:
-    flags   = O_WRONLY | O_CREAT | O_TRUNC;
-    dest_fd = 1;
+    flags    = O_WRONLY | O_CREAT | O_TRUNC;
+    *dest_fd = 1;
     break;
   case REDIR_APPEND:
-    flags   = O_WRONLY | O_CREAT | O_APPEND;
-    dest_fd = 1;
+    flags    = O_WRONLY | O_CREAT | O_APPEND;
+    *dest_fd = 1;
     break;
   case REDIR_IN:
-    flags   = O_RDONLY;
-    dest_fd = 0;
+    flags    = O_RDONLY;
+    *dest_fd = 0;
     break;
   default:
     free(target);
@@ -119,6 +178,17 @@ static int apply_one_redir(const redir_t *r)
     return -1;
   }
   free(target);
+  return fd;
+}
+
+/* Open @p r's target, then dup2 it onto its canonical fd. Returns 0 on
+ * success, -1 on any error — caller is expected to bail out. */
+static int apply_one_redir(const redir_t *r)
+{
+  int dest_fd;
+  int fd = open_redir(r, &dest_fd);
+  if(fd < 0)
+    return -1;
   if(fd != dest_fd) {
     if(dup2(fd, dest_fd) < 0) {
       close(fd);
@@ -138,6 +208,48 @@ static int apply_redirs(const redir_t *list)
   return 0;
 }
 
+static void acts_add(spawn_acts_t *acts, int fd, int target)
+{
+  if(acts->n < 0)
+    return;
+  if(acts->n == ALCOR_SPAWN_MAX_FDS) {
+    acts->n = -1;
+    return;
+  }
+  acts->a[acts->n].fd       = fd;
+  acts->a[acts->n++].target = target;
+}
+
+/* Open every target of @p list in the shell and queue, in order, the dup2
+ * that apply_redirs would do in a child (in @p fa and @p acts). The fds are
+ * stored in @p fds for the caller to close once the child is spawned.
+ * Returns their count, or -1 (with the ones opened so far closed). */
+static int spawn_redirs(
+    const redir_t *list, posix_spawn_file_actions_t *fa, spawn_acts_t *acts,
+    int *fds
+)
+{
+  int n = 0;
+  for(const redir_t *r = list; r; r = r->next) {
+    int dest_fd;
+    int fd = n < MAX_SPAWN_REDIRS ? open_redir(r, &dest_fd) : -1;
+    if(fd >= 0) {
+      fds[n++] = fd;
+      if(fd == dest_fd)
+        continue;
+      acts_add(acts, fd, dest_fd);
+      acts_add(acts, fd, -1);
+      if(posix_spawn_file_actions_adddup2(fa, fd, dest_fd) == 0 &&
+         posix_spawn_file_actions_addclose(fa, fd) == 0)
+        continue;
+    }
+    while(n > 0)
+      close(fds[--n]);
+    return -1;
+  }
+  return n;
+}
+
 /* Build a fresh, NULL-terminated argv with each word expanded. Returns a
  * heap-allocated array of heap-allocated strings; caller frees via
  * free_expanded_argv. NULL on allocation failure. The AST is left untouched
@@ -170,8 +282,41 @@ static void free_expanded_argv(char **argv, int argc)
   free(argv);
 }
 
+/* Try each PATH directory in turn for @p name (an empty entry is the
+ * current directory). Returns 1 with the hit in @p out_path, 0 otherwise. */
+static int search_path(const char *name, char *out_path)
+{
+  const char *dir = getenv("PATH");
+  if(!dir || !*dir)
+    dir = DEFAULT_PATH;
+  size_t nlen = strlen(name);
+
+  for(;;) {
+    const char *end = strchr(dir, ':');
+    if(!end)
+      end = dir + strlen(dir);
+    size_t dlen = (size_t)(end - dir);
+    if(dlen == 0) {
+      dir  = ".";
+      dlen = 1;
+    }
+    if(dlen + 1 + nlen < MAX_EXEC_PATH) {
+      memcpy(out_path, dir, dlen);
+      out_path[dlen] = '/';
+      memcpy(out_path + dlen + 1, name, nlen + 1);
+      struct stat st;
+      if(stat(out_path, &st) == 0)
+        return 1;
+    }
+    if(!*end)
+      return 0;
+    dir = end + 1;
+  }
+}
+
 /* Look up @p name in the search path, copying the result into @p out_path
- * (size MAX_EXEC_PATH). Returns 1 if found, 0 otherwise. */
+ * (size MAX_EXEC_PATH). Bare names are answered from cmdhash when it has
+ * them and remembered there otherwise. Returns 1 if found, 0 otherwise. */
 static int resolve_path(const char *name, char *out_path)
 {
   if(name[0] == '/') {
@@ -197,44 +342,164 @@ static int resolve_path(const char *name, char *out_path)
     return 0;
   }
 
-  static const char *const dirs[] = {"/bin/", "/usr/bin/", NULL};
-  for(int i = 0; dirs[i]; i++) {
-    char       *p      = out_path;
-    const char *prefix = dirs[i];
-    while(*prefix && p < out_path + MAX_EXEC_PATH - 1)
-      *p++ = *prefix++;
-    const char *c = name;
-    while(*c && p < out_path + MAX_EXEC_PATH - 1)
-      *p++ = *c++;
-    *p = '\0';
+  const char *hit = cmdhash_get(name);
+  if(hit) {
+    strcpy(out_path, hit);
+    return 1;
+  }
+  if(!search_path(name, out_path))
+    return 0;
+  cmdhash_put(name, out_path);
+  return 1;
+}
 
-    struct stat st;
-    if(stat(out_path, &st) == 0)
-      return 1;
+/* Search again for a bare @p name whose remembered path failed to run with
+ * ENOENT (the binary was removed or moved). Returns 1 with a new path in
+ * @p out_path, 0 if there is nothing else to try. */
+static int resolve_again(const char *name, int err, char *out_path)
+{
+  if(err != ENOENT || strchr(name, '/'))
+    return 0;
+  cmdhash_forget(name);
+  return resolve_path(name, out_path);
+}
+
+int vega_hash_add(const char *name)
+{
+  char path[MAX_EXEC_PATH];
+  if(!name || !*name || strchr(name, '/'))
+    return -1;
+  cmdhash_forget(name);
+  return resolve_path(name, path) ? 0 : -1;
+}
+
+void vega_spawn_warm(void)
+{
+  const char *list = getenv("VEGA_PRESPAWN");
+  if(!list)
+    list = PRESPAWN_DEFAULT;
+
+  char name[MAX_EXEC_PATH];
+  char path[MAX_EXEC_PATH];
+  for(;;) {
+    const char *end = strchr(list, ':');
+    if(!end)
+      end = list + strlen(list);
+    size_t len = (size_t)(end - list);
+    if(len > 0 && len < sizeof(name)) {
+      memcpy(name, list, len);
+      name[len] = '\0';
+      if(resolve_path(name, path))
+        syscall(SYS_ALCOR_SPAWN, ALCOR_SPAWN_WARM, path, 0);
+    }
+    if(!*end)
+      return;
+    list = end + 1;
   }
+}
+
+/* Start @p path from its kernel template, if it has one, with @p acts for
+ * fd actions. Returns 0 with the child in @p pid, -1 to use posix_spawn. */
+static int spawn_template(
+    pid_t *pid, const char *path, char **argv, const spawn_acts_t *acts
+)
+{
+  if(acts->n < 0)
+    return -1;
+  alcor_spawn_req_t req = {
+      .argv  = (uint64_t)(uintptr_t)argv,
+      .envp  = (uint64_t)(uintptr_t)environ,
+      .fds   = (uint64_t)(uintptr_t)acts->a,
+      .nfds  = (uint32_t)acts->n,
+      .flags = 0,
+  };
+  long rc = syscall(SYS_ALCOR_SPAWN, ALCOR_SPAWN_RUN, path, &req);
+  if(rc < 0)
+    return -1;
+  *pid = (pid_t)rc;
   return 0;
 }
 
+/* Give the child of @p fa the write end of a new pipe @p out as fd 1, for
+ * the capture in progress. Returns 0, or -1 with nothing left open. */
+static int spawn_capture(
+    posix_spawn_file_actions_t *fa, spawn_acts_t *acts, int out[2]
+)
+{
+  if(pipe(out) < 0)
+    return -1;
+  acts_add(acts, out[1], 1);
+  acts_add(acts, out[0], -1);
+  acts_add(acts, out[1], -1);
+  if(posix_spawn_file_actions_adddup2(fa, out[1], 1) == 0 &&
+     posix_spawn_file_actions_addclose(fa, out[0]) == 0 &&
+     posix_spawn_file_actions_addclose(fa, out[1]) == 0)
+    return 0;
+  close(out[0]);
+  close(out[1]);
+  return -1;
+}
+
+/* Spawn @p argv[0] (resolved through resolve_path) under @p redirs and wait
+ * for it. Returns its exit status, 1 if a redirection failed, 127 if it
+ * could not be executed, or -1 if it was not found. */
 static int run_external(char **argv, const redir_t *redirs)
 {
   char path[MAX_EXEC_PATH];
   if(!resolve_path(argv[0], path))
     return -1;
 
-  int pid = fork();
-  if(pid < 0)
+  posix_spawn_file_actions_t fa;
+  if(posix_spawn_file_actions_init(&fa) != 0)
     return -1;
-  if(pid == 0) {
-    if(apply_redirs(redirs) < 0)
-      _exit(1);
-    if(child_argv0_to_resolved_path(argv, path) < 0)
-      _exit(127);
-    execve(path, argv, environ);
-    _exit(127);
+  /* Queued first, so the command's own redirections override it. */
+  spawn_acts_t acts;
+  acts.n     = 0;
+  int out[2] = {-1, -1};
+  if(capture_active() && spawn_capture(&fa, &acts, out) < 0) {
+    posix_spawn_file_actions_destroy(&fa);
+    return 1;
+  }
+  int mark = n_writers;
+  int fds[MAX_SPAWN_REDIRS];
+  int nfds = spawn_redirs(redirs, &fa, &acts, fds);
+  if(nfds < 0) {
+    posix_spawn_file_actions_destroy(&fa);
+    if(out[0] >= 0) {
+      close(out[0]);
+      close(out[1]);
+    }
+    reap_writers(mark);
+    return 1;
+  }
+
+  /* musl/clang treat argv[0] like /proc/self/exe — must be the resolved
+   * path. */
+  char *name = argv[0];
+  argv[0]    = path;
+  pid_t pid;
+  int   rc = 0;
+  if(spawn_template(&pid, path, argv, &acts) < 0)
+    rc = posix_spawn(&pid, path, &fa, NULL, argv, environ);
+  if(rc != 0 && resolve_again(name, rc, path))
+    rc = posix_spawn(&pid, path, &fa, NULL, argv, environ);
+  argv[0] = name;
+
+  while(nfds > 0)
+    close(fds[--nfds]);
+  posix_spawn_file_actions_destroy(&fa);
+  if(out[0] >= 0) {
+    close(out[1]);
+    if(rc == 0)
+      capture_drain(out[0]);
+    close(out[0]);
   }
   int status = 0;
-  if(waitpid(pid, &status, 0) < 0)
-    return -1;
+  if(rc == 0 && waitpid(pid, &status, 0) < 0)
+    rc = -1;
+  reap_writers(mark);
+  if(rc != 0)
+    return rc < 0 ? -1 : 127;
   return (status >> 8) & 0xff;
 }
 
@@ -245,6 +510,16 @@ static int run_external(char **argv, const redir_t *redirs)
  * the fallback. */
 typedef int (*builtin_fn_t)(int argc, char *const argv[]);
 
+/* True if @p list sends fd 1 elsewhere, away from any capture. */
+static int redirects_stdout(const redir_t *list)
+{
+  for(const redir_t *r = list; r; r = r->next) {
+    if(r->kind == REDIR_OUT || r->kind == REDIR_APPEND)
+      return 1;
+  }
+  return 0;
+}
+
 static int  run_in_process_redirected(
      builtin_fn_t fn, int argc, char *const argv[], const redir_t *redirs
  )
@@ -254,10 +529,17 @@ static int  run_in_process_redirected(
 
   int saved_in  = dup(0); /* may be -1 (fallback) */
   int saved_out = dup(1);
+  int to_file   = redirects_stdout(redirs);
+  int mark      = n_writers;
 
   int rc = apply_redirs(redirs);
-  if(rc == 0)
+  if(rc == 0) {
+    if(to_file)
+      capture_suspend();
     rc = fn(argc, argv);
+    if(to_file)
+      capture_resume();
+  }
 
   if(saved_in >= 0) {
     dup2(saved_in, 0);
@@ -271,19 +553,27 @@ static int  run_in_process_redirected(
   } else {
     close(1);
   }
+  reap_writers(mark);
   return rc;
 }
 
-/* Bind positional args (argv[1..]) into the function's named parameters,
- * then exec the body. Missing args bind to "". Variables are global today,
- * so this clobbers any like-named outer var (no local scope). */
+/* Bind positional args (argv[1..]) into the function's named parameters in
+ * a fresh frame, then exec the body. Missing args bind to "". Parameters
+ * shadow like-named outer vars until the body returns. */
 static int call_function(const fn_entry_t *fn, int argc, char *const argv[])
 {
+  const vega_prog_t *prog = fntab_program(fn);
+  if(!prog || expand_push_frame() < 0)
+    return 1;
   for(int i = 0; i < fn->n_args; i++) {
     const char *val = (i + 1 < argc) ? argv[i + 1] : "";
-    vega_setvar(fn->arg_names[i], val);
+    expand_bind_local(fn->arg_names[i], val);
   }
-  return vega_exec(fn->body);
+  fntab_enter(fn);
+  int rc = vega_exec_prog(prog);
+  fntab_leave(fn);
+  expand_pop_frame();
+  return rc;
 }
 
 /* Run a function under @p redirs. Mirrors run_builtin_redirected: dup-save
@@ -297,10 +587,17 @@ static int call_function_redirected(
 
   int saved_in  = dup(0);
   int saved_out = dup(1);
+  int to_file   = redirects_stdout(redirs);
+  int mark      = n_writers;
 
   int rc = apply_redirs(redirs);
-  if(rc == 0)
+  if(rc == 0) {
+    if(to_file)
+      capture_suspend();
     rc = call_function(fn, argc, argv);
+    if(to_file)
+      capture_resume();
+  }
 
   if(saved_in >= 0) {
     dup2(saved_in, 0);
@@ -314,9 +611,58 @@ static int call_function_redirected(
   } else {
     close(1);
   }
+  reap_writers(mark);
   return rc;
 }
 
+/* What a command name dispatches to. */
+enum
+{
+  CMD_UNRESOLVED, /* zero, as the parser leaves it */
+  CMD_FUNCTION,
+  CMD_BUILTIN,
+  CMD_UTIL, /* utils.c */
+  CMD_EXTERNAL,
+};
+
+/* True if @p word expands to itself, so the node's command name is the same
+ * on every run. Braces are refused too: inside a string they interpolate. */
+static int is_constant_word(const char *word)
+{
+  if(word[0] == VEGA_LITERAL_SENTINEL)
+    return 1;
+  return !strchr(word, '$') && !strchr(word, '{');
+}
+
+/* Classify @p name, the expanded argv[0] of @p n, storing the function entry
+ * (CMD_FUNCTION) or utility (CMD_UTIL) in @p *target. When the source word
+ * is constant the answer is cached on the node and reused until the
+ * function table changes, so a loop body resolves its commands once.
+ * Builtins are fixed by the host, switching a utility bumps the function
+ * table's generation, and external paths have their own cache (cmdhash). */
+static int resolve_cmd(ast_t *n, const char *name, const void **target)
+{
+  unsigned gen = fntab_generation();
+  if(n->u.cmd.resolved != CMD_UNRESOLVED && n->u.cmd.resolved_gen == gen) {
+    *target = n->u.cmd.resolved_fn;
+    return n->u.cmd.resolved;
+  }
+
+  int kind = CMD_EXTERNAL;
+  if((*target = fntab_get(name)) != NULL)
+    kind = CMD_FUNCTION;
+  else if(vega_host->is_builtin(name))
+    kind = CMD_BUILTIN;
+  else if((*target = util_lookup(name)) != NULL)
+    kind = CMD_UTIL;
+  if(is_constant_word(n->u.cmd.argv[0])) {
+    n->u.cmd.resolved     = kind;
+    n->u.cmd.resolved_gen = gen;
+    n->u.cmd.resolved_fn  = *target;
+  }
+  return kind;
+}
+
 static int exec_cmd(ast_t *n)
 {
   if(n->u.cmd.argc == 0)
@@ -332,12 +678,16 @@ static int exec_cmd(ast_t *n)
   if(argv[0][0] == '\0') {
     ret = 0; /* expansion produced empty command name */
   } else {
-    const fn_entry_t *fn = fntab_get(argv[0]);
-    if(fn) {
-      ret = call_function_redirected(fn, argc, argv, redirs);
-    } else if(vega_host->is_builtin(argv[0])) {
+    const void *target;
+    int         kind = resolve_cmd(n, argv[0], &target);
+    if(kind == CMD_FUNCTION) {
+      ret = call_function_redirected(target, argc, argv, redirs);
+    } else if(kind == CMD_BUILTIN) {
       ret =
           run_in_process_redirected(vega_host->run_builtin, argc, argv, redirs);
+    } else if(kind == CMD_UTIL) {
+      const util_t *u = target;
+      ret             = run_in_process_redirected(u->run, argc, argv, redirs);
     } else {
       ret = run_external(argv, redirs);
       if(ret < 0) {
@@ -412,17 +762,23 @@ static void exec_stage_in_child(ast_t *stage)
   if(apply_redirs(stage->u.cmd.redirs) < 0)
     _exit(1);
 
-  const fn_entry_t *fn = fntab_get(argv[0]);
-  if(fn) {
-    int rc = call_function(fn, argc, argv);
+  const void *target;
+  int         kind = resolve_cmd(stage, argv[0], &target);
+  if(kind == CMD_FUNCTION) {
+    int rc = call_function(target, argc, argv);
     _exit(rc);
   }
 
-  if(vega_host->is_builtin(argv[0])) {
+  if(kind == CMD_BUILTIN) {
     int rc = vega_host->run_builtin(argc, argv);
     _exit(rc);
   }
 
+  if(kind == CMD_UTIL) {
+    const util_t *u = target;
+    _exit(u->run(argc, argv));
+  }
+
   char path[MAX_EXEC_PATH];
   if(!resolve_path(argv[0], path)) {
     (void)write(STDOUT_FILENO, (argv[0]), strlen((argv[0])));
@@ -432,9 +788,12 @@ static void exec_stage_in_child(ast_t *stage)
     );
     _exit(127);
   }
-  if(child_argv0_to_resolved_path(argv, path) < 0)
-    _exit(127);
+  /* argv[0] must be the resolved path, as in run_external. */
+  char *name = argv[0];
+  argv[0]    = path;
   execve(path, argv, environ);
+  if(resolve_again(name, errno, path))
+    execve(path, argv, environ);
   _exit(127);
 }
 
@@ -454,10 +813,13 @@ static int exec_pipeline(ast_t *n)
   /* Expansion happens inside each child via exec_stage_in_child to avoid
    * mutating the shared AST (loop bodies re-execute the same nodes). The
    * last stage inherits fd 1 from the shell, which lands directly in the
-   * kernel fb_console — no host-side capture/relay needed. */
+   * kernel fb_console — no host-side capture/relay needed — unless a
+   * `$(...)` is capturing: then it writes to one more pipe, drained here. */
+  int capturing = capture_active();
+  int n_pipes   = N - 1 + capturing;
 
-  int pipes[MAX_PIPE_STAGES - 1][2];
-  for(int i = 0; i < N - 1; i++) {
+  int pipes[MAX_PIPE_STAGES][2];
+  for(int i = 0; i < n_pipes; i++) {
     if(pipe(pipes[i]) < 0) {
       for(int j = 0; j < i; j++) {
         close(pipes[j][0]);
@@ -475,7 +837,7 @@ static int exec_pipeline(ast_t *n)
   for(int i = 0; i < N; i++) {
     pids[i] = fork();
     if(pids[i] < 0) {
-      for(int j = 0; j < N - 1; j++) {
+      for(int j = 0; j < n_pipes; j++) {
         close(pipes[j][0]);
         close(pipes[j][1]);
       }
@@ -488,12 +850,13 @@ static int exec_pipeline(ast_t *n)
     if(pids[i] == 0) {
       if(i > 0)
         dup2(pipes[i - 1][0], 0);
-      if(i < N - 1)
+      if(i < n_pipes)
         dup2(pipes[i][1], 1);
-      for(int j = 0; j < N - 1; j++) {
+      for(int j = 0; j < n_pipes; j++) {
         close(pipes[j][0]);
         close(pipes[j][1]);
       }
+      capture_forget();
       exec_stage_in_child(stages[i]);
     }
   }
@@ -502,6 +865,11 @@ static int exec_pipeline(ast_t *n)
     close(pipes[i][0]);
     close(pipes[i][1]);
   }
+  if(capturing) {
+    close(pipes[N - 1][1]);
+    capture_drain(pipes[N - 1][0]);
+    close(pipes[N - 1][0]);
+  }
 
   int last_status = 0;
   for(int i = 0; i < N; i++) {
@@ -513,106 +881,201 @@ static int exec_pipeline(ast_t *n)
   return last_status;
 }
 
-int vega_exec(ast_t *node)
+static int exec_let(ast_t *node)
 {
-  if(!node)
+  char *v = expand_word(node->u.let_.value);
+  if(!v)
+    return 1;
+  int status = (vega_setvar(node->u.let_.name, v) < 0) ? 1 : 0;
+  free(v);
+  return status;
+}
+
+/* Register the AST_FN @p node. The statement's arena dies after it runs,
+ * so the table gets a copy in an arena of its own. An empty body defines
+ * nothing. */
+static int define_function(const ast_t *node)
+{
+  if(!node->u.fn.body)
     return 0;
 
-  int status;
-  switch(node->kind) {
-  case AST_CMD:
-    status = exec_cmd(node);
-    break;
-  case AST_AND: {
-    int s  = vega_exec(node->u.binop.left);
-    status = (s == 0) ? vega_exec(node->u.binop.right) : s;
-    break;
+  vega_arena_t *arena = arena_create();
+  ast_t        *copy  = NULL;
+  if(arena) {
+    vega_arena_t *prev = arena_use(arena);
+    copy               = ast_clone(node);
+    arena_use(prev);
   }
-  case AST_OR: {
-    int s  = vega_exec(node->u.binop.left);
-    status = (s != 0) ? vega_exec(node->u.binop.right) : s;
-    break;
-  }
-  case AST_SEQ:
-    vega_exec(node->u.binop.left);
-    status = vega_exec(node->u.binop.right);
-    break;
-  case AST_PIPE:
-    status = exec_pipeline(node);
-    break;
-  case AST_IF: {
-    int cond = vega_exec(node->u.if_.cond);
-    if(cond == 0) {
-      status = vega_exec(node->u.if_.then_branch);
-    } else if(node->u.if_.else_branch) {
-      status = vega_exec(node->u.if_.else_branch);
-    } else {
-      status = 0;
-    }
-    break;
+  if(copy && fntab_set(
+                 arena, copy->u.fn.name, copy->u.fn.arg_names,
+                 copy->u.fn.n_args, copy->u.fn.body
+             ) == 0)
+    return 0;
+  arena_destroy(arena);
+  (void)write(
+      STDOUT_FILENO, ("vega: out of memory defining function\n"),
+      strlen(("vega: out of memory defining function\n"))
+  );
+  return 1;
+}
+
+/* Bind the AST_FOR @p node's next word, slots[s + 1], to its variable.
+ * Returns 0 when the words are exhausted or one fails to expand (then
+ * slots[s], the loop's status, becomes 1). */
+static int for_next(const ast_t *node, int *slots, int s)
+{
+  int i = slots[s + 1];
+  if(i >= node->u.for_.nwords)
+    return 0;
+  char *expanded = expand_word(node->u.for_.words[i]);
+  if(!expanded) {
+    slots[s] = 1;
+    return 0;
   }
-  case AST_WHILE: {
-    status = 0;
-    while(vega_exec(node->u.while_.cond) == 0)
-      status = vega_exec(node->u.while_.body);
-    break;
+  vega_setvar(node->u.for_.name, expanded);
+  free(expanded);
+  slots[s + 1] = i + 1;
+  return 1;
+}
+
+int vega_exec_prog(const vega_prog_t *p)
+{
+  int  stack_slots[VM_STACK_SLOTS];
+  int *slots = stack_slots;
+  if(p->n_slots > VM_STACK_SLOTS) {
+    slots = (int *)malloc((size_t)p->n_slots * sizeof(*slots));
+    if(!slots)
+      return 1;
   }
-  case AST_FOR: {
-    status = 0;
-    for(int i = 0; i < node->u.for_.nwords; i++) {
-      char *expanded = expand_word(node->u.for_.words[i]);
-      if(!expanded) {
-        status = 1;
-        break;
-      }
-      vega_setvar(node->u.for_.name, expanded);
-      free(expanded);
-      if(node->u.for_.body)
-        status = vega_exec(node->u.for_.body);
+
+  const vega_insn_t *code   = p->code;
+  int                status = 0;
+  for(int pc = 0; code[pc].op != OP_END;) {
+    const vega_insn_t *in = &code[pc++];
+    switch((vega_op_t)in->op) {
+    case OP_CMD:
+      status = exec_cmd(in->node);
+      break;
+    case OP_PIPE:
+      status = exec_pipeline(in->node);
+      break;
+    case OP_LET:
+      status = exec_let(in->node);
+      break;
+    case OP_FN:
+      status = define_function(in->node);
+      break;
+    case OP_BG:
+      status = jobs_start(in->node->u.bg.body);
+      break;
+    case OP_PAR:
+      status = jobs_par_for(in->node);
+      break;
+    case OP_CONST:
+      status = in->arg;
+      break;
+    case OP_STATUS:
+      expand_set_status(status);
+      break;
+    case OP_STORE:
+      slots[in->slot] = status;
+      break;
+    case OP_LOAD:
+      status = slots[in->slot];
+      break;
+    case OP_JMP:
+      pc = in->arg;
+      break;
+    case OP_JZ:
+      if(status == 0)
+        pc = in->arg;
+      break;
+    case OP_JNZ:
+      if(status != 0)
+        pc = in->arg;
+      break;
+    case OP_FOR_NEXT:
+      if(!for_next(in->node, slots, in->slot))
+        pc = in->arg;
+      break;
+    case OP_END:
+      break;
     }
-    break;
   }
-  case AST_LET: {
-    char *v = expand_word(node->u.let_.value);
-    if(!v) {
-      status = 1;
-    } else {
-      status = (vega_setvar(node->u.let_.name, v) < 0) ? 1 : 0;
-      free(v);
-    }
-    break;
+
+  if(slots != stack_slots)
+    free(slots);
+  return status;
+}
+
+int vega_exec(ast_t *node)
+{
+  if(!node)
+    return 0;
+
+  vega_prog_t *p = vega_compile(node);
+  if(!p) {
+    (void)write(
+        STDOUT_FILENO, ("vega: out of memory\n"),
+        strlen(("vega: out of memory\n"))
+    );
+    expand_set_status(1);
+    return 1;
   }
-  case AST_FN: {
-    /* Register, transferring ownership to the table. After the steal,
-     * ast_free finds NULL pointers and does nothing. If body is already
-     * NULL (e.g. an AST_FN nested inside another fn body that has been
-     * called once already), this is a no-op — the function stays
-     * registered from the first call. */
-    if(node->u.fn.body) {
-      if(fntab_set(
-             node->u.fn.name, node->u.fn.arg_names, node->u.fn.n_args,
-             node->u.fn.body
-         ) == 0) {
-        node->u.fn.name      = NULL;
-        node->u.fn.arg_names = NULL;
-        node->u.fn.n_args    = 0;
-        node->u.fn.body      = NULL;
-        status               = 0;
-      } else {
-        (void)write(
-            STDOUT_FILENO, ("vega: function table full\n"),
-            strlen(("vega: function table full\n"))
-        );
-        status = 1;
-      }
-    } else {
-      status = 0;
-    }
-    break;
+  int status = vega_exec_prog(p);
+  vega_prog_free(p);
+  return status;
+}
+
+/* Worker of exec_capturable; @p depth counts the function bodies entered. */
+static int capturable(const ast_t *n, int depth)
+{
+  if(!n)
+    return 1;
+  switch(n->kind) {
+  case AST_CMD: {
+    if(n->u.cmd.argc == 0)
+      return 1;
+    /* `cmd!` exits the shell on failure; a computed name is unknown. */
+    if(n->u.cmd.fail_fast || !is_constant_word(n->u.cmd.argv[0]))
+      return 0;
+    char *name = expand_word(n->u.cmd.argv[0]);
+    if(!name)
+      return 0;
+    int               ok = 1;
+    const fn_entry_t *fn = fntab_get(name);
+    if(fn)
+      ok = depth < CAPTURE_DEPTH && capturable(fn->body, depth + 1);
+    else if(vega_host->is_builtin(name))
+      ok = vega_host->is_pure && vega_host->is_pure(name);
+    free(name);
+    return ok;
   }
+  case AST_AND:
+  case AST_OR:
+  case AST_SEQ:
+    return capturable(n->u.binop.left, depth) &&
+           capturable(n->u.binop.right, depth);
+  case AST_PIPE:
+    return 1; /* every stage runs in a child */
+  case AST_IF:
+    return capturable(n->u.if_.cond, depth) &&
+           capturable(n->u.if_.then_branch, depth) &&
+           capturable(n->u.if_.else_branch, depth);
+  case AST_WHILE:
+    return capturable(n->u.while_.cond, depth) &&
+           capturable(n->u.while_.body, depth);
+  case AST_FOR:
+    return !n->u.for_.par && capturable(n->u.for_.body, depth);
+  case AST_LET:
+    return 1; /* undone by the substitution's scope */
   default:
-    status = 0;
+    return 0; /* AST_FN would define the function in the shell, AST_BG
+                 leave a job in its table */
   }
-  expand_set_status(status);
-  return status;
+}
+
+int exec_capturable(const ast_t *node)
+{
+  return capturable(node, 0);
 }
@@ -3,22 +3,35 @@
  * @brief vega expansion: $-syntax in words, special vars, user vars.
  *
  * The expander writes into a growing heap buffer to keep the implementation
- * straightforward. User variable storage is a tiny static table — fine for
- * MVP; will be revisited if/when scoping gets richer.
+ * straightforward. User variables live in a growable array of entries, one
+ * per name ever assigned (the name is interned there and never freed),
+ * found through an open-addressed index on strhash(). Function parameters
+ * use shallow binding: binding one saves the entry's current value on an
+ * undo stack and popping the frame puts it back, so lookups stay a single
+ * probe no matter how deep the calls nest. A scope frame, opened around
+ * a `$(...)` run in the shell process, puts the same undo stack to work
+ * for plain assignments, so the substitution still cannot change the
+ * shell's variables.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <vega/arena.h>
 #include <vega/ast.h>
 #include <vega/host.h>
+#include <vega/internal/capture.h>
+#include <vega/internal/exec.h>
 #include <vega/internal/expand.h>
+#include <vega/internal/jobs.h>
+#include <vega/internal/strhash.h>
+#include <vega/parse.h>
 #include <vega/vega.h>
 
-#define MAX_VARS    32
 #define NAME_MAX    64
 #define PID_BUF_MAX 16
+#define INDEX_MIN   64 /* initial index slots; a power of two */
 
 static int last_status = 0;
 static char
@@ -26,25 +39,44 @@ static char
 
 typedef struct
 {
-  char *name;
-  char *value;
+  char    *name;  /* interned, never freed */
+  char    *value; /* NULL: unset (reads as "") */
+  unsigned hash;
+  unsigned scope; /* scope whose undo stack holds the value; 0: none */
 } var_t;
 
-static var_t vars[MAX_VARS];
-static int   var_count = 0;
-
-void         expand_set_status(int status)
+/* A binding shadowed by a function parameter, or a value assigned over
+ * inside a scope, restored on frame pop. */
+typedef struct
 {
-  last_status = status;
-}
+  int   var;
+  char *value;
+  int   scoped; /* saved by vega_setvar for a scope */
+} saved_t;
 
-static var_t *find_var(const char *name)
+typedef struct
 {
-  for(int i = 0; i < var_count; i++) {
-    if(strcmp(vars[i].name, name) == 0)
-      return &vars[i];
-  }
-  return NULL;
+  int      saved; /* saved_count when pushed */
+  unsigned scope; /* innermost scope frame at or below this one; 0: none */
+} frame_t;
+
+static var_t   *vars;
+static int      var_count = 0;
+static int      var_cap   = 0;
+static int     *var_index; /* entry + 1 per slot; 0 is empty */
+static unsigned index_mask;
+
+static saved_t *saved;
+static int      saved_count = 0;
+static int      saved_cap   = 0;
+static frame_t *frames;
+static int      frame_count = 0;
+static int      frame_cap   = 0;
+static unsigned scope_count = 0; /* scopes ever opened, numbering them */
+
+void            expand_set_status(int status)
+{
+  last_status = status;
 }
 
 static char *strdup_alcor(const char *s)
@@ -58,41 +90,222 @@ static char *strdup_alcor(const char *s)
   return p;
 }
 
-int vega_setvar(const char *name, const char *value)
+/* Index slot holding @p name, or the empty slot where it would go. */
+static int *probe(const char *name, unsigned h)
 {
-  if(!name || !*name)
+  unsigned i = h & index_mask;
+  for(;;) {
+    int *slot = &var_index[i];
+    if(*slot == 0)
+      return slot;
+    const var_t *v = &vars[*slot - 1];
+    if(v->hash == h && strcmp(v->name, name) == 0)
+      return slot;
+    i = (i + 1) & index_mask;
+  }
+}
+
+/* Double the index (or create it) and re-insert every entry. */
+static int grow_index(void)
+{
+  unsigned slots = var_index ? (index_mask + 1) * 2 : INDEX_MIN;
+  int     *index = (int *)calloc(slots, sizeof(*index));
+  if(!index)
     return -1;
+  free(var_index);
+  var_index  = index;
+  index_mask = slots - 1;
+  for(int i = 0; i < var_count; i++)
+    *probe(vars[i].name, vars[i].hash) = i + 1;
+  return 0;
+}
+
+static var_t *find_var(const char *name)
+{
+  if(!var_index)
+    return NULL;
+  int slot = *probe(name, strhash(name));
+  return slot ? &vars[slot - 1] : NULL;
+}
 
-  var_t *existing = find_var(name);
-  if(existing) {
-    char *new_val = strdup_alcor(value);
-    if(!new_val)
+/* Entry for @p name, created unset if absent. */
+static var_t *intern_var(const char *name)
+{
+  unsigned h = strhash(name);
+  if(var_index) {
+    int slot = *probe(name, h);
+    if(slot)
+      return &vars[slot - 1];
+  }
+
+  /* Keep the index at most half full so probe chains stay short. */
+  if(!var_index || (unsigned)(var_count + 1) * 2 > index_mask + 1) {
+    if(grow_index() < 0)
+      return NULL;
+  }
+  if(var_count == var_cap) {
+    int    cap = var_cap ? var_cap * 2 : 16;
+    var_t *nv  = (var_t *)realloc(vars, (size_t)cap * sizeof(*nv));
+    if(!nv)
+      return NULL;
+    vars    = nv;
+    var_cap = cap;
+  }
+
+  char *n = strdup_alcor(name);
+  if(!n)
+    return NULL;
+  var_t *v = &vars[var_count];
+  v->name  = n;
+  v->value = NULL;
+  v->hash  = h;
+  v->scope = 0;
+  var_count++;
+  *probe(name, h) = var_count;
+  return v;
+}
+
+/* Push @p v's current value on the undo stack of the innermost frame. */
+static int save_value(var_t *v, int scoped)
+{
+  if(saved_count == saved_cap) {
+    int      cap = saved_cap ? saved_cap * 2 : 16;
+    saved_t *ns  = (saved_t *)realloc(saved, (size_t)cap * sizeof(*ns));
+    if(!ns)
       return -1;
-    free(existing->value);
-    existing->value = new_val;
-    return 0;
+    saved     = ns;
+    saved_cap = cap;
   }
+  saved[saved_count].var   = (int)(v - vars);
+  saved[saved_count].value  = v->value;
+  saved[saved_count].scoped = scoped;
+  saved_count++;
+  return 0;
+}
 
-  if(var_count >= MAX_VARS)
+int vega_setvar(const char *name, const char *value)
+{
+  if(!name || !*name)
     return -1;
 
-  char *n = strdup_alcor(name);
-  char *v = strdup_alcor(value);
-  if(!n || !v) {
-    free(n);
-    free(v);
+  var_t *v = intern_var(name);
+  if(!v)
     return -1;
+  char *new_val = strdup_alcor(value);
+  if(!new_val)
+    return -1;
+
+  /* Inside a scope, keep the value from before its first assignment. */
+  unsigned scope = frame_count ? frames[frame_count - 1].scope : 0;
+  if(scope && v->scope != scope) {
+    if(save_value(v, 1) < 0) {
+      free(new_val);
+      return -1;
+    }
+    v->scope = scope;
+  } else {
+    free(v->value);
   }
-  vars[var_count].name  = n;
-  vars[var_count].value = v;
-  var_count++;
+  v->value = new_val;
   return 0;
 }
 
 const char *expand_getvar(const char *name)
 {
   var_t *v = find_var(name);
-  return v ? v->value : "";
+  return v && v->value ? v->value : "";
+}
+
+int expand_push_frame(void)
+{
+  if(frame_count == frame_cap) {
+    int      cap = frame_cap ? frame_cap * 2 : 8;
+    frame_t *nf  = (frame_t *)realloc(frames, (size_t)cap * sizeof(*nf));
+    if(!nf)
+      return -1;
+    frames    = nf;
+    frame_cap = cap;
+  }
+  frames[frame_count].saved = saved_count;
+  frames[frame_count].scope =
+      frame_count ? frames[frame_count - 1].scope : 0;
+  frame_count++;
+  return 0;
+}
+
+int expand_push_scope(void)
+{
+  if(expand_push_frame() < 0)
+    return -1;
+  if(++scope_count == 0)
+    scope_count = 1;
+  frames[frame_count - 1].scope = scope_count;
+  return 0;
+}
+
+int expand_bind_local(const char *name, const char *value)
+{
+  if(frame_count == 0 || !name || !*name)
+    return -1;
+
+  var_t *v = intern_var(name);
+  if(!v)
+    return -1;
+  char *new_val = strdup_alcor(value);
+  if(!new_val)
+    return -1;
+  if(save_value(v, 0) < 0) {
+    free(new_val);
+    return -1;
+  }
+  v->value = new_val;
+  return 0;
+}
+
+/* True if frame entries [@p base, @p end) bind @p var as a parameter. */
+static int binds(int base, int end, int var)
+{
+  for(int i = base; i < end; i++) {
+    if(!saved[i].scoped && saved[i].var == var)
+      return 1;
+  }
+  return 0;
+}
+
+void expand_pop_frame(void)
+{
+  if(frame_count == 0)
+    return;
+  const frame_t *f     = &frames[--frame_count];
+  unsigned       outer = frame_count ? frames[frame_count - 1].scope : 0;
+  int            base  = f->saved;
+  int            end   = saved_count;
+  int            keep  = base;
+
+  /* Newest first, so a name bound twice in one frame ends up as before.
+   * A function frame inside a scope also holds the values the scope saved
+   * while it ran: those of its own parameters go with the bindings, the
+   * others stay for the scope to restore. */
+  for(int i = end - 1; i >= base; i--) {
+    saved_t *s       = &saved[i];
+    var_t   *v       = &vars[s->var];
+    int      for_out = s->scoped && f->scope == outer;
+    if(for_out && !binds(base, end, s->var))
+      continue;
+    if(for_out) {
+      free(s->value);
+    } else {
+      free(v->value);
+      v->value = s->value;
+    }
+    v->scope = 0;
+    s->var   = -1;
+  }
+  for(int i = base; i < end; i++) {
+    if(saved[i].var >= 0)
+      saved[keep++] = saved[i];
+  }
+  saved_count = keep;
 }
 
 /* Append @p src (length @p len) to a growing heap buffer. The buffer is
@@ -164,60 +377,63 @@ static int is_name_cont(char c)
   return is_name_start(c) || (c >= '0' && c <= '9');
 }
 
-/* Run @p cmd_str through vega_run in a forked child with stdout redirected
- * to a pipe; capture stdout into a heap-allocated string. Trailing newlines
- * are stripped (matches bash $(...)). Returns NULL on any failure. */
-static char *run_substitution(const char *cmd_str)
+/* Run @p ast with fd 1 going into the capture already begun: in the shell
+ * process when exec_capturable allows it, under a scope so its variables
+ * stay its own, else in a forked child writing to a pipe. */
+static void run_captured(ast_t *ast)
 {
+  if(exec_capturable(ast) && expand_push_scope() == 0) {
+    int status = last_status;
+    vega_exec(ast);
+    expand_pop_frame();
+    last_status = status;
+    return;
+  }
+
   int pipefd[2];
   if(pipe(pipefd) < 0)
-    return NULL;
-
+    return;
   int pid = fork();
   if(pid < 0) {
     close(pipefd[0]);
     close(pipefd[1]);
-    return NULL;
+    return;
   }
   if(pid == 0) {
     close(pipefd[0]);
     dup2(pipefd[1], 1);
     close(pipefd[1]);
-    int rc = vega_run(cmd_str);
-    _exit(rc);
+    capture_forget();
+    _exit(vega_exec(ast));
   }
-
   close(pipefd[1]);
+  capture_drain(pipefd[0]);
+  close(pipefd[0]);
+  waitpid(pid, NULL, 0);
+}
 
-  size_t cap = 256;
-  size_t len = 0;
-  char  *buf = (char *)malloc(cap);
-  if(!buf) {
-    close(pipefd[0]);
-    waitpid(pid, NULL, 0);
+/* Run @p cmd_str with its stdout captured into a heap-allocated string.
+ * Trailing newlines are stripped (matches bash $(...)). Returns NULL on
+ * any failure. */
+static char *run_substitution(const char *cmd_str)
+{
+  vega_arena_t *arena = arena_create();
+  if(!arena)
     return NULL;
-  }
+  vega_arena_t *prev = arena_use(arena);
+  ast_t        *ast  = vega_parse(cmd_str);
+  arena_use(prev);
 
-  while(1) {
-    if(len + 256 + 1 > cap) {
-      size_t new_cap = cap * 2;
-      char  *new_buf = (char *)realloc(buf, new_cap);
-      if(!new_buf) {
-        free(buf);
-        close(pipefd[0]);
-        waitpid(pid, NULL, 0);
-        return NULL;
-      }
-      buf = new_buf;
-      cap = new_cap;
-    }
-    long n = read(pipefd[0], buf + len, 256);
-    if(n <= 0)
-      break;
-    len += (size_t)n;
+  char  *buf = NULL;
+  size_t len = 0;
+  if(capture_begin() == 0) {
+    if(ast)
+      run_captured(ast);
+    buf = capture_end(&len);
   }
-  close(pipefd[0]);
-  waitpid(pid, NULL, 0);
+  arena_destroy(arena);
+  if(!buf)
+    return NULL;
 
   while(len > 0 && buf[len - 1] == '\n')
     len--;
@@ -293,6 +509,18 @@ static int expand_one(const char *cur, char **buf, size_t *cap, size_t *len)
     return 1;
   }
 
+  /* $! — newest background job's PID, empty before the first */
+  if(*cur == '!') {
+    pid_t pid = jobs_last_pid();
+    if(pid > 0) {
+      char s[24];
+      render_uint((unsigned long)pid, s);
+      if(buf_append(buf, cap, len, s, strlen(s)) < 0)
+        return -1;
+    }
+    return 1;
+  }
+
   /* $(cmd) — command substitution */
   if(*cur == '(') {
     const char *body_start = cur + 1;
@@ -1,64 +1,165 @@
 /**
  * @file sdk/vega/fntab.c
- * @brief Fixed-capacity function table.
+ * @brief Growable function table, open addressing on strhash.
+ *
+ * Each entry is its own allocation, so the pointers fntab_get hands out
+ * survive the index growing; redefining a function rewrites its entry in
+ * place. Functions are never removed. A definition (name, parameters, body)
+ * lives in an arena of its own; redefining a function that is running, e.g.
+ * from its own body, parks the old arena until the last call returns.
  */
 
 #include <stdlib.h>
 #include <string.h>
+#include <vega/arena.h>
 #include <vega/host.h>
+#include <vega/internal/bytecode.h>
 #include <vega/internal/fntab.h>
+#include <vega/internal/strhash.h>
 
-#define MAX_FUNCTIONS 16
+#define FNTAB_MIN_SLOTS 32 /* power of two */
 
-static fn_entry_t  g_table[MAX_FUNCTIONS];
-static int         g_count = 0;
+static fn_entry_t **g_slots;
+static unsigned     g_mask;
+static int          g_count      = 0;
+static unsigned     g_generation = 1;
 
-static fn_entry_t *find_slot(const char *name)
+/* Slot holding @p name, or the empty slot where it would go. */
+static fn_entry_t **probe(fn_entry_t **slots, unsigned mask, const char *name)
 {
-  for(int i = 0; i < g_count; i++) {
-    if(strcmp(g_table[i].name, name) == 0)
-      return &g_table[i];
+  unsigned i = strhash(name) & mask;
+  for(;;) {
+    fn_entry_t **slot = &slots[i];
+    if(!*slot || strcmp((*slot)->name, name) == 0)
+      return slot;
+    i = (i + 1) & mask;
   }
-  return NULL;
 }
 
-static void free_entry(fn_entry_t *e)
+/* Double the index (or create it), keeping it at most half full. */
+static int grow(void)
 {
-  free(e->name);
-  if(e->arg_names) {
-    for(int i = 0; i < e->n_args; i++)
-      free(e->arg_names[i]);
-    free(e->arg_names);
+  unsigned     n     = g_slots ? (g_mask + 1) * 2 : FNTAB_MIN_SLOTS;
+  fn_entry_t **slots = (fn_entry_t **)calloc(n, sizeof(*slots));
+  if(!slots)
+    return -1;
+  for(unsigned i = 0; g_slots && i <= g_mask; i++) {
+    if(g_slots[i])
+      *probe(slots, n - 1, g_slots[i]->name) = g_slots[i];
   }
-  ast_free(e->body);
-  e->name      = NULL;
-  e->arg_names = NULL;
-  e->n_args    = 0;
-  e->body      = NULL;
+  free(g_slots);
+  g_slots = slots;
+  g_mask  = n - 1;
+  return 0;
 }
 
-int fntab_set(char *name, char **arg_names, int n_args, ast_t *body)
+/* A replaced definition some call is still executing. */
+typedef struct retired
+{
+  vega_arena_t   *arena;
+  vega_prog_t    *prog;
+  struct retired *next;
+} retired_t;
+
+static void free_retired(fn_entry_t *e)
 {
-  fn_entry_t *slot = find_slot(name);
-  if(slot) {
-    free_entry(slot);
-    slot->name      = name;
-    slot->arg_names = arg_names;
-    slot->n_args    = n_args;
-    slot->body      = body;
-    return 0;
+  while(e->retired) {
+    retired_t *r = e->retired;
+    e->retired   = r->next;
+    vega_prog_free(r->prog);
+    arena_destroy(r->arena);
+    free(r);
   }
-  if(g_count >= MAX_FUNCTIONS)
-    return -1;
-  slot            = &g_table[g_count++];
-  slot->name      = name;
-  slot->arg_names = arg_names;
-  slot->n_args    = n_args;
-  slot->body      = body;
+}
+
+/* Drop @p e's definition, or park it while calls are running it. Fails only
+ * if parking does not get memory. */
+static int release_entry(fn_entry_t *e)
+{
+  if(e->running) {
+    retired_t *r = (retired_t *)malloc(sizeof(*r));
+    if(!r)
+      return -1;
+    r->arena   = e->arena;
+    r->prog    = e->prog;
+    r->next    = e->retired;
+    e->retired = r;
+  } else {
+    vega_prog_free(e->prog);
+    arena_destroy(e->arena);
+  }
+  e->arena = NULL;
+  e->prog  = NULL;
+  return 0;
+}
+
+int fntab_set(
+    vega_arena_t *arena, char *name, char **arg_names, int n_args, ast_t *body
+)
+{
+  if(!g_slots || (unsigned)(g_count + 1) * 2 > g_mask + 1) {
+    if(grow() < 0)
+      return -1;
+  }
+
+  fn_entry_t **slot = probe(g_slots, g_mask, name);
+  fn_entry_t  *e    = *slot;
+  if(e) {
+    if(release_entry(e) < 0)
+      return -1;
+  } else {
+    e = (fn_entry_t *)malloc(sizeof(*e));
+    if(!e)
+      return -1;
+    e->running = 0;
+    e->retired = NULL;
+    *slot      = e;
+    g_count++;
+  }
+  e->arena     = arena;
+  e->name      = name;
+  e->arg_names = arg_names;
+  e->n_args    = n_args;
+  e->body      = body;
+  e->prog      = NULL;
+  g_generation++;
   return 0;
 }
 
 const fn_entry_t *fntab_get(const char *name)
 {
-  return find_slot(name);
+  if(!g_slots)
+    return NULL;
+  return *probe(g_slots, g_mask, name);
+}
+
+unsigned fntab_generation(void)
+{
+  return g_generation;
+}
+
+void fntab_invalidate(void)
+{
+  g_generation++;
+}
+
+const struct vega_prog *fntab_program(const fn_entry_t *fn)
+{
+  /* Entries are only handed out const; the cache is ours to fill. */
+  fn_entry_t *e = (fn_entry_t *)fn;
+  if(!e->prog)
+    e->prog = vega_compile(e->body);
+  return e->prog;
+}
+
+void fntab_enter(const fn_entry_t *fn)
+{
+  ((fn_entry_t *)fn)->running++;
+}
+
+void fntab_leave(const fn_entry_t *fn)
+{
+  fn_entry_t *e = (fn_entry_t *)fn;
+  if(--e->running == 0)
+    free_retired(e);
 }
@@ -0,0 +1,78 @@
+/**
+ * @file vega/internal/bytecode.h
+ * @brief vega bytecode: ASTs flattened into one block of instructions.
+ *
+ * Control flow (`&&`, `||`, `;`, `if`, `while`, `for`) compiles to jumps
+ * over a flat instruction array, so loops run by bumping a program counter
+ * instead of re-walking pointer trees. Leaves (commands, pipelines, `let`,
+ * `fn`, background jobs and `par for`) keep a pointer to their AST node
+ * and are executed by exec.c as before; a program therefore never
+ * outlives the AST it was built from.
+ *
+ * The VM has one status register. Every instruction that produces a status
+ * leaves it there; OP_STATUS publishes it as `$?` at the points where the
+ * tree walker used to. Loops keep their result in numbered slots so the
+ * condition's status doesn't clobber the body's.
+ */
+
+#ifndef VEGA_BYTECODE_H
+#define VEGA_BYTECODE_H
+
+#include <vega/ast.h>
+
+typedef enum
+{
+  OP_END,      /* stop; the program's status is the register */
+  OP_CMD,      /* status = run AST_CMD node */
+  OP_PIPE,     /* status = run AST_PIPE node */
+  OP_LET,      /* status = run AST_LET node */
+  OP_FN,       /* status = register AST_FN node */
+  OP_BG,       /* status = start AST_BG node's body as a job */
+  OP_PAR,      /* status = run `par for` AST_FOR node */
+  OP_CONST,    /* status = arg */
+  OP_STATUS,   /* $? = status */
+  OP_STORE,    /* slots[slot] = status */
+  OP_LOAD,     /* status = slots[slot] */
+  OP_JMP,      /* pc = arg */
+  OP_JZ,       /* if status == 0, pc = arg */
+  OP_JNZ,      /* if status != 0, pc = arg */
+  OP_FOR_NEXT, /* bind AST_FOR node's next word (index in slots[slot + 1])
+                  or pc = arg when done or on failure (slots[slot] = 1) */
+} vega_op_t;
+
+typedef struct
+{
+  unsigned char  op;
+  unsigned short slot;
+  int            arg;
+  ast_t         *node;
+} vega_insn_t;
+
+/**
+ * @brief A compiled program: header and instructions in one allocation.
+ *
+ * @c arena, when non-NULL, holds the tree the program was compiled from
+ * and is destroyed with it.
+ */
+typedef struct vega_prog
+{
+  struct vega_arena *arena;
+  int                n_slots;
+  int                n_code;
+  vega_insn_t        code[];
+} vega_prog_t;
+
+/**
+ * @brief Compile @p root (may be NULL). The tree is not taken; set
+ *        prog->arena to hand over the arena it lives in.
+ * @return New program, or NULL on allocation failure.
+ */
+vega_prog_t *vega_compile(ast_t *root);
+
+/** @brief Free @p p and, if it owns one, its tree. NULL is a no-op. */
+void vega_prog_free(vega_prog_t *p);
+
+/** @brief Run @p p to completion and return its status. */
+int vega_exec_prog(const vega_prog_t *p);
+
+#endif /* VEGA_BYTECODE_H */
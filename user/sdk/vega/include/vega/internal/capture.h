@@ -0,0 +1,56 @@
+/**
+ * @file vega/internal/capture.h
+ * @brief Standard output of a `$(...)` run inside the shell process.
+ *
+ * While a capture is open, output that would go to fd 1 is collected in a
+ * growable buffer instead: hosts write builtin output through
+ * vega_stdout_write, which appends to it, and a command spawned meanwhile
+ * gets a pipe as fd 1 that the shell drains into it. Captures nest; only
+ * the innermost one collects.
+ */
+
+#ifndef VEGA_CAPTURE_H
+#define VEGA_CAPTURE_H
+
+#include <stddef.h>
+
+/**
+ * @brief Start collecting fd 1 output in a new, empty buffer.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int capture_begin(void);
+
+/**
+ * @brief Stop the innermost capture and hand over what it collected.
+ * @return NUL-terminated heap buffer (caller frees) holding @p *len bytes,
+ *         or NULL if the capture ran out of memory along the way.
+ */
+char *capture_end(size_t *len);
+
+/** @brief True if output to fd 1 is being collected right now. */
+int capture_active(void);
+
+/**
+ * @brief Let output reach the real fd 1 until ::capture_resume, for a
+ *        command whose stdout is redirected. Calls nest.
+ */
+void capture_suspend(void);
+
+/** @brief Undo one ::capture_suspend. */
+void capture_resume(void);
+
+/**
+ * @brief Read @p fd to end of file into the innermost capture, a page at a
+ *        time. Keeps draining after running out of memory so the writer is
+ *        never left blocked; ::capture_end then reports the failure.
+ */
+void capture_drain(int fd);
+
+/**
+ * @brief Drop every capture without freeing it, in a forked child whose fd
+ *        1 is the parent's capture pipe: its copies of the buffers are not
+ *        the parent's.
+ */
+void capture_forget(void);
+
+#endif /* VEGA_CAPTURE_H */
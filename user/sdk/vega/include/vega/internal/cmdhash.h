@@ -0,0 +1,28 @@
+/**
+ * @file vega/internal/cmdhash.h
+ * @brief vega command → resolved-path cache (bash's `hash`).
+ *
+ * Remembers where each bare command name was found in PATH so repeated
+ * commands skip the search and its stat() per directory. The whole table is
+ * dropped when PATH differs from the value it was filled under; a single
+ * entry is dropped when running its path fails with ENOENT. The table is
+ * fixed-size; once it is full, further names are looked up every time.
+ */
+
+#ifndef VEGA_CMDHASH_H
+#define VEGA_CMDHASH_H
+
+/**
+ * @brief Cached path of @p name, counting a hit.
+ * @return The path (owned by the table, valid until the next cmdhash_*
+ *         call), or NULL if @p name is not cached.
+ */
+const char *cmdhash_get(const char *name);
+
+/** @brief Remember that @p name resolves to @p path. Best effort. */
+void cmdhash_put(const char *name, const char *path);
+
+/** @brief Drop the entry of @p name, if any. */
+void cmdhash_forget(const char *name);
+
+#endif /* VEGA_CMDHASH_H */
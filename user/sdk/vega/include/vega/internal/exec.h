@@ -1,6 +1,6 @@
 /**
  * @file vega/internal/exec.h
- * @brief vega AST executor.
+ * @brief vega AST executor (compiles to bytecode, see bytecode.h).
  */
 
 #ifndef VEGA_EXEC_H
@@ -14,4 +14,16 @@
  */
 int vega_exec(ast_t *node);
 
+/**
+ * @brief True if `$(...)` may run @p node in the shell process under a
+ *        variable scope (expand_push_scope) instead of a forked child.
+ *
+ * Refused are trees that could change the shell some other way: function
+ * definitions, `cmd!`, builtins the host does not call pure, and command
+ * names computed at run time. Functions are judged by their bodies, which
+ * must pass too. External commands and pipelines are fine: they run in
+ * children anyway.
+ */
+int exec_capturable(const ast_t *node);
+
 #endif /* VEGA_EXEC_H */
@@ -16,6 +16,32 @@ void expand_set_status(int status);
  */
 const char *expand_getvar(const char *name);
 
+/**
+ * @brief Open a variable frame for a function call.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int expand_push_frame(void);
+
+/**
+ * @brief Bind @p name to @p value until the innermost frame is popped.
+ *
+ * The previous binding (global or an outer call's) is hidden meanwhile:
+ * reads and vega_setvar see the local one, as with bash's `local`.
+ *
+ * @return 0 on success, -1 with no frame open or on allocation failure.
+ */
+int expand_bind_local(const char *name, const char *value);
+
+/**
+ * @brief Open a frame that undoes every assignment made inside it, through
+ *        vega_setvar or in nested frames, when it is popped.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int expand_push_scope(void);
+
+/** @brief Drop the innermost frame, restoring the bindings it shadowed. */
+void expand_pop_frame(void);
+
 /**
  * @brief Expand $-syntax in @p src and return a new heap-allocated string.
  *        The caller takes ownership and must free.
@@ -4,32 +4,43 @@
  *
  * Stores registered functions keyed by name. Defining a function via the
  * `fn name(args) { body }` syntax routes through this module — it takes
- * ownership of the name, arg-names array and body AST. Redefining replaces
- * the previous body (the old AST is freed). The table is fixed-size for
- * simplicity; further entries are rejected.
+ * ownership of the arena holding the name, arg-names array and body AST.
+ * Redefining replaces the previous definition (its arena is destroyed once
+ * no call is running it). The table grows as needed and entries keep their
+ * address for the life of the shell.
  */
 
 #ifndef VEGA_FNTAB_H
 #define VEGA_FNTAB_H
 
+#include <vega/arena.h>
 #include <vega/ast.h>
 
+struct vega_prog;
+struct retired;
+
 typedef struct
 {
-  char  *name;
-  char **arg_names; /* may be NULL when n_args == 0 */
-  int    n_args;
-  ast_t *body; /* never NULL for an occupied entry */
+  vega_arena_t     *arena; /* owns name, arg_names and body */
+  char             *name;
+  char            **arg_names; /* may be NULL when n_args == 0 */
+  int               n_args;
+  ast_t            *body; /* never NULL for an occupied entry */
+  struct vega_prog *prog; /* body compiled on first call, else NULL */
+  int               running;
+  struct retired   *retired; /* replaced definitions still running */
 } fn_entry_t;
 
 /**
- * @brief Insert or replace a function. Takes ownership of @p name,
- * @p arg_names (and each string therein) and @p body.
+ * @brief Insert or replace a function. Takes ownership of @p arena, which
+ * holds @p name, @p arg_names (and each string therein) and @p body.
  *
- * @return 0 on success, -1 if the table is full or allocation failed; on
- *         failure the caller still owns the inputs.
+ * @return 0 on success, -1 if allocation failed; on failure the caller
+ *         still owns the arena.
  */
-int fntab_set(char *name, char **arg_names, int n_args, ast_t *body);
+int fntab_set(
+    vega_arena_t *arena, char *name, char **arg_names, int n_args, ast_t *body
+);
 
 /**
  * @brief Look up a function by name.
@@ -37,4 +48,29 @@ int fntab_set(char *name, char **arg_names, int n_args, ast_t *body);
  */
 const fn_entry_t *fntab_get(const char *name);
 
+/**
+ * @brief Counter bumped by every fntab_set. A name resolved while it held
+ *        some value resolves the same way as long as it still does.
+ */
+unsigned fntab_generation(void);
+
+/**
+ * @brief Bump the generation with no function changed, for a change in how
+ *        names resolve made elsewhere (a utility builtin switched on/off).
+ */
+void fntab_invalidate(void);
+
+/**
+ * @brief Compiled body of @p fn, compiling it on first use. Owned by the
+ *        entry and freed when the function is redefined.
+ * @return The program, or NULL on allocation failure.
+ */
+const struct vega_prog *fntab_program(const fn_entry_t *fn);
+
+/** @brief Note that a call of @p fn starts; its definition stays alive. */
+void fntab_enter(const fn_entry_t *fn);
+
+/** @brief Note that a call of @p fn returned. */
+void fntab_leave(const fn_entry_t *fn);
+
 #endif /* VEGA_FNTAB_H */
@@ -0,0 +1,43 @@
+/**
+ * @file vega/internal/jobs.h
+ * @brief Background jobs (`cmd &`), `par for` and the `wait` and `jobs`
+ *        utilities.
+ *
+ * A background job is a forked child running one and-or list; the job
+ * table remembers it under a small number (`%1`) until it is waited for or
+ * reported. `par for` forks a worker per word, keeping at most its worker
+ * count running. Any child reaped while waiting is recorded in the table,
+ * so one kind of wait never loses the status another is waiting for.
+ */
+
+#ifndef VEGA_JOBS_H
+#define VEGA_JOBS_H
+
+#include <sys/types.h>
+#include <vega/ast.h>
+
+/**
+ * @brief Start @p body as a background job reading an empty stdin, and
+ *        make it `$!`.
+ * @return 0, or 1 if the table is full or fork failed.
+ */
+int jobs_start(ast_t *body);
+
+/**
+ * @brief Run the `par for` AST_FOR @p node: each word's body runs in a
+ *        child with the loop variable bound there, never in the shell.
+ * @return The last word's body status, as for `for`; 1 if a word fails to
+ *         expand, the worker count is bad or a fork fails.
+ */
+int jobs_par_for(const ast_t *node);
+
+/** @brief Pid of the newest background job, 0 if none was started. */
+pid_t jobs_last_pid(void);
+
+/** @brief `wait [-n] [%job | pid]...` (utility builtin). */
+int jobs_wait_cmd(int argc, char *const argv[]);
+
+/** @brief `jobs`: list the jobs, dropping the finished ones. */
+int jobs_list_cmd(int argc, char *const argv[]);
+
+#endif /* VEGA_JOBS_H */
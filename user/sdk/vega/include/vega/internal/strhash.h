@@ -0,0 +1,18 @@
+/**
+ * @file vega/internal/strhash.h
+ * @brief String hash shared by vega's name-keyed tables.
+ */
+
+#ifndef VEGA_STRHASH_H
+#define VEGA_STRHASH_H
+
+/** @brief 32-bit FNV-1a of the NUL-terminated string @p s. */
+static inline unsigned strhash(const char *s)
+{
+  unsigned h = 2166136261u;
+  while(*s)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+#endif /* VEGA_STRHASH_H */
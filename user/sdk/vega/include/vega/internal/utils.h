@@ -0,0 +1,28 @@
+/**
+ * @file vega/internal/utils.h
+ * @brief Utility builtins: common coreutils run inside libvega.
+ *
+ * echo, printf, test / [, pwd, true, false, basename and dirname are run
+ * in the shell process instead of spawning a binary per call; so are wait
+ * and jobs, which only make sense there. A command name resolves to one
+ * after functions and host builtins and before PATH; vega_util_enable
+ * switches each one off so the binary runs instead.
+ */
+
+#ifndef VEGA_UTILS_H
+#define VEGA_UTILS_H
+
+typedef struct
+{
+  const char *name;
+  int (*run)(int argc, char *const argv[]);
+  int enabled;
+} util_t;
+
+/**
+ * @brief Utility builtin called @p name.
+ * @return The entry, or NULL if there is none or it is switched off.
+ */
+const util_t *util_lookup(const char *name);
+
+#endif /* VEGA_UTILS_H */
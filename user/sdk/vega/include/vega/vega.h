@@ -32,4 +32,70 @@ int vega_run(const char *line);
  */
 int vega_setvar(const char *name, const char *value);
 
+/**
+ * @brief Run the vega script file at @p path (a host's `source`).
+ *
+ * The compiled script is cached by path and kept while the file's inode,
+ * size and modification time are unchanged, so running it again skips
+ * reading and parsing.
+ *
+ * @return Exit status of the script's last command (0 if it parsed empty),
+ *         or -1 if @p path could not be read.
+ */
+int vega_source(const char *path);
+
+/** @brief Callback of vega_hash_each(): one remembered command. */
+typedef void (*vega_hash_fn_t)(
+    const char *name, const char *path, unsigned hits, void *ctx
+);
+
+/**
+ * @brief Look @p name up in PATH and remember where it was found, as if it
+ *        had just been run. Hosts use this for `hash <name>`.
+ *
+ * @return 0 on success, -1 if @p name is not found or contains a '/'.
+ */
+int vega_hash_add(const char *name);
+
+/** @brief Forget every remembered command path (`hash -r`). */
+void vega_hash_reset(void);
+
+/**
+ * @brief Have the kernel pre-load the commands named in @c VEGA_PRESPAWN
+ *        (colon-separated, looked up in PATH), so running them skips the
+ *        exec. Names not found are skipped.
+ *
+ * Without the variable a few small utilities (ls, cat, ...) are loaded.
+ * Hosts call this once, after setting PATH.
+ */
+void vega_spawn_warm(void);
+
+/** @brief Call @p fn for each remembered command, in no particular order. */
+void vega_hash_each(vega_hash_fn_t fn, void *ctx);
+
+/** @brief Callback of vega_util_each(): one utility builtin. */
+typedef void (*vega_util_fn_t)(const char *name, int enabled, void *ctx);
+
+/**
+ * @brief Switch the utility builtin @p name on or off (bash's `enable`).
+ *
+ * libvega runs echo, printf, test, [, pwd, true, false, basename,
+ * dirname, wait and jobs itself unless a function or host builtin has the
+ * name. All are on initially; while one is off, its name is looked up in
+ * PATH.
+ *
+ * @return 0 on success, -1 if @p name is not a utility builtin.
+ */
+int vega_util_enable(const char *name, int on);
+
+/** @brief Call @p fn for each utility builtin, in alphabetical order. */
+void vega_util_each(vega_util_fn_t fn, void *ctx);
+
+/**
+ * @brief Report background jobs (`cmd &`) that have finished, as `jobs`
+ *        does, and forget them. Interactive hosts call this before each
+ *        prompt.
+ */
+void vega_jobs_notify(void);
+
 #endif /* VEGA_H */
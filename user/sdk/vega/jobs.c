@@ -0,0 +1,416 @@
+/**
+ * @file sdk/vega/jobs.c
+ * @brief Background jobs, `par for`, `wait` and `jobs`.
+ *
+ * There is no job control: a job cannot be stopped or brought to the
+ * foreground, only waited for. Its stdin is an empty pipe (there is no
+ * /dev/null), so it never competes with the shell for keystrokes, and its
+ * stdout is the shell's. Children themselves start with an empty table:
+ * their `wait` must not try to reap their siblings.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vega/host.h>
+#include <vega/internal/bytecode.h>
+#include <vega/internal/capture.h>
+#include <vega/internal/exec.h>
+#include <vega/internal/expand.h>
+#include <vega/internal/jobs.h>
+#include <vega/vega.h>
+
+#define MAX_JOBS        32
+#define MAX_PAR_WORKERS 64
+#define NO_SUCH_JOB     127 /* status of waiting for what isn't a child */
+
+typedef struct
+{
+  int   id; /* %id; 0 marks a free slot */
+  pid_t pid;
+  int   done;
+  int   status;
+} job_t;
+
+static job_t g_jobs[MAX_JOBS];
+static pid_t g_last_pid;
+
+static void complain(const char *a, const char *b)
+{
+  (void)write(STDOUT_FILENO, "vega: ", 6);
+  (void)write(STDOUT_FILENO, a, strlen(a));
+  if(b)
+    (void)write(STDOUT_FILENO, b, strlen(b));
+  (void)write(STDOUT_FILENO, "\n", 1);
+}
+
+static int exit_status(int wstatus)
+{
+  return (wstatus >> 8) & 0xff;
+}
+
+static job_t *job_by_pid(pid_t pid)
+{
+  for(int i = 0; i < MAX_JOBS; i++) {
+    if(g_jobs[i].id && g_jobs[i].pid == pid)
+      return &g_jobs[i];
+  }
+  return NULL;
+}
+
+/* Record that @p j exited with @p status. */
+static void finished(job_t *j, int status)
+{
+  j->done   = 1;
+  j->status = status;
+}
+
+/* Wait for any child. A job among them is marked finished in the table.
+ * Returns its pid and sets *status, or -1 when there are no children. */
+static pid_t reap_any(int *status)
+{
+  int   wstatus = 0;
+  pid_t pid;
+  do {
+    pid = waitpid(-1, &wstatus, 0);
+  } while(pid < 0 && errno == EINTR);
+  if(pid < 0)
+    return -1;
+
+  *status  = exit_status(wstatus);
+  job_t *j = job_by_pid(pid);
+  if(j)
+    finished(j, *status);
+  return pid;
+}
+
+/* Block until @p j has finished. */
+static void wait_job(job_t *j)
+{
+  while(!j->done) {
+    int   wstatus = 0;
+    pid_t pid     = waitpid(j->pid, &wstatus, 0);
+    if(pid == j->pid)
+      finished(j, exit_status(wstatus));
+    else if(errno != EINTR)
+      finished(j, NO_SUCH_JOB);
+  }
+}
+
+/* Mark every job that has exited by now as finished, without blocking. */
+static void poll_jobs(void)
+{
+  for(int i = 0; i < MAX_JOBS; i++) {
+    job_t *j = &g_jobs[i];
+    if(!j->id || j->done)
+      continue;
+    int   wstatus = 0;
+    pid_t pid     = waitpid(j->pid, &wstatus, WNOHANG);
+    if(pid == j->pid)
+      finished(j, exit_status(wstatus));
+    else if(pid < 0 && errno == ECHILD)
+      finished(j, NO_SUCH_JOB);
+  }
+}
+
+/* In a child just forked: the jobs are its siblings now. */
+static void forget_jobs(void)
+{
+  memset(g_jobs, 0, sizeof(g_jobs));
+}
+
+/* One past the highest job number in use, as in sh: finished jobs free
+ * their numbers once reported. */
+static int next_id(void)
+{
+  int id = 0;
+  for(int i = 0; i < MAX_JOBS; i++) {
+    if(g_jobs[i].id > id)
+      id = g_jobs[i].id;
+  }
+  return id + 1;
+}
+
+/* "[id] pid state\n" for @p j into @p line. */
+static int format_job(const job_t *j, char *line, size_t size)
+{
+  if(!j->done)
+    return snprintf(line, size, "[%d] %d running\n", j->id, (int)j->pid);
+  if(j->status == 0)
+    return snprintf(line, size, "[%d] %d done\n", j->id, (int)j->pid);
+  return snprintf(
+      line, size, "[%d] %d exit %d\n", j->id, (int)j->pid, j->status
+  );
+}
+
+int jobs_start(ast_t *body)
+{
+  job_t *j = NULL;
+  for(int i = 0; i < MAX_JOBS && !j; i++) {
+    if(!g_jobs[i].id)
+      j = &g_jobs[i];
+  }
+  if(!j) {
+    complain("too many background jobs", NULL);
+    return 1;
+  }
+
+  int in[2];
+  if(pipe(in) < 0) {
+    complain("pipe failed", NULL);
+    return 1;
+  }
+  pid_t pid = fork();
+  if(pid < 0) {
+    close(in[0]);
+    close(in[1]);
+    complain("fork failed", NULL);
+    return 1;
+  }
+  if(pid == 0) {
+    dup2(in[0], STDIN_FILENO);
+    close(in[0]);
+    close(in[1]);
+    capture_forget();
+    forget_jobs();
+    _exit(vega_exec(body));
+  }
+  close(in[0]);
+  close(in[1]);
+
+  j->id      = next_id();
+  j->pid     = pid;
+  j->done    = 0;
+  j->status  = 0;
+  g_last_pid = pid;
+  return 0;
+}
+
+pid_t jobs_last_pid(void)
+{
+  return g_last_pid;
+}
+
+/* Worker count of the `par for` @p node, or -1 after a diagnostic. */
+static int par_workers(const ast_t *node)
+{
+  if(!node->u.for_.workers) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cpus < 1)
+      return 1;
+    return cpus > MAX_PAR_WORKERS ? MAX_PAR_WORKERS : (int)cpus;
+  }
+
+  char *text = expand_word(node->u.for_.workers);
+  if(!text)
+    return -1;
+  char *end;
+  long  n = strtol(text, &end, 10);
+  if(end == text || *end || n < 1) {
+    complain("par: bad worker count: ", text);
+    free(text);
+    return -1;
+  }
+  free(text);
+  return n > MAX_PAR_WORKERS ? MAX_PAR_WORKERS : (int)n;
+}
+
+typedef struct
+{
+  pid_t pids[MAX_PAR_WORKERS];
+  int   words[MAX_PAR_WORKERS]; /* index of the word each one runs */
+  int   running;
+  int   last_word;   /* highest word index collected so far */
+  int   last_status; /* its body's status */
+} workers_t;
+
+/* Wait for one of @p w's workers to exit. */
+static void collect(workers_t *w)
+{
+  while(w->running > 0) {
+    int   status;
+    pid_t pid = reap_any(&status);
+    if(pid < 0) {
+      w->running = 0; /* somebody else reaped them */
+      return;
+    }
+    for(int i = 0; i < w->running; i++) {
+      if(w->pids[i] != pid)
+        continue;
+      if(w->words[i] > w->last_word) {
+        w->last_word   = w->words[i];
+        w->last_status = status;
+      }
+      w->running--;
+      w->pids[i]  = w->pids[w->running];
+      w->words[i] = w->words[w->running];
+      return;
+    }
+  }
+}
+
+int jobs_par_for(const ast_t *node)
+{
+  int max = par_workers(node);
+  if(max < 0)
+    return 1;
+  /* Compiled once here, not once per worker. */
+  vega_prog_t *body = vega_compile(node->u.for_.body);
+  if(!body) {
+    complain("out of memory", NULL);
+    return 1;
+  }
+
+  workers_t w      = {.last_word = -1};
+  int       failed = 0;
+  for(int i = 0; i < node->u.for_.nwords; i++) {
+    char *word = expand_word(node->u.for_.words[i]);
+    if(!word) {
+      failed = 1;
+      break;
+    }
+    if(w.running == max)
+      collect(&w);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+      capture_forget();
+      forget_jobs();
+      vega_setvar(node->u.for_.name, word);
+      _exit(vega_exec_prog(body));
+    }
+    free(word);
+    if(pid < 0) {
+      complain("fork failed", NULL);
+      failed = 1;
+      break;
+    }
+    w.pids[w.running]  = pid;
+    w.words[w.running] = i;
+    w.running++;
+  }
+  while(w.running > 0)
+    collect(&w);
+
+  vega_prog_free(body);
+  return failed ? 1 : w.last_status;
+}
+
+/* Job named by @p arg, "%N" or a pid; NULL after a diagnostic. */
+static job_t *job_by_arg(const char *arg)
+{
+  const char *digits = arg[0] == '%' ? arg + 1 : arg;
+  char       *end;
+  long        n = strtol(digits, &end, 10);
+  if(end != digits && !*end && n > 0) {
+    for(int i = 0; i < MAX_JOBS; i++) {
+      job_t *j = &g_jobs[i];
+      if(j->id && (arg[0] == '%' ? j->id == n : j->pid == (pid_t)n))
+        return j;
+    }
+  }
+  complain("wait: no such job: ", arg);
+  return NULL;
+}
+
+/* `wait -n`: the first of @p set (all jobs if @p n is 0) to finish. */
+static int wait_next(job_t **set, int n)
+{
+  while(1) {
+    int live = 0;
+    for(int i = 0; i < MAX_JOBS; i++) {
+      job_t *j  = &g_jobs[i];
+      int    in = n == 0 && j->id;
+      for(int k = 0; k < n && !in; k++)
+        in = set[k] == j;
+      if(!in)
+        continue;
+      if(j->done) {
+        int status = j->status;
+        j->id      = 0;
+        return status;
+      }
+      live++;
+    }
+    int status;
+    if(live == 0 || reap_any(&status) < 0)
+      return NO_SUCH_JOB;
+  }
+}
+
+int jobs_wait_cmd(int argc, char *const argv[])
+{
+  int next  = argc > 1 && strcmp(argv[1], "-n") == 0;
+  int first = 1 + next;
+
+  job_t *set[MAX_JOBS];
+  int    n = 0, status = 0;
+  for(int i = first; i < argc; i++) {
+    job_t *j = job_by_arg(argv[i]);
+    if(!j) {
+      status = NO_SUCH_JOB;
+      continue;
+    }
+    if(n < MAX_JOBS)
+      set[n++] = j;
+  }
+  if(next)
+    return (n == 0 && argc > first) ? status : wait_next(set, n);
+
+  if(argc == first) {
+    /* Plain `wait` waits for everything and succeeds. */
+    for(int i = 0; i < MAX_JOBS; i++) {
+      if(g_jobs[i].id) {
+        wait_job(&g_jobs[i]);
+        g_jobs[i].id = 0;
+      }
+    }
+    return 0;
+  }
+  for(int i = 0; i < n; i++) {
+    /* A job listed twice has already been dropped. */
+    if(!set[i]->id)
+      continue;
+    wait_job(set[i]);
+    status     = set[i]->status;
+    set[i]->id = 0;
+  }
+  return status;
+}
+
+int jobs_list_cmd(int argc, char *const argv[])
+{
+  (void)argc;
+  (void)argv;
+  poll_jobs();
+  char line[64];
+  for(int i = 0; i < MAX_JOBS; i++) {
+    job_t *j = &g_jobs[i];
+    if(!j->id)
+      continue;
+    int len = format_job(j, line, sizeof(line));
+    if(len > 0)
+      (void)vega_stdout_write(line, (size_t)len);
+    if(j->done)
+      j->id = 0;
+  }
+  return 0;
+}
+
+void vega_jobs_notify(void)
+{
+  poll_jobs();
+  char line[64];
+  for(int i = 0; i < MAX_JOBS; i++) {
+    job_t *j = &g_jobs[i];
+    if(!j->id || !j->done)
+      continue;
+    int len = format_job(j, line, sizeof(line));
+    if(len > 0)
+      (void)write(STDOUT_FILENO, line, (size_t)len);
+    j->id = 0;
+  }
+}
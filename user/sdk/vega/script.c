@@ -0,0 +1,166 @@
+/**
+ * @file sdk/vega/script.c
+ * @brief Running script files, with compiled programs cached per path.
+ *
+ * A cached program owns its tree and is run again as long as the file's
+ * inode, size and modification time still match, so re-sourcing an rc file
+ * skips reading, lexing, parsing and compiling. Entries that are running
+ * (a script sourcing itself, or one that sources others) are never evicted;
+ * if no entry is free the script runs uncached.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vega/arena.h>
+#include <vega/internal/bytecode.h>
+#include <vega/parse.h>
+#include <vega/vega.h>
+
+#define SCRIPT_CACHE_SLOTS 8
+
+typedef struct
+{
+  char           *path; /* NULL: free slot */
+  ino_t           ino;
+  off_t           size;
+  struct timespec mtime;
+  vega_prog_t    *prog;
+  unsigned        last_use;
+  int             running;
+} script_t;
+
+static script_t g_cache[SCRIPT_CACHE_SLOTS];
+static unsigned g_clock = 0;
+
+static int same_file(const script_t *s, const struct stat *st)
+{
+  return s->ino == st->st_ino && s->size == st->st_size &&
+         s->mtime.tv_sec == st->st_mtim.tv_sec &&
+         s->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Read all of @p path into a NUL-terminated heap string. */
+static char *read_file(const char *path, off_t size)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return NULL;
+  char *buf = (char *)malloc((size_t)size + 1);
+  if(!buf) {
+    close(fd);
+    return NULL;
+  }
+  size_t len = 0;
+  while(len < (size_t)size) {
+    long n = read(fd, buf + len, (size_t)size - len);
+    if(n <= 0)
+      break;
+    len += (size_t)n;
+  }
+  close(fd);
+  buf[len] = '\0';
+  return buf;
+}
+
+/* Parse and compile the script; the program owns the tree. NULL if the file
+ * could not be read; *empty is set when it parsed to nothing (or failed to
+ * parse, which vega_parse has already reported). */
+static vega_prog_t *load(const char *path, const struct stat *st, int *empty)
+{
+  char *text = read_file(path, st->st_size);
+  if(!text)
+    return NULL;
+  vega_arena_t *arena = arena_create();
+  if(!arena) {
+    free(text);
+    return NULL;
+  }
+  vega_arena_t *prev = arena_use(arena);
+  ast_t        *ast  = vega_parse(text);
+  arena_use(prev);
+  free(text);
+
+  vega_prog_t *p = ast ? vega_compile(ast) : NULL;
+  if(!p) {
+    *empty = !ast;
+    arena_destroy(arena);
+    return NULL;
+  }
+  p->arena = arena;
+  return p;
+}
+
+static void drop(script_t *s)
+{
+  free(s->path);
+  vega_prog_free(s->prog);
+  s->path = NULL;
+  s->prog = NULL;
+}
+
+/* Slot to (re)fill for @p path: its own entry if idle, else a free or
+ * least recently used idle one. NULL if every candidate is running. */
+static script_t *pick_slot(const char *path)
+{
+  script_t *victim = NULL;
+  for(int i = 0; i < SCRIPT_CACHE_SLOTS; i++) {
+    script_t *s = &g_cache[i];
+    if(s->path && strcmp(s->path, path) == 0)
+      return s->running ? NULL : s;
+  }
+  for(int i = 0; i < SCRIPT_CACHE_SLOTS; i++) {
+    script_t *s = &g_cache[i];
+    if(s->running)
+      continue;
+    if(!s->path)
+      return s;
+    if(!victim || s->last_use < victim->last_use)
+      victim = s;
+  }
+  return victim;
+}
+
+static int run_cached(script_t *s)
+{
+  s->last_use = ++g_clock;
+  s->running++;
+  int status = vega_exec_prog(s->prog);
+  s->running--;
+  return status;
+}
+
+int vega_source(const char *path)
+{
+  struct stat st;
+  if(!path || stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+    return -1;
+
+  for(int i = 0; i < SCRIPT_CACHE_SLOTS; i++) {
+    script_t *s = &g_cache[i];
+    if(s->path && strcmp(s->path, path) == 0 && same_file(s, &st))
+      return run_cached(s);
+  }
+
+  int          empty = 0;
+  vega_prog_t *p     = load(path, &st, &empty);
+  if(!p)
+    return empty ? 0 : -1;
+
+  script_t *s    = pick_slot(path);
+  char     *name = s ? strdup(path) : NULL;
+  if(!name) {
+    int status = vega_exec_prog(p);
+    vega_prog_free(p);
+    return status;
+  }
+  drop(s);
+  s->path  = name;
+  s->ino   = st.st_ino;
+  s->size  = st.st_size;
+  s->mtime = st.st_mtim;
+  s->prog  = p;
+  return run_cached(s);
+}
@@ -0,0 +1,573 @@
+/**
+ * @file sdk/vega/utils.c
+ * @brief Utility builtins: echo, printf, test / [, pwd, true, false,
+ *        basename and dirname.
+ *
+ * Each one would otherwise cost a spawn and the load of a static binary per
+ * call, which dominates scripts that call them in loops. echo and pwd
+ * behave exactly like user/bin/echo.c and user/bin/pwd.c (echo follows
+ * every word with a space); the others follow POSIX. Output is collected
+ * and written with one vega_stdout_write, so an in-process `$(...)`
+ * captures it; diagnostics go straight to fd 1 like the rest of libvega's.
+ * wait and jobs (jobs.c) share the table, being shell state that no binary
+ * could reach.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vega/host.h>
+#include <vega/internal/fntab.h>
+#include <vega/internal/jobs.h>
+#include <vega/internal/utils.h>
+#include <vega/vega.h>
+
+#define CWD_MAX 256 /* as in user/bin/pwd.c */
+
+/* Output of one call, grown as needed and written at the end. */
+typedef struct
+{
+  char  *data;
+  size_t len;
+  size_t cap;
+  int    failed;
+} out_t;
+
+static void put(out_t *o, const char *s, size_t n)
+{
+  if(o->failed || n == 0)
+    return;
+  if(o->len + n > o->cap) {
+    size_t cap = o->cap ? o->cap : 128;
+    while(cap < o->len + n)
+      cap *= 2;
+    char *data = (char *)realloc(o->data, cap);
+    if(!data) {
+      o->failed = 1;
+      return;
+    }
+    o->data = data;
+    o->cap  = cap;
+  }
+  memcpy(o->data + o->len, s, n);
+  o->len += n;
+}
+
+static void put_str(out_t *o, const char *s)
+{
+  put(o, s, strlen(s));
+}
+
+/* Append printf(@p spec, ...), a single conversion. */
+static void put_fmt(out_t *o, const char *spec, ...)
+{
+  char    small[128];
+  va_list ap;
+  va_start(ap, spec);
+  int n = vsnprintf(small, sizeof(small), spec, ap);
+  va_end(ap);
+  if(n < 0)
+    return;
+  if((size_t)n < sizeof(small)) {
+    put(o, small, (size_t)n);
+    return;
+  }
+
+  char *big = (char *)malloc((size_t)n + 1);
+  if(!big) {
+    o->failed = 1;
+    return;
+  }
+  va_start(ap, spec);
+  vsnprintf(big, (size_t)n + 1, spec, ap);
+  va_end(ap);
+  put(o, big, (size_t)n);
+  free(big);
+}
+
+/* Write out @p o and release it. Returns @p status, or 1 if the output
+ * could not be built or written. */
+static int flush(out_t *o, int status)
+{
+  if(o->failed)
+    status = 1;
+  else if(o->len && vega_stdout_write(o->data, o->len) < 0)
+    status = 1;
+  free(o->data);
+  return status;
+}
+
+/* "util: msg[ arg]" on fd 1. */
+static void complain(const char *util, const char *msg, const char *arg)
+{
+  (void)write(STDOUT_FILENO, util, strlen(util));
+  (void)write(STDOUT_FILENO, ": ", 2);
+  (void)write(STDOUT_FILENO, msg, strlen(msg));
+  if(arg) {
+    (void)write(STDOUT_FILENO, " ", 1);
+    (void)write(STDOUT_FILENO, arg, strlen(arg));
+  }
+  (void)write(STDOUT_FILENO, "\n", 1);
+}
+
+static int util_true(int argc, char *const argv[])
+{
+  (void)argc;
+  (void)argv;
+  return 0;
+}
+
+static int util_false(int argc, char *const argv[])
+{
+  (void)argc;
+  (void)argv;
+  return 1;
+}
+
+static int util_echo(int argc, char *const argv[])
+{
+  out_t o = {0};
+  for(int i = 1; i < argc; i++) {
+    put_str(&o, argv[i]);
+    put(&o, " ", 1);
+  }
+  put(&o, "\n", 1);
+  return flush(&o, 0);
+}
+
+static int util_pwd(int argc, char *const argv[])
+{
+  (void)argc;
+  (void)argv;
+  char  cwd[CWD_MAX];
+  out_t o = {0};
+  if(getcwd(cwd, sizeof(cwd)) != NULL) {
+    put_str(&o, cwd);
+    put(&o, "\n", 1);
+  }
+  return flush(&o, 0);
+}
+
+/* Length of @p s without its trailing slashes, keeping one if that is all
+ * there is. */
+static size_t trim_slashes(const char *s, size_t len)
+{
+  while(len > 1 && s[len - 1] == '/')
+    len--;
+  return len;
+}
+
+static int util_basename(int argc, char *const argv[])
+{
+  if(argc < 2 || argc > 3) {
+    complain("basename", "usage: basename string [suffix]", NULL);
+    return 1;
+  }
+  const char *s   = argv[1];
+  size_t      len = trim_slashes(s, strlen(s));
+  size_t      at  = len;
+  while(at > 0 && s[at - 1] != '/')
+    at--;
+  if(len > 1 || s[0] != '/') {
+    s += at;
+    len -= at;
+  }
+
+  if(argc == 3) {
+    size_t n = strlen(argv[2]);
+    if(n < len && memcmp(s + len - n, argv[2], n) == 0)
+      len -= n;
+  }
+  out_t o = {0};
+  put(&o, s, len);
+  put(&o, "\n", 1);
+  return flush(&o, 0);
+}
+
+static int util_dirname(int argc, char *const argv[])
+{
+  if(argc != 2) {
+    complain("dirname", "usage: dirname string", NULL);
+    return 1;
+  }
+  const char *s   = argv[1];
+  size_t      len = trim_slashes(s, strlen(s));
+  while(len > 0 && s[len - 1] != '/')
+    len--;
+  if(len == 0) {
+    s   = ".";
+    len = 1;
+  } else {
+    len = trim_slashes(s, len);
+  }
+  out_t o = {0};
+  put(&o, s, len);
+  put(&o, "\n", 1);
+  return flush(&o, 0);
+}
+
+/* ---- printf ---- */
+
+/* Append the escape whose letter starts @p p (just past the backslash) and
+ * return where the text resumes. */
+static const char *put_escape(out_t *o, const char *p)
+{
+  static const char from[] = "\\abfnrtv\"";
+  static const char to[]   = "\\\a\b\f\n\r\t\v\"";
+
+  const char *e = *p ? strchr(from, *p) : NULL;
+  if(e) {
+    put(o, &to[e - from], 1);
+    return p + 1;
+  }
+  if(*p >= '0' && *p <= '7') {
+    int v = 0;
+    for(int i = 0; i < 3 && *p >= '0' && *p <= '7'; i++)
+      v = v * 8 + (*p++ - '0');
+    char c = (char)v;
+    put(o, &c, 1);
+    return p;
+  }
+  put(o, "\\", 1);
+  return p;
+}
+
+/* Numeric value of a printf argument: a number in C syntax, or the code of
+ * the character after a leading quote. Missing arguments are 0. */
+static long printf_number(const char *arg, int *status)
+{
+  if(!arg || !*arg)
+    return 0;
+  if(arg[0] == '\'' || arg[0] == '"')
+    return (unsigned char)arg[1];
+  char *end;
+  long  v = strtol(arg, &end, 0);
+  if(*end) {
+    complain("printf", "invalid number:", arg);
+    *status = 1;
+  }
+  return v;
+}
+
+/* The format is reused while arguments remain and it consumes some, and
+ * missing arguments read as "" or 0, as POSIX has it. */
+static int util_printf(int argc, char *const argv[])
+{
+  if(argc < 2) {
+    complain("printf", "usage: printf format [argument...]", NULL);
+    return 1;
+  }
+  const char *fmt    = argv[1];
+  int         ai     = 2;
+  int         status = 0;
+  out_t       o      = {0};
+
+  for(;;) {
+    int first = ai;
+    for(const char *p = fmt; *p;) {
+      if(*p == '\\') {
+        p = put_escape(&o, p + 1);
+        continue;
+      }
+      if(*p != '%') {
+        put(&o, p++, 1);
+        continue;
+      }
+      if(p[1] == '%') {
+        put(&o, "%", 1);
+        p += 2;
+        continue;
+      }
+
+      /* Copy "%[flags][width][.precision]" and add the length we pass. */
+      char   spec[32];
+      size_t n  = 0;
+      spec[n++] = *p++;
+      while(*p && strchr("-+ #0", *p) && n < 8)
+        spec[n++] = *p++;
+      while(*p >= '0' && *p <= '9' && n < 16)
+        spec[n++] = *p++;
+      if(*p == '.') {
+        spec[n++] = *p++;
+        while(*p >= '0' && *p <= '9' && n < 24)
+          spec[n++] = *p++;
+      }
+      char        conv = *p ? *p++ : '\0';
+      const char *arg  = ai < argc ? argv[ai++] : NULL;
+
+      switch(conv) {
+      case 's':
+      case 'c': {
+        char one[2] = {arg ? arg[0] : '\0', '\0'};
+        spec[n++]   = 's';
+        spec[n]     = '\0';
+        put_fmt(&o, spec, conv == 'c' ? one : (arg ? arg : ""));
+        break;
+      }
+      case 'd':
+      case 'i':
+        spec[n++] = 'l';
+        spec[n++] = 'd';
+        spec[n]   = '\0';
+        put_fmt(&o, spec, printf_number(arg, &status));
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        spec[n++] = 'l';
+        spec[n++] = conv;
+        spec[n]   = '\0';
+        put_fmt(&o, spec, (unsigned long)printf_number(arg, &status));
+        break;
+      default: {
+        char bad[3] = {'%', conv, '\0'};
+        complain("printf", "invalid directive", bad);
+        return flush(&o, 1);
+      }
+      }
+    }
+    if(ai >= argc || ai == first)
+      break;
+  }
+  return flush(&o, status);
+}
+
+/* ---- test / [ ---- */
+
+typedef struct
+{
+  char *const *argv;
+  int          n;
+  int          pos;
+  const char  *err; /* first syntax error, or NULL */
+  const char  *bad; /* argument it is about */
+} test_t;
+
+static int is_binop(const char *s)
+{
+  static const char *const ops[] = {
+      "=", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL,
+  };
+  for(int i = 0; ops[i]; i++) {
+    if(strcmp(s, ops[i]) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+static int is_unop(const char *s)
+{
+  return s[0] == '-' && s[1] && !s[2] && strchr("nzefdsrwxhL", s[1]);
+}
+
+static void test_error(test_t *t, const char *err, const char *bad)
+{
+  if(!t->err) {
+    t->err = err;
+    t->bad = bad;
+  }
+}
+
+static long test_number(test_t *t, const char *s)
+{
+  char *end;
+  long  v = strtol(s, &end, 10);
+  if(!*s || *end)
+    test_error(t, "integer expression expected:", s);
+  return v;
+}
+
+static int test_unary(char op, const char *s)
+{
+  struct stat st;
+  switch(op) {
+  case 'n':
+    return s[0] != '\0';
+  case 'z':
+    return s[0] == '\0';
+  case 'r':
+    return access(s, R_OK) == 0;
+  case 'w':
+    return access(s, W_OK) == 0;
+  case 'x':
+    return access(s, X_OK) == 0;
+  case 'h':
+  case 'L':
+    return lstat(s, &st) == 0 && S_ISLNK(st.st_mode);
+  default:
+    break;
+  }
+  if(stat(s, &st) < 0)
+    return 0;
+  if(op == 'f')
+    return S_ISREG(st.st_mode);
+  if(op == 'd')
+    return S_ISDIR(st.st_mode);
+  if(op == 's')
+    return st.st_size > 0;
+  return 1; /* -e */
+}
+
+static int test_binary(test_t *t, const char *a, const char *op, const char *b)
+{
+  if(strcmp(op, "=") == 0)
+    return strcmp(a, b) == 0;
+  if(strcmp(op, "!=") == 0)
+    return strcmp(a, b) != 0;
+
+  long x = test_number(t, a);
+  long y = test_number(t, b);
+  switch(op[1] << 8 | op[2]) {
+  case 'e' << 8 | 'q':
+    return x == y;
+  case 'n' << 8 | 'e':
+    return x != y;
+  case 'l' << 8 | 't':
+    return x < y;
+  case 'l' << 8 | 'e':
+    return x <= y;
+  case 'g' << 8 | 't':
+    return x > y;
+  default:
+    return x >= y;
+  }
+}
+
+static int test_or(test_t *t);
+
+/* primary: "(" or ")" | string binop string | unop string | string. A
+ * binary operator in second place wins, so `[ -n = x ]` compares. */
+static int test_primary(test_t *t)
+{
+  if(t->pos >= t->n) {
+    test_error(t, "argument expected", NULL);
+    return 0;
+  }
+  const char *a = t->argv[t->pos++];
+  if(t->pos + 1 < t->n && is_binop(t->argv[t->pos])) {
+    const char *op = t->argv[t->pos++];
+    return test_binary(t, a, op, t->argv[t->pos++]);
+  }
+  if(strcmp(a, "(") == 0 && t->pos < t->n) {
+    int r = test_or(t);
+    if(t->pos >= t->n || strcmp(t->argv[t->pos], ")") != 0)
+      test_error(t, "')' expected", NULL);
+    else
+      t->pos++;
+    return r;
+  }
+  if(is_unop(a) && t->pos < t->n)
+    return test_unary(a[1], t->argv[t->pos++]);
+  return a[0] != '\0';
+}
+
+static int test_not(test_t *t)
+{
+  if(t->pos + 1 < t->n && strcmp(t->argv[t->pos], "!") == 0) {
+    t->pos++;
+    return !test_not(t);
+  }
+  return test_primary(t);
+}
+
+static int test_and(test_t *t)
+{
+  int r = test_not(t);
+  while(!t->err && t->pos < t->n && strcmp(t->argv[t->pos], "-a") == 0) {
+    t->pos++;
+    r = test_not(t) && r;
+  }
+  return r;
+}
+
+static int test_or(test_t *t)
+{
+  int r = test_and(t);
+  while(!t->err && t->pos < t->n && strcmp(t->argv[t->pos], "-o") == 0) {
+    t->pos++;
+    r = test_and(t) || r;
+  }
+  return r;
+}
+
+/* 0 if the expression in @p argv[0..n) holds, 1 if not, 2 on error. */
+static int test_eval(const char *util, char *const argv[], int n)
+{
+  if(n == 0)
+    return 1;
+  test_t t = {argv, n, 0, NULL, NULL};
+  int    r = test_or(&t);
+  if(!t.err && t.pos < t.n)
+    test_error(&t, "unexpected argument", t.argv[t.pos]);
+  if(t.err) {
+    complain(util, t.err, t.bad);
+    return 2;
+  }
+  return r ? 0 : 1;
+}
+
+static int util_test(int argc, char *const argv[])
+{
+  return test_eval("test", argv + 1, argc - 1);
+}
+
+static int util_bracket(int argc, char *const argv[])
+{
+  if(argc < 2 || strcmp(argv[argc - 1], "]") != 0) {
+    complain("[", "missing ]", NULL);
+    return 2;
+  }
+  return test_eval("[", argv + 1, argc - 2);
+}
+
+static util_t g_utils[] = {
+    {"[", util_bracket, 1},
+    {"basename", util_basename, 1},
+    {"dirname", util_dirname, 1},
+    {"echo", util_echo, 1},
+    {"false", util_false, 1},
+    {"jobs", jobs_list_cmd, 1},
+    {"printf", util_printf, 1},
+    {"pwd", util_pwd, 1},
+    {"test", util_test, 1},
+    {"true", util_true, 1},
+    {"wait", jobs_wait_cmd, 1},
+    {NULL, NULL, 0},
+};
+
+static util_t *find(const char *name)
+{
+  for(util_t *u = g_utils; u->name; u++) {
+    if(strcmp(u->name, name) == 0)
+      return u;
+  }
+  return NULL;
+}
+
+const util_t *util_lookup(const char *name)
+{
+  const util_t *u = find(name);
+  return u && u->enabled ? u : NULL;
+}
+
+int vega_util_enable(const char *name, int on)
+{
+  util_t *u = find(name);
+  if(!u)
+    return -1;
+  if(u->enabled != !!on) {
+    u->enabled = !!on;
+    fntab_invalidate(); /* commands cached as resolving to it or past it */
+  }
+  return 0;
+}
+
+void vega_util_each(vega_util_fn_t fn, void *ctx)
+{
+  for(const util_t *u = g_utils; u->name; u++)
+    fn(u->name, u->enabled, ctx);
+}
@@ -1,8 +1,12 @@
 /**
  * @file sdk/vega/vega.c
  * @brief vega top-level: host registration + lex → parse → execute → free.
+ *
+ * Each statement is parsed into an arena of its own (see vega/arena.h) so
+ * its tokens and nodes go away in one step once it has run.
  */
 
+#include <vega/arena.h>
 #include <vega/ast.h>
 #include <vega/host.h>
 #include <vega/internal/exec.h>
@@ -19,10 +23,14 @@ void                   vega_init(const vega_host_ops_t *ops)
 
 int vega_run(const char *line)
 {
-  ast_t *ast = vega_parse(line);
-  if(!ast)
-    return 0;
-  int status = vega_exec(ast);
-  ast_free(ast);
+  vega_arena_t *arena = arena_create();
+  if(!arena)
+    return 1;
+  vega_arena_t *prev = arena_use(arena);
+  ast_t        *ast  = vega_parse(line);
+  arena_use(prev);
+
+  int status = ast ? vega_exec(ast) : 0;
+  arena_destroy(arena);
   return status;
 }